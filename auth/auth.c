@@ -261,7 +261,7 @@ S_auth_makeauth (struct authhandle *auth,
 /* A pending user.  */
 struct pending_user
   {
-    hurd_ihash_locp_t locp;	/* Position in the pending_users ihash table.  */
+    hurd_ihash_locp_t locp;	/* Position in the users ihash table.  */
     pthread_cond_t wakeup;	/* The reader is blocked on this condition.  */
 
     /* The user's auth handle.  */
@@ -274,16 +274,43 @@ struct pending_user
 /* A pending server.  */
 struct pending_server
   {
-    hurd_ihash_locp_t locp;	/* Position in the pending_servers ihash table.  */
+    hurd_ihash_locp_t locp;	/* Position in the servers ihash table.  */
     pthread_cond_t wakeup;	/* The server is blocked on this condition.  */
   };
 
-/* Table of pending transactions keyed on RENDEZVOUS.  */
-struct hurd_ihash pending_users
-  = HURD_IHASH_INITIALIZER (offsetof (struct pending_user, locp));
-struct hurd_ihash pending_servers
-  = HURD_IHASH_INITIALIZER (offsetof (struct pending_server, locp));
-pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Number of shards of the table of pending transactions; a power of
+   two.  Each exec and many opens reauthenticate, so unrelated
+   transactions should not wait for one another's lock.  */
+#define PENDING_SHARDS	16
+
+/* Tables of pending transactions keyed on RENDEZVOUS, and the lock
+   both halves of a transaction wait under.  */
+struct pending_shard
+  {
+    pthread_mutex_t lock;
+    struct hurd_ihash users;
+    struct hurd_ihash servers;
+  } __attribute__ ((aligned (64)));
+
+static struct pending_shard pending[PENDING_SHARDS] =
+  {
+    [0 ... PENDING_SHARDS - 1] =
+      {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.users = HURD_IHASH_INITIALIZER (offsetof (struct pending_user, locp)),
+	.servers
+	  = HURD_IHASH_INITIALIZER (offsetof (struct pending_server, locp)),
+      }
+  };
+
+/* Both halves of a transaction receive RENDEZVOUS as the same name, so
+   they meet in the same shard.  The low bits of a name are a generation
+   count; pick the shard by the index.  */
+static inline struct pending_shard *
+pending_shard (mach_port_t rendezvous)
+{
+  return &pending[MACH_PORT_INDEX (rendezvous) & (PENDING_SHARDS - 1)];
+}
 
 /* Implement auth_user_authenticate as described in <hurd/auth.defs>. */
 kern_return_t
@@ -294,6 +321,7 @@ S_auth_user_authenticate (struct authhandle *userauth,
 			  mach_port_t *newport,
 			  mach_msg_type_name_t *newporttype)
 {
+  struct pending_shard *shard;
   struct pending_server *s;
   struct pending_user u;
   error_t err;
@@ -307,11 +335,12 @@ S_auth_user_authenticate (struct authhandle *userauth,
   u.user = userauth;
   pthread_cond_init (&u.wakeup, NULL);
 
-  pthread_mutex_lock (&pending_lock);
+  shard = pending_shard (rendezvous);
+  pthread_mutex_lock (&shard->lock);
 
-  err = hurd_ihash_add (&pending_users, rendezvous, &u);
+  err = hurd_ihash_add (&shard->users, rendezvous, &u);
   if (err) {
-    pthread_mutex_unlock (&pending_lock);
+    pthread_mutex_unlock (&shard->lock);
     return err;
   }
 
@@ -320,12 +349,12 @@ S_auth_user_authenticate (struct authhandle *userauth,
   ports_port_ref (userauth);
 
   /* Look for this rendezvous in the server list.  */
-  s = hurd_ihash_find (&pending_servers, rendezvous);
+  s = hurd_ihash_find (&shard->servers, rendezvous);
   if (s) {
     /* Found it!  */
 
     /* Remove it from the pending list.  */
-    hurd_ihash_locp_remove (&pending_servers, s->locp);
+    hurd_ihash_locp_remove (&shard->servers, s->locp);
 
     /* Tell it we eventually arrived.  */
     pthread_cond_signal (&s->wakeup);
@@ -333,11 +362,11 @@ S_auth_user_authenticate (struct authhandle *userauth,
 
   ports_interrupt_self_on_port_death (userauth, rendezvous);
   /* Wait for server answer.  */
-  if (pthread_hurd_cond_wait_np (&u.wakeup, &pending_lock) &&
-      hurd_ihash_find (&pending_users, rendezvous))
+  if (pthread_hurd_cond_wait_np (&u.wakeup, &shard->lock) &&
+      hurd_ihash_find (&shard->users, rendezvous))
     /* We were interrupted; remove our record.  */
     {
-      hurd_ihash_locp_remove (&pending_users, u.locp);
+      hurd_ihash_locp_remove (&shard->users, u.locp);
 
       /* Was it a normal interruption or did RENDEZVOUS die?  */
       mach_port_type_t type;
@@ -345,7 +374,7 @@ S_auth_user_authenticate (struct authhandle *userauth,
       err = type & MACH_PORT_TYPE_DEAD_NAME ? EINVAL : EINTR;
     }
 
-  pthread_mutex_unlock (&pending_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   if (! err)
     {
@@ -375,6 +404,7 @@ S_auth_server_authenticate (struct authhandle *serverauth,
 			    uid_t **agids,
 			    mach_msg_type_number_t *nagids)
 {
+  struct pending_shard *shard;
   struct pending_user *u;
   struct authhandle *user;
   error_t err = 0;
@@ -385,24 +415,25 @@ S_auth_server_authenticate (struct authhandle *serverauth,
   if (! MACH_PORT_VALID (rendezvous))
     return EINVAL;
 
-  pthread_mutex_lock (&pending_lock);
+  shard = pending_shard (rendezvous);
+  pthread_mutex_lock (&shard->lock);
 
   /* Look for this rendezvous in the user list.  */
-  u = hurd_ihash_find (&pending_users, rendezvous);
+  u = hurd_ihash_find (&shard->users, rendezvous);
   if (! u)
     {
       /* User not here yet, have to wait for it.  */
       struct pending_server s;
       pthread_cond_init (&s.wakeup, NULL);
-      err = hurd_ihash_add (&pending_servers, rendezvous, &s);
+      err = hurd_ihash_add (&shard->servers, rendezvous, &s);
       if (! err)
         {
 	  ports_interrupt_self_on_port_death (serverauth, rendezvous);
-	  if (pthread_hurd_cond_wait_np (&s.wakeup, &pending_lock) &&
-	      hurd_ihash_find (&pending_servers, rendezvous))
+	  if (pthread_hurd_cond_wait_np (&s.wakeup, &shard->lock) &&
+	      hurd_ihash_find (&shard->servers, rendezvous))
 	    /* We were interrupted; remove our record.  */
 	    {
-	      hurd_ihash_locp_remove (&pending_servers, s.locp);
+	      hurd_ihash_locp_remove (&shard->servers, s.locp);
 
 	      /* Was it a normal interruption or did RENDEZVOUS die?  */
 	      mach_port_type_t type;
@@ -411,7 +442,7 @@ S_auth_server_authenticate (struct authhandle *serverauth,
 	    }
 	  else
 	    {
-	      u = hurd_ihash_find (&pending_users, rendezvous);
+	      u = hurd_ihash_find (&shard->users, rendezvous);
 	      if (! u)
 		/* User still not here, odd! */
 		err = EINTR;
@@ -424,12 +455,12 @@ S_auth_server_authenticate (struct authhandle *serverauth,
       error_t err2;
 
       /* Remove it from the pending list.  */
-      hurd_ihash_locp_remove (&pending_users, u->locp);
+      hurd_ihash_locp_remove (&shard->users, u->locp);
 
       /* Found it!  */
       user = u->user;
 
-      pthread_mutex_unlock (&pending_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       /* Tell third party.  */
       err2 = auth_server_authenticate_reply (reply, reply_type, 0,
@@ -441,7 +472,7 @@ S_auth_server_authenticate (struct authhandle *serverauth,
       if (err2)
         mach_port_deallocate (mach_task_self (), reply);
 
-      pthread_mutex_lock (&pending_lock);
+      pthread_mutex_lock (&shard->lock);
 
       /* Give the user the new port and wake the RPC up.  */
       u->passthrough = newport;
@@ -449,7 +480,7 @@ S_auth_server_authenticate (struct authhandle *serverauth,
       pthread_cond_signal (&u->wakeup);
     }
 
-  pthread_mutex_unlock (&pending_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   if (err)
     return err;
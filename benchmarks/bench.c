@@ -0,0 +1,71 @@
+/* Common code for the microbenchmarks.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+
+static const char *label = "";
+
+static const struct argp_option options[] =
+{
+  {"label",	'L', "LABEL",	0, "Name the configuration measured, e.g."
+				   " the kernel build"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'L': label = arg; break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+const struct argp bench_argp = { options, parse_opt };
+
+double
+bench_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void
+bench_report (const char *bench, const char *test, int threads,
+	      size_t ops, double ns, size_t bytes)
+{
+  double secs = ns / 1e9;
+
+  printf ("{\"bench\": \"%s\", \"test\": \"%s\", \"label\": \"%s\", "
+	  "\"threads\": %d, \"ops\": %zu, \"seconds\": %.6f, "
+	  "\"ops_per_sec\": %.1f",
+	  bench, test, label, threads, ops, secs, secs > 0 ? ops / secs : 0);
+  if (bytes)
+    printf (", \"mb_per_sec\": %.2f",
+	    secs > 0 ? bytes / secs / (1024 * 1024) : 0);
+  printf ("}\n");
+  fflush (stdout);
+}
@@ -0,0 +1,47 @@
+/* Common code for the microbenchmarks.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <argp.h>
+#include <stddef.h>
+
+/* The microbenchmarks print each result as a JSON object on a line of
+   its own, so that scripts can keep track of them across kernel and
+   Hurd builds:
+
+   {"bench": "rpc", "test": "null-rpc", "label": "", "threads": 1,
+    "ops": 100000, "seconds": 1.234, "ops_per_sec": 81037.3}
+
+   with "mb_per_sec" added for the tests that move data.  The label is
+   given with --label, to tell the configurations measured apart.  */
+
+/* Add --label to the options of a benchmark, as a child of its argp.  */
+extern const struct argp bench_argp;
+
+/* The monotonic clock, in nanoseconds.  */
+double bench_now (void);
+
+/* Print the result of TEST of BENCH, which made OPS operations with
+   THREADS threads in NS nanoseconds, moving BYTES bytes if nonzero.  */
+void bench_report (const char *bench, const char *test, int threads,
+		   size_t ops, double ns, size_t bytes);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,119 @@
+/* bpf-filter -- Measure the cost of running the packet filters.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Register NFILTERS copies of the filter pfinet and lwip set on their
+   interfaces, as eth-multiplexer would for as many clients, then run
+   them all on each of NPACKETS frames of several types, the way
+   eth-multiplexer delivers a frame, and print the time taken per frame
+   and per filter run.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mach.h>
+#include <device/net_status.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+
+#include "../libbpf/bpf_impl.h"
+
+static struct bpf_insn ether_filter[] =
+{
+    {NETF_IN|NETF_BPF, 0, 0, 0},		/* Header. */
+    {BPF_LD|BPF_H|BPF_ABS, 0, 0, 12},		/* Load Ethernet type */
+    {BPF_JMP|BPF_JEQ|BPF_K, 2, 0, 0x0806},	/* Accept ARP */
+    {BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 0x0800},	/* Accept IPv4 */
+    {BPF_JMP|BPF_JEQ|BPF_K, 0, 1, 0x86DD},	/* Accept IPv6 */
+    {BPF_RET|BPF_K, 0, 0, 1500},		/* And return 1500 bytes */
+    {BPF_RET|BPF_K, 0, 0, 0},			/* Or discard it all */
+};
+
+/* The Ethernet types of the frames: the last one is rejected.  */
+static const unsigned short types[] = { 0x0800, 0x86DD, 0x0806, 0x88CC };
+#define NTYPES (sizeof types / sizeof types[0])
+
+int
+main (int argc, char *argv[])
+{
+  if_filter_list_t list;
+  net_rcv_port_t infp, nextfp;
+  struct timespec start, end;
+  static char header[NTYPES][sizeof (struct ether_header)];
+  static char packet[NET_RCV_MAX];
+  long npackets, nfilters, i, j, accepted = 0;
+  double ns;
+
+  if (argc != 3)
+    {
+      printf ("usage: %s number-of-filters number-of-packets\n", argv[0]);
+      exit (1);
+    }
+  nfilters = atol (argv[1]);
+  npackets = atol (argv[2]);
+  if (nfilters <= 0 || npackets <= 0)
+    {
+      printf ("%s: both numbers must be positive\n", argv[0]);
+      exit (2);
+    }
+
+  queue_init (&list.if_rcv_port_list);
+  queue_init (&list.if_snd_port_list);
+  for (i = 0; i < nfilters; i++)
+    /* Any distinct name does, no message is sent to it.  */
+    if (net_set_filter (&list, (mach_port_t) (i + 1), 0,
+			(filter_t *) ether_filter,
+			sizeof ether_filter / (sizeof (filter_t))))
+      {
+	printf ("%s: net_set_filter failed\n", argv[0]);
+	exit (3);
+      }
+
+  for (i = 0; i < NTYPES; i++)
+    {
+      struct ether_header *eh = (struct ether_header *) header[i];
+      memset (eh, 0xff, sizeof *eh);
+      eh->ether_type = htons (types[i]);
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; i < npackets; i++)
+    {
+      queue_head_t *if_port_list = &list.if_rcv_port_list;
+
+      FILTER_ITERATE (if_port_list, infp, nextfp, &infp->input)
+	{
+	  net_hash_entry_t entp, *hash_headp;
+
+	  if (bpf_do_filter (infp, packet, 1000, header[i % NTYPES],
+			     sizeof header[0], &hash_headp, &entp))
+	    accepted++;
+	}
+      FILTER_ITERATE_END
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  j = npackets * nfilters;
+  printf ("%ld frames, %ld filters, %ld accepted\n", npackets, nfilters,
+	  accepted);
+  printf ("%.1f ns per frame, %.1f ns per filter run\n",
+	  ns / npackets, ns / j);
+  return 0;
+}
@@ -0,0 +1,138 @@
+/* execs -- Measure the time taken by each phase of a fork and exec.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Fork NEXECS children that each exec this very program again, which
+   only reports when it started and exits, and print the average time
+   spent in each phase: from fork until the child runs, from the exec
+   call until the new program runs, and from then until the parent's
+   wait returns.  The times are taken in both processes from the
+   monotonic clock; the child sends its own through a pipe.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+read_fully (int fd, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = read (fd, buf, len);
+      if (n <= 0)
+	return -1;
+      buf = (char *) buf + n;
+      len -= n;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  double fork_time = 0, exec_time = 0, exit_time = 0;
+  int nexecs, i;
+
+  if (argc == 3 && strcmp (argv[1], "--child") == 0)
+    {
+      /* The exec'd child.  */
+      double started = now ();
+      write (atoi (argv[2]), &started, sizeof started);
+      _exit (0);
+    }
+
+  if (argc < 2)
+    {
+      printf ("usage: %s number-of-execs\n", argv[0]);
+      exit (1);
+    }
+  nexecs = atoi (argv[1]);
+  if (nexecs <= 0)
+    {
+      printf ("%s: bad number of execs\n", argv[1]);
+      exit (2);
+    }
+
+  for (i = 0; i < nexecs; i++)
+    {
+      /* Times of the fork, its return in the child, the exec call,
+	 the start of the new program, and the return of wait.  */
+      double t[5];
+      int fds[2], status;
+      pid_t child;
+
+      if (pipe (fds) < 0)
+	{
+	  perror ("pipe");
+	  exit (3);
+	}
+
+      t[0] = now ();
+      child = fork ();
+      if (child == -1)
+	{
+	  perror ("fork");
+	  exit (4);
+	}
+      if (child == 0)
+	{
+	  char fd[16];
+	  t[1] = now ();
+	  close (fds[0]);
+	  snprintf (fd, sizeof fd, "%d", fds[1]);
+	  t[2] = now ();
+	  write (fds[1], &t[1], 2 * sizeof t[1]);
+	  execl (argv[0], argv[0], "--child", fd, NULL);
+	  perror ("exec");
+	  _exit (127);
+	}
+
+      close (fds[1]);
+      if (read_fully (fds[0], &t[1], 3 * sizeof t[1]) < 0)
+	{
+	  fprintf (stderr, "%s: the child did not report\n", argv[0]);
+	  exit (5);
+	}
+      while (waitpid (child, &status, 0) == -1)
+	;
+      t[4] = now ();
+      close (fds[0]);
+
+      fork_time += t[1] - t[0];
+      exec_time += t[3] - t[2];
+      exit_time += t[4] - t[3];
+    }
+
+  printf ("fork:       %10.1f us\n", fork_time / nexecs * 1e6);
+  printf ("exec:       %10.1f us\n", exec_time / nexecs * 1e6);
+  printf ("exit+wait:  %10.1f us\n", exit_time / nexecs * 1e6);
+  printf ("total:      %10.1f us\n",
+	  (fork_time + exec_time + exit_time) / nexecs * 1e6);
+  exit (0);
+}
@@ -0,0 +1,422 @@
+/* fsbench -- Measure filesystem metadata and data operations.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Run a series of tests in a fresh directory below DIR, each timing
+   every operation it makes with the monotonic clock, and print for each
+   the number of operations, their rate, and the 50th, 90th and 99th
+   percentile and the largest of their latencies.
+
+   The metadata tests work on NFILES files: create, stat, chmod, rename,
+   readdir (each operation a scan of the whole directory), unlink, then
+   mkdir and rmdir.  The data tests work on a file of FILESIZE bytes in
+   blocks of BLOCKSIZE: sequential write and read, random write and
+   read, and last a loop of writing a block and calling fsync.
+
+   The journal is configured when the filesystem is started, so its cost
+   is measured by running fsbench against a filesystem started with
+   --journal and against one started without, giving each run a --label.
+   With --sync each metadata operation is followed by an fsync of the
+   directory or the file, so that the journal makes it durable at once
+   rather than in the background.  With --format=json each result is
+   printed as a JSON object on a line of its own, for scripts to keep
+   track of.  */
+
+#include <argp.h>
+#include <dirent.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static size_t nfiles = 1000;
+static size_t filesize = 16 * 1024 * 1024;
+static size_t blocksize = 8192;
+static size_t nsyncs = 100;
+static int sync_metadata;
+static int json;
+static const char *label = "";
+static const char *only;
+static char *dir;
+
+/* The directory the tests work in, and a descriptor on it.  */
+static char *workdir;
+static int workfd;
+
+/* Latencies of the operations of the current test, in nanoseconds.  */
+static double *lat;
+static size_t nlat;
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double
+percentile (double p)
+{
+  size_t i = p / 100 * (nlat - 1) + 0.5;
+  return lat[i];
+}
+
+/* Print the results of test NAME, which took TOTAL nanoseconds.  */
+static void
+report (const char *name, double total)
+{
+  double rate;
+
+  if (nlat == 0)
+    return;
+
+  qsort (lat, nlat, sizeof *lat, compare_double);
+  rate = nlat / (total / 1e9);
+
+  if (json)
+    printf ("{\"label\": \"%s\", \"test\": \"%s\", \"ops\": %zu, "
+	    "\"ops_per_sec\": %.1f, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+	    "\"p99_us\": %.2f, \"max_us\": %.2f, \"sync\": %s}\n",
+	    label, name, nlat, rate, percentile (50) / 1e3,
+	    percentile (90) / 1e3, percentile (99) / 1e3,
+	    lat[nlat - 1] / 1e3, sync_metadata ? "true" : "false");
+  else
+    printf ("%-10s %8zu %12.1f %10.2f %10.2f %10.2f %10.2f\n",
+	    name, nlat, rate, percentile (50) / 1e3, percentile (90) / 1e3,
+	    percentile (99) / 1e3, lat[nlat - 1] / 1e3);
+  fflush (stdout);
+}
+
+/* Timing of a single operation.  */
+#define TIMED(op)						\
+  ({								\
+    double _start = now ();					\
+    int _ret = (op);						\
+    lat[nlat++] = now () - _start;				\
+    _ret;							\
+  })
+
+static void
+name_file (char *buf, size_t len, char prefix, size_t i)
+{
+  snprintf (buf, len, "%c%06zu", prefix, i);
+}
+
+/* With --sync, make the metadata change just made durable.  */
+static int
+maybe_sync (int fd)
+{
+  return sync_metadata ? fsync (fd) : 0;
+}
+
+static int
+create_one (const char *name)
+{
+  int fd = openat (workfd, name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+  if (fd < 0)
+    return -1;
+  if (maybe_sync (fd) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return close (fd);
+}
+
+static int
+stat_one (const char *name)
+{
+  struct stat st;
+  return fstatat (workfd, name, &st, 0);
+}
+
+static int
+chmod_one (const char *name)
+{
+  if (fchmodat (workfd, name, 0600, 0) < 0)
+    return -1;
+  return maybe_sync (workfd);
+}
+
+static int
+rename_one (const char *from, const char *to)
+{
+  if (renameat (workfd, from, workfd, to) < 0)
+    return -1;
+  return maybe_sync (workfd);
+}
+
+static int
+unlink_one (const char *name, int flags)
+{
+  if (unlinkat (workfd, name, flags) < 0)
+    return -1;
+  return maybe_sync (workfd);
+}
+
+static int
+mkdir_one (const char *name)
+{
+  if (mkdirat (workfd, name, 0755) < 0)
+    return -1;
+  return maybe_sync (workfd);
+}
+
+static int
+scan_dir (void)
+{
+  DIR *d = opendir (workdir);
+  size_t n = 0;
+
+  if (!d)
+    return -1;
+  while (readdir (d))
+    n++;
+  closedir (d);
+  return n >= nfiles ? 0 : -1;
+}
+
+static int
+selected (const char *name)
+{
+  size_t len = strlen (name);
+  const char *p;
+
+  if (!only)
+    return 1;
+  for (p = only; (p = strstr (p, name)); p += len)
+    if ((p == only || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+      return 1;
+  return 0;
+}
+
+/* Run the operation OP COUNT times as test TEST, with I counting them
+   and START the time the test began.  */
+#define RUN(test, count, op)						\
+  do									\
+    {									\
+      nlat = 0;								\
+      start = now ();							\
+      for (i = 0; i < (count); i++)					\
+	if (TIMED (op) < 0)						\
+	  error (1, errno, "%s", test);					\
+      if (selected (test))						\
+	report (test, now () - start);					\
+    }									\
+  while (0)
+
+static void
+metadata_tests (void)
+{
+  char name[24], other[24];
+  double start;
+  size_t i;
+
+  /* The later tests need the files of the earlier ones, so all of
+     them run; --tests only picks which are reported.  */
+  RUN ("create", nfiles, (name_file (name, sizeof name, 'f', i),
+			  create_one (name)));
+  RUN ("stat", nfiles, (name_file (name, sizeof name, 'f', i),
+			stat_one (name)));
+  RUN ("chmod", nfiles, (name_file (name, sizeof name, 'f', i),
+			 chmod_one (name)));
+  RUN ("rename", nfiles, (name_file (name, sizeof name, 'f', i),
+			  name_file (other, sizeof other, 'r', i),
+			  rename_one (name, other)));
+  RUN ("readdir", 16, scan_dir ());
+  RUN ("unlink", nfiles, (name_file (name, sizeof name, 'r', i),
+			  unlink_one (name, 0)));
+  RUN ("mkdir", nfiles, (name_file (name, sizeof name, 'd', i),
+			 mkdir_one (name)));
+  RUN ("rmdir", nfiles, (name_file (name, sizeof name, 'd', i),
+			 unlink_one (name, AT_REMOVEDIR)));
+}
+
+static int
+write_block (int fd, const char *buf, off_t offset)
+{
+  return pwrite (fd, buf, blocksize, offset) == (ssize_t) blocksize ? 0 : -1;
+}
+
+static int
+read_block (int fd, char *buf, off_t offset)
+{
+  return pread (fd, buf, blocksize, offset) == (ssize_t) blocksize ? 0 : -1;
+}
+
+static int
+write_and_sync (int fd, const char *buf)
+{
+  if (write_block (fd, buf, 0) < 0)
+    return -1;
+  return fsync (fd);
+}
+
+static void
+data_tests (void)
+{
+  size_t nblocks = filesize / blocksize;
+  char *buf;
+  double start;
+  size_t i;
+  int fd;
+
+  buf = malloc (blocksize);
+  if (!buf)
+    error (1, errno, "malloc");
+  memset (buf, 0x5a, blocksize);
+
+  fd = openat (workfd, "data", O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0)
+    error (1, errno, "data");
+
+  srandom (1);
+
+  RUN ("seqwrite", nblocks, write_block (fd, buf, (off_t) i * blocksize));
+  RUN ("seqread", nblocks, read_block (fd, buf, (off_t) i * blocksize));
+  RUN ("randwrite", nblocks,
+       write_block (fd, buf, (off_t) (random () % nblocks) * blocksize));
+  RUN ("randread", nblocks,
+       read_block (fd, buf, (off_t) (random () % nblocks) * blocksize));
+  RUN ("fsync", nsyncs, write_and_sync (fd, buf));
+
+  close (fd);
+  unlinkat (workfd, "data", 0);
+  free (buf);
+}
+
+static const struct argp_option options[] =
+{
+  {"files",	'n', "N",	0, "Number of files for the metadata tests"
+				   " (default 1000)"},
+  {"file-size",	's', "BYTES",	0, "Size of the file for the data tests"
+				   " (default 16777216)"},
+  {"block-size",'b', "BYTES",	0, "Size of each read and write"
+				   " (default 8192)"},
+  {"fsyncs",	'f', "N",	0, "Number of fsync loop iterations"
+				   " (default 100)"},
+  {"tests",	't', "LIST",	0, "Only report the tests in the comma"
+				   " separated LIST"},
+  {"sync",	'S', 0,		0, "Make each metadata change durable with"
+				   " fsync"},
+  {"label",	'l', "LABEL",	0, "Name the configuration measured, e.g."
+				   " journal or no-journal"},
+  {"format",	'F', "FORMAT",	0, "Print text (the default) or json"},
+  {0}
+};
+
+static size_t
+parse_size (const char *arg, struct argp_state *state)
+{
+  char *end;
+  unsigned long long v = strtoull (arg, &end, 0);
+
+  if (*end || v == 0)
+    argp_error (state, "%s: invalid number", arg);
+  return v;
+}
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'n': nfiles = parse_size (arg, state); break;
+    case 's': filesize = parse_size (arg, state); break;
+    case 'b': blocksize = parse_size (arg, state); break;
+    case 'f': nsyncs = parse_size (arg, state); break;
+    case 't': only = arg; break;
+    case 'S': sync_metadata = 1; break;
+    case 'l': label = arg; break;
+    case 'F':
+      if (strcmp (arg, "json") == 0)
+	json = 1;
+      else if (strcmp (arg, "text") == 0)
+	json = 0;
+      else
+	argp_error (state, "%s: unknown format", arg);
+      break;
+
+    case ARGP_KEY_ARG:
+      if (dir)
+	argp_error (state, "Too many arguments");
+      dir = arg;
+      break;
+    case ARGP_KEY_END:
+      if (!dir)
+	argp_error (state, "No directory given");
+      if (filesize < blocksize)
+	argp_error (state, "The file size is smaller than a block");
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp argp =
+    { options, parse_opt, "DIR",
+      "Measure filesystem metadata and data operations in DIR." };
+  size_t max;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  max = nfiles > filesize / blocksize ? nfiles : filesize / blocksize;
+  if (nsyncs > max)
+    max = nsyncs;
+  lat = calloc (max, sizeof *lat);
+  if (!lat)
+    error (1, errno, "calloc");
+
+  if (asprintf (&workdir, "%s/fsbench.%d", dir, getpid ()) < 0)
+    error (1, errno, "asprintf");
+  if (mkdir (workdir, 0755) < 0)
+    error (1, errno, "%s", workdir);
+  workfd = open (workdir, O_RDONLY | O_DIRECTORY);
+  if (workfd < 0)
+    error (1, errno, "%s", workdir);
+
+  if (!json)
+    printf ("%-10s %8s %12s %10s %10s %10s %10s\n",
+	    "test", "ops", "ops/s", "p50 us", "p90 us", "p99 us", "max us");
+
+  metadata_tests ();
+  data_tests ();
+
+  close (workfd);
+  if (rmdir (workdir) < 0)
+    error (0, errno, "%s", workdir);
+  exit (0);
+}
@@ -0,0 +1,294 @@
+/* ihashbench -- Compare hash tables under concurrent lookups and updates.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Fill a table with every other key of KEYS, then start THREADS threads
+   that each make OPS operations on random keys: a lookup with a chance
+   of LOOKUP percent, and otherwise an update, which removes the key if
+   it is there and adds it if not, so that the table stays about half
+   full.  The tables are a hurd_ihash behind a single mutex, the way the
+   servers use one today, and a hurd_cihash.  Each table is measured
+   with 1, 2, 4 and so on up to THREADS threads, and the rate of all the
+   operations together is reported.
+
+   Before that, the rates of plain hurd_ihash operations without any
+   lock are measured on their own by one thread: adding each of the
+   KEYS keys, finding each, and removing each.  */
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <hurd/ihash.h>
+#include <hurd/cihash.h>
+
+#include "bench.h"
+
+static size_t nthreads = 4;
+static size_t nops = 1000000;
+static size_t nkeys = 65536;
+static unsigned lookup_pct = 90;
+
+struct table
+{
+  const char *name;
+  void (*init) (void);
+  void (*destroy) (void);
+  void *(*find) (hurd_ihash_key_t key);
+  void (*update) (hurd_ihash_key_t key);
+};
+
+static struct hurd_ihash locked_ht;
+static pthread_mutex_t locked_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hurd_cihash ci_ht;
+
+/* Values must not be 0 or ~0, which the tables use themselves.  */
+#define VALUE(key) ((void *) ((key) + 1))
+
+static void
+locked_init (void)
+{
+  hurd_ihash_key_t k;
+
+  hurd_ihash_init (&locked_ht, HURD_IHASH_NO_LOCP);
+  for (k = 0; k < nkeys; k += 2)
+    if (hurd_ihash_add (&locked_ht, k, VALUE (k)))
+      error (1, ENOMEM, "hurd_ihash_add");
+}
+
+static void
+locked_destroy (void)
+{
+  hurd_ihash_destroy (&locked_ht);
+}
+
+static void *
+locked_find (hurd_ihash_key_t key)
+{
+  void *value;
+
+  pthread_mutex_lock (&locked_lock);
+  value = hurd_ihash_find (&locked_ht, key);
+  pthread_mutex_unlock (&locked_lock);
+  return value;
+}
+
+static void
+locked_update (hurd_ihash_key_t key)
+{
+  pthread_mutex_lock (&locked_lock);
+  if (! hurd_ihash_remove (&locked_ht, key))
+    hurd_ihash_add (&locked_ht, key, VALUE (key));
+  pthread_mutex_unlock (&locked_lock);
+}
+
+static void
+ci_init (void)
+{
+  hurd_ihash_key_t k;
+
+  hurd_cihash_init (&ci_ht, HURD_IHASH_NO_LOCP);
+  for (k = 0; k < nkeys; k += 2)
+    if (hurd_cihash_add (&ci_ht, k, VALUE (k)))
+      error (1, ENOMEM, "hurd_cihash_add");
+}
+
+static void
+ci_destroy (void)
+{
+  hurd_cihash_destroy (&ci_ht);
+}
+
+static void *
+ci_find (hurd_ihash_key_t key)
+{
+  return hurd_cihash_find (&ci_ht, key);
+}
+
+static void
+ci_update (hurd_ihash_key_t key)
+{
+  hurd_ihash_t ht = hurd_cihash_lock (&ci_ht, key, 1);
+
+  if (! hurd_ihash_remove (ht, key))
+    hurd_ihash_add (ht, key, VALUE (key));
+  hurd_cihash_unlock (&ci_ht, key);
+}
+
+static const struct table tables[] =
+{
+  { "mix-ihash-mutex", locked_init, locked_destroy, locked_find,
+    locked_update },
+  { "mix-cihash", ci_init, ci_destroy, ci_find, ci_update },
+};
+
+static const struct table *table;
+
+/* Lookups that found their key, so that they can't be optimized away.  */
+static size_t hits;
+
+static void *
+worker (void *arg)
+{
+  uint64_t x = (uintptr_t) arg * 0x9e3779b97f4a7c15ULL + 1;
+  size_t i, found = 0;
+
+  for (i = 0; i < nops; i++)
+    {
+      hurd_ihash_key_t key;
+
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      key = (x >> 8) % nkeys;
+      if ((x & 0xff) * 100 < lookup_pct * 256)
+	found += table->find (key) != NULL;
+      else
+	table->update (key);
+    }
+
+  __atomic_add_fetch (&hits, found, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static void
+run (size_t n)
+{
+  pthread_t threads[n];
+  double start, elapsed;
+  size_t i;
+  int err;
+
+  table->init ();
+  start = bench_now ();
+  for (i = 0; i < n; i++)
+    {
+      err = pthread_create (&threads[i], NULL, worker, (void *) (i + 1));
+      if (err)
+	error (1, err, "pthread_create");
+    }
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], NULL);
+  elapsed = bench_now () - start;
+  table->destroy ();
+
+  bench_report ("ihash", table->name, n, n * nops, elapsed, 0);
+}
+
+/* Time the operations of a hurd_ihash by themselves.  */
+static void
+run_serial (void)
+{
+  struct hurd_ihash ht;
+  hurd_ihash_key_t k;
+  double start;
+  size_t found = 0;
+
+  hurd_ihash_init (&ht, HURD_IHASH_NO_LOCP);
+
+  start = bench_now ();
+  for (k = 0; k < nkeys; k++)
+    if (hurd_ihash_add (&ht, k, VALUE (k)))
+      error (1, ENOMEM, "hurd_ihash_add");
+  bench_report ("ihash", "add", 1, nkeys, bench_now () - start, 0);
+
+  start = bench_now ();
+  for (k = 0; k < nkeys; k++)
+    found += hurd_ihash_find (&ht, k) != NULL;
+  bench_report ("ihash", "find", 1, nkeys, bench_now () - start, 0);
+
+  start = bench_now ();
+  for (k = 0; k < nkeys; k++)
+    hurd_ihash_remove (&ht, k);
+  bench_report ("ihash", "remove", 1, nkeys, bench_now () - start, 0);
+
+  hurd_ihash_destroy (&ht);
+  if (found != nkeys)
+    error (1, 0, "found %zu keys of %zu", found, nkeys);
+}
+
+static const struct argp_option options[] =
+{
+  {"threads",	't', "N",	0, "Largest number of threads (default 4)"},
+  {"ops",	'n', "N",	0, "Operations made by each thread"
+				   " (default 1000000)"},
+  {"keys",	'k', "N",	0, "Number of different keys (default 65536)"},
+  {"lookup",	'l', "PERCENT",	0, "Share of the operations that are lookups"
+				   " (default 90)"},
+  {0}
+};
+
+static size_t
+parse_size (const char *arg, struct argp_state *state)
+{
+  char *end;
+  unsigned long long v = strtoull (arg, &end, 0);
+
+  if (*end || v == 0)
+    argp_error (state, "%s: invalid number", arg);
+  return v;
+}
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+
+  switch (key)
+    {
+    case 't': nthreads = parse_size (arg, state); break;
+    case 'n': nops = parse_size (arg, state); break;
+    case 'k': nkeys = parse_size (arg, state); break;
+    case 'l':
+      lookup_pct = strtoul (arg, &end, 10);
+      if (*arg == '\0' || *end || lookup_pct > 100)
+	argp_error (state, "%s: invalid percentage", arg);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp_child children[] = { { &bench_argp }, { 0 } };
+  const struct argp argp =
+    { options, parse_opt, NULL,
+      "Compare hash tables under concurrent lookups and updates.",
+      children };
+  size_t i, n;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  run_serial ();
+
+  for (i = 0; i < sizeof tables / sizeof tables[0]; i++)
+    {
+      table = &tables[i];
+      for (n = 1; n < nthreads; n *= 2)
+	run (n);
+      run (nthreads);
+    }
+
+  return 0;
+}
@@ -0,0 +1,212 @@
+/* pagerbench -- Measure page faults on a libpager pager and pager_memcpy.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Serve a memory object of SIZE bytes with a trivial pager, whose
+   pages are all zeros and whose writes are thrown away, map it and
+   time:
+
+   fault	touching each page of a fresh mapping once, for the rate of
+		page faults that libpager turns into pager_read_page calls;
+   memcpy-read	pager_memcpy from the whole object to a buffer;
+   memcpy-write	pager_memcpy from a buffer to the whole object.
+
+   The object is not cached by the kernel once unmapped, so each test
+   starts with none of it in memory.  */
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <mach.h>
+#include <hurd/pager.h>
+#include <hurd/ports.h>
+
+#include "bench.h"
+
+static size_t size = 64 * 1024 * 1024;
+
+struct user_pager_info
+{
+  size_t size;
+};
+
+error_t
+pager_read_page (struct user_pager_info *upi, vm_offset_t page,
+		 vm_address_t *buf, int *writelock)
+{
+  void *p = mmap (0, vm_page_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+
+  if (p == MAP_FAILED)
+    return EIO;
+  *buf = (vm_address_t) p;
+  *writelock = 0;
+  return 0;
+}
+
+error_t
+pager_write_page (struct user_pager_info *upi, vm_offset_t page,
+		  vm_address_t buf)
+{
+  return 0;
+}
+
+error_t
+pager_unlock_page (struct user_pager_info *upi, vm_offset_t address)
+{
+  return 0;
+}
+
+void
+pager_notify_evict (struct user_pager_info *upi, vm_offset_t page)
+{
+}
+
+error_t
+pager_report_extent (struct user_pager_info *upi,
+		     vm_address_t *offset, vm_size_t *size)
+{
+  *offset = 0;
+  *size = upi->size;
+  return 0;
+}
+
+void
+pager_clear_user_data (struct user_pager_info *upi)
+{
+}
+
+void
+pager_dropweak (struct user_pager_info *upi)
+{
+}
+
+/* Map the memory object MEMOBJ, all of it.  */
+static void *
+map (memory_object_t memobj)
+{
+  vm_address_t addr = 0;
+  error_t err;
+
+  err = vm_map (mach_task_self (), &addr, size, 0, 1, memobj, 0, 0,
+		VM_PROT_READ|VM_PROT_WRITE, VM_PROT_READ|VM_PROT_WRITE,
+		VM_INHERIT_NONE);
+  if (err)
+    error (1, err, "vm_map");
+  return (void *) addr;
+}
+
+static const struct argp_option options[] =
+{
+  {"size",	's', "BYTES",	0, "Size of the memory object"
+				   " (default 67108864)"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+
+  switch (key)
+    {
+    case 's':
+      size = strtoull (arg, &end, 0);
+      if (*end || size == 0)
+	argp_error (state, "%s: invalid number", arg);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp_child children[] = { { &bench_argp }, { 0 } };
+  const struct argp argp =
+    { options, parse_opt, NULL,
+      "Measure page faults on a libpager pager and pager_memcpy.",
+      children };
+  struct port_bucket *bucket;
+  struct pager_requests *requests;
+  struct user_pager_info *upi;
+  struct pager *pager;
+  memory_object_t memobj;
+  volatile char *p;
+  double start;
+  size_t i, len, npages;
+  char *buf;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+  size = round_page (size);
+  npages = size / vm_page_size;
+
+  bucket = ports_create_bucket ();
+  if (! bucket)
+    error (1, errno, "ports_create_bucket");
+  err = pager_start_workers (bucket, &requests);
+  if (err)
+    error (1, err, "pager_start_workers");
+
+  pager = pager_create_alloc (sizeof *upi, bucket, 0,
+			      MEMORY_OBJECT_COPY_DELAY, 0);
+  if (! pager)
+    error (1, errno, "pager_create");
+  upi = pager_get_upi (pager);
+  upi->size = size;
+  memobj = pager_get_port (pager);
+  err = mach_port_insert_right (mach_task_self (), memobj, memobj,
+				MACH_MSG_TYPE_MAKE_SEND);
+  if (err)
+    error (1, err, "mach_port_insert_right");
+
+  p = map (memobj);
+  start = bench_now ();
+  for (i = 0; i < npages; i++)
+    (void) p[i * vm_page_size];
+  bench_report ("pager", "fault", 1, npages, bench_now () - start, 0);
+  munmap ((void *) p, size);
+
+  buf = malloc (size);
+  if (! buf)
+    error (1, errno, "malloc");
+  memset (buf, 1, size);
+
+  len = size;
+  start = bench_now ();
+  err = pager_memcpy (pager, memobj, 0, buf, &len, VM_PROT_READ);
+  if (err)
+    error (1, err, "pager_memcpy");
+  bench_report ("pager", "memcpy-read", 1, npages, bench_now () - start, len);
+
+  len = size;
+  start = bench_now ();
+  err = pager_memcpy (pager, memobj, 0, buf, &len, VM_PROT_WRITE);
+  if (err)
+    error (1, err, "pager_memcpy");
+  bench_report ("pager", "memcpy-write", 1, npages, bench_now () - start, len);
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/* rpcbench -- Measure null RPC round trips through libports.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Serve a port with libports' multithreaded loop and time THREADS
+   client threads each making OPS RPCs to it that do nothing but reply,
+   so that what is measured is the Mach message path and libports' own
+   work for each RPC: looking up the port, ports_begin_rpc and
+   ports_end_rpc.  The test is run with one client thread and with
+   THREADS, unless that is one too.  */
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mach.h>
+#include <mach/mig_errors.h>
+#include <hurd/ports.h>
+
+#include "bench.h"
+
+/* The id of the null RPC; any that no interface uses does.  */
+#define NULL_RPC_ID 31337
+
+static size_t nthreads = 4;
+static size_t nops = 100000;
+
+/* A send right to the port served.  */
+static mach_port_t server;
+
+static int
+demuxer (mach_msg_header_t *inp, mach_msg_header_t *outp)
+{
+  if (inp->msgh_id != NULL_RPC_ID)
+    return 0;
+  ((mig_reply_header_t *) outp)->RetCode = 0;
+  return 1;
+}
+
+static void *
+serve (void *bucket)
+{
+  ports_manage_port_operations_multithread (bucket, demuxer, 0, 0, 0);
+  return NULL;
+}
+
+static void *
+client (void *arg)
+{
+  mach_port_t reply = mach_reply_port ();
+  union
+  {
+    mach_msg_header_t head;
+    mig_reply_header_t reply;
+  } msg;
+  size_t i;
+  error_t err;
+
+  for (i = 0; i < nops; i++)
+    {
+      msg.head.msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND,
+					   MACH_MSG_TYPE_MAKE_SEND_ONCE);
+      msg.head.msgh_size = sizeof msg.head;
+      msg.head.msgh_remote_port = server;
+      msg.head.msgh_local_port = reply;
+      msg.head.msgh_seqno = 0;
+      msg.head.msgh_id = NULL_RPC_ID;
+
+      err = mach_msg (&msg.head, MACH_SEND_MSG | MACH_RCV_MSG,
+		      sizeof msg.head, sizeof msg, reply,
+		      MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+      if (! err)
+	err = msg.reply.RetCode;
+      if (err)
+	error (1, err, "null RPC");
+    }
+
+  mach_port_destroy (mach_task_self (), reply);
+  return NULL;
+}
+
+static void
+run (size_t n)
+{
+  pthread_t threads[n];
+  double start;
+  size_t i;
+  error_t err;
+
+  start = bench_now ();
+  for (i = 0; i < n; i++)
+    {
+      err = pthread_create (&threads[i], NULL, client, NULL);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], NULL);
+
+  bench_report ("rpc", "null-rpc", n, n * nops, bench_now () - start, 0);
+}
+
+static const struct argp_option options[] =
+{
+  {"threads",	't', "N",	0, "Number of client threads (default 4)"},
+  {"ops",	'n', "N",	0, "RPCs made by each thread"
+				   " (default 100000)"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+
+  switch (key)
+    {
+    case 't':
+    case 'n':
+      {
+	unsigned long long v = strtoull (arg, &end, 0);
+	if (*end || v == 0)
+	  argp_error (state, "%s: invalid number", arg);
+	if (key == 't')
+	  nthreads = v;
+	else
+	  nops = v;
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp_child children[] = { { &bench_argp }, { 0 } };
+  const struct argp argp =
+    { options, parse_opt, NULL,
+      "Measure null RPC round trips through libports.", children };
+  struct port_bucket *bucket;
+  struct port_class *class;
+  struct port_info *pi;
+  pthread_t t;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  bucket = ports_create_bucket ();
+  class = ports_create_class (NULL, NULL);
+  if (! bucket || ! class)
+    error (1, errno, "ports_create_bucket");
+  err = ports_create_port (class, bucket, sizeof *pi, &pi);
+  if (err)
+    error (1, err, "ports_create_port");
+  server = ports_get_send_right (pi);
+  ports_port_deref (pi);
+
+  err = pthread_create (&t, NULL, serve, bucket);
+  if (err)
+    error (1, err, "pthread_create");
+  pthread_detach (t);
+
+  run (1);
+  if (nthreads > 1)
+    run (nthreads);
+
+  return 0;
+}
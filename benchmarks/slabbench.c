@@ -0,0 +1,234 @@
+/* slabbench -- Measure allocations from libhurd-slab.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Time, with each of 1, 2, 4 and so on up to THREADS threads sharing a
+   slab space of SIZE byte objects:
+
+   alloc-free	OPS allocations each freed at once, which the magazines
+		of each thread serve;
+   alloc	allocating BATCH objects at a time, OPS in all;
+   free		freeing them again;
+
+   and the same with malloc and free, to compare with.  */
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hurd/slab.h>
+
+#include "bench.h"
+
+static size_t nthreads = 4;
+static size_t nops = 1000000;
+static size_t size = 64;
+static size_t batch = 1000;
+
+static struct hurd_slab_space space;
+
+struct allocator
+{
+  const char *name;
+  void *(*alloc) (void);
+  void (*free) (void *);
+};
+
+static void *
+slab_alloc (void)
+{
+  void *p;
+
+  if (hurd_slab_alloc (&space, &p))
+    return NULL;
+  return p;
+}
+
+static void
+slab_free (void *p)
+{
+  hurd_slab_dealloc (&space, p);
+}
+
+static void *
+libc_alloc (void)
+{
+  return malloc (size);
+}
+
+static const struct allocator allocators[] =
+{
+  { "slab", slab_alloc, slab_free },
+  { "malloc", libc_alloc, free },
+};
+
+static const struct allocator *allocator;
+
+/* The time each thread spent on each kind of test, in nanoseconds.  */
+struct times
+{
+  double alloc_free, alloc, free;
+};
+
+static void *
+worker (void *arg)
+{
+  struct times *t = arg;
+  void **objs = malloc (batch * sizeof *objs);
+  double start;
+  size_t i, j;
+
+  if (! objs)
+    error (1, errno, "malloc");
+
+  start = bench_now ();
+  for (i = 0; i < nops; i++)
+    {
+      void *p = allocator->alloc ();
+      if (! p)
+	error (1, ENOMEM, "%s", allocator->name);
+      allocator->free (p);
+    }
+  t->alloc_free = bench_now () - start;
+
+  for (i = 0; i < nops; i += batch)
+    {
+      size_t n = nops - i < batch ? nops - i : batch;
+
+      start = bench_now ();
+      for (j = 0; j < n; j++)
+	if (! (objs[j] = allocator->alloc ()))
+	  error (1, ENOMEM, "%s", allocator->name);
+      t->alloc += bench_now () - start;
+
+      start = bench_now ();
+      for (j = 0; j < n; j++)
+	allocator->free (objs[j]);
+      t->free += bench_now () - start;
+    }
+
+  free (objs);
+  return NULL;
+}
+
+static void
+run (size_t n)
+{
+  pthread_t threads[n];
+  struct times times[n], longest = { 0 };
+  char test[32];
+  size_t i;
+  error_t err;
+
+  memset (times, 0, sizeof times);
+  for (i = 0; i < n; i++)
+    {
+      err = pthread_create (&threads[i], NULL, worker, &times[i]);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+  for (i = 0; i < n; i++)
+    {
+      pthread_join (threads[i], NULL);
+      if (times[i].alloc_free > longest.alloc_free)
+	longest.alloc_free = times[i].alloc_free;
+      if (times[i].alloc > longest.alloc)
+	longest.alloc = times[i].alloc;
+      if (times[i].free > longest.free)
+	longest.free = times[i].free;
+    }
+
+  snprintf (test, sizeof test, "%s-alloc-free", allocator->name);
+  bench_report ("slab", test, n, n * nops, longest.alloc_free, 0);
+  snprintf (test, sizeof test, "%s-alloc", allocator->name);
+  bench_report ("slab", test, n, n * nops, longest.alloc, 0);
+  snprintf (test, sizeof test, "%s-free", allocator->name);
+  bench_report ("slab", test, n, n * nops, longest.free, 0);
+}
+
+static const struct argp_option options[] =
+{
+  {"threads",	't', "N",	0, "Largest number of threads (default 4)"},
+  {"ops",	'n', "N",	0, "Allocations made by each thread"
+				   " (default 1000000)"},
+  {"size",	's', "BYTES",	0, "Size of the objects (default 64)"},
+  {"batch",	'b', "N",	0, "Objects allocated before they are freed"
+				   " (default 1000)"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+  unsigned long long v;
+
+  switch (key)
+    {
+    case 't':
+    case 'n':
+    case 's':
+    case 'b':
+      v = strtoull (arg, &end, 0);
+      if (*end || v == 0)
+	argp_error (state, "%s: invalid number", arg);
+      if (key == 't')
+	nthreads = v;
+      else if (key == 'n')
+	nops = v;
+      else if (key == 's')
+	size = v;
+      else
+	batch = v;
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp_child children[] = { { &bench_argp }, { 0 } };
+  const struct argp argp =
+    { options, parse_opt, NULL,
+      "Measure allocations from libhurd-slab.", children };
+  size_t i, n;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  err = hurd_slab_init (&space, size, 0, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    error (1, err, "hurd_slab_init");
+
+  for (i = 0; i < sizeof allocators / sizeof allocators[0]; i++)
+    {
+      allocator = &allocators[i];
+      for (n = 1; n < nthreads; n *= 2)
+	run (n);
+      run (nthreads);
+    }
+
+  return 0;
+}
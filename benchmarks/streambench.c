@@ -0,0 +1,256 @@
+/* streambench -- Measure stream throughput of pflocal, pipes and pfinet.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Time moving TOTAL bytes in writes and reads of BLOCKSIZE bytes, from
+   one thread to another, through:
+
+   local-stream	a pair of AF_LOCAL stream sockets, which pflocal serves
+		with libpipe;
+   pipe		a pipe, which the C library makes of such a pair;
+   tcp-stream	a TCP connection over the loopback interface of pfinet;
+
+   and time CONNECTIONS TCP connections over the loopback, each accepted
+   and closed at both ends, for tcp-connect.  */
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+
+static size_t total = 256 * 1024 * 1024;
+static size_t blocksize = 65536;
+static size_t nconnections = 1000;
+
+struct writer
+{
+  int fd;
+  char *buf;
+};
+
+static void *
+writer (void *arg)
+{
+  struct writer *w = arg;
+  size_t done = 0;
+
+  while (done < total)
+    {
+      size_t len = total - done < blocksize ? total - done : blocksize;
+      ssize_t n = write (w->fd, w->buf, len);
+      if (n < 0)
+	error (1, errno, "write");
+      done += n;
+    }
+  close (w->fd);
+  return NULL;
+}
+
+/* Move TOTAL bytes from WFD to RFD and report it as TEST.  Both are
+   closed.  */
+static void
+pump (const char *test, int rfd, int wfd)
+{
+  struct writer w = { wfd };
+  char *buf;
+  size_t done = 0, reads = 0;
+  pthread_t t;
+  double start;
+  error_t err;
+
+  buf = malloc (blocksize);
+  w.buf = malloc (blocksize);
+  if (! buf || ! w.buf)
+    error (1, errno, "malloc");
+  memset (w.buf, 'x', blocksize);
+
+  start = bench_now ();
+  err = pthread_create (&t, NULL, writer, &w);
+  if (err)
+    error (1, err, "pthread_create");
+  for (;;)
+    {
+      ssize_t n = read (rfd, buf, blocksize);
+      if (n < 0)
+	error (1, errno, "read");
+      if (n == 0)
+	break;
+      done += n;
+      reads++;
+    }
+  pthread_join (t, NULL);
+  bench_report ("stream", test, 2, reads, bench_now () - start, done);
+
+  if (done != total)
+    error (1, 0, "%s: read %zu bytes of %zu", test, done, total);
+  close (rfd);
+  free (buf);
+  free (w.buf);
+}
+
+/* Return a socket listening on the loopback, and its address in SIN.  */
+static int
+tcp_listen (struct sockaddr_in *sin)
+{
+  socklen_t len = sizeof *sin;
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    error (1, errno, "socket");
+  memset (sin, 0, sizeof *sin);
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (fd, (struct sockaddr *) sin, sizeof *sin) < 0
+      || listen (fd, 128) < 0
+      || getsockname (fd, (struct sockaddr *) sin, &len) < 0)
+    error (1, errno, "loopback listen");
+  return fd;
+}
+
+/* Connect to SIN, and return the connected socket.  */
+static int
+tcp_connect (const struct sockaddr_in *sin)
+{
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    error (1, errno, "socket");
+  if (connect (fd, (const struct sockaddr *) sin, sizeof *sin) < 0)
+    error (1, errno, "connect");
+  return fd;
+}
+
+static void *
+acceptor (void *arg)
+{
+  int lfd = (intptr_t) arg;
+  size_t i;
+
+  for (i = 0; i < nconnections; i++)
+    {
+      int fd = accept (lfd, NULL, NULL);
+      if (fd < 0)
+	error (1, errno, "accept");
+      close (fd);
+    }
+  return NULL;
+}
+
+static void
+test_tcp_connect (void)
+{
+  struct sockaddr_in sin;
+  int lfd = tcp_listen (&sin);
+  pthread_t t;
+  double start;
+  size_t i;
+  error_t err;
+
+  start = bench_now ();
+  err = pthread_create (&t, NULL, acceptor, (void *) (intptr_t) lfd);
+  if (err)
+    error (1, err, "pthread_create");
+  for (i = 0; i < nconnections; i++)
+    close (tcp_connect (&sin));
+  pthread_join (t, NULL);
+  bench_report ("stream", "tcp-connect", 2, nconnections,
+		bench_now () - start, 0);
+  close (lfd);
+}
+
+static const struct argp_option options[] =
+{
+  {"bytes",	'b', "BYTES",	0, "Bytes moved by each stream test"
+				   " (default 268435456)"},
+  {"block-size",'s', "BYTES",	0, "Size of each read and write"
+				   " (default 65536)"},
+  {"connections",'c', "N",	0, "Connections made by tcp-connect"
+				   " (default 1000)"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+  unsigned long long v;
+
+  switch (key)
+    {
+    case 'b':
+    case 's':
+    case 'c':
+      v = strtoull (arg, &end, 0);
+      if (*end || v == 0)
+	argp_error (state, "%s: invalid number", arg);
+      if (key == 'b')
+	total = v;
+      else if (key == 's')
+	blocksize = v;
+      else
+	nconnections = v;
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct argp_child children[] = { { &bench_argp }, { 0 } };
+  const struct argp argp =
+    { options, parse_opt, NULL,
+      "Measure stream throughput of pflocal, pipes and pfinet.", children };
+  struct sockaddr_in sin;
+  int fds[2], lfd, rfd;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  if (socketpair (AF_LOCAL, SOCK_STREAM, 0, fds) < 0)
+    error (1, errno, "socketpair");
+  pump ("local-stream", fds[0], fds[1]);
+
+  if (pipe (fds) < 0)
+    error (1, errno, "pipe");
+  pump ("pipe", fds[0], fds[1]);
+
+  lfd = tcp_listen (&sin);
+  fds[1] = tcp_connect (&sin);
+  rfd = accept (lfd, NULL, NULL);
+  if (rfd < 0)
+    error (1, errno, "accept");
+  close (lfd);
+  pump ("tcp-stream", rfd, fds[1]);
+
+  test_tcp_connect ();
+
+  return 0;
+}
@@ -160,11 +160,10 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
 
     if (! err && (delta & IFF_PROMISC))
       {
-	/* The ethernet device is always in promiscuous mode, and we
-	   forward all packets.  If this flag is cleared for a virtual
-	   device, we should filter traffic based on observed MAC
-	   addresses from this interface.  */
-	/* XXX: Implement this.  */
+	/* The ethernet device is always in promiscuous mode.  A
+	   virtual device in promiscuous mode gets every packet, others
+	   only those to the MAC addresses observed from them, see
+	   broadcast_msg.  */
       }
 
     if (! err && (delta & IFF_ALLMULTI))
@@ -179,7 +178,7 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
       }
 
     if (! err)
-      ifp->if_flags = flags;
+      set_dev_flags (ifp, flags);
     break;
 
   case NET_ADDRESS:
@@ -194,7 +193,7 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
       if (count != addr_int_count)
 	return D_INVALID_SIZE;
 
-      memcpy(ifp->if_address, status, addr_byte_count);
+      set_dev_address (ifp, (char *) status);
       for (i = 0; i < addr_int_count; i++) {
 	int word;
 
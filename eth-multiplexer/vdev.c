@@ -42,10 +42,106 @@
 static struct vether_device *dev_head;
 static int dev_num;
 
+/* The number of interfaces in promiscuous mode.  */
+static int promisc_num;
+
 /* This lock is only used to protected the virtual device list.
  * TODO every device structure should has its own lock to protect itself. */
 static pthread_mutex_t dev_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* A unicast MAC address reached through VDEV: its own, or the source
+ * address of a packet it sent.  */
+struct mac_entry
+{
+  char addr[ETH_ALEN];
+  struct vether_device *vdev;
+  /* The list of the addresses of VDEV.  */
+  struct mac_entry *next;
+  struct mac_entry **pprev;
+};
+
+/* Learn no more addresses than this, packets to the others go to all
+ * the interfaces.  */
+#define MAC_TABLE_MAX 4096
+
+static hurd_ihash_key_t
+mac_hash (const void *key)
+{
+  return hurd_ihash_hash32 (key, ETH_ALEN, 0);
+}
+
+static int
+mac_compare (const void *key1, const void *key2)
+{
+  return memcmp (key1, key2, ETH_ALEN) == 0;
+}
+
+/* The mac_entry of every learned address, keyed by the address, so that
+ * a unicast packet is only delivered to the interface having its
+ * destination.  Protected by dev_list_lock.  */
+static struct hurd_ihash mac_table
+  = HURD_IHASH_INITIALIZER_GKI (HURD_IHASH_NO_LOCP, NULL, NULL,
+				mac_hash, mac_compare);
+
+/* Record that ADDR is reached through VDEV.  dev_list_lock must be
+ * held.  */
+static void
+learn_address (struct vether_device *vdev, const char *addr)
+{
+  struct mac_entry *entry;
+
+  /* Group addresses go to all interfaces anyway.  */
+  if (addr[0] & 1)
+    return;
+
+  entry = hurd_ihash_find (&mac_table, (hurd_ihash_key_t) addr);
+  if (entry)
+    {
+      if (entry->vdev == vdev)
+	return;
+      /* The address moved to another interface.  */
+      *entry->pprev = entry->next;
+      if (entry->next)
+	entry->next->pprev = entry->pprev;
+    }
+  else
+    {
+      if (mac_table.nr_items >= MAC_TABLE_MAX)
+	return;
+      entry = malloc (sizeof *entry);
+      if (entry == NULL)
+	return;
+      memcpy (entry->addr, addr, ETH_ALEN);
+      if (hurd_ihash_add (&mac_table, (hurd_ihash_key_t) entry->addr, entry))
+	{
+	  free (entry);
+	  return;
+	}
+    }
+
+  entry->vdev = vdev;
+  entry->next = vdev->macs;
+  entry->pprev = &vdev->macs;
+  if (entry->next)
+    entry->next->pprev = &entry->next;
+  vdev->macs = entry;
+}
+
+/* Forget all the addresses of VDEV.  dev_list_lock must be held.  */
+static void
+forget_addresses (struct vether_device *vdev)
+{
+  struct mac_entry *entry, *next;
+
+  for (entry = vdev->macs; entry; entry = next)
+    {
+      next = entry->next;
+      hurd_ihash_remove (&mac_table, (hurd_ihash_key_t) entry->addr);
+      free (entry);
+    }
+  vdev->macs = NULL;
+}
+
 /* Should match MiG's desired_complex_alignof */
 #define MSG_ALIGNMENT __alignof__(uintptr_t)
 
@@ -91,6 +187,24 @@ lookup_dev_by_name (const char *name)
   return vdev;
 }
 
+void
+set_dev_flags (struct vether_device *vdev, short flags)
+{
+  pthread_mutex_lock (&dev_list_lock);
+  promisc_num += !!(flags & IFF_PROMISC) - !!(vdev->if_flags & IFF_PROMISC);
+  vdev->if_flags = flags;
+  pthread_mutex_unlock (&dev_list_lock);
+}
+
+void
+set_dev_address (struct vether_device *vdev, const char *addr)
+{
+  pthread_mutex_lock (&dev_list_lock);
+  memcpy (vdev->if_address, addr, ETH_ALEN);
+  learn_address (vdev, addr);
+  pthread_mutex_unlock (&dev_list_lock);
+}
+
 int
 foreach_dev_do (int (func) (struct vether_device *))
 {
@@ -166,7 +280,10 @@ add_vdev (char *name, size_t size)
   queue_init (&vdev->port_list.if_rcv_port_list);
   queue_init (&vdev->port_list.if_snd_port_list);
 
+  vdev->macs = NULL;
+
   pthread_mutex_lock (&dev_list_lock);
+  learn_address (vdev, vdev->if_address);
   vdev->next = dev_head;
   dev_head = vdev;
   vdev->pprev = &dev_head;
@@ -191,6 +308,9 @@ destroy_vdev (void *port)
   if (vdev->next)
     vdev->next->pprev = vdev->pprev;
   dev_num--;
+  if (vdev->if_flags & IFF_PROMISC)
+    promisc_num--;
+  forget_addresses (vdev);
   pthread_mutex_unlock (&dev_list_lock);
 
   /* TODO Delete all filters in the interface,
@@ -200,6 +320,50 @@ destroy_vdev (void *port)
 
 static int deliver_msg (struct net_rcv_msg *msg, struct vether_device *vdev);
 
+/* Deliver MSG to the virtual interfaces that are up, except FROM_VDEV.
+ * As a switch does, a unicast packet to a learned address only goes
+ * to the interface it was learned from and to the interfaces in
+ * promiscuous mode, without running the filters of the others; any
+ * other packet goes to all.  */
+static int
+dispatch_msg (struct net_rcv_msg *msg, struct vether_device *from_vdev)
+{
+  struct ethhdr *header = (struct ethhdr *) msg->header;
+  struct mac_entry *entry = NULL;
+  struct vether_device *vdev;
+
+  int internal_deliver_msg (struct vether_device *vdev)
+    {
+      /* Skip current interface.  */
+      if (from_vdev == vdev)
+	return 0;
+      /* Skip interfaces that are down.  */
+      if ((vdev->if_flags & IFF_UP) == 0)
+        return 0;
+      return deliver_msg (msg, vdev);
+    }
+
+  if ((header->h_dest[0] & 1) == 0)
+    {
+      pthread_mutex_lock (&dev_list_lock);
+      entry = hurd_ihash_find (&mac_table, (hurd_ihash_key_t) header->h_dest);
+      if (entry)
+	{
+	  if (entry->vdev != from_vdev && (entry->vdev->if_flags & IFF_UP))
+	    deliver_msg (msg, entry->vdev);
+	  if (promisc_num > 0)
+	    for (vdev = dev_head; vdev; vdev = vdev->next)
+	      if (vdev != entry->vdev && (vdev->if_flags & IFF_PROMISC))
+		internal_deliver_msg (vdev);
+	}
+      pthread_mutex_unlock (&dev_list_lock);
+      if (entry)
+	return 0;
+    }
+
+  return foreach_dev_do (internal_deliver_msg);
+}
+
 /* Broadcast the packet to all virtual interfaces
  * except the one the packet is from */
 int
@@ -226,18 +390,11 @@ broadcast_pack (char *data, int datalen, struct vether_device *from_vdev)
   packet->length = pack_size + sizeof (struct packet_header);
   msg.packet_type.msgt_number = packet->length;
 
-  int internal_deliver_pack (struct vether_device *vdev)
-    {
-      /* Skip current interface.  */
-      if (from_vdev == vdev)
-	return 0;
-      /* Skip interfaces that are down.  */
-      if ((vdev->if_flags & IFF_UP) == 0)
-        return 0;
-      return deliver_msg (&msg, vdev);
-    }
+  pthread_mutex_lock (&dev_list_lock);
+  learn_address (from_vdev, (char *) header->h_source);
+  pthread_mutex_unlock (&dev_list_lock);
 
-  return foreach_dev_do (internal_deliver_pack);
+  return dispatch_msg (&msg, from_vdev);
 }
 
 /* Broadcast the message to all virtual interfaces. */
@@ -247,17 +404,9 @@ broadcast_msg (struct net_rcv_msg *msg)
   int rval = 0;
   mach_msg_header_t header;
 
-  int internal_deliver_msg (struct vether_device *vdev)
-    {
-      /* Skip interfaces that are down.  */
-      if ((vdev->if_flags & IFF_UP) == 0)
-        return 0;
-      return deliver_msg (msg, vdev);
-    }
-
   /* Save the message header because deliver_msg will change it. */
   header = msg->msg_hdr;
-  rval = foreach_dev_do (internal_deliver_msg);
+  rval = dispatch_msg (msg, NULL);
   msg->msg_hdr = header;
   return rval;
 }
@@ -38,6 +38,8 @@ extern struct port_class *vdev_portclass;
 
 #define ETH_MTU 1500
 
+struct mac_entry;
+
 struct vether_device
 {
   /* The ports used by the socket server to send packets to the interface. */
@@ -56,6 +58,9 @@ struct vether_device
   struct vether_device *next;
   struct vether_device **pprev;
 
+  /* The MAC addresses frames for the interface are sent to.  */
+  struct mac_entry *macs;
+
   if_filter_list_t port_list;
 };
 
@@ -71,6 +76,8 @@ boolean_t all_dev_close (void);
 int broadcast_pack (char *data, int datalen, struct vether_device *from_vdev);
 int broadcast_msg (struct net_rcv_msg *msg);
 int get_dev_num (void);
+void set_dev_flags (struct vether_device *vdev, short flags);
+void set_dev_address (struct vether_device *vdev, const char *addr);
 int foreach_dev_do (dev_act_func func);
 
 /* dev_stat.c */
@@ -0,0 +1,316 @@
+/* GNU Hurd standard exec server, cache of the executables' headers.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* The same few programs are executed over and over, and reading and
+   checking their headers again each time is most of the work of an exec
+   that does not need to copy any data.  So what `check_elf' finds is
+   kept here for the files executed last, along with the name of their
+   interpreter.  For a #! script, what is kept is its first line, which
+   spares both `check_elf' and reading the line again.
+
+   An image is only used for a file whose io_map returns the very memory
+   object it was made from: as we keep a send right to that object, its
+   name cannot be reused for another one meanwhile.  The file system id,
+   file id, size and modification time must match as well, so that a
+   file written since is read again.  Checking the memory object also
+   means that whoever could not map the file cannot use its image.  */
+
+#include "priv.h"
+#include <errno.h>
+#include <time.h>
+
+/* How many images to keep.  */
+#define IMAGE_CACHE_SIZE 64
+
+/* How many seconds an image is kept once it was last used.  Holding
+   the memory object keeps the file alive, so this should not be long
+   either.  */
+#define IMAGE_CACHE_TIMEOUT 60
+
+struct image
+  {
+    /* What identifies the file.  */
+    memory_object_t filemap;
+    fsid_t fsid;
+    ino_t fileid;
+    off_t file_size;
+    struct timespec mtime;
+
+    /* What `check_elf' found.  */
+    vm_address_t entry;
+    ElfW(Addr) phdr_addr;
+    ElfW(Word) phnum;
+    int anywhere;
+    char *interp_name;		/* Malloc'd, or null if none.  */
+
+    /* The first line of a #! script after the `#!', with a null at the
+       end, malloc'd; or null if the file is no script.  */
+    char *hashbang;
+    size_t hashbang_len;	/* Including the null.  */
+
+    time_t last_use;
+    struct image *next, **prevp; /* In the list, most recently used first.  */
+    ElfW(Phdr) phdr[0];
+  };
+
+static struct image *images;
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static void
+unlink_image (struct image *im)
+{
+  *im->prevp = im->next;
+  if (im->next)
+    im->next->prevp = im->prevp;
+}
+
+static void
+link_image (struct image *im)
+{
+  im->next = images;
+  if (images)
+    images->prevp = &im->next;
+  im->prevp = &images;
+  images = im;
+}
+
+/* Unlink IM and free it.  IMAGE_LOCK must be held.  */
+static void
+drop_image (struct image *im)
+{
+  unlink_image (im);
+  mach_port_deallocate (mach_task_self (), im->filemap);
+  free (im->interp_name);
+  free (im->hashbang);
+  free (im);
+}
+
+/* Drop the images unused for too long, and the least recently used ones
+   beyond LIMIT.  IMAGE_LOCK must be held.  */
+static void
+prune_images (int limit, time_t t)
+{
+  struct image *im, *next;
+  int i = 0;
+
+  for (im = images; im; im = next)
+    {
+      next = im->next;
+      if (i++ >= limit || t - im->last_use > IMAGE_CACHE_TIMEOUT)
+	drop_image (im);
+    }
+}
+
+static int
+image_matches (const struct image *im, const struct execdata *e)
+{
+  return (im->filemap == e->filemap
+	  && im->fsid == e->fsid
+	  && im->fileid == e->fileid
+	  && im->file_size == e->file_size
+	  && im->mtime.tv_sec == e->mtime.tv_sec
+	  && im->mtime.tv_nsec == e->mtime.tv_nsec);
+}
+
+/* Give E its own copy of the program headers at PHDR, and of the
+   interpreter name NAME.  */
+static error_t
+copy_image (struct execdata *e, const ElfW(Phdr) *phdr, const char *name)
+{
+  size_t size = e->info.elf.phnum * sizeof (ElfW(Phdr));
+
+  e->image_phdr = malloc (size ?: 1);
+  if (! e->image_phdr)
+    return ENOMEM;
+  memcpy (e->image_phdr, phdr, size);
+  e->info.elf.phdr = e->image_phdr;
+
+  if (name)
+    {
+      e->interp_name = strdup (name);
+      if (! e->interp_name)
+	return ENOMEM;
+    }
+  return 0;
+}
+
+int
+image_cache_lookup (struct execdata *e)
+{
+  struct image *im;
+  time_t t;
+
+  if (! e->cacheable)
+    return 0;
+
+  t = now ();
+  pthread_mutex_lock (&image_lock);
+  prune_images (IMAGE_CACHE_SIZE, t);
+  for (im = images; im; im = im->next)
+    if (image_matches (im, e))
+      break;
+  if (! im)
+    {
+      pthread_mutex_unlock (&image_lock);
+      return 0;
+    }
+
+  if (im->hashbang)
+    {
+      /* `check_elf' would fail; leave the line for `check_hashbang',
+	 which reads it from the file if we cannot copy it.  */
+      e->hashbang = malloc (im->hashbang_len);
+      if (e->hashbang)
+	{
+	  memcpy (e->hashbang, im->hashbang, im->hashbang_len);
+	  e->hashbang_len = im->hashbang_len;
+	}
+      e->error = ENOEXEC;
+    }
+  else
+    {
+      e->entry = im->entry;
+      e->info.elf.anywhere = im->anywhere;
+      e->info.elf.loadbase = 0;
+      e->info.elf.phnum = im->phnum;
+      e->info.elf.phdr_addr = im->phdr_addr;
+      e->error = copy_image (e, im->phdr, im->interp_name);
+    }
+
+  im->last_use = t;
+  unlink_image (im);
+  link_image (im);
+  pthread_mutex_unlock (&image_lock);
+
+  return 1;
+}
+
+void
+image_cache_enter (struct execdata *e)
+{
+  const ElfW(Phdr) *phdr;
+  size_t size = e->info.elf.phnum * sizeof (ElfW(Phdr));
+  struct image *im;
+  time_t t;
+
+  if (! e->cacheable)
+    return;
+
+  im = malloc (sizeof *im + size);
+  if (! im)
+    return;
+
+  im->filemap = e->filemap;
+  im->fsid = e->fsid;
+  im->fileid = e->fileid;
+  im->file_size = e->file_size;
+  im->mtime = e->mtime;
+  im->entry = e->entry;
+  im->phdr_addr = e->info.elf.phdr_addr;
+  im->phnum = e->info.elf.phnum;
+  im->anywhere = e->info.elf.anywhere;
+  im->interp_name = NULL;
+  im->hashbang = NULL;
+  /* E's headers are in the mapping window, which `map' may reuse
+     below.  */
+  memcpy (im->phdr, e->info.elf.phdr, size);
+
+  for (phdr = im->phdr; phdr < &im->phdr[im->phnum]; phdr++)
+    if (phdr->p_type == PT_INTERP)
+      {
+	/* Fetch the name as `do_exec' does.  */
+	const char *name = map (e, phdr->p_offset & ~(phdr->p_align - 1),
+				phdr->p_filesz);
+	if (name)
+	  im->interp_name = strndup (name, phdr->p_filesz); /* XXX/fault */
+	if (! im->interp_name)
+	  {
+	    /* Let `do_exec' try again and report the error.  */
+	    e->error = copy_image (e, im->phdr, NULL);
+	    free (im);
+	    return;
+	  }
+	break;
+      }
+
+  e->error = copy_image (e, im->phdr, im->interp_name);
+  if (e->error)
+    {
+      free (im->interp_name);
+      free (im);
+      return;
+    }
+
+  mach_port_mod_refs (mach_task_self (), im->filemap, MACH_PORT_RIGHT_SEND, 1);
+  t = now ();
+  im->last_use = t;
+
+  pthread_mutex_lock (&image_lock);
+  prune_images (IMAGE_CACHE_SIZE - 1, t);
+  link_image (im);
+  pthread_mutex_unlock (&image_lock);
+}
+
+void
+script_cache_enter (struct execdata *e, const char *line, size_t len)
+{
+  struct image *im;
+  time_t t;
+
+  if (! e->cacheable)
+    return;
+
+  im = malloc (sizeof *im);
+  if (! im)
+    return;
+  im->hashbang = malloc (len);
+  if (! im->hashbang)
+    {
+      free (im);
+      return;
+    }
+  memcpy (im->hashbang, line, len);
+  im->hashbang_len = len;
+
+  im->filemap = e->filemap;
+  im->fsid = e->fsid;
+  im->fileid = e->fileid;
+  im->file_size = e->file_size;
+  im->mtime = e->mtime;
+  im->phnum = 0;
+  im->interp_name = NULL;
+
+  mach_port_mod_refs (mach_task_self (), im->filemap, MACH_PORT_RIGHT_SEND, 1);
+  t = now ();
+  im->last_use = t;
+
+  pthread_mutex_lock (&image_lock);
+  prune_images (IMAGE_CACHE_SIZE - 1, t);
+  link_image (im);
+  pthread_mutex_unlock (&image_lock);
+}
@@ -400,6 +400,10 @@ prepare (file_t file, struct execdata *e)
   e->cntlmap = MACH_PORT_NULL;
 
   e->interp.section = NULL;
+  e->cacheable = 0;
+  e->image_phdr = NULL;
+  e->interp_name = NULL;
+  e->hashbang = NULL;
 
   e->start_code = 0;
   e->end_code = 0;
@@ -470,6 +474,11 @@ prepare (file_t file, struct execdata *e)
 	return;
       e->file_size = st.st_size;
       e->optimal_block = st.st_blksize;
+
+      e->cacheable = e->filemap != MACH_PORT_NULL;
+      e->fsid = st.st_fsid;
+      e->fileid = st.st_ino;
+      e->mtime = st.st_mtim;
     }
 }
 
@@ -603,7 +612,12 @@ check_elf_phdr (struct execdata *e, const ElfW(Phdr) *mapped_phdr)
 static void
 check (struct execdata *e)
 {
+  if (image_cache_lookup (e))
+    return;
+
   check_elf (e);		/* XXX/fault */
+  if (! e->error)
+    image_cache_enter (e);
 }
 
 
@@ -655,6 +669,12 @@ finish (struct execdata *e, int dealloc_file)
 	map_buffer (e) = NULL;
       }
     }
+  free (e->image_phdr);
+  e->image_phdr = NULL;
+  free (e->interp_name);
+  e->interp_name = NULL;
+  free (e->hashbang);
+  e->hashbang = NULL;
   if (dealloc_file && e->file != MACH_PORT_NULL)
     {
       mach_port_deallocate (mach_task_self (), e->file);
@@ -1140,9 +1160,9 @@ do_exec (file_t file,
 	 along with this executable.  Find the name of the file and open
 	 it.  */
 
-      char *name = map (&e, (e.interp.phdr->p_offset
-			     & ~(e.interp.phdr->p_align - 1)),
-			e.interp.phdr->p_filesz);
+      char *name = e.interp_name ?: map (&e, (e.interp.phdr->p_offset
+					      & ~(e.interp.phdr->p_align - 1)),
+					 e.interp.phdr->p_filesz);
       if (! name && ! e.error)
 	e.error = ENOEXEC;
 
@@ -1592,6 +1612,58 @@ S_exec_exec_paths (struct trivfs_protid *protid,
 		  destroynames, ndestroynames);
 }
 
+kern_return_t
+S_exec_exec_packed (struct trivfs_protid *protid,
+		    file_t file,
+		    task_t oldtask,
+		    int flags,
+		    const_string_t path,
+		    const_string_t abspath,
+		    const char *argv, mach_msg_type_number_t argvlen,
+		    boolean_t argv_copy,
+		    const char *envp, mach_msg_type_number_t envplen,
+		    boolean_t envp_copy,
+		    int dtablesize,
+		    const mach_port_t *ports, mach_msg_type_number_t nports,
+		    boolean_t ports_copy,
+		    const int *intarray, mach_msg_type_number_t nints,
+		    boolean_t intarray_copy,
+		    const mach_port_t *deallocnames,
+		    mach_msg_type_number_t ndeallocnames,
+		    const mach_port_t *destroynames,
+		    mach_msg_type_number_t ndestroynames)
+{
+  error_t err;
+
+  if (! protid)
+    return EOPNOTSUPP;
+
+  if (dtablesize < 0 || dtablesize > nports)
+    return EINVAL;
+
+  /* BOOT keeps the dtable where it is, while do_exec copies the
+     portarray; so it is told the portarray need not be freed, which
+     is done here for the pages of it past the dtable.  */
+  err = do_exec (file, oldtask, flags, path, abspath,
+		 (char *) argv, argvlen, argv_copy,
+		 (char *) envp, envplen, envp_copy,
+		 (mach_port_t *) ports, dtablesize, ports_copy,
+		 (mach_port_t *) ports + dtablesize, nports - dtablesize, 1,
+		 (int *) intarray, nints, intarray_copy,
+		 deallocnames, ndeallocnames,
+		 destroynames, ndestroynames);
+
+  if (! err && ! ports_copy)
+    {
+      vm_address_t start = round_page ((vm_address_t) (ports + dtablesize));
+      vm_address_t end = round_page ((vm_address_t) (ports + nports));
+      if (end > start)
+	munmap ((void *) start, end - start);
+    }
+
+  return err;
+}
+
 kern_return_t
 S_exec_setexecdata (struct trivfs_protid *protid,
 		    const mach_port_t *ports, mach_msg_type_number_t nports, int ports_copy,
@@ -140,38 +140,50 @@ check_hashbang (struct execdata *e,
   char interp_buf[vm_page_size - 2 + 1];
 
   e->error = 0;
-  page = map (e, 0, 2);
-
-  if (!page)
+  if (e->hashbang)
     {
-      if (!e->error)
-	e->error = ENOEXEC;
-      return;
+      /* The image cache knew the line.  */
+      interp_len = e->hashbang_len;
+      memcpy (interp_buf, e->hashbang, interp_len);
     }
-
-  /* Check for our ``magic number''--"#!".  */
-  if (page[0] != '#' || page[1] != '!')
+  else
     {
-      /* These are not the droids we're looking for.  */
-      e->error = ENOEXEC;
-      return;
-    }
+      page = map (e, 0, 2);
 
-  /* Read the rest of the first line of the file.
-     We in fact impose an arbitrary limit of about a page on this.  */
+      if (!page)
+	{
+	  if (!e->error)
+	    e->error = ENOEXEC;
+	  return;
+	}
 
-  p = memccpy (interp_buf, page + 2, '\n',
-	       MIN (map_fsize (e) - 2, sizeof interp_buf));
-  if (p == NULL)
-    {
-      /* The first line went on for more than sizeof INTERP_BUF!  */
-      interp_len = sizeof interp_buf;
-      interp_buf[interp_len - 1] = '\0';
-    }
-  else
-    {
-      interp_len = p - interp_buf; /* Includes null terminator.  */
-      *--p = '\0';		/* Kill the newline.  */
+      /* Check for our ``magic number''--"#!".  */
+      if (page[0] != '#' || page[1] != '!')
+	{
+	  /* These are not the droids we're looking for.  */
+	  e->error = ENOEXEC;
+	  return;
+	}
+
+      /* Read the rest of the first line of the file.
+	 We in fact impose an arbitrary limit of about a page on this.  */
+
+      p = memccpy (interp_buf, page + 2, '\n',
+		   MIN (map_fsize (e) - 2, sizeof interp_buf));
+      if (p == NULL)
+	{
+	  /* The first line went on for more than sizeof INTERP_BUF!  */
+	  interp_len = sizeof interp_buf;
+	  interp_buf[interp_len - 1] = '\0';
+	}
+      else
+	{
+	  interp_len = p - interp_buf; /* Includes null terminator.  */
+	  *--p = '\0';		/* Kill the newline.  */
+	}
+
+      /* Save reading and checking the file the next time.  */
+      script_cache_enter (e, interp_buf, interp_len);
     }
 
   /* We are now done reading the script file.  */
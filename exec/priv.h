@@ -102,6 +102,16 @@ struct execdata
     off_t file_size;
     size_t optimal_block;	/* Optimal size for io_read from file.  */
 
+    /* Set by prepare, for the image cache.  */
+    int cacheable;		/* Nonzero if the following identify FILE.  */
+    fsid_t fsid;
+    ino_t fileid;
+    struct timespec mtime;
+    ElfW(Phdr) *image_phdr;	/* Malloc'd program headers, if any.  */
+    char *interp_name;		/* Malloc'd interpreter name, if known.  */
+    char *hashbang;		/* Malloc'd #! line, if known.  */
+    size_t hashbang_len;	/* Including its null.  */
+
     /* Set by caller of load.  */
     task_t task;
 
@@ -132,6 +142,21 @@ void finish (struct execdata *, int dealloc_file_port);
 void *map (struct execdata *e, off_t posn, size_t len);
 
 
+/* Fill in E as `check_elf' would from the image cache, and return
+   nonzero, if E's file is in there.  */
+int image_cache_lookup (struct execdata *e);
+
+/* Enter in the image cache what `check_elf' found for E.  Either way,
+   E's program headers are then in E->image_phdr.  */
+void image_cache_enter (struct execdata *e);
+
+/* Enter in the image cache that E is a #! script whose first line,
+   after the `#!', is the LEN bytes at LINE, which end with a null.
+   `image_cache_lookup' then fails E with ENOEXEC, giving it a copy of
+   the line in E->hashbang.  */
+void script_cache_enter (struct execdata *e, const char *line, size_t len);
+
+
 void check_hashbang (struct execdata *e,
 		     file_t file,
 		     task_t oldtask,
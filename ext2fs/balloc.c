@@ -41,6 +41,8 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <trace.h>
 #include "ext2fs.h"
 #include "bitmap.c"
 
@@ -54,6 +56,249 @@ memscan (void *buf, unsigned char ch, size_t len)
 
 #define in_range(b, first, len) ((b) >= (first) && (b) <= (first) + (len) - 1)
 
+/* Each group's block bitmap and free blocks count are protected by the
+   group's lock, so that writers working in different groups don't
+   contend.  */
+static pthread_mutex_t *group_locks;
+static unsigned long group_locks_count;
+
+/* For each group, a bit below which every block of the group is known
+   to be allocated, protected by the group's lock.  Searching a group
+   from its start begins there, so that on a nearly full volume each
+   allocation does not walk the same full front of the bitmap again.  */
+static uint32_t *group_first_free;
+
+/* Changes to the superblock's free blocks count that have not been
+   folded into SBLOCK yet.  Each thread adds to its own stripe so that
+   concurrent writers seldom touch the same cache line.  */
+#define FREE_BLOCKS_STRIPES	16
+static struct
+{
+  long delta;
+} __attribute__ ((aligned (64))) free_blocks_delta[FREE_BLOCKS_STRIPES];
+
+static unsigned int next_stripe;
+static __thread int alloc_stripe = -1;
+
+void
+ext2_balloc_init (void)
+{
+  if (group_locks_count != groups_count)
+    {
+      free (group_locks);
+      free (group_first_free);
+      group_locks = malloc (groups_count * sizeof *group_locks);
+      group_first_free = malloc (groups_count * sizeof *group_first_free);
+      if (! group_locks || ! group_first_free)
+	ext2_panic ("can't allocate block group locks");
+      for (unsigned long i = 0; i < groups_count; i++)
+	pthread_mutex_init (&group_locks[i], NULL);
+      group_locks_count = groups_count;
+    }
+
+  /* SBLOCK was just read, so anything pending is stale.  */
+  for (int i = 0; i < FREE_BLOCKS_STRIPES; i++)
+    free_blocks_delta[i].delta = 0;
+  memset (group_first_free, 0, groups_count * sizeof *group_first_free);
+}
+
+/* Add DELTA to the free blocks count.  */
+static void
+free_blocks_add (long delta)
+{
+  if (alloc_stripe < 0)
+    alloc_stripe = (__atomic_fetch_add (&next_stripe, 1, __ATOMIC_RELAXED)
+		    % FREE_BLOCKS_STRIPES);
+  __atomic_add_fetch (&free_blocks_delta[alloc_stripe].delta, delta,
+		      __ATOMIC_RELAXED);
+}
+
+/* Return the free blocks count, including changes not folded in yet.  */
+static long
+free_blocks_now (void)
+{
+  long count = le32toh (sblock->s_free_blocks_count);
+
+  for (int i = 0; i < FREE_BLOCKS_STRIPES; i++)
+    count += __atomic_load_n (&free_blocks_delta[i].delta, __ATOMIC_RELAXED);
+  return count;
+}
+
+static inline int
+test_root (int a, int b)
+{
+  if (a == 0)
+    return 1;
+  while (1)
+    {
+      if (a == 1)
+	return 1;
+      if (a % b)
+	return 0;
+      a = a / b;
+    }
+}
+
+/* True if GROUP holds a copy of the superblock and the descriptors.  */
+static inline int
+group_has_super (int group)
+{
+  return (!EXT2_HAS_RO_COMPAT_FEATURE (sblock,
+				       EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)
+	  || test_root (group, 3) || test_root (group, 5)
+	  || test_root (group, 7));
+}
+
+/* True if BLOCK belongs to GROUP; with flex_bg, a group's bitmaps and
+   inode table may be in another.  */
+static inline int
+block_in_group (block_t block, unsigned long group)
+{
+  return ((block - le32toh (sblock->s_first_data_block))
+	  / le32toh (sblock->s_blocks_per_group)) == group;
+}
+
+/* Fill in BH, the block bitmap of group GROUP with descriptor GDP,
+   which mke2fs left uninitialized because nothing but the group's own
+   metadata was allocated in it.  The group's lock is held.  */
+static void
+init_block_bitmap (unsigned long group, struct ext2_group_desc *gdp,
+		   unsigned char *bh)
+{
+  unsigned long blocks_per_group = le32toh (sblock->s_blocks_per_group);
+  block_t first = group * blocks_per_group
+    + le32toh (sblock->s_first_data_block);
+  unsigned long bits = blocks_per_group, i;
+
+  ext2_debug ("initializing block bitmap of group %lu", group);
+
+  memset (bh, 0, block_size);
+
+  if (group_has_super (group))
+    for (i = 0; i < 1 + db_per_group + le16toh (sblock->s_reserved_gdt_blocks);
+	 i++)
+      set_bit (i, bh);
+
+  if (block_in_group (le32toh (gdp->bg_block_bitmap), group))
+    set_bit (le32toh (gdp->bg_block_bitmap) - first, bh);
+  if (block_in_group (le32toh (gdp->bg_inode_bitmap), group))
+    set_bit (le32toh (gdp->bg_inode_bitmap) - first, bh);
+  for (i = 0; i < itb_per_group; i++)
+    if (block_in_group (le32toh (gdp->bg_inode_table) + i, group))
+      set_bit (le32toh (gdp->bg_inode_table) + i - first, bh);
+
+  /* The last group may be short; the blocks past the end of the
+     filesystem, and the bits past the end of the group, stay in use.  */
+  if (first + bits > le32toh (sblock->s_blocks_count))
+    bits = le32toh (sblock->s_blocks_count) - first;
+  for (i = bits; i < block_size * 8; i++)
+    set_bit (i, bh);
+
+  disk_cache_block_ref_ptr (bh);
+  record_global_poke (bh);
+
+  gdp->bg_flags &= htole16 (~EXT4_BG_BLOCK_UNINIT);
+  ext2_group_desc_csum_set (group, gdp);
+  disk_cache_block_ref_ptr (gdp);
+  record_global_poke (gdp);
+}
+
+/* True if the group with descriptor GDP has no block bitmap on disk
+   yet.  */
+static inline int
+block_bitmap_uninit (struct ext2_group_desc *gdp)
+{
+  return (EXT2_HAS_GDT_CSUM (sblock)
+	  && (gdp->bg_flags & htole16 (EXT4_BG_BLOCK_UNINIT)));
+}
+
+/* Make sure BH, the block bitmap of group GROUP with descriptor GDP,
+   is initialized.  The group's lock is held.  */
+static inline void
+block_bitmap_ready (unsigned long group, struct ext2_group_desc *gdp,
+		    unsigned char *bh)
+{
+  if (block_bitmap_uninit (gdp))
+    init_block_bitmap (group, gdp, bh);
+}
+
+/* Blocks promised to delayed allocations (see delalloc.c), which other
+   allocations must leave alone.  */
+static unsigned long reserved_blocks;
+static pthread_spinlock_t reserved_blocks_lock = PTHREAD_SPINLOCK_INITIALIZER;
+
+/* Room kept free for the indirect blocks that allocating N reserved
+   blocks may need.  */
+#define RESERVE_SLACK(n)	((n) / addr_per_block + 3)
+
+error_t
+ext2_reserve_blocks (unsigned long count)
+{
+  error_t err;
+  int drained = 0;
+
+ retry:
+  err = 0;
+  pthread_spin_lock (&reserved_blocks_lock);
+  if (free_blocks_now () - (long) (reserved_blocks + count)
+      < (long) RESERVE_SLACK (reserved_blocks + count))
+    err = ENOSPC;
+  else
+    reserved_blocks += count;
+  pthread_spin_unlock (&reserved_blocks_lock);
+
+  if (err && ! drained && ext2_drain_deferred_frees ())
+    {
+      drained = 1;
+      goto retry;
+    }
+
+  return err;
+}
+
+void
+ext2_unreserve_blocks (unsigned long count)
+{
+  pthread_spin_lock (&reserved_blocks_lock);
+  assert_backtrace (reserved_blocks >= count);
+  reserved_blocks -= count;
+  pthread_spin_unlock (&reserved_blocks_lock);
+}
+
+unsigned long
+ext2_count_reserved_blocks (void)
+{
+  return __atomic_load_n (&reserved_blocks, __ATOMIC_RELAXED);
+}
+
+/* Set while the calling thread fills a reservation; see
+   ext2_use_reserved_blocks.  */
+static __thread int using_reserved;
+
+void
+ext2_use_reserved_blocks (int on)
+{
+  using_reserved = on;
+}
+
+void
+ext2_sync_free_blocks_count (void)
+{
+  long delta = 0;
+
+  for (int i = 0; i < FREE_BLOCKS_STRIPES; i++)
+    delta += __atomic_exchange_n (&free_blocks_delta[i].delta, 0,
+				  __ATOMIC_RELAXED);
+  if (delta == 0)
+    return;
+
+  pthread_spin_lock (&global_lock);
+  sblock->s_free_blocks_count =
+    htole32 (le32toh (sblock->s_free_blocks_count) + delta);
+  sblock_dirty = 1;
+  pthread_spin_unlock (&global_lock);
+}
+
 void
 ext2_free_blocks (block_t block, unsigned long count)
 {
@@ -67,22 +312,22 @@ ext2_free_blocks (block_t block, unsigned long count)
   assert_backtrace (block >= group_desc_block_end
 		 && block + count <= store->size >> log2_block_size);
 
-  pthread_spin_lock (&global_lock);
-
   if (block < le32toh (sblock->s_first_data_block) ||
       (block + count) > le32toh (sblock->s_blocks_count))
     {
       ext2_error ("freeing blocks not in datazone - "
 		  "block = %u, count = %lu", block, count);
-      pthread_spin_unlock (&global_lock);
       return;
     }
 
   ext2_debug ("freeing block %u[%lu]", block, count);
 
+  ext2_discard_note (block, count);
+
   do
     {
       unsigned long int gcount = count;
+      long freed = 0;
 
       block_group = ((block - le32toh (sblock->s_first_data_block)) /
 		     le32toh (sblock->s_blocks_per_group));
@@ -103,6 +348,8 @@ ext2_free_blocks (block_t block, unsigned long count)
 	}
       gdp = group_desc (block_group);
       bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
+      pthread_mutex_lock (&group_locks[block_group]);
+      block_bitmap_ready (block_group, gdp, bh);
 
       if (in_range (le32toh (gdp->bg_block_bitmap), block, gcount) ||
 	  in_range (le32toh (gdp->bg_inode_bitmap), block, gcount) ||
@@ -117,13 +364,16 @@ ext2_free_blocks (block_t block, unsigned long count)
 	  if (!clear_bit (bit + i, bh))
 	    ext2_warning ("bit already cleared for block %lu", block + i);
 	  else
-	    {
-	      gdp->bg_free_blocks_count =
-		htole16 (le16toh (gdp->bg_free_blocks_count) + 1);
-	      sblock->s_free_blocks_count =
-		htole32 (le32toh (sblock->s_free_blocks_count) + 1);
-	    }
+	    freed++;
 	}
+      if (bit < group_first_free[block_group])
+	group_first_free[block_group] = bit;
+      gdp->bg_free_blocks_count =
+	htole16 (le16toh (gdp->bg_free_blocks_count) + freed);
+      ext2_group_desc_csum_set (block_group, gdp);
+
+      pthread_mutex_unlock (&group_locks[block_group]);
+      free_blocks_add (freed);
 
       record_global_poke (bh);
       disk_cache_block_ref_ptr (gdp);
@@ -133,48 +383,281 @@ ext2_free_blocks (block_t block, unsigned long count)
       count -= gcount;
     } while (count > 0);
 
-  sblock_dirty = 1;
+  alloc_sync (0);
+}
 
-  pthread_spin_unlock (&global_lock);
+error_t
+ext2_discard_free_blocks (block_t block, unsigned long count)
+{
+  unsigned char *bh;
+  unsigned long block_group, bit, i, start;
+  struct ext2_group_desc *gdp;
+  error_t err = 0;
 
-  alloc_sync (0);
+  while (count > 0 && ! err)
+    {
+      unsigned long gcount = count;
+
+      block_group = ((block - le32toh (sblock->s_first_data_block)) /
+		     le32toh (sblock->s_blocks_per_group));
+      bit = (block - le32toh (sblock->s_first_data_block)) %
+		     le32toh (sblock->s_blocks_per_group);
+      if (bit + gcount > le32toh (sblock->s_blocks_per_group))
+	gcount = le32toh (sblock->s_blocks_per_group) - bit;
+
+      gdp = group_desc (block_group);
+      bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
+      pthread_mutex_lock (&group_locks[block_group]);
+
+      /* Only the parts still free are discarded; the group's lock keeps
+	 them so until the device is done.  */
+      if (! block_bitmap_uninit (gdp))
+	for (i = 0; i < gcount && ! err; )
+	  {
+	    if (test_bit (bit + i, bh))
+	      {
+		i++;
+		continue;
+	      }
+	    for (start = i; i < gcount && ! test_bit (bit + i, bh); i++)
+	      ;
+	    err = store_discard (store,
+				 (store_offset_t) (block + start)
+				 << log2_dev_blocks_per_fs_block,
+				 (store_offset_t) (i - start) << log2_block_size);
+	  }
+
+      pthread_mutex_unlock (&group_locks[block_group]);
+      disk_cache_block_deref (bh);
+
+      block += gcount;
+      count -= gcount;
+    }
+
+  return err;
+}
+
+/* Big truncations leave the blocks they unmap to a thread, which frees
+   them a batch at a time, so that deleting a large file does not keep
+   the caller waiting on every block bitmap it touches.  The blocks are
+   no longer in any file, so a crash before they are freed only leaves
+   them marked in use until the next fsck.  Allocations that find no
+   space wait for the queue to drain before giving up.  */
+
+/* Runs handed to ext2_free_blocks at a time.  */
+#define DEFERRED_BATCH 64
+
+struct deferred_run
+{
+  block_t block;
+  unsigned long count;
+};
+
+static pthread_mutex_t deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferred_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t deferred_done = PTHREAD_COND_INITIALIZER;
+static struct deferred_run *deferred_runs;
+static size_t deferred_runs_count, deferred_runs_alloced;
+static int deferred_thread_started;
+
+/* Batches being freed.  */
+static int deferred_in_flight;
+
+/* Blocks queued or in flight; changed with DEFERRED_LOCK held.  */
+static unsigned long deferred_blocks;
+
+/* Move up to DEFERRED_BATCH runs off the queue into BATCH, and return
+   how many.  DEFERRED_LOCK is held.  */
+static int
+deferred_take (struct deferred_run *batch)
+{
+  int n = 0;
+
+  while (n < DEFERRED_BATCH && deferred_runs_count > 0)
+    batch[n++] = deferred_runs[--deferred_runs_count];
+  if (n)
+    deferred_in_flight++;
+  return n;
+}
+
+/* Free the N runs in BATCH taken by deferred_take.  DEFERRED_LOCK is
+   held, but released meanwhile.  */
+static void
+deferred_free (struct deferred_run *batch, int n)
+{
+  unsigned long freed = 0;
+  error_t err;
+  int i;
+
+  pthread_mutex_unlock (&deferred_lock);
+  err = diskfs_catch_exception ();
+  if (! err)
+    {
+      for (i = 0; i < n; i++)
+	ext2_free_blocks (batch[i].block, batch[i].count);
+      diskfs_end_catch_exception ();
+    }
+  else
+    ext2_warning ("cannot free blocks of truncated files: %s",
+		  strerror (err));
+  for (i = 0; i < n; i++)
+    freed += batch[i].count;
+  pthread_mutex_lock (&deferred_lock);
+
+  __atomic_sub_fetch (&deferred_blocks, freed, __ATOMIC_RELAXED);
+  deferred_in_flight--;
+  pthread_cond_broadcast (&deferred_done);
+}
+
+static void *
+deferred_thread (void *arg)
+{
+  struct deferred_run batch[DEFERRED_BATCH];
+  int n;
+
+  pthread_mutex_lock (&deferred_lock);
+  for (;;)
+    {
+      while (! deferred_runs_count)
+	pthread_cond_wait (&deferred_wakeup, &deferred_lock);
+      pthread_mutex_unlock (&deferred_lock);
+
+      /* Keep the filesystem from being made read-only under us; that
+	 syncs, which drains the queue first.  */
+      pthread_rwlock_rdlock (&diskfs_fsys_lock);
+      pthread_mutex_lock (&deferred_lock);
+      n = deferred_take (batch);
+      if (n)
+	deferred_free (batch, n);
+      pthread_mutex_unlock (&deferred_lock);
+      pthread_rwlock_unlock (&diskfs_fsys_lock);
+
+      pthread_mutex_lock (&deferred_lock);
+    }
+
+  return NULL;
+}
+
+void
+ext2_free_blocks_deferred (block_t block, unsigned long count)
+{
+  struct deferred_run *last;
+
+  pthread_mutex_lock (&deferred_lock);
+
+  if (! deferred_thread_started)
+    {
+      pthread_t thread;
+      error_t err = pthread_create (&thread, NULL, deferred_thread, NULL);
+      if (! err)
+	{
+	  pthread_detach (thread);
+	  deferred_thread_started = 1;
+	}
+    }
+
+  last = deferred_runs_count ? &deferred_runs[deferred_runs_count - 1] : NULL;
+  if (last && last->block + last->count == block)
+    last->count += count;
+  else
+    {
+      if (deferred_runs_count == deferred_runs_alloced
+	  && deferred_thread_started)
+	{
+	  size_t alloced = deferred_runs_alloced * 2 ?: 256;
+	  void *new = realloc (deferred_runs, alloced * sizeof *deferred_runs);
+	  if (new)
+	    {
+	      deferred_runs = new;
+	      deferred_runs_alloced = alloced;
+	    }
+	}
+      if (deferred_runs_count == deferred_runs_alloced)
+	{
+	  /* No room, or no thread: free them now.  */
+	  pthread_mutex_unlock (&deferred_lock);
+	  ext2_free_blocks (block, count);
+	  return;
+	}
+      deferred_runs[deferred_runs_count].block = block;
+      deferred_runs[deferred_runs_count].count = count;
+      deferred_runs_count++;
+    }
+
+  __atomic_add_fetch (&deferred_blocks, count, __ATOMIC_RELAXED);
+  pthread_cond_signal (&deferred_wakeup);
+  pthread_mutex_unlock (&deferred_lock);
+}
+
+int
+ext2_drain_deferred_frees (void)
+{
+  struct deferred_run batch[DEFERRED_BATCH];
+  int n;
+
+  pthread_mutex_lock (&deferred_lock);
+  if (! deferred_blocks)
+    {
+      pthread_mutex_unlock (&deferred_lock);
+      return 0;
+    }
+
+  while ((n = deferred_take (batch)) > 0)
+    deferred_free (batch, n);
+  while (deferred_in_flight)
+    pthread_cond_wait (&deferred_done, &deferred_lock);
+
+  pthread_mutex_unlock (&deferred_lock);
+  return 1;
+}
+
+unsigned long
+ext2_count_deferred_blocks (void)
+{
+  return __atomic_load_n (&deferred_blocks, __ATOMIC_RELAXED);
 }
 
 /*
- * ext2_new_block uses a goal block to assist allocation.  If the goal is
+ * new_block uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within
  * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
+ * bitmap, and then for any free bit if that fails.  Groups another thread is
+ * busy allocating in are passed over on a first pass, so that concurrent
+ * writers spread out instead of queueing on one group.
  */
-block_t
-ext2_new_block (block_t goal,
-		block_t prealloc_goal,
-		block_t *prealloc_count, block_t *prealloc_block)
+static block_t
+new_block (block_t goal,
+	   block_t prealloc_goal,
+	   block_t *prealloc_count, block_t *prealloc_block)
 {
   unsigned char *bh = NULL;
   unsigned char *p, *r;
   int i, j, k, tmp;
   uint32_t lmap;
   struct ext2_group_desc *gdp;
+  long allocated;
+  int start, pass;
 
 #ifdef EXT2FS_DEBUG
   static int goal_hits = 0, goal_attempts = 0;
 #endif
 
-  pthread_spin_lock (&global_lock);
-
 #ifdef XXX /* Auth check to use reserved blocks  */
   if (le32toh (sblock->s_free_blocks_count) <= le32toh (sblock->s_r_blocks_count) &&
       (!fsuser () && (sb->u.ext2_sb.s_resuid != current->fsuid) &&
        (sb->u.ext2_sb.s_resgid == 0 ||
 	!in_group_p (sb->u.ext2_sb.s_resgid))))
-    {
-      pthread_spin_unlock (&global_lock);
-      return 0;
-    }
+    return 0;
 #endif
 
+  /* Blocks reserved for delayed allocations are spoken for.  Filling a
+     reservation takes one of them while it is still counted here; any
+     other allocation must leave them all.  */
+  if (free_blocks_now () - (long) ext2_count_reserved_blocks ()
+      < (using_reserved ? 0 : 1))
+    return 0;
+
   ext2_debug ("goal=%u", goal);
 
 repeat:
@@ -197,6 +680,8 @@ repeat:
 	goal_attempts++;
 #endif
       bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
+      pthread_mutex_lock (&group_locks[i]);
+      block_bitmap_ready (i, gdp, bh);
 
       ext2_debug ("goal is at %d:%d", i, j);
 
@@ -264,6 +749,7 @@ repeat:
 	  goto got_block;
 	}
 
+      pthread_mutex_unlock (&group_locks[i]);
       disk_cache_block_deref (bh);
       bh = NULL;
     }
@@ -272,37 +758,57 @@ repeat:
 
   /*
      * Now search the rest of the groups.  We assume that
-     * i and gdp correctly point to the last group visited.
+     * i and gdp correctly point to the last group visited.  The first
+     * pass skips groups whose lock is taken.
    */
-  for (k = 0; k < groups_count; k++)
+  start = i;
+  for (pass = 0; pass < 2; pass++)
     {
-      i++;
-      if (i >= groups_count)
-	i = 0;
-      gdp = group_desc (i);
-      if (le16toh (gdp->bg_free_blocks_count) > 0)
+      i = start;
+      for (k = 0; k < groups_count; k++)
+	{
+	  i++;
+	  if (i >= groups_count)
+	    i = 0;
+	  gdp = group_desc (i);
+	  if (le16toh (gdp->bg_free_blocks_count) == 0)
+	    continue;
+	  if (pass == 0)
+	    {
+	      if (pthread_mutex_trylock (&group_locks[i]))
+		continue;
+	    }
+	  else
+	    pthread_mutex_lock (&group_locks[i]);
+	  if (le16toh (gdp->bg_free_blocks_count) > 0)
+	    break;
+	  pthread_mutex_unlock (&group_locks[i]);
+	}
+      if (k < groups_count)
 	break;
     }
-  if (k >= groups_count)
-    {
-      pthread_spin_unlock (&global_lock);
-      return 0;
-    }
+  if (pass == 2)
+    return 0;
   assert_backtrace (bh == NULL);
   bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
-  r = memscan (bh, 0, le32toh (sblock->s_blocks_per_group) >> 3);
+  block_bitmap_ready (i, gdp, bh);
+  k = group_first_free[i];
+  r = memscan (bh + (k >> 3), 0,
+	       (le32toh (sblock->s_blocks_per_group) >> 3) - (k >> 3));
   j = (r - bh) << 3;
   if (j < le32toh (sblock->s_blocks_per_group))
     goto search_back;
   else
-    j = find_first_zero_bit ((uint32_t *) bh,
-			     le32toh (sblock->s_blocks_per_group));
+    j = find_next_zero_bit ((uint32_t *) bh,
+			    le32toh (sblock->s_blocks_per_group), k);
+  /* J is now the first free bit of the group.  */
+  group_first_free[i] = j;
   if (j >= le32toh (sblock->s_blocks_per_group))
     {
+      pthread_mutex_unlock (&group_locks[i]);
       disk_cache_block_deref (bh);
       bh = NULL;
       ext2_error ("free blocks count corrupted for block group %d", i);
-      pthread_spin_unlock (&global_lock);
       return 0;
     }
 
@@ -331,10 +837,12 @@ got_block:
   if (set_bit (j, bh))
     {
       ext2_warning ("bit already set for block %d", j);
+      pthread_mutex_unlock (&group_locks[i]);
       disk_cache_block_deref (bh);
       bh = NULL;
       goto repeat;
     }
+  allocated = 1;
 
   /* Since due to bletcherousness block-modified bits are never turned off
      when writing disk-pager pages, make sure they are here, in case this
@@ -373,8 +881,7 @@ got_block:
 	}
       gdp->bg_free_blocks_count = htole16 (le16toh (gdp->bg_free_blocks_count) - 
 	  *prealloc_count);
-      sblock->s_free_blocks_count = htole32 (le32toh (sblock->s_free_blocks_count) -
-	  *prealloc_count);
+      allocated += *prealloc_count;
       ext2_debug ("preallocated a further %u bits", *prealloc_count);
     }
 #endif
@@ -387,6 +894,9 @@ got_block:
   if (j >= le32toh (sblock->s_blocks_count))
     {
       ext2_error ("block >= blocks count - block_group = %d, block=%d", i, j);
+      ext2_group_desc_csum_set (i, gdp);
+      pthread_mutex_unlock (&group_locks[i]);
+      free_blocks_add (1 - allocated);
       j = 0;
       goto sync_out;
     }
@@ -395,15 +905,15 @@ got_block:
 	      j, goal_hits, goal_attempts);
 
   gdp->bg_free_blocks_count = htole16 (le16toh (gdp->bg_free_blocks_count) - 1);
+  ext2_group_desc_csum_set (i, gdp);
+  pthread_mutex_unlock (&group_locks[i]);
   disk_cache_block_ref_ptr (gdp);
   record_global_poke (gdp);
 
-  sblock->s_free_blocks_count = htole32 (le32toh (sblock->s_free_blocks_count) - 1);
-  sblock_dirty = 1;
+  free_blocks_add (-allocated);
 
  sync_out:
   assert_backtrace (bh == NULL);
-  pthread_spin_unlock (&global_lock);
   alloc_sync (0);
 
   /* Trap trying to allocate superblock, block group descriptor table, or beyond the end */
@@ -414,9 +924,26 @@ got_block:
   return j;
 }
 
+block_t
+ext2_new_block (block_t goal,
+		block_t prealloc_goal,
+		block_t *prealloc_count, block_t *prealloc_block)
+{
+  block_t block = new_block (goal, prealloc_goal,
+			     prealloc_count, prealloc_block);
+
+  /* Blocks still waiting to be freed count as free space.  */
+  if (! block && ext2_drain_deferred_frees ())
+    block = new_block (goal, prealloc_goal, prealloc_count, prealloc_block);
+  TRACE (TRACE_EXT2_ALLOC_BLOCK, block, goal);
+  return block;
+}
+
 unsigned long
 ext2_count_free_blocks (void)
 {
+  ext2_sync_free_blocks_count ();
+
 #ifdef EXT2FS_DEBUG
   unsigned long desc_count, bitmap_count, x;
   struct ext2_group_desc *gdp;
@@ -431,9 +958,17 @@ ext2_count_free_blocks (void)
     {
       void *bh;
       gdp = group_desc (i);
-      desc_count += le16toh (gdp->bg_free_blocks_count);
+      if (block_bitmap_uninit (gdp))
+	{
+	  desc_count += le16toh (gdp->bg_free_blocks_count);
+	  bitmap_count += le16toh (gdp->bg_free_blocks_count);
+	  continue;
+	}
       bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
+      pthread_mutex_lock (&group_locks[i]);
+      desc_count += le16toh (gdp->bg_free_blocks_count);
       x = count_free (bh, block_size);
+      pthread_mutex_unlock (&group_locks[i]);
       disk_cache_block_deref (bh);
       printf ("group %d: stored = %d, counted = %lu",
 	      i, le16toh (gdp->bg_free_blocks_count), x);
@@ -449,11 +984,14 @@ ext2_count_free_blocks (void)
 #endif
 }
 
+/* True if BLOCK is marked in use in MAP, the bitmap of GROUP; blocks
+   of other groups are not checked.  */
 static inline int
-block_in_use (block_t block, unsigned char *map)
+block_in_use (block_t block, unsigned long group, unsigned char *map)
 {
-  return test_bit ((block - le32toh (sblock->s_first_data_block)) %
-		   le32toh (sblock->s_blocks_per_group), map);
+  return (! block_in_group (block, group)
+	  || test_bit ((block - le32toh (sblock->s_first_data_block)) %
+		       le32toh (sblock->s_blocks_per_group), map));
 }
 
 void
@@ -465,6 +1003,8 @@ ext2_check_blocks_bitmap (void)
   struct ext2_group_desc *gdp;
   int i, j;
 
+  ext2_sync_free_blocks_count ();
+
   pthread_spin_lock (&global_lock);
 
   desc_count = 0;
@@ -475,32 +1015,19 @@ ext2_check_blocks_bitmap (void)
 
   for (i = 0; i < groups_count; i++)
     {
-      inline int test_root (int a, int b)
-	{
-	  if (a == 0)
-	    return 1;
-	  while (1)
-	    {
-	      if (a == 1)
-		return 1;
-	      if (a % b)
-		return 0;
-	      a = a / b;
-	    }
-	}
-      inline int ext2_group_sparse (int group)
+      gdp = group_desc (i);
+      desc_count += le16toh (gdp->bg_free_blocks_count);
+      if (block_bitmap_uninit (gdp))
 	{
-	  return (test_root (group, 3) || test_root (group, 5)
-		  || test_root (group, 7));
+	  /* There is no bitmap to check until the group is used.  */
+	  bitmap_count += le16toh (gdp->bg_free_blocks_count);
+	  continue;
 	}
 
-      gdp = group_desc (i);
-      desc_count += le16toh (gdp->bg_free_blocks_count);
       bh = disk_cache_block_ref (le32toh (gdp->bg_block_bitmap));
+      pthread_mutex_lock (&group_locks[i]);
 
-      if (!EXT2_HAS_RO_COMPAT_FEATURE (sblock,
-				       EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)
-	  || ext2_group_sparse (i))
+      if (group_has_super (i))
 	{
 	  if (!test_bit (0, bh))
 	    ext2_error ("superblock in group %d is marked free", i);
@@ -511,22 +1038,23 @@ ext2_check_blocks_bitmap (void)
 			  j, i);
 	}
 
-      if (!block_in_use (le32toh (gdp->bg_block_bitmap), bh))
+      if (!block_in_use (le32toh (gdp->bg_block_bitmap), i, bh))
 	ext2_error ("block bitmap for group %d is marked free", i);
 
-      if (!block_in_use (le32toh (gdp->bg_inode_bitmap), bh))
+      if (!block_in_use (le32toh (gdp->bg_inode_bitmap), i, bh))
 	ext2_error ("inode bitmap for group %d is marked free", i);
 
       for (j = 0; j < itb_per_group; j++)
-	if (!block_in_use (le32toh (gdp->bg_inode_table) + j, bh))
+	if (!block_in_use (le32toh (gdp->bg_inode_table) + j, i, bh))
 	  ext2_error ("block #%d of the inode table in group %d is marked free", j, i);
 
       x = count_free (bh, block_size);
-      disk_cache_block_deref (bh);
       if (le16toh (gdp->bg_free_blocks_count) != x)
 	ext2_error ("wrong free blocks count for group %d,"
 		    " stored = %d, counted = %lu",
 		    i, le16toh (gdp->bg_free_blocks_count), x);
+      pthread_mutex_unlock (&group_locks[i]);
+      disk_cache_block_deref (bh);
       bitmap_count += x;
     }
   if (le32toh (sblock->s_free_blocks_count) != bitmap_count)
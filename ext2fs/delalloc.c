@@ -0,0 +1,226 @@
+/* Delayed block allocation for regular files
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* When a page of a regular file is made writable, its missing blocks
+   are only reserved: the free blocks count is charged for them, but no
+   bitmap is touched.  The blocks are allocated when the pager writes the
+   page out, and then the whole run of reserved blocks around it is
+   allocated in file order, so that a file written in small appends
+   still ends up in long extents.
+
+   A node's reservations are kept as a sorted array of disjoint runs of
+   file blocks.  Everything here is done with the node's ALLOC_LOCK held
+   for writing.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ext2fs.h"
+
+/* At most this many blocks are allocated at once beyond the one the
+   pager needs.  */
+#define DELALLOC_MAX_RUN 1024
+
+/* Return the index of the first run of DN that ends after BLOCK.  */
+static int
+run_after (struct disknode *dn, block_t block)
+{
+  int lo = 0, hi = dn->delalloc_runs;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      struct delalloc_run *run = &dn->delalloc[mid];
+      if (run->start + run->len <= block)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Make room for a new run at index I of DN.  */
+static error_t
+run_insert (struct disknode *dn, int i)
+{
+  if (dn->delalloc_runs == dn->delalloc_alloced)
+    {
+      int n = dn->delalloc_alloced ? 2 * dn->delalloc_alloced : 4;
+      struct delalloc_run *new = realloc (dn->delalloc, n * sizeof *new);
+      if (! new)
+	return ENOMEM;
+      dn->delalloc = new;
+      dn->delalloc_alloced = n;
+    }
+  memmove (&dn->delalloc[i + 1], &dn->delalloc[i],
+	   (dn->delalloc_runs - i) * sizeof *dn->delalloc);
+  dn->delalloc_runs++;
+  return 0;
+}
+
+/* Remove run I of DN.  */
+static void
+run_remove (struct disknode *dn, int i)
+{
+  dn->delalloc_runs--;
+  memmove (&dn->delalloc[i], &dn->delalloc[i + 1],
+	   (dn->delalloc_runs - i) * sizeof *dn->delalloc);
+}
+
+int
+ext2_delalloc_reserved (struct node *node, block_t block)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int i = run_after (dn, block);
+
+  return i < dn->delalloc_runs && dn->delalloc[i].start <= block;
+}
+
+error_t
+ext2_delalloc_reserve (struct node *node, block_t block)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int i = run_after (dn, block);
+  int next = i < dn->delalloc_runs;
+  error_t err;
+
+  if (next && dn->delalloc[i].start <= block)
+    return 0;
+
+  err = ext2_reserve_blocks (1);
+  if (err)
+    return err;
+
+  if (i > 0 && dn->delalloc[i - 1].start + dn->delalloc[i - 1].len == block)
+    {
+      /* Extend the run before; the common case of appending.  */
+      dn->delalloc[i - 1].len++;
+      if (next && dn->delalloc[i].start == block + 1)
+	{
+	  dn->delalloc[i - 1].len += dn->delalloc[i].len;
+	  run_remove (dn, i);
+	}
+    }
+  else if (next && dn->delalloc[i].start == block + 1)
+    {
+      dn->delalloc[i].start--;
+      dn->delalloc[i].len++;
+    }
+  else
+    {
+      err = run_insert (dn, i);
+      if (err)
+	{
+	  ext2_unreserve_blocks (1);
+	  return err;
+	}
+      dn->delalloc[i].start = block;
+      dn->delalloc[i].len = 1;
+    }
+
+  __atomic_add_fetch (&dn->delalloc_blocks, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* Forget the reservation of the first COUNT blocks of run I of DN.  */
+static void
+unreserve_front (struct disknode *dn, int i, block_t count)
+{
+  struct delalloc_run *run = &dn->delalloc[i];
+
+  assert_backtrace (count <= run->len);
+  if (run->len == count)
+    run_remove (dn, i);
+  else
+    {
+      run->start += count;
+      run->len -= count;
+    }
+
+  ext2_unreserve_blocks (count);
+  __atomic_sub_fetch (&dn->delalloc_blocks, count, __ATOMIC_RELAXED);
+}
+
+error_t
+ext2_delalloc_allocate (struct node *node, block_t block)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int i = run_after (dn, block);
+  block_t first, end, b;
+  error_t err = 0;
+
+  if (i == dn->delalloc_runs || dn->delalloc[i].start > block)
+    return 0;
+
+  /* Allocate from the start of the run, so that the blocks are in file
+     order on disk, up to BLOCK and somewhat past it.  */
+  first = dn->delalloc[i].start;
+  end = first + dn->delalloc[i].len;
+  if (end > block + DELALLOC_MAX_RUN)
+    end = block + DELALLOC_MAX_RUN;
+
+  /* ext2_new_block keeps the reserved blocks for their owners, so each
+     block's reservation goes as soon as it is allocated; otherwise the
+     blocks already allocated would still count against the free ones,
+     and the rest of the run could fail with ENOSPC.  */
+  for (b = first; b < end; b++)
+    {
+      block_t disk_block;
+      ext2_use_reserved_blocks (1);
+      err = ext2_getblk (node, b, 1, &disk_block);
+      ext2_use_reserved_blocks (0);
+      if (err)
+	break;
+      unreserve_front (dn, i, 1);
+    }
+
+  return err;
+}
+
+void
+ext2_delalloc_truncate (struct node *node, block_t end)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int i = run_after (dn, end);
+  block_t count = 0;
+
+  if (i < dn->delalloc_runs && dn->delalloc[i].start < end)
+    {
+      /* Keep the part of this run before END.  */
+      struct delalloc_run *run = &dn->delalloc[i];
+      count += run->start + run->len - end;
+      run->len = end - run->start;
+      i++;
+    }
+
+  for (int j = i; j < dn->delalloc_runs; j++)
+    count += dn->delalloc[j].len;
+  dn->delalloc_runs = i;
+
+  if (count)
+    {
+      ext2_unreserve_blocks (count);
+      __atomic_sub_fetch (&dn->delalloc_blocks, count, __ATOMIC_RELAXED);
+    }
+
+  if (dn->delalloc_runs == 0)
+    {
+      free (dn->delalloc);
+      dn->delalloc = NULL;
+      dn->delalloc_alloced = 0;
+    }
+}
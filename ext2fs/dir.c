@@ -89,6 +89,10 @@ struct dirstat
   /* For stat COMPRESS, this is the number of bytes needed to be copied
      in order to undertake the compression. */
   size_t nbytes;
+
+  /* If the lookup went through the directory's hash index, the way it
+     took; otherwise DX.LEVELS is -1.  */
+  struct ext2_dx_path dx;
 };
 
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -152,6 +156,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   vm_address_t blockaddr;
   int idx, lastidx;
   int looped;
+  int dot;
 
   if ((type == REMOVE) || (type == RENAME))
     assert_backtrace (npp);
@@ -177,6 +182,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
       ds->type = LOOKUP;
       ds->mapbuf = 0;
       ds->mapextent = 0;
+      ds->dx.levels = -1;
     }
   if (buf)
     {
@@ -205,9 +211,63 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 
   diskfs_set_node_atime (dp);
 
-  /* Start the lookup at diskfs_node_disknode (DP)->dir_idx.  */
+  dot = (namelen <= 2 && name[0] == '.' && (namelen == 1 || name[1] == '.'));
+  if (EXT2_DX_ENABLED (dp) && !dot)
+    {
+      struct ext2_dx_path dx;
+
+      /* Only the leaves the index points to can hold NAME.  If the index
+	 is unusable, fall back to scanning every block.  */
+      if (ext2_dx_find (dp, buf, name, namelen, &dx) == 0)
+	{
+	  do
+	    {
+	      idx = dx.leaf;
+	      err = dirscanblock (buf + idx * DIRBLKSIZ, dp, idx, name, namelen,
+				  type, ds, &inum);
+	    }
+	  while (err == ENOENT && ext2_dx_next (dp, buf, &dx));
+
+	  if (err && err != ENOENT)
+	    {
+	      munmap ((caddr_t) buf, buflen);
+	      return err;
+	    }
+	  if (ds)
+	    ds->dx = dx;
+	  goto scanned;
+	}
+    }
+  else if (!EXT2_DX_ENABLED (dp) && ext2_dirhash_build (dp, buf))
+    {
+      size_t cursor = 0;
+
+      /* Only the blocks the name table gives can hold NAME; a new entry
+	 goes into the first block with room for it.  */
+      err = ENOENT;
+      while (err == ENOENT
+	     && (idx = ext2_dirhash_lookup (dp, name, namelen, &cursor)) >= 0)
+	err = dirscanblock (buf + idx * DIRBLKSIZ, dp, idx, name, namelen,
+			    type, ds, &inum);
+
+      if (err == ENOENT && ds && ds->stat == LOOKING
+	  && (idx = ext2_dirhash_find_room (dp, EXT2_DIR_REC_LEN (namelen))) >= 0)
+	dirscanblock (buf + idx * DIRBLKSIZ, dp, idx, name, namelen,
+		      type, ds, &inum);
+
+      if (err && err != ENOENT)
+	{
+	  munmap ((caddr_t) buf, buflen);
+	  return err;
+	}
+      goto scanned;
+    }
+
+  /* Start the lookup at diskfs_node_disknode (DP)->dir_idx; "." and
+     ".." of an indexed directory are always in block 0.  */
   idx = diskfs_node_disknode (dp)->dir_idx;
-  if (idx * DIRBLKSIZ > dp->dn_stat.st_size)
+  if (idx * DIRBLKSIZ > dp->dn_stat.st_size
+      || (dot && EXT2_DX_ENABLED (dp)))
     idx = 0;			/* just in case */
   blockaddr = buf + idx * DIRBLKSIZ;
   looped = (idx == 0);
@@ -240,6 +300,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 	}
     }
 
+ scanned:
   diskfs_set_node_atime (dp);
   if (diskfs_synchronous)
     diskfs_node_update (dp, 1);
@@ -519,6 +580,34 @@ dirscanblock (vm_address_t blockaddr, struct node *dp, int idx,
   return 0;
 }
 
+/* Make sure DS maps at least EXTRA bytes past the end of DP, which may
+   have grown since the lookup.  */
+static error_t
+dirstat_map_extra (struct node *dp, struct dirstat *ds, vm_size_t extra)
+{
+  vm_size_t len = round_page (dp->dn_stat.st_size + extra);
+  memory_object_t memobj;
+  vm_address_t buf = 0;
+  error_t err;
+
+  if (ds->mapextent >= len)
+    return 0;
+
+  memobj = diskfs_get_filemap (dp, VM_PROT_READ | VM_PROT_WRITE);
+  if (memobj == MACH_PORT_NULL)
+    return errno;
+  err = vm_map (mach_task_self (), &buf, len, 0, 1, memobj, 0, 0,
+		VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE, 0);
+  mach_port_deallocate (mach_task_self (), memobj);
+  if (err)
+    return err;
+
+  munmap ((caddr_t) ds->mapbuf, ds->mapextent);
+  ds->mapbuf = buf;
+  ds->mapextent = len;
+  return 0;
+}
+
 /* Following a lookup call for CREATE, this adds a node to a directory.
    DP is the directory to be modified; NAME is the name to be entered;
    NP is the node being linked in; DS is the cached information returned
@@ -544,6 +633,57 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
 
   dp->dn_set_mtime = 1;
 
+  if (ds->stat == EXTEND
+      && (ds->dx.levels >= 0
+	  || (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX)
+	      && !(diskfs_node_disknode (dp)->info.i_flags & EXT2_INDEX_FL)
+	      && dp->dn_stat.st_size == DIRBLKSIZ)))
+    {
+      /* Rather than appending a block no lookup would find, split the
+	 leaf NAME hashes to, first indexing the directory if it is about
+	 to outgrow its first block.  */
+      ino_t inum;
+
+      /* The entry counts would go stale as blocks are added or split.  */
+      free (diskfs_node_disknode (dp)->dirents);
+      diskfs_node_disknode (dp)->dirents = 0;
+
+      err = dirstat_map_extra (dp, ds, 2 * DIRBLKSIZ);
+      if (!err && ds->dx.levels < 0)
+	err = ext2_dx_create (dp, ds->mapbuf, name, namelen, &ds->dx, cred);
+      if (!err)
+	{
+	  ds->stat = LOOKING;
+	  dirscanblock (ds->mapbuf + ds->dx.leaf * DIRBLKSIZ, dp,
+			ds->dx.leaf, name, namelen, CREATE, ds, &inum);
+	  if (ds->stat == LOOKING)
+	    {
+	      err = ext2_dx_split (dp, ds->mapbuf, &ds->dx, cred);
+	      free (diskfs_node_disknode (dp)->dirents);
+	      diskfs_node_disknode (dp)->dirents = 0;
+	      if (!err)
+		dirscanblock (ds->mapbuf + ds->dx.leaf * DIRBLKSIZ, dp,
+			      ds->dx.leaf, name, namelen, CREATE, ds, &inum);
+	    }
+	}
+
+      if (err || ds->stat == LOOKING)
+	{
+	  /* Append to the directory unindexed after all.  */
+	  free (diskfs_node_disknode (dp)->dirents);
+	  diskfs_node_disknode (dp)->dirents = 0;
+	  ds->dx.levels = -1;
+	  ds->stat = EXTEND;
+	  ds->idx = dp->dn_stat.st_size / DIRBLKSIZ;
+	  err = dirstat_map_extra (dp, ds, DIRBLKSIZ);
+	  if (err)
+	    {
+	      munmap ((caddr_t) ds->mapbuf, ds->mapextent);
+	      return err;
+	    }
+	}
+    }
+
   /* Select a location for the new directory entry.  Each branch of this
      switch is responsible for setting NEW to point to the on-disk
      directory entry being written, and setting NEW->rec_len appropriately.  */
@@ -664,10 +804,19 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
   new->name_len = namelen;
   memcpy (new->name, name, namelen);
 
-  /* Mark the directory inode has having been written.  */
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+  /* An entry placed without the index invalidates it.  */
+  if (ds->dx.levels < 0)
+    diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_INDEX_FL;
   dp->dn_set_mtime = 1;
 
+  if (ds->dx.levels >= 0)
+    ext2_dirhash_drop (dp);
+  else if (diskfs_node_disknode (dp)->dirhash)
+    {
+      ext2_dirhash_add (dp, name, namelen, ds->idx);
+      ext2_dirhash_block_changed (dp, ds->mapbuf, ds->idx);
+    }
+
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
   if (ds->stat != EXTEND)
@@ -733,7 +882,12 @@ diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
     }
 
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+
+  if (diskfs_node_disknode (dp)->dirhash)
+    {
+      ext2_dirhash_remove (dp, ds->entry->name, ds->entry->name_len, ds->idx);
+      ext2_dirhash_block_changed (dp, ds->mapbuf, ds->idx);
+    }
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -765,7 +919,6 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np, struct dirstat *ds)
 
   ds->entry->inode = htole32 (np->cache_id);
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -0,0 +1,448 @@
+/* In-memory name tables for large unindexed directories
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Finding a name in a directory without an htree index means scanning
+   every block of it, and so does finding that the name is not there.
+   For a directory of DIRHASH_MIN_BLOCKS blocks or more, the first lookup
+   instead builds a table from the hash of each name to the block holding
+   it, along with the free space in each block.  Later lookups scan only
+   the blocks the table gives for their name, and creations go straight
+   to a block with room.  direnter and dirremove keep the table up to
+   date; dirrewrite changes neither names nor free space.
+
+   Everything here is done with the directory locked, except that the
+   tables are also reachable from a global list so that, once together
+   they take more than ext2_dirhash_max bytes, those not used lately can
+   be dropped.  DIRHASH_LOCK protects the list and may be taken with a
+   directory locked; a directory's lock is then only ever tried.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ext2fs.h"
+
+/* Directories smaller than this many blocks are scanned as before.  */
+#define DIRHASH_MIN_BLOCKS 8
+
+/* How much memory all tables together may use.  */
+size_t ext2_dirhash_max = 8 << 20;
+
+/* A name with hash HASH is in directory block BLOCK.  */
+struct dirhash_slot
+{
+  uint32_t hash;
+  uint32_t block;
+};
+
+/* Values of BLOCK in slots holding no name.  */
+#define SLOT_EMPTY ((uint32_t) -1)
+#define SLOT_DELETED ((uint32_t) -2)
+
+struct dirhash
+{
+  /* The directory, and its neighbours on the global list.  */
+  struct node *dp;
+  struct dirhash *prev, *next;
+
+  /* Set by every use, cleared when the table is passed over for
+     dropping.  */
+  int referenced;
+
+  /* An open-addressed table of NSLOTS slots, a power of two.  USED of
+     them are not empty, LIVE of those hold names.  */
+  struct dirhash_slot *slots;
+  size_t nslots, used, live;
+
+  /* The free bytes in each of the NBLOCKS directory blocks, with room
+     for BLKALLOC.  */
+  uint32_t *blkfree;
+  size_t nblocks, blkalloc;
+
+  /* Memory this table is accounted for.  */
+  size_t bytes;
+};
+
+static pthread_mutex_t dirhash_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dirhash *dirhash_list;
+static size_t dirhash_bytes;
+
+/* FNV-1a.  */
+static uint32_t
+name_hash (const char *name, size_t len)
+{
+  uint32_t hash = 2166136261u;
+
+  while (len--)
+    hash = (hash ^ (unsigned char) *name++) * 16777619;
+  return hash;
+}
+
+static size_t
+dirhash_size (struct dirhash *dh)
+{
+  return (sizeof *dh + dh->nslots * sizeof *dh->slots
+	  + dh->blkalloc * sizeof *dh->blkfree);
+}
+
+/* Free DH.  DIRHASH_LOCK is held and, if DH is on the list, DH->dp is
+   locked.  */
+static void
+dirhash_free (struct dirhash *dh)
+{
+  if (dh->prev || dirhash_list == dh)
+    {
+      if (dh->prev)
+	dh->prev->next = dh->next;
+      else
+	dirhash_list = dh->next;
+      if (dh->next)
+	dh->next->prev = dh->prev;
+      dirhash_bytes -= dh->bytes;
+    }
+  diskfs_node_disknode (dh->dp)->dirhash = 0;
+  free (dh->slots);
+  free (dh->blkfree);
+  free (dh);
+}
+
+/* Drop tables other than KEEP until all fit in ext2_dirhash_max, first
+   those not used since they were last passed over.  Return whether they
+   now fit.  DIRHASH_LOCK is held.  */
+static int
+dirhash_trim (struct dirhash *keep)
+{
+  struct dirhash *dh, *next;
+  int pass;
+
+  for (pass = 0; pass < 2 && dirhash_bytes > ext2_dirhash_max; pass++)
+    for (dh = dirhash_list; dh && dirhash_bytes > ext2_dirhash_max; dh = next)
+      {
+	struct node *np = dh->dp;
+
+	next = dh->next;
+	if (dh == keep)
+	  continue;
+	if (pass == 0 && dh->referenced)
+	  {
+	    dh->referenced = 0;
+	    continue;
+	  }
+	if (pthread_mutex_trylock (&np->lock))
+	  continue;
+	dirhash_free (dh);
+	pthread_mutex_unlock (&np->lock);
+      }
+
+  return dirhash_bytes <= ext2_dirhash_max;
+}
+
+/* Account for DH's current size, making room by dropping other tables,
+   or DH itself if that fails.  */
+static void
+dirhash_account (struct dirhash *dh)
+{
+  size_t bytes = dirhash_size (dh);
+
+  pthread_mutex_lock (&dirhash_lock);
+  dirhash_bytes += bytes - dh->bytes;
+  dh->bytes = bytes;
+  if (! dirhash_trim (dh))
+    dirhash_free (dh);
+  pthread_mutex_unlock (&dirhash_lock);
+}
+
+/* Enter HASH for BLOCK into DH, which has a free slot.  */
+static void
+slot_insert (struct dirhash *dh, uint32_t hash, uint32_t block)
+{
+  size_t mask = dh->nslots - 1;
+  size_t i;
+
+  for (i = hash & mask; dh->slots[i].block != SLOT_EMPTY
+	 && dh->slots[i].block != SLOT_DELETED; i = (i + 1) & mask)
+    ;
+  if (dh->slots[i].block == SLOT_EMPTY)
+    dh->used++;
+  dh->slots[i].hash = hash;
+  dh->slots[i].block = block;
+  dh->live++;
+}
+
+/* Make sure DH has room for one more name, keeping it at most three
+   quarters full.  Return false if memory runs out.  */
+static int
+slots_reserve (struct dirhash *dh)
+{
+  struct dirhash_slot *old = dh->slots;
+  size_t oldn = dh->nslots;
+  size_t n, i;
+
+  if ((dh->used + 1) * 4 <= dh->nslots * 3)
+    return 1;
+
+  /* Grow unless most used slots are just deleted ones.  */
+  n = oldn ?: 64;
+  while ((dh->live + 1) * 2 > n)
+    n *= 2;
+
+  dh->slots = malloc (n * sizeof *dh->slots);
+  if (! dh->slots)
+    {
+      dh->slots = old;
+      return 0;
+    }
+  memset (dh->slots, 0xff, n * sizeof *dh->slots);
+  dh->nslots = n;
+  dh->used = dh->live = 0;
+  for (i = 0; i < oldn; i++)
+    if (old[i].block != SLOT_EMPTY && old[i].block != SLOT_DELETED)
+      slot_insert (dh, old[i].hash, old[i].block);
+  free (old);
+  return 1;
+}
+
+/* Return the free bytes in the directory block at BLOCKADDR, or -1 if its
+   entries look wrong.  */
+static long
+block_free (vm_address_t blockaddr)
+{
+  vm_address_t off;
+  long nfree = 0;
+
+  for (off = blockaddr; off < blockaddr + DIRBLKSIZ; )
+    {
+      struct ext2_dir_entry_2 *entry = (struct ext2_dir_entry_2 *) off;
+      size_t reclen = le16toh (entry->rec_len);
+
+      if (reclen == 0 || reclen % EXT2_DIR_PAD
+	  || off + reclen > blockaddr + DIRBLKSIZ
+	  || EXT2_DIR_REC_LEN (entry->name_len) > reclen)
+	return -1;
+
+      if (le32toh (entry->inode) == 0)
+	nfree += reclen;
+      else
+	nfree += reclen - EXT2_DIR_REC_LEN (entry->name_len);
+      off += reclen;
+    }
+  return nfree;
+}
+
+void
+ext2_dirhash_drop (struct node *dp)
+{
+  struct disknode *dn = diskfs_node_disknode (dp);
+
+  /* DP need not be locked when it is going away, so look again once
+     nobody else can drop the table.  */
+  if (dn->dirhash)
+    {
+      pthread_mutex_lock (&dirhash_lock);
+      if (dn->dirhash)
+	dirhash_free (dn->dirhash);
+      pthread_mutex_unlock (&dirhash_lock);
+    }
+}
+
+int
+ext2_dirhash_build (struct node *dp, vm_address_t buf)
+{
+  struct disknode *dn = diskfs_node_disknode (dp);
+  size_t nblocks = dp->dn_stat.st_size / DIRBLKSIZ;
+  struct dirhash *dh;
+  size_t b;
+
+  if (dn->dirhash)
+    return 1;
+  if (nblocks < DIRHASH_MIN_BLOCKS || nblocks >= SLOT_DELETED)
+    return 0;
+
+  dh = calloc (1, sizeof *dh);
+  if (! dh)
+    return 0;
+  dh->dp = dp;
+  dh->blkalloc = nblocks;
+  dh->blkfree = malloc (nblocks * sizeof *dh->blkfree);
+  if (! dh->blkfree || ! slots_reserve (dh))
+    {
+      free (dh->blkfree);
+      free (dh);
+      return 0;
+    }
+
+  for (b = 0; b < nblocks; b++)
+    {
+      vm_address_t blockaddr = buf + b * DIRBLKSIZ;
+      vm_address_t off;
+      long nfree = block_free (blockaddr);
+
+      if (nfree < 0)
+	{
+	  /* Leave damaged directories to the plain scan, which
+	     complains about them.  */
+	  free (dh->slots);
+	  free (dh->blkfree);
+	  free (dh);
+	  return 0;
+	}
+      dh->blkfree[b] = nfree;
+
+      for (off = blockaddr; off < blockaddr + DIRBLKSIZ;
+	   off += le16toh (((struct ext2_dir_entry_2 *) off)->rec_len))
+	{
+	  struct ext2_dir_entry_2 *entry = (struct ext2_dir_entry_2 *) off;
+
+	  if (le32toh (entry->inode) == 0)
+	    continue;
+	  if (! slots_reserve (dh))
+	    {
+	      free (dh->slots);
+	      free (dh->blkfree);
+	      free (dh);
+	      return 0;
+	    }
+	  slot_insert (dh, name_hash (entry->name, entry->name_len), b);
+	}
+    }
+  dh->nblocks = nblocks;
+  dh->referenced = 1;
+
+  pthread_mutex_lock (&dirhash_lock);
+  dh->next = dirhash_list;
+  if (dirhash_list)
+    dirhash_list->prev = dh;
+  dirhash_list = dh;
+  dn->dirhash = dh;
+  pthread_mutex_unlock (&dirhash_lock);
+  dirhash_account (dh);
+
+  return dn->dirhash != 0;
+}
+
+int
+ext2_dirhash_lookup (struct node *dp, const char *name, size_t namelen,
+		     size_t *cursor)
+{
+  struct dirhash *dh = diskfs_node_disknode (dp)->dirhash;
+  uint32_t hash = name_hash (name, namelen);
+  size_t mask = dh->nslots - 1;
+  size_t k;
+
+  dh->referenced = 1;
+  for (k = *cursor; ; k++)
+    {
+      struct dirhash_slot *slot = &dh->slots[(hash + k) & mask];
+
+      if (slot->block == SLOT_EMPTY)
+	return -1;
+      if (slot->block != SLOT_DELETED && slot->hash == hash)
+	{
+	  *cursor = k + 1;
+	  return slot->block;
+	}
+    }
+}
+
+int
+ext2_dirhash_find_room (struct node *dp, size_t needed)
+{
+  struct dirhash *dh = diskfs_node_disknode (dp)->dirhash;
+  size_t b;
+
+  for (b = 0; b < dh->nblocks; b++)
+    if (dh->blkfree[b] >= needed)
+      return b;
+  return -1;
+}
+
+void
+ext2_dirhash_add (struct node *dp, const char *name, size_t namelen,
+		  int block)
+{
+  struct dirhash *dh = diskfs_node_disknode (dp)->dirhash;
+  size_t oldn;
+
+  if (! dh)
+    return;
+  oldn = dh->nslots;
+  if (! slots_reserve (dh))
+    {
+      ext2_dirhash_drop (dp);
+      return;
+    }
+  slot_insert (dh, name_hash (name, namelen), block);
+  if (dh->nslots != oldn)
+    dirhash_account (dh);
+}
+
+void
+ext2_dirhash_remove (struct node *dp, const char *name, size_t namelen,
+		     int block)
+{
+  struct dirhash *dh = diskfs_node_disknode (dp)->dirhash;
+  uint32_t hash = name_hash (name, namelen);
+  size_t mask, i;
+
+  if (! dh)
+    return;
+  mask = dh->nslots - 1;
+  for (i = hash & mask; dh->slots[i].block != SLOT_EMPTY; i = (i + 1) & mask)
+    if (dh->slots[i].block == block && dh->slots[i].hash == hash)
+      {
+	dh->slots[i].block = SLOT_DELETED;
+	dh->live--;
+	return;
+      }
+
+  /* The table has lost track of the directory somehow.  */
+  ext2_dirhash_drop (dp);
+}
+
+void
+ext2_dirhash_block_changed (struct node *dp, vm_address_t buf, int block)
+{
+  struct dirhash *dh = diskfs_node_disknode (dp)->dirhash;
+  long nfree;
+
+  if (! dh)
+    return;
+  if (block >= dh->blkalloc)
+    {
+      size_t n = dh->blkalloc * 2 > block ? dh->blkalloc * 2 : block + 1;
+      uint32_t *blkfree = realloc (dh->blkfree, n * sizeof *blkfree);
+
+      if (! blkfree)
+	{
+	  ext2_dirhash_drop (dp);
+	  return;
+	}
+      dh->blkfree = blkfree;
+      dh->blkalloc = n;
+      dirhash_account (dh);
+      if (! diskfs_node_disknode (dp)->dirhash)
+	return;
+    }
+
+  while (dh->nblocks <= block)
+    dh->blkfree[dh->nblocks++] = 0;
+
+  nfree = block_free (buf + block * DIRBLKSIZ);
+  if (nfree < 0)
+    ext2_dirhash_drop (dp);
+  else
+    dh->blkfree[block] = nfree;
+}
@@ -0,0 +1,236 @@
+/* Telling the device about freed blocks
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* With --discard, ext2_free_blocks notes here each run it frees.  A
+   run may only be discarded once the disk no longer says it is in use:
+   until then a crash would bring back the file that had it, without its
+   data.  So each run is stamped with the current epoch; a sync starts a
+   new one, and once a waited-for sync is done, the runs of the epochs
+   before it are sorted, merged, and passed to a thread.  That thread
+   discards whatever of them is still free, a group at a time with the
+   group locked, so that nothing is allocated and written there while
+   the device drops it.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ext2fs.h"
+
+/* Nonzero if freed blocks are to be discarded.  */
+int use_discard;
+
+/* Runs noted at most, so that memory stays bounded if no waited-for
+   sync comes; later runs are not discarded.  */
+#define DISCARD_MAX_RUNS 65536
+
+struct discard_run
+{
+  block_t block;
+  unsigned long count;
+  uint64_t epoch;
+};
+
+/* A growable list of runs.  */
+struct discard_list
+{
+  struct discard_run *runs;
+  size_t count, alloced;
+};
+
+static pthread_mutex_t discard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t discard_wakeup = PTHREAD_COND_INITIALIZER;
+static int discard_thread_started;
+
+/* Runs not known to be free on disk yet, and runs for the thread.  */
+static struct discard_list pending, ready;
+
+static uint64_t discard_epoch;
+
+/* Append the run (BLOCK, COUNT, EPOCH) to LIST, or join it to the last
+   one.  Return zero if there was no room.  DISCARD_LOCK is held.  */
+static int
+list_add (struct discard_list *list, block_t block, unsigned long count,
+	  uint64_t epoch)
+{
+  struct discard_run *last = list->count ? &list->runs[list->count - 1] : 0;
+
+  if (last && last->epoch == epoch && last->block + last->count == block)
+    {
+      last->count += count;
+      return 1;
+    }
+
+  if (list->count == list->alloced)
+    {
+      size_t alloced = list->alloced * 2 ?: 256;
+      void *new;
+
+      if (alloced > DISCARD_MAX_RUNS)
+	return 0;
+      new = realloc (list->runs, alloced * sizeof *list->runs);
+      if (! new)
+	return 0;
+      list->runs = new;
+      list->alloced = alloced;
+    }
+
+  list->runs[list->count].block = block;
+  list->runs[list->count].count = count;
+  list->runs[list->count].epoch = epoch;
+  list->count++;
+  return 1;
+}
+
+static int
+run_cmp (const void *a, const void *b)
+{
+  const struct discard_run *ra = a, *rb = b;
+  return ra->block < rb->block ? -1 : ra->block > rb->block;
+}
+
+/* Discard the runs of LIST, which the caller owns, and empty it.  */
+static void
+discard_list (struct discard_list *list)
+{
+  size_t i, n = 0;
+  error_t err = 0;
+
+  /* Sort and merge the runs, so that neighbouring frees make one
+     request, and a block freed twice is only discarded once.  */
+  qsort (list->runs, list->count, sizeof *list->runs, run_cmp);
+  for (i = 0; i < list->count; i++)
+    {
+      struct discard_run *run = &list->runs[i];
+      if (n > 0 && run->block <= list->runs[n - 1].block
+				 + list->runs[n - 1].count)
+	{
+	  struct discard_run *last = &list->runs[n - 1];
+	  if (run->block + run->count > last->block + last->count)
+	    last->count = run->block + run->count - last->block;
+	}
+      else
+	list->runs[n++] = *run;
+    }
+
+  for (i = 0; i < n && use_discard; i++)
+    {
+      err = ext2_discard_free_blocks (list->runs[i].block,
+				      list->runs[i].count);
+      if (err == EOPNOTSUPP)
+	{
+	  ext2_warning ("the device can't discard; no longer trying");
+	  use_discard = 0;
+	}
+      else if (err && err != EROFS)
+	ext2_warning ("discarding blocks %u[%lu]: %s",
+		      list->runs[i].block, list->runs[i].count,
+		      strerror (err));
+    }
+
+  list->count = 0;
+}
+
+static void *
+discard_thread (void *arg)
+{
+  struct discard_list work = { 0 };
+
+  pthread_mutex_lock (&discard_lock);
+  for (;;)
+    {
+      struct discard_list tmp;
+
+      while (! ready.count)
+	pthread_cond_wait (&discard_wakeup, &discard_lock);
+
+      /* Take the runs, leaving the emptied list of the last round for
+	 the next.  */
+      tmp = ready;
+      ready = work;
+      work = tmp;
+      pthread_mutex_unlock (&discard_lock);
+
+      /* Keep the filesystem from going read-only under us.  */
+      pthread_rwlock_rdlock (&diskfs_fsys_lock);
+      discard_list (&work);
+      pthread_rwlock_unlock (&diskfs_fsys_lock);
+
+      pthread_mutex_lock (&discard_lock);
+    }
+
+  return NULL;
+}
+
+void
+ext2_discard_note (block_t block, unsigned long count)
+{
+  if (! use_discard)
+    return;
+
+  pthread_mutex_lock (&discard_lock);
+  list_add (&pending, block, count, discard_epoch);
+  pthread_mutex_unlock (&discard_lock);
+}
+
+uint64_t
+ext2_discard_sync_begin (void)
+{
+  uint64_t epoch;
+
+  pthread_mutex_lock (&discard_lock);
+  epoch = discard_epoch++;
+  pthread_mutex_unlock (&discard_lock);
+  return epoch;
+}
+
+void
+ext2_discard_sync_end (uint64_t epoch)
+{
+  size_t i, n = 0;
+
+  pthread_mutex_lock (&discard_lock);
+
+  if (! discard_thread_started && pending.count)
+    {
+      pthread_t thread;
+      error_t err = pthread_create (&thread, NULL, discard_thread, NULL);
+      if (err)
+	{
+	  pthread_mutex_unlock (&discard_lock);
+	  return;
+	}
+      pthread_detach (thread);
+      discard_thread_started = 1;
+    }
+
+  /* Move the runs of EPOCH and before over to the thread, keeping the
+     others in their order.  Runs there is no room for just stay as they
+     are on the device.  */
+  for (i = 0; i < pending.count; i++)
+    {
+      struct discard_run *run = &pending.runs[i];
+      if (run->epoch > epoch)
+	pending.runs[n++] = *run;
+      else
+	list_add (&ready, run->block, run->count, run->epoch);
+    }
+  pending.count = n;
+
+  if (ready.count)
+    pthread_cond_signal (&discard_wakeup);
+  pthread_mutex_unlock (&discard_lock);
+}
@@ -132,10 +132,21 @@ struct ext2_group_desc
 	__u16	bg_free_blocks_count;	/* Free blocks count */
 	__u16	bg_free_inodes_count;	/* Free inodes count */
 	__u16	bg_used_dirs_count;	/* Directories count */
-	__u16	bg_pad;
-	__u32	bg_reserved[3];
+	__u16	bg_flags;		/* EXT4_BG_* flags */
+	__u32	bg_exclude_bitmap;	/* Snapshot exclusion bitmap */
+	__u16	bg_block_bitmap_csum;	/* crc32c of the blocks bitmap */
+	__u16	bg_inode_bitmap_csum;	/* crc32c of the inodes bitmap */
+	__u16	bg_itable_unused;	/* Unused inodes at the table's end */
+	__u16	bg_checksum;		/* crc16 of the descriptor */
 };
 
+/*
+ * Block group flags, valid with EXT4_FEATURE_RO_COMPAT_GDT_CSUM
+ */
+#define EXT4_BG_INODE_UNINIT	0x0001	/* Inode bitmap not initialized */
+#define EXT4_BG_BLOCK_UNINIT	0x0002	/* Block bitmap not initialized */
+#define EXT4_BG_INODE_ZEROED	0x0004	/* Inode table zeroed */
+
 /*
  * Macro-instructions used to manage group descriptors
  */
@@ -170,11 +181,14 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			EXT2_BTREE_FL /* hash-indexed directory */
 #define EXT2_IMAGIC_FL			0x00002000	/* AFS directory */
 #define EXT2_JOURNAL_DATA_FL		0x00004000 /* Reserved for ext3 */
 #define EXT2_NOTAIL_FL			0x00008000	/* file tail should not be merged */
 #define EXT2_DIRSYNC_FL			0x00010000	/* dirsync behaviour (directories only) */
 #define EXT2_TOPDIR_FL			0x00020000	/* Top of directory hierarchies*/
+#define EXT4_EXTENTS_FL			0x00080000 /* Inode uses extents */
+#define EXT4_INLINE_DATA_FL		0x10000000 /* Inode has inline data */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -288,6 +302,61 @@ struct ext2_inode {
 #define i_author	osd2.hurd2.h_i_author
 #define i_mode_high	osd2.hurd2.h_i_mode_high
 
+/*
+ * In inodes larger than EXT2_GOOD_OLD_INODE_SIZE, the fields that follow
+ * struct ext2_inode.  i_extra_isize counts the bytes of them in use; the
+ * rest of the inode may hold extended attributes.
+ */
+struct ext2_inode_extra {
+	__u16	i_extra_isize;
+	__u16	i_checksum_hi;
+	__u32	i_ctime_extra;
+	__u32	i_mtime_extra;
+	__u32	i_atime_extra;
+	__u32	i_crtime;
+	__u32	i_crtime_extra;
+	__u32	i_version_hi;
+	__u32	i_projid;
+};
+
+#define EXT2_INODE_EXTRA(inode) ((struct ext2_inode_extra *) ((inode) + 1))
+
+/*
+ * Structure of an extent tree (for inodes with EXT4_EXTENTS_FL).  The
+ * root node lives in i_block; every other node fills a block.  All
+ * fields are little-endian.
+ */
+struct ext4_extent_header {
+	__u16	eh_magic;	/* EXT4_EXT_MAGIC */
+	__u16	eh_entries;	/* Number of valid entries */
+	__u16	eh_max;		/* Capacity of this node */
+	__u16	eh_depth;	/* Zero for a leaf */
+	__u32	eh_generation;
+};
+
+/* A leaf entry: a run of blocks.  */
+struct ext4_extent {
+	__u32	ee_block;	/* First logical block */
+	__u16	ee_len;		/* Number of blocks */
+	__u16	ee_start_hi;	/* High 16 bits of physical block */
+	__u32	ee_start_lo;	/* Low 32 bits of physical block */
+};
+
+/* An interior entry: the node covering blocks from ei_block on.  */
+struct ext4_extent_idx {
+	__u32	ei_block;	/* First logical block covered */
+	__u32	ei_leaf_lo;	/* Low 32 bits of the child's block */
+	__u16	ei_leaf_hi;	/* High 16 bits of the child's block */
+	__u16	ei_unused;
+};
+
+#define EXT4_EXT_MAGIC		0xf30a
+#define EXT4_EXT_MAX_DEPTH	5
+
+/* An ee_len above this marks an unwritten (preallocated) extent of
+   ee_len - EXT4_EXT_INIT_MAX_LEN blocks, which reads as zeros.  */
+#define EXT4_EXT_INIT_MAX_LEN	(1 << 15)
+
 /*
  * File system states
  */
@@ -393,7 +462,7 @@ struct ext2_super_block {
 	 */
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
-	__u16	s_padding1;
+	__u16	s_reserved_gdt_blocks;	/* Per group table for online growth */
   /*
 	 * Journaling support valid if EXT3_FEATURE_COMPAT_HAS_JOURNAL set.
 	 */
@@ -407,9 +476,23 @@ struct ext2_super_block {
 	__u16	s_reserved_word_pad;
 	__u32	s_default_mount_opts;
 	__u32	s_first_meta_bg; 	/* First metablock block group */
-	__u32	s_reserved[190];	/* Padding to the end of the block */
+	__u32	s_mkfs_time;		/* When the filesystem was created */
+	__u32	s_jnl_blocks[17];	/* Backup of the journal inode */
+	__u32	s_blocks_count_hi;	/* Blocks count, high 32 bits */
+	__u32	s_r_blocks_count_hi;	/* Reserved blocks count, high 32 bits */
+	__u32	s_free_blocks_hi;	/* Free blocks count, high 32 bits */
+	__u16	s_min_extra_isize;	/* All inodes have at least # bytes */
+	__u16	s_want_extra_isize; 	/* New inodes should reserve # bytes */
+	__u32	s_flags;		/* Miscellaneous flags */
+	__u32	s_reserved[167];	/* Padding to the end of the block */
 };
 
+/*
+ * Superblock flags
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001	/* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002	/* Unsigned dirhash in use */
+
 /*
  * Codes for operating systems
  */
@@ -464,6 +547,7 @@ struct ext2_super_block {
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
 #define EXT2_FEATURE_RO_COMPAT_BTREE_DIR	0x0004
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM		0x0010
 #define EXT2_FEATURE_RO_COMPAT_ANY		0xffffffff
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
@@ -471,13 +555,22 @@ struct ext2_super_block {
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
 #define EXT2_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT4_FEATURE_INCOMPAT_EXTENTS		0x0040
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG		0x0200
+#define EXT4_FEATURE_INCOMPAT_INLINE_DATA	0x8000
 #define EXT2_FEATURE_INCOMPAT_ANY		0xffffffff
 
-#define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
-#define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
+#define EXT2_FEATURE_COMPAT_SUPP	(EXT2_FEATURE_COMPAT_EXT_ATTR| \
+					 EXT3_FEATURE_COMPAT_HAS_JOURNAL)
+#define EXT2_FEATURE_INCOMPAT_SUPP	(EXT2_FEATURE_INCOMPAT_FILETYPE| \
+					 EXT3_FEATURE_INCOMPAT_RECOVER| \
+					 EXT4_FEATURE_INCOMPAT_EXTENTS| \
+					 EXT4_FEATURE_INCOMPAT_FLEX_BG| \
+					 EXT4_FEATURE_INCOMPAT_INLINE_DATA)
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
-					 EXT2_FEATURE_RO_COMPAT_BTREE_DIR)
+					 EXT2_FEATURE_RO_COMPAT_BTREE_DIR| \
+					 EXT4_FEATURE_RO_COMPAT_GDT_CSUM)
 #define EXT2_FEATURE_RO_COMPAT_UNSUPPORTED	~EXT2_FEATURE_RO_COMPAT_SUPP
 #define EXT2_FEATURE_INCOMPAT_UNSUPPORTED	~EXT2_FEATURE_INCOMPAT_SUPP
 
@@ -553,6 +646,43 @@ struct ext2_dir_entry_2 {
 					 ~EXT2_DIR_ROUND)
 #define EXT2_MAX_REC_LEN		((1<<16)-1)
 
+/*
+ * Hashed directory index (htree).  Block 0 of an indexed directory
+ * holds "." and "..", the latter spanning the rest of the block;
+ * inside it follow an ext2_dx_root_info and an array of ext2_dx_entry.
+ * Interior index blocks hold one unused entry spanning the block and
+ * then the array.  The hash field of each array's first entry holds
+ * an ext2_dx_countlimit instead.
+ */
+struct ext2_dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;		/* 8 */
+	__u8	indirect_levels;	/* Interior levels below the root */
+	__u8	unused_flags;
+};
+
+struct ext2_dx_entry {
+	__u32	hash;			/* Lowest hash in the block */
+	__u32	block;			/* Directory block */
+};
+
+struct ext2_dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+/*
+ * Directory hash versions.  The unsigned variants are never stored in a
+ * root, but chosen by EXT2_FLAGS_UNSIGNED_HASH in the superblock.
+ */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
 /*
  * second extended file system inode data in memory
  */
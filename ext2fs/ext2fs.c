@@ -97,6 +97,9 @@ int ext2_debug_flag;
 /* Use extended attribute-based translator records.  */
 int use_xattr_translator_records = 1;
 #define NO_XATTR_TRANSLATOR_RECORDS	-1
+#define DISK_CACHE_SIZE_OPT		-2
+#define DISCARD_OPT			-3
+#define NO_DISCARD_OPT			-4
 
 /* Ext2fs-specific options.  */
 static const struct argp_option
@@ -109,6 +112,13 @@ options[] =
   },
   {"no-xattr-translator-records", NO_XATTR_TRANSLATOR_RECORDS, 0, 0,
    "Do not store translator records in extended attributes (legacy)"},
+  {"disk-cache-size", DISK_CACHE_SIZE_OPT, "BLOCKS", 0,
+   "Cache at most BLOCKS metadata blocks (default 65536); at run time"
+   " this cannot exceed the size given at startup"},
+  {"discard", DISCARD_OPT, 0, 0,
+   "Tell the device which blocks are freed, once that is on disk"},
+  {"no-discard", NO_DISCARD_OPT, 0, 0,
+   "Do not tell the device about freed blocks (default)"},
 #ifdef ALTERNATE_SBLOCK
   /* XXX This is not implemented.  */
   {"sblock", 'S', "BLOCKNO", 0,
@@ -127,6 +137,8 @@ parse_opt (int key, char *arg, struct argp_state *state)
   {
     int debug_flag;
     int use_xattr_translator_records;
+    int disk_cache_size;
+    int discard;
 #ifdef ALTERNATE_SBLOCK
     unsigned int sb_block;
 #endif
@@ -140,6 +152,20 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case NO_XATTR_TRANSLATOR_RECORDS:
       values->use_xattr_translator_records = 0;
       break;
+    case DISCARD_OPT:
+      values->discard = 1;
+      break;
+    case NO_DISCARD_OPT:
+      values->discard = 0;
+      break;
+    case DISK_CACHE_SIZE_OPT:
+      values->disk_cache_size = strtol (arg, &arg, 0);
+      if (!arg || *arg != '\0' || values->disk_cache_size < DISK_CACHE_MIN_BLOCKS)
+	{
+	  argp_error (state, "invalid number for --disk-cache-size");
+	  return EINVAL;
+	}
+      break;
 #ifdef ALTERNATE_SBLOCK
     case 'S':
       values->sb_block = strtoul (arg, &arg, 0);
@@ -159,6 +185,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
       state->hook = values;
       memset (values, 0, sizeof *values);
       values->use_xattr_translator_records = use_xattr_translator_records;
+      values->discard = use_discard;
 #ifdef ALTERNATE_SBLOCK
       values->sb_block = SBLOCK_BLOCK;
 #endif
@@ -176,7 +203,16 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
 	}
 
+      if (values->disk_cache_size
+	  && disk_cache_set_max (values->disk_cache_size))
+	{
+	  argp_failure (state, 2, 0,
+			"--disk-cache-size cannot grow the cache at run time");
+	  return EINVAL;
+	}
+
       use_xattr_translator_records = values->use_xattr_translator_records;
+      use_discard = values->discard;
       break;
 
     default:
@@ -197,6 +233,16 @@ diskfs_append_args (char **argz, size_t *argz_len)
   if (!err && !use_xattr_translator_records)
     err = argz_add (argz, argz_len, "--no-xattr-translator-records");
 
+  if (!err && use_discard)
+    err = argz_add (argz, argz_len, "--discard");
+
+  if (!err && disk_cache_max != DISK_CACHE_BLOCKS)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--disk-cache-size=%d", disk_cache_max);
+      err = argz_add (argz, argz_len, buf);
+    }
+
 #ifdef EXT2FS_DEBUG
   if (!err && ext2_debug_flag)
     err = argz_add (argz, argz_len, "--debug");
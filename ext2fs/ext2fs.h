@@ -33,8 +33,10 @@
 #include <pthread.h>
 #include <sys/mman.h>
 #include <endian.h>
+#include <refcount.h>
 
 /* Types used by the ext2 header files.  */
+typedef u_int64_t __u64;
 typedef u_int32_t __u32;
 typedef int32_t   __s32;
 typedef u_int16_t __u16;
@@ -154,6 +156,9 @@ clear_bit (unsigned num, unsigned char *bitmap)
 
 /* ---------------------------------------------------------------- */
 
+/* How many runs of blocks each node remembers the location of.  */
+#define BLOCK_RUN_CACHE_SIZE	4
+
 /* ext2fs specific per-file data.  */
 struct disknode
 {
@@ -161,6 +166,10 @@ struct disknode
      each DIRBLKSIZE piece of the directory. */
   int *dirents;
 
+  /* For a large directory, a table of where its names are; see
+     dirhash.c.  */
+  struct dirhash *dirhash;
+
   /* Lock to lock while fiddling with this inode's block allocation info.  */
   pthread_rwlock_t alloc_lock;
 
@@ -174,12 +183,66 @@ struct disknode
   /* This file's pager.  */
   struct pager *pager;
 
+  /* Once PAGER has been given write access, its place in the list of
+     pagers a sync visits, or NULL; changed with NODE_TO_PAGE_LOCK
+     held.  */
+  struct disknode *wpager_next, **wpager_prevp;
+
   /* True if the last page of the file has been made writable, but is only
      partially allocated.  */
   int last_page_partially_writable;
 
+  /* Sequential read detection: the page a sequential reader would page
+     in next, and how many pages to read ahead of it.  Only a hint, so
+     updated without locking.  */
+  vm_offset_t ra_next;
+  int ra_window;
+
+  /* The POSIX_FADV_* access pattern last given with file_advise.  */
+  int ra_advice;
+
+  /* NODE's extended attributes as last read, or NULL; see xattr.c.  */
+  struct xattr_cache *xattr_cache;
+
+  /* For a directory, the block group its new files were last put in, or
+     -1 if not yet known; see ialloc.c.  */
+  long child_group;
+
+  /* Runs of blocks recently looked up: LEN blocks from logical block LBLK
+     are at disk blocks from PBLK.  Unused entries have LEN zero.  Changes
+     to the block map clear them all.  RUN_CACHE_NEXT is the entry to
+     replace next.  Protected by RUN_CACHE_LOCK rather than ALLOC_LOCK,
+     since lookups hold that only for reading.  */
+  struct block_run
+  {
+    block_t lblk, pblk, len;
+  } run_cache[BLOCK_RUN_CACHE_SIZE];
+  int run_cache_next;
+  pthread_spinlock_t run_cache_lock;
+
   /* Index to start a directory lookup at.  */
   int dir_idx;
+
+  /* Blocks of a regular file made writable but not yet allocated, as
+     DELALLOC_RUNS runs sorted by START with room for DELALLOC_ALLOCED;
+     DELALLOC_BLOCKS is their total.  Protected by ALLOC_LOCK; see
+     delalloc.c.  */
+  struct delalloc_run
+  {
+    block_t start, len;
+  } *delalloc;
+  int delalloc_runs, delalloc_alloced;
+  unsigned long delalloc_blocks;
+
+  /* True once a block in an unwritten extent has been made writable; it
+     is turned into a written one when written out.  Protected by
+     ALLOC_LOCK.  */
+  int unwritten_writable;
+
+  /* For a node with inline data, how many bytes its inode holds: those
+     of i_block and of its system.data attribute.  Protected by
+     ALLOC_LOCK; see inline.c.  */
+  size_t inline_size;
 };
 
 struct user_pager_info
@@ -196,7 +259,11 @@ struct user_pager_info
 /* ---------------------------------------------------------------- */
 /* pager.c */
 
+/* Default size of the disk cache, in blocks.  */
 #define DISK_CACHE_BLOCKS	65536
+/* The cache is never shrunk below this many blocks besides the ones
+   holding the superblock and the group descriptors.  */
+#define DISK_CACHE_MIN_BLOCKS	1024
 
 #include <hurd/diskfs-pager.h>
 
@@ -231,11 +298,19 @@ extern struct store_parsed *store_parsed;
 extern void *disk_cache;
 extern store_offset_t disk_cache_size;
 extern int disk_cache_blocks;
+/* The most blocks the cache may use.  */
+extern int disk_cache_max;
+
+/* Let the disk cache use at most BLOCKS blocks.  Before the disk pager is
+   created this sets the size of the cache mapping; afterwards BLOCKS
+   must fit within it.  */
+error_t disk_cache_set_max (int blocks);
 
 #define DC_INCORE	0x01	/* Not in core.  */
 #define DC_UNTOUCHED	0x02	/* Not touched by disk_pager_read_paged
 				   or disk_cache_block_ref.  */
 #define DC_FIXED	0x04	/* Must not be re-associated.  */
+#define DC_REFERENCED	0x08	/* Used again since the last sweep.  */
 
 /* Flags that forbid re-association of page.  DC_UNTOUCHED is included
    because this flag is used only when page is already to be
@@ -249,26 +324,50 @@ extern int disk_cache_blocks;
 #define DISK_CACHE_LAST_READ_XOR	0xDEADBEEF
 #endif
 
-/* Disk cache blocks' meta info.  */
+/* Disk cache blocks' meta info.  BLOCK and FLAGS are protected by the
+   lock of shard SHARD; REF_COUNT is changed atomically, and only goes
+   from zero to one with that lock held.  */
 struct disk_cache_info
 {
   block_t block;
   uint16_t flags;
-  uint16_t ref_count;
+  uint16_t shard;		/* Never changes.  */
+  refcount_t ref_count;
   struct disk_cache_info *next;	/* List of reusable entries.  */
 #ifdef DEBUG_DISK_CACHE
   block_t last_read, last_read_xor;
 #endif
 };
 
-/* block num --> pointer to in-memory block */
-extern hurd_ihash_t disk_cache_bptr;
+/* The disk cache is split into shards so that threads using different
+   blocks seldom wait for each other.  Block BLOCK is only ever cached in
+   one of the entries of shard DISK_CACHE_SHARD (BLOCK).  */
+#define DISK_CACHE_SHARDS	16
+#define DISK_CACHE_SHARD(block)	((block) % DISK_CACHE_SHARDS)
+
+struct disk_cache_shard
+{
+  /* Lock for the mappings and the free list of this shard.  */
+  pthread_mutex_t lock;
+  /* Fired when a re-association is done.  */
+  pthread_cond_t reassociation;
+  /* block num --> pointer to in-memory block */
+  hurd_ihash_t bptr;
+  /* List of potentially unused entries.  */
+  struct disk_cache_info *free;
+} __attribute__ ((aligned (64)));
+
+extern struct disk_cache_shard disk_cache_shards[DISK_CACHE_SHARDS];
 /* Metadata about cached block. */
 extern struct disk_cache_info *disk_cache_info;
-/* Lock for these mappings */
-extern pthread_mutex_t disk_cache_lock;
-/* Fired when a re-association is done.  */
-extern pthread_cond_t disk_cache_reassociation;
+
+/* The shard of the cache entry with index INDEX.  */
+#define disk_cache_info_shard(index) \
+  (&disk_cache_shards[disk_cache_info[index].shard])
+
+/* Return the cached copy of BLOCK without taking a reference, or NULL if
+   it is not in the cache.  */
+void *disk_cache_block_find (block_t block);
 
 void *disk_cache_block_ref (block_t block);
 void disk_cache_block_ref_ptr (void *ptr);
@@ -314,6 +413,16 @@ void get_hypermetadata (void);
    diskfs_set_hypermetadata to update the superblock from the cache
    `sblock' points to.  */
 void map_hypermetadata (void);
+
+/* True if the group descriptors carry checksums and uninitialized
+   group flags.  */
+#define EXT2_HAS_GDT_CSUM(sb) \
+  EXT2_HAS_RO_COMPAT_FEATURE (sb, EXT4_FEATURE_RO_COMPAT_GDT_CSUM)
+
+/* After changing the descriptor GDP of group GROUP, update its
+   checksum.  */
+void ext2_group_desc_csum_set (unsigned long group,
+			       struct ext2_group_desc *gdp);
 
 /* ---------------------------------------------------------------- */
 /* Random stuff calculated from the super block.  */
@@ -366,9 +475,7 @@ EXT2FS_EI char *
 boffs_ptr (off_t offset)
 {
   block_t block = boffs_block (offset);
-  pthread_mutex_lock (&disk_cache_lock);
-  char *ptr = hurd_ihash_find (disk_cache_bptr, block);
-  pthread_mutex_unlock (&disk_cache_lock);
+  char *ptr = disk_cache_block_find (block);
   assert_backtrace (ptr);
   ptr += offset % block_size;
   ext2_debug ("(%lld) = %p", offset, ptr);
@@ -380,14 +487,16 @@ EXT2FS_EI off_t
 bptr_offs (void *ptr)
 {
   vm_offset_t mem_offset = (char *)ptr - (char *)disk_cache;
+  int index = boffs_block (mem_offset);
+  struct disk_cache_shard *shard;
   off_t offset;
   assert_backtrace (mem_offset < disk_cache_size);
-  pthread_mutex_lock (&disk_cache_lock);
-  offset = (off_t) disk_cache_info[boffs_block (mem_offset)].block
-    << log2_block_size;
+  shard = disk_cache_info_shard (index);
+  pthread_mutex_lock (&shard->lock);
+  offset = (off_t) disk_cache_info[index].block << log2_block_size;
   assert_backtrace (offset || mem_offset < block_size);
   offset += mem_offset % block_size;
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
   ext2_debug ("(%p) = %lld", ptr, offset);
   return offset;
 }
@@ -428,8 +537,9 @@ dino_ref (ino_t inum)
   unsigned long group_inum = (inum - 1) % inodes_per_group;
   struct ext2_group_desc *bg = group_desc (bg_num);
   block_t block = le32toh (bg->bg_inode_table) + (group_inum / inodes_per_block);
-  struct ext2_inode *inode = disk_cache_block_ref (block);
-  inode += group_inum % inodes_per_block;
+  char *inodes = disk_cache_block_ref (block);
+  struct ext2_inode *inode = (struct ext2_inode *)
+    (inodes + (group_inum % inodes_per_block) * EXT2_INODE_SIZE (sblock));
   ext2_debug ("(%llu) = %p", inum, inode);
   return inode;
 }
@@ -450,6 +560,28 @@ _dino_deref (struct ext2_inode *inode)
 /* Write all active disknodes into the inode pager. */
 void write_all_disknodes (void);
 
+/* ---------------------------------------------------------------- */
+/* jbd2.c */
+
+/* Nonzero if the filesystem has an internal journal we can use.  */
+extern int jbd2_present;
+
+/* Find and check the internal journal named by the superblock, if any.  */
+void jbd2_load (void);
+
+/* Nonzero if the journal holds committed transactions not yet replayed.  */
+int jbd2_needs_recovery (void);
+
+/* Replay the journal onto the disk and mark it empty.  */
+void jbd2_recover (void);
+
+/* Log the contents DATA of the N filesystem blocks BLOCKS as a single
+   journal transaction, waiting for it to commit.  */
+error_t jbd2_log_blocks (const block_t *blocks, void *const *data, size_t n);
+
+/* Write every logged block home and mark the journal empty.  */
+error_t jbd2_checkpoint (void);
+
 /* ---------------------------------------------------------------- */
 
 /* What to lock if changing global data data (e.g., the superblock or block
@@ -518,6 +650,9 @@ sync_global_ptr (void *ptr, int wait)
   void *block_ptr = bptr (block);
   ext2_debug ("(%p -> %u)", ptr, block);
   global_block_modified (block);
+  if (jbd2_present && !diskfs_readonly)
+    /* Commit the block to the journal before it goes home.  */
+    jbd2_log_blocks (&block, &block_ptr, 1);
   disk_cache_block_deref (block_ptr);
   pager_sync_some (diskfs_disk_pager,
 		   block_ptr - disk_cache, block_size, wait);
@@ -573,13 +708,267 @@ void ext2_discard_prealloc (struct node *node);
    otherwise EINVAL is returned.  */
 error_t ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block);
 
+/* Like ext2_getblk without CREATE, but also return in COUNT how many
+   blocks from BLOCK on are known to be contiguous on disk (at least
+   one).  */
+error_t ext2_getblks (struct node *node, block_t block,
+		      block_t *disk_block, block_t *count);
+
+/* Allocate a new block for the file NODE, as close to block GOAL as
+   possible, and return it, or 0 if none could be had.  If ZERO is true, then
+   zero the block (and add it to NODE's list of modified indirect blocks).  */
+block_t ext2_alloc_block (struct node *node, block_t goal, int zero);
+
+/* If BLOCK of NODE is in a run in NODE's run cache, return in DISK_BLOCK
+   and COUNT what ext2_getblks would, and return true.  */
+int ext2_run_cache_lookup (struct node *node, block_t block,
+			   block_t *disk_block, block_t *count);
+
+/* Remember that COUNT blocks from BLOCK of NODE are at DISK_BLOCK on.  */
+void ext2_run_cache_add (struct node *node, block_t block,
+			 block_t disk_block, block_t count);
+
+/* Forget all the runs NODE's run cache holds.  Call this whenever NODE's
+   block map changes.  */
+void ext2_run_cache_clear (struct node *node);
+
 block_t ext2_new_block (block_t goal,
 			block_t prealloc_goal,
 			block_t *prealloc_count, block_t *prealloc_block);
 
 void ext2_free_blocks (block_t block, unsigned long count);
+
+/* Free COUNT blocks from BLOCK later, in the background; see balloc.c.  */
+void ext2_free_blocks_deferred (block_t block, unsigned long count);
+
+/* Free now all the blocks given to ext2_free_blocks_deferred, and
+   return nonzero if there were any.  */
+int ext2_drain_deferred_frees (void);
+
+/* Return how many blocks are waiting to be freed in the background.  */
+unsigned long ext2_count_deferred_blocks (void);
+
+/* Tell the store that whichever of the COUNT blocks from BLOCK are
+   still free need not be kept.  The caller makes sure that freeing
+   them has reached the disk.  */
+error_t ext2_discard_free_blocks (block_t block, unsigned long count);
+
+/* Set up the per-group allocation state; call whenever SBLOCK and the
+   group descriptors have been (re)read.  */
+void ext2_balloc_init (void);
+
+/* Fold the free block counts kept by the allocator into SBLOCK.  */
+void ext2_sync_free_blocks_count (void);
+
+/* Set aside COUNT free blocks for delayed allocation, or return ENOSPC
+   if there are not that many left.  */
+error_t ext2_reserve_blocks (unsigned long count);
+
+/* Give back COUNT blocks set aside by ext2_reserve_blocks.  */
+void ext2_unreserve_blocks (unsigned long count);
+
+/* Return how many blocks are set aside.  */
+unsigned long ext2_count_reserved_blocks (void);
+
+/* While ON is nonzero, let the blocks the calling thread allocates be
+   taken from those set aside, as the ones it fills a reservation with
+   are.  */
+void ext2_use_reserved_blocks (int on);
+
+/* ---------------------------------------------------------------- */
+/* discard.c */
+
+/* Nonzero if freed blocks are to be discarded.  */
+extern int use_discard;
+
+/* Note that the COUNT blocks from BLOCK were freed, to be discarded once
+   that is on disk.  */
+void ext2_discard_note (block_t block, unsigned long count);
+
+/* A sync is starting; return what to give ext2_discard_sync_end.  */
+uint64_t ext2_discard_sync_begin (void);
+
+/* The waited-for sync that ext2_discard_sync_begin returned EPOCH for
+   is done: discard the blocks freed before it started.  */
+void ext2_discard_sync_end (uint64_t epoch);
+
+/* ---------------------------------------------------------------- */
+/* extents.c */
+
+/* True if NODE's blocks are mapped by an extent tree.  */
+#define EXT4_HAS_EXTENTS(node) \
+  (diskfs_node_disknode (node)->info.i_flags & EXT4_EXTENTS_FL)
+
+/* Give NODE, which has no blocks, an empty extent tree.  */
+void ext4_ext_init (struct node *node);
+
+/* ext2_getblk for a node with an extent tree; COUNT is as for
+   ext2_getblks, and is 1 when a block is created.  */
+error_t ext4_getblk (struct node *node, block_t block, int create,
+		     block_t *disk_block, block_t *count);
+
+/* Free the blocks of NODE's extent tree from END on; with DEFER, in
+   the background.  */
+void ext4_ext_truncate (struct node *node, block_t end, int defer);
+
+/* Return whether BLOCK of NODE is in an unwritten extent.  */
+int ext4_ext_unwritten (struct node *node, block_t block);
+
+/* Allocate disk blocks for the holes of NODE from BLOCK up to END, in as
+   few runs as possible, and map them as unwritten extents, which read as
+   zeros until they are written.  */
+error_t ext4_ext_preallocate (struct node *node, block_t block,
+			      block_t end);
+
+/* ---------------------------------------------------------------- */
+/* inline.c */
+
+/* True if NODE keeps its data in its inode rather than in blocks.  */
+#define EXT4_HAS_INLINE_DATA(node) \
+  (diskfs_node_disknode (node)->info.i_flags & EXT4_INLINE_DATA_FL)
+
+/* Bytes of inline data that i_block holds.  */
+#define EXT4_MIN_INLINE_DATA_SIZE (EXT2_N_BLOCKS * sizeof (__u32))
+
+/* Set up the sizes of NODE, just read and with inline data.  */
+error_t ext4_inline_read_node (struct node *node);
+
+/* Make NODE, a new regular file, keep its data inline if the filesystem
+   allows it, and return whether it does.  */
+int ext4_inline_new (struct node *node);
+
+/* True if NODE's inline data is written in place, rather than moved to
+   a block when the pager makes it writable.  */
+int ext4_inline_writable (struct node *node);
+
+/* Fill the BLOCK_SIZE bytes at BUF, which are zero, with the inline data
+   of NODE, as the first block of its file.  NODE's ALLOC_LOCK is held.  */
+error_t ext4_inline_read (struct node *node, void *buf);
+
+/* Write the page at OFFSET of NODE, in BUF, to its inline data.  NODE's
+   ALLOC_LOCK is held.  */
+error_t ext4_inline_write (struct node *node, vm_offset_t offset,
+			   const void *buf);
+
+/* Move the inline data of NODE to a new block.  NODE's ALLOC_LOCK is held
+   for writing.  */
+error_t ext4_inline_convert (struct node *node);
+
+/* Shorten the inline data of NODE to LENGTH bytes.  NODE's ALLOC_LOCK is
+   held for writing.  */
+error_t ext4_inline_truncate (struct node *node, off_t length);
+
+/* Store the LEN bytes of TARGET, too long for i_block, as the inline
+   data of symlink NODE, or return EINVAL.  */
+error_t ext4_inline_symlink_write (struct node *node, const char *target,
+				   size_t len);
+
+/* Copy the target of inline symlink NODE to TARGET.  */
+error_t ext4_inline_symlink_read (struct node *node, char *target);
+
+/* ---------------------------------------------------------------- */
+/* htree.c */
+
+/* True if directory DP should be looked up through its hash index.  */
+#define EXT2_DX_ENABLED(dp) \
+  ((diskfs_node_disknode (dp)->info.i_flags & EXT2_INDEX_FL) \
+   && EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX))
+
+/* The way from the root of a directory's hash index to a leaf block.  */
+struct ext2_dx_path
+{
+  /* How many interior index blocks lie between the root and the leaf,
+     or -1 if the index is not being used.  */
+  int levels;
+
+  /* The hash of the name looked for.  */
+  uint32_t hash;
+
+  /* The index block at each level, starting from the root (block 0),
+     and the entry of it that was followed.  */
+  struct
+  {
+    block_t block;
+    int pos;
+  } level[2];
+
+  /* The leaf reached.  */
+  block_t leaf;
+};
+
+/* Find the leaf of directory DP, mapped at BUF, that NAME (of NAMELEN
+   bytes) belongs in, and fill in PATH.  Return EINVAL if DP's index
+   cannot be used, in which case its blocks must be scanned in order.  */
+error_t ext2_dx_find (struct node *dp, vm_address_t buf, const char *name,
+		      size_t namelen, struct ext2_dx_path *path);
+
+/* If the leaf after PATH's may also hold names with PATH's hash, move
+   PATH there and return true.  */
+int ext2_dx_next (struct node *dp, vm_address_t buf,
+		  struct ext2_dx_path *path);
+
+/* Split the leaf of PATH, which has no room for a new name with PATH's
+   hash, into a new block at the end of DP, and point PATH at the half
+   the name now belongs in.  BUF must map two blocks past DP's end.  */
+error_t ext2_dx_split (struct node *dp, vm_address_t buf,
+		       struct ext2_dx_path *path, struct protid *cred);
+
+/* Give the single-block directory DP a hash index, moving its entries
+   into a new leaf, and fill in PATH for NAME.  BUF must map two blocks
+   past DP's end.  */
+error_t ext2_dx_create (struct node *dp, vm_address_t buf, const char *name,
+			size_t namelen, struct ext2_dx_path *path,
+			struct protid *cred);
 
 /* ---------------------------------------------------------------- */
+/* delalloc.c */
+
+/* Return whether BLOCK of NODE is reserved but not allocated.  */
+int ext2_delalloc_reserved (struct node *node, block_t block);
+
+/* Reserve space for BLOCK of NODE, a hole, to be allocated later.  */
+error_t ext2_delalloc_reserve (struct node *node, block_t block);
+
+/* Allocate BLOCK of NODE if it is reserved, along with the reserved
+   blocks before it in the same run and some after it.  */
+error_t ext2_delalloc_allocate (struct node *node, block_t block);
+
+/* Drop the reservations of NODE for blocks from END on.  */
+void ext2_delalloc_truncate (struct node *node, block_t end);
+
+/* ---------------------------------------------------------------- */
+/* dirhash.c */
+
+/* How much memory the in-memory name tables of directories may use.  */
+extern size_t ext2_dirhash_max;
+
+/* Give directory DP, mapped at BUF, a table of its names if it is big
+   enough and has none yet.  Return whether it has one now.  */
+int ext2_dirhash_build (struct node *dp, vm_address_t buf);
+
+/* Drop DP's name table, if it has one.  */
+void ext2_dirhash_drop (struct node *dp);
+
+/* Return a block of DP that may hold NAME, or -1 when there are no
+   more.  Start with *CURSOR zero; it is advanced past each block
+   returned.  */
+int ext2_dirhash_lookup (struct node *dp, const char *name, size_t namelen,
+			 size_t *cursor);
+
+/* Return the first block of DP with at least NEEDED bytes free, or -1.  */
+int ext2_dirhash_find_room (struct node *dp, size_t needed);
+
+/* Note that NAME was entered into, or removed from, block BLOCK of DP.  */
+void ext2_dirhash_add (struct node *dp, const char *name, size_t namelen,
+		       int block);
+void ext2_dirhash_remove (struct node *dp, const char *name, size_t namelen,
+			  int block);
+
+/* Note that block BLOCK of DP, mapped at BUF, was changed or added.  */
+void ext2_dirhash_block_changed (struct node *dp, vm_address_t buf,
+				 int block);
+
+/* ---------------------------------------------------------------- */
 
 /* Write disk block ADDR with DATA of LEN bytes, waiting for completion.  */
 error_t dev_write_sync (block_t addr, vm_address_t data, long len);
@@ -612,6 +1001,16 @@ error_t ext2_list_xattr (struct node *np, char *buffer, size_t *len);
 error_t ext2_get_xattr (struct node *np, const char *name, char *value, size_t *len);
 error_t ext2_set_xattr (struct node *np, const char *name, const char *value, size_t len, int flags);
 error_t ext2_free_xattr_block (struct node *np);
+/* Get or set attribute NAME of NP in the body of its inode only, as ext4
+   wants the system.data attribute of inline data.  They bypass NP's
+   attribute cache, and so do not need NP locked.  Setting returns
+   ENOSPC if the value does not fit in the inode.  */
+error_t ext2_get_ibody_xattr (struct node *np, const char *name,
+			      char *value, size_t *len);
+error_t ext2_set_ibody_xattr (struct node *np, const char *name,
+			      const char *value, size_t len);
+/* Forget the attributes of NP decoded by the functions above.  */
+void ext2_xattr_cache_drop (struct node *np);
 
 /* Use extended attribute-based translator records.
  *
@@ -0,0 +1,842 @@
+/* ext4 extent trees
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* An inode with EXT4_EXTENTS_FL maps its blocks with a B-tree of extents
+   instead of indirect blocks.  The root node is kept in the inode's
+   i_data; the other nodes are filesystem blocks reached through the disk
+   cache, and are written back like indirect blocks are.  Every caller
+   holds the node's ALLOC_LOCK: for reading when only looking blocks up,
+   for writing when changing the tree.  */
+
+#include <string.h>
+#include "ext2fs.h"
+
+/* The entries following the node header HDR.  Leaf and interior entries
+   are both twelve bytes long and both start with a logical block.  */
+#define EXT_EXTENTS(hdr)	((struct ext4_extent *) ((hdr) + 1))
+#define EXT_INDICES(hdr)	((struct ext4_extent_idx *) ((hdr) + 1))
+#define EXT_ENTRY_BLOCK(hdr, i)	le32toh (EXT_EXTENTS (hdr)[i].ee_block)
+
+#define EXT_ENTRIES(hdr)	le16toh ((hdr)->eh_entries)
+#define EXT_MAX(hdr)		le16toh ((hdr)->eh_max)
+#define EXT_DEPTH(hdr)		le16toh ((hdr)->eh_depth)
+
+/* How many entries fit in the root node, and in any other.  */
+#define EXT_ROOT_MAX							\
+  ((EXT2_N_BLOCKS * sizeof (__u32) - sizeof (struct ext4_extent_header))	\
+   / sizeof (struct ext4_extent))
+#define EXT_BLOCK_MAX							\
+  ((block_size - sizeof (struct ext4_extent_header))			\
+   / sizeof (struct ext4_extent))
+
+/* True if BLOCK may hold file data or tree nodes.  */
+#define EXT_BLOCK_OK(block)						\
+  ((block) >= group_desc_block_end && (block) < store->size >> log2_block_size)
+
+/* One level of a path from the root of an extent tree down to a leaf.  */
+struct ext_path
+{
+  /* The node: the inode's i_data at level 0, otherwise a block in the
+     disk cache that the path holds a reference to.  */
+  struct ext4_extent_header *hdr;
+  /* The last entry starting at or before the block looked up, or -1 if
+     there is none.  */
+  int pos;
+  /* True if HDR has been changed.  */
+  int dirty;
+};
+
+static inline struct ext4_extent_header *
+ext_root (struct node *node)
+{
+  return (struct ext4_extent_header *) diskfs_node_disknode (node)->info.i_data;
+}
+
+static inline block_t
+ext_len (const struct ext4_extent *ex)
+{
+  unsigned len = le16toh (ex->ee_len);
+  return len > EXT4_EXT_INIT_MAX_LEN ? len - EXT4_EXT_INIT_MAX_LEN : len;
+}
+
+static inline int
+ext_unwritten (const struct ext4_extent *ex)
+{
+  return le16toh (ex->ee_len) > EXT4_EXT_INIT_MAX_LEN;
+}
+
+static inline void
+ext_set_len (struct ext4_extent *ex, block_t len, int unwritten)
+{
+  ex->ee_len = htole16 (unwritten ? len + EXT4_EXT_INIT_MAX_LEN : len);
+}
+
+static inline void
+ext_set (struct ext4_extent *ex, block_t block, block_t len, block_t start,
+	 int unwritten)
+{
+  ex->ee_block = htole32 (block);
+  ex->ee_start_lo = htole32 (start);
+  ex->ee_start_hi = 0;
+  ext_set_len (ex, len, unwritten);
+}
+
+static int
+ext_header_ok (const struct ext4_extent_header *hdr, int depth,
+	       unsigned max)
+{
+  return (le16toh (hdr->eh_magic) == EXT4_EXT_MAGIC
+	  && EXT_DEPTH (hdr) == depth
+	  && EXT_MAX (hdr) > 0 && EXT_MAX (hdr) <= max
+	  && EXT_ENTRIES (hdr) <= EXT_MAX (hdr));
+}
+
+/* Return the last entry of HDR starting at or before BLOCK, or -1.  */
+static int
+ext_search (struct ext4_extent_header *hdr, block_t block)
+{
+  int lo = 0, hi = EXT_ENTRIES (hdr);
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (EXT_ENTRY_BLOCK (hdr, mid) <= block)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo - 1;
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Give up our reference to the tree block HDR of NODE, which has been
+   changed, so that it gets written back.  */
+static void
+ext_dirty_block (struct node *node, void *hdr)
+{
+  if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+    sync_global_ptr (hdr, 1);
+  else
+    record_indir_poke (node, hdr);
+}
+
+/* Drop the references PATH holds on its nodes below the root, down to
+   level DEPTH, writing back those that were changed.  */
+static void
+ext_path_release (struct node *node, struct ext_path *path, int depth)
+{
+  int level;
+
+  if (path[0].dirty)
+    node->dn_stat_dirty = 1;
+
+  for (level = 1; level <= depth; level++)
+    if (path[level].dirty)
+      ext_dirty_block (node, path[level].hdr);
+    else
+      disk_cache_block_deref (path[level].hdr);
+}
+
+/* Fill PATH with the nodes of NODE's extent tree leading to BLOCK, and
+   return the depth of the tree in DEPTH.  */
+static error_t
+ext_find (struct node *node, block_t block, struct ext_path *path,
+	  int *depth)
+{
+  struct ext4_extent_header *hdr = ext_root (node);
+  int level, d = EXT_DEPTH (hdr);
+
+  if (d > EXT4_EXT_MAX_DEPTH || ! ext_header_ok (hdr, d, EXT_ROOT_MAX))
+    {
+      ext2_warning ("bad extent tree root in inode %llu",
+		    (unsigned long long) node->cache_id);
+      return EIO;
+    }
+
+  for (level = 0; ; level++)
+    {
+      struct ext4_extent_idx *idx;
+      block_t child;
+
+      path[level].hdr = hdr;
+      path[level].pos = ext_search (hdr, block);
+      path[level].dirty = 0;
+      if (level == d)
+	break;
+
+      if (EXT_ENTRIES (hdr) == 0)
+	goto corrupt;
+      idx = &EXT_INDICES (hdr)[path[level].pos < 0 ? 0 : path[level].pos];
+      child = le32toh (idx->ei_leaf_lo);
+      if (idx->ei_leaf_hi || ! EXT_BLOCK_OK (child))
+	goto corrupt;
+
+      hdr = (struct ext4_extent_header *) disk_cache_block_ref (child);
+      if (! ext_header_ok (hdr, d - level - 1, EXT_BLOCK_MAX))
+	{
+	  disk_cache_block_deref (hdr);
+	  goto corrupt;
+	}
+    }
+
+  *depth = d;
+  return 0;
+
+ corrupt:
+  ext_path_release (node, path, level);
+  ext2_warning ("bad extent tree node in inode %llu",
+		(unsigned long long) node->cache_id);
+  return EIO;
+}
+
+/* Make the index entries on PATH, which leads to a leaf that now maps
+   BLOCK, start no later than BLOCK.  */
+static void
+ext_fix_keys (struct ext_path *path, int depth, block_t block)
+{
+  int level;
+
+  for (level = 0; level < depth; level++)
+    {
+      int pos = path[level].pos < 0 ? 0 : path[level].pos;
+      struct ext4_extent_idx *idx = &EXT_INDICES (path[level].hdr)[pos];
+
+      if (le32toh (idx->ei_block) > block)
+	{
+	  idx->ei_block = htole32 (block);
+	  path[level].dirty = 1;
+	}
+    }
+}
+
+/* Where to allocate blocks for NODE when there is nothing better.  */
+static block_t
+ext_default_goal (struct node *node)
+{
+  return (diskfs_node_disknode (node)->info.i_block_group
+	  * EXT2_BLOCKS_PER_GROUP (sblock)
+	  + le32toh (sblock->s_first_data_block));
+}
+
+/* Allocate a zeroed block for a new node of NODE's extent tree and return
+   it in *HDR, referenced, or return 0 if there is no space.  Tree blocks
+   are not taken from NODE's preallocation, which is kept for data.  */
+static block_t
+ext_alloc_node (struct node *node, struct ext4_extent_header **hdr,
+		int depth)
+{
+  block_t block = ext2_new_block (ext_default_goal (node), 0, 0, 0);
+
+  if (! block)
+    return 0;
+
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+
+  *hdr = (struct ext4_extent_header *) disk_cache_block_ref (block);
+  memset (*hdr, 0, block_size);
+  (*hdr)->eh_magic = htole16 (EXT4_EXT_MAGIC);
+  (*hdr)->eh_max = htole16 (EXT_BLOCK_MAX);
+  (*hdr)->eh_depth = htole16 (depth);
+  return block;
+}
+
+/* Move the contents of the root of NODE's extent tree into a new block,
+   leaving the root an interior node with that block as its only child.  */
+static error_t
+ext_grow (struct node *node, struct ext_path *path)
+{
+  struct ext4_extent_header *root = path[0].hdr, *hdr;
+  struct ext4_extent_idx *idx = EXT_INDICES (root);
+  int n = EXT_ENTRIES (root);
+  block_t block;
+
+  block = ext_alloc_node (node, &hdr, EXT_DEPTH (root));
+  if (! block)
+    return ENOSPC;
+  memcpy (EXT_EXTENTS (hdr), EXT_EXTENTS (root),
+	  n * sizeof (struct ext4_extent));
+  hdr->eh_entries = htole16 (n);
+  ext_dirty_block (node, hdr);
+
+  idx->ei_block = htole32 (n > 0 ? EXT_ENTRY_BLOCK (root, 0) : 0);
+  idx->ei_leaf_lo = htole32 (block);
+  idx->ei_leaf_hi = 0;
+  idx->ei_unused = 0;
+  root->eh_entries = htole16 (1);
+  root->eh_depth = htole16 (EXT_DEPTH (root) + 1);
+  path[0].dirty = 1;
+  return 0;
+}
+
+/* Split the full node at LEVEL of PATH, whose parent has room, moving
+   its upper entries into a new node.  BLOCK is the block about to be
+   inserted.  */
+static error_t
+ext_split (struct node *node, struct ext_path *path, int level,
+	   block_t block)
+{
+  struct ext4_extent_header *hdr = path[level].hdr;
+  struct ext4_extent_header *parent = path[level - 1].hdr, *new_hdr;
+  struct ext4_extent_idx *idx = EXT_INDICES (parent);
+  int n = EXT_ENTRIES (hdr), m, pos;
+  block_t new_block, start;
+
+  /* A leaf being appended to keeps all its entries and BLOCK starts a
+     new one, so sequential writes leave full leaves behind them.  Other
+     nodes are split in half.  */
+  if (EXT_DEPTH (hdr) == 0 && path[level].pos == n - 1)
+    m = n;
+  else
+    m = n / 2;
+  start = m < n ? EXT_ENTRY_BLOCK (hdr, m) : block;
+
+  new_block = ext_alloc_node (node, &new_hdr, EXT_DEPTH (hdr));
+  if (! new_block)
+    return ENOSPC;
+  memcpy (EXT_EXTENTS (new_hdr), &EXT_EXTENTS (hdr)[m],
+	  (n - m) * sizeof (struct ext4_extent));
+  new_hdr->eh_entries = htole16 (n - m);
+  ext_dirty_block (node, new_hdr);
+
+  hdr->eh_entries = htole16 (m);
+  path[level].dirty = 1;
+
+  pos = (path[level - 1].pos < 0 ? 0 : path[level - 1].pos) + 1;
+  memmove (&idx[pos + 1], &idx[pos],
+	   (EXT_ENTRIES (parent) - pos) * sizeof *idx);
+  idx[pos].ei_block = htole32 (start);
+  idx[pos].ei_leaf_lo = htole32 (new_block);
+  idx[pos].ei_leaf_hi = 0;
+  idx[pos].ei_unused = 0;
+  parent->eh_entries = htole16 (EXT_ENTRIES (parent) + 1);
+  path[level - 1].dirty = 1;
+  return 0;
+}
+
+/* Insert NEW, which overlaps no extent, into NODE's extent tree,
+   splitting nodes as needed.  */
+static error_t
+ext_insert (struct node *node, const struct ext4_extent *new)
+{
+  block_t block = le32toh (new->ee_block);
+
+  for (;;)
+    {
+      struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+      struct ext4_extent_header *leaf;
+      int depth, level;
+      error_t err;
+
+      err = ext_find (node, block, path, &depth);
+      if (err)
+	return err;
+
+      leaf = path[depth].hdr;
+      if (EXT_ENTRIES (leaf) < EXT_MAX (leaf))
+	{
+	  struct ext4_extent *ex = EXT_EXTENTS (leaf);
+	  int pos = path[depth].pos + 1;
+
+	  memmove (&ex[pos + 1], &ex[pos],
+		   (EXT_ENTRIES (leaf) - pos) * sizeof *ex);
+	  ex[pos] = *new;
+	  leaf->eh_entries = htole16 (EXT_ENTRIES (leaf) + 1);
+	  path[depth].dirty = 1;
+	  ext_fix_keys (path, depth, block);
+	  ext_path_release (node, path, depth);
+	  return 0;
+	}
+
+      /* Split the deepest node whose parent has room for another entry;
+	 if every node up to the root is full, add a level instead.  */
+      for (level = depth; level > 0; level--)
+	if (EXT_ENTRIES (path[level - 1].hdr) < EXT_MAX (path[level - 1].hdr))
+	  break;
+      if (level > 0)
+	err = ext_split (node, path, level, block);
+      else if (depth < EXT4_EXT_MAX_DEPTH)
+	err = ext_grow (node, path);
+      else
+	err = ENOSPC;
+
+      ext_path_release (node, path, depth);
+      if (err)
+	return err;
+    }
+}
+
+/* Allocate a disk block for BLOCK, which is in a hole of NODE's extent
+   tree, and return it in DISK_BLOCK.  PATH leads to BLOCK; release it.  */
+static error_t
+ext_alloc (struct node *node, struct ext_path *path, int depth,
+	   block_t block, block_t *disk_block)
+{
+  struct ext4_extent_header *leaf = path[depth].hdr;
+  int pos = path[depth].pos;
+  struct ext4_extent *prev = NULL, *next = NULL;
+  struct ext4_extent new;
+  block_t goal;
+  error_t err;
+
+  if (pos >= 0)
+    prev = &EXT_EXTENTS (leaf)[pos];
+  if (pos + 1 < EXT_ENTRIES (leaf))
+    next = &EXT_EXTENTS (leaf)[pos + 1];
+
+  /* Aim for the disk block that would continue the neighbouring
+     extent.  */
+  if (prev)
+    goal = le32toh (prev->ee_start_lo) + (block - le32toh (prev->ee_block));
+  else if (next
+	   && le32toh (next->ee_start_lo) > le32toh (next->ee_block) - block)
+    goal = le32toh (next->ee_start_lo) - (le32toh (next->ee_block) - block);
+  else
+    goal = ext_default_goal (node);
+
+  *disk_block = ext2_alloc_block (node, goal, 0);
+  if (! *disk_block)
+    {
+      ext_path_release (node, path, depth);
+      return ENOSPC;
+    }
+
+  node->dn_set_ctime = node->dn_set_mtime = 1;
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+
+  if (prev && ! ext_unwritten (prev)
+      && ext_len (prev) < EXT4_EXT_INIT_MAX_LEN
+      && le32toh (prev->ee_block) + ext_len (prev) == block
+      && le32toh (prev->ee_start_lo) + ext_len (prev) == *disk_block)
+    /* Sequential allocation, the common case: PREV just gets longer.  */
+    {
+      ext_set_len (prev, ext_len (prev) + 1, 0);
+      path[depth].dirty = 1;
+      ext_path_release (node, path, depth);
+      return 0;
+    }
+
+  if (next && ! ext_unwritten (next)
+      && ext_len (next) < EXT4_EXT_INIT_MAX_LEN
+      && block + 1 == le32toh (next->ee_block)
+      && *disk_block + 1 == le32toh (next->ee_start_lo))
+    {
+      ext_set (next, block, ext_len (next) + 1, *disk_block, 0);
+      path[depth].dirty = 1;
+      ext_fix_keys (path, depth, block);
+      ext_path_release (node, path, depth);
+      return 0;
+    }
+
+  ext_path_release (node, path, depth);
+
+  ext_set (&new, block, 1, *disk_block, 0);
+  err = ext_insert (node, &new);
+  if (err)
+    {
+      ext2_free_blocks (*disk_block, 1);
+      node->dn_stat.st_blocks -= 1 << log2_stat_blocks_per_fs_block;
+      *disk_block = 0;
+    }
+  return err;
+}
+
+/* Turn BLOCK, inside the unwritten extent EX at the leaf of PATH, into an
+   initialized block, and return its disk block in DISK_BLOCK.  The rest
+   of EX stays unwritten.  Release PATH.  */
+static error_t
+ext_convert (struct node *node, struct ext_path *path, int depth,
+	     struct ext4_extent *ex, block_t block, block_t *disk_block)
+{
+  block_t start = le32toh (ex->ee_block), len = ext_len (ex);
+  block_t pstart = le32toh (ex->ee_start_lo), offs = block - start;
+  struct ext4_extent *prev = NULL;
+  struct ext4_extent piece;
+  error_t err;
+
+  *disk_block = pstart + offs;
+  path[depth].dirty = 1;
+  node->dn_set_ctime = node->dn_set_mtime = 1;
+
+  if (path[depth].pos > 0)
+    prev = ex - 1;
+
+  if (len == 1)
+    {
+      ext_set_len (ex, 1, 0);
+      ext_path_release (node, path, depth);
+      return 0;
+    }
+
+  if (offs > 0)
+    ext_set_len (ex, offs, 1);
+  else
+    {
+      ext_set (ex, start + 1, len - 1, pstart + 1, 1);
+      if (prev && ! ext_unwritten (prev)
+	  && ext_len (prev) < EXT4_EXT_INIT_MAX_LEN
+	  && le32toh (prev->ee_block) + ext_len (prev) == block
+	  && le32toh (prev->ee_start_lo) + ext_len (prev) == *disk_block)
+	/* Writing through a preallocated region from its start, so the
+	   written part can keep growing one extent.  */
+	{
+	  ext_set_len (prev, ext_len (prev) + 1, 0);
+	  ext_path_release (node, path, depth);
+	  return 0;
+	}
+    }
+  ext_path_release (node, path, depth);
+
+  ext_set (&piece, block, 1, *disk_block, 0);
+  err = ext_insert (node, &piece);
+  if (!err && offs > 0 && offs + 1 < len)
+    {
+      ext_set (&piece, block + 1, len - offs - 1, *disk_block + 1, 1);
+      err = ext_insert (node, &piece);
+    }
+  return err;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+ext4_ext_init (struct node *node)
+{
+  struct ext4_extent_header *root = ext_root (node);
+
+  memset (diskfs_node_disknode (node)->info.i_data, 0,
+	  sizeof diskfs_node_disknode (node)->info.i_data);
+  root->eh_magic = htole16 (EXT4_EXT_MAGIC);
+  root->eh_max = htole16 (EXT_ROOT_MAX);
+  diskfs_node_disknode (node)->info.i_flags |= EXT4_EXTENTS_FL;
+  ext2_run_cache_clear (node);
+}
+
+error_t
+ext4_getblk (struct node *node, block_t block, int create,
+	     block_t *disk_block, block_t *count)
+{
+  struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+  struct ext4_extent *ex = NULL;
+  error_t err;
+  int depth;
+
+  if (ext2_run_cache_lookup (node, block, disk_block, count))
+    return 0;
+
+  err = ext_find (node, block, path, &depth);
+  if (err)
+    return err;
+
+  if (path[depth].pos >= 0)
+    {
+      ex = &EXT_EXTENTS (path[depth].hdr)[path[depth].pos];
+      if (block - le32toh (ex->ee_block) >= ext_len (ex))
+	ex = NULL;		/* BLOCK is in a hole after EX.  */
+      else if (ex->ee_start_hi
+	       || ! EXT_BLOCK_OK (le32toh (ex->ee_start_lo))
+	       || ! EXT_BLOCK_OK (le32toh (ex->ee_start_lo)
+				  + ext_len (ex) - 1))
+	{
+	  ext_path_release (node, path, depth);
+	  ext2_warning ("bad extent in inode %llu",
+			(unsigned long long) node->cache_id);
+	  return EIO;
+	}
+    }
+
+  if (ex && ! ext_unwritten (ex))
+    {
+      block_t offs = block - le32toh (ex->ee_block);
+
+      *disk_block = le32toh (ex->ee_start_lo) + offs;
+      *count = ext_len (ex) - offs;
+      ext2_run_cache_add (node, le32toh (ex->ee_block),
+			  le32toh (ex->ee_start_lo), ext_len (ex));
+      ext_path_release (node, path, depth);
+      return 0;
+    }
+
+  if (! create)
+    {
+      ext_path_release (node, path, depth);
+      return EINVAL;
+    }
+
+  ext2_run_cache_clear (node);
+  if (ex)
+    err = ext_convert (node, path, depth, ex, block, disk_block);
+  else
+    err = ext_alloc (node, path, depth, block, disk_block);
+  *count = 1;
+
+  if (!err && (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync))
+    diskfs_node_update (node, 1);
+
+  return err;
+}
+
+/* The longest unwritten extent.  */
+#define EXT_UNWRITTEN_MAX_LEN	(EXT4_EXT_INIT_MAX_LEN - 1)
+
+int
+ext4_ext_unwritten (struct node *node, block_t block)
+{
+  struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+  struct ext4_extent *ex;
+  int depth, unwritten = 0;
+
+  if (ext_find (node, block, path, &depth))
+    return 0;
+
+  if (path[depth].pos >= 0)
+    {
+      ex = &EXT_EXTENTS (path[depth].hdr)[path[depth].pos];
+      unwritten = (block - le32toh (ex->ee_block) < ext_len (ex)
+		   && ext_unwritten (ex));
+    }
+
+  ext_path_release (node, path, depth);
+  return unwritten;
+}
+
+error_t
+ext4_ext_preallocate (struct node *node, block_t block, block_t end)
+{
+  block_t disk_block = 0;
+  error_t err = 0;
+
+  while (block < end && !err)
+    {
+      struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+      struct ext4_extent_header *leaf;
+      struct ext4_extent *prev = NULL, new;
+      block_t hole_end = end, goal, len;
+      int depth, level, pos;
+
+      err = ext_find (node, block, path, &depth);
+      if (err)
+	break;
+
+      leaf = path[depth].hdr;
+      pos = path[depth].pos;
+      if (pos >= 0)
+	{
+	  prev = &EXT_EXTENTS (leaf)[pos];
+	  if (block - le32toh (prev->ee_block) < ext_len (prev))
+	    {
+	      /* Already mapped; skip to the end of the extent.  */
+	      block = le32toh (prev->ee_block) + ext_len (prev);
+	      ext_path_release (node, path, depth);
+	      continue;
+	    }
+	}
+
+      /* BLOCK is in a hole, which ends where the next extent starts: the
+	 next one in the leaf, or else the first one under the next entry
+	 of the deepest node that has one.  */
+      if (pos + 1 < EXT_ENTRIES (leaf))
+	{
+	  if (EXT_ENTRY_BLOCK (leaf, pos + 1) < hole_end)
+	    hole_end = EXT_ENTRY_BLOCK (leaf, pos + 1);
+	}
+      else
+	for (level = depth - 1; level >= 0; level--)
+	  {
+	    struct ext4_extent_header *hdr = path[level].hdr;
+	    int next = (path[level].pos < 0 ? 0 : path[level].pos) + 1;
+	    if (next < EXT_ENTRIES (hdr))
+	      {
+		if (EXT_ENTRY_BLOCK (hdr, next) < hole_end)
+		  hole_end = EXT_ENTRY_BLOCK (hdr, next);
+		break;
+	      }
+	  }
+
+      if (prev)
+	goal = (le32toh (prev->ee_start_lo)
+		+ (block - le32toh (prev->ee_block)));
+      else
+	goal = ext_default_goal (node);
+      ext_path_release (node, path, depth);
+
+      /* Take as long a run of contiguous blocks as we can get; a block
+	 that does not continue it starts the next one.  */
+      if (! disk_block)
+	disk_block = ext2_alloc_block (node, goal, 0);
+      if (! disk_block)
+	{
+	  err = ENOSPC;
+	  break;
+	}
+      ext_set (&new, block, 1, disk_block, 1);
+      for (len = 1, disk_block = 0;
+	   block + len < hole_end && len < EXT_UNWRITTEN_MAX_LEN; len++)
+	{
+	  disk_block = ext2_alloc_block (node, le32toh (new.ee_start_lo) + len,
+					 0);
+	  if (disk_block != le32toh (new.ee_start_lo) + len)
+	    break;
+	  disk_block = 0;
+	}
+      ext_set_len (&new, len, 1);
+
+      node->dn_stat.st_blocks += len << log2_stat_blocks_per_fs_block;
+      node->dn_set_ctime = 1;
+      node->dn_stat_dirty = 1;
+
+      err = ext_insert (node, &new);
+      if (err)
+	{
+	  ext2_free_blocks (le32toh (new.ee_start_lo), len);
+	  node->dn_stat.st_blocks -= len << log2_stat_blocks_per_fs_block;
+	  break;
+	}
+      block += len;
+    }
+
+  if (disk_block)
+    /* Taken for a run that was not inserted.  */
+    ext2_free_blocks (disk_block, 1);
+
+  ext2_run_cache_clear (node);
+  if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+    diskfs_node_update (node, 1);
+
+  return err;
+}
+
+/* ---------------------------------------------------------------- */
+
+static void
+ext_free (struct node *node, block_t block, block_t count, int defer)
+{
+  node->dn_stat.st_blocks -= count << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+  if (defer)
+    ext2_free_blocks_deferred (block, count);
+  else
+    ext2_free_blocks (block, count);
+}
+
+/* Free the blocks from END on mapped by the extent tree node HDR of NODE,
+   along with any nodes below HDR left empty, in the background if
+   DEFER.  Return true if HDR was changed.  */
+static int
+ext_trunc_node (struct node *node, struct ext4_extent_header *hdr,
+		block_t end, int defer)
+{
+  int n = EXT_ENTRIES (hdr), i, changed = 0;
+
+  if (EXT_DEPTH (hdr) == 0)
+    {
+      struct ext4_extent *ex = EXT_EXTENTS (hdr);
+
+      for (i = n - 1; i >= 0; i--)
+	{
+	  block_t start = le32toh (ex[i].ee_block), len = ext_len (&ex[i]);
+
+	  if (start + len <= end)
+	    break;
+
+	  if (start >= end)
+	    {
+	      ext_free (node, le32toh (ex[i].ee_start_lo), len, defer);
+	      n--;
+	    }
+	  else
+	    {
+	      ext_free (node, le32toh (ex[i].ee_start_lo) + (end - start),
+			start + len - end, defer);
+	      ext_set_len (&ex[i], end - start, ext_unwritten (&ex[i]));
+	    }
+	  changed = 1;
+	}
+    }
+  else
+    {
+      struct ext4_extent_idx *idx = EXT_INDICES (hdr);
+
+      for (i = n - 1; i >= 0; i--)
+	{
+	  block_t child = le32toh (idx[i].ei_leaf_lo);
+	  struct ext4_extent_header *ch;
+
+	  if (idx[i].ei_leaf_hi || ! EXT_BLOCK_OK (child))
+	    goto corrupt;
+	  ch = (struct ext4_extent_header *) disk_cache_block_ref (child);
+	  if (! ext_header_ok (ch, EXT_DEPTH (hdr) - 1, EXT_BLOCK_MAX))
+	    {
+	      disk_cache_block_deref (ch);
+	      goto corrupt;
+	    }
+
+	  if (! ext_trunc_node (node, ch, end, defer))
+	    disk_cache_block_deref (ch);
+	  else if (EXT_ENTRIES (ch) > 0)
+	    ext_dirty_block (node, ch);
+	  else
+	    {
+	      pager_flush_some (diskfs_disk_pager,
+				bptr_index (ch) << log2_block_size,
+				block_size, 1);
+	      disk_cache_block_deref (ch);
+	      ext_free (node, child, 1, defer);
+	      n--;
+	      changed = 1;
+	    }
+
+	  /* The children before this one map only blocks before it.  */
+	  if (le32toh (idx[i].ei_block) <= end)
+	    break;
+	}
+    }
+
+  hdr->eh_entries = htole16 (n);
+  return changed;
+
+ corrupt:
+  /* Leave the rest for fsck.  */
+  ext2_warning ("bad extent tree node in inode %llu",
+		(unsigned long long) node->cache_id);
+  hdr->eh_entries = htole16 (n);
+  return changed;
+}
+
+void
+ext4_ext_truncate (struct node *node, block_t end, int defer)
+{
+  struct ext4_extent_header *root = ext_root (node);
+
+  if (EXT_DEPTH (root) > EXT4_EXT_MAX_DEPTH
+      || ! ext_header_ok (root, EXT_DEPTH (root), EXT_ROOT_MAX))
+    {
+      ext2_warning ("bad extent tree root in inode %llu",
+		    (unsigned long long) node->cache_id);
+      return;
+    }
+
+  if (ext_trunc_node (node, root, end, defer))
+    {
+      if (EXT_ENTRIES (root) == 0)
+	root->eh_depth = 0;
+      node->dn_stat_dirty = 1;
+    }
+}
@@ -60,10 +60,82 @@ ext2_discard_prealloc (struct node *node)
 #endif
 }
 
+int
+ext2_run_cache_lookup (struct node *node, block_t block,
+		       block_t *disk_block, block_t *count)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int i, hit = 0;
+
+  pthread_spin_lock (&dn->run_cache_lock);
+  for (i = 0; i < BLOCK_RUN_CACHE_SIZE; i++)
+    {
+      struct block_run *run = &dn->run_cache[i];
+      if (block >= run->lblk && block - run->lblk < run->len)
+	{
+	  *disk_block = run->pblk + (block - run->lblk);
+	  *count = run->len - (block - run->lblk);
+	  hit = 1;
+	  break;
+	}
+    }
+  pthread_spin_unlock (&dn->run_cache_lock);
+
+  return hit;
+}
+
+void
+ext2_run_cache_add (struct node *node, block_t block,
+		    block_t disk_block, block_t count)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  struct block_run *run;
+  int i;
+
+  pthread_spin_lock (&dn->run_cache_lock);
+  /* A run found again from its start replaces itself; otherwise evict the
+     oldest entry.  */
+  for (i = 0; i < BLOCK_RUN_CACHE_SIZE; i++)
+    if (dn->run_cache[i].len > 0 && dn->run_cache[i].lblk == block)
+      break;
+  if (i == BLOCK_RUN_CACHE_SIZE)
+    {
+      i = dn->run_cache_next;
+      dn->run_cache_next = (i + 1) % BLOCK_RUN_CACHE_SIZE;
+    }
+  run = &dn->run_cache[i];
+  run->lblk = block;
+  run->pblk = disk_block;
+  run->len = count;
+  pthread_spin_unlock (&dn->run_cache_lock);
+}
+
+void
+ext2_run_cache_clear (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  pthread_spin_lock (&dn->run_cache_lock);
+  memset (dn->run_cache, 0, sizeof dn->run_cache);
+  pthread_spin_unlock (&dn->run_cache_lock);
+}
+
+/* Return how many of the at most N block pointers from P on are
+   contiguous on disk, given that *P is allocated.  */
+static block_t
+run_length (const block_t *p, block_t n)
+{
+  block_t i;
+
+  for (i = 1; i < n && p[i] == p[0] + i; i++)
+    ;
+  return i;
+}
+
 /* Allocate a new block for the file NODE, as close to block GOAL as
    possible, and return it, or 0 if none could be had.  If ZERO is true, then
    zero the block (and add it to NODE's list of modified indirect blocks).  */
-static block_t
+block_t
 ext2_alloc_block (struct node *node, block_t goal, int zero)
 {
 #ifdef EXT2FS_DEBUG
@@ -71,6 +143,8 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
 #endif
   block_t result;
 
+  ext2_run_cache_clear (node);
+
 #ifdef EXT2_PREALLOCATE
   if (diskfs_node_disknode (node)->info.i_prealloc_count &&
       (goal == diskfs_node_disknode (node)->info.i_prealloc_block ||
@@ -117,9 +191,11 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
   return result;
 }
 
+/* If RUN is not null, then on success it is set to how many blocks from
+   *RESULT on are mapped contiguously by the entries from NR on.  */
 static error_t
 inode_getblk (struct node *node, int nr, int create, int zero,
-	      block_t new_block, block_t *result)
+	      block_t new_block, block_t *result, block_t *run)
 {
   int i;
   block_t goal = 0;
@@ -135,6 +211,11 @@ inode_getblk (struct node *node, int nr, int create, int zero,
       /* Trap trying to access superblock, block group descriptor table, or beyond the end */
       assert_backtrace (*result >= group_desc_block_end
 		     && *result < store->size >> log2_block_size);
+      if (run)
+	*run = nr < EXT2_NDIR_BLOCKS
+	       ? run_length (diskfs_node_disknode (node)->info.i_data + nr,
+			     EXT2_NDIR_BLOCKS - nr)
+	       : 1;
       return 0;
     }
 
@@ -174,6 +255,8 @@ inode_getblk (struct node *node, int nr, int create, int zero,
     return ENOSPC;
 
   diskfs_node_disknode (node)->info.i_data[nr] = *result;
+  if (run)
+    *run = 1;
 
   diskfs_node_disknode (node)->info.i_next_alloc_block = new_block;
   diskfs_node_disknode (node)->info.i_next_alloc_goal = *result;
@@ -187,9 +270,10 @@ inode_getblk (struct node *node, int nr, int create, int zero,
   return 0;
 }
 
-error_t
+/* RUN is as for inode_getblk.  */
+static error_t
 block_getblk (struct node *node, block_t block, int nr, int create, int zero,
-	      block_t new_block, block_t *result)
+	      block_t new_block, block_t *result, block_t *run)
 {
   int i;
   block_t goal = 0;
@@ -198,6 +282,8 @@ block_getblk (struct node *node, block_t block, int nr, int create, int zero,
   *result = bh[nr];
   if (*result)
     {
+      if (run)
+	*run = run_length (bh + nr, EXT2_ADDR_PER_BLOCK (sblock) - nr);
       disk_cache_block_deref (bh);
       return 0;
     }
@@ -232,6 +318,8 @@ block_getblk (struct node *node, block_t block, int nr, int create, int zero,
     }
 
   bh[nr] = *result;
+  if (run)
+    *run = 1;
 
   if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
     sync_global_ptr (bh, 1);
@@ -247,16 +335,23 @@ block_getblk (struct node *node, block_t block, int nr, int create, int zero,
   return 0;
 }
 
-/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE.
-   If there is no such block yet, but CREATE is true, then it is created,
-   otherwise EINVAL is returned.  */
-error_t
-ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
+/* Look BLOCK of NODE up as ext2_getblk does, also returning in COUNT how
+   many blocks from BLOCK on are contiguous on disk.  */
+static error_t
+getblk (struct node *node, block_t block, int create, block_t *disk_block,
+	block_t *count)
 {
   error_t err;
   block_t indir, b;
   unsigned long addr_per_block = EXT2_ADDR_PER_BLOCK (sblock);
 
+  if (EXT4_HAS_INLINE_DATA (node))
+    /* There are no blocks; the data is moved out before any are added.  */
+    return create ? EIO : EINVAL;
+
+  if (EXT4_HAS_EXTENTS (node))
+    return ext4_getblk (node, block, create, disk_block, count);
+
   if (block > EXT2_NDIR_BLOCKS + addr_per_block +
       addr_per_block * addr_per_block +
       addr_per_block * addr_per_block * addr_per_block)
@@ -280,46 +375,70 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
       diskfs_node_disknode (node)->info.i_next_alloc_goal++;
     }
 
+  /* Sequential access mostly lands in a run found before, which saves
+     walking the indirect blocks, and taking the disk cache lock to do
+     so.  */
+  if (ext2_run_cache_lookup (node, block, disk_block, count))
+    return 0;
+
   b = block;
 
   if (block < EXT2_NDIR_BLOCKS)
-    return inode_getblk (node, block, create, 0, b, disk_block);
-
-  block -= EXT2_NDIR_BLOCKS;
-  if (block < addr_per_block)
+    err = inode_getblk (node, block, create, 0, b, disk_block, count);
+  else if ((block -= EXT2_NDIR_BLOCKS) < addr_per_block)
     {
-      err = inode_getblk (node, EXT2_IND_BLOCK, create, 1, b, &indir);
+      err = inode_getblk (node, EXT2_IND_BLOCK, create, 1, b, &indir, 0);
       if (!err)
-	err = block_getblk (node, indir, block, create, 0, b, disk_block);
-      return err;
+	err = block_getblk (node, indir, block, create, 0, b, disk_block,
+			    count);
     }
-
-  block -= addr_per_block;
-  if (block < addr_per_block * addr_per_block)
+  else if ((block -= addr_per_block) < addr_per_block * addr_per_block)
     {
-      err = inode_getblk (node, EXT2_DIND_BLOCK, create, 1, b, &indir);
+      err = inode_getblk (node, EXT2_DIND_BLOCK, create, 1, b, &indir, 0);
       if (!err)
 	err = block_getblk (node, indir, block / addr_per_block, create, 1,
-			    b, &indir);
+			    b, &indir, 0);
       if (!err)
 	err = block_getblk (node, indir, block & (addr_per_block - 1),
-			    create, 0, b, disk_block);
-      return err;
+			    create, 0, b, disk_block, count);
+    }
+  else
+    {
+      block -= addr_per_block * addr_per_block;
+      err = inode_getblk (node, EXT2_TIND_BLOCK, create, 1, b, &indir, 0);
+      if (!err)
+	err = block_getblk (node, indir,
+			    block / (addr_per_block * addr_per_block),
+			    create, 1, b, &indir, 0);
+      if (!err)
+	err =
+	  block_getblk (node, indir,
+			(block / addr_per_block) & (addr_per_block - 1),
+			create, 1, b, &indir, 0);
+      if (!err)
+	err = block_getblk (node, indir, block & (addr_per_block - 1),
+			    create, 0, b, disk_block, count);
     }
 
-  block -= addr_per_block * addr_per_block;
-  err = inode_getblk (node, EXT2_TIND_BLOCK, create, 1, b, &indir);
-  if (!err)
-    err = block_getblk (node, indir, block / (addr_per_block * addr_per_block),
-			create, 1, b, &indir);
   if (!err)
-    err =
-      block_getblk (node, indir,
-		    (block / addr_per_block) & (addr_per_block - 1),
-		    create, 1, b, &indir);
-  if (!err)
-    err = block_getblk (node, indir, block & (addr_per_block - 1), create, 0,
-			b, disk_block);
+    ext2_run_cache_add (node, b, *disk_block, *count);
 
   return err;
 }
+
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE.
+   If there is no such block yet, but CREATE is true, then it is created,
+   otherwise EINVAL is returned.  */
+error_t
+ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
+{
+  block_t count;
+  return getblk (node, block, create, disk_block, &count);
+}
+
+error_t
+ext2_getblks (struct node *node, block_t block,
+	      block_t *disk_block, block_t *count)
+{
+  return getblk (node, block, 0, disk_block, count);
+}
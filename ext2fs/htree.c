@@ -0,0 +1,740 @@
+/* Hashed directory indexes
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* A directory with EXT2_INDEX_FL keeps its names in ordinary directory
+   blocks, so it can always be read by scanning them in order.  Its
+   block 0 also holds the root of a tree, at most two levels deep, that
+   maps the hash of a name to the one leaf block that may hold it; see
+   <ext2_fs.h>.  The layout and the hashes are those of Linux and
+   e2fsprogs.  All functions here work on the directory as mapped by
+   diskfs_lookup_hard, with DP locked.  */
+
+#include <string.h>
+#include <stdlib.h>
+#include <hurd/sigpreempt.h>
+#include "ext2fs.h"
+
+/* Where the index entries start in the root and in interior blocks.  */
+#define DX_ROOT_OFFSET \
+  (2 * EXT2_DIR_REC_LEN (1) + sizeof (struct ext2_dx_root_info))
+#define DX_NODE_OFFSET EXT2_DIR_REC_LEN (0)
+
+#define DX_BLOCK(buf, block) \
+  ((char *) (buf) + ((vm_address_t) (block) << log2_block_size))
+
+#define DX_COUNT(entries) \
+  le16toh (((struct ext2_dx_countlimit *) (entries))->count)
+#define DX_LIMIT(entries) \
+  le16toh (((struct ext2_dx_countlimit *) (entries))->limit)
+#define DX_HASH(entry) le32toh ((entry)->hash)
+#define DX_CHILD(entry) (le32toh ((entry)->block) & 0x0fffffff)
+
+/* The largest hash; it is reserved to mean the end of the directory.  */
+#define DX_HASH_EOF 0xfffffffe
+
+static inline void
+dx_set_countlimit (struct ext2_dx_entry *entries, unsigned count,
+		   unsigned limit)
+{
+  struct ext2_dx_countlimit *cl = (struct ext2_dx_countlimit *) entries;
+  cl->count = htole16 (count);
+  cl->limit = htole16 (limit);
+}
+
+static inline struct ext2_dx_root_info *
+dx_root_info (vm_address_t buf)
+{
+  return (struct ext2_dx_root_info *) (DX_BLOCK (buf, 0)
+				       + 2 * EXT2_DIR_REC_LEN (1));
+}
+
+/* Hashing.  */
+
+/* The hash code used by the first htree implementation.  */
+static uint32_t
+dx_hack_hash (const char *name, size_t len, int unsigned_char)
+{
+  uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      int c = (unsigned_char
+	       ? (int) (unsigned char) name[i] : (int) (signed char) name[i]);
+      hash = hash1 + (hash0 ^ (uint32_t) (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+/* Fill the NUM words of BUF from the first NUM * 4 bytes of the LEN
+   bytes at MSG, padding with a pattern made from LEN.  */
+static void
+dx_str2hashbuf (const char *msg, size_t len, uint32_t *buf, int num,
+		int unsigned_char)
+{
+  uint32_t pad, val;
+  size_t i;
+
+  pad = (uint32_t) len | ((uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      int c = (unsigned_char
+	       ? (int) (unsigned char) msg[i] : (int) (signed char) msg[i]);
+      val = c + (val << 8);
+      if (i % 4 == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static inline uint32_t
+rol32 (uint32_t x, int s)
+{
+  return (x << s) | (x >> (32 - s));
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) ((a) += f (b, c, d) + (x), \
+				    (a) = rol32 ((a), (s)))
+#define K2 0x5a827999
+#define K3 0x6ed9eba1
+
+/* The MD4 transform cut down to three rounds of eight steps.  */
+static void
+dx_half_md4 (uint32_t buf[4], const uint32_t in[8])
+{
+  uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  ROUND (F, a, b, c, d, in[0], 3);
+  ROUND (F, d, a, b, c, in[1], 7);
+  ROUND (F, c, d, a, b, in[2], 11);
+  ROUND (F, b, c, d, a, in[3], 19);
+  ROUND (F, a, b, c, d, in[4], 3);
+  ROUND (F, d, a, b, c, in[5], 7);
+  ROUND (F, c, d, a, b, in[6], 11);
+  ROUND (F, b, c, d, a, in[7], 19);
+
+  ROUND (G, a, b, c, d, in[1] + K2, 3);
+  ROUND (G, d, a, b, c, in[3] + K2, 5);
+  ROUND (G, c, d, a, b, in[5] + K2, 9);
+  ROUND (G, b, c, d, a, in[7] + K2, 13);
+  ROUND (G, a, b, c, d, in[0] + K2, 3);
+  ROUND (G, d, a, b, c, in[2] + K2, 5);
+  ROUND (G, c, d, a, b, in[4] + K2, 9);
+  ROUND (G, b, c, d, a, in[6] + K2, 13);
+
+  ROUND (H, a, b, c, d, in[3] + K3, 3);
+  ROUND (H, d, a, b, c, in[7] + K3, 9);
+  ROUND (H, c, d, a, b, in[2] + K3, 11);
+  ROUND (H, b, c, d, a, in[6] + K3, 15);
+  ROUND (H, a, b, c, d, in[1] + K3, 3);
+  ROUND (H, d, a, b, c, in[5] + K3, 9);
+  ROUND (H, c, d, a, b, in[0] + K3, 11);
+  ROUND (H, b, c, d, a, in[4] + K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+#undef F
+#undef G
+#undef H
+#undef ROUND
+#undef K2
+#undef K3
+
+/* Sixteen rounds of the Tiny Encryption Algorithm.  */
+static void
+dx_tea (uint32_t buf[4], const uint32_t in[4])
+{
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* The hash of the LEN bytes at NAME under hash VERSION.  The low bit is
+   always clear; the index uses it to flag runs of equal hashes.  */
+static uint32_t
+dx_hash (const char *name, size_t len, int version)
+{
+  uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  uint32_t in[8];
+  uint32_t hash;
+  int unsigned_char = version >= EXT2_HASH_LEGACY_UNSIGNED;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (sblock->s_hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = le32toh (sblock->s_hash_seed[i]);
+
+  switch (version)
+    {
+    case EXT2_HASH_HALF_MD4:
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+      for (; len > 0; name += 32, len -= len < 32 ? len : 32)
+	{
+	  dx_str2hashbuf (name, len, in, 8, unsigned_char);
+	  dx_half_md4 (buf, in);
+	}
+      hash = buf[1];
+      break;
+
+    case EXT2_HASH_TEA:
+    case EXT2_HASH_TEA_UNSIGNED:
+      for (; len > 0; name += 16, len -= len < 16 ? len : 16)
+	{
+	  dx_str2hashbuf (name, len, in, 4, unsigned_char);
+	  dx_tea (buf, in);
+	}
+      hash = buf[0];
+      break;
+
+    default:
+      hash = dx_hack_hash (name, len, unsigned_char);
+      break;
+    }
+
+  hash &= ~1;
+  if (hash == DX_HASH_EOF)
+    hash = DX_HASH_EOF - 2;
+  return hash;
+}
+
+/* The hash version to use with the index whose root info is INFO.  */
+static int
+dx_hash_version (struct ext2_dx_root_info *info)
+{
+  int version = info->hash_version;
+  if (version <= EXT2_HASH_TEA
+      && (le32toh (sblock->s_flags) & EXT2_FLAGS_UNSIGNED_HASH))
+    version += EXT2_HASH_LEGACY_UNSIGNED;
+  return version;
+}
+
+/* Index blocks.  */
+
+/* Return whether block 0 of DP, mapped at BUF, is an index root we can
+   use.  */
+static int
+dx_root_ok (struct node *dp, vm_address_t buf)
+{
+  struct ext2_dir_entry_2 *dot = (struct ext2_dir_entry_2 *) DX_BLOCK (buf, 0);
+  struct ext2_dir_entry_2 *dotdot =
+    (struct ext2_dir_entry_2 *) ((char *) dot + EXT2_DIR_REC_LEN (1));
+  struct ext2_dx_root_info *info = dx_root_info (buf);
+
+  return (dp->dn_stat.st_size >= 2 * block_size
+	  && le16toh (dot->rec_len) == EXT2_DIR_REC_LEN (1)
+	  && le16toh (dotdot->rec_len) == block_size - EXT2_DIR_REC_LEN (1)
+	  && info->reserved_zero == 0
+	  && info->info_length == sizeof *info
+	  && info->hash_version <= EXT2_HASH_TEA
+	  && info->indirect_levels <= 1);
+}
+
+/* Return the index entries in block BLOCK of DP, mapped at BUF, which is
+   the root if ROOT; or 0 if they look wrong.  */
+static struct ext2_dx_entry *
+dx_entries (struct node *dp, vm_address_t buf, block_t block, int root)
+{
+  char *p = DX_BLOCK (buf, block);
+  struct ext2_dx_entry *entries;
+  unsigned limit;
+
+  if (((off_t) block + 1) << log2_block_size > dp->dn_stat.st_size)
+    return 0;
+
+  if (root)
+    {
+      entries = (struct ext2_dx_entry *) (p + DX_ROOT_OFFSET);
+      limit = (block_size - DX_ROOT_OFFSET) / sizeof *entries;
+    }
+  else
+    {
+      struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *) p;
+      if (de->inode != 0 || le16toh (de->rec_len) != block_size)
+	return 0;
+      entries = (struct ext2_dx_entry *) (p + DX_NODE_OFFSET);
+      limit = (block_size - DX_NODE_OFFSET) / sizeof *entries;
+    }
+
+  if (DX_LIMIT (entries) != limit
+      || DX_COUNT (entries) == 0 || DX_COUNT (entries) > limit)
+    return 0;
+  return entries;
+}
+
+/* Return the position of the last of ENTRIES whose hash is at most HASH.
+   The first entry covers all hashes below the second's.  */
+static int
+dx_search (struct ext2_dx_entry *entries, uint32_t hash)
+{
+  int lo = 1, hi = DX_COUNT (entries) - 1;
+
+  while (lo <= hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+      if (DX_HASH (&entries[mid]) > hash)
+	hi = mid - 1;
+      else
+	lo = mid + 1;
+    }
+  return lo - 1;
+}
+
+/* Return whether BLOCK can be a leaf of DP.  */
+static inline int
+dx_leaf_ok (struct node *dp, block_t block)
+{
+  return block != 0
+    && ((off_t) block + 1) << log2_block_size <= dp->dn_stat.st_size;
+}
+
+error_t
+ext2_dx_find (struct node *dp, vm_address_t buf, const char *name,
+	      size_t namelen, struct ext2_dx_path *path)
+{
+  struct ext2_dx_root_info *info = dx_root_info (buf);
+  block_t block = 0;
+  int level, levels;
+
+  if (! dx_root_ok (dp, buf))
+    return EINVAL;
+
+  levels = info->indirect_levels;
+  path->hash = dx_hash (name, namelen, dx_hash_version (info));
+
+  for (level = 0; level <= levels; level++)
+    {
+      struct ext2_dx_entry *entries = dx_entries (dp, buf, block, level == 0);
+      int pos;
+
+      if (! entries)
+	return EINVAL;
+      pos = dx_search (entries, path->hash);
+      path->level[level].block = block;
+      path->level[level].pos = pos;
+      block = DX_CHILD (&entries[pos]);
+    }
+
+  if (! dx_leaf_ok (dp, block))
+    return EINVAL;
+
+  path->levels = levels;
+  path->leaf = block;
+  return 0;
+}
+
+int
+ext2_dx_next (struct node *dp, vm_address_t buf, struct ext2_dx_path *path)
+{
+  struct ext2_dx_path next = *path;
+  struct ext2_dx_entry *entries;
+  block_t block;
+  int level;
+
+  /* Find the deepest level that has another entry to the right.  */
+  for (level = next.levels; ; level--)
+    {
+      if (level < 0)
+	return 0;
+      entries = dx_entries (dp, buf, next.level[level].block, level == 0);
+      if (! entries)
+	return 0;
+      if (next.level[level].pos + 1 < DX_COUNT (entries))
+	break;
+    }
+
+  /* The leaves under it continue ours only if they start with our hash,
+     flagged as a continuation.  */
+  next.level[level].pos++;
+  if ((DX_HASH (&entries[next.level[level].pos]) & ~1) != path->hash)
+    return 0;
+
+  block = DX_CHILD (&entries[next.level[level].pos]);
+  for (level++; level <= next.levels; level++)
+    {
+      entries = dx_entries (dp, buf, block, 0);
+      if (! entries)
+	return 0;
+      next.level[level].block = block;
+      next.level[level].pos = 0;
+      block = DX_CHILD (&entries[0]);
+    }
+
+  if (! dx_leaf_ok (dp, block))
+    return 0;
+
+  next.leaf = block;
+  *path = next;
+  return 1;
+}
+
+/* Add a block holding one unused entry to the end of directory DP,
+   mapped at BUF with room for it, and return its index in *BLOCK.  */
+static error_t
+dx_new_block (struct node *dp, vm_address_t buf, struct protid *cred,
+	      block_t *block)
+{
+  off_t size = dp->dn_stat.st_size;
+  struct ext2_dir_entry_2 *de;
+  error_t err;
+
+  while (size + block_size > dp->allocsize)
+    {
+      err = diskfs_grow (dp, size + block_size, cred);
+      if (err)
+	return err;
+    }
+
+  de = (struct ext2_dir_entry_2 *) (buf + size);
+  err = hurd_safe_memset (de, 0, block_size);
+  if (err)
+    return err == EKERN_MEMORY_ERROR ? ENOSPC : err;
+  de->rec_len = htole16 (block_size);
+
+  dp->dn_stat.st_size = size + block_size;
+  dp->dn_set_ctime = 1;
+  *block = size >> log2_block_size;
+  return 0;
+}
+
+/* Insert an entry for HASH and BLOCK after entry POS of ENTRIES, which
+   has room for it.  */
+static void
+dx_insert (struct ext2_dx_entry *entries, int pos, uint32_t hash,
+	   block_t block)
+{
+  unsigned count = DX_COUNT (entries);
+
+  memmove (&entries[pos + 2], &entries[pos + 1],
+	   (count - pos - 1) * sizeof *entries);
+  entries[pos + 1].hash = htole32 (hash);
+  entries[pos + 1].block = htole32 (block);
+  dx_set_countlimit (entries, count + 1, DX_LIMIT (entries));
+}
+
+/* A live entry of a leaf being split.  */
+struct dx_map_entry
+{
+  uint32_t hash;
+  uint16_t offs;
+  uint16_t size;
+};
+
+static int
+dx_map_cmp (const void *a, const void *b)
+{
+  const struct dx_map_entry *x = a, *y = b;
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->offs - y->offs;
+}
+
+/* Copy the N entries of MAP from the leaf at FROM into TO, packed, with
+   the last one taking up the rest of the block.  */
+static void
+dx_pack (char *to, const char *from, struct dx_map_entry *map, int n)
+{
+  struct ext2_dir_entry_2 *de = 0;
+  size_t offs = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      de = (struct ext2_dir_entry_2 *) (to + offs);
+      memcpy (de, from + map[i].offs, map[i].size);
+      de->rec_len = htole16 (map[i].size);
+      offs += map[i].size;
+    }
+  if (de)
+    de->rec_len = htole16 (map[n - 1].size + block_size - offs);
+  else
+    {
+      memset (to, 0, EXT2_DIR_REC_LEN (0));
+      ((struct ext2_dir_entry_2 *) to)->rec_len = htole16 (block_size);
+    }
+}
+
+error_t
+ext2_dx_split (struct node *dp, vm_address_t buf, struct ext2_dx_path *path,
+	       struct protid *cred)
+{
+  struct ext2_dx_root_info *info = dx_root_info (buf);
+  int version = dx_hash_version (info);
+  struct ext2_dx_entry *root, *node = 0, *parent;
+  struct dx_map_entry *map;
+  char *leaf = DX_BLOCK (buf, path->leaf), *tmp;
+  char *p;
+  block_t newleaf, newnode = 0;
+  uint32_t hash2;
+  size_t total, moved;
+  int n, split, full, ppos;
+  error_t err;
+
+  root = dx_entries (dp, buf, 0, 1);
+  if (path->levels > 0)
+    node = dx_entries (dp, buf, path->level[1].block, 0);
+  if (! root || (path->levels > 0 && ! node))
+    return EINVAL;
+
+  /* Without a third level, a full interior block under a full root
+     cannot take another leaf.  */
+  parent = node ?: root;
+  full = DX_COUNT (parent) == DX_LIMIT (parent);
+  if (full && path->levels > 0 && DX_COUNT (root) == DX_LIMIT (root))
+    return ENOSPC;
+
+  map = malloc ((block_size / EXT2_DIR_REC_LEN (1)) * sizeof *map);
+  tmp = malloc (block_size);
+  if (! map || ! tmp)
+    {
+      free (map);
+      free (tmp);
+      return ENOMEM;
+    }
+
+  /* Sort the live entries of the leaf by hash.  */
+  n = 0;
+  total = 0;
+  for (p = leaf; p < leaf + block_size;
+       p += le16toh (((struct ext2_dir_entry_2 *) p)->rec_len))
+    {
+      struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *) p;
+      if (! de->rec_len
+	  || p + le16toh (de->rec_len) > leaf + block_size
+	  || EXT2_DIR_REC_LEN (de->name_len) > le16toh (de->rec_len))
+	{
+	  free (map);
+	  free (tmp);
+	  return EINVAL;
+	}
+      if (de->inode)
+	{
+	  map[n].hash = dx_hash (de->name, de->name_len, version);
+	  map[n].offs = p - leaf;
+	  map[n].size = EXT2_DIR_REC_LEN (de->name_len);
+	  total += map[n].size;
+	  n++;
+	}
+    }
+  if (n < 2)
+    {
+      free (map);
+      free (tmp);
+      return ENOSPC;
+    }
+  qsort (map, n, sizeof *map, dx_map_cmp);
+
+  /* Move the upper half by size to the new leaf.  */
+  for (split = n, moved = 0; split > 1 && moved < total / 2; )
+    moved += map[--split].size;
+  hash2 = map[split].hash;
+  if (map[split - 1].hash == hash2)
+    hash2 |= 1;
+
+  err = dx_new_block (dp, buf, cred, &newleaf);
+  if (! err && full)
+    err = dx_new_block (dp, buf, cred, &newnode);
+  if (err)
+    {
+      free (map);
+      free (tmp);
+      return err;
+    }
+
+  dx_pack (DX_BLOCK (buf, newleaf), leaf, map + split, n - split);
+  dx_pack (tmp, leaf, map, split);
+  memcpy (leaf, tmp, block_size);
+  free (map);
+  free (tmp);
+
+  if (full && path->levels == 0)
+    {
+      /* Move the root's entries down into a new interior block.  */
+      struct ext2_dx_entry *entries =
+	(struct ext2_dx_entry *) (DX_BLOCK (buf, newnode) + DX_NODE_OFFSET);
+      unsigned count = DX_COUNT (root);
+
+      memcpy (entries, root, count * sizeof *entries);
+      dx_set_countlimit (entries, count,
+			 (block_size - DX_NODE_OFFSET) / sizeof *entries);
+      dx_set_countlimit (root, 1, DX_LIMIT (root));
+      root[0].block = htole32 (newnode);
+      info->indirect_levels = 1;
+
+      path->levels = 1;
+      path->level[1].block = newnode;
+      path->level[1].pos = path->level[0].pos;
+      path->level[0].pos = 0;
+      parent = entries;
+    }
+  else if (full)
+    {
+      /* Move the upper half of the interior block to a new one, and
+	 enter that in the root.  */
+      struct ext2_dx_entry *entries =
+	(struct ext2_dx_entry *) (DX_BLOCK (buf, newnode) + DX_NODE_OFFSET);
+      unsigned count = DX_COUNT (node);
+      unsigned m = count / 2;
+      uint32_t hashm = DX_HASH (&node[m]);
+
+      memcpy (entries, &node[m], (count - m) * sizeof *entries);
+      dx_set_countlimit (entries, count - m, DX_LIMIT (node));
+      dx_set_countlimit (node, m, DX_LIMIT (node));
+      dx_insert (root, path->level[0].pos, hashm, newnode);
+
+      if (path->level[1].pos + 1 > m)
+	{
+	  path->level[0].pos++;
+	  path->level[1].block = newnode;
+	  path->level[1].pos -= m;
+	  parent = entries;
+	}
+    }
+
+  ppos = path->level[path->levels].pos;
+  dx_insert (parent, ppos, hash2, newleaf);
+
+  if (path->hash >= hash2)
+    {
+      path->level[path->levels].pos = ppos + 1;
+      path->leaf = newleaf;
+    }
+  return 0;
+}
+
+error_t
+ext2_dx_create (struct node *dp, vm_address_t buf, const char *name,
+		size_t namelen, struct ext2_dx_path *path,
+		struct protid *cred)
+{
+  char *blk = DX_BLOCK (buf, 0);
+  struct ext2_dir_entry_2 *dot = (struct ext2_dir_entry_2 *) blk;
+  struct ext2_dir_entry_2 *dotdot, *de, *last = 0;
+  struct ext2_dx_root_info *info;
+  struct ext2_dx_entry *entries;
+  char dotdot_copy[EXT2_DIR_REC_LEN (2)];
+  char *leaf, *p;
+  block_t block;
+  size_t offs;
+  error_t err;
+
+  if (dp->dn_stat.st_size != block_size)
+    return EINVAL;
+
+  /* "." and ".." must come first.  */
+  if (dot->name_len != 1 || dot->name[0] != '.'
+      || le16toh (dot->rec_len) < EXT2_DIR_REC_LEN (1)
+      || le16toh (dot->rec_len) + EXT2_DIR_REC_LEN (2) > block_size)
+    return EINVAL;
+  dotdot = (struct ext2_dir_entry_2 *) (blk + le16toh (dot->rec_len));
+  if (dotdot->name_len != 2 || dotdot->name[0] != '.' || dotdot->name[1] != '.'
+      || le16toh (dotdot->rec_len) < EXT2_DIR_REC_LEN (2)
+      || (char *) dotdot + le16toh (dotdot->rec_len) > blk + block_size)
+    return EINVAL;
+
+  for (p = (char *) dotdot + le16toh (dotdot->rec_len);
+       p < blk + block_size; p += le16toh (de->rec_len))
+    {
+      de = (struct ext2_dir_entry_2 *) p;
+      if (! de->rec_len
+	  || p + le16toh (de->rec_len) > blk + block_size
+	  || EXT2_DIR_REC_LEN (de->name_len) > le16toh (de->rec_len))
+	return EINVAL;
+    }
+
+  err = dx_new_block (dp, buf, cred, &block);
+  if (err)
+    return err;
+  leaf = DX_BLOCK (buf, block);
+
+  /* Move the other entries into the new leaf, packed.  */
+  offs = 0;
+  for (p = (char *) dotdot + le16toh (dotdot->rec_len);
+       p < blk + block_size; p += le16toh (de->rec_len))
+    {
+      de = (struct ext2_dir_entry_2 *) p;
+      if (de->inode)
+	{
+	  size_t size = EXT2_DIR_REC_LEN (de->name_len);
+	  last = (struct ext2_dir_entry_2 *) (leaf + offs);
+	  memcpy (last, de, size);
+	  last->rec_len = htole16 (size);
+	  offs += size;
+	}
+    }
+  if (last)
+    last->rec_len = htole16 (le16toh (last->rec_len) + block_size - offs);
+
+  /* Turn block 0 into the root.  */
+  memcpy (dotdot_copy, dotdot, sizeof dotdot_copy);
+  dot->rec_len = htole16 (EXT2_DIR_REC_LEN (1));
+  dotdot = (struct ext2_dir_entry_2 *) (blk + EXT2_DIR_REC_LEN (1));
+  memcpy (dotdot, dotdot_copy, sizeof dotdot_copy);
+  dotdot->rec_len = htole16 (block_size - EXT2_DIR_REC_LEN (1));
+
+  info = dx_root_info (buf);
+  memset (info, 0, block_size - 2 * EXT2_DIR_REC_LEN (1));
+  info->hash_version = (sblock->s_def_hash_version <= EXT2_HASH_TEA
+			? sblock->s_def_hash_version : EXT2_HASH_HALF_MD4);
+  info->info_length = sizeof *info;
+
+  entries = (struct ext2_dx_entry *) (blk + DX_ROOT_OFFSET);
+  dx_set_countlimit (entries, 1,
+		     (block_size - DX_ROOT_OFFSET) / sizeof *entries);
+  entries[0].block = htole32 (block);
+
+  diskfs_node_disknode (dp)->info.i_flags |= EXT2_INDEX_FL;
+  dp->dn_set_ctime = 1;
+
+  return ext2_dx_find (dp, buf, name, namelen, path);
+}
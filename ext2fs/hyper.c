@@ -18,6 +18,7 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <error.h>
 #include <inttypes.h>
@@ -111,8 +112,6 @@ get_hypermetadata (void)
 		  store->block_size, block_size);
 
   /* Set these handy variables.  */
-  inodes_per_block = block_size / EXT2_INODE_SIZE (sblock);
-
   frag_size = EXT2_MIN_FRAG_SIZE << le32toh (sblock->s_log_frag_size);
   if (frag_size == 0)
     ext2_panic ("frag size is zero!");
@@ -133,12 +132,14 @@ get_hypermetadata (void)
 			features);
 	  diskfs_readonly = 1;
 	}
-      if (le16toh (sblock->s_inode_size) != EXT2_GOOD_OLD_INODE_SIZE)
-	ext2_panic ("inode size %d isn't supported, only %d is supported", le16toh (sblock->s_inode_size), EXT2_GOOD_OLD_INODE_SIZE);
-      if (EXT2_HAS_COMPAT_FEATURE (sblock, EXT3_FEATURE_COMPAT_HAS_JOURNAL))
-        ext2_warning ("mounting ext3 filesystem as ext2");
+      unsigned int inode_size = le16toh (sblock->s_inode_size);
+      if (inode_size < EXT2_GOOD_OLD_INODE_SIZE || inode_size > block_size
+	  || (inode_size & (inode_size - 1)) != 0)
+	ext2_panic ("inode size %d isn't supported", inode_size);
     }
 
+  inodes_per_block = block_size / EXT2_INODE_SIZE (sblock);
+
   groups_count =
     ((le32toh (sblock->s_blocks_count) - le32toh (sblock->s_first_data_block) +
       le32toh (sblock->s_blocks_per_group) - 1)
@@ -149,6 +150,24 @@ get_hypermetadata (void)
   addr_per_block = block_size / sizeof (block_t);
   db_per_group = (groups_count + desc_per_block - 1) / desc_per_block;
 
+  jbd2_load ();
+  if (jbd2_needs_recovery ())
+    {
+      if (store->flags & STORE_READONLY)
+	{
+	  ext2_warning ("journal needs recovery but the device is read-only");
+	  diskfs_readonly = 1;
+	}
+      else
+	{
+	  jbd2_recover ();
+	  /* The replayed blocks may include the superblock and the group
+	     descriptors, so start over.  */
+	  get_hypermetadata ();
+	  return;
+	}
+    }
+
   ext2fs_clean = sblock->s_state & htole16 (EXT2_VALID_FS);
   if (! ext2fs_clean)
     {
@@ -170,6 +189,103 @@ get_hypermetadata (void)
     }
 }
 
+/* The CRC-16 (polynomial 0x8005, bit-reversed) of LEN bytes at BUF,
+   continuing from CRC.  */
+static uint16_t
+crc16 (uint16_t crc, const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  int i;
+
+  while (len--)
+    {
+      crc ^= *p++;
+      for (i = 0; i < 8; i++)
+	crc = (crc >> 1) ^ (crc & 1 ? 0xa001 : 0);
+    }
+  return crc;
+}
+
+/* The checksum of the descriptor GDP of group GROUP, as mke2fs and
+   e2fsck compute it: over the filesystem's UUID, the group number, and
+   the descriptor up to the checksum itself.  */
+static uint16_t
+group_desc_csum (unsigned long group, const struct ext2_group_desc *gdp)
+{
+  uint32_t le_group = htole32 (group);
+  uint16_t crc;
+
+  crc = crc16 (~0, sblock->s_uuid, sizeof sblock->s_uuid);
+  crc = crc16 (crc, &le_group, sizeof le_group);
+  crc = crc16 (crc, gdp, offsetof (struct ext2_group_desc, bg_checksum));
+  return htole16 (crc);
+}
+
+/* Several threads may change different parts of one descriptor at
+   once, holding different locks; the last of them to store the
+   checksum must have seen every change.  */
+static pthread_spinlock_t group_desc_csum_lock = PTHREAD_SPINLOCK_INITIALIZER;
+
+void
+ext2_group_desc_csum_set (unsigned long group, struct ext2_group_desc *gdp)
+{
+  if (! EXT2_HAS_GDT_CSUM (sblock))
+    return;
+
+  pthread_spin_lock (&group_desc_csum_lock);
+  gdp->bg_checksum = group_desc_csum (group, gdp);
+  pthread_spin_unlock (&group_desc_csum_lock);
+}
+
+/* Check the group descriptors' checksums, and make the filesystem
+   read-only if one is wrong: its counts and flags can't be trusted.  */
+static void
+check_group_descs (void)
+{
+  unsigned long i;
+
+  if (! EXT2_HAS_GDT_CSUM (sblock))
+    return;
+
+  for (i = 0; i < groups_count; i++)
+    if (group_desc (i)->bg_checksum != group_desc_csum (i, group_desc (i)))
+      {
+	ext2_warning ("checksum of group descriptor %lu is wrong", i);
+	if (! diskfs_readonly)
+	  {
+	    ext2_warning ("MOUNTED READ-ONLY; PLEASE fsck");
+	    diskfs_readonly = 1;
+	    diskfs_readonly_changed (1);
+	  }
+	return;
+      }
+}
+
+/* Make the superblock's free counts the sum of the group descriptors',
+   which are updated with the bitmaps and so are right even when the
+   superblock was not written back at unmount.  */
+static void
+sum_group_free_counts (void)
+{
+  uint32_t free_blocks = 0, free_inodes = 0;
+  unsigned long i;
+
+  for (i = 0; i < groups_count; i++)
+    {
+      free_blocks += le16toh (group_desc (i)->bg_free_blocks_count);
+      free_inodes += le16toh (group_desc (i)->bg_free_inodes_count);
+    }
+
+  if (le32toh (sblock->s_free_blocks_count) != free_blocks
+      || le32toh (sblock->s_free_inodes_count) != free_inodes)
+    {
+      sblock->s_free_blocks_count = htole32 (free_blocks);
+      sblock->s_free_inodes_count = htole32 (free_inodes);
+      if (! diskfs_readonly)
+	sblock_dirty = 1;
+    }
+}
+
 static struct ext2_super_block *mapped_sblock;
 
 void
@@ -181,21 +297,36 @@ map_hypermetadata (void)
      These are stored in the filesystem blocks following the superblock.  */
   group_desc_image =
     (struct ext2_group_desc *) bptr (group_desc_block);
+
+  /* Mounting looks at the descriptors only, never at the bitmaps,
+     which are read as the allocator reaches each group.  A clean
+     filesystem's superblock counts are trusted as they are.  */
+  check_group_descs ();
+  if (! ext2fs_clean)
+    sum_group_free_counts ();
+
+  ext2_balloc_init ();
 }
 
 error_t
 diskfs_set_hypermetadata (int wait, int clean)
 {
+  ext2_sync_free_blocks_count ();
+
   if (clean && ext2fs_clean && !(sblock->s_state & htole16 (EXT2_VALID_FS)))
     /* The filesystem is clean, so we need to set the clean flag.  */
     {
       sblock->s_state |= htole16 (EXT2_VALID_FS);
+      EXT2_CLEAR_INCOMPAT_FEATURE (sblock, EXT3_FEATURE_INCOMPAT_RECOVER);
       sblock_dirty = 1;
     }
   else if (!clean && (sblock->s_state & htole16 (EXT2_VALID_FS)))
     /* The filesystem just became dirty, so clear the clean flag.  */
     {
       sblock->s_state &= htole16 (~EXT2_VALID_FS);
+      if (jbd2_present)
+	/* Tell fsck to look at the journal should we crash.  */
+	EXT2_SET_INCOMPAT_FEATURE (sblock, EXT3_FEATURE_INCOMPAT_RECOVER);
       sblock_dirty = 1;
       wait = 1;
     }
@@ -215,6 +346,10 @@ diskfs_set_hypermetadata (int wait, int clean)
 
   sync_global (wait);
 
+  if (clean && wait)
+    /* A clean filesystem leaves nothing to replay.  */
+    jbd2_checkpoint ();
+
   return 0;
 }
 
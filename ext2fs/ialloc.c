@@ -45,9 +45,44 @@
 #include "bitmap.c"
 
 #include <inttypes.h>
+#include <trace.h>
 
 /* ---------------------------------------------------------------- */
 
+/* True if the group with descriptor GDP has no inode bitmap on disk
+   yet.  */
+static inline int
+inode_bitmap_uninit (struct ext2_group_desc *gdp)
+{
+  return (EXT2_HAS_GDT_CSUM (sblock)
+	  && (gdp->bg_flags & htole16 (EXT4_BG_INODE_UNINIT)));
+}
+
+/* Fill in BH, the inode bitmap of group GROUP with descriptor GDP,
+   which mke2fs left uninitialized because none of the group's inodes
+   were in use.  Called with global_lock held.  */
+static void
+init_inode_bitmap (unsigned long group, struct ext2_group_desc *gdp,
+		   unsigned char *bh)
+{
+  unsigned long i;
+
+  ext2_debug ("initializing inode bitmap of group %lu", group);
+
+  memset (bh, 0, block_size);
+  for (i = le32toh (sblock->s_inodes_per_group); i < block_size * 8; i++)
+    set_bit (i, bh);
+  disk_cache_block_ref_ptr (bh);
+  record_global_poke (bh);
+
+  gdp->bg_flags &= htole16 (~EXT4_BG_INODE_UNINIT);
+  ext2_group_desc_csum_set (group, gdp);
+  disk_cache_block_ref_ptr (gdp);
+  record_global_poke (gdp);
+}
+
+/* ---------------------------------------------------------------- */
+
 /* Free node NP; the on disk copy has already been synced with
    diskfs_node_update (where NP->dn_stat.st_mode was 0).  It's
    mode used to be OLD_MODE.  */
@@ -91,6 +126,7 @@ diskfs_free_node (struct node *np, mode_t old_mode)
       gdp->bg_free_inodes_count = htole16 (le16toh (gdp->bg_free_inodes_count) + 1);
       if (S_ISDIR (old_mode))
 	gdp->bg_used_dirs_count = htole16 (le16toh (gdp->bg_used_dirs_count) - 1);
+      ext2_group_desc_csum_set (block_group, gdp);
       disk_cache_block_ref_ptr (gdp);
       record_global_poke (gdp);
 
@@ -105,24 +141,137 @@ diskfs_free_node (struct node *np, mode_t old_mode)
 
 /* ---------------------------------------------------------------- */
 
+/* The name of the extended attribute a directory keeps its child group
+   in, so that it survives remounts.  */
+#define CHILD_GROUP_XATTR "gnu.ext2fs.child_group"
+
+/* Return the group new files in directory DIR start looking in: the
+   group the last of them went to, or failing that the directory's
+   own.  DIR is locked.  */
+static long
+dir_child_group (struct node *dir)
+{
+  struct disknode *dn = diskfs_node_disknode (dir);
+
+  if (dn->child_group < 0)
+    {
+      uint32_t group;
+      size_t len = sizeof group;
+
+      dn->child_group = inode_group_num (dir->cache_id);
+      if (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR)
+	  && ext2_get_xattr (dir, CHILD_GROUP_XATTR, (char *) &group, &len) == 0
+	  && len == sizeof group
+	  && le32toh (group) < groups_count)
+	dn->child_group = le32toh (group);
+    }
+  return dn->child_group;
+}
+
+/* Record that a new file of directory DIR went to group GROUP.  DIR is
+   locked.  */
+static void
+dir_set_child_group (struct node *dir, long group)
+{
+  struct disknode *dn = diskfs_node_disknode (dir);
+  uint32_t value = htole32 (group);
+
+  if (dn->child_group == group)
+    return;
+  dn->child_group = group;
+
+  /* Only a change is written, which happens when a group fills up, so
+     most directories never have the attribute.  */
+  if (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR)
+      && !diskfs_readonly)
+    ext2_set_xattr (dir, CHILD_GROUP_XATTR, (char *) &value, sizeof value, 0);
+}
+
+/* Choose a group for a new directory at the top of a hierarchy, in the
+   Orlov manner: spread such directories out, over the groups with more
+   free inodes and blocks than average, preferring those with fewest
+   directories.  Return the group, or -1.  Called with global_lock
+   held.  */
+static int
+find_group_orlov_top (unsigned long avefreei, unsigned long avefreeb)
+{
+  static unsigned long start;
+  int best = -1;
+  unsigned long best_ndirs = ~0UL;
+
+  /* Rotate the starting point so that ties go to different groups.  */
+  start = (start + 1) % groups_count;
+
+  for (unsigned long j = 0; j < groups_count; j++)
+    {
+      unsigned long i = (start + j) % groups_count;
+      struct ext2_group_desc *gdp = group_desc (i);
+
+      if (le16toh (gdp->bg_free_inodes_count) < avefreei
+	  || le16toh (gdp->bg_free_blocks_count) < avefreeb)
+	continue;
+      if (le16toh (gdp->bg_used_dirs_count) < best_ndirs)
+	{
+	  best = i;
+	  best_ndirs = le16toh (gdp->bg_used_dirs_count);
+	}
+    }
+  return best;
+}
+
+/* Choose a group for a new directory below the top, whose parent's
+   children go to group PARENT: the first group from PARENT on that is
+   not much worse than average at free inodes and blocks and does not
+   have too many directories already.  Return the group, or -1.  Called
+   with global_lock held.  */
+static int
+find_group_orlov (long parent, unsigned long avefreei, unsigned long avefreeb,
+		  unsigned long ndirs)
+{
+  unsigned long inodes_per_group = le32toh (sblock->s_inodes_per_group);
+  unsigned long blocks_per_group = le32toh (sblock->s_blocks_per_group);
+  unsigned long max_dirs = ndirs / groups_count + inodes_per_group / 16;
+  long min_inodes = (long) avefreei - (long) (inodes_per_group / 4);
+  long min_blocks = (long) avefreeb - (long) (blocks_per_group / 4);
+
+  if (min_inodes < 1)
+    min_inodes = 1;
+  if (min_blocks < 1)
+    min_blocks = 1;
+
+  for (unsigned long j = 0; j < groups_count; j++)
+    {
+      unsigned long i = (parent + j) % groups_count;
+      struct ext2_group_desc *gdp = group_desc (i);
+
+      if (le16toh (gdp->bg_used_dirs_count) < max_dirs
+	  && (long) le16toh (gdp->bg_free_inodes_count) >= min_inodes
+	  && (long) le16toh (gdp->bg_free_blocks_count) >= min_blocks)
+	return i;
+    }
+  return -1;
+}
+
 /*
- * There are two policies for allocating an inode.  If the new inode is
- * a directory, then a forward search is made for a block group with both
- * free space and a low directory-to-inode ratio; if that fails, then of
- * the groups with above-average free space, that group with the fewest
- * directories already is chosen.
+ * New directories are placed in the Orlov manner.  Those at the top of a
+ * hierarchy (in the root, or in a directory with EXT2_TOPDIR_FL set) are
+ * spread out over the emptier groups; others stay in their parent's
+ * group unless it is fuller than average, and else go to the next group
+ * that is not.  Failing that, of the groups with above-average free
+ * inodes the one with most free blocks is chosen.
  *
- * For other inodes, search forward from the parent directory\'s block
- * group to find a free inode.
+ * For other inodes, search forward from the group the directory's
+ * files last went to, to find a free inode.
  */
 ino_t
-ext2_alloc_inode (ino_t dir_inum, mode_t mode)
+ext2_alloc_inode (struct node *dir, mode_t mode)
 {
   unsigned char *bh = NULL;
   int i, j, avefreei;
   ino_t inum;
   struct ext2_group_desc *gdp;
   struct ext2_group_desc *tmp;
+  long parent_group = dir_child_group (dir);
 
   pthread_spin_lock (&global_lock);
 
@@ -133,22 +282,23 @@ repeat:
 
   if (S_ISDIR (mode))
     {
-      avefreei = le32toh (sblock->s_free_inodes_count) / groups_count;
+      unsigned long avefreeb, ndirs = 0;
 
-/* I am not yet convinced that this next bit is necessary.
-      i = inode_group_num(dir_inum);
+      avefreei = le32toh (sblock->s_free_inodes_count) / groups_count;
+      avefreeb = le32toh (sblock->s_free_blocks_count) / groups_count;
       for (j = 0; j < groups_count; j++)
-	{
-	  tmp = group_desc (i);
-	  if ((le16toh (tmp->bg_used_dirs_count) << 8) < le16toh (tmp->bg_free_inodes_count))
-	    {
-	      gdp = tmp;
-	      break;
-	    }
-	  else
-	    i = ++i % groups_count;
-	}
- */
+	ndirs += le16toh (group_desc (j)->bg_used_dirs_count);
+
+      if (dir->cache_id == EXT2_ROOT_INO
+	  || diskfs_node_disknode (dir)->info.i_flags & EXT2_TOPDIR_FL)
+	i = find_group_orlov_top (avefreei, avefreeb);
+      else
+	i = find_group_orlov (inode_group_num (dir->cache_id),
+			      avefreei, avefreeb, ndirs);
+      if (i >= 0)
+	gdp = group_desc (i);
+      else
+	i = 0;
 
       if (!gdp)
 	{
@@ -172,9 +322,9 @@ repeat:
   else
     {
       /*
-       * Try to place the inode in its parent directory
+       * Try to place the inode with its siblings
        */
-      i = inode_group_num(dir_inum);
+      i = parent_group;
       tmp = group_desc (i);
       if (le16toh (tmp->bg_free_inodes_count))
 	gdp = tmp;
@@ -202,7 +352,7 @@ repeat:
 	  /*
 	   * That failed: try linear search for a free inode
 	   */
-	  i = inode_group_num(dir_inum) + 1;
+	  i = parent_group + 1;
 	  for (j = 2; j < groups_count; j++)
 	    {
 	      if (++i >= groups_count)
@@ -224,6 +374,8 @@ repeat:
     }
 
   bh = disk_cache_block_ref (le32toh (gdp->bg_inode_bitmap));
+  if (inode_bitmap_uninit (gdp))
+    init_inode_bitmap (i, gdp, bh);
   if ((inum =
        find_first_zero_bit ((uint32_t *) bh, le32toh (sblock->s_inodes_per_group)))
       < le32toh (sblock->s_inodes_per_group))
@@ -251,6 +403,17 @@ repeat:
       goto repeat;
     }
 
+  if (EXT2_HAS_GDT_CSUM (sblock))
+    {
+      /* e2fsck does not look at the inodes past the used part of the
+	 table, so it must cover this one.  */
+      unsigned long used = (le32toh (sblock->s_inodes_per_group)
+			    - le16toh (gdp->bg_itable_unused));
+      if (inum >= used)
+	gdp->bg_itable_unused =
+	  htole16 (le32toh (sblock->s_inodes_per_group) - inum - 1);
+    }
+
   inum += i * le32toh (sblock->s_inodes_per_group) + 1;
   if (inum < EXT2_FIRST_INO (sblock) || inum > le32toh (sblock->s_inodes_count))
     {
@@ -263,6 +426,7 @@ repeat:
   gdp->bg_free_inodes_count = htole16 (le16toh (gdp->bg_free_inodes_count) - 1);
   if (S_ISDIR (mode))
     gdp->bg_used_dirs_count = htole16 (le16toh (gdp->bg_used_dirs_count) + 1);
+  ext2_group_desc_csum_set (i, gdp);
   disk_cache_block_ref_ptr (gdp);
   record_global_poke (gdp);
 
@@ -278,7 +442,14 @@ repeat:
      fields.  */
   {
     struct ext2_inode *di = dino_ref (inum);
-    memset (di, 0, sizeof *di);
+    size_t extra = EXT2_INODE_SIZE (sblock) - EXT2_GOOD_OLD_INODE_SIZE;
+
+    memset (di, 0, EXT2_INODE_SIZE (sblock));
+    if (extra >= sizeof (struct ext2_inode_extra))
+      /* Reserve the standard extra fields, leaving the rest of the inode
+	 for extended attributes.  */
+      EXT2_INODE_EXTRA (di)->i_extra_isize =
+	htole16 (sizeof (struct ext2_inode_extra));
     dino_deref (di);
   }
 
@@ -303,11 +474,15 @@ diskfs_alloc_node (struct node *dir, mode_t mode, struct node **node)
 
   assert_backtrace (!diskfs_readonly);
 
-  inum = ext2_alloc_inode (dir->cache_id, mode);
+  inum = ext2_alloc_inode (dir, mode);
+  TRACE (TRACE_EXT2_ALLOC_INODE, inum, dir->cache_id);
 
   if (inum == 0)
     return ENOSPC;
 
+  if (! S_ISDIR (mode))
+    dir_set_child_group (dir, inode_group_num (inum));
+
   err = diskfs_cached_lookup (inum, &np);
   if (err)
     return err;
@@ -326,12 +501,21 @@ diskfs_alloc_node (struct node *dir, mode_t mode, struct node **node)
   /* Zero out the block pointers in case there's some noise left on disk.  */
   for (block = 0; block < EXT2_N_BLOCKS; block++)
     diskfs_node_disknode (np)->info.i_data[block] = 0;
+  ext2_run_cache_clear (np);
 
   /* Propagate initial inode flags from the directory, as Linux does.  */
   diskfs_node_disknode (np)->info.i_flags =
     ext2_mask_flags(mode,
 	       diskfs_node_disknode (dir)->info.i_flags & EXT2_FL_INHERITED);
 
+  /* Files and directories get extent trees where the filesystem has
+     them, unless a file can start out with its data inline.  Symlinks
+     don't, since fast ones keep their target in i_data.  */
+  if (! (S_ISREG (mode) && ext4_inline_new (np))
+      && (S_ISREG (mode) || S_ISDIR (mode))
+      && EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT4_FEATURE_INCOMPAT_EXTENTS))
+    ext4_ext_init (np);
+
   diskfs_node_disknode (np)->info.i_faddr = 0;
   diskfs_node_disknode (np)->info.i_frag_no = 0;
   diskfs_node_disknode (np)->info.i_frag_size = 0;
@@ -383,6 +567,11 @@ ext2_count_free_inodes (void)
       void *bh;
       gdp = group_desc (i);
       desc_count += le16toh (gdp->bg_free_inodes_count);
+      if (inode_bitmap_uninit (gdp))
+	{
+	  bitmap_count += le16toh (gdp->bg_free_inodes_count);
+	  continue;
+	}
       bh = disk_cache_block_ref (le32toh (gdp->bg_inode_bitmap));
       x = count_free (bh, le32toh (sblock->s_inodes_per_group) / 8);
       disk_cache_block_deref (bh);
@@ -418,6 +607,11 @@ ext2_check_inodes_bitmap (void)
       void *bh;
       gdp = group_desc (i);
       desc_count += le16toh (gdp->bg_free_inodes_count);
+      if (inode_bitmap_uninit (gdp))
+	{
+	  bitmap_count += le16toh (gdp->bg_free_inodes_count);
+	  continue;
+	}
       bh = disk_cache_block_ref (le32toh (gdp->bg_inode_bitmap));
       x = count_free (bh, le32toh (sblock->s_inodes_per_group) / 8);
       disk_cache_block_deref (bh);
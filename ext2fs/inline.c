@@ -0,0 +1,351 @@
+/* Inline data: file contents kept in the inode
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* With the inline_data feature, an inode with EXT4_INLINE_DATA_FL has no
+   blocks: the first EXT4_MIN_INLINE_DATA_SIZE bytes of its data are in
+   i_block, and the rest in the value of its system.data attribute, which
+   ext4 wants in the body of the inode.
+
+   New regular files start out like this, with an empty system.data,
+   and are written in place while they fit in i_block.  The pager reads
+   inline data as the first page of the file.  A file that grows past
+   i_block, or whose data is partly in system.data, is moved to a block
+   when it is first made writable or grown, as is an inline directory;
+   those are mostly made by other systems.
+
+   An inline directory starts with the inode number of its parent, and
+   has no entries for "." and "..".  It is shown to the directory code
+   as one directory block that has them, and which it is converted to
+   before being changed, so that dir.c need not know about it.  Its
+   size is that of a block in memory, and that of its inline data on
+   disk; see write_node.
+
+   Symlinks too long for i_block but not for the inode are inline as
+   well.
+
+   The inline data of a node only changes with its ALLOC_LOCK held for
+   writing.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ext2fs.h"
+
+#define INLINE_XATTR "system.data"
+
+error_t
+ext4_inline_read_node (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  size_t len = 0;
+  error_t err;
+
+  err = diskfs_catch_exception ();
+  if (err)
+    return err;
+  dn->inline_size = EXT4_MIN_INLINE_DATA_SIZE;
+  if (ext2_get_ibody_xattr (node, INLINE_XATTR, NULL, &len) == 0)
+    dn->inline_size += len;
+  diskfs_end_catch_exception ();
+
+  if (dn->inline_size > block_size)
+    {
+      ext2_warning ("inline data of inode %llu is too big", node->cache_id);
+      return EIO;
+    }
+
+  if (S_ISDIR (node->dn_stat.st_mode))
+    {
+      node->dn_stat.st_size = block_size;
+      node->allocsize = block_size;
+    }
+  else if (S_ISREG (node->dn_stat.st_mode))
+    node->allocsize = dn->inline_size;
+  else
+    /* Symlinks are read by ext4_inline_symlink_read.  */
+    node->allocsize = 0;
+
+  return 0;
+}
+
+int
+ext4_inline_new (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  if (! EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT4_FEATURE_INCOMPAT_INLINE_DATA)
+      || ext2_set_ibody_xattr (node, INLINE_XATTR, "", 0))
+    return 0;
+
+  dn->info.i_flags |= EXT4_INLINE_DATA_FL;
+  dn->inline_size = EXT4_MIN_INLINE_DATA_SIZE;
+  node->allocsize = EXT4_MIN_INLINE_DATA_SIZE;
+  return 1;
+}
+
+int
+ext4_inline_writable (struct node *node)
+{
+  return (S_ISREG (node->dn_stat.st_mode)
+	  && (diskfs_node_disknode (node)->inline_size
+	      == EXT4_MIN_INLINE_DATA_SIZE));
+}
+
+/* Make the BLOCK_SIZE bytes at BUF the directory block that shows the
+   LEN bytes of inline directory data at DATA.  */
+static error_t
+inline_dir_read (struct node *node, char *buf, const char *data, size_t len)
+{
+  struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *) buf;
+  int type = (EXT2_HAS_INCOMPAT_FEATURE (sblock,
+					 EXT2_FEATURE_INCOMPAT_FILETYPE)
+	      ? EXT2_FT_DIR : 0);
+  size_t offs, end;
+
+  de->inode = htole32 (node->cache_id);
+  de->rec_len = htole16 (EXT2_DIR_REC_LEN (1));
+  de->name_len = 1;
+  de->file_type = type;
+  memcpy (de->name, ".", 1);
+
+  de = (struct ext2_dir_entry_2 *) (buf + EXT2_DIR_REC_LEN (1));
+  memcpy (&de->inode, data, sizeof de->inode);
+  de->rec_len = htole16 (EXT2_DIR_REC_LEN (2));
+  de->name_len = 2;
+  de->file_type = type;
+  memcpy (de->name, "..", 2);
+
+  offs = EXT2_DIR_REC_LEN (1) + EXT2_DIR_REC_LEN (2);
+  end = offs + len - sizeof de->inode;
+  memcpy (buf + offs, data + sizeof de->inode, len - sizeof de->inode);
+
+  while (offs < end)
+    {
+      struct ext2_dir_entry_2 *next =
+	(struct ext2_dir_entry_2 *) (buf + offs);
+      size_t rec_len = le16toh (next->rec_len);
+
+      if (rec_len < EXT2_DIR_REC_LEN (next->name_len) || rec_len & 3
+	  || offs + rec_len > end)
+	{
+	  ext2_warning ("inline directory %llu is corrupt", node->cache_id);
+	  return EIO;
+	}
+      de = next;
+      offs += rec_len;
+    }
+
+  /* The last entry takes the rest of the block.  */
+  de->rec_len = htole16 (block_size - ((char *) de - buf));
+  return 0;
+}
+
+error_t
+ext4_inline_read (struct node *node, void *buf)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  size_t len = dn->inline_size;
+  char *data = S_ISDIR (node->dn_stat.st_mode) ? alloca (len) : buf;
+
+  memcpy (data, dn->info.i_data, EXT4_MIN_INLINE_DATA_SIZE);
+  if (len > EXT4_MIN_INLINE_DATA_SIZE)
+    {
+      size_t xlen = len - EXT4_MIN_INLINE_DATA_SIZE;
+      error_t err = diskfs_catch_exception ();
+      if (err)
+	return err;
+      err = ext2_get_ibody_xattr (node, INLINE_XATTR,
+				  data + EXT4_MIN_INLINE_DATA_SIZE, &xlen);
+      diskfs_end_catch_exception ();
+      if (err || xlen != len - EXT4_MIN_INLINE_DATA_SIZE)
+	{
+	  ext2_warning ("inline data of inode %llu is missing",
+			node->cache_id);
+	  return EIO;
+	}
+    }
+
+  if (S_ISDIR (node->dn_stat.st_mode))
+    return inline_dir_read (node, buf, data, len);
+  return 0;
+}
+
+error_t
+ext4_inline_write (struct node *node, vm_offset_t offset, const void *buf)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  struct ext2_inode *di;
+  error_t err;
+
+  /* Nothing else is ever made writable while inline.  */
+  if (offset > 0 || ! ext4_inline_writable (node))
+    return 0;
+
+  err = diskfs_catch_exception ();
+  if (err)
+    return err;
+  memcpy (dn->info.i_data, buf, EXT4_MIN_INLINE_DATA_SIZE);
+  di = dino_ref (node->cache_id);
+  memcpy (di->i_block, buf, EXT4_MIN_INLINE_DATA_SIZE);
+  record_global_poke (di);
+  diskfs_end_catch_exception ();
+
+  return 0;
+}
+
+error_t
+ext4_inline_convert (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  __u32 saved[EXT2_N_BLOCKS];
+  struct ext2_inode *di;
+  block_t block;
+  size_t written;
+  void *buf;
+  error_t err;
+
+  buf = calloc (1, block_size);
+  if (! buf)
+    return ENOMEM;
+
+  err = ext4_inline_read (node, buf);
+  if (err)
+    goto out;
+
+  memcpy (saved, dn->info.i_data, sizeof saved);
+  dn->info.i_flags &= ~EXT4_INLINE_DATA_FL;
+  if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT4_FEATURE_INCOMPAT_EXTENTS))
+    ext4_ext_init (node);
+  else
+    {
+      memset (dn->info.i_data, 0, sizeof dn->info.i_data);
+      ext2_run_cache_clear (node);
+    }
+
+  err = ext2_getblk (node, 0, 1, &block);
+  if (err)
+    {
+      /* No block was allocated; leave the data where it was.  */
+      dn->info.i_flags &= ~EXT4_EXTENTS_FL;
+      dn->info.i_flags |= EXT4_INLINE_DATA_FL;
+      memcpy (dn->info.i_data, saved, sizeof saved);
+      ext2_run_cache_clear (node);
+      goto out;
+    }
+
+  err = store_write (store, (store_offset_t) block
+		     << log2_dev_blocks_per_fs_block,
+		     buf, block_size, &written);
+  if (!err && written != block_size)
+    err = EIO;
+
+  ext2_set_ibody_xattr (node, INLINE_XATTR, NULL, 0);
+  dn->inline_size = 0;
+  node->allocsize = block_size;
+  dn->last_page_partially_writable =
+    trunc_page (node->allocsize) != node->allocsize;
+
+  /* Update the inode with its attribute, in the same block, rather than
+     leave an inline inode without system.data until write_node.  */
+  di = dino_ref (node->cache_id);
+  di->i_flags = htole32 (dn->info.i_flags);
+  memcpy (di->i_block, dn->info.i_data, sizeof di->i_block);
+  di->i_blocks = htole32 (node->dn_stat.st_blocks);
+  if (S_ISDIR (node->dn_stat.st_mode))
+    di->i_size = htole32 (block_size);
+  record_global_poke (di);
+
+ out:
+  free (buf);
+  return err;
+}
+
+error_t
+ext4_inline_truncate (struct node *node, off_t length)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  error_t err = 0;
+
+  if (length < EXT4_MIN_INLINE_DATA_SIZE)
+    memset ((char *) dn->info.i_data + length, 0,
+	    EXT4_MIN_INLINE_DATA_SIZE - length);
+
+  if (dn->inline_size > EXT4_MIN_INLINE_DATA_SIZE
+      && length < dn->inline_size)
+    {
+      size_t keep = (length > EXT4_MIN_INLINE_DATA_SIZE
+		     ? length - EXT4_MIN_INLINE_DATA_SIZE : 0);
+      size_t xlen = dn->inline_size - EXT4_MIN_INLINE_DATA_SIZE;
+      char value[xlen];
+
+      err = ext2_get_ibody_xattr (node, INLINE_XATTR, value, &xlen);
+      if (!err)
+	err = ext2_set_ibody_xattr (node, INLINE_XATTR, value, keep);
+      if (!err)
+	dn->inline_size = EXT4_MIN_INLINE_DATA_SIZE + keep;
+    }
+
+  node->allocsize = S_ISREG (node->dn_stat.st_mode) ? dn->inline_size : 0;
+  return err;
+}
+
+error_t
+ext4_inline_symlink_write (struct node *node, const char *target, size_t len)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  if (! EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT4_FEATURE_INCOMPAT_INLINE_DATA)
+      || ext2_set_ibody_xattr (node, INLINE_XATTR,
+			       target + EXT4_MIN_INLINE_DATA_SIZE,
+			       len - EXT4_MIN_INLINE_DATA_SIZE))
+    return EINVAL;
+
+  memcpy (dn->info.i_data, target, EXT4_MIN_INLINE_DATA_SIZE);
+  dn->info.i_flags |= EXT4_INLINE_DATA_FL;
+  dn->inline_size = len;
+  node->dn_stat.st_size = len;
+  node->dn_set_ctime = 1;
+  node->dn_set_mtime = 1;
+
+  return 0;
+}
+
+error_t
+ext4_inline_symlink_read (struct node *node, char *target)
+{
+  size_t len = node->dn_stat.st_size;
+  size_t xlen;
+  error_t err;
+
+  if (len <= EXT4_MIN_INLINE_DATA_SIZE)
+    {
+      memcpy (target, diskfs_node_disknode (node)->info.i_data, len);
+      return 0;
+    }
+
+  memcpy (target, diskfs_node_disknode (node)->info.i_data,
+	  EXT4_MIN_INLINE_DATA_SIZE);
+  xlen = len - EXT4_MIN_INLINE_DATA_SIZE;
+  err = ext2_get_ibody_xattr (node, INLINE_XATTR,
+			      target + EXT4_MIN_INLINE_DATA_SIZE, &xlen);
+  if (err || xlen != len - EXT4_MIN_INLINE_DATA_SIZE)
+    {
+      ext2_warning ("inline symlink %llu is corrupt", node->cache_id);
+      return EIO;
+    }
+  return 0;
+}
@@ -20,8 +20,10 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include "ext2fs.h"
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <sys/stat.h>
@@ -59,8 +61,23 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   /* Format specific data for the new node.  */
   dn = diskfs_node_disknode (np);
   dn->dirents = 0;
+  dn->dirhash = 0;
+  dn->xattr_cache = NULL;
   dn->dir_idx = 0;
   dn->pager = 0;
+  dn->wpager_prevp = NULL;
+  dn->ra_next = 0;
+  dn->ra_window = 0;
+  dn->ra_advice = POSIX_FADV_NORMAL;
+  dn->child_group = -1;
+  memset (dn->run_cache, 0, sizeof dn->run_cache);
+  dn->run_cache_next = 0;
+  dn->delalloc = NULL;
+  dn->delalloc_runs = 0;
+  dn->delalloc_alloced = 0;
+  dn->delalloc_blocks = 0;
+  dn->unwritten_writable = 0;
+  pthread_spin_init (&dn->run_cache_lock, PTHREAD_PROCESS_PRIVATE);
   pthread_rwlock_init (&dn->alloc_lock, NULL);
   pokel_init (&dn->indir_pokel, diskfs_disk_pager, disk_cache);
 
@@ -75,6 +92,9 @@ diskfs_node_norefs (struct node *np)
 {
   if (diskfs_node_disknode (np)->dirents)
     free (diskfs_node_disknode (np)->dirents);
+  ext2_dirhash_drop (np);
+  ext2_xattr_cache_drop (np);
+  ext2_delalloc_truncate (np, 0);
   assert_backtrace (!diskfs_node_disknode (np)->pager);
 
   /* Move any pending writes of indirect blocks.  */
@@ -254,8 +274,14 @@ diskfs_user_read_node (struct node *np, struct lookup_context *ctx)
   dino_deref (di);
   diskfs_end_catch_exception ();
 
-  if (S_ISREG (st->st_mode) || S_ISDIR (st->st_mode)
-      || (S_ISLNK (st->st_mode) && st->st_blocks))
+  if (EXT4_HAS_INLINE_DATA (np))
+    {
+      err = ext4_inline_read_node (np);
+      if (err)
+	return err;
+    }
+  else if (S_ISREG (st->st_mode) || S_ISDIR (st->st_mode)
+	   || (S_ISLNK (st->st_mode) && st->st_blocks))
     {
       unsigned offset;
 
@@ -451,7 +477,11 @@ write_node (struct node *np)
       else
 	{
 	  di->i_dtime = htole32 (0);
-	  di->i_size = htole32 (st->st_size);
+	  if (info->i_flags & EXT4_INLINE_DATA_FL && S_ISDIR (st->st_mode))
+	    /* In memory, it has the size of the block it is shown as.  */
+	    di->i_size = htole32 (diskfs_node_disknode (np)->inline_size);
+	  else
+	    di->i_size = htole32 (st->st_size);
 	  if (sizeof (off_t) >= 8 && !S_ISDIR (st->st_mode))
 	    /* 64bit file size */
 	    di->i_size_high = htole32 (st->st_size >> 32);
@@ -465,6 +495,7 @@ write_node (struct node *np)
 		EXT2_N_BLOCKS * sizeof di->i_block[0]);
 
       diskfs_end_catch_exception ();
+      diskfs_forget_stat_snapshot (np);
       np->dn_stat_dirty = 0;
 
       /* Leave invoking dino_deref (di) to the caller.  */
@@ -486,6 +517,8 @@ diskfs_node_reload (struct node *node)
       free (dn->dirents);
       dn->dirents = 0;
     }
+  ext2_dirhash_drop (node);
+  ext2_xattr_cache_drop (node);
   pokel_flush (&dn->indir_pokel);
   flush_node_pager (node);
   diskfs_user_read_node (node, NULL);
@@ -493,29 +526,136 @@ diskfs_node_reload (struct node *node)
   return 0;
 }
 
-/* Write all active disknodes into the ext2_inode pager. */
+/* Return true if NODE may have anything for write_all_disknodes to do.
+   Called without NODE locked; a node dirtied after we look is written by
+   the next sync.  */
+static int
+disknode_needs_write (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  return (node->dn_stat_dirty
+	  || node->dn_set_atime || node->dn_set_ctime || node->dn_set_mtime
+	  || dn->info.i_prealloc_count
+	  || dn->indir_pokel.pokes != NULL);
+}
+
+/* Sync NODE's indirect blocks and update its inode image, returning a
+   reference to it as write_node does.  NODE is locked.  */
+static struct ext2_inode *
+write_disknode_image (struct node *node)
+{
+  /* Sync the indirect blocks here; they'll all be done before any
+     inodes.  Waiting for them shouldn't be too bad.  */
+  pokel_sync (&diskfs_node_disknode (node)->indir_pokel, 1);
+
+  diskfs_set_node_times (node);
+
+  return write_node (node);
+}
+
+struct node_write
+{
+  block_t block;		/* The inode table block NODE is in.  */
+  struct node *node;
+};
+
+static int
+node_write_cmp (const void *a, const void *b)
+{
+  const struct node_write *x = a, *y = b;
+
+  if (x->block != y->block)
+    return x->block < y->block ? -1 : 1;
+  return (x->node->cache_id > y->node->cache_id)
+	 - (x->node->cache_id < y->node->cache_id);
+}
+
+/* Write all active disknodes into the ext2_inode pager.  Only the nodes
+   that changed since the last call are looked at.  The dirty nodes are
+   written in inode table order, and each inode table block is recorded
+   only once however many of its inodes changed.  */
 void
 write_all_disknodes (void)
 {
+  unsigned long inodes_per_group = le32toh (sblock->s_inodes_per_group);
+  struct node **nodes;
+  struct node_write *writes;
+  size_t num_nodes, i;
+  struct ext2_inode *pending = NULL;
+  block_t pending_block = 0;
+
   error_t write_one_disknode (struct node *node)
     {
-      struct ext2_inode *di;
+      struct ext2_inode *di = write_disknode_image (node);
+      if (di)
+	record_global_poke (di);
+      return 0;
+    }
 
-      /* Sync the indirect blocks here; they'll all be done before any
-	 inodes.  Waiting for them shouldn't be too bad.  */
-      pokel_sync (&diskfs_node_disknode (node)->indir_pokel, 1);
+  if (diskfs_node_collect_changed (disknode_needs_write, &nodes, &num_nodes))
+    {
+      diskfs_node_iterate (write_one_disknode);
+      return;
+    }
+
+  writes = malloc (num_nodes * sizeof *writes);
+  if (writes == NULL && num_nodes > 0)
+    {
+      for (i = 0; i < num_nodes; i++)
+	{
+	  pthread_mutex_lock (&nodes[i]->lock);
+	  write_one_disknode (nodes[i]);
+	  pthread_mutex_unlock (&nodes[i]->lock);
+	  diskfs_nrele (nodes[i]);
+	}
+      free (nodes);
+      return;
+    }
+
+  for (i = 0; i < num_nodes; i++)
+    {
+      ino_t inum = nodes[i]->cache_id;
+      struct ext2_group_desc *bg = group_desc ((inum - 1) / inodes_per_group);
+
+      writes[i].block = le32toh (bg->bg_inode_table)
+	+ ((inum - 1) % inodes_per_group) / inodes_per_block;
+      writes[i].node = nodes[i];
+    }
+  free (nodes);
+
+  qsort (writes, num_nodes, sizeof *writes, node_write_cmp);
+
+  for (i = 0; i < num_nodes; i++)
+    {
+      struct node *node = writes[i].node;
+      struct ext2_inode *di;
 
-      diskfs_set_node_times (node);
+      pthread_mutex_lock (&node->lock);
+      di = write_disknode_image (node);
+      pthread_mutex_unlock (&node->lock);
 
-      /* Update the inode image.  */
-      di = write_node (node);
       if (di)
-	record_global_poke (di);
+	{
+	  if (pending && writes[i].block == pending_block)
+	    /* PENDING already holds this block.  */
+	    dino_deref (di);
+	  else
+	    {
+	      if (pending)
+		record_global_poke (pending);
+	      pending = di;
+	      pending_block = writes[i].block;
+	    }
+	}
 
-      return 0;
+      diskfs_nrele (node);
     }
 
-  diskfs_node_iterate (write_one_disknode);
+  if (pending)
+    record_global_poke (pending);
+
+  free (writes);
 }
 
 /* Sync the info in NP->dn_stat and any associated format-specific
@@ -540,9 +680,16 @@ error_t
 diskfs_set_statfs (struct statfs *st)
 {
   st->f_type = FSTYPE_EXT2FS;
+  ext2_sync_free_blocks_count ();
   st->f_bsize = block_size;
   st->f_blocks = le32toh (sblock->s_blocks_count);
   st->f_bfree = le32toh (sblock->s_free_blocks_count);
+  /* Blocks waiting to be freed in the background are as good as free.  */
+  st->f_bfree += ext2_count_deferred_blocks ();
+  if (st->f_bfree > ext2_count_reserved_blocks ())
+    st->f_bfree -= ext2_count_reserved_blocks ();
+  else
+    st->f_bfree = 0;
   st->f_bavail = st->f_bfree - le32toh (sblock->s_r_blocks_count);
   if (st->f_bfree < le32toh (sblock->s_r_blocks_count))
     st->f_bavail = 0;
@@ -819,7 +966,7 @@ write_symlink (struct node *node, const char *target)
   size_t len = strlen (target) + 1;
 
   if (len > MAX_INODE_SYMLINK)
-    return EINVAL;
+    return ext4_inline_symlink_write (node, target, len - 1);
 
   memcpy (diskfs_node_disknode (node)->info.i_data, target, len);
   node->dn_stat.st_size = len - 1;
@@ -833,6 +980,9 @@ write_symlink (struct node *node, const char *target)
 static error_t
 read_symlink (struct node *node, char *target)
 {
+  if (EXT4_HAS_INLINE_DATA (node))
+    return ext4_inline_symlink_read (node, target);
+
   if (node->dn_stat.st_size >= MAX_INODE_SYMLINK)
     return EINVAL;
 
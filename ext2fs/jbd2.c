@@ -0,0 +1,805 @@
+/* Internal ext3/ext4 style (JBD2) journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <hurd/store.h>
+#include "ext2fs.h"
+#include "jbd2.h"
+
+/* Nonzero if the filesystem has an internal journal we can use.  */
+int jbd2_present;
+
+/* Filesystem block holding each block of the journal inode.  */
+static block_t *jbd2_map;
+
+/* Our copy of the journal superblock (one filesystem block).  */
+static struct jbd2_superblock *jbd2_sb;
+
+/* Log blocks live in [JBD2_FIRST, JBD2_MAXLEN).  */
+static uint32_t jbd2_first, jbd2_maxlen;
+
+/* While the journal holds transactions, JBD2_TAIL is the first log block
+   of the oldest one and JBD2_HEAD the block after the newest one.  */
+static uint32_t jbd2_tail, jbd2_head;
+static int jbd2_empty;
+
+/* ID of the next transaction to commit.  */
+static uint32_t jbd2_sequence;
+
+/* Home locations of the blocks logged since the journal was last empty;
+   there can't be more of them than the journal has blocks.  */
+static block_t *jbd2_logged;
+static size_t jbd2_nlogged;
+
+static pthread_mutex_t jbd2_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Compare transaction IDs, which wrap.  */
+static inline int
+tid_gt (uint32_t x, uint32_t y)
+{
+  return (int32_t) (x - y) > 0;
+}
+
+static inline uint32_t
+log_next (uint32_t pos)
+{
+  return ++pos >= jbd2_maxlen ? jbd2_first : pos;
+}
+
+/* Read filesystem block BLOCK into BUF, directly from the store.  */
+static error_t
+read_fs_block (block_t block, void *buf)
+{
+  void *data = buf;
+  size_t read = block_size;
+  error_t err;
+
+  err = store_read (store,
+		    (store_offset_t) block << log2_dev_blocks_per_fs_block,
+		    block_size, &data, &read);
+  if (err)
+    return err;
+  if (data != buf)
+    {
+      memcpy (buf, data, read < block_size ? read : block_size);
+      munmap (data, read);
+    }
+  return read == block_size ? 0 : EIO;
+}
+
+/* Write NBLOCKS filesystem blocks from BUF starting at BLOCK.  */
+static error_t
+write_fs_blocks (block_t block, const void *buf, size_t nblocks)
+{
+  size_t len = nblocks << log2_block_size, amount;
+  error_t err;
+
+  err = store_write (store,
+		     (store_offset_t) block << log2_dev_blocks_per_fs_block,
+		     buf, len, &amount);
+  if (!err && amount != len)
+    err = EIO;
+  return err;
+}
+
+static inline error_t
+read_log_block (uint32_t pos, void *buf)
+{
+  return read_fs_block (jbd2_map[pos], buf);
+}
+
+/* Write NBLOCKS log blocks from BUF starting at log block POS, merging
+   blocks that are contiguous on disk into a single store write.  */
+static error_t
+write_log_blocks (uint32_t pos, const char *buf, size_t nblocks)
+{
+  while (nblocks > 0)
+    {
+      size_t run = 1;
+      error_t err;
+
+      while (run < nblocks && pos + run < jbd2_maxlen
+	     && jbd2_map[pos + run] == jbd2_map[pos] + run)
+	run++;
+
+      err = write_fs_blocks (jbd2_map[pos], buf, run);
+      if (err)
+	return err;
+
+      buf += run << log2_block_size;
+      nblocks -= run;
+      pos += run;
+      if (pos >= jbd2_maxlen)
+	pos = jbd2_first;
+    }
+  return 0;
+}
+
+static error_t
+write_journal_super (void)
+{
+  return write_fs_blocks (jbd2_map[0], jbd2_sb, 1);
+}
+
+/* Read the on-disk inode INUM into INODE, bypassing the disk cache,
+   which doesn't exist yet when we are called.  */
+static error_t
+read_raw_inode (ino_t inum, struct ext2_inode *inode)
+{
+  unsigned long group = inode_group_num (inum);
+  unsigned long index = (inum - 1) % le32toh (sblock->s_inodes_per_group);
+  struct ext2_group_desc *gd;
+  block_t block;
+  char *buf;
+  error_t err;
+
+  if (inum > le32toh (sblock->s_inodes_count) || group >= groups_count)
+    return EINVAL;
+
+  buf = malloc (block_size);
+  if (! buf)
+    return ENOMEM;
+
+  err = read_fs_block (group_desc_block + group / desc_per_block, buf);
+  if (! err)
+    {
+      gd = (struct ext2_group_desc *) buf + group % desc_per_block;
+      block = le32toh (gd->bg_inode_table) + index / inodes_per_block;
+      err = read_fs_block (block, buf);
+    }
+  if (! err)
+    memcpy (inode,
+	    buf + (index % inodes_per_block) * EXT2_INODE_SIZE (sblock),
+	    sizeof *inode);
+
+  free (buf);
+  return err;
+}
+
+/* Append to jbd2_map the blocks reached through BLOCK, an indirect block
+   of level DEPTH (zero for a data block), until NBLOCKS are mapped.  */
+static error_t
+map_journal_blocks (block_t block, int depth, uint32_t *count,
+		    uint32_t nblocks)
+{
+  block_t *ind;
+  unsigned i;
+  error_t err;
+
+  if (*count >= nblocks)
+    return 0;
+  if (block == 0 || block >= le32toh (sblock->s_blocks_count))
+    /* The journal must be fully allocated.  */
+    return EINVAL;
+
+  if (depth == 0)
+    {
+      jbd2_map[(*count)++] = block;
+      return 0;
+    }
+
+  ind = malloc (block_size);
+  if (! ind)
+    return ENOMEM;
+
+  err = read_fs_block (block, ind);
+  for (i = 0; !err && i < addr_per_block && *count < nblocks; i++)
+    err = map_journal_blocks (le32toh (ind[i]), depth - 1, count, nblocks);
+
+  free (ind);
+  return err;
+}
+
+/* Append to jbd2_map the blocks mapped by the extent tree node HDR, until
+   NBLOCKS are mapped.  */
+static error_t
+map_journal_extents (struct ext4_extent_header *hdr, uint32_t *count,
+		     uint32_t nblocks)
+{
+  unsigned i, n = le16toh (hdr->eh_entries);
+  unsigned depth = le16toh (hdr->eh_depth);
+  struct ext4_extent_header *child;
+  error_t err = 0;
+
+  if (le16toh (hdr->eh_magic) != EXT4_EXT_MAGIC
+      || depth > EXT4_EXT_MAX_DEPTH)
+    return EINVAL;
+
+  if (depth == 0)
+    {
+      struct ext4_extent *ex = (struct ext4_extent *) (hdr + 1);
+
+      for (i = 0; i < n && *count < nblocks; i++)
+	{
+	  unsigned len = le16toh (ex[i].ee_len);
+	  block_t start = le32toh (ex[i].ee_start_lo);
+
+	  /* The journal must be fully allocated and written.  */
+	  if (len > EXT4_EXT_INIT_MAX_LEN || ex[i].ee_start_hi
+	      || le32toh (ex[i].ee_block) != *count || start == 0
+	      || start + len > le32toh (sblock->s_blocks_count))
+	    return EINVAL;
+	  while (len-- > 0 && *count < nblocks)
+	    jbd2_map[(*count)++] = start++;
+	}
+      return 0;
+    }
+
+  child = malloc (block_size);
+  if (! child)
+    return ENOMEM;
+
+  for (i = 0; !err && i < n && *count < nblocks; i++)
+    {
+      struct ext4_extent_idx *idx = (struct ext4_extent_idx *) (hdr + 1) + i;
+      block_t block = le32toh (idx->ei_leaf_lo);
+
+      if (idx->ei_leaf_hi || block == 0
+	  || block >= le32toh (sblock->s_blocks_count))
+	err = EINVAL;
+      else
+	err = read_fs_block (block, child);
+      if (! err && le16toh (child->eh_depth) != depth - 1)
+	err = EINVAL;
+      if (! err)
+	err = map_journal_extents (child, count, nblocks);
+    }
+
+  free (child);
+  return err;
+}
+
+/* Find the journal named by the superblock, map its blocks and check its
+   superblock.  Sets jbd2_present.  */
+void
+jbd2_load (void)
+{
+  struct ext2_inode inode;
+  uint32_t nblocks, count = 0, incompat = 0;
+  ino_t inum;
+  error_t err;
+  int i;
+
+  jbd2_present = 0;
+  if (! EXT2_HAS_COMPAT_FEATURE (sblock, EXT3_FEATURE_COMPAT_HAS_JOURNAL))
+    return;
+
+  inum = le32toh (sblock->s_journal_inum);
+  if (inum == 0)
+    ext2_panic ("external journals are not supported");
+
+  err = read_raw_inode (inum, &inode);
+  if (err)
+    ext2_panic ("can't read journal inode %llu: %s",
+		(unsigned long long) inum, strerror (err));
+
+  nblocks = le32toh (inode.i_size) >> log2_block_size;
+  if (nblocks < JBD2_MIN_JOURNAL_BLOCKS)
+    ext2_panic ("journal inode %llu is too small (%" PRIu32 " blocks)",
+		(unsigned long long) inum, nblocks);
+
+  free (jbd2_map);
+  free (jbd2_logged);
+  jbd2_map = malloc (nblocks * sizeof *jbd2_map);
+  jbd2_logged = malloc (nblocks * sizeof *jbd2_logged);
+  jbd2_nlogged = 0;
+  if (! jbd2_sb)
+    jbd2_sb = malloc (block_size);
+  if (! jbd2_map || ! jbd2_logged || ! jbd2_sb)
+    ext2_panic ("can't allocate journal map");
+
+  if (le32toh (inode.i_flags) & EXT4_EXTENTS_FL)
+    err = map_journal_extents ((struct ext4_extent_header *) inode.i_block,
+			       &count, nblocks);
+  else
+    {
+      for (i = 0; !err && i < EXT2_NDIR_BLOCKS; i++)
+	err = map_journal_blocks (le32toh (inode.i_block[i]), 0,
+				  &count, nblocks);
+      if (! err)
+	err = map_journal_blocks (le32toh (inode.i_block[EXT2_IND_BLOCK]), 1,
+				  &count, nblocks);
+      if (! err)
+	err = map_journal_blocks (le32toh (inode.i_block[EXT2_DIND_BLOCK]), 2,
+				  &count, nblocks);
+      if (! err)
+	err = map_journal_blocks (le32toh (inode.i_block[EXT2_TIND_BLOCK]), 3,
+				  &count, nblocks);
+    }
+  if (! err && count != nblocks)
+    err = EINVAL;
+  if (! err)
+    err = read_fs_block (jbd2_map[0], jbd2_sb);
+  if (err)
+    ext2_panic ("can't map journal inode %llu: %s",
+		(unsigned long long) inum, strerror (err));
+
+  if (be32toh (jbd2_sb->s_header.h_magic) != JBD2_MAGIC_NUMBER)
+    ext2_panic ("bad journal magic number %#x (should be %#x)",
+		be32toh (jbd2_sb->s_header.h_magic), JBD2_MAGIC_NUMBER);
+
+  switch (be32toh (jbd2_sb->s_header.h_blocktype))
+    {
+    case JBD2_SUPERBLOCK_V1:
+      break;
+    case JBD2_SUPERBLOCK_V2:
+      incompat = be32toh (jbd2_sb->s_feature_incompat);
+      break;
+    default:
+      ext2_panic ("unknown journal superblock type %u",
+		  be32toh (jbd2_sb->s_header.h_blocktype));
+    }
+
+  if (incompat & ~JBD2_FEATURE_INCOMPAT_SUPP)
+    ext2_panic ("could not mount because of unsupported journal features "
+		"(0x%x)", incompat & ~JBD2_FEATURE_INCOMPAT_SUPP);
+
+  if (be32toh (jbd2_sb->s_blocksize) != block_size)
+    ext2_panic ("journal block size %u doesn't match the filesystem's (%u)",
+		be32toh (jbd2_sb->s_blocksize), block_size);
+
+  jbd2_maxlen = be32toh (jbd2_sb->s_maxlen);
+  jbd2_first = be32toh (jbd2_sb->s_first);
+  if (jbd2_maxlen > nblocks || jbd2_first == 0 || jbd2_first >= jbd2_maxlen)
+    ext2_panic ("journal superblock is corrupt (first %" PRIu32
+		", length %" PRIu32 ")", jbd2_first, jbd2_maxlen);
+
+  jbd2_sequence = be32toh (jbd2_sb->s_sequence);
+  jbd2_empty = jbd2_sb->s_start == 0;
+  jbd2_tail = jbd2_head = jbd2_empty ? jbd2_first : be32toh (jbd2_sb->s_start);
+  jbd2_present = 1;
+}
+
+/* Nonzero if the journal holds transactions that have to be replayed.  */
+int
+jbd2_needs_recovery (void)
+{
+  return jbd2_present && jbd2_sb->s_start != 0;
+}
+
+/* Revoked blocks, with the latest transaction that revoked each.  */
+struct revoke_entry
+{
+  block_t block;
+  uint32_t sequence;
+};
+
+struct revoke_table
+{
+  struct revoke_entry *slots;
+  size_t size, count;	/* SIZE is a power of two; empty slots have block 0. */
+};
+
+static inline size_t
+revoke_hash (block_t block, size_t size)
+{
+  return ((uint64_t) block * 0x9e3779b97f4a7c15ULL >> 32) & (size - 1);
+}
+
+static struct revoke_entry *
+revoke_find (struct revoke_table *table, block_t block)
+{
+  size_t i;
+
+  if (table->size == 0)
+    return NULL;
+  for (i = revoke_hash (block, table->size); table->slots[i].block;
+       i = (i + 1) & (table->size - 1))
+    if (table->slots[i].block == block)
+      return &table->slots[i];
+  return NULL;
+}
+
+static error_t
+revoke_set (struct revoke_table *table, block_t block, uint32_t sequence)
+{
+  struct revoke_entry *entry = revoke_find (table, block);
+  size_t i;
+
+  if (entry)
+    {
+      if (tid_gt (sequence, entry->sequence))
+	entry->sequence = sequence;
+      return 0;
+    }
+
+  if ((table->count + 1) * 4 > table->size * 3)
+    {
+      struct revoke_table grown;
+
+      grown.size = table->size ? table->size * 2 : 256;
+      grown.count = 0;
+      grown.slots = calloc (grown.size, sizeof *grown.slots);
+      if (! grown.slots)
+	return ENOMEM;
+      for (i = 0; i < table->size; i++)
+	if (table->slots[i].block)
+	  revoke_set (&grown, table->slots[i].block,
+		      table->slots[i].sequence);
+      free (table->slots);
+      *table = grown;
+    }
+
+  for (i = revoke_hash (block, table->size); table->slots[i].block;
+       i = (i + 1) & (table->size - 1))
+    ;
+  table->slots[i].block = block;
+  table->slots[i].sequence = sequence;
+  table->count++;
+  return 0;
+}
+
+/* Whether a copy of BLOCK logged by transaction SEQUENCE is revoked.  */
+static int
+revoke_test (struct revoke_table *table, block_t block, uint32_t sequence)
+{
+  struct revoke_entry *entry = revoke_find (table, block);
+
+  return entry && !tid_gt (sequence, entry->sequence);
+}
+
+enum recovery_pass { PASS_SCAN, PASS_REVOKE, PASS_REPLAY };
+
+struct recovery_info
+{
+  uint32_t end_sequence;	/* First transaction not fully committed.  */
+  struct revoke_table revoked;
+  unsigned long replayed, skipped;
+};
+
+/* Walk the committed part of the log once, doing PASS.  The scan pass
+   finds the end of the log; the revoke pass collects revoke records; the
+   replay pass writes every logged block that wasn't later revoked back
+   to its home location.  */
+static error_t
+recovery_pass (enum recovery_pass pass, struct recovery_info *info)
+{
+  uint32_t pos = be32toh (jbd2_sb->s_start);
+  uint32_t sequence = be32toh (jbd2_sb->s_sequence);
+  struct jbd2_header *header;
+  char *buf, *data;
+  error_t err = 0;
+
+  buf = malloc (block_size);
+  data = malloc (block_size);
+  if (! buf || ! data)
+    {
+      free (buf);
+      free (data);
+      return ENOMEM;
+    }
+  header = (struct jbd2_header *) buf;
+
+  while (pass == PASS_SCAN || sequence != info->end_sequence)
+    {
+      err = read_log_block (pos, buf);
+      if (err)
+	break;
+
+      if (be32toh (header->h_magic) != JBD2_MAGIC_NUMBER
+	  || be32toh (header->h_sequence) != sequence)
+	break;
+      pos = log_next (pos);
+
+      if (be32toh (header->h_blocktype) == JBD2_DESCRIPTOR_BLOCK)
+	{
+	  char *tagp = buf + sizeof *header;
+
+	  while (!err && tagp + JBD2_TAG_SIZE <= buf + block_size)
+	    {
+	      struct jbd2_block_tag *tag = (struct jbd2_block_tag *) tagp;
+	      unsigned flags = be16toh (tag->t_flags);
+	      block_t home = be32toh (tag->t_blocknr);
+
+	      if (pass != PASS_REPLAY)
+		;
+	      else if (revoke_test (&info->revoked, home, sequence))
+		info->skipped++;
+	      else if (home >= le32toh (sblock->s_blocks_count))
+		ext2_warning ("journal block %u has bad home block %u",
+			      pos, home);
+	      else
+		{
+		  err = read_log_block (pos, data);
+		  if (!err && (flags & JBD2_FLAG_ESCAPE))
+		    *(uint32_t *) data = htobe32 (JBD2_MAGIC_NUMBER);
+		  if (! err)
+		    err = write_fs_blocks (home, data, 1);
+		  info->replayed++;
+		}
+
+	      pos = log_next (pos);
+	      tagp += JBD2_TAG_SIZE;
+	      if (! (flags & JBD2_FLAG_SAME_UUID))
+		tagp += 16;
+	      if (flags & JBD2_FLAG_LAST_TAG)
+		break;
+	    }
+	}
+      else if (be32toh (header->h_blocktype) == JBD2_COMMIT_BLOCK)
+	sequence++;
+      else if (be32toh (header->h_blocktype) == JBD2_REVOKE_BLOCK)
+	{
+	  struct jbd2_revoke_header *revoke = (void *) buf;
+	  size_t used = be32toh (revoke->r_count), off;
+
+	  if (used > block_size)
+	    used = block_size;
+	  for (off = sizeof *revoke;
+	       pass == PASS_REVOKE && !err && off + 4 <= used; off += 4)
+	    err = revoke_set (&info->revoked,
+			      be32toh (*(uint32_t *) (buf + off)), sequence);
+	}
+      else
+	break;
+    }
+
+  if (pass == PASS_SCAN)
+    info->end_sequence = sequence;
+
+  free (buf);
+  free (data);
+  return err;
+}
+
+/* Replay the committed transactions in the journal, then mark the journal
+   empty and clear the superblock's needs-recovery flag.  Called before the
+   disk cache is set up, so everything goes straight to the store.  */
+void
+jbd2_recover (void)
+{
+  struct recovery_info info = { 0 };
+  struct ext2_super_block *sb;
+  size_t read = 0, amount;
+  uint32_t start_sequence = be32toh (jbd2_sb->s_sequence);
+  error_t err;
+
+  err = recovery_pass (PASS_SCAN, &info);
+  if (! err)
+    err = recovery_pass (PASS_REVOKE, &info);
+  if (! err)
+    err = recovery_pass (PASS_REPLAY, &info);
+  free (info.revoked.slots);
+  if (err)
+    ext2_panic ("journal recovery failed: %s", strerror (err));
+
+  ext2_warning ("recovered journal transactions %u-%u "
+		"(%lu blocks replayed, %lu revoked)",
+		start_sequence, info.end_sequence - 1,
+		info.replayed, info.skipped);
+
+  /* Skip the ID of a transaction that may have been partly written.  */
+  jbd2_sequence = info.end_sequence + 1;
+  jbd2_sb->s_sequence = htobe32 (jbd2_sequence);
+  jbd2_sb->s_start = 0;
+  err = write_journal_super ();
+  if (err)
+    ext2_panic ("can't update journal superblock: %s", strerror (err));
+  jbd2_empty = 1;
+  jbd2_tail = jbd2_head = jbd2_first;
+
+  /* The replay may have rewritten the superblock, so reread it.  */
+  sb = NULL;
+  err = store_read (store, SBLOCK_OFFS >> store->log2_block_size,
+		    SBLOCK_SIZE, (void **) &sb, &read);
+  if (err || read != SBLOCK_SIZE)
+    ext2_panic ("Cannot read hypermetadata");
+  EXT2_CLEAR_INCOMPAT_FEATURE (sb, EXT3_FEATURE_INCOMPAT_RECOVER);
+  err = store_write (store, SBLOCK_OFFS >> store->log2_block_size,
+		     sb, SBLOCK_SIZE, &amount);
+  if (!err && amount != SBLOCK_SIZE)
+    err = EIO;
+  munmap (sb, read);
+  if (err)
+    ext2_panic ("can't clear the needs-recovery flag: %s", strerror (err));
+}
+
+/* Space left in the log, keeping one block free so that a full log can
+   be told apart from an empty one.  */
+static uint32_t
+log_free (void)
+{
+  uint32_t len = jbd2_maxlen - jbd2_first;
+  uint32_t used = jbd2_head >= jbd2_tail
+		  ? jbd2_head - jbd2_tail
+		  : len - (jbd2_tail - jbd2_head);
+
+  return jbd2_empty ? len - 1 : len - used - 1;
+}
+
+/* Empty the journal.  Every block it holds is first forced to its home
+   location; most were written back when their transaction committed, so
+   this usually finds them clean.  Called with jbd2_lock held.  */
+static error_t
+checkpoint (void)
+{
+  error_t err;
+  size_t i;
+
+  if (jbd2_empty)
+    return 0;
+
+  for (i = 0; i < jbd2_nlogged; i++)
+    {
+      void *ptr;
+
+      ptr = disk_cache_block_find (jbd2_logged[i]);
+
+      /* A block no longer in the cache was written out when it left.  */
+      if (ptr)
+	pager_sync_some (diskfs_disk_pager, (char *) ptr - (char *) disk_cache,
+			 block_size, 1);
+    }
+
+  jbd2_sb->s_sequence = htobe32 (jbd2_sequence);
+  jbd2_sb->s_start = 0;
+  err = write_journal_super ();
+  if (! err)
+    {
+      jbd2_empty = 1;
+      jbd2_tail = jbd2_head = jbd2_first;
+      jbd2_nlogged = 0;
+    }
+  return err;
+}
+
+/* Write the current contents DATA[i] of the N filesystem blocks BLOCKS[i]
+   to the journal as a single transaction, and return once it is
+   committed.  The blocks must not be written in place before this
+   returns.  If the log is full, it is checkpointed first; ENOSPC means
+   the transaction is larger than the whole journal.  */
+error_t
+jbd2_log_blocks (const block_t *blocks, void *const *data, size_t n)
+{
+  size_t per_desc = (block_size - sizeof (struct jbd2_header) - 16)
+		    / JBD2_TAG_SIZE;
+  size_t ndesc = (n + per_desc - 1) / per_desc;
+  size_t nlog = ndesc + n, i, done;
+  struct jbd2_commit_header *commit;
+  char *buf, *p;
+  error_t err;
+
+  if (! jbd2_present)
+    return EOPNOTSUPP;
+  if (diskfs_readonly)
+    return EROFS;
+  if (n == 0)
+    return 0;
+
+  buf = malloc ((nlog + 1) << log2_block_size);
+  if (! buf)
+    return ENOMEM;
+
+  pthread_mutex_lock (&jbd2_lock);
+
+  err = 0;
+  if (nlog + 1 > log_free ())
+    err = checkpoint ();
+  if (err || nlog + 1 > log_free ())
+    {
+      pthread_mutex_unlock (&jbd2_lock);
+      free (buf);
+      return err ?: ENOSPC;
+    }
+
+  /* Lay out each descriptor block followed by the blocks it describes.  */
+  p = buf;
+  for (done = 0; done < n; )
+    {
+      struct jbd2_header *header = (struct jbd2_header *) p;
+      size_t count = n - done < per_desc ? n - done : per_desc;
+      char *tagp = p + sizeof *header;
+      char *copy = p + block_size;
+
+      memset (p, 0, block_size);
+      header->h_magic = htobe32 (JBD2_MAGIC_NUMBER);
+      header->h_blocktype = htobe32 (JBD2_DESCRIPTOR_BLOCK);
+      header->h_sequence = htobe32 (jbd2_sequence);
+
+      for (i = 0; i < count; i++)
+	{
+	  struct jbd2_block_tag *tag = (struct jbd2_block_tag *) tagp;
+	  unsigned flags = 0;
+
+	  memcpy (copy, data[done + i], block_size);
+	  if (*(uint32_t *) copy == htobe32 (JBD2_MAGIC_NUMBER))
+	    {
+	      *(uint32_t *) copy = 0;
+	      flags |= JBD2_FLAG_ESCAPE;
+	    }
+	  copy += block_size;
+
+	  tag->t_blocknr = htobe32 (blocks[done + i]);
+	  tagp += JBD2_TAG_SIZE;
+	  if (i == 0)
+	    {
+	      memcpy (tagp, jbd2_sb->s_uuid, 16);
+	      tagp += 16;
+	    }
+	  else
+	    flags |= JBD2_FLAG_SAME_UUID;
+	  if (i == count - 1)
+	    flags |= JBD2_FLAG_LAST_TAG;
+	  tag->t_flags = htobe16 (flags);
+	}
+
+      done += count;
+      p = copy;
+    }
+
+  commit = (struct jbd2_commit_header *) p;
+  memset (commit, 0, block_size);
+  commit->h_header.h_magic = htobe32 (JBD2_MAGIC_NUMBER);
+  commit->h_header.h_blocktype = htobe32 (JBD2_COMMIT_BLOCK);
+  commit->h_header.h_sequence = htobe32 (jbd2_sequence);
+  commit->h_commit_sec = htobe64 (diskfs_mtime->seconds);
+  commit->h_commit_nsec = htobe32 (diskfs_mtime->microseconds * 1000);
+
+  if (jbd2_empty)
+    /* Point the journal superblock at the log before there's anything in
+       it; a crash before the commit block lands then replays nothing.  */
+    {
+      jbd2_tail = jbd2_head = jbd2_first;
+      jbd2_sb->s_sequence = htobe32 (jbd2_sequence);
+      jbd2_sb->s_start = htobe32 (jbd2_tail);
+      err = write_journal_super ();
+    }
+
+  /* The commit block goes out only after the rest of the transaction.  */
+  if (! err)
+    err = write_log_blocks (jbd2_head, buf, nlog);
+  if (! err)
+    {
+      uint32_t commit_pos = jbd2_head;
+
+      for (i = 0; i < nlog; i++)
+	commit_pos = log_next (commit_pos);
+      err = write_log_blocks (commit_pos, p, 1);
+      if (! err)
+	{
+	  jbd2_head = log_next (commit_pos);
+	  jbd2_empty = 0;
+	  jbd2_sequence++;
+	  memcpy (jbd2_logged + jbd2_nlogged, blocks, n * sizeof *blocks);
+	  jbd2_nlogged += n;
+	}
+    }
+
+  pthread_mutex_unlock (&jbd2_lock);
+  free (buf);
+  return err;
+}
+
+/* Make sure every logged block has reached its home location on disk and
+   empty the journal.  */
+error_t
+jbd2_checkpoint (void)
+{
+  error_t err;
+
+  if (! jbd2_present || diskfs_readonly)
+    return 0;
+
+  pthread_mutex_lock (&jbd2_lock);
+  err = checkpoint ();
+  pthread_mutex_unlock (&jbd2_lock);
+
+  return err;
+}
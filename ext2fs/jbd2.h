@@ -0,0 +1,132 @@
+/*
+ *  On-disk format of the JBD2 journal used by ext3 and ext4.
+ *
+ *  Only the subset we read and write is described here: the journal
+ *  superblock, descriptor blocks with 32-bit block tags, commit blocks
+ *  and revoke blocks.  Every field is stored big-endian.
+ */
+
+#ifndef _EXT2FS_JBD2_H
+#define _EXT2FS_JBD2_H
+
+#define JBD2_MAGIC_NUMBER	0xc03b3998U
+
+/*
+ * Block types.
+ */
+#define JBD2_DESCRIPTOR_BLOCK	1
+#define JBD2_COMMIT_BLOCK	2
+#define JBD2_SUPERBLOCK_V1	3
+#define JBD2_SUPERBLOCK_V2	4
+#define JBD2_REVOKE_BLOCK	5
+
+/*
+ * The journal is at least this many blocks long.
+ */
+#define JBD2_MIN_JOURNAL_BLOCKS	1024
+
+/*
+ * Standard header for every journal metadata block.
+ */
+struct jbd2_header
+{
+	__u32	h_magic;
+	__u32	h_blocktype;
+	__u32	h_sequence;		/* Transaction ID */
+};
+
+/*
+ * Descriptor block tag, as laid out when neither the 64BIT nor the
+ * checksum features are enabled; the old JBD format had a 32-bit
+ * t_flags field, whose low half overlays the one here.
+ */
+struct jbd2_block_tag
+{
+	__u32	t_blocknr;		/* Home block of the logged data */
+	__u16	t_checksum;
+	__u16	t_flags;		/* See below */
+};
+
+#define JBD2_TAG_SIZE		8
+
+/*
+ * Tag flags.
+ */
+#define JBD2_FLAG_ESCAPE	1	/* Block had the magic number in it */
+#define JBD2_FLAG_SAME_UUID	2	/* No UUID follows this tag */
+#define JBD2_FLAG_DELETED	4	/* Block deleted by this transaction */
+#define JBD2_FLAG_LAST_TAG	8	/* Last tag in this descriptor block */
+
+/*
+ * Revoke block: the header is followed by 32-bit block numbers;
+ * r_count is the number of bytes used, header included.
+ */
+struct jbd2_revoke_header
+{
+	struct jbd2_header r_header;
+	__u32	r_count;
+};
+
+/*
+ * Commit block.
+ */
+struct jbd2_commit_header
+{
+	struct jbd2_header h_header;
+	__u8	h_chksum_type;
+	__u8	h_chksum_size;
+	__u8	h_padding[2];
+	__u32	h_chksum[8];
+	__u64	h_commit_sec;
+	__u32	h_commit_nsec;
+};
+
+/*
+ * The journal superblock, which lives in the first block of the journal.
+ */
+struct jbd2_superblock
+{
+	struct jbd2_header s_header;
+
+	/* Static description of the journal.  */
+	__u32	s_blocksize;		/* Journal device block size */
+	__u32	s_maxlen;		/* Total blocks in journal file */
+	__u32	s_first;		/* First block of log information */
+
+	/* Dynamic state of the log.  */
+	__u32	s_sequence;		/* First commit ID expected in log */
+	__u32	s_start;		/* Block of start of log; 0 if empty */
+	__s32	s_errno;
+
+	/* Remaining fields are only valid in a version 2 superblock.  */
+	__u32	s_feature_compat;
+	__u32	s_feature_incompat;
+	__u32	s_feature_ro_compat;
+	__u8	s_uuid[16];		/* 128-bit uuid for journal */
+	__u32	s_nr_users;		/* Nr of filesystems sharing log */
+	__u32	s_dynsuper;
+	__u32	s_max_transaction;	/* Limit of journal blocks per trans. */
+	__u32	s_max_trans_data;	/* Limit of data blocks per trans. */
+	__u8	s_checksum_type;
+	__u8	s_padding2[3];
+	__u32	s_padding[42];
+	__u32	s_checksum;
+	__u8	s_users[16*48];		/* Ids of all fs'es sharing the log */
+};
+
+/*
+ * Journal feature flags.
+ */
+#define JBD2_FEATURE_COMPAT_CHECKSUM		0x00000001
+
+#define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
+#define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
+#define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
+#define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
+
+#define JBD2_FEATURE_INCOMPAT_SUPP	(JBD2_FEATURE_INCOMPAT_REVOKE| \
+					 JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+
+#endif	/* _EXT2FS_JBD2_H */
@@ -20,12 +20,18 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <error.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <time.h>
 #include <hurd/store.h>
+#include <mach/vm_statistics.h>
 #include "ext2fs.h"
 #include <libdiskfs/journal.h>
+#include <trace.h>
+#include <shrinker.h>
 
 /* XXX */
 #include "../libpager/priv.h"
@@ -42,6 +48,12 @@ struct pager_requests *file_pager_requests;
 
 pthread_spinlock_t node_to_page_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
+/* The disknodes whose file pagers have been given write access, which
+   are the only ones that can have dirty pages, and their number.
+   Protected by NODE_TO_PAGE_LOCK.  */
+static struct disknode *writable_pagers;
+static size_t num_writable_pagers;
+
 static int disk_cache_initialized;
 
 
@@ -54,38 +66,102 @@ static int disk_cache_initialized;
 #define STATS
 
 #ifdef STATS
+/* The counters are kept in several copies, each thread adding to the
+   one it was given first, so that threads on different processors
+   rarely write to the same cache line; diskfs_append_stats sums them.
+   They are only ever updated with relaxed atomics.  */
+#define STATS_SHARDS 8
+
+/* Histogram buckets: 0 counts zeros, I the values from 2^(I-1) to
+   2^I - 1, and the last one everything larger.  */
+#define STATS_HIST_BUCKETS 16
+
 struct ext2fs_pager_stats
 {
-  pthread_spinlock_t lock;
-
   unsigned long disk_pageins;
   unsigned long disk_pageouts;
 
+  unsigned long disk_cache_hits; /* Blocks found mapped */
+  unsigned long disk_cache_misses; /* Blocks that had to be mapped */
+  unsigned long disk_cache_reassoc_waits; /* Waits for a re-association */
+  unsigned long disk_cache_reclaims; /* Scans for unused blocks */
+
   unsigned long file_pageins;
   unsigned long file_pagein_reads; /* Device reads done by file pagein */
   unsigned long file_pagein_freed_bufs;	/* Discarded pages */
   unsigned long file_pagein_alloced_bufs; /* Allocated pages */
+  unsigned long file_readaheads; /* Readaheads offered to the kernel */
+  unsigned long file_readahead_pages; /* Pages they offered */
+  unsigned long file_readahead_hits; /* Pageins right after a readahead */
+  unsigned long file_readahead_misses; /* Pageins of pages read ahead */
 
   unsigned long file_pageouts;
 
   unsigned long file_page_unlocks;
   unsigned long file_grows;
-};
 
-static struct ext2fs_pager_stats ext2s_pager_stats =
-  { .lock = PTHREAD_SPINLOCK_INITIALIZER };
+  unsigned long writebacks;	/* Paging write requests */
+  unsigned long writeback_us;	/* Total time they took */
+  unsigned long writeback_max_us;
+  unsigned long writeback_latency[STATS_HIST_BUCKETS];
+} __attribute__ ((aligned (64)));
+
+static struct ext2fs_pager_stats ext2s_pager_stats[STATS_SHARDS];
+static unsigned int ext2s_pager_stats_next;
+static __thread struct ext2fs_pager_stats *thread_pager_stats;
+
+static inline struct ext2fs_pager_stats *
+pager_stats (void)
+{
+  if (__builtin_expect (thread_pager_stats == NULL, 0))
+    thread_pager_stats = &ext2s_pager_stats[
+      __atomic_fetch_add (&ext2s_pager_stats_next, 1, __ATOMIC_RELAXED)
+      % STATS_SHARDS];
+  return thread_pager_stats;
+}
 
-#define STAT_INC(field)							      \
-do { pthread_spin_lock (&ext2s_pager_stats.lock);			      \
-     ext2s_pager_stats.field++;						      \
-     pthread_spin_unlock (&ext2s_pager_stats.lock); } while (0)
+#define STAT_ADD(field, n)						        __atomic_fetch_add (&pager_stats ()->field, (n), __ATOMIC_RELAXED)
+#define STAT_INC(field) STAT_ADD (field, 1)
+
+static uint64_t
+stats_now_us (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Account for a paging write request that started at START, as
+   returned by stats_now_us.  */
+static void
+stat_writeback (uint64_t start)
+{
+  struct ext2fs_pager_stats *st = pager_stats ();
+  unsigned long us = stats_now_us () - start, max;
+  unsigned int i = 0;
+
+  while ((us >> i) > 0 && i < STATS_HIST_BUCKETS - 1)
+    i++;
+
+  __atomic_fetch_add (&st->writebacks, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&st->writeback_us, us, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&st->writeback_latency[i], 1, __ATOMIC_RELAXED);
+  max = __atomic_load_n (&st->writeback_max_us, __ATOMIC_RELAXED);
+  while (us > max
+	 && ! __atomic_compare_exchange_n (&st->writeback_max_us, &max, us, 1,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
 
 #else /* !STATS */
+#define STAT_ADD(field, n) /* nop */0
 #define STAT_INC(field) /* nop */0
+#define stats_now_us() 0
+#define stat_writeback(start) /* nop */0
 #endif /* STATS */
 
 static void
-disk_cache_info_free_push (struct disk_cache_info *p);
+disk_cache_info_release (int index);
 
 #define FREE_PAGE_BUFS 24
 
@@ -166,6 +242,239 @@ find_block (struct node *node, vm_offset_t offset,
   return err;
 }
 
+/* Find the disk blocks of the NPAGES pages of NODE at OFFSET, all inside
+   NODE->allocsize, and put them in BLOCKS.  Stop at the first page with
+   a hole in it, and return how many pages were mapped.  NODE's
+   ALLOC_LOCK is held.  */
+static int
+map_pages (struct node *node, vm_offset_t offset, int npages, block_t *blocks)
+{
+  int blocks_per_page = vm_page_size >> log2_block_size;
+  int nblocks = npages * blocks_per_page;
+  int i = 0;
+
+  while (i < nblocks)
+    {
+      block_t disk_block, count;
+
+      if (ext2_getblks (node, (offset >> log2_block_size) + i,
+			&disk_block, &count)
+	  || disk_block == 0)
+	break;
+      while (count-- > 0 && i < nblocks)
+	blocks[i++] = disk_block++;
+    }
+  return i / blocks_per_page;
+}
+
+/* Read the NBLOCKS disk blocks in BLOCKS into BUF, with one store_read
+   for each physically contiguous run of them.  */
+static error_t
+read_block_runs (const block_t *blocks, int nblocks, void *buf)
+{
+  error_t err = 0;
+  int i, j;
+
+  for (i = 0; i < nblocks && !err; i = j)
+    {
+      void *run = buf + (i << log2_block_size);
+      void *new_buf = run;
+      size_t amount, new_len;
+
+      for (j = i + 1; j < nblocks && blocks[j] == blocks[j - 1] + 1; j++)
+	;
+      amount = new_len = (j - i) << log2_block_size;
+
+      STAT_INC (file_pagein_reads);
+
+      err = store_read (store,
+			(store_offset_t) blocks[i] << log2_dev_blocks_per_fs_block,
+			amount, &new_buf, &new_len);
+      if (err)
+	break;
+      if (amount != new_len)
+	err = EIO;
+      if (new_buf != run)
+	{
+	  if (! err)
+	    memcpy (run, new_buf, amount);
+	  munmap (new_buf, new_len);
+	}
+    }
+
+  return err;
+}
+
+/* File pageins just past the previous one, or past what was read ahead
+   of it, double the readahead window up to READAHEAD_MAX_PAGES; any
+   other pagein closes it.  After POSIX_FADV_SEQUENTIAL advice, every
+   pagein reads READAHEAD_MAX_PAGES ahead; after POSIX_FADV_RANDOM,
+   none does.  */
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+/* Read the whole, allocated pages among the NPAGES pages of NODE at
+   START that nobody else is reading, up to the first that is not, and
+   offer them to the kernel.  Return how many were.  NODE's ALLOC_LOCK
+   is held.  */
+static int
+file_pager_offer (struct node *node, vm_offset_t start, int npages)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int blocks_per_page = vm_page_size >> log2_block_size;
+  int i;
+  struct pager *pager;
+  error_t err;
+  void *buf;
+
+  /* Only whole pages, and only while their blocks are allocated: a hole
+     or the partial page at the end is left to file_pager_read_page.  */
+  if (start >= node->allocsize)
+    return 0;
+  if (npages > (node->allocsize - start) / vm_page_size)
+    npages = (node->allocsize - start) / vm_page_size;
+  if (npages > READAHEAD_MAX_PAGES)
+    npages = READAHEAD_MAX_PAGES;
+  if (npages == 0)
+    return 0;
+
+  block_t blocks[npages * blocks_per_page];
+  npages = map_pages (node, start, npages, blocks);
+  if (npages == 0)
+    return 0;
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = dn->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+  if (! pager)
+    return 0;
+
+  buf = mmap (0, npages * vm_page_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    {
+      ports_port_deref (pager);
+      return 0;
+    }
+
+  i = pager_prepare_offer (pager, start, npages);
+  if (i < npages)
+    munmap (buf + i * vm_page_size, (npages - i) * vm_page_size);
+  npages = i;
+  if (npages == 0)
+    {
+      ports_port_deref (pager);
+      return 0;
+    }
+
+  STAT_INC (file_readaheads);
+  STAT_ADD (file_readahead_pages, npages);
+  err = read_block_runs (blocks, npages * blocks_per_page, buf);
+
+  pager_offer_pages (pager, 0, start, npages, (vm_address_t) buf, err);
+  ports_port_deref (pager);
+  return npages;
+}
+
+/* The NPAGES pages of NODE at PAGE were just read in; if NODE is being
+   read sequentially, offer the kernel the pages after them.  NODE's
+   ALLOC_LOCK is held.  */
+static void
+file_pager_readahead (struct node *node, vm_offset_t page, int npages)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  vm_offset_t start = page + npages * vm_page_size;
+  int advice = __atomic_load_n (&dn->ra_advice, __ATOMIC_RELAXED);
+  int window;
+
+  if (advice == POSIX_FADV_RANDOM)
+    return;
+
+  /* A pagein just past what was last read ahead means the kernel kept
+     all of it; one within it, that some was dropped before it was
+     used.  */
+  if (dn->ra_window > 0)
+    {
+      if (page == dn->ra_next)
+	STAT_INC (file_readahead_hits);
+      else if (page < dn->ra_next
+	       && page + dn->ra_window * vm_page_size >= dn->ra_next)
+	STAT_INC (file_readahead_misses);
+    }
+
+  if (advice == POSIX_FADV_SEQUENTIAL)
+    window = READAHEAD_MAX_PAGES;
+  else if (page != dn->ra_next)
+    {
+      dn->ra_window = 0;
+      dn->ra_next = start;
+      return;
+    }
+  else
+    {
+      window = dn->ra_window * 2 ?: READAHEAD_MIN_PAGES;
+      if (window > READAHEAD_MAX_PAGES)
+	window = READAHEAD_MAX_PAGES;
+    }
+  dn->ra_window = window;
+  dn->ra_next = start;
+
+  npages = file_pager_offer (node, start, window);
+  dn->ra_next = start + npages * vm_page_size;
+}
+
+/* The most pages file_pager_read_pages reads at once.  */
+#define READ_PAGES_MAX 64
+
+/* Read the NPAGES pages for the pager backing NODE at OFFSET into a new
+   buffer, returned in BUF, with as few device reads as possible.  Only
+   done if every page is whole and fully allocated, as the result is
+   given to the kernel with a single write lock setting; otherwise
+   return EOPNOTSUPP.  */
+static error_t
+file_pager_read_pages (struct node *node, vm_offset_t offset, int npages,
+		       void **buf, int *writelock)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  int blocks_per_page = vm_page_size >> log2_block_size;
+  error_t err = EOPNOTSUPP;
+
+  if (npages > READ_PAGES_MAX)
+    return EOPNOTSUPP;
+
+  pthread_rwlock_rdlock (&dn->alloc_lock);
+
+  if (! EXT4_HAS_INLINE_DATA (node)
+      && offset + npages * vm_page_size <= node->allocsize)
+    {
+      block_t blocks[npages * blocks_per_page];
+      if (map_pages (node, offset, npages, blocks) == npages)
+	{
+	  *buf = mmap (0, npages * vm_page_size, PROT_READ|PROT_WRITE,
+		       MAP_ANON, 0, 0);
+	  if (*buf == MAP_FAILED)
+	    err = EIO;
+	  else
+	    {
+	      STAT_INC (file_pageins);
+	      err = read_block_runs (blocks, npages * blocks_per_page, *buf);
+	      if (err)
+		munmap (*buf, npages * vm_page_size);
+	      else
+		{
+		  *writelock = 0;
+		  file_pager_readahead (node, offset, npages);
+		}
+	    }
+	}
+    }
+
+  pthread_rwlock_unlock (&dn->alloc_lock);
+
+  return err;
+}
+
 /* Read one page for the pager backing NODE at offset PAGE, into BUF.  This
    may need to read several filesystem blocks to satisfy one page, and tries
    to consolidate the i/o if possible.  */
@@ -175,6 +484,7 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 {
   error_t err = 0;
   int offs = 0;
+  vm_offset_t start = page;
   int partial = 0;		/* A page truncated by the EOF.  */
   pthread_rwlock_t *lock = NULL;
   int left = vm_page_size;
@@ -237,6 +547,29 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 
   *writelock = 0;
 
+  lock = &diskfs_node_disknode (node)->alloc_lock;
+  pthread_rwlock_rdlock (lock);
+
+  if (EXT4_HAS_INLINE_DATA (node))
+    {
+      /* Making it writable is left to pager_unlock_page, which moves
+	 the data out of the inode if it has to be.  */
+      *writelock = 1;
+      if (page >= node->allocsize)
+	err = EIO;
+      else if (! (*buf = get_page_buf ()))
+	err = ENOMEM;
+      else
+	{
+	  memset (*buf, 0, vm_page_size);
+	  err = ext4_inline_read (node, *buf);
+	  if (err)
+	    free_page_buf (*buf);
+	}
+      pthread_rwlock_unlock (lock);
+      return err;
+    }
+
   if (page >= node->allocsize)
     {
       err = EIO;
@@ -292,6 +625,9 @@ file_pager_read_page (struct node *node, vm_offset_t page,
   if (!err && partial && !*writelock)
     diskfs_node_disknode (node)->last_page_partially_writable = 1;
 
+  if (!err && !partial)
+    file_pager_readahead (node, start, 1);
+
   if (lock)
     pthread_rwlock_unlock (lock);
 
@@ -323,13 +659,18 @@ pending_blocks_write (struct pending_blocks *pb)
 
       ext2_debug ("writing block %u[%ld]", pb->block, pb->num);
 
-      if (pb->offs > 0)
+      if (pb->offs % vm_page_size != 0)
 	/* Put what we're going to write into a page-aligned buffer.  */
 	{
-	  void *page_buf = get_page_buf ();
+	  size_t buf_len = round_page (length);
+	  void *page_buf = (buf_len == vm_page_size ? get_page_buf ()
+			    : mmap (0, buf_len, PROT_READ|PROT_WRITE,
+				    MAP_ANON, 0, 0));
+	  if (page_buf == 0 || page_buf == MAP_FAILED)
+	    return EIO;
 	  memcpy ((void *)page_buf, pb->buf + pb->offs, length);
 	  err = store_write (store, dev_block, page_buf, length, &amount);
-	  free_page_buf (page_buf);
+	  munmap (page_buf, buf_len);
 	}
       else
 	err = store_write (store, dev_block, pb->buf, length, &amount);
@@ -380,6 +721,54 @@ pending_blocks_add (struct pending_blocks *pb, block_t block)
   return 0;
 }
 
+/* Allocate the reserved blocks among the LENGTH bytes of NODE at OFFSET,
+   which the pager is about to write out, and make the unwritten ones
+   written.  */
+static error_t
+allocate_delayed (struct node *node, vm_offset_t offset, vm_size_t length)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  error_t err;
+
+  /* The pages were made writable before the kernel could write them, so
+     any reservations or unwritten blocks for them show here.  */
+  if (! __atomic_load_n (&dn->delalloc_blocks, __ATOMIC_RELAXED)
+      && ! __atomic_load_n (&dn->unwritten_writable, __ATOMIC_RELAXED))
+    return 0;
+
+  pthread_rwlock_wrlock (&dn->alloc_lock);
+
+  if (offset >= node->allocsize)
+    length = 0;
+  else if (offset + length > node->allocsize)
+    length = node->allocsize - offset;
+
+  err = diskfs_catch_exception ();
+  if (!err)
+    {
+      block_t block = offset >> log2_block_size;
+      block_t end = (offset + length) >> log2_block_size;
+
+      for (; !err && block < end; block++)
+	if (ext2_delalloc_reserved (node, block))
+	  err = ext2_delalloc_allocate (node, block);
+	else if (dn->unwritten_writable && ext4_ext_unwritten (node, block))
+	  {
+	    block_t disk_block;
+	    err = ext2_getblk (node, block, 1, &disk_block);
+	  }
+      diskfs_end_catch_exception ();
+    }
+
+  pthread_rwlock_unlock (&dn->alloc_lock);
+
+  if (err)
+    ext2_warning ("inode=%" PRIu64 ", page=0x%lx: %s",
+		  node->cache_id, (unsigned long) offset, strerror (err));
+
+  return err;
+}
+
 /* Write one page for the pager backing NODE, at OFFSET, into BUF.  This
    may need to write several filesystem blocks to satisfy one page, and tries
    to consolidate the i/o if possible.  */
@@ -392,6 +781,10 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
   block_t block;
   int left = vm_page_size;
 
+  err = allocate_delayed (node, offset, vm_page_size);
+  if (err)
+    return err;
+
   pending_blocks_init (&pb, buf);
 
   /* Holding diskfs_node_disknode (node)->alloc_lock effectively locks NODE->allocsize,
@@ -399,6 +792,13 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
      diskfs_grow and diskfs_truncate.  */
   pthread_rwlock_rdlock (&diskfs_node_disknode (node)->alloc_lock);
 
+  if (EXT4_HAS_INLINE_DATA (node))
+    {
+      err = ext4_inline_write (node, offset, buf);
+      pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
+      return err;
+    }
+
   if (offset >= node->allocsize)
     left = 0;
   else if (offset + left > node->allocsize)
@@ -413,7 +813,7 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
       err = find_block (node, offset, &block, &lock);
       if (err)
 	break;
-      /* pager_unlock_page etc. have allocated it */
+      /* Allocated by pager_unlock_page etc., or by allocate_delayed.  */
       assert_backtrace (block);
       pending_blocks_add (&pb, block);
       offset += block_size;
@@ -428,6 +828,96 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
   return err;
 }
 
+/* Write the pending blocks in PB, as file_pager_write_pages' part of the
+   pages at BUF: if that fails, set the entries of ERRORS for the pages
+   they are in.  */
+static void
+pending_blocks_write_pages (struct pending_blocks *pb, error_t *errors)
+{
+  if (pb->num > 0)
+    {
+      int first = pb->offs / vm_page_size;
+      int last = (pb->offs + (pb->num << log2_block_size) - 1) / vm_page_size;
+      error_t err = pending_blocks_write (pb);
+      if (err)
+	{
+	  while (first <= last)
+	    errors[first++] = err;
+	  pb->offs += pb->num << log2_block_size;
+	  pb->num = 0;
+	}
+    }
+}
+
+/* Write the NPAGES pages at BUF for the pager backing NODE, at OFFSET,
+   with one device write for each physically contiguous run of blocks
+   they cover, and set ERRORS[I] to the outcome for page I.  */
+static void
+file_pager_write_pages (struct node *node, vm_offset_t offset, void *buf,
+			int npages, error_t *errors)
+{
+  error_t err = 0;
+  struct pending_blocks pb;
+  pthread_rwlock_t *lock = &diskfs_node_disknode (node)->alloc_lock;
+  block_t block;
+  vm_size_t left = npages * vm_page_size;
+  int i;
+
+  err = allocate_delayed (node, offset, left);
+  for (i = 0; i < npages; i++)
+    errors[i] = err;
+  if (err)
+    return;
+
+  pending_blocks_init (&pb, buf);
+
+  /* As in file_pager_write_page.  */
+  pthread_rwlock_rdlock (&diskfs_node_disknode (node)->alloc_lock);
+
+  if (EXT4_HAS_INLINE_DATA (node))
+    {
+      for (i = 0; i < npages; i++)
+	errors[i] = ext4_inline_write (node, offset + i * vm_page_size,
+				       buf + i * vm_page_size);
+      pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
+      return;
+    }
+
+  if (offset >= node->allocsize)
+    left = 0;
+  else if (offset + left > node->allocsize)
+    left = node->allocsize - offset;
+
+  ext2_debug ("writing inode %d pages %d[%d]", node->cache_id, offset, left);
+
+  STAT_INC (file_pageouts);
+
+  while (left > 0)
+    {
+      err = find_block (node, offset, &block, &lock);
+      if (err)
+	break;
+      /* Allocated by pager_unlock_page etc., or by allocate_delayed.  */
+      assert_backtrace (block);
+      if (block != pb.block + pb.num)
+	{
+	  pending_blocks_write_pages (&pb, errors);
+	  pb.block = block;
+	}
+      pb.num++;
+      offset += block_size;
+      left -= block_size;
+    }
+
+  pending_blocks_write_pages (&pb, errors);
+  if (err)
+    for (i = (pb.offs + (pb.num << log2_block_size)) / vm_page_size;
+	 i < npages; i++)
+      errors[i] = err;
+
+  pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
+}
+
 static error_t
 disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
 {
@@ -435,8 +925,9 @@ disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
   size_t length = vm_page_size, read = 0;
   store_offset_t offset = page, dev_end = store->size;
   int index = offset >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_info_shard (index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   offset = ((store_offset_t) disk_cache_info[index].block << log2_block_size)
     + offset % block_size;
   disk_cache_info[index].flags |= DC_INCORE;
@@ -446,10 +937,12 @@ disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
   disk_cache_info[index].last_read_xor
     = disk_cache_info[index].block ^ DISK_CACHE_LAST_READ_XOR;
 #endif
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   ext2_debug ("(%lld)", offset >> log2_block_size);
 
+  STAT_INC (disk_pageins);
+
   if (offset + vm_page_size > dev_end)
     length = dev_end - offset;
 
@@ -472,8 +965,9 @@ disk_pager_write_page (vm_offset_t page, void *buf)
   size_t length = vm_page_size, amount;
   store_offset_t offset = page, dev_end = store->size;
   int index = offset >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_info_shard (index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   assert_backtrace (disk_cache_info[index].block != DC_NO_BLOCK);
   offset = ((store_offset_t) disk_cache_info[index].block << log2_block_size)
     + offset % block_size;
@@ -483,7 +977,7 @@ disk_pager_write_page (vm_offset_t page, void *buf)
   assert_backtrace (disk_cache_info[index].last_read
 	  == disk_cache_info[index].block);
 #endif
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   if (offset + vm_page_size > dev_end)
     length = dev_end - offset;
@@ -541,15 +1035,14 @@ static void
 disk_pager_notify_evict (vm_offset_t page)
 {
   unsigned long index = page >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_info_shard (index);
 
   ext2_debug ("(block %lu)", index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   disk_cache_info[index].flags &= ~DC_INCORE;
-  if (disk_cache_info[index].ref_count == 0 &&
-      !(disk_cache_info[index].flags & DC_DONT_REUSE))
-    disk_cache_info_free_push (&disk_cache_info[index]);
-  pthread_mutex_unlock (&disk_cache_lock);
+  disk_cache_info_release (index);
+  pthread_mutex_unlock (&shard->lock);
 }
 
 /* Satisfy a pager read request for either the disk pager or file pager
@@ -565,16 +1058,60 @@ pager_read_page (struct user_pager_info *pager, vm_offset_t page,
     return file_pager_read_page (pager->node, page, (void **)buf, writelock);
 }
 
+/* Satisfy a pager read request for the NPAGES pages at OFFSET, into
+   BUF, with a single buffer; only file pagers do.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t offset,
+		  int npages, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == DISK)
+    return EOPNOTSUPP;
+  else
+    return file_pager_read_pages (pager->node, offset, npages,
+				  (void **)buf, writelock);
+}
+
 /* Satisfy a pager write request for either the disk pager or file pager
    PAGER, from the page at offset PAGE from BUF.  */
 error_t
 pager_write_page (struct user_pager_info *pager, vm_offset_t page,
 		  vm_address_t buf)
 {
+  uint64_t start = stats_now_us ();
+  error_t err;
+
   if (pager->type == DISK)
-    return disk_pager_write_page (page, (void *)buf);
+    err = disk_pager_write_page (page, (void *)buf);
+  else
+    {
+      /* Writing out may allocate blocks, changing the node.  */
+      err = file_pager_write_page (pager->node, page, (void *)buf);
+      diskfs_node_changed (pager->node);
+    }
+  stat_writeback (start);
+  return err;
+}
+
+/* Satisfy a pager write request for the NPAGES pages at OFFSET from BUF,
+   which the kernel returned together.  */
+void
+pager_write_pages (struct user_pager_info *pager, vm_offset_t offset,
+		   vm_address_t buf, int npages, error_t *errors)
+{
+  uint64_t start = stats_now_us ();
+  int i;
+
+  if (pager->type == FILE_DATA)
+    {
+      file_pager_write_pages (pager->node, offset, (void *)buf, npages,
+			      errors);
+      diskfs_node_changed (pager->node);
+    }
   else
-    return file_pager_write_page (pager->node, page, (void *)buf);
+    for (i = 0; i < npages; i++)
+      errors[i] = disk_pager_write_page (offset + vm_page_size * i,
+					 (void *)buf + vm_page_size * i);
+  stat_writeback (start);
 }
 
 void
@@ -585,9 +1122,35 @@ pager_notify_evict (struct user_pager_info *pager, vm_offset_t page)
 }
 
 
+/* Make block BLOCK of NODE writable.  A hole in a regular file only gets
+   space reserved for it, and is allocated when it is written out; other
+   files get the block allocated right away.  NODE's ALLOC_LOCK is held
+   for writing.  */
+static error_t
+make_block_writable (struct node *node, block_t block)
+{
+  block_t disk_block;
+  error_t err;
+
+  if (! S_ISREG (node->dn_stat.st_mode))
+    return ext2_getblk (node, block, 1, &disk_block);
+
+  err = ext2_getblk (node, block, 0, &disk_block);
+  if (err == EINVAL && EXT4_HAS_EXTENTS (node)
+      && ext4_ext_unwritten (node, block))
+    {
+      /* Already allocated; it becomes written when written out.  */
+      diskfs_node_disknode (node)->unwritten_writable = 1;
+      err = 0;
+    }
+  else if (err == EINVAL)
+    err = ext2_delalloc_reserve (node, block);
+  return err;
+}
+
 /* Make page PAGE writable, at least up to ALLOCSIZE.  This function and
-   diskfs_grow are the only places that blocks are actually added to the
-   file.  */
+   diskfs_grow are the only places that blocks are added to the file,
+   other than the delayed allocation on write out.  */
 error_t
 pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 {
@@ -608,12 +1171,24 @@ pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
       if (!err)
 	{
 	  block_t block = page >> log2_block_size;
-	  int left = (partial_page ? node->allocsize - page : vm_page_size);
+	  int left;
+
+	  if (EXT4_HAS_INLINE_DATA (node) && ! ext4_inline_writable (node))
+	    {
+	      /* Only a small file is written in its inode; anything else
+		 gets a block for its data first.  */
+	      err = ext4_inline_convert (node);
+	      partial_page = (page + vm_page_size > node->allocsize);
+	    }
+
+	  if (err || EXT4_HAS_INLINE_DATA (node))
+	    left = 0;
+	  else
+	    left = (partial_page ? node->allocsize - page : vm_page_size);
 
 	  while (left > 0)
 	    {
-	      block_t disk_block;
-	      err = ext2_getblk (node, block++, 1, &disk_block);
+	      err = make_block_writable (node, block++);
 	      if (err)
 		break;
 	      left -= block_size;
@@ -643,6 +1218,7 @@ pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
       STAT_INC (file_page_unlocks);
 
       pthread_rwlock_unlock (&dn->alloc_lock);
+      diskfs_node_changed (node);
 
       if (err == ENOSPC)
 	ext2_warning ("This filesystem is out of space.");
@@ -675,6 +1251,24 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
 
       pthread_rwlock_wrlock (&dn->alloc_lock);
 
+      if (EXT4_HAS_INLINE_DATA (node))
+	{
+	  /* It outgrows its inode, so its data goes to a block first.  */
+	  err = diskfs_catch_exception ();
+	  if (! err)
+	    {
+	      err = ext4_inline_convert (node);
+	      diskfs_end_catch_exception ();
+	    }
+	  if (err)
+	    {
+	      pthread_rwlock_unlock (&dn->alloc_lock);
+	      ext2_warning ("inode=%" PRIu64 ": %s",
+			    node->cache_id, strerror (err));
+	      return err;
+	    }
+	}
+
       old_size = node->allocsize;
       new_size = round_block (size);
 
@@ -715,10 +1309,7 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
 	      if (! err)
 		{
 		  while (!err && end_block < writable_end)
-		    {
-		      block_t disk_block;
-		      err = ext2_getblk (node, end_block++, 1, &disk_block);
-		    }
+		    err = make_block_writable (node, end_block++);
 		  diskfs_end_catch_exception ();
 		}
 
@@ -750,6 +1341,38 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
   else
     return 0;
 }
+
+/* Preallocation needs unwritten extents, so that the blocks need not be
+   zeroed; files mapped by indirect blocks get EOPNOTSUPP, and the
+   caller writes zeros itself.  */
+error_t
+diskfs_file_allocate (struct node *node, off_t start, off_t end)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  error_t err;
+
+  if (! EXT4_HAS_EXTENTS (node))
+    return EOPNOTSUPP;
+
+  /* Extents map 32-bit block numbers.  */
+  if (round_block (end) >> log2_block_size > UINT32_MAX)
+    return EFBIG;
+
+  pthread_rwlock_wrlock (&dn->alloc_lock);
+  err = diskfs_catch_exception ();
+  if (! err)
+    {
+      err = ext4_ext_preallocate (node, start >> log2_block_size,
+				  round_block (end) >> log2_block_size);
+      diskfs_end_catch_exception ();
+    }
+  pthread_rwlock_unlock (&dn->alloc_lock);
+
+  diskfs_node_changed (node);
+  if (err == ENOSPC)
+    ext2_warning ("This filesystem is out of space.");
+  return err;
+}
 
 /* This syncs a single file (NODE) to disk.  Wait for all I/O to complete
    if WAIT is set.  NODE->lock must be held.  */
@@ -775,6 +1398,124 @@ diskfs_file_update (struct node *node, int wait)
   diskfs_node_update (node, wait);
 }
 
+/* Sync the data of NODE from START up to END, or through the end if END
+   is -1.  If DATASYNC, leave the inode alone unless something other
+   than its times changed.  */
+void
+diskfs_file_update_range (struct node *node, off_t start, off_t end,
+			  int datasync, int wait)
+{
+  struct pager *pager;
+
+  if (end == -1 || end > node->allocsize)
+    end = node->allocsize;
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = diskfs_node_disknode (node)->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+
+  if (pager)
+    {
+      if (start < end)
+	{
+	  vm_address_t first = trunc_page (start);
+	  pager_sync_some (pager, first, round_page (end) - first, wait);
+	}
+      ports_port_deref (pager);
+    }
+
+  /* The indirect blocks are needed to find the data.  */
+  pokel_sync (&diskfs_node_disknode (node)->indir_pokel, wait);
+
+  if (! datasync || node->dn_stat_dirty)
+    diskfs_node_update (node, wait);
+}
+
+/* Act on advice given with file_advise.  The access pattern applies to
+   the whole file, as in Linux; the other advice to the pages of the
+   range.  Nothing is read ahead for a file that has no pager yet: its
+   first read makes one.  */
+void
+diskfs_file_advise_range (struct node *node, off_t start, off_t end,
+			  int advice)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  struct pager *pager;
+  vm_offset_t first, last, page;
+
+  switch (advice)
+    {
+    case POSIX_FADV_NORMAL:
+    case POSIX_FADV_RANDOM:
+    case POSIX_FADV_SEQUENTIAL:
+      __atomic_store_n (&dn->ra_advice, advice, __ATOMIC_RELAXED);
+      dn->ra_window = 0;
+      return;
+
+    case POSIX_FADV_WILLNEED:
+      for (page = trunc_page (start); end == -1 || page < end; )
+	{
+	  vm_size_t left = (end == -1 ? READAHEAD_MAX_PAGES * vm_page_size
+			    : round_page (end) - page);
+	  int npages;
+
+	  /* Writers that allocate blocks wait only for one read.  */
+	  pthread_rwlock_rdlock (&dn->alloc_lock);
+	  if (page >= node->allocsize)
+	    npages = -1;
+	  else if (left > READAHEAD_MAX_PAGES * vm_page_size)
+	    npages = file_pager_offer (node, page, READAHEAD_MAX_PAGES);
+	  else
+	    npages = file_pager_offer (node, page, left / vm_page_size);
+	  pthread_rwlock_unlock (&dn->alloc_lock);
+
+	  if (npages < 0)
+	    break;
+	  /* Step over what is in the kernel already, or a hole.  */
+	  page += (npages ?: 1) * vm_page_size;
+	}
+      return;
+
+    case POSIX_FADV_DONTNEED:
+    case POSIX_FADV_NOREUSE:
+      break;
+
+    default:
+      return;
+    }
+
+  if (end == -1 || end > node->allocsize)
+    end = node->allocsize;
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = dn->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+  if (! pager)
+    return;
+
+  if (start < end)
+    {
+      /* Start writing the pages back now, so that they are clean when
+	 memory gets short.  Pages not needed again are dropped, once
+	 written; only the ones wholly in the range, as the rest of a
+	 page at either end may be in use.  */
+      first = trunc_page (start);
+      pager_sync_some (pager, first, round_page (end) - first,
+		       advice == POSIX_FADV_DONTNEED);
+
+      first = round_page (start);
+      last = end == node->allocsize ? round_page (end) : trunc_page (end);
+      if (advice == POSIX_FADV_DONTNEED && first < last)
+	pager_return_some (pager, first, last - first, 0);
+    }
+
+  ports_port_deref (pager);
+}
+
 /* Invalidate any pager data associated with NODE.  */
 void
 flush_node_pager (struct node *node)
@@ -846,7 +1587,17 @@ pager_dropweak (struct user_pager_info *upi)
       pager = diskfs_node_disknode (upi->node)->pager;
       if (pager && pager_get_upi (pager) == upi)
 	{
-	  diskfs_node_disknode (upi->node)->pager = NULL;
+	  struct disknode *dn = diskfs_node_disknode (upi->node);
+
+	  dn->pager = NULL;
+	  if (dn->wpager_prevp)
+	    {
+	      *dn->wpager_prevp = dn->wpager_next;
+	      if (dn->wpager_next)
+		dn->wpager_next->wpager_prevp = dn->wpager_prevp;
+	      dn->wpager_prevp = NULL;
+	      num_writable_pagers--;
+	    }
 	  ports_port_deref_weak (pager);
 	}
       pthread_spin_unlock (&node_to_page_lock);
@@ -860,54 +1611,90 @@ void *disk_cache;
 store_offset_t disk_cache_size;
 int disk_cache_blocks;
 
-/* block num --> pointer to in-memory block */
-hurd_ihash_t disk_cache_bptr;
+/* The most entries the cache may use, as asked for by the user.  */
+int disk_cache_max = DISK_CACHE_BLOCKS;
+
+/* Only the first DISK_CACHE_LIMIT entries are used for new blocks.  The
+   limit follows memory pressure between DISK_CACHE_MIN_BLOCKS (plus the
+   fixed entries) and DISK_CACHE_MAX.  Changed with DISK_CACHE_SWEEP_LOCK
+   held, read without it.  */
+static int disk_cache_limit;
+/* Number of entries holding the superblock and group descriptors.  */
+static int disk_cache_fixed;
+
+/* Serializes sweeps over the cache and changes of its limit.  */
+static pthread_mutex_t disk_cache_sweep_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Where the next sweep starts.  */
+static int disk_cache_hand;
+/* Kernel pageout count when we last looked.  */
+static integer_t disk_cache_pageouts;
+
+/* Shards of the cache, each with its own mapping and lock.  */
+struct disk_cache_shard disk_cache_shards[DISK_CACHE_SHARDS];
 /* Cached blocks' info.  */
 struct disk_cache_info *disk_cache_info;
-/* Lock for these structures.  */
-pthread_mutex_t disk_cache_lock;
-/* Fired when a re-association is done.  */
-pthread_cond_t disk_cache_reassociation;
-
-/* Linked list of potentially unused blocks. */
-static struct disk_cache_info *disk_cache_info_free;
-static pthread_mutex_t disk_cache_info_free_lock;
 
-/* Get a reusable entry.  Must be called with disk_cache_lock
+/* Get a reusable entry of SHARD.  Must be called with SHARD->lock
    held.  */
 static struct disk_cache_info *
-disk_cache_info_free_pop (void)
+disk_cache_info_free_pop (struct disk_cache_shard *shard)
 {
   struct disk_cache_info *p;
 
   do
     {
-      pthread_mutex_lock (&disk_cache_info_free_lock);
-      p = disk_cache_info_free;
+      p = shard->free;
       if (p)
 	{
-	  disk_cache_info_free = p->next;
+	  shard->free = p->next;
 	  p->next = NULL;
 	}
-      pthread_mutex_unlock (&disk_cache_info_free_lock);
     }
-  while (p && (p->flags & DC_DONT_REUSE || p->ref_count > 0));
+  while (p && (p->flags & DC_DONT_REUSE
+	       || refcount_references (&p->ref_count) > 0
+	       || p - disk_cache_info
+		  >= __atomic_load_n (&disk_cache_limit, __ATOMIC_RELAXED)));
   return p;
 }
 
-/* Add P to the list of potentially re-usable entries.  */
+/* Add P to the list of potentially re-usable entries of its shard.
+   Must be called with the shard's lock held.  */
 static void
 disk_cache_info_free_push (struct disk_cache_info *p)
 {
-  pthread_mutex_lock (&disk_cache_info_free_lock);
+  struct disk_cache_shard *shard = &disk_cache_shards[p->shard];
+
   if (! p->next)
     {
-      p->next = disk_cache_info_free;
-      disk_cache_info_free = p;
+      p->next = shard->free;
+      shard->free = p;
     }
-  pthread_mutex_unlock (&disk_cache_info_free_lock);
 }
 
+/* Entry INDEX may have become unused; let it be reused, or if it is
+   beyond the limit, forget its block.  Must be called with the entry's
+   shard lock held.  */
+static void
+disk_cache_info_release (int index)
+{
+  struct disk_cache_info *p = &disk_cache_info[index];
+
+  if (refcount_references (&p->ref_count) > 0 || p->flags & DC_DONT_REUSE)
+    return;
+
+  if (index < __atomic_load_n (&disk_cache_limit, __ATOMIC_RELAXED))
+    disk_cache_info_free_push (p);
+  else if (p->block != DC_NO_BLOCK)
+    {
+      /* The page is not in core, so nothing is lost.  */
+      hurd_ihash_remove (disk_cache_shards[p->shard].bptr, p->block);
+      p->block = DC_NO_BLOCK;
+      p->flags &= ~DC_REFERENCED;
+    }
+}
+
+static struct shrinker disk_cache_shrinker;
+
 /* Finish mapping initialization. */
 static void
 disk_cache_init (void)
@@ -916,26 +1703,48 @@ disk_cache_init (void)
     ext2_panic ("Block size %u != vm_page_size %lu",
 		block_size, (unsigned long)vm_page_size);
 
-  pthread_mutex_init (&disk_cache_lock, NULL);
-  pthread_cond_init (&disk_cache_reassociation, NULL);
-  pthread_mutex_init (&disk_cache_info_free_lock, NULL);
+  for (int s = 0; s < DISK_CACHE_SHARDS; s++)
+    {
+      struct disk_cache_shard *shard = &disk_cache_shards[s];
 
-  /* Allocate space for block num -> in-memory pointer mapping.  */
-  if (hurd_ihash_create (&disk_cache_bptr, HURD_IHASH_NO_LOCP))
-    ext2_panic ("Can't allocate memory for disk_pager_bptr");
+      pthread_mutex_init (&shard->lock, NULL);
+      pthread_cond_init (&shard->reassociation, NULL);
+      shard->free = NULL;
+
+      /* Allocate space for block num -> in-memory pointer mapping.  */
+      if (hurd_ihash_create (&shard->bptr, HURD_IHASH_NO_LOCP))
+	ext2_panic ("Can't allocate memory for disk_pager_bptr");
+    }
 
   /* Allocate space for disk cache blocks' info.  */
   disk_cache_info = malloc ((sizeof *disk_cache_info) * disk_cache_blocks);
   if (!disk_cache_info)
     ext2_panic ("Cannot allocate space for disk cache info");
 
-  /* Initialize disk_cache_info.  Start with the last entry so that
-     the first ends up at the front of the free list.  This keeps the
-     assertions at the end of this function happy.  */
+  /* The superblock and the block group descriptors are mapped into the
+     first entries, in order.  */
+  block_t fixed_first = boffs_block (SBLOCK_OFFS);
+  block_t fixed_last = fixed_first
+    + (round_block ((sizeof *group_desc_image) * groups_count)
+       >> log2_block_size);
+  ext2_debug ("%u-%u\n", fixed_first, fixed_last);
+  assert_backtrace (fixed_last - fixed_first + 1 <= (block_t)disk_cache_blocks + 3);
+  int fixed_count = fixed_last - fixed_first + 1;
+  disk_cache_fixed = fixed_count;
+  disk_cache_limit = disk_cache_blocks;
+
+  /* Initialize disk_cache_info.  The entries that are to hold the fixed
+     blocks belong to the shards of those blocks; the others are dealt
+     out in turn.  Start with the last entry so that the first ends up
+     at the front of the free lists.  This keeps the assertions at the
+     end of this function happy.  */
   for (int i = disk_cache_blocks - 1; i >= 0; i--)
     {
       disk_cache_info[i].block = DC_NO_BLOCK;
       disk_cache_info[i].flags = 0;
+      disk_cache_info[i].shard = (i < fixed_count
+				  ? DISK_CACHE_SHARD (fixed_first + i)
+				  : i % DISK_CACHE_SHARDS);
       disk_cache_info[i].ref_count = 0;
       disk_cache_info[i].next = NULL;
       disk_cache_info_free_push (&disk_cache_info[i]);
@@ -947,12 +1756,6 @@ disk_cache_init (void)
     }
 
   /* Map the superblock and the block group descriptors.  */
-  block_t fixed_first = boffs_block (SBLOCK_OFFS);
-  block_t fixed_last = fixed_first
-    + (round_block ((sizeof *group_desc_image) * groups_count)
-       >> log2_block_size);
-  ext2_debug ("%u-%u\n", fixed_first, fixed_last);
-  assert_backtrace (fixed_last - fixed_first + 1 <= (block_t)disk_cache_blocks + 3);
   for (block_t i = fixed_first; i <= fixed_last; i++)
     {
       disk_cache_block_ref (i);
@@ -960,58 +1763,176 @@ disk_cache_init (void)
       disk_cache_info[i-fixed_first].flags |= DC_FIXED;
     }
   disk_cache_initialized = 1;
+
+  shrinker_register (&disk_cache_shrinker);
+}
+
+/* Return the pages of entries BEGIN to END to the kernel.  */
+static void
+disk_cache_return_run (int begin, int end)
+{
+  if (begin < end)
+    pager_return_some (diskfs_disk_pager, begin * vm_page_size,
+		       (end - begin) * vm_page_size, 1);
+}
+
+/* Let the cache use entries up to LIMIT.  Must be called with
+   disk_cache_sweep_lock held.  */
+static void
+disk_cache_set_limit (int limit)
+{
+  int old = disk_cache_limit;
+  int low = limit < old ? limit : old;
+  int high = limit < old ? old : limit;
+  int pending_begin = -1, pending_end = -1;
+
+  __atomic_store_n (&disk_cache_limit, limit, __ATOMIC_RELAXED);
+
+  for (int index = low; index < high; index++)
+    {
+      struct disk_cache_shard *shard = disk_cache_info_shard (index);
+      int unused;
+
+      pthread_mutex_lock (&shard->lock);
+      disk_cache_info_release (index);
+      unused = (limit < old
+		&& disk_cache_info[index].block != DC_NO_BLOCK
+		&& ! refcount_references (&disk_cache_info[index].ref_count));
+      pthread_mutex_unlock (&shard->lock);
+
+      /* Entries given up that are still in core are forgotten once the
+	 kernel tells us it has evicted them.  */
+      if (unused)
+	{
+	  if (index != pending_end)
+	    {
+	      if (pending_end >= 0)
+		disk_cache_return_run (pending_begin, pending_end);
+	      pending_begin = index;
+	    }
+	  pending_end = index + 1;
+	}
+    }
+
+  if (pending_end >= 0)
+    disk_cache_return_run (pending_begin, pending_end);
+}
+
+/* Grow the cache if memory is plentiful, and shrink it if the kernel
+   has been paging out since we last looked.  Return nonzero if the cache
+   grew.  Must be called with disk_cache_sweep_lock held.  */
+static int
+disk_cache_adjust (void)
+{
+  struct vm_statistics vmstats;
+  int limit = disk_cache_limit;
+  int low = disk_cache_fixed + DISK_CACHE_MIN_BLOCKS;
+  int high = disk_cache_max < disk_cache_blocks ? disk_cache_max
+					       : disk_cache_blocks;
+
+  if (vm_statistics (mach_task_self (), &vmstats))
+    return 0;
+
+  if (vmstats.pageouts != disk_cache_pageouts)
+    limit -= limit / 8;
+  else
+    limit += high / 8;
+  disk_cache_pageouts = vmstats.pageouts;
+
+  if (limit > high)
+    limit = high;
+  if (limit < low)
+    limit = low < high ? low : high;
+  if (limit == disk_cache_limit)
+    return 0;
+
+  ext2_debug ("limit %d -> %d", disk_cache_limit, limit);
+  int grew = limit > disk_cache_limit;
+  disk_cache_set_limit (limit);
+  return grew;
+}
+
+/* Return up to WANTED unused pages to the kernel, sweeping the entries
+   in CLOCK order.  An entry used again since the last sweep gets a
+   second chance, so blocks only read once, as by a large scan, go
+   before the ones in steady use.  Return the number of pages returned.
+   Must be called with disk_cache_sweep_lock held.  */
+static int
+disk_cache_sweep (int wanted)
+{
+  int limit = disk_cache_limit;
+  int index = disk_cache_hand < limit ? disk_cache_hand : 0;
+  int pending_begin = -1, pending_end = -1;
+  int found = 0;
+
+  for (int scanned = 0; scanned < 2 * limit && found < wanted; scanned++)
+    {
+      struct disk_cache_shard *shard = disk_cache_info_shard (index);
+      struct disk_cache_info *info = &disk_cache_info[index];
+      int victim = 0;
+
+      /* Only unused pages in core are worth returning.  */
+      pthread_mutex_lock (&shard->lock);
+      if ((info->flags & DC_DONT_REUSE) == DC_INCORE
+	  && ! refcount_references (&info->ref_count))
+	{
+	  if (info->flags & DC_REFERENCED)
+	    info->flags &= ~DC_REFERENCED;
+	  else
+	    victim = 1;
+	}
+      pthread_mutex_unlock (&shard->lock);
+
+      if (victim)
+	{
+	  ext2_debug ("return %u -> %d", info->block, index);
+	  if (index != pending_end)
+	    {
+	      /* Return previous region, if there is such, ... */
+	      if (pending_end >= 0)
+		disk_cache_return_run (pending_begin, pending_end);
+	      /* ... and start new region.  */
+	      pending_begin = index;
+	    }
+	  pending_end = index + 1;
+	  found++;
+	}
+
+      if (++index == limit)
+	index = 0;
+    }
+
+  /* Return last region, if there is such.   */
+  if (pending_end >= 0)
+    disk_cache_return_run (pending_begin, pending_end);
+
+  disk_cache_hand = index;
+  return found;
 }
 
 static void
 disk_cache_return_unused (void)
 {
-  int index;
+  vm_offset_t size;
+  int grew, found;
 
   /* XXX: Touch all pages.  It seems that sometimes GNU Mach "forgets"
      to notify us about evicted pages.  Disk cache must be
      unlocked.  */
-  for (vm_offset_t i = 0; i < disk_cache_size; i += vm_page_size)
+  size = (vm_offset_t) __atomic_load_n (&disk_cache_limit, __ATOMIC_RELAXED)
+    << log2_block_size;
+  for (vm_offset_t i = 0; i < size; i += vm_page_size)
     *(volatile char *)(disk_cache + i);
 
   /* Release some references to cached blocks.  */
   pokel_sync (&global_pokel, 1);
 
-  /* Return unused pages that are in core.  */
-  int pending_begin = -1, pending_end = -1;
-  pthread_mutex_lock (&disk_cache_lock);
-  for (index = 0; index < disk_cache_blocks; index++)
-    if (! (disk_cache_info[index].flags & (DC_DONT_REUSE & ~DC_INCORE))
-	&& ! disk_cache_info[index].ref_count)
-      {
-	ext2_debug ("return %u -> %d",
-		    disk_cache_info[index].block, index);
-	if (index != pending_end)
-	  {
-	    /* Return previous region, if there is such, ... */
-	    if (pending_end >= 0)
-	      {
-		pthread_mutex_unlock (&disk_cache_lock);
-		pager_return_some (diskfs_disk_pager,
-				   pending_begin * vm_page_size,
-				   (pending_end - pending_begin)
-				   * vm_page_size, 1);
-		pthread_mutex_lock (&disk_cache_lock);
-	      }
-	    /* ... and start new region.  */
-	    pending_begin = index;
-	  }
-	pending_end = index + 1;
-      }
+  pthread_mutex_lock (&disk_cache_sweep_lock);
+  grew = disk_cache_adjust ();
+  found = disk_cache_sweep (disk_cache_limit / 8);
+  pthread_mutex_unlock (&disk_cache_sweep_lock);
 
-  pthread_mutex_unlock (&disk_cache_lock);
-
-  /* Return last region, if there is such.   */
-  if (pending_end >= 0)
-    pager_return_some (diskfs_disk_pager,
-		       pending_begin * vm_page_size,
-		       (pending_end - pending_begin) * vm_page_size,
-		       1);
-  else
+  if (! grew && ! found)
     {
       ext2_debug ("ext2fs: disk cache is starving\n");
 
@@ -1020,10 +1941,67 @@ disk_cache_return_unused (void)
     }
 }
 
+error_t
+disk_cache_set_max (int blocks)
+{
+  if (blocks < DISK_CACHE_MIN_BLOCKS)
+    return EINVAL;
+
+  if (! disk_cache_initialized)
+    {
+      disk_cache_max = blocks;
+      return 0;
+    }
+
+  if (blocks > disk_cache_blocks)
+    return EINVAL;
+
+  pthread_mutex_lock (&disk_cache_sweep_lock);
+  disk_cache_max = blocks;
+  if (blocks < disk_cache_fixed + DISK_CACHE_MIN_BLOCKS)
+    blocks = disk_cache_fixed + DISK_CACHE_MIN_BLOCKS;
+  if (blocks > disk_cache_blocks)
+    blocks = disk_cache_blocks;
+  disk_cache_set_limit (blocks);
+  pthread_mutex_unlock (&disk_cache_sweep_lock);
+
+  return 0;
+}
+
+/* Under memory pressure, unused cached blocks are given back to the
+   kernel in the order a sweep finds them.  Any entry up to the limit
+   may be one.  */
+static size_t
+disk_cache_shrinker_count (struct shrinker *shrinker)
+{
+  return (__atomic_load_n (&disk_cache_limit, __ATOMIC_RELAXED)
+	  - disk_cache_fixed);
+}
+
+static size_t
+disk_cache_shrinker_scan (struct shrinker *shrinker, size_t nr)
+{
+  int found;
+
+  pthread_mutex_lock (&disk_cache_sweep_lock);
+  found = disk_cache_sweep (nr < INT_MAX ? nr : INT_MAX);
+  pthread_mutex_unlock (&disk_cache_sweep_lock);
+
+  return found;
+}
+
+static struct shrinker disk_cache_shrinker =
+{
+  .name = "ext2fs-disk-cache",
+  .count = disk_cache_shrinker_count,
+  .scan = disk_cache_shrinker_scan,
+};
+
 /* Map block and return pointer to it.  */
 void *
 disk_cache_block_ref (block_t block)
 {
+  struct disk_cache_shard *shard = &disk_cache_shards[DISK_CACHE_SHARD (block)];
   struct disk_cache_info *info;
   int index;
   void *bptr;
@@ -1037,9 +2015,9 @@ disk_cache_block_ref (block_t block)
   ext2_debug ("(%u)", block);
 
 retry_ref:
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  bptr = hurd_ihash_locp_find (disk_cache_bptr, block, &slot);
+  bptr = hurd_ihash_locp_find (shard->bptr, block, &slot);
   if (bptr)
     /* Already mapped.  */
     {
@@ -1049,8 +2027,9 @@ retry_ref:
       if (disk_cache_info[index].flags & DC_UNTOUCHED)
 	{
 	  /* Wait re-association to finish.  */
-	  pthread_cond_wait (&disk_cache_reassociation, &disk_cache_lock);
-	  pthread_mutex_unlock (&disk_cache_lock);
+	  STAT_INC (disk_cache_reassoc_waits);
+	  pthread_cond_wait (&shard->reassociation, &shard->lock);
+	  pthread_mutex_unlock (&shard->lock);
 
 #if 0
 	  printf ("Re-association -- wait finished.\n");
@@ -1060,32 +2039,33 @@ retry_ref:
 	}
 
       /* Just increment reference and return.  */
-      assert_backtrace (disk_cache_info[index].ref_count + 1
-	      > disk_cache_info[index].ref_count);
-      disk_cache_info[index].ref_count++;
+      STAT_INC (disk_cache_hits);
+      refcount_unsafe_ref (&disk_cache_info[index].ref_count);
+      disk_cache_info[index].flags |= DC_REFERENCED;
 
-      ext2_debug ("cached %u -> %d (ref_count = %hu, flags = %#hx, ptr = %p)",
+      ext2_debug ("cached %u -> %d (ref_count = %u, flags = %#hx, ptr = %p)",
 		  disk_cache_info[index].block, index,
-		  disk_cache_info[index].ref_count,
+		  refcount_references (&disk_cache_info[index].ref_count),
 		  disk_cache_info[index].flags, bptr);
 
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       return bptr;
     }
 
   /* Search for a block that is not in core and is not referenced.  */
-  info = disk_cache_info_free_pop ();
+  info = disk_cache_info_free_pop (shard);
 
   /* Is suitable place found?  */
   if (info == NULL)
     /* No place is found.  Try to release some blocks and try
        again.  */
     {
-      ext2_debug ("flush %u -> %d", disk_cache_info[index].block, index);
+      ext2_debug ("flush %u", block);
 
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
+      STAT_INC (disk_cache_reclaims);
       disk_cache_return_unused ();
 
       goto retry_ref;
@@ -1093,6 +2073,8 @@ retry_ref:
 
   /* Suitable place is found.  */
   index = info - disk_cache_info;
+  TRACE (TRACE_EXT2_CACHE_MISS, block, index);
+  STAT_INC (disk_cache_misses);
 
   /* Calculate pointer to data.  */
   bptr = (char *)disk_cache + (index << log2_block_size);
@@ -1100,22 +2082,23 @@ retry_ref:
 
   /* This pager_return_some is used only to set PM_FORCEREAD for the
      page.  DC_UNTOUCHED is set so that we catch if someone has
-     referenced the block while we didn't hold disk_cache_lock.  */
+     referenced the block while we didn't hold the shard lock.  */
   disk_cache_info[index].flags |= DC_UNTOUCHED;
+  disk_cache_info[index].flags &= ~DC_REFERENCED;
 
 #if 0 /* XXX: Let's see if this is needed at all.  */
 
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
   pager_return_some (diskfs_disk_pager, bptr - disk_cache, vm_page_size, 1);
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
   /* Has someone used our bptr?  Has someone mapped requested block
-     while we have unlocked disk_cache_lock?  If so, environment has
+     while we have unlocked the shard lock?  If so, environment has
      changed and we have to restart operation.  */
   if ((! (disk_cache_info[index].flags & DC_UNTOUCHED))
-      || hurd_ihash_find (disk_cache_bptr, block))
+      || hurd_ihash_find (shard->bptr, block))
     {
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
       goto retry_ref;
     }
 
@@ -1126,48 +2109,49 @@ retry_ref:
   pthread_mutex_lock (&diskfs_disk_pager->interlock);
   int page = (bptr - disk_cache) / vm_page_size;
   assert_backtrace (page >= 0);
-  int is_incore = (page < diskfs_disk_pager->pagemapsize
-		   && (diskfs_disk_pager->pagemap[page] & PM_INCORE));
+  short *pm_entry = _pager_pagemap_find (diskfs_disk_pager, page);
+  int is_incore = pm_entry && (*pm_entry & PM_INCORE);
   pthread_mutex_unlock (&diskfs_disk_pager->interlock);
   if (is_incore)
     {
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
       printf ("INCORE\n");
       goto retry_ref;
     }
 
 #endif
 
-  /* Re-associate.  */
+  /* Re-associate.  Entries only ever hold blocks of their own shard, so
+     the old association is in this shard's mapping too.  */
 
   /* New association.  */
-  if (hurd_ihash_locp_add (disk_cache_bptr, slot, block, bptr))
+  if (hurd_ihash_locp_add (shard->bptr, slot, block, bptr))
     ext2_panic ("Couldn't hurd_ihash_locp_add new disk block");
   if (disk_cache_info[index].block != DC_NO_BLOCK)
     /* Remove old association.  */
-    hurd_ihash_remove (disk_cache_bptr, disk_cache_info[index].block);
+    hurd_ihash_remove (shard->bptr, disk_cache_info[index].block);
   assert_backtrace (! (disk_cache_info[index].flags & DC_DONT_REUSE & ~DC_UNTOUCHED));
   disk_cache_info[index].block = block;
-  assert_backtrace (! disk_cache_info[index].ref_count);
-  disk_cache_info[index].ref_count = 1;
+  assert_backtrace (! refcount_references (&disk_cache_info[index].ref_count));
+  refcount_init (&disk_cache_info[index].ref_count, 1);
 
   /* All data structures are set up.  */
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   /* Try to read page.  */
   *(volatile char *) bptr;
 
   /* Check if it's actually read.  */
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   if (disk_cache_info[index].flags & DC_UNTOUCHED)
     /* It's not read.  */
     {
       /* Remove newly created association.  */
-      hurd_ihash_remove (disk_cache_bptr, block);
+      hurd_ihash_remove (shard->bptr, block);
       disk_cache_info[index].block = DC_NO_BLOCK;
       disk_cache_info[index].flags &=~ DC_UNTOUCHED;
       disk_cache_info[index].ref_count = 0;
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       /* Prepare next time association of this page to succeed.  */
       pager_flush_some (diskfs_disk_pager, bptr - disk_cache,
@@ -1181,73 +2165,86 @@ retry_ref:
     }
 
   /* Re-association was successful.  */
-  pthread_cond_broadcast (&disk_cache_reassociation);
+  pthread_cond_broadcast (&shard->reassociation);
 
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   ext2_debug ("(%u) = %p", block, bptr);
   return bptr;
 }
 
+/* The caller already holds a reference, so the entry can't be reused
+   under us and no lock is needed.  */
 void
 disk_cache_block_ref_ptr (void *ptr)
 {
-  int index;
+  int index = bptr_index (ptr);
+  unsigned int ref_count;
 
-  pthread_mutex_lock (&disk_cache_lock);
-  index = bptr_index (ptr);
-  assert_backtrace (disk_cache_info[index].ref_count >= 1);
-  assert_backtrace (disk_cache_info[index].ref_count + 1
-	  > disk_cache_info[index].ref_count);
-  disk_cache_info[index].ref_count++;
-  assert_backtrace (! (disk_cache_info[index].flags & DC_UNTOUCHED));
-  ext2_debug ("(%p) (ref_count = %hu, flags = %#hx)",
-	      ptr,
-	      disk_cache_info[index].ref_count,
-	      disk_cache_info[index].flags);
-  pthread_mutex_unlock (&disk_cache_lock);
+  ref_count = refcount_unsafe_ref (&disk_cache_info[index].ref_count);
+  assert_backtrace (ref_count > 1);
+  ext2_debug ("(%p) (ref_count = %u, flags = %#hx)",
+	      ptr, ref_count, disk_cache_info[index].flags);
 }
 
 void
 _disk_cache_block_deref (void *ptr)
 {
+  struct disk_cache_shard *shard;
   int index;
 
   assert_backtrace (disk_cache <= ptr && ptr <= disk_cache + disk_cache_size);
 
-  pthread_mutex_lock (&disk_cache_lock);
   index = bptr_index (ptr);
-  ext2_debug ("(%p) (ref_count = %hu, flags = %#hx)",
+  ext2_debug ("(%p) (ref_count = %u, flags = %#hx)",
 	      ptr,
-	      disk_cache_info[index].ref_count - 1,
+	      refcount_references (&disk_cache_info[index].ref_count) - 1,
 	      disk_cache_info[index].flags);
   assert_backtrace (! (disk_cache_info[index].flags & DC_UNTOUCHED));
-  assert_backtrace (disk_cache_info[index].ref_count >= 1);
-  disk_cache_info[index].ref_count--;
-  if (disk_cache_info[index].ref_count == 0 &&
-      !(disk_cache_info[index].flags & DC_DONT_REUSE))
-    disk_cache_info_free_push (&disk_cache_info[index]);
-  pthread_mutex_unlock (&disk_cache_lock);
+  if (refcount_deref (&disk_cache_info[index].ref_count) > 0)
+    return;
+
+  /* That was the last reference; the entry may now be reused.  Someone
+     may have looked the block up again meanwhile, which the free list
+     copes with.  */
+  shard = disk_cache_info_shard (index);
+  pthread_mutex_lock (&shard->lock);
+  disk_cache_info_release (index);
+  pthread_mutex_unlock (&shard->lock);
+}
+
+void *
+disk_cache_block_find (block_t block)
+{
+  struct disk_cache_shard *shard = &disk_cache_shards[DISK_CACHE_SHARD (block)];
+  void *ptr;
+
+  pthread_mutex_lock (&shard->lock);
+  ptr = hurd_ihash_find (shard->bptr, block);
+  pthread_mutex_unlock (&shard->lock);
+
+  return ptr;
 }
 
 /* Not used.  */
 int
 disk_cache_block_is_ref (block_t block)
 {
+  struct disk_cache_shard *shard = &disk_cache_shards[DISK_CACHE_SHARD (block)];
   int ref;
   void *ptr;
 
-  pthread_mutex_lock (&disk_cache_lock);
-  ptr = hurd_ihash_find (disk_cache_bptr, block);
+  pthread_mutex_lock (&shard->lock);
+  ptr = hurd_ihash_find (shard->bptr, block);
   if (ptr == NULL)
     ref = 0;
   else				/* XXX: Should check for DC_UNTOUCHED too.  */
-    ref = disk_cache_info[bptr_index (ptr)].ref_count;
-  pthread_mutex_unlock (&disk_cache_lock);
+    ref = refcount_references (&disk_cache_info[bptr_index (ptr)].ref_count);
+  pthread_mutex_unlock (&shard->lock);
 
   return ref;
 }
-
+
 /* Create the disk pager, and the file pager.  */
 void
 create_disk_pager (void)
@@ -1261,7 +2258,7 @@ create_disk_pager (void)
   upi->type = DISK;
   disk_pager_bucket = ports_create_bucket ();
   get_hypermetadata ();
-  disk_cache_blocks = DISK_CACHE_BLOCKS;
+  disk_cache_blocks = disk_cache_max;
   disk_cache_size = disk_cache_blocks << log2_block_size;
   diskfs_start_disk_pager (upi, disk_pager_bucket, MAY_CACHE, 1,
 			   disk_cache_size, &disk_cache);
@@ -1308,6 +2305,7 @@ resume_ext2_pager (void)
 mach_port_t
 diskfs_get_filemap (struct node *node, vm_prot_t prot)
 {
+  struct disknode *dn;
   struct pager *pager;
   mach_port_t right;
 
@@ -1317,7 +2315,8 @@ diskfs_get_filemap (struct node *node, vm_prot_t prot)
 
   pthread_spin_lock (&node_to_page_lock);
 
-  pager = diskfs_node_disknode (node)->pager;
+  dn = diskfs_node_disknode (node);
+  pager = dn->pager;
   if (pager)
     {
       ports_port_ref (pager);
@@ -1339,12 +2338,22 @@ diskfs_get_filemap (struct node *node, vm_prot_t prot)
       upi->node = node;
       upi->max_prot = prot;
       diskfs_nref_light (node);
-      diskfs_node_disknode (node)->pager = pager;
+      dn->pager = pager;
 
       /* A weak reference for being part of the node.  */
       ports_port_ref_weak (pager);
     }
 
+  if ((prot & VM_PROT_WRITE) && ! dn->wpager_prevp)
+    {
+      dn->wpager_next = writable_pagers;
+      if (writable_pagers)
+	writable_pagers->wpager_prevp = &dn->wpager_next;
+      dn->wpager_prevp = &writable_pagers;
+      writable_pagers = dn;
+      num_writable_pagers++;
+    }
+
   pthread_spin_unlock (&node_to_page_lock);
 
   if (prot & VM_PROT_WRITE)
@@ -1435,10 +2444,14 @@ diskfs_shutdown_pager (void)
 }
 
 /* Sync all the pagers. */
-void
-diskfs_sync_everything (int wait)
+/* Sync the file pagers that may have dirty pages: those that have been
+   given write access.  */
+static void
+sync_file_pagers (int wait)
 {
-  flush_journal_to_file();
+  struct pager **pagers = NULL;
+  size_t n, alloced = 0;
+  struct disknode *dn;
 
   error_t sync_one (void *v_p)
     {
@@ -1447,11 +2460,65 @@ diskfs_sync_everything (int wait)
       return 0;
     }
 
+  pthread_spin_lock (&node_to_page_lock);
+  while (num_writable_pagers > alloced)
+    {
+      n = num_writable_pagers;
+      pthread_spin_unlock (&node_to_page_lock);
+
+      free (pagers);
+      alloced = n + n / 4;
+      pagers = malloc (alloced * sizeof *pagers);
+      if (pagers == NULL)
+	{
+	  ports_bucket_iterate (file_pager_bucket, sync_one);
+	  return;
+	}
+
+      pthread_spin_lock (&node_to_page_lock);
+    }
+
+  n = 0;
+  for (dn = writable_pagers; dn; dn = dn->wpager_next)
+    {
+      ports_port_ref (dn->pager);
+      pagers[n++] = dn->pager;
+    }
+  pthread_spin_unlock (&node_to_page_lock);
+
+  while (n > 0)
+    {
+      struct pager *p = pagers[--n];
+      pager_sync (p, wait);
+      ports_port_deref (p);
+    }
+  free (pagers);
+}
+
+void
+diskfs_sync_everything (int wait)
+{
+  flush_journal_to_file();
+  uint64_t checkpoint = journal_checkpoint_begin ();
+
+  /* The bitmaps written below should not miss blocks already taken
+     out of files.  */
+  ext2_drain_deferred_frees ();
+  uint64_t discard_epoch = ext2_discard_sync_begin ();
+
   write_all_disknodes ();
-  ports_bucket_iterate (file_pager_bucket, sync_one);
+  sync_file_pagers (wait);
 
   /* Do things on the the disk pager.  */
   sync_global (wait);
+
+  /* Only a waited-for sync is known to have reached the disk.  */
+  if (wait)
+    {
+      journal_checkpoint_commit (checkpoint);
+      jbd2_checkpoint ();
+      ext2_discard_sync_end (discard_epoch);
+    }
 }
 
 static void
@@ -1566,3 +2633,79 @@ diskfs_max_user_pager_prot (void)
 
   return max_prot;
 }
+
+#ifdef STATS
+/* Add the pager and disk cache statistics to those journal_fetch_stats
+   returns, summed over all the copies.  */
+void
+diskfs_append_stats (FILE *out)
+{
+  struct ext2fs_pager_stats sum = { 0 };
+  int i, j;
+
+#define SUM(field)							      \
+  sum.field += __atomic_load_n (&st->field, __ATOMIC_RELAXED)
+
+  for (i = 0; i < STATS_SHARDS; i++)
+    {
+      struct ext2fs_pager_stats *st = &ext2s_pager_stats[i];
+      unsigned long max;
+
+      SUM (disk_pageins);
+      SUM (disk_pageouts);
+      SUM (disk_cache_hits);
+      SUM (disk_cache_misses);
+      SUM (disk_cache_reassoc_waits);
+      SUM (disk_cache_reclaims);
+      SUM (file_pageins);
+      SUM (file_pagein_reads);
+      SUM (file_pagein_freed_bufs);
+      SUM (file_pagein_alloced_bufs);
+      SUM (file_readaheads);
+      SUM (file_readahead_pages);
+      SUM (file_readahead_hits);
+      SUM (file_readahead_misses);
+      SUM (file_pageouts);
+      SUM (file_page_unlocks);
+      SUM (file_grows);
+      SUM (writebacks);
+      SUM (writeback_us);
+      for (j = 0; j < STATS_HIST_BUCKETS; j++)
+	SUM (writeback_latency[j]);
+
+      max = __atomic_load_n (&st->writeback_max_us, __ATOMIC_RELAXED);
+      if (max > sum.writeback_max_us)
+	sum.writeback_max_us = max;
+    }
+#undef SUM
+
+  fprintf (out, "ext2-disk-pageins %lu\n", sum.disk_pageins);
+  fprintf (out, "ext2-disk-pageouts %lu\n", sum.disk_pageouts);
+  fprintf (out, "ext2-disk-cache-hits %lu\n", sum.disk_cache_hits);
+  fprintf (out, "ext2-disk-cache-misses %lu\n", sum.disk_cache_misses);
+  fprintf (out, "ext2-disk-cache-reassoc-waits %lu\n",
+	   sum.disk_cache_reassoc_waits);
+  fprintf (out, "ext2-disk-cache-reclaims %lu\n", sum.disk_cache_reclaims);
+  fprintf (out, "ext2-disk-cache-blocks %d\n", disk_cache_blocks);
+  fprintf (out, "ext2-file-pageins %lu\n", sum.file_pageins);
+  fprintf (out, "ext2-file-pagein-reads %lu\n", sum.file_pagein_reads);
+  fprintf (out, "ext2-file-pagein-freed-bufs %lu\n",
+	   sum.file_pagein_freed_bufs);
+  fprintf (out, "ext2-file-pagein-alloced-bufs %lu\n",
+	   sum.file_pagein_alloced_bufs);
+  fprintf (out, "ext2-readaheads %lu\n", sum.file_readaheads);
+  fprintf (out, "ext2-readahead-pages %lu\n", sum.file_readahead_pages);
+  fprintf (out, "ext2-readahead-hits %lu\n", sum.file_readahead_hits);
+  fprintf (out, "ext2-readahead-misses %lu\n", sum.file_readahead_misses);
+  fprintf (out, "ext2-file-pageouts %lu\n", sum.file_pageouts);
+  fprintf (out, "ext2-file-page-unlocks %lu\n", sum.file_page_unlocks);
+  fprintf (out, "ext2-file-grows %lu\n", sum.file_grows);
+  fprintf (out, "ext2-writebacks %lu\n", sum.writebacks);
+  fprintf (out, "ext2-writeback-us %lu\n", sum.writeback_us);
+  fprintf (out, "ext2-writeback-max-us %lu\n", sum.writeback_max_us);
+  fprintf (out, "ext2-writeback-latency-us");
+  for (j = 0; j < STATS_HIST_BUCKETS; j++)
+    fprintf (out, " %lu", sum.writeback_latency[j]);
+  fputc ('\n', out);
+}
+#endif /* STATS */
@@ -20,6 +20,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
+#include <string.h>
 #include "ext2fs.h"
 
 void
@@ -115,6 +116,74 @@ pokel_add (struct pokel *pokel, void *loc, vm_size_t length)
   pthread_spin_unlock (&pokel->lock);
 }
 
+/* Log the disk cache blocks covered by POKES to the journal as a single
+   transaction, so that they are committed before being written back in
+   place.  */
+static void
+journal_pokes (struct poke *pokes)
+{
+  struct poke *pl;
+  size_t n = 0, max = 0;
+  block_t *blocks;
+  void **data;
+  error_t err;
+
+  for (pl = pokes; pl; pl = pl->next)
+    max += (round_block (pl->offset + pl->length) - trunc_block (pl->offset))
+	   >> log2_block_size;
+  if (max == 0)
+    return;
+
+  blocks = malloc (max * sizeof *blocks);
+  data = malloc (max * sizeof *data);
+  if (blocks && data)
+    {
+      for (pl = pokes; pl; pl = pl->next)
+	{
+	  vm_offset_t begin = trunc_block (pl->offset);
+	  vm_offset_t end = round_block (pl->offset + pl->length);
+	  for (vm_offset_t i = begin; i != end; i += block_size)
+	    {
+	      int index = i >> log2_block_size;
+	      struct disk_cache_shard *shard = disk_cache_info_shard (index);
+	      block_t block;
+	      int modified = 1;
+
+	      pthread_mutex_lock (&shard->lock);
+	      block = disk_cache_info[index].block;
+	      pthread_mutex_unlock (&shard->lock);
+
+	      if (block == DC_NO_BLOCK)
+		continue;
+	      if (modified_global_blocks)
+		/* Pages may hold cached blocks nobody touched.  */
+		{
+		  pthread_spin_lock (&modified_global_blocks_lock);
+		  modified = test_bit (block, modified_global_blocks);
+		  pthread_spin_unlock (&modified_global_blocks_lock);
+		}
+	      if (modified)
+		{
+		  blocks[n] = block;
+		  data[n] = disk_cache + i;
+		  n++;
+		}
+	    }
+	}
+
+      err = jbd2_log_blocks (blocks, data, n);
+    }
+  else
+    err = ENOMEM;
+
+  if (err)
+    ext2_warning ("writing %zu metadata blocks back unjournaled: %s",
+		  n, strerror (err));
+
+  free (blocks);
+  free (data);
+}
+
 /* Move all pending pokes from POKEL into its free list.  If SYNC is true,
    otherwise do nothing.  */
 void
@@ -127,6 +196,10 @@ _pokel_exec (struct pokel *pokel, int sync, int wait)
   pokel->pokes = NULL;
   pthread_spin_unlock (&pokel->lock);
 
+  if (sync && pokes && pokel->image == disk_cache
+      && jbd2_present && !diskfs_readonly)
+    journal_pokes (pokes);
+
   for (pl = pokes; pl; last = pl, pl = pl->next)
     {
       if (sync)
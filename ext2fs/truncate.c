@@ -28,20 +28,28 @@
 
 /* ---------------------------------------------------------------- */
 
+/* Truncations unmapping at least this many blocks leave freeing them
+   to the background; see ext2_free_blocks_deferred.  */
+#define TRUNCATE_DEFER_BLOCKS 8192
+
 /* A sequence of blocks to be freed in NODE.  */
 struct free_block_run
 {
   block_t first_block;
   unsigned long num_blocks;
   struct node *node;
+  int defer;
 };
 
-/* Initialize FBR, pointing to NODE.  */
+/* Initialize FBR, pointing to NODE.  If DEFER, the blocks are freed in
+   the background.  */
 static inline void
-free_block_run_init (struct free_block_run *fbr, struct node *node)
+free_block_run_init (struct free_block_run *fbr, struct node *node,
+		     int defer)
 {
   fbr->num_blocks = 0;
   fbr->node = node;
+  fbr->defer = defer;
 }
 
 static inline void
@@ -49,7 +57,10 @@ _free_block_run_flush (struct free_block_run *fbr, unsigned long count)
 {
   fbr->node->dn_stat.st_blocks -= count << log2_stat_blocks_per_fs_block;
   fbr->node->dn_stat_dirty = 1;
-  ext2_free_blocks (fbr->first_block, count);
+  if (fbr->defer)
+    ext2_free_blocks_deferred (fbr->first_block, count);
+  else
+    ext2_free_blocks (fbr->first_block, count);
 }
 
 /* Add BLOCK to the list of blocks to be freed in FBR.  */
@@ -291,6 +302,32 @@ diskfs_truncate (struct node *node, off_t length)
   if (length >= node->dn_stat.st_size)
     return 0;
 
+  if (EXT4_HAS_INLINE_DATA (node))
+    {
+      /* The tail is cleared in the inode itself, so the pager's copy of
+	 the data is written back before, and dropped after.  */
+      diskfs_file_update (node, 1);
+
+      pthread_rwlock_wrlock (&diskfs_node_disknode (node)->alloc_lock);
+      err = diskfs_catch_exception ();
+      if (!err)
+	{
+	  err = ext4_inline_truncate (node, length);
+	  diskfs_end_catch_exception ();
+	}
+      if (!err)
+	node->dn_stat.st_size = length;
+      pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
+
+      flush_node_pager (node);
+
+      node->dn_set_mtime = 1;
+      node->dn_set_ctime = 1;
+      node->dn_stat_dirty = 1;
+      diskfs_node_update (node, diskfs_synchronous);
+      return err;
+    }
+
   if (! node->dn_stat.st_blocks
       && !S_ISREG (node->dn_stat.st_mode)
       && !S_ISDIR (node->dn_stat.st_mode))
@@ -346,25 +383,40 @@ diskfs_truncate (struct node *node, off_t length)
   node->dn_set_ctime = 1;
   diskfs_node_update (node, diskfs_synchronous);
 
+  /* No lookups can refill it while we hold ALLOC_LOCK for writing.  */
+  ext2_run_cache_clear (node);
+  ext2_dirhash_drop (node);
+  ext2_delalloc_truncate (node, boffs_block (round_block (length)));
+
   err = diskfs_catch_exception ();
   if (!err)
     {
       block_t end = boffs_block (round_block (length)), offs;
       block_t *bptrs = diskfs_node_disknode (node)->info.i_data;
       struct free_block_run fbr;
+      int defer = ((node->dn_stat.st_blocks >> log2_stat_blocks_per_fs_block)
+		   >= end + TRUNCATE_DEFER_BLOCKS);
 
-      free_block_run_init (&fbr, node);
+      if (EXT4_HAS_EXTENTS (node))
+	ext4_ext_truncate (node, end, defer);
+      else
+	{
+	  free_block_run_init (&fbr, node, defer);
 
-      trunc_direct (node, end, &fbr);
+	  trunc_direct (node, end, &fbr);
 
-      offs = EXT2_NDIR_BLOCKS;
-      trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs, &fbr);
-      offs += addr_per_block;
-      trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs, &fbr);
-      offs += addr_per_block * addr_per_block;
-      trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs, &fbr);
+	  offs = EXT2_NDIR_BLOCKS;
+	  trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block;
+	  trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block * addr_per_block;
+	  trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs,
+				 &fbr);
 
-      free_block_run_finish (&fbr);
+	  free_block_run_finish (&fbr);
+	}
 
       node->allocsize = round_block (length);
 
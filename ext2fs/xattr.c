@@ -39,6 +39,8 @@ xattr_prefixes[] =
   {
   1, "user.", sizeof "user." - 1},
   {
+  7, "system.", sizeof "system." - 1},
+  {
   10, "gnu.", sizeof "gnu." - 1},
   {
   0, NULL, 0}
@@ -148,50 +150,21 @@ xattr_entry_rehash (struct ext2_xattr_header *header,
 #undef BLOCK_HASH_SHIFT
 
 /*
- * Given an entry, appends its name to a buffer.  The provided buffer
- * length is reduced by the name size, even if the buffer is NULL (for
- * computing the list size).  Returns EOPNOTSUPP (operation not
- * supported) if the entry index cannot be found on the array of
- * supported prefixes.  If a buffer is provided (not NULL) and its
- * length is not enough for name, ERANGE is returned.
+ * Given an entry, returns the index in the array of supported prefixes
+ * of its prefix, which is that of the terminating element if it is not
+ * supported.
  */
-static error_t
-xattr_entry_list (struct ext2_xattr_entry *entry, char *buffer, size_t *len)
+static int
+xattr_entry_prefix (struct ext2_xattr_entry *entry)
 {
-
   int i;
-  size_t size;
 
   for (i = 0; xattr_prefixes[i].prefix != NULL; i++)
     {
       if (entry->e_name_index == xattr_prefixes[i].index)
 	break;
     }
-
-  if (xattr_prefixes[i].prefix == NULL)
-    return EOPNOTSUPP;
-
-  size = xattr_prefixes[i].size + entry->e_name_len + 1;
-
-  if (buffer)
-    {
-      if (size <= *len)
-	{
-	  memcpy (buffer, xattr_prefixes[i].prefix, xattr_prefixes[i].size);
-	  buffer += xattr_prefixes[i].size;
-	  memcpy (buffer, entry->e_name, entry->e_name_len);
-	  buffer += entry->e_name_len;
-	  *buffer++ = 0;
-	}
-      else
-	{
-	  return ERANGE;
-	}
-    }
-
-  *len -= size;
-  return 0;
-
+  return i;
 }
 
 /*
@@ -310,11 +283,12 @@ xattr_entry_create (struct ext2_xattr_header *header,
 
 /*
  * Removes an entry from the xattr block, giving a pointer to the
- * block header, the last attribute entry, the position of the entry
- * to be removed and the remaining space in the block.
+ * block header, its first and last attribute entries, the position of
+ * the entry to be removed and the remaining space in the block.
  */
 static error_t
 xattr_entry_remove (struct ext2_xattr_header *header,
+		    struct ext2_xattr_entry *first,
 		    struct ext2_xattr_entry *last,
 		    struct ext2_xattr_entry *position, size_t rest)
 {
@@ -334,7 +308,7 @@ xattr_entry_remove (struct ext2_xattr_header *header,
   memset ((char *) header + start, 0, size);
 
   /* Adjust all value offsets */
-  entry = EXT2_XATTR_ENTRY_FIRST (header);
+  entry = first;
   while (!EXT2_XATTR_ENTRY_LAST (entry))
     {
       if (le16toh (entry->e_value_offs) < end)
@@ -357,13 +331,15 @@ xattr_entry_remove (struct ext2_xattr_header *header,
 
 /*
  * Replaces the value of an existing attribute entry, given the block
- * header, the last entry, the entry whose value should be replaced,
+ * header, the first and last entries, the entry whose value should be
+ * replaced,
  * the new value, its length, and the remaining space in the block.
  * Returns ERANGE if there is not enough space (when the new value is
  * bigger than the old one).
  */
 static error_t
 xattr_entry_replace (struct ext2_xattr_header *header,
+		     struct ext2_xattr_entry *first,
 		     struct ext2_xattr_entry *last,
 		     struct ext2_xattr_entry *position,
 		     const char *value, size_t len, size_t rest)
@@ -375,7 +351,7 @@ xattr_entry_replace (struct ext2_xattr_header *header,
   old_size = EXT2_XATTR_ALIGN (le32toh (position->e_value_size));
   new_size = EXT2_XATTR_ALIGN (len);
 
-  if (rest < 4 || new_size - old_size > rest - 4)
+  if (new_size > old_size && (rest < 4 || new_size - old_size > rest - 4))
     return ERANGE;
 
   if (new_size != old_size)
@@ -392,7 +368,7 @@ xattr_entry_replace (struct ext2_xattr_header *header,
 	       end - start);
 
       /* Adjust all value offsets */
-      entry = EXT2_XATTR_ENTRY_FIRST (header);
+      entry = first;
       while (!EXT2_XATTR_ENTRY_LAST (entry))
 	{
 	  if (le16toh (entry->e_value_offs) < end)
@@ -424,6 +400,280 @@ xattr_header_valid(struct ext2_xattr_header *header)
 }
 
 
+/* Where extended attributes are kept: an xattr block, or the space after
+   the extra fields of a large inode.  Entries start at FIRST, value
+   offsets count from BASE, and SIZE bytes from BASE are usable.  */
+struct xattr_region
+{
+  char *base;
+  struct ext2_xattr_entry *first;
+  size_t size;
+};
+
+/* If inode EI has attributes in its body, set *R to where they are and
+   return 1.  If CREATE, make room for them if the inode has space,
+   rather than returning 0.  */
+static int
+xattr_ibody_region (struct ext2_inode *ei, int create, struct xattr_region *r)
+{
+  size_t inode_size = EXT2_INODE_SIZE (sblock);
+  size_t extra_isize;
+  uint32_t *magic;
+
+  if (inode_size <= EXT2_GOOD_OLD_INODE_SIZE)
+    return 0;
+
+  extra_isize = le16toh (EXT2_INODE_EXTRA (ei)->i_extra_isize);
+  if (extra_isize < sizeof (uint32_t) || extra_isize & EXT2_XATTR_ROUND
+      || (EXT2_GOOD_OLD_INODE_SIZE + extra_isize + 2 * sizeof (uint32_t)
+	  > inode_size))
+    return 0;
+
+  magic = (uint32_t *) ((char *) EXT2_INODE_EXTRA (ei) + extra_isize);
+  r->base = (char *) (magic + 1);
+  r->first = (struct ext2_xattr_entry *) r->base;
+  r->size = inode_size - EXT2_GOOD_OLD_INODE_SIZE - extra_isize
+    - sizeof (uint32_t);
+
+  if (*magic != htole32 (EXT2_XATTR_IBODY_MAGIC))
+    {
+      if (!create)
+	return 0;
+      *magic = htole32 (EXT2_XATTR_IBODY_MAGIC);
+      memset (r->base, 0, r->size);
+    }
+  return 1;
+}
+
+/* Set *R to the region of xattr block BLOCK and return 1, or return 0
+   if BLOCK is not a valid xattr block.  */
+static int
+xattr_block_region (void *block, struct xattr_region *r)
+{
+  struct ext2_xattr_header *header = EXT2_XATTR_HEADER (block);
+
+  if (xattr_header_valid (header))
+    return 0;
+
+  r->base = block;
+  r->first = EXT2_XATTR_ENTRY_FIRST (header);
+  r->size = block_size;
+  return 1;
+}
+
+/*
+ * Walk the entries of region R, looking for the attribute NAME unless
+ * it is NULL.  *FOUND is set to its entry, or NULL, *LAST to the entry
+ * ending the list, and *REST to the space left in the region.  Returns
+ * EIO if the entries do not fit in the region.
+ */
+static error_t
+xattr_region_scan (struct xattr_region *r, const char *name,
+		   struct ext2_xattr_entry **found,
+		   struct ext2_xattr_entry **last, size_t *rest)
+{
+  struct ext2_xattr_entry *entry = r->first;
+  char *end = r->base + r->size;
+  size_t values = 0;
+
+  *found = NULL;
+  for (;;)
+    {
+      if ((char *) entry + sizeof (uint32_t) > end)
+	return EIO;
+      if (EXT2_XATTR_ENTRY_LAST (entry))
+	break;
+      if ((char *) entry + sizeof *entry > end
+	  || (char *) EXT2_XATTR_ENTRY_NEXT (entry) > end
+	  || (le16toh (entry->e_value_offs) + le32toh (entry->e_value_size)
+	      > r->size))
+	return EIO;
+
+      if (name && !*found)
+	{
+	  size_t size;
+	  error_t err = xattr_entry_get (NULL, entry, name, NULL, &size, NULL);
+	  if (err == 0)
+	    *found = entry;
+	  else if (err != ENODATA)
+	    return err;
+	}
+
+      values += EXT2_XATTR_ALIGN (le32toh (entry->e_value_size));
+      entry = EXT2_XATTR_ENTRY_NEXT (entry);
+    }
+
+  if (values + ((char *) entry - r->base) > r->size)
+    return EIO;
+
+  *last = entry;
+  *rest = r->size - values - ((char *) entry - r->base);
+  return 0;
+}
+
+/* A node's extended attributes, decoded, so that looking one up touches
+   neither the inode nor the xattr block.  The names and values follow
+   ENTRIES in the same allocation.  */
+struct xattr_cache
+{
+  error_t list_err;		/* What listing the names returns, if not 0. */
+  size_t names_len;		/* Bytes the names take when listed.  */
+  size_t count;
+  struct
+  {
+    const char *name;
+    const char *value;
+    size_t len;
+  } entries[];
+};
+
+/* The cache of nodes without attributes.  */
+static struct xattr_cache xattr_cache_empty;
+
+/* Read the attributes of NP into a new cache in *CACHEP.  */
+static error_t
+xattr_cache_build (struct node *np, struct xattr_cache **cachep)
+{
+  struct xattr_region regions[2];
+  int nregions = 0;
+  struct ext2_inode *ei;
+  void *block = NULL;
+  struct xattr_cache *cache;
+  error_t list_err = 0;
+  size_t count = 0, names_len = 0, values_len = 0;
+  char *p;
+  error_t err = 0;
+
+  ei = dino_ref (np->cache_id);
+
+  if (xattr_ibody_region (ei, 0, &regions[nregions]))
+    nregions++;
+
+  if (ei->i_file_acl != 0)
+    {
+      block = disk_cache_block_ref (ei->i_file_acl);
+      if (! xattr_block_region (block, &regions[nregions]))
+	{
+	  ext2_warning ("Invalid extended attribute block.");
+	  err = EIO;
+	  goto cleanup;
+	}
+      nregions++;
+    }
+
+  for (int r = 0; r < nregions; r++)
+    {
+      struct ext2_xattr_entry *entry, *last;
+      size_t rest;
+
+      err = xattr_region_scan (&regions[r], NULL, &entry, &last, &rest);
+      if (err)
+	{
+	  ext2_warning ("Invalid extended attributes in inode %llu.",
+			np->cache_id);
+	  goto cleanup;
+	}
+
+      for (entry = regions[r].first; entry != last;
+	   entry = EXT2_XATTR_ENTRY_NEXT (entry))
+	{
+	  int i = xattr_entry_prefix (entry);
+
+	  if (xattr_prefixes[i].prefix == NULL)
+	    {
+	      list_err = EOPNOTSUPP;
+	      continue;
+	    }
+	  count++;
+	  names_len += xattr_prefixes[i].size + entry->e_name_len + 1;
+	  values_len += le32toh (entry->e_value_size);
+	}
+    }
+
+  if (count == 0 && list_err == 0)
+    {
+      *cachep = &xattr_cache_empty;
+      goto cleanup;
+    }
+
+  cache = malloc (sizeof *cache + count * sizeof cache->entries[0]
+		  + names_len + values_len);
+  if (cache == NULL)
+    {
+      err = ENOMEM;
+      goto cleanup;
+    }
+  cache->list_err = list_err;
+  cache->names_len = names_len;
+  cache->count = 0;
+
+  p = (char *) &cache->entries[count];
+  for (int r = 0; r < nregions; r++)
+    {
+      struct ext2_xattr_entry *entry;
+
+      for (entry = regions[r].first; !EXT2_XATTR_ENTRY_LAST (entry);
+	   entry = EXT2_XATTR_ENTRY_NEXT (entry))
+	{
+	  int i = xattr_entry_prefix (entry);
+	  size_t len = le32toh (entry->e_value_size);
+
+	  if (xattr_prefixes[i].prefix == NULL)
+	    continue;
+
+	  cache->entries[cache->count].name = p;
+	  memcpy (p, xattr_prefixes[i].prefix, xattr_prefixes[i].size);
+	  p += xattr_prefixes[i].size;
+	  memcpy (p, entry->e_name, entry->e_name_len);
+	  p += entry->e_name_len;
+	  *p++ = 0;
+
+	  cache->entries[cache->count].value = p;
+	  memcpy (p, regions[r].base + le16toh (entry->e_value_offs), len);
+	  p += len;
+	  cache->entries[cache->count].len = len;
+	  cache->count++;
+	}
+    }
+
+  *cachep = cache;
+
+cleanup:
+  if (block)
+    disk_cache_block_deref (block);
+  dino_deref (ei);
+
+  return err;
+}
+
+/* Return in *CACHEP the decoded attributes of NP, reading them if
+   need be.  */
+static error_t
+xattr_cache_get (struct node *np, struct xattr_cache **cachep)
+{
+  struct disknode *dn = diskfs_node_disknode (np);
+
+  if (dn->xattr_cache == NULL)
+    {
+      error_t err = xattr_cache_build (np, &dn->xattr_cache);
+      if (err)
+	return err;
+    }
+
+  *cachep = dn->xattr_cache;
+  return 0;
+}
+
+void
+ext2_xattr_cache_drop (struct node *np)
+{
+  struct disknode *dn = diskfs_node_disknode (np);
+
+  if (dn->xattr_cache != &xattr_cache_empty)
+    free (dn->xattr_cache);
+  dn->xattr_cache = NULL;
+}
+
 /*
  * Given a node, free extended attributes block associated with
  * this node.
@@ -446,6 +696,8 @@ ext2_free_xattr_block (struct node *np)
   err = 0;
   block = NULL;
 
+  ext2_xattr_cache_drop (np);
+
   ei = dino_ref (np->cache_id);
   blkno = ei->i_file_acl;
 
@@ -514,11 +766,7 @@ ext2_list_xattr (struct node *np, char *buffer, size_t *len)
 {
 
   error_t err;
-  block_t blkno;
-  void *block;
-  struct ext2_inode *ei;
-  struct ext2_xattr_header *header;
-  struct ext2_xattr_entry *entry;
+  struct xattr_cache *cache;
 
   if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR))
     {
@@ -529,47 +777,24 @@ ext2_list_xattr (struct node *np, char *buffer, size_t *len)
   if (!len)
     return EINVAL;
 
-  size_t size = *len;
-
-  ei = dino_ref (np->cache_id);
-  blkno = ei->i_file_acl;
-  dino_deref (ei);
+  err = xattr_cache_get (np, &cache);
+  if (err)
+    return err;
 
-  if (blkno == 0)
-    {
-      *len = 0;
-      return 0;
-    }
+  if (cache->list_err)
+    return cache->list_err;
 
-  err = EIO;
-  block = disk_cache_block_ref (blkno);
-
-  header = EXT2_XATTR_HEADER (block);
-  if (xattr_header_valid(header))
+  if (buffer)
     {
-      ext2_warning ("Invalid extended attribute block.");
-      err = EIO;
-      goto cleanup;
-    }
-
-  entry = EXT2_XATTR_ENTRY_FIRST (header);
+      if (*len < cache->names_len)
+	return ERANGE;
 
-  while (!EXT2_XATTR_ENTRY_LAST (entry))
-    {
-      err = xattr_entry_list (entry, buffer, &size);
-      if (err)
-	goto cleanup;
-      if (buffer)
-        buffer += strlen (buffer) + 1;
-      entry = EXT2_XATTR_ENTRY_NEXT (entry);
+      for (size_t i = 0; i < cache->count; i++)
+	buffer = stpcpy (buffer, cache->entries[i].name) + 1;
     }
 
-  *len = *len - size;
-
-cleanup:
-  disk_cache_block_deref (block);
-
-  return err;
+  *len = cache->names_len;
+  return 0;
 
 }
 
@@ -580,20 +805,18 @@ cleanup:
  * even if the value is NULL.  May return EOPNOTSUPP if underlying
  * filesystem does not support extended attributes or the given name
  * prefix.  If there is no sufficient space in value buffer or
- * attribute name is too long, returns ERANGE.  Returns EIO if xattr
- * block is invalid and ENODATA if there is no such block or no entry
- * in the block matching the name.
+ * attribute name is too long, returns ERANGE.  Returns EIO if the
+ * attributes are invalid and ENODATA if there is no attribute
+ * matching the name.
  */
 error_t
 ext2_get_xattr (struct node *np, const char *name, char *value, size_t *len)
 {
 
-  size_t size;
-  int err;
-  void *block;
-  struct ext2_inode *ei;
-  struct ext2_xattr_header *header;
-  struct ext2_xattr_entry *entry;
+  int index;
+  const char *suffix;
+  error_t err;
+  struct xattr_cache *cache;
 
   if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR))
     {
@@ -607,44 +830,28 @@ ext2_get_xattr (struct node *np, const char *name, char *value, size_t *len)
   if (strlen(name) > 255)
     return ERANGE;
 
-  ei = dino_ref (np->cache_id);
-
-  if (ei->i_file_acl == 0)
-    {
-      dino_deref (ei);
-      return ENODATA;
-    }
-
-  block = disk_cache_block_ref (ei->i_file_acl);
-  dino_deref (ei);
-
-  header = EXT2_XATTR_HEADER (block);
-  if (xattr_header_valid(header))
-    {
-      ext2_warning ("Invalid extended attribute block.");
-      err = EIO;
-      goto cleanup;
-    }
-
-  err = ENODATA;
-  entry = EXT2_XATTR_ENTRY_FIRST (header);
-
-  while (!EXT2_XATTR_ENTRY_LAST (entry))
-    {
-      size = *len;
-      err = xattr_entry_get (block, entry, name, value, &size, NULL);
-      if (err!= ENODATA)
-	break;
-      entry = EXT2_XATTR_ENTRY_NEXT (entry);
-    }
-
-  if (!err)
-    *len = size;
-
-cleanup:
-  disk_cache_block_deref (block);
+  if (xattr_prefixes[xattr_name_prefix (name, &index, &suffix)].prefix
+      == NULL)
+    return EOPNOTSUPP;
 
-  return err;
+  err = xattr_cache_get (np, &cache);
+  if (err)
+    return err;
+
+  for (size_t i = 0; i < cache->count; i++)
+    if (strcmp (cache->entries[i].name, name) == 0)
+      {
+	if (value)
+	  {
+	    if (*len < cache->entries[i].len)
+	      return ERANGE;
+	    memcpy (value, cache->entries[i].value, cache->entries[i].len);
+	  }
+	*len = cache->entries[i].len;
+	return 0;
+      }
+
+  return ENODATA;
 
 }
 
@@ -662,11 +869,12 @@ cleanup:
  * EOPNOTSUPP is returned in case extended attributes or the name
  * prefix are not supported.  If there is no space available in the
  * block, ERANGE is returned.  If there is no any entry after removing
- * the specified entry, free the xattr block.
+ * the specified entry, free the xattr block.  This only looks at the
+ * xattr block, not at attributes in the inode.
  */
-error_t
-ext2_set_xattr (struct node *np, const char *name, const char *value,
-		size_t len, int flags)
+static error_t
+xattr_block_set (struct node *np, const char *name, const char *value,
+		 size_t len, int flags)
 {
 
   int found;
@@ -679,18 +887,6 @@ ext2_set_xattr (struct node *np, const char *name, const char *value,
   struct ext2_xattr_entry *entry;
   struct ext2_xattr_entry *location;
 
-  if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR))
-    {
-      ext2_warning ("Filesystem has no support for extended attributes.");
-      return EOPNOTSUPP;
-    }
-
-  if (!name)
-    return EINVAL;
-
-  if (strlen(name) > 255 || len > block_size)
-    return ERANGE;
-
   ei = dino_ref (np->cache_id);
   blkno = ei->i_file_acl;
 
@@ -812,12 +1008,14 @@ ext2_set_xattr (struct node *np, const char *name, const char *value,
 	  goto cleanup;
 	}
       else
-	err = xattr_entry_replace (header, entry, location, value, len, rest);
+	err = xattr_entry_replace (header, EXT2_XATTR_ENTRY_FIRST (header),
+				   entry, location, value, len, rest);
     }
   else if (value)
     {
       if (found)
-	err = xattr_entry_replace (header, entry, location, value, len, rest);
+	err = xattr_entry_replace (header, EXT2_XATTR_ENTRY_FIRST (header),
+				   entry, location, value, len, rest);
       else
 	err = xattr_entry_create (header, entry, location, name, value, len,
 		rest);
@@ -835,7 +1033,8 @@ ext2_set_xattr (struct node *np, const char *name, const char *value,
 	  goto cleanup;
 	}
       else
-	err = xattr_entry_remove (header, entry, location, rest);
+	err = xattr_entry_remove (header, EXT2_XATTR_ENTRY_FIRST (header),
+				  entry, location, rest);
     }
 
   /* Check if the xattr block is empty */
@@ -884,3 +1083,224 @@ cleanup:
   return err;
 
 }
+
+/*
+ * Set the attribute NAME of node NP in the body of its inode, as
+ * ext2_set_xattr does.  *DONE is set if this was done here; otherwise
+ * the attribute is not in the inode and belongs in the xattr block,
+ * because it is being removed or replaced, or there is no room.
+ */
+static error_t
+xattr_ibody_set (struct node *np, const char *name, const char *value,
+		 size_t len, int flags, int *done)
+{
+  error_t err;
+  size_t rest;
+  struct ext2_inode *ei;
+  struct xattr_region region;
+  struct ext2_xattr_entry *found;
+  struct ext2_xattr_entry *last;
+
+  *done = 0;
+
+  ei = dino_ref (np->cache_id);
+  if (! xattr_ibody_region (ei, value != NULL, &region))
+    {
+      dino_deref (ei);
+      return 0;
+    }
+
+  err = xattr_region_scan (&region, name, &found, &last, &rest);
+  if (err)
+    {
+      if (err == EIO)
+	ext2_warning ("Invalid extended attributes in inode %llu.",
+		      np->cache_id);
+      *done = 1;
+      dino_deref (ei);
+      return err;
+    }
+
+  if (found)
+    {
+      *done = 1;
+
+      if (value && flags & XATTR_CREATE)
+	err = EEXIST;
+      else if (value)
+	{
+	  err = xattr_entry_replace ((struct ext2_xattr_header *) region.base,
+				     region.first, last, found,
+				     value, len, rest);
+	  if (err == ERANGE)
+	    {
+	      /* The new value does not fit in the inode; move the
+		 attribute to the block.  */
+	      dino_deref (ei);
+	      err = xattr_block_set (np, name, value, len, 0);
+	      if (err)
+		return err;
+
+	      ei = dino_ref (np->cache_id);
+	      xattr_ibody_region (ei, 0, &region);
+	      err = xattr_region_scan (&region, name, &found, &last, &rest);
+	      if (!err && found)
+		err = xattr_entry_remove ((struct ext2_xattr_header *)
+					  region.base, region.first, last,
+					  found, rest);
+	    }
+	  else if (!err)
+	    xattr_entry_hash ((struct ext2_xattr_header *) region.base, found);
+	}
+      else if (flags & XATTR_REPLACE || flags & XATTR_CREATE)
+	err = EINVAL;
+      else
+	err = xattr_entry_remove ((struct ext2_xattr_header *) region.base,
+				  region.first, last, found, rest);
+    }
+  else if (value && !(flags & XATTR_REPLACE))
+    {
+      /* Create the attribute here, unless it is in the block.  */
+      if (ei->i_file_acl != 0)
+	{
+	  void *block = disk_cache_block_ref (ei->i_file_acl);
+	  struct xattr_region block_region;
+	  struct ext2_xattr_entry *block_found = NULL;
+	  struct ext2_xattr_entry *block_last;
+	  size_t block_rest;
+
+	  if (xattr_block_region (block, &block_region))
+	    xattr_region_scan (&block_region, name, &block_found,
+			       &block_last, &block_rest);
+	  disk_cache_block_deref (block);
+
+	  if (block_found)
+	    {
+	      dino_deref (ei);
+	      return 0;
+	    }
+	}
+
+      err = xattr_entry_create ((struct ext2_xattr_header *) region.base,
+				last, last, name, value, len, rest);
+      if (err == ERANGE)
+	{
+	  dino_deref (ei);
+	  return 0;
+	}
+
+      *done = 1;
+      if (!err)
+	xattr_entry_hash ((struct ext2_xattr_header *) region.base, last);
+    }
+  else
+    {
+      dino_deref (ei);
+      return 0;
+    }
+
+  if (err)
+    dino_deref (ei);
+  else
+    record_global_poke (ei);
+
+  return err;
+}
+
+/*
+ * Set the value of an attribute giving the node, the attribute name,
+ * value, the value length and flags, as xattr_block_set does.  When
+ * the inode is large enough, new attributes are put in its body if
+ * they fit, and only go to the xattr block otherwise.
+ */
+error_t
+ext2_set_xattr (struct node *np, const char *name, const char *value,
+		size_t len, int flags)
+{
+
+  error_t err;
+  int done;
+
+  if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR))
+    {
+      ext2_warning ("Filesystem has no support for extended attributes.");
+      return EOPNOTSUPP;
+    }
+
+  if (!name)
+    return EINVAL;
+
+  if (strlen(name) > 255 || len > block_size)
+    return ERANGE;
+
+  ext2_xattr_cache_drop (np);
+
+  err = xattr_ibody_set (np, name, value, len, flags, &done);
+  if (done)
+    return err;
+
+  return xattr_block_set (np, name, value, len, flags);
+
+}
+
+/*
+ * Get the attribute NAME of node NP from the body of its inode, as
+ * ext2_get_xattr does, but reading the inode rather than NP's
+ * attribute cache.  ENODATA is returned if the attribute is not there.
+ */
+error_t
+ext2_get_ibody_xattr (struct node *np, const char *name, char *value,
+		      size_t *len)
+{
+  error_t err;
+  size_t rest;
+  struct ext2_inode *ei;
+  struct xattr_region region;
+  struct ext2_xattr_entry *found;
+  struct ext2_xattr_entry *last;
+
+  ei = dino_ref (np->cache_id);
+  if (! xattr_ibody_region (ei, 0, &region))
+    err = ENODATA;
+  else
+    {
+      err = xattr_region_scan (&region, name, &found, &last, &rest);
+      if (!err && !found)
+	err = ENODATA;
+      else if (!err)
+	err = xattr_entry_get (region.base, found, name, value, len, NULL);
+    }
+  dino_deref (ei);
+
+  return err;
+}
+
+/*
+ * Set the attribute NAME of node NP in the body of its inode, removing
+ * it if VALUE is NULL.  Unlike ext2_set_xattr, this never uses the
+ * xattr block: ENOSPC is returned if the value does not fit, and the
+ * attribute is then gone.  NP's attribute cache is left alone, since
+ * the pager calls this without NP locked; nothing looks NAME up there.
+ */
+error_t
+ext2_set_ibody_xattr (struct node *np, const char *name, const char *value,
+		      size_t len)
+{
+  error_t err;
+  int done;
+
+  if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_EXT_ATTR))
+    return EOPNOTSUPP;
+
+  /* Removing it first, so that a new value never has to move.  */
+  err = xattr_ibody_set (np, name, NULL, 0, 0, &done);
+  if (err)
+    return err;
+  if (!value)
+    return 0;
+
+  err = xattr_ibody_set (np, name, value, len, XATTR_CREATE, &done);
+  if (!done)
+    return ENOSPC;
+  return err;
+}
@@ -27,6 +27,10 @@
 /* Identifies whether a block is a proper xattr block. */
 #define EXT2_XATTR_BLOCK_MAGIC 0xEA020000
 
+/* Identifies the start of the xattr entries in the body of an inode;
+   see xattr.c.  */
+#define EXT2_XATTR_IBODY_MAGIC 0xEA020000
+
 /* xattr block header. */
 struct ext2_xattr_header
 {
@@ -63,6 +63,17 @@ pthread_spinlock_t allocate_free_cluster_lock = PTHREAD_SPINLOCK_INITIALIZER;
    FAT.  */
 cluster_t next_free_cluster = 2;
 
+/* One bit for each data cluster, set if the cluster is free, and the
+   number of bits set.  Built from the FAT at startup so that neither
+   allocating a cluster nor counting the free ones has to scan the FAT;
+   hold allocate_free_cluster_lock while using them.  */
+static unsigned long *free_map;
+static cluster_t free_map_count;
+
+#define MAP_BITS (sizeof (unsigned long) * CHAR_BIT)
+#define MAP_WORD(cluster) (((cluster) - 2) / MAP_BITS)
+#define MAP_BIT(cluster) (1UL << (((cluster) - 2) % MAP_BITS))
+
 
 /* Read the superblock.  */
 void
@@ -254,6 +265,22 @@ fat_write_next_cluster(cluster_t cluster, cluster_t next_cluster)
       write_dword (fat_image + fat_entry_offset, next_cluster & 0x0fffffff);
     }
 
+  if (free_map)
+    {
+      int is_free = next_cluster == FAT_FREE_CLUSTER;
+
+      pthread_spin_lock (&allocate_free_cluster_lock);
+      if (!(free_map[MAP_WORD (cluster)] & MAP_BIT (cluster)) != !is_free)
+	{
+	  free_map[MAP_WORD (cluster)] ^= MAP_BIT (cluster);
+	  if (is_free)
+	    free_map_count++;
+	  else
+	    free_map_count--;
+	}
+      pthread_spin_unlock (&allocate_free_cluster_lock);
+    }
+
   return 0;
 }
 
@@ -307,6 +334,42 @@ fat_get_next_cluster(cluster_t cluster, cluster_t *next_cluster)
   return 0;
 }
 
+/* Build the map of the free clusters from the FAT.  */
+void
+fat_init_free_map (void)
+{
+  size_t words = (nr_of_clusters + MAP_BITS - 1) / MAP_BITS;
+  unsigned long *map;
+  cluster_t count = 0;
+  cluster_t cluster;
+  error_t err;
+
+  map = calloc (words ?: 1, sizeof *map);
+  if (!map)
+    error (1, errno, "Could not allocate the map of free clusters");
+
+  err = diskfs_catch_exception ();
+  if (err)
+    error (1, err, "Could not read the FAT");
+  for (cluster = 2; cluster < nr_of_clusters + 2; cluster++)
+    {
+      cluster_t content;
+
+      fat_get_next_cluster (cluster, &content);
+      if (content == FAT_FREE_CLUSTER)
+	{
+	  map[MAP_WORD (cluster)] |= MAP_BIT (cluster);
+	  count++;
+	}
+    }
+  diskfs_end_catch_exception ();
+
+  pthread_spin_lock (&allocate_free_cluster_lock);
+  free_map = map;
+  free_map_count = count;
+  pthread_spin_unlock (&allocate_free_cluster_lock);
+}
+
 /* Allocate a new cluster, write CONTENT into the FAT at this new
    clusters position.  At success, 0 is returned and CLUSTER contains
    the cluster number allocated.  Otherwise, ENOSPC is returned if the
@@ -315,48 +378,106 @@ fat_get_next_cluster(cluster_t cluster, cluster_t *next_cluster)
 error_t
 fat_allocate_cluster (cluster_t content, cluster_t *cluster)
 {
-  error_t err = 0;
-  cluster_t old_next_free_cluster;
-  int wrapped = 0;
-  cluster_t found_cluster = FAT_FREE_CLUSTER;
+  size_t words = (nr_of_clusters + MAP_BITS - 1) / MAP_BITS;
+  size_t word, i;
+  unsigned long bits;
+  cluster_t found_cluster;
 
   assert_backtrace (content != FAT_FREE_CLUSTER);
+  assert_backtrace (free_map);
 
   pthread_spin_lock (&allocate_free_cluster_lock);
-  old_next_free_cluster = next_free_cluster;
 
-  /* Loop over all clusters, starting from next_free_cluster and
-     wrapping if reaching the end of the FAT, until we either find an
-     unallocated cluster, or we have to give up because all clusters
-     are allocated.  */
-  do
+  if (free_map_count == 0)
     {
-      cluster_t next_free_content;
+      pthread_spin_unlock (&allocate_free_cluster_lock);
+      return ENOSPC;
+    }
 
-      fat_get_next_cluster (next_free_cluster, &next_free_content);
+  /* Look for a free cluster from next_free_cluster on, a word of the
+     map at a time, wrapping at the end of the map.  The first word is
+     looked at twice, the second time for the clusters before
+     next_free_cluster.  */
+  word = MAP_WORD (next_free_cluster);
+  bits = free_map[word] & ~(MAP_BIT (next_free_cluster) - 1);
+  for (i = 0; !bits && i < words; i++)
+    {
+      if (++word == words)
+	word = 0;
+      bits = free_map[word];
+    }
+  assert_backtrace (bits);
 
-      if (next_free_content == FAT_FREE_CLUSTER)
-	found_cluster = next_free_cluster;
+  found_cluster = word * MAP_BITS + __builtin_ctzl (bits) + 2;
+  free_map[word] &= ~MAP_BIT (found_cluster);
+  free_map_count--;
+
+  next_free_cluster = found_cluster + 1;
+  if (next_free_cluster == nr_of_clusters + 2)
+    next_free_cluster = 2;
+
+  /* The map already has the cluster allocated, so this doesn't
+     account for it again.  */
+  pthread_spin_unlock (&allocate_free_cluster_lock);
+  fat_write_next_cluster (found_cluster, content);
 
-      if (++next_free_cluster == nr_of_clusters + 2)
+  *cluster = found_cluster;
+  return 0;
+}
+
+/* Add DISK_CLUSTER to the runs of DN as the cluster of the file
+   following the LENGTH_OF_CHAIN ones known.  Hold
+   DN->CHAIN_EXTENSION_LOCK.  */
+static error_t
+append_cluster (struct disknode *dn, cluster_t disk_cluster)
+{
+  struct cluster_run *run;
+
+  if (dn->nr_runs > 0)
+    {
+      run = &dn->runs[dn->nr_runs - 1];
+      if (run->disk + run->count == disk_cluster)
 	{
-	  next_free_cluster = 2;
-	  wrapped = 1;
+	  run->count++;
+	  return 0;
 	}
     }
-  while (found_cluster == FAT_FREE_CLUSTER
-	 && !(wrapped && next_free_cluster == old_next_free_cluster));
 
-  if (found_cluster != FAT_FREE_CLUSTER)
+  if (dn->nr_runs == dn->runs_alloced)
     {
-      *cluster = found_cluster;
-      fat_write_next_cluster(found_cluster, content);
+      size_t alloced = dn->runs_alloced ? 2 * dn->runs_alloced : 4;
+
+      run = realloc (dn->runs, alloced * sizeof *run);
+      if (!run)
+	return ENOMEM;
+      dn->runs = run;
+      dn->runs_alloced = alloced;
     }
-  else 
-    err = ENOSPC;
 
-  pthread_spin_unlock (&allocate_free_cluster_lock);
-  return err;
+  run = &dn->runs[dn->nr_runs++];
+  run->start = dn->length_of_chain;
+  run->disk = disk_cluster;
+  run->count = 1;
+  return 0;
+}
+
+/* Return the run of DN holding the cluster CLUSTER of the file, which
+   must be less than its LENGTH_OF_CHAIN.  */
+static struct cluster_run *
+find_run (struct disknode *dn, cluster_t cluster)
+{
+  size_t lo = 0, hi = dn->nr_runs;
+
+  assert_backtrace (cluster < dn->length_of_chain);
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (dn->runs[mid].start <= cluster)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return &dn->runs[lo];
 }
 
 /* Extend the cluster chain to maximum size or new_last_cluster,
@@ -369,26 +490,8 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 {
   error_t err = 0;
   struct disknode *dn = node->dn;
-  struct cluster_chain *table;
-  int offs;
   cluster_t left, prev_cluster, cluster;
 
-  error_t allocate_new_table(struct cluster_chain **table)
-    {
-      struct cluster_chain *t;
-
-      t = *table;
-      *table = malloc (sizeof (struct cluster_chain));
-      if (!*table)
-	return ENOMEM;
-      (*table)->next = 0;
-      if (t)
-	dn->last = t->next = *table;
-      else
-	dn->last = dn->first = *table;
-      return 0;
-    }
-  
   pthread_spin_lock (&dn->chain_extension_lock);
 
   /* If we already have what we need, or we have all clusters that are
@@ -402,17 +505,13 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 
   left = new_last_cluster + 1 - dn->length_of_chain;
 
-  table = dn->last;
-  if (table)
+  if (dn->nr_runs > 0)
     {
-      offs = (dn->length_of_chain - 1) & (CLUSTERS_PER_TABLE - 1);
-      prev_cluster = table->cluster[offs];
+      struct cluster_run *run = &dn->runs[dn->nr_runs - 1];
+      prev_cluster = run->disk + run->count - 1;
     }
   else
-    {
-      offs = CLUSTERS_PER_TABLE - 1;
-      prev_cluster = FAT_FREE_CLUSTER;
-    }
+    prev_cluster = FAT_FREE_CLUSTER;
 
    while (left)
      {
@@ -442,16 +541,10 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 		 break;
 	     }
 	 }
+       err = append_cluster (dn, cluster);
+       if (err)
+	 break;
        prev_cluster = cluster;
-       offs++;
-       if (offs == CLUSTERS_PER_TABLE)
-	 {
-	   offs = 0;
-	   err = allocate_new_table(&table);
-	   if (err)
-	     break;
-	 }
-       table->cluster[offs] = cluster;
        dn->length_of_chain++;
        left--;
      }
@@ -471,39 +564,35 @@ fat_getcluster (struct node *node, cluster_t cluster, int create,
 		cluster_t *disk_cluster)
 {
   error_t err = 0;
-  cluster_t chains_to_go = cluster >> LOG2_CLUSTERS_PER_TABLE;
-  cluster_t offs = cluster & (CLUSTERS_PER_TABLE - 1);
-  struct cluster_chain *chain;
+  struct disknode *dn = node->dn;
+  struct cluster_run *run;
 
-  if (cluster >= node->dn->length_of_chain)
+  if (cluster >= dn->length_of_chain)
     {
       err = fat_extend_chain (node, cluster, create);
       if (err)
 	return err;
-      if (cluster >= node->dn->length_of_chain)
+      if (cluster >= dn->length_of_chain)
 	{
 	  assert_backtrace (!create);
 	  return EINVAL;
 	}
     }
-  chain = node->dn->first;
-  while (chains_to_go--)
-    {
-      assert_backtrace (chain);
-      chain = chain->next;
-    }
-  assert_backtrace (chain);
-  *disk_cluster = chain->cluster[offs];
+
+  /* The runs may be moved by an extension of the chain by another
+     reader.  */
+  pthread_spin_lock (&dn->chain_extension_lock);
+  run = find_run (dn, cluster);
+  *disk_cluster = run->disk + (cluster - run->start);
+  pthread_spin_unlock (&dn->chain_extension_lock);
   return 0;
 }
 
 void
 fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 {
-  struct cluster_chain *next;
-  cluster_t count;
-  cluster_t offs;
-  cluster_t pos;
+  struct disknode *dn = node->dn;
+  size_t i = 0;
 
   /* The root dir of a FAT12/16 fs is of fixed size, while the root
      dir of a FAT32 fs must never decease to exist.  */
@@ -512,77 +601,62 @@ fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 
   /* Expand the cluster chain, because we have to know the complete tail.  */
   fat_extend_chain (node, FAT_EOC, 0);
-  if (clusters_to_keep == node->dn->length_of_chain)
+  if (clusters_to_keep == dn->length_of_chain)
     return;
-  assert_backtrace (clusters_to_keep < node->dn->length_of_chain);
+  assert_backtrace (clusters_to_keep < dn->length_of_chain);
 
   /* Truncation happens here.  */
-  next = node->dn->first;
   if (clusters_to_keep == 0)
-    {
-      /* Deallocate the complete file.  */
-      node->dn->start_cluster = 0;
-      pos = count = offs = 0;
-      node->dn->last = 0;
-    }
+    /* Deallocate the complete file.  */
+    dn->start_cluster = 0;
   else
     {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-
-	  /* This cluster is now the last cluster in the chain.  */
-	  if (count == 0)
-	    node->dn->last = next;
+      struct cluster_run *run = find_run (dn, clusters_to_keep - 1);
 
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      fat_write_next_cluster (next->cluster[offs++], FAT_EOC);
-      pos = clusters_to_keep;
+      /* This cluster is now the last cluster in the chain.  */
+      fat_write_next_cluster (run->disk + (clusters_to_keep - 1 - run->start),
+			      FAT_EOC);
+      i = run - dn->runs;
     }
 
   /* Purge dangling clusters. If we die here, scandisk will have to
      clean up the remains.  */
-  while (pos < node->dn->length_of_chain)
-    {
-      if (offs == CLUSTERS_PER_TABLE)
-	{
-	  offs = 0;
-	  next = next->next;
-	  assert_backtrace (next);
-	}
-      fat_write_next_cluster(next->cluster[offs++], 0);
-      pos++;
-    }
- 
-  /* Free now unused tables.  (Could be done in one run with the above.)  */
-  next = node->dn->first;
-  if (clusters_to_keep != 0)
+  for (; i < dn->nr_runs; i++)
     {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      next = next->next;
+      struct cluster_run *run = &dn->runs[i];
+      cluster_t offs;
+
+      offs = clusters_to_keep > run->start ? clusters_to_keep - run->start : 0;
+      for (; offs < run->count; offs++)
+	fat_write_next_cluster (run->disk + offs, 0);
     }
-  while (next)
+
+  /* Drop the runs of the purged clusters.  */
+  if (clusters_to_keep == 0)
+    dn->nr_runs = 0;
+  else
     {
-      struct cluster_chain *next_next = next->next;
-      free (next);
-      next = next_next;
+      struct cluster_run *run = find_run (dn, clusters_to_keep - 1);
+
+      run->count = clusters_to_keep - run->start;
+      dn->nr_runs = run - dn->runs + 1;
     }
 
-  if (clusters_to_keep == 0)
-    node->dn->first = 0;
-  
-  node->dn->length_of_chain = clusters_to_keep; 
+  dn->length_of_chain = clusters_to_keep; 
+}
+
+/* Forget what is known of the clusters of NODE.  */
+void
+fat_drop_chain (struct node *node)
+{
+  struct disknode *dn = node->dn;
+
+  free (dn->runs);
+  dn->runs = 0;
+  dn->nr_runs = 0;
+  dn->runs_alloced = 0;
+  dn->length_of_chain = 0;
+  dn->chain_complete = 0;
 }
 
 
@@ -590,24 +664,11 @@ fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 int
 fat_get_freespace (void)
 {
-  int free_clusters = 0;
-  cluster_t curr_cluster;
-  cluster_t next_cluster;
-  error_t err;
+  int free_clusters;
 
-  err = diskfs_catch_exception ();
-  if (!err)
-    {
-      /* First cluster is the 3rd entry in the FAT table.  */
-      for (curr_cluster = 2; curr_cluster < nr_of_clusters + 2;
-	   curr_cluster++)
-	{
-	  fat_get_next_cluster (curr_cluster, &next_cluster);
-	  if (next_cluster == FAT_FREE_CLUSTER)
-	    free_clusters++;
-	}
-      diskfs_end_catch_exception ();
-    }
+  pthread_spin_lock (&allocate_free_cluster_lock);
+  free_clusters = free_map_count;
+  pthread_spin_unlock (&allocate_free_cluster_lock);
 
   return free_clusters;
 }
@@ -307,13 +307,13 @@ extern size_t bytes_per_cluster;
 /* A cluster number.  */
 typedef unsigned long cluster_t;
 
-#define LOG2_CLUSTERS_PER_TABLE 10
-#define CLUSTERS_PER_TABLE (1 << LOG2_CLUSTERS_PER_TABLE)
-
-struct cluster_chain
+/* COUNT clusters of a file, starting with its cluster START, that are
+   contiguous on disk, starting with cluster DISK.  */
+struct cluster_run
 {
-  struct cluster_chain *next;
-  cluster_t cluster[CLUSTERS_PER_TABLE];
+  cluster_t start;
+  cluster_t disk;
+  cluster_t count;
 };
 
 /* Prototyping.  */
@@ -324,6 +324,8 @@ error_t fat_getcluster (struct node *, cluster_t, int, cluster_t *);
 void fat_truncate_node (struct node *, cluster_t);
 error_t fat_extend_chain (struct node *, cluster_t, int);
 int fat_get_freespace (void);
+void fat_init_free_map (void);
+void fat_drop_chain (struct node *);
 
 /* Unprocessed superblock.  */
 extern struct boot_sector *sblock;
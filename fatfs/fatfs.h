@@ -56,8 +56,13 @@ struct disknode
      Hold only if you hold readers alloc_lock, then you don't need to
      hold it if you hold writers alloc_lock already.  */
   pthread_spinlock_t chain_extension_lock;
-  struct cluster_chain *first;
-  struct cluster_chain *last;
+  /* The clusters of the file known so far, as runs of clusters
+     contiguous on disk, sorted by START.  Only change these, or read
+     them without holding the writers ALLOC_LOCK, while holding
+     CHAIN_EXTENSION_LOCK.  */
+  struct cluster_run *runs;
+  size_t nr_runs;
+  size_t runs_alloced;
   cluster_t length_of_chain;
   int chain_complete;
 
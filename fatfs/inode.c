@@ -54,8 +54,9 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   /* Format specific data for the new node.  */
   dn = np->dn;
   dn->pager = 0;
-  dn->first = 0;
-  dn->last = 0;
+  dn->runs = 0;
+  dn->nr_runs = 0;
+  dn->runs_alloced = 0;
   dn->length_of_chain = 0;
   dn->chain_complete = 0;
   dn->chain_extension_lock = PTHREAD_SPINLOCK_INITIALIZER;
@@ -83,14 +84,7 @@ diskfs_cached_lookup_in_dirbuf (int inum, struct node **npp, vm_address_t buf)
 void
 diskfs_node_norefs (struct node *np)
 {
-  struct cluster_chain *last = np->dn->first;
-
-  while (last)
-    {
-      struct cluster_chain *next = last->next;
-      free(last);
-      last = next;
-    }
+  fat_drop_chain (np);
 
   if (np->dn->translator)
     free (np->dn->translator);
@@ -382,6 +376,7 @@ write_node (struct node *np)
 		      (unsigned char *) &dr->write_time, &st->st_mtime);
 
       pthread_rwlock_unlock (&np->dn->dirent_lock);
+      diskfs_forget_stat_snapshot (np);
       np->dn_stat_dirty = 0;
 
       munmap ((caddr_t) buf, buflen);
@@ -394,14 +389,9 @@ write_node (struct node *np)
 error_t
 diskfs_node_reload (struct node *node)
 {
-  struct cluster_chain *last = node->dn->first;
   static struct lookup_context ctx = { buf: 0 };
-  while (last)
-    {
-      struct cluster_chain *next = last->next;
-      free(last);
-      last = next;
-    }
+
+  fat_drop_chain (node);
   flush_node_pager (node);
 
   return diskfs_user_read_node (node, &ctx);
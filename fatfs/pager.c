@@ -308,6 +308,110 @@ file_pager_read_huge_page (struct node *node, vm_offset_t page,
   return err;
 }
 
+/* Read LEN bytes from device block DEV_BLOCK into BUF.  */
+static error_t
+read_cluster_run (daddr_t dev_block, void *buf, size_t len)
+{
+  error_t err;
+  void *new_buf = buf;
+  size_t new_len = len;
+
+  STAT_INC (file_pagein_reads);
+
+  err = store_read (store, dev_block, len, &new_buf, &new_len);
+  if (err)
+    return err;
+  if (new_len != len)
+    err = EIO;
+  else if (new_buf != buf)
+    memcpy (buf, new_buf, len);
+
+  if (new_buf != buf)
+    munmap (new_buf, new_len);
+
+  return err;
+}
+
+/* Read the NPAGES pages for the pager backing NODE at OFFSET into a new
+   buffer BUF, issuing one device read for each physically contiguous run
+   of clusters.  If any part of the range lies beyond ALLOCSIZE, return
+   EOPNOTSUPP so that the pages are read one by one.  */
+static error_t
+file_pager_read_pages (struct node *node, vm_offset_t offset, int npages,
+		       void **buf, int *writelock)
+{
+  error_t err = 0;
+  pthread_rwlock_t *lock = NULL;
+  size_t length = npages * vm_page_size;
+  /* Each lookup maps a cluster or a page, whichever is smaller.  */
+  size_t step = bytes_per_cluster < vm_page_size
+		? bytes_per_cluster : vm_page_size;
+  size_t done, run_offs = 0, run_len = 0;
+  daddr_t run_block = 0;
+  void *data;
+
+  *writelock = 0;
+
+  pthread_rwlock_rdlock (&node->dn->alloc_lock);
+  if (offset + length > node->allocsize)
+    {
+      pthread_rwlock_unlock (&node->dn->alloc_lock);
+      return EOPNOTSUPP;
+    }
+  lock = &node->dn->alloc_lock;
+
+  data = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (data == MAP_FAILED)
+    {
+      pthread_rwlock_unlock (lock);
+      return EOPNOTSUPP;
+    }
+
+  STAT_INC (file_pageins);
+
+  for (done = 0; done < length; done += step)
+    {
+      cluster_t cluster;
+      daddr_t dev_block;
+
+      err = find_cluster (node, offset + done, &cluster, &lock);
+      if (err)
+	break;
+
+      dev_block = FAT_FIRST_CLUSTER_BLOCK (cluster)
+		  + (((offset + done) % bytes_per_cluster)
+		     >> store->log2_block_size);
+
+      if (run_len > 0
+	  && dev_block != run_block + (run_len >> store->log2_block_size))
+	{
+	  err = read_cluster_run (run_block, data + run_offs, run_len);
+	  if (err)
+	    break;
+	  run_len = 0;
+	}
+
+      if (run_len == 0)
+	{
+	  run_block = dev_block;
+	  run_offs = done;
+	}
+      run_len += step;
+    }
+
+  if (!err && run_len > 0)
+    err = read_cluster_run (run_block, data + run_offs, run_len);
+
+  pthread_rwlock_unlock (lock);
+
+  if (err)
+    munmap (data, length);
+  else
+    *buf = data;
+
+  return err;
+}
+
 struct pending_clusters
   {
     /* The cluster number of the first of the clusters.  */
@@ -569,6 +673,22 @@ pager_read_page (struct user_pager_info *pager, vm_offset_t page,
     }
 }
 
+/* Satisfy a pager read request for NPAGES pages at OFFSET.  Only file
+   data in the cluster area is read as a range; the FAT and a FAT12/16
+   root directory fall back to per-page reads.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t offset,
+		  int npages, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == FAT
+      || (pager->node == diskfs_root_node
+	  && (fat_type == FAT12 || fat_type == FAT16)))
+    return EOPNOTSUPP;
+
+  return file_pager_read_pages (pager->node, offset, npages,
+				(void **)buf, writelock);
+}
+
 /* Satisfy a pager write request for either the disk pager or file pager
    PAGER, from the page at offset PAGE from BUF.  */
 error_t
@@ -18,231 +18,346 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
+/* The image of a file is fetched and kept in chunks of CHUNK_SIZE bytes,
+   each of which is missing, being fetched, or present.  A read fetches
+   the chunks it lacks: over the data connection left open by the last
+   fetch if it ends where they start, so that sequential reads stream the
+   file; otherwise over a new one started there with REST, so that a read
+   in the middle of a file does not download what comes before.  When a
+   read lacks many chunks, they are fetched by several connections at
+   once.  */
+
 #include <unistd.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 
 #include <hurd/netfs.h>
 
 #include "ccache.h"
 
 #define READ_CHUNK_SIZE   (8*1024)
-#define ALLOC_CHUNK_SIZE  (64*1024)
-
-/* Read LEN bytes at OFFS in the file referred to by CC into DATA, or return
-   an error.  */
-error_t
-ccache_read (struct ccache *cc, off_t offs, size_t len, void *data)
+#define CHUNK_SIZE        (64*1024)
+
+/* A read lacking at least this many chunks has them fetched by up to
+   MAX_PARALLEL_FETCHES connections at once.  */
+#define PARALLEL_MIN_CHUNKS  16
+#define MAX_PARALLEL_FETCHES 4
+
+enum { CHUNK_MISSING, CHUNK_FETCHING, CHUNK_PRESENT };
+
+/* Close the data connection DATA of the transfer on CONN, and give CONN
+   back to the pool of FS.  */
+static void
+end_transfer (struct ftpfs *fs, struct ftp_conn *conn, int data)
+{
+  close (data);
+  ftp_conn_finish_transfer (conn);
+  ftpfs_release_ftp_conn (fs, conn);
+}
+
+/* Mark the chunks from FIRST to END (exclusive) as STATE, and wake up
+   whoever waits for them.  CC must be locked.  */
+static void
+mark_chunks (struct ccache *cc, size_t first, size_t end, int state)
+{
+  memset (cc->chunks + first, state, end - first);
+  pthread_cond_broadcast (&cc->wakeup);
+}
+
+/* Fetch the chunks from FIRST to END (exclusive) into the image of CC;
+   the caller has marked them as being fetched.  Each chunk is marked
+   present as soon as it is complete; those left at an error are marked
+   missing again.  */
+static error_t
+fetch_chunks (struct ccache *cc, size_t first, size_t end)
 {
+  struct netnode *nn = cc->node->nn;
+  off_t start = (off_t) first * CHUNK_SIZE;
+  off_t stop = (off_t) end * CHUNK_SIZE;
+  size_t done = first;		/* First chunk not marked present.  */
+  struct ftp_conn *conn = 0;
+  int data = -1, reused = 0;
+  off_t pos = 0;
   error_t err = 0;
-  size_t max = offs + len;
 
-  pthread_mutex_lock (&cc->lock);
+  if (stop > cc->size)
+    stop = cc->size;
 
-  if (max > cc->size)
-    max = cc->size;
+  pthread_mutex_lock (&cc->lock);
+  if (cc->conn && cc->data_conn_pos == start)
+    /* Go on with the transfer the last fetch stopped.  */
+    {
+      conn = cc->conn;
+      data = cc->data_conn;
+      pos = start;
+      cc->conn = 0;
+      cc->data_conn = -1;
+      reused = 1;
+    }
+  pthread_mutex_unlock (&cc->lock);
 
-  while (cc->max < max && !err)
+  while (pos < stop && !err)
     {
-      if (cc->fetching_active)
-	/* Some thread is fetching data, so just let it do its thing, but get
-	   a wakeup call when it's done.  */
+      ssize_t rd;
+
+      if (! conn)
 	{
-	  if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
-	    err = EINTR;
+	  err = ftpfs_get_ftp_conn (nn->fs, &conn);
+	  if (err)
+	    break;
+
+	  pos = cc->no_restart ? 0 : start;
+	  err = ftp_conn_start_retrieve_at (conn, nn->rmt_path, pos, &data);
+	  if (err == EOPNOTSUPP && pos > 0)
+	    /* The server cannot restart transfers; read from the start.  */
+	    {
+	      cc->no_restart = 1;
+	      pos = 0;
+	      err = ftp_conn_start_retrieve (conn, nn->rmt_path, &data);
+	    }
+	  if (err == ENOENT)
+	    err = ESTALE;
+	  if (err)
+	    {
+	      ftpfs_release_ftp_conn (nn->fs, conn);
+	      conn = 0;
+	      break;
+	    }
+	}
+
+      if (pos < start)
+	/* Skip what comes before START.  */
+	{
+	  char buf[READ_CHUNK_SIZE];
+	  rd = read (data, buf, MIN (sizeof buf, start - pos));
 	}
       else
+	rd = read (data, cc->image + pos, MIN (READ_CHUNK_SIZE, stop - pos));
+
+      if (rd < 0)
+	err = errno;
+      else if (rd == 0)
+	/* EOF.  Either the file changed size, or the data connection we
+	   kept got closed; try a new connection once, and then assume the
+	   former.  */
 	{
-	  int re_connected = 0;
-	  struct netnode *nn = cc->node->nn;
-
-	  cc->fetching_active = 1;
+	  end_transfer (nn->fs, conn, data);
+	  conn = 0;
+	  data = -1;
+	  if (reused)
+	    reused = 0;
+	  else
+	    err = EIO;
+	}
+      else
+	{
+	  size_t complete;
 
-	  while (cc->max < max && !err)
+	  pos += rd;
+	  complete = pos == stop ? end : pos / CHUNK_SIZE;
+	  if (pos >= start && complete > done)
+	    /* Some chunks are complete; let their readers have them.  */
 	    {
+	      pthread_mutex_lock (&cc->lock);
+	      mark_chunks (cc, done, complete, CHUNK_PRESENT);
 	      pthread_mutex_unlock (&cc->lock);
+	      done = complete;
+	    }
+	}
 
-	      if (! cc->conn)
-		/* We need to setup a connection to fetch data over.  */
-		{
-		  err = ftpfs_get_ftp_conn (nn->fs, &cc->conn);
-		  if (! err)
-		    {
-		      err = ftp_conn_start_retrieve (cc->conn, nn->rmt_path,
-						     &cc->data_conn);
-		      if (err == ENOENT)
-			err = ESTALE;
-		      if (err)
-			{
-			  ftpfs_release_ftp_conn (nn->fs, cc->conn);
-			  cc->conn = 0;
-			}
-		      else
-			cc->data_conn_pos = 0;
-		    }
-		  re_connected = 1;
-		}
-
-	      if (! err)
-		/* Try and read some data over the connection.  */
-		{
-		  size_t new_end = cc->max + READ_CHUNK_SIZE;
-
-		  if (new_end > cc->size)
-		    new_end = cc->size;
-
-		  if (new_end > cc->alloced)
-		    /* Make some room in memory for the new part of the
-		       image.  */
-		    {
-		      size_t alloc_end = cc->alloced + ALLOC_CHUNK_SIZE;
-
-		      if (alloc_end < new_end)
-			alloc_end = new_end;
-		      else if (alloc_end > cc->size)
-			alloc_end = cc->size;
-
-		      if (cc->alloced == 0)
-			{
-			  vm_address_t addr = 0;
-			  addr = (vm_address_t) mmap (0, alloc_end, 
-						      PROT_READ|PROT_WRITE,
-						      MAP_ANON, 0, 0);
-			  err = (addr == -1) ? errno : 0;
-			  if (! err)
-			    cc->image = (char *)addr;
-			}
-		      else
-			{
-			  vm_address_t addr =
-			    (vm_address_t)cc->image + cc->alloced;
-			  /* XXX.  This can't be replaced with mmap until we
-			     have MAP_EXCL.  -tb  */
-			  err = vm_allocate (mach_task_self (),
-					     &addr, alloc_end - cc->alloced,
-					     0);
-			  if (err == EKERN_NO_SPACE)
-			    /* Gack.  We've goota move the whole splooge.  */
-			    {
-			      addr = 0;
-			      addr = (vm_address_t) mmap (0, alloc_end, 
-							  PROT_READ|PROT_WRITE,
-							  MAP_ANON, 0, 0);
-			      err = (addr == -1) ? errno : 0;
-			      if (! err)
-				/* That worked; copy what's already-fetched. */
-				{
-				  bcopy (cc->image, (void *)addr, cc->max);
-				  munmap (cc->image, cc->alloced);
-				  cc->image = (char *)addr;
-				}
-			    }
-			}
-		      if (! err)
-			cc->alloced = alloc_end;
-		    }
-
-		  if (! err)
-		    {
-		      ssize_t rd =
-			read (cc->data_conn,
-			      cc->image + cc->data_conn_pos,
-			      new_end - cc->data_conn_pos);
-		      if (rd < 0)
-			err = errno;
-		      else if (rd == 0)
-			/* EOF.  This either means the file changed size, or
-			   our data-connection got closed; we just try to
-			   open the connection a second time, and then if
-			   that fails, assume the size changed.  */
-			{
-			  if (re_connected)
-			    err = EIO; /* Something's fucked */
-			  else
-			    /* Try opening the connection again.  */
-			    {
-			      close (cc->data_conn);
-			      ftp_conn_finish_transfer (cc->conn);
-			      ftpfs_release_ftp_conn (nn->fs, cc->conn);
-			      cc->conn = 0;
-			    }
-			}
-		      else
-			{
-			  cc->data_conn_pos += rd;
-			  if (cc->data_conn_pos > cc->max)
-			    cc->max = cc->data_conn_pos;
-			}
-		    }
-
-		  if (!err && ports_self_interrupted ())
-		    err = EINTR;
-		}
+      if (!err && ports_self_interrupted ())
+	err = EINTR;
+    }
 
-	      pthread_mutex_lock (&cc->lock);
+  pthread_mutex_lock (&cc->lock);
+  if (done < end)
+    mark_chunks (cc, done, end, CHUNK_MISSING);
+  if (conn && !err && pos < cc->size && !cc->conn)
+    /* Keep the transfer for a read of what follows.  */
+    {
+      cc->conn = conn;
+      cc->data_conn = data;
+      cc->data_conn_pos = pos;
+      conn = 0;
+    }
+  pthread_mutex_unlock (&cc->lock);
 
-	      if (cc->max < max && !err)
-		/* If anyone's waiting for data, let them look (if we're done
-		   fetching, this gets delayed until below).  */
-		pthread_cond_broadcast (&cc->wakeup);
-	    }
+  if (conn)
+    end_transfer (nn->fs, conn, data);
+
+  return err;
+}
+
+struct fetch_job
+{
+  struct ccache *cc;
+  size_t first, end;
+  error_t err;
+};
 
-	  if (!err && cc->conn && cc->max == cc->size)
-	    /* We're finished reading all data, close the data connection.  */
+static void *
+fetch_thread (void *arg)
+{
+  struct fetch_job *job = arg;
+  job->err = fetch_chunks (job->cc, job->first, job->end);
+  return NULL;
+}
+
+/* Fetch the chunks from FIRST to END (exclusive) as fetch_chunks does,
+   over several connections at once if there are many.  */
+static error_t
+fetch_run (struct ccache *cc, size_t first, size_t end)
+{
+  struct fetch_job jobs[MAX_PARALLEL_FETCHES];
+  pthread_t threads[MAX_PARALLEL_FETCHES];
+  size_t n = end - first, per_job;
+  int num_jobs, started, i;
+  error_t err;
+
+  if (n < PARALLEL_MIN_CHUNKS || cc->no_restart)
+    return fetch_chunks (cc, first, end);
+
+  num_jobs = MIN (MAX_PARALLEL_FETCHES, n / (PARALLEL_MIN_CHUNKS / 2));
+  per_job = (n + num_jobs - 1) / num_jobs;
+  for (i = 0; i < num_jobs; i++)
+    {
+      jobs[i].cc = cc;
+      jobs[i].first = first + i * per_job;
+      jobs[i].end = MIN (end, jobs[i].first + per_job);
+      jobs[i].err = 0;
+    }
+
+  for (started = 1; started < num_jobs; started++)
+    if (pthread_create (&threads[started], NULL, fetch_thread, &jobs[started]))
+      break;
+
+  /* This thread fetches the first part, which the reader waits for, and
+     those that could not get a thread of their own.  */
+  err = fetch_chunks (cc, jobs[0].first, jobs[0].end);
+  for (i = started; i < num_jobs; i++)
+    {
+      error_t job_err = fetch_chunks (cc, jobs[i].first, jobs[i].end);
+      if (! err)
+	err = job_err;
+    }
+
+  for (i = 1; i < started; i++)
+    {
+      pthread_join (threads[i], NULL);
+      if (! err)
+	err = jobs[i].err;
+    }
+  return err;
+}
+
+/* Read LEN bytes at OFFS in the file referred to by CC into DATA, or return
+   an error.  */
+error_t
+ccache_read (struct ccache *cc, off_t offs, size_t len, void *data)
+{
+  error_t err = 0;
+  off_t max = offs + len;
+  size_t chunk, last;
+
+  pthread_mutex_lock (&cc->lock);
+
+  if (max > cc->size)
+    max = cc->size;
+  if (offs >= max)
+    {
+      pthread_mutex_unlock (&cc->lock);
+      return 0;
+    }
+
+  if (! cc->image)
+    {
+      size_t num_chunks = (cc->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+      void *image = mmap (0, cc->size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+
+      if (image == MAP_FAILED)
+	err = errno;
+      else
+	{
+	  cc->chunks = calloc (num_chunks, 1);
+	  if (cc->chunks)
+	    cc->image = image;
+	  else
 	    {
-	      close (cc->data_conn);
-	      ftp_conn_finish_transfer (cc->conn);
-	      ftpfs_release_ftp_conn (nn->fs, cc->conn);
-	      cc->conn = 0;
+	      munmap (image, cc->size);
+	      err = ENOMEM;
 	    }
+	}
+    }
 
-	  /* We're done, error or no.  */
-	  cc->fetching_active = 0;
+  chunk = offs / CHUNK_SIZE;
+  last = (max - 1) / CHUNK_SIZE;
+  while (!err)
+    {
+      size_t end;
+
+      while (chunk <= last && cc->chunks[chunk] == CHUNK_PRESENT)
+	chunk++;
+      if (chunk > last)
+	break;
 
-	  /* Let others know something's going on.  */
-	  pthread_cond_broadcast (&cc->wakeup);
+      if (cc->chunks[chunk] == CHUNK_FETCHING)
+	/* Some thread is fetching it, so just let it do its thing, but get
+	   a wakeup call when it's done.  */
+	{
+	  if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
+	    err = EINTR;
+	  continue;
 	}
+
+      for (end = chunk; end <= last && cc->chunks[end] == CHUNK_MISSING; end++)
+	cc->chunks[end] = CHUNK_FETCHING;
+
+      pthread_mutex_unlock (&cc->lock);
+      err = fetch_run (cc, chunk, end);
+      pthread_mutex_lock (&cc->lock);
     }
 
   if (! err)
-    bcopy (cc->image + offs, data, max - offs);
+    memcpy (data, cc->image + offs, max - offs);
 
   pthread_mutex_unlock (&cc->lock);
 
   return err;
 }
-
+
 /* Discard any cached contents in CC.  */
 error_t
 ccache_invalidate (struct ccache *cc)
 {
   error_t err = 0;
+  size_t num_chunks = (cc->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
 
   pthread_mutex_lock (&cc->lock);
 
-  while  (cc->fetching_active && !err)
-    /* Some thread is fetching data, so just let it do its thing, but get
-       a wakeup call when it's done.  */
-    {
-      if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
-	err = EINTR;
-    }
+  if (cc->image)
+    while (!err && memchr (cc->chunks, CHUNK_FETCHING, num_chunks))
+      /* Some thread is fetching data, so just let it do its thing, but get
+	 a wakeup call when it's done.  */
+      {
+	if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
+	  err = EINTR;
+      }
 
   if (! err)
     {
-      if (cc->alloced > 0)
+      if (cc->image)
 	{
-	  munmap (cc->image, cc->alloced);
+	  munmap (cc->image, cc->size);
 	  cc->image = 0;
-	  cc->alloced = 0;
-	  cc->max = 0;
+	  free (cc->chunks);
+	  cc->chunks = 0;
 	}
       if (cc->conn)
 	{
-	  close (cc->data_conn);
-	  ftp_conn_finish_transfer (cc->conn);
-	  ftpfs_release_ftp_conn (cc->node->nn->fs, cc->conn);
+	  end_transfer (cc->node->nn->fs, cc->conn, cc->data_conn);
 	  cc->conn = 0;
+	  cc->data_conn = -1;
 	}
     }
 
@@ -250,7 +365,7 @@ ccache_invalidate (struct ccache *cc)
 
   return err;
 }
-
+
 /* Return a ccache object for NODE in CC.  */
 error_t
 ccache_create (struct node *node, struct ccache **cc)
@@ -263,13 +378,12 @@ ccache_create (struct node *node, struct ccache **cc)
   new->node = node;
   new->image = 0;
   new->size = node->nn_stat.st_size;
-  new->max = 0;
-  new->alloced = 0;
+  new->chunks = 0;
   pthread_mutex_init (&new->lock, NULL);
   pthread_cond_init (&new->wakeup, NULL);
-  new->fetching_active = 0;
   new->conn = 0;
   new->data_conn = -1;
+  new->no_restart = 0;
 
   *cc = new;
 
@@ -280,14 +394,12 @@ ccache_create (struct node *node, struct ccache **cc)
 void
 ccache_free (struct ccache *cc)
 {
-  if (cc->alloced > 0)
-    munmap (cc->image, cc->alloced);
-  if (cc->data_conn >= 0)
-    close (cc->data_conn);
-  if (cc->conn)
+  if (cc->image)
     {
-      ftp_conn_finish_transfer (cc->conn);
-      ftpfs_release_ftp_conn (cc->node->nn->fs, cc->conn);
+      munmap (cc->image, cc->size);
+      free (cc->chunks);
     }
+  if (cc->conn)
+    end_transfer (cc->node->nn->fs, cc->conn, cc->data_conn);
   free (cc);
 }
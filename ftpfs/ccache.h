@@ -28,33 +28,32 @@ struct ccache
   /* The filesystem node this is a cache of.  */
   struct node *node;
 
-  /* In memory file image, alloced using vm_allocate.  */
+  /* In memory file image, mmap'd for SIZE bytes once first read.  */
   char *image;
 
   /* Size of data.  */
   off_t size;
 
-  /* Upper bounds of fetched image.  */
-  off_t max;
-
-  /* Amount of IMAGE that has been allocated.  */
-  size_t alloced;
+  /* The state of each CHUNK_SIZE piece of IMAGE: missing, being fetched
+     by some thread, or present.  Only the thread fetching a chunk writes
+     to it in IMAGE.  */
+  unsigned char *chunks;
 
   pthread_mutex_t lock;
 
   /* People can wait for a reading thread on this condition.  */
   pthread_cond_t wakeup;
 
-  /* True if some thread is now fetching data.  Only that thread should
-     modify the DATA_CONN, DATA_CONN_POS, and MAX fields.  */
-  int fetching_active;
-
-  /* Ftp connection over which data is being fetched, or 0.  */
+  /* Ftp connection left in the middle of a transfer by the last fetch, or
+     0; whoever goes on with it clears this.  */
   struct ftp_conn *conn;
-  /* File descriptor over which data is being fetched.  */
+  /* File descriptor over which data was being fetched.  */
   int data_conn;
   /* Where DATA_CONN points in the file.  */
   off_t data_conn_pos;
+
+  /* True if the server can't restart a transfer in the middle.  */
+  int no_restart;
 };
 
 /* Read LEN bytes at OFFS in the file referred to by CC into DATA, or return
@@ -70,7 +70,8 @@ struct hostmux
 struct hostmux_name
 {
   const char *name;		/* Looked up name (may be a number).  */
-  const char *canon;		/* The canonical (fq) host name.  */
+  const char *canon;		/* The canonical (fq) host name, or 0 if
+				   there is no such host.  */
 
   /* A filesystem node associated with NAME.  If canonicalize is 0 or
      NAME = CANON, then this will refer to a node with a translator for that
@@ -78,6 +79,11 @@ struct hostmux_name
      */
   struct node *node;
 
+  /* Until when NAME is remembered once NODE has gone away; looking it up
+     again before then needs no resolver.  Protected by NAMES_LOCK, like
+     NODE.  */
+  time_t expires;
+
   ino_t fileno;			/* The inode number for this entry.  */
 
   struct hostmux_name *next;
@@ -213,6 +213,20 @@ netfs_get_dirents (struct iouser *cred, struct node *dir,
 
 /* Host lookup.  */
 
+/* How many seconds a host name is remembered once its node has gone
+   away, so that looking it up again does not ask the resolver.  */
+#define NAME_CACHE_TIME		300
+/* The same for a name that was found not to be that of any host.  */
+#define NEGATIVE_CACHE_TIME	30
+
+static time_t
+now (void)
+{
+  struct timeval tv;
+  maptime_read (hostmux_maptime, &tv);
+  return tv.tv_sec;
+}
+
 /* Free storage allocated consumed by the host mux name NM, but not the node
    it points to.  */
 static void
@@ -226,10 +240,10 @@ free_name (struct hostmux_name *nm)
 
 /* See if there's an existing entry for the name HOST, and if so, return its
    node in NODE with an additional references.  True is returned iff the
-   lookup succeeds.  If PURGE is true, then any nodes with a null node are
-   removed.  */
+   lookup succeeds.  If PURGE is true, then any names with a null node that
+   have expired at time T, or that are for HOST, are removed.  */
 static int
-lookup_cached (struct hostmux *mux, const char *host, int purge,
+lookup_cached (struct hostmux *mux, const char *host, int purge, time_t t,
 	       struct node **node)
 {
   struct hostmux_name *nm = mux->names, **prevl = &mux->names;
@@ -237,20 +251,16 @@ lookup_cached (struct hostmux *mux, const char *host, int purge,
   while (nm)
     {
       struct hostmux_name *next = nm->next;
+      int match = strcasecmp (host, nm->name) == 0;
 
-      if (strcasecmp (host, nm->name) == 0)
+      if (match && nm->node)
 	{
-          if (nm->node)
-            netfs_nref (nm->node);
-
-	  if (nm->node)
-	    {
-	      *node = nm->node;
-	      return 1;
-	    }
+	  netfs_nref (nm->node);
+	  *node = nm->node;
+	  return 1;
 	}
 
-      if (purge && !nm->node)
+      if (purge && !nm->node && (match || t >= nm->expires))
 	{
 	  *prevl = nm->next;
 	  free_name (nm);
@@ -263,7 +273,76 @@ lookup_cached (struct hostmux *mux, const char *host, int purge,
 
   return 0;
 }
-
+
+/* See if HOST was looked up in MUX less than a while before time T, and
+   if so, return what that found: a new node for it like the one it had
+   then, with a single reference, in NODE, or ENOENT if there is no such
+   host.  Return EAGAIN if HOST must be looked up anew.  NAMES_LOCK must be
+   held for writing.  */
+static error_t
+lookup_remembered (struct hostmux *mux, const char *host, time_t t,
+		   struct node **node)
+{
+  struct hostmux_name *nm;
+
+  for (nm = mux->names; nm; nm = nm->next)
+    if (strcasecmp (host, nm->name) == 0 && (nm->node || t < nm->expires))
+      {
+	if (nm->node)
+	  /* Made again since we last looked.  */
+	  {
+	    netfs_nref (nm->node);
+	    *node = nm->node;
+	    return 0;
+	  }
+	else if (! nm->canon)
+	  return ENOENT;
+	else
+	  {
+	    nm->expires = t + NAME_CACHE_TIME;
+	    return create_host_node (mux, nm, node);
+	  }
+      }
+
+  return EAGAIN;
+}
+
+/* Remember at time T that there is no host called HOST in MUX.  */
+static void
+remember_missing (struct hostmux *mux, const char *host, time_t t)
+{
+  struct node *node;
+  struct hostmux_name *nm = malloc (sizeof (struct hostmux_name));
+
+  if (! nm)
+    return;
+  nm->name = strdup (host);
+  if (! nm->name)
+    {
+      free (nm);
+      return;
+    }
+  nm->canon = 0;
+  nm->node = 0;
+  nm->expires = t + NEGATIVE_CACHE_TIME;
+
+  pthread_rwlock_wrlock (&mux->names_lock);
+  if (lookup_cached (mux, host, 1, t, &node))
+    /* Someone found HOST meanwhile after all.  */
+    {
+      pthread_rwlock_unlock (&mux->names_lock);
+      netfs_nrele (node);
+      free_name (nm);
+    }
+  else
+    {
+      nm->fileno = 0;
+      nm->next = mux->names;
+      mux->names = nm;
+      pthread_rwlock_unlock (&mux->names_lock);
+    }
+}
+
 /* See if there's an existing entry for the name HOST, and if so, return its
    node in NODE, with an additional reference, otherwise, create a new node
    for the host HE as referred to by HOST, and return that instead, with a
@@ -272,7 +351,7 @@ lookup_cached (struct hostmux *mux, const char *host, int purge,
    official name, if it doesn't.  */
 static error_t
 lookup_addrinfo (struct hostmux *mux, const char *host, struct addrinfo *he,
-		 struct node **node)
+		 time_t t, struct node **node)
 {
   error_t err;
   struct hostmux_name *nm = malloc (sizeof (struct hostmux_name));
@@ -285,6 +364,7 @@ lookup_addrinfo (struct hostmux *mux, const char *host, struct addrinfo *he,
     nm->canon = nm->name;
   else
     nm->canon = strdup (he->ai_canonname);
+  nm->expires = t + NAME_CACHE_TIME;
 
   err = create_host_node (mux, nm, node);
   if (err)
@@ -294,7 +374,7 @@ lookup_addrinfo (struct hostmux *mux, const char *host, struct addrinfo *he,
     }
 
   pthread_rwlock_wrlock (&mux->names_lock);
-  if (lookup_cached (mux, host, 1, node))
+  if (lookup_cached (mux, host, 1, t, node))
     /* An entry for HOST has already been created between the time we last
        looked and now (which is possible because we didn't lock MUX).
        Just throw away our version and return the one already in the cache.  */
@@ -308,6 +388,7 @@ lookup_addrinfo (struct hostmux *mux, const char *host, struct addrinfo *he,
     /* Enter NM into MUX's list of names, and return the new node.  */
     {
       nm->fileno = mux->next_fileno++; /* Now that we hold the lock...  */
+      (*node)->nn_stat.st_ino = nm->fileno;
       nm->next = mux->names;
       mux->names = nm;
       pthread_rwlock_unlock (&mux->names_lock);
@@ -323,6 +404,8 @@ lookup_host (struct hostmux *mux, const char *host, struct node **node)
 {
   int was_cached;
   int h_err;
+  error_t err;
+  time_t t;
   struct addrinfo *ai;
   struct addrinfo hints;
 
@@ -332,27 +415,51 @@ lookup_host (struct hostmux *mux, const char *host, struct node **node)
   hints.ai_protocol  = IPPROTO_IP;
 
   pthread_rwlock_rdlock (&mux->names_lock);
-  was_cached = lookup_cached (mux, host, 0, node);
+  was_cached = lookup_cached (mux, host, 0, 0, node);
   pthread_rwlock_unlock (&mux->names_lock);
 
   if (was_cached)
     return 0;
 
-  if (mux->canonicalize)
+  /* HOST may still be known from a node since gone.  */
+  t = now ();
+  pthread_rwlock_wrlock (&mux->names_lock);
+  err = lookup_remembered (mux, host, t, node);
+  pthread_rwlock_unlock (&mux->names_lock);
+
+  if (err != EAGAIN)
+    return err;
+
+  if (! mux->canonicalize)
+    return lookup_addrinfo (mux, host, NULL, t, node);
+
+  h_err = getaddrinfo (host, NULL, &hints, &ai);
+  switch (h_err)
     {
-      h_err = getaddrinfo (host, NULL, &hints, &ai);
-      if (! h_err)
-	{
-	  h_err = lookup_addrinfo (mux, host, ai, node);
-	  freeaddrinfo (ai);
-	}
-    }
-  else
-    h_err = lookup_addrinfo (mux, host, NULL, node);
+    case 0:
+      err = lookup_addrinfo (mux, host, ai, t, node);
+      freeaddrinfo (ai);
+      return err;
 
-  return h_err;
+    case EAI_NONAME:
+#ifdef EAI_NODATA
+    case EAI_NODATA:
+#endif
+      remember_missing (mux, host, t);
+      return ENOENT;
+
+    case EAI_AGAIN:
+      /* Not remembered: it may well work the next time.  */
+      return EAGAIN;
+    case EAI_MEMORY:
+      return ENOMEM;
+    case EAI_SYSTEM:
+      return errno;
+    default:
+      return EIO;
+    }
 }
-
+
 /* This should sync the entire remote filesystem.  If WAIT is set, return
    only after sync is completely finished.  */
 error_t
@@ -107,6 +107,9 @@ typedef struct timespec timespec_t;
 #define FS_TRANS_SET	   0x00000004 /* Set or clear translator */
 #define FS_TRANS_ORPHAN    0x00000008 /* Orphan the active translator.  */
 
+/* Bits for flags in fs.defs:file_allocate call: */
+#define FS_ALLOC_KEEP_SIZE 0x00000001 /* Don't extend the file's size.  */
+
 /* Values for retry field in fs.defs:dir_lookup call: */
 enum retry_type
 {
@@ -316,6 +319,15 @@ struct procinfo
 typedef int *procinfo_t;
 typedef const int *const_procinfo_t;
 
+/* The header of each process in the reply of proc_getprocinfo_bulk.  */
+struct procinfo_bulk
+{
+  pid_t pid;
+  int err;			/* error fetching it, or zero */
+  int flags;			/* PI_FETCH_ flags fetched */
+  int size;			/* bytes of struct procinfo that follow */
+};
+
 /* Bits in struct procinfo  state: */
 #define PI_STOPPED 0x00000001	/* Proc server thinks is stopped.  */
 #define PI_EXECED  0x00000002	/* Has called proc_exec.  */
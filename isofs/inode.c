@@ -59,6 +59,8 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   /* Format specific data for the new node.  */
   dn = diskfs_node_disknode (np);
   dn->fileinfo = 0;
+  dn->index = 0;
+  dn->zf = 0;
   dn->dr = ctx->dr;
   err = calculate_file_start (ctx->dr, &dn->file_start, &ctx->rr);
   if (err)
@@ -271,6 +273,17 @@ diskfs_user_read_node (struct node *np, struct lookup_context *ctx)
   st->st_blksize = logical_block_size;
   st->st_blocks = (st->st_size - 1) / 512 + 1;
 
+  /* The blocks are those on the medium, the size is uncompressed.  */
+  if ((rl->valid & VALID_ZF) && S_ISREG (st->st_mode) && !np->dn->zf)
+    {
+      err = zisofs_init_node (np, rl);
+      if (err)
+	{
+	  diskfs_end_catch_exception ();
+	  return err;
+	}
+    }
+
   if (rl->valid & VALID_FL)
     st->st_flags = rl->flags;
   else
@@ -327,6 +340,8 @@ diskfs_node_norefs (struct node *np)
 {
   if (np->dn->translator)
     free (np->dn->translator);
+  free_dir_index (np->dn->index);
+  zisofs_drop_node (np);
 
   assert_backtrace (!np->dn->fileinfo);
   free (np);
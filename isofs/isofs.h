@@ -43,6 +43,12 @@ struct disknode
 
   size_t translen;
   char *translator;
+
+  /* For a directory, the index of its entries once read.  */
+  struct dirindex *index;
+
+  /* For a file compressed by zisofs, what we know about it.  */
+  struct zisofs_file *zf;
 };
 
 struct user_pager_info
@@ -102,5 +108,11 @@ error_t cache_id (struct dirrect *record, struct rrip_lookup *rr, ino_t *idp);
 
 error_t calculate_file_start (struct dirrect *, off_t *, struct rrip_lookup *);
 
+void free_dir_index (struct dirindex *);
+
+error_t zisofs_init_node (struct node *, struct rrip_lookup *);
+void zisofs_drop_node (struct node *);
+error_t zisofs_read (struct node *, off_t, size_t, void *);
+
 char *isodate_915 (char *, struct timespec *);
 char *isodate_84261 (char *, struct timespec *);
@@ -26,9 +26,30 @@
 /* From inode.c */
 int use_file_start_id (struct dirrect *record, struct rrip_lookup *rr);
 
-/* Forward */
-static error_t dirscanblock (void *, const char *, size_t,
-			     struct dirrect **, struct rrip_lookup *);
+/* An entry of a directory, other than a relocated one.  */
+struct dirindex_entry
+{
+  struct dirrect *dr;
+
+  /* The Rock Ridge name of the entry if RR, which then is the only name
+     it matches; otherwise the ISO 9660 name, shortened as by
+     index_key.  */
+  const char *key;
+  size_t keylen;
+  int rr;
+};
+
+/* The index of a directory, made the first time it is read.  The medium
+   is read-only, so it never changes.  */
+struct dirindex
+{
+  /* In the order of the directory.  */
+  struct dirindex_entry *entries;
+  size_t nentries;
+
+  /* The same entries, sorted by key with compare_keys.  */
+  struct dirindex_entry **sorted;
+};
 
 static int
 isonamematch (const char *dirname, size_t dnamelen,
@@ -63,6 +84,268 @@ isonamematch (const char *dirname, size_t dnamelen,
   return 0;
 }
 
+/* Return in *KEYLEN the length of the part of the ISO 9660 name NAME
+   (of length NAMELEN) which has to match a name looked up: without a
+   version number, nor an empty extension.  */
+static const char *
+index_key (const char *name, size_t namelen, size_t *keylen)
+{
+  const char *semi;
+
+  /* Special representations for `.' and `..' */
+  if (namelen == 1 && name[0] == '\0')
+    name = ".";
+  else if (namelen == 1 && name[0] == '\1')
+    name = "..";
+  else
+    {
+      semi = memchr (name, ';', namelen);
+      if (semi)
+	namelen = semi - name;
+      if (namelen >= 2 && name[namelen - 1] == '.'
+	  && !(namelen == 2 && name[0] == '.'))
+	namelen--;
+      *keylen = namelen;
+      return name;
+    }
+
+  *keylen = strlen (name);
+  return name;
+}
+
+/* ISO 9660 names match regardless of case, so the keys are sorted
+   that way; a Rock Ridge name is then told from the other names of the
+   same key when looking it up.  */
+static int
+compare_keys (const char *a, size_t alen, const char *b, size_t blen)
+{
+  int cmp = strncasecmp (a, b, alen < blen ? alen : blen);
+  if (cmp)
+    return cmp;
+  return (alen > blen) - (alen < blen);
+}
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  const struct dirindex_entry *x = *(struct dirindex_entry **) a;
+  const struct dirindex_entry *y = *(struct dirindex_entry **) b;
+  int cmp = compare_keys (x->key, x->keylen, y->key, y->keylen);
+  if (cmp)
+    return cmp;
+
+  /* Of the entries matching a name, the first in the directory is the
+     one found.  */
+  return (x->dr > y->dr) - (x->dr < y->dr);
+}
+
+void
+free_dir_index (struct dirindex *index)
+{
+  size_t i;
+
+  if (!index)
+    return;
+  for (i = 0; i < index->nentries; i++)
+    if (index->entries[i].rr)
+      free ((char *) index->entries[i].key);
+  free (index->entries);
+  free (index->sorted);
+  free (index);
+}
+
+/* Make the index of directory DP if it has none yet, parsing the
+   Rock Ridge fields of each of its entries once.  DP must be locked.  */
+static error_t
+make_dir_index (struct node *dp)
+{
+  struct dirindex *index;
+  size_t alloced = 0;
+  void *buf, *blkaddr, *currentoff;
+  size_t i;
+  error_t err;
+
+  if (dp->dn->index)
+    return 0;
+
+  index = calloc (1, sizeof *index);
+  if (!index)
+    return ENOMEM;
+
+  err = diskfs_catch_exception ();
+  if (err)
+    {
+      free (index);
+      return err;
+    }
+
+  buf = disk_image + (dp->dn->file_start << store->log2_block_size);
+  for (blkaddr = buf;
+       !err && blkaddr < buf + dp->dn_stat.st_size;
+       blkaddr += logical_sector_size)
+    {
+      size_t reclen;
+
+      for (currentoff = blkaddr;
+	   currentoff < blkaddr + logical_sector_size;
+	   currentoff += reclen)
+	{
+	  struct dirrect *entry = currentoff;
+	  struct dirindex_entry *e;
+	  struct rrip_lookup rr;
+
+	  reclen = entry->len;
+
+	  /* Validate reclen */
+	  if (reclen == 0
+	      || reclen < sizeof (struct dirrect)
+	      || currentoff + reclen > blkaddr + logical_sector_size
+	      || reclen < sizeof (struct dirrect) + entry->namelen)
+	    break;
+
+	  rrip_lookup (entry, &rr, 0);
+
+	  /* Ignore RE entries */
+	  if (rr.valid & VALID_RE)
+	    {
+	      release_rrip (&rr);
+	      continue;
+	    }
+
+	  if (index->nentries == alloced)
+	    {
+	      size_t new_alloced = alloced ? 2 * alloced : 32;
+	      e = realloc (index->entries, new_alloced * sizeof *e);
+	      if (!e)
+		{
+		  release_rrip (&rr);
+		  err = ENOMEM;
+		  break;
+		}
+	      index->entries = e;
+	      alloced = new_alloced;
+	    }
+
+	  e = &index->entries[index->nentries++];
+	  e->dr = entry;
+	  e->rr = (rr.valid & VALID_NM) != 0;
+	  if (e->rr)
+	    {
+	      /* Keep the name parsed.  */
+	      e->key = rr.name;
+	      e->keylen = strlen (rr.name);
+	      rr.valid &= ~VALID_NM;
+	    }
+	  else
+	    e->key = index_key ((const char *) entry->name, entry->namelen,
+				&e->keylen);
+	  release_rrip (&rr);
+	}
+    }
+
+  diskfs_end_catch_exception ();
+
+  if (!err)
+    {
+      index->sorted = malloc ((index->nentries ?: 1) * sizeof *index->sorted);
+      if (!index->sorted)
+	err = ENOMEM;
+    }
+  if (err)
+    {
+      free_dir_index (index);
+      return err;
+    }
+
+  for (i = 0; i < index->nentries; i++)
+    index->sorted[i] = &index->entries[i];
+  qsort (index->sorted, index->nentries, sizeof *index->sorted,
+	 compare_entries);
+
+  dp->dn->index = index;
+  return 0;
+}
+
+/* Look for the first entry matching KEY (of length KEYLEN) in INDEX
+   that NAME (of length NAMELEN) matches, better than *FOUND if set.  */
+static void
+search_dir_index (struct dirindex *index, const char *key, size_t keylen,
+		  const char *name, size_t namelen,
+		  struct dirindex_entry **found)
+{
+  size_t lo = 0, hi = index->nentries;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      struct dirindex_entry *e = index->sorted[mid];
+      if (compare_keys (e->key, e->keylen, key, keylen) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (; lo < index->nentries; lo++)
+    {
+      struct dirindex_entry *e = index->sorted[lo];
+      int match;
+
+      if (compare_keys (e->key, e->keylen, key, keylen))
+	break;
+      if (*found && (*found)->dr < e->dr)
+	break;
+
+      if (e->rr)
+	match = e->keylen == namelen && !memcmp (e->key, name, namelen);
+      else
+	match = isonamematch ((const char *) e->dr->name, e->dr->namelen,
+			      name, namelen);
+      if (match)
+	{
+	  *found = e;
+	  break;
+	}
+    }
+}
+
+/* Find NAME (of length NAMELEN) in directory DP, returning its record
+   in *RECORD and its Rock Ridge fields in RR.  */
+static error_t
+dirscan (struct node *dp, const char *name, size_t namelen,
+	 struct dirrect **record, struct rrip_lookup *rr)
+{
+  struct dirindex_entry *found = 0;
+  const char *key;
+  size_t keylen;
+  error_t err;
+
+  err = make_dir_index (dp);
+  if (err)
+    return err;
+
+  /* A Rock Ridge name only matches itself, but an ISO 9660 name also
+     matches without its version number or empty extension.  */
+  search_dir_index (dp->dn->index, name, namelen, name, namelen, &found);
+  key = index_key (name, namelen, &keylen);
+  if (keylen != namelen)
+    search_dir_index (dp->dn->index, key, keylen, name, namelen, &found);
+
+  if (!found)
+    {
+      *record = 0;
+      return ENOENT;
+    }
+
+  err = diskfs_catch_exception ();
+  if (err)
+    return err;
+  rrip_lookup (found->dr, rr, 0);
+  diskfs_end_catch_exception ();
+
+  *record = found->dr;
+  return 0;
+}
+
 /* Implement the diskfs_lookup callback from the diskfs library.  See
    <hurd/diskfs.h> for the interface specification. */
 error_t
@@ -73,8 +356,6 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   struct lookup_context ctx;
   int namelen;
   int spec_dotdot;
-  void *buf;
-  void *blockaddr;
   ino_t id;
 
   if ((type == REMOVE) || (type == RENAME))
@@ -93,20 +374,9 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   if (type == RENAME)
     return EROFS;
 
-  buf = disk_image + (dp->dn->file_start << store->log2_block_size);
-
-  for (blockaddr = buf;
-       blockaddr < buf + dp->dn_stat.st_size;
-       blockaddr += logical_sector_size)
-    {
-      err = dirscanblock (blockaddr, name, namelen, &ctx.dr, &ctx.rr);
-
-      if (!err)
-	break;
-
-      if (err != ENOENT)
-	return err;
-    }
+  err = dirscan (dp, name, namelen, &ctx.dr, &ctx.rr);
+  if (err && err != ENOENT)
+    return err;
 
   if ((!err && type == REMOVE)
       || (err == ENOENT && type == CREATE))
@@ -154,72 +424,6 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 }
 
 
-/* Scan one logical sector of directory contents (at address BLKADDR)
-   for NAME of length NAMELEN.  Return its address in *RECORD. */
-static error_t
-dirscanblock (void *blkaddr, const char *name, size_t namelen,
-	      struct dirrect **record, struct rrip_lookup *rr)
-{
-  struct dirrect *entry;
-  void *currentoff;
-  size_t reclen;
-  size_t entry_namelen;
-  int matchrr;
-  int matchnormal;
-
-  for (currentoff = blkaddr;
-       currentoff < blkaddr + logical_sector_size;
-       currentoff += reclen)
-    {
-      entry = (struct dirrect *) currentoff;
-
-      reclen = entry->len;
-
-      /* Validate reclen */
-      if (reclen == 0
-	  || reclen < sizeof (struct dirrect)
-	  || currentoff + reclen > blkaddr + logical_sector_size)
-	break;
-
-      entry_namelen = entry->namelen;
-
-      /* More validation */
-      if (reclen < sizeof (struct dirrect) + entry_namelen)
-	break;
-
-      /* Check to see if the name matches the directory entry. */
-      if (isonamematch ((const char *) entry->name, entry_namelen, name, namelen))
-	matchnormal = 1;
-      else
-	matchnormal = 0;
-
-      /* Now scan for RRIP fields */
-      matchrr = rrip_match_lookup (entry, name, namelen, rr);
-
-      /* Ignore RE entries */
-      if (rr->valid & VALID_RE)
-	{
-	  release_rrip (rr);
-	  continue;
-	}
-
-      /* See if the name matches */
-      if (((rr->valid & VALID_NM) && matchrr)
-	  || (!(rr->valid & VALID_NM) && matchnormal))
-	{
-	  /* We've got it.  Return success */
-	  *record = entry;
-	  return 0;
-	}
-
-      release_rrip (rr);
-    }
-
-  /* Wasn't there. */
-  *record = 0;
-  return ENOENT;
-}
-
 error_t
 diskfs_get_directs (struct node *dp,
 		    int entry,
@@ -256,40 +460,25 @@ diskfs_get_directs (struct node *dp,
 
   /* Skip to ENTRY */
   dirbuf = disk_image + (dp->dn->file_start << store->log2_block_size);
-  bufp = dirbuf;
-  for (i = 0; i < entry; i ++)
+  err = make_dir_index (dp);
+  if (!err && entry >= dp->dn->index->nentries)
     {
-      struct rrip_lookup rr;
-
-      ep = (struct dirrect *) bufp;
-      rrip_lookup (ep, &rr, 0);
-
-      /* Ignore and skip RE entries */
-      if (rr.valid & VALID_RE)
-	i--;
-      else
-	{
-	  if (bufp - dirbuf >= dp->dn_stat.st_size)
-	    {
-	      /* Not that many entries in the directory; return nothing. */
-	      release_rrip (&rr);
-	      if (allocsize > *datacnt)
-		munmap (data, allocsize);
-	      *datacnt = 0;
-	      *amt = 0;
-	      return 0;
-	    }
-	}
-      bufp = bufp + ep->len;
-      release_rrip (&rr);
-
-      /* If BUFP points at a null, then we have hit the last
-	 record in this logical sector.  In that case, skip up to
-	 the next logical sector. */
-      if (*(char *)bufp == '\0')
-	bufp = (void *) (((long) bufp & ~(logical_sector_size - 1))
-			 + logical_sector_size);
+      /* Not that many entries in the directory; return nothing. */
+      diskfs_end_catch_exception ();
+      if (ouralloc)
+	munmap (*data, allocsize);
+      *datacnt = 0;
+      *amt = 0;
+      return 0;
+    }
+  if (err)
+    {
+      diskfs_end_catch_exception ();
+      if (ouralloc)
+	munmap (*data, allocsize);
+      return err;
     }
+  bufp = dp->dn->index->entries[entry].dr;
 
   /* Now copy entries one at a time */
   i = 0;
@@ -59,6 +59,18 @@ pager_read_page (struct user_pager_info *upi,
 	  return 0;
 	}
 
+      if (np->dn->zf)
+	{
+	  *buf = (vm_address_t) mmap (0, vm_page_size, PROT_READ|PROT_WRITE,
+				      MAP_ANON, 0, 0);
+	  if ((void *) *buf == MAP_FAILED)
+	    return ENOMEM;
+	  err = zisofs_read (np, page, vm_page_size, (void *) *buf);
+	  if (err)
+	    munmap ((void *) *buf, vm_page_size);
+	  return err;
+	}
+
       if (page + vm_page_size > np->dn_stat.st_size)
 	overrun = page + vm_page_size - np->dn_stat.st_size;
     }
@@ -81,6 +93,86 @@ pager_read_page (struct user_pager_info *upi,
   return 0;
 }
 
+/* Implement the pager_read_pages callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  Files are contiguous on
+   the medium, so any range is a single read.  */
+error_t
+pager_read_pages (struct user_pager_info *upi,
+		  vm_offset_t offset,
+		  int npages,
+		  vm_address_t *buf,
+		  int *writelock)
+{
+  error_t err;
+  daddr_t addr;
+  struct node *np = upi->np;
+  size_t length = npages * vm_page_size;
+  size_t amount = length;
+  size_t read = length;
+  void *data;
+
+  /* This is a read-only medium */
+  *writelock = 1;
+
+  if (upi->type == FILE_DATA)
+    {
+      if (offset >= np->dn_stat.st_size)
+	return EOPNOTSUPP;
+
+      if (np->dn->zf)
+	{
+	  data = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+	  if (data == MAP_FAILED)
+	    return ENOMEM;
+	  err = zisofs_read (np, offset, length, data);
+	  if (err)
+	    {
+	      munmap (data, length);
+	      return err;
+	    }
+	  *buf = (vm_address_t) data;
+	  return 0;
+	}
+
+      addr = np->dn->file_start + (offset >> store->log2_block_size);
+      if (offset + length > np->dn_stat.st_size)
+	amount = round_page (np->dn_stat.st_size - offset);
+    }
+  else
+    {
+      assert_backtrace (upi->type == DISK);
+      addr = offset >> store->log2_block_size;
+    }
+
+  data = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (data == MAP_FAILED)
+    return EIO;
+
+  *buf = (vm_address_t) data;
+  err = store_read (store, addr, amount, (void **) buf, &read);
+  if (!err && read != amount)
+    err = EIO;
+  if ((void *) *buf != data)
+    {
+      if (!err)
+	memcpy (data, (void *) *buf, amount);
+      munmap ((void *) *buf, read);
+      *buf = (vm_address_t) data;
+    }
+  if (err)
+    {
+      munmap (data, length);
+      return err;
+    }
+
+  /* Past the end of the file, the pages read as zeros.  */
+  if (upi->type == FILE_DATA && offset + amount > np->dn_stat.st_size)
+    memset (data + np->dn_stat.st_size - offset, 0,
+	    offset + amount - np->dn_stat.st_size);
+
+  return 0;
+}
+
 /* This function should never be called.  */
 error_t
 pager_write_page (struct user_pager_info *pager,
@@ -530,6 +530,25 @@ rrip_work (struct dirrect *dr, struct rrip_lookup *rr,
 	  goto next_field;
 	}
 
+      /* ZF says the file is compressed by zisofs, with the given
+	 uncompressed size. */
+      if (susp->sig[0] == 'Z'
+	  && susp->sig[1] == 'F'
+	  && susp->version == 1
+	  && susp->len >= sizeof (struct su_header) + sizeof (struct rr_zf))
+	{
+	  struct rr_zf *zf = body;
+
+	  if (zf->algorithm[0] == 'p' && zf->algorithm[1] == 'z')
+	    {
+	      rr->zfsize = isonum_733 (zf->size);
+	      rr->zfheadersize = zf->header_size << 2;
+	      rr->zflog2blocksize = zf->log2_block_size;
+	      rr->valid |= VALID_ZF;
+	    }
+	  goto next_field;
+	}
+
       /* PL is found in the ".." entry of a relocated directory.
 	 The present directory entry points to the fictitious parent
 	 (the one that holds the fictitious RE link here); the PL
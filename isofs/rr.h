@@ -67,6 +67,11 @@ struct rrip_lookup
   /* FL */
   long flags;
 
+  /* ZF */
+  off_t zfsize;			/* uncompressed size */
+  int zfheadersize;		/* in bytes */
+  int zflog2blocksize;
+
   int valid;
 };
 
@@ -83,6 +88,7 @@ struct rrip_lookup
 #define VALID_TR	0x0200
 #define VALID_MD	0x0400
 #define VALID_FL	0x0800
+#define VALID_ZF	0x1000
 
 
 /* Definitions for System Use Sharing Protocol.
@@ -221,6 +227,17 @@ struct rr_sf
   char size[8];
 };
 
+
+/* The body of a ZF (zisofs compressed file) field, as in the
+   extension of mkzftree and Linux. */
+struct rr_zf
+{
+  char algorithm[2];		/* "pz" */
+  u_char header_size;		/* in 4 byte units */
+  u_char log2_block_size;
+  unsigned char size[8];	/* uncompressed */
+};
+
 
 /* GNU extensions */
 
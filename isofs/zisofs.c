@@ -0,0 +1,436 @@
+/* Files compressed by zisofs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+/* A zisofs file, as made by mkzftree, starts with a header, followed
+   by a table of the offsets of its blocks in the file, one more than
+   there are blocks.  Each block is compressed with zlib on its own; a
+   block of length zero is all zeros.  The ZF field of the directory
+   entry gives the uncompressed size.  */
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "isofs.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+static const unsigned char zisofs_magic[8] =
+  { 0x37, 0xe4, 0x53, 0x96, 0xc9, 0xdb, 0xd6, 0x07 };
+
+/* The most blocks of a read that are uncompressed at once, and the
+   number of recently uncompressed blocks that are kept.  A block is
+   usually 32k, and bigger than a page, so without the cache each page
+   of it would be uncompressed again.  */
+#define ZISOFS_THREADS	4
+#define ZISOFS_CACHE_BLOCKS	64
+
+struct zisofs_file
+{
+  pthread_mutex_t lock;
+  int log2_block_size;
+  size_t header_size;
+  off_t compressed_size;
+  size_t nblocks;
+  /* The offsets of the blocks; null until the first read.  */
+  uint32_t *pointers;
+};
+
+/* An uncompressed block in the cache.  */
+struct zblock
+{
+  off_t file_start;		/* the file it is from */
+  size_t block;
+  char *data;			/* null if the slot is free */
+  size_t len;
+  unsigned long stamp;
+};
+
+static struct zblock zcache[ZISOFS_CACHE_BLOCKS];
+static unsigned long zcache_clock;
+static pthread_mutex_t zcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A block to uncompress.  */
+struct zjob
+{
+  size_t block;
+  const void *src;
+  size_t srclen;
+  char *data;
+  size_t len;
+  error_t err;
+};
+
+struct zrun
+{
+  struct zjob *jobs;
+  int njobs;
+  int next;
+};
+
+/* Read LEN bytes at byte OFFSET of the file starting at store block
+   FILE_START.  Return in *MAP what to munmap afterwards, of length
+   *MAPLEN, and in *DATA where the bytes are in it.  */
+static error_t
+read_bytes (off_t file_start, off_t offset, size_t len,
+	    void **map, size_t *maplen, void **data)
+{
+  error_t err;
+  size_t skip = offset & (store->block_size - 1);
+  size_t amount = ((skip + len + store->block_size - 1)
+		   & ~(store->block_size - 1));
+  store_offset_t addr = file_start + (offset >> store->log2_block_size);
+
+  *map = 0;
+  *maplen = 0;
+  err = store_read (store, addr, amount, map, maplen);
+  if (err)
+    return err;
+  if (*maplen < skip + len)
+    {
+      munmap (*map, *maplen);
+      return EIO;
+    }
+
+  *data = *map + skip;
+  return 0;
+}
+
+/* Read the header and block pointers of NP.  */
+/* Be careful that NP->dn->zf->lock is already locked.  */
+static error_t
+load_pointers (struct node *np)
+{
+  struct zisofs_file *zf = np->dn->zf;
+  size_t tablelen = (zf->nblocks + 1) * sizeof (uint32_t);
+  const unsigned char *p;
+  void *map, *data;
+  size_t maplen, i;
+  uint32_t *pointers;
+  error_t err;
+
+  if (zf->header_size < sizeof zisofs_magic
+      || zf->header_size + tablelen > zf->compressed_size)
+    return EIO;
+
+  err = read_bytes (np->dn->file_start, 0, zf->header_size + tablelen,
+		    &map, &maplen, &data);
+  if (err)
+    return err;
+
+  pointers = malloc (tablelen);
+  if (! pointers)
+    {
+      munmap (map, maplen);
+      return ENOMEM;
+    }
+
+  if (memcmp (data, zisofs_magic, sizeof zisofs_magic))
+    err = EIO;
+
+  p = data + zf->header_size;
+  for (i = 0; !err && i <= zf->nblocks; i++, p += 4)
+    {
+      pointers[i] = (p[0] | (p[1] << 8) | (p[2] << 16)
+		     | ((uint32_t) p[3] << 24));
+      if (pointers[i] > zf->compressed_size
+	  || (i > 0 && pointers[i] < pointers[i - 1]))
+	err = EIO;
+    }
+
+  munmap (map, maplen);
+  if (err)
+    {
+      free (pointers);
+      return err;
+    }
+
+  zf->pointers = pointers;
+  return 0;
+}
+
+/* Copy LEN bytes at OFFSET of block BLOCK of the file at FILE_START to
+   DEST, if it is cached.  Return nonzero if it was.  */
+static int
+cache_lookup (off_t file_start, size_t block, size_t offset, size_t len,
+	      void *dest)
+{
+  int i, found = 0;
+
+  pthread_mutex_lock (&zcache_lock);
+  for (i = 0; i < ZISOFS_CACHE_BLOCKS; i++)
+    if (zcache[i].data
+	&& zcache[i].file_start == file_start && zcache[i].block == block)
+      {
+	memcpy (dest, zcache[i].data + offset, len);
+	zcache[i].stamp = ++zcache_clock;
+	found = 1;
+	break;
+      }
+  pthread_mutex_unlock (&zcache_lock);
+
+  return found;
+}
+
+/* Put the LEN bytes of DATA, block BLOCK of the file at FILE_START, in
+   the cache, which consumes DATA.  */
+static void
+cache_insert (off_t file_start, size_t block, char *data, size_t len)
+{
+  struct zblock *victim = &zcache[0];
+  int i;
+
+  pthread_mutex_lock (&zcache_lock);
+  for (i = 0; i < ZISOFS_CACHE_BLOCKS; i++)
+    {
+      if (zcache[i].data
+	  && zcache[i].file_start == file_start && zcache[i].block == block)
+	{
+	  /* Another thread was first.  */
+	  pthread_mutex_unlock (&zcache_lock);
+	  free (data);
+	  return;
+	}
+
+      if (! zcache[i].data)
+	victim = &zcache[i];
+      else if (victim->data && zcache[i].stamp < victim->stamp)
+	victim = &zcache[i];
+    }
+
+  free (victim->data);
+  victim->file_start = file_start;
+  victim->block = block;
+  victim->data = data;
+  victim->len = len;
+  victim->stamp = ++zcache_clock;
+  pthread_mutex_unlock (&zcache_lock);
+}
+
+/* Uncompress the blocks of RUN until none is left.  */
+static void *
+zisofs_worker (void *arg)
+{
+  struct zrun *run = arg;
+  int i;
+
+  while ((i = __atomic_fetch_add (&run->next, 1, __ATOMIC_RELAXED))
+	 < run->njobs)
+    {
+      struct zjob *job = &run->jobs[i];
+      uLongf len = job->len;
+
+      job->data = malloc (job->len);
+      if (! job->data)
+	{
+	  job->err = ENOMEM;
+	  continue;
+	}
+
+      if (job->srclen == 0)
+	memset (job->data, 0, job->len);
+      else if (uncompress ((Bytef *) job->data, &len,
+			   job->src, job->srclen) != Z_OK)
+	job->err = EIO;
+      else if (len < job->len)
+	memset (job->data + len, 0, job->len - len);
+    }
+
+  return NULL;
+}
+
+/* Set up NP as a zisofs file, according to the ZF field in RR.  */
+error_t
+zisofs_init_node (struct node *np, struct rrip_lookup *rr)
+{
+  struct zisofs_file *zf;
+
+  /* These are the block sizes mkzftree can make.  */
+  if (rr->zflog2blocksize < 15 || rr->zflog2blocksize > 17)
+    return 0;
+
+  zf = malloc (sizeof *zf);
+  if (! zf)
+    return ENOMEM;
+
+  pthread_mutex_init (&zf->lock, NULL);
+  zf->log2_block_size = rr->zflog2blocksize;
+  zf->header_size = rr->zfheadersize;
+  zf->compressed_size = np->dn_stat.st_size;
+  zf->nblocks = ((rr->zfsize + (1 << zf->log2_block_size) - 1)
+		 >> zf->log2_block_size);
+  zf->pointers = NULL;
+
+  np->dn->zf = zf;
+  np->dn_stat.st_size = rr->zfsize;
+  return 0;
+}
+
+void
+zisofs_drop_node (struct node *np)
+{
+  struct zisofs_file *zf = np->dn->zf;
+
+  if (zf)
+    {
+      free (zf->pointers);
+      free (zf);
+    }
+}
+
+/* Fill BUF with the LEN uncompressed bytes of NP at OFFSET.  Whatever
+   of BUF is past the end of the file is left alone.  The blocks not in
+   the cache are read at once, and uncompressed by up to ZISOFS_THREADS
+   threads.  */
+error_t
+zisofs_read (struct node *np, off_t offset, size_t len, void *buf)
+{
+  struct zisofs_file *zf = np->dn->zf;
+  size_t block_size = 1 << zf->log2_block_size;
+  off_t file_start = np->dn->file_start;
+  size_t first, last, block;
+  struct zjob *jobs;
+  struct zrun run;
+  pthread_t threads[ZISOFS_THREADS - 1];
+  int nthreads = 0;
+  void *map = 0, *data;
+  size_t maplen = 0;
+  error_t err = 0;
+  off_t end;
+  int i;
+
+  pthread_mutex_lock (&zf->lock);
+  if (! zf->pointers)
+    err = load_pointers (np);
+  pthread_mutex_unlock (&zf->lock);
+  if (err)
+    return err;
+
+  end = offset + len;
+  if (end > np->dn_stat.st_size)
+    end = np->dn_stat.st_size;
+  if (offset >= end)
+    return 0;
+
+  first = offset >> zf->log2_block_size;
+  last = (end - 1) >> zf->log2_block_size;
+
+  jobs = calloc (last - first + 1, sizeof *jobs);
+  if (! jobs)
+    return ENOMEM;
+  run.jobs = jobs;
+  run.njobs = 0;
+  run.next = 0;
+
+  /* Take what we can from the cache.  */
+  for (block = first; block <= last; block++)
+    {
+      off_t start = (off_t) block << zf->log2_block_size;
+      off_t from = start > offset ? start : offset;
+      off_t to = start + block_size < end ? start + block_size : end;
+
+      if (! cache_lookup (file_start, block, from - start, to - from,
+			  buf + (from - offset)))
+	{
+	  jobs[run.njobs].block = block;
+	  jobs[run.njobs].len = (np->dn_stat.st_size - start < block_size
+				 ? np->dn_stat.st_size - start : block_size);
+	  run.njobs++;
+	}
+    }
+
+  if (run.njobs == 0)
+    goto out;
+
+  /* The compressed blocks follow one another; read them all.  */
+  {
+    uint32_t from = zf->pointers[jobs[0].block];
+    uint32_t to = zf->pointers[jobs[run.njobs - 1].block + 1];
+
+    data = 0;
+    if (to > from)
+      {
+	err = read_bytes (file_start, from, to - from, &map, &maplen, &data);
+	if (err)
+	  goto out;
+      }
+
+    for (i = 0; i < run.njobs; i++)
+      {
+	jobs[i].src = data + zf->pointers[jobs[i].block] - from;
+	jobs[i].srclen = (zf->pointers[jobs[i].block + 1]
+			  - zf->pointers[jobs[i].block]);
+      }
+  }
+
+  for (i = 1; i < run.njobs && nthreads < ZISOFS_THREADS - 1; i++)
+    if (pthread_create (&threads[nthreads], NULL, zisofs_worker, &run) == 0)
+      nthreads++;
+  zisofs_worker (&run);
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+
+  if (map)
+    munmap (map, maplen);
+
+  for (i = 0; i < run.njobs; i++)
+    {
+      struct zjob *job = &jobs[i];
+      off_t start = (off_t) job->block << zf->log2_block_size;
+      off_t from = start > offset ? start : offset;
+      off_t to = start + job->len < end ? start + job->len : end;
+
+      if (job->err)
+	{
+	  err = err ?: job->err;
+	  free (job->data);
+	  continue;
+	}
+
+      memcpy (buf + (from - offset), job->data + (from - start), to - from);
+      cache_insert (file_start, job->block, job->data, job->len);
+    }
+
+ out:
+  free (jobs);
+  return err;
+}
+
+#else /* ! HAVE_LIBZ */
+
+/* Without zlib, zisofs files are served as they are on the medium.  */
+
+error_t
+zisofs_init_node (struct node *np, struct rrip_lookup *rr)
+{
+  return 0;
+}
+
+void
+zisofs_drop_node (struct node *np)
+{
+}
+
+error_t
+zisofs_read (struct node *np, off_t offset, size_t len, void *buf)
+{
+  return EIO;
+}
+
+#endif /* HAVE_LIBZ */
@@ -48,11 +48,118 @@
 
 static struct net_hash_header filter_hash_header[N_NET_HASH];
 
+/*
+ * The operations a filter program is decoded into by bpf_decode, each
+ * standing for a BPF instruction.  The order is that of the handlers
+ * in bpf_do_filter.
+ */
+enum {
+	OP_ABORT,
+	OP_RET_K, OP_RET_A, OP_RET_MATCH,
+	OP_LD_W_ABS, OP_LD_H_ABS, OP_LD_B_ABS,
+	OP_LD_W_IND, OP_LD_H_IND, OP_LD_B_IND,
+	OP_LD_LEN, OP_LDX_LEN, OP_LDX_MSH,
+	OP_LD_IMM, OP_LDX_IMM, OP_LD_MEM, OP_LDX_MEM, OP_ST, OP_STX,
+	OP_JA,
+	OP_JGT_K, OP_JGE_K, OP_JEQ_K, OP_JSET_K,
+	OP_JGT_X, OP_JGE_X, OP_JEQ_X, OP_JSET_X,
+	OP_ADD_X, OP_SUB_X, OP_MUL_X, OP_DIV_X,
+	OP_AND_X, OP_OR_X, OP_LSH_X, OP_RSH_X,
+	OP_ADD_K, OP_SUB_K, OP_MUL_K, OP_DIV_K,
+	OP_AND_K, OP_OR_K, OP_LSH_K, OP_RSH_K,
+	OP_NEG, OP_TAX, OP_TXA,
+};
+
+/*
+ * Decode the filter program of INFP, whose instructions have been
+ * validated, into INFP->prog.  Jump offsets become the indices of
+ * their targets, so that bpf_do_filter neither decodes an instruction
+ * nor computes a target for each packet.
+ */
+static void
+bpf_decode(net_rcv_port_t infp)
+{
+	bpf_insn_t f = ((bpf_insn_t) infp->filter) + 1;
+	int len = (bpf_insn_t) infp->filter_end - f;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		struct bpf_op *op = &infp->prog[i];
+
+		op->k = f[i].k;
+		op->jt = i + 1 + f[i].jt;
+		op->jf = i + 1 + f[i].jf;
+
+		switch (f[i].code) {
+		default:			op->op = OP_ABORT; break;
+		case BPF_RET|BPF_K:		op->op = OP_RET_K; break;
+		case BPF_RET|BPF_A:		op->op = OP_RET_A; break;
+		case BPF_RET|BPF_MATCH_IMM:
+			op->op = OP_RET_MATCH;
+			/* The number of keys.  */
+			op->jt = f[i].jt;
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:	op->op = OP_LD_W_ABS; break;
+		case BPF_LD|BPF_H|BPF_ABS:	op->op = OP_LD_H_ABS; break;
+		case BPF_LD|BPF_B|BPF_ABS:	op->op = OP_LD_B_ABS; break;
+		case BPF_LD|BPF_W|BPF_IND:	op->op = OP_LD_W_IND; break;
+		case BPF_LD|BPF_H|BPF_IND:	op->op = OP_LD_H_IND; break;
+		case BPF_LD|BPF_B|BPF_IND:	op->op = OP_LD_B_IND; break;
+		case BPF_LD|BPF_W|BPF_LEN:	op->op = OP_LD_LEN; break;
+		case BPF_LDX|BPF_W|BPF_LEN:	op->op = OP_LDX_LEN; break;
+		case BPF_LDX|BPF_MSH|BPF_B:	op->op = OP_LDX_MSH; break;
+		case BPF_LD|BPF_IMM:		op->op = OP_LD_IMM; break;
+		case BPF_LDX|BPF_IMM:		op->op = OP_LDX_IMM; break;
+		case BPF_LD|BPF_MEM:		op->op = OP_LD_MEM; break;
+		case BPF_LDX|BPF_MEM:		op->op = OP_LDX_MEM; break;
+		case BPF_ST:			op->op = OP_ST; break;
+		case BPF_STX:			op->op = OP_STX; break;
+		case BPF_JMP|BPF_JA:
+			op->op = OP_JA;
+			op->jt = i + 1 + f[i].k;
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:	op->op = OP_JGT_K; break;
+		case BPF_JMP|BPF_JGE|BPF_K:	op->op = OP_JGE_K; break;
+		case BPF_JMP|BPF_JEQ|BPF_K:	op->op = OP_JEQ_K; break;
+		case BPF_JMP|BPF_JSET|BPF_K:	op->op = OP_JSET_K; break;
+		case BPF_JMP|BPF_JGT|BPF_X:	op->op = OP_JGT_X; break;
+		case BPF_JMP|BPF_JGE|BPF_X:	op->op = OP_JGE_X; break;
+		case BPF_JMP|BPF_JEQ|BPF_X:	op->op = OP_JEQ_X; break;
+		case BPF_JMP|BPF_JSET|BPF_X:	op->op = OP_JSET_X; break;
+		case BPF_ALU|BPF_ADD|BPF_X:	op->op = OP_ADD_X; break;
+		case BPF_ALU|BPF_SUB|BPF_X:	op->op = OP_SUB_X; break;
+		case BPF_ALU|BPF_MUL|BPF_X:	op->op = OP_MUL_X; break;
+		case BPF_ALU|BPF_DIV|BPF_X:	op->op = OP_DIV_X; break;
+		case BPF_ALU|BPF_AND|BPF_X:	op->op = OP_AND_X; break;
+		case BPF_ALU|BPF_OR|BPF_X:	op->op = OP_OR_X; break;
+		case BPF_ALU|BPF_LSH|BPF_X:	op->op = OP_LSH_X; break;
+		case BPF_ALU|BPF_RSH|BPF_X:	op->op = OP_RSH_X; break;
+		case BPF_ALU|BPF_ADD|BPF_K:	op->op = OP_ADD_K; break;
+		case BPF_ALU|BPF_SUB|BPF_K:	op->op = OP_SUB_K; break;
+		case BPF_ALU|BPF_MUL|BPF_K:	op->op = OP_MUL_K; break;
+		case BPF_ALU|BPF_DIV|BPF_K:	op->op = OP_DIV_K; break;
+		case BPF_ALU|BPF_AND|BPF_K:	op->op = OP_AND_K; break;
+		case BPF_ALU|BPF_OR|BPF_K:	op->op = OP_OR_K; break;
+		case BPF_ALU|BPF_LSH|BPF_K:	op->op = OP_LSH_K; break;
+		case BPF_ALU|BPF_RSH|BPF_K:	op->op = OP_RSH_K; break;
+		case BPF_ALU|BPF_NEG:		op->op = OP_NEG; break;
+		case BPF_MISC|BPF_TAX:		op->op = OP_TAX; break;
+		case BPF_MISC|BPF_TXA:		op->op = OP_TXA; break;
+		}
+	}
+
+	/* Running off the end rejects the packet.  */
+	infp->prog[len].op = OP_ABORT;
+}
+
 /*
  * Execute the filter program starting at pc on the packet p
  * wirelen is the length of the original packet
  * buflen is the amount of data present
  *
+ * The program is run as decoded by bpf_decode: each handler jumps
+ * straight to the handler of the next operation.
+ *
  * @p: packet data.
  * @wirelen: data_count (in bytes)
  * @hlen: header len (in bytes)
@@ -63,7 +170,56 @@ bpf_do_filter(net_rcv_port_t infp, char *p,	unsigned int wirelen,
 		char *header, unsigned int hlen, net_hash_entry_t **hash_headpp,
 		net_hash_entry_t *entpp)
 {
-	bpf_insn_t pc, pc_end;
+	static const void *const handlers[] = {
+		[OP_ABORT] = &&op_abort,
+		[OP_RET_K] = &&op_ret_k,
+		[OP_RET_A] = &&op_ret_a,
+		[OP_RET_MATCH] = &&op_ret_match,
+		[OP_LD_W_ABS] = &&op_ld_w_abs,
+		[OP_LD_H_ABS] = &&op_ld_h_abs,
+		[OP_LD_B_ABS] = &&op_ld_b_abs,
+		[OP_LD_W_IND] = &&op_ld_w_ind,
+		[OP_LD_H_IND] = &&op_ld_h_ind,
+		[OP_LD_B_IND] = &&op_ld_b_ind,
+		[OP_LD_LEN] = &&op_ld_len,
+		[OP_LDX_LEN] = &&op_ldx_len,
+		[OP_LDX_MSH] = &&op_ldx_msh,
+		[OP_LD_IMM] = &&op_ld_imm,
+		[OP_LDX_IMM] = &&op_ldx_imm,
+		[OP_LD_MEM] = &&op_ld_mem,
+		[OP_LDX_MEM] = &&op_ldx_mem,
+		[OP_ST] = &&op_st,
+		[OP_STX] = &&op_stx,
+		[OP_JA] = &&op_ja,
+		[OP_JGT_K] = &&op_jgt_k,
+		[OP_JGE_K] = &&op_jge_k,
+		[OP_JEQ_K] = &&op_jeq_k,
+		[OP_JSET_K] = &&op_jset_k,
+		[OP_JGT_X] = &&op_jgt_x,
+		[OP_JGE_X] = &&op_jge_x,
+		[OP_JEQ_X] = &&op_jeq_x,
+		[OP_JSET_X] = &&op_jset_x,
+		[OP_ADD_X] = &&op_add_x,
+		[OP_SUB_X] = &&op_sub_x,
+		[OP_MUL_X] = &&op_mul_x,
+		[OP_DIV_X] = &&op_div_x,
+		[OP_AND_X] = &&op_and_x,
+		[OP_OR_X] = &&op_or_x,
+		[OP_LSH_X] = &&op_lsh_x,
+		[OP_RSH_X] = &&op_rsh_x,
+		[OP_ADD_K] = &&op_add_k,
+		[OP_SUB_K] = &&op_sub_k,
+		[OP_MUL_K] = &&op_mul_k,
+		[OP_DIV_K] = &&op_div_k,
+		[OP_AND_K] = &&op_and_k,
+		[OP_OR_K] = &&op_or_k,
+		[OP_LSH_K] = &&op_lsh_k,
+		[OP_RSH_K] = &&op_rsh_k,
+		[OP_NEG] = &&op_neg,
+		[OP_TAX] = &&op_tax,
+		[OP_TXA] = &&op_txa,
+	};
+	const struct bpf_op *prog = infp->prog, *pc = prog;
 	unsigned int buflen;
 
 	unsigned int A, X;
@@ -73,268 +229,258 @@ bpf_do_filter(net_rcv_port_t infp, char *p,	unsigned int wirelen,
 	/* Generic pointer to either HEADER or P according to the specified offset. */
 	char *data = NULL;
 
-	pc = ((bpf_insn_t) infp->filter) + 1;
-	/* filter[0].code is (NETF_BPF | flags) */
-	pc_end = (bpf_insn_t)infp->filter_end;
+#define NEXT		goto *handlers[(++pc)->op]
+#define JUMP(n)		do { pc = &prog[n]; goto *handlers[pc->op]; } while (0)
+
 	buflen = NET_RCV_MAX;
 	*entpp = 0;			/* default */
 
 	A = 0;
 	X = 0;
-	for (; pc < pc_end; ++pc) {
-		switch (pc->code) {
+	goto *handlers[pc->op];
 
-			default:
-				// Unknown instruction, abort
-				return 0;
-			case BPF_RET|BPF_K:
-				if (infp->rcv_port == MACH_PORT_NULL &&
-						*entpp == 0) {
-					return 0;
-				}
-				return ((u_int)pc->k <= wirelen) ?
-					pc->k : wirelen;
+op_abort:
+	// Unknown instruction, abort
+	return 0;
 
-			case BPF_RET|BPF_A:
-				if (infp->rcv_port == MACH_PORT_NULL &&
-						*entpp == 0) {
-					return 0;
-				}
-				return ((u_int)A <= wirelen) ?
-					A : wirelen;
-
-			case BPF_RET|BPF_MATCH_IMM:
-				if (bpf_match ((net_hash_header_t)infp, pc->jt, mem,
-							hash_headpp, entpp)) {
-					return ((u_int)pc->k <= wirelen) ?
-						pc->k : wirelen;
-				}
-				return 0;
+op_ret_k:
+	if (infp->rcv_port == MACH_PORT_NULL &&
+			*entpp == 0) {
+		return 0;
+	}
+	return ((u_int)pc->k <= wirelen) ?
+		pc->k : wirelen;
 
-			case BPF_LD|BPF_W|BPF_ABS:
-				k = pc->k;
+op_ret_a:
+	if (infp->rcv_port == MACH_PORT_NULL &&
+			*entpp == 0) {
+		return 0;
+	}
+	return ((u_int)A <= wirelen) ?
+		A : wirelen;
+
+op_ret_match:
+	if (bpf_match ((net_hash_header_t)infp, pc->jt, mem,
+				hash_headpp, entpp)) {
+		return ((u_int)pc->k <= wirelen) ?
+			pc->k : wirelen;
+	}
+	return 0;
+
+op_ld_w_abs:
+	k = pc->k;
 
 load_word:
-				if ((u_int)k + sizeof(int) <= hlen)
-					data = header;
-				else if ((u_int)k + sizeof(int) <= buflen) {
-					k -= hlen;
-					data = p;
-				} else
-					return 0;
+	if ((u_int)k + sizeof(int) <= hlen)
+		data = header;
+	else if ((u_int)k + sizeof(int) <= buflen) {
+		k -= hlen;
+		data = p;
+	} else
+		return 0;
 
 #ifdef BPF_ALIGN
-				if (((int)(data + k) & 3) != 0)
-					A = EXTRACT_LONG(&data[k]);
-				else
+	if (((int)(data + k) & 3) != 0)
+		A = EXTRACT_LONG(&data[k]);
+	else
 #endif
-					A = ntohl(*(int *)(data + k));
-				continue;
+		A = ntohl(*(int *)(data + k));
+	NEXT;
 
-			case BPF_LD|BPF_H|BPF_ABS:
-				k = pc->k;
+op_ld_h_abs:
+	k = pc->k;
 
 load_half:
-				if ((u_int)k + sizeof(short) <= hlen)
-					data = header;
-				else if ((u_int)k + sizeof(short) <= buflen) {
-					k -= hlen;
-					data = p;
-				} else
-					return 0;
+	if ((u_int)k + sizeof(short) <= hlen)
+		data = header;
+	else if ((u_int)k + sizeof(short) <= buflen) {
+		k -= hlen;
+		data = p;
+	} else
+		return 0;
 
-				A = EXTRACT_SHORT(&data[k]);
-				continue;
+	A = EXTRACT_SHORT(&data[k]);
+	NEXT;
 
-			case BPF_LD|BPF_B|BPF_ABS:
-				k = pc->k;
+op_ld_b_abs:
+	k = pc->k;
 
 load_byte:
-				if ((u_int)k < hlen)
-					data = header;
-				else if ((u_int)k < buflen) {
-					data = p;
-					k -= hlen;
-				} else
-					return 0;
-
-				A = data[k];
-				continue;
-
-			case BPF_LD|BPF_W|BPF_LEN:
-				A = wirelen;
-				continue;
-
-			case BPF_LDX|BPF_W|BPF_LEN:
-				X = wirelen;
-				continue;
+	if ((u_int)k < hlen)
+		data = header;
+	else if ((u_int)k < buflen) {
+		data = p;
+		k -= hlen;
+	} else
+		return 0;
 
-			case BPF_LD|BPF_W|BPF_IND:
-				k = X + pc->k;
-				goto load_word;
-
-			case BPF_LD|BPF_H|BPF_IND:
-				k = X + pc->k;
-				goto load_half;
-
-			case BPF_LD|BPF_B|BPF_IND:
-				k = X + pc->k;
-				goto load_byte;
-
-			case BPF_LDX|BPF_MSH|BPF_B:
-				k = pc->k;
-				if (k < hlen)
-					data = header;
-				else if (k < buflen) {
-					data = p;
-					k -= hlen;
-				} else
-					return 0;
+	A = data[k];
+	NEXT;
+
+op_ld_len:
+	A = wirelen;
+	NEXT;
+
+op_ldx_len:
+	X = wirelen;
+	NEXT;
+
+op_ld_w_ind:
+	k = X + pc->k;
+	goto load_word;
+
+op_ld_h_ind:
+	k = X + pc->k;
+	goto load_half;
+
+op_ld_b_ind:
+	k = X + pc->k;
+	goto load_byte;
+
+op_ldx_msh:
+	k = pc->k;
+	if (k < hlen)
+		data = header;
+	else if (k < buflen) {
+		data = p;
+		k -= hlen;
+	} else
+		return 0;
 
-				X = (data[k] & 0xf) << 2;
-				continue;
+	X = (data[k] & 0xf) << 2;
+	NEXT;
 
-			case BPF_LD|BPF_IMM:
-				A = pc->k;
-				continue;
+op_ld_imm:
+	A = pc->k;
+	NEXT;
 
-			case BPF_LDX|BPF_IMM:
-				X = pc->k;
-				continue;
+op_ldx_imm:
+	X = pc->k;
+	NEXT;
 
-			case BPF_LD|BPF_MEM:
-				A = mem[pc->k];
-				continue;
+op_ld_mem:
+	A = mem[pc->k];
+	NEXT;
 
-			case BPF_LDX|BPF_MEM:
-				X = mem[pc->k];
-				continue;
+op_ldx_mem:
+	X = mem[pc->k];
+	NEXT;
 
-			case BPF_ST:
-				mem[pc->k] = A;
-				continue;
+op_st:
+	mem[pc->k] = A;
+	NEXT;
 
-			case BPF_STX:
-				mem[pc->k] = X;
-				continue;
+op_stx:
+	mem[pc->k] = X;
+	NEXT;
 
-			case BPF_JMP|BPF_JA:
-				pc += pc->k;
-				continue;
+op_ja:
+	JUMP (pc->jt);
 
-			case BPF_JMP|BPF_JGT|BPF_K:
-				pc += (A > pc->k) ? pc->jt : pc->jf;
-				continue;
+op_jgt_k:
+	JUMP ((A > pc->k) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JGE|BPF_K:
-				pc += (A >= pc->k) ? pc->jt : pc->jf;
-				continue;
+op_jge_k:
+	JUMP ((A >= pc->k) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JEQ|BPF_K:
-				pc += (A == pc->k) ? pc->jt : pc->jf;
-				continue;
+op_jeq_k:
+	JUMP ((A == pc->k) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JSET|BPF_K:
-				pc += (A & pc->k) ? pc->jt : pc->jf;
-				continue;
+op_jset_k:
+	JUMP ((A & pc->k) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JGT|BPF_X:
-				pc += (A > X) ? pc->jt : pc->jf;
-				continue;
+op_jgt_x:
+	JUMP ((A > X) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JGE|BPF_X:
-				pc += (A >= X) ? pc->jt : pc->jf;
-				continue;
+op_jge_x:
+	JUMP ((A >= X) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JEQ|BPF_X:
-				pc += (A == X) ? pc->jt : pc->jf;
-				continue;
+op_jeq_x:
+	JUMP ((A == X) ? pc->jt : pc->jf);
 
-			case BPF_JMP|BPF_JSET|BPF_X:
-				pc += (A & X) ? pc->jt : pc->jf;
-				continue;
+op_jset_x:
+	JUMP ((A & X) ? pc->jt : pc->jf);
 
-			case BPF_ALU|BPF_ADD|BPF_X:
-				A += X;
-				continue;
+op_add_x:
+	A += X;
+	NEXT;
 
-			case BPF_ALU|BPF_SUB|BPF_X:
-				A -= X;
-				continue;
+op_sub_x:
+	A -= X;
+	NEXT;
 
-			case BPF_ALU|BPF_MUL|BPF_X:
-				A *= X;
-				continue;
+op_mul_x:
+	A *= X;
+	NEXT;
 
-			case BPF_ALU|BPF_DIV|BPF_X:
-				if (X == 0)
-					return 0;
-				A /= X;
-				continue;
+op_div_x:
+	if (X == 0)
+		return 0;
+	A /= X;
+	NEXT;
 
-			case BPF_ALU|BPF_AND|BPF_X:
-				A &= X;
-				continue;
+op_and_x:
+	A &= X;
+	NEXT;
 
-			case BPF_ALU|BPF_OR|BPF_X:
-				A |= X;
-				continue;
+op_or_x:
+	A |= X;
+	NEXT;
 
-			case BPF_ALU|BPF_LSH|BPF_X:
-				A <<= X;
-				continue;
+op_lsh_x:
+	A <<= X;
+	NEXT;
 
-			case BPF_ALU|BPF_RSH|BPF_X:
-				A >>= X;
-				continue;
+op_rsh_x:
+	A >>= X;
+	NEXT;
 
-			case BPF_ALU|BPF_ADD|BPF_K:
-				A += pc->k;
-				continue;
+op_add_k:
+	A += pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_SUB|BPF_K:
-				A -= pc->k;
-				continue;
+op_sub_k:
+	A -= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_MUL|BPF_K:
-				A *= pc->k;
-				continue;
+op_mul_k:
+	A *= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_DIV|BPF_K:
-				A /= pc->k;
-				continue;
+op_div_k:
+	A /= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_AND|BPF_K:
-				A &= pc->k;
-				continue;
+op_and_k:
+	A &= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_OR|BPF_K:
-				A |= pc->k;
-				continue;
+op_or_k:
+	A |= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_LSH|BPF_K:
-				A <<= pc->k;
-				continue;
+op_lsh_k:
+	A <<= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_RSH|BPF_K:
-				A >>= pc->k;
-				continue;
+op_rsh_k:
+	A >>= pc->k;
+	NEXT;
 
-			case BPF_ALU|BPF_NEG:
-				A = -A;
-				continue;
+op_neg:
+	A = -A;
+	NEXT;
 
-			case BPF_MISC|BPF_TAX:
-				X = A;
-				continue;
+op_tax:
+	X = A;
+	NEXT;
 
-			case BPF_MISC|BPF_TXA:
-				A = X;
-				continue;
-		}
-	}
+op_txa:
+	A = X;
+	NEXT;
 
-	return 0;
+#undef NEXT
+#undef JUMP
 }
 
 /*
@@ -590,7 +736,7 @@ net_set_filter(if_filter_list_t *ifp, mach_port_t rcv_port, int priority,
 	filter_bytes = CSPF_BYTES (filter_count);
 	match = (bpf_insn_t) 0;
 
-	if (filter_count == 0) {
+	if (filter_count == 0 || filter_count > NET_MAX_FILTER) {
 		return (D_INVALID_OPERATION);
 	} else if (!((filter[0] & NETF_IN) || (filter[0] & NETF_OUT))) {
 		return (D_INVALID_OPERATION); /* NETF_IN or NETF_OUT required */
@@ -740,6 +886,7 @@ hash_loop_end:
 		memcpy (my_infp->filter, filter, filter_bytes);
 		my_infp->filter_end =
 			(filter_t *)((char *)my_infp->filter + filter_bytes);
+		bpf_decode (my_infp);
 
 		/* Insert my_infp according to priority */
 		if (in) {
@@ -92,6 +92,20 @@ typedef filter_t	*filter_array_t;
 
 #define CSPF_BYTES(n) ((n) * sizeof (filter_t))
 
+/* The most instructions a filter program has room for.  */
+#define NET_MAX_BPF_INSNS	(CSPF_BYTES (NET_MAX_FILTER) / sizeof (struct bpf_insn))
+
+/*
+ * A BPF instruction as decoded by net_set_filter, jumps giving the
+ * index of their target.
+ */
+struct bpf_op {
+	unsigned short	op;
+	unsigned short	jt;
+	unsigned short	jf;
+	int		k;
+};
+
 /*
  * Receive port for net, with packet filter.
  * This data structure by itself represents a packet
@@ -106,6 +120,8 @@ struct net_rcv_port {
 	filter_t	*filter_end;	/* pointer to end of filter */
 	filter_t	filter[NET_MAX_FILTER];
 	/* filter operations */
+	struct bpf_op	prog[NET_MAX_BPF_INSNS];
+	/* the same, decoded for bpf_do_filter */
 };
 typedef struct net_rcv_port *net_rcv_port_t;
 
@@ -22,6 +22,7 @@
 #define _HURD_CONS_H
 
 #include <dirent.h>
+#include <time.h>
 
 #include <hurd/ports.h>
 #include <mach.h>
@@ -106,6 +107,20 @@ struct vcons
   } state;
 
   uint32_t scrolling;
+
+  /* For redrawing the changes at a bounded rate, see vcons-redraw.c.
+     DRAWN_LINE is the display line shown at the top when the screen
+     was last drawn, and DIRTY has a bit for each line of the matrix
+     changed since then, DIRTY_LINES in all; if DIRTY_ALL is set, all of
+     them are.  */
+  uint32_t drawn_line;
+  uint32_t *dirty;
+  uint32_t dirty_lines;
+  int dirty_all;
+  int redraw_pending;
+  int redraw_queued;
+  vcons_t redraw_next;
+  struct timespec redraw_time;
 };
 
 struct cons
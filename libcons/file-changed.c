@@ -94,15 +94,14 @@ cons_S_file_changed (cons_notify_t notify, natural_t tickno,
 		    /* The cursor was visible before.  */
 		    cons_vcons_set_cursor_status (vcons, CONS_CURSOR_INVISIBLE);
 
-		  _cons_vcons_console_event (vcons, CONS_EVT_OUTPUT);
-		  cons_vcons_update (vcons);
+		  vcons->redraw_pending = 1;
 		}
 	      if (change.what.cursor_status)
 		{
 		  vcons->state.cursor.status = vcons->display->cursor.status;
 		  cons_vcons_set_cursor_status (vcons,
 						vcons->state.cursor.status);
-		  cons_vcons_update (vcons);
+		  vcons->redraw_pending = 1;
 		}
 	      if (change.what.screen_cur_line)
 		{
@@ -112,13 +111,8 @@ cons_S_file_changed (cons_notify_t notify, natural_t tickno,
 
 		  if (new_cur_line != vcons->state.screen.cur_line)
 		    {
-		      off_t size = vcons->state.screen.width
-			* vcons->state.screen.lines;
-		      off_t vis_start;
 		      uint32_t scrolling;
-		      off_t start;
-		      off_t end;
-		      
+
 		      if (new_cur_line > vcons->state.screen.cur_line)
 			scrolling = new_cur_line
 			  - vcons->state.screen.cur_line;
@@ -137,59 +131,16 @@ cons_S_file_changed (cons_notify_t notify, natural_t tickno,
 			    {
 			      if (vcons->scrolling + scrolling
 				  <= vcons->state.screen.scr_lines)
-				{
-				  vcons->scrolling += scrolling;
-				  scrolling = 0;
-				}
+				vcons->scrolling += scrolling;
 			      else
-				{
-				  scrolling -= vcons->state.screen.scr_lines
-				    - vcons->scrolling;
-				  vcons->scrolling
-				    = vcons->state.screen.scr_lines;
-				}
+				vcons->scrolling
+				  = vcons->state.screen.scr_lines;
 			    }
 			}
 
-		      if (scrolling)
-			{
-			  uint32_t cur_disp_line;
-
-			  if (new_cur_line >= vcons->scrolling)
-			    cur_disp_line = new_cur_line - vcons->scrolling;
-			  else
-			    cur_disp_line = (UINT32_MAX - (vcons->scrolling - new_cur_line)) + 1;
-
-			  if (scrolling > vcons->state.screen.height)
-			    scrolling = vcons->state.screen.height;
-			  if (scrolling < vcons->state.screen.height)
-			    cons_vcons_scroll (vcons, scrolling);
-			  else
-			    cons_vcons_clear (vcons, vcons->state.screen.width
-					      * vcons->state.screen.height,
-					      0, 0);
-			  vis_start = vcons->state.screen.width
-			    * (cur_disp_line % vcons->state.screen.lines);
-			  start = (((cur_disp_line % vcons->state.screen.lines)
-				    + vcons->state.screen.height - scrolling)
-				   * vcons->state.screen.width) % size;
-			  end = start + scrolling * vcons->state.screen.width - 1;
-			  cons_vcons_write (vcons,
-					    vcons->state.screen.matrix + start,
-					    end < size
-					    ? end - start + 1 
-					    : size - start,
-					    0, vcons->state.screen.height
-					    - scrolling);
-			  if (end >= size)
-			    cons_vcons_write (vcons,
-					      vcons->state.screen.matrix,
-					      end - size + 1,
-					      0, (size - vis_start)
-					      / vcons->state.screen.width);
-			  _cons_vcons_console_event (vcons, CONS_EVT_OUTPUT);
-			  cons_vcons_update (vcons);
-			}
+		      /* The redraw scrolls the screen, and draws the lines
+			 coming in.  */
+		      vcons->redraw_pending = 1;
 		      vcons->state.screen.cur_line = new_cur_line;
 		    }
 		}
@@ -237,119 +188,14 @@ cons_S_file_changed (cons_notify_t notify, natural_t tickno,
 	    }
 	  else
 	    {
-	      /* For clipping.  */
-	      off_t size = vcons->state.screen.width*vcons->state.screen.lines;
-	      off_t rotate;
-	      off_t vis_end = vcons->state.screen.height
-		* vcons->state.screen.width - 1;
-	      off_t end2 = -1;
-	      off_t start_rel = 0;    /* start relative to visible start.  */
-	      off_t start = change.matrix.start;
-	      off_t end = change.matrix.end;
-
 	      if (vcons->scrolling && _cons_jump_down_on_output)
 		_cons_vcons_scrollback (vcons, CONS_SCROLL_ABSOLUTE_LINE, 0);
 
-	      if (vcons->state.screen.cur_line >= vcons->scrolling)
-		rotate = vcons->state.screen.cur_line - vcons->scrolling;
-	      else
-		rotate = (UINT32_MAX - (vcons->scrolling - vcons->state.screen.cur_line)) + 1;
-	      rotate = vcons->state.screen.width * (rotate % vcons->state.screen.lines);
-
-	      /* Rotate the buffer.  */
-	      start -= rotate;
-	      if (start < 0)
-		start += size;
-	      end -= rotate;
-	      if (end < 0)
-		end += size;
-	      
-	      /* Find the intersection.  */
-	      if (start > vis_end)
-		{
-		  if (end < start)
-		    {
-		      start = 0;
-		      if (vis_end < end)
-			end = vis_end;
-		    }
-		  else
-		    start = -1;
-		}
-	      else
-		{
-		  if (end >= start)
-		    {
-		      if (end > vis_end)
-			end = vis_end;
-		    }
-		  else
-		    {
-		      end2 = end;
-		      end = vis_end;
-		    }
-		}
-	      /* We now have three cases: No intersection if start ==
-		 -1, one intersection [start;end] if end2 == -1, and
-		 two intersections [start;end] and [0;end2] if end2 !=
-		 -1.  However, we still have to undo the buffer
-		 rotation.  */
-	      if (start != -1)
-		{
-		  start_rel = start;
-		  start += rotate;
-		  if (start >= size)
-		    start -= size;
-		  end += rotate;
-		  if (end >= size)
-		    end -= size;
-		  if (start > end)
-		    end += size;
-		}
-	      if (end2 != -1)
-		/* The interval should be [vis_start:end2].  */
-		end2 += rotate;
-	      
-	      if (start != -1)
-		{
-		  cons_vcons_clear (vcons, end - start + 1,
-				    start_rel % vcons->state.screen.width,
-				    start_rel / vcons->state.screen.width);
-		  cons_vcons_write (vcons, vcons->state.screen.matrix + start,
-				    end < size
-				    ? end - start + 1
-				    : size - start,
-				    start_rel % vcons->state.screen.width,
-				    start_rel / vcons->state.screen.width);
-		  if (end >= size)
-		    cons_vcons_write (vcons, vcons->state.screen.matrix,
-				      end - size + 1,
-				      (size - rotate)
-				      % vcons->state.screen.width,
-				      (size - rotate)
-				      / vcons->state.screen.width);
-		  if (end2 != -1)
-		    {
-		      cons_vcons_clear (vcons, end2 - rotate + 1, 0, 0);
-		      cons_vcons_write (vcons,
-					vcons->state.screen.matrix + rotate,
-					end2 < size
-					? end2 - rotate + 1
-					: size - rotate,
-					0, 0);
-		      if (end2 >= size)
-			cons_vcons_write (vcons, vcons->state.screen.matrix,
-					  end2 - size + 1,
-					  (size - rotate)
-					  % vcons->state.screen.width,
-					  (size - rotate)
-					  / vcons->state.screen.width);
-		    }
-		  _cons_vcons_console_event (vcons, CONS_EVT_OUTPUT);
-		  cons_vcons_update (vcons);
-		}
+	      _cons_vcons_mark_dirty (vcons, change.matrix.start,
+				      change.matrix.end);
 	    }
 	}
+      _cons_vcons_schedule_redraw (vcons);
       break;
     case FILE_CHANGED_EXTEND:
       /* File has grown.  */
@@ -71,6 +71,26 @@ error_t _cons_vcons_input (vcons_t vcons, char *buf, size_t size);
 /* Generate the console event EVENT for console VCONS.  */
 void _cons_vcons_console_event (vcons_t vcons, int event);
 
+/* Mark the positions START to END of the screen matrix of VCONS as
+   changed, to be drawn by the next redraw.  END is before START if
+   the change wraps around the end of the matrix.  */
+void _cons_vcons_mark_dirty (vcons_t vcons, off_t start, off_t end);
+
+/* Draw on VCONS what changed and how far it scrolled since the last
+   redraw, or moved in the scrollback buffer, without updating the
+   display.  VCONS is locked.  */
+void _cons_vcons_draw (vcons_t vcons);
+
+/* Like _cons_vcons_draw, but update the display too.  */
+void _cons_vcons_redraw (vcons_t vcons);
+
+/* Have _cons_vcons_redraw called for VCONS, which is locked, soon, but
+   not more often than a few dozen times a second.  */
+void _cons_vcons_schedule_redraw (vcons_t vcons);
+
+/* All of VCONS, which is locked, has just been drawn as it is now.  */
+void _cons_vcons_redrawn (vcons_t vcons);
+
 
 /* Called by MiG to translate ports into cons_notify_t.  mutations.h
    arranges for this to happen for the fs_notify interfaces. */
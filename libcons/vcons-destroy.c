@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/fcntl.h>
 
@@ -49,4 +50,6 @@ cons_vcons_destroy (void *port)
       munmap (vcons->display, vcons->display_size);
       vcons->display = MAP_FAILED;
     }
+  free (vcons->dirty);
+  vcons->dirty = NULL;
 }
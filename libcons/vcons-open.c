@@ -60,6 +60,15 @@ cons_vcons_open (cons_t cons, vcons_list_t vcons_entry, vcons_t *r_vcons)
   vcons->input = -1;
   vcons->display = MAP_FAILED;
   vcons->scrolling = 0;
+  vcons->drawn_line = 0;
+  vcons->dirty = NULL;
+  vcons->dirty_lines = 0;
+  vcons->dirty_all = 0;
+  vcons->redraw_pending = 0;
+  vcons->redraw_queued = 0;
+  vcons->redraw_next = NULL;
+  vcons->redraw_time.tv_sec = 0;
+  vcons->redraw_time.tv_nsec = 0;
 
   /* Open the directory port of the virtual console.  */
   vconsp = file_name_lookup_under (cons->dirport, name,
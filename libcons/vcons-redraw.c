@@ -0,0 +1,284 @@
+/* vcons-redraw.c - Redraw the changed parts of a virtual console.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cons.h"
+#include "priv.h"
+
+/* A program writing fast to the console makes the server report many
+   small changes, each a line or a scroll by one line.  Rather than
+   drawing each at once, the lines of the screen matrix that changed are
+   marked, and how far the screen scrolled is worked out from the line
+   shown at the top when it was last drawn.  The screen is then drawn at
+   most every REDRAW_INTERVAL: scrolled at once by as much as it needs
+   to, and each run of changed lines in view written once.
+
+   Moving through the scrollback buffer is drawn the same way, at once:
+   the matrix holds the history as a ring of lines, so a move only
+   changes the line at the top of the view, and only the lines it
+   brings in are written, however long the history is.  */
+
+/* In nanoseconds; 50 frames a second.  */
+#define REDRAW_INTERVAL 20000000
+
+/* The virtual consoles waiting for the redraw thread, linked by
+   REDRAW_NEXT and each with a reference.  */
+static vcons_t redraw_queue;
+static pthread_mutex_t redraw_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t redraw_wakeup = PTHREAD_COND_INITIALIZER;
+static int redraw_thread_started;
+
+/* The display line of VCONS shown at the top of the screen.  */
+static inline uint32_t
+top_line (vcons_t vcons)
+{
+  /* Unsigned arithmetic wraps like the server's line count.  */
+  return vcons->state.screen.cur_line - vcons->scrolling;
+}
+
+static inline int
+line_dirty_p (vcons_t vcons, uint32_t line)
+{
+  return (vcons->dirty_all
+	  || (vcons->dirty[line / 32] & (1U << (line % 32))));
+}
+
+static inline void
+mark_line (vcons_t vcons, uint32_t line)
+{
+  if (! vcons->dirty_all)
+    vcons->dirty[line / 32] |= 1U << (line % 32);
+}
+
+/* Make sure VCONS has room to mark each line of its matrix; if there is
+   no memory, everything is redrawn instead.  */
+static void
+ensure_dirty_map (vcons_t vcons)
+{
+  uint32_t words = (vcons->state.screen.lines + 31) / 32;
+
+  if (vcons->dirty && vcons->dirty_lines == vcons->state.screen.lines)
+    return;
+
+  free (vcons->dirty);
+  vcons->dirty = calloc (words, sizeof *vcons->dirty);
+  vcons->dirty_lines = vcons->dirty ? vcons->state.screen.lines : 0;
+  if (! vcons->dirty)
+    vcons->dirty_all = 1;
+}
+
+void
+_cons_vcons_mark_dirty (vcons_t vcons, off_t start, off_t end)
+{
+  uint32_t width = vcons->state.screen.width;
+  uint32_t lines = vcons->state.screen.lines;
+  uint32_t line, last;
+
+  ensure_dirty_map (vcons);
+  vcons->redraw_pending = 1;
+  if (vcons->dirty_all || start < 0 || end < 0)
+    return;
+
+  line = (start / width) % lines;
+  last = (end / width) % lines;
+  for (;;)
+    {
+      mark_line (vcons, line);
+      if (line == last)
+	break;
+      line = (line + 1) % lines;
+    }
+}
+
+void
+_cons_vcons_draw (vcons_t vcons)
+{
+  uint32_t width = vcons->state.screen.width;
+  uint32_t height = vcons->state.screen.height;
+  uint32_t lines = vcons->state.screen.lines;
+  uint32_t top = top_line (vcons);
+  /* Unsigned arithmetic wraps, so this is negative for a move back.  */
+  int32_t delta = (int32_t) (top - vcons->drawn_line);
+  uint32_t row;
+
+  if (! vcons->redraw_pending)
+    return;
+  ensure_dirty_map (vcons);
+
+  if (delta > 0 && (uint32_t) delta < height)
+    {
+      /* The screen moved up by DELTA lines; the lines coming in at the
+	 bottom need drawing.  */
+      cons_vcons_scroll (vcons, delta);
+      for (row = height - delta; row < height; row++)
+	mark_line (vcons, (top + row) % lines);
+    }
+  else if (delta < 0 && (uint32_t) -delta < height)
+    {
+      /* The screen moved down by -DELTA lines, back into the scrollback
+	 buffer; the lines coming in at the top need drawing.  */
+      cons_vcons_scroll (vcons, delta);
+      for (row = 0; row < (uint32_t) -delta; row++)
+	mark_line (vcons, (top + row) % lines);
+    }
+  else if (delta != 0)
+    {
+      /* Too far; nothing on the screen can be kept.  */
+      cons_vcons_clear (vcons, width * height, 0, 0);
+      vcons->dirty_all = 1;
+    }
+
+  /* Write the runs of changed lines; a run ends where the matrix
+     wraps.  */
+  row = 0;
+  while (row < height)
+    {
+      uint32_t line = (top + row) % lines;
+      uint32_t n = 0;
+
+      while (row + n < height && line + n < lines
+	     && line_dirty_p (vcons, line + n))
+	n++;
+      if (n == 0)
+	{
+	  row++;
+	  continue;
+	}
+
+      cons_vcons_clear (vcons, n * width, 0, row);
+      cons_vcons_write (vcons, vcons->state.screen.matrix + line * width,
+			n * width, 0, row);
+      row += n;
+    }
+
+  if (vcons->dirty)
+    memset (vcons->dirty, 0, (vcons->dirty_lines + 31) / 32
+	    * sizeof *vcons->dirty);
+  vcons->dirty_all = vcons->dirty == NULL;
+  vcons->drawn_line = top;
+  vcons->redraw_pending = 0;
+  clock_gettime (CLOCK_MONOTONIC, &vcons->redraw_time);
+}
+
+void
+_cons_vcons_redraw (vcons_t vcons)
+{
+  if (! vcons->redraw_pending)
+    return;
+
+  _cons_vcons_draw (vcons);
+  _cons_vcons_console_event (vcons, CONS_EVT_OUTPUT);
+  cons_vcons_update (vcons);
+}
+
+void
+_cons_vcons_redrawn (vcons_t vcons)
+{
+  if (vcons->dirty)
+    memset (vcons->dirty, 0, (vcons->dirty_lines + 31) / 32
+	    * sizeof *vcons->dirty);
+  vcons->dirty_all = vcons->dirty == NULL;
+  vcons->drawn_line = top_line (vcons);
+}
+
+static void *
+redraw_thread (void *arg)
+{
+  struct timespec interval = { 0, REDRAW_INTERVAL };
+
+  for (;;)
+    {
+      vcons_t vcons;
+
+      pthread_mutex_lock (&redraw_lock);
+      while (! redraw_queue)
+	pthread_cond_wait (&redraw_wakeup, &redraw_lock);
+      pthread_mutex_unlock (&redraw_lock);
+
+      /* Let the changes of a frame gather.  */
+      nanosleep (&interval, NULL);
+
+      pthread_mutex_lock (&redraw_lock);
+      vcons = redraw_queue;
+      redraw_queue = NULL;
+      pthread_mutex_unlock (&redraw_lock);
+
+      while (vcons)
+	{
+	  vcons_t next;
+
+	  pthread_mutex_lock (&vcons->lock);
+	  next = vcons->redraw_next;
+	  vcons->redraw_queued = 0;
+	  _cons_vcons_redraw (vcons);
+	  pthread_mutex_unlock (&vcons->lock);
+	  ports_port_deref (vcons);
+	  vcons = next;
+	}
+    }
+
+  return NULL;
+}
+
+void
+_cons_vcons_schedule_redraw (vcons_t vcons)
+{
+  struct timespec now;
+  int64_t since;
+
+  if (! vcons->redraw_pending || vcons->redraw_queued)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  since = (int64_t) (now.tv_sec - vcons->redraw_time.tv_sec) * 1000000000
+    + (now.tv_nsec - vcons->redraw_time.tv_nsec);
+  if (since >= REDRAW_INTERVAL)
+    {
+      /* Nothing was drawn for a while; the first change after a pause
+	 shows at once.  */
+      _cons_vcons_redraw (vcons);
+      return;
+    }
+
+  pthread_mutex_lock (&redraw_lock);
+  if (! redraw_thread_started)
+    {
+      pthread_t thread;
+
+      if (pthread_create (&thread, NULL, redraw_thread, NULL))
+	{
+	  pthread_mutex_unlock (&redraw_lock);
+	  _cons_vcons_redraw (vcons);
+	  return;
+	}
+      pthread_detach (thread);
+      redraw_thread_started = 1;
+    }
+  ports_port_ref (vcons);
+  vcons->redraw_queued = 1;
+  vcons->redraw_next = redraw_queue;
+  redraw_queue = vcons;
+  pthread_cond_signal (&redraw_wakeup);
+  pthread_mutex_unlock (&redraw_lock);
+}
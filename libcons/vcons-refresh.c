@@ -71,6 +71,8 @@ cons_vcons_refresh (vcons_t vcons)
   cons_vcons_set_cursor_status (vcons, vcons->state.cursor.status);
   cons_vcons_set_scroll_lock (vcons, vcons->state.flags
 			      & CONS_FLAGS_SCROLL_LOCK);
+  _cons_vcons_redrawn (vcons);
+  vcons->redraw_pending = 0;
   _cons_vcons_console_event (vcons, CONS_EVT_OUTPUT);
   cons_vcons_update (vcons);
 }
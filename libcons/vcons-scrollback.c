@@ -62,60 +62,6 @@ _cons_vcons_scrollback (vcons_t vcons, cons_scroll_t type, float value)
   if (new_scr == vcons->scrolling)
     return 0;
 
-  scrolling = vcons->scrolling - new_scr;
-  {
-    uint32_t new_cur_line;
-    off_t size = vcons->state.screen.width
-      * vcons->state.screen.lines;
-    off_t vis_start;
-    off_t start;
-    off_t end;
-
-    if (vcons->state.screen.cur_line >= new_scr)
-      new_cur_line = vcons->state.screen.cur_line - new_scr;
-    else
-      new_cur_line = (UINT32_MAX - (new_scr - vcons->state.screen.cur_line)) + 1;
-
-    if (scrolling > 0 && (uint32_t) scrolling > vcons->state.screen.height)
-      scrolling = vcons->state.screen.height;
-    else if (scrolling < 0
-	     && (uint32_t) (-scrolling) > vcons->state.screen.height)
-      scrolling = -vcons->state.screen.height;
-    if ((scrolling > 0 && scrolling < vcons->state.screen.height)
-	|| (scrolling < 0
-	    && (uint32_t) (-scrolling) < vcons->state.screen.height))
-      cons_vcons_scroll (vcons, scrolling);
-    else if ((scrolling > 0 && scrolling == vcons->state.screen.height)
-	|| (scrolling < 0
-	    && (uint32_t) (-scrolling) == vcons->state.screen.height))
-      cons_vcons_clear (vcons, vcons->state.screen.width
-			* vcons->state.screen.height, 0, 0);
-
-    vis_start = vcons->state.screen.width
-      * (new_cur_line % vcons->state.screen.lines);
-    if (scrolling > 0)
-      start = (((new_cur_line % vcons->state.screen.lines)
-		+ vcons->state.screen.height - scrolling)
-	       * vcons->state.screen.width) % size;
-    else
-      start = vis_start;
-    end = start + abs (scrolling) * vcons->state.screen.width - 1;
-
-    cons_vcons_write (vcons,
-		      vcons->state.screen.matrix + start,
-		      end < size
-		      ? end - start + 1 
-		      : size - start,
-		      0, (scrolling > 0)
-		      ? vcons->state.screen.height - scrolling : 0);
-    if (end >= size)
-      cons_vcons_write (vcons,
-			vcons->state.screen.matrix,
-			end - size + 1,
-			0, (size - vis_start)
-			/ vcons->state.screen.width);
-  }
-
   /* Set the new cursor position.  */
   {
     uint32_t row = vcons->state.cursor.row;
@@ -134,9 +80,14 @@ _cons_vcons_scrollback (vcons_t vcons, cons_scroll_t type, float value)
       cons_vcons_set_cursor_status (vcons, CONS_CURSOR_INVISIBLE);
   }
 
-  vcons->scrolling -= scrolling;
+  /* What stays in view is scrolled, and only the lines that come into
+     view are written, along with any changes not drawn yet.  */
+  scrolling = new_scr - vcons->scrolling;
+  vcons->scrolling = new_scr;
+  vcons->redraw_pending = 1;
+  _cons_vcons_draw (vcons);
 
-  return -scrolling;
+  return scrolling;
 }
 
 /* Scroll back into the history of VCONS.  If TYPE is
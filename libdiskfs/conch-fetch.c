@@ -17,6 +17,7 @@
 
 #include "priv.h"
 #include <hurd/iohelp.h>
+#include <fcntl.h>
 
 /* Update our copy of the relevant fields from a shared page.  Callers
    must have the share lock on the shared page as well as the inode
@@ -38,13 +39,14 @@ iohelp_fetch_shared_data (void *arg)
   else if (cred->po->np->dn_stat.st_size != cred->mapped->file_size)
     {
       /* The user can validly set the size, but block the attempt
-	 if we are readonly. */
-      if (diskfs_check_readonly ())
+	 if we are readonly or the user did not open for writing. */
+      if (diskfs_check_readonly () || !(cred->po->openstat & O_WRITE))
 	cred->mapped->file_size = cred->po->np->dn_stat.st_size;
       else
 	{
 	  cred->po->np->dn_stat.st_size = cred->mapped->file_size;
 	  cred->po->np->dn_set_ctime = 1;
+	  cred->po->np->dn_stat_dirty = 1;
 	  mod = 1;
 	}
     }
@@ -53,7 +55,7 @@ iohelp_fetch_shared_data (void *arg)
       
   if (!diskfs_check_readonly ())
     {
-      if (cred->mapped->written)
+      if (cred->mapped->written && (cred->po->openstat & O_WRITE))
 	{
 	  cred->po->np->dn_set_mtime = 1;
 	  mod = 1;
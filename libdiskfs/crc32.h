@@ -25,7 +25,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* IEEE 802.3 CRC32, used by journal formats up to version 2.  */
 uint32_t crc32 (const void *data, size_t len);
 
+/* Extend CRC, the result of an earlier crc32 call, over LEN more bytes
+   at DATA.  */
+uint32_t crc32_update (uint32_t crc, const void *data, size_t len);
+
+/* CRC32C (Castagnoli), used from journal version 3 on.  Uses the CPU's
+   crc32 instructions where available.  */
+uint32_t crc32c (const void *data, size_t len);
+
+/* Extend CRC, the result of an earlier crc32c call, over LEN more bytes
+   at DATA.  */
+uint32_t crc32c_update (uint32_t crc, const void *data, size_t len);
+
 #endif /* CRC32_H */
 
@@ -25,6 +25,7 @@
 #include "ifsock_S.h"
 #include "startup_notify_S.h"
 #include "exec_startup_S.h"
+#include "journal_S.h"
 
 int
 diskfs_demuxer (mach_msg_header_t *inp,
@@ -39,7 +40,8 @@ diskfs_demuxer (mach_msg_header_t *inp,
       (diskfs_shortcut_ifsock ?
        (routine = diskfs_ifsock_server_routine (inp)) : 0) ||
       (routine = diskfs_startup_notify_server_routine (inp)) ||
-      (routine = diskfs_exec_startup_server_routine (inp)))
+      (routine = diskfs_exec_startup_server_routine (inp)) ||
+      (routine = diskfs_journal_server_routine (inp)))
     {
       (*routine) (inp, outp);
       return TRUE;
@@ -28,6 +28,76 @@
 #include "priv.h"
 #include "fs_S.h"
 
+/* Resolve as many leading components of *FILENAME in *DNPP as the name
+   cache knows and that name plain directories, without going through
+   diskfs_lookup and without ever holding two node locks.  *DNPP is
+   locked and referenced on entry and on return, and *FILENAME is
+   advanced past the components resolved.  The last component is always
+   left to the caller, as are "." and "..", names not in the cache, and
+   anything that is not a directory or is translated.  */
+static void
+walk_cached (struct protid *dircred, struct node **dnpp,
+	     const char **filenamep)
+{
+  struct node *dnp = *dnpp;
+  const char *filename = *filenamep;
+
+  for (;;)
+    {
+      char *slash = strchr (filename, '/');
+      const char *next;
+      struct node *np;
+      ino64_t id;
+
+      if (!slash)
+	break;
+      next = slash + 1;
+      while (*next == '/')
+	next++;
+      if (*next == '\0')
+	/* A trailing slash; the last component has its own rules.  */
+	break;
+
+      if (filename[0] == '.'
+	  && (slash == filename + 1
+	      || (filename[1] == '.' && slash == filename + 2)))
+	break;
+
+      if (!S_ISDIR (dnp->dn_stat.st_mode)
+	  || fshelp_access (&dnp->dn_stat, S_IEXEC, dircred->user)
+	  || !_diskfs_lookup_cache_id (dnp, filename, slash - filename, &id))
+	break;
+
+      np = _diskfs_cached_ref (id);
+      if (!np)
+	break;
+
+      pthread_mutex_unlock (&dnp->lock);
+      pthread_mutex_lock (&np->lock);
+
+      if (!S_ISDIR (np->dn_stat.st_mode)
+	  || (np->dn_stat.st_mode & S_IPTRANS)
+	  || fshelp_translated (&np->transbox))
+	{
+	  /* Leave this component to the slow path.  */
+	  pthread_mutex_unlock (&np->lock);
+	  diskfs_nrele (np);
+	  pthread_mutex_lock (&dnp->lock);
+	  break;
+	}
+
+      /* Terminate the component, as the slow path does; translator
+	 paths are trimmed by looking for it.  */
+      *slash = '\0';
+      diskfs_nrele (dnp);
+      dnp = np;
+      filename = next;
+    }
+
+  *dnpp = dnp;
+  *filenamep = filename;
+}
+
 /* Implement dir_lookup as described in <hurd/fs.defs>. */
 kern_return_t
 diskfs_S_dir_lookup (struct protid *dircred,
@@ -103,6 +173,9 @@ diskfs_S_dir_lookup (struct protid *dircred,
     {
       assert_backtrace (!lastcomp);
 
+      /* Skip what the name cache can resolve by itself.  */
+      walk_cached (dircred, &dnp, &filename);
+
       /* Find the name of the next pathname component */
       nextname = index (filename, '/');
 
@@ -266,16 +339,34 @@ diskfs_S_dir_lookup (struct protid *dircred,
 	    .modep = &np->dn_stat.st_mode,
 	    .next = dircred->po,
 	  };
-	  err = fshelp_fetch_root (&np->transbox,
-				   &cookie,
-				   dirport,
-				   dircred->user,
-				   lastcomp ? flags : 0,
-				   ((np->dn_stat.st_mode & S_IPTRANS)
-				    ? _diskfs_translator_callback1
-				    : fshelp_short_circuited_callback1),
-				   _diskfs_translator_callback2,
-				   do_retry, retry_name, retry_port);
+	  /* What DIRPORT leads to, for the roots libfshelp keeps for the
+	     lookups that go on through the translator.  DIRPORT holds
+	     references on all of these.  */
+	  struct
+	  {
+	    struct node *dir;
+	    struct node *shadow_root;
+	    mach_port_t root_parent;
+	    mach_port_t shadow_root_parent;
+	  } context = {
+	    .dir = dnp,
+	    .shadow_root = dircred->po->shadow_root,
+	    .root_parent = dircred->po->root_parent,
+	    .shadow_root_parent = dircred->po->shadow_root_parent,
+	  };
+
+	  err = fshelp_fetch_root_cached (&np->transbox,
+					  &cookie,
+					  dirport,
+					  lastcomp ? NULL : &context,
+					  sizeof context,
+					  dircred->user,
+					  lastcomp ? flags : 0,
+					  ((np->dn_stat.st_mode & S_IPTRANS)
+					   ? _diskfs_translator_callback1
+					   : fshelp_short_circuited_callback1),
+					  _diskfs_translator_callback2,
+					  do_retry, retry_name, retry_port);
 
 	  /* fetch_root copies DIRPORT for success, so we always should
 	     deallocate our send right.  */
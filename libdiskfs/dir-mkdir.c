@@ -55,6 +55,9 @@ diskfs_S_dir_mkdir (struct protid *dircred,
   mode &= ~(S_ISPARE | S_IFMT | S_ITRANS);
   mode |= S_IFDIR;
 
+  /* The node creation, the mkdir and the parent's new link count are
+     journaled as one transaction.  */
+  journal_tx_begin ();
   error = diskfs_create_node (dnp, name, mode, &np, dircred, ds);
   if (!error) 
     {
@@ -68,8 +71,17 @@ diskfs_S_dir_mkdir (struct protid *dircred,
         .mode = mode,
 	.has_mode = true
       };
-      journal_log_metadata (np, &info, dur);
+      journal_tx_add (np, &info);
+      struct journal_entry_info pinfo = {
+        .action = "nlink",
+        .name = name,
+        .parent_ino = dnp->dn_stat.st_ino
+      };
+      journal_tx_add (dnp, &pinfo);
+      journal_tx_commit (dur);
     }
+  else
+    journal_tx_abort ();
   if (diskfs_synchronous)
     {
       diskfs_file_update (dnp, 1);
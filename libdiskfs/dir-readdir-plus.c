@@ -0,0 +1,198 @@
+/* dir_readdir_plus
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "priv.h"
+#include "fs_S.h"
+
+struct entry_order
+{
+  ino64_t ino;
+  int index;
+};
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  const struct entry_order *x = a, *y = b;
+
+  if (x->ino != y->ino)
+    return x->ino < y->ino ? -1 : 1;
+  return x->index - y->index;
+}
+
+/* Store in *ST what io_stat on NP through CRED would return, unless a
+   lookup of NP would start or reach a translator.  NP must be locked.  */
+static void
+stat_node (struct protid *cred, struct node *np, io_statbuf_t *st)
+{
+  if ((np->dn_stat.st_mode & S_IPTRANS)
+      || S_ISFIFO (np->dn_stat.st_mode)
+      || S_ISCHR (np->dn_stat.st_mode)
+      || S_ISBLK (np->dn_stat.st_mode)
+      || fshelp_translated (&np->transbox))
+    return;
+
+  iohelp_get_conch (&np->conch);
+  if (diskfs_synchronous)
+    diskfs_node_update (np, 1);
+  else
+    diskfs_set_node_times (np);
+
+  memcpy (st, &np->dn_stat, sizeof (struct stat));
+  st->st_mode &= ~(S_IATRANS | S_IROOT);
+  if (cred->po->shadow_root == np || np == diskfs_root_node)
+    st->st_mode |= S_IROOT;
+}
+
+/* Fill STATS with the status of the AMT entries in DATA of directory
+   DP, which is locked.  The nodes are looked up in inode number order,
+   so that their inodes are read in the order they are on disk.  */
+static error_t
+stat_entries (struct protid *cred, struct node *dp, char *data, int amt,
+	      io_statbuf_t *stats)
+{
+  struct entry_order *order;
+  char *p = data;
+  int i;
+
+  order = malloc (amt * sizeof *order);
+  if (! order)
+    return ENOMEM;
+
+  for (i = 0; i < amt; i++)
+    {
+      struct dirent *d = (struct dirent *) p;
+
+      /* The parent may be on another filesystem, and locking it here
+	 would be against the lock order anyway.  */
+      if (d->d_namlen == 2 && d->d_name[0] == '.' && d->d_name[1] == '.')
+	order[i].ino = 0;
+      else
+	order[i].ino = d->d_fileno;
+      order[i].index = i;
+      p += d->d_reclen;
+    }
+
+  qsort (order, amt, sizeof *order, compare_entries);
+
+  for (i = 0; i < amt; i++)
+    {
+      io_statbuf_t *st = &stats[order[i].index];
+      struct node *np;
+
+      if (order[i].ino == 0)
+	continue;
+
+      if (i > 0 && order[i].ino == order[i - 1].ino)
+	{
+	  /* Another link to the same node.  */
+	  *st = stats[order[i - 1].index];
+	  continue;
+	}
+
+      if (order[i].ino == dp->cache_id)
+	{
+	  stat_node (cred, dp, st);
+	  continue;
+	}
+
+      if (diskfs_cached_lookup (order[i].ino, &np))
+	continue;
+      stat_node (cred, np, st);
+      diskfs_nput (np);
+    }
+
+  free (order);
+  return 0;
+}
+
+/* Implement dir_readdir_plus as described in <hurd/fs.defs>.  */
+kern_return_t
+diskfs_S_dir_readdir_plus (struct protid *cred,
+			   data_t *data,
+			   mach_msg_type_number_t *datacnt,
+			   boolean_t *data_dealloc,
+			   data_t *stats,
+			   mach_msg_type_number_t *statscnt,
+			   boolean_t *stats_dealloc,
+			   int entry,
+			   int nentries,
+			   vm_size_t bufsiz,
+			   int *amt)
+{
+  error_t err;
+  struct node *np;
+  size_t size;
+
+  if (!cred)
+    return EOPNOTSUPP;
+
+  np = cred->po->np;
+  pthread_mutex_lock (&np->lock);
+
+  if ((cred->po->openstat & O_READ) == 0)
+    {
+      pthread_mutex_unlock (&np->lock);
+      return EBADF;
+    }
+
+  if ((np->dn_stat.st_mode & S_IFMT) != S_IFDIR)
+    {
+      pthread_mutex_unlock (&np->lock);
+      return ENOTDIR;
+    }
+
+  err = fshelp_access (&np->dn_stat, S_IEXEC, cred->user);
+  if (err)
+    {
+      pthread_mutex_unlock (&np->lock);
+      return err;
+    }
+
+  err = diskfs_get_directs (np, entry, nentries, data, datacnt, bufsiz, amt);
+  *data_dealloc = 1;		/* XXX */
+  if (err)
+    {
+      pthread_mutex_unlock (&np->lock);
+      return err;
+    }
+
+  size = *amt * sizeof (io_statbuf_t);
+  if (size > *statscnt)
+    {
+      *stats = mmap (0, size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (*stats == MAP_FAILED)
+	err = ENOMEM;
+    }
+  if (! err)
+    {
+      *statscnt = size;
+      *stats_dealloc = 1;
+      memset (*stats, 0, size);
+      err = stat_entries (cred, np, *data, *amt, (io_statbuf_t *) *stats);
+    }
+
+  pthread_mutex_unlock (&np->lock);
+  return err;
+}
@@ -22,9 +22,10 @@
 #include <string.h>
 #include <libdiskfs/journal.h>
 
-/* To avoid races in checkpath, and to prevent a directory from being
-   simultaneously renamed by two processes, we serialize all renames of
-   directores with this lock */
+/* To avoid races in checkpath, we serialize the renames of directories
+   into another directory with this lock.  A rename within a directory
+   doesn't change any path, so it only needs the directory's lock; the
+   source is checked again under it by diskfs_rename_dir.  */
 static pthread_mutex_t renamedirlock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Implement dir_rename as described in <hurd/fs.defs>. */
@@ -74,14 +75,24 @@ diskfs_S_dir_rename (struct protid *fromcred,
 
   if (S_ISDIR (fnp->dn_stat.st_mode))
     {
+      int cross = fdp != tdp;
+
       pthread_mutex_unlock (&fnp->lock);
-      if (pthread_mutex_trylock (&renamedirlock))
+      if (cross && pthread_mutex_trylock (&renamedirlock))
 	{
 	  diskfs_nrele (fnp);
 	  goto try_again;
 	}
       err = diskfs_rename_dir (fdp, fnp, fromname, tdp, toname, fromcred,
 			       tocred, excl);
+      if (err == EAGAIN)
+	/* FROMNAME was renamed meanwhile; look it up again.  */
+	{
+	  diskfs_nrele (fnp);
+	  if (cross)
+	    pthread_mutex_unlock (&renamedirlock);
+	  goto try_again;
+	}
       if (diskfs_synchronous)
 	{
 	  pthread_mutex_lock (&fdp->lock);
@@ -98,7 +109,8 @@ diskfs_S_dir_rename (struct protid *fromcred,
 	}
       
       diskfs_nrele (fnp);
-      pthread_mutex_unlock (&renamedirlock);
+      if (cross)
+	pthread_mutex_unlock (&renamedirlock);
       if (!err)
 	/* MiG won't do this for us, which it ought to. */
 	mach_port_deallocate (mach_task_self (), tocred->pi.port_right);
@@ -166,6 +178,10 @@ diskfs_S_dir_rename (struct protid *fromcred,
   fnp->dn_set_ctime = 1;
   diskfs_node_update (fnp, diskfs_synchronous);
 
+  /* The overwritten target and the rename itself are journaled as one
+     transaction.  */
+  journal_tx_begin ();
+
   if (tnp)
     {
       err = diskfs_dirrewrite (tdp, tnp, fnp, toname, ds);
@@ -173,6 +189,12 @@ diskfs_S_dir_rename (struct protid *fromcred,
 	{
 	  tnp->dn_stat.st_nlink--;
 	  tnp->dn_set_ctime = 1;
+	  struct journal_entry_info tinfo = {
+	    .action = "unlink",
+	    .name = toname,
+	    .parent_ino = tdp->dn_stat.st_ino
+	  };
+	  journal_tx_add (tnp, &tinfo);
 	  if (diskfs_synchronous)
 	    diskfs_node_update (tnp, 1);
 	}
@@ -188,6 +210,7 @@ diskfs_S_dir_rename (struct protid *fromcred,
   pthread_mutex_unlock (&fnp->lock);
   if (err)
     {
+      journal_tx_abort ();
       diskfs_nrele (fnp);
       return err;
     }
@@ -201,6 +224,7 @@ diskfs_S_dir_rename (struct protid *fromcred,
   err = diskfs_lookup (fdp, fromname, REMOVE, &tmpnp, ds, fromcred);
   if (err)
     {
+      journal_tx_abort ();
       diskfs_drop_dirstat (tdp, ds);
       pthread_mutex_unlock (&fdp->lock);
       diskfs_nrele (fnp);
@@ -210,6 +234,7 @@ diskfs_S_dir_rename (struct protid *fromcred,
   if (tmpnp != fnp)
     {
       /* This is no longer the node being renamed, so just return. */
+      journal_tx_abort ();
       diskfs_drop_dirstat (tdp, ds);
       diskfs_nput (tmpnp);
       diskfs_nrele (fnp);
@@ -235,7 +260,8 @@ diskfs_S_dir_rename (struct protid *fromcred,
       .name = toname, 
       .parent_ino = tdp->dn_stat.st_ino
   };
-  journal_log_metadata (fnp, &info, JOURNAL_DURABILITY_SYNC);
+  journal_tx_add (fnp, &info);
+  journal_tx_commit (JOURNAL_DURABILITY_SYNC);
 
   if (diskfs_synchronous)
     diskfs_node_update (fnp, 1);
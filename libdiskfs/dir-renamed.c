@@ -21,9 +21,11 @@
 /* Check if source directory is in the path of the target directory.
    We get target locked, source unlocked but with a reference.  When
    we return, nothing is locked, and target has lost its reference.
-   This routine assumes that no renames of directories will happen
-   while it is running; as a result, ufs_rename serializes all renames
-   of directories.  */
+   This routine assumes that no renames of directories into another
+   directory will happen while it is running; as a result,
+   diskfs_S_dir_rename serializes them.  The parents are taken from the
+   name cache when it has them, which saves the permission checks and
+   the directory scan of diskfs_lookup.  */
 static error_t
 checkpath(struct node *source,
 	  struct node *target,
@@ -32,19 +34,8 @@ checkpath(struct node *source,
   error_t err;
   struct node *np, *newnp;
 
-  for (newnp = target, err = 0;
-       /* nothing */;
-       /* This special lookup does a diskfs_nput on its first argument
-	  when it succeeds. */
-       err = diskfs_lookup (np, "..", LOOKUP | SPEC_DOTDOT, &newnp, 0, cred))
+  for (np = target; ; np = newnp)
     {
-      if (err)
-	{
-	  diskfs_nput (np);
-	  return err;
-	}
-      np = newnp;
-
       if (np == source)
 	{
 	  diskfs_nput (np);
@@ -56,15 +47,36 @@ checkpath(struct node *source,
 	  diskfs_nput (np);
 	  return 0;
 	}
+
+      newnp = diskfs_check_lookup_cache (np, "..");
+      if (newnp == np)
+	/* Only the root is its own parent; don't trust this.  */
+	diskfs_nrele (newnp);
+      else if (newnp && newnp != (struct node *) -1)
+	{
+	  diskfs_nput (np);
+	  continue;
+	}
+
+      /* This special lookup does a diskfs_nput on its first argument
+	 when it succeeds. */
+      err = diskfs_lookup (np, "..", LOOKUP | SPEC_DOTDOT, &newnp, 0, cred);
+      if (err)
+	{
+	  diskfs_nput (np);
+	  return err;
+	}
     }
 }
 
 /* Rename directory node FNP (whose parent is FDP, and which has name
    FROMNAME in that directory) to have name TONAME inside directory
    TDP.  None of these nodes are locked, and none should be locked
-   upon return.  This routine is serialized, so it doesn't have to be
-   reentrant.  Directories will never be renamed except by this
-   routine.  FROMCRED and TOCRED are the users responsible for
+   upon return.  Renames into another directory are serialized by
+   our caller; renames within one directory are not, so FROMNAME is
+   looked up again once FDP is locked, and EAGAIN returned if it no
+   longer names FNP.  Directories will never be renamed except by
+   this routine.  FROMCRED and TOCRED are the users responsible for
    FDP/FNP and TDP respectively.  If EXCL is set, then fail if TONAME
    already exists inside directory TDP. */
 error_t
@@ -78,13 +90,17 @@ diskfs_rename_dir (struct node *fdp, struct node *fnp, const char *fromname,
   struct dirstat *ds;
   struct dirstat *tmpds;
 
-  pthread_mutex_lock (&tdp->lock);
-  diskfs_nref (tdp);		/* reference and lock will get consumed by
+  /* Within one directory, TDP is FNP's parent and can't be below it.  */
+  if (fdp != tdp)
+    {
+      pthread_mutex_lock (&tdp->lock);
+      diskfs_nref (tdp);	/* reference and lock will get consumed by
 				   checkpath */
-  err = checkpath (fnp, tdp, tocred);
+      err = checkpath (fnp, tdp, tocred);
 
-  if (err)
-    return err;
+      if (err)
+	return err;
+    }
 
   /* Now, lock the parent directories.  This is legal because tdp is not
      a child of fnp (guaranteed by checkpath above). */
@@ -117,10 +133,23 @@ diskfs_rename_dir (struct node *fdp, struct node *fnp, const char *fromname,
   /* Check permissions to remove FROMNAME and lock FNP.  */
   tmpds = alloca (diskfs_dirstat_size);
   err = diskfs_lookup (fdp, fromname, REMOVE, &tmpnp, tmpds, fromcred);
-  assert_backtrace (!tmpnp || tmpnp == fnp);
+  diskfs_drop_dirstat (fdp, tmpds);
+  if (tmpnp && tmpnp != fnp)
+    /* A rename within FDP got there first.  */
+    {
+      diskfs_nput (tmpnp);
+      fnp = NULL;
+      err = EAGAIN;
+      goto out;
+    }
   if (tmpnp)
     diskfs_nrele (tmpnp);
-  diskfs_drop_dirstat (fdp, tmpds);
+  else
+    /* diskfs_lookup has not locked fnp then, do not unlock it. */
+    fnp = NULL;
+  if (err == ENOENT)
+    /* Or moved FROMNAME away.  */
+    err = EAGAIN;
   if (err)
     goto out;
 
@@ -40,6 +40,8 @@ diskfs_direnter (struct node *dp,
   if (err)
     return err;
 
+  _diskfs_new_dir_generation (dp);
+
   if (dp->dirmod_reqs)
     diskfs_notice_dirchange (dp, DIR_CHANGED_NEW, name);
 
@@ -35,9 +35,11 @@ diskfs_dirremove (struct node *dp,
 {
   error_t err;
 
-  diskfs_purge_lookup_cache (dp, np);
+  diskfs_purge_lookup_cache_name (dp, np, name);
 
   err = diskfs_dirremove_hard (dp, ds);
+  if (!err)
+    _diskfs_new_dir_generation (dp);
 
   if (!err && dp->dirmod_reqs)
     diskfs_notice_dirchange (dp, DIR_CHANGED_UNLINK, name);
@@ -37,12 +37,14 @@ error_t diskfs_dirrewrite (struct node *dp,
 {
   error_t err;
 
-  diskfs_purge_lookup_cache (dp, oldnp);
+  diskfs_purge_lookup_cache_name (dp, oldnp, name);
 
   err = diskfs_dirrewrite_hard (dp, np, ds);
   if (err)
     return err;
 
+  _diskfs_new_dir_generation (dp);
+
   if (dp->dirmod_reqs)
     diskfs_notice_dirchange (dp, DIR_CHANGED_RENUMBER, name);
   diskfs_enter_lookup_cache (dp, np, name);
@@ -20,8 +20,10 @@
 #define _HURD_DISKFS
 
 #include <assert-backtrace.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <hurd/ports.h>
 #include <hurd/fshelp.h>
 #include <hurd/ihash.h>
@@ -119,12 +121,42 @@ struct node
   struct modreq *dirmod_reqs;
   unsigned int dirmod_tick;
 
+  /* For a directory, changed whenever an entry is added, removed or
+     rewritten; negative lookup cache entries are only good while it
+     stays the same.  */
+  unsigned int dir_generation;
+
   struct modreq *filemod_reqs;
   unsigned int filemod_tick;
 
   loff_t allocsize;
 
   ino64_t cache_id;
+
+  /* While the node is in the cache without hard references, its place
+     in the cache's LRU list.  */
+  struct node *lru_prev, *lru_next;
+  int lru_linked;
+
+  /* While the node may have changed since the last
+     diskfs_node_collect_changed, its place in the cache's list of such
+     nodes.  */
+  struct node *changed_prev, *changed_next;
+  int changed_linked;
+
+  /* Data transfers in progress, which run without LOCK held; see
+     _diskfs_range_lock.  */
+  struct diskfs_range *ranges;
+  int ranges_draining;
+  pthread_cond_t ranges_cond;
+
+  /* A copy of DN_STAT made by io_stat while the node was clean, which
+     io_stat, io_readable and file_get_translator use without taking
+     LOCK for as long as the node stays clean.  STAT_SEQ is odd while
+     the copy is being changed.  */
+  io_statbuf_t stat_snapshot;
+  unsigned int stat_seq;
+  int stat_snapshot_valid;
 };
 
 struct diskfs_control
@@ -518,6 +550,30 @@ void diskfs_write_disknode (struct node *np, int wait);
    then return only after the physical media has been completely updated.  */
 void diskfs_file_update (struct node *np, int wait);
 
+/* The user may define this function.  Sync the contents of file NP
+   from START up to END, or through the end of the file if END is -1,
+   like diskfs_file_update.  If DATASYNC is true, the metadata need only
+   be written if it is needed to read the data back, which is when
+   NP->dn_stat_dirty is set; changed times may be left for later.  The
+   default function calls diskfs_file_update.  */
+void diskfs_file_update_range (struct node *np, off_t start, off_t end,
+			       int datasync, int wait);
+
+/* The user may define this function.  Act on ADVICE, one of the
+   POSIX_FADV_* values of <fcntl.h>, given for the contents of regular
+   file NP from START up to END, or through the end of the file if END
+   is -1.  NP is not locked.  The default function ignores the
+   advice.  */
+void diskfs_file_advise_range (struct node *np, off_t start, off_t end,
+			       int advice);
+
+/* The user may define this function.  Allocate storage for the contents
+   of regular file NP from START up to END, which may be past
+   NP->allocsize, so that writing them cannot fail for lack of space;
+   what had no storage must still read as zeros.  NP is locked.  The
+   default function returns EOPNOTSUPP.  */
+error_t diskfs_file_allocate (struct node *np, off_t start, off_t end);
+
 /* The user must define this function unless she wants to use the node
    cache.  See the section `Node cache' below.  For each active node, call
    FUN.  The node is to be locked around the call to FUN.  If FUN
@@ -613,13 +669,60 @@ error_t diskfs_user_make_node (struct node **npp, struct lookup_context *ctx);
 error_t diskfs_user_read_node (struct node *np, struct lookup_context *ctx);
 
 /* The user must define this function if she wants to use the node
-   cache.  The last hard reference to a node has gone away; arrange to
-   have all the weak references dropped that can be.  */
+   cache.  A node without hard references is being removed from the
+   cache; arrange to have all the weak references dropped that can be.
+   This happens when the node gets old, see diskfs_set_node_cache_size,
+   so it may be a while after the last hard reference has gone away.  */
 void diskfs_user_try_dropping_softrefs (struct node *np);
 
 /* Lookup node INUM (which must have a reference already) and return it
    without allocating any new references. */
 struct node *diskfs_cached_ifind (ino64_t inum);
+
+/* Return in *NODES, allocated with malloc, the active nodes for which
+   WANT returns nonzero, and their number in *NUM_NODES.  Each returned
+   node has a hard reference, which the caller must drop with
+   diskfs_nrele.  WANT is called without the node being locked, and must
+   not block.  */
+error_t diskfs_node_collect (int (*want)(struct node *),
+			     struct node ***nodes, size_t *num_nodes);
+
+/* Like diskfs_node_collect, but consider only the nodes that may have
+   changed since the last call: those that had hard references meanwhile
+   or were passed to diskfs_node_changed.  A sync can use this to visit
+   only what needs writing.  */
+error_t diskfs_node_collect_changed (int (*want)(struct node *),
+				     struct node ***nodes,
+				     size_t *num_nodes);
+
+/* Note that NP has changed although no one may hold a hard reference
+   to it, as a filesystem's pager may change a node it only has a light
+   reference to, so that diskfs_node_collect_changed returns it.  Call
+   this after the change.  Gaining a hard reference does this by
+   itself.  */
+void diskfs_node_changed (struct node *np);
+
+/* Keep up to about NODES nodes without hard references in the cache,
+   forgetting the least recently used ones beyond that, or forget nodes
+   as soon as they lose their last hard reference if NODES is 0.  Nodes
+   without links are always forgotten at once.  */
+void diskfs_set_node_cache_size (size_t nodes);
+
+/* Return the number last given to diskfs_set_node_cache_size, or the
+   default.  */
+size_t diskfs_get_node_cache_size (void);
+
+/* Start writing everything back once data written through io_write
+   since the last writeback is more than BACKGROUND percent of physical
+   memory, or more nodes than the node cache keeps have been made dirty,
+   and make writers wait for the writeback once it is more than DIRTY
+   percent.  BACKGROUND 0 leaves it to the periodic sync, and DIRTY 0
+   never makes writers wait.  */
+error_t diskfs_set_dirty_ratios (unsigned int background, unsigned int dirty);
+
+/* Return the numbers last given to diskfs_set_dirty_ratios, or the
+   defaults.  */
+void diskfs_get_dirty_ratios (unsigned int *background, unsigned int *dirty);
 
 /* The library exports the following functions for general use */
 
@@ -641,6 +744,14 @@ mach_port_t diskfs_startup_diskfs (mach_port_t bootstrap, int flags);
    just diskfs_demuxer.  */
 void diskfs_spawn_first_thread (ports_demuxer_type demuxer);
 
+/* Handle at most MAX requests of diskfs_port_bucket at once, or any
+   number if MAX is 0, which is the default.  See
+   ports_set_bucket_max_threads.  */
+void diskfs_set_max_threads (unsigned int max);
+
+/* Return the number last given to diskfs_set_max_threads.  */
+unsigned int diskfs_get_max_threads (void);
+
 /* Once diskfs_root_node is set, call this if we are a bootstrap
    filesystem.  If you call this, then the library will call
    diskfs_init_completed once it has a valid proc and auth port. */
@@ -655,6 +766,13 @@ void diskfs_drop_node (struct node *np);
    media has been completely updated.  */
 void diskfs_node_update (struct node *np, int wait);
 
+/* The on-disk fields of NP are about to be written from NP->dn_stat and
+   its dn_stat_dirty flag cleared; forget the copy of its stat
+   information kept for io_stat, which may be out of date by now.  A
+   filesystem that clears dn_stat_dirty itself must call this first.
+   NP must be locked.  */
+void diskfs_forget_stat_snapshot (struct node *np);
+
 /* Add a hard reference to a node.  If there were no hard
    references previously, then the node cannot be locked
    (because you must hold a hard reference to hold the lock). */
@@ -1005,20 +1123,53 @@ void diskfs_enter_lookup_cache (struct node *dir, struct node *np,
    directory DP. */
 void diskfs_purge_lookup_cache (struct node *dp, struct node *np);
 
+/* Purge the reference in the cache to NP as NAME inside directory DP;
+   cheaper than diskfs_purge_lookup_cache when the name is known.  */
+void diskfs_purge_lookup_cache_name (struct node *dp, struct node *np,
+				     const char *name);
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
    a newly allocated reference. */
 struct node *diskfs_check_lookup_cache (struct node *dir, const char *name);
 
+/* Make the lookup cache hold about ENTRIES entries, or disable it if
+   ENTRIES is 0.  */
+error_t diskfs_set_name_cache_size (size_t entries);
+
+/* Return the number of entries last given to
+   diskfs_set_name_cache_size, or the default.  */
+size_t diskfs_get_name_cache_size (void);
+
+struct diskfs_name_cache_stats
+{
+  uint64_t hits;		/* Lookups answered with a node.  */
+  uint64_t negative_hits;	/* Lookups answered with no such name.  */
+  uint64_t misses;		/* Lookups the cache could not answer.  */
+  uint64_t capacity;		/* Entries currently allocated.  */
+};
+
+/* Fill in *STATS with the lookup cache statistics.  */
+void diskfs_get_name_cache_stats (struct diskfs_name_cache_stats *stats);
+
+/* Write the filesystem's own statistics to OUT, one "NAME VALUE" line
+   each, for the journal_fetch_stats RPC to return after those of the
+   library.  The default definition writes nothing.  */
+void diskfs_append_stats (FILE *out);
+
 /* Rename directory node FNP (whose parent is FDP, and which has name
    FROMNAME in that directory) to have name TONAME inside directory
    TDP.  None of these nodes are locked, and none should be locked
-   upon return.  This routine is serialized, so it doesn't have to be
-   reentrant.  Directories will never be renamed except by this
-   routine.  FROMCRED and TOCRED are the users responsible for
-   FDP/FNP and TDP respectively. If EXCL is set, then fail if TONAME
-   already exists inside directory TDP. This routine assumes the usual
+   upon return.  Renames into another directory (FDP != TDP) are
+   serialized, so that the path between them doesn't change while
+   this runs; renames within one directory only take FDP's lock, so
+   renames in different directories run concurrently.  If FROMNAME no
+   longer names FNP once FDP is locked, return EAGAIN and the rename
+   is retried.  Directories will never be renamed except by this
+   routine.  FROMCRED and TOCRED are the users responsible for FDP/FNP
+   and TDP respectively. If EXCL is set, then fail if TONAME already
+   exists inside directory TDP. This routine assumes the usual
    convention where `.' and `..' are represented by ordinary links;
    if that is not true for your format, you have to redefine this
    function.*/
@@ -0,0 +1,76 @@
+/* libdiskfs implementation of fs.defs: file_allocate
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include "fs_S.h"
+#include <fcntl.h>
+
+/* Implement file_allocate as described in <hurd/fs.defs>.  */
+kern_return_t
+diskfs_S_file_allocate (struct protid *cred,
+			off_t offset,
+			off_t length,
+			int flags)
+{
+  struct node *np;
+  int keep_size = flags & FS_ALLOC_KEEP_SIZE;
+  off_t end;
+  error_t err = 0;
+
+  if (!cred)
+    return EOPNOTSUPP;
+
+  if (diskfs_check_readonly ())
+    return EROFS;
+
+  if (!(cred->po->openstat & O_WRITE))
+    return EBADF;
+
+  if (offset < 0 || length <= 0 || (flags & ~FS_ALLOC_KEEP_SIZE))
+    return EINVAL;
+
+  if (__builtin_add_overflow (offset, length, &end))
+    return EFBIG;
+
+  np = cred->po->np;
+  if (! S_ISREG (np->dn_stat.st_mode))
+    return ENODEV;
+
+  pthread_mutex_lock (&np->lock);
+  iohelp_get_conch (&np->conch);
+
+  err = diskfs_file_allocate (np, offset, end);
+  if (!err && !keep_size && end > np->allocsize)
+    err = diskfs_grow (np, end, cred);
+
+  if (!err && !keep_size && end > np->dn_stat.st_size)
+    {
+      np->dn_stat.st_size = end;
+      np->dn_set_ctime = 1;
+      np->dn_stat_dirty = 1;
+      if (np->filemod_reqs)
+	diskfs_notice_filechange (np, FILE_CHANGED_EXTEND, 0, end);
+    }
+
+  if (!err && diskfs_synchronous)
+    diskfs_node_update (np, 1);
+
+  pthread_mutex_unlock (&np->lock);
+  return err;
+}
@@ -29,7 +29,7 @@ diskfs_S_file_chflags (struct protid *cred,
                      /* Only root is allowed to change the high 16
                         bits.  */
                      if ((HI (flags) != HI (np->dn_stat.st_flags))
-                         && ! idvec_contains (cred->user->uids, 0))
+                         && ! iohelp_iouser_has_uid (cred->user, 0))
                        return EPERM;
 
 		     err = fshelp_isowner (&np->dn_stat, cred->user);
@@ -30,7 +30,7 @@ diskfs_S_file_chmod (struct protid *cred,
 		     ({
 		       if (!(err = fshelp_isowner (&np->dn_stat, cred->user)))
 			 {
-			   if (!idvec_contains (cred->user->uids, 0))
+			   if (!iohelp_iouser_has_uid (cred->user, 0))
 			     {
 			       if (!S_ISDIR (np->dn_stat.st_mode))
 				 mode &= ~S_ISVTX;
@@ -33,10 +33,10 @@ diskfs_S_file_chown (struct protid *cred,
 		     err = fshelp_isowner (&np->dn_stat, cred->user);
 		     if (err
 			 || (((uid != (uid_t) -1
-			       && !idvec_contains (cred->user->uids, uid))
+			       && !iohelp_iouser_has_uid (cred->user, uid))
 			      || (gid != (gid_t) -1
-				  && !idvec_contains (cred->user->gids, gid)))
-			     && !idvec_contains (cred->user->uids, 0)))
+				  && !iohelp_iouser_has_gid (cred->user, gid)))
+			     && !iohelp_iouser_has_uid (cred->user, 0)))
 		       err = EPERM;
 		     else
 		       {
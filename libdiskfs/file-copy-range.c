@@ -0,0 +1,151 @@
+/* libdiskfs implementation of fs.defs: file_copy_range
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include "fs_S.h"
+#include <fcntl.h>
+
+/* The most that is mapped from the source at a time.  */
+#define COPY_CHUNK (256 * vm_page_size)
+
+/* Map up to *LEN bytes of the regular file open as CRED at OFFSET, or
+   at its file pointer, which is moved, if OFFSET is -1.  Return in *LEN
+   how many bytes could be read, which is zero at the end of the file.
+   The pages holding them are mapped copy-on-write, as by
+   _diskfs_read_map, at *DATA; they start *SKIP bytes into it.  */
+static error_t
+map_source (struct protid *cred, off_t offset, vm_size_t *len,
+	    char **data, vm_size_t *skip)
+{
+  struct node *np = cred->po->np;
+  struct diskfs_range range;
+  vm_size_t amt = *len;
+  off_t off, start;
+  error_t err;
+
+  pthread_mutex_lock (&np->lock);
+
+ retry:
+  iohelp_get_conch (&np->conch);
+
+  off = offset == -1 ? cred->po->filepointer : offset;
+  if (off < 0)
+    {
+      pthread_mutex_unlock (&np->lock);
+      return EINVAL;
+    }
+
+  if (off >= np->dn_stat.st_size)
+    amt = 0;
+  else if (off + (off_t) amt > np->dn_stat.st_size)
+    amt = np->dn_stat.st_size - off;
+  if (amt == 0)
+    {
+      pthread_mutex_unlock (&np->lock);
+      *len = 0;
+      return 0;
+    }
+
+  start = off & ~((off_t) vm_page_size - 1);
+  if (_diskfs_range_lock (np, &range, start, off + amt, 0))
+    goto retry;
+
+  if (offset == -1)
+    cred->po->filepointer = off + amt;
+  err = _diskfs_read_map (np, &range, start, off + amt - start,
+			  cred->po->openstat & O_NOATIME, data);
+  if (err && offset == -1 && cred->po->filepointer == off + amt)
+    cred->po->filepointer = off;
+
+  pthread_mutex_unlock (&np->lock);
+
+  if (!err)
+    {
+      *len = amt;
+      *skip = off - start;
+    }
+  return err;
+}
+
+/* Implement file_copy_range as described in <hurd/fs.defs>.  The
+   source is mapped copy-on-write a chunk at a time and written to the
+   target as io_write would, so that page aligned parts are copied
+   between the pagers with vm_copy by pager_memcpy, and the data never
+   leaves the server.  */
+kern_return_t
+diskfs_S_file_copy_range (struct protid *cred,
+			  off_t in_offset,
+			  struct protid *target,
+			  off_t out_offset,
+			  off_t length,
+			  off_t *copied)
+{
+  error_t err = 0;
+  off_t done = 0;
+
+  if (!cred)
+    return EOPNOTSUPP;
+
+  if (!target)
+    return EXDEV;
+
+  if (!(cred->po->openstat & O_READ) || !(target->po->openstat & O_WRITE))
+    return EBADF;
+
+  if (length < 0 || in_offset < -1 || out_offset < -1)
+    return EINVAL;
+
+  if (! S_ISREG (cred->po->np->dn_stat.st_mode)
+      || ! S_ISREG (target->po->np->dn_stat.st_mode))
+    return EINVAL;
+
+  while (done < length)
+    {
+      vm_size_t len = length - done > COPY_CHUNK ? COPY_CHUNK : length - done;
+      vm_size_t skip, amt;
+      char *data;
+
+      err = map_source (cred, in_offset == -1 ? -1 : in_offset + done,
+			&len, &data, &skip);
+      if (err || len == 0)
+	break;
+
+      err = _diskfs_io_write (target, data + skip, len,
+			      out_offset == -1 ? -1 : out_offset + done, &amt);
+      munmap (data, round_page (skip + len));
+      if (err)
+	amt = 0;
+      if (in_offset == -1 && amt < len)
+	{
+	  /* Leave the file pointer after what was copied.  */
+	  pthread_mutex_lock (&cred->po->np->lock);
+	  cred->po->filepointer -= len - amt;
+	  pthread_mutex_unlock (&cred->po->np->lock);
+	}
+      if (err)
+	break;
+
+      done += amt;
+      if (amt < len)
+	break;
+    }
+
+  *copied = done;
+  return done ? 0 : err;
+}
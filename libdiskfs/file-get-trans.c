@@ -28,6 +28,7 @@ diskfs_S_file_get_translator (struct protid *cred,
                               mach_msg_type_number_t *translen)
 {
   struct node *np;
+  io_statbuf_t st;
   error_t err = 0;
 
   if (!cred)
@@ -35,6 +36,14 @@ diskfs_S_file_get_translator (struct protid *cred,
 
   np = cred->po->np;
 
+  /* Most nodes have no translator to report at all, which the copy of
+     their stat information kept for io_stat can tell without the
+     lock.  */
+  if (_diskfs_read_stat_snapshot (np, &st)
+      && !(st.st_mode & S_IPTRANS)
+      && (S_ISREG (st.st_mode) || S_ISDIR (st.st_mode)))
+    return EINVAL;
+
   pthread_mutex_lock (&np->lock);
 
   if (np->dn_stat.st_mode & S_IPTRANS)
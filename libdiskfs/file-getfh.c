@@ -35,7 +35,7 @@ diskfs_S_file_getfh (struct protid *cred, data_t *fh,
   if (! cred)
     return EOPNOTSUPP;
 
-  if (! idvec_contains (cred->user->uids, 0))
+  if (! iohelp_iouser_has_uid (cred->user, 0))
     return EPERM;
 
   assert_backtrace (sizeof *f == sizeof f->bytes);
@@ -27,10 +27,14 @@ diskfs_S_file_set_size (struct protid *cred,
 {
   CHANGE_NODE_FIELD (cred,
 		     ({
+		       /* A holder of the conch must not put back the old
+			  size afterwards.  */
+		       iohelp_get_conch (&np->conch);
 		       if (!(cred->po->openstat & O_WRITE) || (size < 0))
 			 err = EINVAL;
 		       else if (size < np->dn_stat.st_size)
 			 {
+			   _diskfs_range_drain (np, size);
 			   err = diskfs_truncate (np, size);
 			   if (!err)
 			    {
@@ -60,6 +64,7 @@ diskfs_S_file_set_size (struct protid *cred,
 			       journal_log_metadata (np, &info, JOURNAL_DURABILITY_ASYNC);
 			       np->dn_stat.st_size = size;
 			       np->dn_set_ctime = np->dn_set_mtime = 1;
+			       np->dn_stat_dirty = 1;
 			       if (np->filemod_reqs)
 				 diskfs_notice_filechange (np, 
 							   FILE_CHANGED_EXTEND,
@@ -170,6 +170,7 @@ diskfs_S_file_set_translator (struct protid *cred,
 		  np->dn_stat.st_rdev = gnu_dev_makedev (major, minor);
 		}
 
+	      _diskfs_range_drain (np, 0);
 	      err = diskfs_truncate (np, 0);
 	      if (err)
 		{
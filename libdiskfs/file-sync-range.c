@@ -0,0 +1,50 @@
+/* libdiskfs implementation of fs.defs: file_sync_range
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include "fs_S.h"
+
+/* Implement file_sync_range as described in <hurd/fs.defs>.  */
+kern_return_t
+diskfs_S_file_sync_range (struct protid *cred,
+			  off_t offset,
+			  off_t length,
+			  int wait,
+			  int omitmetadata)
+{
+  struct node *np;
+
+  if (!cred)
+    return EOPNOTSUPP;
+
+  if (offset < 0 || length < 0)
+    return EINVAL;
+
+  if (diskfs_synchronous)
+    wait = 1;
+
+  np = cred->po->np;
+
+  pthread_mutex_lock (&np->lock);
+  iohelp_get_conch (&np->conch);
+  pthread_mutex_unlock (&np->lock);
+  diskfs_file_update_range (np, offset, length ? offset + length : -1,
+			    omitmetadata, wait);
+  return 0;
+}
@@ -37,6 +37,9 @@ diskfs_S_file_sync (struct protid *cred,
   pthread_mutex_lock (&np->lock);
   iohelp_get_conch (&np->conch);
   pthread_mutex_unlock (&np->lock);
-  diskfs_file_update (np, wait);
+  if (omitmetadata)
+    diskfs_file_update_range (np, 0, -1, 1, wait);
+  else
+    diskfs_file_update (np, wait);
   return 0;
 }
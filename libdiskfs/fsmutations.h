@@ -34,6 +34,7 @@
 #define IO_IMPORTS import "libdiskfs/priv.h";
 #define FSYS_IMPORTS import "libdiskfs/priv.h";
 #define IFSOCK_IMPORTS import "libdiskfs/priv.h";
+#define JOURNAL_IMPORTS import "libdiskfs/priv.h";
 
 #define EXEC_STARTUP_INTRAN                             \
   bootinfo_t diskfs_begin_using_bootinfo_port (exec_startup_t)
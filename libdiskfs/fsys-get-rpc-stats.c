@@ -0,0 +1,47 @@
+/* Statistics of the RPCs served
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include "fsys_S.h"
+
+/* Implement fsys_get_rpc_stats as described in <hurd/fsys.defs>.  */
+kern_return_t
+diskfs_S_fsys_get_rpc_stats (struct diskfs_control *fsys,
+			     mach_port_t reply,
+			     mach_msg_type_name_t replytype,
+			     int enable,
+			     data_t *data, mach_msg_type_number_t *data_len)
+{
+  char *buf;
+  size_t len;
+  error_t err;
+
+  if (! fsys)
+    return EOPNOTSUPP;
+
+  err = ports_format_rpc_stats (&buf, &len);
+  if (err)
+    return err;
+
+  if (enable != -1)
+    ports_enable_rpc_stats (enable);
+
+  /* Move BUF from a malloced buffer into a vm_alloced one.  */
+  return iohelp_return_malloced_buffer (buf, len, data, data_len);
+}
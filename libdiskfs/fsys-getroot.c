@@ -61,6 +61,7 @@ diskfs_S_fsys_getroot (struct diskfs_control *pt,
 
   user.uids = make_idvec ();
   user.gids = make_idvec ();
+  user.idset = NULL;
   idvec_set_ids (user.uids, uids, nuids);
   idvec_set_ids (user.gids, gids, ngids);
 #define drop_idvec() idvec_free (user.gids); idvec_free (user.uids)
@@ -26,6 +26,21 @@
 
 static int thread_timeout = 1000 * 60 * 2; /* two minutes */
 static int server_timeout = 1000 * 60 * 10; /* ten minutes */
+static unsigned int max_threads;
+
+void
+diskfs_set_max_threads (unsigned int max)
+{
+  max_threads = max;
+  if (diskfs_port_bucket)
+    ports_set_bucket_max_threads (diskfs_port_bucket, max);
+}
+
+unsigned int
+diskfs_get_max_threads (void)
+{
+  return max_threads;
+}
 
 
 static void *
@@ -33,6 +48,8 @@ master_thread_function (void *demuxer)
 {
   error_t err;
 
+  /* The bucket did not exist yet when the options were parsed.  */
+  ports_set_bucket_max_threads (diskfs_port_bucket, max_threads);
 
   do
     {
@@ -23,6 +23,7 @@
 #include <device/device.h>
 #include <hurd/fsys.h>
 #include <stdio.h>
+#include <error.h>
 #include <maptime.h>
 #include <libdiskfs/journal.h>
 
@@ -100,6 +101,15 @@ diskfs_init_diskfs (void)
   _hurd_port_init (&_diskfs_exec_portcell, MACH_PORT_NULL);
 
   journal_init();
+
+  /* Give cold cache contents back when the system runs short of
+     memory.  */
+  shrinker_register (&_diskfs_node_cache_shrinker);
+  err = shrinker_start (DISKFS_SHRINK_INTERVAL);
+  if (err)
+    /* The caches only stay bigger than they need be.  */
+    error (0, err, "Warning: cannot start the cache shrinker");
+
   return 0;
 }
 
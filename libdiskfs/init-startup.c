@@ -202,6 +202,16 @@ _diskfs_init_completed (void)
   /* Contact the startup server and register our shutdown request.
      If we get an error, print an informational message. */
 
+  if (_diskfs_activate_names)
+    {
+      /* Our root and cwd are set by now; look the nodes up in the
+	 background while the boot goes on.  */
+      err = fshelp_activate_translators (_diskfs_activate_names,
+					 _diskfs_activate_names_len);
+      if (err)
+	error (0, err, "Warning: cannot start all translators for --activate");
+    }
+
   proc = getproc ();
   assert_backtrace (proc);
 
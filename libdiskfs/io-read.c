@@ -19,6 +19,10 @@
 #include "io_S.h"
 #include <fcntl.h>
 
+/* Page aligned reads of at least this much are served by mapping the
+   file's pages into the reply copy-on-write, see _diskfs_read_map.  */
+#define READ_MAP_MIN (16 * vm_page_size)
+
 /* Implement io_read as described in <hurd/io.defs>. */
 kern_return_t
 diskfs_S_io_read (struct protid *cred,
@@ -29,9 +33,11 @@ diskfs_S_io_read (struct protid *cred,
 {
   struct node *np;
   int err;
-  off_t off = offset;
+  off_t off;
   char *buf;
   int ourbuf = 0;
+  int ranged, mapped;
+  struct diskfs_range range;
 
   if (!cred)
     return EOPNOTSUPP;
@@ -42,8 +48,10 @@ diskfs_S_io_read (struct protid *cred,
 
   pthread_mutex_lock (&np->lock);
 
+ retry:
   iohelp_get_conch (&np->conch);
 
+  off = offset;
   if (off == -1)
     off = cred->po->filepointer;
   if (off < 0)
@@ -57,7 +65,18 @@ diskfs_S_io_read (struct protid *cred,
   else if (off + (off_t) maxread > np->dn_stat.st_size)
     maxread = np->dn_stat.st_size - off;
 
-  if (maxread > *datalen)
+  /* Regular files are read without holding NP's lock, see
+     _diskfs_rdwr_range.  */
+  ranged = S_ISREG (np->dn_stat.st_mode) && maxread > 0;
+  if (ranged && _diskfs_range_lock (np, &range, off, off + maxread, 0))
+    goto retry;
+
+  mapped = (ranged && maxread > *datalen && maxread >= READ_MAP_MIN
+	    && (off & (vm_page_size - 1)) == 0);
+
+  if (mapped)
+    buf = NULL;
+  else if (maxread > *datalen)
     {
       ourbuf = 1;
       buf = mmap (0, maxread, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);     
@@ -69,7 +88,27 @@ diskfs_S_io_read (struct protid *cred,
 
   *datalen = maxread;
 
-  if (maxread == 0)
+  if (ranged)
+    {
+      /* Move the file pointer now, so that concurrent reads through the
+	 same open read what follows.  */
+      if (offset == -1)
+	cred->po->filepointer = off + maxread;
+      if (mapped)
+	{
+	  err = _diskfs_read_map (np, &range, off, maxread,
+				  cred->po->openstat & O_NOATIME, &buf);
+	  if (!err)
+	    *data = buf;
+	}
+      else
+	err = _diskfs_rdwr_range (np, &range, buf, off, datalen, 0,
+				  cred->po->openstat & O_NOATIME);
+      if (offset == -1 && (err || *datalen < maxread)
+	  && cred->po->filepointer == off + maxread)
+	cred->po->filepointer = err ? off : off + *datalen;
+    }
+  else if (maxread == 0)
     err = 0;
   else if (S_ISLNK (np->dn_stat.st_mode))
     {
@@ -92,14 +131,14 @@ diskfs_S_io_read (struct protid *cred,
   else
     err = EINVAL;		/* Use read below.  */
 
-  if (err == EINVAL)
+  if (err == EINVAL && !ranged)
     err = _diskfs_rdwr_internal (np, buf, off, datalen, 0,
 				 cred->po->openstat & O_NOATIME);
 
   if (diskfs_synchronous)
     diskfs_node_update (np, 1);	/* atime! */
 
-  if (offset == -1 && !err)
+  if (offset == -1 && !err && !ranged)
     cred->po->filepointer += *datalen;
 
   if (err && ourbuf)
@@ -25,6 +25,7 @@ diskfs_S_io_readable (struct protid *cred,
 		      vm_size_t *amount)
 {
   struct node *np;
+  io_statbuf_t st;
 
   if (!cred)
     return EOPNOTSUPP;
@@ -33,7 +34,17 @@ diskfs_S_io_readable (struct protid *cred,
     return EINVAL;
 
   np = cred->po->np;
-  
+
+  /* The file pointer is only stored whole where it is no wider than a
+     word; elsewhere we need the lock to read it.  */
+  if (sizeof cred->po->filepointer <= sizeof (long)
+      && _diskfs_read_stat_snapshot (np, &st))
+    {
+      loff_t fp = __atomic_load_n (&cred->po->filepointer, __ATOMIC_RELAXED);
+      *amount = st.st_size > fp ? st.st_size - fp : 0;
+      return 0;
+    }
+
   pthread_mutex_lock (&np->lock);
   iohelp_get_conch (&np->conch);
   if (np->dn_stat.st_size > cred->po->filepointer)
@@ -25,27 +25,41 @@ diskfs_S_io_stat (struct protid *cred,
 		  io_statbuf_t *statbuf)
 {
   struct node *np;
+  int translated;
 
   if (!cred)
     return EOPNOTSUPP;
 
   np = cred->po->np;
-  pthread_mutex_lock (&np->lock);
 
-  iohelp_get_conch (&np->conch);
-  if (diskfs_synchronous)
-    diskfs_node_update (np, 1);
+  if (!diskfs_synchronous && _diskfs_read_stat_snapshot (np, statbuf))
+    /* Without the lock this may be out of date by a moment, as it
+       would be had we been called a moment earlier.  */
+    translated = fshelp_translated (&np->transbox);
   else
-    diskfs_set_node_times (np);
+    {
+      pthread_mutex_lock (&np->lock);
+
+      iohelp_get_conch (&np->conch);
+      if (diskfs_synchronous)
+	diskfs_node_update (np, 1);
+      else
+	{
+	  diskfs_set_node_times (np);
+	  _diskfs_take_stat_snapshot (np);
+	}
+
+      memcpy (statbuf, &np->dn_stat, sizeof (struct stat));
+      translated = fshelp_translated (&np->transbox);
+
+      pthread_mutex_unlock (&np->lock);
+    }
 
-  memcpy (statbuf, &np->dn_stat, sizeof (struct stat));
   statbuf->st_mode &= ~(S_IATRANS | S_IROOT);
-  if (fshelp_translated (&np->transbox))
+  if (translated)
     statbuf->st_mode |= S_IATRANS;
   if (cred->po->shadow_root == np || np == diskfs_root_node)
     statbuf->st_mode |= S_IROOT;
 
-  pthread_mutex_unlock (&np->lock);
-
   return 0;
 }
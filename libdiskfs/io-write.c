@@ -26,14 +26,23 @@ diskfs_S_io_write (struct protid *cred,
                    mach_msg_type_number_t datalen,
                    off_t offset,
                    vm_size_t *amt)
+{
+  if (!cred)
+    return EOPNOTSUPP;
+
+  return _diskfs_io_write (cred, data, datalen, offset, amt);
+}
+
+error_t
+_diskfs_io_write (struct protid *cred, const char *data, vm_size_t datalen,
+		  off_t offset, vm_size_t *amt)
 {
   struct node *np;
   error_t err;
-  off_t off = offset;
+  off_t off;
   mach_msg_type_number_t nwritten;
-
-  if (!cred)
-    return EOPNOTSUPP;
+  int ranged, was_clean, synced;
+  struct diskfs_range range;
 
   if (diskfs_check_readonly ())
     return EROFS;
@@ -46,8 +55,10 @@ diskfs_S_io_write (struct protid *cred,
 
   assert_backtrace (!S_ISDIR(np->dn_stat.st_mode));
 
+ retry:
   iohelp_get_conch (&np->conch);
 
+  off = offset;
   if (off == -1)
     {
       if (cred->po->openstat & O_APPEND)
@@ -60,13 +71,23 @@ diskfs_S_io_write (struct protid *cred,
       goto out;
     }
 
+  /* Regular files are written without holding NP's lock, see
+     _diskfs_rdwr_range.  */
+  ranged = S_ISREG (np->dn_stat.st_mode) && datalen > 0;
+  if (ranged && _diskfs_range_lock (np, &range, off, off + datalen, 1))
+    goto retry;
+
   while (off + (off_t) datalen > np->allocsize)
     {
       err = diskfs_grow (np, off + datalen, cred);
       if (diskfs_synchronous)
 	diskfs_node_update (np, 1);
       if (err)
-	goto out;
+	{
+	  if (ranged)
+	    _diskfs_range_unlock (np, &range);
+	  goto out;
+	}
       if (np->filemod_reqs)
 	diskfs_notice_filechange (np, FILE_CHANGED_EXTEND, 0, off + datalen);
     }
@@ -75,25 +96,47 @@ diskfs_S_io_write (struct protid *cred,
     {
       np->dn_stat.st_size = off + datalen;
       np->dn_set_ctime = 1;
+      /* Not just a time: fdatasync must write the new size.  */
+      np->dn_stat_dirty = 1;
       if (diskfs_synchronous)
 	diskfs_node_update (np, 1);
     }
 
+  was_clean = ! (np->dn_set_mtime || np->dn_stat_dirty);
   nwritten = datalen;
-  err = _diskfs_rdwr_internal (np, (char *) data, off, &nwritten, 1, 0);
+  if (ranged)
+    {
+      /* Move the file pointer now, so that concurrent writes through the
+	 same open go after this one.  */
+      if (offset == -1)
+	cred->po->filepointer = off + datalen;
+      err = _diskfs_rdwr_range (np, &range, (char *) data, off, &nwritten,
+				1, 0);
+      if (offset == -1 && (err || nwritten < datalen)
+	  && cred->po->filepointer == off + datalen)
+	cred->po->filepointer = err ? off : off + nwritten;
+    }
+  else
+    err = _diskfs_rdwr_internal (np, (char *) data, off, &nwritten, 1, 0);
   if (!err)
     *amt = nwritten;
 
-  if (!err && offset == -1)
+  if (!err && offset == -1 && !ranged)
     cred->po->filepointer += nwritten;
 
-  if (!err
-      && ((cred->po->openstat & O_FSYNC) || diskfs_synchronous))
+  synced = (!err
+	    && ((cred->po->openstat & O_FSYNC) || diskfs_synchronous));
+  if (synced)
     diskfs_file_update (np, 1);
 
   if (!err && np->filemod_reqs)
     diskfs_notice_filechange (np, FILE_CHANGED_WRITE, off, off + nwritten);
  out:
   pthread_mutex_unlock (&np->lock);
+
+  /* Written data stays in the pager until it is written back; keep
+     count of it, and wait here should there be too much.  */
+  if (!err && !synced && nwritten > 0)
+    _diskfs_note_dirty (nwritten, was_clean);
   return err;
 }
@@ -0,0 +1,93 @@
+/* journal_read_changes, journal_set_cursor, journal_get_cursor,
+   journal_read_history
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+
+#include "priv.h"
+#include "journal_feed.h"
+#include "journal_S.h"
+
+/* Implement journal_read_changes as described in <hurd/journal.defs>.  */
+kern_return_t
+diskfs_S_journal_read_changes (struct diskfs_control *port,
+			       uint64_t cursor, natural_t max,
+			       data_t *data, mach_msg_type_number_t *data_len,
+			       uint64_t *next)
+{
+  char *buf;
+  size_t len;
+  error_t err;
+
+  if (!port)
+    return EOPNOTSUPP;
+
+  err = journal_feed_read (cursor, max, &buf, &len, next);
+  if (err)
+    return err;
+
+  /* Move BUF from a malloced buffer into a vm_alloced one.  */
+  return iohelp_return_malloced_buffer (buf, len, data, data_len);
+}
+
+/* Implement journal_set_cursor as described in <hurd/journal.defs>.  */
+kern_return_t
+diskfs_S_journal_set_cursor (struct diskfs_control *port,
+			     const_string_t name, uint64_t cursor)
+{
+  if (!port)
+    return EOPNOTSUPP;
+
+  return journal_feed_set_cursor (name, cursor);
+}
+
+/* Implement journal_get_cursor as described in <hurd/journal.defs>.  */
+kern_return_t
+diskfs_S_journal_get_cursor (struct diskfs_control *port,
+			     const_string_t name, uint64_t *cursor)
+{
+  if (!port)
+    return EOPNOTSUPP;
+
+  return journal_feed_get_cursor (name, cursor);
+}
+
+/* Implement journal_read_history as described in <hurd/journal.defs>.  */
+kern_return_t
+diskfs_S_journal_read_history (struct diskfs_control *port,
+			       uint64_t ino, boolean_t children,
+			       uint64_t since,
+			       data_t *data, mach_msg_type_number_t *data_len)
+{
+  char *buf;
+  size_t len;
+  error_t err;
+
+  if (!port)
+    return EOPNOTSUPP;
+
+  err = journal_feed_history (children ? JOURNAL_INDEX_DIR
+			      : JOURNAL_INDEX_INODE,
+			      ino, since, &buf, &len);
+  if (err)
+    return err;
+
+  /* Move BUF from a malloced buffer into a vm_alloced one.  */
+  return iohelp_return_malloced_buffer (buf, len, data, data_len);
+}
@@ -0,0 +1,99 @@
+/* journal_fetch_stats
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "priv.h"
+#include "journal.h"
+#include "journal_S.h"
+
+static void
+print_hist (FILE *out, const char *name, const uint64_t *hist)
+{
+  fprintf (out, "%s", name);
+  for (int i = 0; i < JOURNAL_HIST_BUCKETS; i++)
+    fprintf (out, " %" PRIu64, hist[i]);
+  fputc ('\n', out);
+}
+
+/* Implement journal_fetch_stats as described in <hurd/journal.defs>.  */
+kern_return_t
+diskfs_S_journal_fetch_stats (struct diskfs_control *port,
+			      data_t *data, mach_msg_type_number_t *data_len)
+{
+  struct journal_stats stats;
+  struct diskfs_name_cache_stats nc;
+  struct ports_thread_stats ts;
+  char *buf = NULL;
+  size_t len = 0;
+
+  if (!port)
+    return EOPNOTSUPP;
+
+  FILE *out = open_memstream (&buf, &len);
+  if (!out)
+    return errno;
+
+  journal_get_stats (&stats);
+  fprintf (out, "enqueued %" PRIu64 "\n", stats.enqueued);
+  fprintf (out, "dropped %" PRIu64 "\n", stats.dropped);
+  fprintf (out, "coalesced %" PRIu64 "\n", stats.coalesced);
+  fprintf (out, "batches %" PRIu64 "\n", stats.batches);
+  print_hist (out, "batch-size", stats.batch_size);
+  print_hist (out, "flush-latency-us", stats.flush_latency);
+  fprintf (out, "syncs %" PRIu64 "\n", stats.syncs);
+  fprintf (out, "bytes-written %" PRIu64 "\n", stats.bytes_written);
+  fprintf (out, "compressed-in %" PRIu64 "\n", stats.compressed_in);
+  fprintf (out, "compressed-out %" PRIu64 "\n", stats.compressed_out);
+  fprintf (out, "replica-bytes %" PRIu64 "\n", stats.replica_bytes);
+  fprintf (out, "replica-resyncs %" PRIu64 "\n", stats.replica_resyncs);
+  fprintf (out, "replica-queued %" PRIu64 "\n", stats.replica_queued);
+  fprintf (out, "ring-used %" PRIu64 "\n", stats.ring_used);
+  fprintf (out, "ring-size %" PRIu64 "\n", stats.ring_size);
+
+  diskfs_get_name_cache_stats (&nc);
+  fprintf (out, "name-cache-hits %" PRIu64 "\n", nc.hits);
+  fprintf (out, "name-cache-negative-hits %" PRIu64 "\n", nc.negative_hits);
+  fprintf (out, "name-cache-misses %" PRIu64 "\n", nc.misses);
+  fprintf (out, "name-cache-capacity %" PRIu64 "\n", nc.capacity);
+
+  ports_get_bucket_thread_stats (diskfs_port_bucket, &ts);
+  fprintf (out, "threads %u\n", ts.threads);
+  fprintf (out, "threads-busy %u\n", ts.busy);
+  fprintf (out, "threads-max %u\n", ts.max_threads);
+  fprintf (out, "threads-saturated %" PRIu64 "\n", ts.saturated);
+  fprintf (out, "threads-wait-us %" PRIu64 "\n", ts.wait_us);
+  fprintf (out, "threads-max-wait-us %" PRIu64 "\n", ts.max_wait_us);
+  fprintf (out, "requests %" PRIu64 "\n", ts.requests);
+  fprintf (out, "requests-drained %" PRIu64 "\n", ts.drained);
+  fprintf (out, "requests-service-us %" PRIu64 "\n", ts.service_us);
+  fprintf (out, "requests-max-service-us %" PRIu64 "\n", ts.max_service_us);
+
+  diskfs_append_stats (out);
+
+  if (fclose (out) != 0)
+    {
+      free (buf);
+      return errno;
+    }
+
+  /* Move BUF from a malloced buffer into a vm_alloced one.  */
+  return iohelp_return_malloced_buffer (buf, len, data, data_len);
+}
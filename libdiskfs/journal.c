@@ -24,10 +24,15 @@
 #include <libdiskfs/journal.h>
 #include <libdiskfs/journal_writer.h>
 #include <libdiskfs/journal_globals.h>
+#include <libdiskfs/journal_monitor.h>
+#include <libdiskfs/journal_replayer.h>
+#include <libdiskfs/journal_filter.h>
+#include <libdiskfs/journal_policy.h>
 #include <diskfs.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <time.h>
 #include <stdlib.h>
@@ -35,78 +40,68 @@
 #include <hurd/fshelp.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <maptime.h>
 
 #define MAX_REASONABLE_TIME 16725229200	/* Jan 1, 2500 */
 #define MIN_REASONABLE_TIME 315536400	/* Jan 1, 1980 */
-#define IGNORE_INODE(inode) \
-  ((inode) == 82814 || (inode) == 48803 || (inode) == 49144 \
-   || (inode) == 49142 || (inode) == 48795 || (inode) == 48794)
 
-static volatile uint64_t journal_tx_id = 1;
+/* The last tx_id handed out.  RPC threads log concurrently, so it is
+   only touched atomically; see next_tx_id.  */
+static uint64_t journal_tx_id = 1;
 static volatile bool journal_shutting_down;
 static pthread_t journal_flusher_tid;
 static pthread_t monitor_tid;
 
+/* The transaction this thread is collecting events for, if any.  */
+struct journal_tx
+{
+  unsigned int depth;		/* Nesting of journal_tx_begin calls */
+  bool aborted;
+  journal_durability_t durability;	/* As the call sites ask */
+  bool caller_events;		/* Some event has no policy of its own */
+  enum journal_policy policy;	/* Strongest policy among the others */
+  unsigned int lazy_ms;		/* Shortest deadline of lazy events */
+  uint64_t tx_id;
+  size_t count;
+  size_t capacity;
+  struct journal_payload_bin *entries;
+};
+
+static __thread struct journal_tx *current_tx;
+
+/* Return a tx_id no other event has.  Allocation is a single atomic
+   add rather than per-thread ranges: checkpoints, replay and change
+   feed cursors all rely on tx_ids following the order in which events
+   were logged, which ranges handed out ahead of time would break.  */
+static inline uint64_t
+next_tx_id (void)
+{
+  return __atomic_add_fetch (&journal_tx_id, 1, __ATOMIC_RELAXED);
+}
+
+/* Read from the mapped time page rather than with gettimeofday, which
+   is an RPC.  The timestamps are only informational: replay orders
+   records by tx_id.  */
 static uint64_t
 current_time_ms (void)
 {
   struct timeval tv;
-  gettimeofday (&tv, NULL);
+  maptime_read (diskfs_mtime, &tv);
   return ((uint64_t) tv.tv_sec) * 1000 + tv.tv_usec / 1000;
 }
 
-static void *
-journal_device_monitor_thread (void *arg)
-{
-  (void) arg;
-  while (1)
-    {
-      int fd = open (RAW_DEVICE_PATH, O_RDWR);
-      if (fd >= 0)
-	{
-	  if (!journal_device_ready)
-	    {
-	      fsync (fd);
-	      char test_buf[1];
-	      ssize_t n = pread (fd, test_buf, sizeof (test_buf), 0);
-
-	      if (n == 1)
-		{
-		  journal_device_ready = true;
-		  LOG_DEBUG ("All checks worked. Journal device is ready!");
-		  pthread_mutex_lock (&queue_lock);
-		  pthread_cond_signal (&queue_cond);	// Wake queue flusher
-		  pthread_mutex_unlock (&queue_lock);
-		}
-	      else
-		{
-		  LOG_DEBUG ("pread returned %zd, still not ready", n);
-		}
-	    }
-	}
-      else
-	{
-	  if (journal_device_ready)
-	    {
-	      journal_device_ready = false;
-	      LOG_DEBUG ("Journal device is not ready.");
-	    }
-	}
-
-      if (fd >= 0)
-	close (fd);
-
-      int sleep_ms = journal_device_ready ? 1000 : 100;	// 1s if ready, 100ms if not
-      usleep (sleep_ms * 1000);
-    }
-  return NULL;
-}
-
 void
 journal_init (void)
 {
   LOG_DEBUG ("Toy journaling: journal_init() called.");
 
+  /* Start tx_ids above those of earlier runs, so that they keep growing
+     across restarts, for replay and for change feed cursors.  */
+  struct timeval tv;
+  maptime_read (diskfs_mtime, &tv);
+  __atomic_store_n (&journal_tx_id, (uint64_t) tv.tv_sec << 32,
+		    __ATOMIC_RELAXED);
+
   journal_queue_init ();
   if (pthread_create
       (&journal_flusher_tid, NULL, journal_flusher_thread, NULL) != 0)
@@ -115,6 +110,10 @@ journal_init (void)
       journal_shutting_down = true;
     }
 
+  /* Before the monitor, so that the replay sees the device become
+     ready.  */
+  journal_replay_start ();
+
   if (pthread_create (&monitor_tid, NULL, journal_device_monitor_thread, NULL)
       != 0)
     {
@@ -143,28 +142,31 @@ flush_journal_to_file (void)
   journal_flush_now ();
 }
 
-void
-journal_log_metadata (void *node_ptr, const struct journal_entry_info *info,
-		      journal_durability_t durability)
+uint64_t
+journal_checkpoint_begin (void)
 {
-  if (!node_ptr)
-    {
-      LOG_ERROR
-	("Toy journaling: NULL node_ptr received in journal_log_metadata, skipping.");
-      return;
-    }
-  if (!info)
-    {
-
-      LOG_ERROR
-	("Toy journaling: NULL info pointer received in journal_log_metadata, skipping.");
-      return;
-    }
+  /* Every event with this tx_id or a lower one is already reflected in
+     the in-core nodes the caller is about to write back.  */
+  return __atomic_load_n (&journal_tx_id, __ATOMIC_RELAXED);
+}
 
-  const struct stat *st = &((struct node *) node_ptr)->dn_stat;
-  if (IGNORE_INODE (st->st_ino))
+void
+journal_checkpoint_commit (uint64_t checkpoint)
+{
+  if (!journal_device_ready)
     return;
 
+  if (!journal_write_checkpoint (checkpoint))
+    LOG_ERROR ("Toy journaling: checkpoint at tx %" PRIu64 " failed.",
+	       checkpoint);
+}
+
+/* Fill ENTRY, which may hold stale data, from ST and INFO as part of
+   transaction TX_ID.  */
+static void
+fill_payload (struct journal_payload_bin *entry, const struct stat *st,
+	      const struct journal_entry_info *info, uint64_t tx_id)
+{
   const char *action = info->action ? : "";
   const char *name = info->name ? : "";
   const char *extra = info->extra ? : "";
@@ -172,20 +174,12 @@ journal_log_metadata (void *node_ptr, const struct journal_entry_info *info,
   const char *new_name = info->new_name ? : "";
   const char *target = info->target ? info->target : "";
 
-  size_t total_size = sizeof (struct journal_payload_bin);
-  if (total_size > JOURNAL_ENTRY_SIZE)
-    {
-      LOG_ERROR ("Toy journaling: entry too large, dropped.");
-      return;
-    }
-
-  char *buf = calloc (1, total_size);
-  if (!buf)
-    return;
-
-  struct journal_payload_bin *entry = (struct journal_payload_bin *) buf;
+  /* The string fields are fully overwritten by strncpy below.  */
+  memset (entry, 0, offsetof (struct journal_payload_bin, action));
 
-  entry->tx_id = ++journal_tx_id;
+  entry->tx_id = tx_id;
+  entry->tx_remaining = 0;
+  entry->tx_records = 1;
   entry->timestamp_ms = current_time_ms ();
 
   entry->parent_ino = (journal_ino_t) info->parent_ino;
@@ -237,15 +231,229 @@ journal_log_metadata (void *node_ptr, const struct journal_entry_info *info,
   entry->old_name[sizeof (entry->old_name) - 1] = '\0';
   entry->new_name[sizeof (entry->new_name) - 1] = '\0';
   entry->target[sizeof (entry->target) - 1] = '\0';
+}
+
+/* Fill ENTRY with a revoke record for inode INO in transaction TX_ID.  */
+static void
+fill_revoke (struct journal_payload_bin *entry, ino_t ino, uint64_t tx_id)
+{
+  memset (entry, 0, sizeof *entry);
+  entry->tx_id = tx_id;
+  entry->tx_records = 1;
+  entry->timestamp_ms = current_time_ms ();
+  entry->ino = (journal_ino_t) ino;
+  strcpy (entry->action, "revoke");
+}
+
+void
+journal_log_metadata (void *node_ptr, const struct journal_entry_info *info,
+		      journal_durability_t durability)
+{
+  if (!node_ptr)
+    {
+      LOG_ERROR
+	("Toy journaling: NULL node_ptr received in journal_log_metadata, skipping.");
+      return;
+    }
+  if (!info)
+    {
+
+      LOG_ERROR
+	("Toy journaling: NULL info pointer received in journal_log_metadata, skipping.");
+      return;
+    }
+
+  const struct stat *st = &((struct node *) node_ptr)->dn_stat;
+  if (journal_filter_skip (st, info))
+    return;
+
+  unsigned int lazy_ms = 0;
+  enum journal_policy policy = journal_policy_for (info->action, &lazy_ms);
+
+  if (current_tx)
+    {
+      if (durability == JOURNAL_DURABILITY_SYNC
+	  && policy == JOURNAL_POLICY_CALLER)
+	current_tx->durability = JOURNAL_DURABILITY_SYNC;
+      journal_tx_add (node_ptr, info);
+      return;
+    }
+
+  if (st->st_nlink == 0)
+    {
+      /* The event goes out together with the revoke record that
+         journal_tx_add puts in front of it.  */
+      journal_tx_begin ();
+      if (current_tx)
+	{
+	  journal_tx_add (node_ptr, info);
+	  journal_tx_commit (durability);
+	  return;
+	}
+    }
+
+  if (policy != JOURNAL_POLICY_CALLER)
+    durability = (policy == JOURNAL_POLICY_SYNC
+		  ? JOURNAL_DURABILITY_SYNC : JOURNAL_DURABILITY_ASYNC);
 
   if (journal_device_ready && durability == JOURNAL_DURABILITY_SYNC)
     {
-      if (!journal_write_raw_sync (entry))
+      /* The caller blocks until the record is written, so it can live on
+         the stack.  */
+      struct journal_payload_bin entry;
+      fill_payload (&entry, st, info, next_tx_id ());
+      if (!journal_write_raw_sync (&entry))
 	LOG_ERROR ("Failed to write sync.");
     }
   else
     {
-      journal_enqueue (buf, total_size);
+      struct journal_payload_bin *slot = journal_queue_reserve ();
+      if (!slot)
+	return;
+      fill_payload (slot, st, info, next_tx_id ());
+      journal_queue_commit (slot);
+      if (policy == JOURNAL_POLICY_LAZY)
+	journal_flush_within (lazy_ms);
+    }
+}
+
+void
+journal_tx_begin (void)
+{
+  if (current_tx)
+    {
+      current_tx->depth++;
+      return;
+    }
+
+  current_tx = calloc (1, sizeof *current_tx);
+  if (!current_tx)
+    {
+      /* Events are then logged one by one, as without a transaction.  */
+      LOG_ERROR ("Toy journaling: out of memory starting a transaction.");
+      return;
+    }
+  current_tx->depth = 1;
+  current_tx->durability = JOURNAL_DURABILITY_ASYNC;
+}
+
+void
+journal_tx_add (void *node_ptr, const struct journal_entry_info *info)
+{
+  struct journal_tx *tx = current_tx;
+
+  if (!tx)
+    {
+      journal_log_metadata (node_ptr, info, JOURNAL_DURABILITY_ASYNC);
+      return;
+    }
+  if (!node_ptr || !info)
+    {
+      LOG_ERROR ("Toy journaling: NULL argument to journal_tx_add, skipping.");
+      return;
+    }
+
+  const struct stat *st = &((struct node *) node_ptr)->dn_stat;
+  if (tx->aborted || journal_filter_skip (st, info))
+    return;
+
+  if (tx->count + 2 > tx->capacity)
+    {
+      size_t capacity = tx->capacity ? tx->capacity * 2 : 4;
+      struct journal_payload_bin *entries =
+	realloc (tx->entries, capacity * sizeof *entries);
+      if (!entries)
+	{
+	  LOG_ERROR ("Toy journaling: out of memory, aborting transaction.");
+	  tx->aborted = true;
+	  return;
+	}
+      tx->entries = entries;
+      tx->capacity = capacity;
+    }
+
+  unsigned int lazy_ms = 0;
+  enum journal_policy policy = journal_policy_for (info->action, &lazy_ms);
+  if (policy == JOURNAL_POLICY_CALLER)
+    tx->caller_events = true;
+  else
+    {
+      if (policy == JOURNAL_POLICY_LAZY
+	  && (tx->policy != JOURNAL_POLICY_LAZY || lazy_ms < tx->lazy_ms))
+	tx->lazy_ms = lazy_ms;
+      if (policy > tx->policy)
+	tx->policy = policy;
+    }
+
+  if (tx->count == 0)
+    tx->tx_id = next_tx_id ();
+  if (st->st_nlink == 0)
+    /* The inode is going away and its number may be reused, so what the
+       journal says about it so far no longer applies.  */
+    fill_revoke (&tx->entries[tx->count++], st->st_ino, tx->tx_id);
+  fill_payload (&tx->entries[tx->count++], st, info, tx->tx_id);
+}
+
+/* Leave one level of the current transaction; at the outermost level
+   write it out unless it was aborted.  */
+static void
+journal_tx_end (void)
+{
+  struct journal_tx *tx = current_tx;
+
+  if (!tx || --tx->depth > 0)
+    return;
+  current_tx = NULL;
+
+  if (!tx->aborted && tx->count > 0)
+    {
+      for (size_t i = 0; i < tx->count; i++)
+	{
+	  tx->entries[i].tx_remaining = tx->count - 1 - i;
+	  tx->entries[i].tx_records = tx->count;
+	}
+
+      /* Events with a policy of their own follow it; the others what
+         the call sites asked for.  */
+      bool sync = tx->policy == JOURNAL_POLICY_SYNC
+	|| (tx->caller_events && tx->durability == JOURNAL_DURABILITY_SYNC);
+
+      if (journal_device_ready && sync)
+	{
+	  if (!journal_write_raw_sync_n (tx->entries, tx->count))
+	    LOG_ERROR ("Failed to write sync.");
+	}
+      else
+	/* If some of these are dropped on overflow, replay discards the
+	   whole transaction.  */
+	for (size_t i = 0; i < tx->count; i++)
+	  {
+	    struct journal_payload_bin *slot = journal_queue_reserve ();
+	    if (!slot)
+	      break;
+	    memcpy (slot, &tx->entries[i], sizeof *slot);
+	    journal_queue_commit (slot);
+	  }
+      if (!sync && tx->policy == JOURNAL_POLICY_LAZY)
+	journal_flush_within (tx->lazy_ms);
     }
-  free (buf);
+
+  free (tx->entries);
+  free (tx);
+}
+
+void
+journal_tx_commit (journal_durability_t durability)
+{
+  if (current_tx && durability == JOURNAL_DURABILITY_SYNC)
+    current_tx->durability = JOURNAL_DURABILITY_SYNC;
+  journal_tx_end ();
+}
+
+void
+journal_tx_abort (void)
+{
+  if (current_tx)
+    current_tx->aborted = true;
+  journal_tx_end ();
 }
@@ -23,6 +23,7 @@
 #define JOURNAL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 struct journal_entry_info
@@ -57,5 +58,170 @@ void journal_shutdown (void);
 void flush_journal_to_file (void);
 void journal_log_metadata (void *node_ptr, const struct journal_entry_info *info,  journal_durability_t  durability);
 
+/* Transactions.  Between journal_tx_begin and journal_tx_commit the
+   events this thread logs, through journal_tx_add or
+   journal_log_metadata, are collected and written as one group sharing
+   a tx_id, with a single durability barrier; replay ignores a group
+   whose last record is missing.  The group is synchronous if the commit
+   or any of its events asks for it.  Transactions nest, and only the
+   outermost commit writes.  journal_tx_abort drops the whole
+   transaction.  */
+void journal_tx_begin (void);
+void journal_tx_add (void *node_ptr, const struct journal_entry_info *info);
+void journal_tx_commit (journal_durability_t durability);
+void journal_tx_abort (void);
+
+/* Checkpointing.  Call journal_checkpoint_begin before writing all
+   metadata back to disk, and pass its result to
+   journal_checkpoint_commit once that write has completed; the journal
+   then stops retaining the events made durable by it, so replay only
+   covers what was logged since.  */
+uint64_t journal_checkpoint_begin (void);
+void journal_checkpoint_commit (uint64_t checkpoint);
+
+/* Use SPEC, a file name or a TYPE:NAME store spec, as the journal
+   device.  Must be called before journal_init.  */
+void journal_set_device (const char *spec);
+
+/* Give a new journal SIZE bytes of its device, a number with an
+   optional K, M or G suffix, rounded down to whole 4 KiB blocks; the
+   default is 8M.  A journal keeps the size it was formatted with, so
+   this only takes effect when it is formatted or opened empty.  Must be
+   called before journal_init.  Return 0, or EINVAL if SIZE is malformed
+   or out of range.  */
+int journal_set_size (const char *size);
+uint64_t journal_get_size (void);
+
+/* Flush tuning.  The flusher waits at most the flush delay (in
+   milliseconds) after an event is queued, and less when the load
+   allows; it flushes early once roughly the flush byte count is
+   waiting.  */
+void journal_set_flush_delay (unsigned int ms);
+unsigned int journal_get_flush_delay (void);
+void journal_set_flush_bytes (size_t bytes);
+size_t journal_get_flush_bytes (void);
+
+/* What journal_log_metadata does with an asynchronous event when the
+   queue is full.  */
+enum journal_overflow_policy
+{
+	JOURNAL_OVERFLOW_DROP,	/* Lose the event.  */
+	JOURNAL_OVERFLOW_FLUSH,	/* Kick the flusher and retry briefly.  */
+	JOURNAL_OVERFLOW_BLOCK,	/* Wait a bounded time for room.  */
+	JOURNAL_OVERFLOW_SPILL	/* Queue it in a heap overflow arena.  */
+};
+
+struct journal_overflow_stats
+{
+	uint64_t blocked;	/* Producers that waited for room.  */
+	uint64_t block_timeouts;	/* ... and gave up.  */
+	uint64_t flushed;	/* Early flushes kicked by a full queue.  */
+	uint64_t spilled;	/* Events put in the overflow arena.  */
+	uint64_t dropped;	/* Events lost anyway.  */
+};
+
+/* Set the overflow policy from SPEC, one of "drop", "flush", "spill",
+   "block" or "block:MS".  Return 0 or EINVAL.  */
+int journal_set_overflow (const char *spec);
+/* Write the current policy, in the form journal_set_overflow takes, to
+   BUF.  */
+void journal_get_overflow (char *buf, size_t size);
+void journal_get_overflow_stats (struct journal_overflow_stats *stats);
+
+/* Leave the events SPEC describes out of the journal.  SPEC is a
+   comma-separated list of inode numbers or ranges ("N" or "N-M"),
+   "dir:N" for the directory N, whatever is done in it and in the
+   directories later made in it, and "action:NAME" for an action such
+   as "utimes".  An empty SPEC excludes nothing.  Return 0, EINVAL or
+   ENOMEM.  */
+int journal_set_exclude (const char *spec);
+/* Return a malloced copy of the SPEC last given to
+   journal_set_exclude, or NULL if nothing is excluded.  */
+char *journal_get_exclude (void);
+
+/* Override the durability the call sites ask for.  SPEC is a
+   comma-separated list of ACTION=POLICY items and of bare POLICYs,
+   which apply to the actions not listed; POLICY is "default" (as the
+   call site asks), "sync", "async", or "lazy[:MS]", which queues the
+   event but has it written within MS milliseconds.  Return 0, EINVAL
+   or ENOMEM.  */
+int journal_set_durability (const char *spec);
+/* Return a malloced copy of the SPEC last given to
+   journal_set_durability, or NULL if the call sites decide.  */
+char *journal_get_durability (void);
+
+/* Store the records the journal flushes as compressed frames if METHOD
+   is "lz4", or as they are if it is "none", the default.  Return 0 or
+   EINVAL.  */
+int journal_set_compression (const char *method);
+/* Return the METHOD last given to journal_set_compression.  */
+const char *journal_get_compression (void);
+
+/* Copy the journal to a second store as it is written: SPEC is a path
+   or store spec as for the journal itself, "tcp:HOST:PORT" or
+   "unix:PATH" for journalrecv listening there, or "none" or "" for no
+   replica.  Return 0, EINVAL or ENOMEM.  */
+int journal_set_replica (const char *spec);
+/* Return a malloced copy of the SPEC last given to journal_set_replica,
+   or NULL without a replica.  */
+char *journal_get_replica (void);
+
+/* Whether durable journal writes wait for the replica: with POLICY
+   "async", the default, they are copied to it in the background, with
+   "sync" they are only durable once they are durable there.  Return 0
+   or EINVAL.  */
+int journal_set_replica_policy (const char *policy);
+const char *journal_get_replica_policy (void);
+
+/* What the journal sends to a replica over a socket: a message header
+   followed by LENGTH bytes to be written at OFFSET in the replica, in
+   the byte order of the journal itself.  A message with
+   JOURNAL_REPLICA_SYNC set, and no data, asks for what was written so
+   far to be made durable; it is answered with a uint32_t, 0 or an
+   error code.  */
+#define JOURNAL_REPLICA_MAGIC	0x4A4E4C52	/* "JNLR" */
+#define JOURNAL_REPLICA_SYNC	0x1
+#define JOURNAL_REPLICA_MAX_LEN	(1024 * 1024)	/* Most data in a message */
+
+struct __attribute__((__packed__)) journal_replica_msg
+{
+	uint32_t magic;
+	uint32_t flags;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t reserved;
+};
+
+/* Runtime statistics.  Histogram bucket 0 counts zeros, bucket
+   I values from 2^(I-1) to 2^I - 1, and the last bucket everything
+   larger.  */
+#define JOURNAL_HIST_BUCKETS 16
+
+struct journal_stats
+{
+	uint64_t enqueued;	/* Events taken from the queue.  */
+	uint64_t dropped;	/* Events lost, for whatever reason.  */
+	uint64_t coalesced;	/* Events merged into a later one.  */
+	uint64_t batches;	/* Batches handed to the writer.  */
+	uint64_t batch_size[JOURNAL_HIST_BUCKETS];	/* Records per batch.  */
+	uint64_t flush_latency[JOURNAL_HIST_BUCKETS];	/* Microseconds.  */
+	uint64_t syncs;		/* Journal device syncs.  */
+	uint64_t bytes_written;	/* Bytes written to the journal device.  */
+	uint64_t compressed_in;	/* Bytes of records put in frames.  */
+	uint64_t compressed_out;	/* Bytes of the frames they made.  */
+	uint64_t replica_bytes;	/* Bytes sent to the replica.  */
+	uint64_t replica_resyncs;	/* Times it was copied whole.  */
+	uint64_t replica_queued;	/* Bytes waiting to be sent to it.  */
+	uint64_t ring_used;	/* Bytes of the ring holding records.  */
+	uint64_t ring_size;	/* Bytes the ring can hold.  */
+};
+
+void journal_get_stats (struct journal_stats *stats);
+
+/* How much the journal reports on stderr: 0 nothing, 1 errors, 2 also
+   debugging output.  The default is 1.  */
+void journal_set_log_level (int level);
+int journal_get_log_level (void);
+
 #endif /* JOURNAL_H */
 
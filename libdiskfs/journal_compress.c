@@ -0,0 +1,223 @@
+/* journal_compress.c - Compression of journal frames
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Frames are compressed in the LZ4 block format, so that they can be
+   inspected with standard tools, but the codec is our own: it only
+   ever sees one frame of at most JOURNAL_FRAME_RAW_MAX bytes, and
+   greedy matching with a small hash table is enough for records that
+   repeat the same inode numbers, modes and name prefixes.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_compress.h>
+#include <libdiskfs/journal_format.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ4_MINMATCH	4
+#define LZ4_LASTLITERALS 5	/* Bytes at the end always left literal */
+#define LZ4_MFLIMIT	12	/* No match starts in this many last bytes */
+#define LZ4_MAX_OFFSET	65535
+#define LZ4_HASH_BITS	12
+
+static bool compression_enabled;
+
+static inline uint32_t
+hash4 (const unsigned char *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Store the length N, of which the token already holds up to 15, as
+   LZ4 extension bytes at *OP.  */
+static inline void
+put_length (unsigned char **op, size_t n)
+{
+  for (; n >= 255; n -= 255)
+    *(*op)++ = 255;
+  *(*op)++ = (unsigned char) n;
+}
+
+/* Emit the literals from ANCHOR to IP, followed by a match of MATCHLEN
+   bytes OFFSET back unless MATCHLEN is 0.  */
+static bool
+put_sequence (unsigned char **op, const unsigned char *oend,
+	      const unsigned char *anchor, const unsigned char *ip,
+	      size_t offset, size_t matchlen)
+{
+  size_t litlen = ip - anchor;
+  size_t need = 1 + litlen + litlen / 255 + 1
+    + (matchlen ? 2 + (matchlen - LZ4_MINMATCH) / 255 + 1 : 0);
+  if ((size_t) (oend - *op) < need)
+    return false;
+
+  unsigned char *token = (*op)++;
+  *token = (litlen >= 15 ? 15 : litlen) << 4;
+  if (litlen >= 15)
+    put_length (op, litlen - 15);
+  memcpy (*op, anchor, litlen);
+  *op += litlen;
+
+  if (matchlen)
+    {
+      size_t m = matchlen - LZ4_MINMATCH;
+      *(*op)++ = offset & 0xff;
+      *(*op)++ = offset >> 8;
+      *token |= m >= 15 ? 15 : m;
+      if (m >= 15)
+	put_length (op, m - 15);
+    }
+  return true;
+}
+
+size_t
+journal_lz4_compress (const void *src, size_t len, void *dst, size_t size)
+{
+  const unsigned char *in = src, *end = in + len;
+  const unsigned char *ip = in, *anchor = in;
+  unsigned char *op = dst, *oend = op + size;
+  uint16_t table[1 << LZ4_HASH_BITS];
+
+  if (len > JOURNAL_FRAME_RAW_MAX)
+    return 0;
+
+  if (len > LZ4_MFLIMIT)
+    {
+      const unsigned char *mflimit = end - LZ4_MFLIMIT;
+      const unsigned char *matchlimit = end - LZ4_LASTLITERALS;
+
+      /* Stale entries are harmless: every candidate is compared.  */
+      memset (table, 0, sizeof table);
+      while (ip < mflimit)
+	{
+	  uint32_t h = hash4 (ip);
+	  const unsigned char *ref = in + table[h];
+	  table[h] = ip - in;
+
+	  if (ref >= ip || ip - ref > LZ4_MAX_OFFSET
+	      || memcmp (ref, ip, LZ4_MINMATCH) != 0)
+	    {
+	      ip++;
+	      continue;
+	    }
+
+	  const unsigned char *m = ip + LZ4_MINMATCH;
+	  const unsigned char *r = ref + LZ4_MINMATCH;
+	  while (m < matchlimit && *m == *r)
+	    m++, r++;
+	  while (ip > anchor && ref > in && ip[-1] == ref[-1])
+	    ip--, ref--;
+
+	  if (!put_sequence (&op, oend, anchor, ip, ip - ref, m - ip))
+	    return 0;
+	  ip = anchor = m;
+	}
+    }
+
+  if (!put_sequence (&op, oend, anchor, end, 0, 0))
+    return 0;
+  return op - (unsigned char *) dst;
+}
+
+/* Add the LZ4 extension bytes at *IP to *N.  */
+static inline bool
+get_length (const unsigned char **ip, const unsigned char *iend, size_t *n)
+{
+  unsigned char b;
+  do
+    {
+      if (*ip >= iend)
+	return false;
+      b = *(*ip)++;
+      *n += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+size_t
+journal_lz4_decompress (const void *src, size_t len, void *dst, size_t size)
+{
+  const unsigned char *ip = src, *iend = ip + len;
+  unsigned char *out = dst, *op = out, *oend = out + size;
+
+  while (ip < iend)
+    {
+      unsigned char token = *ip++;
+      size_t litlen = token >> 4;
+      if (litlen == 15 && !get_length (&ip, iend, &litlen))
+	return 0;
+      if (litlen > (size_t) (iend - ip) || litlen > (size_t) (oend - op))
+	return 0;
+      memcpy (op, ip, litlen);
+      op += litlen;
+      ip += litlen;
+
+      /* The last sequence has no match.  */
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	return 0;
+      size_t offset = ip[0] | (size_t) ip[1] << 8;
+      ip += 2;
+      if (offset == 0 || offset > (size_t) (op - out))
+	return 0;
+
+      size_t matchlen = token & 15;
+      if (matchlen == 15 && !get_length (&ip, iend, &matchlen))
+	return 0;
+      matchlen += LZ4_MINMATCH;
+      if (matchlen > (size_t) (oend - op))
+	return 0;
+
+      /* The match may overlap what it produces.  */
+      const unsigned char *ref = op - offset;
+      while (matchlen-- > 0)
+	*op++ = *ref++;
+    }
+
+  return op - out;
+}
+
+bool
+journal_compression_enabled (void)
+{
+  return __atomic_load_n (&compression_enabled, __ATOMIC_RELAXED);
+}
+
+int
+journal_set_compression (const char *method)
+{
+  if (strcmp (method, "none") == 0)
+    __atomic_store_n (&compression_enabled, false, __ATOMIC_RELAXED);
+  else if (strcmp (method, "lz4") == 0)
+    __atomic_store_n (&compression_enabled, true, __ATOMIC_RELAXED);
+  else
+    return EINVAL;
+  return 0;
+}
+
+const char *
+journal_get_compression (void)
+{
+  return journal_compression_enabled () ? "lz4" : "none";
+}
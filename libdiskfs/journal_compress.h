@@ -0,0 +1,41 @@
+/* journal_compress.h - Compression of journal frames
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_COMPRESS_H
+#define JOURNAL_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compress the LEN bytes at SRC, at most JOURNAL_FRAME_RAW_MAX, into
+   DST, which has room for SIZE bytes, as an LZ4 block.  Return the
+   compressed length, or 0 if it does not fit.  */
+size_t journal_lz4_compress (const void *src, size_t len,
+			     void *dst, size_t size);
+
+/* Expand the LZ4 block of LEN bytes at SRC into DST, which has room for
+   SIZE bytes.  Return the expanded length, or 0 if the block is
+   malformed or does not fit.  */
+size_t journal_lz4_decompress (const void *src, size_t len,
+			       void *dst, size_t size);
+
+/* Whether flushed records are to be written as compressed frames.  */
+bool journal_compression_enabled (void);
+
+#endif /* JOURNAL_COMPRESS_H */
@@ -0,0 +1,391 @@
+/* journal_device.c - Journal device access
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* A journal given as a plain path is accessed with the POSIX calls, as
+   it always was.  A TYPE:NAME store spec is opened with libstore and
+   written with store_write, which goes straight to the device instead
+   of through the translator serving a file.  A path naming a device
+   node, such as one served by storeio, is opened as the device store
+   underneath it for the same reason: the node's own cache would hold a
+   second copy of every journal page.  */
+
+#include <libdiskfs/journal_device.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_globals.h>
+#include <libdiskfs/journal_stats.h>
+#include <hurd.h>
+#include <hurd/store.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct journal_dev
+{
+  int fd;			/* For a plain path, or -1 */
+  struct store *store;		/* For a store spec, or null */
+};
+
+static char *configured_spec;
+static uint64_t configured_size = JOURNAL_DEFAULT_SIZE;
+
+void
+journal_set_device (const char *spec)
+{
+  char *copy = spec ? strdup (spec) : NULL;
+  if (spec && !copy)
+    {
+      LOG_ERROR ("journal_set_device: out of memory");
+      return;
+    }
+  free (configured_spec);
+  configured_spec = copy;
+}
+
+int
+journal_set_size (const char *size)
+{
+  char *end;
+  uint64_t unit = 1;
+  errno = 0;
+  uint64_t bytes = strtoull (size, &end, 0);
+
+  switch (*end)
+    {
+    case 'G': case 'g': unit *= 1024;	/* Fall through.  */
+    case 'M': case 'm': unit *= 1024;	/* Fall through.  */
+    case 'K': case 'k': unit *= 1024; end++; break;
+    }
+  if (errno || end == size || *end != '\0' || size[0] == '-'
+      || bytes > JOURNAL_MAX_SIZE / unit)
+    return EINVAL;
+  bytes *= unit;
+  if (bytes < JOURNAL_MIN_SIZE)
+    return EINVAL;
+
+  configured_size = bytes - bytes % JOURNAL_ENTRY_SIZE;
+  return 0;
+}
+
+uint64_t
+journal_get_size (void)
+{
+  return configured_size;
+}
+
+const char *
+journal_dev_spec (void)
+{
+  return configured_spec ?: RAW_DEVICE_PATH;
+}
+
+/* Return whether SPEC names a store type rather than a path.  */
+static bool
+is_store_spec (const char *spec)
+{
+  return spec[0] != '/' && strchr (spec, ':') != NULL;
+}
+
+const char *
+journal_dev_file_name (void)
+{
+  const char *spec = journal_dev_spec ();
+
+  if (!is_store_spec (spec))
+    return spec;
+  if (strncmp (spec, "file:", 5) == 0 && spec[5] == '/')
+    return spec + 5;
+  return NULL;
+}
+
+/* If DEV->fd is a device node, replace it with the device store it is
+   served from.  Return false if DEV should keep using the node.  */
+static bool
+open_node_device (struct journal_dev *dev)
+{
+  struct stat st;
+  if (fstat (dev->fd, &st) < 0
+      || !(S_ISBLK (st.st_mode) || S_ISCHR (st.st_mode)))
+    return false;
+
+  file_t node = getdport (dev->fd);
+  if (node == MACH_PORT_NULL)
+    return false;
+
+  struct store *store;
+  error_t err = store_create (node, 0, NULL, &store);
+  if (err)
+    {
+      mach_port_deallocate (mach_task_self (), node);
+      return false;
+    }
+  if (store->class->id != STORAGE_DEVICE || store->size < JOURNAL_MIN_SIZE)
+    {
+      store_free (store);
+      return false;
+    }
+
+  close (dev->fd);
+  dev->fd = -1;
+  dev->store = store;
+  return true;
+}
+
+/* Make sure the journal file behind DEV->fd has all its space
+   allocated, so that ring writes never fill holes and the unused part
+   of a new journal reads back as zeros.  */
+static void
+preallocate_file (struct journal_dev *dev, const char *spec)
+{
+  struct stat st;
+  off_t size = journal_get_size ();
+  if (fstat (dev->fd, &st) < 0 || !S_ISREG (st.st_mode)
+      || st.st_size >= size)
+    return;
+
+  int err = posix_fallocate (dev->fd, 0, size);
+  if (err)
+    LOG_ERROR ("journal: cannot preallocate %s: %s", spec, strerror (err));
+  else
+    fsync (dev->fd);
+}
+
+struct journal_dev *
+journal_dev_open (const char *spec)
+{
+  struct journal_dev *dev = malloc (sizeof *dev);
+  if (!dev)
+    return NULL;
+  dev->fd = -1;
+  dev->store = NULL;
+
+  if (!spec)
+    spec = journal_dev_spec ();
+
+  if (!is_store_spec (spec))
+    {
+      dev->fd = open (spec, O_RDWR);
+      if (dev->fd < 0)
+	{
+	  free (dev);
+	  return NULL;
+	}
+      if (!open_node_device (dev))
+	preallocate_file (dev, spec);
+      return dev;
+    }
+
+  error_t err = store_typed_open (spec, 0, NULL, &dev->store);
+  if (!err && dev->store->size < JOURNAL_MIN_SIZE)
+    {
+      LOG_ERROR ("journal: %s holds %lld bytes, need %d", spec,
+		 (long long) dev->store->size, JOURNAL_MIN_SIZE);
+      store_free (dev->store);
+      err = ENOSPC;
+    }
+  if (err)
+    {
+      free (dev);
+      errno = err;
+      return NULL;
+    }
+  return dev;
+}
+
+off_t
+journal_dev_size (struct journal_dev *dev)
+{
+  struct stat st;
+
+  if (dev->store)
+    return dev->store->size;
+  if (fstat (dev->fd, &st) < 0 || !S_ISREG (st.st_mode))
+    return -1;
+  return st.st_size;
+}
+
+void
+journal_dev_close (struct journal_dev *dev)
+{
+  if (!dev)
+    return;
+  if (dev->fd >= 0)
+    close (dev->fd);
+  if (dev->store)
+    store_free (dev->store);
+  free (dev);
+}
+
+/* Read the whole blocks of STORE covering LEN bytes at OFFSET into BUF,
+   which has room for them.  */
+static error_t
+store_read_blocks (struct store *store, void *buf, size_t len, off_t offset)
+{
+  size_t bsize = store->block_size;
+
+  while (len > 0)
+    {
+      void *data = buf;
+      size_t data_len = len;
+      error_t err = store_read (store, offset / bsize, len, &data, &data_len);
+      if (err)
+	return err;
+      if (data_len == 0)
+	return EIO;
+      if (data_len > len)
+	data_len = len;
+      if (data != buf)
+	{
+	  memcpy (buf, data, data_len);
+	  munmap (data, data_len);
+	}
+      buf = (char *) buf + data_len;
+      offset += data_len;
+      len -= data_len;
+    }
+  return 0;
+}
+
+ssize_t
+journal_dev_pread (struct journal_dev *dev, void *buf, size_t len,
+		   off_t offset)
+{
+  if (dev->fd >= 0)
+    return pread (dev->fd, buf, len, offset);
+
+  size_t bsize = dev->store->block_size;
+  off_t first = offset - offset % bsize;
+  size_t span = (offset + len + bsize - 1) / bsize * bsize - first;
+  if (offset >= dev->store->size)
+    return 0;
+  if (first + span > dev->store->size)
+    span = dev->store->size - first;
+
+  char *block_buf = buf;
+  if (first != offset || span != len)
+    {
+      block_buf = malloc (span);
+      if (!block_buf)
+	return -1;
+    }
+
+  error_t err = store_read_blocks (dev->store, block_buf, span, first);
+  size_t done = span - (offset - first) < len ? span - (offset - first) : len;
+  if (!err && block_buf != buf)
+    memcpy (buf, block_buf + (offset - first), done);
+  if (block_buf != buf)
+    free (block_buf);
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return done;
+}
+
+ssize_t
+journal_dev_pwrite (struct journal_dev *dev, const void *buf, size_t len,
+		    off_t offset)
+{
+  if (dev->fd >= 0)
+    {
+      ssize_t written = pwrite (dev->fd, buf, len, offset);
+      if (written > 0)
+	journal_stats_write (written);
+      return written;
+    }
+
+  size_t bsize = dev->store->block_size;
+  off_t first = offset - offset % bsize;
+  size_t span = (offset + len + bsize - 1) / bsize * bsize - first;
+  if (first + span > dev->store->size)
+    {
+      errno = ENOSPC;
+      return -1;
+    }
+
+  const char *block_buf = buf;
+  char *bounce = NULL;
+  error_t err = 0;
+  if (first != offset || span != len)
+    {
+      /* Merge the partial blocks at either end with what is on disk.  */
+      /* Page aligned, so that the device can take it without a copy.  */
+      err = posix_memalign ((void **) &bounce, getpagesize (), span);
+      if (err)
+	{
+	  errno = err;
+	  return -1;
+	}
+      if (offset != first)
+	err = store_read_blocks (dev->store, bounce, bsize, first);
+      if (!err && (offset + len) % bsize != 0
+	  && (span > bsize || offset == first))
+	err = store_read_blocks (dev->store, bounce + span - bsize, bsize,
+				 first + span - bsize);
+      memcpy (bounce + (offset - first), buf, len);
+      block_buf = bounce;
+    }
+
+  size_t written = 0;
+  while (!err && written < span)
+    {
+      size_t amount;
+      err = store_write (dev->store, (first + written) / bsize,
+			 block_buf + written, span - written, &amount);
+      if (!err && amount == 0)
+	err = EIO;
+      written += amount;
+    }
+
+  free (bounce);
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  journal_stats_write (len);
+  return len;
+}
+
+int
+journal_dev_sync (struct journal_dev *dev)
+{
+  journal_stats_sync ();
+  if (dev->fd >= 0)
+    return fsync (dev->fd);
+
+  /* store_write to a device only returns once the device has the data;
+     a file store needs its server told.  */
+  if (dev->store->class->id == STORAGE_HURD_FILE)
+    {
+      error_t err = file_sync (dev->store->port, 1, 0);
+      if (err)
+	{
+	  errno = err;
+	  return -1;
+	}
+    }
+  return 0;
+}
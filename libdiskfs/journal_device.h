@@ -0,0 +1,59 @@
+/* journal_device.h - Journal device access
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_DEVICE_H
+#define JOURNAL_DEVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* An open journal device.  The journal is either a plain file, named by
+   a path, or any store libstore can open from a TYPE:NAME spec such as
+   device:hd0s3, part:2:device:hd0 or file:/var/journal.  */
+struct journal_dev;
+
+/* Open the journal named by SPEC, or the configured one if SPEC is
+   null.  Return null and set errno on failure.  */
+struct journal_dev *journal_dev_open (const char *spec);
+void journal_dev_close (struct journal_dev *dev);
+
+/* Like pread and pwrite, at byte offsets; any alignment the device
+   needs is handled here.  */
+ssize_t journal_dev_pread (struct journal_dev *dev, void *buf, size_t len,
+			   off_t offset);
+ssize_t journal_dev_pwrite (struct journal_dev *dev, const void *buf,
+			    size_t len, off_t offset);
+
+/* Return the bytes DEV holds, or -1 if that is not known.  */
+off_t journal_dev_size (struct journal_dev *dev);
+
+/* Make completed writes durable.  Return 0, or -1 and set errno.  */
+int journal_dev_sync (struct journal_dev *dev);
+
+/* The configured journal spec.  */
+const char *journal_dev_spec (void);
+
+/* If the configured journal lives in a filesystem, return its file
+   name, which may be watched for changes; otherwise return null.  */
+const char *journal_dev_file_name (void);
+
+#endif /* JOURNAL_DEVICE_H */
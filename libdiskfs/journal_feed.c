@@ -0,0 +1,327 @@
+/* journal_feed.c - Change feed over the journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Backup and indexing tools ask for the events since a tx_id instead
+   of walking the whole tree, or for those about one inode or directory,
+   which journal_index.c finds without reading the whole ring.  The ring is read from the newest point
+   before which every record is older than the cursor, and the events
+   found are put in tx_id order.
+
+   An event only shows up once it is settled: the synchronous writes of
+   one thread can reach the ring ahead of the queued events of another
+   with lower tx_ids, so handing out a cursor past an event still in the
+   queue would skip it.  Events older than the longest a queued event
+   waits are settled, as is everything before them.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_feed.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_record.h>
+#include <libdiskfs/journal_writer.h>
+#include <diskfs.h>
+#include <maptime.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* How much longer than the flush delay an event may take to reach the
+   ring, in milliseconds.  */
+#define JOURNAL_FEED_SETTLE_MS 1000
+
+/* Remembered cursors.  */
+#define JOURNAL_FEED_CURSORS 16
+
+struct feed_cursor
+{
+  char name[64];
+  uint64_t cursor;		/* 0 if the slot is free */
+};
+
+static pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct feed_cursor cursors[JOURNAL_FEED_CURSORS];
+static uint64_t min_cursor = UINT64_MAX;
+
+struct change
+{
+  uint64_t tx_id;
+  size_t seq;			/* Position in the ring */
+  uint64_t timestamp_ms;
+  char *line;
+};
+
+struct feed_scan
+{
+  struct change *changes;
+  size_t count, alloc;
+  bool failed;
+};
+
+/* Write the name NAME to OUT so that it is a single word: "-" for an
+   empty one, and octal escapes for white space, backslashes and
+   unprintable bytes.  */
+static void
+put_name (FILE *out, const char *name)
+{
+  if (!*name)
+    {
+      fputs (" -", out);
+      return;
+    }
+
+  putc (' ', out);
+  if (strcmp (name, "-") == 0)
+    {
+      fputs ("\\055", out);
+      return;
+    }
+  for (const unsigned char *p = (const unsigned char *) name; *p; p++)
+    if (*p <= ' ' || *p == '\\' || *p >= 0x7f)
+      fprintf (out, "\\%03o", *p);
+    else
+      putc (*p, out);
+}
+
+static void
+collect (const struct journal_payload_bin *payload, void *arg)
+{
+  struct feed_scan *scan = arg;
+  enum journal_opcode op = journal_opcode_from_action (payload->action);
+
+  /* These are the journal's own bookkeeping.  */
+  if (op == JOURNAL_OP_CHECKPOINT || op == JOURNAL_OP_REVOKE || scan->failed)
+    return;
+
+  if (scan->count == scan->alloc)
+    {
+      size_t alloc = scan->alloc ? 2 * scan->alloc : 64;
+      struct change *c = realloc (scan->changes, alloc * sizeof *c);
+      if (!c)
+	{
+	  scan->failed = true;
+	  return;
+	}
+      scan->changes = c;
+      scan->alloc = alloc;
+    }
+
+  char *line = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream (&line, &len);
+  if (!out)
+    {
+      scan->failed = true;
+      return;
+    }
+  fprintf (out, "%llu %s %lu %lu", (unsigned long long) payload->tx_id,
+	   payload->action[0] ? payload->action : "-",
+	   (unsigned long) payload->ino, (unsigned long) payload->parent_ino);
+  put_name (out, payload->name);
+  if (op == JOURNAL_OP_RENAME)
+    {
+      fprintf (out, " %lu", (unsigned long) payload->src_parent_ino);
+      put_name (out, payload->old_name);
+    }
+  putc ('\n', out);
+  if (fclose (out) != 0)
+    {
+      free (line);
+      scan->failed = true;
+      return;
+    }
+
+  scan->changes[scan->count] = (struct change) {
+    .tx_id = payload->tx_id,
+    .seq = scan->count,
+    .timestamp_ms = payload->timestamp_ms,
+    .line = line,
+  };
+  scan->count++;
+}
+
+static int
+change_cmp (const void *a, const void *b)
+{
+  const struct change *x = a, *y = b;
+  if (x->tx_id != y->tx_id)
+    return x->tx_id < y->tx_id ? -1 : 1;
+  /* The records of a transaction are written together, in the order
+     they were logged.  */
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+error_t
+journal_feed_read (uint64_t cursor, size_t max,
+		   char **buf, size_t *len, uint64_t *next)
+{
+  struct feed_scan scan = { 0 };
+  struct timeval tv;
+  error_t err;
+
+  err = journal_scan_ring (cursor, collect, &scan);
+  if (!err && scan.failed)
+    err = ENOMEM;
+  if (err)
+    goto out;
+
+  qsort (scan.changes, scan.count, sizeof *scan.changes, change_cmp);
+
+  maptime_read (diskfs_mtime, &tv);
+  uint64_t settled_before = (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000
+    - journal_get_flush_delay () - JOURNAL_FEED_SETTLE_MS;
+
+  /* Everything up to the newest settled event is settled.  */
+  size_t settled = 0;
+  for (size_t i = 0; i < scan.count; i++)
+    if (scan.changes[i].timestamp_ms <= settled_before)
+      settled = i + 1;
+
+  /* Hand out whole transactions only, but at least one.  */
+  size_t n = settled < max ? settled : max;
+  if (n < settled)
+    {
+      while (n > 0 && scan.changes[n].tx_id == scan.changes[n - 1].tx_id)
+	n--;
+      if (n == 0)
+	while (n < settled && scan.changes[n].tx_id == scan.changes[0].tx_id)
+	  n++;
+    }
+
+  FILE *out = open_memstream (buf, len);
+  if (!out)
+    {
+      err = errno;
+      goto out;
+    }
+  for (size_t i = 0; i < n; i++)
+    fputs (scan.changes[i].line, out);
+  if (fclose (out) != 0)
+    {
+      free (*buf);
+      err = errno;
+      goto out;
+    }
+
+  *next = n > 0 ? scan.changes[n - 1].tx_id + 1 : cursor;
+
+out:
+  for (size_t i = 0; i < scan.count; i++)
+    free (scan.changes[i].line);
+  free (scan.changes);
+  return err;
+}
+
+error_t
+journal_feed_history (enum journal_index_kind kind, uint64_t key,
+		      uint64_t since, char **buf, size_t *len)
+{
+  struct feed_scan scan = { 0 };
+  error_t err;
+
+  if (key == 0 || key > UINT32_MAX)
+    return EINVAL;
+
+  err = journal_scan_index (kind, (journal_ino_t) key, since, collect, &scan);
+  if (!err && scan.failed)
+    err = ENOMEM;
+
+  FILE *out = err ? NULL : open_memstream (buf, len);
+  if (!err && !out)
+    err = errno;
+  if (out)
+    {
+      for (size_t i = 0; i < scan.count; i++)
+	fputs (scan.changes[i].line, out);
+      if (fclose (out) != 0)
+	{
+	  free (*buf);
+	  err = errno;
+	}
+    }
+
+  for (size_t i = 0; i < scan.count; i++)
+    free (scan.changes[i].line);
+  free (scan.changes);
+  return err;
+}
+
+static void
+update_min_cursor (void)
+{
+  uint64_t min = UINT64_MAX;
+  for (size_t i = 0; i < JOURNAL_FEED_CURSORS; i++)
+    if (cursors[i].cursor && cursors[i].cursor < min)
+      min = cursors[i].cursor;
+  __atomic_store_n (&min_cursor, min, __ATOMIC_RELAXED);
+}
+
+error_t
+journal_feed_set_cursor (const char *name, uint64_t cursor)
+{
+  struct feed_cursor *slot = NULL, *free_slot = NULL;
+
+  if (!*name || strlen (name) >= sizeof cursors[0].name)
+    return EINVAL;
+
+  pthread_mutex_lock (&cursor_lock);
+  for (size_t i = 0; i < JOURNAL_FEED_CURSORS; i++)
+    if (!cursors[i].cursor)
+      free_slot = free_slot ? : &cursors[i];
+    else if (strcmp (cursors[i].name, name) == 0)
+      slot = &cursors[i];
+
+  if (!slot && cursor)
+    {
+      slot = free_slot;
+      if (!slot)
+	{
+	  pthread_mutex_unlock (&cursor_lock);
+	  return ENOSPC;
+	}
+      strcpy (slot->name, name);
+    }
+  if (slot)
+    slot->cursor = cursor;
+  update_min_cursor ();
+  pthread_mutex_unlock (&cursor_lock);
+  return 0;
+}
+
+error_t
+journal_feed_get_cursor (const char *name, uint64_t *cursor)
+{
+  error_t err = ENOENT;
+
+  pthread_mutex_lock (&cursor_lock);
+  for (size_t i = 0; i < JOURNAL_FEED_CURSORS; i++)
+    if (cursors[i].cursor && strcmp (cursors[i].name, name) == 0)
+      {
+	*cursor = cursors[i].cursor;
+	err = 0;
+      }
+  pthread_mutex_unlock (&cursor_lock);
+  return err;
+}
+
+uint64_t
+journal_feed_min_cursor (void)
+{
+  return __atomic_load_n (&min_cursor, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,50 @@
+/* journal_feed.h - Change feed over the journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_FEED_H
+#define JOURNAL_FEED_H
+
+#include <libdiskfs/journal_index.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Return in *BUF, malloced, and *LEN the events with a tx_id of CURSOR
+   or more, at most MAX of them, as described for journal_read_changes
+   in <hurd/journal.defs>, and in *NEXT the cursor to continue from.  */
+error_t journal_feed_read (uint64_t cursor, size_t max,
+			   char **buf, size_t *len, uint64_t *next);
+
+/* Return in *BUF, malloced, and *LEN the events about KEY in the index
+   KIND with a tx_id of SINCE or more, as described for
+   journal_read_history in <hurd/journal.defs>.  */
+error_t journal_feed_history (enum journal_index_kind kind, uint64_t key,
+			      uint64_t since, char **buf, size_t *len);
+
+/* Remember CURSOR under NAME, or forget NAME if CURSOR is 0.  The
+   journal keeps the events from the lowest remembered cursor on.  */
+error_t journal_feed_set_cursor (const char *name, uint64_t cursor);
+
+/* Return in *CURSOR the cursor remembered under NAME, or ENOENT.  */
+error_t journal_feed_get_cursor (const char *name, uint64_t *cursor);
+
+/* The lowest remembered cursor, or UINT64_MAX if there is none.  */
+uint64_t journal_feed_min_cursor (void);
+
+#endif /* JOURNAL_FEED_H */
@@ -0,0 +1,452 @@
+/* journal_filter.c - Events left out of the journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* The filter is checked for every event before its payload is built,
+   so it is kept cheap: a flag when nothing is excluded, a bit mask of
+   opcodes for actions, a sorted array of inode ranges, and for
+   directories a small Bloom filter in front of a hash set, as most
+   events are not in an excluded directory.
+
+   A directory only lists its own entries, so we cannot tell whether a
+   node is somewhere below an excluded directory.  Instead we learn the
+   directories made in (or renamed into) an excluded directory from the
+   events themselves, and forget them when they are removed or renamed
+   out of it.  Subdirectories that already exist must be listed
+   themselves.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_filter.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_record.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bits in the Bloom filter of excluded directories; a power of 2.  */
+#define FILTER_BLOOM_BITS	1024
+
+struct ino_range
+{
+  journal_ino_t first, last;
+};
+
+/* Open-addressing set of inode numbers; 0 marks a free slot.  */
+struct ino_set
+{
+  journal_ino_t *slots;
+  size_t size;			/* 0 or a power of 2 */
+  size_t count;
+};
+
+struct journal_filter
+{
+  char *spec;			/* As given to journal_set_exclude */
+  uint32_t actions;		/* Bit N set excludes opcode N */
+  struct ino_range *ranges;	/* Sorted, not overlapping */
+  size_t nranges;
+  struct ino_set dirs;		/* Listed in SPEC */
+  struct ino_set learned;	/* Made in an excluded directory */
+  uint64_t bloom[FILTER_BLOOM_BITS / 64];	/* Of DIRS and LEARNED */
+};
+
+/* Opcodes must fit in the action mask.  */
+_Static_assert (JOURNAL_OP_MAX <= 32, "too many journal opcodes");
+
+static pthread_rwlock_t filter_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct journal_filter *filter;
+static bool filter_active;
+
+static inline uint64_t
+ino_hash (journal_ino_t ino)
+{
+  return (uint64_t) ino * 0x9e3779b97f4a7c15ULL;
+}
+
+static void
+bloom_add (struct journal_filter *f, journal_ino_t ino)
+{
+  uint64_t h = ino_hash (ino);
+  unsigned int a = (h >> 32) & (FILTER_BLOOM_BITS - 1);
+  unsigned int b = (h >> 48) & (FILTER_BLOOM_BITS - 1);
+
+  f->bloom[a / 64] |= 1ULL << (a % 64);
+  f->bloom[b / 64] |= 1ULL << (b % 64);
+}
+
+static inline bool
+bloom_test (const struct journal_filter *f, journal_ino_t ino)
+{
+  uint64_t h = ino_hash (ino);
+  unsigned int a = (h >> 32) & (FILTER_BLOOM_BITS - 1);
+  unsigned int b = (h >> 48) & (FILTER_BLOOM_BITS - 1);
+
+  return ((f->bloom[a / 64] >> (a % 64)) & 1)
+    && ((f->bloom[b / 64] >> (b % 64)) & 1);
+}
+
+static bool
+set_contains (const struct ino_set *s, journal_ino_t ino)
+{
+  if (s->count == 0 || ino == 0)
+    return false;
+
+  size_t mask = s->size - 1;
+  for (size_t i = ino_hash (ino) >> 32 & mask; s->slots[i]; i = (i + 1) & mask)
+    if (s->slots[i] == ino)
+      return true;
+  return false;
+}
+
+static void
+set_insert (struct ino_set *s, journal_ino_t ino)
+{
+  size_t mask = s->size - 1;
+  size_t i;
+
+  for (i = ino_hash (ino) >> 32 & mask; s->slots[i]; i = (i + 1) & mask)
+    if (s->slots[i] == ino)
+      return;
+  s->slots[i] = ino;
+  s->count++;
+}
+
+/* Add INO to S, keeping it at most half full.  */
+static error_t
+set_add (struct ino_set *s, journal_ino_t ino)
+{
+  if (2 * (s->count + 1) > s->size)
+    {
+      struct ino_set bigger = { .size = s->size ? 2 * s->size : 16 };
+
+      bigger.slots = calloc (bigger.size, sizeof *bigger.slots);
+      if (!bigger.slots)
+	return ENOMEM;
+      for (size_t i = 0; i < s->size; i++)
+	if (s->slots[i])
+	  set_insert (&bigger, s->slots[i]);
+      free (s->slots);
+      *s = bigger;
+    }
+
+  set_insert (s, ino);
+  return 0;
+}
+
+static void
+set_remove (struct ino_set *s, journal_ino_t ino)
+{
+  if (s->count == 0)
+    return;
+
+  size_t mask = s->size - 1;
+  size_t i = ino_hash (ino) >> 32 & mask;
+  while (s->slots[i] != ino)
+    {
+      if (!s->slots[i])
+	return;
+      i = (i + 1) & mask;
+    }
+
+  /* Move back the entries that would no longer be found past the hole.  */
+  size_t hole = i;
+  for (i = (i + 1) & mask; s->slots[i]; i = (i + 1) & mask)
+    {
+      size_t home = ino_hash (s->slots[i]) >> 32 & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask))
+	{
+	  s->slots[hole] = s->slots[i];
+	  hole = i;
+	}
+    }
+  s->slots[hole] = 0;
+  s->count--;
+}
+
+static bool
+range_contains (const struct journal_filter *f, journal_ino_t ino)
+{
+  size_t lo = 0, hi = f->nranges;
+
+  if (hi == 0 || ino < f->ranges[0].first || ino > f->ranges[hi - 1].last)
+    return false;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (ino > f->ranges[mid].last)
+	lo = mid + 1;
+      else if (ino < f->ranges[mid].first)
+	hi = mid;
+      else
+	return true;
+    }
+  return false;
+}
+
+static bool
+dir_excluded (const struct journal_filter *f, journal_ino_t ino)
+{
+  return ino && bloom_test (f, ino)
+    && (set_contains (&f->dirs, ino) || set_contains (&f->learned, ino));
+}
+
+static void
+filter_free (struct journal_filter *f)
+{
+  if (!f)
+    return;
+  free (f->spec);
+  free (f->ranges);
+  free (f->dirs.slots);
+  free (f->learned.slots);
+  free (f);
+}
+
+static int
+range_cmp (const void *a, const void *b)
+{
+  const struct ino_range *x = a, *y = b;
+  return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/* Parse an inode number at *P, moving *P past it.  */
+static bool
+parse_ino (const char **p, journal_ino_t *ino)
+{
+  char *end;
+  unsigned long long n;
+
+  if (**p < '0' || **p > '9')
+    return false;
+  errno = 0;
+  n = strtoull (*p, &end, 0);
+  if (errno || n == 0 || n > UINT32_MAX)
+    return false;
+  *p = end;
+  *ino = n;
+  return true;
+}
+
+/* Add the item ITEM, of length LEN, to F.  */
+static error_t
+parse_item (struct journal_filter *f, const char *item, size_t len,
+	    size_t *ranges_size)
+{
+  char buf[MAX_FIELD_LEN];
+  const char *p = buf;
+  journal_ino_t first, last;
+
+  if (len >= sizeof buf)
+    return EINVAL;
+  memcpy (buf, item, len);
+  buf[len] = '\0';
+
+  if (strncmp (buf, "action:", 7) == 0)
+    {
+      enum journal_opcode op = journal_opcode_from_action (buf + 7);
+      if (op == JOURNAL_OP_UNKNOWN)
+	return EINVAL;
+      f->actions |= 1U << op;
+      return 0;
+    }
+
+  if (strncmp (buf, "dir:", 4) == 0)
+    {
+      p += 4;
+      if (!parse_ino (&p, &first) || *p)
+	return EINVAL;
+      bloom_add (f, first);
+      return set_add (&f->dirs, first);
+    }
+
+  if (!parse_ino (&p, &first))
+    return EINVAL;
+  last = first;
+  if (*p == '-')
+    {
+      p++;
+      if (!parse_ino (&p, &last) || last < first)
+	return EINVAL;
+    }
+  if (*p)
+    return EINVAL;
+
+  if (f->nranges == *ranges_size)
+    {
+      size_t size = *ranges_size ? 2 * *ranges_size : 8;
+      struct ino_range *r = realloc (f->ranges, size * sizeof *r);
+      if (!r)
+	return ENOMEM;
+      f->ranges = r;
+      *ranges_size = size;
+    }
+  f->ranges[f->nranges].first = first;
+  f->ranges[f->nranges].last = last;
+  f->nranges++;
+  return 0;
+}
+
+int
+journal_set_exclude (const char *spec)
+{
+  struct journal_filter *f = NULL, *old;
+  size_t ranges_size = 0;
+  error_t err = 0;
+
+  if (*spec)
+    {
+      f = calloc (1, sizeof *f);
+      if (!f)
+	return ENOMEM;
+      f->spec = strdup (spec);
+      if (!f->spec)
+	err = ENOMEM;
+
+      for (const char *p = spec; !err; p++)
+	{
+	  size_t len = strcspn (p, ",");
+	  err = parse_item (f, p, len, &ranges_size);
+	  p += len;
+	  if (!*p)
+	    break;
+	}
+
+      if (!err && f->nranges > 1)
+	{
+	  /* Sort and merge the ranges, so they can be searched.  */
+	  size_t n = 0;
+	  qsort (f->ranges, f->nranges, sizeof *f->ranges, range_cmp);
+	  for (size_t i = 1; i < f->nranges; i++)
+	    if (f->ranges[i].first <= f->ranges[n].last
+		|| f->ranges[i].first - 1 == f->ranges[n].last)
+	      {
+		if (f->ranges[i].last > f->ranges[n].last)
+		  f->ranges[n].last = f->ranges[i].last;
+	      }
+	    else
+	      f->ranges[++n] = f->ranges[i];
+	  f->nranges = n + 1;
+	}
+
+      if (err)
+	{
+	  filter_free (f);
+	  return err;
+	}
+    }
+
+  pthread_rwlock_wrlock (&filter_lock);
+  old = filter;
+  filter = f;
+  __atomic_store_n (&filter_active, f != NULL, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock (&filter_lock);
+
+  filter_free (old);
+  return 0;
+}
+
+char *
+journal_get_exclude (void)
+{
+  char *spec = NULL;
+
+  pthread_rwlock_rdlock (&filter_lock);
+  if (filter)
+    spec = strdup (filter->spec);
+  pthread_rwlock_unlock (&filter_lock);
+  return spec;
+}
+
+/* After deciding on the event OP on the directory INO, whose parent is
+   now PARENT: return whether INO should be in the learned set, or -1 if
+   the event does not say.  */
+static int
+learn_dir (const struct journal_filter *f, enum journal_opcode op,
+	   journal_ino_t parent)
+{
+  switch (op)
+    {
+    case JOURNAL_OP_MKDIR:
+    case JOURNAL_OP_RENAME:
+      return dir_excluded (f, parent);
+    case JOURNAL_OP_RMDIR:
+      return 0;
+    default:
+      return -1;
+    }
+}
+
+bool
+journal_filter_skip (const struct stat *st,
+		     const struct journal_entry_info *info)
+{
+  if (!__atomic_load_n (&filter_active, __ATOMIC_ACQUIRE))
+    return false;
+
+  journal_ino_t ino = (journal_ino_t) st->st_ino;
+  enum journal_opcode op = JOURNAL_OP_UNKNOWN;
+  bool skip = false;
+  int learn = -1;
+
+  pthread_rwlock_rdlock (&filter_lock);
+  struct journal_filter *f = filter;
+  if (f)
+    {
+      if (f->actions || S_ISDIR (st->st_mode))
+	op = journal_opcode_from_action (info->action ? : "");
+
+      skip = ((f->actions >> op) & 1)
+	|| range_contains (f, ino)
+	|| dir_excluded (f, ino)
+	|| dir_excluded (f, (journal_ino_t) info->parent_ino)
+	|| dir_excluded (f, (journal_ino_t) info->src_parent_ino)
+	|| dir_excluded (f, (journal_ino_t) info->dst_parent_ino);
+
+      if (S_ISDIR (st->st_mode))
+	{
+	  learn = learn_dir (f, op, (journal_ino_t) info->parent_ino);
+	  if (learn == set_contains (&f->learned, ino))
+	    learn = -1;
+	}
+    }
+  pthread_rwlock_unlock (&filter_lock);
+
+  if (learn != -1)
+    {
+      pthread_rwlock_wrlock (&filter_lock);
+      /* The filter may have been replaced meanwhile; learning is then
+         just lost, as if it had happened before the change.  */
+      if (filter == f)
+	{
+	  if (learn)
+	    {
+	      if (set_add (&f->learned, ino) == 0)
+		bloom_add (f, ino);
+	    }
+	  else
+	    set_remove (&f->learned, ino);
+	}
+      pthread_rwlock_unlock (&filter_lock);
+    }
+
+  return skip;
+}
@@ -0,0 +1,34 @@
+/* journal_filter.h - Events left out of the journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_FILTER_H
+#define JOURNAL_FILTER_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+struct journal_entry_info;
+
+/* Return whether the event INFO on the node with stat ST is excluded by
+   journal_set_exclude, and so should not be journaled.  Cheap when
+   nothing is excluded.  */
+bool journal_filter_skip (const struct stat *st,
+			  const struct journal_entry_info *info);
+
+#endif /* JOURNAL_FILTER_H */
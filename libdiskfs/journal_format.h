@@ -22,14 +22,26 @@
 #ifndef JOURNAL_FORMAT_H
 #define JOURNAL_FORMAT_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <stdbool.h>
 
 #define JOURNAL_MAGIC        0x4A4E4C30  /* "JNL0" */
-#define JOURNAL_VERSION      1
+#define JOURNAL_WRAP_MAGIC   0x4A4E4C57  /* "JNLW" */
+#define JOURNAL_FRAME_MAGIC  0x4A4E4C5A  /* "JNLZ" */
+#define JOURNAL_VERSION_SLOTS 1		 /* Fixed 4 KiB slots */
+#define JOURNAL_VERSION_COMPACT 2	 /* Variable-length records */
+#define JOURNAL_VERSION_CRC32C 3	 /* Version 2 records, CRC32C */
+#define JOURNAL_VERSION_SIZED 4		 /* Version 3, ring size in header */
+#define JOURNAL_VERSION      JOURNAL_VERSION_SIZED
 #define MAX_FIELD_LEN        256
 
+/* Records in a version 2 ring start on this boundary.  The data area
+   is a multiple of it, so the space left before the end of the ring is
+   always big enough for a wrap marker.  */
+#define JOURNAL_RECORD_ALIGN 8
+
 typedef uint32_t journal_ino_t;
 typedef uint32_t journal_uid_t;
 
@@ -59,8 +71,129 @@ struct __attribute__((__packed__)) journal_payload_bin
 	char new_name[MAX_FIELD_LEN];
 	char target[MAX_FIELD_LEN];
 	char extra[MAX_FIELD_LEN];
+	/* Fields below are not part of version 1 slots, which hold only the
+	   first JOURNAL_PAYLOAD_V1_SIZE bytes.  */
+	uint16_t tx_remaining;	/* Records following in this transaction */
+	uint16_t tx_records;	/* Records in this transaction; not stored */
+};
+
+#define JOURNAL_PAYLOAD_V1_SIZE \
+	offsetof (struct journal_payload_bin, tx_remaining)
+
+/* Operation codes stored in version 2 records in place of the
+   `action' string.  Values are part of the on-disk format; only ever
+   append to this list.  */
+enum journal_opcode
+{
+	JOURNAL_OP_UNKNOWN = 0,
+	JOURNAL_OP_CREATE,
+	JOURNAL_OP_MKFILE,
+	JOURNAL_OP_UNLINK,
+	JOURNAL_OP_RENAME,
+	JOURNAL_OP_LINK,
+	JOURNAL_OP_MKDIR,
+	JOURNAL_OP_RMDIR,
+	JOURNAL_OP_SYMLINK,
+	JOURNAL_OP_CHMOD,
+	JOURNAL_OP_CHOWN,
+	JOURNAL_OP_TRUNCATE,
+	JOURNAL_OP_GROW,
+	JOURNAL_OP_UTIMES,
+	JOURNAL_OP_CHECKPOINT,	/* tx_id: everything up to it is on disk */
+	JOURNAL_OP_NLINK,	/* Link count change of a parent directory */
+	JOURNAL_OP_REVOKE,	/* Records for ino with a lower tx_id are void */
+	JOURNAL_OP_MAX
+};
+
+/* Bits in journal_record_hdr.flags.  */
+#define JOURNAL_REC_HAS_MODE	0x01
+#define JOURNAL_REC_HAS_SIZE	0x02
+#define JOURNAL_REC_HAS_UID	0x04
+#define JOURNAL_REC_HAS_GID	0x08
+
+/* Number of length-prefixed strings following a version 2 record
+   header, in this order: name, old_name, new_name, target, extra, and
+   the action string (only stored for JOURNAL_OP_UNKNOWN).  */
+#define JOURNAL_REC_NSTRINGS	6
+
+/* Fixed part of a version 2 record.  It is followed by
+   JOURNAL_REC_NSTRINGS strings, each a uint8_t length and that many
+   bytes with no terminator, then padding up to JOURNAL_RECORD_ALIGN.
+   LENGTH covers the header and the strings but not the padding, and
+   CRC32 is computed over those LENGTH bytes with CRC32 itself zero.
+   Version 3 uses the same layout with a CRC32C checksum instead.
+
+   The records of a transaction share one tx_id, and TX_REMAINING counts
+   down to 0 in the last one, which commits it.  A lone event is a
+   transaction of one record.  */
+struct __attribute__((__packed__)) journal_record_hdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t length;
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t tx_remaining;	/* Records following in this transaction */
+	uint32_t crc32;
+	uint64_t tx_id;
+	uint64_t timestamp_ms;
+	journal_ino_t parent_ino;
+	journal_ino_t src_parent_ino;
+	journal_ino_t dst_parent_ino;
+	journal_ino_t ino;
+	uint32_t st_mode;
+	uint32_t st_nlink;
+	uint64_t st_size;
+	uint64_t st_blocks;
+	int64_t mtime;
+	int64_t ctime;
+	journal_uid_t uid;
+	journal_uid_t gid;
 };
 
+/* Written where a version 2 record would not fit before the end of the
+   data area; readers continue from the start of the ring.  */
+struct __attribute__((__packed__)) journal_wrap_marker
+{
+	uint32_t magic;		/* JOURNAL_WRAP_MAGIC */
+	uint32_t reserved;
+};
+
+/* Compression methods of journal frames.  */
+#define JOURNAL_FRAME_LZ4	1
+
+/* Most record bytes a frame holds.  */
+#define JOURNAL_FRAME_RAW_MAX	(64 * 1024)
+
+/* A run of records of format VERSION stored compressed, in place of
+   the records themselves.  The header is followed by LENGTH bytes of
+   compressed data, then padding up to JOURNAL_RECORD_ALIGN; the data
+   expands to RAW_LENGTH bytes holding NRECORDS records, padding
+   included, each still with its own CRC.  CRC32 is computed as for a
+   record of VERSION over the header, with CRC32 itself zero, and the
+   compressed data.  MAX_TX is the highest tx_id of the records.
+
+   Frames are only written when they are smaller than their records,
+   so a frame never needs more room in the ring than they would.  */
+struct __attribute__((__packed__)) journal_frame_hdr
+{
+	uint32_t magic;		/* JOURNAL_FRAME_MAGIC */
+	uint16_t version;
+	uint8_t method;
+	uint8_t reserved;
+	uint32_t length;
+	uint32_t raw_length;
+	uint32_t crc32;
+	uint32_t nrecords;
+	uint64_t max_tx;
+};
+
+/* Largest possible version 2 record, padding included.  */
+#define JOURNAL_RECORD_MAX \
+	((sizeof (struct journal_record_hdr) \
+	  + JOURNAL_REC_NSTRINGS * MAX_FIELD_LEN + JOURNAL_RECORD_ALIGN - 1) \
+	 & ~(size_t) (JOURNAL_RECORD_ALIGN - 1))
+
 struct journal_payload
 {
 	const char *data;
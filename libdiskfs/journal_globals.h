@@ -9,22 +9,37 @@
 #define DEBUG 1
 #endif
 
+/* See journal_set_log_level.  DEBUG only decides whether LOG_DEBUG is
+   compiled in at all.  */
+extern volatile int journal_log_level;
+
 #define LOG_ERROR(fmt, ...) \
-	do { fprintf(stderr, "[ERROR] " fmt "\n", ##__VA_ARGS__); fflush(stderr); } while (0)
+	do { if (journal_log_level >= 1) { fprintf(stderr, "[ERROR] " fmt "\n", ##__VA_ARGS__); fflush(stderr); } } while (0)
 
 #if DEBUG
 #define LOG_DEBUG(fmt, ...) \
-	do { fprintf(stderr, "[DEBUG] " fmt "\n", ##__VA_ARGS__); fflush(stderr); } while (0)
+	do { if (journal_log_level >= 2) { fprintf(stderr, "[DEBUG] " fmt "\n", ##__VA_ARGS__); fflush(stderr); } } while (0)
 #else
 #define LOG_DEBUG(fmt, ...) do { } while (0)
 #endif
 
 #define RAW_DEVICE_PATH "/tmp/journal-pipe"
-#define RAW_DEVICE_SIZE (8 * 1024 * 1024)	/* 8MB */
 #define JOURNAL_ENTRY_SIZE 4096ULL
 #define JOURNAL_RESERVED_SPACE 4096ULL	/* Leave room for future header growth */
-#define JOURNAL_DATA_CAPACITY (RAW_DEVICE_SIZE - JOURNAL_RESERVED_SPACE)
-#define JOURNAL_NUM_ENTRIES (JOURNAL_DATA_CAPACITY / JOURNAL_ENTRY_SIZE)
+
+/* Bytes of journal device a new journal takes unless told otherwise,
+   and the least and most it can be given.  Rings before version 4
+   always had the default size.  */
+#define JOURNAL_DEFAULT_SIZE (8 * 1024 * 1024)	/* 8MB */
+#define JOURNAL_MIN_SIZE (1024 * 1024)
+#define JOURNAL_MAX_SIZE (1024 * 1024 * 1024)
+#define JOURNAL_LEGACY_CAPACITY (JOURNAL_DEFAULT_SIZE - JOURNAL_RESERVED_SPACE)
+#define JOURNAL_NUM_ENTRIES (JOURNAL_LEGACY_CAPACITY / JOURNAL_ENTRY_SIZE)
+
+/* Bytes in the data area of the ring the writer uses, as its header
+   says.  Only changed by the writer, with its lock held, when it reads
+   the header or formats a new ring.  */
+extern uint64_t journal_data_capacity;
 
 // Global state
 extern volatile size_t dropped_events;
@@ -41,18 +56,42 @@ struct __attribute__((__packed__)) journal_header
 	uint64_t start_index;
 	uint64_t end_index;
 	uint32_t crc32;
+	uint64_t ring_size;	/* Bytes in the data area; version 4 on */
 };
 
+/* Bytes of the header of a ring of format VERSION, which its CRC32
+   covers.  */
+	static inline size_t
+journal_header_len (uint32_t version)
+{
+	return (version >= JOURNAL_VERSION_SIZED ? sizeof (struct journal_header)
+		: offsetof (struct journal_header, ring_size));
+}
+
 struct __attribute__((__packed__)) journal_entry_bin
 {
 	uint32_t magic;
 	uint32_t version;
-	struct journal_payload_bin payload;
+	/* The leading part of a struct journal_payload_bin.  */
+	uint8_t payload[JOURNAL_PAYLOAD_V1_SIZE];
 	uint8_t padding[JOURNAL_ENTRY_SIZE - sizeof (uint32_t) - sizeof (uint32_t) -
-		sizeof (struct journal_payload_bin) - sizeof (uint32_t)];
+		JOURNAL_PAYLOAD_V1_SIZE - sizeof (uint32_t)];
 	uint32_t crc32;
 };
 
+/* Whether a ring data area of CAPACITY bytes is sound and fits on a
+   device of DEV_SIZE bytes, or of unknown size if DEV_SIZE is -1.  */
+	static inline bool
+journal_capacity_fits (uint64_t capacity, off_t dev_size)
+{
+	return (capacity % JOURNAL_RECORD_ALIGN == 0
+		&& capacity >= JOURNAL_MIN_SIZE - JOURNAL_RESERVED_SPACE
+		&& capacity <= JOURNAL_MAX_SIZE - JOURNAL_RESERVED_SPACE
+		&& (dev_size < 0
+		    || JOURNAL_RESERVED_SPACE + capacity <= (uint64_t) dev_size));
+}
+
+/* Version 1 rings: header indices count fixed-size slots.  */
 	static inline uint64_t
 index_to_offset (uint64_t index)
 {
@@ -60,4 +99,18 @@ index_to_offset (uint64_t index)
 		(index % (uint64_t) JOURNAL_NUM_ENTRIES) * (uint64_t) JOURNAL_ENTRY_SIZE;
 }
 
+/* Version 2 rings: header indices are byte positions in the data area.  */
+	static inline uint64_t
+ring_pos_to_offset (uint64_t pos)
+{
+	return JOURNAL_RESERVED_SPACE + pos % journal_data_capacity;
+}
+
+/* Bytes between START and END, going forward around the ring.  */
+	static inline uint64_t
+ring_used (uint64_t start, uint64_t end)
+{
+	return (end + journal_data_capacity - start) % journal_data_capacity;
+}
+
 #endif // JOURNAL_GLOBALS_H
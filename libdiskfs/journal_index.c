@@ -0,0 +1,258 @@
+/* journal_index.c - Index of the journal ring by inode
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Each index is a flat array of (key, tx_id, position) entries sorted
+   by key and tx_id, and a short unsorted array of the entries added
+   since it was last sorted.  When the short one fills up it is sorted
+   and merged into the long one, and the entries of records that have
+   left the ring are dropped on the way.  A lookup is a binary search in
+   the long array and a pass over the short one.
+
+   The index lives in memory only.  It is built by one pass over the
+   ring the first time it is needed, and kept up to date by the writer
+   after that.  */
+
+#include <libdiskfs/journal_index.h>
+#include <libdiskfs/journal_record.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Entries added between merges.  */
+#define JOURNAL_INDEX_RECENT 1024
+
+struct index_entry
+{
+  journal_ino_t key;
+  uint32_t pos;
+  uint64_t tx_id;
+};
+
+struct journal_index
+{
+  struct index_entry *sorted;
+  size_t nsorted;
+  struct index_entry recent[JOURNAL_INDEX_RECENT];
+  size_t nrecent;
+};
+
+static struct journal_index indices[JOURNAL_INDEX_KINDS];
+static bool complete;
+static uint64_t dropped_tx;	/* Entries up to it are stale */
+
+static int
+entry_cmp (const void *a, const void *b)
+{
+  const struct index_entry *x = a, *y = b;
+
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  if (x->tx_id != y->tx_id)
+    return x->tx_id < y->tx_id ? -1 : 1;
+  return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static inline bool
+entry_less (const struct index_entry *x, const struct index_entry *y)
+{
+  return entry_cmp (x, y) < 0;
+}
+
+/* Merge the recent entries of IDX into its sorted ones.  */
+static bool
+merge (struct journal_index *idx)
+{
+  struct index_entry *out;
+  size_t i = 0, j = 0, n = 0;
+
+  qsort (idx->recent, idx->nrecent, sizeof idx->recent[0], entry_cmp);
+
+  out = malloc ((idx->nsorted + idx->nrecent) * sizeof *out);
+  if (!out)
+    return false;
+
+  while (i < idx->nsorted || j < idx->nrecent)
+    {
+      const struct index_entry *e;
+      if (j == idx->nrecent
+	  || (i < idx->nsorted && entry_less (&idx->sorted[i],
+					      &idx->recent[j])))
+	e = &idx->sorted[i++];
+      else
+	e = &idx->recent[j++];
+      if (e->tx_id > dropped_tx)
+	out[n++] = *e;
+    }
+
+  free (idx->sorted);
+  idx->sorted = out;
+  idx->nsorted = n;
+  idx->nrecent = 0;
+  return true;
+}
+
+void
+journal_index_reset (void)
+{
+  for (int k = 0; k < JOURNAL_INDEX_KINDS; k++)
+    {
+      free (indices[k].sorted);
+      indices[k].sorted = NULL;
+      indices[k].nsorted = 0;
+      indices[k].nrecent = 0;
+    }
+  complete = false;
+  dropped_tx = 0;
+}
+
+bool
+journal_index_complete (void)
+{
+  return complete;
+}
+
+void
+journal_index_set_complete (void)
+{
+  complete = true;
+}
+
+static void
+add_entry (enum journal_index_kind kind, journal_ino_t key, uint64_t tx_id,
+	   uint64_t pos)
+{
+  struct journal_index *idx = &indices[kind];
+
+  if (key == 0)
+    return;
+
+  if (idx->nrecent == JOURNAL_INDEX_RECENT && !merge (idx))
+    {
+      /* Without memory for the merge the index cannot be trusted.  */
+      journal_index_reset ();
+      return;
+    }
+
+  idx->recent[idx->nrecent++] = (struct index_entry) {
+    .key = key,
+    .pos = (uint32_t) pos,
+    .tx_id = tx_id,
+  };
+}
+
+void
+journal_index_add (const struct journal_payload_bin *payload, uint64_t pos)
+{
+  enum journal_opcode op = journal_opcode_from_action (payload->action);
+
+  if (op == JOURNAL_OP_CHECKPOINT || op == JOURNAL_OP_REVOKE)
+    return;
+
+  add_entry (JOURNAL_INDEX_INODE, payload->ino, payload->tx_id, pos);
+  add_entry (JOURNAL_INDEX_DIR, payload->parent_ino, payload->tx_id, pos);
+  if (op == JOURNAL_OP_RENAME && payload->src_parent_ino != payload->parent_ino)
+    add_entry (JOURNAL_INDEX_DIR, payload->src_parent_ino, payload->tx_id,
+	       pos);
+}
+
+void
+journal_index_drop (uint64_t tx_id)
+{
+  if (tx_id > dropped_tx)
+    dropped_tx = tx_id;
+}
+
+static int
+hit_cmp (const void *a, const void *b)
+{
+  const struct journal_index_hit *x = a, *y = b;
+
+  if (x->tx_id != y->tx_id)
+    return x->tx_id < y->tx_id ? -1 : 1;
+  return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+struct hits
+{
+  struct journal_index_hit *hits;
+  size_t count, alloc;
+};
+
+static bool
+add_hit (struct hits *h, const struct index_entry *e)
+{
+  if (h->count == h->alloc)
+    {
+      size_t alloc = h->alloc ? 2 * h->alloc : 16;
+      struct journal_index_hit *more = realloc (h->hits,
+						alloc * sizeof *more);
+      if (!more)
+	return false;
+      h->hits = more;
+      h->alloc = alloc;
+    }
+  h->hits[h->count++] = (struct journal_index_hit) {
+    .tx_id = e->tx_id,
+    .pos = e->pos,
+  };
+  return true;
+}
+
+bool
+journal_index_lookup (enum journal_index_kind kind, journal_ino_t key,
+		      uint64_t since, struct journal_index_hit **hits,
+		      size_t *count)
+{
+  struct journal_index *idx = &indices[kind];
+  struct index_entry probe = { .key = key, .tx_id = since, .pos = 0 };
+  struct hits h = { 0 };
+  size_t lo = 0, hi = idx->nsorted;
+
+  if (probe.tx_id <= dropped_tx)
+    probe.tx_id = dropped_tx + 1;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (entry_less (&idx->sorted[mid], &probe))
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (size_t i = lo; i < idx->nsorted && idx->sorted[i].key == key; i++)
+    if (!add_hit (&h, &idx->sorted[i]))
+      goto nomem;
+
+  size_t from_sorted = h.count;
+  for (size_t i = 0; i < idx->nrecent; i++)
+    if (idx->recent[i].key == key && idx->recent[i].tx_id >= probe.tx_id
+	&& !add_hit (&h, &idx->recent[i]))
+      goto nomem;
+
+  if (h.count > from_sorted)
+    qsort (h.hits, h.count, sizeof *h.hits, hit_cmp);
+
+  *hits = h.hits;
+  *count = h.count;
+  return true;
+
+nomem:
+  free (h.hits);
+  return false;
+}
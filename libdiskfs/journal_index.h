@@ -0,0 +1,67 @@
+/* journal_index.h - Index of the journal ring by inode
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_INDEX_H
+#define JOURNAL_INDEX_H
+
+#include <libdiskfs/journal_format.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* What an index is keyed by.  */
+enum journal_index_kind
+{
+  JOURNAL_INDEX_INODE,		/* The inode an event is about */
+  JOURNAL_INDEX_DIR,		/* The directories whose entries it changes */
+  JOURNAL_INDEX_KINDS
+};
+
+/* Where a record is in the ring, as found in an index.  */
+struct journal_index_hit
+{
+  uint64_t tx_id;
+  uint32_t pos;
+};
+
+/* The functions below are called by the writer with its lock held.  */
+
+/* Forget everything; the index is rebuilt from the ring.  */
+void journal_index_reset (void);
+
+/* Return whether the index covers every record in the ring.  */
+bool journal_index_complete (void);
+
+/* Note that the index covers the ring from now on.  */
+void journal_index_set_complete (void);
+
+/* Add the record PAYLOAD, written at ring position POS.  */
+void journal_index_add (const struct journal_payload_bin *payload,
+			uint64_t pos);
+
+/* Records with a tx_id of at most TX_ID are gone from the ring.  */
+void journal_index_drop (uint64_t tx_id);
+
+/* Store in *HITS, malloced, and *COUNT where the records of KEY in the
+   index KIND with a tx_id of SINCE or more are, in tx_id order.  */
+bool journal_index_lookup (enum journal_index_kind kind, journal_ino_t key,
+			   uint64_t since, struct journal_index_hit **hits,
+			   size_t *count);
+
+#endif /* JOURNAL_INDEX_H */
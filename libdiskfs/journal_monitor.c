@@ -0,0 +1,242 @@
+/* journal_monitor.c - Journal device readiness tracking
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Rather than polling a journal that lives in a filesystem, we ask that
+   filesystem for change notifications on its directory
+   (dir_notice_changes) and probe the journal only when its name appears
+   or disappears.  Journals on a store, and directories that cannot send
+   notifications, are polled.  */
+
+#include <libdiskfs/journal_monitor.h>
+#include <libdiskfs/journal_writer.h>
+#include <libdiskfs/journal_globals.h>
+#include <libdiskfs/journal_device.h>
+#include <hurd.h>
+#include <hurd/fs.h>
+#include <mach.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_notify_S.h"
+
+extern int diskfs_fs_notify_server (mach_msg_header_t *inp,
+				    mach_msg_header_t *outp);
+
+/* How often to re-probe a device whose name exists but which cannot be
+   read yet (e.g. its translator is still starting), in milliseconds.  */
+#define JOURNAL_PROBE_RETRY_MS 100
+
+static mach_port_t notify_port = MACH_PORT_NULL;
+static char *device_name;
+static bool probe_pending;
+
+/* Return whether the journal device can be opened and read.  */
+static bool
+probe_device (void)
+{
+  struct journal_dev *dev = journal_dev_open (NULL);
+  if (!dev)
+    return false;
+
+  char test_buf[1];
+  ssize_t n = journal_dev_pread (dev, test_buf, sizeof (test_buf), 0);
+  journal_dev_close (dev);
+  if (n != 1)
+    LOG_DEBUG ("pread returned %zd, still not ready", n);
+  return n == 1;
+}
+
+static void
+set_device_ready (bool ready)
+{
+  if (ready == journal_device_ready)
+    return;
+
+  if (ready)
+    {
+      journal_writer_reset ();
+      pthread_mutex_lock (&queue_lock);
+      journal_device_ready = true;
+      pthread_cond_broadcast (&queue_cond);	// Wake queue flusher
+      pthread_mutex_unlock (&queue_lock);
+      LOG_DEBUG ("All checks worked. Journal device is ready!");
+    }
+  else
+    {
+      journal_device_ready = false;
+      LOG_DEBUG ("Journal device is not ready.");
+    }
+}
+
+static void
+reprobe (void)
+{
+  bool ready = probe_device ();
+  set_device_ready (ready);
+  probe_pending = !ready && access (journal_dev_file_name (), F_OK) == 0;
+}
+
+kern_return_t
+diskfs_S_dir_changed (mach_port_t notify, natural_t tickno,
+		      dir_changed_type_t change, const_string_t name)
+{
+  if (notify != notify_port)
+    return EOPNOTSUPP;
+
+  switch (change)
+    {
+    case DIR_CHANGED_NULL:
+      reprobe ();
+      break;
+
+    case DIR_CHANGED_NEW:
+    case DIR_CHANGED_RENUMBER:
+      if (strcmp (name, device_name) == 0)
+	reprobe ();
+      break;
+
+    case DIR_CHANGED_UNLINK:
+      if (strcmp (name, device_name) == 0)
+	{
+	  set_device_ready (false);
+	  probe_pending = false;
+	}
+      break;
+    }
+
+  return 0;
+}
+
+kern_return_t
+diskfs_S_file_changed (mach_port_t notify, natural_t tickno,
+		       file_changed_type_t change, loff_t start, loff_t end)
+{
+  return EOPNOTSUPP;
+}
+
+/* The old behaviour, for directories that do not support
+   dir_notice_changes.  */
+static void
+poll_device (void)
+{
+  while (1)
+    {
+      set_device_ready (probe_device ());
+
+      int sleep_ms = journal_device_ready ? 1000 : 100;	// 1s if ready, 100ms if not
+      usleep (sleep_ms * 1000);
+    }
+}
+
+/* Ask for notifications on the directory holding the journal device.  */
+static error_t
+watch_device_dir (void)
+{
+  const char *file_name = journal_dev_file_name ();
+  if (!file_name)
+    return EOPNOTSUPP;
+
+  char *path = strdup (file_name);
+  char *path2 = strdup (file_name);
+  error_t err = 0;
+
+  if (!path || !path2)
+    {
+      free (path);
+      free (path2);
+      return ENOMEM;
+    }
+
+  device_name = strdup (basename (path));
+  if (!device_name)
+    err = ENOMEM;
+
+  file_t dir = MACH_PORT_NULL;
+  if (!err)
+    {
+      dir = file_name_lookup (dirname (path2), O_READ, 0);
+      if (dir == MACH_PORT_NULL)
+	err = errno;
+    }
+
+  if (!err)
+    err = mach_port_allocate (mach_task_self (), MACH_PORT_RIGHT_RECEIVE,
+			      &notify_port);
+  if (!err)
+    err = mach_port_insert_right (mach_task_self (), notify_port,
+				  notify_port, MACH_MSG_TYPE_MAKE_SEND);
+  if (!err)
+    /* This immediately sends DIR_CHANGED_NULL, which does the first
+       probe.  */
+    err = dir_notice_changes (dir, notify_port);
+
+  if (dir != MACH_PORT_NULL)
+    mach_port_deallocate (mach_task_self (), dir);
+  free (path);
+  free (path2);
+
+  if (err && notify_port != MACH_PORT_NULL)
+    {
+      mach_port_mod_refs (mach_task_self (), notify_port,
+			  MACH_PORT_RIGHT_RECEIVE, -1);
+      notify_port = MACH_PORT_NULL;
+    }
+  return err;
+}
+
+static int
+journal_notify_demuxer (mach_msg_header_t *inp, mach_msg_header_t *outp)
+{
+  return diskfs_fs_notify_server (inp, outp);
+}
+
+void *
+journal_device_monitor_thread (void *arg)
+{
+  (void) arg;
+
+  error_t err = watch_device_dir ();
+  if (err)
+    {
+      if (err != EOPNOTSUPP)
+	LOG_ERROR ("journal: cannot watch %s (%s), polling instead",
+		   journal_dev_spec (), strerror (err));
+      poll_device ();
+      return NULL;
+    }
+
+  while (1)
+    {
+      err = mach_msg_server_timeout (journal_notify_demuxer, 0, notify_port,
+				     probe_pending ? MACH_RCV_TIMEOUT : 0,
+				     JOURNAL_PROBE_RETRY_MS);
+      if (err == MACH_RCV_TIMED_OUT)
+	reprobe ();
+    }
+
+  return NULL;
+}
@@ -0,0 +1,30 @@
+/* journal_monitor.h - Journal device readiness tracking
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_MONITOR_H
+#define JOURNAL_MONITOR_H
+
+/* Track whether the journal device is usable and keep
+   journal_device_ready up to date.  Runs forever; start it in its own
+   thread.  */
+void *journal_device_monitor_thread (void *arg);
+
+#endif /* JOURNAL_MONITOR_H */
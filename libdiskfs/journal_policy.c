@@ -0,0 +1,166 @@
+/* journal_policy.c - Durability of journal events by operation
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Each call site says whether its event must be on disk before the RPC
+   returns.  The table here lets a mount override that per operation.
+   An entry packs the policy in its low two bits and, for lazy events,
+   the flush deadline in milliseconds above them; entries are read and
+   replaced one at a time without a lock.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_policy.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_record.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Flush deadline of "lazy" without one.  */
+#define JOURNAL_LAZY_DEFAULT_MS 50
+
+#define POLICY_BITS 2
+#define POLICY_MASK ((1U << POLICY_BITS) - 1)
+
+static uint32_t policy_table[JOURNAL_OP_MAX];
+static bool policy_active;
+
+static pthread_mutex_t policy_spec_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *policy_spec;
+
+enum journal_policy
+journal_policy_for (const char *action, unsigned int *lazy_ms)
+{
+  if (!__atomic_load_n (&policy_active, __ATOMIC_RELAXED))
+    return JOURNAL_POLICY_CALLER;
+
+  enum journal_opcode op = journal_opcode_from_action (action ? : "");
+  uint32_t entry = __atomic_load_n (&policy_table[op], __ATOMIC_RELAXED);
+
+  *lazy_ms = entry >> POLICY_BITS;
+  return entry & POLICY_MASK;
+}
+
+/* Parse the policy NAME into *ENTRY.  */
+static bool
+parse_policy (const char *name, uint32_t *entry)
+{
+  if (strcmp (name, "default") == 0)
+    *entry = JOURNAL_POLICY_CALLER;
+  else if (strcmp (name, "async") == 0)
+    *entry = JOURNAL_POLICY_ASYNC;
+  else if (strcmp (name, "sync") == 0)
+    *entry = JOURNAL_POLICY_SYNC;
+  else if (strncmp (name, "lazy", 4) == 0
+	   && (name[4] == '\0' || name[4] == ':'))
+    {
+      unsigned long ms = JOURNAL_LAZY_DEFAULT_MS;
+      if (name[4] == ':')
+	{
+	  char *end;
+	  ms = strtoul (name + 5, &end, 10);
+	  if (*end != '\0' || end == name + 5
+	      || ms > UINT32_MAX >> POLICY_BITS)
+	    return false;
+	}
+      *entry = JOURNAL_POLICY_LAZY | (uint32_t) ms << POLICY_BITS;
+    }
+  else
+    return false;
+  return true;
+}
+
+int
+journal_set_durability (const char *spec)
+{
+  uint32_t table[JOURNAL_OP_MAX] = { 0 };
+  bool active = false;
+  char *copy, *item, *save;
+
+  copy = strdup (spec);
+  if (!copy)
+    return ENOMEM;
+
+  /* A bare policy applies to every operation not listed by name,
+     wherever it appears.  */
+  for (item = strtok_r (copy, ",", &save); item;
+       item = strtok_r (NULL, ",", &save))
+    {
+      char *eq = strchr (item, '=');
+      uint32_t entry;
+
+      if (!parse_policy (eq ? eq + 1 : item, &entry))
+	{
+	  free (copy);
+	  return EINVAL;
+	}
+      if (!eq)
+	for (unsigned int op = 0; op < JOURNAL_OP_MAX; op++)
+	  table[op] = entry;
+    }
+
+  strcpy (copy, spec);
+  for (item = strtok_r (copy, ",", &save); item;
+       item = strtok_r (NULL, ",", &save))
+    {
+      char *eq = strchr (item, '=');
+      uint32_t entry;
+
+      if (!eq)
+	continue;
+      *eq = '\0';
+      enum journal_opcode op = journal_opcode_from_action (item);
+      if (op == JOURNAL_OP_UNKNOWN || !parse_policy (eq + 1, &entry))
+	{
+	  free (copy);
+	  return EINVAL;
+	}
+      table[op] = entry;
+    }
+
+  for (unsigned int op = 0; op < JOURNAL_OP_MAX; op++)
+    active |= table[op] != JOURNAL_POLICY_CALLER;
+
+  strcpy (copy, spec);
+  pthread_mutex_lock (&policy_spec_lock);
+  for (unsigned int op = 0; op < JOURNAL_OP_MAX; op++)
+    __atomic_store_n (&policy_table[op], table[op], __ATOMIC_RELAXED);
+  __atomic_store_n (&policy_active, active, __ATOMIC_RELAXED);
+  free (policy_spec);
+  policy_spec = active ? copy : NULL;
+  pthread_mutex_unlock (&policy_spec_lock);
+
+  if (!active)
+    free (copy);
+  return 0;
+}
+
+char *
+journal_get_durability (void)
+{
+  char *spec = NULL;
+
+  pthread_mutex_lock (&policy_spec_lock);
+  if (policy_spec)
+    spec = strdup (policy_spec);
+  pthread_mutex_unlock (&policy_spec_lock);
+  return spec;
+}
@@ -0,0 +1,39 @@
+/* journal_policy.h - Durability of journal events by operation
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_POLICY_H
+#define JOURNAL_POLICY_H
+
+/* How an event is written, from weakest to strongest after
+   JOURNAL_POLICY_CALLER.  */
+enum journal_policy
+{
+  JOURNAL_POLICY_CALLER,	/* As the call site asks */
+  JOURNAL_POLICY_ASYNC,		/* Queued */
+  JOURNAL_POLICY_LAZY,		/* Queued, and flushed within some time */
+  JOURNAL_POLICY_SYNC		/* Written before returning */
+};
+
+/* Return the policy journal_set_durability chose for ACTION.  For
+   JOURNAL_POLICY_LAZY, store in *LAZY_MS how soon the event must be
+   flushed.  */
+enum journal_policy journal_policy_for (const char *action,
+					unsigned int *lazy_ms);
+
+#endif /* JOURNAL_POLICY_H */
@@ -20,8 +20,11 @@
    along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
 
 #include <libdiskfs/journal_queue.h>
+#include <libdiskfs/journal.h>
 #include <libdiskfs/journal_format.h>
 #include <libdiskfs/journal_writer.h>
+#include <libdiskfs/journal_record.h>
+#include <libdiskfs/journal_stats.h>
 #include <libdiskfs/journal_globals.h>
 #include <pthread.h>
 #include <string.h>
@@ -34,32 +37,213 @@
 #include <sys/stat.h>
 #include <hurd/fshelp.h>
 #include <errno.h>
+#include <sched.h>
+#include <trace.h>
+#include <stddef.h>
 
 #define JOURNAL_FLUSH_TIMEOUT_MS 500
+#define JOURNAL_FLUSH_BYTES_DEFAULT (256 * 1024)
+/* Shortest wait once an event is queued, so that a burst arriving
+   together still shares a write.  */
+#define JOURNAL_FLUSH_MIN_DELAY_US 1000
+/* Rough encoded size of an event, used to turn the byte threshold into
+   a number of queued events.  */
+#define JOURNAL_EVENT_BYTES_ESTIMATE 128
+#define JOURNAL_OVERFLOW_WAIT_MS 100
+/* Upper bound on events held in the overflow arena.  */
+#define JOURNAL_SPILL_MAX 65536
 #define JOURNAL_QUEUE_MAX 4096
+/* Wake the flusher early once this many events are waiting.  */
+#define JOURNAL_QUEUE_HIGH_WATER (JOURNAL_QUEUE_MAX * 3 / 4)
 
+/* Bounded multi-producer, single-consumer ring.  A slot whose SEQ equals
+   position P is free for the producer that reserved P; SEQ == P + 1
+   means the producer has published it; the flusher hands it back with
+   SEQ == P + JOURNAL_QUEUE_MAX once the event has been written.  */
 struct journal_queue_entry
 {
-  char data[sizeof (struct journal_payload_bin)];
+  size_t seq;
+  size_t pos;			/* Position reserved for this fill.  */
+  bool wake;			/* Signal the flusher on commit.  */
   size_t len;
-  bool used;
+  struct journal_payload_bin payload;
 };
 
 static struct journal_queue_entry journal_queue[JOURNAL_QUEUE_MAX];
-static size_t head = 0, tail = 0, count = 0;
+
+/* Next position handed to a producer, and number of positions reserved
+   but not yet released by the flusher.  Both only change atomically.  */
+static size_t enqueue_pos;
+static size_t queued;
+
+/* Next position the flusher will consume.  Private to the flusher.  */
+static size_t dequeue_pos;
+
 pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
-static bool shutdown_in_progress = false;
+static volatile bool shutdown_in_progress = false;
+
+/* Flush tunables, settable through fsysopts.  The flusher waits at most
+   FLUSH_MAX_DELAY_MS after the first queued event, and flushes early
+   once about FLUSH_BYTES worth of events are waiting.  */
+static volatile unsigned int flush_max_delay_ms = JOURNAL_FLUSH_TIMEOUT_MS;
+static volatile size_t flush_bytes = JOURNAL_FLUSH_BYTES_DEFAULT;
+static volatile size_t flush_threshold_events =
+  JOURNAL_FLUSH_BYTES_DEFAULT / JOURNAL_EVENT_BYTES_ESTIMATE;
+
+/* What to do with an event when both the thread's stage and the shared
+   queue are full, and how often each path was taken.  */
+static volatile enum journal_overflow_policy overflow_policy =
+  JOURNAL_OVERFLOW_BLOCK;
+static volatile unsigned int overflow_wait_ms = JOURNAL_OVERFLOW_WAIT_MS;
+static struct journal_overflow_stats overflow_stats;
+
+/* Producers blocked for room wait on SPACE_COND (with queue_lock); the
+   flusher broadcasts it after handing slots back.  */
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+static int space_waiters;
+
+/* Set to make the flusher write what it has without waiting further.  */
+static volatile bool flush_requested;
+
+/* The shortest delay a lazy event asked for since the flusher last took
+   a snapshot, in microseconds, or UINT64_MAX.  */
+static uint64_t lazy_delay_us = UINT64_MAX;
+
+/* Overflow arena for JOURNAL_OVERFLOW_SPILL: a list of individually
+   allocated events in reservation order, protected by spill_lock.  */
+struct journal_spill
+{
+  struct journal_spill *next;
+  bool published;
+  struct journal_payload_bin payload;
+};
+
+static pthread_mutex_t spill_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct journal_spill *spill_head;
+static struct journal_spill **spill_tail = &spill_head;
+static size_t spill_count;
+
+/* Flusher-private load estimates: exponentially weighted averages of
+   the event arrival rate and of how long a batch write takes.  */
+static double arrival_rate_per_us;
+static double write_latency_us;
+static bool streaming;
+
+/* Per-thread staging buffers.  Each producer thread fills its own small
+   single-producer ring and only falls back to the shared queue when it
+   is full, so the common path touches no cache line written by another
+   producer.  HEAD is advanced by the flusher, TAIL by the owner.  Each
+   flush round (epoch) the flusher snapshots every stage's TAIL, writes
+   what it found, and only then moves HEAD; the stages of exited threads
+   are freed once a round leaves them empty.  */
+#define JOURNAL_STAGE_SLOTS 16
+#define JOURNAL_BATCH_MAX (JOURNAL_QUEUE_MAX * 2)
+
+struct journal_stage
+{
+  struct journal_stage *next;
+  size_t head __attribute__ ((aligned (64)));
+  size_t tail __attribute__ ((aligned (64)));
+  bool dead;
+  struct journal_payload_bin slots[JOURNAL_STAGE_SLOTS];
+};
+
+static __thread struct journal_stage *thread_stage;
+static struct journal_stage *stage_list;
+static pthread_mutex_t stage_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stage_key;
+static pthread_once_t stage_key_once = PTHREAD_ONCE_INIT;
+
+static void
+wake_flusher (void)
+{
+  pthread_mutex_lock (&queue_lock);
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+static bool
+is_queue_slot (const struct journal_payload_bin *payload)
+{
+  return (const char *) payload >= (const char *) &journal_queue[0]
+    && (const char *) payload < (const char *) &journal_queue[JOURNAL_QUEUE_MAX];
+}
+
+static size_t
+queue_depth (void)
+{
+  return __atomic_load_n (&queued, __ATOMIC_ACQUIRE);
+}
+
+static void
+stage_release (void *arg)
+{
+  struct journal_stage *stage = arg;
+  __atomic_store_n (&stage->dead, true, __ATOMIC_RELEASE);
+}
+
+static void
+stage_key_create (void)
+{
+  pthread_key_create (&stage_key, stage_release);
+}
+
+/* Return the calling thread's stage, creating it on first use.  */
+static struct journal_stage *
+get_thread_stage (void)
+{
+  if (thread_stage)
+    return thread_stage;
+
+  pthread_once (&stage_key_once, stage_key_create);
+  struct journal_stage *stage = calloc (1, sizeof *stage);
+  if (!stage)
+    return NULL;
+
+  pthread_mutex_lock (&stage_list_lock);
+  stage->next = stage_list;
+  stage_list = stage;
+  pthread_mutex_unlock (&stage_list_lock);
+
+  pthread_setspecific (stage_key, stage);
+  thread_stage = stage;
+  return stage;
+}
+
+static bool
+is_stage_slot (const struct journal_stage *stage,
+	       const struct journal_payload_bin *payload)
+{
+  return stage && payload >= &stage->slots[0]
+    && payload < &stage->slots[JOURNAL_STAGE_SLOTS];
+}
+
+/* Whether any stage or the overflow arena holds published events.
+   Flusher only.  */
+static bool
+stages_pending (void)
+{
+  pthread_mutex_lock (&spill_lock);
+  bool pending = spill_head && spill_head->published;
+  pthread_mutex_unlock (&spill_lock);
+
+  pthread_mutex_lock (&stage_list_lock);
+  for (struct journal_stage * st = stage_list; st && !pending; st = st->next)
+    pending = __atomic_load_n (&st->tail, __ATOMIC_SEQ_CST) != st->head;
+  pthread_mutex_unlock (&stage_list_lock);
+  return pending;
+}
 
 void
 journal_queue_init (void)
 {
   shutdown_in_progress = false;
-  head = tail = count = 0;
+  enqueue_pos = dequeue_pos = queued = 0;
   for (size_t i = 0; i < JOURNAL_QUEUE_MAX; i++)
     {
       journal_queue[i].len = 0;
-      journal_queue[i].used = false;
+      __atomic_store_n (&journal_queue[i].seq, i, __ATOMIC_RELEASE);
     }
 }
 
@@ -72,74 +256,676 @@ journal_queue_shutdown (void)
   pthread_mutex_unlock (&queue_lock);
 }
 
+/* Take a slot in the shared queue, or return NULL if it is full.  */
+static struct journal_payload_bin *
+reserve_shared (void)
+{
+  /* Claim room first so a reserved position always maps to a slot the
+     flusher has already released.  */
+  size_t depth = __atomic_fetch_add (&queued, 1, __ATOMIC_ACQ_REL);
+  if (depth >= JOURNAL_QUEUE_MAX)
+    {
+      __atomic_fetch_sub (&queued, 1, __ATOMIC_RELEASE);
+      return NULL;
+    }
+
+  size_t pos = __atomic_fetch_add (&enqueue_pos, 1, __ATOMIC_RELAXED);
+  struct journal_queue_entry *e = &journal_queue[pos % JOURNAL_QUEUE_MAX];
+
+  e->pos = pos;
+  e->wake = depth == 0 || depth + 1 == JOURNAL_QUEUE_HIGH_WATER
+    || depth + 1 == flush_threshold_events;
+  e->len = sizeof e->payload;
+  return &e->payload;
+}
+
+static struct journal_payload_bin *
+reserve_spill (void)
+{
+  pthread_mutex_lock (&spill_lock);
+  if (spill_count >= JOURNAL_SPILL_MAX)
+    {
+      pthread_mutex_unlock (&spill_lock);
+      return NULL;
+    }
+
+  struct journal_spill *sp = malloc (sizeof *sp);
+  if (!sp)
+    {
+      pthread_mutex_unlock (&spill_lock);
+      return NULL;
+    }
+  sp->next = NULL;
+  sp->published = false;
+  *spill_tail = sp;
+  spill_tail = &sp->next;
+  spill_count++;
+  pthread_mutex_unlock (&spill_lock);
+  return &sp->payload;
+}
+
+/* The stage and the shared queue are both full: apply the overflow
+   policy.  */
+static struct journal_payload_bin *
+reserve_overflow (void)
+{
+  struct journal_payload_bin *slot = NULL;
+
+  switch (overflow_policy)
+    {
+    case JOURNAL_OVERFLOW_DROP:
+      break;
+
+    case JOURNAL_OVERFLOW_FLUSH:
+      __atomic_fetch_add (&overflow_stats.flushed, 1, __ATOMIC_RELAXED);
+      journal_flush_now ();
+      for (int i = 0; i < 10 && !slot; i++)
+	{
+	  sched_yield ();
+	  slot = reserve_shared ();
+	}
+      break;
+
+    case JOURNAL_OVERFLOW_BLOCK:
+      /* Nothing will drain the queue while the device is away, so do
+         not hold up RPCs for it.  */
+      if (!journal_device_ready)
+	break;
+      __atomic_fetch_add (&overflow_stats.blocked, 1, __ATOMIC_RELAXED);
+      {
+	struct timespec deadline;
+	clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += (overflow_wait_ms % 1000) * 1000000;
+	deadline.tv_sec += overflow_wait_ms / 1000
+	  + deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock (&queue_lock);
+	space_waiters++;
+	flush_requested = true;
+	pthread_cond_signal (&queue_cond);
+	while (!(slot = reserve_shared ()))
+	  if (pthread_cond_timedwait (&space_cond, &queue_lock, &deadline)
+	      == ETIMEDOUT)
+	    {
+	      slot = reserve_shared ();
+	      break;
+	    }
+	space_waiters--;
+	pthread_mutex_unlock (&queue_lock);
+      }
+      if (!slot)
+	__atomic_fetch_add (&overflow_stats.block_timeouts, 1,
+			    __ATOMIC_RELAXED);
+      break;
+
+    case JOURNAL_OVERFLOW_SPILL:
+      slot = reserve_spill ();
+      if (slot)
+	__atomic_fetch_add (&overflow_stats.spilled, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+  if (!slot)
+    {
+      __atomic_fetch_add (&overflow_stats.dropped, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&dropped_events, 1, __ATOMIC_RELAXED);
+    }
+  return slot;
+}
+
+struct journal_payload_bin *
+journal_queue_reserve (void)
+{
+  struct journal_stage *stage = get_thread_stage ();
+  if (stage
+      && stage->tail - __atomic_load_n (&stage->head, __ATOMIC_ACQUIRE)
+      < JOURNAL_STAGE_SLOTS)
+    return &stage->slots[stage->tail % JOURNAL_STAGE_SLOTS];
+
+  struct journal_payload_bin *slot = reserve_shared ();
+  return slot ? : reserve_overflow ();
+}
+
+void
+journal_queue_commit (struct journal_payload_bin *payload)
+{
+  struct journal_stage *stage = thread_stage;
+  if (is_stage_slot (stage, payload))
+    {
+      size_t tail = stage->tail;
+      TRACE (TRACE_JOURNAL_ENQUEUE, 1, 0);
+      __atomic_store_n (&stage->tail, tail + 1, __ATOMIC_SEQ_CST);
+      /* If the flusher has already consumed everything before this
+         event it may be asleep; it rechecks TAIL after moving HEAD, so
+         otherwise it is bound to see the new event.  */
+      if (__atomic_load_n (&stage->head, __ATOMIC_SEQ_CST) == tail)
+	wake_flusher ();
+      return;
+    }
+
+  if (!is_queue_slot (payload))
+    {
+      struct journal_spill *sp = (struct journal_spill *)
+	((char *) payload - offsetof (struct journal_spill, payload));
+      TRACE (TRACE_JOURNAL_ENQUEUE, 2, 0);
+      pthread_mutex_lock (&spill_lock);
+      sp->published = true;
+      pthread_mutex_unlock (&spill_lock);
+      wake_flusher ();
+      return;
+    }
+
+  struct journal_queue_entry *e = (struct journal_queue_entry *)
+    ((char *) payload - offsetof (struct journal_queue_entry, payload));
+  bool wake = e->wake;
+
+  TRACE (TRACE_JOURNAL_ENQUEUE, 0, 0);
+
+  /* The flusher may recycle the slot as soon as it is published.  */
+  __atomic_store_n (&e->seq, e->pos + 1, __ATOMIC_RELEASE);
+
+  if (wake)
+    wake_flusher ();
+}
+
 bool
 journal_enqueue (const char *data, size_t len)
 {
   if (len != sizeof (struct journal_payload_bin))
     return false;
 
-  pthread_mutex_lock (&queue_lock);
+  struct journal_payload_bin *slot = journal_queue_reserve ();
+  if (!slot)
+    return false;
+
+  memcpy (slot, data, len);
+  journal_queue_commit (slot);
+  return true;
+}
 
-  if (count >= JOURNAL_QUEUE_MAX)
+void
+journal_flush_now (void)
+{
+  flush_requested = true;
+  wake_flusher ();
+}
+
+void
+journal_flush_within (unsigned int ms)
+{
+  uint64_t us = (uint64_t) ms * 1000;
+  uint64_t cur = __atomic_load_n (&lazy_delay_us, __ATOMIC_SEQ_CST);
+
+  while (us < cur)
+    if (__atomic_compare_exchange_n (&lazy_delay_us, &cur, us, false,
+				     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      {
+	/* The flusher may be waiting for a later deadline.  */
+	wake_flusher ();
+	break;
+      }
+}
+
+static size_t
+threshold_for_bytes (size_t bytes)
+{
+  size_t events = bytes / JOURNAL_EVENT_BYTES_ESTIMATE;
+  if (events < 1)
+    events = 1;
+  if (events > JOURNAL_QUEUE_HIGH_WATER)
+    events = JOURNAL_QUEUE_HIGH_WATER;
+  return events;
+}
+
+void
+journal_set_flush_delay (unsigned int ms)
+{
+  flush_max_delay_ms = ms;
+  journal_flush_now ();
+}
+
+unsigned int
+journal_get_flush_delay (void)
+{
+  return flush_max_delay_ms;
+}
+
+void
+journal_set_flush_bytes (size_t bytes)
+{
+  flush_bytes = bytes;
+  flush_threshold_events = threshold_for_bytes (bytes);
+  journal_flush_now ();
+}
+
+size_t
+journal_get_flush_bytes (void)
+{
+  return flush_bytes;
+}
+
+int
+journal_set_overflow (const char *spec)
+{
+  unsigned int wait_ms = JOURNAL_OVERFLOW_WAIT_MS;
+  enum journal_overflow_policy policy;
+
+  if (strcmp (spec, "drop") == 0)
+    policy = JOURNAL_OVERFLOW_DROP;
+  else if (strcmp (spec, "flush") == 0)
+    policy = JOURNAL_OVERFLOW_FLUSH;
+  else if (strcmp (spec, "spill") == 0)
+    policy = JOURNAL_OVERFLOW_SPILL;
+  else if (strncmp (spec, "block", 5) == 0
+	   && (spec[5] == '\0' || spec[5] == ':'))
     {
-      pthread_mutex_unlock (&queue_lock);
-      return false;
+      policy = JOURNAL_OVERFLOW_BLOCK;
+      if (spec[5] == ':')
+	{
+	  char *end;
+	  unsigned long ms = strtoul (spec + 6, &end, 10);
+	  if (*end != '\0' || end == spec + 6)
+	    return EINVAL;
+	  wait_ms = ms;
+	}
     }
+  else
+    return EINVAL;
 
-  struct journal_queue_entry *e = &journal_queue[tail];
-  memcpy (e->data, data, len);
-  e->len = len;
-  e->used = true;
+  overflow_wait_ms = wait_ms;
+  overflow_policy = policy;
+  return 0;
+}
 
-  tail = (tail + 1) % JOURNAL_QUEUE_MAX;
-  count++;
+void
+journal_get_overflow (char *buf, size_t size)
+{
+  static const char *const names[] = {
+    [JOURNAL_OVERFLOW_DROP] = "drop",
+    [JOURNAL_OVERFLOW_FLUSH] = "flush",
+    [JOURNAL_OVERFLOW_BLOCK] = "block",
+    [JOURNAL_OVERFLOW_SPILL] = "spill",
+  };
+  enum journal_overflow_policy policy = overflow_policy;
 
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
-  return true;
+  if (policy == JOURNAL_OVERFLOW_BLOCK)
+    snprintf (buf, size, "block:%u", overflow_wait_ms);
+  else
+    snprintf (buf, size, "%s", names[policy]);
 }
 
 void
-journal_flush_now (void)
+journal_get_overflow_stats (struct journal_overflow_stats *stats)
 {
-  pthread_mutex_lock (&queue_lock);
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
+  stats->blocked = __atomic_load_n (&overflow_stats.blocked,
+				    __ATOMIC_RELAXED);
+  stats->block_timeouts = __atomic_load_n (&overflow_stats.block_timeouts,
+					   __ATOMIC_RELAXED);
+  stats->flushed = __atomic_load_n (&overflow_stats.flushed,
+				    __ATOMIC_RELAXED);
+  stats->spilled = __atomic_load_n (&overflow_stats.spilled,
+				    __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n (&overflow_stats.dropped,
+				    __ATOMIC_RELAXED);
 }
 
-void *
-journal_flusher_thread (void *arg)
+static uint64_t
+monotonic_us (void)
 {
-  while (1)
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double
+ewma (double avg, double sample)
+{
+  return avg == 0 ? sample : avg * 0.75 + sample * 0.25;
+}
+
+/* How long to keep collecting events before flushing, in microseconds.
+   Under sustained load there is no point waiting at all; when events
+   are sparse, waiting will not gather a second one, so flush almost at
+   once; in between, wait about as long as it takes to reach the byte
+   threshold, and at least as long as a write takes.  */
+static uint64_t
+flush_delay_us (void)
+{
+  uint64_t max_us = (uint64_t) flush_max_delay_ms * 1000;
+
+  if (streaming)
+    return 0;
+  if (arrival_rate_per_us * max_us < 2)
+    return JOURNAL_FLUSH_MIN_DELAY_US < max_us
+      ? JOURNAL_FLUSH_MIN_DELAY_US : max_us;
+
+  uint64_t delay = flush_threshold_events / arrival_rate_per_us;
+  if (delay < write_latency_us)
+    delay = write_latency_us;
+  if (delay < JOURNAL_FLUSH_MIN_DELAY_US)
+    delay = JOURNAL_FLUSH_MIN_DELAY_US;
+  return delay < max_us ? delay : max_us;
+}
+
+/* Event runs being merged into one batch: the shared queue and each
+   stage yield events in tx_id order, so the batch is a merge of them.  */
+struct event_run
+{
+  struct journal_payload_bin *(*at) (void *src, size_t i);
+  void *src;
+  size_t next, count;
+};
+
+static struct journal_payload_bin *
+queue_run_at (void *src, size_t i)
+{
+  (void) src;
+  return &journal_queue[(dequeue_pos + i) % JOURNAL_QUEUE_MAX].payload;
+}
+
+static struct journal_payload_bin *
+stage_run_at (void *src, size_t i)
+{
+  struct journal_stage *stage = src;
+  return &stage->slots[(stage->head + i) % JOURNAL_STAGE_SLOTS];
+}
+
+static struct journal_payload_bin *
+spill_run_at (void *src, size_t i)
+{
+  struct journal_spill **nodes = src;
+  return &nodes[i]->payload;
+}
+
+/* Detach the published prefix of the overflow arena into an array.  */
+static struct journal_spill **
+take_spilled (size_t *count)
+{
+  struct journal_spill **nodes = NULL;
+  size_t n = 0;
+
+  pthread_mutex_lock (&spill_lock);
+  for (struct journal_spill * sp = spill_head; sp && sp->published;
+       sp = sp->next)
+    n++;
+  if (n > JOURNAL_QUEUE_MAX)
+    n = JOURNAL_QUEUE_MAX;
+  if (n > 0)
+    nodes = malloc (n * sizeof *nodes);
+  if (!nodes)
+    n = 0;
+  for (size_t i = 0; i < n; i++)
     {
-      // Wait until the journal device is ready
-      while (!journal_device_ready && !shutdown_in_progress)
+      nodes[i] = spill_head;
+      spill_head = spill_head->next;
+    }
+  if (!spill_head)
+    spill_tail = &spill_head;
+  spill_count -= n;
+  pthread_mutex_unlock (&spill_lock);
+
+  *count = n;
+  return nodes;
+}
+
+/* Put back the spilled events the flusher did not get to.  */
+static void
+return_spilled (struct journal_spill **nodes, size_t from, size_t count)
+{
+  if (from == count)
+    return;
+
+  pthread_mutex_lock (&spill_lock);
+  nodes[count - 1]->next = spill_head;
+  for (size_t i = from; i + 1 < count; i++)
+    nodes[i]->next = nodes[i + 1];
+  if (!spill_head)
+    spill_tail = &nodes[count - 1]->next;
+  spill_head = nodes[from];
+  spill_count += count - from;
+  pthread_mutex_unlock (&spill_lock);
+}
+
+/* Number of published events at the head of the shared queue.  */
+static size_t
+queue_published (size_t max)
+{
+  size_t n = 0;
+  while (n < max && n < JOURNAL_QUEUE_MAX)
+    {
+      size_t pos = dequeue_pos + n;
+      struct journal_queue_entry *e = &journal_queue[pos % JOURNAL_QUEUE_MAX];
+      if (__atomic_load_n (&e->seq, __ATOMIC_ACQUIRE) != pos + 1)
+	break;
+      n++;
+    }
+  return n;
+}
+
+/* Fill BATCH with up to MAX events from RUNS, oldest tx_id first.  */
+static size_t
+merge_runs (struct event_run *runs, size_t nruns,
+	    struct journal_payload *batch, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+    {
+      struct event_run *best = NULL;
+      uint64_t best_tx = 0;
+      for (size_t r = 0; r < nruns; r++)
 	{
-	  usleep (100 * 1000);	// Sleep 100ms
+	  struct event_run *run = &runs[r];
+	  if (run->next == run->count)
+	    continue;
+	  uint64_t tx = run->at (run->src, run->next)->tx_id;
+	  if (!best || tx < best_tx)
+	    {
+	      best = run;
+	      best_tx = tx;
+	    }
 	}
+      if (!best)
+	break;
+      batch[n].data = (const char *) best->at (best->src, best->next++);
+      batch[n].len = sizeof (struct journal_payload_bin);
+      n++;
+    }
+  return n;
+}
+
+/* Whether PAYLOAD, a transaction of its own, only updates attributes of
+   its inode, so that a later such update of the inode supersedes it.  */
+static bool
+is_attr_update (const struct journal_payload_bin *payload)
+{
+  if (payload->tx_records != 1)
+    return false;
+
+  switch (journal_opcode_from_action (payload->action))
+    {
+    case JOURNAL_OP_CHMOD:
+    case JOURNAL_OP_CHOWN:
+    case JOURNAL_OP_TRUNCATE:
+    case JOURNAL_OP_GROW:
+    case JOURNAL_OP_UTIMES:
+      return true;
+    default:
+      return false;
+    }
+}
 
+/* Newest attribute update of an inode seen while walking a batch
+   backwards, or NULL if a namespace operation on it came after.  */
+struct coalesce_slot
+{
+  journal_ino_t ino;		/* 0 if the slot is free */
+  struct journal_payload_bin *latest;
+};
+
+/* Drop from BATCH, of COUNT events in tx_id order, every attribute
+   update followed by another one of the same inode with no other event
+   for that inode in between.  What the dropped update set is folded
+   into the one kept, so the last writer wins field by field.  Other
+   events are neither dropped nor reordered.  Return the new count.  */
+static size_t
+coalesce_batch (struct journal_payload *batch, size_t count)
+{
+  static struct coalesce_slot *slots;
+  static size_t nslots;
+  size_t dropped = 0;
+
+  if (count < 2)
+    return count;
+
+  if (nslots < count * 2)
+    {
+      size_t n = nslots ? nslots : 256;
+      while (n < count * 2)
+	n *= 2;
+      struct coalesce_slot *s = realloc (slots, n * sizeof *s);
+      if (!s)
+	return count;
+      slots = s;
+      nslots = n;
+    }
+  memset (slots, 0, nslots * sizeof *slots);
+
+  for (size_t i = count; i-- > 0;)
+    {
+      struct journal_payload_bin *p =
+	(struct journal_payload_bin *) batch[i].data;
+      if (p->ino == 0)
+	continue;
+
+      size_t h = (((uint64_t) p->ino * 0x9e3779b97f4a7c15ULL) >> 32)
+	& (nslots - 1);
+      while (slots[h].ino != 0 && slots[h].ino != p->ino)
+	h = (h + 1) & (nslots - 1);
+      struct coalesce_slot *slot = &slots[h];
+      slot->ino = p->ino;
+
+      if (!is_attr_update (p))
+	{
+	  slot->latest = NULL;
+	  continue;
+	}
+      if (!slot->latest)
+	{
+	  slot->latest = p;
+	  continue;
+	}
+
+      /* The kept update's mode and size are snapshots taken later, so
+         only the ownership it did not carry needs copying.  */
+      struct journal_payload_bin *latest = slot->latest;
+      latest->has_mode |= p->has_mode;
+      latest->has_size |= p->has_size;
+      if (p->has_uid && !latest->has_uid)
+	{
+	  latest->uid = p->uid;
+	  latest->has_uid = true;
+	}
+      if (p->has_gid && !latest->has_gid)
+	{
+	  latest->gid = p->gid;
+	  latest->has_gid = true;
+	}
+      batch[i].data = NULL;
+      dropped++;
+    }
+
+  if (dropped == 0)
+    return count;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++)
+    if (batch[i].data)
+      batch[kept++] = batch[i];
+  LOG_DEBUG ("Coalesced %zu of %zu events.", dropped, count);
+  return kept;
+}
+
+/* Hand back the events taken from each stage and free the stages of
+   exited threads once they are empty.  */
+static void
+release_stages (struct event_run *runs, size_t nruns)
+{
+  for (size_t r = 2; r < nruns; r++)
+    {
+      struct journal_stage *stage = runs[r].src;
+      __atomic_store_n (&stage->head, stage->head + runs[r].next,
+			__ATOMIC_SEQ_CST);
+    }
+
+  pthread_mutex_lock (&stage_list_lock);
+  for (struct journal_stage ** p = &stage_list; *p;)
+    {
+      struct journal_stage *stage = *p;
+      if (__atomic_load_n (&stage->dead, __ATOMIC_ACQUIRE)
+	  && __atomic_load_n (&stage->tail, __ATOMIC_ACQUIRE) == stage->head)
+	{
+	  *p = stage->next;
+	  free (stage);
+	}
+      else
+	p = &stage->next;
+    }
+  pthread_mutex_unlock (&stage_list_lock);
+}
+
+void *
+journal_flusher_thread (void *arg)
+{
+  static struct journal_payload batch[JOURNAL_BATCH_MAX];
+  struct event_run *runs = NULL;
+  size_t runs_alloc = 0;
+
+  while (1)
+    {
       pthread_mutex_lock (&queue_lock);
 
-      while (count == 0 && !shutdown_in_progress)
+      /* Wait until the journal device is ready; the device monitor
+         signals QUEUE_COND when it becomes so.  */
+      while (!journal_device_ready && !shutdown_in_progress)
+	pthread_cond_wait (&queue_cond, &queue_lock);
+
+      while (queue_depth () == 0 && !stages_pending ()
+	     && !shutdown_in_progress)
 	pthread_cond_wait (&queue_cond, &queue_lock);
 
-      if (shutdown_in_progress && count == 0)
+      if (shutdown_in_progress && queue_depth () == 0 && !stages_pending ())
 	{
 	  pthread_mutex_unlock (&queue_lock);
 	  break;
 	}
 
+      uint64_t delay_us = flush_delay_us ();
       struct timespec start;
       clock_gettime (CLOCK_REALTIME, &start);
 
       struct timespec deadline = start;
-      deadline.tv_nsec += (JOURNAL_FLUSH_TIMEOUT_MS % 1000) * 1000000;
-      deadline.tv_sec +=
-	JOURNAL_FLUSH_TIMEOUT_MS / 1000 + deadline.tv_nsec / 1000000000;
+      deadline.tv_nsec += (delay_us % 1000000) * 1000;
+      deadline.tv_sec += delay_us / 1000000 + deadline.tv_nsec / 1000000000;
       deadline.tv_nsec %= 1000000000;
 
-      while (count < JOURNAL_QUEUE_MAX && !shutdown_in_progress)
+      while (delay_us > 0 && queue_depth () < flush_threshold_events
+	     && !flush_requested && !shutdown_in_progress)
 	{
+	  uint64_t lazy_us = __atomic_load_n (&lazy_delay_us,
+					      __ATOMIC_SEQ_CST);
+	  if (lazy_us < delay_us)
+	    {
+	      delay_us = lazy_us;
+	      deadline = start;
+	      deadline.tv_nsec += (delay_us % 1000000) * 1000;
+	      deadline.tv_sec += delay_us / 1000000
+		+ deadline.tv_nsec / 1000000000;
+	      deadline.tv_nsec %= 1000000000;
+	      if (delay_us == 0)
+		break;
+	    }
+
 	  struct timespec now;
 	  clock_gettime (CLOCK_REALTIME, &now);
 	  if (now.tv_sec > deadline.tv_sec
@@ -149,27 +935,117 @@ journal_flusher_thread (void *arg)
 	  pthread_cond_timedwait (&queue_cond, &queue_lock, &deadline);
 	}
 
+      flush_requested = false;
+      pthread_mutex_unlock (&queue_lock);
+
       // If the device went away again, skip flushing
       if (!journal_device_ready)
+	continue;
+
+      /* Lazy events published before this are in the snapshot below;
+         those published after it set the delay for the next round.  */
+      __atomic_store_n (&lazy_delay_us, UINT64_MAX, __ATOMIC_SEQ_CST);
+
+      /* Snapshot the runs for this epoch: the shared queue first, then
+         the overflow arena, then every stage.  Events published after
+         this point wait for the next round.  */
+      size_t spilled_count;
+      struct journal_spill **spilled = take_spilled (&spilled_count);
+
+      pthread_mutex_lock (&stage_list_lock);
+      size_t nstages = 0;
+      for (struct journal_stage * st = stage_list; st; st = st->next)
+	nstages++;
+      if (nstages + 2 > runs_alloc)
 	{
-	  pthread_mutex_unlock (&queue_lock);
+	  struct event_run *r = realloc (runs, (nstages + 2) * sizeof *r);
+	  if (r)
+	    {
+	      runs = r;
+	      runs_alloc = nstages + 2;
+	    }
+	}
+      size_t nruns = 0;
+      if (runs_alloc > 0)
+	{
+	  runs[0].at = queue_run_at;
+	  runs[0].src = NULL;
+	  runs[0].next = 0;
+	  runs[0].count = queue_published (JOURNAL_QUEUE_MAX);
+	  runs[1].at = spill_run_at;
+	  runs[1].src = spilled;
+	  runs[1].next = 0;
+	  runs[1].count = spilled_count;
+	  nruns = 2;
+	  for (struct journal_stage * st = stage_list;
+	       st && nruns < runs_alloc; st = st->next, nruns++)
+	    {
+	      runs[nruns].at = stage_run_at;
+	      runs[nruns].src = st;
+	      runs[nruns].next = 0;
+	      runs[nruns].count =
+		__atomic_load_n (&st->tail, __ATOMIC_ACQUIRE) - st->head;
+	    }
+	}
+      pthread_mutex_unlock (&stage_list_lock);
+
+      size_t batch_count = merge_runs (runs, nruns, batch, JOURNAL_BATCH_MAX);
+      if (batch_count == 0)
+	{
+	  return_spilled (spilled, 0, spilled_count);
+	  free (spilled);
+	  /* Reserved but not yet published; give the producer a moment.  */
+	  sched_yield ();
 	  continue;
 	}
 
-      size_t batch_count = count;
-      struct journal_payload batch[JOURNAL_QUEUE_MAX];
+      /* Events taken from the runs are released below whether or not
+         they survive coalescing.  */
+      size_t merged_count = batch_count;
+      batch_count = coalesce_batch (batch, batch_count);
+
+      uint64_t write_start = monotonic_us ();
+      journal_write_raw (batch, batch_count);
+      uint64_t write_end = monotonic_us ();
+      journal_stats_batch (merged_count, batch_count,
+			   write_end - write_start);
+
+      /* Update the load estimates.  We keep streaming while each round
+         still finds at least a threshold's worth of events.  */
+      static uint64_t last_flush_us;
+      if (last_flush_us != 0 && write_end > last_flush_us)
+	arrival_rate_per_us = ewma (arrival_rate_per_us,
+				    (double) merged_count
+				    / (write_end - last_flush_us));
+      last_flush_us = write_end;
+      write_latency_us = ewma (write_latency_us, write_end - write_start);
+      streaming = merged_count >= flush_threshold_events;
 
-      for (size_t i = 0; i < batch_count; i++)
+      size_t taken = runs[0].next;
+      for (size_t i = 0; i < taken; i++)
 	{
-	  batch[i].data = journal_queue[head].data;
-	  batch[i].len = journal_queue[head].len;
-	  journal_queue[head].used = false;
-	  head = (head + 1) % JOURNAL_QUEUE_MAX;
+	  size_t pos = dequeue_pos + i;
+	  __atomic_store_n (&journal_queue[pos % JOURNAL_QUEUE_MAX].seq,
+			    pos + JOURNAL_QUEUE_MAX, __ATOMIC_RELEASE);
 	}
-      count = 0;
+      dequeue_pos += taken;
+      __atomic_fetch_sub (&queued, taken, __ATOMIC_RELEASE);
+      release_stages (runs, nruns);
 
-      pthread_mutex_unlock (&queue_lock);
-      journal_write_raw (batch, batch_count);
+      size_t spilled_taken = nruns > 1 ? runs[1].next : 0;
+      for (size_t i = 0; i < spilled_taken; i++)
+	free (spilled[i]);
+      return_spilled (spilled, spilled_taken, spilled_count);
+      free (spilled);
+
+      if (taken > 0)
+	{
+	  pthread_mutex_lock (&queue_lock);
+	  if (space_waiters > 0)
+	    pthread_cond_broadcast (&space_cond);
+	  pthread_mutex_unlock (&queue_lock);
+	}
     }
+  free (runs);
   return NULL;
 }
@@ -22,13 +22,28 @@
 #ifndef JOURNAL_QUEUE_H
 #define JOURNAL_QUEUE_H
 
+#include <libdiskfs/journal_format.h>
 #include <stddef.h>
 #include <stdbool.h>
 
 void journal_queue_init (void);
 void journal_queue_shutdown (void);
+
+/* Reserve a queue slot and return its payload for the caller to fill in
+   place, or NULL if the queue is full.  The slot is not zeroed.  Every
+   successful reservation must be followed by journal_queue_commit.  */
+struct journal_payload_bin *journal_queue_reserve (void);
+
+/* Publish a payload obtained from journal_queue_reserve to the flusher.  */
+void journal_queue_commit (struct journal_payload_bin *payload);
+
+/* Copy LEN bytes of DATA, a struct journal_payload_bin, into the queue.  */
 bool journal_enqueue (const char *data, size_t len);
 void journal_flush_now (void);
+
+/* Make sure that the events queued so far are flushed within MS
+   milliseconds.  */
+void journal_flush_within (unsigned int ms);
 void *journal_flusher_thread (void *arg);
 
 #endif /* JOURNAL_QUEUE_H */
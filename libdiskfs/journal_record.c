@@ -0,0 +1,312 @@
+/* journal_record.c - Encoding of compact (version 2) journal records
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <libdiskfs/journal_record.h>
+#include <libdiskfs/journal_compress.h>
+#include <string.h>
+
+static const char *const opcode_names[JOURNAL_OP_MAX] = {
+  [JOURNAL_OP_UNKNOWN] = "",
+  [JOURNAL_OP_CREATE] = "create",
+  [JOURNAL_OP_MKFILE] = "mkfile",
+  [JOURNAL_OP_UNLINK] = "unlink",
+  [JOURNAL_OP_RENAME] = "rename",
+  [JOURNAL_OP_LINK] = "link",
+  [JOURNAL_OP_MKDIR] = "mkdir",
+  [JOURNAL_OP_RMDIR] = "rmdir",
+  [JOURNAL_OP_SYMLINK] = "symlink",
+  [JOURNAL_OP_CHMOD] = "chmod",
+  [JOURNAL_OP_CHOWN] = "chown",
+  [JOURNAL_OP_TRUNCATE] = "truncate",
+  [JOURNAL_OP_GROW] = "grow",
+  [JOURNAL_OP_UTIMES] = "utimes",
+  [JOURNAL_OP_CHECKPOINT] = "checkpoint",
+  [JOURNAL_OP_NLINK] = "nlink",
+  [JOURNAL_OP_REVOKE] = "revoke",
+};
+
+enum journal_opcode
+journal_opcode_from_action (const char *action)
+{
+  for (unsigned int op = JOURNAL_OP_UNKNOWN + 1; op < JOURNAL_OP_MAX; op++)
+    if (strcmp (action, opcode_names[op]) == 0)
+      return op;
+  return JOURNAL_OP_UNKNOWN;
+}
+
+const char *
+journal_opcode_name (unsigned int opcode)
+{
+  return opcode < JOURNAL_OP_MAX ? opcode_names[opcode] : "";
+}
+
+/* Append the NUL-terminated field STR (of at most MAX_FIELD_LEN - 1
+   bytes) at *P, which must stay below END.  */
+static bool
+put_string (unsigned char **p, const unsigned char *end,
+	    const char *str, size_t max)
+{
+  size_t len = strnlen (str, max - 1);
+
+  if ((size_t) (end - *p) < 1 + len)
+    return false;
+  *(*p)++ = (unsigned char) len;
+  memcpy (*p, str, len);
+  *p += len;
+  return true;
+}
+
+static bool
+get_string (const unsigned char **p, const unsigned char *end,
+	    char *str, size_t max)
+{
+  if (*p >= end)
+    return false;
+
+  size_t len = *(*p)++;
+  if (len >= max || (size_t) (end - *p) < len)
+    return false;
+  memcpy (str, *p, len);
+  str[len] = '\0';
+  *p += len;
+  return true;
+}
+
+size_t
+journal_record_encode (const struct journal_payload_bin *payload,
+		       void *buf, size_t size)
+{
+  struct journal_record_hdr *hdr = buf;
+  unsigned char *p = (unsigned char *) buf + sizeof *hdr;
+  const unsigned char *end = (unsigned char *) buf + size;
+
+  if (size < sizeof *hdr)
+    return 0;
+
+  enum journal_opcode op = journal_opcode_from_action (payload->action);
+
+  hdr->magic = JOURNAL_MAGIC;
+  hdr->version = JOURNAL_VERSION;
+  hdr->opcode = op;
+  hdr->flags = ((payload->has_mode ? JOURNAL_REC_HAS_MODE : 0)
+		| (payload->has_size ? JOURNAL_REC_HAS_SIZE : 0)
+		| (payload->has_uid ? JOURNAL_REC_HAS_UID : 0)
+		| (payload->has_gid ? JOURNAL_REC_HAS_GID : 0));
+  hdr->tx_remaining = payload->tx_remaining;
+  hdr->crc32 = 0;
+  hdr->tx_id = payload->tx_id;
+  hdr->timestamp_ms = payload->timestamp_ms;
+  hdr->parent_ino = payload->parent_ino;
+  hdr->src_parent_ino = payload->src_parent_ino;
+  hdr->dst_parent_ino = payload->dst_parent_ino;
+  hdr->ino = payload->ino;
+  hdr->st_mode = payload->st_mode;
+  hdr->st_nlink = (uint32_t) payload->st_nlink;
+  hdr->st_size = payload->st_size;
+  hdr->st_blocks = payload->st_blocks;
+  hdr->mtime = payload->mtime;
+  hdr->ctime = payload->ctime;
+  hdr->uid = payload->uid;
+  hdr->gid = payload->gid;
+
+  if (!put_string (&p, end, payload->name, sizeof payload->name)
+      || !put_string (&p, end, payload->old_name, sizeof payload->old_name)
+      || !put_string (&p, end, payload->new_name, sizeof payload->new_name)
+      || !put_string (&p, end, payload->target, sizeof payload->target)
+      || !put_string (&p, end, payload->extra, sizeof payload->extra)
+      || !put_string (&p, end, op == JOURNAL_OP_UNKNOWN ? payload->action : "",
+		      sizeof payload->action))
+    return 0;
+
+  size_t length = p - (unsigned char *) buf;
+  size_t padded = journal_record_padded_len (length);
+  if (padded > size)
+    return 0;
+  memset (p, 0, padded - length);
+
+  hdr->length = (uint16_t) length;
+  hdr->crc32 = journal_checksum (JOURNAL_VERSION, 0, buf, length);
+  return padded;
+}
+
+bool
+journal_record_verify (unsigned int version, const void *buf, size_t avail,
+		       struct journal_record_hdr *hdr, size_t *reclen)
+{
+  if (avail < sizeof *hdr)
+    return false;
+  memcpy (hdr, buf, sizeof *hdr);
+
+  if (hdr->magic != JOURNAL_MAGIC || hdr->version != version
+      || hdr->length < sizeof *hdr || hdr->length > avail)
+    return false;
+
+  uint32_t stored_crc = hdr->crc32;
+  hdr->crc32 = 0;
+  uint32_t crc = journal_checksum (version, 0, hdr, sizeof *hdr);
+  crc = journal_checksum (version, crc, (const unsigned char *) buf + sizeof *hdr,
+			  hdr->length - sizeof *hdr);
+  hdr->crc32 = stored_crc;
+  if (crc != stored_crc)
+    return false;
+
+  /* The strings must exactly fill the record.  */
+  const unsigned char *p = (const unsigned char *) buf + sizeof *hdr;
+  const unsigned char *end = (const unsigned char *) buf + hdr->length;
+  size_t len = 0;
+  for (int i = 0; i < JOURNAL_REC_NSTRINGS; i++)
+    {
+      if (p >= end)
+	return false;
+      len = *p++;
+      if (len >= MAX_FIELD_LEN || (size_t) (end - p) < len)
+	return false;
+      p += len;
+    }
+  if (p != end)
+    return false;
+
+  /* Unknown operations carry their action string, which must not be
+     empty.  */
+  if (hdr->opcode == JOURNAL_OP_UNKNOWN && len == 0)
+    return false;
+
+  *reclen = journal_record_padded_len (hdr->length);
+  return true;
+}
+
+bool
+journal_record_decode (unsigned int version, const void *buf, size_t avail,
+		       struct journal_payload_bin *payload, size_t *reclen)
+{
+  struct journal_record_hdr hdr;
+
+  if (!journal_record_verify (version, buf, avail, &hdr, reclen))
+    return false;
+
+  memset (payload, 0, sizeof *payload);
+  payload->tx_id = hdr.tx_id;
+  payload->timestamp_ms = hdr.timestamp_ms;
+  payload->parent_ino = hdr.parent_ino;
+  payload->src_parent_ino = hdr.src_parent_ino;
+  payload->dst_parent_ino = hdr.dst_parent_ino;
+  payload->ino = hdr.ino;
+  payload->st_mode = hdr.st_mode;
+  payload->st_size = hdr.st_size;
+  payload->st_nlink = hdr.st_nlink;
+  payload->st_blocks = hdr.st_blocks;
+  payload->mtime = hdr.mtime;
+  payload->ctime = hdr.ctime;
+  payload->uid = hdr.uid;
+  payload->gid = hdr.gid;
+  payload->has_mode = (hdr.flags & JOURNAL_REC_HAS_MODE) != 0;
+  payload->has_size = (hdr.flags & JOURNAL_REC_HAS_SIZE) != 0;
+  payload->has_uid = (hdr.flags & JOURNAL_REC_HAS_UID) != 0;
+  payload->has_gid = (hdr.flags & JOURNAL_REC_HAS_GID) != 0;
+  payload->tx_remaining = hdr.tx_remaining;
+
+  const unsigned char *p = (const unsigned char *) buf + sizeof hdr;
+  const unsigned char *end = (const unsigned char *) buf + hdr.length;
+  char action[MAX_FIELD_LEN];
+
+  if (!get_string (&p, end, payload->name, sizeof payload->name)
+      || !get_string (&p, end, payload->old_name, sizeof payload->old_name)
+      || !get_string (&p, end, payload->new_name, sizeof payload->new_name)
+      || !get_string (&p, end, payload->target, sizeof payload->target)
+      || !get_string (&p, end, payload->extra, sizeof payload->extra)
+      || !get_string (&p, end, action, sizeof action)
+      || p != end)
+    return false;
+
+  strcpy (payload->action, hdr.opcode == JOURNAL_OP_UNKNOWN
+	  ? action : journal_opcode_name (hdr.opcode));
+  return true;
+}
+
+size_t
+journal_frame_encode (const void *records, size_t raw_len, size_t nrecords,
+		      uint64_t max_tx, void *buf, size_t size)
+{
+  struct journal_frame_hdr *hdr = buf;
+
+  if (size < sizeof *hdr || raw_len <= sizeof *hdr)
+    return 0;
+
+  /* Only keep the frame if it saves room.  */
+  size_t room = raw_len - sizeof *hdr;
+  if (room > size - sizeof *hdr)
+    room = size - sizeof *hdr;
+  size_t length = journal_lz4_compress (records, raw_len, hdr + 1, room);
+  if (length == 0)
+    return 0;
+  size_t padded = journal_record_padded_len (sizeof *hdr + length);
+  if (padded >= raw_len || padded > size)
+    return 0;
+
+  *hdr = (struct journal_frame_hdr) {
+    .magic = JOURNAL_FRAME_MAGIC,
+    .version = JOURNAL_VERSION,
+    .method = JOURNAL_FRAME_LZ4,
+    .length = length,
+    .raw_length = raw_len,
+    .nrecords = nrecords,
+    .max_tx = max_tx,
+  };
+  hdr->crc32 = journal_checksum (JOURNAL_VERSION, 0, buf,
+				 sizeof *hdr + length);
+  memset ((char *) buf + sizeof *hdr + length, 0,
+	  padded - sizeof *hdr - length);
+  return padded;
+}
+
+bool
+journal_frame_expand (unsigned int version, const void *buf, size_t avail,
+		      void *out, size_t size,
+		      struct journal_frame_hdr *hdr, size_t *framelen)
+{
+  if (avail < sizeof *hdr)
+    return false;
+  memcpy (hdr, buf, sizeof *hdr);
+
+  if (hdr->magic != JOURNAL_FRAME_MAGIC || hdr->version != version
+      || hdr->method != JOURNAL_FRAME_LZ4
+      || hdr->length > avail - sizeof *hdr
+      || hdr->raw_length > size)
+    return false;
+
+  uint32_t stored_crc = hdr->crc32;
+  hdr->crc32 = 0;
+  uint32_t crc = journal_checksum (version, 0, hdr, sizeof *hdr);
+  crc = journal_checksum (version, crc,
+			  (const unsigned char *) buf + sizeof *hdr,
+			  hdr->length);
+  hdr->crc32 = stored_crc;
+  if (crc != stored_crc)
+    return false;
+
+  if (journal_lz4_decompress ((const unsigned char *) buf + sizeof *hdr,
+			      hdr->length, out, hdr->raw_length)
+      != hdr->raw_length)
+    return false;
+
+  *framelen = journal_record_padded_len (sizeof *hdr + hdr->length);
+  return true;
+}
@@ -0,0 +1,92 @@
+/* journal_record.h - Encoding of compact (version 2) journal records
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_RECORD_H
+#define JOURNAL_RECORD_H
+
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/crc32.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Round a record LENGTH up to the ring alignment.  */
+static inline size_t
+journal_record_padded_len (size_t length)
+{
+  return (length + JOURNAL_RECORD_ALIGN - 1)
+    & ~(size_t) (JOURNAL_RECORD_ALIGN - 1);
+}
+
+/* Extend CRC over LEN bytes at DATA with the checksum used by journal
+   format VERSION.  */
+static inline uint32_t
+journal_checksum (unsigned int version, uint32_t crc,
+		  const void *data, size_t len)
+{
+  return (version >= JOURNAL_VERSION_CRC32C
+	  ? crc32c_update (crc, data, len) : crc32_update (crc, data, len));
+}
+
+enum journal_opcode journal_opcode_from_action (const char *action);
+const char *journal_opcode_name (unsigned int opcode);
+
+/* Encode PAYLOAD as a JOURNAL_VERSION record into BUF, which has room for SIZE
+   bytes.  The padding is zeroed.  Return the padded length of the
+   record, or 0 if it does not fit.  */
+size_t journal_record_encode (const struct journal_payload_bin *payload,
+			      void *buf, size_t size);
+
+/* Check the record at BUF, of which AVAIL bytes are readable, against
+   format VERSION (2 or later) without unpacking its strings.  On
+   success copy its fixed part to *HDR, store its padded length in
+   *RECLEN and return true.  */
+bool journal_record_verify (unsigned int version,
+			    const void *buf, size_t avail,
+			    struct journal_record_hdr *hdr, size_t *reclen);
+
+/* Check the record at BUF, of which AVAIL bytes are readable, against
+   format VERSION (2 or later) and unpack it into PAYLOAD.  On success store the padded length of
+   the record in *RECLEN and return true.  */
+bool journal_record_decode (unsigned int version,
+			    const void *buf, size_t avail,
+			    struct journal_payload_bin *payload,
+			    size_t *reclen);
+
+/* Compress the RAW_LEN bytes of NRECORDS records at RECORDS, of which
+   MAX_TX is the highest tx_id, into a JOURNAL_VERSION frame in BUF,
+   which has room for SIZE bytes.  Return the padded length of the
+   frame, or 0 if it does not fit or would not be smaller than the
+   records.  */
+size_t journal_frame_encode (const void *records, size_t raw_len,
+			     size_t nrecords, uint64_t max_tx,
+			     void *buf, size_t size);
+
+/* Check the frame at BUF, of which AVAIL bytes are readable, against
+   format VERSION and expand its records into OUT, which has room for
+   SIZE bytes.  On success copy its header to *HDR, store its padded
+   length in *FRAMELEN and return true.  */
+bool journal_frame_expand (unsigned int version,
+			   const void *buf, size_t avail,
+			   void *out, size_t size,
+			   struct journal_frame_hdr *hdr, size_t *framelen);
+
+#endif /* JOURNAL_RECORD_H */
@@ -19,8 +19,22 @@
    You should have received a copy of the GNU General Public License
    along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
 
+/* Replay streams through the ring instead of loading it whole.  The
+   ring is read in large sequential chunks; the reader finds the record
+   boundaries in each chunk, worker threads check the CRCs of their
+   share of the records and order it by tx_id, and the shares are then
+   merged and applied in tx_id order.  Per-inode state is kept in a flat
+   open-addressing table, so memory use is bounded by the chunk size and
+   the number of distinct inodes.  tx_ids are assigned in order and the
+   flusher writes them in order, so the merge only has to correct small
+   local reorderings (for example synchronous writes that overtook a
+   queued batch).  */
+
+#include <libdiskfs/journal_replayer.h>
 #include <libdiskfs/journal_format.h>
 #include <libdiskfs/journal_globals.h>
+#include <libdiskfs/journal_record.h>
+#include <libdiskfs/journal_device.h>
 #include <libdiskfs/crc32.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -31,109 +45,594 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <pthread.h>
+
+#define REPLAY_CHUNK		(1024 * 1024)
+#define REPLAY_MAX_WORKERS	8
+
+/* Below this many records in a chunk, checking them is cheaper than
+   starting threads.  */
+#define REPLAY_MIN_PARALLEL	512
+
+/* Smallest possible record; bounds the number of records in a chunk.  */
+#define REPLAY_MIN_RECORD \
+  ((sizeof (struct journal_record_hdr) + JOURNAL_REC_NSTRINGS \
+    + JOURNAL_RECORD_ALIGN - 1) & ~(size_t) (JOURNAL_RECORD_ALIGN - 1))
+#define REPLAY_MAX_RECORDS	(REPLAY_CHUNK / REPLAY_MIN_RECORD + 1)
+
+/* Replayed state of one inode.  */
+struct replay_inode
+{
+  journal_ino_t ino;		/* 0 if the slot is free */
+  uint32_t events;
+  uint64_t last_tx_id;
+  uint64_t revoke_tx_id;	/* Records below this tx_id are void */
+  uint64_t st_size;
+  uint32_t st_mode;
+  uint32_t st_nlink;
+  journal_uid_t uid;
+  journal_uid_t gid;
+  uint8_t flags;		/* JOURNAL_REC_HAS_* seen so far */
+  uint8_t last_opcode;
+};
 
-struct journal_entries
+struct replay_table
 {
-  struct journal_payload_bin **entries;
+  struct replay_inode *slots;
+  size_t mask;			/* capacity - 1, capacity a power of two */
   size_t count;
-  size_t capacity;
 };
 
-static void
-add_event_to_global_list (struct journal_entries *list,
-			  struct journal_payload_bin *entry)
+/* A record found in the current chunk.  */
+struct replay_rec
+{
+  uint32_t off;			/* Offset in the chunk buffer */
+  uint32_t len;			/* Padded length */
+  uint64_t pos;			/* Ring position, for messages */
+  struct journal_record_hdr hdr;
+};
+
+/* One worker's share of a chunk.  */
+struct replay_share
+{
+  const char *buf;
+  unsigned int version;
+  struct replay_rec *recs;
+  size_t count;
+  size_t valid;			/* Length of the verified prefix */
+};
+
+/* A record of a transaction whose commit has not been seen yet.  */
+struct replay_pending
+{
+  struct journal_record_hdr hdr;
+  uint64_t pos;
+};
+
+struct replay_state
+{
+  unsigned int version;
+  uint64_t capacity;		/* Bytes in the data area of the ring */
+  struct replay_table inodes;
+  size_t applied;
+  uint64_t last_tx_id;
+  size_t reordered;
+  size_t checkpoints;
+  size_t revoked;		/* Records voided by a revoke record */
+  struct replay_pending *pending;
+  size_t npending;
+  size_t pending_capacity;
+  /* Buffers reused for every chunk, and for the records of a frame.  */
+  char *buf;
+  char *frame_buf;
+  struct replay_rec *recs;
+  int nworkers;
+};
+
+/* The device offset of the ring position POS.  */
+static inline off_t
+replay_offset (const struct replay_state *st, uint64_t pos)
+{
+  return JOURNAL_RESERVED_SPACE + pos % st->capacity;
+}
+
+static inline size_t
+hash_ino (journal_ino_t ino)
+{
+  return (size_t) (((uint64_t) ino * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static bool
+table_grow (struct replay_table *t)
+{
+  size_t capacity = t->slots ? (t->mask + 1) * 2 : 1024;
+  struct replay_inode *slots = calloc (capacity, sizeof *slots);
+  if (!slots)
+    return false;
+
+  if (t->slots)
+    {
+      for (size_t i = 0; i <= t->mask; i++)
+	if (t->slots[i].ino != 0)
+	  {
+	    size_t j = hash_ino (t->slots[i].ino) & (capacity - 1);
+	    while (slots[j].ino != 0)
+	      j = (j + 1) & (capacity - 1);
+	    slots[j] = t->slots[i];
+	  }
+      free (t->slots);
+    }
+
+  t->slots = slots;
+  t->mask = capacity - 1;
+  return true;
+}
+
+/* Find or add the entry for INO.  */
+static struct replay_inode *
+table_lookup (struct replay_table *t, journal_ino_t ino)
 {
-  if (list->count == list->capacity)
+  if ((!t->slots || (t->count + 1) * 4 > (t->mask + 1) * 3)
+      && !table_grow (t))
+    return NULL;
+
+  size_t i = hash_ino (ino) & t->mask;
+  while (t->slots[i].ino != 0 && t->slots[i].ino != ino)
+    i = (i + 1) & t->mask;
+
+  if (t->slots[i].ino == 0)
     {
-      size_t new_capacity = list->capacity == 0 ? 128 : list->capacity * 2;
-      list->entries =
-	realloc (list->entries, new_capacity * sizeof (*list->entries));
-      list->capacity = new_capacity;
+      t->slots[i].ino = ino;
+      t->count++;
     }
-  list->entries[list->count++] = entry;
+  return &t->slots[i];
 }
 
-static int
-compare_entries_by_time_then_txid (const void *a, const void *b)
+/* Apply the event described by HDR, found at ring position POS.  */
+static bool
+apply_event (struct replay_state *st, const struct journal_record_hdr *hdr,
+	     uint64_t pos)
 {
-  const struct journal_payload_bin *entry_a =
-    *(const struct journal_payload_bin **) a;
-  const struct journal_payload_bin *entry_b =
-    *(const struct journal_payload_bin **) b;
+  if (hdr->opcode == JOURNAL_OP_CHECKPOINT)
+    {
+      /* The header start already points past what it released.  */
+      LOG_DEBUG ("index: %" PRIu64 ", checkpoint at tx_id %" PRIu64,
+		 pos, hdr->tx_id);
+      st->checkpoints++;
+      return true;
+    }
+
+  if (hdr->ino == 0)
+    {
+      LOG_DEBUG ("ino not valid on index %" PRIu64 " tx_id %" PRIu64
+		 " ino = 0", pos, hdr->tx_id);
+      return false;
+    }
+
+  struct replay_inode *node = table_lookup (&st->inodes, hdr->ino);
+  if (!node)
+    {
+      LOG_DEBUG ("Out of memory");
+      return false;
+    }
+
+  if (hdr->opcode == JOURNAL_OP_REVOKE)
+    {
+      /* Forget the inode's history; records for it that are still to
+         come with a lower tx_id are skipped below.  */
+      if (hdr->tx_id > node->revoke_tx_id)
+	{
+	  st->revoked += node->events;
+	  *node = (struct replay_inode) {
+	    .ino = hdr->ino,
+	    .revoke_tx_id = hdr->tx_id,
+	  };
+	}
+      return true;
+    }
 
-  if (entry_a->timestamp_ms < entry_b->timestamp_ms)
-    return -1;
-  if (entry_a->timestamp_ms > entry_b->timestamp_ms)
-    return 1;
+  if (hdr->tx_id < node->revoke_tx_id)
+    {
+      st->revoked++;
+      return true;
+    }
 
-  // Tie-breaker: lower tx_id wins
-  if (entry_a->tx_id < entry_b->tx_id)
-    return -1;
-  if (entry_a->tx_id > entry_b->tx_id)
-    return 1;
+  if (hdr->tx_id < st->last_tx_id)
+    st->reordered++;
+  else
+    st->last_tx_id = hdr->tx_id;
 
-  return 0;
+  if (hdr->tx_id >= node->last_tx_id)
+    {
+      node->last_tx_id = hdr->tx_id;
+      node->last_opcode = hdr->opcode;
+      node->st_nlink = hdr->st_nlink;
+      if (hdr->flags & JOURNAL_REC_HAS_MODE)
+	node->st_mode = hdr->st_mode;
+      if (hdr->flags & JOURNAL_REC_HAS_SIZE)
+	node->st_size = hdr->st_size;
+      if (hdr->flags & JOURNAL_REC_HAS_UID)
+	node->uid = hdr->uid;
+      if (hdr->flags & JOURNAL_REC_HAS_GID)
+	node->gid = hdr->gid;
+      node->flags |= hdr->flags;
+    }
+  node->events++;
+  st->applied++;
+
+  LOG_DEBUG ("index: %" PRIu64 ", tx_id: %" PRIu64 ", timestamp: %"
+	     PRIu64 ", ino: %u, action: %s", pos, hdr->tx_id,
+	     hdr->timestamp_ms, hdr->ino,
+	     hdr->opcode == JOURNAL_OP_UNKNOWN
+	     ? "other" : journal_opcode_name (hdr->opcode));
+  return true;
 }
 
-static void
-sort_global_entries (struct journal_entries *list)
+/* Apply the record HDR, found at ring position POS, once the
+   transaction it belongs to is complete.  */
+static bool
+apply_record (struct replay_state *st, const struct journal_record_hdr *hdr,
+	      uint64_t pos)
 {
-  qsort (list->entries, list->count,
-	 sizeof (struct journal_payload_bin *),
-	 compare_entries_by_time_then_txid);
+  bool open = false;
+  for (size_t i = 0; i < st->npending && !open; i++)
+    open = st->pending[i].hdr.tx_id == hdr->tx_id;
+  if (!open && hdr->tx_remaining == 0)
+    return apply_event (st, hdr, pos);
+
+  if (st->npending == st->pending_capacity)
+    {
+      size_t capacity = st->pending_capacity ? st->pending_capacity * 2 : 16;
+      struct replay_pending *p =
+	realloc (st->pending, capacity * sizeof *p);
+      if (!p)
+	{
+	  LOG_DEBUG ("Out of memory");
+	  return false;
+	}
+      st->pending = p;
+      st->pending_capacity = capacity;
+    }
+  st->pending[st->npending++] = (struct replay_pending) {
+    .hdr = *hdr,
+    .pos = pos,
+  };
+
+  /* The transaction is complete once its records cover every count
+     from the first one's TX_REMAINING down to 0.  */
+  unsigned int first = 0;
+  for (size_t i = 0; i < st->npending; i++)
+    if (st->pending[i].hdr.tx_id == hdr->tx_id
+	&& st->pending[i].hdr.tx_remaining > first)
+      first = st->pending[i].hdr.tx_remaining;
+
+  size_t members[first + 1];
+  for (unsigned int r = 0; r <= first; r++)
+    {
+      size_t i = 0;
+      while (i < st->npending
+	     && (st->pending[i].hdr.tx_id != hdr->tx_id
+		 || st->pending[i].hdr.tx_remaining != r))
+	i++;
+      if (i == st->npending)
+	return true;
+      members[r] = i;
+    }
+
+  bool ok = true;
+  for (unsigned int r = first + 1; r-- > 0 && ok;)
+    ok = apply_event (st, &st->pending[members[r]].hdr,
+		      st->pending[members[r]].pos);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < st->npending; i++)
+    if (st->pending[i].hdr.tx_id != hdr->tx_id)
+      st->pending[kept++] = st->pending[i];
+  st->npending = kept;
+  return ok;
 }
 
-void
-journal_replay_from_file (const char *path)
+/* Check the records of SHARE and sort them by tx_id.  Records are
+   almost always in order already, so insertion sort is linear in
+   practice.  */
+static void *
+verify_share (void *arg)
 {
-  fprintf (stderr, "Toy journaling: Starting validation.\n");
-  int fd = open (path, O_RDONLY);
-  if (fd < 0)
+  struct replay_share *share = arg;
+
+  share->valid = 0;
+  for (size_t i = 0; i < share->count; i++)
     {
-      fprintf (stderr, "journal_replay_and_validate: open failed: %s\n",
-	       strerror (errno));
-      return;
+      struct replay_rec *rec = &share->recs[i];
+      size_t reclen;
+      if (!journal_record_verify (share->version, share->buf + rec->off,
+				  rec->len, &rec->hdr, &reclen)
+	  || reclen != rec->len)
+	break;
+      share->valid++;
     }
 
-  struct journal_header hdr = { 0 };
-  ssize_t n = pread (fd, &hdr, sizeof (hdr), 0);
-  if (n != sizeof (hdr))
+  for (size_t i = 1; i < share->valid; i++)
     {
-      fprintf (stderr, "journal replay: could not read journal header\n");
-      close (fd);
-      return;
+      struct replay_rec rec = share->recs[i];
+      size_t j = i;
+      while (j > 0 && share->recs[j - 1].hdr.tx_id > rec.hdr.tx_id)
+	{
+	  share->recs[j] = share->recs[j - 1];
+	  j--;
+	}
+      share->recs[j] = rec;
     }
+  return NULL;
+}
 
-  uint32_t expected_crc = hdr.crc32;
-  hdr.crc32 = 0;
-  uint32_t actual_crc = crc32 ((const void *) &hdr, sizeof (hdr));
-  if (actual_crc != expected_crc
-      || hdr.magic != JOURNAL_MAGIC || hdr.version != JOURNAL_VERSION)
+/* Check and apply the COUNT records found in BUF, the current chunk or
+   the contents of a frame.  */
+static bool
+process_chunk (struct replay_state *st, const char *buf, size_t count)
+{
+  struct replay_share shares[REPLAY_MAX_WORKERS];
+  pthread_t threads[REPLAY_MAX_WORKERS];
+  bool started[REPLAY_MAX_WORKERS] = { false };
+  int nshares = count >= REPLAY_MIN_PARALLEL ? st->nworkers : 1;
+  size_t per = (count + nshares - 1) / nshares;
+
+  for (int i = 0; i < nshares; i++)
     {
-      fprintf (stderr, "journal replay: header invalid\n");
-      close (fd);
-      return;
+      size_t lo = i * per < count ? i * per : count;
+      size_t hi = lo + per < count ? lo + per : count;
+      shares[i] = (struct replay_share) {
+	.buf = buf,
+	.version = st->version,
+	.recs = st->recs + lo,
+	.count = hi - lo,
+      };
     }
 
-  if (hdr.start_index >= JOURNAL_NUM_ENTRIES
-      || hdr.end_index >= JOURNAL_NUM_ENTRIES)
+  for (int i = 1; i < nshares; i++)
+    started[i] = pthread_create (&threads[i], NULL, verify_share,
+				 &shares[i]) == 0;
+  verify_share (&shares[0]);
+  for (int i = 1; i < nshares; i++)
     {
-      fprintf (stderr, "journal_write_raw: header indices out of bounds\n");
-      close (fd);
-      return;
+      if (started[i])
+	pthread_join (threads[i], NULL);
+      else
+	verify_share (&shares[i]);
     }
 
-  uint64_t index = hdr.start_index;
-  uint64_t end_index = hdr.end_index;
-  LOG_DEBUG ("header start index %llu and end index %llu", index, end_index);
-  char buf[JOURNAL_ENTRY_SIZE] = { 0 };
+  /* Only the records before the first bad one can be trusted.  */
+  int nvalid = 0;
   bool all_good = true;
-  struct journal_entries list = { 0 };
+  while (nvalid < nshares && shares[nvalid].valid == shares[nvalid].count)
+    nvalid++;
+  if (nvalid < nshares)
+    {
+      const struct replay_rec *bad =
+	&shares[nvalid].recs[shares[nvalid].valid];
+      fprintf (stderr, "journal replay: bad record at offset %ld\n",
+	       (long) replay_offset (st, bad->pos));
+      all_good = false;
+      nvalid++;
+    }
+
+  /* Merge the sorted shares by tx_id.  */
+  size_t next[REPLAY_MAX_WORKERS] = { 0 };
+  while (1)
+    {
+      int best = -1;
+      for (int i = 0; i < nvalid; i++)
+	if (next[i] < shares[i].valid
+	    && (best < 0
+		|| shares[i].recs[next[i]].hdr.tx_id
+		< shares[best].recs[next[best]].hdr.tx_id))
+	  best = i;
+      if (best < 0)
+	break;
+
+      const struct replay_rec *rec = &shares[best].recs[next[best]++];
+      if (!apply_record (st, &rec->hdr, rec->pos))
+	return false;
+    }
+
+  return all_good;
+}
+
+/* Check and apply the records of the frame at BUF, of which AVAIL bytes
+   are readable, found at ring position POS.  On success store its
+   padded length in *FRAMELEN.  */
+static bool
+replay_frame (struct replay_state *st, const char *buf, size_t avail,
+	      uint64_t pos, size_t *framelen)
+{
+  struct journal_frame_hdr hdr;
+  size_t count = 0;
+
+  if (!journal_frame_expand (st->version, buf, avail, st->frame_buf,
+			     JOURNAL_FRAME_RAW_MAX, &hdr, framelen))
+    {
+      fprintf (stderr, "journal replay: bad frame at offset %ld\n",
+	       (long) replay_offset (st, pos));
+      return false;
+    }
+
+  /* Only find the boundaries here; verify_share checks each record.  */
+  for (size_t off = 0; off < hdr.raw_length;)
+    {
+      const struct journal_record_hdr *rec =
+	(const struct journal_record_hdr *) (st->frame_buf + off);
+      size_t len;
+      if (hdr.raw_length - off < sizeof *rec
+	  || rec->length < sizeof *rec + JOURNAL_REC_NSTRINGS
+	  || (len = journal_record_padded_len (rec->length))
+	     > hdr.raw_length - off)
+	{
+	  fprintf (stderr, "journal replay: bad frame at offset %ld\n",
+		   (long) replay_offset (st, pos));
+	  return false;
+	}
+      st->recs[count++] = (struct replay_rec) {
+	.off = off,
+	.len = len,
+	.pos = pos,
+      };
+      off += len;
+    }
+
+  return process_chunk (st, st->frame_buf, count);
+}
+
+/* Replay the records between ring positions POS and LIMIT, which do not
+   wrap.  A wrap marker ends the segment early and sets *WRAPPED.  */
+static bool
+replay_segment (struct journal_dev *dev, struct replay_state *st, uint64_t pos,
+		uint64_t limit, bool *wrapped)
+{
+  size_t have = 0;		/* Bytes in the buffer, starting at POS */
+  uint64_t read_pos = pos;	/* Ring position of the next read */
+
+  *wrapped = false;
+  while (pos < limit)
+    {
+      size_t want = REPLAY_CHUNK - have;
+      if (want > limit - read_pos)
+	want = limit - read_pos;
+      while (want > 0)
+	{
+	  ssize_t n = journal_dev_pread (dev, st->buf + have, want,
+					 (off_t) replay_offset (st, read_pos));
+	  if (n <= 0)
+	    {
+	      fprintf (stderr,
+		       "journal replay: incomplete read at offset %ld\n",
+		       (long) replay_offset (st, read_pos));
+	      return false;
+	    }
+	  have += n;
+	  read_pos += n;
+	  want -= n;
+	}
+
+      /* Find the record boundaries.  */
+      size_t off = 0;
+      size_t count = 0;
+      bool at_end = read_pos == limit;
+      while (off < have)
+	{
+	  size_t left = have - off;
+	  const struct journal_wrap_marker *marker =
+	    (const struct journal_wrap_marker *) (st->buf + off);
+	  if (left >= sizeof *marker && marker->magic == JOURNAL_WRAP_MAGIC)
+	    {
+	      *wrapped = true;
+	      break;
+	    }
+
+	  if (left >= sizeof (struct journal_frame_hdr)
+	      && marker->magic == JOURNAL_FRAME_MAGIC)
+	    {
+	      const struct journal_frame_hdr *fh =
+		(const struct journal_frame_hdr *) (st->buf + off);
+	      if (fh->length <= JOURNAL_FRAME_RAW_MAX
+		  && journal_record_padded_len (sizeof *fh + fh->length) > left)
+		break;
+
+	      /* Apply what came before the frame, then its records.  */
+	      if (count > 0 && !process_chunk (st, st->buf, count))
+		return false;
+	      count = 0;
+	      size_t framelen;
+	      if (!replay_frame (st, st->buf + off, left, pos + off,
+				 &framelen))
+		return false;
+	      off += framelen;
+	      continue;
+	    }
+
+	  if (left < sizeof (struct journal_record_hdr))
+	    break;
+	  const struct journal_record_hdr *hdr =
+	    (const struct journal_record_hdr *) (st->buf + off);
+	  size_t len = journal_record_padded_len (hdr->length);
+	  /* No shorter record passes journal_record_verify, and
+	     REPLAY_MAX_RECORDS counts on that.  */
+	  if (hdr->magic != JOURNAL_MAGIC
+	      || hdr->length < (sizeof (struct journal_record_hdr)
+				+ JOURNAL_REC_NSTRINGS))
+	    {
+	      fprintf (stderr, "journal replay: bad record at offset %ld\n",
+		       (long) replay_offset (st, pos + off));
+	      if (count > 0)
+		process_chunk (st, st->buf, count);
+	      return false;
+	    }
+	  if (len > left)
+	    break;
+
+	  st->recs[count++] = (struct replay_rec) {
+	    .off = off,
+	    .len = len,
+	    .pos = pos + off,
+	  };
+	  off += len;
+
+	  if (count == REPLAY_MAX_RECORDS)
+	    {
+	      if (!process_chunk (st, st->buf, count))
+		return false;
+	      count = 0;
+	    }
+	}
+
+      if (!*wrapped && off < have && at_end)
+	{
+	  fprintf (stderr,
+		   "journal replay: incomplete read at offset %ld\n",
+		   (long) replay_offset (st, pos + off));
+	  if (count > 0)
+	    process_chunk (st, st->buf, count);
+	  return false;
+	}
+
+      if (count > 0 && !process_chunk (st, st->buf, count))
+	return false;
+      if (*wrapped)
+	return true;
+
+      /* Keep the partial record for the next round.  */
+      memmove (st->buf, st->buf + off, have - off);
+      have -= off;
+      pos += off;
+      if (at_end && have == 0)
+	break;
+    }
+  return true;
+}
+
+/* Walk a version 1 ring of fixed-size slots.  */
+static bool
+replay_slots (struct journal_dev *dev, const struct journal_header *hdr,
+	      struct replay_state *st)
+{
+  if (hdr->start_index >= JOURNAL_NUM_ENTRIES
+      || hdr->end_index >= JOURNAL_NUM_ENTRIES)
+    {
+      fprintf (stderr, "journal replay: header indices out of bounds\n");
+      return false;
+    }
+
+  uint64_t index = hdr->start_index;
+  uint64_t end_index = hdr->end_index;
+  LOG_DEBUG ("header start index %" PRIu64 " and end index %" PRIu64,
+	     index, end_index);
+  char buf[JOURNAL_ENTRY_SIZE] = { 0 };
+  char rec[JOURNAL_RECORD_MAX];
+  struct journal_payload_bin payload;
   while (index != end_index)
     {
       uint64_t offset = index_to_offset (index);
-      if (pread (fd, buf, JOURNAL_ENTRY_SIZE, (off_t) offset) !=
-	  JOURNAL_ENTRY_SIZE)
+      if (journal_dev_pread (dev, buf, JOURNAL_ENTRY_SIZE, (off_t) offset)
+	  != JOURNAL_ENTRY_SIZE)
 	{
 	  fprintf (stderr,
 		   "journal replay: incomplete read at offset %ld\n",
@@ -147,70 +646,236 @@ journal_replay_from_file (const char *path)
 	{
 	  fprintf (stderr, "journal replay: bad magic at offset %ld\n",
 		   (long) offset);
-	  all_good = false;
-	  break;
+	  return false;
 	}
 
-      if (entry->version != JOURNAL_VERSION)
+      if (entry->version != JOURNAL_VERSION_SLOTS)
 	{
 	  fprintf (stderr, "journal replay: version mismatch at offset %ld\n",
 		   (long) offset);
-	  all_good = false;
-	  break;
+	  return false;
 	}
       uint32_t stored_crc = entry->crc32;
       entry->crc32 = 0;
-      uint32_t actual_entry_crc = crc32 ((const char *) &entry->payload,
-					 sizeof (struct journal_payload_bin));
+      uint32_t actual_entry_crc = crc32 (entry->payload,
+					 sizeof entry->payload);
       if (actual_entry_crc != stored_crc)
 	{
 	  fprintf (stderr, "journal replay: CRC mismatch at offset %ld\n",
 		   (long) offset);
-	  all_good = false;
-	  break;
+	  return false;
 	}
 
-      struct journal_payload_bin *payload = &entry->payload;
-      if (strnlen (payload->action, sizeof (payload->action)) == 0)
-	{
-	  LOG_DEBUG ("action not valid on index %llu tx_id %llu action %s",
-		     index, payload->tx_id, payload->action);
-	  all_good = false;
-	  break;
-	}
-      if (payload->ino == 0)
-	{
-	  LOG_DEBUG ("ino not valid on index %llu tx_id %llu ino = 0",
-		     index, payload->tx_id);
-	  all_good = false;
-	  break;
-	}
-      struct journal_payload_bin *payload_copy =
-	malloc (sizeof *payload_copy);
-      if (!payload_copy)
+      memset (&payload, 0, sizeof payload);
+      memcpy (&payload, entry->payload, sizeof entry->payload);
+      if (strnlen (payload.action, sizeof (payload.action)) == 0)
 	{
-	  LOG_DEBUG ("Out of memory");
-	  goto CLEANUP;
+	  LOG_DEBUG ("action not valid on index %" PRIu64 " tx_id %" PRIu64,
+		     index, payload.tx_id);
+	  return false;
 	}
-      memcpy (payload_copy, payload, sizeof *payload_copy);
-      LOG_DEBUG ("index: %" PRIu64 ", tx_id: %" PRIu64 ", timestamp: %"
-		 PRIu64 ", ino: %u, action: %s", index, payload->tx_id,
-		 payload->timestamp_ms, payload->ino, payload->action);
-      add_event_to_global_list (&list, payload_copy);
+
+      /* Slots are few and legacy; apply them in ring order through the
+	 same path as version 2 records.  */
+      if (journal_record_encode (&payload, rec, sizeof rec) == 0
+	  || !apply_record (st, (const struct journal_record_hdr *) rec, index))
+	return false;
       index = (index + 1) % JOURNAL_NUM_ENTRIES;
     }
+  return true;
+}
+
+/* Walk a version 2, 3 or 4 ring of variable-length records.  */
+static bool
+replay_records (struct journal_dev *dev, const struct journal_header *hdr,
+		struct replay_state *st)
+{
+  if (hdr->start_index >= st->capacity
+      || hdr->end_index >= st->capacity
+      || hdr->start_index % JOURNAL_RECORD_ALIGN != 0
+      || hdr->end_index % JOURNAL_RECORD_ALIGN != 0)
+    {
+      fprintf (stderr, "journal replay: header indices out of bounds\n");
+      return false;
+    }
+
+  uint64_t pos = hdr->start_index;
+  uint64_t end_pos = hdr->end_index;
+  LOG_DEBUG ("header start pos %" PRIu64 " and end pos %" PRIu64,
+	     pos, end_pos);
+
+  st->buf = malloc (REPLAY_CHUNK);
+  st->frame_buf = malloc (JOURNAL_FRAME_RAW_MAX);
+  st->recs = malloc (REPLAY_MAX_RECORDS * sizeof *st->recs);
+  if (!st->buf || !st->frame_buf || !st->recs)
+    {
+      LOG_DEBUG ("Out of memory");
+      return false;
+    }
+
+  long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+  st->nworkers = ncpus < 1 ? 1
+    : ncpus > REPLAY_MAX_WORKERS ? REPLAY_MAX_WORKERS : (int) ncpus;
+
+  bool wrapped;
+  if (pos <= end_pos)
+    return replay_segment (dev, st, pos, end_pos, &wrapped);
+
+  if (!replay_segment (dev, st, pos, st->capacity, &wrapped))
+    return false;
+  return replay_segment (dev, st, 0, end_pos, &wrapped);
+}
+
+void
+journal_replay_device (struct journal_dev *dev)
+{
+  fprintf (stderr, "Toy journaling: Starting validation.\n");
+
+  struct journal_header hdr = { 0 };
+  ssize_t n = journal_dev_pread (dev, &hdr, sizeof (hdr), 0);
+  if (n != sizeof (hdr))
+    {
+      fprintf (stderr, "journal replay: could not read journal header\n");
+      return;
+    }
+
+  uint32_t expected_crc = hdr.crc32;
+  hdr.crc32 = 0;
+  uint32_t actual_crc = journal_checksum (hdr.version, 0, &hdr,
+					  journal_header_len (hdr.version));
+  if (actual_crc != expected_crc || hdr.magic != JOURNAL_MAGIC)
+    {
+      fprintf (stderr, "journal replay: header invalid\n");
+      return;
+    }
+
+  if (hdr.version < JOURNAL_VERSION_SIZED)
+    hdr.ring_size = JOURNAL_LEGACY_CAPACITY;
+  else if (!journal_capacity_fits (hdr.ring_size, journal_dev_size (dev)))
+    {
+      fprintf (stderr, "journal replay: ring size %" PRIu64 " invalid\n",
+	       hdr.ring_size);
+      return;
+    }
+
+  struct replay_state st = {
+    .version = hdr.version,
+    .capacity = hdr.ring_size,
+  };
+  bool all_good;
+  switch (hdr.version)
+    {
+    case JOURNAL_VERSION_SLOTS:
+      all_good = replay_slots (dev, &hdr, &st);
+      break;
+    case JOURNAL_VERSION_COMPACT:
+    case JOURNAL_VERSION_CRC32C:
+    case JOURNAL_VERSION_SIZED:
+      all_good = replay_records (dev, &hdr, &st);
+      break;
+    default:
+      fprintf (stderr, "journal replay: unknown version %u\n", hdr.version);
+      all_good = false;
+      break;
+    }
+
+  if (st.npending > 0)
+    LOG_DEBUG ("Ignored %zu records of uncommitted transactions.",
+	       st.npending);
+  LOG_DEBUG ("Replayed %zu events on %zu inodes, last tx_id %" PRIu64
+	     ", %zu out of order, %zu checkpoints, %zu revoked.", st.applied,
+	     st.inodes.count, st.last_tx_id, st.reordered, st.checkpoints,
+	     st.revoked);
   if (!all_good)
+    LOG_DEBUG ("Validation completed with errors.");
+  else
+    LOG_DEBUG ("Validation completed successfully.");
+
+  free (st.pending);
+  free (st.inodes.slots);
+  free (st.recs);
+  free (st.frame_buf);
+  free (st.buf);
+}
+
+void
+journal_replay_from_file (const char *path)
+{
+  struct journal_dev *dev = journal_dev_open (path);
+  if (!dev)
     {
-      LOG_DEBUG ("Validation completed with errors.");
-      goto CLEANUP;
+      fprintf (stderr, "journal_replay_and_validate: open failed: %s\n",
+	       strerror (errno));
+      return;
     }
-  LOG_DEBUG ("Validation completed successfully.");
-  sort_global_entries (&list);
 
-CLEANUP:
-  for (size_t i = 0; i < list.count; i++)
-    free (list.entries[i]);
-  if (list.entries)
-    free (list.entries);
-  close (fd);
+  journal_replay_device (dev);
+  journal_dev_close (dev);
+}
+
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replay_cond = PTHREAD_COND_INITIALIZER;
+static bool replay_active;
+
+static void
+replay_finished (void)
+{
+  pthread_mutex_lock (&replay_lock);
+  replay_active = false;
+  pthread_cond_broadcast (&replay_cond);
+  pthread_mutex_unlock (&replay_lock);
+}
+
+/* The replay only reads the ring as its header was when it started.
+   Writers append behind that, and wait for us in journal_replay_wait
+   before dropping records we might still have to read.  */
+static void *
+replay_thread (void *arg)
+{
+  (void) arg;
+
+  pthread_mutex_lock (&queue_lock);
+  while (!journal_device_ready)
+    pthread_cond_wait (&queue_cond, &queue_lock);
+  pthread_mutex_unlock (&queue_lock);
+
+  journal_replay_from_file (NULL);
+  replay_finished ();
+  return NULL;
+}
+
+void
+journal_replay_start (void)
+{
+  pthread_t tid;
+
+  pthread_mutex_lock (&replay_lock);
+  replay_active = true;
+  pthread_mutex_unlock (&replay_lock);
+
+  if (pthread_create (&tid, NULL, replay_thread, NULL) != 0)
+    {
+      LOG_ERROR ("journal: cannot start the replay thread");
+      replay_finished ();
+      return;
+    }
+  pthread_detach (tid);
+}
+
+bool
+journal_replay_running (void)
+{
+  pthread_mutex_lock (&replay_lock);
+  bool active = replay_active;
+  pthread_mutex_unlock (&replay_lock);
+  return active;
+}
+
+void
+journal_replay_wait (void)
+{
+  pthread_mutex_lock (&replay_lock);
+  while (replay_active)
+    pthread_cond_wait (&replay_cond, &replay_lock);
+  pthread_mutex_unlock (&replay_lock);
 }
@@ -1,6 +1,26 @@
 #ifndef JOURNAL_REPLAYER_H
 #define JOURNAL_REPLAYER_H
 
+#include <stdbool.h>
+
+struct journal_dev;
+
+/* Check and replay the journal on DEV.  */
+void journal_replay_device (struct journal_dev *dev);
+
+/* Likewise for the journal at PATH, a file name or store spec.  */
 void journal_replay_from_file (const char *path);
 
+/* Replay the configured journal in a background thread, once its
+   device is ready.  Writers may append at the head meanwhile.  */
+void journal_replay_start (void);
+
+/* Return whether the replay started by journal_replay_start has not
+   finished yet.  */
+bool journal_replay_running (void);
+
+/* Wait for the replay started by journal_replay_start to finish, before
+   overwriting records it may not have read.  */
+void journal_replay_wait (void);
+
 #endif // JOURNAL_REPLAYER_H
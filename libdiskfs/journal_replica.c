@@ -0,0 +1,655 @@
+/* journal_replica.c - Copying the journal to a second store
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* The replica is a byte for byte copy of the journal device.  The
+   writer records each write it makes, batch and header alike, and once
+   they are durable hands them over as one commit.  With the "async"
+   policy commits are queued for a thread that sends them on, so the
+   writer never waits for the replica; with "sync" the writer sends
+   them itself and waits for the replica to have them on disk.
+
+   Writes land at fixed offsets, so sending one twice does no harm.
+   Whenever the replica may have missed some, because it could not be
+   reached, a write failed or the queue overflowed, it is marked stale
+   and copied whole from the journal device before the next commit;
+   commits made meanwhile are sent after the copy and repair whatever
+   it read while they were being written.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_replica.h>
+#include <libdiskfs/journal_device.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_globals.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Most bytes of commits waiting for the replica thread; past it the
+   replica is copied whole instead.  */
+#define REPLICA_QUEUE_MAX	(4 * 1024 * 1024)
+
+/* Bytes read from the journal device at a time to copy it whole.  */
+#define REPLICA_COPY_CHUNK	(64 * 1024)
+
+/* Seconds to wait before trying again to reach a replica that failed,
+   and for a replica across a socket to take or answer a message.  */
+#define REPLICA_RETRY_SECS	1
+#define REPLICA_TIMEOUT_SECS	5
+
+/* A commit: journal_replica_msg headers, each followed by its data.  */
+struct replica_batch
+{
+  struct replica_batch *next;
+  size_t len;
+  char data[];
+};
+
+/* The writes recorded since the last commit.  Only used by the writer,
+   under its lock.  */
+static char *pending;
+static size_t pending_len, pending_alloc;
+static bool pending_lost;	/* Some did not fit */
+
+/* Protected by replica_lock; REPLICA_SPEC and REPLICA_ACTIVE only
+   change with target_lock held as well.  */
+static pthread_mutex_t replica_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replica_cond = PTHREAD_COND_INITIALIZER;
+static char *replica_spec;
+static bool replica_active;	/* REPLICA_SPEC is set; read unlocked */
+static bool replica_sync;
+static struct replica_batch *queue_head, **queue_tail = &queue_head;
+static size_t queue_bytes;
+static bool stale = true;	/* The replica must be copied whole */
+static time_t failed_at;	/* When it last failed, or 0 */
+static bool thread_started;
+
+/* Taken before replica_lock, and held while talking to the replica so
+   that commits reach it in the order they were taken off the queue.  */
+static pthread_mutex_t target_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct journal_dev *target_dev;
+static int target_sock = -1;
+
+static uint64_t sent_bytes, resyncs;
+
+void
+journal_replica_record (const void *buf, size_t len, off_t offset)
+{
+  struct journal_replica_msg msg = {
+    .magic = JOURNAL_REPLICA_MAGIC,
+    .offset = offset,
+    .length = len,
+  };
+
+  if (!__atomic_load_n (&replica_active, __ATOMIC_RELAXED) || pending_lost)
+    return;
+
+  size_t need = pending_len + sizeof msg + len;
+  if (len > JOURNAL_REPLICA_MAX_LEN)
+    {
+      pending_lost = true;
+      return;
+    }
+  if (need > pending_alloc)
+    {
+      size_t alloc = pending_alloc ? 2 * pending_alloc : 64 * 1024;
+      while (alloc < need)
+	alloc *= 2;
+      char *more = realloc (pending, alloc);
+      if (!more)
+	{
+	  pending_lost = true;
+	  return;
+	}
+      pending = more;
+      pending_alloc = alloc;
+    }
+
+  memcpy (pending + pending_len, &msg, sizeof msg);
+  memcpy (pending + pending_len + sizeof msg, buf, len);
+  pending_len = need;
+}
+
+void
+journal_replica_discard (void)
+{
+  pending_len = 0;
+  pending_lost = false;
+}
+
+/* Take the whole queue.  Called with replica_lock held.  */
+static struct replica_batch *
+take_queue (void)
+{
+  struct replica_batch *b = queue_head;
+
+  queue_head = NULL;
+  queue_tail = &queue_head;
+  queue_bytes = 0;
+  return b;
+}
+
+static void
+free_batches (struct replica_batch *b)
+{
+  while (b)
+    {
+      struct replica_batch *next = b->next;
+      free (b);
+      b = next;
+    }
+}
+
+static void
+close_target (void)
+{
+  journal_dev_close (target_dev);
+  target_dev = NULL;
+  if (target_sock >= 0)
+    close (target_sock);
+  target_sock = -1;
+}
+
+/* Apply the usual timeouts to the socket FD.  */
+static void
+set_timeouts (int fd)
+{
+  struct timeval tv = { .tv_sec = REPLICA_TIMEOUT_SECS };
+
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+}
+
+/* Connect to journalrecv at HOSTPORT, "HOST:PORT".  */
+static int
+connect_tcp (const char *hostport)
+{
+  const char *colon = strrchr (hostport, ':');
+  if (!colon || colon == hostport || colon[1] == '\0')
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  char host[colon - hostport + 1];
+  memcpy (host, hostport, colon - hostport);
+  host[colon - hostport] = '\0';
+
+  struct addrinfo hints = {
+    .ai_family = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM,
+  };
+  struct addrinfo *ai, *a;
+  int err = getaddrinfo (host, colon + 1, &hints, &ai);
+  if (err)
+    {
+      LOG_ERROR ("journal replica: %s: %s", host, gai_strerror (err));
+      errno = EHOSTUNREACH;
+      return -1;
+    }
+
+  int fd = -1;
+  for (a = ai; a && fd < 0; a = a->ai_next)
+    {
+      fd = socket (a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd < 0)
+	continue;
+      set_timeouts (fd);
+      if (connect (fd, a->ai_addr, a->ai_addrlen) < 0)
+	{
+	  close (fd);
+	  fd = -1;
+	}
+    }
+  freeaddrinfo (ai);
+  return fd;
+}
+
+/* Connect to journalrecv on the local socket PATH.  */
+static int
+connect_local (const char *path)
+{
+  struct sockaddr_un sun = { .sun_family = AF_LOCAL };
+
+  if (strlen (path) >= sizeof sun.sun_path)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  strcpy (sun.sun_path, path);
+
+  int fd = socket (PF_LOCAL, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  set_timeouts (fd);
+  if (connect (fd, (struct sockaddr *) &sun, sizeof sun) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Make sure the replica is open.  Called with target_lock held.  */
+static bool
+open_target (void)
+{
+  if (target_dev || target_sock >= 0)
+    return true;
+
+  pthread_mutex_lock (&replica_lock);
+  bool wait = failed_at && time (NULL) - failed_at < REPLICA_RETRY_SECS;
+  pthread_mutex_unlock (&replica_lock);
+  if (wait || !replica_spec)
+    return false;
+
+  if (strncmp (replica_spec, "tcp:", 4) == 0)
+    target_sock = connect_tcp (replica_spec + 4);
+  else if (strncmp (replica_spec, "unix:", 5) == 0)
+    target_sock = connect_local (replica_spec + 5);
+  else
+    target_dev = journal_dev_open (replica_spec);
+
+  if (!target_dev && target_sock < 0)
+    {
+      LOG_ERROR ("journal replica: cannot open %s: %s", replica_spec,
+		 strerror (errno));
+      return false;
+    }
+
+  /* Whatever it holds, it was not sent by us since it was opened.  */
+  pthread_mutex_lock (&replica_lock);
+  stale = true;
+  pthread_mutex_unlock (&replica_lock);
+  return true;
+}
+
+static bool
+write_all (int fd, const char *data, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = send (fd, data, len, MSG_NOSIGNAL);
+      if (n <= 0)
+	{
+	  if (n < 0 && errno == EINTR)
+	    continue;
+	  if (n == 0)
+	    errno = EPIPE;
+	  return false;
+	}
+      data += n;
+      len -= n;
+    }
+  return true;
+}
+
+static bool
+read_all (int fd, void *buf, size_t len)
+{
+  char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n = read (fd, p, len);
+      if (n <= 0)
+	{
+	  if (n < 0 && errno == EINTR)
+	    continue;
+	  if (n == 0)
+	    errno = EPIPE;
+	  return false;
+	}
+      p += n;
+      len -= n;
+    }
+  return true;
+}
+
+/* Send the LEN bytes of messages at DATA to the replica.  */
+static bool
+send_messages (const char *data, size_t len)
+{
+  if (target_sock >= 0)
+    {
+      if (!write_all (target_sock, data, len))
+	return false;
+    }
+  else
+    {
+      size_t off = 0;
+      while (off < len)
+	{
+	  struct journal_replica_msg msg;
+	  memcpy (&msg, data + off, sizeof msg);
+	  off += sizeof msg;
+	  if (journal_dev_pwrite (target_dev, data + off, msg.length,
+				  msg.offset) != (ssize_t) msg.length)
+	    return false;
+	  off += msg.length;
+	}
+    }
+
+  __atomic_fetch_add (&sent_bytes, len, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* Have the replica make what it was sent durable.  */
+static bool
+flush_target (void)
+{
+  if (target_dev)
+    return journal_dev_sync (target_dev) == 0;
+
+  struct journal_replica_msg msg = {
+    .magic = JOURNAL_REPLICA_MAGIC,
+    .flags = JOURNAL_REPLICA_SYNC,
+  };
+  uint32_t status;
+  if (!write_all (target_sock, (const char *) &msg, sizeof msg)
+      || !read_all (target_sock, &status, sizeof status))
+    return false;
+  if (status != 0)
+    {
+      errno = status;
+      return false;
+    }
+  return true;
+}
+
+/* Copy the journal device to the replica.  */
+static bool
+copy_whole (void)
+{
+  struct journal_dev *dev = journal_dev_open (NULL);
+  if (!dev)
+    return false;
+
+  struct journal_replica_msg *msg =
+    malloc (sizeof *msg + REPLICA_COPY_CHUNK);
+  bool ok = msg != NULL;
+  off_t size = JOURNAL_RESERVED_SPACE
+    + __atomic_load_n (&journal_data_capacity, __ATOMIC_RELAXED);
+  for (off_t off = 0; ok && off < size; off += REPLICA_COPY_CHUNK)
+    {
+      size_t len = size - off < REPLICA_COPY_CHUNK
+	? size - off : REPLICA_COPY_CHUNK;
+      *msg = (struct journal_replica_msg) {
+	.magic = JOURNAL_REPLICA_MAGIC,
+	.offset = off,
+	.length = len,
+      };
+      ssize_t n = journal_dev_pread (dev, msg + 1, len, off);
+      if (n >= 0 && n != (ssize_t) len)
+	errno = EIO;
+      ok = n == (ssize_t) len
+	&& send_messages ((const char *) msg, sizeof *msg + len);
+    }
+
+  free (msg);
+  journal_dev_close (dev);
+  if (ok)
+    __atomic_fetch_add (&resyncs, 1, __ATOMIC_RELAXED);
+  return ok;
+}
+
+/* Send the LEN bytes of messages at DATA to the replica, copying it
+   whole first if it is stale, and if FLUSH have it make them durable.
+   Called with target_lock held.  */
+static bool
+deliver (const char *data, size_t len, bool flush)
+{
+  if (!open_target ())
+    goto fail;
+
+  pthread_mutex_lock (&replica_lock);
+  bool copy = stale;
+  stale = false;
+  pthread_mutex_unlock (&replica_lock);
+
+  if ((copy && !copy_whole ()) || !send_messages (data, len)
+      || (flush && !flush_target ()))
+    {
+      LOG_ERROR ("journal replica: %s: %s", replica_spec,
+		 strerror (errno));
+      close_target ();
+      goto fail;
+    }
+
+  pthread_mutex_lock (&replica_lock);
+  failed_at = 0;
+  pthread_mutex_unlock (&replica_lock);
+  return true;
+
+fail:
+  pthread_mutex_lock (&replica_lock);
+  stale = true;
+  failed_at = time (NULL);
+  pthread_mutex_unlock (&replica_lock);
+  return false;
+}
+
+/* Deliver the batches B in order, and free them.  A failure leaves the
+   replica stale, and the copy that follows covers the rest.  */
+static void
+deliver_batches (struct replica_batch *b)
+{
+  bool ok = true;
+
+  while (b)
+    {
+      struct replica_batch *next = b->next;
+      if (ok)
+	ok = deliver (b->data, b->len, !next);
+      free (b);
+      b = next;
+    }
+}
+
+static void *
+replica_thread (void *arg)
+{
+  (void) arg;
+
+  pthread_mutex_lock (&replica_lock);
+  while (1)
+    {
+      if (!replica_spec || (!queue_head && !stale))
+	{
+	  pthread_cond_wait (&replica_cond, &replica_lock);
+	  continue;
+	}
+      if (failed_at && time (NULL) - failed_at < REPLICA_RETRY_SECS)
+	{
+	  struct timespec until = { .tv_sec = failed_at + REPLICA_RETRY_SECS };
+	  pthread_cond_timedwait (&replica_cond, &replica_lock, &until);
+	  continue;
+	}
+      pthread_mutex_unlock (&replica_lock);
+
+      pthread_mutex_lock (&target_lock);
+      pthread_mutex_lock (&replica_lock);
+      struct replica_batch *b = take_queue ();
+      pthread_mutex_unlock (&replica_lock);
+      if (b)
+	deliver_batches (b);
+      else
+	deliver (NULL, 0, true);
+      pthread_mutex_unlock (&target_lock);
+
+      pthread_mutex_lock (&replica_lock);
+    }
+  return NULL;
+}
+
+bool
+journal_replica_commit (void)
+{
+  if (!__atomic_load_n (&replica_active, __ATOMIC_RELAXED))
+    {
+      journal_replica_discard ();
+      return true;
+    }
+
+  bool lost = pending_lost;
+  pthread_mutex_lock (&replica_lock);
+  bool sync = replica_sync;
+  if (!sync)
+    {
+      struct replica_batch *b = NULL;
+      if (!lost && queue_bytes + pending_len <= REPLICA_QUEUE_MAX)
+	b = malloc (sizeof *b + pending_len);
+      if (b)
+	{
+	  b->next = NULL;
+	  b->len = pending_len;
+	  memcpy (b->data, pending, pending_len);
+	  *queue_tail = b;
+	  queue_tail = &b->next;
+	  queue_bytes += pending_len;
+	}
+      else
+	{
+	  free_batches (take_queue ());
+	  stale = true;
+	}
+      pthread_cond_signal (&replica_cond);
+      pthread_mutex_unlock (&replica_lock);
+      journal_replica_discard ();
+      return true;
+    }
+  if (lost)
+    stale = true;
+  pthread_mutex_unlock (&replica_lock);
+
+  /* Older commits still queued from the "async" policy go first.  */
+  pthread_mutex_lock (&target_lock);
+  pthread_mutex_lock (&replica_lock);
+  struct replica_batch *old = take_queue ();
+  pthread_mutex_unlock (&replica_lock);
+  deliver_batches (old);
+  bool ok = deliver (pending, pending_len, true);
+  pthread_mutex_unlock (&target_lock);
+
+  journal_replica_discard ();
+  return ok;
+}
+
+int
+journal_set_replica (const char *spec)
+{
+  char *copy = NULL;
+  error_t err;
+
+  if (spec[0] != '\0' && strcmp (spec, "none") != 0)
+    {
+      if (strncmp (spec, "tcp:", 4) == 0
+	  && (!strrchr (spec + 4, ':') || strrchr (spec, ':')[1] == '\0'))
+	return EINVAL;
+      copy = strdup (spec);
+      if (!copy)
+	return ENOMEM;
+    }
+
+  pthread_mutex_lock (&target_lock);
+  pthread_mutex_lock (&replica_lock);
+  if (copy && !thread_started)
+    {
+      pthread_t thread;
+      err = pthread_create (&thread, NULL, replica_thread, NULL);
+      if (err)
+	{
+	  pthread_mutex_unlock (&replica_lock);
+	  pthread_mutex_unlock (&target_lock);
+	  free (copy);
+	  return err;
+	}
+      pthread_detach (thread);
+      thread_started = true;
+    }
+
+  close_target ();
+  free (replica_spec);
+  replica_spec = copy;
+  __atomic_store_n (&replica_active, copy != NULL, __ATOMIC_RELAXED);
+  free_batches (take_queue ());
+  stale = true;
+  failed_at = 0;
+  pthread_cond_signal (&replica_cond);
+  pthread_mutex_unlock (&replica_lock);
+  pthread_mutex_unlock (&target_lock);
+  return 0;
+}
+
+char *
+journal_get_replica (void)
+{
+  pthread_mutex_lock (&replica_lock);
+  char *spec = replica_spec ? strdup (replica_spec) : NULL;
+  pthread_mutex_unlock (&replica_lock);
+  return spec;
+}
+
+int
+journal_set_replica_policy (const char *policy)
+{
+  bool sync;
+
+  if (strcmp (policy, "async") == 0)
+    sync = false;
+  else if (strcmp (policy, "sync") == 0)
+    sync = true;
+  else
+    return EINVAL;
+
+  pthread_mutex_lock (&replica_lock);
+  replica_sync = sync;
+  pthread_mutex_unlock (&replica_lock);
+  return 0;
+}
+
+const char *
+journal_get_replica_policy (void)
+{
+  pthread_mutex_lock (&replica_lock);
+  bool sync = replica_sync;
+  pthread_mutex_unlock (&replica_lock);
+  return sync ? "sync" : "async";
+}
+
+void
+journal_replica_get_stats (uint64_t *bytes, uint64_t *copies,
+			   uint64_t *queued)
+{
+  *bytes = __atomic_load_n (&sent_bytes, __ATOMIC_RELAXED);
+  *copies = __atomic_load_n (&resyncs, __ATOMIC_RELAXED);
+  pthread_mutex_lock (&replica_lock);
+  *queued = queue_bytes;
+  pthread_mutex_unlock (&replica_lock);
+}
@@ -0,0 +1,47 @@
+/* journal_replica.h - Copying the journal to a second store
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_REPLICA_H
+#define JOURNAL_REPLICA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The writer calls these with its lock held.  LEN bytes of BUF were
+   written to the journal device at OFFSET; remember them for the
+   replica.  */
+void journal_replica_record (const void *buf, size_t len, off_t offset);
+
+/* The writes recorded since the last commit are durable on the journal
+   device: send them to the replica, and with the "sync" policy wait
+   until they are durable there too.  Return false if they should be
+   but are not.  */
+bool journal_replica_commit (void);
+
+/* Forget the writes recorded since the last commit.  */
+void journal_replica_discard (void);
+
+/* Bytes sent to the replica, times it was copied whole, and bytes
+   waiting to be sent.  */
+void journal_replica_get_stats (uint64_t *bytes, uint64_t *resyncs,
+				uint64_t *queued);
+
+#endif /* JOURNAL_REPLICA_H */
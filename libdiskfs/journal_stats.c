@@ -0,0 +1,105 @@
+/* journal_stats.c - Journal statistics counters
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* The counters are only ever added to, with relaxed atomics: a reader
+   may see one counter a little ahead of another, which is fine for
+   statistics.  */
+
+#include <libdiskfs/journal.h>
+#include <libdiskfs/journal_stats.h>
+#include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_globals.h>
+#include <libdiskfs/journal_writer.h>
+#include <libdiskfs/journal_replica.h>
+
+static struct journal_stats stats;
+
+/* The histogram bucket for VALUE, as described in <libdiskfs/journal.h>.  */
+static unsigned int
+hist_bucket (uint64_t value)
+{
+  unsigned int i = 0;
+  while (value > 0 && i < JOURNAL_HIST_BUCKETS - 1)
+    {
+      value >>= 1;
+      i++;
+    }
+  return i;
+}
+
+static inline void
+add (uint64_t *counter, uint64_t n)
+{
+  __atomic_fetch_add (counter, n, __ATOMIC_RELAXED);
+}
+
+void
+journal_stats_batch (size_t taken, size_t written, uint64_t latency_us)
+{
+  add (&stats.enqueued, taken);
+  add (&stats.coalesced, taken - written);
+  add (&stats.batches, 1);
+  add (&stats.batch_size[hist_bucket (written)], 1);
+  add (&stats.flush_latency[hist_bucket (latency_us)], 1);
+}
+
+void
+journal_stats_write (size_t bytes)
+{
+  add (&stats.bytes_written, bytes);
+}
+
+void
+journal_stats_frame (size_t raw, size_t stored)
+{
+  add (&stats.compressed_in, raw);
+  add (&stats.compressed_out, stored);
+}
+
+void
+journal_stats_sync (void)
+{
+  add (&stats.syncs, 1);
+}
+
+#define LOAD(field) __atomic_load_n (&stats.field, __ATOMIC_RELAXED)
+
+void
+journal_get_stats (struct journal_stats *out)
+{
+  out->enqueued = LOAD (enqueued);
+  out->dropped = __atomic_load_n (&dropped_events, __ATOMIC_RELAXED);
+  out->coalesced = LOAD (coalesced);
+  out->batches = LOAD (batches);
+  for (size_t i = 0; i < JOURNAL_HIST_BUCKETS; i++)
+    {
+      out->batch_size[i] = LOAD (batch_size[i]);
+      out->flush_latency[i] = LOAD (flush_latency[i]);
+    }
+  out->syncs = LOAD (syncs);
+  out->bytes_written = LOAD (bytes_written);
+  out->compressed_in = LOAD (compressed_in);
+  out->compressed_out = LOAD (compressed_out);
+  journal_replica_get_stats (&out->replica_bytes, &out->replica_resyncs,
+			     &out->replica_queued);
+  out->ring_used = journal_ring_used ();
+  out->ring_size = journal_data_capacity;
+}
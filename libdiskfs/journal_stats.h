@@ -0,0 +1,42 @@
+/* journal_stats.h - Journal statistics counters
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   Written by Milos Nikic.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef JOURNAL_STATS_H
+#define JOURNAL_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The flusher handed the writer a batch of WRITTEN records, left over
+   from TAKEN queued events once coalescing was done, and the write took
+   LATENCY_US microseconds.  */
+void journal_stats_batch (size_t taken, size_t written, uint64_t latency_us);
+
+/* BYTES reached the journal device.  */
+void journal_stats_write (size_t bytes);
+
+/* RAW bytes of records were written as a frame of STORED bytes.  */
+void journal_stats_frame (size_t raw, size_t stored);
+
+/* The journal device was synced.  */
+void journal_stats_sync (void);
+
+#endif /* JOURNAL_STATS_H */
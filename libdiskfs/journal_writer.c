@@ -24,8 +24,18 @@
 #include <libdiskfs/journal_queue.h>
 #include <libdiskfs/journal_globals.h>
 #include <libdiskfs/journal_replayer.h>
+#include <libdiskfs/journal_feed.h>
+#include <libdiskfs/journal_index.h>
+#include <libdiskfs/journal_record.h>
+#include <libdiskfs/journal_compress.h>
+#include <libdiskfs/journal_replica.h>
+#include <libdiskfs/journal_stats.h>
+#include <libdiskfs/journal_device.h>
 #include <libdiskfs/crc32.h>
+#include <diskfs.h>
 #include <hurd/fshelp.h>
+#include <maptime.h>
+#include <mach.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -36,35 +46,175 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <trace.h>
 
 volatile size_t dropped_events = 0;
 volatile bool journal_device_ready = false;
+volatile int journal_log_level = 1;
+uint64_t journal_data_capacity = JOURNAL_LEGACY_CAPACITY;
 static pthread_mutex_t sync_write_lock = PTHREAD_MUTEX_INITIALIZER;
-static int sync_fd = -1;
+static struct journal_dev *sync_dev;
 
-static int
-get_sync_fd (void)
+/* Authoritative ring positions, protected by sync_write_lock.  The
+   on-disk header is only read to seed them when the journal is first
+   opened or after the device has gone away and come back.  */
+static uint64_t ring_start_index;
+static uint64_t ring_end_index;
+static bool ring_indices_valid = false;
+
+/* Ring positions before which every record has a tx_id of at most
+   UPTO_TX, oldest first.  A checkpoint moves the ring start to the
+   newest mark it covers.  Protected by sync_write_lock.  */
+#define JOURNAL_MARKS_MAX 1024
+
+struct ring_mark
+{
+  uint64_t pos;
+  uint64_t upto_tx;
+};
+
+static struct ring_mark ring_marks[JOURNAL_MARKS_MAX];
+static size_t marks_first;
+static size_t marks_count;
+static uint64_t ring_max_tx;	/* Highest tx_id written so far */
+static uint64_t ring_lost_tx;	/* Highest tx_id no longer in the ring */
+
+static inline struct ring_mark *
+mark_at (size_t i)
+{
+  return &ring_marks[(marks_first + i) % JOURNAL_MARKS_MAX];
+}
+
+static void
+pop_marks (size_t n)
+{
+  marks_first = (marks_first + n) % JOURNAL_MARKS_MAX;
+  marks_count -= n;
+}
+
+/* Note that the ring now ends at POS.  */
+static void
+push_mark (uint64_t pos)
 {
-  if (sync_fd >= 0)
+  if (marks_count > 0 && mark_at (marks_count - 1)->pos == pos)
     {
-      // Check if fd is still valid
-      if (fcntl (sync_fd, F_GETFL) != -1)
-	return sync_fd;
+      mark_at (marks_count - 1)->upto_tx = ring_max_tx;
+      return;
+    }
+
+  /* Losing the oldest mark only makes the next checkpoint less
+     effective; newer marks cover more anyway.  */
+  if (marks_count == JOURNAL_MARKS_MAX)
+    pop_marks (1);
+  *mark_at (marks_count++) = (struct ring_mark) {
+    .pos = pos,
+    .upto_tx = ring_max_tx,
+  };
+}
+
+/* The ring start moved from OLD_START to NEW_START; forget the marks it
+   passed.  */
+static void
+prune_marks (uint64_t old_start, uint64_t new_start)
+{
+  uint64_t moved = ring_used (old_start, new_start);
+
+  size_t n = 0;
+  while (n < marks_count
+	 && ring_used (old_start, mark_at (n)->pos) <= moved)
+    n++;
+  pop_marks (n);
+}
+
+/* The records up to TX_ID are leaving the ring.  */
+static void
+lose_records (uint64_t tx_id)
+{
+  if (tx_id > ring_lost_tx)
+    ring_lost_tx = tx_id;
+  journal_index_drop (tx_id);
+}
+
+/* Records are encoded back to back into BATCH_BUF and reach the device
+   in one write per contiguous run of the ring: the batch is flushed
+   when it fills up, when the ring wraps and when the caller is done.
+   BATCH_POS is the ring position of BATCH_BUF[0].  Only used with
+   sync_write_lock held.  */
+#define JOURNAL_BATCH_BUF_SIZE (512 * 1024)
+
+static char *batch_buf;
+static size_t batch_len;
+static uint64_t batch_pos;
+
+/* Records that might have to move to the start of the ring are built
+   here first.  It sits in the same allocation, after BATCH_BUF.  */
+static char *record_buf;
 
-      // Stale or broken fd, close and reset
-      close (sync_fd);
-      sync_fd = -1;
+/* With compression on, records are collected in FRAME_BUF instead, and
+   go to the batch as one frame, built in FRAME_OUT, once it is full or
+   the caller is done.  FRAME_LEN bytes of FRAME_NRECORDS records are
+   there, of which FRAME_MAX_TX is the highest tx_id.  Both buffers
+   follow RECORD_BUF.  */
+static char *frame_buf;
+static char *frame_out;
+static size_t frame_len;
+static size_t frame_nrecords;
+static uint64_t frame_max_tx;
+
+/* Allocate the buffers above as fresh pages, so that whole batches
+   reach the device without being copied to align them.  */
+static bool
+alloc_batch_buf (void)
+{
+  if (batch_buf)
+    return true;
+
+  vm_address_t addr = 0;
+  error_t err = vm_allocate (mach_task_self (), &addr,
+			     JOURNAL_BATCH_BUF_SIZE + JOURNAL_RECORD_MAX
+			     + 2 * JOURNAL_FRAME_RAW_MAX, 1);
+  if (err)
+    {
+      LOG_ERROR ("alloc_batch_buf: %s", strerror (err));
+      return false;
     }
+  batch_buf = (char *) addr;
+  record_buf = batch_buf + JOURNAL_BATCH_BUF_SIZE;
+  frame_buf = record_buf + JOURNAL_RECORD_MAX;
+  frame_out = frame_buf + JOURNAL_FRAME_RAW_MAX;
+  return true;
+}
+
+/* Forget what was added to the batch and not flushed yet.  */
+static void
+discard_batch (void)
+{
+  batch_len = 0;
+  frame_len = 0;
+  frame_nrecords = 0;
+  frame_max_tx = 0;
+  journal_replica_discard ();
+}
+
+static struct journal_dev *
+get_sync_dev (void)
+{
+  if (sync_dev)
+    return sync_dev;
 
-  sync_fd = open (RAW_DEVICE_PATH, O_RDWR);
-  if (sync_fd < 0)
-    LOG_ERROR ("get_sync_fd: open failed: %s", strerror (errno));
+  if (!alloc_batch_buf ())
+    return NULL;
+  sync_dev = journal_dev_open (NULL);
+  if (!sync_dev)
+    LOG_ERROR ("get_sync_dev: cannot open %s: %s", journal_dev_spec (),
+	       strerror (errno));
 
-  return sync_fd;
+  return sync_dev;
 }
 
+/* Write the ring header.  The caller is responsible for flushing it.  */
 static bool
-persist_header_with_retry (int fd, uint64_t start_index,
+persist_header_with_retry (struct journal_dev *dev, uint64_t start_index,
 			   uint64_t end_index, int retries)
 {
   struct journal_header hdr = {
@@ -73,15 +223,16 @@ persist_header_with_retry (int fd, uint64_t start_index,
     .start_index = start_index,
     .end_index = end_index,
     .crc32 = 0,
+    .ring_size = journal_data_capacity,
   };
 
-  hdr.crc32 = crc32 ((const void *) &hdr, sizeof (hdr));
+  hdr.crc32 = journal_checksum (JOURNAL_VERSION, 0, &hdr, sizeof (hdr));
 
   while (retries-- > 0)
     {
-      if (pwrite (fd, &hdr, sizeof (hdr), 0) == sizeof (hdr))
+      if (journal_dev_pwrite (dev, &hdr, sizeof (hdr), 0) == sizeof (hdr))
 	{
-	  fsync (fd);
+	  journal_replica_record (&hdr, sizeof (hdr), 0);
 	  return true;
 	}
 
@@ -93,11 +244,31 @@ persist_header_with_retry (int fd, uint64_t start_index,
   return false;
 }
 
+/* Return the data area a journal formatted on DEV now would have.  */
+static uint64_t
+format_capacity (struct journal_dev *dev)
+{
+  uint64_t size = journal_get_size ();
+  off_t dev_size = journal_dev_size (dev);
+
+  if (dev_size >= JOURNAL_MIN_SIZE && (uint64_t) dev_size < size)
+    size = dev_size - dev_size % JOURNAL_ENTRY_SIZE;
+  return size - JOURNAL_RESERVED_SPACE;
+}
+
+/* Read the ring positions and size from the header on DEV.  If there is
+   no sound header, or the ring is empty, start a new one of the
+   configured size.  */
 static bool
-initialize_indices (int fd, uint64_t * start_index, uint64_t * end_index)
+initialize_indices (struct journal_dev *dev, uint64_t * start_index,
+		    uint64_t * end_index)
 {
   struct journal_header hdr = { 0 };
-  ssize_t n = pread (fd, &hdr, sizeof (hdr), 0);
+  ssize_t n = journal_dev_pread (dev, &hdr, sizeof (hdr), 0);
+
+  *start_index = 0;
+  *end_index = 0;
+  journal_data_capacity = format_capacity (dev);
 
   if (n == -1 && errno == EIO)
     {
@@ -109,90 +280,395 @@ initialize_indices (int fd, uint64_t * start_index, uint64_t * end_index)
   if (n != sizeof (hdr))
     {
       LOG_ERROR ("journal_write_raw: header read failed or missing");
-      *start_index = 0;
-      *end_index = 0;
       return true;
     }
 
   uint32_t expected_crc = hdr.crc32;
   hdr.crc32 = 0;
-  uint32_t actual_crc = crc32 ((const void *) &hdr, sizeof (hdr));
+  uint32_t actual_crc = journal_checksum (hdr.version, 0, &hdr,
+					  journal_header_len (hdr.version));
 
   if (actual_crc != expected_crc
       || hdr.magic != JOURNAL_MAGIC || hdr.version != JOURNAL_VERSION)
     {
       LOG_ERROR ("journal_write_raw: header CRC mismatch or invalid");
-      *start_index = 0;
-      *end_index = 0;
       return true;
     }
 
-  if (hdr.start_index >= JOURNAL_NUM_ENTRIES
-      || hdr.end_index >= JOURNAL_NUM_ENTRIES)
+  if (!journal_capacity_fits (hdr.ring_size, journal_dev_size (dev)))
+    {
+      LOG_ERROR ("journal_write_raw: ring size %" PRIu64 " invalid",
+		 hdr.ring_size);
+      return true;
+    }
+
+  if (hdr.start_index >= hdr.ring_size
+      || hdr.end_index >= hdr.ring_size
+      || hdr.start_index % JOURNAL_RECORD_ALIGN != 0
+      || hdr.end_index % JOURNAL_RECORD_ALIGN != 0)
     {
       LOG_ERROR ("journal_write_raw: header indices out of bounds");
-      *start_index = 0;
-      *end_index = 0;
       return true;
     }
 
+  /* Nothing is lost by giving an empty ring the size now wanted.  */
+  if (hdr.start_index == hdr.end_index)
+    return true;
+
+  journal_data_capacity = hdr.ring_size;
   *start_index = hdr.start_index;
   *end_index = hdr.end_index;
 
-  LOG_DEBUG ("journal_write_raw: start_index=%llu, end_index=%llu",
-	     *start_index, *end_index);
+  LOG_DEBUG ("journal_write_raw: start_index=%" PRIu64 ", end_index=%"
+	     PRIu64 ", ring_size=%" PRIu64, *start_index, *end_index,
+	     journal_data_capacity);
 
   return true;
 }
 
+/* Make sure ring_start_index and ring_end_index reflect the journal
+   behind FD.  Called with sync_write_lock held.  */
 static bool
-journal_write_indexed (int fd, const char *data, size_t len,
-		       uint64_t * end_index, uint64_t * start_index)
+load_indices (struct journal_dev *dev)
+{
+  if (ring_indices_valid)
+    return true;
+
+  marks_count = 0;
+  journal_index_reset ();
+  if (!initialize_indices (dev, &ring_start_index, &ring_end_index))
+    return false;
+
+  ring_indices_valid = true;
+  return true;
+}
+
+void
+journal_writer_reset (void)
+{
+  pthread_mutex_lock (&sync_write_lock);
+  ring_indices_valid = false;
+  journal_dev_close (sync_dev);
+  sync_dev = NULL;
+  pthread_mutex_unlock (&sync_write_lock);
+}
+
+static bool
+flush_batch (struct journal_dev *dev)
 {
-  if (len > sizeof (struct journal_payload_bin))
+  if (batch_len == 0)
+    return true;
+
+  TRACE (TRACE_JOURNAL_FLUSH, batch_len, batch_pos);
+
+  ssize_t written = journal_dev_pwrite (dev, batch_buf, batch_len,
+					ring_pos_to_offset (batch_pos));
+  if (written != (ssize_t) batch_len)
     {
-      LOG_ERROR ("journal_write_indexed: payload too large: %zu bytes", len);
+      LOG_ERROR ("flush_batch: write of %zu bytes failed: %s",
+		 batch_len, strerror (errno));
+      batch_len = 0;
       return false;
     }
 
-  uint64_t next = (*end_index + 1) % JOURNAL_NUM_ENTRIES;
-  if (next == *start_index)
-    *start_index = (*start_index + 1) % JOURNAL_NUM_ENTRIES;
+  journal_replica_record (batch_buf, batch_len,
+			  ring_pos_to_offset (batch_pos));
+  batch_len = 0;
+  return true;
+}
 
-  char buf[JOURNAL_ENTRY_SIZE] = { 0 };
-  struct journal_entry_bin *entry = (struct journal_entry_bin *) buf;
+/* Append LEN bytes of DATA to the batch at ring position POS.  */
+static bool
+append_to_batch (struct journal_dev *dev, const void *data, size_t len, uint64_t pos)
+{
+  if (batch_len > 0
+      && (batch_pos + batch_len != pos || batch_len + len > JOURNAL_BATCH_BUF_SIZE))
+    if (!flush_batch (dev))
+      return false;
 
-  entry->magic = JOURNAL_MAGIC;
-  entry->version = JOURNAL_VERSION;
+  if (batch_len == 0)
+    batch_pos = pos;
+  memcpy (batch_buf + batch_len, data, len);
+  batch_len += len;
+  return true;
+}
 
-  // Copy only into the payload section
-  memcpy (&entry->payload, data, len);
+/* Read LEN bytes of the ring at POS, which may not have reached the
+   device yet.  */
+static bool
+read_ring (struct journal_dev *dev, void *buf, size_t len, uint64_t pos)
+{
+  if (batch_len > 0 && pos >= batch_pos && pos + len <= batch_pos + batch_len)
+    {
+      memcpy (buf, batch_buf + (pos - batch_pos), len);
+      return true;
+    }
+
+  return journal_dev_pread (dev, buf, len, ring_pos_to_offset (pos))
+    == (ssize_t) len;
+}
+
+/* Forget the oldest record in the ring by moving *START_INDEX past it.
+   END_INDEX is only used to detect an empty ring.  */
+static bool
+drop_oldest_record (struct journal_dev *dev, uint64_t * start_index,
+		    uint64_t end_index)
+{
+  if (*start_index == end_index)
+    return false;
 
-  entry->crc32 = 0;		// Ensure zero before calculating
-  entry->crc32 =
-    crc32 ((const char *) &entry->payload,
-	   sizeof (struct journal_payload_bin));
+  struct journal_record_hdr hdr;
+  size_t avail = journal_data_capacity - *start_index;
+  size_t want = avail < sizeof hdr ? avail : sizeof hdr;
 
-  off_t offset = index_to_offset (*end_index);
-  if (lseek (fd, offset, SEEK_SET) == (off_t) - 1)
+  if (!read_ring (dev, &hdr, want, *start_index))
     {
-      LOG_ERROR ("journal_write_indexed: lseek failed: %s", strerror (errno));
+      LOG_ERROR ("drop_oldest_record: read failed: %s", strerror (errno));
       return false;
     }
 
-  ssize_t written = write (fd, buf, JOURNAL_ENTRY_SIZE);
-  if (written != JOURNAL_ENTRY_SIZE)
+  uint64_t old_start = *start_index;
+  if (hdr.magic == JOURNAL_WRAP_MAGIC)
+    {
+      *start_index = 0;
+      prune_marks (old_start, 0);
+      return true;
+    }
+
+  if (want >= sizeof (struct journal_frame_hdr)
+      && hdr.magic == JOURNAL_FRAME_MAGIC)
+    {
+      struct journal_frame_hdr frame;
+      memcpy (&frame, &hdr, sizeof frame);
+      if (frame.length <= JOURNAL_FRAME_RAW_MAX)
+	{
+	  lose_records (frame.max_tx);
+	  *start_index = (*start_index
+			  + journal_record_padded_len (sizeof frame
+						       + frame.length))
+	    % journal_data_capacity;
+	  prune_marks (old_start, *start_index);
+	  return true;
+	}
+    }
+
+  if (want < sizeof hdr || hdr.magic != JOURNAL_MAGIC
+      || hdr.length < sizeof hdr)
+    {
+      /* The tail is unreadable, so nothing behind it can be replayed
+         either.  Start over from the current end.  */
+      LOG_ERROR ("drop_oldest_record: corrupt record at %" PRIu64
+		 ", discarding journal contents", *start_index);
+      *start_index = end_index;
+      lose_records (ring_max_tx);
+      prune_marks (old_start, end_index);
+      return true;
+    }
+
+  lose_records (hdr.tx_id);
+  *start_index = (*start_index + journal_record_padded_len (hdr.length))
+    % journal_data_capacity;
+  prune_marks (old_start, *start_index);
+  return true;
+}
+
+/* Make room for a record of LEN bytes at *END_INDEX, dropping old
+   records as needed and moving *END_INDEX to the start of the ring when
+   the record would not fit before its end.  */
+static bool
+reserve_record_space (struct journal_dev *dev, size_t len,
+		      uint64_t * end_index, uint64_t * start_index)
+{
+  uint64_t skip = 0;
+  if (journal_data_capacity - *end_index < len)
+    skip = journal_data_capacity - *end_index;
+
+  /* Keep one alignment unit free so a full ring is not mistaken for an
+     empty one.  The records we drop may not have been replayed yet.  */
+  while (journal_data_capacity - JOURNAL_RECORD_ALIGN
+	 - ring_used (*start_index, *end_index) < skip + len)
+    {
+      journal_replay_wait ();
+      if (!drop_oldest_record (dev, start_index, *end_index))
+	return false;
+    }
+
+  if (skip)
     {
-      LOG_ERROR ("journal_write_indexed: write failed: %s", strerror (errno));
+      struct journal_wrap_marker marker = {
+	.magic = JOURNAL_WRAP_MAGIC,
+	.reserved = 0,
+      };
+      if (!append_to_batch (dev, &marker, sizeof marker, *end_index)
+	  || !flush_batch (dev))
+	{
+	  LOG_ERROR ("reserve_record_space: wrap marker write failed");
+	  return false;
+	}
+      *end_index = 0;
+    }
+
+  return true;
+}
+
+/* Add PAYLOAD to the batch at *END_INDEX as a record of its own.  */
+static bool
+write_record (struct journal_dev *dev,
+	      const struct journal_payload_bin *payload,
+	      uint64_t * end_index, uint64_t * start_index)
+{
+  /* Far from the end of the ring the record is encoded straight into the
+     batch; near it, it may have to go to the start, so build it aside.  */
+  bool in_place = journal_data_capacity - *end_index >= JOURNAL_RECORD_MAX;
+  if (in_place
+      && (batch_len + JOURNAL_RECORD_MAX > JOURNAL_BATCH_BUF_SIZE
+	  || (batch_len > 0 && batch_pos + batch_len != *end_index)))
+    if (!flush_batch (dev))
+      return false;
+  if (in_place && batch_len == 0)
+    batch_pos = *end_index;
+
+  char *buf = in_place ? batch_buf + batch_len : record_buf;
+  size_t len = journal_record_encode (payload, buf, JOURNAL_RECORD_MAX);
+  if (len == 0)
+    {
+      LOG_ERROR ("journal_write_indexed: failed to encode tx %" PRIu64,
+		 payload->tx_id);
       return false;
     }
 
-  *end_index = next;
+  if (!reserve_record_space (dev, len, end_index, start_index))
+    return false;
+
+  if (in_place)
+    batch_len += len;
+  else if (!append_to_batch (dev, buf, len, *end_index))
+    return false;
+
+  if (journal_index_complete ())
+    journal_index_add (payload, *end_index);
+
+  *end_index = (*end_index + len) % journal_data_capacity;
+  if (payload->tx_id > ring_max_tx)
+    ring_max_tx = payload->tx_id;
   return true;
 }
 
-bool
-journal_write_raw_sync (struct journal_payload_bin *payload)
+/* Add the records in FRAME_BUF to the batch at *END_INDEX, as a frame if
+   they compress, or else one by one.  */
+static bool
+emit_frame (struct journal_dev *dev, uint64_t * end_index,
+	    uint64_t * start_index)
+{
+  struct journal_payload_bin payload;
+  size_t raw_len = frame_len, nrecords = frame_nrecords;
+  uint64_t max_tx = frame_max_tx;
+  size_t off, reclen;
+
+  frame_len = 0;
+  frame_nrecords = 0;
+  frame_max_tx = 0;
+  if (raw_len == 0)
+    return true;
+
+  size_t len = journal_frame_encode (frame_buf, raw_len, nrecords, max_tx,
+				     frame_out, JOURNAL_FRAME_RAW_MAX);
+  if (len == 0)
+    {
+      for (off = 0; off < raw_len; off += reclen)
+	if (!journal_record_decode (JOURNAL_VERSION, frame_buf + off,
+				    raw_len - off, &payload, &reclen)
+	    || !write_record (dev, &payload, end_index, start_index))
+	  return false;
+      return true;
+    }
+
+  if (!reserve_record_space (dev, len, end_index, start_index)
+      || !append_to_batch (dev, frame_out, len, *end_index))
+    return false;
+  journal_stats_frame (raw_len, len);
+
+  /* Index entries of records in a frame point at the frame.  */
+  if (journal_index_complete ())
+    for (off = 0; off < raw_len; off += reclen)
+      {
+	if (!journal_record_decode (JOURNAL_VERSION, frame_buf + off,
+				    raw_len - off, &payload, &reclen))
+	  break;
+	journal_index_add (&payload, *end_index);
+      }
+
+  *end_index = (*end_index + len) % journal_data_capacity;
+  if (max_tx > ring_max_tx)
+    ring_max_tx = max_tx;
+  return true;
+}
+
+/* Add PAYLOAD to the batch at *END_INDEX.  The caller must finish_batch
+   before publishing the new indices.  */
+static bool
+journal_write_indexed (struct journal_dev *dev,
+		       const struct journal_payload_bin *payload,
+		       uint64_t * end_index, uint64_t * start_index)
+{
+  if (!journal_compression_enabled ())
+    return emit_frame (dev, end_index, start_index)
+      && write_record (dev, payload, end_index, start_index);
+
+  if (frame_len + JOURNAL_RECORD_MAX > JOURNAL_FRAME_RAW_MAX
+      && !emit_frame (dev, end_index, start_index))
+    return false;
+
+  size_t len = journal_record_encode (payload, frame_buf + frame_len,
+				      JOURNAL_RECORD_MAX);
+  if (len == 0)
+    {
+      LOG_ERROR ("journal_write_indexed: failed to encode tx %" PRIu64,
+		 payload->tx_id);
+      return false;
+    }
+  frame_len += len;
+  frame_nrecords++;
+  if (payload->tx_id > frame_max_tx)
+    frame_max_tx = payload->tx_id;
+  return true;
+}
+
+/* Write out what journal_write_indexed left in the batch, moving
+   *END_INDEX past it.  */
+static bool
+finish_batch (struct journal_dev *dev, uint64_t * end_index,
+	      uint64_t * start_index)
+{
+  return emit_frame (dev, end_index, start_index) && flush_batch (dev);
+}
+
+/* A caller of journal_write_raw_sync waiting for its records to be
+   committed as part of a group.  */
+struct group_waiter
+{
+  const struct journal_payload_bin *payloads;
+  size_t count;
+  bool ok;
+};
+
+#define JOURNAL_GROUP_MAX 64
+
+/* Group commit state, protected by group_lock.  Records queued while
+   GROUP_OPEN_SEQ is current are written together by a single leader;
+   GROUP_DONE_SEQ is the last group whose outcome is known.  */
+static pthread_mutex_t group_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t group_cond = PTHREAD_COND_INITIALIZER;
+static struct group_waiter *group_queue[JOURNAL_GROUP_MAX];
+static size_t group_queued;
+static uint64_t group_open_seq = 1;
+static uint64_t group_done_seq;
+static bool group_leader_active;
+
+/* Write the records of COUNT waiters, then the header, and flush once.  A record
+   torn by a crash before the flush fails its CRC on replay.  */
+static bool
+write_sync_group (struct group_waiter *const *group, size_t count)
 {
   pthread_mutex_lock (&sync_write_lock);
   // Dirty hack to avoid blocking in the early boot
@@ -202,63 +678,110 @@ journal_write_raw_sync (struct journal_payload_bin *payload)
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
-  int fd = get_sync_fd ();
-  if (fd < 0)
+  struct journal_dev *dev = get_sync_dev ();
+  if (!dev)
     {
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
 
-  uint64_t start_index = 0, end_index = 0;
-  if (!initialize_indices (fd, &start_index, &end_index))
+  if (!load_indices (dev))
     {
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
 
-  char buf[JOURNAL_ENTRY_SIZE] = { 0 };
-  struct journal_entry_bin *entry = (struct journal_entry_bin *) buf;
-
-  entry->magic = JOURNAL_MAGIC;
-  entry->version = JOURNAL_VERSION;
-  memcpy (&entry->payload, payload, sizeof (struct journal_payload_bin));
-  entry->crc32 = 0;
-  entry->crc32 =
-    crc32 ((const char *) &entry->payload,
-	   sizeof (struct journal_payload_bin));
+  uint64_t start_index = ring_start_index, end_index = ring_end_index;
+  for (size_t i = 0; i < count; i++)
+    for (size_t j = 0; j < group[i]->count; j++)
+      if (!journal_write_indexed (dev, &group[i]->payloads[j],
+				  &end_index, &start_index))
+	{
+	  LOG_ERROR ("journal_write_direct_sync: write failed");
+	  discard_batch ();
+	  ring_indices_valid = false;
+	  pthread_mutex_unlock (&sync_write_lock);
+	  return false;
+	}
 
-  off_t offset = index_to_offset (end_index);
-  if (lseek (fd, offset, SEEK_SET) == (off_t) - 1)
+  if (!finish_batch (dev, &end_index, &start_index))
     {
-      LOG_ERROR ("journal_write_direct_sync: lseek failed: %s",
-		 strerror (errno));
+      discard_batch ();
+      ring_indices_valid = false;
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
 
-  if (write (fd, buf, JOURNAL_ENTRY_SIZE) != JOURNAL_ENTRY_SIZE)
+  ring_start_index = start_index;
+  ring_end_index = end_index;
+  push_mark (end_index);
+
+  if (!persist_header_with_retry (dev, start_index, end_index, 3))
     {
-      LOG_ERROR ("journal_write_direct_sync: write failed: %s",
-		 strerror (errno));
+      LOG_ERROR ("journal_write_direct_sync: failed to persist header");
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
+  bool ok = journal_dev_sync (dev) == 0 && journal_replica_commit ();
+
+  pthread_mutex_unlock (&sync_write_lock);
+  return ok;
+}
+
+bool
+journal_write_raw_sync_n (const struct journal_payload_bin *payloads,
+			  size_t count)
+{
+  struct group_waiter self = {
+    .payloads = payloads,
+    .count = count,
+    .ok = false,
+  };
+
+  pthread_mutex_lock (&group_lock);
+  while (group_queued == JOURNAL_GROUP_MAX)
+    pthread_cond_wait (&group_cond, &group_lock);
 
-  fsync (fd);
+  uint64_t seq = group_open_seq;
+  group_queue[group_queued++] = &self;
 
-  uint64_t next_index = (end_index + 1) % JOURNAL_NUM_ENTRIES;
-  if (next_index == start_index)
-    start_index = (start_index + 1) % JOURNAL_NUM_ENTRIES;
-  if (!persist_header_with_retry (fd, start_index, next_index, 3))
+  while (group_done_seq < seq)
     {
-      LOG_ERROR ("journal_write_direct_sync: failed to persist header");
-      pthread_mutex_unlock (&sync_write_lock);
-      return false;
+      if (group_leader_active)
+	{
+	  pthread_cond_wait (&group_cond, &group_lock);
+	  continue;
+	}
+
+      /* Nobody is writing, so our group is still the open one.  Take it
+         and let later callers start the next group meanwhile.  */
+      struct group_waiter *group[JOURNAL_GROUP_MAX];
+      size_t count = group_queued;
+      memcpy (group, group_queue, count * sizeof group[0]);
+      group_queued = 0;
+      group_open_seq++;
+      group_leader_active = true;
+      pthread_cond_broadcast (&group_cond);
+      pthread_mutex_unlock (&group_lock);
+
+      bool ok = write_sync_group (group, count);
+
+      pthread_mutex_lock (&group_lock);
+      for (size_t i = 0; i < count; i++)
+	group[i]->ok = ok;
+      group_done_seq = seq;
+      group_leader_active = false;
+      pthread_cond_broadcast (&group_cond);
     }
-  fsync (fd);
+  pthread_mutex_unlock (&group_lock);
 
-  pthread_mutex_unlock (&sync_write_lock);
-  return true;
+  return self.ok;
+}
+
+bool
+journal_write_raw_sync (struct journal_payload_bin *payload)
+{
+  return journal_write_raw_sync_n (payload, 1);
 }
 
 bool
@@ -266,21 +789,19 @@ journal_write_raw (const struct journal_payload *entries, size_t count)
 {
   pthread_mutex_lock (&sync_write_lock);
 
-  uint64_t end_index = 0;
-  uint64_t start_index = 0;
   const size_t expected_len = sizeof (struct journal_payload_bin);
 
-  int fd = get_sync_fd ();
-  if (fd < 0)
+  struct journal_dev *dev = get_sync_dev ();
+  if (!dev)
     {
       dropped_events += count;
       LOG_ERROR
-	("journal_write_raw: failed to get fd. Dropped %zu txs now and %zu since the start.",
+	("journal_write_raw: cannot open the journal. Dropped %zu txs now and %zu since the start.",
 	 count, dropped_events);
       pthread_mutex_unlock (&sync_write_lock);
       return false;
     }
-  if (!initialize_indices (fd, &start_index, &end_index))
+  if (!load_indices (dev))
     {
       dropped_events += count;
       LOG_ERROR
@@ -290,14 +811,8 @@ journal_write_raw (const struct journal_payload *entries, size_t count)
       return false;
     }
 
-  static bool validation_done = false;
-  if (!validation_done)
-    {
-      journal_replay_from_file ("/var/journal.img");
-      // journal_replay_from_file (RAW_DEVICE_PATH);
-      validation_done = true;
-    }
-
+  uint64_t start_index = ring_start_index;
+  uint64_t end_index = ring_end_index;
   for (size_t i = 0; i < count; ++i)
     {
       if (entries[i].len != expected_len)
@@ -305,28 +820,423 @@ journal_write_raw (const struct journal_payload *entries, size_t count)
 	  LOG_ERROR ("journal_write_raw: unexpected payload size %zu",
 		     entries[i].len);
 	  dropped_events += count;
+	  discard_batch ();
+	  ring_indices_valid = false;
 	  pthread_mutex_unlock (&sync_write_lock);
 	  return false;
 	}
 
-      if (!journal_write_indexed (fd, entries[i].data, expected_len,
-				  &end_index, &start_index))
+      if (!journal_write_indexed (dev,
+				  (const struct journal_payload_bin *)
+				  entries[i].data, &end_index, &start_index))
 	{
 	  dropped_events += count;
 	  LOG_ERROR
 	    ("journal_write_raw: failed to write entry. Dropped %zu txs now and %zu since the start.",
 	     count, dropped_events);
+	  /* Part of the batch may have hit the disk past the persisted
+	     header; reload from the header rather than guess.  */
+	  discard_batch ();
+	  ring_indices_valid = false;
 	  pthread_mutex_unlock (&sync_write_lock);
 	  return false;
 	}
     }
 
-  if (!persist_header_with_retry (fd, start_index, end_index, 3))
+  if (!finish_batch (dev, &end_index, &start_index))
+    {
+      dropped_events += count;
+      discard_batch ();
+      ring_indices_valid = false;
+      pthread_mutex_unlock (&sync_write_lock);
+      return false;
+    }
+
+  ring_start_index = start_index;
+  ring_end_index = end_index;
+  push_mark (end_index);
+
+  if (!persist_header_with_retry (dev, start_index, end_index, 3))
     LOG_ERROR
       ("journal_write_raw: failed to persist updated header after retries.");
+  if (journal_dev_sync (dev) == 0)
+    journal_replica_commit ();
 
-  LOG_ERROR ("Toy journaling: wrote %zu entries to raw disk.", count);
+  LOG_DEBUG ("journal_write_raw: wrote %zu entries.", count);
 
   pthread_mutex_unlock (&sync_write_lock);
   return true;
 }
+
+uint64_t
+journal_ring_used (void)
+{
+  pthread_mutex_lock (&sync_write_lock);
+  uint64_t used = (ring_indices_valid
+		   ? ring_used (ring_start_index, ring_end_index) : 0);
+  pthread_mutex_unlock (&sync_write_lock);
+  return used;
+}
+
+void
+journal_set_log_level (int level)
+{
+  journal_log_level = level;
+}
+
+int
+journal_get_log_level (void)
+{
+  return journal_log_level;
+}
+
+bool
+journal_write_checkpoint (uint64_t tx_id)
+{
+  pthread_mutex_lock (&sync_write_lock);
+
+  /* Marks only exist for records written since the indices were
+     loaded; without them there is nothing to release.  Nor is there
+     while the replay is still reading the old records; the next
+     checkpoint releases them.  */
+  if (!journal_device_ready || !ring_indices_valid || !sync_dev
+      || journal_replay_running ())
+    {
+      pthread_mutex_unlock (&sync_write_lock);
+      return true;
+    }
+
+  /* Keep what change feed consumers have not read yet.  */
+  uint64_t keep = journal_feed_min_cursor ();
+  if (keep <= tx_id)
+    tx_id = keep - 1;
+
+  size_t n = 0;
+  while (n < marks_count && mark_at (n)->upto_tx <= tx_id)
+    n++;
+  if (n == 0)
+    {
+      pthread_mutex_unlock (&sync_write_lock);
+      return true;
+    }
+
+  uint64_t start_index = mark_at (n - 1)->pos;
+  uint64_t end_index = ring_end_index;
+  lose_records (mark_at (n - 1)->upto_tx);
+  pop_marks (n);
+
+  struct journal_payload_bin payload;
+  memset (&payload, 0, sizeof payload);
+  payload.tx_id = tx_id;
+  struct timeval tv;
+  maptime_read (diskfs_mtime, &tv);
+  payload.timestamp_ms = (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  strcpy (payload.action, "checkpoint");
+
+  struct journal_dev *dev = sync_dev;
+  if (!journal_write_indexed (dev, &payload, &end_index, &start_index)
+      || !finish_batch (dev, &end_index, &start_index))
+    {
+      LOG_ERROR ("journal_write_checkpoint: write failed");
+      discard_batch ();
+      ring_indices_valid = false;
+      pthread_mutex_unlock (&sync_write_lock);
+      return false;
+    }
+
+  ring_start_index = start_index;
+  ring_end_index = end_index;
+
+  bool ok = persist_header_with_retry (dev, start_index, end_index, 3)
+    && journal_dev_sync (dev) == 0 && journal_replica_commit ();
+  if (ok)
+    LOG_DEBUG ("journal: checkpoint at tx %" PRIu64 ", %" PRIu64
+	       " bytes retained", tx_id, ring_used (start_index, end_index));
+
+  pthread_mutex_unlock (&sync_write_lock);
+  return ok;
+}
+
+/* Bytes of the ring read at a time by scan_records, and the size of
+   the buffer it needs: a chunk, and room to expand a frame.  A frame
+   is never larger than its records, so it fits in a chunk.  */
+#define JOURNAL_SCAN_CHUNK JOURNAL_FRAME_RAW_MAX
+#define JOURNAL_SCAN_BUF (JOURNAL_SCAN_CHUNK + JOURNAL_FRAME_RAW_MAX)
+
+/* Call FN with ARG on each of the LEN bytes of records at RECORDS, the
+   contents of the frame at ring position POS.  */
+static error_t
+scan_frame (const char *records, size_t len, uint64_t pos,
+	    void (*fn) (const struct journal_payload_bin *, uint64_t,
+			void *),
+	    void *arg)
+{
+  struct journal_payload_bin payload;
+  size_t reclen;
+
+  for (size_t off = 0; off < len; off += reclen)
+    {
+      if (!journal_record_decode (JOURNAL_VERSION, records + off, len - off,
+				  &payload, &reclen))
+	return EIO;
+      (*fn) (&payload, pos, arg);
+    }
+  return 0;
+}
+
+/* Call FN with ARG on every record of the ring from POS to END, with
+   its position, using BUF of JOURNAL_SCAN_BUF bytes.  Records in a
+   frame are given the position of the frame.  Called with
+   sync_write_lock held.  */
+static error_t
+scan_records (struct journal_dev *dev, uint64_t pos, uint64_t end, char *buf,
+	      void (*fn) (const struct journal_payload_bin *, uint64_t,
+			  void *),
+	      void *arg)
+{
+  struct journal_payload_bin payload;
+
+  while (pos != end)
+    {
+      size_t want = (pos < end ? end : journal_data_capacity) - pos;
+      if (want > JOURNAL_SCAN_CHUNK)
+	want = JOURNAL_SCAN_CHUNK;
+      if (journal_dev_pread (dev, buf, want, ring_pos_to_offset (pos))
+	  != (ssize_t) want)
+	return EIO;
+
+      size_t off = 0;
+      bool wrapped = false;
+      while (off < want)
+	{
+	  const struct journal_record_hdr *hdr =
+	    (const struct journal_record_hdr *) (buf + off);
+	  size_t avail = want - off;
+	  size_t reclen;
+
+	  if (avail >= sizeof (uint32_t) && hdr->magic == JOURNAL_WRAP_MAGIC)
+	    {
+	      wrapped = true;
+	      break;
+	    }
+	  if (avail >= sizeof (uint32_t) && hdr->magic == JOURNAL_FRAME_MAGIC)
+	    {
+	      const struct journal_frame_hdr *fh =
+		(const struct journal_frame_hdr *) hdr;
+	      struct journal_frame_hdr frame;
+	      error_t err;
+
+	      if (avail < sizeof *fh
+		  || (fh->length <= JOURNAL_FRAME_RAW_MAX
+		      && journal_record_padded_len (sizeof *fh + fh->length)
+			 > avail))
+		break;
+	      if (!journal_frame_expand (JOURNAL_VERSION, fh, avail,
+					 buf + JOURNAL_SCAN_CHUNK,
+					 JOURNAL_FRAME_RAW_MAX, &frame, &reclen))
+		return EIO;
+	      err = scan_frame (buf + JOURNAL_SCAN_CHUNK, frame.raw_length,
+				pos + off, fn, arg);
+	      if (err)
+		return err;
+	      off += reclen;
+	      continue;
+	    }
+	  if (avail < sizeof *hdr
+	      || journal_record_padded_len (hdr->length) > avail)
+	    break;
+	  if (!journal_record_decode (JOURNAL_VERSION, hdr, avail, &payload,
+				      &reclen))
+	    return EIO;
+	  (*fn) (&payload, pos + off, arg);
+	  off += reclen;
+	}
+
+      if (wrapped)
+	pos = 0;
+      else if (off == 0)
+	/* Not even one record in a whole chunk.  */
+	return EIO;
+      else
+	pos = (pos + off) % journal_data_capacity;
+    }
+
+  return 0;
+}
+
+/* Take sync_write_lock and make sure the ring indices are loaded.
+   Return the device, or NULL (without the lock) if it is not ready.  */
+static struct journal_dev *
+lock_ring (void)
+{
+  pthread_mutex_lock (&sync_write_lock);
+  struct journal_dev *dev = journal_device_ready ? get_sync_dev () : NULL;
+  if (!dev || !load_indices (dev))
+    {
+      pthread_mutex_unlock (&sync_write_lock);
+      return NULL;
+    }
+  return dev;
+}
+
+struct scan_filter
+{
+  uint64_t cursor;
+  void (*fn) (const struct journal_payload_bin *, void *);
+  void *arg;
+};
+
+static void
+scan_from_cursor (const struct journal_payload_bin *payload, uint64_t pos,
+		  void *arg)
+{
+  struct scan_filter *f = arg;
+
+  if (payload->tx_id >= f->cursor)
+    (*f->fn) (payload, f->arg);
+}
+
+error_t
+journal_scan_ring (uint64_t cursor,
+		   void (*fn) (const struct journal_payload_bin *, void *),
+		   void *arg)
+{
+  struct scan_filter filter = { .cursor = cursor, .fn = fn, .arg = arg };
+  error_t err;
+
+  char *buf = malloc (JOURNAL_SCAN_BUF);
+  if (!buf)
+    return ENOMEM;
+
+  struct journal_dev *dev = lock_ring ();
+  if (!dev)
+    {
+      free (buf);
+      return EAGAIN;
+    }
+
+  /* Records written after the events CURSOR asks for may still
+     have been written before some of them, so start at the newest
+     point before which everything is older than CURSOR.  */
+  bool lost = cursor > 0 && cursor <= ring_lost_tx;
+  uint64_t pos = ring_start_index;
+  for (size_t i = marks_count; i-- > 0;)
+    if (mark_at (i)->upto_tx < cursor)
+      {
+	pos = mark_at (i)->pos;
+	break;
+      }
+
+  err = scan_records (dev, pos, ring_end_index, buf, scan_from_cursor,
+		      &filter);
+
+  pthread_mutex_unlock (&sync_write_lock);
+  free (buf);
+  return err ? : lost ? ERANGE : 0;
+}
+
+static void
+index_record (const struct journal_payload_bin *payload, uint64_t pos,
+	      void *arg)
+{
+  (void) arg;
+  journal_index_add (payload, pos);
+}
+
+error_t
+journal_scan_index (enum journal_index_kind kind, journal_ino_t key,
+		    uint64_t since,
+		    void (*fn) (const struct journal_payload_bin *, void *),
+		    void *arg)
+{
+  struct journal_index_hit *hits = NULL;
+  struct journal_payload_bin payload;
+  size_t count = 0;
+  error_t err = 0;
+
+  char *buf = malloc (JOURNAL_SCAN_BUF);
+  if (!buf)
+    return ENOMEM;
+
+  struct journal_dev *dev = lock_ring ();
+  if (!dev)
+    {
+      free (buf);
+      return EAGAIN;
+    }
+
+  if (!journal_index_complete ())
+    {
+      journal_index_reset ();
+      journal_index_drop (ring_lost_tx);
+      err = scan_records (dev, ring_start_index, ring_end_index, buf,
+			  index_record, NULL);
+      if (err)
+	journal_index_reset ();
+      else
+	journal_index_set_complete ();
+    }
+
+  if (!err && !journal_index_lookup (kind, key, since, &hits, &count))
+    err = ENOMEM;
+
+  for (size_t i = 0; !err && i < count; i++)
+    {
+      struct journal_record_hdr hdr;
+      struct journal_frame_hdr frame;
+      const char *records;
+      size_t len, reclen;
+
+      /* Records of a transaction in one frame share their entry.  */
+      if (i > 0 && hits[i].pos == hits[i - 1].pos
+	  && hits[i].tx_id == hits[i - 1].tx_id)
+	continue;
+
+      /* Records and frames never straddle the end of the ring.  */
+      if (!read_ring (dev, &hdr, sizeof frame, hits[i].pos))
+	continue;
+      memcpy (&frame, &hdr, sizeof frame);
+      if (frame.magic == JOURNAL_FRAME_MAGIC)
+	{
+	  if (frame.length > JOURNAL_SCAN_CHUNK - sizeof frame)
+	    continue;
+	  len = journal_record_padded_len (sizeof frame + frame.length);
+	  if (!read_ring (dev, buf, len, hits[i].pos)
+	      || !journal_frame_expand (JOURNAL_VERSION, buf, len,
+					buf + JOURNAL_SCAN_CHUNK,
+					JOURNAL_FRAME_RAW_MAX, &frame, &len))
+	    continue;
+	  records = buf + JOURNAL_SCAN_CHUNK;
+	  len = frame.raw_length;
+	}
+      else
+	{
+	  if (!read_ring (dev, &hdr, sizeof hdr, hits[i].pos)
+	      || hdr.magic != JOURNAL_MAGIC || hdr.length < sizeof hdr)
+	    continue;
+	  len = journal_record_padded_len (hdr.length);
+	  if (!read_ring (dev, buf, len, hits[i].pos))
+	    continue;
+	  records = buf;
+	}
+
+      for (size_t off = 0; off < len; off += reclen)
+	{
+	  if (!journal_record_decode (JOURNAL_VERSION, records + off,
+				      len - off, &payload, &reclen))
+	    break;
+
+	  /* The entry may be stale, if its record has been overwritten.  */
+	  if (payload.tx_id != hits[i].tx_id
+	      || (kind == JOURNAL_INDEX_INODE ? payload.ino != key
+		  : payload.parent_ino != key && payload.src_parent_ino != key))
+	    continue;
+	  (*fn) (&payload, arg);
+	}
+    }
+  free (hits);
+
+  pthread_mutex_unlock (&sync_write_lock);
+  free (buf);
+  return err;
+}
@@ -23,11 +23,51 @@
 #define JOURNAL_WRITER_H
 
 #include <libdiskfs/journal_format.h>
+#include <libdiskfs/journal_index.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
 
 bool journal_write_raw (const struct journal_payload *entries, size_t count);
 bool journal_write_raw_sync (struct journal_payload_bin *payload);
 
+/* Write the COUNT records at PAYLOADS back to back and wait until they
+   are on disk.  */
+bool journal_write_raw_sync_n (const struct journal_payload_bin *payloads,
+			       size_t count);
+
+/* Everything logged with a tx_id of at most TX_ID is now on disk: move
+   the ring start past the records that are no longer needed, log a
+   checkpoint record and persist the header.  */
+bool journal_write_checkpoint (uint64_t tx_id);
+
+/* Drop the cached ring indices and journal fd so they are reloaded from
+   the device on the next write.  Call when the device (re)appears.  */
+void journal_writer_reset (void);
+
+/* Call FN with ARG on every record in the ring that has a tx_id of
+   CURSOR or more, in ring order, which is only roughly tx_id order.
+   Return EAGAIN if the journal device is not ready, ERANGE if records
+   with a tx_id of CURSOR or more may have been dropped (the records
+   that are left are still passed to FN), or EIO.  */
+error_t journal_scan_ring (uint64_t cursor,
+			   void (*fn) (const struct journal_payload_bin *,
+				       void *),
+			   void *arg);
+
+/* Call FN with ARG on every record in the ring about KEY in the index
+   KIND (see journal_index.h) with a tx_id of SINCE or more, in tx_id
+   order.  Return EAGAIN if the journal device is not ready, ENOMEM or
+   EIO.  */
+error_t journal_scan_index (enum journal_index_kind kind, journal_ino_t key,
+			    uint64_t since,
+			    void (*fn) (const struct journal_payload_bin *,
+					void *),
+			    void *arg);
+
+/* Bytes of the ring currently holding records.  */
+uint64_t journal_ring_used (void);
+
 #endif /* JOURNAL_WRITER_H */
 
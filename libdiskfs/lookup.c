@@ -20,6 +20,7 @@
 
 #include "priv.h"
 #include <string.h>
+#include <trace.h>
 
 /* Lookup in directory DP (which is locked) the name NAME.  TYPE will
    either be LOOKUP, CREATE, RENAME, or REMOVE.  CRED identifies the
@@ -80,6 +81,8 @@ diskfs_lookup (struct node *dp, const char *name, enum lookup_type type,
   if (type == REMOVE || type == RENAME)
     assert_backtrace (np);
 
+  TRACE (TRACE_DISKFS_LOOKUP, dp->cache_id, type);
+
   if (!S_ISDIR (dp->dn_stat.st_mode))
     {
       if (ds)
@@ -1,6 +1,6 @@
 /* Directory name lookup caching
 
-   Copyright (C) 1996, 1997, 1998, 2014 Free Software Foundation, Inc.
+   Copyright (C) 1996, 1997, 1998, 2014, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG, & Miles Bader.
 
    This file is part of the GNU Hurd.
@@ -22,141 +22,256 @@
 #include "priv.h"
 #include <assert-backtrace.h>
 #include <hurd/ihash.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
-
-/* The name cache is implemented using a hash table.
+
+/* The name cache is implemented using a hash table, split into shards
+   by the low bits of the hash so that lookups in different directories
+   rarely meet.
 
    We use buckets of a fixed size.  We approximate the
    least-frequently used cache algorithm by counting the number of
-   lookups using saturating arithmetic in the two lowest bits of the
-   pointer to the name.  Using this strategy we achieve a constant
-   worst-case lookup and insertion time.  */
-
-/* Number of buckets.  Must be a power of two. */
-#define CACHE_SIZE	256
+   lookups using saturating arithmetic in each entry.  Using this
+   strategy we achieve a constant worst-case lookup and insertion time.
+
+   Changes to a shard are made with its lock held, between two
+   increments of its sequence count.  Lookups take no lock: they read
+   the shard and retry if the sequence count shows a change started or
+   happened meanwhile.  For that, names are kept in the entries rather
+   than pointed to, and longer names are not cached.  A table replaced
+   by a resize is freed once every thread of diskfs_port_bucket has
+   finished the RPC it was serving, so that no lookup is still reading
+   it.
+
+   A negative entry also records the generation of its directory when
+   it was made, and is ignored once the directory has changed, so that
+   no change can leave a stale one behind.  Generations come from one
+   counter, so a directory dropped from the node cache and read again
+   does not see its old entries as valid.  */
+
+/* Number of shards.  Must be a power of two.  */
+#define CACHE_SHARDS	16
 
 /* Entries per bucket.  */
 #define BUCKET_SIZE	4
 
-/* A mask for fast binary modulo.  */
-#define CACHE_MASK	(CACHE_SIZE - 1)
+/* The longest name that is cached; it makes an entry 64 bytes.  */
+#define CACHE_NAME_LEN	38
 
-/* Cache bucket with BUCKET_SIZE entries.
+/* The default number of entries.  */
+#define DEFAULT_CACHE_ENTRIES	8192
 
-   The layout of the bucket is chosen so that it will be straight
-   forward to use vector operations in the future.  */
-struct cache_bucket
+struct cache_entry
 {
-  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  If
-     NULL, the entry is unused.  */
-  unsigned long name[BUCKET_SIZE];
-
-  /* The key.  */
-  unsigned long key[BUCKET_SIZE];
-
   /* Used to indentify nodes to the fs dependent code.  */
-  ino64_t dir_cache_id[BUCKET_SIZE];
+  ino64_t dir_cache_id;
 
   /* 0 for NODE_CACHE_ID means a `negative' entry -- recording that
      there's definitely no node with this name.  */
-  ino64_t node_cache_id[BUCKET_SIZE];
+  ino64_t node_cache_id;
+
+  /* The key.  */
+  uint32_t key;
+
+  /* The dir_generation of the directory when the entry was made.  */
+  uint32_t generation;
+
+  /* Approximation of use frequency, 0 to 3.  */
+  uint8_t frequ;
+
+  /* Length of NAME.  If 0, the entry is unused.  */
+  uint8_t len;
+
+  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID, not
+     NUL-terminated.  */
+  char name[CACHE_NAME_LEN];
 };
 
+/* Cache bucket with BUCKET_SIZE entries.  */
+struct cache_bucket
+{
+  struct cache_entry entry[BUCKET_SIZE];
+};
+
+/* The buckets of a shard, with the mask for fast binary modulo by their
+   number, so that both are read with one pointer.  */
+struct cache_table
+{
+  unsigned long mask;
+
+  /* Frees the table once it has been replaced.  */
+  struct ports_deferred_call deferred;
+
+  struct cache_bucket bucket[];
+};
+
+struct cache_shard
+{
+  /* Taken to change the shard.  */
+  pthread_mutex_t lock;
+
+  /* Odd while the shard is being changed.  */
+  unsigned int seq;
+
+  /* If there is no best candidate to replace, pick any.  We approximate
+     any by picking the slot depicted by REPLACE, and increment REPLACE
+     then.  */
+  int replace;
+
+  /* NULL until the first entry is made, or when the cache is off.  */
+  struct cache_table *table;
+
+  /* Statistics; updated without the lock.  */
+  uint64_t hits, negative_hits, misses;
+} __attribute__ ((aligned (64)));
+
 /* The cache.  */
-static struct cache_bucket name_cache[CACHE_SIZE];
-
-/* Protected by this lock.  */
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/* Given VALUE, return the char pointer.  */
-static inline char *
-charp (unsigned long value)
+static struct cache_shard name_cache[CACHE_SHARDS] =
+{
+  [0 ... CACHE_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+/* The number of entries the tables are made for.  Changes are
+   serialized by SIZE_LOCK, which is taken before any shard's lock.  */
+static size_t cache_entries = DEFAULT_CACHE_ENTRIES;
+static pthread_mutex_t size_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash the directory cache_id and the name.  */
+static inline uint32_t
+hash (ino64_t dir_cache_id, const char *name, size_t len)
 {
-  return (char *) (value & ~3L);
+  uint32_t h;
+  h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
+  h = hurd_ihash_hash32 (name, len, h);
+  return h;
 }
 
-/* Given VALUE, return the approximation of use frequency.  */
-static inline unsigned long
-frequ (unsigned long value)
+/* The last directory generation given out.  */
+static unsigned int dir_generations;
+
+void
+_diskfs_new_dir_generation (struct node *np)
 {
-  return value & 3;
+  np->dir_generation = __atomic_add_fetch (&dir_generations, 1,
+					   __ATOMIC_RELAXED);
 }
-
-/* Add an entry in the Ith slot of the given bucket.  If there is a
-   value there, remove it first.  */
-static inline void
-add_entry (struct cache_bucket *b, int i,
-	   const char *name, unsigned long key,
-	   ino64_t dir_cache_id, ino64_t node_cache_id)
+
+static inline struct cache_shard *
+shard (uint32_t key)
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
+  return &name_cache[key & (CACHE_SHARDS - 1)];
+}
 
-  b->name[i] = (unsigned long) strdup (name);
-  assert_backtrace ((b->name[i] & 3) == 0);
-  if (b->name[i] == 0)
-    return;
+static inline struct cache_bucket *
+bucket (struct cache_table *t, uint32_t key)
+{
+  return &t->bucket[(key / CACHE_SHARDS) & t->mask];
+}
 
-  b->key[i] = key;
-  b->dir_cache_id[i] = dir_cache_id;
-  b->node_cache_id[i] = node_cache_id;
+/* Begin and end changing shard S, whose lock is held.  */
+static inline void
+write_begin (struct cache_shard *s)
+{
+  __atomic_store_n (&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
 }
 
-/* Remove the entry in the Ith slot of the given bucket.  */
 static inline void
-remove_entry (struct cache_bucket *b, int i)
+write_end (struct cache_shard *s)
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
-  b->name[i] = 0;
+  __atomic_store_n (&s->seq, s->seq + 1, __ATOMIC_RELEASE);
 }
 
-/* Check if the entry in the Ith slot of the given bucket is
-   valid.  */
+/* Check if entry E is (DIR_CACHE_ID, NAME, KEY).  */
 static inline int
-valid_entry (struct cache_bucket *b, int i)
+entry_matches (struct cache_entry *e, ino64_t dir_cache_id,
+	       const char *name, size_t len, uint32_t key)
 {
-  return b->name[i] != 0;
+  return (e->len == len
+	  && e->key == key
+	  && e->dir_cache_id == dir_cache_id
+	  && memcmp (e->name, name, len) == 0);
 }
-
-/* If there is no best candidate to replace, pick any.  We approximate
-   any by picking the slot depicted by REPLACE, and increment REPLACE
-   then.  */
-static int replace;
-
-/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache.  If it is found,
-   return 1 and set BUCKET and INDEX to the item.  Otherwise, return 0
-   and set BUCKET and INDEX to the slot where the item should be
-   inserted.  */
-static inline int
-lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
-	struct cache_bucket **bucket, int *index)
+
+/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache without locking.  If it
+   is found, return 1 and set *ID to the node it names and *GENERATION to
+   the directory generation it was made in.  Otherwise, return 0.  */
+static int
+lookup (ino64_t dir_cache_id, const char *name, size_t len, uint32_t key,
+	ino64_t *id, unsigned int *generation)
+{
+  struct cache_shard *s = shard (key);
+  struct cache_entry *found;
+  unsigned int seq;
+
+  for (;;)
+    {
+      struct cache_table *t;
+
+      seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+	continue;
+
+      found = NULL;
+      t = __atomic_load_n (&s->table, __ATOMIC_RELAXED);
+      if (t)
+	{
+	  struct cache_bucket *b = bucket (t, key);
+	  int i;
+
+	  for (i = 0; i < BUCKET_SIZE; i++)
+	    if (entry_matches (&b->entry[i], dir_cache_id, name, len, key))
+	      {
+		found = &b->entry[i];
+		*id = found->node_cache_id;
+		*generation = found->generation;
+		break;
+	      }
+	}
+
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&s->seq, __ATOMIC_RELAXED) == seq)
+	break;
+    }
+
+  if (found)
+    {
+      /* Racing with a change of the entry at worst misplaces a count.  */
+      uint8_t f = __atomic_load_n (&found->frequ, __ATOMIC_RELAXED);
+      if (f < 3)
+	__atomic_store_n (&found->frequ, f + 1, __ATOMIC_RELAXED);
+    }
+
+  return found != NULL;
+}
+
+/* Return the slot in bucket B of shard S where (DIR_CACHE_ID, NAME,
+   KEY) is or should be entered, setting *FOUND to whether it is
+   there.  S is locked.  */
+static struct cache_entry *
+slot (struct cache_shard *s, struct cache_bucket *b, ino64_t dir_cache_id,
+      const char *name, size_t len, uint32_t key, int *found)
 {
-  struct cache_bucket *b = *bucket = &name_cache[key & CACHE_MASK];
   unsigned long best = 3;
-  int i;
+  int i, index = 0;
 
   for (i = 0; i < BUCKET_SIZE; i++)
     {
-      unsigned long f = frequ (b->name[i]);
+      struct cache_entry *e = &b->entry[i];
 
-      if (valid_entry (b, i)
-	  && b->key[i] == key
-	  && b->dir_cache_id[i] == dir_cache_id
-	  && strcmp (charp (b->name[i]), name) == 0)
+      if (entry_matches (e, dir_cache_id, name, len, key))
 	{
-	  if (f < 3)
-	    b->name[i] += 1;
-
-	  *index = i;
-	  return 1;
+	  *found = 1;
+	  return e;
 	}
 
       /* Keep track of the replacement candidate.  */
-      if (f < best)
+      if (e->len == 0 || e->frequ < best)
 	{
-	  best = f;
-	  *index = i;
+	  best = e->len == 0 ? 0 : e->frequ;
+	  index = i;
 	}
     }
 
@@ -164,64 +279,152 @@ lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
      any entry.  */
   if (best == 3)
     {
-      *index = replace;
-      replace = (replace + 1) & (BUCKET_SIZE - 1);
+      index = s->replace;
+      s->replace = (s->replace + 1) & (BUCKET_SIZE - 1);
     }
 
-  return 0;
+  *found = 0;
+  return &b->entry[index];
 }
 
-/* Hash the directory cache_id and the name.  */
-static inline unsigned long
-hash (ino64_t dir_cache_id, const char *name)
+/* Allocate an empty table for a cache of ENTRIES entries in all, or
+   return NULL.  */
+static struct cache_table *
+table_alloc (size_t entries)
 {
-  unsigned long h;
-  h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
-  h = hurd_ihash_hash32 (name, strlen (name), h);
-  return h;
+  size_t buckets = 1;
+  struct cache_table *t;
+
+  while (buckets * BUCKET_SIZE * CACHE_SHARDS < entries)
+    buckets *= 2;
+
+  t = calloc (1, sizeof *t + buckets * sizeof t->bucket[0]);
+  if (t)
+    t->mask = buckets - 1;
+  return t;
 }
-
+
+static void
+table_free (struct ports_deferred_call *call)
+{
+  free ((char *) call - offsetof (struct cache_table, deferred));
+}
+
 /* Node NP has just been found in DIR with NAME.  If NP is null, that
    means that this name has been confirmed as absent in the directory. */
 void
 diskfs_enter_lookup_cache (struct node *dir, struct node *np, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t len = strlen (name);
+  uint32_t key = hash (dir->cache_id, name, len);
   ino64_t value = np ? np->cache_id : 0;
-  struct cache_bucket *bucket;
-  int i = 0, found;
+  struct cache_shard *s = shard (key);
+  struct cache_entry *e;
+  int found;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (! found)
-    add_entry (bucket, i, name, key, dir->cache_id, value);
-  else
-    if (bucket->node_cache_id[i] != value)
-      bucket->node_cache_id[i] = value;
+  if (len == 0 || len > CACHE_NAME_LEN)
+    return;
+
+  pthread_mutex_lock (&s->lock);
+
+  if (s->table == NULL)
+    {
+      struct cache_table *t;
+      size_t entries;
+
+      entries = __atomic_load_n (&cache_entries, __ATOMIC_RELAXED);
+      t = entries ? table_alloc (entries) : NULL;
+      if (t == NULL)
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return;
+	}
+      /* No lookup can be reading a table that was never published.  */
+      __atomic_store_n (&s->table, t, __ATOMIC_RELEASE);
+    }
 
-  pthread_mutex_unlock (&cache_lock);
+  e = slot (s, bucket (s->table, key), dir->cache_id, name, len, key, &found);
+  if (! found || e->node_cache_id != value
+      || e->generation != dir->dir_generation)
+    {
+      write_begin (s);
+      if (! found)
+	{
+	  e->dir_cache_id = dir->cache_id;
+	  e->key = key;
+	  e->frequ = 0;
+	  e->len = len;
+	  memcpy (e->name, name, len);
+	}
+      e->node_cache_id = value;
+      e->generation = dir->dir_generation;
+      write_end (s);
+    }
+
+  pthread_mutex_unlock (&s->lock);
 }
-
+
 /* Purge all references in the cache to NP as a node inside
    directory DP. */
 void
 diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 {
-  int i;
-  struct cache_bucket *b;
+  struct cache_shard *s;
 
-  pthread_mutex_lock (&cache_lock);
+  for (s = &name_cache[0]; s < &name_cache[CACHE_SHARDS]; s++)
+    {
+      unsigned long j;
+      int i;
 
-  for (b = &name_cache[0]; b < &name_cache[CACHE_SIZE]; b++)
-    for (i = 0; i < BUCKET_SIZE; i++)
-      if (valid_entry (b, i)
-	  && b->dir_cache_id[i] == dp->cache_id
-	  && b->node_cache_id[i] == np->cache_id)
-	remove_entry (b, i);
+      pthread_mutex_lock (&s->lock);
+      if (s->table)
+	{
+	  write_begin (s);
+	  for (j = 0; j <= s->table->mask; j++)
+	    for (i = 0; i < BUCKET_SIZE; i++)
+	      {
+		struct cache_entry *e = &s->table->bucket[j].entry[i];
+		if (e->len
+		    && e->dir_cache_id == dp->cache_id
+		    && e->node_cache_id == np->cache_id)
+		  e->len = 0;
+	      }
+	  write_end (s);
+	}
+      pthread_mutex_unlock (&s->lock);
+    }
+}
 
-  pthread_mutex_unlock (&cache_lock);
+/* Purge the entry in the cache for NAME in directory DP, which refers
+   to NP.  */
+void
+diskfs_purge_lookup_cache_name (struct node *dp, struct node *np,
+				const char *name)
+{
+  size_t len = strlen (name);
+  uint32_t key = hash (dp->cache_id, name, len);
+  struct cache_shard *s = shard (key);
+  struct cache_entry *e;
+  int found;
+
+  if (len == 0 || len > CACHE_NAME_LEN)
+    return;
+
+  pthread_mutex_lock (&s->lock);
+  if (s->table)
+    {
+      e = slot (s, bucket (s->table, key), dp->cache_id, name, len, key,
+		&found);
+      if (found && e->node_cache_id == np->cache_id)
+	{
+	  write_begin (s);
+	  e->len = 0;
+	  write_end (s);
+	}
+    }
+  pthread_mutex_unlock (&s->lock);
 }
-
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
@@ -229,65 +432,190 @@ diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 struct node *
 diskfs_check_lookup_cache (struct node *dir, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t len = strlen (name);
+  uint32_t key = hash (dir->cache_id, name, len);
   int lookup_parent = name[0] == '.' && name[1] == '.' && name[2] == '\0';
-  struct cache_bucket *bucket;
-  int i, found;
+  struct cache_shard *s = shard (key);
+  unsigned int generation;
+  ino64_t id;
 
   if (lookup_parent && dir == diskfs_root_node)
     /* This is outside our file system, return cache miss.  */
     return NULL;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (found)
+  if (len > CACHE_NAME_LEN
+      || ! lookup (dir->cache_id, name, len, key, &id, &generation)
+      || (id == 0 && generation != dir->dir_generation))
+    {
+      __atomic_add_fetch (&s->misses, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+  if (id == 0)
+    /* A negative cache entry.  */
+    {
+      __atomic_add_fetch (&s->negative_hits, 1, __ATOMIC_RELAXED);
+      return (struct node *) -1;
+    }
+
+  __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+
+  if (id == dir->cache_id)
+    /* The cached node is the same as DIR.  */
     {
-      ino64_t id = bucket->node_cache_id[i];
-      pthread_mutex_unlock (&cache_lock);
-
-      if (id == 0)
-	/* A negative cache entry.  */
-	return (struct node *) -1;
-      else if (id == dir->cache_id)
-	/* The cached node is the same as DIR.  */
+      diskfs_nref (dir);
+      return dir;
+    }
+  else
+    /* Just a normal entry in DIR; get the actual node.  */
+    {
+      struct node *np;
+      error_t err;
+
+      if (lookup_parent)
 	{
-	  diskfs_nref (dir);
-	  return dir;
+	  ino64_t again;
+	  unsigned int again_generation;
+
+	  pthread_mutex_unlock (&dir->lock);
+	  err = diskfs_cached_lookup (id, &np);
+	  pthread_mutex_lock (&dir->lock);
+
+	  if (err)
+	    return 0;
+
+	  /* In the window where DP was unlocked, we might
+	     have lost.  So check the cache again, and see
+	     if it's still there; if so, then we win. */
+	  if (! lookup (dir->cache_id, name, len, key, &again,
+			&again_generation)
+	      || again != id)
+	    {
+	      /* Lose */
+	      diskfs_nput (np);
+	      return 0;
+	    }
 	}
       else
-	/* Just a normal entry in DIR; get the actual node.  */
+	err = diskfs_cached_lookup (id, &np);
+      return err ? 0 : np;
+    }
+}
+
+/* If the cache knows that the LEN bytes at NAME name a node other than
+   DIR inside DIR, set *ID to it and return 1; otherwise return 0.  DIR
+   is locked.  */
+int
+_diskfs_lookup_cache_id (struct node *dir, const char *name, size_t len,
+			 ino64_t *id)
+{
+  uint32_t key = hash (dir->cache_id, name, len);
+  unsigned int generation;
+
+  if (len == 0 || len > CACHE_NAME_LEN
+      || ! lookup (dir->cache_id, name, len, key, id, &generation)
+      || *id == 0 || *id == dir->cache_id)
+    return 0;
+
+  __atomic_add_fetch (&shard (key)->hits, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/* Make the cache hold about ENTRIES entries, or none if ENTRIES is
+   0.  */
+error_t
+diskfs_set_name_cache_size (size_t entries)
+{
+  struct cache_shard *s;
+
+  pthread_mutex_lock (&size_lock);
+  __atomic_store_n (&cache_entries, entries, __ATOMIC_RELAXED);
+
+  for (s = &name_cache[0]; s < &name_cache[CACHE_SHARDS]; s++)
+    {
+      struct cache_table *old, *new = NULL;
+
+      pthread_mutex_lock (&s->lock);
+      old = s->table;
+      if (old == NULL && entries > 0)
 	{
-	  struct node *np;
-	  error_t err;
+	  /* Let the next entry allocate a table.  */
+	  pthread_mutex_unlock (&s->lock);
+	  continue;
+	}
+
+      if (entries > 0)
+	{
+	  unsigned long j;
+	  int i;
 
-	  if (lookup_parent)
+	  new = table_alloc (entries);
+	  if (new == NULL)
 	    {
-	      pthread_mutex_unlock (&dir->lock);
-	      err = diskfs_cached_lookup (id, &np);
-	      pthread_mutex_lock (&dir->lock);
-
-	      /* In the window where DP was unlocked, we might
-		 have lost.  So check the cache again, and see
-		 if it's still there; if so, then we win. */
-	      pthread_mutex_lock (&cache_lock);
-	      found = lookup (dir->cache_id, name, key, &bucket, &i);
-	      if (! found
-		  || bucket->node_cache_id[i] != id)
-		{
-		  pthread_mutex_unlock (&cache_lock);
-
-		  /* Lose */
-		  diskfs_nput (np);
-		  return 0;
-		}
-	      pthread_mutex_unlock (&cache_lock);
+	      pthread_mutex_unlock (&s->lock);
+	      pthread_mutex_unlock (&size_lock);
+	      return ENOMEM;
 	    }
+
+	  /* Keep what fits of the old entries.  */
+	  for (j = 0; j <= old->mask; j++)
+	    for (i = 0; i < BUCKET_SIZE; i++)
+	      {
+		struct cache_entry *e = &old->bucket[j].entry[i], *n;
+		int found;
+
+		if (e->len == 0)
+		  continue;
+		n = slot (s, bucket (new, e->key), e->dir_cache_id,
+			  e->name, e->len, e->key, &found);
+		if (! found && n->len == 0)
+		  *n = *e;
+	      }
+	}
+
+      write_begin (s);
+      s->table = new;
+      write_end (s);
+      pthread_mutex_unlock (&s->lock);
+
+      if (old)
+	{
+	  /* Before it serves RPCs, only this thread can be looking.  */
+	  old->deferred.function = table_free;
+	  if (diskfs_port_bucket)
+	    ports_defer_call (diskfs_port_bucket, &old->deferred);
 	  else
-	    err = diskfs_cached_lookup (id, &np);
-	  return err ? 0 : np;
+	    table_free (&old->deferred);
 	}
     }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&size_lock);
   return 0;
 }
+
+size_t
+diskfs_get_name_cache_size (void)
+{
+  return __atomic_load_n (&cache_entries, __ATOMIC_RELAXED);
+}
+
+/* Fill in *STATS with the cache's statistics.  */
+void
+diskfs_get_name_cache_stats (struct diskfs_name_cache_stats *stats)
+{
+  struct cache_shard *s;
+
+  memset (stats, 0, sizeof *stats);
+  for (s = &name_cache[0]; s < &name_cache[CACHE_SHARDS]; s++)
+    {
+      stats->hits += __atomic_load_n (&s->hits, __ATOMIC_RELAXED);
+      stats->negative_hits += __atomic_load_n (&s->negative_hits,
+					       __ATOMIC_RELAXED);
+      stats->misses += __atomic_load_n (&s->misses, __ATOMIC_RELAXED);
+
+      pthread_mutex_lock (&s->lock);
+      if (s->table)
+	stats->capacity += (s->table->mask + 1) * BUCKET_SIZE;
+      pthread_mutex_unlock (&s->lock);
+    }
+}
@@ -18,16 +18,36 @@
    along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <hurd/ihash.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include "priv.h"
 
-/* The node cache is implemented using a hash table.  Access to the
-   cache is protected by nodecache_lock.
+/* The node cache is implemented using hash tables, one per shard of the
+   inode numbers.  Access to each shard is protected by its own lock, so
+   that creating or dropping a node only holds up lookups of nodes in
+   the same shard.
 
    Every node in the cache carries a light reference.  When we are
    asked to give up that light reference, we reacquire our lock
    momentarily to check whether someone else reacquired a reference
-   through the cache.  */
+   through the cache.
+
+   A node that loses its last hard reference is not forgotten at once
+   but kept, unused, at the end of its shard's LRU list.  Once a shard
+   has more unused nodes than its part of nodecache_unused, the oldest
+   are forgotten.  A node leaves the list when it is found in the cache
+   again.  The lists are changed with the shard's lock held for
+   writing, or held for reading together with the shard's LRU_LOCK.
+
+   A node can only change while someone holds a hard reference to it,
+   or through a pager that tells us with diskfs_node_changed.  Each
+   shard therefore also keeps a list of the nodes that may have changed
+   since the last diskfs_node_collect_changed: a node is put on it when
+   it gains a hard reference, and taken off when a collection finds it
+   without any.  An idle filesystem thus has next to nothing to sync,
+   however many nodes it caches.  That list is only changed with
+   LRU_LOCK held, and nodes leave it before leaving the table.  */
 
 /* The size of ino_t is larger than hurd_ihash_key_t on 32 bit
    platforms.  We therefore have to use libihashs generalized key
@@ -55,10 +75,318 @@ compare (const void *a, const void *b)
   return *(ino_t *) a == *(ino_t *) b;
 }
 
-static struct hurd_ihash nodecache =
-  HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, slot), NULL, NULL,
-                              hash, compare);
-static pthread_rwlock_t nodecache_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Number of shards.  Must be a power of two.  */
+#define NODECACHE_SHARDS	16
+
+struct nodecache_shard
+{
+  struct hurd_ihash table;
+  pthread_rwlock_t lock;
+
+  /* Nodes without hard references, oldest first.  */
+  struct node *lru_head, *lru_tail;
+  size_t lru_count;
+  pthread_mutex_t lru_lock;
+
+  /* Nodes that may have changed since the last collection.  */
+  struct node *changed;
+} __attribute__ ((aligned (64)));
+
+static struct nodecache_shard nodecache[NODECACHE_SHARDS] =
+{
+  [0 ... NODECACHE_SHARDS - 1] =
+  {
+    .table = HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, slot),
+					 NULL, NULL, hash, compare),
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .lru_lock = PTHREAD_MUTEX_INITIALIZER,
+  }
+};
+
+/* How many unused nodes to keep in the whole cache.  */
+static size_t nodecache_unused = 1024;
+
+/* At most this many nodes are forgotten at once.  */
+#define NODECACHE_EVICT_BATCH	16
+
+/* Return the shard of inode INUM.  The tables hash on the low bits of
+   the mixed number, so the shard is chosen by the high ones.  */
+static inline struct nodecache_shard *
+shard (ino_t inum)
+{
+  uint64_t h = inum;
+  mix_fasthash (h);
+  return &nodecache[h >> (64 - __builtin_ctz (NODECACHE_SHARDS))];
+}
+
+/* Put NP at the end of the LRU list of S.  */
+static void
+lru_append (struct nodecache_shard *s, struct node *np)
+{
+  np->lru_prev = s->lru_tail;
+  np->lru_next = NULL;
+  if (s->lru_tail)
+    s->lru_tail->lru_next = np;
+  else
+    s->lru_head = np;
+  s->lru_tail = np;
+  s->lru_count++;
+  __atomic_store_n (&np->lru_linked, 1, __ATOMIC_RELAXED);
+}
+
+/* Take NP off the LRU list of S.  */
+static void
+lru_unlink (struct nodecache_shard *s, struct node *np)
+{
+  if (np->lru_prev)
+    np->lru_prev->lru_next = np->lru_next;
+  else
+    s->lru_head = np->lru_next;
+  if (np->lru_next)
+    np->lru_next->lru_prev = np->lru_prev;
+  else
+    s->lru_tail = np->lru_prev;
+  np->lru_prev = np->lru_next = NULL;
+  s->lru_count--;
+  __atomic_store_n (&np->lru_linked, 0, __ATOMIC_RELAXED);
+}
+
+/* NP was found in S, whose lock we hold at least for reading, and is
+   getting a hard reference: it is no longer unused.  Only this can take
+   NP off the list under a read lock, so if NP isn't on it now, it won't
+   be put there until our lock is released.  */
+static void
+lru_forget (struct nodecache_shard *s, struct node *np)
+{
+  if (__atomic_load_n (&np->lru_linked, __ATOMIC_RELAXED))
+    {
+      pthread_mutex_lock (&s->lru_lock);
+      if (np->lru_linked)
+	lru_unlink (s, np);
+      pthread_mutex_unlock (&s->lru_lock);
+    }
+}
+
+/* Put NP on the list of changed nodes of S, unless it is on it.
+   LRU_LOCK of S is held.  */
+static void
+changed_link (struct nodecache_shard *s, struct node *np)
+{
+  if (np->changed_linked)
+    return;
+  np->changed_prev = NULL;
+  np->changed_next = s->changed;
+  if (s->changed)
+    s->changed->changed_prev = np;
+  s->changed = np;
+  __atomic_store_n (&np->changed_linked, 1, __ATOMIC_RELAXED);
+}
+
+/* Take NP off the list of changed nodes of S, if it is on it.  LRU_LOCK
+   of S is held.  */
+static void
+changed_unlink (struct nodecache_shard *s, struct node *np)
+{
+  if (! np->changed_linked)
+    return;
+  if (np->changed_prev)
+    np->changed_prev->changed_next = np->changed_next;
+  else
+    s->changed = np->changed_next;
+  if (np->changed_next)
+    np->changed_next->changed_prev = np->changed_prev;
+  np->changed_prev = np->changed_next = NULL;
+  __atomic_store_n (&np->changed_linked, 0, __ATOMIC_RELAXED);
+}
+
+/* NP, whose SLOT has just been cleared with the lock of S held for
+   writing, is leaving the cache.  */
+static void
+changed_forget (struct nodecache_shard *s, struct node *np)
+{
+  pthread_mutex_lock (&s->lru_lock);
+  changed_unlink (s, np);
+  pthread_mutex_unlock (&s->lru_lock);
+}
+
+void
+diskfs_node_changed (struct node *np)
+{
+  struct nodecache_shard *s = shard (np->cache_id);
+
+  /* Pairs with the fence in diskfs_node_collect_changed: either it sees
+     the change, or we see that it took NP off the list.  */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&np->changed_linked, __ATOMIC_RELAXED))
+    return;
+
+  pthread_mutex_lock (&s->lru_lock);
+  /* A node leaving the cache has its slot cleared before it is taken
+     off the list with this lock held, so we see that it left.  */
+  if (np->slot)
+    changed_link (s, np);
+  pthread_mutex_unlock (&s->lru_lock);
+}
+
+/* Return how many unused nodes each shard keeps.  */
+static inline size_t
+shard_unused (void)
+{
+  size_t unused = __atomic_load_n (&nodecache_unused, __ATOMIC_RELAXED);
+  return (unused + NODECACHE_SHARDS - 1) / NODECACHE_SHARDS;
+}
+
+/* Remove the oldest unused nodes of S from the cache until it has no
+   more than KEEP, but at most NODECACHE_EVICT_BATCH of them, and store
+   them in VICTIMS, locked, each still with the cache's light reference.
+   Return their number.  Nodes SELF (which the caller has locked), in
+   use, or locked by someone else are passed over.  The lock of S must
+   be held for writing.  */
+static int
+lru_detach (struct nodecache_shard *s, size_t keep, struct node *self,
+	    struct node **victims)
+{
+  struct node *np, *next;
+  int n = 0;
+
+  for (np = s->lru_head;
+       np && s->lru_count > keep && n < NODECACHE_EVICT_BATCH;
+       np = next)
+    {
+      struct references result;
+
+      next = np->lru_next;
+      if (np == self || pthread_mutex_trylock (&np->lock))
+	continue;
+
+      refcounts_references (&np->refcounts, &result);
+      if (result.hard > 0)
+	{
+	  /* Referenced by diskfs_node_iterate; it stays unused.  */
+	  pthread_mutex_unlock (&np->lock);
+	  continue;
+	}
+
+      lru_unlink (s, np);
+      hurd_ihash_locp_remove (&s->table, np->slot);
+      np->slot = NULL;
+      changed_forget (s, np);
+      victims[n++] = np;
+    }
+
+  return n;
+}
+
+/* Finish forgetting the N nodes returned by lru_detach.  */
+static void
+evict (struct node **victims, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      struct node *np = victims[i];
+      struct references result;
+
+      /* Flush node if needed, before forgetting it */
+      diskfs_node_update (np, diskfs_synchronous);
+      diskfs_user_try_dropping_softrefs (np);
+
+      refcounts_deref_weak (&np->refcounts, &result);
+      if (result.hard == 0 && result.weak == 0)
+	diskfs_drop_node (np);
+      else
+	pthread_mutex_unlock (&np->lock);
+    }
+}
+
+/* Keep about NODES nodes without hard references in the cache, or
+   forget nodes as soon as they lose their last hard reference if NODES
+   is 0.  */
+void
+diskfs_set_node_cache_size (size_t nodes)
+{
+  struct node *victims[NODECACHE_EVICT_BATCH];
+  struct nodecache_shard *s;
+  size_t keep;
+  int n;
+
+  __atomic_store_n (&nodecache_unused, nodes, __ATOMIC_RELAXED);
+  keep = shard_unused ();
+
+  for (s = &nodecache[0]; s < &nodecache[NODECACHE_SHARDS]; s++)
+    do
+      {
+	pthread_rwlock_wrlock (&s->lock);
+	n = lru_detach (s, keep, NULL, victims);
+	pthread_rwlock_unlock (&s->lock);
+	evict (victims, n);
+      }
+    while (n == NODECACHE_EVICT_BATCH);
+}
+
+/* Return the number last given to diskfs_set_node_cache_size, or the
+   default.  */
+size_t
+diskfs_get_node_cache_size (void)
+{
+  return __atomic_load_n (&nodecache_unused, __ATOMIC_RELAXED);
+}
+
+/* Under memory pressure, unused nodes are forgotten before their time,
+   taking their pagers and so the file pages the kernel keeps for them
+   along.  Each shard gives up its share of them, oldest first.  */
+static size_t
+shrinker_count (struct shrinker *shrinker)
+{
+  struct nodecache_shard *s;
+  size_t n = 0;
+
+  for (s = &nodecache[0]; s < &nodecache[NODECACHE_SHARDS]; s++)
+    n += __atomic_load_n (&s->lru_count, __ATOMIC_RELAXED);
+  return n;
+}
+
+static size_t
+shrinker_scan (struct shrinker *shrinker, size_t nr)
+{
+  struct node *victims[NODECACHE_EVICT_BATCH];
+  struct nodecache_shard *s;
+  size_t total = shrinker_count (shrinker), freed = 0;
+
+  if (total == 0)
+    return 0;
+
+  for (s = &nodecache[0]; s < &nodecache[NODECACHE_SHARDS]; s++)
+    {
+      size_t want = (nr * __atomic_load_n (&s->lru_count, __ATOMIC_RELAXED)
+		     + total - 1) / total;
+      int n;
+
+      while (want > 0)
+	{
+	  pthread_rwlock_wrlock (&s->lock);
+	  n = lru_detach (s, s->lru_count > want ? s->lru_count - want : 0,
+			  NULL, victims);
+	  pthread_rwlock_unlock (&s->lock);
+	  evict (victims, n);
+	  freed += n;
+
+	  if (n < NODECACHE_EVICT_BATCH)
+	    break;
+	  want -= n;
+	}
+    }
+
+  return freed;
+}
+
+struct shrinker _diskfs_node_cache_shrinker =
+{
+  .name = "diskfs-node-cache",
+  .count = shrinker_count,
+  .scan = shrinker_scan,
+};
 
 /* Fetch inode INUM, set *NPP to the node structure;
    gain one user reference and lock the node.  */
@@ -77,12 +405,13 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
   error_t err;
   struct node *np, *tmp;
   hurd_ihash_locp_t slot;
+  struct nodecache_shard *s = shard (inum);
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &inum, &slot);
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_locp_find (&s->table, (hurd_ihash_key_t) &inum, &slot);
   if (np)
     goto gotit;
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&s->lock);
 
   err = diskfs_user_make_node (&np, ctx);
   if (err)
@@ -92,8 +421,8 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
   pthread_mutex_lock (&np->lock);
 
   /* Put NP in NODEHASH.  */
-  pthread_rwlock_wrlock (&nodecache_lock);
-  tmp = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &np->cache_id,
+  pthread_rwlock_wrlock (&s->lock);
+  tmp = hurd_ihash_locp_find (&s->table, (hurd_ihash_key_t) &np->cache_id,
 			      &slot);
   if (tmp)
     {
@@ -103,11 +432,12 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
       goto gotit;
     }
 
-  err = hurd_ihash_locp_add (&nodecache, slot,
+  err = hurd_ihash_locp_add (&s->table, slot,
 			     (hurd_ihash_key_t) &np->cache_id, np);
   assert_perror_backtrace (err);
   diskfs_nref_light (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  diskfs_node_changed (np);
+  pthread_rwlock_unlock (&s->lock);
 
   /* Get the contents of NP off disk.  */
   err = diskfs_user_read_node (np, ctx);
@@ -121,22 +451,43 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
 
  gotit:
   diskfs_nref (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  lru_forget (s, np);
+  pthread_rwlock_unlock (&s->lock);
   pthread_mutex_lock (&np->lock);
   *npp = np;
   return 0;
 }
 
+/* If node INUM is in the cache, return it with a new hard reference but
+   without locking it; otherwise return NULL without reading it.  */
+struct node *
+_diskfs_cached_ref (ino_t inum)
+{
+  struct node *np;
+  struct nodecache_shard *s = shard (inum);
+
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_find (&s->table, (hurd_ihash_key_t) &inum);
+  if (np)
+    {
+      diskfs_nref (np);
+      lru_forget (s, np);
+    }
+  pthread_rwlock_unlock (&s->lock);
+  return np;
+}
+
 /* Lookup node INUM (which must have a reference already) and return it
    without allocating any new references. */
 struct node *
 diskfs_cached_ifind (ino_t inum)
 {
   struct node *np;
+  struct nodecache_shard *s = shard (inum);
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_find (&nodecache, (hurd_ihash_key_t) &inum);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_find (&s->table, (hurd_ihash_key_t) &inum);
+  pthread_rwlock_unlock (&s->lock);
 
   assert_backtrace (np);
   return np;
@@ -145,7 +496,10 @@ diskfs_cached_ifind (ino_t inum)
 void __attribute__ ((weak))
 diskfs_try_dropping_softrefs (struct node *np)
 {
-  pthread_rwlock_wrlock (&nodecache_lock);
+  struct nodecache_shard *s = shard (np->cache_id);
+  size_t keep = shard_unused ();
+
+  pthread_rwlock_wrlock (&s->lock);
   if (np->slot != NULL)
     {
       /* Check if someone reacquired a reference through the
@@ -157,23 +511,103 @@ diskfs_try_dropping_softrefs (struct node *np)
 	{
 	  /* A reference was reacquired through a hash table lookup.
 	     It's fine, we didn't touch anything yet. */
-	  pthread_rwlock_unlock (&nodecache_lock);
+	  pthread_rwlock_unlock (&s->lock);
+	  return;
+	}
+
+      if (keep > 0 && np->dn_stat.st_nlink > 0)
+	{
+	  /* Keep NP around, unused, and forget older nodes instead.  */
+	  struct node *victims[NODECACHE_EVICT_BATCH];
+	  int n;
+
+	  if (! np->lru_linked)
+	    lru_append (s, np);
+	  n = lru_detach (s, keep, np, victims);
+	  pthread_rwlock_unlock (&s->lock);
+	  evict (victims, n);
 	  return;
 	}
 
-      hurd_ihash_locp_remove (&nodecache, np->slot);
+      if (np->lru_linked)
+	lru_unlink (s, np);
+      hurd_ihash_locp_remove (&s->table, np->slot);
       np->slot = NULL;
+      changed_forget (s, np);
 
       /* Flush node if needed, before forgetting it */
       diskfs_node_update (np, diskfs_synchronous);
 
       diskfs_nrele_light (np);
     }
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&s->lock);
 
   diskfs_user_try_dropping_softrefs (np);
 }
 
+/* Return in *NODES the active nodes for which WANT, unless it is NULL,
+   returns nonzero, and their number in *NUM_NODES, each with a hard
+   reference.  Only one shard is locked at a time, and only for reading,
+   so this holds up no lookups and creations in other shards.  */
+static error_t
+collect (int (*want)(struct node *), struct node ***nodes, size_t *num_nodes)
+{
+  struct node **node_list = NULL;
+  size_t n = 0, alloced = 0;
+  struct nodecache_shard *s;
+
+  for (s = &nodecache[0]; s < &nodecache[NODECACHE_SHARDS]; s++)
+    {
+      pthread_rwlock_rdlock (&s->lock);
+
+      if (n + s->table.nr_items > alloced)
+	{
+	  size_t new_alloced = n + s->table.nr_items;
+	  struct node **new_list;
+
+	  if (new_alloced < 2 * alloced)
+	    new_alloced = 2 * alloced;
+	  new_list = realloc (node_list, new_alloced * sizeof *node_list);
+	  if (new_list == NULL)
+	    {
+	      pthread_rwlock_unlock (&s->lock);
+	      while (n > 0)
+		diskfs_nrele (node_list[--n]);
+	      free (node_list);
+	      return ENOMEM;
+	    }
+	  node_list = new_list;
+	  alloced = new_alloced;
+	}
+
+      HURD_IHASH_ITERATE (&s->table, i)
+	{
+	  struct node *node = i;
+
+	  if (want && ! (*want)(node))
+	    continue;
+
+	  /* We acquire a hard reference for node, but without using
+	     diskfs_nref.  We do this so that diskfs_new_hardrefs will not
+	     get called.  Our caller may change the node, though.  */
+	  refcounts_ref (&node->refcounts, NULL);
+	  if (! __atomic_load_n (&node->changed_linked, __ATOMIC_RELAXED))
+	    {
+	      pthread_mutex_lock (&s->lru_lock);
+	      changed_link (s, node);
+	      pthread_mutex_unlock (&s->lru_lock);
+	    }
+	  node_list[n++] = node;
+	}
+
+      pthread_rwlock_unlock (&s->lock);
+    }
+
+  *nodes = node_list;
+  *num_nodes = n;
+  return 0;
+}
+
 /* For each active node, call FUN.  The node is to be locked around the call
    to FUN.  If FUN returns non-zero for any node, then immediately stop, and
    return that value.  */
@@ -184,36 +618,14 @@ diskfs_node_iterate (error_t (*fun)(struct node *))
   size_t num_nodes;
   struct node *node, **node_list, **p;
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-
-  /* We must copy everything from the hash table into another data structure
-     to avoid running into any problems with the hash-table being modified
-     during processing (normally we delegate access to hash-table with
-     nodecache_lock, but we can't hold this while locking the
+  /* We must copy everything from the hash tables into another data
+     structure to avoid running into any problems with the tables being
+     modified during processing (normally we delegate access to the
+     tables with their locks, but we can't hold these while locking the
      individual node locks).  */
-  /* XXX: Can we?  */
-  num_nodes = nodecache.nr_items;
-
-  /* TODO This method doesn't scale beyond a few dozen nodes and should be
-     replaced.  */
-  node_list = malloc (num_nodes * sizeof (struct node *));
-  if (node_list == NULL)
-    {
-      pthread_rwlock_unlock (&nodecache_lock);
-      return ENOMEM;
-    }
-
-  p = node_list;
-  HURD_IHASH_ITERATE (&nodecache, i)
-    {
-      *p++ = node = i;
-
-      /* We acquire a hard reference for node, but without using
-	 diskfs_nref.  We do this so that diskfs_new_hardrefs will not
-	 get called.  */
-      refcounts_ref (&node->refcounts, NULL);
-    }
-  pthread_rwlock_unlock (&nodecache_lock);
+  err = collect (NULL, &node_list, &num_nodes);
+  if (err)
+    return err;
 
   p = node_list;
   while (num_nodes-- > 0)
@@ -232,6 +644,92 @@ diskfs_node_iterate (error_t (*fun)(struct node *))
   return err;
 }
 
+/* Return in *NODES the active nodes for which WANT returns nonzero, and
+   their number in *NUM_NODES, each with a hard reference.  Unlike
+   diskfs_node_iterate, no node is locked, so that a caller looking for a
+   few nodes among many need not take all their locks.  */
+error_t
+diskfs_node_collect (int (*want)(struct node *),
+		     struct node ***nodes, size_t *num_nodes)
+{
+  return collect (want, nodes, num_nodes);
+}
+
+error_t
+diskfs_node_collect_changed (int (*want)(struct node *),
+			     struct node ***nodes, size_t *num_nodes)
+{
+  struct node **node_list = NULL, *node, *next;
+  size_t n = 0, alloced = 0;
+  struct nodecache_shard *s;
+
+  for (s = &nodecache[0]; s < &nodecache[NODECACHE_SHARDS]; s++)
+    {
+      pthread_rwlock_rdlock (&s->lock);
+      pthread_mutex_lock (&s->lru_lock);
+
+      for (node = s->changed; node; node = next)
+	{
+	  struct references result;
+
+	  next = node->changed_next;
+
+	  refcounts_references (&node->refcounts, &result);
+	  if (result.hard == 0)
+	    {
+	      /* It cannot change again before someone gets a hard
+		 reference or calls diskfs_node_changed, which put it back.
+		 They look whether it is on the list after their change,
+		 and we look for their change after taking it off.  */
+	      changed_unlink (s, node);
+	      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+	      refcounts_references (&node->refcounts, &result);
+	      if (result.hard > 0)
+		changed_link (s, node);
+	    }
+
+	  if (want && ! (*want)(node))
+	    continue;
+
+	  if (n == alloced)
+	    {
+	      size_t new_alloced = alloced ? 2 * alloced : 64;
+	      struct node **new_list;
+
+	      new_list = realloc (node_list, new_alloced * sizeof *node_list);
+	      if (new_list == NULL)
+		{
+		  /* Put back what we took off before failing.  */
+		  changed_link (s, node);
+		  pthread_mutex_unlock (&s->lru_lock);
+		  pthread_rwlock_unlock (&s->lock);
+		  while (n > 0)
+		    {
+		      node = node_list[--n];
+		      diskfs_node_changed (node);
+		      diskfs_nrele (node);
+		    }
+		  free (node_list);
+		  return ENOMEM;
+		}
+	      node_list = new_list;
+	      alloced = new_alloced;
+	    }
+
+	  /* As in collect, without calling diskfs_new_hardrefs.  */
+	  refcounts_ref (&node->refcounts, NULL);
+	  node_list[n++] = node;
+	}
+
+      pthread_mutex_unlock (&s->lru_lock);
+      pthread_rwlock_unlock (&s->lock);
+    }
+
+  *nodes = node_list;
+  *num_nodes = n;
+  return 0;
+}
+
 /* The user must define this function if she wants to use the node
    cache.  Create and initialize a node.  */
 error_t __attribute__ ((weak))
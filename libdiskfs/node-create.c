@@ -85,7 +85,7 @@ diskfs_create_node (struct node *dir,
   if (!_diskfs_no_inherit_dir_group)
     {
       newgid = dir->dn_stat.st_gid;
-      if (!idvec_contains (cred->user->gids, newgid))
+      if (!iohelp_iouser_has_gid (cred->user, newgid))
        mode &= ~S_ISGID;
     }
   else
@@ -100,7 +100,7 @@ diskfs_create_node (struct node *dir,
            mode |= S_ISGID;
          else
            {
-             if (!idvec_contains (cred->user->gids, newgid))
+             if (!iohelp_iouser_has_gid (cred->user, newgid))
                mode &= ~S_ISGID;
            }
        }
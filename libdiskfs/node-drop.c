@@ -93,8 +93,10 @@ diskfs_drop_node (struct node *np)
     free_modreqs (np->filemod_reqs);
 
   assert_backtrace (!np->sockaddr);
+  assert_backtrace (!np->ranges);
 
   pthread_mutex_unlock(&np->lock);
   pthread_mutex_destroy(&np->lock);
+  pthread_cond_destroy (&np->ranges_cond);
   diskfs_node_norefs (np);
 }
@@ -35,8 +35,18 @@ init_node (struct node *np, struct disknode *dn)
 
   np->dirmod_reqs = 0;
   np->dirmod_tick = 0;
+  _diskfs_new_dir_generation (np);
   np->filemod_reqs = 0;
   np->filemod_tick = 0;
+  np->lru_prev = np->lru_next = NULL;
+  np->lru_linked = 0;
+  np->changed_prev = np->changed_next = NULL;
+  np->changed_linked = 0;
+  np->ranges = NULL;
+  np->ranges_draining = 0;
+  pthread_cond_init (&np->ranges_cond, NULL);
+  np->stat_seq = 0;
+  np->stat_snapshot_valid = 0;
 
   fshelp_transbox_init (&np->transbox, &np->lock, np);
   iohelp_initialize_conch (&np->conch, &np->lock);
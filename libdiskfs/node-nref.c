@@ -28,6 +28,11 @@ diskfs_nref (struct node *np)
 {
   struct references result;
   refcounts_ref (&np->refcounts, &result);
+
+  /* Whoever holds a hard reference may change NP.  */
+  if (np->slot)
+    diskfs_node_changed (np);
+
   if (result.hard == 1)
     {
       pthread_mutex_lock (&np->lock);
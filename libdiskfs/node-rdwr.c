@@ -55,6 +55,7 @@ diskfs_node_rdwr (struct node *np,
 	{
 	  np->dn_stat.st_size = off + amt;
 	  np->dn_set_ctime = 1;
+	  np->dn_stat_dirty = 1;
 	}
       else
 	amt = np->dn_stat.st_size - off;
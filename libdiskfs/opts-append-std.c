@@ -22,8 +22,10 @@
 
 #include <stdio.h>
 #include <argz.h>
+#include <stdlib.h>
 
 #include "priv.h"
+#include "journal.h"
 
 error_t
 diskfs_append_std_options (char **argz, size_t *argz_len)
@@ -64,5 +66,123 @@ diskfs_append_std_options (char **argz, size_t *argz_len)
 	}
     }
 
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--journal-flush-delay=%u", journal_get_flush_delay ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--journal-flush-bytes=%zu", journal_get_flush_bytes ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80], policy[32];
+      journal_get_overflow (policy, sizeof policy);
+      sprintf (buf, "--journal-overflow=%s", policy);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--journal-log-level=%d", journal_get_log_level ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char *spec = journal_get_exclude ();
+      if (spec)
+	{
+	  char *buf;
+	  if (asprintf (&buf, "--journal-exclude=%s", spec) < 0)
+	    err = ENOMEM;
+	  else
+	    {
+	      err = argz_add (argz, argz_len, buf);
+	      free (buf);
+	    }
+	  free (spec);
+	}
+    }
+  if (! err)
+    {
+      char *spec = journal_get_durability ();
+      if (spec)
+	{
+	  char *buf;
+	  if (asprintf (&buf, "--journal-durability=%s", spec) < 0)
+	    err = ENOMEM;
+	  else
+	    {
+	      err = argz_add (argz, argz_len, buf);
+	      free (buf);
+	    }
+	  free (spec);
+	}
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--journal-compression=%s", journal_get_compression ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char *spec = journal_get_replica ();
+      if (spec)
+	{
+	  char *buf;
+	  if (asprintf (&buf, "--journal-replica=%s", spec) < 0)
+	    err = ENOMEM;
+	  else
+	    {
+	      err = argz_add (argz, argz_len, buf);
+	      free (buf);
+	    }
+	  free (spec);
+	}
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--journal-replica-policy=%s",
+	       journal_get_replica_policy ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--name-cache-size=%zu", diskfs_get_name_cache_size ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80];
+      sprintf (buf, "--node-cache-size=%zu", diskfs_get_node_cache_size ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err && diskfs_get_max_threads ())
+    {
+      char buf[80];
+      sprintf (buf, "--max-threads=%u", diskfs_get_max_threads ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      char buf[80];
+      unsigned int background, dirty;
+      diskfs_get_dirty_ratios (&background, &dirty);
+      sprintf (buf, "--dirty-background-ratio=%u", background);
+      err = argz_add (argz, argz_len, buf);
+      if (! err)
+	{
+	  sprintf (buf, "--dirty-ratio=%u", dirty);
+	  err = argz_add (argz, argz_len, buf);
+	}
+    }
+
   return err;
 }
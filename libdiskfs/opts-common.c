@@ -59,5 +59,48 @@ const struct argp_option diskfs_common_options[] =
   {"relatime", 'R', 0, 0,
     "Only update access times once daily or if older than change time "
     "or modification time."},
+  {"journal-flush-delay", OPT_JOURNAL_FLUSH_DELAY, "MS", 0,
+   "Flush queued journal events at most MS milliseconds after they are"
+   " logged (default 500)"},
+  {"journal-flush-bytes", OPT_JOURNAL_FLUSH_BYTES, "BYTES", 0,
+   "Flush the journal early once about BYTES of events are queued"
+   " (default 262144)"},
+  {"journal-overflow", OPT_JOURNAL_OVERFLOW, "POLICY", 0,
+   "What to do with journal events when the queue is full: drop, flush,"
+   " spill, or block[:MS] (default block:100)"},
+  {"journal-log-level", OPT_JOURNAL_LOG_LEVEL, "LEVEL", 0,
+   "How much the journal reports on stderr: 0 nothing, 1 errors,"
+   " 2 also debugging output (default 1)"},
+  {"journal-exclude", OPT_JOURNAL_EXCLUDE, "SPEC", 0,
+   "Do not journal the events SPEC lists, separated by commas: inode"
+   " numbers or ranges N-M, dir:N for what is done in the directory N,"
+   " and action:NAME"},
+  {"journal-durability", OPT_JOURNAL_DURABILITY, "SPEC", 0,
+   "How to write journal events, as a list of ACTION=POLICY and of a"
+   " POLICY for the other actions: default, sync, async or lazy[:MS]"},
+  {"journal-compression", OPT_JOURNAL_COMPRESSION, "METHOD", 0,
+   "Compress the journal records written together with METHOD: none"
+   " or lz4 (default none)"},
+  {"journal-replica", OPT_JOURNAL_REPLICA, "SPEC", 0,
+   "Also copy the journal to SPEC: a file or store, tcp:HOST:PORT or"
+   " unix:PATH for journalrecv, or none"},
+  {"journal-replica-policy", OPT_JOURNAL_REPLICA_POLICY, "POLICY", 0,
+   "Whether durable journal writes wait for the replica: async, the"
+   " default, or sync"},
+  {"name-cache-size", OPT_NAME_CACHE_SIZE, "ENTRIES", 0,
+   "Cache about ENTRIES directory lookups; 0 disables the cache"
+   " (default 8192)"},
+  {"node-cache-size", OPT_NODE_CACHE_SIZE, "NODES", 0,
+   "Keep about NODES unused nodes cached; 0 forgets them at once"
+   " (default 1024)"},
+  {"max-threads", OPT_MAX_THREADS, "THREADS", 0,
+   "Handle at most THREADS requests at once; 0 for no limit"
+   " (default 0)"},
+  {"dirty-background-ratio", OPT_DIRTY_BACKGROUND_RATIO, "PERCENT", 0,
+   "Write back once data written is PERCENT of memory; 0 leaves it to"
+   " the periodic sync (default 10)"},
+  {"dirty-ratio", OPT_DIRTY_RATIO, "PERCENT", 0,
+   "Make writers wait once data written is PERCENT of memory; 0 never"
+   " does (default 20)"},
   {0, 0}
 };
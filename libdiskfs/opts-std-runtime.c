@@ -21,6 +21,7 @@
 #include <argp.h>
 
 #include "priv.h"
+#include "journal.h"
 
 static const struct argp_option
 std_runtime_options[] =
@@ -34,6 +35,12 @@ struct parse_hook
 {
   int readonly, sync, sync_interval, remount, nosuid, noexec, noatime,
     noinheritdirgroup, relatime;
+  long journal_flush_delay, journal_flush_bytes, journal_log_level;
+  long name_cache_size, node_cache_size, max_threads;
+  long dirty_background_ratio, dirty_ratio;
+  const char *journal_overflow, *journal_exclude, *journal_durability;
+  const char *journal_compression, *journal_replica;
+  const char *journal_replica_policy;
 };
 
 /* Implement the options in H, and free H.  */
@@ -84,6 +91,40 @@ set_opts (struct parse_hook *h)
     _diskfs_relatime = h->relatime;
   if (h->noinheritdirgroup != -1)
     _diskfs_no_inherit_dir_group = h->noinheritdirgroup;
+  if (h->journal_flush_delay != -1)
+    journal_set_flush_delay (h->journal_flush_delay);
+  if (h->journal_flush_bytes != -1)
+    journal_set_flush_bytes (h->journal_flush_bytes);
+  if (h->journal_log_level != -1)
+    journal_set_log_level (h->journal_log_level);
+  if (h->journal_overflow && !err)
+    err = journal_set_overflow (h->journal_overflow);
+  if (h->journal_exclude && !err)
+    err = journal_set_exclude (h->journal_exclude);
+  if (h->journal_durability && !err)
+    err = journal_set_durability (h->journal_durability);
+  if (h->journal_compression && !err)
+    err = journal_set_compression (h->journal_compression);
+  if (h->journal_replica_policy && !err)
+    err = journal_set_replica_policy (h->journal_replica_policy);
+  if (h->journal_replica && !err)
+    err = journal_set_replica (h->journal_replica);
+  if (h->name_cache_size != -1 && !err)
+    err = diskfs_set_name_cache_size (h->name_cache_size);
+  if (h->node_cache_size != -1 && !err)
+    diskfs_set_node_cache_size (h->node_cache_size);
+  if (h->max_threads != -1 && !err)
+    diskfs_set_max_threads (h->max_threads);
+  if ((h->dirty_background_ratio != -1 || h->dirty_ratio != -1) && !err)
+    {
+      unsigned int background, dirty;
+      diskfs_get_dirty_ratios (&background, &dirty);
+      if (h->dirty_background_ratio != -1)
+	background = h->dirty_background_ratio;
+      if (h->dirty_ratio != -1)
+	dirty = h->dirty_ratio;
+      err = diskfs_set_dirty_ratios (background, dirty);
+    }
 
   free (h);
 
@@ -115,6 +156,52 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     case OPT_NO_INHERIT_DIR_GROUP: h->noinheritdirgroup = 1; break;
     case OPT_INHERIT_DIR_GROUP: h->noinheritdirgroup = 0; break;
     case 'n': h->sync_interval = 0; h->sync = 0; break;
+    case OPT_JOURNAL_FLUSH_DELAY:
+      h->journal_flush_delay = strtol (arg, NULL, 0);
+      if (h->journal_flush_delay < 0)
+	return EINVAL;
+      break;
+    case OPT_JOURNAL_FLUSH_BYTES:
+      h->journal_flush_bytes = strtol (arg, NULL, 0);
+      if (h->journal_flush_bytes < 0)
+	return EINVAL;
+      break;
+    case OPT_JOURNAL_OVERFLOW: h->journal_overflow = arg; break;
+    case OPT_JOURNAL_EXCLUDE: h->journal_exclude = arg; break;
+    case OPT_JOURNAL_DURABILITY: h->journal_durability = arg; break;
+    case OPT_JOURNAL_COMPRESSION: h->journal_compression = arg; break;
+    case OPT_JOURNAL_REPLICA: h->journal_replica = arg; break;
+    case OPT_JOURNAL_REPLICA_POLICY: h->journal_replica_policy = arg; break;
+    case OPT_JOURNAL_LOG_LEVEL:
+      h->journal_log_level = strtol (arg, NULL, 0);
+      if (h->journal_log_level < 0)
+	return EINVAL;
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      h->name_cache_size = strtol (arg, NULL, 0);
+      if (h->name_cache_size < 0)
+	return EINVAL;
+      break;
+    case OPT_NODE_CACHE_SIZE:
+      h->node_cache_size = strtol (arg, NULL, 0);
+      if (h->node_cache_size < 0)
+	return EINVAL;
+      break;
+    case OPT_MAX_THREADS:
+      h->max_threads = strtol (arg, NULL, 0);
+      if (h->max_threads < 0)
+	return EINVAL;
+      break;
+    case OPT_DIRTY_BACKGROUND_RATIO:
+      h->dirty_background_ratio = strtol (arg, NULL, 0);
+      if (h->dirty_background_ratio < 0)
+	return EINVAL;
+      break;
+    case OPT_DIRTY_RATIO:
+      h->dirty_ratio = strtol (arg, NULL, 0);
+      if (h->dirty_ratio < 0)
+	return EINVAL;
+      break;
     case 's':
       if (arg)
 	{
@@ -138,6 +225,13 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	  h->sync_interval = -1;
 	  h->remount = 0;
 	  h->nosuid = h->noexec = h->noatime = h->noinheritdirgroup = h->relatime = -1;
+	  h->journal_flush_delay = h->journal_flush_bytes = -1;
+	  h->journal_log_level = -1;
+	  h->name_cache_size = h->node_cache_size = h->max_threads = -1;
+	  h->dirty_background_ratio = h->dirty_ratio = -1;
+	  h->journal_overflow = h->journal_exclude = NULL;
+	  h->journal_durability = h->journal_compression = NULL;
+	  h->journal_replica = h->journal_replica_policy = NULL;
 
 	  /* We know that we have one child, with which we share our hook.  */
 	  state->child_inputs[0] = h;
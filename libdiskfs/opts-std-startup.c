@@ -23,15 +23,20 @@
 
 #include <stdio.h>
 #include <argp.h>
+#include <argz.h>
 #include <hurd/store.h>
 #include <hurd/paths.h>
 #include "priv.h"
+#include "journal.h"
 
 const char *diskfs_boot_command_line;
 char **_diskfs_boot_command;
 
 int _diskfs_boot_pause;
 
+char *_diskfs_activate_names;
+size_t _diskfs_activate_names_len;
+
 extern char **diskfs_argv;
 
 mach_port_t diskfs_exec_server_task = MACH_PORT_NULL;
@@ -47,6 +52,9 @@ mach_port_t diskfs_kernel_task = MACH_PORT_NULL;
 #define OPT_BOOT_INIT_PROGRAM	(-6)
 #define OPT_BOOT_PAUSE		(-7)
 #define OPT_KERNEL_TASK		(-8)
+#define OPT_JOURNAL		(-9)
+#define OPT_ACTIVATE		(-10)
+#define OPT_JOURNAL_SIZE	(-11)
 
 static const struct argp_option
 startup_options[] =
@@ -55,6 +63,11 @@ startup_options[] =
    "Use DIRECTORY as the root of the filesystem"},
   {"virtual-root",	 0, 0, OPTION_ALIAS},
   {"chroot",		 0, 0, OPTION_ALIAS},
+  {"journal",		 OPT_JOURNAL,		 "STORE", 0,
+   "Keep the metadata journal on STORE, a file name or a TYPE:NAME store"
+   " spec such as device:hd0s3"},
+  {"journal-size",	 OPT_JOURNAL_SIZE,	 "SIZE", 0,
+   "Format a new journal with SIZE bytes, from 1M to 1G (default 8M)"},
 
   {0,0,0,0, "Boot options:", -2},
   {"multiboot-command-line", OPT_BOOT_CMDLINE, "ARGS", 0,
@@ -71,6 +84,9 @@ startup_options[] =
   {"device-master-port", OPT_DEVICE_MASTER_PORT, "PORT"},
   {"exec-server-task",   OPT_EXEC_SERVER_TASK,   "PORT"},
   {"kernel-task",        OPT_KERNEL_TASK,        "PORT"},
+  {"activate",		 OPT_ACTIVATE,		 "FILE", 0,
+   "Once the system is up, start the passive translator on FILE in the"
+   " background; may be repeated, the translators starting concurrently"},
 
   {0}
 };
@@ -114,6 +130,69 @@ parse_startup_opt (int opt, char *arg, struct argp_state *state)
       diskfs_default_sync_interval = 0;
       break;
 
+    case OPT_JOURNAL_FLUSH_DELAY:
+      journal_set_flush_delay (atoi (arg));
+      break;
+    case OPT_JOURNAL_FLUSH_BYTES:
+      journal_set_flush_bytes (strtoul (arg, NULL, 0));
+      break;
+    case OPT_JOURNAL_OVERFLOW:
+      if (journal_set_overflow (arg))
+	argp_error (state, "%s: Unknown journal overflow policy", arg);
+      break;
+    case OPT_JOURNAL_EXCLUDE:
+      if (journal_set_exclude (arg))
+	argp_error (state, "%s: Invalid journal exclusion list", arg);
+      break;
+    case OPT_JOURNAL_DURABILITY:
+      if (journal_set_durability (arg))
+	argp_error (state, "%s: Invalid journal durability policy", arg);
+      break;
+    case OPT_JOURNAL_COMPRESSION:
+      if (journal_set_compression (arg))
+	argp_error (state, "%s: Unknown journal compression method", arg);
+      break;
+    case OPT_JOURNAL_REPLICA:
+      if (journal_set_replica (arg))
+	argp_error (state, "%s: Invalid journal replica", arg);
+      break;
+    case OPT_JOURNAL_REPLICA_POLICY:
+      if (journal_set_replica_policy (arg))
+	argp_error (state, "%s: Unknown journal replica policy", arg);
+      break;
+    case OPT_JOURNAL_LOG_LEVEL:
+      journal_set_log_level (atoi (arg));
+      break;
+    case OPT_JOURNAL:
+      journal_set_device (arg);
+      break;
+    case OPT_JOURNAL_SIZE:
+      if (journal_set_size (arg))
+	argp_error (state, "%s: Invalid journal size", arg);
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      diskfs_set_name_cache_size (strtoul (arg, NULL, 0));
+      break;
+    case OPT_NODE_CACHE_SIZE:
+      diskfs_set_node_cache_size (strtoul (arg, NULL, 0));
+      break;
+    case OPT_MAX_THREADS:
+      diskfs_set_max_threads (strtoul (arg, NULL, 0));
+      break;
+    case OPT_DIRTY_BACKGROUND_RATIO:
+    case OPT_DIRTY_RATIO:
+      {
+	unsigned int background, dirty;
+	diskfs_get_dirty_ratios (&background, &dirty);
+	if (opt == OPT_DIRTY_RATIO)
+	  dirty = strtoul (arg, NULL, 0);
+	else
+	  background = strtoul (arg, NULL, 0);
+	if (diskfs_set_dirty_ratios (background, dirty))
+	  argp_error (state, "%s: Invalid dirty ratio", arg);
+      }
+      break;
+
       /* Boot options */
     case OPT_DEVICE_MASTER_PORT:
       _hurd_device_master = atoi (arg); break;
@@ -131,6 +210,11 @@ parse_startup_opt (int opt, char *arg, struct argp_state *state)
       _diskfs_boot_pause = 1; break;
     case 'C':
       _diskfs_chroot_directory = arg; break;
+    case OPT_ACTIVATE:
+      if (argz_add (&_diskfs_activate_names, &_diskfs_activate_names_len,
+		    arg))
+	argp_failure (state, 1, ENOMEM, "--activate");
+      break;
 
     case OPT_BOOT_COMMAND:
       if (state->next == state->argc)
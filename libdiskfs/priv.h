@@ -28,6 +28,7 @@
 #include <hurd/iohelp.h>
 #include <hurd/port.h>
 #include <assert-backtrace.h>
+#include <shrinker.h>
 #include <argp.h>
 
 #include "diskfs.h"
@@ -53,6 +54,10 @@ extern char *_diskfs_chroot_directory;
 /* If --boot-command is given, this points to the program and args.  */
 extern char **_diskfs_boot_command;
 
+/* The files given with --activate, an argz vector.  */
+extern char *_diskfs_activate_names;
+extern size_t _diskfs_activate_names_len;
+
 /* Port cell holding a cached port to the exec server.  */
 extern struct hurd_port _diskfs_exec_portcell;
 
@@ -63,6 +68,20 @@ extern const struct argp_option diskfs_common_options[];
 #define OPT_ATIME	602	/* --atime */
 #define OPT_NO_INHERIT_DIR_GROUP	603	/* --no-inherit-dir-group */
 #define OPT_INHERIT_DIR_GROUP		604	/* --inherit-dir-group */
+#define OPT_JOURNAL_FLUSH_DELAY		605	/* --journal-flush-delay */
+#define OPT_JOURNAL_FLUSH_BYTES		606	/* --journal-flush-bytes */
+#define OPT_JOURNAL_OVERFLOW		607	/* --journal-overflow */
+#define OPT_JOURNAL_LOG_LEVEL		608	/* --journal-log-level */
+#define OPT_NAME_CACHE_SIZE		609	/* --name-cache-size */
+#define OPT_NODE_CACHE_SIZE		610	/* --node-cache-size */
+#define OPT_MAX_THREADS			611	/* --max-threads */
+#define OPT_DIRTY_BACKGROUND_RATIO	612	/* --dirty-background-ratio */
+#define OPT_DIRTY_RATIO			613	/* --dirty-ratio */
+#define OPT_JOURNAL_EXCLUDE		614	/* --journal-exclude */
+#define OPT_JOURNAL_DURABILITY		615	/* --journal-durability */
+#define OPT_JOURNAL_COMPRESSION		616	/* --journal-compression */
+#define OPT_JOURNAL_REPLICA		617	/* --journal-replica */
+#define OPT_JOURNAL_REPLICA_POLICY	618	/* --journal-replica-policy */
 
 /* Common value for diskfs_common_options and diskfs_default_sync_interval. */
 #define DEFAULT_SYNC_INTERVAL 30
@@ -89,6 +108,53 @@ error_t _diskfs_rdwr_internal (struct node *np, char *data, off_t offset,
                                mach_msg_type_number_t *amt,
                                int dir, int notime);
 
+/* A byte range of a file with a data transfer in progress.  */
+struct diskfs_range
+{
+  off_t start, end;
+  int write;
+  struct diskfs_range *next;
+};
+
+/* Register RANGE as a transfer of [START, END) of NP, for writing if
+   WRITE is set, and return 0.  If an overlapping transfer conflicts with
+   it, wait for that to finish instead without registering RANGE, and
+   return nonzero: NP was unlocked meanwhile, so the caller must check
+   the file again.  NP must be locked.  */
+int _diskfs_range_lock (struct node *np, struct diskfs_range *range,
+			off_t start, off_t end, int write);
+
+/* Unregister RANGE of NP, which must be locked.  */
+void _diskfs_range_unlock (struct node *np, struct diskfs_range *range);
+
+/* Wait until no transfer of NP reaches past START, as before NP is
+   truncated to START.  NP must be locked, but is unlocked while
+   waiting.  */
+void _diskfs_range_drain (struct node *np, off_t start);
+
+/* Like _diskfs_rdwr_internal, but NP, which must be a regular file, is
+   unlocked for the transfer itself, so that transfers of other parts of
+   it can proceed meanwhile.  RANGE must be registered for the transfer
+   with _diskfs_range_lock; it is unregistered before return, with NP
+   locked again.  */
+error_t _diskfs_rdwr_range (struct node *np, struct diskfs_range *range,
+			    char *data, off_t offset,
+			    mach_msg_type_number_t *amt,
+			    int dir, int notime);
+
+/* Read AMT bytes of regular file NP at OFFSET, which must be page
+   aligned, by mapping the file's pages copy-on-write into a new region,
+   which is returned in *DATA.  Other than that, this is like
+   _diskfs_rdwr_range for reading.  */
+error_t _diskfs_read_map (struct node *np, struct diskfs_range *range,
+			  off_t offset, vm_size_t amt, int notime,
+			  char **data);
+
+/* Write DATALEN bytes of DATA to the file open as CRED, as io_write
+   does, and return in *AMT how many were written.  */
+error_t _diskfs_io_write (struct protid *cred, const char *data,
+			  vm_size_t datalen, off_t offset, vm_size_t *amt);
+
 /* Called when we have a real user environment (complete with proc
    and auth ports). */
 void _diskfs_init_completed (void);
@@ -99,6 +165,40 @@ void _diskfs_boot_privports (void);
 /* Clean routine for control port. */
 void _diskfs_control_clean (void *);
 
+/* Gives unused nodes of the node cache back under memory pressure.  */
+extern struct shrinker _diskfs_node_cache_shrinker;
+
+/* How often, in milliseconds, the paging statistics are looked at to
+   tell whether the caches should shrink.  */
+#define DISKFS_SHRINK_INTERVAL 1000
+
+/* If NP is clean, save a copy of its stat information that
+   _diskfs_read_stat_snapshot can return.  NP is locked.  */
+void _diskfs_take_stat_snapshot (struct node *np);
+
+/* If NP is clean and has a copy of its stat information, copy it to
+   STATBUF without locking NP and return 1; otherwise return 0.  */
+int _diskfs_read_stat_snapshot (struct node *np, io_statbuf_t *statbuf);
+
+/* BYTES have just been written to a node through io_write, which was
+   clean before if NEW_NODE.  Start writing back if too much is dirty,
+   and wait for it if far too much is.  No node is locked.  */
+void _diskfs_note_dirty (size_t bytes, int new_node);
+
+/* Give NP a directory generation no node has had, invalidating the
+   negative lookup cache entries made in it.  NP is locked or new.  */
+void _diskfs_new_dir_generation (struct node *np);
+
+/* If the lookup cache knows that the LEN bytes at NAME name a node other
+   than DIR inside DIR, set *ID to it and return 1; otherwise return 0.
+   DIR is locked.  */
+int _diskfs_lookup_cache_id (struct node *dir, const char *name, size_t len,
+			     ino64_t *id);
+
+/* If node INUM is in the node cache, return it with a new hard reference
+   but unlocked; otherwise return NULL.  */
+struct node *_diskfs_cached_ref (ino_t inum);
+
 /* Called when the last hard reference is released.  If there are no
    links, then request soft references to be dropped.  */
 void _diskfs_lastref (struct node *np);
@@ -51,7 +51,8 @@ diskfs_finish_protid (struct protid *cred, struct iouser *user)
   assert_perror_backtrace (err);
 
   err = mach_port_move_member (mach_task_self (), cred->pi.port_right, 
-			       diskfs_port_bucket->portset);
+			       ports_bucket_portset (diskfs_port_bucket,
+						     &cred->pi));
   assert_perror_backtrace (err);
 }
 
@@ -30,6 +30,21 @@ diskfs_protid_rele (void *arg)
   if (cred->shared_object)
     mach_port_deallocate (mach_task_self (), cred->shared_object);
   if (cred->mapped)
-    munmap (cred->mapped, vm_page_size);
+    {
+      struct node *np = cred->po->np;
+
+      /* Nobody is left to release the conch if this user holds it:
+	 take what it left on the page and let waiters go on.  */
+      pthread_mutex_lock (&np->lock);
+      if (np->conch.holder == cred)
+	{
+	  iohelp_fetch_shared_data (cred);
+	  np->conch.holder = 0;
+	  np->conch.holder_shared_page = 0;
+	  pthread_cond_broadcast (&np->conch.wait);
+	}
+      pthread_mutex_unlock (&np->lock);
+      munmap (cred->mapped, vm_page_size);
+    }
   diskfs_release_peropen (cred->po);
 }
@@ -20,17 +20,27 @@
 #include <fcntl.h>
 #include <hurd/pager.h>
 
-/* Actually read or write a file.  The file size must already permit
-   the requested access.  NP is the file to read/write.  DATA is a buffer
-   to write from or fill on read.  OFFSET is the absolute address (-1
-   not permitted here); AMT is the size of the read/write to perform;
-   DIR is set for writing and clear for reading.  The inode must
-   be locked.  If NOTIME is set, then don't update the mtime or atime. */
-error_t
-_diskfs_rdwr_internal (struct node *np, char *data, off_t offset,
-                       mach_msg_type_number_t *amt, int dir, int notime)
+/* Note the access to NP in its times.  */
+static void
+note_access (struct node *np, int dir, int notime)
+{
+  if (!diskfs_check_readonly () && !notime)
+    {
+      if (dir)
+	np->dn_set_mtime = 1;
+      else if (atime_should_update (np))
+	np->dn_set_atime = 1;
+    }
+}
+
+/* Do the transfer of _diskfs_rdwr_internal for NP, unlocking NP during
+   pager_memcpy if RANGE is not NULL.  */
+static error_t
+rdwr (struct node *np, struct diskfs_range *range, char *data, off_t offset,
+      mach_msg_type_number_t *amt, int dir, int notime)
 {
   memory_object_t memobj;
+  struct pager *pager;
   vm_prot_t prot = dir ? (VM_PROT_READ | VM_PROT_WRITE) : VM_PROT_READ;
   error_t err = 0;
 
@@ -38,21 +48,25 @@ _diskfs_rdwr_internal (struct node *np, char *data, off_t offset,
     assert_backtrace (!diskfs_readonly);
 
   if (*amt == 0)
-    /* Zero-length writes do not update mtime or anything else, by POSIX.  */
-    return 0;
-
-  if (!diskfs_check_readonly () && !notime)
     {
-      if (dir)
-	np->dn_set_mtime = 1;
-      else if (atime_should_update (np))
-	np->dn_set_atime = 1;
+      /* Zero-length writes do not update mtime or anything else, by POSIX.  */
+      if (range)
+	_diskfs_range_unlock (np, range);
+      return 0;
     }
 
+  note_access (np, dir, notime);
+
   memobj = diskfs_get_filemap (np, prot);
 
   if (memobj == MACH_PORT_NULL)
-    return errno;
+    {
+      err = errno;
+      if (range)
+	_diskfs_range_unlock (np, range);
+      return err;
+    }
+  pager = diskfs_get_filemap_pager_struct (np);
 
   /* pager_memcpy inherently uses vm_offset_t, which may be smaller than off_t.  */
   if (sizeof(off_t) > sizeof(vm_offset_t) &&
@@ -61,20 +75,151 @@ _diskfs_rdwr_internal (struct node *np, char *data, off_t offset,
   else
     {
       size_t amount = *amt;
-      err = pager_memcpy (diskfs_get_filemap_pager_struct (np), memobj,
-                          offset, data, &amount, prot);
+
+      /* The send right to MEMOBJ keeps PAGER around.  */
+      if (range)
+	pthread_mutex_unlock (&np->lock);
+      err = pager_memcpy (pager, memobj, offset, data, &amount, prot);
+      if (range)
+	pthread_mutex_lock (&np->lock);
       if (!err)
         *amt = amount;
     }
 
-  if (!diskfs_check_readonly () && !notime)
+  if (range)
+    _diskfs_range_unlock (np, range);
+
+  note_access (np, dir, notime);
+
+  mach_port_deallocate (mach_task_self (), memobj);
+  return err;
+}
+
+/* Actually read or write a file.  The file size must already permit
+   the requested access.  NP is the file to read/write.  DATA is a buffer
+   to write from or fill on read.  OFFSET is the absolute address (-1
+   not permitted here); AMT is the size of the read/write to perform;
+   DIR is set for writing and clear for reading.  The inode must
+   be locked.  If NOTIME is set, then don't update the mtime or atime. */
+error_t
+_diskfs_rdwr_internal (struct node *np, char *data, off_t offset,
+                       mach_msg_type_number_t *amt, int dir, int notime)
+{
+  return rdwr (np, NULL, data, offset, amt, dir, notime);
+}
+
+error_t
+_diskfs_rdwr_range (struct node *np, struct diskfs_range *range,
+		    char *data, off_t offset,
+		    mach_msg_type_number_t *amt, int dir, int notime)
+{
+  assert_backtrace (S_ISREG (np->dn_stat.st_mode));
+  return rdwr (np, range, data, offset, amt, dir, notime);
+}
+
+error_t
+_diskfs_read_map (struct node *np, struct diskfs_range *range,
+		  off_t offset, vm_size_t amt, int notime, char **data)
+{
+  memory_object_t memobj;
+  vm_address_t addr = 0;
+  error_t err;
+
+  assert_backtrace (S_ISREG (np->dn_stat.st_mode));
+  assert_backtrace ((offset & (vm_page_size - 1)) == 0);
+
+  note_access (np, 0, notime);
+
+  memobj = diskfs_get_filemap (np, VM_PROT_READ);
+  if (memobj == MACH_PORT_NULL)
+    err = errno;
+  else if (sizeof(off_t) > sizeof(vm_offset_t) &&
+	   offset + amt > ((off_t) 1) << (sizeof(vm_offset_t) * 8))
+    err = EFBIG;
+  else
     {
-      if (dir)
-	np->dn_set_mtime = 1;
-      else if (atime_should_update (np))
-	np->dn_set_atime = 1;
+      /* The pages are only copied when someone writes to the file or
+	 to the region, and are read in when the region is touched, just
+	 as with the vm_copy done by pager_memcpy.  The end of the last
+	 page past AMT is whatever the file's mapping holds there.  */
+      pthread_mutex_unlock (&np->lock);
+      err = vm_map (mach_task_self (), &addr, round_page (amt), 0, 1,
+		    memobj, offset, 1, VM_PROT_READ | VM_PROT_WRITE,
+		    VM_PROT_READ | VM_PROT_WRITE, VM_INHERIT_NONE);
+      pthread_mutex_lock (&np->lock);
     }
 
-  mach_port_deallocate (mach_task_self (), memobj);
+  _diskfs_range_unlock (np, range);
+
+  if (!err)
+    {
+      note_access (np, 0, notime);
+      *data = (char *) addr;
+    }
+
+  if (memobj != MACH_PORT_NULL)
+    mach_port_deallocate (mach_task_self (), memobj);
   return err;
 }
+
+/* Transfers in progress on each node are kept in the unsorted list
+   NP->ranges, protected by NP->lock.  Readers share ranges, a writer
+   excludes everyone from its range.  There are rarely more than a few
+   transfers on one node at a time.  While someone waits in
+   _diskfs_range_drain, no new transfers start, so that a stream of them
+   can't hold up a truncation forever.  */
+
+int
+_diskfs_range_lock (struct node *np, struct diskfs_range *range,
+		    off_t start, off_t end, int write)
+{
+  struct diskfs_range *r;
+
+  if (np->ranges_draining)
+    {
+      pthread_cond_wait (&np->ranges_cond, &np->lock);
+      return 1;
+    }
+
+  for (r = np->ranges; r; r = r->next)
+    if (r->start < end && start < r->end && (write || r->write))
+      {
+	pthread_cond_wait (&np->ranges_cond, &np->lock);
+	return 1;
+      }
+
+  range->start = start;
+  range->end = end;
+  range->write = write;
+  range->next = np->ranges;
+  np->ranges = range;
+  return 0;
+}
+
+void
+_diskfs_range_unlock (struct node *np, struct diskfs_range *range)
+{
+  struct diskfs_range **rp;
+
+  for (rp = &np->ranges; *rp != range; rp = &(*rp)->next)
+    assert_backtrace (*rp);
+  *rp = range->next;
+  pthread_cond_broadcast (&np->ranges_cond);
+}
+
+void
+_diskfs_range_drain (struct node *np, off_t start)
+{
+  struct diskfs_range *r;
+
+  np->ranges_draining++;
+ again:
+  for (r = np->ranges; r; r = r->next)
+    if (r->end > start)
+      {
+	pthread_cond_wait (&np->ranges_cond, &np->lock);
+	goto again;
+      }
+  if (--np->ranges_draining == 0)
+    pthread_cond_broadcast (&np->ranges_cond);
+}
@@ -0,0 +1,103 @@
+/* Stat information for io_stat without locking the node
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include <string.h>
+
+/* Whoever changes dn_stat also sets dn_stat_dirty or one of the
+   dn_set_?time flags, and those are cleared only when the node is
+   written, after diskfs_forget_stat_snapshot.  So while a node is clean
+   its stat information is what it was when it was last found clean, and
+   a copy made then can be returned without taking the lock -- which we
+   would only need to hold off changes that the flags tell us of anyway.
+
+   The copy is guarded by a sequence count, odd while it is being
+   changed under the node's lock; a reader retries should the count
+   change while it looks.  The flags are looked at within the same
+   window, so that a node that was written meanwhile, and is clean
+   again, is noticed by the count.  */
+
+/* Whether NP has changes not reflected in a copy of its stat made when
+   it was clean, or data on a shared page that io_stat must fetch.  */
+static inline int
+stat_busy (struct node *np)
+{
+  return (np->dn_set_ctime || np->dn_set_atime || np->dn_set_mtime
+	  || np->dn_stat_dirty || np->conch.holder);
+}
+
+static inline void
+write_begin (struct node *np)
+{
+  __atomic_store_n (&np->stat_seq, np->stat_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void
+write_end (struct node *np)
+{
+  __atomic_store_n (&np->stat_seq, np->stat_seq + 1, __ATOMIC_RELEASE);
+}
+
+void
+_diskfs_take_stat_snapshot (struct node *np)
+{
+  if (stat_busy (np))
+    return;
+
+  write_begin (np);
+  memcpy (&np->stat_snapshot, &np->dn_stat, sizeof np->stat_snapshot);
+  np->stat_snapshot_valid = 1;
+  write_end (np);
+}
+
+void
+diskfs_forget_stat_snapshot (struct node *np)
+{
+  if (! np->stat_snapshot_valid)
+    return;
+
+  write_begin (np);
+  np->stat_snapshot_valid = 0;
+  write_end (np);
+}
+
+int
+_diskfs_read_stat_snapshot (struct node *np, io_statbuf_t *statbuf)
+{
+  unsigned int seq;
+  int tries, ok;
+
+  for (tries = 0; tries < 4; tries++)
+    {
+      seq = __atomic_load_n (&np->stat_seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+	continue;
+
+      ok = np->stat_snapshot_valid && ! stat_busy (np);
+      if (ok)
+	memcpy (statbuf, &np->stat_snapshot, sizeof *statbuf);
+
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&np->stat_seq, __ATOMIC_RELAXED) == seq)
+	return ok;
+    }
+
+  return 0;
+}
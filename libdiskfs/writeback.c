@@ -0,0 +1,221 @@
+/* Background writeback and throttling of writers
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <mach/vm_statistics.h>
+
+/* The kernel keeps the dirty pages of our pagers, and does not tell us
+   how many there are, so we count the bytes written through io_write
+   since the last writeback instead, and the nodes that were clean
+   before.  Once either is past its background limit, a thread writes
+   everything back; a writer finding the bytes past the dirty limit
+   waits for it, so that no writer gets far enough ahead of the disk for
+   a flush to stall everyone else.  The limits are percentages of
+   physical memory, looked at again on each writeback.  */
+
+/* Percentages of physical memory.  */
+static unsigned int background_ratio = 10;
+static unsigned int dirty_ratio = 20;
+
+/* The limits in bytes; 0 if there are none.  */
+static size_t background_bytes;
+static size_t dirty_bytes_limit;
+
+/* Written since the last writeback began.  */
+static size_t dirty_bytes;
+static size_t dirty_nodes;
+
+static pthread_mutex_t writeback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeback_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writeback_done = PTHREAD_COND_INITIALIZER;
+static int writeback_thread_started;
+static int writeback_pending;
+
+/* Number of writebacks done, so waiting writers see progress.  */
+static unsigned int writeback_generation;
+
+/* Compute the limits from the ratios.  WRITEBACK_LOCK is held.  */
+static void
+update_limits (void)
+{
+  struct vm_statistics vmstats;
+  size_t mem;
+
+  if (vm_statistics (mach_task_self (), &vmstats))
+    return;
+
+  mem = ((size_t) vmstats.free_count + vmstats.active_count
+	 + vmstats.inactive_count + vmstats.wire_count) * vmstats.pagesize;
+  __atomic_store_n (&background_bytes, mem / 100 * background_ratio,
+		    __ATOMIC_RELAXED);
+  __atomic_store_n (&dirty_bytes_limit, mem / 100 * dirty_ratio,
+		    __ATOMIC_RELAXED);
+}
+
+/* Whether a writeback is due.  */
+static inline int
+over_background (size_t bytes, size_t nodes)
+{
+  size_t limit = __atomic_load_n (&background_bytes, __ATOMIC_RELAXED);
+  size_t max_nodes = diskfs_get_node_cache_size ();
+
+  return ((limit && bytes > limit)
+	  || (limit && max_nodes && nodes > max_nodes));
+}
+
+static void *
+writeback_thread (void *arg)
+{
+  size_t bytes, nodes;
+
+  pthread_mutex_lock (&writeback_lock);
+  for (;;)
+    {
+      while (! writeback_pending)
+	pthread_cond_wait (&writeback_wakeup, &writeback_lock);
+
+      /* What is written from now on waits for the next round.  */
+      bytes = __atomic_load_n (&dirty_bytes, __ATOMIC_RELAXED);
+      nodes = __atomic_load_n (&dirty_nodes, __ATOMIC_RELAXED);
+      pthread_mutex_unlock (&writeback_lock);
+
+      pthread_rwlock_rdlock (&diskfs_fsys_lock);
+      if (! diskfs_readonly)
+	diskfs_sync_everything (1);
+      pthread_rwlock_unlock (&diskfs_fsys_lock);
+
+      pthread_mutex_lock (&writeback_lock);
+      /* Only writers add to the counts meanwhile.  */
+      bytes = __atomic_sub_fetch (&dirty_bytes, bytes, __ATOMIC_RELAXED);
+      nodes = __atomic_sub_fetch (&dirty_nodes, nodes, __ATOMIC_RELAXED);
+      update_limits ();
+      writeback_pending = over_background (bytes, nodes);
+      writeback_generation++;
+      pthread_cond_broadcast (&writeback_done);
+    }
+
+  return NULL;
+}
+
+/* Have the writeback thread run.  WRITEBACK_LOCK is held.  Return
+   nonzero if there is no thread to wait for.  */
+static int
+start_writeback (void)
+{
+  if (! writeback_thread_started)
+    {
+      pthread_t thread;
+      error_t err;
+
+      err = pthread_create (&thread, NULL, writeback_thread, NULL);
+      if (err)
+	{
+	  errno = err;
+	  perror ("pthread_create");
+	  return 1;
+	}
+      pthread_detach (thread);
+      writeback_thread_started = 1;
+    }
+
+  if (! writeback_pending)
+    {
+      writeback_pending = 1;
+      pthread_cond_signal (&writeback_wakeup);
+    }
+  return 0;
+}
+
+void
+_diskfs_note_dirty (size_t bytes, int new_node)
+{
+  size_t total, nodes;
+  unsigned int generation;
+  struct timespec timeout;
+
+  if (! __atomic_load_n (&background_ratio, __ATOMIC_RELAXED))
+    return;
+
+  total = __atomic_add_fetch (&dirty_bytes, bytes, __ATOMIC_RELAXED);
+  nodes = new_node ? __atomic_add_fetch (&dirty_nodes, 1, __ATOMIC_RELAXED)
+		   : __atomic_load_n (&dirty_nodes, __ATOMIC_RELAXED);
+  if (__atomic_load_n (&background_bytes, __ATOMIC_RELAXED)
+      && ! over_background (total, nodes))
+    return;
+
+  pthread_mutex_lock (&writeback_lock);
+  if (! background_bytes)
+    {
+      update_limits ();
+      if (! over_background (total, nodes))
+	{
+	  pthread_mutex_unlock (&writeback_lock);
+	  return;
+	}
+    }
+
+  if (start_writeback ())
+    {
+      pthread_mutex_unlock (&writeback_lock);
+      return;
+    }
+
+  /* Past the dirty limit, wait for a writeback to finish.  Don't wait
+     forever should the disk be stuck; the writer is slowed down
+     enough.  */
+  generation = writeback_generation;
+  clock_gettime (CLOCK_REALTIME, &timeout);
+  timeout.tv_sec += 1;
+  while (dirty_bytes_limit && writeback_generation == generation
+	 && __atomic_load_n (&dirty_bytes, __ATOMIC_RELAXED) > dirty_bytes_limit)
+    if (pthread_cond_timedwait (&writeback_done, &writeback_lock, &timeout)
+	== ETIMEDOUT)
+      break;
+
+  pthread_mutex_unlock (&writeback_lock);
+}
+
+error_t
+diskfs_set_dirty_ratios (unsigned int background, unsigned int dirty)
+{
+  if (background > 100 || dirty > 100)
+    return EINVAL;
+
+  pthread_mutex_lock (&writeback_lock);
+  __atomic_store_n (&background_ratio, background, __ATOMIC_RELAXED);
+  dirty_ratio = dirty;
+  __atomic_store_n (&background_bytes, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&dirty_bytes_limit, 0, __ATOMIC_RELAXED);
+  if (background)
+    update_limits ();
+  pthread_mutex_unlock (&writeback_lock);
+  return 0;
+}
+
+void
+diskfs_get_dirty_ratios (unsigned int *background, unsigned int *dirty)
+{
+  pthread_mutex_lock (&writeback_lock);
+  *background = background_ratio;
+  *dirty = dirty_ratio;
+  pthread_mutex_unlock (&writeback_lock);
+}
@@ -0,0 +1,85 @@
+/* Starting passive translators ahead of their first use
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <argz.h>
+#include <errno.h>
+#include <error.h>
+#include <hurd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fshelp.h"
+
+/* Passive translators are started on the first lookup of their node,
+   so whoever gets there first waits for the translator to come up, and
+   at boot each waits in turn.  Looking the nodes up beforehand, each in
+   a thread of its own, overlaps their startup instead.  Translators
+   that need one another still wait for each other: the lookup of a
+   node whose translator is being started waits for it in
+   fshelp_fetch_root.  */
+
+static void *
+activate_one (void *arg)
+{
+  char *name = arg;
+  file_t node;
+
+  node = file_name_lookup (name, 0, 0);
+  if (node == MACH_PORT_NULL)
+    error (0, errno, "Cannot start the translator on %s", name);
+  else
+    mach_port_deallocate (mach_task_self (), node);
+
+  free (name);
+  return NULL;
+}
+
+/* Start the translators on the nodes named in the argz vector NAMES of
+   length NAMES_LEN, all at the same time and in the background.  The
+   names are looked up from our root directory, and failures are
+   reported on stderr.  */
+error_t
+fshelp_activate_translators (const char *names, size_t names_len)
+{
+  const char *name;
+  error_t err = 0;
+
+  for (name = argz_next (names, names_len, NULL);
+       name;
+       name = argz_next (names, names_len, name))
+    {
+      pthread_t thread;
+      char *copy;
+
+      copy = strdup (name);
+      if (! copy)
+	return ENOMEM;
+
+      err = pthread_create (&thread, NULL, activate_one, copy);
+      if (err)
+	{
+	  free (copy);
+	  return err;
+	}
+      pthread_detach (thread);
+    }
+
+  return 0;
+}
@@ -23,6 +23,7 @@
 void
 fshelp_drop_transbox (struct transbox *box)
 {
+  fshelp_drop_cached_roots (box);
   if (box->active != MACH_PORT_NULL)
     mach_port_deallocate (mach_task_self (), box->active);
 }
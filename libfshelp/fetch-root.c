@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1995,96,99,2000,02 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,99,2000,02,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
 
    This file is part of the GNU Hurd.
@@ -26,10 +26,129 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <idvec.h>
 #include <sys/sysmacros.h>
 
 #include "fshelp.h"
 
+/* How many roots fshelp_fetch_root_cached keeps for each translator.  */
+#define CACHED_ROOTS_MAX 8
+
+struct fshelp_cached_root
+{
+  struct fshelp_cached_root *next;
+  mach_port_t root;
+  struct iouser *user;
+  int flags;
+  size_t context_len;
+  char context[];
+};
+
+static void
+free_cached_root (struct fshelp_cached_root *c)
+{
+  mach_port_deallocate (mach_task_self (), c->root);
+  iohelp_free_iouser (c->user);
+  free (c);
+}
+
+void
+fshelp_drop_cached_roots (struct transbox *box)
+{
+  struct fshelp_cached_root *c;
+
+  while ((c = box->roots))
+    {
+      box->roots = c->next;
+      free_cached_root (c);
+    }
+}
+
+/* Look for a root of BOX kept for CONTEXT, USER and FLAGS.  If there
+   is one, return a new send right for it in *ROOT and return 1.  BOX
+   is locked.  */
+static int
+find_cached_root (struct transbox *box,
+		  const void *context, size_t context_len,
+		  struct iouser *user, int flags, file_t *root)
+{
+  struct fshelp_cached_root **prevp, *c;
+  mach_port_type_t type;
+
+  for (prevp = &box->roots; (c = *prevp); prevp = &c->next)
+    if (c->flags == flags
+	&& c->context_len == context_len
+	&& ! memcmp (c->context, context, context_len)
+	&& idvec_equal (c->user->uids, user->uids)
+	&& idvec_equal (c->user->gids, user->gids))
+      {
+	*prevp = c->next;
+
+	if (mach_port_type (mach_task_self (), c->root, &type)
+	    || (type & MACH_PORT_TYPE_DEAD_NAME)
+	    || mach_port_mod_refs (mach_task_self (), c->root,
+				   MACH_PORT_RIGHT_SEND, 1))
+	  /* The translator has let go of it.  */
+	  {
+	    free_cached_root (c);
+	    return 0;
+	  }
+
+	/* Keep the most recently used first.  */
+	c->next = box->roots;
+	box->roots = c;
+	*root = c->root;
+	return 1;
+      }
+
+  return 0;
+}
+
+/* Keep ROOT, which the translator of BOX returned for CONTEXT, USER and
+   FLAGS; the caller keeps its own send right.  BOX is locked.  */
+static void
+cache_root (struct transbox *box,
+	    const void *context, size_t context_len,
+	    struct iouser *user, int flags, file_t root)
+{
+  struct fshelp_cached_root *c, **prevp;
+  int n;
+
+  c = malloc (sizeof *c + context_len);
+  if (! c)
+    return;
+  if (iohelp_dup_iouser (&c->user, user))
+    {
+      free (c);
+      return;
+    }
+  if (mach_port_mod_refs (mach_task_self (), root,
+			  MACH_PORT_RIGHT_SEND, 1))
+    {
+      iohelp_free_iouser (c->user);
+      free (c);
+      return;
+    }
+
+  c->root = root;
+  c->flags = flags;
+  c->context_len = context_len;
+  memcpy (c->context, context, context_len);
+  c->next = box->roots;
+  box->roots = c;
+
+  /* Forget the least recently used ones beyond the limit.  */
+  for (n = 0, prevp = &box->roots; *prevp; n++)
+    if (n >= CACHED_ROOTS_MAX)
+      {
+	c = *prevp;
+	*prevp = c->next;
+	free_cached_root (c);
+      }
+    else
+      prevp = &(*prevp)->next;
+}
+
 error_t
 fshelp_fetch_root (struct transbox *box, void *cookie,
 		   file_t dotdot,
@@ -39,6 +158,22 @@ fshelp_fetch_root (struct transbox *box, void *cookie,
 		   fshelp_fetch_root_callback2_t callback2,
 		   retry_type *retry, char *retryname,
 		   file_t *root)
+{
+  return fshelp_fetch_root_cached (box, cookie, dotdot, NULL, 0, user, flags,
+				   callback1, callback2,
+				   retry, retryname, root);
+}
+
+error_t
+fshelp_fetch_root_cached (struct transbox *box, void *cookie,
+			  file_t dotdot,
+			  const void *context, size_t context_len,
+			  struct iouser *user,
+			  int flags,
+			  fshelp_fetch_root_callback1_t callback1,
+			  fshelp_fetch_root_callback2_t callback2,
+			  retry_type *retry, char *retryname,
+			  file_t *root)
 {
   error_t err;
   mach_port_t control;
@@ -179,6 +314,14 @@ fshelp_fetch_root (struct transbox *box, void *cookie,
       box->active = control;
     }
 
+  if (context
+      && find_cached_root (box, context, context_len, user, flags, root))
+    {
+      *retry = FS_RETRY_NORMAL;
+      *retryname = '\0';
+      return 0;
+    }
+
   control = box->active;
   mach_port_mod_refs (mach_task_self (), control,
 		      MACH_PORT_RIGHT_SEND, 1);
@@ -192,6 +335,10 @@ fshelp_fetch_root (struct transbox *box, void *cookie,
 
   pthread_mutex_lock (box->lock);
 
+  if (! err && context && control == box->active
+      && *retry == FS_RETRY_NORMAL && *retryname == '\0')
+    cache_root (box, context, context_len, user, flags, *root);
+
   if ((err == MACH_SEND_INVALID_DEST || err == MIG_SERVER_DIED)
       && control == box->active)
     fshelp_set_active (box, MACH_PORT_NULL, 0);
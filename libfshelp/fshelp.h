@@ -139,6 +139,8 @@ fshelp_start_translator (fshelp_open_fn_t underlying_open_fn, void *cookie,
    use the passive translator routines above, but they don't require
    the ports library at all.  */
 
+struct fshelp_cached_root;
+
 struct transbox
 {
   fsys_t active;
@@ -146,6 +148,7 @@ struct transbox
   int flags;
   pthread_cond_t wakeup;
   void *cookie;
+  struct fshelp_cached_root *roots; /* see fshelp_fetch_root_cached */
 };
 #define TRANSBOX_STARTING 1
 #define TRANSBOX_WANTED 2
@@ -208,6 +211,31 @@ fshelp_fetch_root (struct transbox *transbox, void *cookie,
 		   fshelp_fetch_root_callback2_t callback2,
 		   retry_type *retry, char *retryname, mach_port_t *root);
 
+/* Like fshelp_fetch_root, but keep the root that the active translator
+   returns for USER and FLAGS, and return it again to the next call with
+   the same USER, FLAGS and CONTEXT instead of asking the translator.
+   CONTEXT_LEN bytes at CONTEXT must tell what DOTDOT leads to, since the
+   translator keeps the DOTDOT of the first call; the objects they name
+   must be kept alive by DOTDOT.  Only roots returned with FS_RETRY_NORMAL
+   and an empty retry name are kept, and the same port is given to each
+   caller, so this is only meant for lookups that go on through the root
+   rather than open it.  The roots are forgotten when they die or the
+   active translator changes.  */
+error_t
+fshelp_fetch_root_cached (struct transbox *transbox, void *cookie,
+			  file_t dotdot,
+			  const void *context, size_t context_len,
+			  struct iouser *user,
+			  int flags,
+			  fshelp_fetch_root_callback1_t callback1,
+			  fshelp_fetch_root_callback2_t callback2,
+			  retry_type *retry, char *retryname,
+			  mach_port_t *root);
+
+/* Forget the roots kept by fshelp_fetch_root_cached for TRANSBOX, which
+   is locked.  */
+void fshelp_drop_cached_roots (struct transbox *transbox);
+
 void
 fshelp_transbox_init (struct transbox *transbox,
 		      pthread_mutex_t *lock,
@@ -259,7 +287,7 @@ error_t fshelp_acquire_lock (struct lock_box *box, int *user,
 /* Unique to a node; initialize with fshelp_rlock_init.  */
 struct rlock_box
 {
-  struct rlock_list *locks;	/* List of locks on the file.  */
+  struct rlock_list *locks;	/* Tree of locks on the file.  */
 };
 
 error_t fshelp_rlock_init (struct rlock_box *box);
@@ -284,6 +312,8 @@ struct rlock_peropen
        o the list of locks owned by this peropen
        o the unique peropen identifier that all locks on this peropen share.  */
   struct rlock_list **locks;
+  /* The tree of the locks owned by this peropen.  */
+  struct rlock_list *index;
 };
 
 error_t fshelp_rlock_po_init (struct rlock_peropen *po);
@@ -298,6 +328,7 @@ error_t fshelp_rlock_po_init (struct rlock_peropen *po)
     return ENOMEM;
 
   *po->locks = NULL;
+  po->index = NULL;
   return 0;
 }
 
@@ -376,6 +407,12 @@ error_t fshelp_get_identity (struct port_bucket *bucket,
    concocted by appending ARGV[0] to _SERVERS.  */
 error_t fshelp_delegate_translation (const char *server_name,
 				     mach_port_t requestor, char **argv);
+
+/* Start the translators on the nodes named in the argz vector NAMES of
+   length NAMES_LEN, all at the same time and in the background, rather
+   than waiting for the first lookup of each.  The names are looked up
+   from our root directory, and failures are reported on stderr.  */
+error_t fshelp_activate_translators (const char *names, size_t names_len);
 
 struct idvec;			/* Include <idvec.h> to get the real thing. */
 
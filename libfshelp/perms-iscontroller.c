@@ -30,9 +30,9 @@ fshelp_iscontroller (struct stat *st, struct iouser *user)
 {
   /* Permitted if USER has the superuser uid, the owner uid or if the
      USER has authority over the process's effective id.  */
-  if (idvec_contains (user->uids, 0)
-      || idvec_contains (user->uids, st->st_uid)
-      || idvec_contains (user->uids, geteuid ()))
+  if (iohelp_iouser_has_uid (user, 0)
+      || iohelp_iouser_has_uid (user, st->st_uid)
+      || iohelp_iouser_has_uid (user, geteuid ()))
     return 0;
   return EPERM;
 }
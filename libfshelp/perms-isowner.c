@@ -29,10 +29,10 @@ fshelp_isowner (struct stat *st, struct iouser *user)
   /* Permitted if the user has the owner UID, the superuser UID, or if
      the user is in the group of the file and has the group ID as
      their user ID.  */
-  if (idvec_contains (user->uids, st->st_uid)
-      || idvec_contains (user->uids, 0)
-      || (idvec_contains (user->gids, st->st_gid)
-	  && idvec_contains (user->uids, st->st_gid)))
+  if (iohelp_iouser_has_uid (user, st->st_uid)
+      || iohelp_iouser_has_uid (user, 0)
+      || (iohelp_iouser_has_gid (user, st->st_gid)
+	  && iohelp_iouser_has_uid (user, st->st_gid)))
     return 0;
   else
     return EPERM;
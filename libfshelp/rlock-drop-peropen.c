@@ -38,12 +38,14 @@ fshelp_rlock_drop_peropen (struct rlock_peropen *po)
 	  pthread_cond_broadcast (&l->wait);
 	}
 
-      list_unlink (node, l);
+      tree_remove (node, &l->box->locks, l);
       pthread_cond_destroy(&l->wait);
 
       t = l->po.next;
       free (l);
     }
 
+  *po->locks = NULL;
+  po->index = NULL;
   return 0;
 }
@@ -39,14 +39,12 @@ int fshelp_rlock_peropen_status (struct rlock_peropen *po)
 /* Like fshelp_rlock_peropen_status except for all users of NODE.  */
 int fshelp_rlock_node_status (struct rlock_box *box)
 {
-  struct rlock_list *l;
-
   if (! box->locks)
     return LOCK_UN;
 
-  for (l = box->locks; l; l = l->node.next)
-    if (l->type == F_WRLCK)
-      return LOCK_EX;
+  /* The root knows whether there is a write lock in the tree.  */
+  if (box->locks->node.max_write_end > 0)
+    return LOCK_EX;
 
   return LOCK_SH;
 }
@@ -0,0 +1,204 @@
+/* Trees of record locks
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "fshelp.h"
+#include "rlock.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+
+#define LINK(l) ((struct rlock_tree_link *) ((char *) (l) + link))
+
+/* Whether A comes before B in a tree.  Locks of different peropens may
+   start at the same offset; their addresses tell them apart.  */
+static inline int
+before (struct rlock_list *a, struct rlock_list *b)
+{
+  return a->start < b->start || (a->start == b->start && a < b);
+}
+
+static inline uint32_t
+priority (struct rlock_list *l)
+{
+  return (uint32_t) ((uintptr_t) l >> 4) * 0x9e3779b1;
+}
+
+/* Recompute the furthest ends of the subtree rooted at L.  No lock
+   ends at 0, so that is the furthest end of no write lock.  */
+static inline void
+fixup (struct rlock_list *l, size_t link)
+{
+  struct rlock_tree_link *t = LINK (l);
+  loff_t end = rlock_end (l);
+  loff_t write_end = l->type == F_WRLCK ? end : 0;
+
+  if (t->left)
+    {
+      if (LINK (t->left)->max_end > end)
+	end = LINK (t->left)->max_end;
+      if (LINK (t->left)->max_write_end > write_end)
+	write_end = LINK (t->left)->max_write_end;
+    }
+  if (t->right)
+    {
+      if (LINK (t->right)->max_end > end)
+	end = LINK (t->right)->max_end;
+      if (LINK (t->right)->max_write_end > write_end)
+	write_end = LINK (t->right)->max_write_end;
+    }
+  t->max_end = end;
+  t->max_write_end = write_end;
+}
+
+void
+_fshelp_rlock_tree_insert (struct rlock_list **root, struct rlock_list *l,
+			   size_t link)
+{
+  struct rlock_list *r = *root;
+
+  if (! r)
+    {
+      LINK (l)->left = LINK (l)->right = NULL;
+      fixup (l, link);
+      *root = l;
+      return;
+    }
+
+  if (before (l, r))
+    {
+      _fshelp_rlock_tree_insert (&LINK (r)->left, l, link);
+      if (priority (LINK (r)->left) > priority (r))
+	/* Rotate right.  */
+	{
+	  struct rlock_list *p = LINK (r)->left;
+	  LINK (r)->left = LINK (p)->right;
+	  LINK (p)->right = r;
+	  fixup (r, link);
+	  r = *root = p;
+	}
+    }
+  else
+    {
+      _fshelp_rlock_tree_insert (&LINK (r)->right, l, link);
+      if (priority (LINK (r)->right) > priority (r))
+	/* Rotate left.  */
+	{
+	  struct rlock_list *p = LINK (r)->right;
+	  LINK (r)->right = LINK (p)->left;
+	  LINK (p)->left = r;
+	  fixup (r, link);
+	  r = *root = p;
+	}
+    }
+
+  fixup (r, link);
+}
+
+/* Join the trees A and B, all the locks of A being before those of B.  */
+static struct rlock_list *
+join (struct rlock_list *a, struct rlock_list *b, size_t link)
+{
+  if (! a)
+    return b;
+  if (! b)
+    return a;
+
+  if (priority (a) > priority (b))
+    {
+      LINK (a)->right = join (LINK (a)->right, b, link);
+      fixup (a, link);
+      return a;
+    }
+  else
+    {
+      LINK (b)->left = join (a, LINK (b)->left, link);
+      fixup (b, link);
+      return b;
+    }
+}
+
+void
+_fshelp_rlock_tree_remove (struct rlock_list **root, struct rlock_list *l,
+			   size_t link)
+{
+  struct rlock_list *r = *root;
+
+  if (! r)
+    return;
+
+  if (r == l)
+    *root = join (LINK (l)->left, LINK (l)->right, link);
+  else
+    {
+      if (before (l, r))
+	_fshelp_rlock_tree_remove (&LINK (r)->left, l, link);
+      else
+	_fshelp_rlock_tree_remove (&LINK (r)->right, l, link);
+      fixup (r, link);
+    }
+}
+
+struct rlock_list *
+_fshelp_rlock_tree_prev (struct rlock_list *root, struct rlock_list *l,
+			 size_t link)
+{
+  struct rlock_list *prev = NULL;
+
+  while (root)
+    if (before (root, l))
+      {
+	prev = root;
+	root = LINK (root)->right;
+      }
+    else
+      root = LINK (root)->left;
+
+  return prev;
+}
+
+struct rlock_list *
+_fshelp_rlock_tree_overlap (struct rlock_list *root, loff_t start, loff_t end,
+			    int writes, size_t link,
+			    int (*match) (struct rlock_list *, void *),
+			    void *arg)
+{
+  struct rlock_list *l;
+
+  /* Nothing in this subtree reaches START.  */
+  if (! root
+      || (writes ? LINK (root)->max_write_end : LINK (root)->max_end) <= start)
+    return NULL;
+
+  l = _fshelp_rlock_tree_overlap (LINK (root)->left, start, end, writes,
+				  link, match, arg);
+  if (l)
+    return l;
+
+  /* This lock and those after it start past END.  */
+  if (root->start >= end)
+    return NULL;
+
+  if (rlock_end (root) > start
+      && (! writes || root->type == F_WRLCK)
+      && (! match || match (root, arg)))
+    return root;
+
+  return _fshelp_rlock_tree_overlap (LINK (root)->right, start, end, writes,
+				     link, match, arg);
+}
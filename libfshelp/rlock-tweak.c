@@ -30,12 +30,12 @@
 #include <hurd.h>
 #include <hurd/process.h>
 
-static inline long overlap (loff_t start, loff_t len, struct rlock_list *l)
+/* Whether the lock L, overlapping the region requested, is not one of
+   those of the peropen whose identifier is PO_ID.  */
+static int
+conflicts (struct rlock_list *l, void *po_id)
 {
-  return ((len == 0 && l->len == 0)
-	  || (len == 0 && l->start + l->len > start)
-	  || (l->len == 0 && start + len > l->start)
-	  || (l->start + l->len > start && start + len > l->start));
+  return l->po_id != po_id;
 }
 
 error_t
@@ -44,6 +44,20 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		    loff_t obj_size, loff_t cur_pointer, int cmd,
 		    struct flock64 *lock, mach_port_t rendezvous)
 {
+  inline void
+  link_lock (struct rlock_list *l)
+    {
+      struct rlock_list *prev;
+
+      tree_insert (node, &box->locks, l);
+      tree_insert (po_tree, &po->index, l);
+
+      /* A new lock may start where one being split does until the
+	 latter is reshaped; it is then put back after the former.  */
+      prev = tree_prev (po_tree, po->index, l);
+      list_link (po, prev ? &prev->po.next : po->locks, l);
+    }
+
   inline struct rlock_list *
   gen_lock (loff_t start, loff_t len, int type)
     {
@@ -55,17 +69,36 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
       l->start = start;
       l->len = len;
       l->type = type;
+      l->box = box;
 
-      list_link (po, po->locks, l);
-      list_link (node, &box->locks, l);
+      link_lock (l);
       return l;
     }
 
   inline void
-  rele_lock (struct rlock_list *l, int wake_waiters)
+  unlink_lock (struct rlock_list *l)
     {
+      tree_remove (node, &box->locks, l);
+      tree_remove (po_tree, &po->index, l);
       list_unlink (po, l);
-      list_unlink (node, l);
+    }
+
+  /* Change the region or the type of the lock L, keeping it in
+     order.  */
+  inline void
+  reshape_lock (struct rlock_list *l, loff_t start, loff_t len, int type)
+    {
+      unlink_lock (l);
+      l->start = start;
+      l->len = len;
+      l->type = type;
+      link_lock (l);
+    }
+
+  inline void
+  rele_lock (struct rlock_list *l, int wake_waiters)
+    {
+      unlink_lock (l);
 
       if (wake_waiters && l->waiting)
 	pthread_cond_broadcast (&l->wait);
@@ -78,9 +111,15 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
   unlock_region (loff_t start, loff_t len)
     {
       struct rlock_list *l;
+      struct rlock_list *next;
 
-      for (l = *po->locks; l; l = l->po.next)
+      /* Start with the first lock of the peropen ending after START.  */
+      for (l = tree_overlap (po_tree, po->index, start, RLOCK_EOF, 0,
+			     NULL, NULL);
+	   l; l = next)
 	{
+	  next = l->po.next;
+
 	  if (l->len != 0 && l->start + l->len <= start)
 	    /* We start after the locked region ends.  */
 	    {
@@ -109,9 +148,9 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      assert (len != 0);
 	      assert (l->len == 0 || start + len < l->start + l->len);
 
-	      if (l->len != 0)
-		l->len -= start + len - l->start;
-	      l->start = start + len;
+	      reshape_lock (l, start + len,
+			    l->len ? l->start + l->len - (start + len) : 0,
+			    l->type);
 
 	      if (l->waiting)
 		{
@@ -128,7 +167,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      assert (len == 0
 		      || (l->len != 0 && l->start + l->len <= start + len));
 
-	      l->len = start - l->start;
+	      reshape_lock (l, l->start, start - l->start, l->type);
 
 	      if (l->waiting)
 		{
@@ -157,7 +196,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      if (! upper_half)
 		return ENOMEM;
 
-	      l->len = start - l->start;
+	      reshape_lock (l, l->start, start - l->start, l->type);
 
 	      return 0;
 	    }
@@ -178,28 +217,26 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
   inline struct rlock_list *
   find_conflict (loff_t start, loff_t len, int type)
     {
-      struct rlock_list *l;
-
-      for (l = box->locks; l; l = l->node.next)
-	{
-	  if (po->locks == l->po_id)
-	    continue;
-
-	  if ((l->type == F_WRLCK || type == F_WRLCK)
-	      && overlap (start, len, l))
-	    return l;
-	}
-
-      return NULL;
+      /* A read lock only conflicts with the write locks.  */
+      return tree_overlap (node, box->locks,
+			   start, len == 0 ? RLOCK_EOF : start + len,
+			   type == F_RDLCK, conflicts, po->locks);
     }
 
   inline error_t
   merge_in (loff_t start, loff_t len, int type)
     {
       struct rlock_list *l;
+      struct rlock_list *next;
 
-      for (l = *po->locks; l; l = l->po.next)
+      /* Start with the first lock of the peropen ending at or after
+	 START, as it may be merged with us.  */
+      for (l = tree_overlap (po_tree, po->index, start ? start - 1 : 0,
+			     RLOCK_EOF, 0, NULL, NULL);
+	   l; l = next)
 	{
+	  next = l->po.next;
+
 	  if (l->start <= start
 	      && (l->len == 0
 		  || (len != 0
@@ -240,30 +277,16 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		    }
 		}
 
-	      if (head)
-		{
-		  loff_t shift = start - l->start;
-
-		  if (l->len != 0)
-		    l->len -= shift;
-		  l->start += shift;
-		}
-
-	      if (tail)
-	        l->len = tail->start - l->start;
-
 	      if (! tail)
-		/* There is a chance we can merge some more.  */
+		/* We end where the locked region does.  There is a
+		   chance we can merge some more.  */
 	        {
-		  start = l->start;
-		  len = l->len;
-
 		  rele_lock (l, 1);
 		  continue;
 		}
 	      else
 	        {
-	          l->type = F_WRLCK;
+		  reshape_lock (l, start, tail->start - start, F_WRLCK);
 		  return 0;
 		}
 	    }
@@ -345,7 +368,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		{
 		  assert (l->type == F_RDLCK);
 
-		  l->len -= l->start + l->len - start;
+		  reshape_lock (l, l->start, start - l->start, l->type);
 
 		  /* Don't create the lock now; we might be able to
 		     consume more locks.  */
@@ -370,8 +393,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		}
 	    }
 	  else if (start < l->start
-		   && (l->len == 0
-		       || l->start <= start + len))
+		   && l->start <= start + len)
 	    /* Our start falls before the locked region and our
 	       end falls (inclusively) between it or one byte before it.
 	       Note, we know that we do not consume the entire locked
@@ -383,9 +405,9 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      if (type == l->type)
 		/* Merge the two areas.  */
 		{
-		  if (l->len)
-		    l->len += l->start - start;
-		  l->start = start;
+		  reshape_lock (l, start,
+				l->len ? l->len + l->start - start : 0,
+				l->type);
 		  return 0;
 		}
 	      else if (l->start == start + len)
@@ -407,9 +429,8 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		  if (! e)
 		    return ENOMEM;
 
-		  if (l->len)
-		    l->len -= common;
-		  l->start += common;
+		  reshape_lock (l, l->start + common,
+				l->len ? l->len - common : 0, l->type);
 
 		  return 0;
 		}
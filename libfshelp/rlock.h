@@ -29,6 +29,7 @@
 
 #include <pthread.h>
 #include <string.h>
+#include <stddef.h>
 
 struct rlock_linked_list
 {
@@ -36,21 +37,45 @@ struct rlock_linked_list
   struct rlock_list **prevp;
 };
 
+/* The links of a lock in a tree ordered by the start of the locks.  The
+   trees are treaps whose priorities are a hash of the address of the
+   locks, so they stay balanced whatever the order of the requests.  */
+struct rlock_tree_link
+{
+  struct rlock_list *left;
+  struct rlock_list *right;
+  /* The furthest end of the locks, and of the write locks, in this
+     subtree, for finding overlaps.  */
+  loff_t max_end;
+  loff_t max_write_end;
+};
+
 struct rlock_list
 {
   loff_t start;
   loff_t len;
   int type;
 
-  struct rlock_linked_list node;
+  /* The tree of every lock on the node, rooted in the rlock box.  */
+  struct rlock_tree_link node;
+  /* The tree and the ordered list of the locks of the peropen.  As
+     these never overlap, the tree finds the first lock of a region and
+     the list gives the following ones.  */
+  struct rlock_tree_link po_tree;
   struct rlock_linked_list po;
 
   pthread_cond_t wait;
   int waiting;
 
   void *po_id;
+  struct rlock_box *box;
 };
 
+/* The offset past the last byte of the lock L; a lock whose length is
+   zero extends to the end of the file, however large it grows.  */
+#define RLOCK_EOF	((loff_t) (~0ULL >> 1))
+#define rlock_end(l)	((l)->len == 0 ? RLOCK_EOF : (l)->start + (l)->len)
+
 FSHELP_EXTERN_INLINE error_t
 rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
 {
@@ -60,18 +85,14 @@ rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
   return 0;
 }
 
-/* void list_list (X ={po,node}, struct rlock_list **head,
+/* void list_link (X = {po}, struct rlock_list **where,
 		   struct rlock_list *node)
 
-   Insert a node in the given list, X, in sorted order.  */
-#define list_link(X, head, node)				\
+   Insert a node in the given list, X, at WHERE.  */
+#define list_link(X, where, node)				\
 	do							\
 	  {							\
-	    struct rlock_list **e;				\
-	    for (e = head;					\
-		 *e && ((*e)->start < node->start);		\
-		 e = &(*e)->X.next)				\
-	      ;							\
+	    struct rlock_list **e = (where);			\
 	    node->X.next = *e;					\
 	    if (node->X.next)					\
 	      node->X.next->X.prevp = &node->X.next;		\
@@ -80,7 +101,7 @@ rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
 	  }							\
 	while (0)
 
-/* void list_unlock (X = {po,node}, struct rlock_list *node)  */
+/* void list_unlink (X = {po}, struct rlock_list *node)  */
 #define list_unlink(X, node)					\
 	do							\
 	  {							\
@@ -90,4 +111,52 @@ rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
 	  }							\
 	while (0)
 
+/* The trees, the link of their locks given by its offset in struct
+   rlock_list.  See rlock-tree.c.  */
+void _fshelp_rlock_tree_insert (struct rlock_list **root,
+				struct rlock_list *l, size_t link);
+void _fshelp_rlock_tree_remove (struct rlock_list **root,
+				struct rlock_list *l, size_t link);
+struct rlock_list *_fshelp_rlock_tree_prev (struct rlock_list *root,
+					    struct rlock_list *l,
+					    size_t link);
+struct rlock_list *_fshelp_rlock_tree_overlap (struct rlock_list *root,
+					       loff_t start, loff_t end,
+					       int writes, size_t link,
+					       int (*match)
+					         (struct rlock_list *, void *),
+					       void *arg);
+
+/* void tree_insert (X = {node,po_tree}, struct rlock_list **root,
+		     struct rlock_list *node)  */
+#define tree_insert(X, root, node) \
+	_fshelp_rlock_tree_insert (root, node, offsetof (struct rlock_list, X))
+
+/* void tree_remove (X = {node,po_tree}, struct rlock_list **root,
+		     struct rlock_list *node)  */
+#define tree_remove(X, root, node) \
+	_fshelp_rlock_tree_remove (root, node, offsetof (struct rlock_list, X))
+
+/* struct rlock_list *tree_prev (X = {node,po_tree},
+				 struct rlock_list *root,
+				 struct rlock_list *node)
+
+   Return the lock before NODE in the tree X, or NULL.  */
+#define tree_prev(X, root, node) \
+	_fshelp_rlock_tree_prev (root, node, offsetof (struct rlock_list, X))
+
+/* struct rlock_list *tree_overlap (X = {node,po_tree},
+				    struct rlock_list *root,
+				    loff_t start, loff_t end, int writes,
+				    int (*match) (struct rlock_list *, void *),
+				    void *arg)
+
+   Return the first lock of the tree X overlapping the bytes from START
+   to END (exclusive), only considering write locks if WRITES is
+   nonzero, for which MATCH, if not NULL, returns true.  */
+#define tree_overlap(X, root, start, end, writes, match, arg)		\
+	_fshelp_rlock_tree_overlap (root, start, end, writes,		\
+				    offsetof (struct rlock_list, X),	\
+				    match, arg)
+
 #endif /* FSHELP_RLOCK_H */
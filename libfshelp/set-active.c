@@ -54,6 +54,7 @@ fshelp_set_active (struct transbox *box,
 	return EINTR;
     }
 
+  fshelp_drop_cached_roots (box);
   if (box->active != MACH_PORT_NULL)
     mach_port_deallocate (mach_task_self (), box->active);
 
@@ -31,4 +31,5 @@ fshelp_transbox_init (struct transbox *transbox,
   transbox->lock = lock;
   pthread_cond_init (&transbox->wakeup, NULL);
   transbox->cookie = cookie;
+  transbox->roots = NULL;
 }
@@ -45,6 +45,8 @@
 
 #define REPLY_NEED_PASS	331	/* User name okay, need password */
 #define REPLY_NEED_ACCT 332	/* Need account for login */
+#define REPLY_PENDING	350	/* Requested file action pending further
+				   information */
 
 #define REPLY_CLOSED	421	/* Service not available, closing control connection */
 #define REPLY_ABORTED	426	/* Connection closed; transfer aborted */
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdio.h>
 #include <netinet/in.h>
 
 #include <ftpconn.h>
@@ -250,6 +251,49 @@ ftp_conn_start_retrieve (struct ftp_conn *conn, const char *name, int *data)
     ftp_conn_start_transfer (conn, "retr", name, ftp_conn_poss_file_errs, data);
 }
 
+/* Start retreiving file NAME over CONN from byte OFFSET on, returning a file
+   descriptor in DATA over which the data can be read.  If the server cannot
+   restart a transfer, EOPNOTSUPP is returned.  */
+error_t
+ftp_conn_start_retrieve_at (struct ftp_conn *conn, const char *name,
+			    off_t offset, int *data)
+{
+  error_t err;
+
+  if (! name)
+    return EINVAL;
+  if (offset == 0)
+    return ftp_conn_start_retrieve (conn, name, data);
+
+  err = ftp_conn_start_open_data (conn, data);
+  if (! err)
+    {
+      int reply;
+      const char *txt;
+      char pos[24];
+
+      /* REST must come right before the RETR it applies to.  */
+      snprintf (pos, sizeof pos, "%lld", (long long) offset);
+      err = ftp_conn_cmd (conn, "rest", pos, &reply, &txt);
+      if (!err && reply != REPLY_PENDING)
+	err = (reply == REPLY_BAD_CMD ? EOPNOTSUPP
+	       : unexpected_reply (conn, reply, txt, 0));
+      if (! err)
+	{
+	  err = ftp_conn_cmd (conn, "retr", name, &reply, &txt);
+	  if (!err && !REPLY_IS_PRELIM (reply))
+	    err = unexpected_reply (conn, reply, txt, ftp_conn_poss_file_errs);
+	}
+
+      if (err)
+	ftp_conn_abort_open_data (conn, *data);
+      else
+	err = ftp_conn_finish_open_data (conn, data);
+    }
+
+  return err;
+}
+
 /* Start retreiving a list of files in NAME over CONN, returning a file
    descriptor in DATA over which the data can be read.  */
 error_t
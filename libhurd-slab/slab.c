@@ -67,6 +67,40 @@ struct hurd_slab
   union hurd_bufctl *free_list;
 };
 
+
+/* Objects deallocated by a thread are kept in a magazine of its own,
+   and allocated again from there, without taking the lock of the
+   space.  A thread has two magazines, so that allocations and
+   deallocations alternating at the boundary of one do not go to the
+   depot every time.  The depot keeps the full and the empty magazines
+   between threads; only when it has no full magazine does an
+   allocation go to the slabs.  The objects in a magazine are still
+   counted as allocated by their slab.
+
+   The magazines of each thread are on a list of the space, so that
+   reaping or destroying it can empty those of all threads.  A spin
+   lock of their own guards them; only a reap ever contends it.  */
+#define MAGAZINE_SIZE 30
+
+struct hurd_slab_magazine
+{
+  struct hurd_slab_magazine *next;
+  int rounds;
+  void *round[MAGAZINE_SIZE];
+};
+
+/* The magazines of one thread for one slab space.  */
+struct hurd_slab_cache
+{
+  hurd_slab_space_t space;
+  pthread_spinlock_t lock;
+  struct hurd_slab_magazine *loaded;
+  struct hurd_slab_magazine *previous;
+
+  /* In the list of the caches of SPACE, under the lock of SPACE.  */
+  struct hurd_slab_cache *next, **prevp;
+};
+
 /* Allocate a buffer in *PTR of size SIZE which must be a power of 2
    and self aligned (i.e. aligned on a SIZE byte boundary) for slab
    space SPACE.  Return 0 on success, an error code on failure.  */
@@ -204,6 +238,200 @@ reap (struct hurd_slab_space *space)
 }
 
 
+static error_t grow (struct hurd_slab_space *space);
+
+/* Allocate a new object from the slabs of SPACE into *BUFFER.  The
+   lock of SPACE must be held.  */
+static error_t
+alloc_from_slab (struct hurd_slab_space *space, void **buffer)
+{
+  error_t err;
+  union hurd_bufctl *bufctl;
+
+  /* If there is no slabs with free buffer, the cache has to be
+     expanded with another slab.  If the slab space has not yet been
+     initialized this is always true.  */
+  if (!space->first_free)
+    {
+      err = grow (space);
+      if (err)
+	return err;
+    }
+
+  /* Remove buffer from the free list and update the reference
+     counter.  If the reference counter will hit the top, it is
+     handled at the time of the next allocation.  */
+  bufctl = space->first_free->free_list;
+  space->first_free->free_list = bufctl->next;
+  space->first_free->refcount++;
+  bufctl->slab = space->first_free;
+
+  /* If the reference counter hits the top it means that there has
+     been an allocation boost, otherwise dealloc would have updated
+     the first_free pointer.  Find a slab with free objects.  */
+  if (space->first_free->refcount == space->full_refcount)
+    {
+      struct hurd_slab *new_first = space->slab_first;
+      while (new_first)
+	{
+	  if (new_first->refcount != space->full_refcount)
+	    break;
+	  new_first = new_first->next;
+	}
+      /* If first_free is set to NULL here it means that there are
+	 only empty slabs.  The next call to alloc will allocate a new
+	 slab if there was no call to dealloc in the meantime.  */
+      space->first_free = new_first;
+    }
+  *buffer = ((void *) bufctl) - (space->size - sizeof *bufctl);
+  return 0;
+}
+
+
+static inline void
+put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
+{
+  bufctl->next = slab->free_list;
+  slab->free_list = bufctl;
+  slab->refcount--;
+  assert_backtrace (slab->refcount >= 0);
+}
+
+
+/* Return the object BUFFER to its slab in SPACE.  The lock of SPACE
+   must be held.  */
+static void
+dealloc_to_slab (struct hurd_slab_space *space, void *buffer)
+{
+  struct hurd_slab *slab;
+  union hurd_bufctl *bufctl;
+
+  bufctl = (buffer + (space->size - sizeof *bufctl));
+  put_on_slab_list (slab = bufctl->slab, bufctl);
+
+  /* Try to have first_free always pointing at the slab that has the
+     most number of free objects.  So after this deallocation, update
+     the first_free pointer if reference counter drops below the
+     current reference counter of first_free.  */
+  if (!space->first_free 
+      || slab->refcount < space->first_free->refcount)
+    space->first_free = slab;
+}
+
+
+/* Return the objects in MAG to their slabs in SPACE, and free MAG.
+   The lock of SPACE must be held.  */
+static void
+drop_magazine (struct hurd_slab_space *space, struct hurd_slab_magazine *mag)
+{
+  if (!mag)
+    return;
+  while (mag->rounds > 0)
+    dealloc_to_slab (space, mag->round[--mag->rounds]);
+  free (mag);
+}
+
+
+/* Return the objects in all the magazines of the depot of SPACE to
+   their slabs, and free the magazines.  The lock of SPACE must be
+   held.  */
+static void
+flush_depot (struct hurd_slab_space *space)
+{
+  struct hurd_slab_magazine *mag, *next;
+
+  for (mag = space->full_magazines; mag; mag = next)
+    {
+      next = mag->next;
+      drop_magazine (space, mag);
+    }
+  for (mag = space->empty_magazines; mag; mag = next)
+    {
+      next = mag->next;
+      free (mag);
+    }
+  space->full_magazines = space->empty_magazines = NULL;
+}
+
+
+/* Return the objects in the magazines of CACHE to their slabs, and free
+   the magazines.  The lock of the space of CACHE must be held.  */
+static void
+drain_cache (struct hurd_slab_cache *cache)
+{
+  pthread_spin_lock (&cache->lock);
+  drop_magazine (cache->space, cache->loaded);
+  drop_magazine (cache->space, cache->previous);
+  cache->loaded = cache->previous = NULL;
+  pthread_spin_unlock (&cache->lock);
+}
+
+
+/* Give the magazines of the thread owning CACHE back to the depot when
+   the thread exits.  */
+static void
+release_cache (void *arg)
+{
+  struct hurd_slab_cache *cache = arg;
+  struct hurd_slab_space *space = cache->space;
+  struct hurd_slab_magazine *mags[2] = { cache->loaded, cache->previous };
+  int i;
+
+  pthread_mutex_lock (&space->lock);
+  *cache->prevp = cache->next;
+  if (cache->next)
+    cache->next->prevp = cache->prevp;
+  for (i = 0; i < 2; i++)
+    if (mags[i] && mags[i]->rounds == MAGAZINE_SIZE)
+      {
+	mags[i]->next = space->full_magazines;
+	space->full_magazines = mags[i];
+      }
+    else
+      drop_magazine (space, mags[i]);
+  pthread_mutex_unlock (&space->lock);
+  pthread_spin_destroy (&cache->lock);
+  free (cache);
+}
+
+
+/* Return the magazines of the calling thread for SPACE, or NULL if it
+   has none and none could be made.  */
+static struct hurd_slab_cache *
+get_cache (struct hurd_slab_space *space)
+{
+  struct hurd_slab_cache *cache;
+
+  if (!space->magazines)
+    return NULL;
+
+  cache = pthread_getspecific (space->cache_key);
+  if (!cache)
+    {
+      cache = calloc (1, sizeof *cache);
+      if (!cache)
+	return NULL;
+      cache->space = space;
+      pthread_spin_init (&cache->lock, PTHREAD_PROCESS_PRIVATE);
+      if (pthread_setspecific (space->cache_key, cache))
+	{
+	  pthread_spin_destroy (&cache->lock);
+	  free (cache);
+	  return NULL;
+	}
+
+      pthread_mutex_lock (&space->lock);
+      cache->next = space->caches;
+      if (cache->next)
+	cache->next->prevp = &cache->next;
+      cache->prevp = &space->caches;
+      space->caches = cache;
+      pthread_mutex_unlock (&space->lock);
+    }
+  return cache;
+}
+
+
 /* Initialize slab space SPACE.  */
 static void
 init_space (hurd_slab_space_t space)
@@ -225,10 +453,13 @@ init_space (hurd_slab_space_t space)
   space->full_refcount 
     = ((space->slab_size - sizeof (struct hurd_slab)) / size);
 
+  space->magazines = pthread_key_create (&space->cache_key,
+					 release_cache) == 0;
+
   /* FIXME: Notify pager's reap functionality about this slab
      space.  */
 
-  space->initialized = true;
+  __atomic_store_n (&space->initialized, true, __ATOMIC_RELEASE);
 }
 
 
@@ -389,11 +620,17 @@ hurd_slab_create (size_t size, size_t alignment,
 error_t
 hurd_slab_destroy (hurd_slab_space_t space)
 {
+  struct hurd_slab_cache *cache, *next;
   error_t err;
 
   /* The caller wants to destroy the slab.  It can not be destroyed if
-     there are any outstanding memory allocations.  */
+     there are any outstanding memory allocations.  Objects in the
+     magazines of the threads and of the depot are not outstanding.  */
   pthread_mutex_lock (&space->lock);
+  for (cache = space->caches; cache; cache = cache->next)
+    drain_cache (cache);
+  flush_depot (space);
+
   err = reap (space);
   if (err)
     {
@@ -409,6 +646,22 @@ hurd_slab_destroy (hurd_slab_space_t space)
       return EBUSY;
     }
 
+  if (space->magazines)
+    {
+      /* No thread uses SPACE any more, and once the key is gone none
+	 frees its cache on exit.  */
+      pthread_setspecific (space->cache_key, NULL);
+      for (cache = space->caches; cache; cache = next)
+	{
+	  next = cache->next;
+	  pthread_spin_destroy (&cache->lock);
+	  free (cache);
+	}
+      space->caches = NULL;
+      pthread_key_delete (space->cache_key);
+      space->magazines = false;
+    }
+
   /* FIXME: Remove slab space from pager's reap functionality.  */
 
   return 0;
@@ -428,67 +681,107 @@ hurd_slab_free (hurd_slab_space_t space)
   return 0;
 }
 
-
-/* Allocate a new object from the slab space SPACE.  */
+
+/* Release the memory of the slabs of SPACE that have no allocated
+   object.  */
 error_t
-hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+hurd_slab_reap (hurd_slab_space_t space)
 {
   error_t err;
-  union hurd_bufctl *bufctl;
+
+  struct hurd_slab_cache *cache;
 
   pthread_mutex_lock (&space->lock);
+  for (cache = space->caches; cache; cache = cache->next)
+    drain_cache (cache);
+  flush_depot (space);
+  err = reap (space);
+  pthread_mutex_unlock (&space->lock);
+  return err;
+}
 
-  /* If there is no slabs with free buffer, the cache has to be
-     expanded with another slab.  If the slab space has not yet been
-     initialized this is always true.  */
-  if (!space->first_free)
+
+/* Describe the slabs of SPACE.  */
+void
+hurd_slab_get_info (hurd_slab_space_t space, struct hurd_slab_info *info)
+{
+  struct hurd_slab *s;
+
+  memset (info, 0, sizeof *info);
+  pthread_mutex_lock (&space->lock);
+  if (space->initialized)
     {
-      err = grow (space);
-      if (err)
+      info->object_size = space->size;
+      info->slab_size = space->slab_size;
+      info->objects_per_slab = space->full_refcount;
+      for (s = space->slab_first; s; s = s->next)
 	{
-	  pthread_mutex_unlock (&space->lock);
-	  return err;
+	  info->slabs++;
+	  if (!s->refcount)
+	    info->free_slabs++;
 	}
     }
+  pthread_mutex_unlock (&space->lock);
+}
 
-  /* Remove buffer from the free list and update the reference
-     counter.  If the reference counter will hit the top, it is
-     handled at the time of the next allocation.  */
-  bufctl = space->first_free->free_list;
-  space->first_free->free_list = bufctl->next;
-  space->first_free->refcount++;
-  bufctl->slab = space->first_free;
 
-  /* If the reference counter hits the top it means that there has
-     been an allocation boost, otherwise dealloc would have updated
-     the first_free pointer.  Find a slab with free objects.  */
-  if (space->first_free->refcount == space->full_refcount)
+/* Allocate a new object from the slab space SPACE.  */
+error_t
+hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+{
+  struct hurd_slab_cache *cache = NULL;
+  struct hurd_slab_magazine *mag;
+  error_t err;
+
+  if (__atomic_load_n (&space->initialized, __ATOMIC_ACQUIRE))
+    cache = get_cache (space);
+
+  if (cache)
     {
-      struct hurd_slab *new_first = space->slab_first;
-      while (new_first)
+      pthread_spin_lock (&cache->lock);
+      if (cache->loaded && cache->loaded->rounds > 0)
 	{
-	  if (new_first->refcount != space->full_refcount)
-	    break;
-	  new_first = new_first->next;
+	  *buffer = cache->loaded->round[--cache->loaded->rounds];
+	  pthread_spin_unlock (&cache->lock);
+	  return 0;
 	}
-      /* If first_free is set to NULL here it means that there are
-	 only empty slabs.  The next call to alloc will allocate a new
-	 slab if there was no call to dealloc in the meantime.  */
-      space->first_free = new_first;
+      if (cache->previous && cache->previous->rounds > 0)
+	{
+	  mag = cache->previous;
+	  cache->previous = cache->loaded;
+	  cache->loaded = mag;
+	  *buffer = mag->round[--mag->rounds];
+	  pthread_spin_unlock (&cache->lock);
+	  return 0;
+	}
+      pthread_spin_unlock (&cache->lock);
     }
-  *buffer = ((void *) bufctl) - (space->size - sizeof *bufctl);
-  pthread_mutex_unlock (&space->lock);
-  return 0;
-}
 
+  pthread_mutex_lock (&space->lock);
 
-static inline void
-put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
-{
-  bufctl->next = slab->free_list;
-  slab->free_list = bufctl;
-  slab->refcount--;
-  assert_backtrace (slab->refcount >= 0);
+  if (cache && space->full_magazines)
+    {
+      /* Both magazines are empty, unless a reap took them: exchange
+	 one for a full one from the depot.  */
+      mag = space->full_magazines;
+      space->full_magazines = mag->next;
+      pthread_spin_lock (&cache->lock);
+      if (cache->previous)
+	{
+	  cache->previous->next = space->empty_magazines;
+	  space->empty_magazines = cache->previous;
+	}
+      cache->previous = cache->loaded;
+      cache->loaded = mag;
+      *buffer = mag->round[--mag->rounds];
+      pthread_spin_unlock (&cache->lock);
+      pthread_mutex_unlock (&space->lock);
+      return 0;
+    }
+
+  err = alloc_from_slab (space, buffer);
+  pthread_mutex_unlock (&space->lock);
+  return err;
 }
 
 
@@ -496,23 +789,66 @@ put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
 void
 hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
 {
-  struct hurd_slab *slab;
-  union hurd_bufctl *bufctl;
+  struct hurd_slab_cache *cache;
+  struct hurd_slab_magazine *mag;
 
   assert_backtrace (space->initialized);
 
+  cache = get_cache (space);
+  if (cache)
+    {
+      pthread_spin_lock (&cache->lock);
+      if (cache->loaded && cache->loaded->rounds < MAGAZINE_SIZE)
+	{
+	  cache->loaded->round[cache->loaded->rounds++] = buffer;
+	  pthread_spin_unlock (&cache->lock);
+	  return;
+	}
+      if (cache->previous && cache->previous->rounds < MAGAZINE_SIZE)
+	{
+	  mag = cache->previous;
+	  cache->previous = cache->loaded;
+	  cache->loaded = mag;
+	  mag->round[mag->rounds++] = buffer;
+	  pthread_spin_unlock (&cache->lock);
+	  return;
+	}
+      pthread_spin_unlock (&cache->lock);
+    }
+
   pthread_mutex_lock (&space->lock);
 
-  bufctl = (buffer + (space->size - sizeof *bufctl));
-  put_on_slab_list (slab = bufctl->slab, bufctl);
+  if (cache)
+    {
+      /* Both magazines are full, unless a reap took them: exchange one
+	 for an empty one from the depot, or a new one.  */
+      mag = space->empty_magazines;
+      if (mag)
+	space->empty_magazines = mag->next;
+      else
+	{
+	  mag = malloc (sizeof *mag);
+	  if (mag)
+	    mag->rounds = 0;
+	}
 
-  /* Try to have first_free always pointing at the slab that has the
-     most number of free objects.  So after this deallocation, update
-     the first_free pointer if reference counter drops below the
-     current reference counter of first_free.  */
-  if (!space->first_free 
-      || slab->refcount < space->first_free->refcount)
-    space->first_free = slab;
+      if (mag)
+	{
+	  pthread_spin_lock (&cache->lock);
+	  if (cache->previous)
+	    {
+	      cache->previous->next = space->full_magazines;
+	      space->full_magazines = cache->previous;
+	    }
+	  cache->previous = cache->loaded;
+	  cache->loaded = mag;
+	  mag->round[mag->rounds++] = buffer;
+	  pthread_spin_unlock (&cache->lock);
+	  pthread_mutex_unlock (&space->lock);
+	  return;
+	}
+    }
 
+  dealloc_to_slab (space, buffer);
   pthread_mutex_unlock (&space->lock);
 }
@@ -111,6 +111,18 @@ struct hurd_slab_space
   /* The size of one object.  Should include possible alignment as
      well as the size of the bufctl structure.  */
   size_t size;
+
+  /* The per-thread magazines of free objects, if the key for them
+     could be created; see slab.c.  */
+  bool magazines;
+  pthread_key_t cache_key;
+
+  /* The depot of magazines not loaded by any thread.  */
+  struct hurd_slab_magazine *full_magazines;
+  struct hurd_slab_magazine *empty_magazines;
+
+  /* The magazines of each thread that has used this space.  */
+  struct hurd_slab_cache *caches;
 };
 
 
@@ -178,6 +190,27 @@ error_t hurd_slab_alloc (hurd_slab_space_t space, void **buffer);
 /* Deallocate the object BUFFER from the slab space SPACE.  */
 void hurd_slab_dealloc (hurd_slab_space_t space, void *buffer);
 
+/* Release the memory of the slabs of SPACE that have no allocated
+   object, after returning to them the objects in the magazines of all
+   threads and of the depot.  */
+error_t hurd_slab_reap (hurd_slab_space_t space);
+
+/* What hurd_slab_get_info reports about a slab space.  All of it is
+   zero until the first allocation.  */
+struct hurd_slab_info
+{
+  size_t object_size;		/* Including alignment and bookkeeping */
+  size_t slab_size;
+  size_t objects_per_slab;
+  size_t slabs;
+  size_t free_slabs;		/* Slabs without any allocated object */
+};
+
+/* Describe the slabs of SPACE in *INFO.  Objects in the magazines of
+   threads or of the depot count as allocated.  */
+void hurd_slab_get_info (hurd_slab_space_t space,
+			 struct hurd_slab_info *info);
+
 /* Create a more strongly typed slab interface a la a C++ template.
 
    NAME is the name of the new slab class.  NAME is used to synthesize
@@ -0,0 +1,182 @@
+/* cihash.c - Integer keyed hash table for concurrent use.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "cihash.h"
+
+/* Return the shard of HT that KEY belongs to.  The tables of the shards
+   mix the hash of their keys differently, so the keys of a shard are
+   still spread over the whole of its table.  */
+static inline struct _hurd_cihash_shard *
+shard (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  hurd_ihash_fct_hash_t fct_hash = ht->shards[0].ht.fct_hash;
+  uint64_t k = fct_hash ? fct_hash ((const void *) key) : key;
+
+  k *= 0x9e3779b97f4a7c15ULL;
+  return &ht->shards[k >> (64 - __builtin_ctz (HURD_CIHASH_SHARDS))];
+}
+
+void
+hurd_cihash_init (hurd_cihash_t ht, intptr_t locp_offs)
+{
+  int i;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS; i++)
+    {
+      pthread_rwlock_init (&ht->shards[i].lock, NULL);
+      hurd_ihash_init (&ht->shards[i].ht, locp_offs);
+    }
+}
+
+void
+hurd_cihash_destroy (hurd_cihash_t ht)
+{
+  int i;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS; i++)
+    {
+      hurd_ihash_destroy (&ht->shards[i].ht);
+      pthread_rwlock_destroy (&ht->shards[i].lock);
+    }
+}
+
+void
+hurd_cihash_set_cleanup (hurd_cihash_t ht, hurd_ihash_cleanup_t cleanup,
+			 void *cleanup_data)
+{
+  int i;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS; i++)
+    hurd_ihash_set_cleanup (&ht->shards[i].ht, cleanup, cleanup_data);
+}
+
+void
+hurd_cihash_set_gki (hurd_cihash_t ht,
+		     hurd_ihash_fct_hash_t fct_hash,
+		     hurd_ihash_fct_cmp_t fct_cmp)
+{
+  int i;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS; i++)
+    hurd_ihash_set_gki (&ht->shards[i].ht, fct_hash, fct_cmp);
+}
+
+hurd_ihash_t
+hurd_cihash_lock (hurd_cihash_t ht, hurd_ihash_key_t key, int exclusive)
+{
+  struct _hurd_cihash_shard *s = shard (ht, key);
+
+  if (exclusive)
+    pthread_rwlock_wrlock (&s->lock);
+  else
+    pthread_rwlock_rdlock (&s->lock);
+  return &s->ht;
+}
+
+void
+hurd_cihash_unlock (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  pthread_rwlock_unlock (&shard (ht, key)->lock);
+}
+
+error_t
+hurd_cihash_add (hurd_cihash_t ht, hurd_ihash_key_t key,
+		 hurd_ihash_value_t item)
+{
+  struct _hurd_cihash_shard *s = shard (ht, key);
+  error_t err;
+
+  pthread_rwlock_wrlock (&s->lock);
+  err = hurd_ihash_add (&s->ht, key, item);
+  pthread_rwlock_unlock (&s->lock);
+  return err;
+}
+
+hurd_ihash_value_t
+hurd_cihash_find (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  struct _hurd_cihash_shard *s = shard (ht, key);
+  hurd_ihash_value_t value;
+
+  pthread_rwlock_rdlock (&s->lock);
+  value = hurd_ihash_find (&s->ht, key);
+  pthread_rwlock_unlock (&s->lock);
+  return value;
+}
+
+int
+hurd_cihash_remove (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  struct _hurd_cihash_shard *s = shard (ht, key);
+  int removed;
+
+  pthread_rwlock_wrlock (&s->lock);
+  removed = hurd_ihash_remove (&s->ht, key);
+  pthread_rwlock_unlock (&s->lock);
+  return removed;
+}
+
+void
+hurd_cihash_locp_remove (hurd_cihash_t ht, hurd_ihash_key_t key,
+			 hurd_ihash_locp_t locp)
+{
+  struct _hurd_cihash_shard *s = shard (ht, key);
+
+  pthread_rwlock_wrlock (&s->lock);
+  hurd_ihash_locp_remove (&s->ht, locp);
+  pthread_rwlock_unlock (&s->lock);
+}
+
+size_t
+hurd_cihash_count (hurd_cihash_t ht)
+{
+  size_t n = 0;
+  int i;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS; i++)
+    n += __atomic_load_n (&ht->shards[i].ht.nr_items, __ATOMIC_RELAXED);
+  return n;
+}
+
+int
+hurd_cihash_iterate (hurd_cihash_t ht,
+		     int (*fn) (hurd_ihash_value_t value, void *arg),
+		     void *arg)
+{
+  int i, ret = 0;
+
+  for (i = 0; i < HURD_CIHASH_SHARDS && !ret; i++)
+    {
+      struct _hurd_cihash_shard *s = &ht->shards[i];
+
+      pthread_rwlock_rdlock (&s->lock);
+      HURD_IHASH_ITERATE (&s->ht, value)
+	{
+	  ret = fn (value, arg);
+	  if (ret)
+	    break;
+	}
+      pthread_rwlock_unlock (&s->lock);
+    }
+
+  return ret;
+}
@@ -0,0 +1,121 @@
+/* cihash.h - Integer keyed hash table for concurrent use.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#ifndef _HURD_CIHASH_H
+#define _HURD_CIHASH_H	1
+
+#include <pthread.h>
+#include <hurd/ihash.h>
+
+/* A hurd_cihash is a hash table that several threads may use at once
+   without a lock of their own.  Its keys are spread over
+   HURD_CIHASH_SHARDS hurd_ihash tables, each with its own read-write
+   lock, so that threads working on different keys rarely wait for one
+   another, and lookups of the same shard don't wait at all.
+
+   The simple operations below take the lock of the key's shard
+   themselves.  For anything more, like looking a value up and taking a
+   reference on it before anyone can remove it, or the location pointer
+   interface, lock the shard with hurd_cihash_lock and use the
+   hurd_ihash functions on the table it returns.  */
+
+/* The number of shards; a power of two.  */
+#define HURD_CIHASH_SHARDS	16
+
+struct _hurd_cihash_shard
+{
+  pthread_rwlock_t lock;
+  struct hurd_ihash ht;
+} __attribute__ ((aligned (64)));
+
+struct hurd_cihash
+{
+  struct _hurd_cihash_shard shards[HURD_CIHASH_SHARDS];
+};
+typedef struct hurd_cihash *hurd_cihash_t;
+
+/* The static initializer for a struct hurd_cihash.  */
+#define HURD_CIHASH_INITIALIZER(locp_offs)				\
+  { .shards = { [0 ... HURD_CIHASH_SHARDS - 1] =			\
+      { .lock = PTHREAD_RWLOCK_INITIALIZER,				\
+	.ht = HURD_IHASH_INITIALIZER (locp_offs) } } }
+
+#define HURD_CIHASH_INITIALIZER_GKI(locp_offs, f_clean, f_clean_data,	\
+				    f_hash, f_compare)			\
+  { .shards = { [0 ... HURD_CIHASH_SHARDS - 1] =			\
+      { .lock = PTHREAD_RWLOCK_INITIALIZER,				\
+	.ht = HURD_IHASH_INITIALIZER_GKI (locp_offs, f_clean,		\
+					  f_clean_data, f_hash,		\
+					  f_compare) } } }
+
+/* Initialize the hash table at address HT, as hurd_ihash_init does.  */
+void hurd_cihash_init (hurd_cihash_t ht, intptr_t locp_offs);
+
+/* Destroy the hash table at address HT, as hurd_ihash_destroy does.  No
+   other thread may be using it.  */
+void hurd_cihash_destroy (hurd_cihash_t ht);
+
+/* Set the cleanup function for the hash table HT, as
+   hurd_ihash_set_cleanup does.  The cleanup function is called with the
+   lock of the shard held.  */
+void hurd_cihash_set_cleanup (hurd_cihash_t ht, hurd_ihash_cleanup_t cleanup,
+			      void *cleanup_data);
+
+/* Use the generalized key interface, as hurd_ihash_set_gki does.  The
+   shard of a key is chosen from FCT_HASH too.  */
+void hurd_cihash_set_gki (hurd_cihash_t ht,
+			  hurd_ihash_fct_hash_t fct_hash,
+			  hurd_ihash_fct_cmp_t fct_cmp);
+
+/* Lock the shard of HT that KEY belongs to, for writing if EXCLUSIVE is
+   true and for reading otherwise, and return its table.  Only keys of
+   this shard may be used with the table.  */
+hurd_ihash_t hurd_cihash_lock (hurd_cihash_t ht, hurd_ihash_key_t key,
+			       int exclusive);
+
+/* Unlock the shard of HT that KEY belongs to.  */
+void hurd_cihash_unlock (hurd_cihash_t ht, hurd_ihash_key_t key);
+
+/* Like hurd_ihash_add.  */
+error_t hurd_cihash_add (hurd_cihash_t ht, hurd_ihash_key_t key,
+			 hurd_ihash_value_t item);
+
+/* Like hurd_ihash_find.  Note that the value may be removed, and its
+   cleanup function called, as soon as this returns.  */
+hurd_ihash_value_t hurd_cihash_find (hurd_cihash_t ht, hurd_ihash_key_t key);
+
+/* Like hurd_ihash_remove.  */
+int hurd_cihash_remove (hurd_cihash_t ht, hurd_ihash_key_t key);
+
+/* Like hurd_ihash_locp_remove, for the item under the key KEY.  */
+void hurd_cihash_locp_remove (hurd_cihash_t ht, hurd_ihash_key_t key,
+			      hurd_ihash_locp_t locp);
+
+/* Return the number of items in HT, which may be out of date by the time
+   it is returned.  */
+size_t hurd_cihash_count (hurd_cihash_t ht);
+
+/* Call FN with each value in HT and ARG, a shard at a time with its lock
+   held for reading, until FN returns non-zero, which is then returned;
+   otherwise return 0.  */
+int hurd_cihash_iterate (hurd_cihash_t ht,
+			 int (*fn) (hurd_ihash_value_t value, void *arg),
+			 void *arg);
+
+#endif	/* _HURD_CIHASH_H */
@@ -50,6 +50,151 @@ compare (hurd_ihash_t ht, hurd_ihash_key_t a, hurd_ihash_key_t b)
 		: a == b;
 }
 
+/* The slots are probed in groups of this many, whose control bytes
+   are looked at together.  HURD_IHASH_MIN_SIZE is a multiple of it.  */
+#define GROUP 16
+
+/* The control bytes of free slots; those of used ones have the high
+   bit set.  */
+#define CTRL_EMPTY	0x00
+#define CTRL_DELETED	0x01
+
+#if defined __SSE2__
+#include <emmintrin.h>
+
+/* Return the mask of the slots of the group at CTRL whose control
+   byte is BYTE.  */
+static inline unsigned int
+group_match (const unsigned char *ctrl, unsigned char byte)
+{
+  __m128i g = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (g, _mm_set1_epi8 (byte)));
+}
+
+/* Return nonzero if the group at CTRL has an empty slot.  */
+static inline unsigned int
+group_empty (const unsigned char *ctrl)
+{
+  __m128i g = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (g, _mm_setzero_si128 ()));
+}
+
+/* Return the mask of the free slots of the group at CTRL.  */
+static inline unsigned int
+group_free (const unsigned char *ctrl)
+{
+  __m128i g = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return ~_mm_movemask_epi8 (g) & 0xffff;
+}
+
+#elif defined __aarch64__ && defined __ARM_NEON
+#include <arm_neon.h>
+
+static inline unsigned int
+neon_mask (uint8x16_t m)
+{
+  static const uint8_t bits[16] =
+    { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t b = vandq_u8 (m, vld1q_u8 (bits));
+  return vaddv_u8 (vget_low_u8 (b)) | (vaddv_u8 (vget_high_u8 (b)) << 8);
+}
+
+static inline unsigned int
+group_match (const unsigned char *ctrl, unsigned char byte)
+{
+  return neon_mask (vceqq_u8 (vld1q_u8 (ctrl), vdupq_n_u8 (byte)));
+}
+
+static inline unsigned int
+group_empty (const unsigned char *ctrl)
+{
+  return neon_mask (vceqzq_u8 (vld1q_u8 (ctrl)));
+}
+
+static inline unsigned int
+group_free (const unsigned char *ctrl)
+{
+  return neon_mask (vcgezq_s8 (vreinterpretq_s8_u8 (vld1q_u8 (ctrl))));
+}
+
+#else
+#include <string.h>
+
+/* Look at the group eight bytes at a time.  The bytes of a word are
+   taken to be in little-endian order.  */
+#define LSB 0x0101010101010101ULL
+#define MSB 0x8080808080808080ULL
+
+static inline uint64_t
+load_word (const unsigned char *p)
+{
+  uint64_t w;
+  memcpy (&w, p, sizeof w);
+  return w;
+}
+
+/* Gather the high bit of each byte of M into a byte.  */
+static inline unsigned int
+msb_mask (uint64_t m)
+{
+  return ((m >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+/* Return the mask of the bytes of W that are zero.  A byte just above
+   a zero one may be included wrongly; here it is always a used slot,
+   whose key is compared anyway.  */
+static inline unsigned int
+zero_mask (uint64_t w)
+{
+  return msb_mask ((w - LSB) & ~w & MSB);
+}
+
+static inline unsigned int
+group_match (const unsigned char *ctrl, unsigned char byte)
+{
+  uint64_t b = LSB * byte;
+  return (zero_mask (load_word (ctrl) ^ b)
+	  | zero_mask (load_word (ctrl + 8) ^ b) << 8);
+}
+
+static inline unsigned int
+group_empty (const unsigned char *ctrl)
+{
+  return zero_mask (load_word (ctrl)) | zero_mask (load_word (ctrl + 8));
+}
+
+static inline unsigned int
+group_free (const unsigned char *ctrl)
+{
+  return (msb_mask (~load_word (ctrl) & MSB)
+	  | msb_mask (~load_word (ctrl + 8) & MSB) << 8);
+}
+#endif
+
+/* Return the hash of KEY in HT, mixed so that the bits choosing the
+   group and those in the control byte are both spread well even for
+   keys that are merely consecutive.  */
+static inline uint32_t
+mix (hurd_ihash_t ht, hurd_ihash_key_t key)
+{
+  uint64_t k = hash (ht, key);
+  uint32_t h = k ^ (k >> 32);
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+/* The control byte of a used slot whose key has the mixed hash H.  */
+static inline unsigned char
+ctrl_byte (uint32_t h)
+{
+  return 0x80 | (h & 0x7f);
+}
+
 /* Return 1 if the slot with the index IDX in the hash table HT is
    empty, and 0 otherwise.  */
 static inline int
@@ -68,39 +213,79 @@ index_valid (hurd_ihash_t ht, unsigned int idx, hurd_ihash_key_t key)
 }
 
 
+/* Find the index of the key KEY, whose mixed hash is H, in the
+   array of SIZE items ITEMS with the control bytes CTRL of the hash
+   table HT, or else that of the first free slot where it could be
+   added.
+
+   The groups are probed in turn from the one given by the hash, until
+   one with an empty slot.  As slots are only emptied by a rehash, no
+   key can be found after such a group.  */
+static inline unsigned int
+probe (hurd_ihash_t ht, _hurd_ihash_item_t items, const unsigned char *ctrl,
+       size_t size, hurd_ihash_key_t key, uint32_t h)
+{
+  unsigned char byte = ctrl_byte (h);
+  unsigned int groups = size / GROUP;
+  unsigned int g = (h >> 7) & (groups - 1);
+  unsigned int first_free = 0;
+  int first_free_set = 0;
+  unsigned int n, m;
+
+  for (n = 0; n < groups; n++, g = (g + 1) & (groups - 1))
+    {
+      const unsigned char *group = &ctrl[g * GROUP];
+
+      for (m = group_match (group, byte); m; m &= m - 1)
+	{
+	  unsigned int idx = g * GROUP + __builtin_ctz (m);
+	  if (compare (ht, items[idx].key, key))
+	    return idx;
+	}
+
+      if (! first_free_set && (m = group_free (group)))
+	first_free = g * GROUP + __builtin_ctz (m), first_free_set = 1;
+
+      if (group_empty (group))
+	break;
+    }
+
+  /* The item could not be found.  Return the index of the first free
+     slot, as this is the position where we can insert an item with
+     the given key once we established that it is not in the table.  */
+  return first_free;
+}
+
+
 /* Given a hash table HT, and a key KEY, find the index in the table
    of that key.  You must subsequently check with index_valid() if the
-   returned index is valid.  */
-static inline int
-find_index (hurd_ihash_t ht, hurd_ihash_key_t key)
+   returned index is valid.  If CTRL is not NULL, the control byte for
+   KEY is returned there.  */
+static inline unsigned int
+find_index (hurd_ihash_t ht, hurd_ihash_key_t key, unsigned char *ctrl)
 {
-  unsigned int idx;
-  unsigned int up_idx;
-  unsigned int first_deleted = 0;
-  int first_deleted_set = 0;
-  unsigned int mask = ht->size - 1;
+  uint32_t h = mix (ht, key);
 
-  idx = hash (ht, key) & mask;
+  if (ctrl)
+    *ctrl = ctrl_byte (h);
+  return probe (ht, ht->items, ht->ctrl, ht->size, key, h);
+}
 
-  up_idx = idx;
-  do
-    {
-      if (ht->items[up_idx].value == _HURD_IHASH_EMPTY)
-        return first_deleted_set ? first_deleted : up_idx;
-      if (compare (ht, ht->items[up_idx].key, key))
-	return up_idx;
-      if (! first_deleted_set
-          && ht->items[up_idx].value == _HURD_IHASH_DELETED)
-        first_deleted = up_idx, first_deleted_set = 1;
-      up_idx = (up_idx + 1) & mask;
-    }
-  while (up_idx != idx);
 
-  /* If we end up here, the item could not be found.  Return the index
-     of the first deleted item, as this is the position where we can
-     insert an item with the given key once we established that it is
-     not in the table.  */
-  return first_deleted;
+/* Return the item with the key KEY in the previous array of items of
+   HT, if it is being resized and has one, and NULL otherwise.  */
+static inline _hurd_ihash_item_t
+find_old (hurd_ihash_t ht, hurd_ihash_key_t key)
+{
+  _hurd_ihash_item_t item;
+
+  if (ht->old_size == 0)
+    return NULL;
+
+  item = &ht->old_items[probe (ht, ht->old_items, ht->old_ctrl,
+			       ht->old_size, key, mix (ht, key))];
+  return (hurd_ihash_value_valid (item->value)
+	  && compare (ht, item->key, key)) ? item : NULL;
 }
 
 
@@ -116,10 +301,14 @@ locp_remove (hurd_ihash_t ht, hurd_ihash_locp_t locp)
     (*ht->cleanup) (item->value, ht->cleanup_data);
   item->value = _HURD_IHASH_DELETED;
   item->key = 0;
+  if (item >= ht->items && item < ht->items + ht->size)
+    ht->ctrl[item - ht->items] = CTRL_DELETED;
+  else
+    ht->old_ctrl[item - ht->old_items] = CTRL_DELETED;
   ht->nr_items--;
 }
 
-
+
 /* Construction and destruction of hash tables.  */
 
 /* Initialize the hash table at address HT.  */
@@ -134,6 +323,11 @@ hurd_ihash_init (hurd_ihash_t ht, intptr_t locp_offs)
   ht->fct_hash = NULL;
   ht->fct_cmp = NULL;
   ht->nr_free = 0;
+  ht->ctrl = NULL;
+  ht->old_items = NULL;
+  ht->old_ctrl = NULL;
+  ht->old_size = 0;
+  ht->old_next = 0;
 }
 
 
@@ -154,6 +348,8 @@ hurd_ihash_destroy (hurd_ihash_t ht)
 
   if (ht->size > 0)
     free (ht->items);
+  if (ht->old_size > 0)
+    free (ht->old_items);
 }
 
 
@@ -239,8 +435,9 @@ static inline int
 add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
 {
   unsigned int idx;
+  unsigned char ctrl;
 
-  idx = find_index (ht, key);
+  idx = find_index (ht, key, &ctrl);
 
   /* Remove the old entry for this key if necessary.  */
   if (index_valid (ht, idx, key))
@@ -256,6 +453,7 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
         }
       ht->items[idx].value = value;
       ht->items[idx].key = key;
+      ht->ctrl[idx] = ctrl;
 
       if (ht->locp_offset != HURD_IHASH_NO_LOCP)
 	*((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
@@ -289,6 +487,7 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
   /* In case of complications, fall back to hurd_ihash_add.  */
   if (ht->size == 0
       || item == NULL
+      || ht->old_size > 0
       || (hurd_ihash_value_valid (item->value)
           && ! compare (ht, item->key, key))
       || hurd_ihash_get_effective_load (ht) > ht->max_load)
@@ -297,6 +496,7 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
   if (! hurd_ihash_value_valid (item->value))
     {
       item->key = key;
+      ht->ctrl[item - ht->items] = ctrl_byte (mix (ht, key));
       ht->nr_items += 1;
       if (item->value == _HURD_IHASH_EMPTY)
         {
@@ -321,17 +521,83 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
 }
 
 
+/* The number of slots of the previous array of items each insertion
+   moves over while the table is being resized.  Growing doubles the
+   size, which leaves the table at half its maximum load, so the
+   previous array is emptied long before the current one has to be
+   resized in turn.  */
+#define MIGRATE_SLOTS 8
+
+/* Move the items in the next COUNT slots of the previous array of
+   items of HT to the current one, and free the previous array once
+   all are moved.  */
+static void
+migrate (hurd_ihash_t ht, size_t count)
+{
+  size_t i, end;
+
+  if (count > ht->old_size - ht->old_next)
+    count = ht->old_size - ht->old_next;
+  end = ht->old_next + count;
+
+  for (i = ht->old_next; i < end; i++)
+    {
+      _hurd_ihash_item_t item = &ht->old_items[i];
+      if (hurd_ihash_value_valid (item->value))
+	{
+	  int was_added;
+
+	  /* It is counted again by add_one.  */
+	  ht->nr_items--;
+	  was_added = add_one (ht, item->key, item->value);
+	  assert (was_added);
+	  item->value = _HURD_IHASH_DELETED;
+	  ht->old_ctrl[i] = CTRL_DELETED;
+	}
+    }
+  ht->old_next = end;
+
+  if (ht->old_next == ht->old_size)
+    {
+      free (ht->old_items);
+      ht->old_items = NULL;
+      ht->old_ctrl = NULL;
+      ht->old_size = 0;
+      ht->old_next = 0;
+    }
+}
+
+
 /* Add ITEM to the hash table HT under the key KEY.  If there already
    is an item under this key, call the cleanup function (if any) for
    it before overriding the value.  If a memory allocation error
-   occurs, ENOMEM is returned, otherwise 0.  */
+   occurs, ENOMEM is returned, otherwise 0.
+
+   The hash table is not rehashed all at once when it is resized: the
+   new array of items is used straight away, and the previous one is
+   kept until each insertion has moved a few of its items over.  This
+   bounds the time an insertion takes, but note that removals never
+   move items, so that they can be done while iterating.  */
 error_t
 hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
 {
-  struct hurd_ihash old_ht = *ht;
+  _hurd_ihash_item_t old_items;
+  unsigned char *old_ctrl;
+  size_t size;
   int was_added;
   int fatal = 0;	/* bail out on allocation errors */
-  unsigned int i;
+
+  if (ht->old_size > 0)
+    {
+      _hurd_ihash_item_t old;
+
+      migrate (ht, MIGRATE_SLOTS);
+
+      /* The key is in only one of the arrays.  */
+      old = find_old (ht, key);
+      if (old)
+	locp_remove (ht, &old->value);
+    }
 
   if (ht->size)
     {
@@ -342,22 +608,38 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
 	  return 0;
     }
 
+  if (ht->old_size > 0)
+    /* Insertions came faster than the previous array was emptied.
+       Finish with it before resizing again.  */
+    migrate (ht, ht->old_size);
+
   /* If the load exceeds the configured maximal load, then the hash
      table is too small, and we have to increase it.  Otherwise we
      merely rehash the table to get rid of the tombstones.  */
-  ht->nr_items = 0;
-  if (ht->size == 0)
-      ht->size = HURD_IHASH_MIN_SIZE;
-  else if (hurd_ihash_get_load (&old_ht) > ht->max_load)
-      ht->size <<= 1;
-  ht->nr_free = ht->size;
+  size = ht->size;
+  if (size == 0)
+    size = HURD_IHASH_MIN_SIZE;
+  else if (hurd_ihash_get_load (ht) > ht->max_load)
+    size <<= 1;
+
+  if (ht->size > 0)
+    {
+      /* The array about to become the previous one must not keep an
+	 entry for KEY, or migrating it would bring it back.  */
+      unsigned int idx = find_index (ht, key, NULL);
+      if (index_valid (ht, idx, key))
+	locp_remove (ht, &ht->items[idx].value);
+    }
 
-  /* calloc() will initialize all values to _HURD_IHASH_EMPTY implicitly.  */
-  ht->items = calloc (ht->size, sizeof (struct _hurd_ihash_item));
+  /* calloc() will initialize all values to _HURD_IHASH_EMPTY, and all
+     control bytes to CTRL_EMPTY, implicitly.  */
+  old_items = ht->items;
+  old_ctrl = ht->ctrl;
+  ht->items = calloc (size, sizeof (struct _hurd_ihash_item) + 1);
 
   if (ht->items == NULL)
     {
-      *ht = old_ht;
+      ht->items = old_items;
       if (fatal || ht->size == 0)
         return ENOMEM;
 
@@ -369,21 +651,21 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
       goto add_one;
     }
 
-  /* We have to rehash the old entries.  */
-  for (i = 0; i < old_ht.size; i++)
-    if (!index_empty (&old_ht, i))
-      {
-	was_added = add_one (ht, old_ht.items[i].key, old_ht.items[i].value);
-	assert (was_added);
-      }
+  /* The old entries are moved over by this and the next insertions.  */
+  ht->old_items = old_items;
+  ht->old_ctrl = old_ctrl;
+  ht->old_size = ht->size;
+  ht->old_next = 0;
+  ht->ctrl = (unsigned char *) &ht->items[size];
+  ht->size = size;
+  ht->nr_free = size;
+  if (ht->old_size > 0)
+    migrate (ht, MIGRATE_SLOTS);
 
   /* Finally add the new element!  */
   was_added = add_one (ht, key, item);
   assert (was_added);
 
-  if (old_ht.size > 0)
-    free (old_ht.items);
-
   return 0;
 }
 
@@ -397,8 +679,13 @@ hurd_ihash_find (hurd_ihash_t ht, hurd_ihash_key_t key)
     return NULL;
   else
     {
-      int idx = find_index (ht, key);
-      return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
+      unsigned int idx = find_index (ht, key, NULL);
+      _hurd_ihash_item_t old;
+
+      if (index_valid (ht, idx, key))
+	return ht->items[idx].value;
+      old = find_old (ht, key);
+      return old ? old->value : NULL;
     }
 }
 
@@ -420,7 +707,7 @@ hurd_ihash_locp_find (hurd_ihash_t ht,
 		      hurd_ihash_key_t key,
 		      hurd_ihash_locp_t *slot)
 {
-  int idx;
+  unsigned int idx;
 
   if (ht->size == 0)
     {
@@ -428,7 +715,16 @@ hurd_ihash_locp_find (hurd_ihash_t ht,
       return NULL;
     }
 
-  idx = find_index (ht, key);
+  idx = find_index (ht, key, NULL);
+  if (! index_valid (ht, idx, key))
+    {
+      _hurd_ihash_item_t old = find_old (ht, key);
+      if (old)
+	{
+	  *slot = &old->value;
+	  return old->value;
+	}
+    }
   *slot = &ht->items[idx].value;
   return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
 }
@@ -441,13 +737,21 @@ hurd_ihash_remove (hurd_ihash_t ht, hurd_ihash_key_t key)
 {
   if (ht->size != 0)
     {
-      int idx = find_index (ht, key);
-      
+      unsigned int idx = find_index (ht, key, NULL);
+      _hurd_ihash_item_t old;
+
       if (index_valid (ht, idx, key))
 	{
 	  locp_remove (ht, &ht->items[idx].value);
 	  return 1;
 	}
+
+      old = find_old (ht, key);
+      if (old)
+	{
+	  locp_remove (ht, &old->value);
+	  return 1;
+	}
     }
 
   return 0;
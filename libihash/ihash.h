@@ -116,6 +116,21 @@ struct hurd_ihash
 
   /* Number of free slots.  */
   size_t nr_free;
+
+  /* One control byte for each slot of ITEMS, allocated after them:
+     zero for an empty slot, one for a deleted one, and otherwise the
+     high bit and seven bits of the hash of the key.  Lookups compare
+     these a group at a time before looking at any key.  */
+  unsigned char *ctrl;
+
+  /* While the table is being resized, the previous array of items,
+     its control bytes and its size, and the index of the first slot in
+     it whose item has not been moved to ITEMS yet.  OLD_SIZE is zero
+     otherwise.  */
+  _hurd_ihash_item_t old_items;
+  unsigned char *old_ctrl;
+  size_t old_size;
+  size_t old_next;
 };
 typedef struct hurd_ihash *hurd_ihash_t;
 
@@ -302,6 +317,28 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    value of the current element is available in the variable VALUE
    (which is declared for you and local to the block).  */
 
+/* While the hash table is being resized, the items are in two arrays,
+   which are iterated over in turn.  Return the first item of HT, or
+   NULL if it has no array of items.  */
+static inline _hurd_ihash_item_t
+_hurd_ihash_first (struct hurd_ihash *ht)
+{
+  return ht->size ? &ht->items[0] : 0;
+}
+
+/* Return the item of HT after ITEM, or NULL if ITEM is the last.  */
+static inline _hurd_ihash_item_t
+_hurd_ihash_next (struct hurd_ihash *ht, _hurd_ihash_item_t item)
+{
+  if (item >= ht->items && item < ht->items + ht->size)
+    {
+      if (++item < ht->items + ht->size)
+	return item;
+      return ht->old_size ? &ht->old_items[0] : 0;
+    }
+  return ++item < ht->old_items + ht->old_size ? item : 0;
+}
+
 /* The implementation of this macro is peculiar.  We want the macro to
    execute a block following its invocation, so we can only prepend
    code.  This excludes creating an outer block.  However, we must
@@ -321,17 +358,17 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    after the loop condition is checked (but of course the value the
    pointer pointed to must not have an influence on the condition
    result, so the comma operator is used to make sure this
-   subexpression is always true).  */
+   subexpression is always true).
+
+   Items may be removed while iterating, but not added, as an insertion
+   may move items from one array to the other.  */
 #define HURD_IHASH_ITERATE(ht, val)					\
   for (hurd_ihash_value_t val,						\
-         *_hurd_ihash_valuep = (ht)->size ? &(ht)->items[0].value : 0;	\
-       (ht)->size							\
-	 && (size_t) ((_hurd_ihash_item_t) _hurd_ihash_valuep		\
-		      - &(ht)->items[0])				\
-            < (ht)->size						\
+         *_hurd_ihash_valuep = (hurd_ihash_value_t *) _hurd_ihash_first (ht); \
+       _hurd_ihash_valuep						\
          && (val = *_hurd_ihash_valuep, 1);				\
        _hurd_ihash_valuep = (hurd_ihash_value_t *)			\
-	 (((_hurd_ihash_item_t) _hurd_ihash_valuep) + 1))		\
+	 _hurd_ihash_next ((ht), (_hurd_ihash_item_t) _hurd_ihash_valuep)) \
     if (val != _HURD_IHASH_EMPTY && val != _HURD_IHASH_DELETED)
 
 /* Iterate over all elements in the hash table making both the key and
@@ -345,9 +382,9 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    key and value of the current element is available as ITEM->key and
    ITEM->value.  */
 #define HURD_IHASH_ITERATE_ITEMS(ht, item)                              \
-  for (_hurd_ihash_item_t item = (ht)->size? &(ht)->items[0]: 0;	\
-       (ht)->size && item - &(ht)->items[0] < (ht)->size;               \
-       item++)                                                          \
+  for (_hurd_ihash_item_t item = _hurd_ihash_first (ht);		\
+       item;								\
+       item = _hurd_ihash_next ((ht), item))				\
     if (item->value != _HURD_IHASH_EMPTY &&                             \
         item->value != _HURD_IHASH_DELETED)
 
@@ -22,6 +22,13 @@
 #include <hurd/hurd_types.h>
 #include <pthread.h>
 #include <hurd/shared.h>
+#include <hurd/ihash.h>
+
+#ifdef IOHELP_DEFINE_EI
+#define IOHELP_EI
+#else
+#define IOHELP_EI __extern_inline
+#endif
 
 /* Conch manipulation.  */
 struct conch
@@ -69,20 +76,99 @@ void iohelp_put_shared_data (void *);
 
 #include <idvec.h>
 
+/* The ids of an iouser.  All the iousers made by this library with the
+   same ids share one idset, which is never modified once made.  */
+struct iohelp_idset
+{
+  /* The ids, in the order they were given.  */
+  struct idvec uids, gids;
+
+  /* The same ids in ascending order without duplicates, for quick
+     membership tests.  */
+  uid_t *sorted_uids, *sorted_gids;
+  unsigned int nsorted_uids, nsorted_gids;
+
+  hurd_ihash_key_t hash;
+  unsigned int refcnt;
+  hurd_ihash_locp_t locp;
+
+  /* Room for the sorted ids.  */
+  uid_t sorted[];
+};
+
 struct iouser
 {
+  /* These point into IDSET when there is one, and must not be changed
+     then.  */
   struct idvec *uids, *gids;
   void *hook; /* Never used by iohelp library */
+
+  /* The shared ids, or NULL if the iouser was not made by this
+     library.  */
+  struct iohelp_idset *idset;
 };
 
-/* Return a copy of IOUSER in CLONE.  On error, *CLONE is set to NULL.  */
+/* Whether the ascending array IDS of N ids contains ID.  */
+extern int _iohelp_sorted_contains (const uid_t *ids, unsigned int n,
+				    uid_t id);
+
+/* Return nonzero if USER has the uid UID.  */
+extern int iohelp_iouser_has_uid (const struct iouser *user, uid_t uid);
+
+/* Return nonzero if USER has the gid GID.  */
+extern int iohelp_iouser_has_gid (const struct iouser *user, gid_t gid);
+
+#if defined(__USE_EXTERN_INLINES) || defined(IOHELP_DEFINE_EI)
+
+IOHELP_EI int
+_iohelp_sorted_contains (const uid_t *ids, unsigned int n, uid_t id)
+{
+  unsigned int lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      unsigned int mid = lo + (hi - lo) / 2;
+      if (ids[mid] < id)
+	lo = mid + 1;
+      else if (ids[mid] > id)
+	hi = mid;
+      else
+	return 1;
+    }
+  return 0;
+}
+
+IOHELP_EI int
+iohelp_iouser_has_uid (const struct iouser *user, uid_t uid)
+{
+  if (user->idset)
+    return _iohelp_sorted_contains (user->idset->sorted_uids,
+				    user->idset->nsorted_uids, uid);
+  return idvec_contains (user->uids, uid);
+}
+
+IOHELP_EI int
+iohelp_iouser_has_gid (const struct iouser *user, gid_t gid)
+{
+  if (user->idset)
+    return _iohelp_sorted_contains (user->idset->sorted_gids,
+				    user->idset->nsorted_gids, gid);
+  return idvec_contains (user->gids, gid);
+}
+
+#endif /* Use extern inlines.  */
+
+/* Return a copy of IOUSER in CLONE, sharing its ids.  On error, *CLONE
+   is set to NULL.  */
 error_t iohelp_dup_iouser (struct iouser **clone, struct iouser *iouser);
 
 /* Free a reference to IOUSER. */
 void iohelp_free_iouser (struct iouser *iouser);
 
-/* Create a new IOUSER in USER for the specified idvecs.  On error, *USER
-   is set to NULL.  */
+/* Create a new IOUSER in USER for the specified idvecs, which it
+   consumes; they may be freed right away should an iouser with the same
+   ids already exist.  On error, *USER is set to NULL and the idvecs are
+   left to the caller.  */
 error_t iohelp_create_iouser (struct iouser **user, struct idvec *uids,
 			      struct idvec *gids);
 
@@ -15,7 +15,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#include "iohelp.h"
+#include "priv.h"
 #include <stdlib.h>
 
 error_t
@@ -23,12 +23,22 @@ iohelp_create_iouser (struct iouser **user, struct idvec *uids,
 		      struct idvec *gids)
 {
   struct iouser *new;
+  error_t err;
+
   *user = new = malloc (sizeof (struct iouser));
   if (!new)
     return ENOMEM;
 
-  new->uids = uids;
-  new->gids = gids;
+  err = _iohelp_intern_ids (&new->idset, uids, gids);
+  if (err)
+    {
+      free (new);
+      *user = 0;
+      return err;
+    }
+
+  new->uids = &new->idset->uids;
+  new->gids = &new->idset->gids;
   new->hook = 0;
 
   return 0;
@@ -15,7 +15,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#include "iohelp.h"
+#include "priv.h"
 
 #include <stdlib.h>
 
@@ -23,36 +23,44 @@ error_t
 iohelp_dup_iouser (struct iouser **clone, struct iouser *iouser)
 {
   struct iouser *new;
-  error_t err = 0;
+  struct idvec *uids, *gids;
+  error_t err;
+
+  if (! iouser->idset)
+    {
+      /* Made by hand; make a proper one with the same ids.  */
+      uids = make_idvec ();
+      gids = make_idvec ();
+      if (!uids || !gids)
+	err = ENOMEM;
+      else
+	{
+	  err = idvec_set (uids, iouser->uids);
+	  if (!err)
+	    err = idvec_set (gids, iouser->gids);
+	  if (!err)
+	    err = iohelp_create_iouser (clone, uids, gids);
+	}
+      if (err)
+	{
+	  if (uids)
+	    idvec_free (uids);
+	  if (gids)
+	    idvec_free (gids);
+	  *clone = 0;
+	}
+      return err;
+    }
 
   *clone = new = malloc (sizeof (struct iouser));
   if (!new)
     return ENOMEM;
 
-  new->uids = make_idvec ();
-  new->gids = make_idvec ();
+  _iohelp_idset_ref (iouser->idset);
+  new->idset = iouser->idset;
+  new->uids = iouser->uids;
+  new->gids = iouser->gids;
   new->hook = 0;
-  if (!new->uids || !new->gids)
-    {
-      err = ENOMEM;
-      goto lose;
-    }
-
-  err = idvec_set (new->uids, iouser->uids);
-  if (!err)
-    err = idvec_set (new->gids, iouser->gids);
-
-  if (err)
-    {
-    lose:
-      if (new->uids)
-	idvec_free (new->uids);
-      if (new->gids)
-	idvec_free (new->gids);
-      free (new);
-      *clone = 0;
-      return err;
-    }
 
   return 0;
 }
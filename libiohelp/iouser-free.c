@@ -15,14 +15,19 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#include "iohelp.h"
+#include "priv.h"
 
 #include <stdlib.h>
 
 void
 iohelp_free_iouser (struct iouser *iouser)
 {
-  idvec_free (iouser->uids);
-  idvec_free (iouser->gids);
+  if (iouser->idset)
+    _iohelp_idset_rele (iouser->idset);
+  else
+    {
+      idvec_free (iouser->uids);
+      idvec_free (iouser->gids);
+    }
   free (iouser);
 }
@@ -0,0 +1,164 @@
+/* Sharing the ids of iousers
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A server usually has thousands of protids but only a handful of
+   different credentials among them, so each set of ids is kept once,
+   in this table, and the iousers count references to it.  A reference
+   may be taken without IDSET_LOCK by one who already holds one; but
+   only with the lock held may a reference be taken from the table or
+   the last one be dropped.  */
+
+static hurd_ihash_key_t
+idset_hash (const void *key)
+{
+  return ((const struct iohelp_idset *) key)->hash;
+}
+
+static int
+idset_compare (const void *key1, const void *key2)
+{
+  const struct iohelp_idset *a = key1, *b = key2;
+
+  return (a->hash == b->hash
+	  && idvec_equal (&a->uids, &b->uids)
+	  && idvec_equal (&a->gids, &b->gids));
+}
+
+static pthread_mutex_t idset_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hurd_ihash idsets =
+  HURD_IHASH_INITIALIZER_GKI (offsetof (struct iohelp_idset, locp),
+			      NULL, NULL, idset_hash, idset_compare);
+
+/* Copy the N ids of IDS to SORTED in ascending order, without
+   duplicates, and return how many there are then.  N is small.  */
+static unsigned int
+sort_ids (uid_t *sorted, const uid_t *ids, unsigned int n)
+{
+  unsigned int i, j, num = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      for (j = num; j > 0 && sorted[j - 1] > ids[i]; j--)
+	;
+      if (j > 0 && sorted[j - 1] == ids[i])
+	continue;
+      memmove (&sorted[j + 1], &sorted[j], (num - j) * sizeof *sorted);
+      sorted[j] = ids[i];
+      num++;
+    }
+
+  return num;
+}
+
+error_t
+_iohelp_intern_ids (struct iohelp_idset **idset,
+		    struct idvec *uids, struct idvec *gids)
+{
+  struct iohelp_idset key, *set;
+  error_t err;
+
+  key.uids = *uids;
+  key.gids = *gids;
+  key.hash = hurd_ihash_hash32 (uids->ids, uids->num * sizeof (uid_t),
+				uids->num);
+  key.hash = hurd_ihash_hash32 (gids->ids, gids->num * sizeof (gid_t),
+				key.hash);
+
+  pthread_mutex_lock (&idset_lock);
+
+  set = hurd_ihash_find (&idsets, (hurd_ihash_key_t) &key);
+  if (set)
+    {
+      __atomic_add_fetch (&set->refcnt, 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock (&idset_lock);
+      idvec_free (uids);
+      idvec_free (gids);
+      *idset = set;
+      return 0;
+    }
+
+  set = malloc (sizeof *set
+		+ (uids->num + gids->num) * sizeof (uid_t));
+  if (! set)
+    {
+      pthread_mutex_unlock (&idset_lock);
+      return ENOMEM;
+    }
+
+  set->uids = *uids;
+  set->gids = *gids;
+  set->sorted_uids = set->sorted;
+  set->nsorted_uids = sort_ids (set->sorted_uids, uids->ids, uids->num);
+  set->sorted_gids = set->sorted + set->nsorted_uids;
+  set->nsorted_gids = sort_ids (set->sorted_gids, gids->ids, gids->num);
+  set->hash = key.hash;
+  set->refcnt = 1;
+
+  err = hurd_ihash_add (&idsets, (hurd_ihash_key_t) set, set);
+  pthread_mutex_unlock (&idset_lock);
+  if (err)
+    {
+      free (set);
+      return err;
+    }
+
+  /* The idset has the ids now.  */
+  idvec_free_wrapper (uids);
+  idvec_free_wrapper (gids);
+  *idset = set;
+  return 0;
+}
+
+void
+_iohelp_idset_ref (struct iohelp_idset *set)
+{
+  __atomic_add_fetch (&set->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+void
+_iohelp_idset_rele (struct iohelp_idset *set)
+{
+  unsigned int refcnt = __atomic_load_n (&set->refcnt, __ATOMIC_RELAXED);
+
+  /* Not the last reference: no one can be looking SET up to revive it
+     in the table, so there's no need for the lock.  */
+  while (refcnt > 1)
+    if (__atomic_compare_exchange_n (&set->refcnt, &refcnt, refcnt - 1, 0,
+				     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+
+  pthread_mutex_lock (&idset_lock);
+  if (__atomic_sub_fetch (&set->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+    {
+      /* Someone found it in the table meanwhile.  */
+      pthread_mutex_unlock (&idset_lock);
+      return;
+    }
+  hurd_ihash_locp_remove (&idsets, set->locp);
+  pthread_mutex_unlock (&idset_lock);
+
+  idvec_fini (&set->uids);
+  idvec_fini (&set->gids);
+  free (set);
+}
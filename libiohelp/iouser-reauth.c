@@ -35,21 +35,18 @@ error_t iohelp_reauth (struct iouser **user,
   uid_t *gen_uids, *gen_gids, *aux_uids, *aux_gids;
   mach_msg_type_number_t genuidlen, gengidlen, auxuidlen, auxgidlen;
   error_t err;
-  struct iouser *new;
+  struct idvec *uids, *gids;
 
-  *user = new = malloc (sizeof (struct iouser));
-  if (!new)
-    return ENOMEM;
+  *user = 0;
 
-  new->uids = make_idvec ();
-  new->gids = make_idvec ();
-  if (!new->uids || !new->gids)
+  uids = make_idvec ();
+  gids = make_idvec ();
+  if (!uids || !gids)
     {
-      if (new->uids)
-	idvec_free (new->uids);
-      if (new->gids)
-	idvec_free (new->gids);
-      free (new);
+      if (uids)
+	idvec_free (uids);
+      if (gids)
+	idvec_free (gids);
       return ENOMEM;
     }
 
@@ -79,9 +76,9 @@ error_t iohelp_reauth (struct iouser **user,
 	goto out;
     }
 
-  err = idvec_set_ids (new->uids, gen_uids, genuidlen);
+  err = idvec_set_ids (uids, gen_uids, genuidlen);
   if (!err)
-    err = idvec_set_ids (new->gids, gen_gids, gengidlen);
+    err = idvec_set_ids (gids, gen_gids, gengidlen);
 
   if (gubuf != gen_uids)
     munmap ((caddr_t) gen_uids, genuidlen * sizeof (uid_t));
@@ -92,16 +89,15 @@ error_t iohelp_reauth (struct iouser **user,
   if (agbuf != aux_gids)
     munmap ((caddr_t) aux_gids, auxgidlen * sizeof (uid_t));
 
+  if (!err)
+    err = iohelp_create_iouser (user, uids, gids);
+
   if (err)
     {
     out:
-      idvec_free (new->uids);
-      idvec_free (new->gids);
-      free (new);
+      idvec_free (uids);
+      idvec_free (gids);
       *user = 0;
-      return err;
     }
-
-  *user = new;
-  return 0;
+  return err;
 }
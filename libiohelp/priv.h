@@ -0,0 +1,36 @@
+/* Private declarations for libiohelp
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _IOHELP_PRIV_H
+#define _IOHELP_PRIV_H
+
+#include "iohelp.h"
+
+/* Return in *IDSET a reference to the shared idset with the ids UIDS
+   and GIDS, which are consumed.  On error, they are left alone.  */
+error_t _iohelp_intern_ids (struct iohelp_idset **idset,
+			    struct idvec *uids, struct idvec *gids);
+
+/* Add a reference to SET, of which the caller already has one.  */
+void _iohelp_idset_ref (struct iohelp_idset *set);
+
+/* Drop a reference to SET, freeing it if it was the last.  */
+void _iohelp_idset_rele (struct iohelp_idset *set);
+
+#endif /* _IOHELP_PRIV_H */
@@ -59,6 +59,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <error.h>
 #include <assert.h>
@@ -69,6 +70,7 @@
 #include <device/device.h> /* fallback to kernel device */
 
 #include "device_S.h"
+#include "device_reply_U.h"
 #include "libports/notify_S.h"
 #include "machdev-dev_hdr.h"
 #include "machdev.h"
@@ -83,10 +85,141 @@ struct port_class *machdev_device_class;
 static struct machdev_device_emulation_ops *emulation_list[MAX_NUM_EMULATION];
 static int num_emul = 0;
 
+/* A read or write an emulation finished after returning MIG_NO_REPLY,
+   waiting for its reply to be sent.  */
+struct completion
+{
+  struct completion *next;
+  mach_port_t reply_port;
+  mach_msg_type_name_t reply_port_type;
+  int write;
+  io_return_t err;
+  io_buf_ptr_t data;		/* for a read */
+  unsigned int count;
+};
+
+static struct completion *completions, **completions_tail = &completions;
+static pthread_mutex_t completions_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t completions_cond = PTHREAD_COND_INITIALIZER;
+
 /*
  * What follows is the interface for the native Mach devices.
  */
 
+/* Send the replies of the finished requests.  The threads of the
+   emulations only queue them, and all that finished since the last round
+   are sent at once.  */
+static void *
+completion_thread (void *arg)
+{
+  mach_port_t host_priv, self;
+
+  /* The emulation may be paging, and its replies with it.  */
+  if (! get_privileged_ports (&host_priv, NULL))
+    {
+      self = mach_thread_self ();
+      thread_wire (host_priv, self, TRUE);
+      mach_port_deallocate (mach_task_self (), self);
+      mach_port_deallocate (mach_task_self (), host_priv);
+    }
+
+  for (;;)
+    {
+      struct completion *c, *next;
+
+      pthread_mutex_lock (&completions_lock);
+      while (! completions)
+	pthread_cond_wait (&completions_cond, &completions_lock);
+      c = completions;
+      completions = NULL;
+      completions_tail = &completions;
+      pthread_mutex_unlock (&completions_lock);
+
+      for (; c; c = next)
+	{
+	  next = c->next;
+	  if (c->write)
+	    ds_device_write_reply (c->reply_port, c->reply_port_type,
+				   c->err, c->count);
+	  else
+	    /* This consumes DATA.  */
+	    ds_device_read_reply (c->reply_port, c->reply_port_type,
+				  c->err, c->data, c->count);
+	  free (c);
+	}
+    }
+
+  return NULL;
+}
+
+static void
+start_completion_thread (void)
+{
+  pthread_t t;
+  int err;
+
+  err = pthread_create (&t, NULL, completion_thread, NULL);
+  if (err)
+    error (1, err, "pthread_create");
+  pthread_detach (t);
+}
+
+/* Queue the reply of a request, sending it right away if that fails.  */
+static void
+complete (mach_port_t reply_port, mach_msg_type_name_t reply_port_type,
+	  int write, io_return_t err, io_buf_ptr_t data, unsigned int count)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  struct completion *c;
+
+  c = malloc (sizeof *c);
+  if (! c)
+    {
+      if (write)
+	ds_device_write_reply (reply_port, reply_port_type, err, count);
+      else
+	ds_device_read_reply (reply_port, reply_port_type, err, data, count);
+      return;
+    }
+
+  pthread_once (&once, start_completion_thread);
+
+  c->next = NULL;
+  c->reply_port = reply_port;
+  c->reply_port_type = reply_port_type;
+  c->write = write;
+  c->err = err;
+  c->data = data;
+  c->count = count;
+
+  pthread_mutex_lock (&completions_lock);
+  *completions_tail = c;
+  completions_tail = &c->next;
+  pthread_cond_signal (&completions_cond);
+  pthread_mutex_unlock (&completions_lock);
+}
+
+/* Finish a device_read for which the emulation returned MIG_NO_REPLY,
+   sending ERR and the COUNT bytes of DATA to REPLY_PORT.  DATA is
+   consumed.  */
+void
+machdev_read_done (mach_port_t reply_port,
+		   mach_msg_type_name_t reply_port_type,
+		   io_return_t err, io_buf_ptr_t data, unsigned int count)
+{
+  complete (reply_port, reply_port_type, 0, err, data, count);
+}
+
+/* Finish a device_write for which the emulation returned MIG_NO_REPLY,
+   sending ERR and COUNT written bytes to REPLY_PORT.  */
+void
+machdev_write_done (mach_port_t reply_port,
+		    mach_msg_type_name_t reply_port_type,
+		    io_return_t err, int count)
+{
+  complete (reply_port, reply_port_type, 1, err, 0, count);
+}
+
 /* Implementation of device interface */
 io_return_t
 ds_device_open (mach_port_t open_port, mach_port_t reply_port,
@@ -152,6 +285,8 @@ ds_device_close (struct mach_device *device)
 	  : D_SUCCESS);
 }
 
+/* The emulation may return MIG_NO_REPLY from its read and write, and
+   reply later with machdev_read_done and machdev_write_done.  */
 io_return_t
 ds_device_write (struct mach_device *device, mach_port_t reply_port,
 		 mach_msg_type_name_t reply_port_type, dev_mode_t mode,
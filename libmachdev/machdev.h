@@ -42,4 +42,16 @@ void * machdev_trivfs_server_loop(void *);
 void * machdev_trivfs_server_loop_forever(void *);
 boolean_t machdev_is_master_device (mach_port_t port);
 
+/* The read and write operations of an emulation may keep the reply
+   port and return MIG_NO_REPLY, for the request to be finished later,
+   from any thread, with one of these.  They don't wait for the reply to
+   be sent.  */
+void machdev_read_done (mach_port_t reply_port,
+			mach_msg_type_name_t reply_port_type,
+			io_return_t err, io_buf_ptr_t data,
+			unsigned int count);
+void machdev_write_done (mach_port_t reply_port,
+			 mach_msg_type_name_t reply_port_type,
+			 io_return_t err, int count);
+
 #endif
@@ -19,12 +19,30 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#include "netfs.h"
+#include <argz.h>
+#include <stdio.h>
+#include "priv.h"
 
 /* Appends to ARGZ & ARGZ_LEN '\0'-separated options describing the standard
    netfs option state.  */
 error_t
 netfs_append_std_options (char **argz, size_t *argz_len)
 {
-  return 0;
+  error_t err = 0;
+  char buf[40];
+
+  if (_netfs_lookup_cache_ttl)
+    {
+      snprintf (buf, sizeof buf, "--lookup-cache-ttl=%d",
+		_netfs_lookup_cache_ttl);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err && _netfs_stat_cache_ttl)
+    {
+      snprintf (buf, sizeof buf, "--stat-cache-ttl=%d",
+		_netfs_stat_cache_ttl);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  return err;
 }
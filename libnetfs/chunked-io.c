@@ -0,0 +1,155 @@
+/* Reads and writes done in several pieces at once
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "priv.h"
+
+error_t __attribute__ ((weak))
+netfs_attempt_read_unlocked (struct iouser *cred, struct node *np,
+			     loff_t offset, size_t *len, void *data)
+{
+  return EOPNOTSUPP;
+}
+
+error_t __attribute__ ((weak))
+netfs_attempt_write_unlocked (struct iouser *cred, struct node *np,
+			      loff_t offset, size_t *len, const void *data)
+{
+  return EOPNOTSUPP;
+}
+
+/* Set once the user functions have said they aren't there.  */
+static int no_unlocked_io[2];
+
+struct chunked_io
+{
+  struct iouser *cred;
+  struct node *np;
+  int write;
+  loff_t offset;
+  size_t len;
+  char *data;
+
+  size_t chunks;
+  size_t next;			/* The next chunk to do.  */
+  size_t *done;			/* The amount done of each chunk.  */
+  error_t *errs;		/* And how it went.  */
+};
+
+/* Do chunks of IO until there are none left.  */
+static void *
+chunk_worker (void *arg)
+{
+  struct chunked_io *io = arg;
+  size_t i;
+
+  while ((i = __atomic_fetch_add (&io->next, 1, __ATOMIC_RELAXED))
+	 < io->chunks)
+    {
+      size_t start = i * NETFS_IO_CHUNK;
+      size_t len = io->len - start;
+
+      if (len > NETFS_IO_CHUNK)
+	len = NETFS_IO_CHUNK;
+
+      if (io->write)
+	io->errs[i] = netfs_attempt_write_unlocked (io->cred, io->np,
+						    io->offset + start, &len,
+						    io->data + start);
+      else
+	io->errs[i] = netfs_attempt_read_unlocked (io->cred, io->np,
+						   io->offset + start, &len,
+						   io->data + start);
+      io->done[i] = len;
+    }
+
+  return NULL;
+}
+
+error_t
+_netfs_chunked_io (struct iouser *cred, struct node *np, int write,
+		   loff_t offset, size_t *len, void *data)
+{
+  struct chunked_io io;
+  pthread_t threads[NETFS_IO_THREADS - 1];
+  int nthreads, i;
+  size_t total, c;
+  error_t err = 0;
+
+  if (no_unlocked_io[write])
+    return EOPNOTSUPP;
+
+  io.cred = cred;
+  io.np = np;
+  io.write = write;
+  io.offset = offset;
+  io.len = *len;
+  io.data = data;
+  io.chunks = (*len + NETFS_IO_CHUNK - 1) / NETFS_IO_CHUNK;
+  io.next = 0;
+  io.done = calloc (io.chunks, sizeof *io.done);
+  io.errs = calloc (io.chunks, sizeof *io.errs);
+  if (! io.done || ! io.errs)
+    {
+      free (io.done);
+      free (io.errs);
+      return ENOMEM;
+    }
+
+  /* This thread does its share too, and all of it if no other thread
+     can be had.  */
+  for (nthreads = 0;
+       nthreads < NETFS_IO_THREADS - 1 && nthreads + 1 < io.chunks;
+       nthreads++)
+    if (pthread_create (&threads[nthreads], NULL, chunk_worker, &io))
+      break;
+  chunk_worker (&io);
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+
+  /* What was done is what comes before the first chunk that failed or
+     came up short.  */
+  for (total = c = 0; c < io.chunks; c++)
+    {
+      size_t want = *len - c * NETFS_IO_CHUNK;
+      if (want > NETFS_IO_CHUNK)
+	want = NETFS_IO_CHUNK;
+
+      if (io.errs[c])
+	{
+	  /* As with a short read or write, report what was done first.  */
+	  if (total == 0)
+	    err = io.errs[c];
+	  break;
+	}
+      total += io.done[c];
+      if (io.done[c] < want)
+	break;
+    }
+
+  if (err == EOPNOTSUPP)
+    no_unlocked_io[write] = 1;
+
+  free (io.done);
+  free (io.errs);
+  *len = total;
+  return err;
+}
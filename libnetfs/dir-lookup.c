@@ -22,7 +22,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <hurd/paths.h>
-#include "netfs.h"
+#include "priv.h"
 #include "fs_S.h"
 #include "callbacks.h"
 #include "misc.h"
@@ -172,7 +172,7 @@ netfs_S_dir_lookup (struct protid *dircred,
 	  }
       else
 	/* Attempt a lookup on the next pathname component. */
-	err = netfs_attempt_lookup (dircred->user, dnp, filename, &np);
+	err = _netfs_lookup (dircred->user, dnp, filename, &np);
 
       /* At this point, DNP is unlocked */
 
@@ -186,8 +186,10 @@ netfs_S_dir_lookup (struct protid *dircred,
 	  mode &= ~(S_IFMT | S_ISPARE | S_ISVTX);
 	  mode |= S_IFREG;
 	  pthread_mutex_lock (&dnp->lock);
+	  netfs_purge_stat_cache (dnp);
 	  err = netfs_attempt_create_file (dircred->user, dnp,
 					   filename, mode, &np);
+	  netfs_purge_lookup_cache (dnp, filename);
 
 	  /* If someone has already created the file (between our lookup
 	     and this create) then we just got EEXIST.  If we are
@@ -205,7 +207,7 @@ netfs_S_dir_lookup (struct protid *dircred,
       if (err)
 	goto out;
 
-      err = netfs_validate_stat (np, dircred->user);
+      err = _netfs_validate_stat (np, dircred->user);
       if (err)
 	goto out;
 
@@ -412,7 +414,7 @@ netfs_S_dir_lookup (struct protid *dircred,
 
   if (mustbedir || (flags & O_DIRECTORY))
     {
-      err = netfs_validate_stat (np, dircred->user);
+      err = _netfs_validate_stat (np, dircred->user);
       if (err)
 	goto out;
       if (!S_ISDIR (np->nn_stat.st_mode))
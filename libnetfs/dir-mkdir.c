@@ -34,6 +34,8 @@ netfs_S_dir_mkdir (struct protid *user, const_string_t name, mode_t mode)
 
   pthread_mutex_lock (&user->po->np->lock);
   err = netfs_attempt_mkdir (user->user, user->po->np, name, mode);
+  netfs_purge_lookup_cache (user->po->np, name);
+  netfs_purge_stat_cache (user->po->np);
   pthread_mutex_unlock (&user->po->np->lock);
   return err;
 }
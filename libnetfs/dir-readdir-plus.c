@@ -0,0 +1,137 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "priv.h"
+#include "fs_S.h"
+
+/* Store in *ST what io_stat on NP through USER would return, unless a
+   lookup of NP would start or reach a translator.  NP must be locked.  */
+static void
+stat_node (struct protid *user, struct node *np, io_statbuf_t *st)
+{
+  if (_netfs_validate_stat (np, user->user)
+      || (np->nn_translated & S_IPTRANS)
+      || S_ISFIFO (np->nn_translated)
+      || S_ISCHR (np->nn_translated)
+      || S_ISBLK (np->nn_translated)
+      || fshelp_translated (&np->transbox))
+    return;
+
+  memcpy (st, &np->nn_stat, sizeof (struct stat));
+  st->st_mode &= ~(S_IATRANS | S_IROOT);
+  if (user->po->shadow_root == np || np == netfs_root_node)
+    st->st_mode |= S_IROOT;
+}
+
+/* Fill STATS with the status of the AMT entries in DATA of directory
+   DIR, which is locked.  */
+static void
+stat_entries (struct protid *user, struct node *dir, char *data, int amt,
+	      io_statbuf_t *stats)
+{
+  char *p = data;
+  int i;
+
+  for (i = 0; i < amt; i++)
+    {
+      struct dirent *d = (struct dirent *) p;
+      struct node *np;
+
+      p += d->d_reclen;
+
+      if (d->d_namlen == 1 && d->d_name[0] == '.')
+	{
+	  stat_node (user, dir, &stats[i]);
+	  continue;
+	}
+      if (d->d_namlen == 2 && d->d_name[0] == '.' && d->d_name[1] == '.')
+	continue;
+
+      /* _netfs_lookup unlocks DIR.  */
+      if (_netfs_lookup (user->user, dir, d->d_name, &np) == 0)
+	{
+	  stat_node (user, np, &stats[i]);
+	  netfs_nput (np);
+	}
+      pthread_mutex_lock (&dir->lock);
+    }
+}
+
+kern_return_t
+netfs_S_dir_readdir_plus (struct protid *user,
+			  data_t *data,
+			  mach_msg_type_number_t *datacnt,
+			  boolean_t *data_dealloc,
+			  data_t *stats,
+			  mach_msg_type_number_t *statscnt,
+			  boolean_t *stats_dealloc,
+			  int entry,
+			  int nentries,
+			  vm_size_t bufsiz,
+			  int *amt)
+{
+  error_t err;
+  struct node *np;
+  size_t size;
+
+  if (!user)
+    return EOPNOTSUPP;
+
+  np = user->po->np;
+  pthread_mutex_lock (&np->lock);
+
+  err = 0;
+  if ((user->po->openstat & O_READ) == 0)
+    err = EBADF;
+  if (!err)
+    err = _netfs_validate_stat (np, user->user);
+  if (!err && (np->nn_stat.st_mode & S_IFMT) != S_IFDIR)
+    err = ENOTDIR;
+  if (!err)
+    err = fshelp_access (&np->nn_stat, S_IEXEC, user->user);
+  if (!err)
+    err = netfs_get_dirents (user->user, np, entry, nentries, data,
+			     datacnt, bufsiz, amt);
+  *data_dealloc = 1;		/* XXX */
+
+  if (!err)
+    {
+      size = *amt * sizeof (io_statbuf_t);
+      if (size > *statscnt)
+	{
+	  *stats = mmap (0, size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+	  if (*stats == MAP_FAILED)
+	    err = ENOMEM;
+	}
+    }
+  if (!err)
+    {
+      *statscnt = size;
+      *stats_dealloc = 1;
+      memset (*stats, 0, size);
+      stat_entries (user, np, *data, *amt, (io_statbuf_t *) *stats);
+    }
+
+  pthread_mutex_unlock (&np->lock);
+  return err;
+}
@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "fs_S.h"
 
 kern_return_t
@@ -36,6 +36,8 @@ netfs_S_dir_rename (struct protid *fromdiruser, const_string_t fromname,
   /* Note that nothing is locked here */
   err = netfs_attempt_rename (fromdiruser->user, fromdiruser->po->np, 
 			      fromname, todiruser->po->np, toname, excl);
+  _netfs_purge_dir (fromdiruser->po->np, fromname);
+  _netfs_purge_dir (todiruser->po->np, toname);
   if (!err)
     mach_port_deallocate (mach_task_self (), todiruser->pi.port_right);
   return err;
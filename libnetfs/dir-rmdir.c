@@ -31,6 +31,8 @@ netfs_S_dir_rmdir (struct protid *diruser, const_string_t name)
 
   pthread_mutex_lock (&diruser->po->np->lock);
   err = netfs_attempt_rmdir (diruser->user, diruser->po->np, name);
+  netfs_purge_lookup_cache (diruser->po->np, name);
+  netfs_purge_stat_cache (diruser->po->np);
   pthread_mutex_unlock (&diruser->po->np->lock);
   return err;
 }
@@ -0,0 +1,38 @@
+/* libnetfs implementation of fs.defs: file_advise
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "netfs.h"
+#include "fs_S.h"
+
+/* Netfs has no hooks to act on advice; as it is only a hint, accept
+   and ignore it.  */
+kern_return_t
+netfs_S_file_advise (struct protid *user,
+		     off_t offset,
+		     off_t length,
+		     int advice)
+{
+  if (!user)
+    return EOPNOTSUPP;
+
+  if (offset < 0 || length < 0)
+    return EINVAL;
+
+  return 0;
+}
@@ -34,6 +34,7 @@ netfs_S_file_chmod (struct protid *user,
   
   pthread_mutex_lock (&user->po->np->lock);
   err = netfs_attempt_chmod (user->user, user->po->np, mode);
+  netfs_purge_stat_cache (user->po->np);
   pthread_mutex_unlock (&user->po->np->lock);
   return err;
 }
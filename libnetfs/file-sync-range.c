@@ -0,0 +1,44 @@
+/* libnetfs implementation of fs.defs: file_sync_range
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "netfs.h"
+#include "fs_S.h"
+
+/* There's no way to sync only part of a file with netfs_attempt_sync,
+   so sync all of it.  */
+kern_return_t
+netfs_S_file_sync_range (struct protid *user,
+			 off_t offset,
+			 off_t length,
+			 int wait,
+			 int omitmeta)
+{
+  error_t err;
+
+  if (!user)
+    return EOPNOTSUPP;
+
+  if (offset < 0 || length < 0)
+    return EINVAL;
+
+  pthread_mutex_lock (&user->po->np->lock);
+  err = netfs_attempt_sync (user->user, user->po->np, wait);
+  pthread_mutex_unlock (&user->po->np->lock);
+  return err;
+}
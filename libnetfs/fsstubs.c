@@ -43,3 +43,23 @@ netfs_S_ifsock_getsockaddr (struct protid *user,
 {
   return EOPNOTSUPP;
 }
+
+kern_return_t __attribute__((weak))
+netfs_S_file_copy_range (struct protid *user,
+			 off_t in_offset,
+			 struct protid *target,
+			 off_t out_offset,
+			 off_t length,
+			 off_t *copied)
+{
+  return EOPNOTSUPP;
+}
+
+kern_return_t __attribute__((weak))
+netfs_S_file_allocate (struct protid *user,
+		       off_t offset,
+		       off_t length,
+		       int flags)
+{
+  return EOPNOTSUPP;
+}
@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "fsys_S.h"
 #include "misc.h"
 #include "callbacks.h"
@@ -58,7 +58,7 @@ netfs_S_fsys_getroot (struct netfs_control *pt,
   flags &= O_HURD;
 
   pthread_mutex_lock (&netfs_root_node->lock);
-  err = netfs_validate_stat (netfs_root_node, cred);
+  err = _netfs_validate_stat (netfs_root_node, cred);
   if (err)
     goto out;
 
@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 
 kern_return_t
@@ -38,7 +38,7 @@ netfs_S_io_identity (struct protid *cred,
   np = cred->po->np;
   pthread_mutex_lock (&np->lock);
 
-  err = netfs_validate_stat (np, cred->user);
+  err = _netfs_validate_stat (np, cred->user);
   if (err)
     {
       pthread_mutex_unlock (&np->lock);
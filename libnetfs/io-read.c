@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -34,6 +34,7 @@ netfs_S_io_read (struct protid *user,
   off_t start;
   struct node *node;
   int alloced = 0;
+  int moved = 0;
   size_t data_size = *datalen;
 
   if (!user)
@@ -92,9 +93,42 @@ netfs_S_io_read (struct protid *user,
     }
   else
     /* Read from a normal file.  */
-    err = netfs_attempt_read (user->user, node, start, &data_size, *data);
+    {
+      err = EOPNOTSUPP;
+
+      if (data_size >= 2 * NETFS_IO_CHUNK)
+	/* Let go of the node while the pieces are read; our open keeps a
+	   reference on it.  Meanwhile the file pointer is past the whole
+	   request, so that a concurrent read through the same open doesn't
+	   read the same data.  It is then put back to where this read
+	   started, to be moved below, unless someone moved it since.  */
+	{
+	  size_t want = data_size;
+
+	  if (offset == -1)
+	    user->po->filepointer = start + want;
+	  pthread_mutex_unlock (&node->lock);
+
+	  err = _netfs_chunked_io (user->user, node, 0, start, &data_size,
+				   *data);
+
+	  pthread_mutex_lock (&node->lock);
+	  if (offset == -1)
+	    {
+	      if (user->po->filepointer == start + want)
+		user->po->filepointer = start;
+	      else
+		moved = 1;
+	    }
+	  if (err == EOPNOTSUPP)
+	    data_size = want;
+	}
+
+      if (err == EOPNOTSUPP)
+	err = netfs_attempt_read (user->user, node, start, &data_size, *data);
+    }
 
-  if (offset == -1 && !err)
+  if (offset == -1 && !err && !moved)
     user->po->filepointer += data_size;
 
   pthread_mutex_unlock (&node->lock);
@@ -20,7 +20,7 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
 #include <fcntl.h>
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 
 kern_return_t
@@ -36,7 +36,7 @@ netfs_S_io_readable (struct protid *user,
     return EINVAL;
   
   pthread_mutex_lock (&user->po->np->lock);
-  err = netfs_validate_stat (user->po->np, user->user);
+  err = _netfs_validate_stat (user->po->np, user->user);
   if (!err)
     {
       if (user->po->np->nn_stat.st_size > user->po->filepointer)
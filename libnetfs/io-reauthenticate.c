@@ -60,7 +60,7 @@ netfs_S_io_reauthenticate (struct protid *user, mach_port_t rend_port)
   mach_port_deallocate (mach_task_self (), newright);
 
   mach_port_move_member (mach_task_self (), newpi->pi.port_right,
-			 netfs_port_bucket->portset);
+			 ports_bucket_portset (netfs_port_bucket, &newpi->pi));
 
   pthread_mutex_unlock (&user->po->np->lock);
   ports_port_deref (newpi);
@@ -16,7 +16,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 
 /* Implement io_revoke as described in <hurd/io.defs>. */
@@ -43,7 +43,7 @@ netfs_S_io_revoke (struct protid *cred)
 
   pthread_mutex_lock (&np->lock);
 
-  err = netfs_validate_stat (np, cred->user);
+  err = _netfs_validate_stat (np, cred->user);
   if (!err)
     err = fshelp_isowner (&np->nn_stat, cred->user);
 
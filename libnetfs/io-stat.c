@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 #include <string.h>
 
@@ -34,7 +34,7 @@ netfs_S_io_stat (struct protid *user, io_statbuf_t *statbuf)
   node = user->po->np;
   pthread_mutex_lock (&node->lock);
 
-  err = netfs_validate_stat (node, user->user);
+  err = _netfs_validate_stat (node, user->user);
   if (! err)
     {
       memcpy (statbuf, &node->nn_stat, sizeof (struct stat));
@@ -18,7 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-#include "netfs.h"
+#include "priv.h"
 #include "io_S.h"
 #include <fcntl.h>
 
@@ -32,6 +32,7 @@ netfs_S_io_write (struct protid *user,
   error_t err;
   off_t off = offset;
   struct node *np;
+  int moved = 0;
   
   if (!user)
     return EOPNOTSUPP;
@@ -48,6 +49,7 @@ netfs_S_io_write (struct protid *user,
     {
       if (user->po->openstat & O_APPEND)
 	{
+	  /* Appending needs the size the file has now.  */
 	  err = netfs_validate_stat (np, user->user);
 	  if (err)
 	    {
@@ -59,8 +61,38 @@ netfs_S_io_write (struct protid *user,
       off = user->po->filepointer;
     }
 
-  err =  netfs_attempt_write (user->user, np, off, amount, data);
-  if (offset == -1 && !err)
+  err = EOPNOTSUPP;
+  if (*amount >= 2 * NETFS_IO_CHUNK && !(user->po->openstat & O_APPEND))
+    /* As io_read does, let go of the node while the pieces are written,
+       with the file pointer past them meanwhile.  Appends stay whole and
+       in order.  */
+    {
+      vm_size_t want = *amount;
+      size_t len = want;
+
+      if (offset == -1)
+	user->po->filepointer = off + want;
+      pthread_mutex_unlock (&np->lock);
+
+      err = _netfs_chunked_io (user->user, np, 1, off, &len, (void *) data);
+      *amount = len;
+
+      pthread_mutex_lock (&np->lock);
+      if (offset == -1)
+	{
+	  if (user->po->filepointer == off + want)
+	    user->po->filepointer = off;
+	  else
+	    moved = 1;
+	}
+      if (err == EOPNOTSUPP)
+	*amount = want;
+    }
+
+  if (err == EOPNOTSUPP)
+    err = netfs_attempt_write (user->user, np, off, amount, data);
+  netfs_purge_stat_cache (np);
+  if (offset == -1 && !err && !moved)
     user->po->filepointer += *amount;
   pthread_mutex_unlock (&np->lock);
   
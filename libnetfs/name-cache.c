@@ -0,0 +1,415 @@
+/* Directory name lookup caching
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include <hurd/fshelp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The name cache is a hash table of buckets of a fixed size, split into
+   shards by the low bits of the hash so that lookups in different
+   directories rarely meet.  As in libdiskfs, the least-frequently used
+   entry of a bucket is replaced, approximated by a saturating count of
+   the lookups of each entry.
+
+   The network filesystems have no numbers to find their nodes with, so
+   an entry holds a reference to its directory and to the node it
+   names, dropped when the entry is replaced, purged, or found expired.
+   Each entry lives for as long as netfs_lookup_cache_ttl said when it
+   was made; a negative entry records that the name was not found.
+
+   A lookup does not keep a shard locked while asking the translator.
+   For no change made meanwhile to leave a stale entry behind, the
+   generation of the directory is read before asking, and the answer is
+   not entered if a purge has changed it since.  */
+
+/* Number of shards.  Must be a power of two.  */
+#define CACHE_SHARDS	16
+
+/* Buckets per shard.  Must be a power of two.  */
+#define SHARD_BUCKETS	64
+
+/* Entries per bucket.  */
+#define BUCKET_SIZE	4
+
+/* The longest name that is cached; it makes an entry 64 bytes.  */
+#define CACHE_NAME_LEN	34
+
+struct cache_entry
+{
+  /* The directory, or NULL if the entry is unused.  */
+  struct node *dir;
+
+  /* The node named, or NULL for a `negative' entry -- recording that
+     there's no node with this name.  */
+  struct node *np;
+
+  /* When the entry expires, in milliseconds.  */
+  uint64_t expires;
+
+  /* The key.  */
+  uint32_t key;
+
+  /* Approximation of use frequency, 0 to 3.  */
+  uint8_t frequ;
+
+  /* Length of NAME.  */
+  uint8_t len;
+
+  /* Name of NP in DIR, not NUL-terminated.  */
+  char name[CACHE_NAME_LEN];
+};
+
+struct cache_bucket
+{
+  struct cache_entry entry[BUCKET_SIZE];
+};
+
+struct cache_shard
+{
+  pthread_mutex_t lock;
+
+  /* If there is no best candidate to replace, pick any.  We approximate
+     any by picking the slot depicted by REPLACE, and increment REPLACE
+     then.  */
+  int replace;
+
+  /* NULL until the first entry is made.  */
+  struct cache_bucket *bucket;
+} __attribute__ ((aligned (64)));
+
+static struct cache_shard name_cache[CACHE_SHARDS] =
+{
+  [0 ... CACHE_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+int _netfs_lookup_cache_ttl;
+
+int __attribute__ ((weak))
+netfs_lookup_cache_ttl (struct node *dir, const char *name, struct node *np)
+{
+  return _netfs_lookup_cache_ttl;
+}
+
+/* Hash the directory and the name.  */
+static inline uint32_t
+hash (struct node *dir, const char *name, size_t len)
+{
+  uintptr_t d = (uintptr_t) dir;
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < sizeof d; i++, d >>= 8)
+    h = (h ^ (d & 0xff)) * 16777619u;
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char) name[i]) * 16777619u;
+  return h;
+}
+
+static inline struct cache_shard *
+shard (uint32_t key)
+{
+  return &name_cache[key & (CACHE_SHARDS - 1)];
+}
+
+static inline struct cache_bucket *
+bucket (struct cache_shard *s, uint32_t key)
+{
+  return &s->bucket[(key / CACHE_SHARDS) & (SHARD_BUCKETS - 1)];
+}
+
+/* Whether NAME of length LEN is worth caching.  "." and ".." are left
+   to netfs_attempt_lookup, as they would make entries hold references
+   in circles.  */
+static inline int
+cacheable (const char *name, size_t len)
+{
+  return (len > 0 && len <= CACHE_NAME_LEN
+	  && ! (name[0] == '.'
+		&& (len == 1 || (len == 2 && name[1] == '.'))));
+}
+
+static inline int
+entry_matches (struct cache_entry *e, struct node *dir,
+	       const char *name, size_t len, uint32_t key)
+{
+  return (e->dir == dir
+	  && e->key == key
+	  && e->len == len
+	  && memcmp (e->name, name, len) == 0);
+}
+
+/* Empty entry E, adding the references it held to the array DROP of
+   *NDROP nodes, to be released once its shard is unlocked.  */
+static inline void
+clear_entry (struct cache_entry *e, struct node **drop, int *ndrop)
+{
+  drop[(*ndrop)++] = e->dir;
+  if (e->np)
+    drop[(*ndrop)++] = e->np;
+  e->dir = NULL;
+}
+
+static void
+release (struct node **drop, int ndrop)
+{
+  while (ndrop > 0)
+    netfs_nrele (drop[--ndrop]);
+}
+
+/* Look NAME up in the locked directory DIR for USER in the cache, as
+   netfs_attempt_lookup would, and return -1 if the cache does not know
+   it.  Otherwise, unlock DIR and return 0, with *NP set to the node
+   found, locked and with a reference, or ENOENT.  */
+static int
+check_lookup_cache (struct iouser *user, struct node *dir, const char *name,
+		    struct node **np)
+{
+  size_t len = strlen (name);
+  uint32_t key = hash (dir, name, len);
+  struct cache_shard *s = shard (key);
+  struct node *drop[2];
+  int ndrop = 0;
+  int hit = 0;
+  int i;
+
+  if (! cacheable (name, len))
+    return -1;
+
+  pthread_mutex_lock (&s->lock);
+  if (s->bucket)
+    {
+      struct cache_bucket *b = bucket (s, key);
+
+      for (i = 0; i < BUCKET_SIZE; i++)
+	{
+	  struct cache_entry *e = &b->entry[i];
+
+	  if (! entry_matches (e, dir, name, len, key))
+	    continue;
+
+	  if (e->expires <= _netfs_now ())
+	    clear_entry (e, drop, &ndrop);
+	  else
+	    {
+	      hit = 1;
+	      *np = e->np;
+	      if (*np)
+		/* The entry holds a reference.  */
+		netfs_nref (*np);
+	      if (e->frequ < 3)
+		e->frequ++;
+	    }
+	  break;
+	}
+    }
+  pthread_mutex_unlock (&s->lock);
+  release (drop, ndrop);
+
+  if (! hit)
+    return -1;
+
+  /* The translator checks that USER may search DIR; so must we.  */
+  if (_netfs_validate_stat (dir, user)
+      || fshelp_access (&dir->nn_stat, S_IEXEC, user))
+    {
+      if (*np)
+	netfs_nrele (*np);
+      return -1;
+    }
+
+  pthread_mutex_unlock (&dir->lock);
+  if (! *np)
+    return ENOENT;
+  pthread_mutex_lock (&(*np)->lock);
+  return 0;
+}
+
+/* NAME has just been looked up in DIR, which was at GENERATION then,
+   finding NP, which is locked, or nothing if NP is NULL.  Enter that
+   in the cache for as long as the translator says.  */
+static void
+enter_lookup_cache (struct node *dir, const char *name, struct node *np,
+		    unsigned int generation)
+{
+  size_t len = strlen (name);
+  uint32_t key = hash (dir, name, len);
+  struct cache_shard *s = shard (key);
+  struct cache_bucket *b;
+  struct cache_entry *e = NULL;
+  struct node *drop[2 * BUCKET_SIZE];
+  int ndrop = 0;
+  unsigned long best = 3;
+  uint64_t t;
+  int ttl, i;
+
+  if (! cacheable (name, len))
+    return;
+
+  ttl = netfs_lookup_cache_ttl (dir, name, np);
+  if (ttl <= 0)
+    return;
+
+  pthread_mutex_lock (&s->lock);
+
+  if (! s->bucket)
+    {
+      s->bucket = calloc (SHARD_BUCKETS, sizeof *s->bucket);
+      if (! s->bucket)
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return;
+	}
+    }
+
+  /* A purge bumps the generation before taking the shard lock, so it
+     either sees the entry we make or we see its change.  */
+  if (__atomic_load_n (&dir->lookup_generation, __ATOMIC_ACQUIRE)
+      != generation)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return;
+    }
+
+  t = _netfs_now ();
+  b = bucket (s, key);
+  for (i = 0; i < BUCKET_SIZE; i++)
+    {
+      struct cache_entry *c = &b->entry[i];
+
+      if (c->dir && (entry_matches (c, dir, name, len, key)
+		     || c->expires <= t))
+	/* Replace the old entry for this name, and drop the expired
+	   ones while we are here.  */
+	clear_entry (c, drop, &ndrop);
+
+      /* Keep track of the replacement candidate.  */
+      if (! c->dir || c->frequ < best)
+	{
+	  best = c->dir ? c->frequ : 0;
+	  e = c;
+	}
+    }
+
+  /* If there was no entry with a lower use frequency, just replace
+     any entry.  */
+  if (best == 3)
+    {
+      e = &b->entry[s->replace];
+      s->replace = (s->replace + 1) & (BUCKET_SIZE - 1);
+    }
+  if (e->dir)
+    clear_entry (e, drop, &ndrop);
+
+  /* We hold references on both, and NP is locked.  */
+  netfs_nref (dir);
+  if (np)
+    netfs_nref (np);
+  e->dir = dir;
+  e->np = np;
+  e->expires = t + ttl;
+  e->key = key;
+  e->frequ = 0;
+  e->len = len;
+  memcpy (e->name, name, len);
+
+  pthread_mutex_unlock (&s->lock);
+  release (drop, ndrop);
+}
+
+error_t
+_netfs_lookup (struct iouser *user, struct node *dir, const char *name,
+	       struct node **np)
+{
+  unsigned int generation;
+  error_t err;
+
+  err = check_lookup_cache (user, dir, name, np);
+  if (err != -1)
+    return err;
+
+  generation = __atomic_load_n (&dir->lookup_generation, __ATOMIC_ACQUIRE);
+
+  /* DIR is unlocked on return, but our caller holds a reference.  */
+  err = netfs_attempt_lookup (user, dir, name, np);
+  if (! err)
+    enter_lookup_cache (dir, name, *np, generation);
+  else if (err == ENOENT)
+    enter_lookup_cache (dir, name, NULL, generation);
+  return err;
+}
+
+void
+netfs_purge_lookup_cache (struct node *dir, const char *name)
+{
+  struct node *drop[2 * BUCKET_SIZE];
+  int ndrop;
+  struct cache_shard *s;
+  unsigned long j;
+  int i;
+
+  __atomic_add_fetch (&dir->lookup_generation, 1, __ATOMIC_RELEASE);
+
+  if (name)
+    {
+      size_t len = strlen (name);
+      uint32_t key = hash (dir, name, len);
+
+      if (! cacheable (name, len))
+	return;
+
+      s = shard (key);
+      ndrop = 0;
+      pthread_mutex_lock (&s->lock);
+      if (s->bucket)
+	for (i = 0; i < BUCKET_SIZE; i++)
+	  {
+	    struct cache_entry *e = &bucket (s, key)->entry[i];
+	    if (entry_matches (e, dir, name, len, key))
+	      clear_entry (e, drop, &ndrop);
+	  }
+      pthread_mutex_unlock (&s->lock);
+      release (drop, ndrop);
+      return;
+    }
+
+  for (s = &name_cache[0]; s < &name_cache[CACHE_SHARDS]; s++)
+    {
+      pthread_mutex_lock (&s->lock);
+      if (s->bucket)
+	for (j = 0; j < SHARD_BUCKETS; j++)
+	  {
+	    ndrop = 0;
+	    for (i = 0; i < BUCKET_SIZE; i++)
+	      {
+		struct cache_entry *e = &s->bucket[j].entry[i];
+		if (e->dir == dir)
+		  clear_entry (e, drop, &ndrop);
+	      }
+	    if (ndrop)
+	      {
+		pthread_mutex_unlock (&s->lock);
+		release (drop, ndrop);
+		pthread_mutex_lock (&s->lock);
+	      }
+	  }
+      pthread_mutex_unlock (&s->lock);
+    }
+}
@@ -24,6 +24,7 @@
 #include <assert-backtrace.h>
 #include <pthread.h>
 #include <refcount.h>
+#include <stdint.h>
 
 /* This library supports client-side network file system
    implementations.  It is analogous to the diskfs library provided for
@@ -98,6 +99,13 @@ struct node
   struct conch conch;
 
   struct dirmod *dirmod_reqs;
+
+  /* Until when NN_STAT may be trusted without calling
+     netfs_validate_stat, in milliseconds; 0 if not at all.  */
+  uint64_t stat_expires;
+
+  /* Changed by netfs_purge_lookup_cache on this directory.  */
+  unsigned int lookup_generation;
 };
 
 struct netfs_control
@@ -329,6 +337,47 @@ error_t netfs_file_get_storage_info (struct iouser *cred,
    to indicate that the concept of a source device is not
    applicable. The default function always returns EOPNOTSUPP.  */
 error_t netfs_get_source (char *source, size_t source_len);
+
+/* The user may define this function.  NAME has just been looked up in
+   DIR by netfs_attempt_lookup, finding NP, which is locked, or nothing
+   at all if NP is null.  Return for how many milliseconds other lookups
+   of NAME in DIR may be answered the same without calling
+   netfs_attempt_lookup.  The default function returns the value of the
+   --lookup-cache-ttl option, 0 unless given, which keeps nothing in
+   the name cache.  The access of the users to DIR is still
+   checked, with its stat information.  Each entry in the cache holds a
+   reference on DIR and on NP.  */
+int netfs_lookup_cache_ttl (struct node *dir, const char *name,
+			    struct node *np);
+
+/* The user may define this function.  The stat information of NP,
+   which is locked, has just been filled by netfs_validate_stat.  Return
+   for how many milliseconds it may be trusted without calling
+   netfs_validate_stat again.  The default function returns the value
+   of the --stat-cache-ttl option, 0 unless given, which always calls
+   it.  */
+int netfs_stat_cache_ttl (struct node *np);
+
+/* The user may define this function.  Like netfs_attempt_read, but NP
+   is not locked, only referenced.  Large io_read requests are then split
+   into pieces of NETFS_IO_CHUNK bytes and up to NETFS_IO_THREADS of them
+   are read at once, into the reply buffer, by different threads.  The
+   default function returns EOPNOTSUPP, after which netfs_attempt_read is
+   used with NP locked; return it only if you never support this.  */
+error_t netfs_attempt_read_unlocked (struct iouser *cred, struct node *np,
+				     loff_t offset, size_t *len, void *data);
+
+/* The user may define this function.  Like netfs_attempt_write, but NP
+   is not locked, only referenced, and large io_write requests are split
+   as for netfs_attempt_read_unlocked.  Pieces may be written out of
+   order, also past the end of the file.  The default function returns
+   EOPNOTSUPP, after which netfs_attempt_write is used.  */
+error_t netfs_attempt_write_unlocked (struct iouser *cred, struct node *np,
+				      loff_t offset, size_t *len,
+				      const void *data);
+
+#define NETFS_IO_CHUNK (256 * 1024)
+#define NETFS_IO_THREADS 4
 
 /* Option parsing */
 
@@ -460,6 +509,17 @@ void netfs_nput (struct node *np);
    from memory.  */
 void netfs_try_dropping_softrefs (struct node *np);
 
+/* Forget what the name cache knows of NAME in the directory DIR, or of
+   every name in DIR if NAME is null.  libnetfs does this after the
+   changes made through it; the user should when it learns of others,
+   without holding any lock netfs_node_norefs takes.  */
+void netfs_purge_lookup_cache (struct node *dir, const char *name);
+
+/* Forget the stat information of the locked node NP kept by the stat
+   cache, so that netfs_validate_stat is called when it is next needed.
+   libnetfs does this after the changes made through it.  */
+void netfs_purge_stat_cache (struct node *np);
+
 /* Called internally when no more references to node NP exist. */
 void netfs_drop_node (struct node *np);
 
@@ -22,11 +22,58 @@
 #define _LIBNETFS_PRIV_H
 
 #include <hurd/hurd_types.h>
+#include <maptime.h>
+#include <stdint.h>
 
 #include "netfs.h"
 
 extern volatile struct mapped_time_value *netfs_mtime;
 
+/* The current time, in milliseconds.  */
+static inline uint64_t __attribute__ ((unused))
+_netfs_now (void)
+{
+  struct timeval t;
+  maptime_read (netfs_mtime, &t);
+  return (uint64_t) t.tv_sec * 1000 + t.tv_usec / 1000;
+}
+
+/* The numbers of milliseconds given with --lookup-cache-ttl and
+   --stat-cache-ttl, returned by the default netfs_lookup_cache_ttl and
+   netfs_stat_cache_ttl.  */
+extern int _netfs_lookup_cache_ttl;
+extern int _netfs_stat_cache_ttl;
+
+/* Like netfs_validate_stat, but trust the stat information of NP for
+   as long as netfs_stat_cache_ttl said when it was last validated.  NP
+   is locked.  */
+error_t _netfs_validate_stat (struct node *np, struct iouser *cred);
+
+/* Like netfs_attempt_lookup, but return what the name cache knows if
+   it knows it, and enter there what netfs_attempt_lookup finds
+   otherwise.  The caller holds a reference on DIR.  */
+error_t _netfs_lookup (struct iouser *user, struct node *dir,
+		       const char *name, struct node **np);
+
+/* Read into DATA, or write from it if WRITE, the *LEN bytes of NP at
+   OFFSET with netfs_attempt_read_unlocked or netfs_attempt_write_unlocked,
+   several pieces at once, and set *LEN to the amount done.  NP is
+   referenced but not locked.  Return EOPNOTSUPP, having done nothing, if
+   the user doesn't define them.  */
+error_t _netfs_chunked_io (struct iouser *cred, struct node *np, int write,
+			   loff_t offset, size_t *len, void *data);
+
+/* Forget what the caches know of NAME in the directory DIR, which is
+   not locked, after a change to it.  */
+static inline void __attribute__ ((unused))
+_netfs_purge_dir (struct node *dir, const char *name)
+{
+  netfs_purge_lookup_cache (dir, name);
+  pthread_mutex_lock (&dir->lock);
+  netfs_purge_stat_cache (dir);
+  pthread_mutex_unlock (&dir->lock);
+}
+
 static inline struct protid * __attribute__ ((unused))
 begin_using_protid_port (file_t port)
 {
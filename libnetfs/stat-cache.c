@@ -0,0 +1,51 @@
+/* Stat information caching
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+
+int _netfs_stat_cache_ttl;
+
+int __attribute__ ((weak))
+netfs_stat_cache_ttl (struct node *np)
+{
+  return _netfs_stat_cache_ttl;
+}
+
+error_t
+_netfs_validate_stat (struct node *np, struct iouser *cred)
+{
+  error_t err;
+  int ttl;
+
+  if (np->stat_expires && _netfs_now () < np->stat_expires)
+    return 0;
+
+  err = netfs_validate_stat (np, cred);
+  if (! err && (ttl = netfs_stat_cache_ttl (np)) > 0)
+    np->stat_expires = _netfs_now () + ttl;
+  else
+    np->stat_expires = 0;
+  return err;
+}
+
+void
+netfs_purge_stat_cache (struct node *np)
+{
+  np->stat_expires = 0;
+}
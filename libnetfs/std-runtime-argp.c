@@ -19,6 +19,54 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <argp.h>
-#include "netfs.h"
+#include <stdlib.h>
+#include "priv.h"
 
-const struct argp netfs_std_runtime_argp = { 0 };
+enum
+{
+  OPT_LOOKUP_CACHE_TTL = 600,	/* --lookup-cache-ttl */
+  OPT_STAT_CACHE_TTL,		/* --stat-cache-ttl */
+};
+
+static const struct argp_option
+std_runtime_options[] =
+{
+  {"lookup-cache-ttl", OPT_LOOKUP_CACHE_TTL, "MSEC", 0,
+   "Reuse the result of looking up a name for MSEC milliseconds"
+   " (default 0)"},
+  {"stat-cache-ttl", OPT_STAT_CACHE_TTL, "MSEC", 0,
+   "Reuse the status of a node for MSEC milliseconds (default 0)"},
+  {0}
+};
+
+static error_t
+parse_std_runtime_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+  long ttl;
+
+  switch (key)
+    {
+    case OPT_LOOKUP_CACHE_TTL:
+    case OPT_STAT_CACHE_TTL:
+      ttl = strtol (arg, &end, 10);
+      if (*end != '\0' || end == arg || ttl < 0 || ttl > INT32_MAX)
+	{
+	  argp_error (state, "%s: Invalid number of milliseconds", arg);
+	  return EINVAL;
+	}
+      if (key == OPT_LOOKUP_CACHE_TTL)
+	_netfs_lookup_cache_ttl = ttl;
+      else
+	_netfs_stat_cache_ttl = ttl;
+      return 0;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+}
+
+const struct argp netfs_std_runtime_argp =
+{
+  std_runtime_options, parse_std_runtime_opt
+};
@@ -23,5 +23,13 @@
 #include <argp.h>
 #include "netfs.h"
 
+/* The runtime options may be given at startup too.  */
+static const struct argp_child
+std_startup_children[] =
+{
+  {&netfs_std_runtime_argp},
+  {0}
+};
+
 const struct argp
-netfs_std_startup_argp = { 0 };
+netfs_std_startup_argp = { 0, 0, 0, 0, std_startup_children };
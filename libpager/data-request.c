@@ -19,14 +19,13 @@
 #include "memory_object_S.h"
 #include <stdio.h>
 #include <string.h>
+#include <trace.h>
 
-/* Implement pagein callback as described in <mach/memory_object.defs>. */
-kern_return_t
-_pager_S_memory_object_data_request (struct pager *p,
-					  mach_port_t control,
-					  vm_offset_t offset,
-					  vm_size_t length,
-					  vm_prot_t access)
+/* Satisfy the kernel's request for the page at OFFSET in P.  P's
+   interlock is held and its termination blocked, and so they are again
+   on return.  */
+static void
+request_page (struct pager *p, vm_offset_t offset, vm_prot_t access)
 {
   short *pm_entry;
   int doread, doerror;
@@ -34,49 +33,12 @@ _pager_S_memory_object_data_request (struct pager *p,
   vm_address_t page;
   int write_lock;
 
-  if (!p
-      || p->port.class != _pager_class)
-    return EOPNOTSUPP;
-
-  /* Acquire the right to meddle with the pagemap */
-  pthread_mutex_lock (&p->interlock);
-
-  /* sanity checks -- we don't do multi-page requests yet.  */
-  if (control != p->memobjcntl)
-    {
-      printf ("incg data request: wrong control port\n");
-      goto release_out;
-    }
-  if (length != __vm_page_size)
-    {
-      printf ("incg data request: bad length size %lu\n", (unsigned long)length);
-      goto release_out;
-    }
-  if (offset % __vm_page_size)
-    {
-      printf ("incg data request: misaligned request\n");
-      goto release_out;
-    }
-
-  _pager_block_termination (p);	/* prevent termination until
-				   mark_object_error is done */
-
-  if (p->pager_state != NORMAL)
-    {
-      printf ("pager in wrong state for read\n");
-      goto allow_release_out;
-    }
-
-  err = _pager_pagemap_resize (p, offset + length);
-  if (err)
-    goto allow_release_out;	/* Can't do much about the actual error.  */
-
   /* If someone is paging this out right now, the disk contents are
      unreliable, so we have to wait.  It is too expensive (right now) to
      find the data and return it, and then interrupt the write, so we just
      mark the page and have the writing thread do m_o_data_supply when it
      gets around to it.  */
-  pm_entry = &p->pagemap[offset / __vm_page_size];
+  pm_entry = _pager_pagemap_entry (p, offset / __vm_page_size);
   if (*pm_entry & PM_PAGINGOUT)
     {
       doread = 0;
@@ -94,9 +56,9 @@ _pager_S_memory_object_data_request (struct pager *p,
 
   if (PM_NEXTERROR (*pm_entry) != PAGE_NOERR && (access & VM_PROT_WRITE))
     {
-      memory_object_data_error (control, offset, length,
+      memory_object_data_error (p->memobjcntl, offset, __vm_page_size,
 				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
-      _pager_mark_object_error (p, offset, length,
+      _pager_mark_object_error (p, offset, __vm_page_size,
 				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
       *pm_entry = SET_PM_NEXTERROR (*pm_entry, PAGE_NOERR);
       doread = 0;
@@ -106,7 +68,7 @@ _pager_S_memory_object_data_request (struct pager *p,
   pthread_mutex_unlock (&p->interlock);
 
   if (!doread)
-    goto allow_term_out;
+    goto out;
   if (doerror)
     goto error_read;
 
@@ -114,24 +76,123 @@ _pager_S_memory_object_data_request (struct pager *p,
   if (err)
     goto error_read;
 
-  memory_object_data_supply (p->memobjcntl, offset, page, length, 1,
+  memory_object_data_supply (p->memobjcntl, offset, page, __vm_page_size, 1,
 			     write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
 			     p->notify_on_evict ? 1 : 0,
 			     MACH_PORT_NULL);
   pthread_mutex_lock (&p->interlock);
-  _pager_mark_object_error (p, offset, length, 0);
-  _pager_allow_termination (p);
-  pthread_mutex_unlock (&p->interlock);
-  return 0;
+  _pager_mark_object_error (p, offset, __vm_page_size, 0);
+  return;
 
  error_read:
-  memory_object_data_error (p->memobjcntl, offset, length, EIO);
-  _pager_mark_object_error (p, offset, length, EIO);
- allow_term_out:
+  memory_object_data_error (p->memobjcntl, offset, __vm_page_size, EIO);
+  _pager_mark_object_error (p, offset, __vm_page_size, EIO);
+ out:
   pthread_mutex_lock (&p->interlock);
-  _pager_allow_termination (p);
+}
+
+/* Try to satisfy the kernel's request for the NPAGES pages at OFFSET in
+   P with a single pager_read_pages and a single m_o_data_supply.  That
+   is only done if none of the pages needs handling of its own.  Return
+   nonzero if the request has been dealt with.  Locking is as for
+   request_page.  */
+static int
+request_pages (struct pager *p, vm_offset_t offset, int npages)
+{
+  short **pm_entries = alloca (npages * sizeof *pm_entries);
+  vm_size_t length = npages * __vm_page_size;
+  error_t err;
+  vm_address_t buf;
+  int write_lock;
+  int i;
+
+  _pager_pagemap_entries (p, offset, npages, pm_entries);
+
+  for (i = 0; i < npages; i++)
+    if ((*pm_entries[i] & (PM_PAGINGOUT | PM_INVALID))
+	|| PM_NEXTERROR (*pm_entries[i]) != PAGE_NOERR)
+      return 0;
+
+  for (i = 0; i < npages; i++)
+    *pm_entries[i] |= PM_INCORE;
+
+  /* Let someone else in.  */
   pthread_mutex_unlock (&p->interlock);
-  return 0;
+
+  err = pager_read_pages (p->upi, offset, npages, &buf, &write_lock);
+  if (err == EOPNOTSUPP)
+    {
+      pthread_mutex_lock (&p->interlock);
+      return 0;
+    }
+
+  if (err)
+    memory_object_data_error (p->memobjcntl, offset, length, EIO);
+  else
+    memory_object_data_supply (p->memobjcntl, offset, buf, length, 1,
+			       write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
+			       p->notify_on_evict ? 1 : 0,
+			       MACH_PORT_NULL);
+
+  pthread_mutex_lock (&p->interlock);
+  _pager_mark_object_error (p, offset, length, err ? EIO : 0);
+  return 1;
+}
+
+/* Implement pagein callback as described in <mach/memory_object.defs>. */
+kern_return_t
+_pager_S_memory_object_data_request (struct pager *p,
+					  mach_port_t control,
+					  vm_offset_t offset,
+					  vm_size_t length,
+					  vm_prot_t access)
+{
+  error_t err;
+  int npages, i;
+
+  if (!p
+      || p->port.class != _pager_class)
+    return EOPNOTSUPP;
+
+  TRACE (TRACE_PAGER_DATA_REQUEST, offset, length);
+
+  /* Acquire the right to meddle with the pagemap */
+  pthread_mutex_lock (&p->interlock);
+
+  /* sanity checks */
+  if (control != p->memobjcntl)
+    {
+      printf ("incg data request: wrong control port\n");
+      goto release_out;
+    }
+  if (length == 0 || length % __vm_page_size)
+    {
+      printf ("incg data request: bad length size %lu\n", (unsigned long)length);
+      goto release_out;
+    }
+  if (offset % __vm_page_size)
+    {
+      printf ("incg data request: misaligned request\n");
+      goto release_out;
+    }
+
+  _pager_block_termination (p);	/* prevent termination until
+				   mark_object_error is done */
+
+  if (p->pager_state != NORMAL)
+    {
+      printf ("pager in wrong state for read\n");
+      goto allow_release_out;
+    }
+
+  err = _pager_pagemap_alloc (p, offset, length);
+  if (err)
+    goto allow_release_out;	/* Can't do much about the actual error.  */
+
+  npages = length / __vm_page_size;
+  if (npages == 1 || !request_pages (p, offset, npages))
+    for (i = 0; i < npages; i++)
+      request_page (p, offset + i * __vm_page_size, access);
 
  allow_release_out:
   _pager_allow_termination (p);
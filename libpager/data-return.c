@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert-backtrace.h>
+#include <trace.h>
 
 /* Worker function used by _pager_S_memory_object_data_return
    and _pager_S_memory_object_data_initialize.  All args are
@@ -35,8 +36,8 @@ _pager_do_write_request (struct pager *p,
 			 int kcopy,
 			 int initializing)
 {
-  short *pm_entries;
-  int npages, i;
+  short **pm_entries;
+  int npages, i, j;
   char *notified;
   error_t *pagerrs;
   struct lock_request *lr;
@@ -49,6 +50,8 @@ _pager_do_write_request (struct pager *p,
       || p->port.class != _pager_class)
     return EOPNOTSUPP;
 
+  TRACE (TRACE_PAGER_DATA_RETURN, offset, length);
+
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
 
@@ -86,9 +89,15 @@ _pager_do_write_request (struct pager *p,
   _pager_block_termination (p);	/* until we are done with the pagemap
 				   when the write completes. */
 
-  _pager_pagemap_resize (p, offset + length);
-
-  pm_entries = &p->pagemap[offset / __vm_page_size];
+  pm_entries = alloca (npages * sizeof *pm_entries);
+  if (_pager_pagemap_alloc (p, offset, length))
+    {
+      /* Can't do much about the actual error.  */
+      munmap ((void *) data, length);
+      _pager_allow_termination (p);
+      goto release_out;
+    }
+  _pager_pagemap_entries (p, offset, npages, pm_entries);
 
   if (! dirty)
     {
@@ -97,7 +106,7 @@ _pager_do_write_request (struct pager *p,
         /* Prepare notified array.  */
         for (i = 0; i < npages; i++)
           notified[i] = (p->notify_on_evict
-                         && ! (pm_entries[i] & PM_PAGEINWAIT));
+                         && ! (*pm_entries[i] & PM_PAGEINWAIT));
 
         goto notify;
       }
@@ -115,9 +124,9 @@ _pager_do_write_request (struct pager *p,
   /* XXX: Is this still needed?  */
  retry:
   for (i = 0; i < npages; i++)
-    if (pm_entries[i] & PM_PAGINGOUT)
+    if (*pm_entries[i] & PM_PAGINGOUT)
       {
-	pm_entries[i] |= PM_WRITEWAIT;
+	*pm_entries[i] |= PM_WRITEWAIT;
 	pthread_cond_wait (&p->wakeup, &p->interlock);
 	goto retry;
       }
@@ -128,15 +137,15 @@ _pager_do_write_request (struct pager *p,
       assert_backtrace (npages < 32);
       for (i = 0; i < npages; i++)
 	{
-	  if (pm_entries[i] & PM_INIT)
+	  if (*pm_entries[i] & PM_INIT)
 	    omitdata |= 1U << i;
 	  else
-	    pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
+	    *pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
 	}
     }
   else
     for (i = 0; i < npages; i++)
-      pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
+      *pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
 
   /* If this write occurs while a lock is pending, record
      it.  We have to keep this list because a lock request
@@ -158,19 +167,23 @@ _pager_do_write_request (struct pager *p,
   /* Let someone else in. */
   pthread_mutex_unlock (&p->interlock);
 
-  /* This is inefficient; we should send all the pages to the device at once
-     but until the pager library interface is changed, this will have to do. */
-
-  for (i = 0; i < npages; i++)
-    if (!(omitdata & (1U << i)))
-      pagerrs[i] = pager_write_page (p->upi,
-				     offset + (vm_page_size * i),
-				     data + (vm_page_size * i));
+  /* Hand each run of pages that are to be written to the user at once,
+     so that it can do them in as few device writes as possible.  */
+  for (i = 0; i < npages; i = j)
+    {
+      if (omitdata & (1U << i))
+	{
+	  j = i + 1;
+	  continue;
+	}
+      for (j = i + 1; j < npages && !(omitdata & (1U << j)); j++)
+	;
+      pager_write_pages (p->upi, offset + (vm_page_size * i),
+			 data + (vm_page_size * i), j - i, &pagerrs[i]);
+    }
 
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
-  _pager_pagemap_resize (p, offset + length);
-  pm_entries = &p->pagemap[offset / __vm_page_size];
 
   wakeup = 0;
   for (i = 0; i < npages; i++)
@@ -181,10 +194,10 @@ _pager_do_write_request (struct pager *p,
 	  continue;
 	}
 
-      if (pm_entries[i] & PM_WRITEWAIT)
+      if (*pm_entries[i] & PM_WRITEWAIT)
 	wakeup = 1;
 
-      if (pagerrs[i] && ! (pm_entries[i] & PM_PAGEINWAIT))
+      if (pagerrs[i] && ! (*pm_entries[i] & PM_PAGEINWAIT))
 	/* The only thing we can do here is mark the page, and give
 	   errors from now on when it is to be read.  This is
 	   imperfect, because if all users go away, the pagemap will
@@ -192,9 +205,9 @@ _pager_do_write_request (struct pager *p,
 	   better than Un*x.  Of course, if we are about to hand this
 	   data to the kernel, the error isn't a problem, hence the
 	   check for pageinwait.  */
-	pm_entries[i] |= PM_INVALID;
+	*pm_entries[i] |= PM_INVALID;
 
-      if (pm_entries[i] & PM_PAGEINWAIT)
+      if (*pm_entries[i] & PM_PAGEINWAIT)
 	{
 	  memory_object_data_supply (p->memobjcntl,
 				     offset + (vm_page_size * i),
@@ -209,10 +222,10 @@ _pager_do_write_request (struct pager *p,
 		  vm_page_size);
 	  notified[i] = (! kcopy && p->notify_on_evict);
 	  if (! kcopy)
-	    pm_entries[i] &= ~PM_INCORE;
+	    *pm_entries[i] &= ~PM_INCORE;
 	}
 
-      pm_entries[i] &= ~(PM_PAGINGOUT | PM_PAGEINWAIT | PM_WRITEWAIT);
+      *pm_entries[i] &= ~(PM_PAGINGOUT | PM_PAGEINWAIT | PM_WRITEWAIT);
     }
 
   for (ll = lock_list; ll; ll = ll->next)
@@ -231,7 +244,7 @@ _pager_do_write_request (struct pager *p,
       assert_backtrace (notified[i] == 0 || notified[i] == 1);
       if (notified[i])
 	{
-	  short *pm_entry = &pm_entries[i];
+	  short *pm_entry = pm_entries[i];
 
 	  /* Do notify user.  */
 	  pager_notify_evict (p->upi, offset + (i * vm_page_size));
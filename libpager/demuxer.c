@@ -32,15 +32,16 @@
 /*
   Worker pool for the server functions.
 
-  A single thread receives messages from the port bucket and puts them
-  into a queue.  A fixed number of consumers actually execute the
-  server functions and send the reply.
+  A single thread receives messages from the port bucket and hands
+  each to one of a number of workers, which actually execute the server
+  functions and send the reply.
 
   The requests to an object O have to be processed in the order they
-  were received.  To this end, each worker has a local queue and a
-  tag.  If a thread processes a request to O, it sets its tag to a
-  unique identifier representing O.  If another thread now dequeues a
-  second request to O, it enqueues it to the first workers queue.
+  were received.  To this end, all requests to O are steered to the
+  same worker, chosen by hashing O's port, and each worker processes
+  its queue in order.  Each worker has its own lock, so the receiver
+  only contends with the worker it delegates to, and a worker only
+  with the receiver.
 
   At least one worker thread is necessary.
 */
@@ -65,29 +66,38 @@ request_inp (const struct request *r)
 struct worker
 {
   struct pager_requests *requests;	/* our pagers request queue */
-  struct queue queue;	/* other workers may delegate requests to us */
-  unsigned long tag;	/* tag of the object we are working on */
-};
-
-/* This is the queue for incoming requests.  A single thread receives
-   messages from the port set, looks the service routine up, and
-   enqueues the request here.  */
-struct pager_requests
-{
-  struct port_bucket *bucket;
+  pthread_mutex_t lock;
   /* Normally, both queues are the same.  However, when the workers are
-     inhibited, a new queue_in is created, but queue_out is left as the
-     old value, so the workers drain queue_out but do not receive new
-     requests.  */
+     inhibited, QUEUE_IN is switched to the other element of QUEUES,
+     but QUEUE_OUT is left as it was, so the worker drains QUEUE_OUT
+     but does not receive new requests.  */
+  struct queue queues[2];
   struct queue *queue_in;	/* the queue to add to */
   struct queue *queue_out;	/* the queue to take from */
   int asleep;
   pthread_cond_t wakeup;
   pthread_cond_t inhibit_wakeup;
-  pthread_mutex_t lock;
-  struct worker workers[WORKER_COUNT];
+} __attribute__ ((aligned (64)));
+
+/* This is the set of workers for the pagers in a port bucket.  A single
+   thread receives messages from the port set, looks the service
+   routine up, and enqueues the request to one of the workers.  */
+struct pager_requests
+{
+  struct port_bucket *bucket;
+  int nworkers;
+  struct worker workers[];
 };
 
+/* Return the worker that handles requests to the object with port
+   PORT.  */
+static inline struct worker *
+object_worker (struct pager_requests *requests, mach_port_t port)
+{
+  unsigned long h = (unsigned long) port * 2654435761UL;
+  return &requests->workers[(h >> 8) % requests->nworkers];
+}
+
 /* Demultiplex a single message directed at a pager port; INP is the
    message received; fill OUTP with the reply.  */
 static int
@@ -116,15 +126,17 @@ pager_demuxer (struct pager_requests *requests,
   r->routine = routine;
   memcpy (request_inp (r), inp, inp->msgh_size);
 
-  pthread_mutex_lock (&requests->lock);
+  struct worker *w = object_worker (requests, inp->msgh_local_port);
+
+  pthread_mutex_lock (&w->lock);
 
-  queue_enqueue (requests->queue_in, &r->item);
+  queue_enqueue (w->queue_in, &r->item);
 
   /* Awake worker, but only if not inhibited.  */
-  if (requests->asleep > 0 && requests->queue_in == requests->queue_out)
-      pthread_cond_signal (&requests->wakeup);
+  if (w->asleep && w->queue_in == w->queue_out)
+    pthread_cond_signal (&w->wakeup);
 
-  pthread_mutex_unlock (&requests->lock);
+  pthread_mutex_unlock (&w->lock);
 
   /* A worker thread will reply.  */
   err = MIG_NO_REPLY;
@@ -170,56 +182,28 @@ static void *
 worker_func (void *arg)
 {
   struct worker *self = (struct worker *) arg;
-  struct pager_requests *requests = self->requests;
   struct request *r = NULL;
   mig_reply_header_t reply_msg;
 
   while (1)
     {
-      int i;
       mach_msg_return_t mr;
 
       /* Free previous message.  */
       free (r);
 
-      pthread_mutex_lock (&requests->lock);
+      pthread_mutex_lock (&self->lock);
 
-      /* First, look in our queue for more requests to the object we
-	 have been working on lately.  Some other thread might have
-	 delegated them to us.  */
-      r = queue_dequeue (&self->queue);
-      if (r != NULL)
-	goto got_one;
-
-      /* Nope.  Clear our tag and...  */
-      self->tag = 0;
-
-    get_request_locked:
-      /* ... get a request from the global queue instead.  */
-      while ((r = queue_dequeue (requests->queue_out)) == NULL)
+      while ((r = queue_dequeue (self->queue_out)) == NULL)
 	{
-	  requests->asleep += 1;
-	  if (requests->asleep == WORKER_COUNT)
-	    pthread_cond_broadcast (&requests->inhibit_wakeup);
-	  pthread_cond_wait (&requests->wakeup, &requests->lock);
-	  requests->asleep -= 1;
+	  self->asleep = 1;
+	  if (self->queue_in != self->queue_out)
+	    pthread_cond_broadcast (&self->inhibit_wakeup);
+	  pthread_cond_wait (&self->wakeup, &self->lock);
+	  self->asleep = 0;
 	}
 
-      for (i = 0; i < WORKER_COUNT; i++)
-	if (requests->workers[i].tag
-	    == (unsigned long) request_inp (r)->msgh_local_port)
-	  {
-	    /* Some other thread is working on that object.  Delegate
-	       the request to that worker.  */
-	    queue_enqueue (&requests->workers[i].queue, &r->item);
-	    goto get_request_locked;
-	  }
-
-      /* Claim responsibility for this object by setting our tag.  */
-      self->tag = (unsigned long) request_inp (r)->msgh_local_port;
-
-    got_one:
-      pthread_mutex_unlock (&requests->lock);
+      pthread_mutex_unlock (&self->lock);
 
       mig_reply_setup (request_inp (r), (mach_msg_header_t *) &reply_msg);
 
@@ -313,6 +297,15 @@ service_paging_requests (void *arg)
 error_t
 pager_start_workers (struct port_bucket *pager_bucket,
 		     struct pager_requests **out_requests)
+{
+  return pager_start_workers_count (pager_bucket, WORKER_COUNT,
+				    out_requests);
+}
+
+/* Start NWORKERS worker threads to service requests.  */
+error_t
+pager_start_workers_count (struct port_bucket *pager_bucket, int nworkers,
+			   struct pager_requests **out_requests)
 {
   error_t err;
   int i;
@@ -321,34 +314,39 @@ pager_start_workers (struct port_bucket *pager_bucket,
   struct rlimit limits = { RLIM_INFINITY, RLIM_INFINITY };
 
   assert_backtrace (out_requests != NULL);
+  assert_backtrace (nworkers > 0);
 
   /* Lift default address space limits if we are allowed */
   if (setrlimit (RLIMIT_AS, &limits) == -1 && errno != EPERM)
     perror ("error lifting address space limits");
 
-  requests = malloc (sizeof *requests);
-  if (requests == NULL)
+  /* Keep each worker on its own cache lines.  */
+  err = posix_memalign ((void **) &requests, __alignof__ (struct worker),
+			sizeof *requests
+			+ nworkers * sizeof *requests->workers);
+  if (err)
     {
-      err = ENOMEM;
+      requests = NULL;
       goto done;
     }
 
   requests->bucket = pager_bucket;
-  requests->asleep = 0;
+  requests->nworkers = nworkers;
 
-  requests->queue_in = malloc (sizeof *requests->queue_in);
-  if (requests->queue_in == NULL)
+  for (i = 0; i < nworkers; i++)
     {
-      err = ENOMEM;
-      goto done;
+      struct worker *w = &requests->workers[i];
+
+      w->requests = requests;
+      pthread_mutex_init (&w->lock, NULL);
+      queue_init (&w->queues[0]);
+      queue_init (&w->queues[1]);
+      /* Until the workers are inhibited, both queues are the same.  */
+      w->queue_in = w->queue_out = &w->queues[0];
+      w->asleep = 0;
+      pthread_cond_init (&w->wakeup, NULL);
+      pthread_cond_init (&w->inhibit_wakeup, NULL);
     }
-  queue_init (requests->queue_in);
-  /* Until the workers are inhibited, both queues are the same.  */
-  requests->queue_out = requests->queue_in;
-
-  pthread_cond_init (&requests->wakeup, NULL);
-  pthread_cond_init (&requests->inhibit_wakeup, NULL);
-  pthread_mutex_init (&requests->lock, NULL);
 
   /* Make a thread to service paging requests.  */
   err = pthread_create (&t, NULL, service_paging_requests, requests);
@@ -356,12 +354,8 @@ pager_start_workers (struct port_bucket *pager_bucket,
     goto done;
   pthread_detach (t);
 
-  for (i = 0; i < WORKER_COUNT; i++)
+  for (i = 0; i < nworkers; i++)
     {
-      requests->workers[i].requests = requests;
-      requests->workers[i].tag = 0;
-      queue_init (&requests->workers[i].queue);
-
       err = pthread_create (&t, NULL, &worker_func, &requests->workers[i]);
       if (err)
 	goto done;
@@ -383,55 +377,61 @@ done:
 error_t
 pager_inhibit_workers (struct pager_requests *requests)
 {
-  error_t err = 0;
+  int i;
 
-  pthread_mutex_lock (&requests->lock);
+  for (i = 0; i < requests->nworkers; i++)
+    {
+      struct worker *w = &requests->workers[i];
 
-  /* Check the workers are not already inhibited.  */
-  assert_backtrace (requests->queue_out == requests->queue_in);
+      pthread_mutex_lock (&w->lock);
 
-  /* Any new paging requests will go into a new queue.  */
-  struct queue *new_queue = malloc (sizeof *new_queue);
-  if (new_queue == NULL)
-    {
-      err = ENOMEM;
-      goto done_locked;
+      /* Check the workers are not already inhibited.  */
+      assert_backtrace (w->queue_out == w->queue_in);
+
+      /* Any new paging requests will go into the other queue, which
+	 was drained when the workers were last resumed.  */
+      w->queue_in = &w->queues[w->queue_out == &w->queues[0]];
+      assert_backtrace (queue_empty (w->queue_in));
+
+      /* Wait until the worker is asleep and its queue has been drained.
+	 Check that the queue is empty, since it's possible that a
+	 request came in, was queued and the worker was signalled but
+	 the lock was acquired here before the worker woke up.  */
+      while (! w->asleep || ! queue_empty (w->queue_out))
+	{
+	  if (w->asleep)
+	    pthread_cond_signal (&w->wakeup);
+	  pthread_cond_wait (&w->inhibit_wakeup, &w->lock);
+	}
+
+      pthread_mutex_unlock (&w->lock);
     }
-  queue_init (new_queue);
-  requests->queue_in = new_queue;
-
-  /* Wait until all the workers are asleep and the queue has been
-     drained. All individual worker queues must have been drained, as
-     they are populated while the relevant worker is still running, and
-     it will always drain its personal queue before sleeping.
-     Check that the queue is empty, since it's possible that a request
-     came in, was queued and a worker was signalled but the lock was
-     acquired here before the worker woke up.  */
-  while (requests->asleep < WORKER_COUNT || !queue_empty(requests->queue_out))
-    pthread_cond_wait (&requests->inhibit_wakeup, &requests->lock);
-
-done_locked:
-  pthread_mutex_unlock (&requests->lock);
-  return err;
+
+  return 0;
 }
 
 void
 pager_resume_workers (struct pager_requests *requests)
 {
-  pthread_mutex_lock (&requests->lock);
+  int i;
+
+  for (i = 0; i < requests->nworkers; i++)
+    {
+      struct worker *w = &requests->workers[i];
 
-  /* Check the workers are inhibited.  */
-  assert_backtrace (requests->queue_out != requests->queue_in);
-  assert_backtrace (requests->asleep == WORKER_COUNT);
-  assert_backtrace (queue_empty(requests->queue_out));
+      pthread_mutex_lock (&w->lock);
 
-  /* The queue has been drained and will no longer be used.  */
-  free (requests->queue_out);
-  requests->queue_out = requests->queue_in;
+      /* Check the workers are inhibited.  */
+      assert_backtrace (w->queue_out != w->queue_in);
+      assert_backtrace (w->asleep);
+      assert_backtrace (queue_empty (w->queue_out));
 
-  /* We need to wake up all workers, as there could be multiple requests
-     in the new queue.  */
-  pthread_cond_broadcast (&requests->wakeup);
+      /* The old queue has been drained, take from the new one.  */
+      w->queue_out = w->queue_in;
 
-  pthread_mutex_unlock (&requests->lock);
+      /* Wake the worker, as there could be requests in the new queue.  */
+      pthread_cond_signal (&w->wakeup);
+
+      pthread_mutex_unlock (&w->lock);
+    }
 }
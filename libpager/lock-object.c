@@ -30,7 +30,6 @@ _pager_lock_object (struct pager *p,
 		    vm_prot_t lock_value,
 		    int sync)
 {
-  vm_size_t i;
   struct lock_request *lr = 0;
 
   pthread_mutex_lock (&p->interlock);
@@ -86,19 +85,24 @@ _pager_lock_object (struct pager *p,
 
       if (should_flush)
 	{
-	  vm_offset_t pm_offs = offset / __vm_page_size;
+	  vm_size_t page = offset / __vm_page_size;
+	  vm_size_t end = page + size / __vm_page_size;
 
-	  _pager_pagemap_resize (p, offset + size);
-	  if (p->pagemapsize > pm_offs)
+	  /* Pages without an entry were never in core, so only the
+	     chunks allocated need looking at.  */
+	  if (end > p->pagemapsize << PAGEMAP_CHUNK_SHIFT)
+	    end = p->pagemapsize << PAGEMAP_CHUNK_SHIFT;
+	  while (page < end)
 	    {
-	      short *pm_entries = &p->pagemap[pm_offs];
-	      vm_size_t bound = size / vm_page_size;
+	      short *chunk = p->pagemap[page >> PAGEMAP_CHUNK_SHIFT];
+	      vm_size_t stop = (page | (PAGEMAP_CHUNK - 1)) + 1;
 
-	      if (bound > p->pagemapsize)
-		bound = p->pagemapsize;
-
-	      for (i = 0; i < bound; i++)
-		pm_entries[i] &= ~PM_INCORE;
+	      if (stop > end)
+		stop = end;
+	      if (chunk)
+		for (; page < stop; page++)
+		  chunk[page & (PAGEMAP_CHUNK - 1)] &= ~PM_INCORE;
+	      page = stop;
 	    }
 	}
     }
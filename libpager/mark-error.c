@@ -32,10 +32,7 @@ _pager_mark_next_request_error(struct pager *pager,
 			       error_t error)
 {
   int page_error;
-  short *p;
-
-  offset /= __vm_page_size;
-  length /= __vm_page_size;
+  vm_size_t page, end;
   
   switch (error)
     {
@@ -54,8 +51,18 @@ _pager_mark_next_request_error(struct pager *pager,
       break;
     }
   
-  for (p = pager->pagemap + offset; p < pager->pagemap + offset + length; p++)
-    *p = SET_PM_NEXTERROR (*p, page_error);
+  /* A page without an entry has no error to clear.  */
+  if (page_error != PAGE_NOERR
+      && _pager_pagemap_alloc (pager, offset, length))
+    return;
+
+  end = (offset + length) / __vm_page_size;
+  for (page = offset / __vm_page_size; page < end; page++)
+    {
+      short *p = _pager_pagemap_find (pager, page);
+      if (p)
+	*p = SET_PM_NEXTERROR (*p, page_error);
+    }
 }
 
 /* We are returning a pager error to the kernel.  Write down
@@ -70,10 +77,7 @@ _pager_mark_object_error(struct pager *pager,
 			 error_t error)
 {
   int page_error = 0;
-  short *p;
-
-  offset /= __vm_page_size;
-  length /= __vm_page_size;
+  vm_size_t page, end;
   
   switch (error)
     {
@@ -92,8 +96,18 @@ _pager_mark_object_error(struct pager *pager,
       break;
     }
   
-  for (p = pager->pagemap + offset; p < pager->pagemap + offset + length; p++)
-    *p = SET_PM_ERROR (*p, page_error);
+  /* A page without an entry has no error to clear.  */
+  if (page_error != PAGE_NOERR
+      && _pager_pagemap_alloc (pager, offset, length))
+    return;
+
+  end = (offset + length) / __vm_page_size;
+  for (page = offset / __vm_page_size; page < end; page++)
+    {
+      short *p = _pager_pagemap_find (pager, page);
+      if (p)
+	*p = SET_PM_ERROR (*p, page_error);
+    }
 }
 
 /* Tell us what the error (set with mark_object_error) for 
@@ -102,19 +116,15 @@ error_t
 pager_get_error (struct pager *p, vm_address_t addr)
 {
   error_t err;
+  short *pm_entry;
   
   pthread_mutex_lock (&p->interlock);
 
   addr /= vm_page_size;
 
-  /* If there really is no error for ADDR, we should be able to exted the
-     pagemap table; otherwise, if some previous operation failed because it
-     couldn't extend the table, this attempt will *probably* (heh) fail for
-     the same reason.  */
-  err = _pager_pagemap_resize (p, addr);
-
-  if (! err)
-    err = _pager_page_errors[PM_ERROR(p->pagemap[addr])];
+  /* A page without an entry has never had an error marked.  */
+  pm_entry = _pager_pagemap_find (p, addr);
+  err = pm_entry ? _pager_page_errors[PM_ERROR(*pm_entry)] : 0;
 
   pthread_mutex_unlock (&p->interlock);
 
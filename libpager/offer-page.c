@@ -30,10 +30,10 @@ pager_offer_page (struct pager *p,
 {
   pthread_mutex_lock (&p->interlock);
 
-  if (_pager_pagemap_resize (p, offset + vm_page_size))
+  if (_pager_pagemap_alloc (p, offset, vm_page_size))
     goto release_out;
 
-  short *pm_entry = &p->pagemap[offset / vm_page_size];
+  short *pm_entry = _pager_pagemap_entry (p, offset / vm_page_size);
   *pm_entry |= PM_INCORE;
 
   memory_object_data_supply (p->memobjcntl, offset, buf, vm_page_size, 0,
@@ -43,3 +43,90 @@ pager_offer_page (struct pager *p,
  release_out:
   pthread_mutex_unlock (&p->interlock);
 }
+
+int
+pager_prepare_offer (struct pager *p,
+		     vm_offset_t offset,
+		     int npages)
+{
+  int i;
+
+  pthread_mutex_lock (&p->interlock);
+
+  if (p->pager_state != NORMAL
+      || _pager_pagemap_alloc (p, offset, npages * vm_page_size))
+    {
+      pthread_mutex_unlock (&p->interlock);
+      return 0;
+    }
+
+  /* Only pages the kernel cannot have, and whose disk contents are
+     good, may be offered.  Claim them the way a pageout does, so that
+     a request for one of them waits for our data rather than reading
+     the disk itself, and a write waits until it has been supplied.  */
+  short **pm_entries = alloca (npages * sizeof *pm_entries);
+  _pager_pagemap_entries (p, offset, npages, pm_entries);
+  for (i = 0; i < npages; i++)
+    if (*pm_entries[i] & (PM_INCORE | PM_PAGINGOUT | PM_INVALID))
+      break;
+  for (npages = i, i = 0; i < npages; i++)
+    *pm_entries[i] |= PM_PAGINGOUT;
+
+  if (npages > 0)
+    _pager_block_termination (p);
+
+  pthread_mutex_unlock (&p->interlock);
+  return npages;
+}
+
+void
+pager_offer_pages (struct pager *p,
+		   int precious,
+		   vm_offset_t offset,
+		   int npages,
+		   vm_address_t buf,
+		   error_t err)
+{
+  int i, wakeup = 0;
+
+  pthread_mutex_lock (&p->interlock);
+
+  short **pm_entries = alloca (npages * sizeof *pm_entries);
+  _pager_pagemap_entries (p, offset, npages, pm_entries);
+
+  if (!err)
+    {
+      for (i = 0; i < npages; i++)
+	*pm_entries[i] |= PM_INCORE;
+      memory_object_data_supply (p->memobjcntl, offset, buf,
+				 npages * vm_page_size, 1, VM_PROT_NONE,
+				 precious, MACH_PORT_NULL);
+    }
+  else
+    {
+      /* Whoever asked for one of these pages meanwhile still needs an
+	 answer.  */
+      for (i = 0; i < npages; i++)
+	if (*pm_entries[i] & PM_PAGEINWAIT)
+	  {
+	    memory_object_data_error (p->memobjcntl,
+				      offset + i * vm_page_size,
+				      vm_page_size, EIO);
+	    _pager_mark_object_error (p, offset + i * vm_page_size,
+				      vm_page_size, EIO);
+	  }
+      munmap ((void *) buf, npages * vm_page_size);
+    }
+
+  for (i = 0; i < npages; i++)
+    {
+      if (*pm_entries[i] & PM_WRITEWAIT)
+	wakeup = 1;
+      *pm_entries[i] &= ~(PM_PAGINGOUT | PM_PAGEINWAIT | PM_WRITEWAIT);
+    }
+  if (wakeup)
+    pthread_cond_broadcast (&p->wakeup);
+
+  _pager_allow_termination (p);
+  pthread_mutex_unlock (&p->interlock);
+}
@@ -19,24 +19,61 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* Grow the pagemap of pager P as necessary to deal with address OFF */
 error_t
-_pager_pagemap_resize (struct pager *p, vm_address_t off)
+_pager_pagemap_alloc (struct pager *p, vm_address_t offset,
+		      vm_size_t length)
 {
-  off /= __vm_page_size;
+  vm_size_t first, last, chunk;
 
-  if (p->pagemapsize < off)
+  if (length == 0)
+    return 0;
+
+  first = (offset / __vm_page_size) >> PAGEMAP_CHUNK_SHIFT;
+  last = ((offset + length - 1) / __vm_page_size) >> PAGEMAP_CHUNK_SHIFT;
+
+  if (p->pagemapsize <= last)
     {
-      void *newaddr = reallocarray (p->pagemap, off,
-                                    sizeof (*p->pagemap));
+      void *newaddr = reallocarray (p->pagemap, last + 1,
+				    sizeof (*p->pagemap));
       if (!newaddr)
         return errno;
 
-      memset ((short *) newaddr + p->pagemapsize, 0,
-              (off - p->pagemapsize) * sizeof (*p->pagemap));
+      memset ((short **) newaddr + p->pagemapsize, 0,
+              (last + 1 - p->pagemapsize) * sizeof (*p->pagemap));
       p->pagemap = newaddr;
-      p->pagemapsize = off;
+      p->pagemapsize = last + 1;
     }
 
+  for (chunk = first; chunk <= last; chunk++)
+    if (p->pagemap[chunk] == NULL)
+      {
+	p->pagemap[chunk] = calloc (PAGEMAP_CHUNK, sizeof (short));
+	if (p->pagemap[chunk] == NULL)
+	  return errno;
+      }
+
   return 0;
 }
+
+void
+_pager_pagemap_entries (struct pager *p, vm_address_t offset,
+			int npages, short **entries)
+{
+  vm_size_t page = offset / __vm_page_size;
+  int i;
+
+  for (i = 0; i < npages; i++)
+    entries[i] = _pager_pagemap_entry (p, page + i);
+}
+
+void
+_pager_pagemap_free (struct pager *p)
+{
+  vm_size_t chunk;
+
+  for (chunk = 0; chunk < p->pagemapsize; chunk++)
+    free (p->pagemap[chunk]);
+  free (p->pagemap);
+  p->pagemap = NULL;
+  p->pagemapsize = 0;
+}
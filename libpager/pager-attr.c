@@ -78,6 +78,11 @@ pager_change_attributes (struct pager *p,
     }      
 
   pthread_mutex_unlock (&p->interlock);
+
+  /* The windows would keep the object from going away.  */
+  if (! may_cache)
+    _pager_forget_windows (p);
+
   memory_object_change_attributes (p->memobjcntl, may_cache, copy_strategy,
 				   wait ? p->port.port_right : MACH_PORT_NULL);
   
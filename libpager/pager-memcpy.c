@@ -28,6 +28,196 @@
    vm_page_size.) */
 #define VMCOPY_BETTER_THAN_MEMCPY (8*vm_page_size)
 
+/* A window is mapped to cover the whole transfer, if it can, but at
+   least that large, so that the next call for sequential data finds it
+   mapped, and at most that large.  Should the address space be short,
+   a window as small as what is copied at once is tried.  */
+#define WINDOW_MIN_SIZE (32 * vm_page_size)
+#define WINDOW_MAX_SIZE (2048 * vm_page_size)
+
+/* Number of windows kept mapped between calls.  */
+#define WINDOW_CACHE_SLOTS 8
+
+struct window
+{
+  /* The pager, with a reference; NULL if the window is not to be
+     cached.  */
+  struct pager *pager;
+
+  /* The memory object mapped, with a send right of ours if CACHED, and
+     the way it is mapped.  */
+  memory_object_t memobj;
+  vm_prot_t prot;
+  int cached;
+
+  /* The object from OFFSET for SIZE bytes is mapped at ADDR.  */
+  vm_offset_t offset;
+  vm_address_t addr;
+  vm_size_t size;
+
+  /* When the window was last used, for replacing the oldest one.  */
+  unsigned int stamp;
+};
+
+/* The windows of pagers that may be cached.  A window in the cache is
+   used by one copy at a time: it is taken out, and put back when the
+   copy is done.  The windows keep their pagers from ever seeing no
+   senders, so those of a pager are released when it stops being
+   cached, see _pager_forget_windows.  */
+static struct window window_cache[WINDOW_CACHE_SLOTS];
+static unsigned int window_stamp;
+static pthread_mutex_t window_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Unmap window W, and drop what it holds.  */
+static void
+release_window (struct window *w)
+{
+  vm_deallocate (mach_task_self (), w->addr, w->size);
+  if (w->cached)
+    mach_port_deallocate (mach_task_self (), w->memobj);
+  if (w->pager)
+    ports_port_deref (w->pager);
+  w->addr = 0;
+  w->size = 0;
+}
+
+/* Map the object MEMOBJ of PAGER with PROT to W, covering the
+   page-aligned START to END, and preferably SIZE bytes from START.  */
+static error_t
+map_window (struct pager *pager, memory_object_t memobj, vm_prot_t prot,
+	    vm_offset_t start, vm_offset_t end, vm_size_t size,
+	    struct window *w)
+{
+  error_t err;
+  int i;
+
+  if (pager)
+    {
+      pthread_mutex_lock (&window_cache_lock);
+      for (i = 0; i < WINDOW_CACHE_SLOTS; i++)
+	{
+	  struct window *c = &window_cache[i];
+	  if (c->pager == pager && c->memobj == memobj && c->prot == prot
+	      && c->offset <= start && end <= c->offset + c->size)
+	    {
+	      *w = *c;
+	      c->pager = NULL;
+	      pthread_mutex_unlock (&window_cache_lock);
+	      return 0;
+	    }
+	}
+      pthread_mutex_unlock (&window_cache_lock);
+    }
+
+  if (size > WINDOW_MAX_SIZE)
+    size = WINDOW_MAX_SIZE;
+  if (size < end - start)
+    size = end - start;
+
+  for (;;)
+    {
+      w->addr = 0;
+      err = vm_map (mach_task_self (), &w->addr, size, 0, 1,
+		    memobj, start, 0, prot, prot, VM_INHERIT_NONE);
+      if (err != KERN_NO_SPACE || size == end - start)
+	break;
+      size = round_page (size / 2);
+      if (size < end - start)
+	size = end - start;
+    }
+  if (err)
+    return err;
+
+  w->pager = pager;
+  if (pager)
+    ports_port_ref (pager);
+  w->memobj = memobj;
+  w->prot = prot;
+  w->cached = 0;
+  w->offset = start;
+  w->size = size;
+  return 0;
+}
+
+/* The copy through window W is done; keep it for the next one.  */
+static void
+put_window (struct window *w)
+{
+  struct window old = { .pager = NULL };
+  int i;
+
+  if (! w->pager)
+    {
+      release_window (w);
+      return;
+    }
+
+  if (! w->cached)
+    {
+      /* The name of MEMOBJ must not go to another port while the window
+	 is cached.  */
+      if (mach_port_mod_refs (mach_task_self (), w->memobj,
+			      MACH_PORT_RIGHT_SEND, 1))
+	{
+	  release_window (w);
+	  return;
+	}
+      w->cached = 1;
+    }
+
+  pthread_mutex_lock (&window_cache_lock);
+
+  /* See _pager_forget_windows.  */
+  if (! w->pager->may_cache || w->pager->pager_state == SHUTDOWN)
+    {
+      pthread_mutex_unlock (&window_cache_lock);
+      release_window (w);
+      return;
+    }
+
+  w->stamp = ++window_stamp;
+  for (i = 0; i < WINDOW_CACHE_SLOTS; i++)
+    if (! window_cache[i].pager)
+      break;
+  if (i == WINDOW_CACHE_SLOTS)
+    {
+      int oldest = 0;
+      for (i = 1; i < WINDOW_CACHE_SLOTS; i++)
+	if (window_stamp - window_cache[i].stamp
+	    > window_stamp - window_cache[oldest].stamp)
+	  oldest = i;
+      i = oldest;
+      old = window_cache[i];
+    }
+  window_cache[i] = *w;
+
+  pthread_mutex_unlock (&window_cache_lock);
+
+  if (old.pager)
+    release_window (&old);
+}
+
+void
+_pager_forget_windows (struct pager *p)
+{
+  struct window drop[WINDOW_CACHE_SLOTS];
+  int i, ndrop = 0;
+
+  /* P stopped being cached, or was shut down, before we took the lock;
+     put_window sees that once it has the lock.  */
+  pthread_mutex_lock (&window_cache_lock);
+  for (i = 0; i < WINDOW_CACHE_SLOTS; i++)
+    if (window_cache[i].pager == p)
+      {
+	drop[ndrop++] = window_cache[i];
+	window_cache[i].pager = NULL;
+      }
+  pthread_mutex_unlock (&window_cache_lock);
+
+  while (ndrop > 0)
+    release_window (&drop[--ndrop]);
+}
+
 /* Try to copy *SIZE bytes between the region OTHER points to
    and the region at OFFSET in the pager indicated by PAGER and MEMOBJ.
    If PROT is VM_PROT_READ, copying is from the pager to OTHER;
@@ -42,11 +232,7 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 {
   error_t err;
   size_t n = *size;
-
-#define VMCOPY_WINDOW_DEFAULT_SIZE (32 * vm_page_size)
-#define MEMCPY_WINDOW_DEFAULT_SIZE (32 * vm_page_size)
-  vm_address_t window;
-  vm_size_t window_size;
+  struct window w = { .addr = 0, .size = 0 };
 
   error_t do_vm_copy (void)
     {
@@ -56,35 +242,37 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 
       do
 	{
-	  window_size =
-	    VMCOPY_WINDOW_DEFAULT_SIZE > n
-	    ? (n - (n & (vm_page_size - 1)))
-	    : VMCOPY_WINDOW_DEFAULT_SIZE;
+	  vm_size_t copy_count = n - (n & (vm_page_size - 1));
+	  vm_address_t from;
 
-	  assert_backtrace (window_size >= VMCOPY_BETTER_THAN_MEMCPY);
-	  assert_backtrace ((window_size & (vm_page_size - 1)) == 0);
+	  if (copy_count > WINDOW_MAX_SIZE)
+	    copy_count = WINDOW_MAX_SIZE;
 
-	  window = 0;
-	  err = vm_map (mach_task_self (), &window, window_size, 0, 1,
-			memobj, offset, 0, prot, prot, VM_INHERIT_NONE);
+	  err = map_window (pager, memobj, prot, offset, offset + copy_count,
+			    copy_count < WINDOW_MIN_SIZE
+			    ? WINDOW_MIN_SIZE : copy_count, &w);
 	  if (err)
 	    return err;
 
+	  from = w.addr + (offset - w.offset);
+
 	  if (prot == VM_PROT_READ)
-	    err = vm_copy (mach_task_self (), window, window_size,
+	    err = vm_copy (mach_task_self (), from, copy_count,
 			   (vm_address_t) other);
 	  else
 	    err = vm_copy (mach_task_self (), (vm_address_t) other,
-			   window_size, window);
-
-	  vm_deallocate (mach_task_self (), window, window_size);
+			   copy_count, from);
 
 	  if (err)
-	    return err;
+	    {
+	      release_window (&w);
+	      return err;
+	    }
+	  put_window (&w);
 
-	  other += window_size;
-	  offset += window_size;
-	  n -= window_size;
+	  other += copy_count;
+	  offset += copy_count;
+	  n -= copy_count;
 	}
       while (n >= VMCOPY_BETTER_THAN_MEMCPY);
 
@@ -95,40 +283,40 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
     {
       error_t do_memcpy (size_t to_copy)
 	{
-	  window_size = MEMCPY_WINDOW_DEFAULT_SIZE;
-
 	  do
 	    {
-	      size_t pageoff = offset & (vm_page_size - 1);
-	      size_t copy_count = window_size - pageoff;
-
-	      /* Map in and copy a standard-sized window, unless that is
-		 more than the total left to be copied.  */
-
-	      if (window_size >= round_page (pageoff + to_copy))
-		{
-		  copy_count = to_copy;
-		  window_size = round_page (pageoff + to_copy);
-		}
-
-	      window = 0;
-	      err = vm_map (mach_task_self (), &window, window_size, 0, 1,
-			    memobj, offset - pageoff, 0,
-			    prot, prot, VM_INHERIT_NONE);
+	      vm_offset_t start = trunc_page (offset);
+	      vm_offset_t end = round_page (offset + to_copy);
+	      size_t copy_count;
+	      void *at;
+
+	      /* Map in and copy as much as a window takes, and as much as
+		 is left to be copied on a later call, should that be
+		 sequential.  */
+	      if (end - start > WINDOW_MAX_SIZE)
+		end = start + WINDOW_MAX_SIZE;
+	      err = map_window (pager, memobj, prot, start, end,
+				end - start < WINDOW_MIN_SIZE
+				? WINDOW_MIN_SIZE : end - start, &w);
 	      if (err)
 		return err;
 
 	      /* Realign the fault preemptor for the new mapping window.  */
-	      preemptor->first = window;
-	      preemptor->last = window + window_size;
+	      preemptor->first = w.addr;
+	      preemptor->last = w.addr + w.size;
 	      __sync_synchronize();
 
+	      at = (void *) w.addr + (offset - w.offset);
+	      copy_count = (void *) w.addr + w.size - at;
+	      if (copy_count > to_copy)
+		copy_count = to_copy;
+
 	      if (prot == VM_PROT_READ)
-		memcpy (other, (const void *) window + pageoff, copy_count);
+		memcpy (other, at, copy_count);
 	      else
-		memcpy ((void *) window + pageoff, other, copy_count);
+		memcpy (at, other, copy_count);
 
-	      vm_deallocate (mach_task_self (), window, window_size);
+	      put_window (&w);
 
 	      assert_backtrace (n >= copy_count);
 	      assert_backtrace (to_copy >= copy_count);
@@ -174,9 +362,9 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
   void fault (int signo, long int sigcode, struct sigcontext *scp)
     {
       assert_backtrace (scp->sc_error == EKERN_MEMORY_ERROR);
-      err = pager_get_error (pager, sigcode - window + offset);
-      n -= sigcode - window;
-      vm_deallocate (mach_task_self (), window, window_size);
+      err = pager_get_error (pager, sigcode - w.addr + w.offset);
+      n -= sigcode - (w.addr + (offset - w.offset));
+      release_window (&w);
       siglongjmp (buf, 1);
     }
 
@@ -204,16 +392,13 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 
   /* Need to do it the hard way.  */
 
-  window = 0;
-  window_size = 0;
-
   if (sigsetjmp (buf, 1) == 0)
     {
       sigset_t mask;
       sigemptyset (&mask);
       sigaddset (&mask, SIGSEGV);
       sigaddset (&mask, SIGBUS);
-      hurd_catch_signal (mask, window, window + window_size,
+      hurd_catch_signal (mask, 0, 0,
 		         &do_copy, (sighandler_t) &fault);
     }
 
@@ -29,4 +29,5 @@ pager_shutdown (struct pager *p)
   p->pager_state = SHUTDOWN;
   ports_destroy_right (p);
   pthread_mutex_unlock (&p->interlock);
+  _pager_forget_windows (p);
 }
@@ -34,6 +34,14 @@ error_t
 pager_start_workers (struct port_bucket *pager_bucket,
 		     struct pager_requests **requests);
 
+/* Like pager_start_workers, but start NWORKERS worker threads, which
+   must be at least one.  Requests to any one pager are always handled
+   by the same worker, so more workers let more pagers be served in
+   parallel.  */
+error_t
+pager_start_workers_count (struct port_bucket *pager_bucket, int nworkers,
+			   struct pager_requests **requests);
+
 /* Inhibit the worker threads libpager uses to service requests,
    blocking until all requests sent before this function is called have
    finished.
@@ -139,6 +147,30 @@ pager_offer_page (struct pager *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);  
 
+/* Prepare to offer the kernel up to NPAGES pages of data, starting at
+   page-aligned OFFSET, that it has not asked for.  Return how many of
+   the leading pages can be offered; zero if none.  Unless zero, the
+   caller must then read that many pages and pass them to
+   pager_offer_pages.  Until it has, requests for and writes of these
+   pages wait.  */
+int
+pager_prepare_offer (struct pager *pager,
+		     vm_offset_t offset,
+		     int npages);
+
+/* Offer the NPAGES pages in BUF, prepared by pager_prepare_offer, to
+   the kernel, as pager_offer_page would, without write access.  BUF,
+   page-aligned memory, is consumed.  If ERR is nonzero, the pages
+   could not be read: nothing is offered, but kernel requests that came
+   in meanwhile get an error.  */
+void
+pager_offer_pages (struct pager *pager,
+		   int precious,
+		   vm_offset_t offset,
+		   int npages,
+		   vm_address_t buf,
+		   error_t err);
+
 /* Change the attributes of the memory object underlying pager PAGER.
    Arguments MAY_CACHE and COPY_STRATEGY are as for
    memory_object_change_attributes.  Wait for the kernel to report
@@ -194,6 +226,19 @@ pager_read_page (struct user_pager_info *pager,
 		 vm_address_t *buf,
 		 int *write_lock);
 
+/* The user may define this function.  For pager PAGER, read the NPAGES
+   pages from OFFSET that the kernel asked for at once.  Set *BUF to the
+   address of the pages, one contiguous page-aligned region, and set
+   *WRITE_LOCK if they must be provided read-only.  Return EOPNOTSUPP to
+   have each page read with pager_read_page instead, which is what the
+   default does; other errors are as for pager_read_page.  */
+error_t
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t offset,
+		  int npages,
+		  vm_address_t *buf,
+		  int *write_lock);
+
 /* The user must define this function.  For pager PAGER, synchronously
    write one page from BUF to offset PAGE.  Do not deallocate BUF, and do
    not keep any references to BUF.  The only permissible error returns
@@ -203,6 +248,19 @@ pager_write_page (struct user_pager_info *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);
 
+/* The user may define this function.  For pager PAGER, synchronously
+   write the NPAGES pages from BUF to offset OFFSET, and set ERRORS[I]
+   to the outcome for page I, as pager_write_page would return it.  The
+   same rules about BUF apply.  This lets a pager write a range the
+   kernel returned in one go instead of page by page; the default just
+   calls pager_write_page for each page.  */
+void
+pager_write_pages (struct user_pager_info *pager,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   int npages,
+		   error_t *errors);
+
 /* The user must define this function.  A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *pager,
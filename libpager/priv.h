@@ -22,6 +22,7 @@
 #include <hurd.h>
 #include <sys/mman.h>
 #include <pthread.h>
+#include <assert-backtrace.h>
 #include "pager.h"
 #include <hurd/ports.h>
 
@@ -65,10 +66,16 @@ struct pager
   struct pending_init *init_head, *init_tail;
 #endif
 
-  short *pagemap;
-  vm_size_t pagemapsize;	/* number of elements in PAGEMAP */
+  /* The PM_* flags of each page, in chunks of PAGEMAP_CHUNK entries.
+     A chunk is only allocated once something is recorded for a page in
+     it, so a big sparse object needs little memory.  */
+  short **pagemap;
+  vm_size_t pagemapsize;	/* number of chunk pointers in PAGEMAP */
 };
 
+#define PAGEMAP_CHUNK_SHIFT	9
+#define PAGEMAP_CHUNK		(1 << PAGEMAP_CHUNK_SHIFT)
+
 struct lock_request
 {
   struct lock_request *next, **prevp;
@@ -133,7 +140,41 @@ extern struct port_class *_pager_class;
 
 void _pager_block_termination (struct pager *);
 void _pager_allow_termination (struct pager *);
-error_t _pager_pagemap_resize (struct pager *, vm_address_t);
+/* Make sure the pagemap of P has entries for the LENGTH bytes at
+   OFFSET.  */
+error_t _pager_pagemap_alloc (struct pager *p, vm_address_t offset,
+			      vm_size_t length);
+
+/* Return the pagemap entry of P for page number PAGE, or NULL if none
+   has been allocated, in which case the entry is as good as zero.  */
+static inline short *
+_pager_pagemap_find (struct pager *p, vm_size_t page)
+{
+  vm_size_t chunk = page >> PAGEMAP_CHUNK_SHIFT;
+
+  if (chunk >= p->pagemapsize || p->pagemap[chunk] == NULL)
+    return NULL;
+  return &p->pagemap[chunk][page & (PAGEMAP_CHUNK - 1)];
+}
+
+/* Return the pagemap entry of P for page number PAGE, which must have
+   been allocated with _pager_pagemap_alloc.  Entries stay where they
+   are until the pagemap is freed.  */
+static inline short *
+_pager_pagemap_entry (struct pager *p, vm_size_t page)
+{
+  short *entry = _pager_pagemap_find (p, page);
+  assert_backtrace (entry);
+  return entry;
+}
+
+/* Store in ENTRIES the pagemap entries of P for the NPAGES pages at
+   OFFSET, which must have been allocated with _pager_pagemap_alloc.  */
+void _pager_pagemap_entries (struct pager *p, vm_address_t offset,
+			     int npages, short **entries);
+
+/* Free the pagemap of P.  */
+void _pager_pagemap_free (struct pager *p);
 void _pager_mark_next_request_error (struct pager *, vm_address_t,
 				     vm_size_t, error_t);
 void _pager_mark_object_error (struct pager *, vm_address_t,
@@ -143,4 +184,8 @@ void _pager_lock_object (struct pager *, vm_offset_t, vm_size_t, int, int,
 void _pager_free_structure (struct pager *);
 void _pager_clean (void *arg);
 void _pager_real_dropweak (void *arg);
+
+/* Release the windows pager_memcpy keeps mapped for P, which has just
+   stopped being cached or been shut down.  */
+void _pager_forget_windows (struct pager *p);
 #endif
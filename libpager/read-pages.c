@@ -0,0 +1,31 @@
+/* Default ranged page read
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+
+#include "priv.h"
+
+/* Used unless the user defines pager_read_pages: have every page read
+   by pager_read_page.  */
+error_t __attribute__((weak))
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t offset,
+		  int npages,
+		  vm_address_t *buf,
+		  int *write_lock)
+{
+  return EOPNOTSUPP;
+}
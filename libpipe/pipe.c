@@ -126,21 +126,22 @@ pipe_remove_select_cond (struct pipe *pipe, struct pipe_select_cond *cond)
 static void
 pipe_select_cond_broadcast (struct pipe *pipe)
 {
-  struct pipe_select_cond *cond, *last;
+  struct pipe_select_cond *cond, *first;
 
-  cond = pipe->pending_selects;
+  first = pipe->pending_selects;
 
-  if (cond == NULL)
+  if (first == NULL)
     return;
 
-  last = cond->prev;
-
+  /* Each waiter has a condition of its own, so only those selecting on
+     PIPE are woken.  */
+  cond = first;
   do
     {
       pthread_cond_broadcast (&cond->cond);
       cond = cond->next;
     }
-  while (cond != last);
+  while (cond != first);
 }
 
 /* Take any actions necessary when PIPE acquires its first writer.  */
@@ -41,28 +41,36 @@ pq_create (struct pq **pq)
 
   (*pq)->head = (*pq)->tail = 0;
   (*pq)->free = 0;
+  (*pq)->num_free = 0;
 
   return 0;
 }
 
+/* Free PACKET and its contents.  */
+static void
+free_packet (struct packet *packet)
+{
+  if (packet->ports)
+    free (packet->ports);
+  if (packet->buf_len > 0)
+    {
+      if (packet->buf_vm_alloced)
+	munmap (packet->buf, packet->buf_len);
+      else
+	free (packet->buf);
+    }
+  free (packet);
+}
+
 /* Free every packet (and its contents) in the linked list rooted at HEAD.  */
 static void
 free_packets (struct packet *head)
 {
-  if (head)
+  while (head)
     {
       struct packet *next = head->next;
-      if (head->ports)
-	free (head->ports);
-      if (head->buf_len > 0)
-	{
-	  if (head->buf_vm_alloced)
-	    munmap (head->buf, head->buf_len);
-	  else
-	    free (head->buf);
-	}
-      free (head);
-      free_packets (next);
+      free_packet (head);
+      head = next;
     }
 }
 
@@ -96,8 +104,16 @@ pq_dequeue (struct pq *pq)
     pipe_dealloc_addr (packet->source);
 
   pq->head = packet->next;
-  packet->next = pq->free;
-  pq->free = packet;
+  if (pq->num_free < PQ_MAX_FREE)
+    /* Keep PACKET and its buffer for the next pq_queue, so that a steady
+       flow of messages allocates nothing.  */
+    {
+      packet->next = pq->free;
+      pq->free = packet;
+      pq->num_free++;
+    }
+  else
+    free_packet (packet);
   if (pq->head)
     pq->head->prev = 0;
   else
@@ -133,7 +149,10 @@ pq_queue (struct pq *pq, unsigned type, void *source)
       packet->buf_vm_alloced = 0;
     }
   else
-    pq->free = packet->next;
+    {
+      pq->free = packet->next;
+      pq->num_free--;
+    }
 
   packet->num_ports = 0;
   packet->buf_start = packet->buf_end = packet->buf;
@@ -342,8 +361,34 @@ packet_write (struct packet *packet,
   if (err)
     return err;
 
-  /* Add the new data.  */
-  memcpy (packet->buf_end, data, data_len);
+  if (packet->buf_vm_alloced && data_len >= PACKET_SIZE_LARGE
+      && trunc_page (data - packet->buf_end) == data - packet->buf_end)
+    /* DATA is page-aligned the same way as the end of our buffer, which is
+       the case of a large write that came out-of-line into an empty
+       packet.  Rather than touching every byte, have the kernel map the
+       whole pages of DATA copy-on-write in BUF.  They stay there once MiG
+       has deallocated DATA, and a large read returns them through
+       packet_fetch, so the data is never copied by the server.  */
+    {
+      char *buf_end = packet->buf_end;
+      vm_address_t pages = round_page (data);
+      vm_address_t pages_end = trunc_page (data + data_len);
+      size_t head = pages - (vm_address_t) data;
+
+      if (pages < pages_end
+	  && vm_copy (mach_task_self (), pages, pages_end - pages,
+		      (vm_address_t) buf_end + head) == KERN_SUCCESS)
+	{
+	  memcpy (buf_end, data, head);
+	  memcpy (buf_end + head + (pages_end - pages), (char *) pages_end,
+		  data + data_len - (char *) pages_end);
+	}
+      else
+	memcpy (buf_end, data, data_len);
+    }
+  else
+    /* Add the new data.  */
+    memcpy (packet->buf_end, data, data_len);
   packet->buf_end += data_len;
   if (amount != NULL)
     *amount = data_len;
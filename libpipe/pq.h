@@ -222,10 +222,15 @@ packet_ensure_efficiently (struct packet *packet, size_t amount)
 
 #endif /* Use extern inlines.  */
 
+/* The number of free packets a packet queue keeps for reuse, buffers
+   included; beyond that, dequeued packets are freed.  */
+#define PQ_MAX_FREE		32
+
 struct pq
 {
   struct packet *head, *tail;	/* Packet queue */
   struct packet *free;		/* Free packets */
+  size_t num_free;		/* Length of FREE */
 };
 
 /* Pushes a new packet of type TYPE and source SOURCE, and returns it, or
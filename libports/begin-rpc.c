@@ -19,17 +19,73 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include "ports.h"
+#include <trace.h>
 
 #define INHIBITED (PORTS_INHIBITED | PORTS_INHIBIT_WAIT)
 
+/* Record that an RPC is in progress on PI.  */
+static void
+link_rpc (struct port_info *pi, struct rpc_info *info)
+{
+  info->thread = hurd_thread_self ();
+  info->notifies = 0;
+
+  pthread_mutex_lock (&pi->rpcs_lock);
+  info->next = pi->current_rpcs;
+  if (pi->current_rpcs)
+    pi->current_rpcs->prevp = &info->next;
+  info->prevp = &pi->current_rpcs;
+  pi->current_rpcs = info;
+  pthread_mutex_unlock (&pi->rpcs_lock);
+
+  __atomic_add_fetch (&pi->class->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&pi->bucket->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&_ports_total_rpcs, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Return nonzero if RPCs on PI are, or are about to be, inhibited.  */
+static int
+inhibited (struct port_info *pi)
+{
+  return ((__atomic_load_n (&_ports_flags, __ATOMIC_SEQ_CST)
+	   | __atomic_load_n (&pi->bucket->flags, __ATOMIC_SEQ_CST)
+	   | __atomic_load_n (&pi->class->flags, __ATOMIC_SEQ_CST)
+	   | __atomic_load_n (&pi->flags, __ATOMIC_SEQ_CST))
+	  & INHIBITED);
+}
+
 error_t
 ports_begin_rpc (void *portstruct, mach_msg_id_t msg_id, struct rpc_info *info)
 {
   int *block_flags = 0;
 
   struct port_info *pi = portstruct;
-  
+
+  TRACE (TRACE_PORTS_RPC_BEGIN, msg_id, pi->port_right);
+
+  info->msg_id = msg_id;
+  info->start = (msg_id && __atomic_load_n (&_ports_rpc_stats,
+					    __ATOMIC_RELAXED)
+		 ? _ports_now_us () : 0);
+
+  /* The common case takes no global lock.  Inhibitors announce
+     themselves before looking for RPCs in progress, so either they
+     find this one, or it sees them below.  */
+  if (__atomic_load_n (&pi->port_right, __ATOMIC_RELAXED) == MACH_PORT_NULL)
+    return EOPNOTSUPP;
+  link_rpc (pi, info);
+  if (! inhibited (pi))
+    return 0;
+
+  /* Back out, and decide under _PORTS_LOCK whether to wait.  */
   pthread_mutex_lock (&_ports_lock);
+
+  if (_ports_unlink_rpc (pi, info))
+    pthread_cond_broadcast (&_ports_block);
+  /* An inhibitor or ports_interrupt_rpcs may have found INFO in the
+     meantime; that was not meant for an RPC that had not begun.  */
+  ports_self_interrupted ();
+  hurd_check_cancel ();
   
   do
     {
@@ -89,18 +145,9 @@ ports_begin_rpc (void *portstruct, mach_msg_id_t msg_id, struct rpc_info *info)
     }
   while (block_flags);
   
-  /* Record that that an RPC is in progress */
-  info->thread = hurd_thread_self ();
-  info->next = pi->current_rpcs;
-  info->notifies = 0;
-  if (pi->current_rpcs)
-    pi->current_rpcs->prevp = &info->next;
-  info->prevp = &pi->current_rpcs;
-  pi->current_rpcs = info;
-
-  pi->class->rpcs++;
-  pi->bucket->rpcs++;
-  _ports_total_rpcs++;
+  /* Record that that an RPC is in progress.  Inhibitors take
+     _PORTS_LOCK, so none can start before this is done.  */
+  link_rpc (pi, info);
 
   pthread_mutex_unlock (&_ports_lock);
 
@@ -0,0 +1,47 @@
+/* Limits and statistics of the threads serving a bucket
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+
+void
+ports_set_bucket_max_threads (struct port_bucket *bucket, unsigned int max)
+{
+  __atomic_store_n (&bucket->max_threads, max, __ATOMIC_RELAXED);
+}
+
+void
+ports_get_bucket_thread_stats (struct port_bucket *bucket,
+			       struct ports_thread_stats *stats)
+{
+  struct ports_thread_stats *s = &bucket->thread_stats;
+
+  stats->threads = __atomic_load_n (&s->threads, __ATOMIC_RELAXED);
+  stats->busy = __atomic_load_n (&s->busy, __ATOMIC_RELAXED);
+  stats->max_threads = __atomic_load_n (&bucket->max_threads,
+					__ATOMIC_RELAXED);
+  stats->saturated = __atomic_load_n (&s->saturated, __ATOMIC_RELAXED);
+  stats->wait_us = __atomic_load_n (&s->wait_us, __ATOMIC_RELAXED);
+  stats->max_wait_us = __atomic_load_n (&s->max_wait_us, __ATOMIC_RELAXED);
+  stats->requests = __atomic_load_n (&s->requests, __ATOMIC_RELAXED);
+  stats->drained = __atomic_load_n (&s->drained, __ATOMIC_RELAXED);
+  stats->service_us = __atomic_load_n (&s->service_us, __ATOMIC_RELAXED);
+  stats->max_service_us = __atomic_load_n (&s->max_service_us,
+					   __ATOMIC_RELAXED);
+}
@@ -22,6 +22,7 @@
 #include <stddef.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <hurd/ihash.h>
 
 static struct port_class *notify_port_class;
@@ -57,6 +58,11 @@ ports_create_bucket (void)
 
   hurd_ihash_init (&ret->htable, offsetof (struct port_info, hentry));
   ret->rpcs = ret->flags = ret->count = 0;
+  ret->portsets = &ret->portset;
+  ret->nportsets = 1;
+  ret->portsets_by_class = 0;
+  ret->max_threads = 0;
+  memset (&ret->thread_stats, 0, sizeof ret->thread_stats);
   _ports_threadpool_init (&ret->threadpool);
 
   /* Create the notify_port for this bucket.  */
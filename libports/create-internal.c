@@ -60,6 +60,7 @@ _ports_create_port_internal (struct port_class *class,
   pi->flags = 0;
   pi->port_right = port;
   pi->current_rpcs = 0;
+  pthread_mutex_init (&pi->rpcs_lock, NULL);
   pi->bucket = bucket;
   
   pthread_mutex_lock (&_ports_lock);
@@ -107,7 +108,7 @@ _ports_create_port_internal (struct port_class *class,
   if (install)
     {
       err = mach_port_move_member (mach_task_self (), pi->port_right,
-				   bucket->portset);
+				   ports_bucket_portset (bucket, pi));
       if (err)
 	goto lose_unlocked;
     }
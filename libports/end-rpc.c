@@ -19,29 +19,58 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include "ports.h"
+#include <trace.h>
+
+int
+_ports_unlink_rpc (struct port_info *pi, struct rpc_info *info)
+{
+  pthread_mutex_lock (&pi->rpcs_lock);
+  *info->prevp = info->next;
+  if (info->next)
+    info->next->prevp = info->prevp;
+  pthread_mutex_unlock (&pi->rpcs_lock);
+
+  __atomic_sub_fetch (&pi->class->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&pi->bucket->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&_ports_total_rpcs, 1, __ATOMIC_SEQ_CST);
+
+  /* Inhibitors set their flag before counting the RPCs in progress,
+     so either they counted this one as finished, or the flag is seen
+     here.  */
+  return ((__atomic_load_n (&pi->flags, __ATOMIC_SEQ_CST)
+	   & PORT_INHIBIT_WAIT)
+	  || (__atomic_load_n (&pi->bucket->flags, __ATOMIC_SEQ_CST)
+	      & PORT_BUCKET_INHIBIT_WAIT)
+	  || (__atomic_load_n (&pi->class->flags, __ATOMIC_SEQ_CST)
+	      & PORT_CLASS_INHIBIT_WAIT)
+	  || (__atomic_load_n (&_ports_flags, __ATOMIC_SEQ_CST)
+	      & _PORTS_INHIBIT_WAIT));
+}
 
 void
 ports_end_rpc (void *port, struct rpc_info *info)
 {
   struct port_info *pi = port;
 
-  pthread_mutex_lock (&_ports_lock);
+  TRACE (TRACE_PORTS_RPC_END, info->msg_id, 0);
 
-  if (info->notifies)
-    _ports_remove_notified_rpc (info);
+  if (info->start)
+    _ports_record_rpc (info->msg_id, _ports_now_us () - info->start);
 
-  *info->prevp = info->next;
-  if (info->next)
-    info->next->prevp = info->prevp;
-  pi->class->rpcs--;
-  _ports_total_rpcs--;
-  pi->bucket->rpcs--;
+  /* Only this thread adds notify requests to INFO.  */
+  if (info->notifies)
+    {
+      pthread_mutex_lock (&_ports_lock);
+      _ports_remove_notified_rpc (info);
+      pthread_mutex_unlock (&_ports_lock);
+    }
 
-  if ((pi->flags & PORT_INHIBIT_WAIT)
-      || (pi->bucket->flags & PORT_BUCKET_INHIBIT_WAIT)
-      || (pi->class->flags & PORT_CLASS_INHIBIT_WAIT)
-      || (_ports_flags & _PORTS_INHIBIT_WAIT))
-    pthread_cond_broadcast (&_ports_block);
+  if (_ports_unlink_rpc (pi, info))
+    {
+      pthread_mutex_lock (&_ports_lock);
+      pthread_cond_broadcast (&_ports_block);
+      pthread_mutex_unlock (&_ports_lock);
+    }
 
   /* This removes the current thread's rpc (which should be INFO) from the
      ports interrupted list.  */
@@ -50,6 +79,4 @@ ports_end_rpc (void *port, struct rpc_info *info)
   /* Clear the cancellation flag for this thread since the current 
      RPC is now finished anyhow. */
   hurd_check_cancel ();
-
-  pthread_mutex_unlock (&_ports_lock);
 }
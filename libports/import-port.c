@@ -54,6 +54,7 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
   pi->flags = stat.mps_srights ? PORT_HAS_SENDRIGHTS : 0;
   pi->port_right = port;
   pi->current_rpcs = 0;
+  pthread_mutex_init (&pi->rpcs_lock, NULL);
   pi->bucket = bucket;
   
   pthread_mutex_lock (&_ports_lock);
@@ -98,7 +99,8 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
   mach_port_set_protected_payload (mach_task_self (), port,
 				   (unsigned long) pi);
 
-  mach_port_move_member (mach_task_self (), port, bucket->portset);
+  mach_port_move_member (mach_task_self (), port,
+			 ports_bucket_portset (bucket, pi));
 
   if (stat.mps_srights)
     {
@@ -35,12 +35,18 @@ ports_inhibit_all_rpcs (void)
     {
       int this_one = 0;
 
+      /* Announce the inhibition first: an RPC starting from now on
+	 either sees it and waits, or is found below.  */
+      __atomic_or_fetch (&_ports_flags, _PORTS_INHIBIT_WAIT,
+			 __ATOMIC_SEQ_CST);
+
       pthread_rwlock_rdlock (&_ports_htable_lock);
       HURD_IHASH_ITERATE (&_ports_htable, portstruct)
 	{
 	  struct rpc_info *rpc;
 	  struct port_info *pi = portstruct;
 
+	  pthread_mutex_lock (&pi->rpcs_lock);
 	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	    {
 	      /* Avoid cancelling the calling thread if it's currently
@@ -50,12 +56,12 @@ ports_inhibit_all_rpcs (void)
 	      else
 		hurd_thread_cancel (rpc->thread);
 	    }
+	  pthread_mutex_unlock (&pi->rpcs_lock);
 	}
       pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (_ports_total_rpcs > this_one)
+      while (__atomic_load_n (&_ports_total_rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  _ports_flags |= _PORTS_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
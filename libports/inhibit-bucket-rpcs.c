@@ -35,12 +35,18 @@ ports_inhibit_bucket_rpcs (struct port_bucket *bucket)
     {
       int this_one = 0;
 
+      /* Announce the inhibition first: an RPC starting from now on
+	 either sees it and waits, or is found below.  */
+      __atomic_or_fetch (&bucket->flags, PORT_BUCKET_INHIBIT_WAIT,
+			 __ATOMIC_SEQ_CST);
+
       pthread_rwlock_rdlock (&_ports_htable_lock);
       HURD_IHASH_ITERATE (&bucket->htable, portstruct)
 	{
 	  struct rpc_info *rpc;
 	  struct port_info *pi = portstruct;
 
+	  pthread_mutex_lock (&pi->rpcs_lock);
 	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	    {
 	      /* Avoid cancelling the calling thread.  */
@@ -49,12 +55,12 @@ ports_inhibit_bucket_rpcs (struct port_bucket *bucket)
 	      else
 		hurd_thread_cancel (rpc->thread);
 	    }
+	  pthread_mutex_unlock (&pi->rpcs_lock);
 	}
       pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (bucket->rpcs > this_one)
+      while (__atomic_load_n (&bucket->rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  bucket->flags |= PORT_BUCKET_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -34,6 +34,11 @@ ports_inhibit_class_rpcs (struct port_class *class)
     {
       int this_one = 0;
 
+      /* Announce the inhibition first: an RPC starting from now on
+	 either sees it and waits, or is found below.  */
+      __atomic_or_fetch (&class->flags, PORT_CLASS_INHIBIT_WAIT,
+			 __ATOMIC_SEQ_CST);
+
       pthread_rwlock_rdlock (&_ports_htable_lock);
       HURD_IHASH_ITERATE (&_ports_htable, portstruct)
 	{
@@ -42,6 +47,7 @@ ports_inhibit_class_rpcs (struct port_class *class)
 	  if (pi->class != class)
 	    continue;
 
+	  pthread_mutex_lock (&pi->rpcs_lock);
 	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	    {
 	      /* Avoid cancelling the calling thread.  */
@@ -50,12 +56,12 @@ ports_inhibit_class_rpcs (struct port_class *class)
 	      else
 		hurd_thread_cancel (rpc->thread);
 	    }
+	  pthread_mutex_unlock (&pi->rpcs_lock);
 	}
       pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (class->rpcs > this_one)
+      while (__atomic_load_n (&class->rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  class->flags |= PORT_CLASS_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
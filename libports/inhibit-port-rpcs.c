@@ -35,7 +35,13 @@ ports_inhibit_port_rpcs (void *portstruct)
     {
       struct rpc_info *rpc;
       struct rpc_info *this_rpc = 0;
+      int busy;
+
+      /* Announce the inhibition first: an RPC starting from now on
+	 either sees it and waits, or is found below.  */
+      __atomic_or_fetch (&pi->flags, PORT_INHIBIT_WAIT, __ATOMIC_SEQ_CST);
   
+      pthread_mutex_lock (&pi->rpcs_lock);
       for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	{
 	  /* Avoid cancelling the calling thread.  */
@@ -44,12 +50,19 @@ ports_inhibit_port_rpcs (void *portstruct)
 	  else
 	    hurd_thread_cancel (rpc->thread);
 	}
+      pthread_mutex_unlock (&pi->rpcs_lock);
 
-      while (pi->current_rpcs
-	     /* If this thread's RPC is the only one left, it doesn't count. */
-	     && !(pi->current_rpcs == this_rpc && ! this_rpc->next))
+      while (1)
 	{
-	  pi->flags |= PORT_INHIBIT_WAIT;
+	  pthread_mutex_lock (&pi->rpcs_lock);
+	  busy = (pi->current_rpcs
+		  /* If this thread's RPC is the only one left, it doesn't
+		     count. */
+		  && !(pi->current_rpcs == this_rpc && ! this_rpc->next));
+	  pthread_mutex_unlock (&pi->rpcs_lock);
+	  if (! busy)
+	    break;
+
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -170,11 +170,11 @@ ports_interrupt_self_on_notification (void *object,
   struct port_info *pi = object;
   thread_t thread = hurd_thread_self ();
 
-  pthread_mutex_lock (&_ports_lock);
+  pthread_mutex_lock (&pi->rpcs_lock);
   for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
     if (rpc->thread == thread)
       break;
-  pthread_mutex_unlock (&_ports_lock);
+  pthread_mutex_unlock (&pi->rpcs_lock);
 
   assert_backtrace (rpc);
 
@@ -28,7 +28,7 @@ ports_interrupt_rpcs (void *portstruct)
   struct rpc_info *rpc;
   thread_t self = hurd_thread_self ();
 
-  pthread_mutex_lock (&_ports_lock);
+  pthread_mutex_lock (&pi->rpcs_lock);
   
   for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
     {
@@ -39,5 +39,5 @@ ports_interrupt_rpcs (void *portstruct)
 	}
     }
 
-  pthread_mutex_unlock (&_ports_lock);
+  pthread_mutex_unlock (&pi->rpcs_lock);
 }
@@ -25,11 +25,30 @@
 #include <mach/message.h>
 #include <mach/thread_info.h>
 #include <mach/thread_switch.h>
+#include <errno.h>
+#include <time.h>
 
 #define STACK_SIZE (64 * 1024)
 
 #define THREAD_PRI 2
 
+/* Idle threads beyond this many do not listen on the port set, but wait
+   on a stack for a thread to be needed.  The one most recently done
+   with a request is woken first, as its stack is still in the cache,
+   and the ones that stay idle at the bottom are the ones that time out.
+   A thread done with a request while fewer than this many are
+   listening goes back to listening straight away; any other first takes
+   the requests already queued, if there are, before it parks.  */
+#define LISTENERS 2
+
+/* An idle thread waiting to be needed again.  */
+struct parked
+{
+  pthread_cond_t wakeup;
+  int woken;
+  struct parked *next, **prevp;
+};
+
 /* XXX To reduce starvation, the priority of new threads is initially
    depressed. This helps already existing threads complete their job and be
    recycled to handle new messages. The duration of this depression is made
@@ -99,18 +118,114 @@ error_host_priv:
     error (0, err, "unable to adjust libports thread priority");
 }
 
-void
-ports_manage_port_operations_multithread (struct port_bucket *bucket,
-					  ports_demuxer_type demuxer,
-					  int thread_timeout,
-					  int global_timeout,
-					  void (*hook)(void))
+/* Like mach_msg_server_timeout, but once DEMUXER has cleared *LISTEN,
+   only take a request that is already queued, and return
+   MACH_RCV_TIMED_OUT if there is none.  The reply and the next receive
+   are done in one mach_msg either way.  */
+static mach_msg_return_t
+serve (int (*demuxer) (mach_msg_header_t *, mach_msg_header_t *),
+       mach_port_t portset, mach_msg_timeout_t timeout, int *listen)
+{
+  mach_msg_size_t max_size = 2 * __vm_page_size;
+  const mach_msg_option_t option = MACH_RCV_TIMEOUT | MACH_RCV_LARGE;
+  mig_reply_header_t *request, *reply, *spare;
+  mach_msg_return_t mr;
+
+  request = alloca (max_size);
+  reply = alloca (max_size);
+
+  while (1)
+    {
+    get_request:
+      mr = mach_msg (&request->Head, MACH_RCV_MSG | option, 0, max_size,
+		     portset, *listen ? timeout : 0, MACH_PORT_NULL);
+      while (mr == MACH_MSG_SUCCESS)
+	{
+	  (*demuxer) (&request->Head, &reply->Head);
+	  assert_backtrace (reply->Head.msgh_size <= max_size);
+
+	  switch (reply->RetCode)
+	    {
+	    case KERN_SUCCESS:
+	      /* Hunky dory.  */
+	      break;
+
+	    case MIG_NO_REPLY:
+	      /* The server function wanted no reply sent.  */
+	      goto get_request;
+
+	    default:
+	      /* Some error; destroy the request message to release any
+		 port rights or VM it holds.  Don't destroy the reply
+		 port right, so we can send an error message.  */
+	      request->Head.msgh_remote_port = MACH_PORT_NULL;
+	      mach_msg_destroy (&request->Head);
+	      break;
+	    }
+
+	  if (reply->Head.msgh_remote_port == MACH_PORT_NULL)
+	    {
+	      /* No reply port, so destroy the reply.  */
+	      if (reply->Head.msgh_bits & MACH_MSGH_BITS_COMPLEX)
+		mach_msg_destroy (&reply->Head);
+	      goto get_request;
+	    }
+
+	  /* Send the reply and receive the next request into the same
+	     buffer.  */
+	  mr = mach_msg (&reply->Head, MACH_SEND_MSG | MACH_RCV_MSG | option,
+			 reply->Head.msgh_size, max_size, portset,
+			 *listen ? timeout : 0, MACH_PORT_NULL);
+	  spare = request;
+	  request = reply;
+	  reply = spare;
+	}
+
+      switch (mr)
+	{
+	case MACH_RCV_TOO_LARGE:
+	  /* The request has not been dequeued, and its header tells the
+	     size it needs.  */
+	  max_size = request->Head.msgh_size;
+	  request = alloca (max_size);
+	  reply = alloca (max_size);
+	  break;
+
+	case MACH_SEND_INVALID_DEST:
+	  /* The reply can't be delivered, so destroy it.  This error
+	     indicates only that the requester went away, so we
+	     continue and get the next request.  */
+	  mach_msg_destroy (&request->Head);
+	  break;
+
+	default:
+	  return mr;
+	}
+    }
+}
+
+/* Serve the ports of BUCKET in PORTSET, with the arguments of
+   ports_manage_port_operations_multithread.  */
+static void
+manage_set (struct port_bucket *bucket, mach_port_t portset,
+	    ports_demuxer_type demuxer, int thread_timeout,
+	    int global_timeout, void (*hook)(void))
 {
   /* totalthreads is the number of total threads created.  nreqthreads
-     is the number of threads not currently servicing any client.  The
-     initial values account for the main thread.  */
+     is the number of threads listening for requests, or about to.  The
+     initial values account for the main thread.  busythreads is the
+     number of threads handling a request.  All are protected by LOCK,
+     as are PARKED, the stack of idle threads not listening, and
+     SATURATED_SINCE, the time since when all threads have been busy
+     and no more could be created, or 0.  */
   unsigned int totalthreads = 1;
   unsigned int nreqthreads = 1;
+  unsigned int busythreads = 0;
+  struct parked *parked = NULL;
+  uint64_t saturated_since = 0;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  struct ports_thread_stats *stats = &bucket->thread_stats;
+  unsigned int published_threads = 0, published_busy = 0;
 
   pthread_attr_t attr;
 
@@ -119,9 +234,75 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   pthread_attr_init (&attr);
   pthread_attr_setstacksize (&attr, STACK_SIZE);
 
+  /* Publish the thread counts; the bucket's are the sum of those of
+     all its sets.  Called with LOCK held.  */
+  void
+  update_stats (void)
+    {
+      __atomic_add_fetch (&stats->threads, totalthreads - published_threads,
+			  __ATOMIC_RELAXED);
+      __atomic_add_fetch (&stats->busy, busythreads - published_busy,
+			  __ATOMIC_RELAXED);
+      published_threads = totalthreads;
+      published_busy = busythreads;
+    }
+
+  /* Wait on the stack of idle threads until woken, and return 1, or
+     until TIMEOUT milliseconds have passed, if it is not zero, and
+     return 0 after leaving the pool.  */
+  int
+  park (int timeout)
+    {
+      struct parked self;
+      struct timespec abstime;
+      int woken;
+
+      pthread_cond_init (&self.wakeup, NULL);
+      self.woken = 0;
+
+      if (timeout)
+	{
+	  clock_gettime (CLOCK_REALTIME, &abstime);
+	  abstime.tv_sec += timeout / 1000;
+	  abstime.tv_nsec += (timeout % 1000) * 1000000;
+	  if (abstime.tv_nsec >= 1000000000)
+	    {
+	      abstime.tv_sec++;
+	      abstime.tv_nsec -= 1000000000;
+	    }
+	}
+
+      pthread_mutex_lock (&lock);
+      self.next = parked;
+      self.prevp = &parked;
+      if (parked)
+	parked->prevp = &self.next;
+      parked = &self;
+
+      while (! self.woken)
+	if (! timeout)
+	  pthread_cond_wait (&self.wakeup, &lock);
+	else if (pthread_cond_timedwait (&self.wakeup, &lock, &abstime)
+		 == ETIMEDOUT && ! self.woken)
+	  {
+	    *self.prevp = self.next;
+	    if (self.next)
+	      self.next->prevp = self.prevp;
+	    totalthreads--;
+	    update_stats ();
+	    break;
+	  }
+      woken = self.woken;
+      pthread_mutex_unlock (&lock);
+
+      pthread_cond_destroy (&self.wakeup);
+      return woken;
+    }
+
   int
   internal_demuxer (mach_msg_header_t *inp,
-		    mach_msg_header_t *outheadp)
+		    mach_msg_header_t *outheadp,
+		    int *listen)
     {
       int status;
       struct port_info *pi;
@@ -136,23 +317,67 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
         .msgt_deallocate = FALSE,
         .msgt_unused = 0
       };
+      int spawn = 0;
+      uint64_t start = _ports_mtime ? _ports_now_us () : 0;
 
-      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
-	/* No thread would be listening for requests, spawn one. */
+      if (! *listen)
+	/* Taken from the queue by a thread on its way to park.  */
+	__atomic_add_fetch (&stats->drained, 1, __ATOMIC_RELAXED);
+
+      pthread_mutex_lock (&lock);
+      if (--nreqthreads == 0)
+	/* No thread would be listening for requests; wake the most
+	   recently parked one, or spawn one if allowed.  */
+	{
+	  /* The limit is shared out evenly among the port sets.  */
+	  unsigned int max = __atomic_load_n (&bucket->max_threads,
+					      __ATOMIC_RELAXED);
+	  if (max)
+	    max = (max + bucket->nportsets - 1) / bucket->nportsets;
+
+	  if (parked)
+	    {
+	      struct parked *t = parked;
+	      parked = t->next;
+	      if (parked)
+		parked->prevp = &parked;
+	      t->woken = 1;
+	      nreqthreads++;
+	      pthread_cond_signal (&t->wakeup);
+	    }
+	  else if (max == 0 || totalthreads < max)
+	    {
+	      totalthreads++;
+	      nreqthreads++;
+	      spawn = 1;
+	    }
+	  else if (! saturated_since)
+	    {
+	      /* Further requests wait in the port set's queue until a
+		 thread is done with its request.  */
+	      saturated_since = _ports_now_us ();
+	      __atomic_add_fetch (&stats->saturated, 1, __ATOMIC_RELAXED);
+	    }
+	}
+      busythreads++;
+      update_stats ();
+      pthread_mutex_unlock (&lock);
+
+      if (spawn)
 	{
 	  pthread_t pthread_id;
 	  error_t err;
 
-	  __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	  __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-
 	  err = pthread_create (&pthread_id, &attr, thread_function, NULL);
 	  if (!err)
 	    pthread_detach (pthread_id);
 	  else
 	    {
-	      __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	      __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	      pthread_mutex_lock (&lock);
+	      totalthreads--;
+	      nreqthreads--;
+	      update_stats ();
+	      pthread_mutex_unlock (&lock);
 	      /* There is not much we can do at this point.  The code
 		 and design of the Hurd servers just don't handle
 		 thread creation failure.  */
@@ -220,7 +445,40 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	  status = 1;
 	}
 
-      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&stats->requests, 1, __ATOMIC_RELAXED);
+      if (start)
+	{
+	  uint64_t took = _ports_now_us () - start;
+	  /* The mapped time can go back.  */
+	  if ((int64_t) took < 0)
+	    took = 0;
+	  __atomic_add_fetch (&stats->service_us, took, __ATOMIC_RELAXED);
+	  if (took > __atomic_load_n (&stats->max_service_us,
+				      __ATOMIC_RELAXED))
+	    __atomic_store_n (&stats->max_service_us, took,
+			      __ATOMIC_RELAXED);
+	}
+
+      /* Whether or not this thread goes back to listening, it looks
+	 for a queued request first, and counts as listening meanwhile.  */
+      pthread_mutex_lock (&lock);
+      busythreads--;
+      *listen = nreqthreads < LISTENERS;
+      nreqthreads++;
+      if (saturated_since)
+	{
+	  /* The requests queued meanwhile can be received again.  */
+	  uint64_t wait = _ports_now_us () - saturated_since;
+	  saturated_since = 0;
+	  if ((int64_t) wait < 0)
+	    wait = 0;
+	  __atomic_add_fetch (&stats->wait_us, wait, __ATOMIC_RELAXED);
+	  if (wait > stats->max_wait_us)
+	    __atomic_store_n (&stats->max_wait_us, wait,
+			      __ATOMIC_RELAXED);
+	}
+      update_stats ();
+      pthread_mutex_unlock (&lock);
 
       return status;
     }
@@ -231,12 +489,13 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
       struct ports_thread thread;
       int master = (int)(uintptr_t) arg;
       int timeout;
+      int listen;
       error_t err;
 
       int synchronized_demuxer (mach_msg_header_t *inp,
 				mach_msg_header_t *outheadp)
       {
-	int r = internal_demuxer (inp, outheadp);
+	int r = internal_demuxer (inp, outheadp, &listen);
 	_ports_thread_quiescent (&bucket->threadpool, &thread);
 	return r;
       }
@@ -253,33 +512,63 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 
       _ports_thread_online (&bucket->threadpool, &thread);
 
-    startover:
-
-      do
+      while (1)
 	{
-	  err = mach_msg_server_timeout (synchronized_demuxer,
-					 0, bucket->portset,
-					 MACH_RCV_TIMEOUT,
-					 timeout ? timeout : 10 * 1000);
+	  listen = 1;
+	  err = serve (synchronized_demuxer, portset,
+		       timeout ? timeout : 10 * 1000, &listen);
 	  _ports_thread_quiescent (&bucket->threadpool, &thread);
-	}
-      while (!(timeout && err == MACH_RCV_TIMED_OUT));
 
-      if (master)
-	{
-	  if (__atomic_load_n (&totalthreads, __ATOMIC_RELAXED) != 1)
-	    goto startover;
-	}
-      else
-	{
-	  if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
+	  if (! listen)
+	    {
+	      /* Nothing was queued, and enough threads are listening,
+		 unless they have all taken a request meanwhile.  */
+	      pthread_mutex_lock (&lock);
+	      if (nreqthreads == 1)
+		{
+		  pthread_mutex_unlock (&lock);
+		  continue;
+		}
+	      nreqthreads--;
+	      pthread_mutex_unlock (&lock);
+
+	      /* Parked threads take no part in deferred
+		 dereferencing.  */
+	      _ports_thread_offline (&bucket->threadpool, &thread);
+	      if (! park (timeout))
+		return NULL;
+	      _ports_thread_online (&bucket->threadpool, &thread);
+	      continue;
+	    }
+
+	  if (! (timeout && err == MACH_RCV_TIMED_OUT))
+	    continue;
+
+	  pthread_mutex_lock (&lock);
+	  if (master)
 	    {
-	      /* No other thread is listening for requests, continue. */
-	      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-	      goto startover;
+	      if (totalthreads != 1)
+		{
+		  pthread_mutex_unlock (&lock);
+		  continue;
+		}
 	    }
-	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  else
+	    {
+	      if (nreqthreads == 1)
+		{
+		  /* No other thread is listening for requests, continue. */
+		  pthread_mutex_unlock (&lock);
+		  continue;
+		}
+	      nreqthreads--;
+	      totalthreads--;
+	      update_stats ();
+	    }
+	  pthread_mutex_unlock (&lock);
+	  break;
 	}
+
       _ports_thread_offline (&bucket->threadpool, &thread);
       return NULL;
     }
@@ -290,5 +579,73 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
      master thread from going away.  */
   global_timeout = 0;
 
+  pthread_mutex_lock (&lock);
+  update_stats ();
+  pthread_mutex_unlock (&lock);
+
   thread_function ((void *) 1);
 }
+
+struct manage_args
+{
+  struct port_bucket *bucket;
+  mach_port_t portset;
+  ports_demuxer_type demuxer;
+  int thread_timeout;
+  int global_timeout;
+  void (*hook)(void);
+};
+
+static void *
+manage_set_thread (void *arg)
+{
+  struct manage_args *args = arg;
+
+  manage_set (args->bucket, args->portset, args->demuxer,
+	      args->thread_timeout, args->global_timeout, args->hook);
+  free (args);
+  return NULL;
+}
+
+void
+ports_manage_port_operations_multithread (struct port_bucket *bucket,
+					  ports_demuxer_type demuxer,
+					  int thread_timeout,
+					  int global_timeout,
+					  void (*hook)(void))
+{
+  pthread_attr_t attr;
+  unsigned int i;
+
+  _ports_map_time ();
+
+  pthread_attr_init (&attr);
+  pthread_attr_setstacksize (&attr, STACK_SIZE);
+
+  /* Each further port set of the bucket gets its own group of
+     threads, started by a master thread of its own.  */
+  for (i = 1; i < bucket->nportsets; i++)
+    {
+      struct manage_args *args = malloc (sizeof *args);
+      pthread_t thread;
+      error_t err;
+
+      if (! args)
+	error (1, ENOMEM, "cannot serve port set");
+      *args = (struct manage_args) {
+	.bucket = bucket,
+	.portset = bucket->portsets[i],
+	.demuxer = demuxer,
+	.thread_timeout = thread_timeout,
+	.global_timeout = global_timeout,
+	.hook = hook,
+      };
+      err = pthread_create (&thread, &attr, manage_set_thread, args);
+      if (err)
+	error (1, err, "cannot serve port set");
+      pthread_detach (thread);
+    }
+
+  manage_set (bucket, bucket->portset, demuxer, thread_timeout,
+	      global_timeout, hook);
+}
@@ -19,6 +19,7 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include "ports.h"
+#include <assert-backtrace.h>
 
 void
 ports_manage_port_operations_one_thread (struct port_bucket *bucket,
@@ -115,6 +116,9 @@ ports_manage_port_operations_one_thread (struct port_bucket *bucket,
      zero.  */
   timeout = 0;
 
+  /* A single thread can only wait on one port set.  */
+  assert_backtrace (bucket->nportsets == 1);
+
   _ports_thread_online (&bucket->threadpool, &thread);
   do
     err = mach_msg_server_timeout (internal_demuxer, 0, bucket->portset, 
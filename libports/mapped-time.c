@@ -0,0 +1,58 @@
+/* Reading the time cheaply, for statistics
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+#include <time.h>
+#include <maptime.h>
+
+volatile struct mapped_time_value *_ports_mtime;
+
+static pthread_once_t mtime_once = PTHREAD_ONCE_INIT;
+
+static void
+map_time (void)
+{
+  if (maptime_map (0, NULL, &_ports_mtime)
+      && maptime_map (1, NULL, &_ports_mtime))
+    _ports_mtime = NULL;
+}
+
+void
+_ports_map_time (void)
+{
+  pthread_once (&mtime_once, map_time);
+}
+
+uint64_t
+_ports_now_us (void)
+{
+  struct timeval tv;
+
+  if (_ports_mtime)
+    maptime_read (_ports_mtime, &tv);
+  else
+    {
+      struct timespec ts;
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+      tv.tv_sec = ts.tv_sec;
+      tv.tv_usec = ts.tv_nsec / 1000;
+    }
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
@@ -80,18 +80,24 @@ _ports_thread_online (struct ports_threadpool *pool,
   pthread_spin_unlock (&pool->lock);
 }
 
-struct pi_list
+/* Make the calls on the list LIST.  */
+static void
+run_calls (struct ports_deferred_call *list)
 {
-  struct pi_list *next;
-  struct port_info *pi;
-};
+  while (list)
+    {
+      struct ports_deferred_call *call = list;
+      list = list->next;
+      (*call->function) (call);
+    }
+}
 
 /* Called by a thread that enters its quiescent period.  */
 void
 _ports_thread_quiescent (struct ports_threadpool *pool,
 			 struct ports_thread *thread)
 {
-  struct pi_list *free_list = NULL, *p;
+  struct ports_deferred_call *free_list = NULL;
   assert_backtrace (valid_color (thread->color));
 
   pthread_spin_lock (&pool->lock);
@@ -110,14 +116,7 @@ _ports_thread_quiescent (struct ports_threadpool *pool,
     }
   pthread_spin_unlock (&pool->lock);
 
-  for (p = free_list; p;)
-    {
-      struct pi_list *old = p;
-      p = p->next;
-
-      ports_port_deref (old->pi);
-      free (old);
-    }
+  run_calls (free_list);
 }
 
 /* Called by a thread to leave a thread pool.  */
@@ -140,24 +139,58 @@ _ports_thread_offline (struct ports_threadpool *pool,
   pthread_spin_unlock (&pool->lock);
 }
 
-/* Schedule an object for deallocation.  */
 void
-_ports_port_deref_deferred (struct port_info *pi)
+ports_defer_call (struct port_bucket *bucket,
+		  struct ports_deferred_call *call)
 {
-  struct ports_threadpool *pool = &pi->bucket->threadpool;
-
-  struct pi_list *pl = malloc (sizeof *pl);
-  if (pl == NULL)
-    return;
-  pl->pi = pi;
+  struct ports_threadpool *pool = &bucket->threadpool;
+  struct ports_deferred_call *free_list = NULL;
 
   pthread_spin_lock (&pool->lock);
-  pl->next = pool->young_objects;
-  pool->young_objects = pl;
+  call->next = pool->young_objects;
+  pool->young_objects = call;
   if (pool->old_threads == 0)
     {
       assert_backtrace (pool->old_objects == NULL);
       flip_generations (pool);
+
+      /* With no thread in the pool, no thread is there to wait for,
+	 and none would make the calls.  */
+      if (pool->old_threads == 0)
+	{
+	  free_list = pool->old_objects;
+	  pool->old_objects = NULL;
+	}
     }
   pthread_spin_unlock (&pool->lock);
+
+  run_calls (free_list);
+}
+
+struct pi_list
+{
+  struct ports_deferred_call call;
+  struct port_info *pi;
+};
+
+static void
+deref_deferred (struct ports_deferred_call *call)
+{
+  struct pi_list *pl = (struct pi_list *) call;
+
+  ports_port_deref (pl->pi);
+  free (pl);
+}
+
+/* Schedule an object for deallocation.  */
+void
+_ports_port_deref_deferred (struct port_info *pi)
+{
+  struct pi_list *pl = malloc (sizeof *pl);
+  if (pl == NULL)
+    return;
+  pl->pi = pi;
+  pl->call.function = deref_deferred;
+
+  ports_defer_call (pi->bucket, &pl->call);
 }
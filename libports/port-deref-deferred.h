@@ -24,8 +24,13 @@
 
 #include <pthread.h>
 
-/* A list of port_info objects.  */
-struct pi_list;
+/* A call deferred with ports_defer_call, normally embedded in the
+   object that FUNCTION releases.  */
+struct ports_deferred_call
+{
+  struct ports_deferred_call *next;
+  void (*function) (struct ports_deferred_call *);
+};
 
 /* We use protected payloads to look up objects without taking a lock.
    A complication arises if we destroy an object using
@@ -33,7 +38,10 @@ struct pi_list;
    resulting in invalid memory accesses when being interpreted as
    pointer), we delay the deallocation of those object until all
    threads running at the time of the objects destruction are done
-   with whatever they were doing and entered a quiescent period.  */
+   with whatever they were doing and entered a quiescent period.
+
+   The same applies to anything else the threads of a bucket read
+   without a lock, see ports_defer_call.  */
 struct ports_threadpool
 {
   /* Access to the threadpool object is serialized by this lock.  */
@@ -52,7 +60,7 @@ struct ports_threadpool
   /* A list of old objects.  Once OLD_THREADS drops to zero, they are
      deallocated, and all young threads and objects become old threads
      and objects.  */
-  struct pi_list *old_objects;
+  struct ports_deferred_call *old_objects;
 
   /* The number of young threads.  Any thread joining or leaving the
      thread group must be a young thread.  */
@@ -60,7 +68,7 @@ struct ports_threadpool
 
   /* The list of young objects.  Any object being marked for delayed
      deallocation is added to this list.  */
-  struct pi_list *young_objects;
+  struct ports_deferred_call *young_objects;
 };
 
 /* Per-thread state.  */
@@ -23,6 +23,7 @@
 
 #include <mach.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <hurd.h>
 #include <hurd/ihash.h>
 #include <mach/notify.h>
@@ -57,7 +58,8 @@ struct port_info
   mach_msg_seqno_t cancel_threshold;	/* needs atomic operations */
   int flags;
   mach_port_t port_right;
-  struct rpc_info *current_rpcs;
+  struct rpc_info *current_rpcs;	/* protected by RPCS_LOCK */
+  pthread_mutex_t rpcs_lock;
   struct port_bucket *bucket;
   hurd_ihash_locp_t hentry;
   hurd_ihash_locp_t ports_htable_entry;
@@ -70,6 +72,22 @@ typedef struct port_info *port_info_t;
 #define PORT_BLOCKED		PORTS_BLOCKED
 #define PORT_INHIBIT_WAIT	PORTS_INHIBIT_WAIT
 
+/* Statistics about the threads ports_manage_port_operations_multithread
+   runs for a bucket.  */
+struct ports_thread_stats
+{
+  unsigned int threads;		/* threads serving the bucket */
+  unsigned int busy;		/* those of them handling a request */
+  unsigned int max_threads;	/* limit on THREADS, or 0 for none */
+  uint64_t saturated;		/* times all were busy at the limit */
+  uint64_t wait_us;		/* total time requests waited then */
+  uint64_t max_wait_us;		/* longest such wait */
+  uint64_t requests;		/* requests handled */
+  uint64_t drained;		/* of those, taken by a thread about to park */
+  uint64_t service_us;		/* total time spent handling them */
+  uint64_t max_service_us;	/* longest time spent on one */
+};
+
 struct port_bucket
 {
   mach_port_t portset;
@@ -82,6 +100,15 @@ struct port_bucket
   struct ports_threadpool threadpool;
   /* A port in this bucket used to receive Mach notifications.  */
   struct port_info *notify_port;
+  /* The port sets the receive rights are spread over, PORTSETS[0]
+     being PORTSET.  See ports_set_bucket_receive_sets.  */
+  mach_port_t *portsets;
+  unsigned int nportsets;
+  int portsets_by_class;
+  /* See ports_set_bucket_max_threads.  */
+  unsigned int max_threads;
+  /* Updated by ports_manage_port_operations_multithread.  */
+  struct ports_thread_stats thread_stats;
 };
 /* FLAGS above are the following: */
 #define PORT_BUCKET_INHIBITED	PORTS_INHIBITED
@@ -112,6 +139,8 @@ struct rpc_info
   struct rpc_info *next, **prevp;
   struct rpc_notify *notifies;
   struct rpc_info *interrupted_next;
+  mach_msg_id_t msg_id;
+  uint64_t start;		/* when it began, if it is being timed */
 };
 
 /* An rpc has requested interruption on a port notification.  */
@@ -150,6 +179,11 @@ extern struct rpc_notify *_ports_free_rpc_notifies;
    notifications.  _PORTS_LOCK should be held.  */
 void _ports_remove_notified_rpc (struct rpc_info *rpc);
 
+/* Remove INFO from the RPCs in progress on PI.  Return nonzero if a
+   thread waiting for RPCs to finish must be woken by broadcasting
+   _ports_block with _PORTS_LOCK held.  */
+int _ports_unlink_rpc (struct port_info *pi, struct rpc_info *info);
+
 struct ports_msg_id_range
 {
   mach_msg_id_t start, end;
@@ -166,6 +200,22 @@ extern struct ports_msg_id_range *ports_default_uninhibitable_rpcs;
 /* Create and return a new bucket. */
 struct port_bucket *ports_create_bucket (void);
 
+/* Spread the receive rights of BUCKET over NSETS port sets, chosen by
+   hashing the port's name, or its class if BY_CLASS is nonzero.
+   ports_manage_port_operations_multithread then runs a separate group
+   of threads for each set, so that fewer threads wait on each one and
+   a port's requests are handled by the same few threads.  This may be
+   done only once for a bucket, and before it is served.  The
+   ports_manage_port_operations_one_thread loop cannot serve a bucket
+   with more than one set.  */
+error_t ports_set_bucket_receive_sets (struct port_bucket *bucket,
+				       unsigned int nsets, int by_class);
+
+/* Return the port set of BUCKET for the receive right of PI.  Use this
+   instead of BUCKET->portset when installing a port's right yourself.  */
+extern mach_port_t ports_bucket_portset (struct port_bucket *bucket,
+					 struct port_info *pi);
+
 /* Create and return a new port class.  If nonzero, CLEAN_ROUTINE will
    be called for each allocated port object in this class when it is
    being destroyed.   If nonzero, DROPWEAK_ROUTINE will be called
@@ -286,6 +336,22 @@ ports_lookup_payload (struct port_bucket *bucket,
   return pi;
 }
 
+PORTS_EI mach_port_t
+ports_bucket_portset (struct port_bucket *bucket, struct port_info *pi)
+{
+  uint32_t key;
+
+  if (bucket->nportsets == 1)
+    return bucket->portset;
+
+  if (bucket->portsets_by_class)
+    key = (uintptr_t) pi->class;
+  else
+    key = pi->port_right;
+  key *= 0x9e3779b1;
+  return bucket->portsets[(key >> 16) % bucket->nportsets];
+}
+
 PORTS_EI mach_port_t
 ports_payload_get_name (uintptr_t payload)
 {
@@ -311,6 +377,16 @@ void ports_port_deref (void *port);
 /* Drop a weak reference to PORT. */
 void ports_port_deref_weak (void *port);
 
+/* Call CALL->function (CALL) once every thread that was serving a
+   message of BUCKET has finished it.  Something the threads of BUCKET
+   only read without a lock can thus be released once it can no longer
+   be found: no thread can still be looking at it by then.  Threads not
+   serving BUCKET are not waited for.  CALL must stay valid until the
+   function is called; it is normally part of what the function
+   releases.  */
+void ports_defer_call (struct port_bucket *bucket,
+		       struct ports_deferred_call *call);
+
 /* Use this port right to request notifications about PORT. */
 #define ports_port_notify_right(port) \
   ((struct port_info *) (port))->bucket->notify_port->port_right
@@ -398,13 +474,62 @@ void ports_manage_port_operations_one_thread(struct port_bucket *bucket,
    LOCAL_TIMEOUT is non-zero, then individual threads will die off if
    they handle no incoming messages for LOCAL_TIMEOUT milliseconds.
    HOOK (if not null) will be called in each new thread immediately
-   after it is created. */
+   after it is created.  No more threads are created than allowed by
+   ports_set_bucket_max_threads; messages then wait until a thread is
+   done with its request.  */
 void ports_manage_port_operations_multithread (struct port_bucket *bucket,
 					       ports_demuxer_type demuxer,
 					       int thread_timeout,
 					       int global_timeout,
 					       void (*hook)(void));
 
+/* Let ports_manage_port_operations_multithread run at most MAX threads
+   for BUCKET, or any number if MAX is 0, which is the default.  A limit
+   must leave enough threads for any request that waits on another
+   request to the same bucket, or the server deadlocks.  */
+void ports_set_bucket_max_threads (struct port_bucket *bucket,
+				   unsigned int max);
+
+/* Fill in STATS for the threads serving BUCKET.  */
+void ports_get_bucket_thread_stats (struct port_bucket *bucket,
+				    struct ports_thread_stats *stats);
+
+/* Statistics of the RPCs with one message id.  HIST counts them by
+   their latency in microseconds: bucket 0 counts those that took less
+   than one, bucket I those from 2^(I-1) to 2^I - 1, and the last
+   bucket the longer ones.  */
+#define PORTS_RPC_HIST_BUCKETS 20
+struct ports_rpc_stats
+{
+  mach_msg_id_t msg_id;
+  uint64_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t hist[PORTS_RPC_HIST_BUCKETS];
+};
+
+/* Start keeping statistics of the RPCs begun and ended with
+   ports_begin_rpc and ports_end_rpc if ENABLE is nonzero, or stop if it
+   is zero.  They are not kept by default.  The statistics are kept
+   across a stop and a new start.  */
+void ports_enable_rpc_stats (int enable);
+
+/* Return nonzero if the statistics of RPCs are being kept.  */
+int ports_rpc_stats_enabled (void);
+
+/* Return in *STATS a malloced array of the statistics of each message
+   id seen so far, sorted by message id, and its length in *COUNT.  In
+   *DROPPED, return the number of RPCs for which there was no room.  */
+error_t ports_get_rpc_stats (struct ports_rpc_stats **stats, size_t *count,
+			     uint64_t *dropped);
+
+/* Return in *BUF a malloced text of the statistics of RPCs, and its
+   length in *LEN, suitable for returning from fsys_get_rpc_stats.  A
+   line "enabled 0" or "enabled 1" and a line "dropped N" are followed
+   by one line for each message id, holding the message id, count,
+   total and largest latency in microseconds, and the histogram.  */
+error_t ports_format_rpc_stats (char **buf, size_t *len);
+
 /* Interrupt any pending RPC on PORT.  Wait for all pending RPC's to
    finish, and then block any new RPC's starting on that port. */
 error_t ports_inhibit_port_rpcs (void *port);
@@ -507,6 +632,18 @@ extern int _ports_flags;
 #define _PORTS_BLOCKED		PORTS_BLOCKED
 #define _PORTS_INHIBIT_WAIT	PORTS_INHIBIT_WAIT
 void _ports_complete_deallocate (struct port_info *);
+
+/* The mapped time, or null if it could not be mapped.  _ports_map_time
+   tries to map it the first time it is called.  */
+extern volatile struct mapped_time_value *_ports_mtime;
+void _ports_map_time (void);
+/* Return the current time in microseconds.  */
+uint64_t _ports_now_us (void);
+
+/* Nonzero if ports_enable_rpc_stats has enabled the statistics.  */
+extern int _ports_rpc_stats;
+/* Account an RPC with message id MSG_ID that took US microseconds.  */
+void _ports_record_rpc (mach_msg_id_t msg_id, uint64_t us);
 error_t _ports_create_port_internal (struct port_class *, struct port_bucket *,
 				     size_t, void *, int);
 
@@ -75,7 +75,8 @@ ports_reallocate_from_external (void *portstruct, mach_port_t receive)
   mach_port_set_protected_payload (mach_task_self (), pi->port_right,
 				   (unsigned long) pi);
 
-  mach_port_move_member (mach_task_self (), receive, pi->bucket->portset);
+  mach_port_move_member (mach_task_self (), receive,
+			 ports_bucket_portset (pi->bucket, pi));
   
   if (stat.mps_srights)
     {
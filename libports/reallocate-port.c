@@ -64,7 +64,7 @@ ports_reallocate_port (void *portstruct)
 				   (unsigned long) pi);
 
   err = mach_port_move_member (mach_task_self (), pi->port_right, 
-			       pi->bucket->portset);
+			       ports_bucket_portset (pi->bucket, pi));
   assert_perror_backtrace (err);
 
   if (dropref)
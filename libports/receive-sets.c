@@ -0,0 +1,91 @@
+/* Spreading the ports of a bucket over several port sets
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+#include <errno.h>
+#include <stdlib.h>
+
+error_t
+ports_set_bucket_receive_sets (struct port_bucket *bucket,
+			       unsigned int nsets, int by_class)
+{
+  mach_port_t *sets;
+  mach_port_t *members;
+  mach_msg_type_number_t nmembers;
+  unsigned int i;
+  error_t err;
+
+  if (nsets == 0)
+    return EINVAL;
+  if (bucket->nportsets != 1)
+    return EBUSY;
+  if (nsets == 1)
+    return 0;
+
+  sets = malloc (nsets * sizeof *sets);
+  if (! sets)
+    return ENOMEM;
+
+  sets[0] = bucket->portset;
+  for (i = 1; i < nsets; i++)
+    {
+      err = mach_port_allocate (mach_task_self (), MACH_PORT_RIGHT_PORT_SET,
+				&sets[i]);
+      if (err)
+	{
+	  while (--i > 0)
+	    mach_port_mod_refs (mach_task_self (), sets[i],
+				MACH_PORT_RIGHT_PORT_SET, -1);
+	  free (sets);
+	  return err;
+	}
+    }
+
+  /* Only the rights already in the bucket's port set move; ports not
+     installed yet find their set when they are.  */
+  err = mach_port_get_set_status (mach_task_self (), bucket->portset,
+				  &members, &nmembers);
+  if (err)
+    {
+      for (i = 1; i < nsets; i++)
+	mach_port_mod_refs (mach_task_self (), sets[i],
+			    MACH_PORT_RIGHT_PORT_SET, -1);
+      free (sets);
+      return err;
+    }
+
+  pthread_rwlock_rdlock (&_ports_htable_lock);
+  bucket->portsets_by_class = by_class;
+  bucket->portsets = sets;
+  __atomic_store_n (&bucket->nportsets, nsets, __ATOMIC_RELEASE);
+
+  for (i = 0; i < nmembers; i++)
+    {
+      struct port_info *pi = hurd_ihash_find (&_ports_htable, members[i]);
+      if (pi && pi->bucket == bucket)
+	mach_port_move_member (mach_task_self (), members[i],
+			       ports_bucket_portset (bucket, pi));
+    }
+  pthread_rwlock_unlock (&_ports_htable_lock);
+
+  vm_deallocate (mach_task_self (), (vm_address_t) members,
+		 nmembers * sizeof *members);
+  return 0;
+}
@@ -0,0 +1,283 @@
+/* Statistics of the RPCs served
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Each thread that ends an RPC accounts for it in a shard of its own,
+   so that no lock is taken and no cache line is shared with another
+   thread; only a reader merges the shards.  The shard of a thread that
+   exits is taken over by the next thread that needs one.  */
+
+#include "ports.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* The number of message ids a shard has room for; a power of two.  */
+#define SHARD_SLOTS 128
+
+struct shard
+{
+  struct ports_rpc_stats slot[SHARD_SLOTS];
+  uint64_t dropped;
+  int in_use;
+  struct shard *next;
+};
+
+int _ports_rpc_stats;
+
+static __thread struct shard *thread_shard;
+
+/* All the shards ever made.  They are never freed.  */
+static struct shard *shards;
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static void
+release_shard (void *arg)
+{
+  struct shard *shard = arg;
+  __atomic_store_n (&shard->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+make_shard_key (void)
+{
+  pthread_key_create (&shard_key, release_shard);
+}
+
+static struct shard *
+get_shard (void)
+{
+  struct shard *shard;
+
+  pthread_mutex_lock (&shards_lock);
+  for (shard = shards; shard; shard = shard->next)
+    if (! __atomic_load_n (&shard->in_use, __ATOMIC_ACQUIRE))
+      break;
+  if (! shard)
+    {
+      shard = calloc (1, sizeof *shard);
+      if (shard)
+	{
+	  shard->next = shards;
+	  shards = shard;
+	}
+    }
+  if (shard)
+    shard->in_use = 1;
+  pthread_mutex_unlock (&shards_lock);
+
+  if (shard)
+    pthread_setspecific (shard_key, shard);
+  return shard;
+}
+
+static int
+hist_bucket (uint64_t us)
+{
+  int i = us ? 64 - __builtin_clzll (us) : 0;
+  return i < PORTS_RPC_HIST_BUCKETS ? i : PORTS_RPC_HIST_BUCKETS - 1;
+}
+
+/* Only the thread owning a shard writes to it, so plain loads and
+   stores do; the stores are atomic only for the readers.  */
+#define BUMP(field, n) \
+  __atomic_store_n (&(field), (field) + (n), __ATOMIC_RELAXED)
+
+void
+_ports_record_rpc (mach_msg_id_t msg_id, uint64_t us)
+{
+  struct shard *shard = thread_shard;
+  struct ports_rpc_stats *s;
+  unsigned int h, i;
+
+  if (! shard)
+    {
+      pthread_once (&shard_key_once, make_shard_key);
+      shard = thread_shard = get_shard ();
+      if (! shard)
+	return;
+    }
+
+  h = ((uint32_t) msg_id * 0x9e3779b1) >> 25;
+  for (i = 0; i < SHARD_SLOTS; i++)
+    {
+      s = &shard->slot[(h + i) & (SHARD_SLOTS - 1)];
+      if (s->msg_id == msg_id)
+	break;
+      if (s->msg_id == 0)
+	{
+	  /* Published last, so that a reader sees zeroed counts.  */
+	  __atomic_store_n (&s->msg_id, msg_id, __ATOMIC_RELEASE);
+	  break;
+	}
+    }
+  if (i == SHARD_SLOTS)
+    {
+      BUMP (shard->dropped, 1);
+      return;
+    }
+
+  BUMP (s->count, 1);
+  BUMP (s->total_us, us);
+  if (us > s->max_us)
+    __atomic_store_n (&s->max_us, us, __ATOMIC_RELAXED);
+  BUMP (s->hist[hist_bucket (us)], 1);
+}
+
+void
+ports_enable_rpc_stats (int enable)
+{
+  if (enable)
+    _ports_map_time ();
+  __atomic_store_n (&_ports_rpc_stats, !!enable, __ATOMIC_RELAXED);
+}
+
+int
+ports_rpc_stats_enabled (void)
+{
+  return __atomic_load_n (&_ports_rpc_stats, __ATOMIC_RELAXED);
+}
+
+static int
+compare_msg_id (const void *a, const void *b)
+{
+  const struct ports_rpc_stats *x = a, *y = b;
+  return (x->msg_id > y->msg_id) - (x->msg_id < y->msg_id);
+}
+
+error_t
+ports_get_rpc_stats (struct ports_rpc_stats **stats, size_t *count,
+		     uint64_t *dropped)
+{
+  struct ports_rpc_stats *all = NULL;
+  struct shard *shard;
+  size_t n = 0, alloced = 0, i, j;
+
+  *dropped = 0;
+
+  /* Copy every slot in use, then merge those of the same id.  */
+  pthread_mutex_lock (&shards_lock);
+  for (shard = shards; shard; shard = shard->next)
+    {
+      *dropped += __atomic_load_n (&shard->dropped, __ATOMIC_RELAXED);
+      for (i = 0; i < SHARD_SLOTS; i++)
+	{
+	  struct ports_rpc_stats *s = &shard->slot[i], *d;
+	  mach_msg_id_t id = __atomic_load_n (&s->msg_id, __ATOMIC_ACQUIRE);
+	  if (id == 0)
+	    continue;
+
+	  if (n == alloced)
+	    {
+	      size_t new_alloced = alloced ? 2 * alloced : SHARD_SLOTS;
+	      struct ports_rpc_stats *new
+		= realloc (all, new_alloced * sizeof *new);
+	      if (! new)
+		{
+		  pthread_mutex_unlock (&shards_lock);
+		  free (all);
+		  return ENOMEM;
+		}
+	      all = new;
+	      alloced = new_alloced;
+	    }
+
+	  d = &all[n++];
+	  d->msg_id = id;
+	  d->count = __atomic_load_n (&s->count, __ATOMIC_RELAXED);
+	  d->total_us = __atomic_load_n (&s->total_us, __ATOMIC_RELAXED);
+	  d->max_us = __atomic_load_n (&s->max_us, __ATOMIC_RELAXED);
+	  for (j = 0; j < PORTS_RPC_HIST_BUCKETS; j++)
+	    d->hist[j] = __atomic_load_n (&s->hist[j], __ATOMIC_RELAXED);
+	}
+    }
+  pthread_mutex_unlock (&shards_lock);
+
+  if (n > 0)
+    qsort (all, n, sizeof *all, compare_msg_id);
+
+  for (i = 0, j = 0; i < n; i++)
+    {
+      if (j > 0 && all[j - 1].msg_id == all[i].msg_id)
+	{
+	  struct ports_rpc_stats *d = &all[j - 1];
+	  d->count += all[i].count;
+	  d->total_us += all[i].total_us;
+	  if (all[i].max_us > d->max_us)
+	    d->max_us = all[i].max_us;
+	  for (int k = 0; k < PORTS_RPC_HIST_BUCKETS; k++)
+	    d->hist[k] += all[i].hist[k];
+	}
+      else
+	all[j++] = all[i];
+    }
+
+  *stats = all;
+  *count = j;
+  return 0;
+}
+
+error_t
+ports_format_rpc_stats (char **buf, size_t *len)
+{
+  struct ports_rpc_stats *stats;
+  size_t count, i;
+  uint64_t dropped;
+  error_t err;
+  FILE *out;
+
+  err = ports_get_rpc_stats (&stats, &count, &dropped);
+  if (err)
+    return err;
+
+  *buf = NULL;
+  *len = 0;
+  out = open_memstream (buf, len);
+  if (! out)
+    {
+      err = errno;
+      free (stats);
+      return err;
+    }
+
+  fprintf (out, "enabled %d\n", ports_rpc_stats_enabled ());
+  fprintf (out, "dropped %" PRIu64 "\n", dropped);
+  for (i = 0; i < count; i++)
+    {
+      fprintf (out, "%d %" PRIu64 " %" PRIu64 " %" PRIu64,
+	       stats[i].msg_id, stats[i].count, stats[i].total_us,
+	       stats[i].max_us);
+      for (int j = 0; j < PORTS_RPC_HIST_BUCKETS; j++)
+	fprintf (out, " %" PRIu64, stats[i].hist[j]);
+      fputc ('\n', out);
+    }
+  free (stats);
+
+  if (fclose (out) != 0)
+    {
+      err = errno;
+      free (*buf);
+      return err;
+    }
+  return 0;
+}
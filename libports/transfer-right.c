@@ -97,7 +97,8 @@ ports_transfer_right (void *tostruct,
       if (topi->bucket != frompi->bucket)
         {
 	  err = mach_port_move_member (mach_task_self (), port,
-				       topi->bucket->portset);
+				       ports_bucket_portset (topi->bucket,
+							     topi));
 	  assert_perror_backtrace (err);
 	}
     }
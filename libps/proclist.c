@@ -375,20 +375,121 @@ proc_stat_list_set_flags (struct proc_stat_list *pp, ps_flags_t flags)
 {
   unsigned nprocs = pp->num_procs;
   struct proc_stat **procs = pp->proc_stats;
+  error_t err = 0;
+  unsigned i;
 
-  while (nprocs-- > 0)
+  /* Fetch the procinfo of all the processes in one go, rather than one
+     proc_getprocinfo per process.  */
+  _proc_stats_prefetch_procinfo (procs, nprocs, flags);
+
+  for (i = 0; i < nprocs && !err; i++)
     {
-      struct proc_stat *ps = *procs++;
+      struct proc_stat *ps = procs[i];
 
       if (!proc_stat_has (ps, flags))
+	err = proc_stat_set_flags (ps, flags);
+    }
+
+  /* What is left would be stale by the next call.  */
+  for (i = 0; i < nprocs; i++)
+    _proc_stat_drop_prefetched (procs[i]);
+
+  return err;
+}
+
+static int
+pid_cmp (const void *a, const void *b)
+{
+  pid_t x = *(const pid_t *) a, y = *(const pid_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Bring PP up to date for a new snapshot, as a program showing processes
+   over and over would: the PSTAT_REFRESH information of every entry is
+   fetched again, with a single proc_getprocinfo_bulk call where the proc
+   server has it, while what doesn't change as a process runs is kept.
+   Entries for processes that have exited are removed and their proc_stats
+   freed, so no other list may still hold them; if ADD_NEW is true,
+   entries are added for the processes that have appeared, with the flags
+   the others had.  Thread entries are removed, as the threads may have
+   changed; proc_stat_list_add_threads adds them back, and their own
+   information is only fetched when asked for.  If a fatal error occurs,
+   the error code is returned, otherwise 0.  */
+error_t
+proc_stat_list_refresh (struct proc_stat_list *pp, int add_new)
+{
+  error_t err;
+  pid_t pid_array[STATICPIDS], *pids = pid_array;
+  mach_msg_type_number_t num_pids = STATICPIDS;
+  ps_flags_t *had;
+  ps_flags_t all = 0, common = ~0;
+  struct proc_stat **procs, **kept;
+  unsigned num_old, i;
+
+  err = proc_stat_list_remove_threads (pp);
+  if (err)
+    return err;
+
+  /* One call tells us which processes are gone and which are new.  */
+  err = proc_getallpids (ps_context_server (pp->context), &pids, &num_pids);
+  if (err)
+    return err;
+  qsort (pids, num_pids, sizeof *pids, pid_cmp);
+
+  had = NEWVEC (ps_flags_t, pp->num_procs + (add_new ? num_pids : 0));
+  if (! had)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  procs = kept = pp->proc_stats;
+  for (i = 0; i < pp->num_procs; i++)
+    {
+      struct proc_stat *ps = procs[i];
+      pid_t pid = proc_stat_pid (ps);
+
+      if (bsearch (&pid, pids, num_pids, sizeof *pids, pid_cmp))
 	{
-	  error_t err = proc_stat_set_flags (ps, flags);
-	  if (err)
-	    return err;
+	  all |= ps->flags;
+	  common &= ps->flags;
+	  had[kept - procs] = proc_stat_invalidate (ps);
+	  *kept++ = ps;
 	}
+      else
+	/* Frees PS too.  */
+	hurd_ihash_remove (&pp->context->procs, pid);
     }
+  pp->num_procs = num_old = kept - procs;
 
-  return 0;
+  if (add_new)
+    {
+      /* New processes get what the others had; PSTAT_NO_MSGPORT is
+	 usually there because some process was found not to answer.  */
+      ps_flags_t flags = (all & ~(PSTAT_NO_MSGPORT | PSTAT_HOOK))
+			 | (common & PSTAT_NO_MSGPORT);
+
+      err = proc_stat_list_add_pids (pp, pids, num_pids, 0);
+      if (err)
+	goto out;
+      for (i = num_old; i < pp->num_procs; i++)
+	had[i] = flags;
+      all |= flags;
+    }
+
+  _proc_stats_prefetch_procinfo (pp->proc_stats, pp->num_procs, all);
+
+  for (i = 0; i < pp->num_procs && !err; i++)
+    err = proc_stat_set_flags (pp->proc_stats[i], had[i]);
+
+  for (i = 0; i < pp->num_procs; i++)
+    _proc_stat_drop_prefetched (pp->proc_stats[i]);
+
+ out:
+  free (had);
+  if (pids != pid_array)
+    VMFREE (pids, sizeof (pid_t) * num_pids);
+  return err;
 }
 
 /* ---------------------------------------------------------------- */
@@ -27,6 +27,7 @@
 #include "common.h"
 
 #include "ps_msg.h"
+#include "ps_process.h"
 
 /* ---------------------------------------------------------------- */
 
@@ -100,57 +101,100 @@ thread_state (thread_basic_info_t bi)
 #define PSTAT_PROCINFO_MERGE    (PSTAT_TASK_BASIC | PSTAT_TASK_EVENTS)
 #define PSTAT_PROCINFO_REFETCH  (PSTAT_PROCINFO - PSTAT_PROCINFO_MERGE)
 
+/* How the PSTAT_PROCINFO flags map to the flags of proc_getprocinfo.  */
+static const struct { ps_flags_t ps_flag; int pi_flags; } procinfo_flags_map[] =
+{
+  { PSTAT_TASK_BASIC,     PI_FETCH_TASKINFO				},
+  { PSTAT_TASK_EVENTS,    PI_FETCH_TASKEVENTS				},
+  { PSTAT_NUM_THREADS,    PI_FETCH_THREADS				},
+  { PSTAT_THREAD_BASIC,   PI_FETCH_THREAD_BASIC | PI_FETCH_THREADS	},
+  { PSTAT_THREAD_SCHED,   PI_FETCH_THREAD_SCHED | PI_FETCH_THREADS	},
+  { PSTAT_THREAD_WAITS,   PI_FETCH_THREAD_WAITS | PI_FETCH_THREADS	},
+  { 0, }
+};
+
+/* Returns the proc_getprocinfo flags needed to fetch NEED given HAVE.  */
+static int
+procinfo_fetch_flags (ps_flags_t need, ps_flags_t have)
+{
+  int pi_flags = 0;
+  int i;
+
+  for (i = 0; procinfo_flags_map[i].ps_flag; i++)
+    if ((need & procinfo_flags_map[i].ps_flag)
+	&& !(have & procinfo_flags_map[i].ps_flag))
+      pi_flags |= procinfo_flags_map[i].pi_flags;
+  return pi_flags;
+}
+
+/* Use the procinfo fetched ahead for PS, if it was fetched with all of
+   PI_FLAGS, as if proc_getprocinfo had returned it: into *PI if it fits
+   in its *PI_SIZE bytes, or else into new vm_alloced memory.  Returns
+   true if it was used, with *PI_FLAGS set to the flags it has.  */
+static int
+use_prefetched_procinfo (struct proc_stat *ps, int *pi_flags,
+			 struct procinfo **pi, mach_msg_type_number_t *pi_size)
+{
+  if (! ps->prefetched_info
+      || (*pi_flags & ~ps->prefetched_info_flags))
+    return 0;
+
+  if (ps->prefetched_info_size > *pi_size)
+    {
+      void *new = mmap (0, ps->prefetched_info_size, PROT_READ|PROT_WRITE,
+			MAP_ANON, 0, 0);
+      if (new == MAP_FAILED)
+	return 0;
+      *pi = new;
+    }
+  memcpy (*pi, ps->prefetched_info, ps->prefetched_info_size);
+  *pi_size = ps->prefetched_info_size;
+  *pi_flags = ps->prefetched_info_flags;
+  return 1;
+}
+
 /* Fetches process information from the set in PSTAT_PROCINFO, returning it
    in PI & PI_SIZE.  NEED is the information, and HAVE is the what we already
    have.  */
 static error_t
-fetch_procinfo (process_t server, pid_t pid,
+fetch_procinfo (struct proc_stat *ps,
 		ps_flags_t need, ps_flags_t *have,
 		struct procinfo **pi,
 		mach_msg_type_number_t *pi_size,
 		char **waits,
 		mach_msg_type_number_t *waits_len)
 {
-  static const struct { ps_flags_t ps_flag; int pi_flags; } map[] =
-  {
-    { PSTAT_TASK_BASIC,     PI_FETCH_TASKINFO				},
-    { PSTAT_TASK_EVENTS,    PI_FETCH_TASKEVENTS				},
-    { PSTAT_NUM_THREADS,    PI_FETCH_THREADS				},
-    { PSTAT_THREAD_BASIC,   PI_FETCH_THREAD_BASIC | PI_FETCH_THREADS	},
-    { PSTAT_THREAD_SCHED,   PI_FETCH_THREAD_SCHED | PI_FETCH_THREADS	},
-    { PSTAT_THREAD_WAITS,   PI_FETCH_THREAD_WAITS | PI_FETCH_THREADS	},
-    { 0, }
-  };
-  int pi_flags = 0;
+  int pi_flags = procinfo_fetch_flags (need, *have);
   int i;
 
-  for (i = 0; map[i].ps_flag; i++)
-    if ((need & map[i].ps_flag) && !(*have & map[i].ps_flag))
-      pi_flags |= map[i].pi_flags;
-
   if (pi_flags || ((need & PSTAT_PROC_INFO) && !(*have & PSTAT_PROC_INFO)))
     {
-      error_t err;
+      error_t err = 0;
 
-      *pi_size /= sizeof (int);	/* getprocinfo takes an array of ints.  */
-      err = proc_getprocinfo (server, pid, &pi_flags,
-			      (procinfo_t *)pi, pi_size, waits, waits_len);
-      *pi_size *= sizeof (int);
+      if (! use_prefetched_procinfo (ps, &pi_flags, pi, pi_size))
+	{
+	  /* getprocinfo takes an array of ints.  */
+	  *pi_size /= sizeof (int);
+	  err = proc_getprocinfo (ps->context->server, ps->pid, &pi_flags,
+				  (procinfo_t *)pi, pi_size, waits, waits_len);
+	  *pi_size *= sizeof (int);
+	}
 
       if (! err)
 	/* Update *HAVE to reflect what we've successfully fetched.  */
 	{
 	  *have |= PSTAT_PROC_INFO;
-	  for (i = 0; map[i].ps_flag; i++)
-	    if ((pi_flags & map[i].pi_flags) == map[i].pi_flags)
-	      *have |= map[i].ps_flag;
+	  for (i = 0; procinfo_flags_map[i].ps_flag; i++)
+	    if ((pi_flags & procinfo_flags_map[i].pi_flags)
+		== procinfo_flags_map[i].pi_flags)
+	      *have |= procinfo_flags_map[i].ps_flag;
 	}
       return err;
     }
   else
     return 0;
 }
-
+
 /* The size of the initial buffer malloced to try and avoid getting
    vm_alloced memory for the procinfo structure returned by getprocinfo.
    Here we just give enough for four threads.  */
@@ -209,7 +253,7 @@ merge_procinfo (struct proc_stat *ps, ps_flags_t need, ps_flags_t have)
       new_waits_len = ps->thread_waits_len;
     }
 
-  err = fetch_procinfo (ps->context->server, ps->pid, really_need, &really_have,
+  err = fetch_procinfo (ps, really_need, &really_have,
 			&new_pi, &new_pi_size,
 			&new_waits, &new_waits_len);
   if (err)
@@ -1090,6 +1134,7 @@ _proc_stat_free (struct proc_stat *ps)
   MFREEPORT (PSTAT_AUTH, auth);
 
   /* free any allocated memory pointed to by PS */
+  _proc_stat_drop_prefetched (ps);
   MFREEMEM (PSTAT_PROC_INFO, proc_info, ps->proc_info_size,
 	    ps->proc_info_vm_alloced, 0, char);
   MFREEMEM (PSTAT_THREAD_BASIC, thread_basic_info, 0, 0, 0, 0);
@@ -1105,6 +1150,133 @@ _proc_stat_free (struct proc_stat *ps)
   FREE (ps);
 }
 
+/* Forget the information in the process entry PS that changes as the
+   process runs, the PSTAT_REFRESH flags, so that setting them fetches it
+   anew, and return those of the flags that PS had.  */
+ps_flags_t
+proc_stat_invalidate (struct proc_stat *ps)
+{
+  ps_flags_t had = ps->flags & PSTAT_REFRESH;
+
+  if (proc_stat_is_thread (ps))
+    return 0;
+
+  /* TASK_BASIC_INFO, TASK_EVENTS_INFO and THREAD_WAIT point into what
+     is freed here.  */
+  _proc_stat_drop_prefetched (ps);
+  MFREEMEM (PSTAT_PROC_INFO, proc_info, ps->proc_info_size,
+	    ps->proc_info_vm_alloced, 0, char);
+  MFREEMEM (PSTAT_THREAD_BASIC, thread_basic_info, 0, 0, 0, 0);
+  MFREEMEM (PSTAT_THREAD_SCHED, thread_sched_info, 0, 0, 0, 0);
+  MFREEMEM (PSTAT_THREAD_WAITS, thread_waits, ps->thread_waits_len,
+	    ps->thread_waits_vm_alloced, 0, char);
+
+  ps->flags &= ~PSTAT_REFRESH;
+  /* What couldn't be fetched last time may be now.  */
+  ps->failed &= ~PSTAT_REFRESH;
+
+  return had;
+}
+
+/* Fetch again the information in the process entry PS that changes as the
+   process runs, as proc_stat_set_flags does.  */
+error_t
+proc_stat_refresh (struct proc_stat *ps)
+{
+  ps_flags_t had = proc_stat_invalidate (ps);
+  return had ? proc_stat_set_flags (ps, had) : 0;
+}
+
+void
+_proc_stats_prefetch_procinfo (struct proc_stat **procs, unsigned num_procs,
+			       ps_flags_t flags)
+{
+  struct proc_stat **fetch;
+  pid_t *pids;
+  unsigned num_fetch = 0, i;
+  int pi_flags = 0;
+  char *data = 0, *p;
+  mach_msg_type_number_t data_len = 0;
+  error_t err;
+
+  if (num_procs < 2)
+    return;
+
+  fetch = NEWVEC (struct proc_stat *, num_procs);
+  pids = NEWVEC (pid_t, num_procs);
+  if (!fetch || !pids)
+    goto out;
+
+  /* Ask for the union of what each process needs; one that needs more
+     later on still falls back to proc_getprocinfo.  */
+  for (i = 0; i < num_procs; i++)
+    {
+      struct proc_stat *ps = procs[i];
+      ps_flags_t have = ps->flags;
+      ps_flags_t need;
+
+      if (proc_stat_is_thread (ps) || !(have & PSTAT_PID))
+	continue;
+
+      need = add_preconditions (flags & ~ps->failed, ps->context);
+      if (! (need & ~have & PSTAT_PROCINFO))
+	continue;
+
+      /* As merge_procinfo does.  */
+      pi_flags |= procinfo_fetch_flags (need | (have & PSTAT_PROCINFO_REFETCH),
+					have & ~PSTAT_PROCINFO_REFETCH);
+      _proc_stat_drop_prefetched (ps);
+      fetch[num_fetch] = ps;
+      pids[num_fetch++] = ps->pid;
+    }
+  pi_flags &= ~PI_FETCH_THREAD_WAITS;
+
+  if (num_fetch < 2)
+    goto out;
+
+  err = ps_proc_getprocinfo_bulk (ps_context_server (fetch[0]->context),
+			       pids, num_fetch, pi_flags, &data, &data_len);
+  if (err)
+    /* Probably an old proc server; do without.  */
+    goto out;
+
+  for (p = data, i = 0; i < num_fetch
+	 && p + sizeof (struct procinfo_bulk) <= data + data_len; i++)
+    {
+      struct procinfo_bulk hdr;
+      struct proc_stat *ps = fetch[i];
+
+      memcpy (&hdr, p, sizeof hdr);
+      p += sizeof hdr;
+      if (hdr.size > data + data_len - p)
+	break;
+
+      if (!hdr.err && hdr.pid == ps->pid)
+	{
+	  ps->prefetched_info = clone (p, hdr.size);
+	  if (ps->prefetched_info)
+	    {
+	      ps->prefetched_info_size = hdr.size;
+	      ps->prefetched_info_flags = hdr.flags;
+	    }
+	}
+      p += hdr.size;
+    }
+
+  VMFREE (data, data_len);
+
+ out:
+  free (fetch);
+  free (pids);
+}
+
+void
+_proc_stat_drop_prefetched (struct proc_stat *ps)
+{
+  free (ps->prefetched_info);
+  ps->prefetched_info = 0;
+}
+
 /* Returns in PS a new proc_stat for the process PID at the process context
    CONTEXT.  If a memory allocation error occurs, ENOMEM is returned,
    otherwise 0.  */
@@ -1121,6 +1293,7 @@ _proc_stat_create (pid_t pid, struct ps_context *context, struct proc_stat **ps)
   (*ps)->inapp = PSTAT_THREAD;
   (*ps)->context = context;
   (*ps)->hook = 0;
+  (*ps)->prefetched_info = 0;
 
   return 0;
 }
@@ -1160,6 +1333,7 @@ proc_stat_thread_create (struct proc_stat *ps, unsigned index, struct proc_stat
       tps->thread_index = index;
 
       tps->context = ps->context;
+      tps->prefetched_info = 0;
 
       *thread_ps = tps;
 
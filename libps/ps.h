@@ -214,6 +214,13 @@ struct proc_stat
   /* The size of the info structure for deallocation purposes.  */
   unsigned proc_info_size;
 
+  /* Procinfo fetched ahead with that of other processes by
+     proc_stat_list_set_flags, or null; malloced.  It was fetched with the
+     PI_FETCH_ flags PREFETCHED_INFO_FLAGS.  */
+  struct procinfo *prefetched_info;
+  size_t prefetched_info_size;
+  int prefetched_info_flags;
+
   /* If present, these are just pointers into the proc_info structure.  */
   unsigned num_threads;
   task_basic_info_t task_basic_info;
@@ -355,6 +362,17 @@ struct proc_stat
 /* Flag bits that don't correspond precisely to any field.  */
 #define PSTAT_NO_MSGPORT     0x1000000 /* Don't use the msgport at all */
 
+/* The flags whose values change as a process runs, and which
+   proc_stat_refresh fetches again; the others, like PSTAT_ARGS or
+   PSTAT_TTY, are kept.  All but PSTAT_NUM_PORTS, and the thread waits,
+   which need an RPC to each process, come from its procinfo.  */
+#define PSTAT_REFRESH \
+  (PSTAT_PROC_INFO | PSTAT_TASK_BASIC | PSTAT_TASK_EVENTS		      \
+   | PSTAT_NUM_THREADS | PSTAT_THREAD_BASIC | PSTAT_THREAD_SCHED	      \
+   | PSTAT_THREAD_WAIT | PSTAT_THREAD_WAITS | PSTAT_STATE		      \
+   | PSTAT_SUSPEND_COUNT | PSTAT_TIMES | PSTAT_NUM_PORTS		      \
+   | PSTAT_OWNER_UID | PSTAT_OWNER)
+
 /* Bits from PSTAT_USER_BASE on up are available for user-use.  */
 #define PSTAT_USER_BASE      0x20000000
 #define PSTAT_USER_MASK      ~(PSTAT_USER_BASE - 1)
@@ -475,12 +493,32 @@ error_t _proc_stat_create (pid_t pid, struct ps_context *context,
    fields of the former may reference the latter.  */
 void _proc_stat_free (struct proc_stat *ps);
 
+/* Fetch ahead, with a single proc_getprocinfo_bulk call, the procinfo
+   that setting FLAGS in the NUM_PROCS proc_stats in PROCS will need, so
+   that proc_stat_set_flags uses it rather than calling proc_getprocinfo
+   for each one.  The proc_stats must share the same ps_context.  Users
+   shouldn't use this routine; proc_stat_list_set_flags does.  */
+void _proc_stats_prefetch_procinfo (struct proc_stat **procs,
+				    unsigned num_procs, ps_flags_t flags);
+
+/* Discard the procinfo fetched ahead for PS, if any.  */
+void _proc_stat_drop_prefetched (struct proc_stat *ps);
+
 /* Adds FLAGS to PS's flags, fetching information as necessary to validate
    the corresponding fields in PS.  Afterwards you must still check the flags
    field before using new fields, as something might have failed.  Returns
    a system error code if a fatal error occurred, and 0 otherwise.  */
 error_t proc_stat_set_flags (struct proc_stat *ps, ps_flags_t flags);
 
+/* Forget the information in the process entry PS that changes as the
+   process runs, the PSTAT_REFRESH flags, so that setting them fetches it
+   anew, and return those of the flags that PS had.  */
+ps_flags_t proc_stat_invalidate (struct proc_stat *ps);
+
+/* Fetch again the information in the process entry PS that changes as the
+   process runs, as proc_stat_set_flags does.  */
+error_t proc_stat_refresh (struct proc_stat *ps);
+
 /* Returns in THREAD_PS a proc_stat for the Nth thread in the proc_stat
    PS (N should be between 0 and the number of threads in the process).  The
    resulting proc_stat isn't fully functional -- most flags can't be set in
@@ -967,6 +1005,19 @@ error_t proc_stat_list_add_pgrp (struct proc_stat_list *pp, pid_t pgrp,
    returned, otherwise 0.  */
 error_t proc_stat_list_set_flags (struct proc_stat_list *pp, ps_flags_t flags);
 
+/* Bring PP up to date for a new snapshot, as a program showing processes
+   over and over would: the PSTAT_REFRESH information of every entry is
+   fetched again, with a single proc_getprocinfo_bulk call where the proc
+   server has it, while what doesn't change as a process runs is kept.
+   Entries for processes that have exited are removed and their proc_stats
+   freed, so no other list may still hold them; if ADD_NEW is true,
+   entries are added for the processes that have appeared, with the flags
+   the others had.  Thread entries are removed, as the threads may have
+   changed; proc_stat_list_add_threads adds them back, and their own
+   information is only fetched when asked for.  If a fatal error occurs,
+   the error code is returned, otherwise 0.  */
+error_t proc_stat_list_refresh (struct proc_stat_list *pp, int add_new);
+
 /* Destructively modify PP to only include proc_stats for which the
    function PREDICATE returns true; if INVERT is true, only proc_stats for
    which PREDICATE returns false are kept.  FLAGS is the set of pstat_flags
@@ -0,0 +1,450 @@
+/* A sharded, thread-safe cache with CLOCK eviction
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lrucache.h"
+
+/* The fewest buckets a shard has once it has any.  */
+#define MIN_BUCKETS 16
+
+static time_t
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static inline struct lrucache_shard *
+shard_of (struct lrucache *cache, size_t hash)
+{
+  /* The top four bits, LRUCACHE_SHARDS being 16, of a multiplicative
+     hash, so that hashes differing only in their high bits still
+     spread.  */
+  return &cache->shard[((uint64_t) hash * 0x9e3779b97f4a7c15ULL) >> 60];
+}
+
+static inline int
+expired (const struct lrucache_entry *e, time_t t)
+{
+  return e->expires != 0 && t >= e->expires;
+}
+
+/* Return the entry of SHARD for KEY, expired or not.  SHARD is locked.  */
+static struct lrucache_entry *
+find (struct lrucache *cache, struct lrucache_shard *s, size_t hash,
+      const void *key)
+{
+  struct lrucache_entry *e;
+
+  if (s->nbuckets == 0)
+    return NULL;
+  for (e = s->buckets[hash & (s->nbuckets - 1)]; e; e = e->hash_next)
+    if (e->hash == hash && (*cache->match) (e, key))
+      return e;
+  return NULL;
+}
+
+/* Double the buckets of S, if that memory can be had.  S is locked for
+   writing.  */
+static void
+grow (struct lrucache_shard *s)
+{
+  size_t n = s->nbuckets ? 2 * s->nbuckets : MIN_BUCKETS;
+  struct lrucache_entry **buckets = calloc (n, sizeof *buckets);
+  size_t i;
+
+  if (! buckets)
+    return;
+
+  for (i = 0; i < s->nbuckets; i++)
+    while (s->buckets[i])
+      {
+	struct lrucache_entry *e = s->buckets[i];
+	s->buckets[i] = e->hash_next;
+	e->hash_next = buckets[e->hash & (n - 1)];
+	buckets[e->hash & (n - 1)] = e;
+      }
+
+  free (s->buckets);
+  s->buckets = buckets;
+  s->nbuckets = n;
+}
+
+/* Take E out of S, which is locked for writing.  The cache's reference
+   to E is then the caller's to drop.  */
+static void
+unlink_entry (struct lrucache_shard *s, struct lrucache_entry *e)
+{
+  struct lrucache_entry **ep = &s->buckets[e->hash & (s->nbuckets - 1)];
+
+  while (*ep != e)
+    ep = &(*ep)->hash_next;
+  *ep = e->hash_next;
+
+  if (e->clock_next == e)
+    s->hand = NULL;
+  else
+    {
+      if (s->hand == e)
+	s->hand = e->clock_next;
+      e->clock_prev->clock_next = e->clock_next;
+      e->clock_next->clock_prev = e->clock_prev;
+    }
+
+  s->count--;
+  s->cost -= e->cost;
+  e->cached = 0;
+}
+
+/* Move the hand of S round until it finds an entry to evict, and take
+   that out of S onto the list *FREED, linked through HASH_NEXT.  Return
+   zero if there is none.  T is the time, or 0 to expire nothing.  S is
+   locked for writing.  */
+static int
+evict_one (struct lrucache_shard *s, time_t t, struct lrucache_entry **freed)
+{
+  size_t n;
+
+  /* Twice round at most: once to clear the referenced bits, and once
+     to find one that stayed clear.  */
+  for (n = 2 * s->count; n > 0; n--)
+    {
+      struct lrucache_entry *e = s->hand;
+
+      s->hand = e->clock_next;
+      if (__atomic_load_n (&e->refs, __ATOMIC_RELAXED) > 1)
+	/* In use.  */
+	continue;
+      if (e->referenced && ! (t && expired (e, t)))
+	{
+	  e->referenced = 0;
+	  continue;
+	}
+
+      unlink_entry (s, e);
+      e->hash_next = *freed;
+      *freed = e;
+      __atomic_add_fetch (&s->evictions, 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+
+  return 0;
+}
+
+/* Drop the cache's references to the entries on the list FREED.  */
+static void
+release_list (struct lrucache *cache, struct lrucache_entry *freed)
+{
+  while (freed)
+    {
+      struct lrucache_entry *e = freed;
+      freed = e->hash_next;
+      lrucache_release (cache, e);
+    }
+}
+
+static size_t
+shrinker_count (struct shrinker *shrinker)
+{
+  struct lrucache *cache = (struct lrucache *)
+    ((char *) shrinker - offsetof (struct lrucache, shrinker));
+  size_t count = 0;
+  int i;
+
+  for (i = 0; i < LRUCACHE_SHARDS; i++)
+    count += __atomic_load_n (&cache->shard[i].count, __ATOMIC_RELAXED);
+  return count;
+}
+
+static size_t
+shrinker_scan (struct shrinker *shrinker, size_t nr)
+{
+  struct lrucache *cache = (struct lrucache *)
+    ((char *) shrinker - offsetof (struct lrucache, shrinker));
+
+  return lrucache_evict (cache, nr);
+}
+
+error_t
+lrucache_init (struct lrucache *cache, size_t capacity,
+	       int (*match) (const struct lrucache_entry *entry,
+			     const void *key),
+	       void (*free_entry) (struct lrucache_entry *entry))
+{
+  int i;
+
+  memset (cache, 0, sizeof *cache);
+  cache->match = match;
+  cache->free_entry = free_entry;
+  cache->capacity = capacity;
+  for (i = 0; i < LRUCACHE_SHARDS; i++)
+    pthread_rwlock_init (&cache->shard[i].lock, NULL);
+  return 0;
+}
+
+void
+lrucache_destroy (struct lrucache *cache)
+{
+  int i;
+
+  if (cache->shrinker_registered)
+    {
+      shrinker_unregister (&cache->shrinker);
+      cache->shrinker_registered = 0;
+    }
+
+  for (i = 0; i < LRUCACHE_SHARDS; i++)
+    {
+      struct lrucache_shard *s = &cache->shard[i];
+      struct lrucache_entry *freed = NULL;
+
+      pthread_rwlock_wrlock (&s->lock);
+      while (s->hand)
+	{
+	  struct lrucache_entry *e = s->hand;
+	  unlink_entry (s, e);
+	  e->hash_next = freed;
+	  freed = e;
+	}
+      free (s->buckets);
+      s->buckets = NULL;
+      s->nbuckets = 0;
+      pthread_rwlock_unlock (&s->lock);
+
+      release_list (cache, freed);
+      pthread_rwlock_destroy (&s->lock);
+    }
+}
+
+void
+lrucache_set_ttl (struct lrucache *cache, unsigned int ttl)
+{
+  __atomic_store_n (&cache->ttl, ttl, __ATOMIC_RELAXED);
+}
+
+void
+lrucache_register_shrinker (struct lrucache *cache, const char *name)
+{
+  if (cache->shrinker_registered)
+    return;
+  cache->shrinker.name = name;
+  cache->shrinker.count = shrinker_count;
+  cache->shrinker.scan = shrinker_scan;
+  shrinker_register (&cache->shrinker);
+  cache->shrinker_registered = 1;
+}
+
+struct lrucache_entry *
+lrucache_lookup (struct lrucache *cache, size_t hash, const void *key)
+{
+  struct lrucache_shard *s = shard_of (cache, hash);
+  struct lrucache_entry *e;
+
+  pthread_rwlock_rdlock (&s->lock);
+  e = find (cache, s, hash, key);
+  if (e && e->expires && expired (e, now ()))
+    e = NULL;
+  if (e)
+    {
+      __atomic_add_fetch (&e->refs, 1, __ATOMIC_RELAXED);
+      if (! __atomic_load_n (&e->referenced, __ATOMIC_RELAXED))
+	__atomic_store_n (&e->referenced, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+    }
+  else
+    __atomic_add_fetch (&s->misses, 1, __ATOMIC_RELAXED);
+  pthread_rwlock_unlock (&s->lock);
+
+  return e;
+}
+
+struct lrucache_entry *
+lrucache_insert (struct lrucache *cache, struct lrucache_entry *entry,
+		 size_t hash, const void *key, size_t cost)
+{
+  struct lrucache_shard *s = shard_of (cache, hash);
+  unsigned int ttl = __atomic_load_n (&cache->ttl, __ATOMIC_RELAXED);
+  size_t share = (cache->capacity + LRUCACHE_SHARDS - 1) / LRUCACHE_SHARDS;
+  struct lrucache_entry *old, *freed = NULL;
+  time_t t = ttl ? now () : 0;
+
+  entry->hash = hash;
+  entry->cost = cost;
+  entry->expires = ttl ? t + ttl : 0;
+  entry->referenced = 0;
+  entry->cached = 1;
+  entry->refs = 2;		/* The cache's, and the caller's.  */
+
+  pthread_rwlock_wrlock (&s->lock);
+
+  old = find (cache, s, hash, key);
+  if (old)
+    {
+      if (! (old->expires && expired (old, t ?: now ())))
+	{
+	  __atomic_add_fetch (&old->refs, 1, __ATOMIC_RELAXED);
+	  pthread_rwlock_unlock (&s->lock);
+	  return old;
+	}
+      unlink_entry (s, old);
+      old->hash_next = freed;
+      freed = old;
+    }
+
+  if (s->count >= s->nbuckets)
+    grow (s);
+  if (s->nbuckets == 0)
+    {
+      /* No memory for even a few buckets: just don't cache ENTRY.  */
+      entry->cached = 0;
+      entry->refs = 1;
+      pthread_rwlock_unlock (&s->lock);
+      release_list (cache, freed);
+      return entry;
+    }
+
+  entry->hash_next = s->buckets[hash & (s->nbuckets - 1)];
+  s->buckets[hash & (s->nbuckets - 1)] = entry;
+  if (s->hand)
+    {
+      /* Just behind the hand, so that it comes last.  */
+      entry->clock_next = s->hand;
+      entry->clock_prev = s->hand->clock_prev;
+      s->hand->clock_prev->clock_next = entry;
+      s->hand->clock_prev = entry;
+    }
+  else
+    s->hand = entry->clock_next = entry->clock_prev = entry;
+  s->count++;
+  s->cost += cost;
+
+  if (cache->capacity)
+    while (s->cost > share && evict_one (s, t, &freed))
+      ;
+
+  pthread_rwlock_unlock (&s->lock);
+
+  release_list (cache, freed);
+  return entry;
+}
+
+void
+lrucache_release (struct lrucache *cache, struct lrucache_entry *entry)
+{
+  if (__atomic_sub_fetch (&entry->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    (*cache->free_entry) (entry);
+}
+
+void
+lrucache_remove (struct lrucache *cache, struct lrucache_entry *entry)
+{
+  struct lrucache_shard *s = shard_of (cache, entry->hash);
+  int was_cached;
+
+  pthread_rwlock_wrlock (&s->lock);
+  was_cached = entry->cached;
+  if (was_cached)
+    unlink_entry (s, entry);
+  pthread_rwlock_unlock (&s->lock);
+
+  if (was_cached)
+    lrucache_release (cache, entry);
+}
+
+size_t
+lrucache_purge (struct lrucache *cache,
+		int (*pred) (struct lrucache_entry *entry, void *arg),
+		void *arg)
+{
+  size_t purged = 0;
+  int i;
+
+  for (i = 0; i < LRUCACHE_SHARDS; i++)
+    {
+      struct lrucache_shard *s = &cache->shard[i];
+      struct lrucache_entry *e, *next, *freed = NULL;
+      size_t n;
+
+      pthread_rwlock_wrlock (&s->lock);
+      for (e = s->hand, n = s->count; n > 0; e = next, n--)
+	{
+	  next = e->clock_next;
+	  if ((*pred) (e, arg))
+	    {
+	      unlink_entry (s, e);
+	      e->hash_next = freed;
+	      freed = e;
+	      purged++;
+	    }
+	}
+      pthread_rwlock_unlock (&s->lock);
+
+      release_list (cache, freed);
+    }
+
+  return purged;
+}
+
+size_t
+lrucache_evict (struct lrucache *cache, size_t nr)
+{
+  /* Each shard gives its part.  */
+  size_t part = (nr + LRUCACHE_SHARDS - 1) / LRUCACHE_SHARDS;
+  time_t t = __atomic_load_n (&cache->ttl, __ATOMIC_RELAXED) ? now () : 0;
+  size_t evicted = 0;
+  int i;
+
+  for (i = 0; i < LRUCACHE_SHARDS && evicted < nr; i++)
+    {
+      struct lrucache_shard *s = &cache->shard[i];
+      struct lrucache_entry *freed = NULL;
+      size_t n;
+
+      pthread_rwlock_wrlock (&s->lock);
+      for (n = 0; n < part && evicted < nr && evict_one (s, t, &freed); n++)
+	evicted++;
+      pthread_rwlock_unlock (&s->lock);
+
+      release_list (cache, freed);
+    }
+
+  return evicted;
+}
+
+void
+lrucache_get_stats (struct lrucache *cache, struct lrucache_stats *stats)
+{
+  int i;
+
+  memset (stats, 0, sizeof *stats);
+  for (i = 0; i < LRUCACHE_SHARDS; i++)
+    {
+      struct lrucache_shard *s = &cache->shard[i];
+
+      pthread_rwlock_rdlock (&s->lock);
+      stats->count += s->count;
+      stats->cost += s->cost;
+      stats->hits += __atomic_load_n (&s->hits, __ATOMIC_RELAXED);
+      stats->misses += __atomic_load_n (&s->misses, __ATOMIC_RELAXED);
+      stats->evictions += __atomic_load_n (&s->evictions, __ATOMIC_RELAXED);
+      pthread_rwlock_unlock (&s->lock);
+    }
+}
@@ -0,0 +1,153 @@
+/* A sharded, thread-safe cache with CLOCK eviction
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef __LRUCACHE_H__
+#define __LRUCACHE_H__
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <shrinker.h>
+
+/* An lrucache maps keys to entries, which the user embeds in objects of
+   its own, the way a cacheq_hdr is.  The user hashes the keys, and
+   tells whether an entry is that of a key.  The entries are spread
+   over shards by their hash, each shard with a lock of its own, and a
+   hit only takes its shard's lock for reading: instead of moving the
+   entry in a list, it sets its referenced bit, which the CLOCK hand
+   that picks the entries to evict clears and looks at again on its
+   next time round.
+
+   Each entry has a cost, given when it is entered, and the cache evicts
+   to keep the costs of each shard under its part of the capacity.
+   Entries may also expire some time after they were entered.  The
+   cache holds a reference to each entry in it, and lookups return
+   another one; an entry is freed once it is out of the cache and has
+   no references.  Entries that are referenced are not evicted.  */
+
+/* This header is in every entry.  */
+struct lrucache_entry
+{
+  /* Private.  */
+  struct lrucache_entry *hash_next;
+  struct lrucache_entry *clock_next, *clock_prev;
+  size_t hash;
+  size_t cost;
+  time_t expires;		/* 0 if never */
+  unsigned int refs;
+  unsigned char referenced;
+  unsigned char cached;
+};
+
+#define LRUCACHE_SHARDS 16
+
+/* Private.  */
+struct lrucache_shard
+{
+  pthread_rwlock_t lock;
+  struct lrucache_entry **buckets;
+  size_t nbuckets;		/* A power of two, or 0.  */
+  size_t count;			/* Entries in the shard.  */
+  size_t cost;			/* Their costs.  */
+  struct lrucache_entry *hand;	/* The next entry the CLOCK looks at.  */
+  uint64_t hits, misses, evictions;
+} __attribute__ ((aligned (64)));
+
+struct lrucache
+{
+  /* Return nonzero if ENTRY is that of KEY.  */
+  int (*match) (const struct lrucache_entry *entry, const void *key);
+
+  /* Free ENTRY, which is out of the cache and has no references left.
+     Called without any lock of the cache held.  */
+  void (*free_entry) (struct lrucache_entry *entry);
+
+  size_t capacity;		/* The costs to keep, or 0 for no limit.  */
+  unsigned int ttl;		/* Seconds an entry lasts, or 0 for ever.  */
+
+  struct lrucache_shard shard[LRUCACHE_SHARDS];
+  struct shrinker shrinker;
+  int shrinker_registered;
+};
+
+struct lrucache_stats
+{
+  size_t count, cost;
+  uint64_t hits, misses, evictions;
+};
+
+/* Initialize CACHE, keeping entries of costs up to CAPACITY in all (no
+   limit if 0), matched to their keys by MATCH, and freed with
+   FREE_ENTRY.  */
+error_t lrucache_init (struct lrucache *cache, size_t capacity,
+		       int (*match) (const struct lrucache_entry *entry,
+				     const void *key),
+		       void (*free_entry) (struct lrucache_entry *entry));
+
+/* Remove all the entries of CACHE, unregister its shrinker if it has
+   one, and free its storage.  Entries still referenced are freed when
+   their references go.  */
+void lrucache_destroy (struct lrucache *cache);
+
+/* Make entries entered in CACHE from now on expire after TTL seconds,
+   or never if TTL is 0.  */
+void lrucache_set_ttl (struct lrucache *cache, unsigned int ttl);
+
+/* Register a shrinker called NAME for CACHE, which evicts its entries
+   under memory pressure.  */
+void lrucache_register_shrinker (struct lrucache *cache, const char *name);
+
+/* Return the entry of CACHE for KEY, whose hash is HASH, with a new
+   reference, or null if there is none or it has expired.  */
+struct lrucache_entry *lrucache_lookup (struct lrucache *cache, size_t hash,
+					const void *key);
+
+/* Enter ENTRY, whose header need not be initialized, in CACHE for KEY,
+   whose hash is HASH, at a cost of COST, evicting other entries as
+   needed to make room.  If CACHE already has a live entry for KEY,
+   leave ENTRY to the caller to free, and return that one instead;
+   otherwise ENTRY replaces any expired one, and is returned.  Either
+   way, the entry returned has a new reference.  */
+struct lrucache_entry *lrucache_insert (struct lrucache *cache,
+					struct lrucache_entry *entry,
+					size_t hash, const void *key,
+					size_t cost);
+
+/* Drop a reference to ENTRY of CACHE.  */
+void lrucache_release (struct lrucache *cache, struct lrucache_entry *entry);
+
+/* Take ENTRY out of CACHE, if it is still there.  */
+void lrucache_remove (struct lrucache *cache, struct lrucache_entry *entry);
+
+/* Take all the entries for which PRED, called with ARG and a shard's
+   lock held, returns nonzero out of CACHE.  Return how many there
+   were.  */
+size_t lrucache_purge (struct lrucache *cache,
+		       int (*pred) (struct lrucache_entry *entry, void *arg),
+		       void *arg);
+
+/* Evict up to NR entries of CACHE, and return how many were.  */
+size_t lrucache_evict (struct lrucache *cache, size_t nr);
+
+/* Fill in *STATS for CACHE.  */
+void lrucache_get_stats (struct lrucache *cache, struct lrucache_stats *stats);
+
+#endif /* __LRUCACHE_H__ */
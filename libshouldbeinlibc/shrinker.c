@@ -0,0 +1,133 @@
+/* Shrinking caches under memory pressure
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <mach.h>
+#include <mach/vm_statistics.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "shrinker.h"
+
+/* The registered shrinkers.  Held while they run, so that none goes
+   away under a scan.  */
+static struct shrinker *shrinkers;
+static pthread_mutex_t shrinkers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+shrinker_register (struct shrinker *shrinker)
+{
+  shrinker->scanned = 0;
+  shrinker->freed = 0;
+
+  pthread_mutex_lock (&shrinkers_lock);
+  shrinker->next = shrinkers;
+  shrinkers = shrinker;
+  pthread_mutex_unlock (&shrinkers_lock);
+}
+
+void
+shrinker_unregister (struct shrinker *shrinker)
+{
+  struct shrinker **sp;
+
+  pthread_mutex_lock (&shrinkers_lock);
+  for (sp = &shrinkers; *sp; sp = &(*sp)->next)
+    if (*sp == shrinker)
+      {
+	*sp = shrinker->next;
+	break;
+      }
+  pthread_mutex_unlock (&shrinkers_lock);
+}
+
+size_t
+shrinker_run (int priority)
+{
+  struct shrinker *s;
+  size_t total = 0;
+
+  pthread_mutex_lock (&shrinkers_lock);
+  for (s = shrinkers; s; s = s->next)
+    {
+      size_t nr = s->count (s) >> priority;
+      size_t freed;
+
+      if (nr == 0)
+	continue;
+      freed = s->scan (s, nr);
+      __atomic_add_fetch (&s->scanned, nr, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&s->freed, freed, __ATOMIC_RELAXED);
+      total += freed;
+    }
+  pthread_mutex_unlock (&shrinkers_lock);
+
+  return total;
+}
+
+static void *
+monitor (void *arg)
+{
+  unsigned interval = (uintptr_t) arg;
+  struct vm_statistics vmstats;
+  integer_t pageouts = -1;
+  int priority = SHRINKER_DEFAULT_PRIORITY;
+
+  for (;;)
+    {
+      usleep (interval * 1000);
+
+      if (vm_statistics (mach_task_self (), &vmstats))
+	continue;
+
+      if (pageouts >= 0 && vmstats.pageouts != pageouts)
+	{
+	  shrinker_run (priority);
+	  if (priority > 1)
+	    priority--;
+	}
+      else
+	priority = SHRINKER_DEFAULT_PRIORITY;
+      pageouts = vmstats.pageouts;
+    }
+
+  return NULL;
+}
+
+error_t
+shrinker_start (unsigned interval)
+{
+  static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+  static int started;
+  pthread_t thread;
+  error_t err = 0;
+
+  pthread_mutex_lock (&start_lock);
+  if (! started)
+    {
+      err = pthread_create (&thread, NULL, monitor,
+			    (void *) (uintptr_t) interval);
+      if (! err)
+	{
+	  pthread_detach (thread);
+	  started = 1;
+	}
+    }
+  pthread_mutex_unlock (&start_lock);
+
+  return err;
+}
@@ -0,0 +1,72 @@
+/* Shrinking caches under memory pressure
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef __SHRINKER_H__
+#define __SHRINKER_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A server registers each of its caches that could give memory back
+   with a shrinker.  While the kernel is paging out, a share of what
+   each registered cache could release is asked back from all of them
+   at once, starting small and growing for as long as the pressure
+   lasts, so that caches give back in proportion to their size and cold
+   objects go before the application memory they would otherwise push
+   out.  */
+struct shrinker
+{
+  /* For statistics.  */
+  const char *name;
+
+  /* Return about how many objects the cache could release now.  */
+  size_t (*count) (struct shrinker *shrinker);
+
+  /* Release up to NR objects, the least recently used first, and
+     return how many were.  */
+  size_t (*scan) (struct shrinker *shrinker, size_t nr);
+
+  /* What the cache has been asked for and has released.  */
+  uint64_t scanned, freed;
+
+  /* Private.  */
+  struct shrinker *next;
+};
+
+/* The share asked back first is the count shifted right by this; each
+   poll that still finds pressure doubles it, up to half the count.  */
+#define SHRINKER_DEFAULT_PRIORITY 6
+
+/* Register SHRINKER.  */
+void shrinker_register (struct shrinker *shrinker);
+
+/* Unregister SHRINKER, waiting until no scan of it is going on.  Must
+   not be called from a scan.  */
+void shrinker_unregister (struct shrinker *shrinker);
+
+/* Ask each registered cache to release its count shifted right by
+   PRIORITY objects.  Return how many were released in all.  */
+size_t shrinker_run (int priority);
+
+/* Start a thread that looks at the kernel's paging statistics every
+   INTERVAL milliseconds, and runs the shrinkers when it has been paging
+   out.  Only the first call starts one.  */
+error_t shrinker_start (unsigned interval);
+
+#endif /* __SHRINKER_H__ */
@@ -0,0 +1,164 @@
+/* Low-overhead event tracing into per-thread ring buffers
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <mach.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "maptime.h"
+#include "trace.h"
+
+const char *const trace_event_names[TRACE_EVENTS_MAX] =
+{
+  [TRACE_NONE] = "none",
+  [TRACE_PORTS_RPC_BEGIN] = "ports-rpc-begin",
+  [TRACE_PORTS_RPC_END] = "ports-rpc-end",
+  [TRACE_PAGER_DATA_REQUEST] = "pager-data-request",
+  [TRACE_PAGER_DATA_RETURN] = "pager-data-return",
+  [TRACE_DISKFS_LOOKUP] = "diskfs-lookup",
+  [TRACE_JOURNAL_ENQUEUE] = "journal-enqueue",
+  [TRACE_JOURNAL_FLUSH] = "journal-flush",
+  [TRACE_EXT2_CACHE_MISS] = "ext2-cache-miss",
+  [TRACE_EXT2_ALLOC_BLOCK] = "ext2-alloc-block",
+  [TRACE_EXT2_ALLOC_INODE] = "ext2-alloc-inode",
+};
+
+struct trace_area *_trace_area;
+
+static volatile struct mapped_time_value *mtime;
+static pthread_key_t ring_key;
+
+static __thread struct trace_ring *thread_ring;
+/* Set once this thread has found no free ring.  */
+static __thread int thread_lost;
+
+static uint64_t
+now_us (void)
+{
+  struct timeval tv;
+
+  if (mtime)
+    maptime_read (mtime, &tv);
+  else
+    {
+      struct timespec ts;
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+      tv.tv_sec = ts.tv_sec;
+      tv.tv_usec = ts.tv_nsec / 1000;
+    }
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Give the ring of a thread that exits back.  Its events stay until
+   the next owner overwrites them.  */
+static void
+release_ring (void *arg)
+{
+  struct trace_ring *ring = arg;
+
+  __atomic_store_n (&ring->owner, 0, __ATOMIC_RELEASE);
+}
+
+static struct trace_ring *
+get_ring (void)
+{
+  uint32_t self = (uint32_t) pthread_self () ? : ~0U;
+  int i;
+
+  if (thread_lost)
+    return NULL;
+
+  for (i = 0; i < TRACE_RINGS; i++)
+    {
+      struct trace_ring *ring = &_trace_area->ring[i];
+      uint32_t free = 0;
+
+      if (__atomic_load_n (&ring->owner, __ATOMIC_RELAXED) == 0
+	  && __atomic_compare_exchange_n (&ring->owner, &free, self, 0,
+					  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+	  pthread_setspecific (ring_key, ring);
+	  thread_ring = ring;
+	  return ring;
+	}
+    }
+
+  thread_lost = 1;
+  __atomic_add_fetch (&_trace_area->lost_threads, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+void
+_trace_record (uint32_t id, uint64_t arg0, uint64_t arg1)
+{
+  struct trace_ring *ring = thread_ring;
+  struct trace_event *e;
+  uint64_t head;
+
+  if (! ring && ! (ring = get_ring ()))
+    return;
+
+  head = ring->head;
+  e = &ring->events[head % TRACE_RING_EVENTS];
+  e->time = now_us ();
+  e->id = id;
+  e->thread = ring->owner;
+  e->arg[0] = arg0;
+  e->arg[1] = arg1;
+  /* Publish the event.  */
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Set up the area if HURD_TRACE asks for it.  The area follows a page
+   that can't be accessed, so that it starts a VM region of its own.  */
+static void __attribute__ ((constructor))
+trace_init (void)
+{
+  const char *env = getenv ("HURD_TRACE");
+  struct trace_area *area;
+  vm_address_t addr = 0;
+  vm_size_t size = round_page (sizeof *area);
+
+  if (! env)
+    return;
+
+  if (vm_allocate (mach_task_self (), &addr, vm_page_size + size, 1))
+    return;
+  if (vm_protect (mach_task_self (), addr, vm_page_size, 0, VM_PROT_NONE)
+      || pthread_key_create (&ring_key, release_ring))
+    {
+      vm_deallocate (mach_task_self (), addr, vm_page_size + size);
+      return;
+    }
+
+  /* The time device, unlike /dev/time, needs no file system, which may
+     be the very program being started.  */
+  if (maptime_map (1, NULL, &mtime))
+    mtime = NULL;
+
+  area = (struct trace_area *) (addr + vm_page_size);
+  area->version = TRACE_VERSION;
+  area->enabled = strcmp (env, "0") != 0;
+  area->ring_events = TRACE_RING_EVENTS;
+  area->rings = TRACE_RINGS;
+  __atomic_store_n (&area->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+  _trace_area = area;
+}
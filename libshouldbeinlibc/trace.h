@@ -0,0 +1,107 @@
+/* Low-overhead event tracing into per-thread ring buffers
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A program records events if it is started with HURD_TRACE in its
+   environment; with HURD_TRACE=0 the buffers are set up but recording
+   starts disabled.  Each thread then writes its events into a ring of
+   its own, without locking, in an area that the tracedump utility maps
+   from the live program to read them and to switch recording on and
+   off.  A tracepoint costs a load and a branch while disabled.  */
+
+/* The events, and what their two arguments are.  */
+enum trace_event_id
+{
+  TRACE_NONE,
+  TRACE_PORTS_RPC_BEGIN,	/* message id, port */
+  TRACE_PORTS_RPC_END,		/* message id, 0 */
+  TRACE_PAGER_DATA_REQUEST,	/* offset, length */
+  TRACE_PAGER_DATA_RETURN,	/* offset, length */
+  TRACE_DISKFS_LOOKUP,		/* directory inode, lookup type */
+  TRACE_JOURNAL_ENQUEUE,	/* 0 queue, 1 thread stage, 2 spill */
+  TRACE_JOURNAL_FLUSH,		/* bytes, ring position */
+  TRACE_EXT2_CACHE_MISS,	/* block, cache index */
+  TRACE_EXT2_ALLOC_BLOCK,	/* block, goal */
+  TRACE_EXT2_ALLOC_INODE,	/* inode, directory inode */
+  TRACE_EVENTS_MAX
+};
+
+/* The names of the events, indexed by their id.  */
+extern const char *const trace_event_names[TRACE_EVENTS_MAX];
+
+struct trace_event
+{
+  uint64_t time;		/* in microseconds */
+  uint32_t id;
+  uint32_t thread;
+  uint64_t arg[2];
+};
+
+#define TRACE_RING_EVENTS 2048	/* a power of two */
+#define TRACE_RINGS 64
+
+/* The events of one thread.  HEAD counts the events written, the last
+   TRACE_RING_EVENTS of which are in EVENTS at their count modulo
+   TRACE_RING_EVENTS.  Only the owner writes; a reader copies the
+   events below HEAD, and then drops those that HEAD has moved past by
+   more than TRACE_RING_EVENTS meanwhile.  */
+struct trace_ring
+{
+  uint64_t head;
+  uint32_t owner;		/* thread, or 0 when the ring is free */
+  uint32_t pad;
+  struct trace_event events[TRACE_RING_EVENTS];
+};
+
+#define TRACE_MAGIC 0x6563617274647268ULL
+#define TRACE_VERSION 1
+
+/* The area starts a VM region of its own, which is how tracedump finds
+   it in the program.  */
+struct trace_area
+{
+  uint64_t magic;		/* TRACE_MAGIC, once set up */
+  uint32_t version;		/* TRACE_VERSION */
+  uint32_t enabled;		/* events are recorded while nonzero */
+  uint32_t ring_events;		/* TRACE_RING_EVENTS */
+  uint32_t rings;		/* TRACE_RINGS */
+  uint64_t lost_threads;	/* threads that found no free ring */
+  struct trace_ring ring[TRACE_RINGS];
+};
+
+/* The area of this program, or null if it doesn't trace.  */
+extern struct trace_area *_trace_area;
+
+/* Record event ID in the ring of this thread.  */
+void _trace_record (uint32_t id, uint64_t arg0, uint64_t arg1);
+
+/* Record event ID with ARG0 and ARG1 if tracing is enabled.  */
+#define TRACE(id, arg0, arg1)						      \
+  do									      \
+    if (__builtin_expect (_trace_area != NULL				      \
+			  && __atomic_load_n (&_trace_area->enabled,	      \
+					      __ATOMIC_RELAXED), 0))	      \
+      _trace_record ((id), (uint64_t) (arg0), (uint64_t) (arg1));	      \
+  while (0)
+
+#endif /* __TRACE_H__ */
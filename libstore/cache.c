@@ -0,0 +1,815 @@
+/* Caching store backend
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* A cache store keeps the most recently used lines of its only child in
+   memory.  Lines are a page, or a block if blocks are larger, and are
+   replaced in least recently used order.  Writes go straight to the
+   child unless the cache was made write-back, in which case they only
+   dirty lines, which are written to the child when they are replaced,
+   when the store is flushed or made inactive, and every so many seconds
+   if a flush interval was given.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "store.h"
+
+/* The size of the cache if none is given.  */
+#define CACHE_DEFAULT_SIZE (8 * 1024 * 1024)
+
+/* The smallest line.  */
+#define CACHE_LINE_MIN 4096
+
+/* Requests of more lines than this go around the cache, so that one
+   large transfer doesn't push everything else out.  */
+#define CACHE_BYPASS_LINES 32
+
+struct cache_line
+{
+  store_offset_t num;		/* The line number.  */
+  size_t len;			/* Bytes valid; short only at the end.  */
+  int dirty;
+  char *data;
+  struct cache_line *hnext;	/* Hash chain.  */
+  struct cache_line *prev, *next; /* LRU list, most recent first.  */
+};
+
+struct cache
+{
+  pthread_mutex_t lock;
+
+  size_t line_size;
+  size_t line_blocks;		/* Child blocks per line.  */
+  store_offset_t size;		/* Bytes in the store.  */
+
+  size_t max_lines, num_lines;
+  struct cache_line **hash;
+  size_t hash_mask;
+  struct cache_line *mru, *lru;
+
+  /* Bumped by every write that goes to the child, so that a reader that
+     missed doesn't cache what it read if it may be stale.  */
+  unsigned long gen;
+
+  /* Whether writes only dirty lines, and if so, how many seconds may
+     pass before a dirty line is written (0 for no limit).  */
+  int write_back;
+  unsigned int flush_secs;
+
+  pthread_t flusher;
+  int have_flusher, stopping;
+  pthread_cond_t stop_cond;
+};
+
+static inline size_t
+hash_line (struct cache *c, store_offset_t num)
+{
+  return ((uint64_t) num * 0x9e3779b97f4a7c15ULL >> 32) & c->hash_mask;
+}
+
+static struct cache_line *
+lookup (struct cache *c, store_offset_t num)
+{
+  struct cache_line *l;
+  for (l = c->hash[hash_line (c, num)]; l; l = l->hnext)
+    if (l->num == num)
+      return l;
+  return NULL;
+}
+
+static void
+lru_unlink (struct cache *c, struct cache_line *l)
+{
+  if (l->prev)
+    l->prev->next = l->next;
+  else
+    c->mru = l->next;
+  if (l->next)
+    l->next->prev = l->prev;
+  else
+    c->lru = l->prev;
+}
+
+static void
+lru_push (struct cache *c, struct cache_line *l)
+{
+  l->prev = NULL;
+  l->next = c->mru;
+  if (c->mru)
+    c->mru->prev = l;
+  else
+    c->lru = l;
+  c->mru = l;
+}
+
+static void
+touch (struct cache *c, struct cache_line *l)
+{
+  if (c->mru != l)
+    {
+      lru_unlink (c, l);
+      lru_push (c, l);
+    }
+}
+
+static void
+hash_remove (struct cache *c, struct cache_line *l)
+{
+  struct cache_line **lp = &c->hash[hash_line (c, l->num)];
+  while (*lp != l)
+    lp = &(*lp)->hnext;
+  *lp = l->hnext;
+}
+
+/* The number of bytes of line NUM within the store.  */
+static inline size_t
+line_len (struct cache *c, store_offset_t num)
+{
+  store_offset_t start = num * c->line_size;
+  return c->size - start < c->line_size ? c->size - start : c->line_size;
+}
+
+/* Write the dirty line L to the child of STORE.  C is locked.  */
+static error_t
+write_line (struct store *store, struct cache_line *l)
+{
+  struct cache *c = store->hook;
+  size_t amount;
+  error_t err = store_write (store->children[0], l->num * c->line_blocks,
+			     l->data, l->len, &amount);
+  if (! err && amount < l->len)
+    err = EIO;
+  if (! err)
+    l->dirty = 0;
+  return err;
+}
+
+/* Write every dirty line of STORE to its child, returning the first
+   error.  C is locked.  */
+static error_t
+flush_lines (struct store *store)
+{
+  struct cache *c = store->hook;
+  struct cache_line *l;
+  error_t err = 0;
+
+  for (l = c->lru; l; l = l->prev)
+    if (l->dirty)
+      {
+	error_t e = write_line (store, l);
+	if (e && ! err)
+	  err = e;
+      }
+  return err;
+}
+
+/* Return a line for NUM, which isn't in the cache, and enter it; its
+   contents are for the caller to fill.  The least recently used line is
+   replaced if the cache is full, being written first if it's dirty.
+   Returns NULL if no line can be had.  C is locked.  */
+static struct cache_line *
+new_line (struct store *store, store_offset_t num)
+{
+  struct cache *c = store->hook;
+  struct cache_line *l;
+
+  if (c->num_lines < c->max_lines)
+    {
+      l = malloc (sizeof *l);
+      if (! l)
+	return NULL;
+      l->data = malloc (c->line_size);
+      if (! l->data)
+	{
+	  free (l);
+	  return NULL;
+	}
+      c->num_lines++;
+    }
+  else
+    {
+      l = c->lru;
+      if (! l || (l->dirty && write_line (store, l)))
+	return NULL;
+      lru_unlink (c, l);
+      hash_remove (c, l);
+    }
+
+  l->num = num;
+  l->len = line_len (c, num);
+  l->dirty = 0;
+  l->hnext = c->hash[hash_line (c, num)];
+  c->hash[hash_line (c, num)] = l;
+  lru_push (c, l);
+  return l;
+}
+
+/* Copy between the buffer BUF, holding the bytes from OFFS on, and line
+   L those bytes of it that lie within the LEN bytes of BUF.  If TO_LINE,
+   the copy is into L.  */
+static void
+copy_line (struct cache *c, struct cache_line *l, store_offset_t offs,
+	   char *buf, size_t len, int to_line)
+{
+  store_offset_t start = l->num * c->line_size, end = start + l->len;
+  if (start < offs)
+    start = offs;
+  if (end > offs + len)
+    end = offs + len;
+  if (start >= end)
+    return;
+  if (to_line)
+    memcpy (l->data + (start - l->num * c->line_size),
+	    buf + (start - offs), end - start);
+  else
+    memcpy (buf + (start - offs),
+	    l->data + (start - l->num * c->line_size), end - start);
+}
+
+/* Copy between BUF, the LEN bytes from OFFS on, and every line in the
+   cache that overlaps them.  C is locked.  */
+static void
+copy_lines (struct cache *c, store_offset_t offs, char *buf, size_t len,
+	    int to_line)
+{
+  store_offset_t first = offs / c->line_size;
+  store_offset_t last = (offs + len - 1) / c->line_size;
+  struct cache_line *l;
+
+  if (last - first + 1 > c->num_lines)
+    {
+      for (l = c->mru; l; l = l->next)
+	if (l->num >= first && l->num <= last)
+	  copy_line (c, l, offs, buf, len, to_line);
+    }
+  else
+    for (store_offset_t n = first; n <= last; n++)
+      if ((l = lookup (c, n)))
+	copy_line (c, l, offs, buf, len, to_line);
+}
+
+/* Read the lines FIRST to LAST from the child of STORE into BUF.  */
+static error_t
+read_lines (struct store *store, store_offset_t first, store_offset_t last,
+	    char *buf)
+{
+  struct cache *c = store->hook;
+  size_t want = (last - first) * c->line_size + line_len (c, last);
+  void *data = buf;
+  size_t data_len = want;
+  error_t err = store_read (store->children[0], first * c->line_blocks,
+			    want, &data, &data_len);
+  if (err)
+    return err;
+  if (data != buf)
+    {
+      memcpy (buf, data, data_len < want ? data_len : want);
+      munmap (data, data_len);
+    }
+  return data_len < want ? EIO : 0;
+}
+
+static error_t
+cache_read (struct store *store,
+	    store_offset_t addr, size_t index, size_t amount,
+	    void **buf, size_t *len)
+{
+  struct cache *c = store->hook;
+  store_offset_t offs = addr * store->block_size;
+  store_offset_t first, last, n;
+  char *out;
+  error_t err = 0;
+
+  if (amount == 0)
+    {
+      *len = 0;
+      return 0;
+    }
+
+  first = offs / c->line_size;
+  last = (offs + amount - 1) / c->line_size;
+
+  if (last - first + 1 > CACHE_BYPASS_LINES)
+    {
+      /* Only the lines already here are newer than the child's data,
+	 and then only if dirty, but copying the clean ones does no harm. */
+      err = store_read (store->children[0], addr, amount, buf, len);
+      if (! err)
+	{
+	  pthread_mutex_lock (&c->lock);
+	  copy_lines (c, offs, *buf, *len, 0);
+	  pthread_mutex_unlock (&c->lock);
+	}
+      return err;
+    }
+
+  if (*len < amount)
+    {
+      out = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (out == MAP_FAILED)
+	return errno;
+    }
+  else
+    out = *buf;
+
+  pthread_mutex_lock (&c->lock);
+  for (n = first; n <= last && ! err; )
+    {
+      struct cache_line *l = lookup (c, n);
+      store_offset_t m, k;
+      unsigned long gen;
+      char *tmp;
+
+      if (l)
+	{
+	  copy_line (c, l, offs, out, amount, 0);
+	  touch (c, l);
+	  n++;
+	  continue;
+	}
+
+      /* Read the whole run of missing lines at once, without the lock,
+	 so that hits on other lines aren't held up.  */
+      for (m = n; m < last && ! lookup (c, m + 1); m++)
+	;
+      gen = c->gen;
+      pthread_mutex_unlock (&c->lock);
+
+      tmp = malloc ((m - n + 1) * c->line_size);
+      if (tmp)
+	err = read_lines (store, n, m, tmp);
+      else
+	err = ENOMEM;
+
+      pthread_mutex_lock (&c->lock);
+      if (! err)
+	for (k = n; k <= m; k++)
+	  {
+	    char *data = tmp + (k - n) * c->line_size;
+	    l = lookup (c, k);
+	    if (! l && gen == c->gen)
+	      {
+		/* Nothing was written meanwhile, so DATA is current.  */
+		l = new_line (store, k);
+		if (l)
+		  memcpy (l->data, data, l->len);
+	      }
+	    if (l)
+	      /* A line that appeared meanwhile may hold newer data.  */
+	      copy_line (c, l, offs, out, amount, 0);
+	    else
+	      {
+		struct cache_line tl = { .num = k, .len = line_len (c, k),
+					 .data = data };
+		copy_line (c, &tl, offs, out, amount, 0);
+	      }
+	  }
+      free (tmp);
+      n = m + 1;
+    }
+  pthread_mutex_unlock (&c->lock);
+
+  if (err)
+    {
+      if (out != *buf)
+	munmap (out, amount);
+      return err;
+    }
+
+  *buf = out;
+  *len = amount;
+  return 0;
+}
+
+static error_t
+cache_write (struct store *store,
+	     store_offset_t addr, size_t index, const void *buf, size_t len,
+	     size_t *amount)
+{
+  struct cache *c = store->hook;
+  store_offset_t offs = addr * store->block_size;
+  store_offset_t first, last, n;
+  error_t err = 0;
+
+  if (len == 0)
+    {
+      *amount = 0;
+      return 0;
+    }
+
+  first = offs / c->line_size;
+  last = (offs + len - 1) / c->line_size;
+
+  if (! c->write_back || last - first + 1 > CACHE_BYPASS_LINES)
+    {
+      err = store_write (store->children[0], addr, buf, len, amount);
+      if (! err && *amount > 0)
+	{
+	  /* Keep the lines here current; dirty ones stay dirty, as they
+	     may hold other data the child hasn't got yet.  */
+	  pthread_mutex_lock (&c->lock);
+	  c->gen++;
+	  copy_lines (c, offs, (char *) buf, *amount, 1);
+	  pthread_mutex_unlock (&c->lock);
+	}
+      return err;
+    }
+
+  pthread_mutex_lock (&c->lock);
+  for (n = first; n <= last && ! err; n++)
+    {
+      struct cache_line *l = lookup (c, n);
+      store_offset_t start = n * c->line_size;
+
+      if (! l)
+	{
+	  if (offs <= start && offs + len >= start + line_len (c, n))
+	    /* All of the line is written, so there's nothing to read.  */
+	    l = new_line (store, n);
+	  else
+	    {
+	      char *tmp = malloc (c->line_size);
+	      unsigned long gen = c->gen;
+
+	      pthread_mutex_unlock (&c->lock);
+	      err = tmp ? read_lines (store, n, n, tmp) : ENOMEM;
+	      pthread_mutex_lock (&c->lock);
+
+	      l = lookup (c, n);
+	      if (! err && ! l && gen == c->gen)
+		{
+		  l = new_line (store, n);
+		  if (l)
+		    memcpy (l->data, tmp, l->len);
+		}
+	      free (tmp);
+	      if (l)
+		err = 0;
+	    }
+	}
+
+      if (! l && ! err)
+	{
+	  /* No line to put it in, so write this part through.  */
+	  store_offset_t s = offs > start ? offs : start;
+	  store_offset_t e = start + line_len (c, n);
+	  size_t done;
+	  if (e > offs + len)
+	    e = offs + len;
+	  pthread_mutex_unlock (&c->lock);
+	  err = store_write (store->children[0], s / store->block_size,
+			     (const char *) buf + (s - offs), e - s, &done);
+	  if (! err && done < e - s)
+	    err = EIO;
+	  pthread_mutex_lock (&c->lock);
+	  c->gen++;
+	  if ((l = lookup (c, n)))
+	    copy_line (c, l, offs, (char *) buf, len, 1);
+	  continue;
+	}
+
+      if (l)
+	{
+	  copy_line (c, l, offs, (char *) buf, len, 1);
+	  l->dirty = 1;
+	  touch (c, l);
+	}
+    }
+  pthread_mutex_unlock (&c->lock);
+
+  if (err && n - 1 == first)
+    return err;
+
+  /* Only whole lines before the failing one were surely stored.  */
+  if (err)
+    {
+      store_offset_t done = (n - 1) * c->line_size - offs;
+      *amount = done < len ? done : len;
+    }
+  else
+    *amount = len;
+  return 0;
+}
+
+static error_t
+cache_set_size (struct store *store, size_t newsize)
+{
+  return EOPNOTSUPP;
+}
+
+static error_t
+cache_set_flags (struct store *store, int flags)
+{
+  if (flags & STORE_INACTIVE)
+    /* Nothing may be left behind once the child can't be used.  */
+    {
+      struct cache *c = store->hook;
+      error_t err;
+      pthread_mutex_lock (&c->lock);
+      err = flush_lines (store);
+      pthread_mutex_unlock (&c->lock);
+      if (err)
+	return err;
+    }
+  return store_set_child_flags (store, flags);
+}
+
+static error_t
+cache_clear_flags (struct store *store, int flags)
+{
+  return store_clear_child_flags (store, flags);
+}
+
+static void *
+flusher (void *arg)
+{
+  struct store *store = arg;
+  struct cache *c = store->hook;
+
+  pthread_mutex_lock (&c->lock);
+  while (! c->stopping)
+    {
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += c->flush_secs;
+      if (pthread_cond_timedwait (&c->stop_cond, &c->lock, &ts) == ETIMEDOUT
+	  && ! c->stopping)
+	flush_lines (store);
+    }
+  pthread_mutex_unlock (&c->lock);
+  return NULL;
+}
+
+static void
+cache_cleanup (struct store *store)
+{
+  struct cache *c = store->hook;
+  struct cache_line *l, *next;
+
+  if (! c)
+    return;
+
+  pthread_mutex_lock (&c->lock);
+  if (c->have_flusher)
+    {
+      c->stopping = 1;
+      pthread_cond_signal (&c->stop_cond);
+      pthread_mutex_unlock (&c->lock);
+      pthread_join (c->flusher, NULL);
+      pthread_mutex_lock (&c->lock);
+    }
+  /* Our children are only freed after this.  */
+  flush_lines (store);
+  pthread_mutex_unlock (&c->lock);
+
+  for (l = c->mru; l; l = next)
+    {
+      next = l->next;
+      free (l->data);
+      free (l);
+    }
+  free (c->hash);
+  pthread_cond_destroy (&c->stop_cond);
+  pthread_mutex_destroy (&c->lock);
+  free (c);
+  store->hook = NULL;
+}
+
+static error_t
+cache_clone (const struct store *from, struct store *to)
+{
+  /* Two caches of the same child would each hold their own data.  */
+  return EOPNOTSUPP;
+}
+
+static error_t
+cache_remap (struct store *source,
+	     const struct store_run *runs, size_t num_runs,
+	     struct store **store)
+{
+  return store_remap_create (source, runs, num_runs, 0, store);
+}
+
+/* Parse the options at the start of NAME, "SIZE[,SECS]:", if any,
+   returning the rest of NAME in CHILD.  */
+static error_t
+parse_name (const char *name, size_t *size, int *flush_secs,
+	    const char **child)
+{
+  char *end;
+  unsigned long long n;
+
+  *size = CACHE_DEFAULT_SIZE;
+  *flush_secs = -1;
+  *child = name;
+
+  if (! isdigit (*name))
+    return 0;
+
+  n = strtoull (name, &end, 0);
+  switch (*end)
+    {
+    case 'g': case 'G': n <<= 10; /* Fall through.  */
+    case 'm': case 'M': n <<= 10; /* Fall through.  */
+    case 'k': case 'K': n <<= 10; end++;
+    }
+  *size = n;
+
+  if (*end == ',')
+    {
+      const char *p = end + 1;
+      if (! isdigit (*p))
+	return EINVAL;
+      *flush_secs = strtoul (p, &end, 10);
+    }
+
+  if (*end != ':' || end[1] == '\0')
+    return EINVAL;
+  *child = end + 1;
+  return 0;
+}
+
+static error_t
+cache_open (const char *name, int flags,
+	    const struct store_class *const *classes,
+	    struct store **store)
+{
+  return store_cache_open (name, flags, classes, store);
+}
+
+static error_t
+cache_validate_name (const char *name,
+		     const struct store_class *const *classes)
+{
+  size_t size;
+  int flush_secs;
+  const char *child;
+  return parse_name (name, &size, &flush_secs, &child);
+}
+
+const struct store_class
+store_cache_class =
+{
+  -1, "cache", cache_read, cache_write, cache_set_size,
+  0, 0, 0,
+  cache_set_flags, cache_clear_flags, cache_cleanup, cache_clone,
+  cache_remap, cache_open, cache_validate_name
+};
+STORE_STD_CLASS (cache);
+
+/* Return a new store in STORE that keeps up to SIZE bytes of the store FROM
+   in memory; FROM is consumed.  If FLUSH_SECS is negative, writes go
+   straight to FROM; otherwise they are kept until the data is replaced,
+   store_cache_flush is called or the store is made inactive or freed,
+   and if FLUSH_SECS is positive, at most that many seconds.  */
+error_t
+store_cache_create (struct store *from, size_t size, int flush_secs,
+		    int flags, struct store **store)
+{
+  error_t err;
+  struct store_run run;
+  struct cache *c;
+  size_t hash_size;
+
+  run.start = 0;
+  run.length = from->end;
+
+  c = calloc (1, sizeof *c);
+  if (! c)
+    return ENOMEM;
+
+  c->line_size = from->block_size > CACHE_LINE_MIN
+    ? from->block_size : CACHE_LINE_MIN;
+  if (c->line_size % from->block_size)
+    {
+      free (c);
+      return EINVAL;
+    }
+  c->line_blocks = c->line_size / from->block_size;
+  c->size = from->size;
+  c->max_lines = size / c->line_size ?: 1;
+  for (hash_size = 1; hash_size < c->max_lines; hash_size <<= 1)
+    ;
+  c->hash_mask = hash_size - 1;
+  c->hash = calloc (hash_size, sizeof *c->hash);
+  if (! c->hash)
+    {
+      free (c);
+      return ENOMEM;
+    }
+  c->write_back = flush_secs >= 0;
+  c->flush_secs = flush_secs > 0 ? flush_secs : 0;
+  pthread_mutex_init (&c->lock, NULL);
+  pthread_cond_init (&c->stop_cond, NULL);
+
+  err = _store_create (&store_cache_class, MACH_PORT_NULL,
+		       flags | from->flags, from->block_size,
+		       &run, 1, 0, store);
+  if (err)
+    {
+      free (c->hash);
+      free (c);
+      return err;
+    }
+  (*store)->hook = c;
+
+  err = store_set_children (*store, &from, 1);
+  if (! err && c->flush_secs > 0)
+    {
+      err = pthread_create (&c->flusher, NULL, flusher, *store);
+      c->have_flusher = ! err;
+    }
+  if (! err)
+    {
+      size_t len = strlen (from->class->name) + 1
+		   + (from->name ? strlen (from->name) : 0) + 1;
+      (*store)->name = malloc (len);
+      if ((*store)->name)
+	snprintf ((*store)->name, len, "%s%s%s", from->class->name,
+		  from->name ? ":" : "", from->name ?: "");
+      else
+	err = ENOMEM;
+    }
+
+  if (err)
+    {
+      /* FROM is the caller's until it's our child.  */
+      if ((*store)->num_children > 0)
+	{
+	  (*store)->num_children = 0;
+	  free ((*store)->children);
+	  (*store)->children = NULL;
+	}
+      store_free (*store);
+    }
+
+  return err;
+}
+
+/* Open the cache store NAME -- which consists of an optional size and flush
+   interval, "SIZE[,SECS]:", followed by another store-class name, a ':',
+   and a name for that store class to open -- and return the corresponding
+   store in STORE.  SIZE is in bytes, or with a suffix of k, M or G, in
+   those units; if there's no SECS, writes go straight to the child store.
+   CLASSES is used to select classes specified by the type name; if it is
+   0, STORE_STD_CLASSES is used.  */
+error_t
+store_cache_open (const char *name, int flags,
+		  const struct store_class *const *classes,
+		  struct store **store)
+{
+  size_t size;
+  int flush_secs;
+  const char *child;
+  struct store *from;
+  error_t err = parse_name (name, &size, &flush_secs, &child);
+
+  if (! err)
+    err = store_typed_open (child, flags, classes, &from);
+  if (! err)
+    {
+      err = store_cache_create (from, size, flush_secs, flags, store);
+      if (err)
+	store_free (from);
+    }
+
+  return err;
+}
+
+/* Write any data the cache store STORE holds that its child hasn't got
+   yet to the child.  */
+error_t
+store_cache_flush (struct store *store)
+{
+  struct cache *c = store->hook;
+  error_t err;
+
+  if (store->class != &store_cache_class)
+    return EINVAL;
+
+  pthread_mutex_lock (&c->lock);
+  err = flush_lines (store);
+  pthread_mutex_unlock (&c->lock);
+  return err;
+}
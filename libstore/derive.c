@@ -24,6 +24,9 @@
 
 #include "store.h"
 
+/* Run lists at least this long are indexed by RUN_ENDS.  */
+#define RUN_INDEX_MIN 16
+
 /* Fills in the values of the various fields in STORE that are derivable from
    the set of runs & the block size.  */
 void
@@ -38,11 +41,19 @@ _store_derive (struct store *store)
   store->blocks = 0;
   store->wrap_src = 0;
 
+  free (store->run_ends);
+  store->run_ends = 0;
+  if (num_runs >= RUN_INDEX_MIN)
+    /* If this fails, runs are just looked for the slow way.  */
+    store->run_ends = malloc (num_runs * sizeof *store->run_ends);
+
   for (i = 0; i < num_runs; i++)
     {
       store->wrap_src += runs[i].length;
       if (runs[i].start >= 0)	/* Not a hole */
 	store->blocks += runs[i].length;
+      if (store->run_ends)
+	store->run_ends[i] = store->wrap_src;
     }
 
   if (store->end == 0)
@@ -93,6 +93,27 @@ dev_set_size (struct store *store, size_t newsize)
   return EOPNOTSUPP;
 }
 
+/* The device_set_status flavor that asks a disk to discard a range of
+   bytes, given as its offset and length, each as two ints with the low
+   half first.  The value is that of Linux's BLKDISCARD ioctl.  */
+#define BLKDISCARD 0x1277
+
+static error_t
+dev_discard (struct store *store, store_offset_t addr, size_t index,
+	     store_offset_t len)
+{
+  uint64_t offset = (uint64_t) addr << store->log2_block_size;
+  int status[4] = { offset & 0xffffffff, offset >> 32,
+		    (uint64_t) len & 0xffffffff, (uint64_t) len >> 32 };
+  error_t err;
+
+  err = device_set_status (store->port, BLKDISCARD, status, 4);
+  if (err == D_INVALID_OPERATION)
+    /* The driver doesn't know the flavor.  */
+    return EOPNOTSUPP;
+  return dev_error (err);
+}
+
 static error_t
 dev_decode (struct store_enc *enc, const struct store_class *const *classes,
 	    struct store **store)
@@ -318,7 +339,7 @@ store_device_class =
 {
   STORAGE_DEVICE, "device", dev_read, dev_write, dev_set_size,
   store_std_leaf_allocate_encoding, store_std_leaf_encode, dev_decode,
-  dev_set_flags, dev_clear_flags, 0, 0, 0, dev_open, 0, dev_map
+  dev_set_flags, dev_clear_flags, 0, 0, 0, dev_open, 0, dev_map, dev_discard
 };
 STORE_STD_CLASS (device);
 
@@ -0,0 +1,814 @@
+/* Streaming gzip decompressing store backend
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Unlike the gunzip store, which decompresses all of its child up front,
+   a gzstream store only decompresses what is read.  A thread goes through
+   the compressed data once, in the background, noting restart points
+   about every GZS_SPAN bytes of output: where in the input the deflate
+   block starting there is, and the 32K of output before it, which is all
+   that later blocks may refer to.  The stretch of output between two
+   restart points, a chunk, can then be decompressed without the rest, by
+   any number of readers at once; a few decompressed chunks are kept.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "store.h"
+
+/* The least output between two restart points.  */
+#define GZS_SPAN (1024 * 1024)
+
+/* The history deflate may refer back to.  */
+#define GZS_WINDOW 32768
+
+/* How much compressed input is read at once.  */
+#define GZS_IN_SIZE (64 * 1024)
+
+/* How many decompressed chunks are kept.  */
+#define GZS_CACHE 8
+
+/* How many threads a read of several chunks may use at once.  */
+#define GZS_THREADS 4
+
+struct point
+{
+  store_offset_t out;		/* Offset in the output.  */
+  store_offset_t in;		/* Offset of the next whole input byte.  */
+  int bits;			/* Bits of the byte before IN still unread.  */
+  unsigned char byte;		/* That byte.  */
+  unsigned char *window;	/* The GZS_WINDOW bytes before OUT, or NULL
+				   at the start of a gzip member.  */
+};
+
+struct chunk
+{
+  size_t num;			/* Chunk number; valid only if VALID.  */
+  char *data;
+  size_t len;
+  int valid;
+  int busy;			/* Being decompressed.  */
+  int refs;			/* Readers copying from DATA.  */
+  unsigned long stamp;		/* Last use, for replacement.  */
+};
+
+struct gzs
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+
+  store_offset_t size;		/* Output size the trailer claims.  */
+
+  struct point *points;
+  size_t num_points, points_alloced;
+
+  /* Set once the indexer is done, with the total output in OUT_TOTAL,
+     or failed with INDEX_ERR.  */
+  int indexed;
+  store_offset_t out_total;
+  error_t index_err;
+
+  struct chunk cache[GZS_CACHE];
+  unsigned long clock;
+
+  pthread_t indexer;
+  int have_indexer, stopping;
+};
+
+/* Read up to LEN bytes at byte offset OFFS of FROM into BUF, returning
+   the amount read in AMOUNT.  */
+static error_t
+read_in (struct store *from, store_offset_t offs, void *buf, size_t len,
+	 size_t *amount)
+{
+  size_t skip = offs & (from->block_size - 1);
+  size_t want;
+  void *data = NULL;
+  size_t data_len = 0;
+  error_t err;
+
+  *amount = 0;
+  if (offs >= from->size)
+    return 0;
+  if (len > from->size - offs)
+    len = from->size - offs;
+
+  want = (skip + len + from->block_size - 1) & ~(from->block_size - 1);
+  err = store_read (from, offs >> from->log2_block_size, want,
+		    &data, &data_len);
+  if (err)
+    return err;
+  if (data_len > skip)
+    {
+      *amount = data_len - skip < len ? data_len - skip : len;
+      memcpy (buf, data + skip, *amount);
+    }
+  munmap (data, data_len);
+  return 0;
+}
+
+/* Return the end of chunk K, which is known.  G is locked.  */
+static store_offset_t
+chunk_end (struct gzs *g, size_t k)
+{
+  return k + 1 < g->num_points ? g->points[k + 1].out : g->out_total;
+}
+
+/* Return in K the chunk holding byte OFFS of the output, waiting for the
+   indexer to get there if need be.  G is locked.  */
+static error_t
+find_chunk (struct gzs *g, store_offset_t offs, size_t *k)
+{
+  size_t lo, hi;
+
+  while (! g->indexed
+	 && (g->num_points < 2 || g->points[g->num_points - 1].out <= offs))
+    {
+      if (g->index_err)
+	return g->index_err;
+      pthread_cond_wait (&g->wakeup, &g->lock);
+    }
+  if (g->num_points == 0
+      || (g->indexed && offs >= chunk_end (g, g->num_points - 1)))
+    return EIO;
+
+  /* The last point at or before OFFS.  */
+  lo = 0;
+  hi = g->num_points;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (g->points[mid].out <= offs)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  *k = lo;
+  return 0;
+}
+
+/* Decompress the LEN bytes of output from point P on into DATA.  */
+static error_t
+inflate_chunk (struct store *from, const struct point *p,
+	       char *data, size_t len)
+{
+  z_stream strm;
+  unsigned char *in;
+  store_offset_t in_offs = p->in;
+  error_t err = 0;
+  int ret;
+
+  in = malloc (GZS_IN_SIZE);
+  if (! in)
+    return ENOMEM;
+
+  memset (&strm, 0, sizeof strm);
+  if (inflateInit2 (&strm, -MAX_WBITS) != Z_OK)
+    {
+      free (in);
+      return ENOMEM;
+    }
+  if (p->bits)
+    inflatePrime (&strm, p->bits, p->byte >> (8 - p->bits));
+  if (p->window)
+    inflateSetDictionary (&strm, p->window, GZS_WINDOW);
+
+  strm.next_out = (unsigned char *) data;
+  strm.avail_out = len;
+  do
+    {
+      if (strm.avail_in == 0)
+	{
+	  size_t n;
+	  err = read_in (from, in_offs, in, GZS_IN_SIZE, &n);
+	  if (err)
+	    break;
+	  if (n == 0)
+	    {
+	      err = EIO;
+	      break;
+	    }
+	  in_offs += n;
+	  strm.next_in = in;
+	  strm.avail_in = n;
+	}
+      ret = inflate (&strm, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+	break;
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+	err = ret == Z_MEM_ERROR ? ENOMEM : EIO;
+    }
+  while (! err && strm.avail_out > 0);
+
+  if (! err && strm.avail_out > 0)
+    err = EIO;
+
+  inflateEnd (&strm);
+  free (in);
+  return err;
+}
+
+/* Return the least recently used chunk that nobody uses, or NULL if
+   there's none.  G is locked.  */
+static struct chunk *
+victim (struct gzs *g)
+{
+  struct chunk *c, *best = NULL;
+  for (c = g->cache; c < g->cache + GZS_CACHE; c++)
+    if (! c->valid)
+      return c;
+    else if (! c->busy && c->refs == 0 && (! best || c->stamp < best->stamp))
+      best = c;
+  return best;
+}
+
+static void
+drop_chunk (struct chunk *c)
+{
+  free (c->data);
+  c->data = NULL;
+  c->valid = 0;
+}
+
+/* Return chunk K, decompressing it if it isn't kept, with a reference
+   that the caller must drop.  G is locked.  */
+static error_t
+get_chunk (struct store *store, size_t k, struct chunk **chunk)
+{
+  struct gzs *g = store->hook;
+  struct chunk *c;
+
+  for (;;)
+    {
+      for (c = g->cache; c < g->cache + GZS_CACHE; c++)
+	if (c->valid && c->num == k)
+	  break;
+      if (c < g->cache + GZS_CACHE)
+	{
+	  if (c->busy)
+	    {
+	      pthread_cond_wait (&g->wakeup, &g->lock);
+	      continue;
+	    }
+	  c->refs++;
+	  c->stamp = ++g->clock;
+	  *chunk = c;
+	  return 0;
+	}
+
+      c = victim (g);
+      if (c)
+	break;
+      pthread_cond_wait (&g->wakeup, &g->lock);
+    }
+
+  /* Decompress K into C, without the lock; anyone else wanting K
+     waits for it.  */
+  {
+    struct point p = g->points[k];
+    size_t len = chunk_end (g, k) - p.out;
+    char *data;
+    error_t err;
+
+    if (c->valid)
+      drop_chunk (c);
+    c->num = k;
+    c->valid = 1;
+    c->busy = 1;
+    pthread_mutex_unlock (&g->lock);
+
+    data = malloc (len ?: 1);
+    err = data ? inflate_chunk (store->children[0], &p, data, len) : ENOMEM;
+
+    pthread_mutex_lock (&g->lock);
+    c->busy = 0;
+    pthread_cond_broadcast (&g->wakeup);
+    if (err)
+      {
+	free (data);
+	c->valid = 0;
+	return err;
+      }
+    c->data = data;
+    c->len = len;
+    c->refs = 1;
+    c->stamp = ++g->clock;
+    *chunk = c;
+    return 0;
+  }
+}
+
+/* Keep chunk K, DATA & LEN, as decompressed by the indexer, if there's
+   room; it's the first to be replaced.  DATA is consumed.  G is
+   locked.  */
+static void
+add_chunk (struct gzs *g, size_t k, char *data, size_t len)
+{
+  struct chunk *c;
+
+  for (c = g->cache; c < g->cache + GZS_CACHE; c++)
+    if (c->valid && c->num == k)
+      {
+	free (data);
+	return;
+      }
+
+  c = victim (g);
+  if (! c)
+    {
+      free (data);
+      return;
+    }
+  if (c->valid)
+    drop_chunk (c);
+  c->num = k;
+  c->data = data;
+  c->len = len;
+  c->valid = 1;
+  c->stamp = 0;
+}
+
+/* Note a restart point at OUT, IN, BITS & BYTE with the window WINDOW,
+   which is copied, ending chunk DATA & LEN, if this isn't the first
+   point.  DATA is consumed.  */
+static error_t
+add_point (struct gzs *g, store_offset_t out, store_offset_t in,
+	   int bits, unsigned char byte, const unsigned char *window,
+	   char *data, size_t len)
+{
+  struct point *p;
+  unsigned char *w = NULL;
+
+  if (window)
+    {
+      w = malloc (GZS_WINDOW);
+      if (! w)
+	{
+	  free (data);
+	  return ENOMEM;
+	}
+      memcpy (w, window, GZS_WINDOW);
+    }
+
+  pthread_mutex_lock (&g->lock);
+  if (g->num_points == g->points_alloced)
+    {
+      size_t n = g->points_alloced ? 2 * g->points_alloced : 64;
+      p = realloc (g->points, n * sizeof *p);
+      if (! p)
+	{
+	  pthread_mutex_unlock (&g->lock);
+	  free (w);
+	  free (data);
+	  return ENOMEM;
+	}
+      g->points = p;
+      g->points_alloced = n;
+    }
+  p = &g->points[g->num_points++];
+  p->out = out;
+  p->in = in;
+  p->bits = bits;
+  p->byte = byte;
+  p->window = w;
+  if (g->num_points > 1)
+    add_chunk (g, g->num_points - 2, data, len);
+  else
+    free (data);
+  pthread_cond_broadcast (&g->wakeup);
+  pthread_mutex_unlock (&g->lock);
+  return 0;
+}
+
+/* Whether the input at IN_OFFS of FROM, with BUF & LEN ahead of it,
+   starts another gzip member.  */
+static int
+another_member (struct store *from, const unsigned char *buf, size_t len,
+		store_offset_t in_offs)
+{
+  unsigned char magic[2];
+  size_t n;
+
+  if (len >= 2)
+    return buf[0] == 0x1f && buf[1] == 0x8b;
+  if (len == 1)
+    {
+      magic[0] = buf[0];
+      if (read_in (from, in_offs, magic + 1, 1, &n) || n < 1)
+	return 0;
+    }
+  else if (read_in (from, in_offs, magic, 2, &n) || n < 2)
+    return 0;
+  return magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+/* Go through all of the input once, noting restart points.  */
+static void *
+indexer (void *arg)
+{
+  struct store *store = arg;
+  struct store *from = store->children[0];
+  struct gzs *g = store->hook;
+  z_stream strm;
+  unsigned char *in;
+  store_offset_t in_offs = 0, total = 0;
+  char *data = NULL;
+  size_t len = 0, alloced = 0;
+  int new_member = 1;
+  error_t err = 0;
+  int ret;
+
+  in = malloc (GZS_IN_SIZE);
+  memset (&strm, 0, sizeof strm);
+  if (! in || inflateInit2 (&strm, 32 + MAX_WBITS) != Z_OK)
+    {
+      free (in);
+      pthread_mutex_lock (&g->lock);
+      g->index_err = ENOMEM;
+      pthread_cond_broadcast (&g->wakeup);
+      pthread_mutex_unlock (&g->lock);
+      return NULL;
+    }
+
+  while (! err && ! __atomic_load_n (&g->stopping, __ATOMIC_RELAXED))
+    {
+      size_t before;
+
+      if (strm.avail_in == 0)
+	{
+	  size_t n;
+	  err = read_in (from, in_offs, in, GZS_IN_SIZE, &n);
+	  if (! err && n == 0)
+	    err = EIO;
+	  if (err)
+	    break;
+	  in_offs += n;
+	  strm.next_in = in;
+	  strm.avail_in = n;
+	}
+
+      if (alloced - len < GZS_WINDOW)
+	{
+	  size_t n = alloced ? 2 * alloced : 2 * GZS_SPAN;
+	  char *new = realloc (data, n);
+	  if (! new)
+	    {
+	      err = ENOMEM;
+	      break;
+	    }
+	  data = new;
+	  alloced = n;
+	}
+      strm.next_out = (unsigned char *) data + len;
+      strm.avail_out = alloced - len;
+
+      before = strm.avail_out;
+      ret = inflate (&strm, Z_BLOCK);
+      len += before - strm.avail_out;
+      total += before - strm.avail_out;
+
+      if (ret == Z_STREAM_END)
+	{
+	  /* gzip members may follow one another; anything else is
+	     padding.  */
+	  if (! another_member (from, strm.next_in, strm.avail_in, in_offs))
+	    break;
+	  inflateReset (&strm);
+	  new_member = 1;
+	  continue;
+	}
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+	{
+	  err = ret == Z_MEM_ERROR ? ENOMEM : EIO;
+	  break;
+	}
+
+      /* At the end of a header or of a block that isn't the last one.
+	 The first block of a member doesn't refer to what went before,
+	 and so needs no window.  */
+      if ((strm.data_type & 128) && ! (strm.data_type & 64)
+	  && (new_member || len >= GZS_SPAN))
+	{
+	  int bits = strm.data_type & 7;
+	  err = add_point (g, total, in_offs - strm.avail_in, bits,
+			   bits ? strm.next_in[-1] : 0,
+			   new_member
+			   ? NULL : (unsigned char *) data + len - GZS_WINDOW,
+			   data, len);
+	  data = NULL;
+	  len = alloced = 0;
+	  new_member = 0;
+	}
+    }
+
+  inflateEnd (&strm);
+  free (in);
+
+  pthread_mutex_lock (&g->lock);
+  if (err)
+    g->index_err = err;
+  else if (! __atomic_load_n (&g->stopping, __ATOMIC_RELAXED))
+    {
+      if (g->num_points > 0)
+	add_chunk (g, g->num_points - 1, data, len);
+      else
+	free (data);
+      data = NULL;
+      g->out_total = total;
+      g->indexed = 1;
+    }
+  pthread_cond_broadcast (&g->wakeup);
+  pthread_mutex_unlock (&g->lock);
+  free (data);
+  return NULL;
+}
+
+/* A read of several chunks, shared by the threads doing it.  */
+struct gzs_read
+{
+  struct store *store;
+  store_offset_t offs, pos, end;
+  char *buf;
+  error_t err;
+};
+
+/* Copy chunks of R until there are none left.  */
+static void *
+read_chunks (void *arg)
+{
+  struct gzs_read *r = arg;
+  struct gzs *g = r->store->hook;
+
+  pthread_mutex_lock (&g->lock);
+  while (r->pos < r->end && ! r->err)
+    {
+      store_offset_t cstart, start, end;
+      struct chunk *c;
+      size_t k;
+      error_t err = find_chunk (g, r->pos, &k);
+
+      if (! err)
+	{
+	  start = r->pos;
+	  cstart = g->points[k].out;
+	  end = chunk_end (g, k);
+	  if (end > r->end)
+	    end = r->end;
+	  r->pos = end;
+	  err = get_chunk (r->store, k, &c);
+	}
+      if (err)
+	{
+	  if (! r->err)
+	    r->err = err;
+	  break;
+	}
+
+      pthread_mutex_unlock (&g->lock);
+      memcpy (r->buf + (start - r->offs), c->data + (start - cstart),
+	      end - start);
+      pthread_mutex_lock (&g->lock);
+      c->refs--;
+      pthread_cond_broadcast (&g->wakeup);
+    }
+  pthread_mutex_unlock (&g->lock);
+  return NULL;
+}
+
+static error_t
+gzs_read (struct store *store,
+	  store_offset_t addr, size_t index, size_t amount,
+	  void **buf, size_t *len)
+{
+  struct gzs_read r;
+  pthread_t threads[GZS_THREADS - 1];
+  int nthreads = 0;
+
+  r.store = store;
+  r.offs = r.pos = addr;
+  r.end = addr + amount;
+  r.err = 0;
+
+  if (*len < amount)
+    {
+      r.buf = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (r.buf == MAP_FAILED)
+	return errno;
+    }
+  else
+    r.buf = *buf;
+
+  /* Chunks are at least GZS_SPAN, so a read of fewer bytes than twice
+     that can't gain from more threads.  */
+  if (amount >= 2 * GZS_SPAN)
+    {
+      int want = amount / GZS_SPAN - 1;
+      if (want > GZS_THREADS - 1)
+	want = GZS_THREADS - 1;
+      while (nthreads < want
+	     && pthread_create (&threads[nthreads], NULL, read_chunks, &r) == 0)
+	nthreads++;
+    }
+  read_chunks (&r);
+  while (nthreads > 0)
+    pthread_join (threads[--nthreads], NULL);
+
+  if (r.err)
+    {
+      if (r.buf != *buf)
+	munmap (r.buf, amount);
+      return r.err;
+    }
+
+  *buf = r.buf;
+  *len = amount;
+  return 0;
+}
+
+static error_t
+gzs_write (struct store *store,
+	   store_offset_t addr, size_t index, const void *buf, size_t len,
+	   size_t *amount)
+{
+  return EROFS;
+}
+
+static error_t
+gzs_set_size (struct store *store, size_t newsize)
+{
+  return EOPNOTSUPP;
+}
+
+static void
+gzs_cleanup (struct store *store)
+{
+  struct gzs *g = store->hook;
+  size_t i;
+
+  if (! g)
+    return;
+
+  if (g->have_indexer)
+    {
+      __atomic_store_n (&g->stopping, 1, __ATOMIC_RELAXED);
+      pthread_join (g->indexer, NULL);
+    }
+
+  for (i = 0; i < g->num_points; i++)
+    free (g->points[i].window);
+  free (g->points);
+  for (i = 0; i < GZS_CACHE; i++)
+    free (g->cache[i].data);
+  pthread_cond_destroy (&g->wakeup);
+  pthread_mutex_destroy (&g->lock);
+  free (g);
+  store->hook = NULL;
+}
+
+static error_t
+gzs_clone (const struct store *from, struct store *to)
+{
+  return EOPNOTSUPP;
+}
+
+static error_t
+gzs_open (const char *name, int flags,
+	  const struct store_class *const *classes,
+	  struct store **store)
+{
+  return store_gzstream_open (name, flags, classes, store);
+}
+
+const struct store_class
+store_gzstream_class =
+{
+  -1, "gzstream", gzs_read, gzs_write, gzs_set_size,
+  0, 0, 0,
+  store_set_child_flags, store_clear_child_flags, gzs_cleanup, gzs_clone,
+  0, gzs_open
+};
+STORE_STD_CLASS (gzstream);
+
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM, which must hold gzip data, decompressing it as it is
+   read; FROM is consumed.  The size of the result is taken from the gzip
+   trailer, so it must be less than 4G, and FROM should hold a single gzip
+   member, as the trailer of the last one is all that is looked at.  */
+error_t
+store_gzstream_create (struct store *from, int flags, struct store **store)
+{
+  error_t err;
+  struct store_run run;
+  struct gzs *g;
+  unsigned char head[2], trailer[4];
+  size_t n;
+
+  err = read_in (from, 0, head, 2, &n);
+  if (! err && (n < 2 || head[0] != 0x1f || head[1] != 0x8b))
+    err = EINVAL;
+  if (! err && from->size < 18)
+    err = EINVAL;
+  if (! err)
+    err = read_in (from, from->size - 4, trailer, 4, &n);
+  if (! err && n < 4)
+    err = EIO;
+  if (err)
+    return err;
+
+  g = calloc (1, sizeof *g);
+  if (! g)
+    return ENOMEM;
+  g->size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+	    | ((store_offset_t) trailer[3] << 24);
+  pthread_mutex_init (&g->lock, NULL);
+  pthread_cond_init (&g->wakeup, NULL);
+
+  run.start = 0;
+  run.length = g->size;
+
+  err = _store_create (&store_gzstream_class, MACH_PORT_NULL,
+		       flags | STORE_HARD_READONLY | STORE_ENFORCED,
+		       1, &run, 1, 0, store);
+  if (err)
+    {
+      pthread_cond_destroy (&g->wakeup);
+      pthread_mutex_destroy (&g->lock);
+      free (g);
+      return err;
+    }
+  (*store)->hook = g;
+
+  err = store_set_children (*store, &from, 1);
+  if (! err)
+    {
+      size_t len = strlen (from->class->name) + 1
+		   + (from->name ? strlen (from->name) : 0) + 1;
+      (*store)->name = malloc (len);
+      if ((*store)->name)
+	snprintf ((*store)->name, len, "%s%s%s", from->class->name,
+		  from->name ? ":" : "", from->name ?: "");
+      else
+	err = ENOMEM;
+    }
+  if (! err)
+    {
+      err = pthread_create (&g->indexer, NULL, indexer, *store);
+      g->have_indexer = ! err;
+    }
+
+  if (err)
+    {
+      /* FROM is the caller's until it's our child.  */
+      if ((*store)->num_children > 0)
+	{
+	  (*store)->num_children = 0;
+	  free ((*store)->children);
+	  (*store)->children = NULL;
+	}
+      store_free (*store);
+    }
+
+  return err;
+}
+
+/* Open the gzstream store NAME -- which consists of another store-class
+   name, a ':', and a name for that store class to open -- and return the
+   corresponding store in STORE.  CLASSES is used to select classes
+   specified by the type name; if it is 0, STORE_STD_CLASSES is used.  */
+error_t
+store_gzstream_open (const char *name, int flags,
+		     const struct store_class *const *classes,
+		     struct store **store)
+{
+  struct store *from;
+  error_t err =
+    store_typed_open (name, flags | STORE_HARD_READONLY, classes, &from);
+
+  if (! err)
+    {
+      err = store_gzstream_create (from, flags, store);
+      if (err)
+	store_free (from);
+    }
+
+  return err;
+}
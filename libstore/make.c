@@ -58,6 +58,7 @@ _store_create (const struct store_class *class,
 	  new->hook = 0;
 	  new->children = 0;
 	  new->num_children = 0;
+	  new->run_ends = 0;
 
 	  new->class = class;
 
@@ -95,6 +96,7 @@ store_free (struct store *store)
     free (store->name);
   if (store->runs)
     free (store->runs);
+  free (store->run_ends);
 
   free (store);
 }
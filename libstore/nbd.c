@@ -29,34 +29,54 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 
 // Avoid dragging in the resolver when linking statically.
 #pragma weak gethostbyname
 
 
-/* The nbd protocol, such as it is, is not really specified anywhere.
-   These message layouts and constants were culled from the nbd-server and
-   Linux kernel nbd module sources.  */
+/* The nbd protocol is specified in the nbd-server sources, in
+   doc/proto.md.  Both the oldstyle handshake and the fixed newstyle one
+   are understood; with the latter, the default export is used.  */
 
-#define NBD_INIT_MAGIC		"NBDMAGIC\x00\x00\x42\x02\x81\x86\x12\x53"
+#define NBD_INIT_MAGIC		"NBDMAGIC"
+#define NBD_OLDSTYLE_MAGIC	"\x00\x00\x42\x02\x81\x86\x12\x53"
+#define NBD_OPTS_MAGIC		"IHAVEOPT"
 
 #define NBD_REQUEST_MAGIC	(htonl (0x25609513))
 #define NBD_REPLY_MAGIC		(htonl (0x67446698))
 
-#define NBD_IO_MAX		10240
+/* Handshake flags sent by the server, and those sent back by the client.  */
+#define NBD_FLAG_FIXED_NEWSTYLE	(1 << 0)
+#define NBD_FLAG_NO_ZEROES	(1 << 1)
 
-struct nbd_startup
-{
-  char magic[16];		/* NBD_INIT_MAGIC */
-  uint64_t size;		/* size in bytes, 64 bits in net order */
-  char reserved[128];		/* zeros, we don't check it */
-};
+#define NBD_OPT_EXPORT_NAME	1
+
+/* Transmission flags.  */
+#define NBD_FLAG_HAS_FLAGS	(1 << 0)
+#define NBD_FLAG_READ_ONLY	(1 << 1)
+#define NBD_FLAG_SEND_FLUSH	(1 << 2)
+#define NBD_FLAG_SEND_TRIM	(1 << 5)
+
+#define NBD_CMD_READ		0
+#define NBD_CMD_WRITE		1
+#define NBD_CMD_DISC		2
+#define NBD_CMD_FLUSH		3
+#define NBD_CMD_TRIM		4
+
+/* The largest amount of data read or written by a single request, and
+   the largest range trimmed by one.  */
+#define NBD_IO_MAX		(1024 * 1024)
+#define NBD_TRIM_MAX		(1024 * 1024 * 1024)
+
+/* How many requests a single call keeps outstanding at once.  */
+#define NBD_WINDOW		16
 
 struct nbd_request
 {
   uint32_t magic;		/* NBD_REQUEST_MAGIC */
-  uint32_t type;		/* 0 read, 1 write, 2 disconnect */
+  uint32_t type;		/* NBD_CMD_*, command flags in the high half */
   uint64_t handle;		/* returned in reply */
   uint64_t from;
   uint32_t len;
@@ -69,7 +89,36 @@ struct nbd_reply
   uint64_t handle;		/* value from request */
 } __attribute__ ((packed));
 
-
+/* A request whose reply has not been read yet.  */
+struct nbd_pending
+{
+  uint64_t handle;
+  int type;
+  char *data;			/* Where the data read goes.  */
+  size_t len;
+  int done;
+  error_t err;
+  struct nbd_pending *next;
+};
+
+/* The state of the connection to a server, shared by the clones of a
+   store.  Any number of threads send requests, each holding SEND_LOCK
+   for the whole of one; whichever of them waits for a reply first reads
+   the replies off the socket for all of them until its own comes.  */
+struct nbd_conn
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  pthread_mutex_t send_lock;
+  unsigned int refs;
+  unsigned int flags;		/* Transmission flags.  */
+  uint64_t next_handle;
+  struct nbd_pending *pending;
+  int reading;			/* Some thread is reading replies.  */
+  error_t err;			/* The connection is unusable.  */
+};
+
+
 /* i/o functions.  */
 
 #if BYTE_ORDER == BIG_ENDIAN
@@ -82,187 +131,340 @@ struct nbd_reply
 #endif
 #define ntohll htonll
 
+/* Read exactly LEN bytes from STORE's socket into BUF.  */
+static error_t
+read_all (struct store *store, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      char *data = buf;
+      mach_msg_type_number_t cc = len;
+      error_t err = io_read (store->port, &data, &cc, -1, len);
+      if (err)
+	return err;
+      if (cc == 0)
+	return EIO;
+      if (data != buf)
+	{
+	  memcpy (buf, data, cc);
+	  munmap (data, cc);
+	}
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
 
-static inline error_t
-read_reply (struct store *store, uint64_t handle)
+/* Write all the LEN bytes in BUF to STORE's socket.  */
+static error_t
+write_all (struct store *store, const void *buf, size_t len)
 {
-  struct nbd_reply reply;
-  char *buf = (void *) &reply;
-  mach_msg_type_number_t cc = sizeof reply;
-  error_t err = io_read (store->port, &buf, &cc, -1, cc);
-  if (err)
-    return err;
-  if (buf != (void *) &reply)
+  while (len > 0)
     {
-      memcpy (&reply, buf, sizeof reply);
-      munmap (buf, cc);
+      vm_size_t cc;
+      error_t err = io_write (store->port, (char *) buf, len, -1, &cc);
+      if (err)
+	return err;
+      if (cc == 0)
+	return EIO;
+      buf += cc;
+      len -= cc;
     }
-  if (cc != sizeof reply)
-    return EIO;
-  if (reply.magic != NBD_REPLY_MAGIC)
-    return EIO;
-  if (reply.handle != handle)
-    return EIO;
-  if (reply.error != 0)
-    return EIO;
   return 0;
 }
 
+/* Translate the error number ERROR of a reply, which has Linux values.  */
 static error_t
-nbd_write (struct store *store,
-	   store_offset_t addr, size_t index, const void *buf, size_t len,
-	   size_t *amount)
+reply_error (uint32_t error)
 {
-  struct nbd_request req =
-  {
-    magic: NBD_REQUEST_MAGIC,
-    type: htonl (1),		/* WRITE */
-  };
-  error_t err;
-  vm_size_t cc;
+  switch (ntohl (error))
+    {
+    case 0:	return 0;
+    case 1:	return EPERM;
+    case 12:	return ENOMEM;
+    case 22:	return EINVAL;
+    case 28:	return ENOSPC;
+    case 75:	return EOVERFLOW;
+    case 95:	return EOPNOTSUPP;
+    default:	return EIO;
+    }
+}
 
-  addr <<= store->log2_block_size;
-  *amount = 0;
+/* Mark every pending request of CONN as failed with ERR, which then
+   fails all the later ones too.  CONN is locked.  */
+static void
+conn_fail (struct nbd_conn *conn, error_t err)
+{
+  struct nbd_pending *p;
 
-  do
+  conn->err = err;
+  for (p = conn->pending; p; p = p->next)
     {
-      size_t chunk = len < NBD_IO_MAX ? len : NBD_IO_MAX, nwrote;
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+      p->done = 1;
+      p->err = err;
+    }
+  conn->pending = NULL;
+  pthread_cond_broadcast (&conn->wakeup);
+}
 
-      err = io_write (store->port, (char *) &req, sizeof req, -1, &cc);
-      if (err)
-	return err;
-      if (cc != sizeof req)
-	return EIO;
+/* Read one reply off STORE's socket and complete its request.  Called
+   with CONN locked and CONN->reading set.  */
+static void
+read_reply (struct store *store, struct nbd_conn *conn)
+{
+  struct nbd_reply reply;
+  struct nbd_pending *p, **pp;
+  error_t err;
 
-      nwrote = 0;
-      do
-	{
-	  err = io_write (store->port, (char *) buf, chunk - nwrote, -1, &cc);
-	  if (err)
-	    return err;
-	  buf += cc;
-	  nwrote += cc;
-	} while (nwrote < chunk);
+  pthread_mutex_unlock (&conn->lock);
+  err = read_all (store, &reply, sizeof reply);
+  pthread_mutex_lock (&conn->lock);
+  if (! err && reply.magic != NBD_REPLY_MAGIC)
+    err = EIO;
+  if (err)
+    {
+      conn_fail (conn, err);
+      return;
+    }
 
-      err = read_reply (store, req.handle);
+  for (pp = &conn->pending; (p = *pp); pp = &p->next)
+    if (p->handle == reply.handle)
+      break;
+  if (! p)
+    {
+      /* A reply to nothing we asked; we can't find the next one.  */
+      conn_fail (conn, EIO);
+      return;
+    }
+  *pp = p->next;
+
+  p->err = reply_error (reply.error);
+  if (! p->err && p->type == NBD_CMD_READ)
+    {
+      /* Nobody else touches P until it is done, and nobody else reads
+	 the socket while we are reading.  */
+      pthread_mutex_unlock (&conn->lock);
+      err = read_all (store, p->data, p->len);
+      pthread_mutex_lock (&conn->lock);
       if (err)
-	return err;
+	{
+	  p->done = 1;
+	  p->err = err;
+	  conn_fail (conn, err);
+	  return;
+	}
+    }
+  p->done = 1;
+  pthread_cond_broadcast (&conn->wakeup);
+}
 
-      addr += chunk;
-      *amount += chunk;
-      len -= chunk;
-    } while (len > 0);
+/* Wait until the reply to P has been read, reading replies for other
+   threads meanwhile if nobody else is.  */
+static error_t
+wait_reply (struct store *store, struct nbd_pending *p)
+{
+  struct nbd_conn *conn = store->hook;
+  error_t err;
 
-  return 0;
+  pthread_mutex_lock (&conn->lock);
+  while (! p->done)
+    if (conn->reading)
+      pthread_cond_wait (&conn->wakeup, &conn->lock);
+    else
+      {
+	conn->reading = 1;
+	read_reply (store, conn);
+	conn->reading = 0;
+	pthread_cond_broadcast (&conn->wakeup);
+      }
+  err = p->err;
+  pthread_mutex_unlock (&conn->lock);
+  return err;
 }
 
+/* Send a request of TYPE for the LEN bytes at byte offset FROM, with the
+   data in DATA for a write, and make P wait for its reply, whose data,
+   for a read, goes to DATA.  If an error is returned, P is not pending.  */
 static error_t
-nbd_read (struct store *store,
-	  store_offset_t addr, size_t index, size_t amount,
-	  void **buf, size_t *len)
+send_request (struct store *store, struct nbd_pending *p, int type,
+	      uint64_t from, size_t len, void *data)
 {
+  struct nbd_conn *conn = store->hook;
   struct nbd_request req =
   {
     magic: NBD_REQUEST_MAGIC,
-    type: htonl (0),		/* READ */
+    type: htonl (type),
+    from: htonll (from),
+    len: htonl (len),
   };
   error_t err;
-  size_t ofs, chunk;
-  char *databuf, *piecebuf;
-  size_t databuflen;
-  mach_msg_type_number_t piecelen;
-
-  /* Send a request for the largest possible piece of remaining data and
-     read the first piece of its reply into PIECEBUF, PIECELEN.  The amount
-     requested can be found in CHUNK.  */
-  inline error_t request_chunk (char **buf, mach_msg_type_number_t *len)
-    {
-      vm_size_t cc;
-
-      chunk = (amount - ofs) < NBD_IO_MAX ? (amount - ofs) : NBD_IO_MAX;
 
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+  p->type = type;
+  p->data = data;
+  p->len = len;
+  p->done = 0;
+  p->err = 0;
 
-      /* Advance ADDR immediately, so it always points past what we've
-	 already requested.  */
-      addr += chunk;
-
-      return (io_write (store->port, (char *) &req, sizeof req, -1, &cc) ?
-	      : cc != sizeof req ? EIO
-	      : read_reply (store, req.handle) ?
-	      : io_read (store->port, buf, len, (off_t) -1, chunk));
+  /* The request must be pending before it is sent, lest its reply be
+     read before.  */
+  pthread_mutex_lock (&conn->lock);
+  err = conn->err;
+  if (! err)
+    {
+      p->handle = req.handle = conn->next_handle++;
+      p->next = conn->pending;
+      conn->pending = p;
     }
+  pthread_mutex_unlock (&conn->lock);
+  if (err)
+    return err;
 
-  addr <<= store->log2_block_size;
+  pthread_mutex_lock (&conn->send_lock);
+  err = write_all (store, &req, sizeof req);
+  if (! err && type == NBD_CMD_WRITE)
+    err = write_all (store, data, len);
+  pthread_mutex_unlock (&conn->send_lock);
 
-  /* Read the first piece, which can go directly into the caller's buffer.  */
-  databuf = *buf;
-  piecelen = databuflen = *len;
-  err = request_chunk (&databuf, &piecelen);
   if (err)
-    return err;
-  if (databuflen >= amount)
     {
-      /* That got it all.  We're done.  */
-      *buf = databuf;
-      *len = piecelen;
-      return 0;
+      /* Part of the request may have been sent, so the connection is of
+	 no more use.  */
+      pthread_mutex_lock (&conn->lock);
+      if (! p->done)
+	conn_fail (conn, err);
+      pthread_mutex_unlock (&conn->lock);
     }
+  return err;
+}
+
+/* Do requests of TYPE for the LEN bytes at byte offset ADDR, each for at
+   most MAX bytes, keeping up to NBD_WINDOW of them outstanding.  DATA is
+   the data written or the buffer read into, or zero.  Return in AMOUNT
+   how much was done before the first failure, and the error of that.  */
+static error_t
+transfer (struct store *store, int type, uint64_t addr, char *data,
+	  size_t len, size_t max, size_t *amount)
+{
+  struct nbd_pending window[NBD_WINDOW];
+  size_t sent = 0, waited = 0, ofs = 0;
+  error_t err = 0, first_err = 0;
+
+  *amount = 0;
 
-  /* We haven't read the entire amount yet.  */
-  ofs = 0;
-  do
+  /* Requests are sent and waited for in turn, so the requests done before
+     the first failure are those waited for before it.  */
+  while (waited < sent || (ofs < len && ! err))
     {
-      /* Account for what we just read.  */
-      ofs += piecelen;
-      chunk -= piecelen;
-      if (ofs == amount)
+      if (ofs < len && ! err && sent - waited < NBD_WINDOW)
 	{
-	  /* That got it all.  We're done.  */
-	  *buf = databuf;
-	  *len = ofs;
-	  return 0;
+	  size_t chunk = len - ofs < max ? len - ofs : max;
+	  err = send_request (store, &window[sent % NBD_WINDOW], type,
+			      addr + ofs, chunk, data ? data + ofs : 0);
+	  if (err)
+	    {
+	      if (! first_err)
+		first_err = err;
+	      continue;
+	    }
+	  sent++;
+	  ofs += chunk;
 	}
-
-      /* Now we'll read another piece of the data, hopefully
-	 into the latter part of the existing buffer.  */
-      piecebuf = databuf + ofs;
-      piecelen = databuflen - ofs;
-
-      if (chunk > 0)
-	/* We haven't finishing reading the last chunk we requested.  */
-	err = io_read (store->port, &piecebuf, &piecelen,
-		       (off_t) -1, chunk);
       else
-	/* Request the next chunk from the server.  */
-	err = request_chunk (&piecebuf, &piecelen);
-
-      if (!err && piecebuf != databuf + ofs)
 	{
-	  /* Now we have two discontiguous pieces of the buffer.  */
-	  size_t newbuflen = round_page (databuflen + piecelen);
-	  char *newbuf = mmap (0, newbuflen,
-			       PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (newbuf == MAP_FAILED)
+	  struct nbd_pending *p = &window[waited++ % NBD_WINDOW];
+	  error_t perr = wait_reply (store, p);
+	  if (perr)
 	    {
-	      err = errno;
-	      break;
+	      err = perr;
+	      if (! first_err)
+		first_err = perr;
 	    }
-	  memcpy (newbuf, databuf, ofs);
-	  memcpy (newbuf + ofs, piecebuf, piecelen);
-	  if (databuf != *buf)
-	    munmap (databuf, databuflen);
-	  databuf = newbuf;
-	  databuflen = newbuflen;
+	  else if (! first_err)
+	    *amount += p->len;
 	}
-    } while (! err);
+    }
 
-  if (databuf != *buf)
-    munmap (databuf, databuflen);
-  return err;
+  return first_err;
+}
+
+static error_t
+nbd_write (struct store *store,
+	   store_offset_t addr, size_t index, const void *buf, size_t len,
+	   size_t *amount)
+{
+  error_t err = transfer (store, NBD_CMD_WRITE,
+			  addr << store->log2_block_size,
+			  (char *) buf, len, NBD_IO_MAX, amount);
+  return *amount > 0 ? 0 : err;
+}
+
+static error_t
+nbd_read (struct store *store,
+	  store_offset_t addr, size_t index, size_t amount,
+	  void **buf, size_t *len)
+{
+  char *databuf = *buf;
+  size_t done;
+  error_t err;
+
+  /* Every reply is read straight into its place in the result.  */
+  if (*len < amount)
+    {
+      databuf = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (databuf == MAP_FAILED)
+	return errno;
+    }
+
+  err = transfer (store, NBD_CMD_READ, addr << store->log2_block_size,
+		  databuf, amount, NBD_IO_MAX, &done);
+  if (err && done == 0)
+    {
+      if (databuf != *buf)
+	munmap (databuf, amount);
+      return err;
+    }
+
+  if (databuf != *buf && round_page (done) < round_page (amount))
+    munmap (databuf + round_page (done),
+	    round_page (amount) - round_page (done));
+  *buf = databuf;
+  *len = done;
+  return 0;
+}
+
+/* Ask the server of STORE to write the data it caches to stable storage.  */
+error_t
+store_nbd_flush (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+  struct nbd_pending p;
+
+  if (store->class != &store_nbd_class)
+    return EINVAL;
+  if (! (conn->flags & NBD_FLAG_SEND_FLUSH))
+    return EOPNOTSUPP;
+
+  return send_request (store, &p, NBD_CMD_FLUSH, 0, 0, 0)
+    ?: wait_reply (store, &p);
+}
+
+/* Tell the server of STORE that the LEN bytes at the underlying address
+   ADDR need not be kept.  */
+error_t
+store_nbd_trim (struct store *store, store_offset_t addr, size_t len)
+{
+  struct nbd_conn *conn = store->hook;
+  size_t done, max;
+
+  if (store->class != &store_nbd_class)
+    return EINVAL;
+  if (! (conn->flags & NBD_FLAG_SEND_TRIM))
+    return EOPNOTSUPP;
+
+  /* Keep every request but the last a multiple of the block size.  */
+  max = NBD_TRIM_MAX - NBD_TRIM_MAX % store->block_size;
+  return transfer (store, NBD_CMD_TRIM, addr << store->log2_block_size, 0,
+		   len, max, &done);
 }
 
 static error_t
@@ -327,19 +529,118 @@ nbd_validate_name (const char *name,
   return 0;
 }
 
+/* Read exactly LEN bytes from SOCK into BUF.  */
+static error_t
+sock_read (int sock, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = read (sock, buf, len);
+      if (cc < 0)
+	return errno;
+      if (cc == 0)
+	return EGRATUITOUS;	/* ? */
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Write the LEN bytes in BUF to SOCK.  */
+static error_t
+sock_write (int sock, const void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = write (sock, buf, len);
+      if (cc < 0)
+	return errno;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Do the initial handshake with the server on SOCK, which tells us the
+   size of the store and its transmission flags.  */
+static error_t
+handshake (int sock, store_offset_t *size, unsigned int *tflags)
+{
+  char magic[16], zeroes[124];
+  uint64_t nsize;
+  error_t err;
+
+  err = sock_read (sock, magic, sizeof magic);
+  if (err)
+    return err;
+  if (memcmp (magic, NBD_INIT_MAGIC, 8) != 0)
+    return EGRATUITOUS;	/* ? */
+
+  if (memcmp (magic + 8, NBD_OLDSTYLE_MAGIC, 8) == 0)
+    {
+      /* The oldstyle startup packet: size, flags and zeroes.  */
+      uint32_t flags;
+      err = sock_read (sock, &nsize, sizeof nsize)
+	?: sock_read (sock, &flags, sizeof flags)
+	?: sock_read (sock, zeroes, sizeof zeroes);
+      if (err)
+	return err;
+      *tflags = ntohl (flags) & 0xffff;
+    }
+  else if (memcmp (magic + 8, NBD_OPTS_MAGIC, 8) == 0)
+    {
+      /* The newstyle one: we say which export we want and the server
+	 answers with its size and flags.  */
+      uint16_t hflags, flags;
+      uint32_t cflags;
+      struct
+      {
+	char magic[8];
+	uint32_t option;
+	uint32_t len;
+      } __attribute__ ((packed)) opt =
+      {
+	magic: NBD_OPTS_MAGIC,
+	option: htonl (NBD_OPT_EXPORT_NAME),
+	len: 0,			/* the default export */
+      };
+
+      err = sock_read (sock, &hflags, sizeof hflags);
+      if (err)
+	return err;
+      hflags = ntohs (hflags);
+      cflags = htonl (hflags & (NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES));
+
+      err = sock_write (sock, &cflags, sizeof cflags)
+	?: sock_write (sock, &opt, sizeof opt)
+	?: sock_read (sock, &nsize, sizeof nsize)
+	?: sock_read (sock, &flags, sizeof flags);
+      if (! err && ! (hflags & NBD_FLAG_NO_ZEROES))
+	err = sock_read (sock, zeroes, sizeof zeroes);
+      if (err)
+	return err;
+      *tflags = ntohs (flags);
+    }
+  else
+    return EGRATUITOUS;	/* ? */
+
+  if (! (*tflags & NBD_FLAG_HAS_FLAGS))
+    *tflags = 0;
+  *size = ntohll (nsize);
+  return 0;
+}
+
 static error_t
-nbdopen (const char *name, int *mod_flags,
-	 socket_t *sockport, size_t *blocksize, store_offset_t *size)
+nbdopen (const char *name, int *mod_flags, socket_t *sockport,
+	 size_t *blocksize, store_offset_t *size, unsigned int *tflags)
 {
   int sock;
   struct sockaddr_in sin;
   const struct hostent *he;
   char **ap;
-  struct nbd_startup ns;
-  ssize_t cc;
-  size_t ofs;
   unsigned long int port;
   char *hostname, *p, *endp;
+  error_t err;
 
   if (!strncmp (name, url_prefix, sizeof url_prefix - 1))
     name += sizeof url_prefix - 1;
@@ -398,27 +699,15 @@ nbdopen (const char *name, int *mod_flags,
       return err;
     }
 
-  /* Read the startup packet, which tells us the size of the store.  */
-  ofs = 0;
-  do {
-    cc = read (sock, (char *) &ns + ofs, sizeof ns - ofs);
-    if (cc < 0)
-      {
-	error_t err = errno;
-	close (sock);
-	return err;
-      }
-    ofs += cc;
-  } while (cc > 0 && ofs < sizeof ns);
-
-  if (ofs != sizeof ns
-      || memcmp (ns.magic, NBD_INIT_MAGIC, sizeof ns.magic) != 0)
+  err = handshake (sock, size, tflags);
+  if (err)
     {
       close (sock);
-      return EGRATUITOUS;	/* ? */
+      return err;
     }
+  if (*tflags & NBD_FLAG_READ_ONLY)
+    *mod_flags |= STORE_HARD_READONLY;
 
-  *size = ntohll (ns.size);
   *sockport = getdport (sock);
   close (sock);
 
@@ -428,21 +717,28 @@ nbdopen (const char *name, int *mod_flags,
 static void
 nbdclose (struct store *store)
 {
+  struct nbd_conn *conn = store->hook;
+
   if (store->port != MACH_PORT_NULL)
     {
       /* Send a disconnect message, but don't wait for a reply.  */
       struct nbd_request req =
       {
 	magic: NBD_REQUEST_MAGIC,
-	type: htonl (2),	/* disconnect */
+	type: htonl (NBD_CMD_DISC),
       };
-      vm_size_t cc;
-      (void) io_write (store->port, (char *) &req, sizeof req, -1, &cc);
+      pthread_mutex_lock (&conn->send_lock);
+      (void) write_all (store, &req, sizeof req);
+      pthread_mutex_unlock (&conn->send_lock);
 
       /* Close the socket.  */
       mach_port_deallocate (mach_task_self (), store->port);
       store->port = MACH_PORT_NULL;
     }
+
+  pthread_mutex_lock (&conn->lock);
+  conn_fail (conn, EIO);
+  pthread_mutex_unlock (&conn->lock);
 }
 
 static error_t
@@ -461,18 +757,47 @@ nbd_set_flags (struct store *store, int flags)
 static error_t
 nbd_clear_flags (struct store *store, int flags)
 {
+  struct nbd_conn *conn = store->hook;
   error_t err = 0;
   if ((flags & ~STORE_INACTIVE) != 0)
     err = EINVAL;
   err = store->name
-    ? nbdopen (store->name, &store->flags,
-	       &store->port, &store->block_size, &store->size)
+    ? nbdopen (store->name, &store->flags, &store->port,
+	       &store->block_size, &store->size, &conn->flags)
     : ENOENT;
   if (! err)
-    store->flags &= ~STORE_INACTIVE;
+    {
+      conn->err = 0;
+      store->flags &= ~STORE_INACTIVE;
+    }
   return err;
 }
 
+static void
+nbd_cleanup (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+
+  if (conn && __atomic_sub_fetch (&conn->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      pthread_mutex_destroy (&conn->lock);
+      pthread_cond_destroy (&conn->wakeup);
+      pthread_mutex_destroy (&conn->send_lock);
+      free (conn);
+    }
+}
+
+/* A clone talks over the same socket, so it must share its state.  */
+static error_t
+nbd_clone (const struct store *from, struct store *to)
+{
+  struct nbd_conn *conn = from->hook;
+
+  __atomic_add_fetch (&conn->refs, 1, __ATOMIC_RELAXED);
+  to->hook = conn;
+  return 0;
+}
+
 const struct store_class store_nbd_class =
 {
   STORAGE_NETWORK, "nbd",
@@ -485,6 +810,7 @@ const struct store_class store_nbd_class =
   encode: store_std_leaf_encode,
   decode: nbd_decode,
   set_flags: nbd_set_flags, clear_flags: nbd_clear_flags,
+  cleanup: nbd_cleanup, clone: nbd_clone,
 };
 STORE_STD_CLASS (nbd);
 
@@ -495,8 +821,24 @@ _store_nbd_create (mach_port_t port, int flags, size_t block_size,
 		   const struct store_run *runs, size_t num_runs,
 		   struct store **store)
 {
-  return _store_create (&store_nbd_class,
-			port, flags, block_size, runs, num_runs, 0, store);
+  struct nbd_conn *conn;
+  error_t err;
+
+  conn = calloc (1, sizeof *conn);
+  if (! conn)
+    return ENOMEM;
+  pthread_mutex_init (&conn->lock, NULL);
+  pthread_cond_init (&conn->wakeup, NULL);
+  pthread_mutex_init (&conn->send_lock, NULL);
+  conn->refs = 1;
+
+  err = _store_create (&store_nbd_class,
+		       port, flags, block_size, runs, num_runs, 0, store);
+  if (err)
+    free (conn);
+  else
+    (*store)->hook = conn;
+  return err;
 }
 
 /* Open a new store backed by the named nbd server.  */
@@ -507,15 +849,17 @@ store_nbd_open (const char *name, int flags, struct store **store)
   socket_t sock;
   struct store_run run;
   size_t blocksize;
+  unsigned int tflags;
 
   run.start = 0;
-  err = nbdopen (name, &flags, &sock, &blocksize, &run.length);
+  err = nbdopen (name, &flags, &sock, &blocksize, &run.length, &tflags);
   if (!err)
     {
       run.length /= blocksize;
       err = _store_nbd_create (sock, flags, blocksize, &run, 1, store);
       if (! err)
 	{
+	  ((struct nbd_conn *) (*store)->hook)->flags = tflags;
 	  if (!strncmp (name, url_prefix, sizeof url_prefix - 1))
 	    err = store_set_name (*store, name);
 	  else
@@ -19,6 +19,7 @@
    59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
 #include <string.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #include "store.h"
@@ -44,9 +45,30 @@ store_find_first_run (struct store *store, store_offset_t addr,
   else
     *base = 0;
 
-  /* XXX: this isn't going to be very efficient if RUNS is very complex...
-     But it should do dandy if it's short.  For long run lists, we could do a
-     binary search or something.  */
+  if (store->run_ends)
+    /* Find the first run that ends after ADDR.  */
+    {
+      const store_offset_t *ends = store->run_ends;
+      size_t lo = 0, hi = store->num_runs;
+
+      while (lo < hi)
+	{
+	  size_t mid = (lo + hi) / 2;
+	  if (ends[mid] > addr)
+	    hi = mid;
+	  else
+	    lo = mid + 1;
+	}
+      if (lo == store->num_runs)
+	return -1;
+
+      *run = tail + lo;
+      *runs_end = tail_end;
+      *index = lo;
+      return addr - (lo > 0 ? ends[lo - 1] : 0);
+    }
+
+  /* Short run lists are quicker to walk.  */
   while (tail < tail_end)
     {
       store_offset_t run_blocks = tail->length;
@@ -89,6 +111,193 @@ store_next_run (struct store *store, struct store_run *runs_end,
     return 1;
 }
 
+/* Requests of at least this many bytes to an interleaved or
+   concatenated store that span more than one run are done with each
+   child store accessed by a thread of its own, so that the children
+   work concurrently.  */
+#define PARALLEL_MIN (64 * 1024)
+
+static inline int
+parallel_ok (struct store *store, size_t amount)
+{
+  return (amount >= PARALLEL_MIN
+	  && (store->class == &store_ileave_class
+	      || store->class == &store_concat_class));
+}
+
+/* The part of a request within one run.  */
+struct segment
+{
+  store_offset_t addr;		/* The address for the class method.  */
+  size_t index;			/* The run, and thus the child.  */
+  size_t offset;		/* Where it is in the whole request.  */
+  size_t len;
+  size_t done;			/* How much of it was done.  */
+  error_t err;
+};
+
+/* The segments of a request that go to run INDEX, done in order.  */
+struct child_io
+{
+  struct store *store;
+  size_t index;
+  struct segment *segs;
+  size_t num_segs;
+  void *buf;			/* For a read.  */
+  const void *wbuf;		/* For a write.  */
+};
+
+/* Return in SEGS and NUM_SEGS the segments of a request for AMOUNT bytes
+   to STORE, starting ADDR blocks into RUN, as found by
+   store_find_first_run.  The request stops short at a hole.  */
+static error_t
+split_request (struct store *store, store_offset_t addr, size_t amount,
+	       struct store_run *run, struct store_run *runs_end,
+	       store_offset_t base, size_t index,
+	       struct segment **segs, size_t *num_segs)
+{
+  int block_shift = store->log2_block_size;
+  size_t n = 0, alloced = 0, offset = 0;
+  struct segment *s = NULL;
+
+  while (amount > 0 && run->start >= 0)
+    {
+      size_t len = (run->length - addr) << block_shift;
+      if (len > amount)
+	len = amount;
+
+      if (n == alloced)
+	{
+	  struct segment *new;
+	  alloced = alloced ? 2 * alloced : 2 * store->num_runs;
+	  new = realloc (s, alloced * sizeof *s);
+	  if (! new)
+	    {
+	      free (s);
+	      return ENOMEM;
+	    }
+	  s = new;
+	}
+
+      s[n].addr = base + run->start + addr;
+      s[n].index = index;
+      s[n].offset = offset;
+      s[n].len = len;
+      s[n].done = 0;
+      s[n].err = 0;
+      n++;
+
+      offset += len;
+      amount -= len;
+      addr = 0;
+      if (amount > 0 && ! store_next_run (store, runs_end, &run, &base, &index))
+	break;
+    }
+
+  *segs = s;
+  *num_segs = n;
+  return 0;
+}
+
+/* Do the segments of IO, in order, until one fails or is cut short.  */
+static void *
+child_io (void *arg)
+{
+  struct child_io *io = arg;
+  struct store *store = io->store;
+  size_t i;
+
+  for (i = 0; i < io->num_segs; i++)
+    {
+      struct segment *seg = &io->segs[i];
+      if (seg->index != io->index)
+	continue;
+
+      if (io->wbuf)
+	seg->err = (*store->class->write) (store, seg->addr, seg->index,
+					   io->wbuf + seg->offset, seg->len,
+					   &seg->done);
+      else
+	{
+	  void *seg_buf = io->buf + seg->offset;
+	  size_t seg_len = seg->len;
+	  seg->err = (*store->class->read) (store, seg->addr, seg->index,
+					    seg->len, &seg_buf, &seg_len);
+	  if (! seg->err)
+	    {
+	      /* As in store_read, the data may have come elsewhere.  */
+	      if (seg_buf != io->buf + seg->offset)
+		{
+		  memcpy (io->buf + seg->offset, seg_buf, seg_len);
+		  munmap (seg_buf, seg_len);
+		}
+	      seg->done = seg_len;
+	    }
+	}
+
+      if (seg->err || seg->done < seg->len)
+	break;
+    }
+
+  return NULL;
+}
+
+/* Do the SEGS (NUM_SEGS of them) of a request to STORE, reading into BUF
+   or writing from WBUF, with a thread for each run they use.  Return the
+   amount done before the first segment that failed or was cut short,
+   and that segment's error in *ERR, if nothing was done.  */
+static size_t
+parallel_io (struct store *store, struct segment *segs, size_t num_segs,
+	     void *buf, const void *wbuf, error_t *err)
+{
+  struct child_io io[store->num_runs];
+  pthread_t threads[store->num_runs];
+  int started[store->num_runs];
+  size_t i, done = 0;
+
+  for (i = 0; i < store->num_runs; i++)
+    {
+      io[i].store = store;
+      io[i].index = i;
+      io[i].segs = segs;
+      io[i].num_segs = num_segs;
+      io[i].buf = buf;
+      io[i].wbuf = wbuf;
+      started[i] = 0;
+    }
+
+  /* The runs not used by the first segment get threads of their own;
+     that one is done by the calling thread.  */
+  for (i = 0; i < num_segs && i < store->num_runs; i++)
+    {
+      size_t index = segs[i].index;
+      if (index != segs[0].index && ! started[index])
+	started[index]
+	  = pthread_create (&threads[index], NULL, child_io, &io[index]) == 0;
+    }
+  child_io (&io[segs[0].index]);
+
+  for (i = 0; i < store->num_runs; i++)
+    if (started[i])
+      pthread_join (threads[i], NULL);
+    else if (i != segs[0].index)
+      /* No thread for it; do it here, then.  */
+      child_io (&io[i]);
+
+  *err = 0;
+  for (i = 0; i < num_segs; i++)
+    {
+      done += segs[i].done;
+      if (segs[i].err || segs[i].done < segs[i].len)
+	{
+	  if (done == 0)
+	    *err = segs[i].err;
+	  break;
+	}
+    }
+  return done;
+}
+
 /* Write LEN bytes from BUF to STORE at ADDR.  Returns the amount written
    in AMOUNT.  ADDR is in BLOCKS (as defined by STORE->block_size).  */
 error_t
@@ -117,6 +326,20 @@ store_write (struct store *store,
   else if ((len >> block_shift) <= run->length - addr)
     /* The first run has it all... */
     err = (*write)(store, base + run->start + addr, index, buf, len, amount);
+  else if (parallel_ok (store, len))
+    /* Write each child's segments concurrently.  */
+    {
+      struct segment *segs;
+      size_t num_segs;
+
+      err = split_request (store, addr, len, run, runs_end, base, index,
+			   &segs, &num_segs);
+      if (! err)
+	{
+	  *amount = parallel_io (store, segs, num_segs, NULL, buf, &err);
+	  free (segs);
+	}
+    }
   else
     /* ARGH, we've got to split up the write ... */
     {
@@ -245,20 +468,38 @@ store_read (struct store *store,
 
       buf_end = whole_buf;
 
-      err = seg_read (base + run->start + addr,
-		      (run->length - addr) << block_shift, &all);
-      while (!err && all && amount > 0
-	     && store_next_run (store, runs_end, &run, &base, &index))
+      if (parallel_ok (store, amount))
+	/* Read each child's segments concurrently.  */
 	{
-	  if (run->start < 0)
-	    /* A hole!  Can't read here.  Must stop.  */
-	    break;
-	  else
-	    err = seg_read (base + run->start,
-			    (amount >> block_shift) <= run->length
-			    ? amount /* This run has the rest.  */
-			    : (run->length << block_shift), /* Whole run.  */
-			    &all);
+	  struct segment *segs;
+	  size_t num_segs;
+
+	  err = split_request (store, addr, amount, run, runs_end, base, index,
+			       &segs, &num_segs);
+	  if (! err)
+	    {
+	      buf_end += parallel_io (store, segs, num_segs, whole_buf, NULL,
+				      &err);
+	      free (segs);
+	    }
+	}
+      else
+	{
+	  err = seg_read (base + run->start + addr,
+			  (run->length - addr) << block_shift, &all);
+	  while (!err && all && amount > 0
+		 && store_next_run (store, runs_end, &run, &base, &index))
+	    {
+	      if (run->start < 0)
+		/* A hole!  Can't read here.  Must stop.  */
+		break;
+	      else
+		err = seg_read (base + run->start,
+				(amount >> block_shift) <= run->length
+				? amount /* This run has the rest.  */
+				: (run->length << block_shift), /* Whole run.  */
+				&all);
+	    }
 	}
 
       /* The actual amount read.  */
@@ -296,3 +537,54 @@ store_set_size (struct store *store, size_t newsize)
 
   return err;
 }
+
+/* Tell STORE that the LEN bytes at ADDR hold nothing worth keeping.
+   ADDR is in BLOCKS (as defined by STORE->block_size).  */
+error_t
+store_discard (struct store *store, store_offset_t addr, store_offset_t len)
+{
+  error_t err = 0;
+  size_t index;
+  store_offset_t base;
+  struct store_run *run, *runs_end;
+  int block_shift = store->log2_block_size;
+  store_discard_meth_t discard = store->class->discard;
+
+  if (! discard)
+    return EOPNOTSUPP;
+
+  if (store->flags & STORE_READONLY)
+    return EROFS;
+
+  if ((addr << block_shift) + len > store->size)
+    return EIO;
+
+  if (store->block_size != 0 && (len & (store->block_size - 1)) != 0)
+    return EINVAL;
+
+  addr = store_find_first_run (store, addr, &run, &runs_end, &base, &index);
+  if (addr < 0)
+    return EIO;
+
+  while (len > 0)
+    {
+      store_offset_t seg_len = (run->length - addr) << block_shift;
+      if (seg_len > len)
+	seg_len = len;
+
+      /* There is nothing to discard in a hole.  */
+      if (run->start >= 0)
+	{
+	  err = (*discard) (store, base + run->start + addr, index, seg_len);
+	  if (err)
+	    break;
+	}
+
+      len -= seg_len;
+      addr = 0;
+      if (len > 0 && ! store_next_run (store, runs_end, &run, &base, &index))
+	break;
+    }
+
+  return err;
+}
@@ -47,6 +47,13 @@ remap_set_size (struct store *store, size_t newsize)
   return store_set_size (store->children[0], newsize);
 }
 
+static error_t
+remap_discard (struct store *store,
+	       store_offset_t addr, size_t index, store_offset_t len)
+{
+  return store_discard (store->children[0], addr, len);
+}
+
 error_t
 remap_allocate_encoding (const struct store *store, struct store_enc *enc)
 {
@@ -210,7 +217,7 @@ store_remap_class =
   remap_allocate_encoding, remap_encode, remap_decode,
   store_set_child_flags, store_clear_child_flags,
   NULL, NULL, NULL,		/* cleanup, clone, remap */
-  remap_open, remap_validate_name
+  remap_open, remap_validate_name, NULL, remap_discard
 };
 STORE_STD_CLASS (remap);
 
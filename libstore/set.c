@@ -43,6 +43,9 @@ store_set_runs (struct store *store,
   store->runs = copy;
   store->num_runs = num_runs;
 
+  free (store->run_ends);
+  store->run_ends = 0;
+
   if (store->block_size > 0)
     _store_derive (store);
 
@@ -100,6 +100,11 @@ struct store
   size_t num_children;
 
   void *hook;			/* Type specific noise.  */
+
+  /* If RUNS is long, the offset in blocks at which each run ends, so that
+     the run holding an address can be found by binary search; NULL
+     otherwise.  Malloced, and kept up to date by _store_derive.  */
+  store_offset_t *run_ends;
 };
 
 /* Store flags.  These are in addition to the STORAGE_ flags defined in
@@ -135,6 +140,9 @@ typedef error_t (*store_read_meth_t)(struct store *store,
 				     void **buf, size_t *len);
 typedef error_t (*store_set_size_meth_t)(struct store *store,
 					 size_t newsize);
+typedef error_t (*store_discard_meth_t)(struct store *store,
+					store_offset_t addr, size_t index,
+					store_offset_t len);
 
 struct store_enc;		/* fwd decl */
 
@@ -207,6 +215,11 @@ struct store_class
 
   /* Return a memory object paging on STORE.  */
   error_t (*map) (const struct store *store, vm_prot_t prot, mach_port_t *memobj);
+
+  /* Tell the storage that the LEN bytes at the underlying address ADDR
+     need not be kept.  INDEX varies from 0 to the number of runs in
+     STORE.  */
+  store_discard_meth_t discard;
 };
 
 /* Return a new store in STORE, which refers to the storage underlying
@@ -319,6 +332,13 @@ error_t store_read (struct store *store,
 /* Set STORE's size to NEWSIZE (in bytes).  */
 error_t store_set_size (struct store *store, size_t newsize);
 
+/* Tell STORE that the LEN bytes at ADDR hold nothing worth keeping, so
+   that the device underneath may reclaim the space; reading them back
+   afterwards may return anything.  ADDR is in BLOCKS (as defined by
+   STORE->block_size).  Returns EOPNOTSUPP if STORE can't do this.  */
+error_t store_discard (struct store *store,
+		       store_offset_t addr, store_offset_t len);
+
 /* If STORE was created using store_create, remove the reference to the
    source from which it was created.  */
 void store_close_source (struct store *store);
@@ -414,6 +434,15 @@ error_t _store_nbd_create (mach_port_t port, int flags, size_t block_size,
 			   const struct store_run *runs, size_t num_runs,
 			   struct store **store);
 
+/* Ask the nbd server of STORE to write any data it caches to stable
+   storage.  Returns EOPNOTSUPP if the server doesn't support it.  */
+error_t store_nbd_flush (struct store *store);
+
+/* Tell the nbd server of STORE that the LEN bytes at the underlying
+   address ADDR need not be kept.  Returns EOPNOTSUPP if the server
+   doesn't support it.  */
+error_t store_nbd_trim (struct store *store, store_offset_t addr, size_t len);
+
 /* Return a new store of type "unknown" that holds a copy of the
    given encoding.  The name of the store is taken from ENC->data.
    Future calls to store_encode/store_return will produce exactly
@@ -466,6 +495,27 @@ error_t store_copy_open (const char *name, int flags,
 			 const struct store_class *const *classes,
 			 struct store **store);
 
+/* Return a new store in STORE that keeps up to SIZE bytes of the store FROM
+   in memory; FROM is consumed.  If FLUSH_SECS is negative, writes go
+   straight to FROM; otherwise they are kept until the data is replaced,
+   store_cache_flush is called or the store is made inactive or freed,
+   and if FLUSH_SECS is positive, at most that many seconds.  */
+error_t store_cache_create (struct store *from, size_t size, int flush_secs,
+			    int flags, struct store **store);
+
+/* Open the cache store NAME -- which consists of an optional size and
+   flush interval, "SIZE[,SECS]:", followed by another store-class name, a
+   ':', and a name for that store class to open -- and return the
+   corresponding store in STORE.  CLASSES is as if passed to
+   store_find_class, which see.  */
+error_t store_cache_open (const char *name, int flags,
+			  const struct store_class *const *classes,
+			  struct store **store);
+
+/* Write any data the cache store STORE holds that its child hasn't got
+   yet to the child.  */
+error_t store_cache_flush (struct store *store);
+
 /* Return a new store in STORE which contains the memory buffer BUF, of
    length BUF_LEN.  BUF must be vm_allocated, and will be consumed.  */
 error_t store_buffer_create (void *buf, size_t buf_len, int flags,
@@ -485,6 +535,22 @@ error_t store_gunzip_open (const char *name, int flags,
 			   const struct store_class *const *classes,
 			   struct store **store);
 
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM, which must hold gzip data, decompressing it as it is
+   read; FROM is consumed.  The size of the result is taken from the gzip
+   trailer, so it must be less than 4G, and FROM should hold a single gzip
+   member, as the trailer of the last one is all that is looked at.  */
+error_t store_gzstream_create (struct store *from, int flags,
+			       struct store **store);
+
+/* Open the gzstream store NAME -- which consists of another store-class
+   name, a ':', and a name for that store class to open -- and return the
+   corresponding store in STORE.  CLASSES is as if passed to
+   store_find_class, which see.  */
+error_t store_gzstream_open (const char *name, int flags,
+			     const struct store_class *const *classes,
+			     struct store **store);
+
 /* Return a new store in STORE which contains a snapshot of the uncompressed
    contents of the store FROM; FROM is consumed.  BLOCK_SIZE is the desired
    block size of the result.  */
@@ -622,7 +688,9 @@ extern const struct store_class store_concat_class;
 extern const struct store_class store_remap_class;
 extern const struct store_class store_query_class;
 extern const struct store_class store_copy_class;
+extern const struct store_class store_cache_class;
 extern const struct store_class store_gunzip_class;
+extern const struct store_class store_gzstream_class;
 extern const struct store_class store_bunzip2_class;
 extern const struct store_class store_typed_open_class;
 extern const struct store_class store_url_open_class;
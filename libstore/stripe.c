@@ -57,6 +57,14 @@ stripe_write (struct store *store,
     store_write (stripe, addr_adj (addr, store, stripe), buf, len, amount);
 }
 
+static error_t
+stripe_discard (struct store *store,
+		store_offset_t addr, size_t index, store_offset_t len)
+{
+  struct store *stripe = store->children[index];
+  return store_discard (stripe, addr_adj (addr, store, stripe), len);
+}
+
 error_t
 stripe_set_size (struct store *store, size_t newsize)
 {
@@ -113,7 +121,8 @@ store_ileave_class =
 {
   STORAGE_INTERLEAVE, "interleave", stripe_read, stripe_write, stripe_set_size,
   ileave_allocate_encoding, ileave_encode, ileave_decode,
-  store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap
+  store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap,
+  0, 0, 0, stripe_discard
 };
 STORE_STD_CLASS (ileave);
 
@@ -158,7 +167,7 @@ store_concat_class =
   STORAGE_CONCAT, "concat", stripe_read, stripe_write, stripe_set_size,
   concat_allocate_encoding, concat_encode, concat_decode,
   store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap,
-  store_concat_open
+  store_concat_open, 0, 0, stripe_discard
 };
 STORE_STD_CLASS (concat);
 
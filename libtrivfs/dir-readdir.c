@@ -30,3 +30,22 @@ trivfs_S_dir_readdir (struct trivfs_protid *cred,
 {
   return cred ? ENOTDIR : EOPNOTSUPP;
 }
+
+kern_return_t
+trivfs_S_dir_readdir_plus (struct trivfs_protid *cred,
+			   mach_port_t reply, mach_msg_type_name_t reply_type,
+			   data_t *data,
+			   size_t *datalen,
+			   boolean_t *data_dealloc,
+			   data_t *stats,
+			   size_t *statslen,
+			   boolean_t *stats_dealloc,
+			   int entry,
+			   int nentries,
+			   vm_size_t bufsiz,
+			   int *amount)
+{
+  /* Translators that implement dir_readdir themselves can't be served
+     by this, so send clients to dir_readdir.  */
+  return EOPNOTSUPP;
+}
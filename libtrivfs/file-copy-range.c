@@ -0,0 +1,30 @@
+/* libtrivfs implementation of fs.defs: file_copy_range
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "priv.h"
+#include "trivfs_fs_S.h"
+
+kern_return_t
+trivfs_S_file_copy_range (struct trivfs_protid *cred,
+			  mach_port_t reply, mach_msg_type_name_t reply_type,
+			  off_t in_offset, struct trivfs_protid *target,
+			  off_t out_offset, off_t length, off_t *copied)
+{
+  return EOPNOTSUPP;
+}
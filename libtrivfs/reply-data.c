@@ -0,0 +1,185 @@
+/* Room for the data of replies such as io_read's.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Data too big for the buffer MIG offers goes out of line, and as the
+   RPCs deallocate it, the kernel moves its pages to the client instead
+   of copying them.  So the memory cannot be used again; but it can be
+   allocated a reserve at a time, so that most replies need no call to
+   allocate it.  The reserve's pages are only zero-fill memory until a
+   reply is written in them.  */
+
+#include "priv.h"
+#include <string.h>
+
+/* How big a reserve each thread takes at a time; a reply is given
+   memory of its own if it would need more than half of it.  */
+#define RESERVE_SIZE (64 * vm_page_size)
+
+/* From how many whole pages on it is worth sharing them copy-on-write
+   with vm_copy rather than copying them.  */
+#define SHARE_MIN_PAGES 4
+
+struct reserve
+{
+  vm_address_t next, end;
+};
+
+static __thread struct reserve reserve;
+
+static pthread_key_t reserve_key;
+static pthread_once_t reserve_key_once = PTHREAD_ONCE_INIT;
+
+/* Give back what is left of the reserve of a thread that exits.  */
+static void
+free_reserve (void *arg)
+{
+  struct reserve *r = arg;
+
+  if (r->end > r->next)
+    vm_deallocate (mach_task_self (), r->next, r->end - r->next);
+  r->next = r->end = 0;
+}
+
+static void
+create_reserve_key (void)
+{
+  pthread_key_create (&reserve_key, free_reserve);
+}
+
+/* Return in *ADDR SIZE bytes of zero-fill memory, SIZE being a multiple
+   of the page size.  */
+static error_t
+take_pages (vm_address_t *addr, vm_size_t size)
+{
+  error_t err;
+
+  if (size > RESERVE_SIZE / 2)
+    {
+      *addr = 0;
+      return vm_allocate (mach_task_self (), addr, size, 1);
+    }
+
+  if (reserve.end - reserve.next < size)
+    {
+      vm_address_t new = 0;
+
+      err = vm_allocate (mach_task_self (), &new, RESERVE_SIZE, 1);
+      if (err)
+	return err;
+
+      pthread_once (&reserve_key_once, create_reserve_key);
+      if (reserve.end == 0)
+	/* This thread's first reserve.  */
+	pthread_setspecific (reserve_key, &reserve);
+      else if (reserve.end > reserve.next)
+	vm_deallocate (mach_task_self (), reserve.next,
+		       reserve.end - reserve.next);
+      reserve.next = new;
+      reserve.end = new + RESERVE_SIZE;
+    }
+
+  *addr = reserve.next;
+  reserve.next += size;
+  return 0;
+}
+
+error_t
+trivfs_get_reply_data (data_t *data, mach_msg_type_number_t *data_len,
+		       size_t amount)
+{
+  vm_address_t addr;
+  error_t err;
+
+  if (amount > *data_len)
+    {
+      err = take_pages (&addr, round_page (amount));
+      if (err)
+	return err;
+      *data = (data_t) addr;
+    }
+  *data_len = amount;
+  return 0;
+}
+
+error_t
+trivfs_reply_data_copy (data_t *data, mach_msg_type_number_t *data_len,
+			const void *buf, size_t amount)
+{
+  data_t inline_data = *data;
+  size_t shared = 0;
+  error_t err;
+
+  err = trivfs_get_reply_data (data, data_len, amount);
+  if (err)
+    return err;
+
+  if (*data != inline_data
+      && ((vm_address_t) buf & (vm_page_size - 1)) == 0
+      && amount >= SHARE_MIN_PAGES * vm_page_size)
+    {
+      shared = trunc_page (amount);
+      if (vm_copy (mach_task_self (), (vm_address_t) buf, shared,
+		   (vm_address_t) *data))
+	shared = 0;
+    }
+
+  /* The rest of the last page stays zero, so that nothing past BUF
+     leaks to the client.  */
+  memcpy (*data + shared, (const char *) buf + shared, amount - shared);
+  return 0;
+}
+
+error_t
+trivfs_reply_data_memobj (data_t *data, mach_msg_type_number_t *data_len,
+			  memory_object_t obj, vm_offset_t offset,
+			  size_t amount)
+{
+  vm_offset_t start = trunc_page (offset);
+  vm_size_t size = round_page (offset + amount) - start;
+  vm_address_t addr = 0;
+  error_t err;
+
+  if (amount == 0)
+    {
+      *data_len = 0;
+      return 0;
+    }
+
+  err = vm_map (mach_task_self (), &addr, size, 0, 1, obj, start, 1,
+		VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+		VM_INHERIT_NONE);
+  if (err)
+    return err;
+
+  if (offset != start || amount <= *data_len)
+    {
+      /* The reply cannot start a page, or fits in line anyway.  */
+      err = trivfs_reply_data_copy (data, data_len,
+				    (char *) addr + (offset - start), amount);
+      vm_deallocate (mach_task_self (), addr, size);
+      return err;
+    }
+
+  /* Send the copy-on-write mapping itself, with nothing of the object
+     past AMOUNT in it.  */
+  if (amount < size)
+    memset ((char *) addr + amount, 0, size - amount);
+  *data = (data_t) addr;
+  *data_len = amount;
+  return 0;
+}
@@ -238,6 +238,32 @@ error_t trivfs_set_atime (struct trivfs_control *cntl);
 /* Call this to set mtime for the node to the current time. */
 error_t trivfs_set_mtime (struct trivfs_control *cntl);
 
+/* Make room for AMOUNT bytes of data in the reply to an RPC like
+   io_read, whose out data is deallocated once sent.  *DATA and *DATA_LEN
+   are the buffer MIG passed, which is used if it is big enough; else
+   *DATA is set to whole pages of memory, taken from a reserve that each
+   thread keeps, that the reply moves to the client without copying.
+   *DATA_LEN is set to AMOUNT.  If the RPC then fails, memory that was
+   not MIG's buffer must be freed with munmap.  */
+error_t trivfs_get_reply_data (data_t *data,
+			       mach_msg_type_number_t *data_len,
+			       size_t amount);
+
+/* Like trivfs_get_reply_data, and copy the AMOUNT bytes at BUF to the
+   room made.  If BUF starts a page, its whole pages are shared
+   copy-on-write rather than copied.  */
+error_t trivfs_reply_data_copy (data_t *data,
+				mach_msg_type_number_t *data_len,
+				const void *buf, size_t amount);
+
+/* Like trivfs_reply_data_copy, for the AMOUNT bytes at OFFSET in the
+   memory object OBJ.  If OFFSET starts a page, the reply is a
+   copy-on-write mapping of the object, so that nothing is copied.  */
+error_t trivfs_reply_data_memobj (data_t *data,
+				  mach_msg_type_number_t *data_len,
+				  memory_object_t obj, vm_offset_t offset,
+				  size_t amount);
+
 /* If this is defined or set to an argp structure, it will be used by the
    default trivfs_set_options to handle runtime options parsing.  Redefining
    this is the normal way to add option parsing to a trivfs program.  */
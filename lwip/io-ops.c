@@ -39,14 +39,12 @@ lwip_S_io_write (struct sock_user *user,
 		 off_t offset, vm_size_t * amount)
 {
   int sent;
-  int sockflags;
 
   if (!user)
     return EOPNOTSUPP;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
   sent = lwip_send (user->sock->sockno, data, datalen,
-		    (sockflags & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+		    sock_io_flags (user->sock, 0));
 
   if (sent >= 0)
     {
@@ -63,7 +61,6 @@ lwip_S_io_read (struct sock_user * user,
 {
   error_t err;
   int alloced = 0;
-  int flags;
 
   if (!user)
     return EOPNOTSUPP;
@@ -81,11 +78,8 @@ lwip_S_io_read (struct sock_user * user,
       alloced = 1;
     }
 
-  /* Get flags */
-  flags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
-
   err = lwip_recv (user->sock->sockno, *data, amount,
-		   (flags & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+		   sock_io_flags (user->sock, 0));
 
   if (err < 0)
     {
@@ -129,17 +123,10 @@ lwip_S_io_readable (struct sock_user * user, vm_size_t * amount)
 error_t
 lwip_S_io_set_all_openmodes (struct sock_user * user, int bits)
 {
-  int opt;
-
   if (!user)
     return EOPNOTSUPP;
 
-  if (bits & O_NONBLOCK)
-    opt = 1;
-  else
-    opt = 0;
-
-  lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
+  sock_set_nonblock (user->sock, bits & O_NONBLOCK);
 
   return errno;
 }
@@ -162,10 +149,7 @@ lwip_S_io_set_some_openmodes (struct sock_user * user, int bits)
     return EOPNOTSUPP;
 
   if (bits & O_NONBLOCK)
-    {
-      int opt = 1;
-      lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
-    }
+    sock_set_nonblock (user->sock, 1);
 
   return errno;
 }
@@ -178,10 +162,7 @@ lwip_S_io_clear_some_openmodes (struct sock_user * user, int bits)
     return EOPNOTSUPP;
 
   if (bits & O_NONBLOCK)
-    {
-      int opt = 0;
-      lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
-    }
+    sock_set_nonblock (user->sock, 0);
 
   return errno;
 }
@@ -358,7 +339,7 @@ lwip_S_io_reauthenticate (struct sock_user * user, mach_port_t rend)
       }
 
   mach_port_move_member (mach_task_self (), newuser->pi.port_right,
-			 lwip_bucket->portset);
+			 ports_bucket_portset (lwip_bucket, &newuser->pi));
 
   ports_port_deref (newuser);
 
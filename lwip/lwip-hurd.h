@@ -58,6 +58,11 @@ struct socket
   int sockno;
   mach_port_t identity;
   refcount_t refcnt;
+
+  /* Whether the socket is in non-blocking mode, as last set by
+     sock_set_nonblock.  Kept here so that reads and writes need not
+     ask lwIP for it.  */
+  int nonblock;
 };
 
 /* Multiple sock_user's can point to the same socket. */
@@ -88,6 +93,13 @@ extern uid_t lwip_group;
 struct socket *sock_alloc (void);
 void sock_release (struct socket *);
 
+/* Put SOCK in non-blocking mode if ON is nonzero, and in blocking mode
+   otherwise.  Return 0 on success, -1 with errno set on failure.  */
+int sock_set_nonblock (struct socket *sock, int on);
+
+/* Return FLAGS with those a read or write on SOCK needs added.  */
+int sock_io_flags (struct socket *sock, int flags);
+
 void clean_addrport (void *);
 void clean_socketport (void *);
 
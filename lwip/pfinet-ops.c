@@ -123,3 +123,11 @@ lwip_S_pfinet_getroutes (io_t port,
 {
   return EOPNOTSUPP;
 }
+
+kern_return_t
+lwip_S_pfinet_getslabinfo (io_t port,
+			   data_t *info,
+			   mach_msg_type_number_t *len)
+{
+  return EOPNOTSUPP;
+}
@@ -84,6 +84,26 @@ sock_alloc (void)
   return sock;
 }
 
+int
+sock_set_nonblock (struct socket *sock, int on)
+{
+  int opt = on != 0;
+  int ret;
+
+  ret = lwip_ioctl (sock->sockno, FIONBIO, &opt);
+  if (ret == 0)
+    __atomic_store_n (&sock->nonblock, opt, __ATOMIC_RELAXED);
+  return ret;
+}
+
+int
+sock_io_flags (struct socket *sock, int flags)
+{
+  if (__atomic_load_n (&sock->nonblock, __ATOMIC_RELAXED))
+    flags |= MSG_DONTWAIT;
+  return flags;
+}
+
 /* This is called from the port cleanup function below, and on
    a newly allocated socket when something went wrong in its creation.  */
 void
@@ -27,10 +27,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <error.h>
 #include <device/device.h>
+#include <device/device_request.h>
 #include <device/net_status.h>
 #include <net/if.h>
 #include <net/if_arp.h>
@@ -45,6 +47,8 @@
 #include <lwip/etharp.h>
 #include <lwip/sockets.h>
 #include <lwip/inet.h>
+#include <lwip/tcpip.h>
+#include <netif/ethernet.h>
 
 /* Get the MAC address from an array of int */
 #define GET_HWADDR_BYTE(x,n)  (((char*)x)[n])
@@ -268,22 +272,31 @@ hurdethif_output (struct netif *netif, struct pbuf *p)
 {
   error_t err;
   hurdethif *ethif = netif_get_state (netif);
-  int count;
+  struct pbuf *frame = p;
   uint8_t tried;
 
   if (p->tot_len != p->len)
-    /* Drop the packet */
-    return ERR_OK;
+    {
+      /* The device takes a frame in one piece */
+      frame = pbuf_alloc (PBUF_RAW, p->tot_len, PBUF_RAM);
+      if (!frame)
+	return ERR_MEM;
+      if (pbuf_copy (frame, p) != ERR_OK)
+	{
+	  pbuf_free (frame);
+	  return ERR_MEM;
+	}
+    }
 
   tried = 0;
-  /* Send the data from the pbuf to the interface, one pbuf at a
-     time. The size of the data in each pbuf is kept in the ->len
-     variable. */
+  /* Only send the request: there is nothing to wait for, as the reply
+     would just tell that the driver took the whole frame. The data is
+     copied when the message is sent. */
   do
     {
       tried++;
-      err = device_write (ethif->ether_port, D_NOWAIT, 0,
-			  p->payload, p->len, &count);
+      err = device_write_request (ethif->ether_port, MACH_PORT_NULL,
+				  D_NOWAIT, 0, frame->payload, frame->len);
       if (err)
 	{
 	  if (tried == 2)
@@ -297,20 +310,21 @@ hurdethif_output (struct netif *netif, struct pbuf *p)
 	      hurdethif_device_open (netif);
 	    }
 	}
-      else if (count != p->len)
-	/* Incomplete package sent, reattempt */
-	err = -1;
     }
   while (err);
 
+  if (frame != p)
+    pbuf_free (frame);
+
   return ERR_OK;
 }
 
 /*
- * Called from the demuxer when incoming data is ready
+ * Copy the frame in MSG into a pbuf chain, or return NULL if the pool is
+ * exhausted
  */
-void
-hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
+static struct pbuf *
+hurdethif_pbuf (struct net_rcv_msg *msg)
 {
   struct pbuf *p, *q;
   uint16_t len;
@@ -363,49 +377,63 @@ hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
 	    q = q->next;
 	}
       while (1);
+    }
 
-      /* Pass the pbuf chain to he input function */
-      if (netif->input (p, netif) != ERR_OK)
-	{
-	  LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
-	  pbuf_free (p);
-	  p = NULL;
-	}
+  return p;
+}
+
+/*
+ * Called from the demuxer when incoming data is ready
+ */
+void
+hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
+{
+  struct pbuf *p = hurdethif_pbuf (msg);
+
+  /* Pass the pbuf chain to he input function */
+  if (p && netif->input (p, netif) != ERR_OK)
+    {
+      LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
+      pbuf_free (p);
     }
 }
 
-/* Demux incoming RPCs from the device */
-int
-hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
+/* Return the interface whose read port received INP, or NULL if none */
+static struct netif *
+hurdethif_find_netif (mach_msg_header_t * inp)
 {
-  struct net_rcv_msg *msg = (struct net_rcv_msg *) inp;
   struct netif *netif;
-  mach_port_t local_port;
-
-  if (inp->msgh_id != NET_RCV_MSG_ID)
-    return 0;
 
+  /* libports makes the address of the port structure the payload */
   if (MACH_MSGH_BITS_LOCAL (inp->msgh_bits) ==
       MACH_MSG_TYPE_PROTECTED_PAYLOAD)
     {
-      struct port_info *pi = ports_lookup_payload (NULL,
-						   inp->msgh_protected_payload,
-						   NULL);
-      if (pi)
-	{
-	  local_port = pi->port_right;
-	  ports_port_deref (pi);
-	}
-      else
-	local_port = MACH_PORT_NULL;
+      NETIF_FOREACH (netif)
+	if (inp->msgh_protected_payload ==
+	    (unsigned long) netif_get_state (netif)->readpt)
+	  return netif;
     }
   else
-    local_port = inp->msgh_local_port;
+    {
+      NETIF_FOREACH (netif)
+	if (inp->msgh_local_port == netif_get_state (netif)->readptname)
+	  return netif;
+    }
+
+  return NULL;
+}
+
+/* Demux incoming RPCs from the device */
+int
+hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
+{
+  struct net_rcv_msg *msg = (struct net_rcv_msg *) inp;
+  struct netif *netif;
 
-  NETIF_FOREACH(netif)
-    if (local_port == netif_get_state (netif)->readptname)
-      break;
+  if (inp->msgh_id != NET_RCV_MSG_ID)
+    return 0;
 
+  netif = hurdethif_find_netif (inp);
   if (!netif)
     {
       if (inp->msgh_remote_port != MACH_PORT_NULL)
@@ -541,12 +569,109 @@ hurdethif_device_init (struct netif *netif)
   return ERR_OK;
 }
 
+/* The most packet messages taken from the device ports per wakeup */
+#define HURDETHIF_BURST 32
+
+/* Frames handed over to the tcpip thread at once */
+struct hurdethif_burst
+{
+  int count;
+  struct pbuf *p[HURDETHIF_BURST];
+  struct netif *netif[HURDETHIF_BURST];
+};
+
+/* Only the input thread uses these */
+static struct net_rcv_msg input_msgs[HURDETHIF_BURST];
+
+/*
+ * Run by the tcpip thread: pass every frame of the burst ARG to the
+ * Ethernet layer, as tcpip_input does for a single one
+ */
+static void
+hurdethif_input_burst (void *arg)
+{
+  struct hurdethif_burst *burst = arg;
+  int i;
+
+  for (i = 0; i < burst->count; i++)
+    if (ethernet_input (burst->p[i], burst->netif[i]) != ERR_OK)
+      {
+	LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
+	pbuf_free (burst->p[i]);
+      }
+
+  free (burst);
+}
+
+/*
+ * Receive the packets of all the devices.
+ *
+ * Wait for a message, then take those already queued too, up to
+ * HURDETHIF_BURST, and hand all their frames to the tcpip thread in a
+ * single message instead of one per frame.
+ */
 static void *
 hurdethif_input_thread (void *arg)
 {
+  mach_port_t portset = etherport_bucket->portset;
 
-  ports_manage_port_operations_one_thread (etherport_bucket,
-					   hurdethif_demuxer, 0);
+  for (;;)
+    {
+      struct hurdethif_burst *burst;
+      error_t err;
+      int n = 0, i;
+
+      do
+	{
+	  err = mach_msg (&input_msgs[n].msg_hdr,
+			  MACH_RCV_MSG | (n > 0 ? MACH_RCV_TIMEOUT : 0),
+			  0, sizeof input_msgs[n], portset, 0, MACH_PORT_NULL);
+	  if (!err)
+	    n++;
+	}
+      while (n == 0 || (!err && n < HURDETHIF_BURST));
+
+      burst = malloc (sizeof *burst);
+      if (burst)
+	burst->count = 0;
+
+      for (i = 0; i < n; i++)
+	{
+	  mach_msg_header_t *inp = &input_msgs[i].msg_hdr;
+	  struct netif *netif;
+	  struct pbuf *p;
+
+	  if (inp->msgh_id != NET_RCV_MSG_ID)
+	    {
+	      mach_msg_destroy (inp);
+	      continue;
+	    }
+
+	  netif = hurdethif_find_netif (inp);
+	  if (netif && !burst)
+	    hurdethif_input (netif, &input_msgs[i]);
+	  else if (netif && (p = hurdethif_pbuf (&input_msgs[i])))
+	    {
+	      burst->p[burst->count] = p;
+	      burst->netif[burst->count] = netif;
+	      burst->count++;
+	    }
+
+	  if (inp->msgh_remote_port != MACH_PORT_NULL)
+	    mach_port_deallocate (mach_task_self (), inp->msgh_remote_port);
+	}
+
+      if (!burst)
+	continue;
+
+      if (burst->count == 0
+	  || tcpip_callback (hurdethif_input_burst, burst) != ERR_OK)
+	{
+	  for (i = 0; i < burst->count; i++)
+	    pbuf_free (burst->p[i]);
+	  free (burst);
+	}
+    }
 
   return 0;
 }
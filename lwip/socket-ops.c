@@ -345,7 +345,6 @@ lwip_S_socket_send (struct sock_user * user,
 		    mach_msg_type_number_t controllen, vm_size_t * amount)
 {
   int sent;
-  int sockflags;
   struct iovec iov = { (char*) data, datalen };
   struct msghdr m = { msg_name:addr ? &addr->address : 0,
     msg_namelen:addr ? addr->address.sa.sa_len : 0,
@@ -360,11 +359,9 @@ lwip_S_socket_send (struct sock_user * user,
   if (nports != 0 || controllen != 0)
     return EINVAL;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
   /* XXX: missing !MSG_NOSIGNAL support, i.e. generate SIGPIPE */
   flags &= ~MSG_NOSIGNAL;
-  if (sockflags & O_NONBLOCK)
-    flags |= MSG_DONTWAIT;
+  flags = sock_io_flags (user->sock, flags);
 
   sent = lwip_sendmsg (user->sock->sockno, &m, flags);
 
@@ -397,7 +394,6 @@ lwip_S_socket_recv (struct sock_user * user,
   error_t err;
   union { struct sockaddr_storage storage; struct sockaddr sa; } addr;
   int alloced = 0;
-  int sockflags;
   struct iovec iov;
   struct msghdr m = { msg_name: &addr.sa, msg_namelen:sizeof addr,
     msg_controllen: 0, msg_iov: &iov, msg_iovlen:1
@@ -422,9 +418,7 @@ lwip_S_socket_recv (struct sock_user * user,
   iov.iov_base = *data;
   iov.iov_len = amount;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
-  if (sockflags & O_NONBLOCK)
-    flags |= MSG_DONTWAIT;
+  flags = sock_io_flags (user->sock, flags);
 
   err = lwip_recvmsg (user->sock->sockno, &m, flags);
 
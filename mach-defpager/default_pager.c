@@ -39,6 +39,7 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include <device/device_types.h>
 #include <device/device.h>
@@ -113,6 +114,12 @@ synchronized_printf (const char *fmt, ...)
 
 #define	USE_PRECIOUS	1
 
+/*
+ * Keep pages of zeroes in the block map only,
+ * without writing them to a paging partition
+ */
+#define	ZERO_PAGES	1
+
 #define	ptoa(p)	((p)*vm_page_size)
 #define	atop(a)	((a)/vm_page_size)
 
@@ -504,23 +511,128 @@ ddprintf ("choose_partition(%x,%d,%d)\n",size,cur_part,i);
 }
 
 /*
- * Allocate a page in a paging partition
+ * Paging space is handed out in stripes of STRIPE_PAGES pages,
+ * taking the partitions in turn, so that the page-outs of the
+ * pager threads go to all the paging devices at once rather than
+ * filling the first one.  There is no priority for partitions in
+ * the paging storage interface, so a partition gets as many
+ * stripes per turn as it is times bigger than the smallest one,
+ * up to STRIPE_WEIGHT_MAX.
+ */
+#define	STRIPE_PAGES		64
+#define	STRIPE_WEIGHT_MAX	16
+
+p_index_t	stripe_part = P_INDEX_INVALID;	/* whose turn it is */
+vm_size_t	stripe_left = 0;		/* pages left in the turn */
+
+/*
+ * Whether partition I can take pages.  Its free count is
+ * looked at unlocked: this only chooses where to try first.
+ * Called with all_partitions locked.
+ */
+static boolean_t
+stripe_usable(int	i)
+{
+	partition_t	part;
+
+	if (i < 0 || i >= all_partitions.n_partitions)
+		return FALSE;
+	part = partition_of(i);
+	return (part != 0 && !part->going_away && part->free > 0);
+}
+
+/*
+ * How many stripes partition I gets per turn.
+ * Called with all_partitions locked.
+ */
+static vm_size_t
+stripe_weight(int	i)
+{
+	vm_size_t	smallest = 0;
+	int		j;
+
+	for (j = 0; j < all_partitions.n_partitions; j++)
+		if (stripe_usable(j)
+		    && (smallest == 0
+			|| partition_of(j)->total_size < smallest))
+			smallest = partition_of(j)->total_size;
+
+	if (smallest == 0)
+		return 1;
+	smallest = partition_of(i)->total_size / smallest;
+	if (smallest > STRIPE_WEIGHT_MAX)
+		smallest = STRIPE_WEIGHT_MAX;
+	return (smallest > 0) ? smallest : 1;
+}
+
+/*
+ * Choose the partition to allocate the next *COUNT pages in,
+ * and reduce *COUNT to what is left of its turn.
+ * Returns P_INDEX_INVALID if no partition has room.
+ */
+p_index_t
+stripe_partition(vm_size_t	*count)
+{
+	p_index_t	pindex;
+	int		i, n;
+
+	pthread_mutex_lock(&all_partitions.lock);
+	n = all_partitions.n_partitions;
+	if (stripe_left == 0 || !stripe_usable(stripe_part)) {
+		stripe_left = 0;
+		for (i = 0; i < n; i++) {
+			if (no_partition(stripe_part) || stripe_part + 1 >= n)
+				stripe_part = 0;
+			else
+				stripe_part++;
+			if (stripe_usable(stripe_part)) {
+				stripe_left = STRIPE_PAGES
+					* stripe_weight(stripe_part);
+				break;
+			}
+		}
+	}
+	if (stripe_left == 0) {
+		pthread_mutex_unlock(&all_partitions.lock);
+		return P_INDEX_INVALID;
+	}
+
+	if (*count > stripe_left)
+		*count = stripe_left;
+	stripe_left -= *count;
+	pindex = stripe_part;
+	pthread_mutex_unlock(&all_partitions.lock);
+	return pindex;
+}
+
+/*
+ * How far to keep looking for a long enough run of free
+ * pages, in bitmap entries, once one free page is found.
+ */
+#define	ALLOC_RUN_SEARCH	64
+
+/*
+ * Allocate up to COUNT contiguous pages in a paging partition;
+ * the number allocated is returned in *GOT.  The first run of COUNT
+ * free pages is taken, or else the longest run seen.
  * The partition is returned unlocked.
  */
 vm_offset_t
-pager_alloc_page(p_index_t	pindex,
-	boolean_t	lock_it)
+pager_alloc_run(p_index_t	pindex,
+	vm_size_t	count,
+	boolean_t	lock_it,
+	vm_size_t	*got)
 {
-	int	bm_e;
-	int	bit;
-	int	limit;
-	bm_entry_t	*bm;
+	vm_offset_t	page, start, best;
+	vm_size_t	len, best_len;
+	int		searched;
 	partition_t	part;
-	static char	here[] = "%spager_alloc_page";
+	static char	here[] = "%spager_alloc_run";
 
+	*got = 0;
 	if (no_partition(pindex))
 	    return (NO_BLOCK);
-ddprintf ("pager_alloc_page(%d,%d)\n",pindex,lock_it);
+ddprintf ("pager_alloc_run(%d,%d,%d)\n",pindex,count,lock_it);
 	part = partition_of(pindex);
 
 	/* unlikely, but possible deadlock against destroy_partition */
@@ -536,35 +648,77 @@ ddprintf ("pager_alloc_page(%d,%d)\n",pindex,lock_it);
 	    return (NO_BLOCK);
 	}
 
-	limit = howmany(part->total_size, NB_BM);
-	bm = part->bitmap;
-	for (bm_e = 0; bm_e < limit; bm_e++, bm++)
-	    if (*bm != BM_MASK)
-		break;
+	if (count > part->free)
+	    count = part->free;
 
-	if (bm_e == limit)
-	    panic(here,my_name);
+	start = best = 0;
+	len = best_len = 0;
+	searched = 0;
+	for (page = 0; page < part->total_size; ) {
+	    bm_entry_t	b = part->bitmap[page / NB_BM];
 
-	/*
-	 * Find and set the proper bit
-	 */
-	{
-	    bm_entry_t	b = *bm;
+	    if (page % NB_BM == 0 && b == BM_MASK) {
+		/* Skip a full entry at once */
+		len = 0;
+		page += NB_BM;
+	    }
+	    else if (page % NB_BM == 0 && b == 0
+		     && page + NB_BM <= part->total_size
+		     && len + NB_BM < count) {
+		/* And an empty one, unless it ends the run */
+		if (len == 0)
+		    start = page;
+		len += NB_BM;
+		page += NB_BM;
+	    }
+	    else {
+		if (b & (1U << (page % NB_BM)))
+		    len = 0;
+		else {
+		    if (len == 0)
+			start = page;
+		    len++;
+		}
+		page++;
+	    }
 
-	    for (bit = 0; bit < NB_BM; bit++)
-		if ((b & (1U<<bit)) == 0)
+	    if (len > best_len) {
+		best = start;
+		best_len = len;
+		if (best_len >= count)
 		    break;
-	    if (bit == NB_BM)
-		panic(here,my_name);
+	    }
+	    if (best_len > 0 && page % NB_BM == 0
+		&& ++searched > ALLOC_RUN_SEARCH)
+		break;
+	}
 
-	    *bm = b | (1U<<bit);
-	    part->free--;
+	if (best_len == 0)
+	    panic(here,my_name);
+	if (best_len > count)
+	    best_len = count;
 
-	}
+	for (page = best; page < best + best_len; page++)
+	    part->bitmap[page / NB_BM] |= 1U << (page % NB_BM);
+	part->free -= best_len;
 
 	pthread_mutex_unlock(&part->p_lock);
 
-	return (bm_e*NB_BM+bit);
+	*got = best_len;
+	return (best);
+}
+
+/*
+ * Allocate a page in a paging partition
+ * The partition is returned unlocked.
+ */
+vm_offset_t
+pager_alloc_page(p_index_t	pindex,
+	boolean_t	lock_it)
+{
+	vm_size_t	got;
+
+	return pager_alloc_run(pindex, 1, lock_it, &got);
 }
 
 /*
@@ -721,13 +875,13 @@ pager_allocated(dpager_t	pager)
 
 			for (emap2 = &map2[PAGEMAP_ENTRIES];
 			     map2 < emap2; map2++)
-				if ( ! no_block(*map2) )
+				if ( ! no_disk_block(*map2) )
 					asize++;
 
 		}
 	} else {
 		for (emap = &map[size]; map < emap; map++)
-			if ( ! no_block(*map) )
+			if ( ! no_disk_block(*map) )
 				asize++;
 	}
 
@@ -957,6 +1111,153 @@ pager_extend(dpager_t	pager,
 	pthread_mutex_unlock(&pager->lock);
 }
 
+/*
+ * Swap-in readahead.  When a page is read, the pages of the
+ * same object that follow it in the partition are read along
+ * with it in a single I/O, and kept in a window, in case they
+ * are faulted in next.  Writing pages of the object drops them
+ * from the windows, as do truncating and deallocating it; a
+ * window being filled remembers which of its pages were
+ * dropped meanwhile.
+ */
+#define	READAHEAD_PAGES		16	/* at most, in a window */
+#define	READAHEAD_WINDOWS	8
+
+struct readahead {
+	dpager_t	pager;		/* 0 if the window is free */
+	vm_offset_t	offset;		/* of the window in the object */
+	vm_offset_t	addr;		/* data, 0 while being filled */
+	vm_size_t	size;
+	unsigned int	valid;		/* one bit for each page */
+	unsigned int	dropped;	/* while being filled */
+	unsigned int	stamp;		/* when last used */
+};
+
+static struct readahead	readahead[READAHEAD_WINDOWS];
+static unsigned int	readahead_stamp;
+static pthread_mutex_t	readahead_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+readahead_free(struct readahead *ra)
+{
+	if (ra->addr)
+	    (void) vm_deallocate(mach_task_self(), ra->addr, ra->size);
+	ra->pager = 0;
+	ra->addr = 0;
+	ra->valid = 0;
+}
+
+/*
+ * Drop the pages of PAGER from SIZE bytes at OFFSET
+ * on from the windows.
+ */
+static void
+readahead_drop(dpager_t	pager,
+	vm_offset_t	offset,
+	vm_size_t	size)
+{
+	struct readahead	*ra;
+	vm_size_t		i;
+
+	pthread_mutex_lock(&readahead_lock);
+	for (ra = readahead; ra < &readahead[READAHEAD_WINDOWS]; ra++) {
+	    if (ra->pager != pager)
+		continue;
+	    for (i = 0; i < atop(ra->size); i++)
+		if (ra->offset + ptoa(i) >= offset
+		    && ra->offset + ptoa(i) - offset < size) {
+		    ra->valid &= ~(1U << i);
+		    ra->dropped |= 1U << i;
+		}
+	    if (ra->addr && ra->valid == 0)
+		readahead_free(ra);
+	}
+	pthread_mutex_unlock(&readahead_lock);
+}
+
+/*
+ * Copy the page of PAGER at OFFSET into ADDR if it is in a window.
+ */
+static boolean_t
+readahead_lookup(dpager_t	pager,
+	vm_offset_t	offset,
+	vm_offset_t	addr)
+{
+	struct readahead	*ra;
+	boolean_t		found = FALSE;
+
+	pthread_mutex_lock(&readahead_lock);
+	for (ra = readahead; ra < &readahead[READAHEAD_WINDOWS]; ra++)
+	    if (ra->pager == pager && ra->addr
+		&& offset >= ra->offset && offset - ra->offset < ra->size
+		&& (ra->valid & (1U << atop(offset - ra->offset)))) {
+		memcpy((char *)addr,
+		       (char *)ra->addr + (offset - ra->offset),
+		       vm_page_size);
+		ra->stamp = ++readahead_stamp;
+		found = TRUE;
+		break;
+	    }
+	pthread_mutex_unlock(&readahead_lock);
+	return found;
+}
+
+/*
+ * Take the least recently used window for SIZE bytes of
+ * PAGER at OFFSET, to be filled with readahead_fill.
+ * Return 0 if all the windows are being filled.
+ */
+static struct readahead *
+readahead_start(dpager_t	pager,
+	vm_offset_t	offset,
+	vm_size_t	size)
+{
+	struct readahead	*ra, *victim = 0;
+
+	pthread_mutex_lock(&readahead_lock);
+	for (ra = readahead; ra < &readahead[READAHEAD_WINDOWS]; ra++) {
+	    if (ra->pager && !ra->addr)
+		continue;		/* being filled */
+	    if (!victim || !ra->pager
+		|| (int) (ra->stamp - victim->stamp) < 0)
+		victim = ra;
+	    if (!ra->pager)
+		break;
+	}
+	if (victim) {
+	    readahead_free(victim);
+	    victim->pager = pager;
+	    victim->offset = offset;
+	    victim->size = size;
+	    victim->dropped = 0;
+	    victim->stamp = ++readahead_stamp;
+	}
+	pthread_mutex_unlock(&readahead_lock);
+	return victim;
+}
+
+/*
+ * Fill RA, taken with readahead_start, with the data at ADDR,
+ * the first FIRST bytes of which are not to be kept; or give it
+ * up if ADDR is 0.
+ */
+static void
+readahead_fill(struct readahead	*ra,
+	vm_offset_t	addr,
+	vm_size_t	first)
+{
+	pthread_mutex_lock(&readahead_lock);
+	if (addr) {
+	    ra->addr = addr;
+	    ra->valid = ((1U << atop(ra->size)) - 1)
+			& ~((1U << atop(first)) - 1)
+			& ~ra->dropped;
+	}
+	if (ra->valid == 0)
+	    readahead_free(ra);
+	pthread_mutex_unlock(&readahead_lock);
+}
+
 /* This deallocates the pages necessary to truncate a direct map
    previously of size NEW_SIZE to the smaller size OLD_SIZE.  */
 static void
@@ -971,12 +1272,10 @@ dealloc_direct (dp_map_t mapptr,
   for (i = new_size; i < old_size; ++i)
     {
       const union dp_map entry = mapptr[i];
-      if (!no_block(entry))
-	{
-	  pager_dealloc_page(entry.block.p_index, entry.block.p_offset,
-			     TRUE);
-	  invalidate_block(mapptr[i]);
-	}
+      if (!no_disk_block(entry))
+	pager_dealloc_page(entry.block.p_index, entry.block.p_offset,
+			   TRUE);
+      invalidate_block(mapptr[i]);
     }
 }
 
@@ -992,6 +1291,8 @@ pager_truncate(dpager_t pager, vm_size_t new_size)	/* in pages */
   int i;
   vm_size_t old_size;
 
+  readahead_drop(pager, ptoa(new_size), (vm_size_t) -1);
+
   pthread_mutex_lock(&pager->lock);	/* XXX lock_write */
 
   if (!pager->map)
@@ -1139,7 +1440,8 @@ void pager_release_offset(dpager_t	pager,
 
 	pthread_mutex_unlock(&pager->lock);
 
-	pager_dealloc_page(entry.block.p_index, entry.block.p_offset, TRUE);
+	if (!no_disk_block(entry))
+	    pager_dealloc_page(entry.block.p_index, entry.block.p_offset, TRUE);
 }
 #endif	/*USE_PRECIOUS*/
 
@@ -1282,15 +1584,32 @@ compute_checksum(addr, size)
 	vm_offset_t	addr;
 	vm_size_t	size;
 {
-	int	checksum = NO_CHECKSUM;
-	int	*ptr;
-	int	count;
+	const unsigned long	*ptr, *end;
+	unsigned long	a = 0, b = 0, c = 0, d = 0;
+	int		checksum = NO_CHECKSUM;
 
-	ptr = (int *)addr;
-	count = size / sizeof(int);
+	/*
+	 * XOR is associative, so whole words can be combined, in
+	 * four independent streams the compiler can vectorize, and
+	 * folded into 32 bits at the end.  SIZE is a multiple of the
+	 * page size.
+	 */
+	ptr = (const unsigned long *)addr;
+	end = (const unsigned long *)(addr + size);
+	for (; ptr + 4 <= end; ptr += 4) {
+	    a ^= ptr[0];
+	    b ^= ptr[1];
+	    c ^= ptr[2];
+	    d ^= ptr[3];
+	}
+	for (; ptr < end; ptr++)
+	    a ^= *ptr;
 
-	while (--count >= 0)
-	    checksum ^= *ptr++;
+	a ^= b ^ c ^ d;
+#if	ULONG_MAX > 0xffffffffUL
+	a ^= a >> 32;
+#endif
+	checksum ^= (int) a;
 
 	return (checksum);
 }
@@ -1299,22 +1618,28 @@ compute_checksum(addr, size)
 /*
  * Given an offset within a paging object, find the
  * corresponding block within the paging partition.
- * Allocate a new block if necessary.
+ * Allocate a new block if necessary, together with
+ * contiguous blocks for as many of the PAGES - 1 pages
+ * that follow as have none yet, so that they can be
+ * written out at once.
+ * If PAGES is 0, the page is all zeroes instead: mark
+ * it so, releasing any block it had.
  *
  * WARNING: paging objects apparently may be extended
  * without notice!
  */
 union dp_map
 pager_write_offset(dpager_t	pager,
-	vm_offset_t		offset)
+	vm_offset_t		offset,
+	vm_size_t		pages)
 {
-	vm_offset_t	f_page;
+	vm_offset_t	f_page, page;
 	dp_map_t	mapptr;
 	union dp_map	block;
 
 	invalidate_block(block);
 
-	f_page = atop(offset);
+	page = f_page = atop(offset);
 
 #if	DEBUG_READER_CONFLICTS
 	if (pager->readers > 0)
@@ -1414,11 +1739,45 @@ pager_write_offset(dpager_t	pager,
 
 	block = mapptr[f_page];
 	ddprintf ("pager_write_offset: block starts as %p[%lx] %p\n", mapptr, f_page, block.indirect);
-	if (no_block(block)) {
+	if (pages == 0) {
+	    if (!no_disk_block(block))
+		pager_dealloc_page(block.block.p_index,
+				   block.block.p_offset, TRUE);
+	    invalidate_block(block);
+	    block.block.p_offset = 0;
+	    block.block.p_index  = P_INDEX_ZERO;
+	    mapptr[f_page] = block;
+	    goto out;
+	}
+	if (no_disk_block(block)) {
 	    vm_offset_t	off;
-
-	    /* get room now */
-	    off = pager_alloc_page(pager->cur_partition, TRUE);
+	    vm_size_t	n, got;
+	    p_index_t	pindex;
+
+	    /* The following pages without a block in this map */
+	    for (n = 1;
+		 n < pages
+		 && page + n < pager->size
+		 && (INDIRECT_PAGEMAP(pager->size)
+		     ? f_page + n < PAGEMAP_ENTRIES : TRUE)
+		 && no_disk_block(mapptr[f_page + n]);
+		 n++)
+		;
+
+	    /* get room now, in the partition whose stripe it is */
+	    pindex = stripe_partition(&n);
+	    if (no_partition(pindex))
+		pindex = pager->cur_partition;
+	    off = pager_alloc_run(pindex, n, TRUE, &got);
+	    if (off != NO_BLOCK) {
+		vm_size_t	i;
+
+		for (i = 1; i < got; i++) {
+		    invalidate_block(mapptr[f_page + i]);
+		    mapptr[f_page + i].block.p_offset = off + i;
+		    mapptr[f_page + i].block.p_index  = pindex;
+		}
+	    }
 	    if (off == NO_BLOCK) {
 		/*
 		 * Before giving up, try all other partitions.
@@ -1427,20 +1786,20 @@ pager_write_offset(dpager_t	pager,
 
 		ddprintf ("pager_write_offset: could not allocate block\n");
 		/* returns it locked (if any one is non-full) */
-		new_part = choose_partition( ptoa(1), pager->cur_partition);
+		new_part = choose_partition( ptoa(1), pindex);
 		if ( ! no_partition(new_part) ) {
 
 #if debug
-dprintf("%s partition %x filled,", my_name, pager->cur_partition);
+dprintf("%s partition %x filled,", my_name, pindex);
 dprintf("extending object %x (size %x) to %x.\n",
 	pager, pager->size, new_part);
 #endif
 
 		    /* this one tastes better */
-		    pager->cur_partition = new_part;
+		    pager->cur_partition = pindex = new_part;
 
 		    /* this unlocks the partition too */
-		    off = pager_alloc_page(pager->cur_partition, FALSE);
+		    off = pager_alloc_page(pindex, FALSE);
 
 		}
 
@@ -1449,12 +1808,14 @@ dprintf("extending object %x (size %x) to %x.\n",
 		     * Oh well.
 		     */
 		    overcommitted(FALSE, 1);
+		    invalidate_block(block);
 		    goto out;
 		}
 		ddprintf ("pager_write_offset: decided to allocate block\n");
 	    }
+	    invalidate_block(block);
 	    block.block.p_offset = off;
-	    block.block.p_index  = pager->cur_partition;
+	    block.block.p_index  = pindex;
 	    mapptr[f_page] = block;
 	}
 
@@ -1478,6 +1839,8 @@ pager_dealloc(dpager_t	pager)
 	dp_map_t	mapptr;
 	union dp_map	block;
 
+	readahead_drop(pager, 0, (vm_size_t) -1);
+
 	if (!pager->map)
 	    return;
 
@@ -1487,7 +1850,7 @@ pager_dealloc(dpager_t	pager)
 		if (mapptr != 0) {
 		    for (j = 0; j < PAGEMAP_ENTRIES; j++) {
 			block = mapptr[j];
-			if ( ! no_block(block) )
+			if ( ! no_disk_block(block) )
 			    pager_dealloc_page(block.block.p_index,
 			    			block.block.p_offset, TRUE);
 		    }
@@ -1511,7 +1874,7 @@ pager_dealloc(dpager_t	pager)
 	    mapptr = pager->map;
 	    for (i = 0; i < pager->size; i++ ) {
 		block = mapptr[i];
-		if ( ! no_block(block) )
+		if ( ! no_disk_block(block) )
 		    pager_dealloc_page(block.block.p_index,
 		    			block.block.p_offset, TRUE);
 	    }
@@ -1614,6 +1977,16 @@ default_read(dpager_t	ds,
 	vm_size_t	original_size = size;
 #endif	 /* CHECKSUM */
 	vm_offset_t	original_offset = offset;
+	struct readahead	*ra;
+	vm_size_t	n;
+
+	/*
+	 * It may have been read ahead
+	 */
+	if (size == vm_page_size && readahead_lookup(ds, offset, addr)) {
+	    *out_addr = addr;
+	    goto done;
+	}
 
 	/*
 	 * Find the block in the paging partition
@@ -1631,6 +2004,11 @@ default_read(dpager_t	ds,
 	    }
 	    return (PAGER_ABSENT);
 	}
+	if ( zero_block(block) ) {
+	    memset ((char *)addr, 0, size);
+	    *out_addr = addr;
+	    goto done;
+	}
 
 	/*
 	 * Read it, trying for the entire page.
@@ -1641,6 +2019,38 @@ ddprintf ("default_read(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
 	first_time = TRUE;
 	*out_addr = addr;
 
+	/*
+	 * Read the pages that follow in the partition too,
+	 * if they are the next ones of the object.
+	 */
+	for (n = 1;
+	     size == vm_page_size && n < READAHEAD_PAGES
+	     && original_offset + ptoa(n) < ds->limit;
+	     n++) {
+	    union dp_map next = pager_read_offset(ds, original_offset + ptoa(n));
+	    if (no_block(next)
+		|| next.block.p_index != block.block.p_index
+		|| next.block.p_offset != block.block.p_offset + n)
+		break;
+	}
+	ra = n > 1 ? readahead_start(ds, original_offset, ptoa(n)) : 0;
+	if (ra) {
+	    rc = page_read_file_direct(part->file,
+				       offset,
+				       ptoa(n),
+				       &raddr,
+				       &rsize);
+	    if (rc == 0 && rsize == ptoa(n)) {
+		memcpy ((char *)addr, (char *)raddr, vm_page_size);
+		readahead_fill(ra, raddr, vm_page_size);
+		goto done;
+	    }
+	    /* Try for the page alone */
+	    if (rc == 0)
+		(void) vm_deallocate(mach_task_self(), raddr, rsize);
+	    readahead_fill(ra, 0, 0);
+	}
+
 	do {
 	    rc = page_read_file_direct(part->file,
 				       offset,
@@ -1675,9 +2085,12 @@ ddprintf ("default_read(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
 	    size -= rsize;
 	} while (size != 0);
 
+    done:
 #if	USE_PRECIOUS
-	if (deallocate)
+	if (deallocate) {
+		readahead_drop(ds, original_offset, vm_page_size);
 		pager_release_offset(ds, original_offset);
+	}
 #endif	/*USE_PRECIOUS*/
 
 #ifdef	CHECKSUM
@@ -1697,58 +2110,108 @@ ddprintf ("default_read(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
 	return (PAGER_SUCCESS);
 }
 
+#if	ZERO_PAGES
+/*
+ * Whether the page at ADDR is all zeroes.
+ */
+static boolean_t
+page_is_zero(vm_offset_t	addr)
+{
+	const unsigned long	*ptr = (const unsigned long *)addr;
+	const unsigned long	*end = (const unsigned long *)(addr + vm_page_size);
+
+	/* Nonzero pages mostly fail at once; check by lines otherwise */
+	for (; ptr < end; ptr += 8)
+	    if (ptr[0] | ptr[1] | ptr[2] | ptr[3]
+		| ptr[4] | ptr[5] | ptr[6] | ptr[7])
+		return FALSE;
+	return TRUE;
+}
+#endif	/* ZERO_PAGES */
+
 int
 default_write(dpager_t	ds,
 	vm_offset_t	addr,
 	vm_size_t	size,
 	vm_offset_t	offset)
 {
-	union dp_map	block;
+	union dp_map	block, next;
 	partition_t		part;
 	mach_msg_type_number_t	wsize;
+	vm_size_t	n, run;
 	int		rc;
+	int		result = PAGER_SUCCESS;
+	vm_offset_t	original_offset = offset;
+	vm_size_t	original_size = size;
 
 	ddprintf ("default_write: pager offset %lx\n", offset);
 
-	/*
-	 * Find block in paging partition
-	 */
-	block = pager_write_offset(ds, offset);
-	if ( no_block(block) ) {
-	    static int warned = 0;
-	    if (!warned) {
-		printf("(default pager): default_write got out of room\n");
-		warned = 1;
+	while (size != 0) {
+#if	ZERO_PAGES
+	    if (page_is_zero(addr)) {
+		block = pager_write_offset(ds, offset, 0);
+		if ( !no_block(block) ) {
+		    addr += vm_page_size;
+		    offset += vm_page_size;
+		    size -= vm_page_size;
+		    continue;
+		}
 	    }
-	    return (PAGER_ERROR);
-	}
+	    for (n = 1; ptoa(n) < size && !page_is_zero(addr + ptoa(n)); n++)
+		;
+#else	/* ZERO_PAGES */
+	    n = atop(size);
+#endif	/* ZERO_PAGES */
+
+	    /*
+	     * Find block in paging partition, and the run
+	     * of pages after it that have the blocks following
+	     * it, to write them all at once.
+	     */
+	    run = n;
+	    block = pager_write_offset(ds, offset, run);
+	    if ( no_block(block) ) {
+		static int warned = 0;
+		if (!warned) {
+		    printf("(default pager): default_write got out of room\n");
+		    warned = 1;
+		}
+		result = PAGER_ERROR;
+		break;
+	    }
+	    for (n = 1; n < run; n++) {
+		next = pager_write_offset(ds, offset + ptoa(n), run - n);
+		if (no_block(next)
+		    || next.block.p_index != block.block.p_index
+		    || next.block.p_offset != block.block.p_offset + n)
+		    break;
+	    }
+	    run = ptoa(n);
 
 #ifdef	CHECKSUM
-	/*
-	 * Save checksum
-	 */
-	{
-	    int	checksum;
+	    /*
+	     * Save checksum
+	     */
+	    {
+		int	checksum;
+		vm_size_t i;
 
-	    checksum = compute_checksum(addr, size);
-	    pager_put_checksum(ds, offset, checksum);
-	}
+		for (i = 0; i < run; i += vm_page_size) {
+		    checksum = compute_checksum(addr + i, vm_page_size);
+		    pager_put_checksum(ds, offset + i, checksum);
+		}
+	    }
 #endif	 /* CHECKSUM */
-	offset = ptoa(block.block.p_offset);
-ddprintf ("default_write(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
-	part   = partition_of(block.block.p_index);
+	    part   = partition_of(block.block.p_index);
+ddprintf ("default_write(%lx,%x,%lx,%d)\n",addr,run,ptoa(block.block.p_offset),block.block.p_index);
 
-	/*
-	 * There are various assumptions made here,we
-	 * will not get into the next disk 'block' by
-	 * accident. It might well be non-contiguous.
-	 */
-	do {
 	    rc = page_write_file_direct(part->file,
-					offset,
+					ptoa(block.block.p_offset),
 					addr,
-					size,
+					run,
 					&wsize);
+	    if (rc == 0 && wsize != run)
+		rc = EIO;
 	    if (rc != 0) {
 		static int warned = 0;
 		if (!warned) {
@@ -1757,14 +2220,21 @@ ddprintf ("default_write(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index)
 		}
 		dprintf("*** PAGER ERROR: default_write: ");
 		dprintf("ds=0x%p addr=0x%lx size=0x%x offset=0x%lx resid=0x%x\n",
-			ds, addr, size, offset, wsize);
-		return (PAGER_ERROR);
+			ds, addr, run, offset, wsize);
+		result = PAGER_ERROR;
+		break;
 	    }
-	    addr += wsize;
-	    offset += wsize;
-	    size -= wsize;
-	} while (size != 0);
-	return (PAGER_SUCCESS);
+	    addr += run;
+	    offset += run;
+	    size -= run;
+	}
+
+	/*
+	 * Whatever was read ahead for these pages is now stale,
+	 * and so is what was being read meanwhile.
+	 */
+	readahead_drop(ds, original_offset, original_size);
+	return (result);
 }
 
 boolean_t
@@ -2606,9 +3076,8 @@ ddprintf ("seqnos_memory_object_data_initialize <%p>: pager_port_unlock: <%p>[s:
 }
 
 /*
- * memory_object_data_return: split up the stuff coming in from
- * a memory_object_data_write call
- * into individual pages and pass them off to default_write.
+ * memory_object_data_return: pass the stuff coming in from
+ * a memory_object_data_write call off to default_write.
  */
 kern_return_t
 seqnos_memory_object_data_return(default_pager_t	ds,
@@ -2620,8 +3089,6 @@ seqnos_memory_object_data_return(default_pager_t	ds,
 	boolean_t	dirty,
 	boolean_t	kernel_copy)
 {
-	register
-	vm_size_t	amount_sent;
 	static char	here[] = "%sdata_return";
 	int err;
 
@@ -2662,17 +3129,10 @@ seqnos_memory_object_data_return(default_pager_t	ds,
 	    return(KERN_SUCCESS);
 	  }
 
-	for (amount_sent = 0;
-	     amount_sent < data_cnt;
-	     amount_sent += vm_page_size) {
-
-	    int result;
-
-	    result = default_write(&ds->dpager,
-			      addr + amount_sent,
-			      vm_page_size,
-			      offset + amount_sent);
-	    if (result != KERN_SUCCESS) {
+	/* The pages are given contiguous blocks where they have none,
+	   and written out in as few I/Os as the blocks allow.  */
+	if (default_write(&ds->dpager, addr, data_cnt, offset)
+	    != PAGER_SUCCESS) {
 		static int warned = 0;
 		if (!warned) {
 		    printf("(default pager): data_return write error, losing data\n");
@@ -2682,9 +3142,8 @@ seqnos_memory_object_data_return(default_pager_t	ds,
 		/* TODO: mark page as lost instead.  */
 		ds->errors++;
 		dstruct_unlock(ds);
-	    }
-	    default_pager_pageout_count++;
 	}
+	default_pager_pageout_count += atop(data_cnt);
 
 	pager_port_finish_write(ds);
 	err = vm_deallocate(default_pager_self, addr, data_cnt);
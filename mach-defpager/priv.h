@@ -133,6 +133,15 @@ typedef union dp_map	*dp_map_t;
 #define	no_block(e)		((e).indirect == (dp_map_t)NO_BLOCK)
 #define	invalidate_block(e)	((e).indirect = (dp_map_t)NO_BLOCK)
 
+/*
+ * A page known to be all zeroes has no block, but this
+ * partition index instead.
+ */
+#define	P_INDEX_ZERO	((p_index_t)-2)
+
+#define	zero_block(e)	(!no_block(e) && (e).block.p_index == P_INDEX_ZERO)
+#define	no_disk_block(e)	(no_block(e) || (e).block.p_index == P_INDEX_ZERO)
+
 struct dpager {
 	pthread_mutex_t	lock;		/* lock for extending block map */
 					/* XXX should be read-write lock */
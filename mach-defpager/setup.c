@@ -113,7 +113,7 @@ S_default_pager_paging_storage (mach_port_t pager,
 }
 #endif
 
-/* Called to read a page from backing store.  */
+/* Called to read pages from backing store.  */
 int
 page_read_file_direct (struct file_direct *fdp,
 		       vm_offset_t offset,
@@ -126,60 +126,64 @@ page_read_file_direct (struct file_direct *fdp,
   char *readloc;
   char *page;
   mach_msg_type_number_t nread;
+  vm_size_t left;
 
   assert_backtrace (page_aligned (offset));
-  assert_backtrace (size == vm_page_size);
+  assert_backtrace (size > 0 && page_aligned (size));
 
   offset >>= fdp->bshift;
 
   assert_backtrace (offset + (size >> fdp->bshift) <= fdp->fd_size);
 
-  /* Find the run containing the beginning of the page.  */
-  for (r = fdp->runs; offset > r->length; ++r)
+  /* Find the run containing the beginning of the pages.  */
+  for (r = fdp->runs; offset >= r->length; ++r)
     offset -= r->length;
 
   if (offset + (size >> fdp->bshift) <= r->length)
-    /* The first run contains the whole page.  */
+    /* The first run contains all the pages.  */
     return device_read (fdp->device, 0, r->start + offset,
 			size, (char **) addr, size_read);
 
-  /* Read the first part of the run.  */
-  err = device_read (fdp->device, 0, r->start + offset,
-		     (r->length - offset) << fdp->bshift,
-		     (char **) addr, &nread);
+  /* Read each part of the pages into a buffer of our own; we always
+     get another out-of-line buffer, so we have to copy out of it and
+     deallocate it.  */
+  err = vm_allocate (mach_task_self (), addr, size, 1);
   if (err)
     return err;
 
-  size -= nread;
   readloc = (char *) *addr;
+  left = size;
   do
     {
-      readloc += nread;
-      offset += nread >> fdp->bshift;
-      if (offset > r->length)
-	offset -= r++->length;
+      mach_msg_type_number_t segsize;
 
-      /* We always get another out-of-line page, so we have to copy
-	 out of that page and deallocate it.  */
-      err = device_read (fdp->device, 0, r->start + offset,
-			 (r->length - offset) << fdp->bshift,
+      segsize = (r->length - offset) << fdp->bshift;
+      if (segsize > left)
+	segsize = left;
+      err = device_read (fdp->device, 0, r->start + offset, segsize,
 			 &page, &nread);
+      if (!err && nread == 0)
+	err = EIO;
       if (err)
 	{
-	  vm_deallocate (mach_task_self (),
-			 (vm_address_t) *addr, vm_page_size);
+	  vm_deallocate (mach_task_self (), *addr, size);
 	  return err;
 	}
       memcpy (readloc, page, nread);
-      vm_deallocate (mach_task_self (), (vm_address_t) page, vm_page_size);
-      size -= nread;
-    } while (size > 0);
+      vm_deallocate (mach_task_self (), (vm_address_t) page, nread);
+
+      readloc += nread;
+      left -= nread;
+      offset += nread >> fdp->bshift;
+      if (offset >= r->length)
+	offset -= r++->length;
+    } while (left > 0);
 
-  *size_read = vm_page_size;
+  *size_read = size;
   return 0;
 }
 
-/* Called to write a page to backing store.  */
+/* Called to write pages to backing store.  */
 int
 page_write_file_direct(struct file_direct *fdp,
 		       vm_offset_t offset,
@@ -190,65 +194,56 @@ page_write_file_direct(struct file_direct *fdp,
   struct storage_run *r;
   error_t err;
   int wrote;
+  vm_size_t left;
 
   assert_backtrace (page_aligned (offset));
-  assert_backtrace (size == vm_page_size);
+  assert_backtrace (size > 0 && page_aligned (size));
 
   offset >>= fdp->bshift;
 
   assert_backtrace (offset + (size >> fdp->bshift) <= fdp->fd_size);
 
-  /* Find the run containing the beginning of the page.  */
-  for (r = fdp->runs; offset > r->length; ++r)
+  /* Find the run containing the beginning of the pages.  */
+  for (r = fdp->runs; offset >= r->length; ++r)
     offset -= r->length;
 
   if (offset + (size >> fdp->bshift) <= r->length)
     {
-      /* The first run contains the whole page.  */
+      /* The first run contains all the pages.  */
       err = device_write (fdp->device, 0, r->start + offset,
 			  (char *) addr, size, &wrote);
       *size_written = wrote;
       return err;
     }
 
-  /* Write the first part of the run.  */
-  err = device_write (fdp->device, 0,
-		      r->start + offset, (char *) addr,
-		      (r->length - offset) << fdp->bshift,
-		      &wrote);
-  if (err)
-    return err;
-
-  size -= wrote;
+  /* Write each part of the pages in turn.  */
+  left = size;
   do
     {
       mach_msg_type_number_t segsize;
 
-      addr += wrote;
-      offset += wrote >> fdp->bshift;
-      if (offset > r->length)
-	offset -= r++->length;
-
       segsize = (r->length - offset) << fdp->bshift;
-      if (segsize > size)
-	segsize = size;
+      if (segsize > left)
+	segsize = left;
       err = device_write (fdp->device, 0, r->start + offset,
 			  (char *) addr, segsize, &wrote);
+      if (!err && wrote <= 0)
+	err = EIO;
       if (err)
-	{
-	  vm_deallocate (mach_task_self (),
-			 (vm_address_t) addr, vm_page_size);
-	  return err;
-	}
+	return err;
 
-      size -= wrote;
-    } while (size > 0);
+      addr += wrote;
+      left -= wrote;
+      offset += wrote >> fdp->bshift;
+      if (offset >= r->length)
+	offset -= r++->length;
+    } while (left > 0);
 
-  *size_written = vm_page_size;
+  *size_written = size;
   return 0;
 }
 
-
+
 /*
  * Destroy a paging_partition given a file name
  */
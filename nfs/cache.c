@@ -84,6 +84,9 @@ lookup_fhandle (struct fhandle *handle, struct node **npp)
   nn->dtrans = NOT_POSSIBLE;
   nn->dead_dir = 0;
   nn->dead_name = 0;
+  nn->uncommitted = 0;
+  nn->writing = 0;
+  nn->fileinfo = 0;
   
   hurd_ihash_add (&nodehash, (hurd_ihash_key_t) &nn->handle, np);
   netfs_nref_light (np);
@@ -156,10 +159,13 @@ netfs_node_norefs (struct node *np)
 }
 
 /* When dropping soft refs, we simply remove the node from the
-   node cache.  */
+   node cache, once what was written to it is committed.  */
 void
 netfs_try_dropping_softrefs (struct node *np)
 {
+  commit_node ((struct iouser *) -1, np);
+  file_pager_drop (np);
+
   pthread_mutex_lock (&nodehash_ihash_lock);
   hurd_ihash_locp_remove (&nodehash, np->nn->slot);
   netfs_nrele_light (np);
@@ -196,3 +202,52 @@ recache_handle (int *p, struct node *np)
   pthread_mutex_unlock (&nodehash_ihash_lock);
   return p + len / sizeof (int);
 }
+
+/* Commit the data written with UNSTABLE writes to every node in the
+   cache, with the credential CRED.  Return the first error.  */
+error_t
+commit_all_nodes (struct iouser *cred)
+{
+  struct node **nodes, **npp;
+  size_t num_nodes = 0;
+  error_t err = 0;
+
+  pthread_mutex_lock (&nodehash_ihash_lock);
+  if (nodehash.nr_items == 0)
+    {
+      pthread_mutex_unlock (&nodehash_ihash_lock);
+      return 0;
+    }
+  nodes = malloc (nodehash.nr_items * sizeof *nodes);
+  if (! nodes)
+    {
+      pthread_mutex_unlock (&nodehash_ihash_lock);
+      return ENOMEM;
+    }
+  HURD_IHASH_ITERATE (&nodehash, i)
+    {
+      struct node *np = i;
+      /* Only looked at unlocked, as nodes are written to while they are
+	 locked, before the sync.  */
+      if (np->nn->uncommitted)
+	{
+	  netfs_nref (np);
+	  nodes[num_nodes++] = np;
+	}
+    }
+  pthread_mutex_unlock (&nodehash_ihash_lock);
+
+  for (npp = nodes; npp < nodes + num_nodes; npp++)
+    {
+      error_t e;
+
+      pthread_mutex_lock (&(*npp)->lock);
+      e = commit_node (cred, *npp);
+      if (! err)
+	err = e;
+      netfs_nput (*npp);
+    }
+
+  free (nodes);
+  return err;
+}
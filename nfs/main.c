@@ -31,6 +31,7 @@
 #include <argz.h>
 #include <error.h>
 #include <version.h>
+#include <shrinker.h>
 
 char *netfs_server_name = "nfs";
 char *netfs_server_version = HURD_VERSION;
@@ -62,6 +63,13 @@ extern char *localhost (void);
 /* Default maximum number of bytes to write at once. */
 #define DEFAULT_WRITE_SIZE    8192
 
+/* Default number of reads or writes to have outstanding at once. */
+#define DEFAULT_RPC_WINDOW    8
+
+/* Milliseconds between looks at the kernel's paging statistics, to
+   shrink the name cache under memory pressure. */
+#define SHRINK_INTERVAL       1000
+
 
 /* Number of seconds to timeout cached stat information. */
 int stat_timeout = DEFAULT_STAT_TIMEOUT;
@@ -92,6 +100,15 @@ int read_size = DEFAULT_READ_SIZE;
 
 /* Maximum number of bytes to write at once. */
 int write_size = DEFAULT_WRITE_SIZE;
+
+/* Number of reads or writes to have outstanding at once. */
+int rpc_window = DEFAULT_RPC_WINDOW;
+
+/* True iff we cache the data of regular files. */
+int cache_file_data = 1;
+
+/* True iff we write with UNSTABLE writes in protocol version 3. */
+int unstable_writes = 0;
 
 #define OPT_SOFT	's'
 #define OPT_HARD	'h'
@@ -111,6 +128,11 @@ int write_size = DEFAULT_WRITE_SIZE;
 #define OPT_PMAP_PORT	-13
 #define OPT_NCACHE_TO	-14
 #define OPT_NCACHE_NEG_TO -15
+#define OPT_RPC_WINDOW	-16
+#define OPT_UNSTABLE	-17
+#define OPT_STABLE	-18
+#define OPT_DATA_CACHE	-19
+#define OPT_NO_DATA_CACHE -20
 
 /* Return a string corresponding to the printed rep of DEFAULT_what */
 #define ___D(what) #what
@@ -136,6 +158,18 @@ static const struct argp_option common_options[] =
   {"write-size",	    OPT_WSIZE,	   "BYTES", 0,
      "Max packet size for writes (default " _D(WRITE_SIZE)")"},
   {"wsize",0,0,OPTION_ALIAS},
+  {"rpc-window",	    OPT_RPC_WINDOW, "RPCS", 0,
+     "Max number of reads or writes outstanding at once (default "
+     _D(RPC_WINDOW) ")"},
+  {"unstable-writes",	    OPT_UNSTABLE,  0, 0,
+     "Let the server commit written data to stable storage only on sync"
+     " (NFSv3 only)"},
+  {"stable-writes",	    OPT_STABLE,	   0, 0,
+     "Have the server commit written data at each write (default)"},
+  {"data-cache",	    OPT_DATA_CACHE, 0, 0,
+     "Cache the contents of regular files, and let them be mapped (default)"},
+  {"no-data-cache",	    OPT_NO_DATA_CACHE, 0, 0,
+     "Read the contents of files from the server at each read"},
 
   {0,0,0,0,"Timeouts:",3},
   {"stat-timeout",	    OPT_STAT_TO,   "SEC", 0,
@@ -170,6 +204,17 @@ parse_common_opt (int key, char *arg, struct argp_state *state)
 
     case OPT_RSIZE: read_size = atoi (arg); break;
     case OPT_WSIZE: write_size = atoi (arg); break;
+    case OPT_RPC_WINDOW:
+      rpc_window = atoi (arg);
+      if (rpc_window < 1)
+	rpc_window = 1;
+      else if (rpc_window > NFS_MAX_RPC_WINDOW)
+	rpc_window = NFS_MAX_RPC_WINDOW;
+      break;
+    case OPT_UNSTABLE: unstable_writes = 1; break;
+    case OPT_STABLE: unstable_writes = 0; break;
+    case OPT_DATA_CACHE: cache_file_data = 1; break;
+    case OPT_NO_DATA_CACHE: cache_file_data = 0; break;
 
     case OPT_STAT_TO: stat_timeout = atoi (arg); break;
     case OPT_CACHE_TO: cache_timeout = atoi (arg); break;
@@ -247,6 +292,11 @@ netfs_append_args (char **argz, size_t *argz_len)
 
   FOPT ("--read-size=%d", read_size);
   FOPT ("--write-size=%d", write_size);
+  FOPT ("--rpc-window=%d", rpc_window);
+  if (! err && unstable_writes)
+    err = argz_add (argz, argz_len, "--unstable-writes");
+  if (! err && ! cache_file_data)
+    err = argz_add (argz, argz_len, "--no-data-cache");
 
   FOPT ("--stat-timeout=%d", stat_timeout);
   FOPT ("--cache-timeout=%d", cache_timeout);
@@ -408,6 +458,11 @@ main (int argc, char **argv)
   if (err)
     error (2, err, "mapping time");
 
+  /* The name cache registers its shrinker on first use.  */
+  err = shrinker_start (SHRINK_INTERVAL);
+  if (err)
+    error (0, err, "Warning: cannot start the cache shrinker");
+
   err = pthread_create (&thread, NULL, timeout_service_thread, NULL);
   if (!err)
     pthread_detach (thread);
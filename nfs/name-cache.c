@@ -21,9 +21,9 @@
 
 #include "nfs.h"
 #include <string.h>
-#include <cacheq.h>
+#include <lrucache.h>
+
 
-
 /* Maximum number of names to cache at any given time */
 #define MAXCACHE 200
 
@@ -33,10 +33,9 @@
 /* Cache entry */
 struct lookup_cache
 {
-  struct cacheq_hdr hdr;
+  struct lrucache_entry hdr;
 
-  /* File handles and lengths for cache entries.  0 for NODE_CACHE_LEN
-     means a  */
+  /* File handles and lengths for cache entries.  */
   char dir_cache_fh[NFS3_FHSIZE];
   size_t dir_cache_len;
 
@@ -48,61 +47,70 @@ struct lookup_cache
      with names too long to fit in this buffer aren't cached at all.  */
   char name[CACHE_NAME_LEN];
 
-  /* Strlen of NAME.  If this is zero, it's an unused entry. */
+  /* Strlen of NAME.  */
   size_t name_len;
 
   /* Time that this cache entry was created.  */
   time_t cache_stamp;
+};
 
-  /* XXX */
-  int stati;
+/* What entries are looked up by.  */
+struct lookup_key
+{
+  const char *dir;
+  size_t len;
+  const char *name;
+  size_t name_len;
 };
 
-/* The contents of the cache in no particular order */
-static struct cacheq lookup_cache = { sizeof (struct lookup_cache) };
+static struct lrucache lookup_cache;
+static pthread_once_t lookup_cache_once = PTHREAD_ONCE_INIT;
 
-static pthread_spinlock_t cache_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
-/* Buffer to hold statistics */
-static struct stats
+static int
+match_cache (const struct lrucache_entry *e, const void *arg)
 {
-  long pos_hits;
-  long neg_hits;
-  long miss;
-  long fetch_errors;
-} statistics;
-
-#define PARTIAL_THRESH 100
-#define NPARTIALS (MAXCACHE / PARTIAL_THRESH)
-struct stats partial_stats [NPARTIALS];
-
-
-/* If there's an entry for NAME, of length NAME_LEN, in directory DIR in the
-   cache, return its entry, otherwise 0.  CACHE_LOCK must be held.  */
-static struct lookup_cache *
-find_cache (char *dir, size_t len, const char *name, size_t name_len)
+  const struct lookup_cache *c = (const struct lookup_cache *) e;
+  const struct lookup_key *key = arg;
+
+  return (c->name_len == key->name_len
+	  && c->dir_cache_len == key->len
+	  && c->name[0] == key->name[0]
+	  && memcmp (c->dir_cache_fh, key->dir, key->len) == 0
+	  && strcmp (c->name, key->name) == 0);
+}
+
+static void
+free_cache (struct lrucache_entry *e)
 {
-  struct lookup_cache *c;
-  int i;
-
-  /* Search the list.  All unused entries are contiguous at the end of the
-     list, so we can stop searching when we see the first one.  */
-  for (i = 0, c = lookup_cache.mru; 
-       c && c->name_len; 
-       c = c->hdr.next, i++)
-    if (c->name_len == name_len
-	&& c->dir_cache_len == len
-	&& c->name[0] == name[0] 
-	&& memcmp (c->dir_cache_fh, dir, len) == 0
-	&& strcmp (c->name, name) == 0)
-      {
-	c->stati = i / PARTIAL_THRESH;
-	return c;
-      }
-  
-  return 0;
+  struct lookup_cache *c = (struct lookup_cache *) e;
+
+  if (c->np)
+    netfs_nrele (c->np);
+  free (c);
+}
+
+static void
+init_lookup_cache (void)
+{
+  lrucache_init (&lookup_cache, MAXCACHE, match_cache, free_cache);
+  lrucache_register_shrinker (&lookup_cache, "nfs-name-cache");
 }
-
+
+/* Fill in KEY for NAME, of length NAME_LEN, in the directory whose
+   fhandle is DIR, of length LEN, and return its hash.  */
+static size_t
+make_key (struct lookup_key *key, const char *dir, size_t len,
+	  const char *name, size_t name_len)
+{
+  key->dir = dir;
+  key->len = len;
+  key->name = name;
+  key->name_len = name_len;
+  return hurd_ihash_hash32 (name, name_len,
+			    hurd_ihash_hash32 (dir, len, 0));
+}
+
 /* Node NP has just been found in DIR with NAME.  If NP is null, this
    name has been confirmed as absent in the directory.  DIR is the
    fhandle of the directory and LEN is its length.  */
@@ -110,27 +118,22 @@ void
 enter_lookup_cache (char *dir, size_t len, struct node *np, const char *name)
 {
   struct lookup_cache *c;
+  struct lrucache_entry *e;
+  struct lookup_key key;
   size_t name_len = strlen (name);
-  
+  size_t hash;
+
   if (name_len > CACHE_NAME_LEN - 1)
     return;
 
-  pthread_spin_lock (&cache_lock);
-
-  if (lookup_cache.length == 0)
-    /* There should always be an lru_cache; this being zero means that the
-       cache hasn't been initialized yet.  Do so.  */
-    cacheq_set_length (&lookup_cache, MAXCACHE);
+  pthread_once (&lookup_cache_once, init_lookup_cache);
 
-  /* See if there's an old entry for NAME in DIR.  If not, replace the least
-     recently used entry.  */
-  c = find_cache (dir, len, name, name_len) ?: lookup_cache.lru;
+  c = malloc (sizeof *c);
+  if (! c)
+    return;
 
-  /* Fill C with the new entry.  */
   memcpy (c->dir_cache_fh, dir, len);
   c->dir_cache_len = len;
-  if (c->np)
-    netfs_nrele (c->np);
   c->np = np;
   if (c->np)
     netfs_nref (c->np);
@@ -138,106 +141,53 @@ enter_lookup_cache (char *dir, size_t len, struct node *np, const char *name)
   c->name_len = name_len;
   c->cache_stamp = mapped_time->seconds;
 
-  /* Now C becomes the MRU entry!  */
-  cacheq_make_mru (&lookup_cache, c);
-
-  pthread_spin_unlock (&cache_lock);
-}
-
-/* Purge all references in the cache to NAME within directory DIR. */
-void
-purge_lookup_cache (struct node *dp, const char *name, size_t namelen)
-{
-  struct lookup_cache *c, *next;
-  
-  pthread_spin_lock (&cache_lock);
-  for (c = lookup_cache.mru; c; c = next)
+  /* C replaces any old entry for NAME in DIR.  */
+  hash = make_key (&key, c->dir_cache_fh, len, c->name, name_len);
+  while ((e = lrucache_insert (&lookup_cache, &c->hdr, hash, &key, 1))
+	 != &c->hdr)
     {
-      /* Save C->hdr.next, since we may move C from this position. */
-      next = c->hdr.next;
-
-      if (c->name_len == namelen
-	  && c->dir_cache_len == dp->nn->handle.size
-	  && memcmp (c->dir_cache_fh, dp->nn->handle.data,
-	             c->dir_cache_len) == 0
-	  && strcmp (c->name, name) == 0)
-	{
-	  if (c->np)
-	    netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c); /* Use C as the next free
-						 entry. */
-	}
+      lrucache_remove (&lookup_cache, e);
+      lrucache_release (&lookup_cache, e);
     }
-  pthread_spin_unlock (&cache_lock);
+  lrucache_release (&lookup_cache, &c->hdr);
 }
 
-/* Purge all references in the cache to node NP. */
+/* Purge all references in the cache to NAME within directory DIR. */
 void
-purge_lookup_cache_node (struct node *np)
+purge_lookup_cache (struct node *dp, const char *name, size_t namelen)
 {
-  struct lookup_cache *c, *next;
-  
-  pthread_spin_lock (&cache_lock);
-  for (c = lookup_cache.mru; c; c = next)
+  struct lrucache_entry *e;
+  struct lookup_key key;
+  size_t hash;
+
+  pthread_once (&lookup_cache_once, init_lookup_cache);
+
+  hash = make_key (&key, dp->nn->handle.data, dp->nn->handle.size,
+		   name, namelen);
+  e = lrucache_lookup (&lookup_cache, hash, &key);
+  if (e)
     {
-      next = c->hdr.next;
-      
-      if (c->np == np)
-	{
-	  netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c);
-	}
+      lrucache_remove (&lookup_cache, e);
+      lrucache_release (&lookup_cache, e);
     }
-  pthread_spin_unlock (&cache_lock);
 }
 
-
-
-/* Register a negative hit for an entry in the Nth stat class */
-void
-register_neg_hit (int n)
+static int
+entry_of_node (struct lrucache_entry *e, void *np)
 {
-  int i;
-
-  statistics.neg_hits++;
-
-  for (i = 0; i < n; i++)
-    partial_stats[i].miss++;
-  for (; i < NPARTIALS; i++)
-    partial_stats[i].neg_hits++;
+  return ((struct lookup_cache *) e)->np == np;
 }
 
-/* Register a positive hit for an entry in the Nth stat class */
-void
-register_pos_hit (int n)
-{
-  int i;
-
-  statistics.pos_hits++;
-
-  for (i = 0; i < n; i++)
-    partial_stats[i].miss++;
-  for (; i < NPARTIALS; i++)
-    partial_stats[i].pos_hits++;
-}
-  
-/* Register a miss */
+/* Purge all references in the cache to node NP. */
 void
-register_miss (void)
+purge_lookup_cache_node (struct node *np)
 {
-  int i;
-  
-  statistics.miss++;
-  for (i = 0; i < NPARTIALS; i++)
-    partial_stats[i].miss++;
+  pthread_once (&lookup_cache_once, init_lookup_cache);
+  lrucache_purge (&lookup_cache, entry_of_node, np);
 }
 
 
-
+
 /* Scan the cache looking for NAME inside DIR.  If we know nothing
    about the entry, then return 0.  If the entry is confirmed to not
    exist, then return -1.  Otherwise, return NP for the entry, with
@@ -248,58 +198,41 @@ struct node *
 check_lookup_cache (struct node *dir, const char *name)
 {
   struct lookup_cache *c;
-  
-  pthread_spin_lock (&cache_lock);
+  struct lrucache_entry *e;
+  struct lookup_key key;
+  struct node *np;
+  int timeout;
+  size_t hash;
+
+  pthread_once (&lookup_cache_once, init_lookup_cache);
+
+  hash = make_key (&key, dir->nn->handle.data, dir->nn->handle.size,
+		   name, strlen (name));
+  e = lrucache_lookup (&lookup_cache, hash, &key);
+  if (! e)
+    return 0;
 
-  c = find_cache (dir->nn->handle.data, dir->nn->handle.size,
-		  name, strlen (name));
-  if (c)
+  c = (struct lookup_cache *) e;
+  timeout = c->np ? name_cache_timeout : name_cache_neg_timeout;
+
+  /* Make sure the entry is still usable; if not, zap it now. */
+  if (mapped_time->seconds - c->cache_stamp >= timeout)
     {
-      int timeout = c->np
-	? name_cache_timeout 
-	: name_cache_neg_timeout;
-
-      /* Make sure the entry is still usable; if not, zap it now. */
-      if (mapped_time->seconds - c->cache_stamp >= timeout)
-	{
-	  register_neg_hit (c->stati);
-	  if (c->np)
-	    netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c);
-	  pthread_spin_unlock (&cache_lock);
-	  return 0;
-	}
-
-      cacheq_make_mru (&lookup_cache, c); /* Record C as recently used.  */
-
-      if (c->np == 0)
-	/* A negative cache entry.  */
-	{
-	  register_neg_hit (c->stati);
-	  pthread_spin_unlock (&cache_lock);
-	  pthread_mutex_unlock (&dir->lock);
-	  return (struct node *)-1;
-	}
-      else 
-	{
-	  struct node *np;
-	  
-	  np = c->np;
-	  netfs_nref (np);
-	  register_pos_hit (c->stati);
-	  pthread_spin_unlock (&cache_lock);
-	  
-	  pthread_mutex_unlock (&dir->lock);
-	  pthread_mutex_lock (&np->lock);
-
-	  return np;
-	}
+      lrucache_remove (&lookup_cache, e);
+      lrucache_release (&lookup_cache, e);
+      return 0;
     }
-  
-  register_miss ();
-  pthread_spin_unlock (&cache_lock);
 
-  return 0;
+  np = c->np;
+  if (np)
+    netfs_nref (np);
+  lrucache_release (&lookup_cache, e);
+
+  pthread_mutex_unlock (&dir->lock);
+  if (np == 0)
+    /* A negative cache entry.  */
+    return (struct node *)-1;
+
+  pthread_mutex_lock (&np->lock);
+  return np;
 }
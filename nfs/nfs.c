@@ -167,7 +167,7 @@ xdr_encode_data (int *p, const char *data, size_t len)
 int *
 xdr_encode_64bit (int *p, long long n)
 {
-  *(p++) = htonl (n & 0xffffffff00000000LL >> 32);
+  *(p++) = htonl ((n >> 32) & 0xffffffff);
   *(p++) = htonl (n & 0xffffffff);
   return p;
 }
@@ -469,10 +469,21 @@ xdr_decode_fattr (int *p, struct stat *st)
       p++;
       st->st_rdev = gnu_dev_makedev (major, minor);
     }
-  st->st_fsid = ntohl (*p);
-  p++;
-  st->st_ino = ntohl (*p);
-  p++;
+  if (protocol_version == 2)
+    {
+      st->st_fsid = ntohl (*p);
+      p++;
+      st->st_ino = ntohl (*p);
+      p++;
+    }
+  else
+    {
+      long long n;
+      p = xdr_decode_64bit (p, &n);
+      st->st_fsid = n;
+      p = xdr_decode_64bit (p, &n);
+      st->st_ino = n;
+    }
   st->st_atim.tv_sec = ntohl (*p);
   p++;
   st->st_atim.tv_nsec = ntohl (*p);
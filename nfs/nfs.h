@@ -71,6 +71,15 @@ struct netnode
 
   struct user_pager_info *fileinfo;
 
+  /* Set if data was written with UNSTABLE writes since the last COMMIT,
+     and then the write verifier the server returned for it.  */
+  int uncommitted;
+  char write_verf[NFS3_WRITEVERFSIZE];
+
+  /* Set while we write to the node, so that the attributes the server
+     returns are not taken as a change by someone else.  */
+  int writing;
+
   /* If this node has been renamed by "deletion" then
      this is the directory and the name in that directory
      which is holding the node */
@@ -117,6 +126,18 @@ extern int read_size;
 /* Maximum amout to write at once */
 extern int write_size;
 
+/* How many reads or writes of a single transfer to have outstanding at
+   once; at most NFS_MAX_RPC_WINDOW.  */
+extern int rpc_window;
+#define NFS_MAX_RPC_WINDOW 64
+
+/* Whether to cache the data of regular files */
+extern int cache_file_data;
+
+/* Whether to write with UNSTABLE writes, committed on sync, in protocol
+   version 3 */
+extern int unstable_writes;
+
 /* Service name for portmapper */
 extern char *pmap_service_name;
 
@@ -164,6 +185,8 @@ extern int protocol_version;
 int hurd_mode_to_nfs_type (mode_t);
 int *xdr_encode_fhandle (int *, const struct fhandle *);
 int *xdr_encode_data (int *, const char *, size_t);
+int *xdr_encode_64bit (int *, long long);
+int *xdr_decode_64bit (int *, long long *);
 int *xdr_encode_string (int *, const char *);
 int *xdr_encode_sattr_mode (int *, mode_t);
 int *xdr_encode_sattr_ids (int *, u_int, u_int);
@@ -185,16 +208,32 @@ extern uint16_t mounted_nfs_port; /* host order */
 
 /* ops.c */
 int *register_fresh_stat (struct node *, int *);
+error_t commit_node (struct iouser *, struct node *);
+error_t nfs_read_data (struct iouser *, struct node *, struct fhandle *,
+		       off_t, size_t *, void *);
+error_t nfs_write_data (struct iouser *, struct node *, struct fhandle *,
+			off_t, size_t *, const void *, int);
 
 /* rpc.c */
 int *initialize_rpc (int, int, int, size_t, void **, uid_t, gid_t, gid_t);
 error_t conduct_rpc (void **, int **);
+error_t send_rpc (void *, int *);
+error_t receive_rpc (void **, int **);
+void abandon_rpc (void *);
 void *timeout_service_thread (void *);
 void *rpc_receive_thread (void *);
 
 /* cache.c */
 void lookup_fhandle (struct fhandle *, struct node **);
 int *recache_handle (int *, struct node *);
+error_t commit_all_nodes (struct iouser *);
+
+/* pager.c */
+error_t file_pager_read (struct iouser *, struct node *, off_t, size_t *,
+			 void *);
+void file_pager_prewrite (struct node *, off_t, size_t);
+void file_pager_update (struct node *, int);
+void file_pager_drop (struct node *);
 
 /* name-cache.c */
 void enter_lookup_cache (char *, size_t, struct node *, const char *);
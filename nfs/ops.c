@@ -34,6 +34,18 @@ int *
 register_fresh_stat (struct node *np, int *p)
 {
   int *ret;
+  struct timespec mtime;
+  off_t size;
+
+  if (! np)
+    /* Nobody to update; just skip the attributes.  */
+    {
+      struct stat st;
+      return xdr_decode_fattr (p, &st);
+    }
+
+  mtime = np->nn_stat.st_mtim;
+  size = np->nn_stat.st_size;
 
   ret = xdr_decode_fattr (p, &np->nn_stat);
   np->nn->stat_updated = mapped_time->seconds;
@@ -75,6 +87,12 @@ register_fresh_stat (struct node *np, int *p)
   np->nn_stat.st_flags = 0;
   np->nn_translated = np->nn_stat.st_mode & S_IFMT;
 
+  /* What we cached of the file is stale if someone else changed it.  */
+  file_pager_update (np, ! np->nn->writing
+		     && (np->nn_stat.st_size != size
+			 || np->nn_stat.st_mtim.tv_sec != mtime.tv_sec
+			 || np->nn_stat.st_mtim.tv_nsec != mtime.tv_nsec));
+
   return ret;
 }
 
@@ -96,7 +114,7 @@ process_returned_stat (struct node *np, int *p, int mod)
       p++;
       if (attrs_exist)
 	p = register_fresh_stat (np, p);
-      else if (mod)
+      else if (mod && np)
 	/* We know that our values are now wrong */
 	np->nn->stat_updated = 0;
       return p;
@@ -124,9 +142,9 @@ process_wcc_stat (struct node *np, int *p, int mod)
       if (attrs_exist)
 	{
 	  /* Just skip them for now */
-	  p += 2 * sizeof (int); /* size */
-	  p += 2 * sizeof (int); /* mtime */
-	  p += 2 * sizeof (int); /* atime */
+	  p += 2; /* size */
+	  p += 2; /* mtime */
+	  p += 2; /* ctime */
 	}
 
       /* Now the post_op_attr */
@@ -420,13 +438,53 @@ netfs_attempt_statfs (struct iouser *cred, struct node *np,
   return err;
 }
 
+/* Have the server commit to stable storage the data written to NP with
+   UNSTABLE writes, using the credential CRED.  NP is locked.  */
+error_t
+commit_node (struct iouser *cred, struct node *np)
+{
+  int *p;
+  void *rpcbuf;
+  error_t err;
+
+  if (! np->nn->uncommitted)
+    return 0;
+
+  p = nfs_initialize_rpc (NFS3PROC_COMMIT, cred, 0, &rpcbuf, np, -1);
+  if (! p)
+    return errno;
+
+  p = xdr_encode_fhandle (p, &np->nn->handle);
+  p = xdr_encode_64bit (p, 0);
+  *(p++) = 0;			/* Up to the end of the file.  */
+
+  err = conduct_rpc (&rpcbuf, &p);
+  if (!err)
+    {
+      err = nfs_error_trans (ntohl (*p));
+      p++;
+      p = process_wcc_stat (np, p, !err);
+      if (!err)
+	{
+	  /* If the verifier changed, the server lost the data we wrote
+	     before it restarted, and we no longer have it.  */
+	  if (memcmp (p, np->nn->write_verf, NFS3_WRITEVERFSIZE))
+	    err = EIO;
+	  np->nn->uncommitted = 0;
+	}
+    }
+
+  free (rpcbuf);
+  return err;
+}
+
 /* Implement the netfs_attempt_sync callback as described in
    <hurd/netfs.h>.  */
 error_t
 netfs_attempt_sync (struct iouser *cred, struct node *np, int wait)
 {
-  /* We are already completely synchronous. */
-  return 0;
+  /* We are otherwise completely synchronous. */
+  return commit_node (cred, np);
 }
 
 /* Implement the netfs_attempt_syncfs callback as described in
@@ -434,40 +492,139 @@ netfs_attempt_sync (struct iouser *cred, struct node *np, int wait)
 error_t
 netfs_attempt_syncfs (struct iouser *cred, int wait)
 {
-  return 0;
+  return commit_all_nodes (cred);
 }
 
-/* Implement the netfs_attempt_read callback as described in
-   <hurd/netfs.h>.  */
+/* Send a READ of LEN bytes at OFFSET of NP, whose handle is HANDLE, for
+   CRED, and return its buffer in *RPCBUF to collect the reply with
+   receive_rpc.  */
+static error_t
+send_read (struct iouser *cred, struct node *np, struct fhandle *handle,
+	   off_t offset, size_t len, void **rpcbuf)
+{
+  int *p;
+  error_t err;
+
+  p = nfs_initialize_rpc (NFSPROC_READ (protocol_version),
+			  cred, 0, rpcbuf, np, -1);
+  if (! p)
+    return errno;
+
+  p = xdr_encode_fhandle (p, handle);
+  if (protocol_version == 2)
+    *(p++) = htonl (offset);
+  else
+    p = xdr_encode_64bit (p, offset);
+  *(p++) = htonl (len);
+  if (protocol_version == 2)
+    *(p++) = 0;
+
+  err = send_rpc (*rpcbuf, p);
+  if (err)
+    free (*rpcbuf);
+  return err;
+}
+
+/* Send a WRITE of the LEN bytes at DATA to OFFSET of NP, whose handle
+   is HANDLE, for CRED, and return its buffer in *RPCBUF to collect the
+   reply with receive_rpc.  Unless STABLE is set, the write may be
+   UNSTABLE.  */
+static error_t
+send_write (struct iouser *cred, struct node *np, struct fhandle *handle,
+	    off_t offset, size_t len, const void *data, int stable,
+	    void **rpcbuf)
+{
+  int *p;
+  error_t err;
+
+  p = nfs_initialize_rpc (NFSPROC_WRITE (protocol_version),
+			  cred, len, rpcbuf, np, -1);
+  if (! p)
+    return errno;
+
+  p = xdr_encode_fhandle (p, handle);
+  if (protocol_version == 2)
+    {
+      *(p++) = 0;
+      *(p++) = htonl (offset);
+      *(p++) = 0;
+    }
+  else
+    {
+      p = xdr_encode_64bit (p, offset);
+      *(p++) = htonl (len);
+      *(p++) = htonl (unstable_writes && !stable ? UNSTABLE : FILE_SYNC);
+    }
+  p = xdr_encode_data (p, data, len);
+
+  err = send_rpc (*rpcbuf, p);
+  if (err)
+    free (*rpcbuf);
+  return err;
+}
+
+/* One READ or WRITE of a transfer, sent but not yet collected.  */
+struct transfer_rpc
+{
+  void *rpcbuf;
+  size_t len;
+};
+
+/* Discard the N RPCs of WINDOW outstanding from HEAD onwards.  */
+static void
+abandon_window (struct transfer_rpc *window, int head, int n)
+{
+  while (n-- > 0)
+    {
+      abandon_rpc (window[head].rpcbuf);
+      head = (head + 1) % NFS_MAX_RPC_WINDOW;
+    }
+}
+
+/* Read up to *LEN bytes at OFFSET of the file whose handle is HANDLE
+   into DATA for CRED, and set *LEN to the amount read.  If NP is not null,
+   it is that file, locked, and its attributes are updated from the
+   replies.  Up to RPC_WINDOW reads of READ_SIZE bytes are kept
+   outstanding, and their replies collected in order.  */
 error_t
-netfs_attempt_read (struct iouser *cred, struct node *np,
-		    off_t offset, size_t *len, void *data)
+nfs_read_data (struct iouser *cred, struct node *np, struct fhandle *handle,
+	       off_t offset, size_t *len, void *data)
 {
+  struct transfer_rpc window[NFS_MAX_RPC_WINDOW], *r;
+  int head = 0, n = 0;
   int *p;
   void *rpcbuf;
   size_t trans_len;
-  error_t err;
-  size_t amt, thisamt;
+  error_t err = 0;
+  size_t done, sent;
   int eof;
 
-  for (amt = *len; amt;)
+  for (done = sent = 0; done < *len;)
     {
-      thisamt = amt;
-      if (thisamt > read_size)
-	thisamt = read_size;
-
-      p = nfs_initialize_rpc (NFSPROC_READ (protocol_version),
-			      cred, 0, &rpcbuf, np, -1);
-      if (! p)
-        return errno;
+      /* Keep the window full.  */
+      while (n < rpc_window && sent < *len)
+	{
+	  r = &window[(head + n) % NFS_MAX_RPC_WINDOW];
+	  r->len = *len - sent;
+	  if (r->len > read_size)
+	    r->len = read_size;
+	  err = send_read (cred, np, handle, offset + sent, r->len,
+			   &r->rpcbuf);
+	  if (err)
+	    break;
+	  sent += r->len;
+	  n++;
+	}
+      if (err)
+	break;
 
-      p = xdr_encode_fhandle (p, &np->nn->handle);
-      *(p++) = htonl (offset);
-      *(p++) = htonl (thisamt);
-      if (protocol_version == 2)
-	*(p++) = 0;
+      /* Collect the oldest one.  */
+      r = &window[head];
+      head = (head + 1) % NFS_MAX_RPC_WINDOW;
+      n--;
 
-      err = conduct_rpc (&rpcbuf, &p);
+      rpcbuf = r->rpcbuf;
+      err = receive_rpc (&rpcbuf, &p);
       if (!err)
 	{
 	  err = nfs_error_trans (ntohl (*p));
@@ -475,77 +632,107 @@ netfs_attempt_read (struct iouser *cred, struct node *np,
 
 	  if (!err || protocol_version == 3)
 	    p = process_returned_stat (np, p, !err);
+	}
+      if (err)
+	{
+	  free (rpcbuf);
+	  break;
+	}
 
-	  if (err)
-	    {
-	      free (rpcbuf);
-	      return err;
-	    }
+      trans_len = ntohl (*p);
+      p++;
+      if (trans_len > r->len)
+	trans_len = r->len;	/* ??? */
 
-	  trans_len = ntohl (*p);
+      if (protocol_version == 3)
+	{
+	  eof = ntohl (*p);
 	  p++;
-	  if (trans_len > thisamt)
-	    trans_len = thisamt;	/* ??? */
-
-	  if (protocol_version == 3)
-	    {
-	      eof = ntohl (*p);
-	      p++;
-	    }
-	  else
-	    eof = (trans_len < thisamt);
+	  /* Skip the length of the data.  */
+	  p++;
+	}
+      else
+	eof = (trans_len < r->len);
 
-	  memcpy (data, p, trans_len);
-	  free (rpcbuf);
+      memcpy (data + done, p, trans_len);
+      free (rpcbuf);
+      done += trans_len;
 
-	  data += trans_len;
-	  offset += trans_len;
-	  amt -= trans_len;
+      if (eof)
+	{
+	  *len = done;
+	  break;
+	}
 
-	  if (eof)
-	    {
-	      *len -= amt;
-	      return 0;
-	    }
+      if (trans_len < r->len)
+	/* A short read before the end of the file: the reads still
+	   outstanding were for the wrong offsets.  */
+	{
+	  abandon_window (window, head, n);
+	  n = 0;
+	  sent = done;
 	}
     }
-  return 0;
+
+  abandon_window (window, head, n);
+  return err;
 }
 
-/* Implement the netfs_attempt_write callback as described in
+/* Implement the netfs_attempt_read callback as described in
    <hurd/netfs.h>.  */
 error_t
-netfs_attempt_write (struct iouser *cred, struct node *np,
-		     off_t offset, size_t *len, const void *data)
+netfs_attempt_read (struct iouser *cred, struct node *np,
+		    off_t offset, size_t *len, void *data)
 {
+  if (cache_file_data && S_ISREG (np->nn_stat.st_mode))
+    return file_pager_read (cred, np, offset, len, data);
+  return nfs_read_data (cred, np, &np->nn->handle, offset, len, data);
+}
+
+/* Write the *LEN bytes at DATA to OFFSET of the file whose handle is
+   HANDLE for CRED, and set *LEN to the amount written.  If NP is not
+   null, it is that file, locked, its attributes are updated from the
+   replies, and unless STABLE is set, the writes may be UNSTABLE.  Up to
+   RPC_WINDOW writes of WRITE_SIZE bytes are kept outstanding, and their
+   replies collected in order.  */
+error_t
+nfs_write_data (struct iouser *cred, struct node *np, struct fhandle *handle,
+		off_t offset, size_t *len, const void *data, int stable)
+{
+  struct transfer_rpc window[NFS_MAX_RPC_WINDOW], *r;
+  int head = 0, n = 0;
   int *p;
   void *rpcbuf;
-  error_t err;
-  size_t amt, thisamt;
+  error_t err = 0;
+  size_t done, sent;
   size_t count;
 
-  for (amt = *len; amt;)
+  for (done = sent = 0; done < *len;)
     {
-      thisamt = amt;
-      if (thisamt > write_size)
-	thisamt = write_size;
-
-      p = nfs_initialize_rpc (NFSPROC_WRITE (protocol_version),
-			      cred, thisamt, &rpcbuf, np, -1);
-      if (! p)
-        return errno;
+      /* Keep the window full.  */
+      while (n < rpc_window && sent < *len)
+	{
+	  r = &window[(head + n) % NFS_MAX_RPC_WINDOW];
+	  r->len = *len - sent;
+	  if (r->len > write_size)
+	    r->len = write_size;
+	  err = send_write (cred, np, handle, offset + sent, r->len,
+			    data + sent, stable || !np, &r->rpcbuf);
+	  if (err)
+	    break;
+	  sent += r->len;
+	  n++;
+	}
+      if (err)
+	break;
 
-      p = xdr_encode_fhandle (p, &np->nn->handle);
-      if (protocol_version == 2)
-	*(p++) = 0;
-      *(p++) = htonl (offset);
-      if (protocol_version == 2)
-	*(p++) = 0;
-      if (protocol_version == 3)
-	*(p++) = htonl (FILE_SYNC);
-      p = xdr_encode_data (p, data, thisamt);
+      /* Collect the oldest one.  */
+      r = &window[head];
+      head = (head + 1) % NFS_MAX_RPC_WINDOW;
+      n--;
 
-      err = conduct_rpc (&rpcbuf, &p);
+      rpcbuf = r->rpcbuf;
+      err = receive_rpc (&rpcbuf, &p);
       if (!err)
 	{
 	  err = nfs_error_trans (ntohl (*p));
@@ -556,39 +743,83 @@ netfs_attempt_write (struct iouser *cred, struct node *np,
 	    {
 	      if (protocol_version == 3)
 		{
+		  int committed;
+
 		  count = ntohl (*p);
 		  p++;
-		  p++;		/* ignore COMMITTED */
-		  /* ignore verf for now */
+		  committed = ntohl (*p);
+		  p++;
+		  if (committed != FILE_SYNC && np)
+		    {
+		      if (! np->nn->uncommitted)
+			{
+			  memcpy (np->nn->write_verf, p, NFS3_WRITEVERFSIZE);
+			  np->nn->uncommitted = 1;
+			}
+		      else if (memcmp (np->nn->write_verf, p,
+				       NFS3_WRITEVERFSIZE))
+			/* The server restarted and lost what we wrote
+			   before, which we cannot write again.  */
+			err = EIO;
+		    }
 		  p += NFS3_WRITEVERFSIZE / sizeof (int);
+		  if (count > r->len)
+		    count = r->len;
 		}
 	      else
 		/* assume it wrote the whole thing */
-		count = thisamt;
+		count = r->len;
 
-	      amt -= count;
-	      data += count;
-	      offset += count;
+	      done += count;
 	    }
 	}
-
       free (rpcbuf);
 
-      if (err == EINTR && amt != *len)
-	{
-	  *len -= amt;
-	  return 0;
-	}
-
       if (err)
+	break;
+
+      if (count < r->len)
+	/* A short write: rewrite the rest from there.  */
 	{
-	  *len = 0;
-	  return err;
+	  abandon_window (window, head, n);
+	  n = 0;
+	  sent = done;
 	}
     }
+
+  abandon_window (window, head, n);
+
+  if (err == EINTR && done > 0)
+    {
+      *len = done;
+      return 0;
+    }
+
+  if (err)
+    {
+      *len = 0;
+      return err;
+    }
   return 0;
 }
 
+/* Implement the netfs_attempt_write callback as described in
+   <hurd/netfs.h>.  */
+error_t
+netfs_attempt_write (struct iouser *cred, struct node *np,
+		     off_t offset, size_t *len, const void *data)
+{
+  error_t err;
+
+  /* Have the pages cached for the range written back and dropped, and
+     do not take the new attributes as a change by someone else.  */
+  file_pager_prewrite (np, offset, *len);
+  np->nn->writing = 1;
+  err = nfs_write_data (cred, np, &np->nn->handle, offset, len, data, 0);
+  np->nn->writing = 0;
+  return err;
+}
+
 /* See if NAME exists in DIR for CRED.  If so, return EEXIST.  */
 error_t
 verify_nonexistent (struct iouser *cred, struct node *dir,
@@ -1687,6 +1918,189 @@ netfs_report_access (struct iouser *cred,
 }
 #endif
 
+/* Append to the buffer of directs at *BUFP, of *BUFSIZEP bytes, whose
+   free space starts at *BPP, an entry for NAME of length NAMLEN with
+   FILENO and TYPE; return it.  */
+static struct dirent *
+add_dirent (void **bufp, size_t *bufsizep, void **bpp,
+	    ino_t fileno, const char *name, int namlen, int type)
+{
+  struct dirent *entry;
+  int reclen;
+
+  /* There's a hidden +1 here for the null byte and -1 because d_name
+     has a size of one already in the sizeof.  */
+  reclen = sizeof (struct dirent) + namlen;
+  reclen = (reclen + 3) & ~3; /* make it a multiple of four */
+
+  /* Expand buffer if necessary */
+  if (*bpp + reclen > *bufp + *bufsizep)
+    {
+      char *newbuf;
+
+      newbuf = realloc (*bufp, *bufsizep *= 2);
+      assert_backtrace (newbuf);
+      *bpp = newbuf + (*bpp - *bufp);
+      *bufp = newbuf;
+    }
+
+  /* Fill in new entry */
+  entry = (struct dirent *) *bpp;
+  entry->d_fileno = fileno;
+  entry->d_reclen = reclen;
+  entry->d_type = type;
+  entry->d_namlen = namlen;
+  memcpy (entry->d_name, name, namlen);
+  entry->d_name[namlen] = '\0';
+
+  *bpp += reclen;
+  return entry;
+}
+
+/* The entry NAME of DIR, which is locked, was returned by READDIRPLUS
+   with the handle at HANDLE and the attributes at ATTRS: enter them in
+   the node and name caches, so that looking the entry up and stating it
+   costs no more RPCs.  Return the type of the entry.  */
+static int
+prime_dirent (struct node *dir, const char *name, int *handle, int *attrs)
+{
+  struct node *np;
+  size_t len = ntohl (*handle);
+  int type;
+
+  /* DIR is locked, so never look it up again.  */
+  if (!strcmp (name, ".") || !strcmp (name, "..")
+      || (len == dir->nn->handle.size
+	  && !memcmp (handle + 1, dir->nn->handle.data, len)))
+    return DT_UNKNOWN;
+
+  xdr_decode_fhandle (handle, &np);
+  register_fresh_stat (np, attrs);
+  type = IFTODT (np->nn_stat.st_mode);
+  enter_lookup_cache (dir->nn->handle.data, dir->nn->handle.size, np, name);
+  netfs_nput (np);
+  return type;
+}
+
+/* Fetch the complete contents of DIR, which is locked, like
+   fetch_directory, with READDIRPLUS from protocol version 3: the handle
+   and the attributes of each entry primes the caches.  */
+static error_t
+fetch_directory_plus (struct iouser *cred, struct node *dir,
+		      void **bufp, size_t *bufsizep, int *totalentries)
+{
+  void *buf;
+  size_t bufmalloced;
+  int cookie[2];
+  char verf[NFS3_COOKIEVERFSIZE];
+  int *p;
+  void *rpcbuf;
+  void *bp;
+  int eof;
+  error_t err;
+  int isnext;
+
+  bufmalloced = read_size;
+
+  buf = malloc (bufmalloced);
+  if (! buf)
+    return ENOMEM;
+
+  bp = buf;
+  cookie[0] = cookie[1] = 0;
+  memset (verf, 0, sizeof verf);
+  eof = 0;
+  *totalentries = 0;
+
+  while (!eof)
+    {
+      /* Fetch new directory entries */
+      p = nfs_initialize_rpc (NFS3PROC_READDIRPLUS, cred, 0, &rpcbuf,
+			      dir, -1);
+      if (! p)
+	{
+	  free (buf);
+	  return errno;
+	}
+
+      p = xdr_encode_fhandle (p, &dir->nn->handle);
+      *(p++) = cookie[0];
+      *(p++) = cookie[1];
+      memcpy (p, verf, sizeof verf);
+      p += sizeof verf / sizeof (int);
+      *(p++) = htonl (read_size);	/* dircount */
+      *(p++) = htonl (read_size);	/* maxcount */
+      err = conduct_rpc (&rpcbuf, &p);
+      if (!err)
+	{
+	  err = nfs_error_trans (ntohl (*p));
+	  p++;
+	  p = process_returned_stat (dir, p, 0);
+	}
+      if (err)
+	{
+	  free (rpcbuf);
+	  free (buf);
+	  return err;
+	}
+
+      memcpy (verf, p, sizeof verf);
+      p += sizeof verf / sizeof (int);
+
+      isnext = ntohl (*p);
+      p++;
+
+      /* Now copy them one at a time. */
+      while (isnext)
+	{
+	  long long fileno;
+	  int namlen;
+	  char *name;
+	  int *attrs = NULL, *handle = NULL;
+	  struct dirent *entry;
+
+	  p = xdr_decode_64bit (p, &fileno);
+	  namlen = ntohl (*p);
+	  p++;
+	  name = (char *) p;
+	  p += INTSIZE (namlen);
+
+	  cookie[0] = *(p++);
+	  cookie[1] = *(p++);
+
+	  if (ntohl (*p++))
+	    {
+	      attrs = p;
+	      p = register_fresh_stat (NULL, p);
+	    }
+	  if (ntohl (*p++))
+	    {
+	      handle = p;
+	      p += 1 + INTSIZE (ntohl (*p));
+	    }
+
+	  entry = add_dirent (&buf, &bufmalloced, &bp, fileno, name, namlen,
+			      DT_UNKNOWN);
+	  if (attrs && handle)
+	    entry->d_type = prime_dirent (dir, entry->d_name, handle, attrs);
+
+	  ++*totalentries;
+
+	  isnext = ntohl (*p);
+	  p++;
+	}
+
+      eof = ntohl (*p);
+      p++;
+      free (rpcbuf);
+    }
+
+  /* Return it all to the user */
+  *bufp = buf;
+  *bufsizep = bufmalloced;
+  return 0;
+}
+
 /* Fetch the complete contents of DIR into a buffer of directs.  Set
    *BUFP to that buffer.  *BUFP must be freed by the caller when no
    longer needed.  If an error occurs, don't touch *BUFP and return
@@ -1700,13 +2114,15 @@ fetch_directory (struct iouser *cred, struct node *dir,
   int cookie;
   int *p;
   void *rpcbuf;
-  struct dirent *entry;
   void *bp;
-  int bufmalloced;
+  size_t bufmalloced;
   int eof;
   error_t err;
   int isnext;
 
+  if (protocol_version == 3)
+    return fetch_directory_plus (cred, dir, bufp, bufsizep, totalentries);
+
   bufmalloced = read_size;
 
   buf = malloc (bufmalloced);
@@ -1752,41 +2168,15 @@ fetch_directory (struct iouser *cred, struct node *dir,
 	{
 	  ino_t fileno;
 	  int namlen;
-	  int reclen;
 
 	  fileno = ntohl (*p);
 	  p++;
 	  namlen = ntohl (*p);
 	  p++;
 
-	  /* There's a hidden +1 here for the null byte and -1 because d_name
-	     has a size of one already in the sizeof.  */
-	  reclen = sizeof (struct dirent) + namlen;
-	  reclen = (reclen + 3) & ~3; /* make it a multiple of four */
-
-	  /* Expand buffer if necessary */
-	  if (bp + reclen > buf + bufmalloced)
-	    {
-	      char *newbuf;
-
-	      newbuf = realloc (buf, bufmalloced *= 2);
-	      assert_backtrace (newbuf);
-	      if (newbuf != buf)
-		bp = newbuf + (bp - buf);
-	      buf = newbuf;
-	    }
-
-	  /* Fill in new entry */
-	  entry = (struct dirent *) bp;
-	  entry->d_fileno = fileno;
-	  entry->d_reclen = reclen;
-	  entry->d_type = DT_UNKNOWN;
-	  entry->d_namlen = namlen;
-	  memcpy (entry->d_name, p, namlen);
-	  entry->d_name[namlen] = '\0';
-
+	  add_dirent (&buf, &bufmalloced, &bp, fileno, (char *) p, namlen,
+		      DT_UNKNOWN);
 	  p += INTSIZE (namlen);
-	  bp = bp + entry->d_reclen;
 
 	  ++*totalentries;
 
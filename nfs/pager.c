@@ -0,0 +1,437 @@
+/* pager.c - Caching the data of NFS files with libpager.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+/* Each regular file that is read or mapped gets a pager, so that its
+   data is cached by the kernel as long as the node lives, and io_map
+   returns a real memory object.  Pages are read and written with the
+   credentials of root, and without taking the lock on the node: a
+   thread holding that lock may be waiting for one of our pages.  */
+
+#include "nfs.h"
+
+#include <hurd/pager.h>
+#include <assert-backtrace.h>
+#include <error.h>
+#include <string.h>
+#include <sys/mman.h>
+
+struct user_pager_info
+{
+  struct node *np;
+  struct pager *p;
+
+  /* A copy of the handle of NP, so that it can be used without NP's
+     lock.  */
+  struct fhandle handle;
+
+  /* Protects the fields below.  */
+  pthread_mutex_t lock;
+
+  /* The size of the file, as of the last attributes of NP.  */
+  off_t size;
+
+  /* Readahead: the page just past the last one read in, and the number
+     of pages read ahead of it.  */
+  vm_offset_t ra_next;
+  int ra_window;
+};
+
+/* Protects the FILEINFO field of every netnode.  */
+static pthread_spinlock_t node2pagelock = PTHREAD_SPINLOCK_INITIALIZER;
+
+static struct port_bucket *pager_bucket;
+static struct pager_requests *pager_requests;
+static pthread_once_t pager_once = PTHREAD_ONCE_INIT;
+
+static void
+init_pagers (void)
+{
+  error_t err;
+
+  pager_bucket = ports_create_bucket ();
+  err = pager_start_workers (pager_bucket, &pager_requests);
+  if (err)
+    error (0, err, "pager_start_workers");
+}
+
+/* Return the pager of NP with a reference, or null if it has none.  */
+static struct pager *
+node_pager (struct node *np)
+{
+  struct pager *p = NULL;
+
+  pthread_spin_lock (&node2pagelock);
+  if (np->nn->fileinfo)
+    {
+      p = np->nn->fileinfo->p;
+      ports_port_ref (p);
+    }
+  pthread_spin_unlock (&node2pagelock);
+  return p;
+}
+
+/* Sequential pageins double the readahead window up to
+   READAHEAD_MAX_PAGES; any other pagein closes it.  */
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+/* The NPAGES pages of UPI at PAGE were just read in; if the file is being
+   read sequentially, offer the kernel the pages after them.  */
+static void
+file_pager_readahead (struct user_pager_info *upi, vm_offset_t page,
+		      int npages)
+{
+  vm_offset_t start = page + npages * vm_page_size;
+  vm_size_t end;
+  size_t len;
+  int window, i;
+  error_t err;
+  void *buf;
+
+  pthread_mutex_lock (&upi->lock);
+  if (page != upi->ra_next)
+    {
+      upi->ra_window = 0;
+      upi->ra_next = start;
+      pthread_mutex_unlock (&upi->lock);
+      return;
+    }
+  window = upi->ra_window * 2 ?: READAHEAD_MIN_PAGES;
+  if (window > READAHEAD_MAX_PAGES)
+    window = READAHEAD_MAX_PAGES;
+  upi->ra_window = window;
+  upi->ra_next = start;
+  end = round_page (upi->size);
+  pthread_mutex_unlock (&upi->lock);
+
+  if (start >= end)
+    return;
+  npages = (end - start) / vm_page_size;
+  if (npages > window)
+    npages = window;
+
+  buf = mmap (0, npages * vm_page_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    return;
+
+  i = pager_prepare_offer (upi->p, start, npages);
+  if (i < npages)
+    munmap (buf + i * vm_page_size, (npages - i) * vm_page_size);
+  npages = i;
+  if (npages == 0)
+    return;
+
+  pthread_mutex_lock (&upi->lock);
+  upi->ra_next = start + npages * vm_page_size;
+  pthread_mutex_unlock (&upi->lock);
+
+  len = npages * vm_page_size;
+  err = nfs_read_data ((struct iouser *) -1, NULL, &upi->handle,
+		       start, &len, buf);
+  pager_offer_pages (upi->p, 0, start, npages, (vm_address_t) buf,
+		     err ? EIO : 0);
+}
+
+/* Implement the pager_read_pages callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  What lies past the end
+   of the file reads as zeros.  */
+error_t
+pager_read_pages (struct user_pager_info *upi, vm_offset_t offset,
+		  int npages, vm_address_t *buf, int *writelock)
+{
+  size_t len = npages * vm_page_size;
+  void *data;
+  error_t err;
+
+  data = mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (data == MAP_FAILED)
+    return EIO;
+
+  err = nfs_read_data ((struct iouser *) -1, NULL, &upi->handle,
+		       offset, &len, data);
+  if (err)
+    {
+      munmap (data, npages * vm_page_size);
+      return EIO;
+    }
+
+  *buf = (vm_address_t) data;
+  *writelock = 0;
+  file_pager_readahead (upi, offset, npages);
+  return 0;
+}
+
+/* Implement the pager_read_page callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  */
+error_t
+pager_read_page (struct user_pager_info *upi, vm_offset_t page,
+		 vm_address_t *buf, int *writelock)
+{
+  return pager_read_pages (upi, page, 1, buf, writelock);
+}
+
+/* Implement the pager_write_pages callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  Nothing is written past
+   the end of the file.  */
+void
+pager_write_pages (struct user_pager_info *upi, vm_offset_t offset,
+		   vm_address_t buf, int npages, error_t *errors)
+{
+  size_t len = npages * vm_page_size;
+  error_t err = 0;
+  int i;
+
+  pthread_mutex_lock (&upi->lock);
+  if (offset >= upi->size)
+    len = 0;
+  else if (offset + len > upi->size)
+    len = upi->size - offset;
+  pthread_mutex_unlock (&upi->lock);
+
+  if (len > 0)
+    {
+      err = nfs_write_data ((struct iouser *) -1, NULL, &upi->handle,
+			    offset, &len, (void *) buf, 1);
+      if (err && err != ENOSPC && err != EDQUOT)
+	err = EIO;
+
+      /* The attributes changed under the node.  */
+      __atomic_store_n (&upi->np->nn->stat_updated, 0, __ATOMIC_RELAXED);
+    }
+
+  for (i = 0; i < npages; i++)
+    errors[i] = err;
+}
+
+/* Implement the pager_write_page callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  */
+error_t
+pager_write_page (struct user_pager_info *upi, vm_offset_t page,
+		  vm_address_t buf)
+{
+  error_t err;
+
+  pager_write_pages (upi, page, buf, 1, &err);
+  return err;
+}
+
+/* Implement the pager_unlock_page callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  */
+error_t
+pager_unlock_page (struct user_pager_info *upi, vm_offset_t address)
+{
+  return 0;
+}
+
+void
+pager_notify_evict (struct user_pager_info *upi, vm_offset_t page)
+{
+  assert_backtrace (!"unrequested notification on eviction");
+}
+
+/* Implement the pager_report_extent callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  */
+error_t
+pager_report_extent (struct user_pager_info *upi,
+		     vm_address_t *offset, vm_size_t *size)
+{
+  *offset = 0;
+  pthread_mutex_lock (&upi->lock);
+  *size = upi->size;
+  pthread_mutex_unlock (&upi->lock);
+  return 0;
+}
+
+/* Implement the pager_clear_user_data callback from the pager library.
+   See <hurd/pager.h> for the interface definition.  */
+void
+pager_clear_user_data (struct user_pager_info *upi)
+{
+  pthread_spin_lock (&node2pagelock);
+  if (upi->np->nn->fileinfo == upi)
+    upi->np->nn->fileinfo = 0;
+  pthread_spin_unlock (&node2pagelock);
+  netfs_nrele_light (upi->np);
+}
+
+void
+pager_dropweak (struct user_pager_info *upi)
+{
+}
+
+/* Implement the netfs_get_filemap callback as described in
+   <hurd/netfs.h>.  Only regular files have a memory object; NP is
+   locked.  */
+mach_port_t
+netfs_get_filemap (struct node *np, vm_prot_t prot)
+{
+  struct user_pager_info *upi;
+  mach_port_t right;
+
+  if (! S_ISREG (np->nn_stat.st_mode))
+    {
+      errno = EOPNOTSUPP;
+      return MACH_PORT_NULL;
+    }
+
+  pthread_once (&pager_once, init_pagers);
+
+  pthread_spin_lock (&node2pagelock);
+  do
+    if (! np->nn->fileinfo)
+      {
+	struct pager *p;
+	p = pager_create_alloc (sizeof *upi, pager_bucket, 1,
+				MEMORY_OBJECT_COPY_DELAY, 0);
+	if (p == NULL)
+	  {
+	    pthread_spin_unlock (&node2pagelock);
+	    return MACH_PORT_NULL;
+	  }
+	upi = pager_get_upi (p);
+	upi->np = np;
+	netfs_nref_light (np);
+	upi->p = p;
+	upi->handle = np->nn->handle;
+	pthread_mutex_init (&upi->lock, NULL);
+	upi->size = np->nn_stat.st_size;
+	upi->ra_next = 0;
+	upi->ra_window = 0;
+	np->nn->fileinfo = upi;
+	right = pager_get_port (p);
+	ports_port_deref (p);
+      }
+    else
+      {
+	/* NP->nn->fileinfo->p is not a real reference, so the pager might
+	   be nearly deallocated, in which case the port right is null.
+	   Clear it then, and loop; the deallocation completes
+	   separately.  */
+	right = pager_get_port (np->nn->fileinfo->p);
+	if (right == MACH_PORT_NULL)
+	  np->nn->fileinfo = 0;
+      }
+  while (right == MACH_PORT_NULL);
+  pthread_spin_unlock (&node2pagelock);
+
+  mach_port_insert_right (mach_task_self (), right, right,
+			  MACH_MSG_TYPE_MAKE_SEND);
+  return right;
+}
+
+/* Read up to *LEN bytes at OFFSET of the regular file NP into DATA for
+   CRED through its pager, and set *LEN to the amount read.  NP is
+   locked.  What cannot be read through the pager is read directly.  */
+error_t
+file_pager_read (struct iouser *cred, struct node *np,
+		 off_t offset, size_t *len, void *data)
+{
+  memory_object_t memobj;
+  struct pager *p;
+  size_t amount, done = 0;
+  error_t err;
+
+  /* Make sure the cache is still valid, and the size right.  */
+  err = netfs_validate_stat (np, cred);
+  if (err)
+    return err;
+
+  if (offset >= np->nn_stat.st_size)
+    {
+      *len = 0;
+      return 0;
+    }
+  if (*len > np->nn_stat.st_size - offset)
+    *len = np->nn_stat.st_size - offset;
+
+  memobj = netfs_get_filemap (np, VM_PROT_READ);
+  p = memobj == MACH_PORT_NULL ? NULL : node_pager (np);
+  if (p)
+    {
+      done = *len;
+      err = pager_memcpy (p, memobj, offset, data, &done, VM_PROT_READ);
+      ports_port_deref (p);
+    }
+  if (memobj != MACH_PORT_NULL)
+    mach_port_deallocate (mach_task_self (), memobj);
+
+  if (done < *len)
+    /* The pager could not be used, or faulted.  */
+    {
+      amount = *len - done;
+      err = nfs_read_data (cred, np, &np->nn->handle, offset + done,
+			   &amount, data + done);
+      *len = done + amount;
+    }
+  else
+    err = 0;
+
+  return err;
+}
+
+/* NP, which is locked, is about to be written LEN bytes at OFFSET to
+   directly: have what its pager cached there written back and
+   dropped.  */
+void
+file_pager_prewrite (struct node *np, off_t offset, size_t len)
+{
+  struct pager *p = node_pager (np);
+  vm_offset_t start = trunc_page (offset);
+
+  if (p)
+    {
+      pager_return_some (p, start, round_page (offset + len) - start, 1);
+      ports_port_deref (p);
+    }
+}
+
+/* The attributes of NP, which is locked, were just updated; if CHANGED,
+   its data changed on the server, and has to be read again.  */
+void
+file_pager_update (struct node *np, int changed)
+{
+  struct pager *p = node_pager (np);
+
+  if (p)
+    {
+      struct user_pager_info *upi = pager_get_upi (p);
+
+      pthread_mutex_lock (&upi->lock);
+      upi->size = np->nn_stat.st_size;
+      pthread_mutex_unlock (&upi->lock);
+
+      if (changed)
+	pager_return (p, 0);
+      ports_port_deref (p);
+    }
+}
+
+/* NP, which is locked, lost its last hard reference: let its pager be
+   freed once nothing maps it.  */
+void
+file_pager_drop (struct node *np)
+{
+  struct pager *p = node_pager (np);
+
+  if (p)
+    {
+      pager_change_attributes (p, 0, MEMORY_OBJECT_COPY_DELAY, 0);
+      ports_port_deref (p);
+    }
+}
@@ -43,6 +43,12 @@ struct rpc_list
 {
   struct rpc_list *next, **prevp;
   void *reply;
+
+  /* The length of the message, and when and how many times it was
+     transmitted.  */
+  size_t len;
+  time_t lasttrans;
+  int ntransmit;
 };
 
 /* A list of all pending RPCs.  */
@@ -167,6 +173,65 @@ link_rpc (struct rpc_list **list, struct rpc_list *hdr)
   *list = hdr;
 }
 
+/* Transmit HDR once more.  On failure, HDR is unlinked.  The rpc_list's
+   lock (OUTSTANDING_LOCK) must be held.  */
+static error_t
+transmit_rpc (struct rpc_list *hdr)
+{
+  ssize_t cc;
+
+  hdr->lasttrans = mapped_time->seconds;
+  hdr->ntransmit++;
+  cc = write (main_udp_socket, (void *) hdr + sizeof (struct rpc_list),
+	      hdr->len);
+  if (cc == -1)
+    {
+      unlink_rpc (hdr);
+      return errno;
+    }
+  else
+    assert_backtrace (cc == hdr->len);
+  return 0;
+}
+
+/* Send the specified RPC message, without waiting for its reply.
+   RPCBUF is the initialized buffer from a previous initialize_rpc call;
+   P, the payload, points past the filledin args.  Once this returns
+   successfully, the reply must be collected with receive_rpc, or
+   discarded with abandon_rpc; on failure, the caller frees RPCBUF.  */
+error_t
+send_rpc (void *rpcbuf, int *p)
+{
+  struct rpc_list *hdr = rpcbuf;
+  error_t err;
+
+  hdr->len = (void *) p - rpcbuf - sizeof (struct rpc_list);
+  hdr->ntransmit = 0;
+
+  pthread_mutex_lock (&outstanding_lock);
+  link_rpc (&outstanding_rpcs, hdr);
+  err = transmit_rpc (hdr);
+  pthread_mutex_unlock (&outstanding_lock);
+
+  return err;
+}
+
+/* Forget about the RPC sent with send_rpc in RPCBUF, and free it along
+   with its reply if one came.  */
+void
+abandon_rpc (void *rpcbuf)
+{
+  struct rpc_list *hdr = rpcbuf;
+
+  pthread_mutex_lock (&outstanding_lock);
+  if (!hdr->reply)
+    unlink_rpc (hdr);
+  pthread_mutex_unlock (&outstanding_lock);
+
+  free (hdr->reply);
+  free (hdr);
+}
+
 /* Send the specified RPC message.  *RPCBUF is the initialized buffer
    from a previous initialize_rpc call; *PP, the payload, points past
    the filledin args.  Set *PP to the address of the reply contents
@@ -175,55 +240,50 @@ link_rpc (struct rpc_list **list, struct rpc_list *hdr)
    *RPCBUF will be freed by this routine.  */
 error_t
 conduct_rpc (void **rpcbuf, int **pp)
+{
+  error_t err;
+
+  err = send_rpc (*rpcbuf, *pp);
+  if (err)
+    return err;
+  return receive_rpc (rpcbuf, pp);
+}
+
+/* Wait for the reply to the RPC sent with send_rpc in *RPCBUF,
+   retransmitting it as needed.  Set *PP to the address of the reply
+   contents themselves.  The user will be expected to free *RPCBUF
+   (which will have changed) when done with the reply contents.  The old
+   value of *RPCBUF will be freed by this routine.  */
+error_t
+receive_rpc (void **rpcbuf, int **pp)
 {
   struct rpc_list *hdr = *rpcbuf;
   error_t err;
-  size_t cc, nc;
   int timeout = initial_transmit_timeout;
-  time_t lasttrans;
-  int ntransmit = 0;
   int *p;
   int xid;
   int n;
   int cancel;
-  
-  pthread_mutex_lock (&outstanding_lock);
-
-  link_rpc (&outstanding_rpcs, hdr);
 
   xid = * (int *) (*rpcbuf + sizeof (struct rpc_list));
 
-  do
-    {
-      /* If we've sent enough, give up.  */
-      if (mounted_soft && ntransmit == soft_retries)
-	{
-	  unlink_rpc (hdr);
-	  pthread_mutex_unlock (&outstanding_lock);
-	  return ETIMEDOUT;
-	}
+  pthread_mutex_lock (&outstanding_lock);
 
-      /* Issue the RPC.  */
-      lasttrans = mapped_time->seconds;
-      ntransmit++;
-      nc = (void *) *pp - *rpcbuf - sizeof (struct rpc_list);
-      cc = write (main_udp_socket, *rpcbuf + sizeof (struct rpc_list), nc);
-      if (cc == -1)
-	{
-	  unlink_rpc (hdr);
-	  pthread_mutex_unlock (&outstanding_lock);
-	  return errno;
-	}
-      else 
-	assert_backtrace (cc == nc);
-      
+  while (!hdr->reply)
+    {
       /* Wait for reply.  */
       cancel = 0;
       while (!hdr->reply
-	     && (mapped_time->seconds - lasttrans < timeout)
+	     && (mapped_time->seconds - hdr->lasttrans < timeout)
 	     && !cancel)
 	cancel = pthread_hurd_cond_wait_np (&rpc_wakeup, &outstanding_lock);
-  
+
+      /* hdr->reply will have been filled in by rpc_receive_thread,
+         if it has been filled in, then the rpc has been fulfilled,
+         otherwise, retransmit and continue to wait.  */
+      if (hdr->reply)
+	break;
+
       if (cancel)
 	{
 	  unlink_rpc (hdr);
@@ -231,17 +291,25 @@ conduct_rpc (void **rpcbuf, int **pp)
 	  return EINTR;
 	}
 
-      /* hdr->reply will have been filled in by rpc_receive_thread,
-         if it has been filled in, then the rpc has been fulfilled,
-         otherwise, retransmit and continue to wait.  */
-      if (!hdr->reply)
+      /* If we've sent enough, give up.  */
+      if (mounted_soft && hdr->ntransmit == soft_retries)
 	{
-	  timeout *= 2;
-	  if (timeout > max_transmit_timeout)
-	    timeout = max_transmit_timeout;
+	  unlink_rpc (hdr);
+	  pthread_mutex_unlock (&outstanding_lock);
+	  return ETIMEDOUT;
+	}
+
+      timeout *= 2;
+      if (timeout > max_transmit_timeout)
+	timeout = max_transmit_timeout;
+
+      err = transmit_rpc (hdr);
+      if (err)
+	{
+	  pthread_mutex_unlock (&outstanding_lock);
+	  return err;
 	}
     }
-  while (!hdr->reply);
 
   pthread_mutex_unlock (&outstanding_lock);
 
@@ -40,8 +40,8 @@
 #undef malloc
 
 #define IDHASH_TABLE_SIZE 1024
-#define FHHASH_TABLE_SIZE 1024
-#define REPLYHASH_TABLE_SIZE 1024
+#define FHHASH_TABLE_SIZE 4096
+#define REPLYHASH_TABLE_SIZE 4096
 
 
 static struct idspec *idhashtable[IDHASH_TABLE_SIZE];
@@ -255,60 +255,101 @@ scan_creds (void)
 
 static struct cache_handle *fhhashtable[FHHASH_TABLE_SIZE];
 pthread_mutex_t fhhashlock = PTHREAD_MUTEX_INITIALIZER;
-static int nfreefh;
-static int leastfhlastuse;
+static int nfhs;
+
+/* The unreferenced handles, least recently released first.  Their ports
+   are kept for a later request of the handle, until they are too old or
+   the first is dropped to make room for a new handle once there are
+   MAX_CACHED_HANDLES.  */
+static struct cache_handle *lru_fhs;
+static struct cache_handle **lru_fhs_tail = &lru_fhs;
 
 static int
 fh_hash (char *fhandle, struct idspec *i)
 {
-  int hash = 0, n;
+  uint32_t hash = (uintptr_t) i >> 6;
+  int n;
 
   for (n = 0; n < NFS2_FHSIZE; n++)
-    hash += fhandle[n];
-  hash += (intptr_t) i >> 6;
+    hash = (hash ^ (unsigned char) fhandle[n]) * 0x01000193;
   return hash % FHHASH_TABLE_SIZE;
 }
 
-int *
-lookup_cache_handle (int *p, struct cache_handle **cp, struct idspec *i)
+static void
+fh_lru_remove (struct cache_handle *c)
+{
+  *c->lru_prevp = c->lru_next;
+  if (c->lru_next)
+    c->lru_next->lru_prevp = c->lru_prevp;
+  else
+    lru_fhs_tail = c->lru_prevp;
+}
+
+/* Drop C, which is unreferenced, from the cache and free it.  */
+static void
+drop_fh (struct cache_handle *c)
+{
+  fh_lru_remove (c);
+  *c->prevp = c->next;
+  if (c->next)
+    c->next->prevp = c->prevp;
+  cred_rele (c->ids);
+  mach_port_deallocate (mach_task_self (), c->port);
+  free (c);
+  nfhs--;
+}
+
+/* Return the cached handle for FHANDLE and I, in bucket HASH, with a new
+   reference, or null if there is none.  FHHASHLOCK is held.  */
+static struct cache_handle *
+find_fh (char *fhandle, struct idspec *i, int hash)
 {
-  int hash;
   struct cache_handle *c;
-  fsys_t fsys;
-  file_t port;
 
-  hash = fh_hash ((char *)p, i);
-  pthread_mutex_lock (&fhhashlock);
   for (c = fhhashtable[hash]; c; c = c->next)
-    if (c->ids == i && ! bcmp (c->handle.array, p, NFS2_FHSIZE))
+    if (c->ids == i && ! bcmp (c->handle.array, fhandle, NFS2_FHSIZE))
       {
 	if (c->references == 0)
-	  nfreefh--;
+	  fh_lru_remove (c);
 	c->references++;
-	pthread_mutex_unlock (&fhhashlock);
-	*cp = c;
-	return p + NFS2_FHSIZE / sizeof (int);
+	return c;
       }
+  return 0;
+}
 
-  /* Not found.  */
+/* Cache PORT as the file FHANDLE opened for I, in bucket HASH, and return
+   the cached handle with a reference; if another thread cached it in the
+   meantime, return that one and deallocate PORT instead.  */
+static struct cache_handle *
+enter_fh (char *fhandle, struct idspec *i, int hash, file_t port)
+{
+  struct cache_handle *c;
 
-  /* First four bytes are our internal table of filesystems.  */
-  fsys = lookup_filesystem (*p);
-  if (fsys == MACH_PORT_NULL
-      || fsys_getfile (fsys, i->uids, i->nuids, i->gids, i->ngids,
-		       (char *)(p + 1), NFS2_FHSIZE - sizeof (int), &port))
+  pthread_mutex_lock (&fhhashlock);
+  c = find_fh (fhandle, i, hash);
+  if (c)
     {
       pthread_mutex_unlock (&fhhashlock);
-      *cp = 0;
-      return p + NFS2_FHSIZE / sizeof (int);
+      mach_port_deallocate (mach_task_self (), port);
+      return c;
     }
 
+  if (nfhs >= MAX_CACHED_HANDLES && lru_fhs)
+    drop_fh (lru_fhs);
+
   c = malloc (sizeof (struct cache_handle));
-  memcpy (c->handle.array, p, NFS2_FHSIZE);
+  if (! c)
+    {
+      pthread_mutex_unlock (&fhhashlock);
+      mach_port_deallocate (mach_task_self (), port);
+      return 0;
+    }
+  memcpy (c->handle.array, fhandle, NFS2_FHSIZE);
   cred_ref (i);
   c->ids = i;
   c->port = port;
   c->references = 1;
+  nfhs++;
 
   c->next = fhhashtable[hash];
   if (c->next)
@@ -317,7 +358,44 @@ lookup_cache_handle (int *p, struct cache_handle **cp, struct idspec *i)
   fhhashtable[hash] = c;
 
   pthread_mutex_unlock (&fhhashlock);
-  *cp = c;
+  return c;
+}
+
+/* The file handles come back to us from the clients as they are, so a
+   handle missing from the cache is reopened with fsys_getfile straight
+   from the handle, without walking any name.  FHHASHLOCK is not held
+   meanwhile, so that a slow filesystem holds up no other lookup.  */
+int *
+lookup_cache_handle (int *p, struct cache_handle **cp, struct idspec *i)
+{
+  int hash;
+  struct cache_handle *c;
+  fsys_t fsys;
+  file_t port;
+
+  hash = fh_hash ((char *)p, i);
+  pthread_mutex_lock (&fhhashlock);
+  c = find_fh ((char *)p, i, hash);
+  pthread_mutex_unlock (&fhhashlock);
+  if (c)
+    {
+      *cp = c;
+      return p + NFS2_FHSIZE / sizeof (int);
+    }
+
+  /* Not found.  */
+
+  /* First four bytes are our internal table of filesystems.  */
+  fsys = lookup_filesystem (*p);
+  if (fsys == MACH_PORT_NULL
+      || fsys_getfile (fsys, i->uids, i->nuids, i->gids, i->ngids,
+		       (char *)(p + 1), NFS2_FHSIZE - sizeof (int), &port))
+    {
+      *cp = 0;
+      return p + NFS2_FHSIZE / sizeof (int);
+    }
+
+  *cp = enter_fh ((char *)p, i, hash, port);
   return p + NFS2_FHSIZE / sizeof (int);
 }
 
@@ -329,9 +407,10 @@ cache_handle_rele (struct cache_handle *c)
   if (c->references == 0)
     {
       c->lastuse = mapped_time->seconds;
-      if (c->lastuse < leastfhlastuse || nfreefh == 0)
-	leastfhlastuse = c->lastuse;
-      nfreefh++;
+      c->lru_next = 0;
+      c->lru_prevp = lru_fhs_tail;
+      *lru_fhs_tail = c;
+      lru_fhs_tail = &c->lru_next;
     }
   pthread_mutex_unlock (&fhhashlock);
 }
@@ -339,43 +418,14 @@ cache_handle_rele (struct cache_handle *c)
 void
 scan_fhs (void)
 {
-  int n;
-  int newleast = mapped_time->seconds;
-
   pthread_mutex_lock (&fhhashlock);
 
-  if (mapped_time->seconds - leastfhlastuse > FH_KEEP_TIMEOUT)
-    {
-      for (n = 0; n < FHHASH_TABLE_SIZE && nfreefh; n++)
-	{
-	  struct cache_handle *c = fhhashtable[n];
-
-	  while (c && nfreefh)
-	    {
-	      struct cache_handle *next_c = c->next;
-
-	      if (!c->references
-		  && mapped_time->seconds - c->lastuse > FH_KEEP_TIMEOUT)
-		{
-		  nfreefh--;
-		  *c->prevp = c->next;
-		  if (c->next)
-		    c->next->prevp = c->prevp;
-		  cred_rele (c->ids);
-		  mach_port_deallocate (mach_task_self (), c->port);
-		  free (c);
-		}
-	      else if (!c->references && newleast > c->lastuse)
-		newleast = c->lastuse;
-
-	      c = next_c;
-	    }
-	}
+  /* The list is in order of last use, so stop at the first handle still
+     young enough.  */
+  while (lru_fhs
+	 && mapped_time->seconds - lru_fhs->lastuse > FH_KEEP_TIMEOUT)
+    drop_fh (lru_fhs);
 
-      /* If we didn't bail early, then this is valid.  */
-      if (nfreefh)
-	leastfhlastuse = newleast;
-    }
   pthread_mutex_unlock (&fhhashlock);
 }
 
@@ -420,17 +470,10 @@ create_cached_handle (int fs, struct cache_handle *credc, file_t userport)
   /* Cache it.  */
   hash = fh_hash (fhandle.array, credc->ids);
   pthread_mutex_lock (&fhhashlock);
-  for (c = fhhashtable[hash]; c; c = c->next)
-    if (c->ids == credc->ids &&
-        ! bcmp (fhandle.array, c->handle.array, NFS2_FHSIZE))
-      {
-	/* Return this one.  */
-	if (c->references == 0)
-	  nfreefh--;
-	c->references++;
-	pthread_mutex_unlock (&fhhashlock);
-	return c;
-      }
+  c = find_fh (fhandle.array, credc->ids, hash);
+  pthread_mutex_unlock (&fhhashlock);
+  if (c)
+    return c;
 
   /* Always call fsys_getfile so that we don't depend on the
      particular open modes of the port passed in.  */
@@ -441,36 +484,51 @@ create_cached_handle (int fs, struct cache_handle *credc, file_t userport)
 		      fhandle.array + sizeof (int), NFS2_FHSIZE - sizeof (int),
 		      &newport);
   if (err)
-    {
-      pthread_mutex_unlock (&fhhashlock);
-      return 0;
-    }
-
-  /* Create it anew.  */
-  c = malloc (sizeof (struct cache_handle));
-  memcpy (c->handle.array, fhandle.array, NFS2_FHSIZE);
-  cred_ref (credc->ids);
-  c->ids = credc->ids;
-  c->port = newport;
-  c->references = 1;
-
-  /* And add it to the hash table.  */
-  c->next = fhhashtable[hash];
-  if (c->next)
-    c->next->prevp = &c->next;
-  c->prevp = &fhhashtable[hash];
-  fhhashtable[hash] = c;
-  pthread_mutex_unlock (&fhhashlock);
+    return 0;
 
-  return c;
+  return enter_fh (fhandle.array, credc->ids, hash, newport);
 }
 
-
+
 
 static struct cached_reply *replyhashtable [REPLYHASH_TABLE_SIZE];
 static pthread_spinlock_t replycachelock = PTHREAD_SPINLOCK_INITIALIZER;
-static int nfreereplies;
-static int leastreplylastuse;
+static int nreplies;
+
+/* The unreferenced replies, least recently released first; the first
+   is dropped to make room once there are MAX_CACHED_REPLIES.  */
+static struct cached_reply *lru_replies;
+static struct cached_reply **lru_replies_tail = &lru_replies;
+
+static int
+reply_hash (int xid, struct sockaddr_in *sender)
+{
+  uint32_t hash = xid ^ sender->sin_addr.s_addr ^ sender->sin_port;
+  return (hash * 0x9e3779b1) % REPLYHASH_TABLE_SIZE;
+}
+
+static void
+lru_remove (struct cached_reply *cr)
+{
+  *cr->lru_prevp = cr->lru_next;
+  if (cr->lru_next)
+    cr->lru_next->lru_prevp = cr->lru_prevp;
+  else
+    lru_replies_tail = cr->lru_prevp;
+}
+
+/* Drop CR, which is unreferenced, from the cache.  */
+static void
+drop_reply (struct cached_reply *cr)
+{
+  lru_remove (cr);
+  *cr->prevp = cr->next;
+  if (cr->next)
+    cr->next->prevp = cr->prevp;
+  if (cr->data)
+    free (cr->data);
+  nreplies--;
+}
 
 /* Check the list of cached replies to see if this is a replay of a
    previous transaction; if so, return the cache record.  Otherwise,
@@ -482,7 +540,7 @@ check_cached_replies (int xid,
   struct cached_reply *cr;
   int hash;
 
-  hash = abs(xid % REPLYHASH_TABLE_SIZE);
+  hash = reply_hash (xid, sender);
 
   pthread_spin_lock (&replycachelock);
   for (cr = replyhashtable[hash]; cr; cr = cr->next)
@@ -491,19 +549,29 @@ check_cached_replies (int xid,
       {
 	cr->references++;
 	if (cr->references == 1)
-	  nfreereplies--;
+	  lru_remove (cr);
 	pthread_spin_unlock (&replycachelock);
 	pthread_mutex_lock (&cr->lock);
 	return cr;
       }
 
-  cr = malloc (sizeof (struct cached_reply));
-  pthread_mutex_init (&cr->lock, NULL);
+  if (nreplies >= MAX_CACHED_REPLIES && lru_replies)
+    {
+      /* Reuse the least recently used reply.  */
+      cr = lru_replies;
+      drop_reply (cr);
+    }
+  else
+    {
+      cr = malloc (sizeof (struct cached_reply));
+      pthread_mutex_init (&cr->lock, NULL);
+    }
   pthread_mutex_lock (&cr->lock);
   memcpy (&cr->source, sender, sizeof (struct sockaddr_in));
   cr->xid = xid;
   cr->data = 0;
   cr->references = 1;
+  nreplies++;
 
   cr->next = replyhashtable[hash];
   if (replyhashtable[hash])
@@ -526,9 +594,10 @@ release_cached_reply (struct cached_reply *cr)
   if (cr->references == 0)
     {
       cr->lastuse = mapped_time->seconds;
-      if (cr->lastuse < leastreplylastuse || nfreereplies == 0)
-	leastreplylastuse = cr->lastuse;
-      nfreereplies++;
+      cr->lru_next = 0;
+      cr->lru_prevp = lru_replies_tail;
+      *lru_replies_tail = cr;
+      lru_replies_tail = &cr->lru_next;
     }
   pthread_spin_unlock (&replycachelock);
 }
@@ -536,42 +605,18 @@ release_cached_reply (struct cached_reply *cr)
 void
 scan_replies (void)
 {
-  int n;
-  int newleast = mapped_time->seconds;
-
   pthread_spin_lock (&replycachelock);
 
-  if (mapped_time->seconds - leastreplylastuse > REPLY_KEEP_TIMEOUT)
+  /* The list is in order of last use, so stop at the first reply still
+     young enough.  */
+  while (lru_replies
+	 && mapped_time->seconds - lru_replies->lastuse > REPLY_KEEP_TIMEOUT)
     {
-      for (n = 0; n < REPLYHASH_TABLE_SIZE && nfreereplies; n++)
-	{
-	  struct cached_reply *cr = replyhashtable[n];
-
-	  while (cr && nfreereplies)
-	    {
-	      struct cached_reply *next_cr = cr->next;
-
-	      if (!cr->references
-		  && mapped_time->seconds - cr->lastuse > REPLY_KEEP_TIMEOUT)
-		{
-		  nfreereplies--;
-		  *cr->prevp = cr->next;
-		  if (cr->next)
-		    cr->next->prevp = cr->prevp;
-		  if (cr->data)
-		    free (cr->data);
-		  free (cr);
-		}
-	      else if (!cr->references && newleast > cr->lastuse)
-		newleast = cr->lastuse;
-
-	      cr = next_cr;
-	    }
-	}
-
-      /* If we didn't bail early, then this is valid.  */
-      if (nfreereplies)
-	leastreplylastuse = newleast;
+      struct cached_reply *cr = lru_replies;
+      drop_reply (cr);
+      pthread_mutex_destroy (&cr->lock);
+      free (cr);
     }
+
   pthread_spin_unlock (&replycachelock);
 }
@@ -19,7 +19,12 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <error.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "nfsd.h"
 
@@ -35,17 +40,17 @@
 #include <rpc/rpc_msg.h>
 #undef malloc
 
-void *
-server_loop (void *arg)
+/* Process the RPC of LEN bytes at BUF, just received from SENDER, and
+   return the cached reply record holding the reply to send back, locked;
+   or return null if no reply is to be sent.  */
+static struct cached_reply *
+handle_request (char *buf, size_t len, struct sockaddr_in *sender)
 {
-  int fd = (int) arg;
-  char buf[MAXIOSIZE];
   int xid;
   int *p, *r;
   char *rbuf;
   struct cached_reply *cr;
   int program;
-  struct sockaddr_in sender;
   int version;
   int procedure;
   struct proctable *table = 0;
@@ -53,173 +58,424 @@ server_loop (void *arg)
   struct idspec *cred;
   struct cache_handle *c, fakec;
   error_t err;
-  socklen_t addrlen;
-  int cc;
-
 
   memset (&fakec, 0, sizeof (struct cache_handle));
 
-  for (;;)
+  p = (int *) buf;
+  proc = 0;
+  if (len < 2 * sizeof (int))
+    return 0;
+  xid = *(p++);
+
+  /* Ignore things that aren't proper RPCs.  */
+  if (ntohl (*p) != CALL)
+    return 0;
+  p++;
+
+  cr = check_cached_replies (xid, sender);
+  if (cr->data)
+    /* This transacation has already completed.  */
+    return cr;
+
+  r = (int *) (rbuf = malloc (MAXIOSIZE));
+
+  if (ntohl (*p) != RPC_MSG_VERSION)
     {
-      p = (int *) buf;
-      proc = 0;
-      addrlen = sizeof (struct sockaddr_in);
-      cc = recvfrom (fd, buf, MAXIOSIZE, 0, &sender, &addrlen);
-      if (cc == -1)
-	continue;		/* Ignore errors.  */
-      xid = *(p++);
+      /* Reject RPC.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_DENIED);
+      *(r++) = htonl (RPC_MISMATCH);
+      *(r++) = htonl (RPC_MSG_VERSION);
+      *(r++) = htonl (RPC_MSG_VERSION);
+      goto send_reply;
+    }
+  p++;
 
-      /* Ignore things that aren't proper RPCs.  */
-      if (ntohl (*p) != CALL)
-	continue;
-      p++;
+  program = ntohl (*p);
+  p++;
+  switch (program)
+    {
+    case MOUNTPROG:
+      version = MOUNTVERS;
+      table = &mounttable;
+      break;
 
-      cr = check_cached_replies (xid, &sender);
-      if (cr->data)
-	/* This transacation has already completed.  */
-	goto repost_reply;
+    case NFS_PROGRAM:
+      version = NFS_VERSION;
+      table = &nfs2table;
+      break;
 
-      r = (int *) (rbuf = malloc (MAXIOSIZE));
+    case PMAPPROG:
+      version = PMAPVERS;
+      table = &pmaptable;
+      break;
 
-      if (ntohl (*p) != RPC_MSG_VERSION)
+    default:
+      /* Program unavailable.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROG_UNAVAIL);
+      goto send_reply;
+    }
+
+  if (ntohl (*p) != version)
+    {
+      /* Program mismatch.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROG_MISMATCH);
+      *(r++) = htonl (version);
+      *(r++) = htonl (version);
+      goto send_reply;
+    }
+  p++;
+
+  procedure = htonl (*p);
+  p++;
+  if (procedure < table->min
+      || procedure > table->max
+      || table->procs[procedure - table->min].func == 0)
+    {
+      /* Procedure unavailable.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROC_UNAVAIL);
+      *(r++) = htonl (table->min);
+      *(r++) = htonl (table->max);
+      goto send_reply;
+    }
+  proc = &table->procs[procedure - table->min];
+
+  p = process_cred (p, &cred);
+
+  if (proc->need_handle)
+    p = lookup_cache_handle (p, &c, cred);
+  else
+    {
+      fakec.ids = cred;
+      c = &fakec;
+    }
+
+  if (proc->alloc_reply)
+    {
+      size_t amt;
+      amt = (*proc->alloc_reply) (p, version) + 256;
+      if (amt > MAXIOSIZE)
 	{
-	  /* Reject RPC.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_DENIED);
-	  *(r++) = htonl (RPC_MISMATCH);
-	  *(r++) = htonl (RPC_MSG_VERSION);
-	  *(r++) = htonl (RPC_MSG_VERSION);
-	  goto send_reply;
+	  free (rbuf);
+	  r = (int *) (rbuf = malloc (amt));
 	}
-      p++;
+    }
 
-      program = ntohl (*p);
-      p++;
-      switch (program)
+  /* Fill in beginning of reply.  */
+  *(r++) = xid;
+  *(r++) = htonl (REPLY);
+  *(r++) = htonl (MSG_ACCEPTED);
+  *(r++) = htonl (AUTH_NULL);
+  *(r++) = htonl (0);
+  *(r++) = htonl (SUCCESS);
+  if (!proc->process_error)
+    /* The function does its own error processing, and we ignore
+       its return value.  */
+    (void) (*proc->func) (c, p, &r, version);
+  else
+    {
+      if (c)
 	{
-	case MOUNTPROG:
-	  version = MOUNTVERS;
-	  table = &mounttable;
-	  break;
-
-	case NFS_PROGRAM:
-	  version = NFS_VERSION;
-	  table = &nfs2table;
-	  break;
-
-	case PMAPPROG:
-	  version = PMAPVERS;
-	  table = &pmaptable;
-	  break;
-
-	default:
-	  /* Program unavailable.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
+	  /* Assume success for now and patch it later if necessary.  */
+	  int *errloc = r;
 	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROG_UNAVAIL);
-	  goto send_reply;
+	  /* Call processing function, its output after error code.  */
+	  err = (*proc->func) (c, p, &r, version);
+	  if (err)
+	    {
+	      r = errloc;	/* Back up, patch error code, discard rest.  */
+	      *(r++) = htonl (nfs_error_trans (err, version));
+	    }
 	}
+      else
+	*(r++) = htonl (nfs_error_trans (ESTALE, version));
+    }
+
+  cred_rele (cred);
+  if (c && c != &fakec)
+    cache_handle_rele (c);
+
+ send_reply:
+  cr->data = rbuf;
+  cr->len = (char *)r - rbuf;
+  return cr;
+}
 
-      if (ntohl (*p) != version)
+
+/* A pool of threads serving the datagrams of one socket.  A thread is
+   added whenever the last idle one takes a request, up to MAX_THREADS,
+   so that a slow filesystem call never holds up the other clients; a
+   thread idle for THREAD_IDLE_TIMEOUT seconds goes away again, but for
+   the last one.  */
+struct server_pool
+{
+  int fd;
+  pthread_spinlock_t lock;
+  int idle;
+  int total;
+};
+
+/* Create a detached thread running FUNC (ARG); return an error code.  */
+static int
+create_thread (void *(*func) (void *), void *arg)
+{
+  pthread_t thread;
+  int fail;
+
+  fail = pthread_create (&thread, NULL, func, arg);
+  if (fail)
+    return fail;
+  pthread_detach (thread);
+  return 0;
+}
+
+static void *
+udp_server_loop (void *arg)
+{
+  struct server_pool *pool = arg;
+  char buf[MAXIOSIZE];
+  struct cached_reply *cr;
+  struct sockaddr_in sender;
+  socklen_t addrlen;
+  int cc;
+
+  for (;;)
+    {
+      struct pollfd pfd = { .fd = pool->fd, .events = POLLIN };
+      int spawn = 0;
+
+      if (poll (&pfd, 1, THREAD_IDLE_TIMEOUT * 1000) == 0)
 	{
-	  /* Program mismatch.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
-	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROG_MISMATCH);
-	  *(r++) = htonl (version);
-	  *(r++) = htonl (version);
-	  goto send_reply;
+	  pthread_spin_lock (&pool->lock);
+	  if (pool->total > 1)
+	    {
+	      pool->total--;
+	      pool->idle--;
+	      pthread_spin_unlock (&pool->lock);
+	      return 0;
+	    }
+	  pthread_spin_unlock (&pool->lock);
+	  continue;
 	}
-      p++;
 
-      procedure = htonl (*p);
-      p++;
-      if (procedure < table->min
-	  || procedure > table->max
-	  || table->procs[procedure - table->min].func == 0)
+      /* Another idle thread may have taken the datagram already.  */
+      addrlen = sizeof (struct sockaddr_in);
+      cc = recvfrom (pool->fd, buf, MAXIOSIZE, MSG_DONTWAIT,
+		     (struct sockaddr *) &sender, &addrlen);
+      if (cc == -1)
+	continue;		/* Ignore errors.  */
+
+      pthread_spin_lock (&pool->lock);
+      if (--pool->idle == 0 && pool->total < max_threads)
 	{
-	  /* Procedure unavailable.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
-	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROC_UNAVAIL);
-	  *(r++) = htonl (table->min);
-	  *(r++) = htonl (table->max);
-	  goto send_reply;
+	  pool->total++;
+	  pool->idle++;
+	  spawn = 1;
 	}
-      proc = &table->procs[procedure - table->min];
+      pthread_spin_unlock (&pool->lock);
 
-      p = process_cred (p, &cred);
+      if (spawn && create_thread (udp_server_loop, pool))
+	{
+	  pthread_spin_lock (&pool->lock);
+	  pool->total--;
+	  pool->idle--;
+	  pthread_spin_unlock (&pool->lock);
+	}
 
-      if (proc->need_handle)
-	p = lookup_cache_handle (p, &c, cred);
-      else
+      cr = handle_request (buf, cc, &sender);
+      if (cr)
 	{
-	  fakec.ids = cred;
-	  c = &fakec;
+	  sendto (pool->fd, cr->data, cr->len, 0,
+		  (struct sockaddr *) &sender, addrlen);
+	  release_cached_reply (cr);
 	}
 
-      if (proc->alloc_reply)
+      pthread_spin_lock (&pool->lock);
+      pool->idle++;
+      pthread_spin_unlock (&pool->lock);
+    }
+}
+
+/* Start serving the datagrams received on FD.  */
+void
+start_udp_server (int fd)
+{
+  struct server_pool *pool;
+  int fail;
+
+  pool = malloc (sizeof *pool);
+  if (! pool)
+    error (1, errno, "Creating server pool");
+  pool->fd = fd;
+  pthread_spin_init (&pool->lock, PTHREAD_PROCESS_PRIVATE);
+  pool->idle = 1;
+  pool->total = 1;
+
+  fail = create_thread (udp_server_loop, pool);
+  if (fail)
+    error (1, fail, "Creating main server thread");
+}
+
+
+/* A connection from a client over TCP.  */
+struct connection
+{
+  int fd;
+  struct sockaddr_in peer;
+};
+
+/* Read exactly LEN bytes from FD into BUF; return nonzero on error or end
+   of file.  */
+static int
+read_fully (int fd, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = read (fd, buf, len);
+      if (cc == -1 && errno == EINTR)
+	continue;
+      if (cc <= 0)
+	return 1;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Write the reply in CR to FD as one record; return nonzero on error.  */
+static int
+write_record (int fd, struct cached_reply *cr)
+{
+  uint32_t mark = htonl (RECORD_LAST_FRAGMENT | cr->len);
+  struct iovec iov[2] =
+    {
+      { .iov_base = &mark, .iov_len = sizeof mark },
+      { .iov_base = cr->data, .iov_len = cr->len },
+    };
+  size_t left = sizeof mark + cr->len;
+  int i = 0;
+
+  while (left > 0)
+    {
+      ssize_t cc = writev (fd, &iov[i], 2 - i);
+      if (cc == -1 && errno == EINTR)
+	continue;
+      if (cc <= 0)
+	return 1;
+      left -= cc;
+      while (i < 2 && cc >= iov[i].iov_len)
+	cc -= iov[i++].iov_len;
+      if (i < 2)
 	{
-	  size_t amt;
-	  amt = (*proc->alloc_reply) (p, version) + 256;
-	  if (amt > MAXIOSIZE)
-	    {
-	      free (rbuf);
-	      r = (int *) (rbuf = malloc (amt));
-	    }
+	  iov[i].iov_base += cc;
+	  iov[i].iov_len -= cc;
+	}
+    }
+  return 0;
+}
+
+/* Serve the RPCs of one TCP connection in turn, each one a record of
+   fragments following RFC 1831 record marking, until the client closes
+   it or sends a record too large for us.  */
+static void *
+tcp_server_loop (void *arg)
+{
+  struct connection *conn = arg;
+  char buf[MAXIOSIZE];
+  struct cached_reply *cr;
+
+  for (;;)
+    {
+      size_t len = 0;
+      uint32_t mark;
+
+      do
+	{
+	  if (read_fully (conn->fd, &mark, sizeof mark))
+	    goto out;
+	  mark = ntohl (mark);
+	  if ((mark & ~RECORD_LAST_FRAGMENT) > MAXIOSIZE - len)
+	    goto out;
+	  if (read_fully (conn->fd, buf + len, mark & ~RECORD_LAST_FRAGMENT))
+	    goto out;
+	  len += mark & ~RECORD_LAST_FRAGMENT;
 	}
+      while (! (mark & RECORD_LAST_FRAGMENT));
 
-      /* Fill in beginning of reply.  */
-      *(r++) = xid;
-      *(r++) = htonl (REPLY);
-      *(r++) = htonl (MSG_ACCEPTED);
-      *(r++) = htonl (AUTH_NULL);
-      *(r++) = htonl (0);
-      *(r++) = htonl (SUCCESS);
-      if (!proc->process_error)
-	/* The function does its own error processing, and we ignore
-	   its return value.  */
-	(void) (*proc->func) (c, p, &r, version);
-      else
+      cr = handle_request (buf, len, &conn->peer);
+      if (cr)
 	{
-	  if (c)
-	    {
-	      /* Assume success for now and patch it later if necessary.  */
-	      int *errloc = r;
-	      *(r++) = htonl (0);
-	      /* Call processing function, its output after error code.  */
-	      err = (*proc->func) (c, p, &r, version);
-	      if (err)
-		{
-		  r = errloc;	/* Back up, patch error code, discard rest.  */
-		  *(r++) = htonl (nfs_error_trans (err, version));
-		}
-	    }
-	  else
-	    *(r++) = htonl (nfs_error_trans (ESTALE, version));
+	  int fail = write_record (conn->fd, cr);
+	  release_cached_reply (cr);
+	  if (fail)
+	    goto out;
 	}
+    }
+
+ out:
+  close (conn->fd);
+  free (conn);
+  return 0;
+}
+
+static void *
+tcp_listen_loop (void *arg)
+{
+  int fd = (intptr_t) arg;
 
-      cred_rele (cred);
-      if (c && c != &fakec)
-	cache_handle_rele (c);
+  for (;;)
+    {
+      struct connection *conn;
+      socklen_t addrlen = sizeof (struct sockaddr_in);
+      int conn_fd;
+
+      conn = malloc (sizeof *conn);
+      if (! conn)
+	{
+	  sleep (1);
+	  continue;
+	}
 
-    send_reply:
-      cr->data = rbuf;
-      cr->len = (char *)r - rbuf;
+      conn_fd = accept (fd, (struct sockaddr *) &conn->peer, &addrlen);
+      if (conn_fd == -1)
+	{
+	  free (conn);
+	  continue;		/* Ignore errors.  */
+	}
 
-    repost_reply:
-      sendto (fd, cr->data, cr->len, 0,
-	      (struct sockaddr *) &sender, addrlen);
-      release_cached_reply (cr);
+      conn->fd = conn_fd;
+      if (create_thread (tcp_server_loop, conn))
+	{
+	  close (conn_fd);
+	  free (conn);
+	}
     }
 }
+
+/* Start accepting the connections made to FD, which is listening, and
+   serve each one with a thread of its own.  */
+void
+start_tcp_server (int fd)
+{
+  int fail;
+
+  fail = create_thread (tcp_listen_loop, (void *) (intptr_t) fd);
+  if (fail)
+    error (1, fail, "Creating TCP server thread");
+}
@@ -25,51 +25,33 @@
 #include <rpc/pmap_prot.h>
 #include <maptime.h>
 #include <hurd.h>
-#include <pthread.h>
 #include <error.h>
 
 volatile struct mapped_time_value *mapped_time;
 
-int main_udp_socket, pmap_udp_socket;
+int main_udp_socket, pmap_udp_socket, main_tcp_socket;
 struct sockaddr_in main_address, pmap_address;
 static char index_file[] = LOCALSTATEDIR "/state/misc/nfsd.index";
 char *index_file_name = index_file;
 
-auth_t authserver;
-
-/* Launch a server loop thread */
-static void
-create_server_thread (int socket)
-{
-  pthread_t thread;
-  int fail;
+int max_threads = DEFAULT_MAX_THREADS;
 
-  fail = pthread_create (&thread, NULL, server_loop, (void *) socket);
-  if (fail)
-    error (1, fail, "Creating main server thread");
-
-  fail = pthread_detach (thread);
-  if (fail)
-    error (1, fail, "Detaching main server thread");
-}
+auth_t authserver;
 
 int
 main (int argc, char **argv)
 {
-  int nthreads;
   int fail;
 
   if (argc > 2)
     {
-      fprintf (stderr, "%s [num-threads]\n", argv[0]);
+      fprintf (stderr, "%s [max-threads]\n", argv[0]);
       exit (1);
     }
-  if (argc == 1)
-    nthreads = 4;
-  else
-    nthreads = atoi (argv[1]);
-  if (!nthreads)
-    nthreads = 4;
+  if (argc == 2)
+    max_threads = atoi (argv[1]);
+  if (max_threads <= 0)
+    max_threads = DEFAULT_MAX_THREADS;
 
   authserver = getauth ();
   maptime_map (0, 0, &mapped_time);
@@ -83,11 +65,19 @@ main (int argc, char **argv)
 
   main_udp_socket = socket (PF_INET, SOCK_DGRAM, 0);
   pmap_udp_socket = socket (PF_INET, SOCK_DGRAM, 0);
+  main_tcp_socket = socket (PF_INET, SOCK_STREAM, 0);
   fail = bind (main_udp_socket, (struct sockaddr *)&main_address,
 	       sizeof (struct sockaddr_in));
   if (fail)
     error (1, errno, "Binding NFS socket");
 
+  fail = bind (main_tcp_socket, (struct sockaddr *)&main_address,
+	       sizeof (struct sockaddr_in));
+  if (fail)
+    error (1, errno, "Binding NFS TCP socket");
+  if (listen (main_tcp_socket, SOMAXCONN))
+    error (1, errno, "Listening on NFS TCP socket");
+
   fail = bind (pmap_udp_socket, (struct sockaddr *)&pmap_address,
 	       sizeof (struct sockaddr_in));
   if (fail)
@@ -95,10 +85,9 @@ main (int argc, char **argv)
 
   init_filesystems ();
 
-  create_server_thread (pmap_udp_socket);
-
-  while (nthreads--)
-    create_server_thread (main_udp_socket);
+  start_udp_server (pmap_udp_socket);
+  start_udp_server (main_udp_socket);
+  start_tcp_server (main_tcp_socket);
 
   for (;;)
     {
@@ -29,10 +29,17 @@
 
 /* These should be configuration options */
 #define ID_KEEP_TIMEOUT 3600	/* one hour */
-#define FH_KEEP_TIMEOUT 600	/* ten minutes */
+#define FH_KEEP_TIMEOUT 3600	/* one hour */
 #define REPLY_KEEP_TIMEOUT 120	/* two minutes */
+#define MAX_CACHED_HANDLES 8192
+#define MAX_CACHED_REPLIES 4096
+#define THREAD_IDLE_TIMEOUT 120	/* two minutes */
+#define DEFAULT_MAX_THREADS 64
 #define MAXIOSIZE 10240
 
+/* The bit of a TCP record mark set on the last fragment of a record.  */
+#define RECORD_LAST_FRAGMENT 0x80000000
+
 struct idspec
 {
   struct idspec *next, **prevp;
@@ -50,6 +57,8 @@ union cache_handle_array {
 struct cache_handle
 {
   struct cache_handle *next, **prevp;
+  /* The unreferenced handles, least recently used first.  */
+  struct cache_handle *lru_next, **lru_prevp;
   union cache_handle_array handle;
   struct idspec *ids;
   file_t port;
@@ -60,6 +69,8 @@ struct cache_handle
 struct cached_reply
 {
   struct cached_reply *next, **prevp;
+  /* The unreferenced replies, least recently used first.  */
+  struct cached_reply *lru_next, **lru_prevp;
   pthread_mutex_t lock;
   struct sockaddr_in source;
   int xid;
@@ -90,9 +101,12 @@ extern volatile struct mapped_time_value *mapped_time;
 
 /* We don't actually distinguish between these two sockets, but
    we have to listen on two different ports, so that's why they're here. */
-extern int main_udp_socket, pmap_udp_socket;
+extern int main_udp_socket, pmap_udp_socket, main_tcp_socket;
 extern struct sockaddr_in main_address, pmap_address;
 
+/* The most threads serving the datagrams of a socket */
+extern int max_threads;
+
 /* Name of the file on disk containing the filesystem index table */
 extern char *index_file_name;
 
@@ -114,7 +128,8 @@ void release_cached_reply (struct cached_reply *cr);
 void scan_replies (void);
 
 /* loop.c */
-void * server_loop (void *);
+void start_udp_server (int);
+void start_tcp_server (int);
 
 /* ops.c */
 extern struct proctable nfs2table, mounttable, pmaptable;
@@ -700,12 +700,12 @@ op_getport (struct cache_handle *c,
   prot = ntohl (*p);
   p++;
 
-  if (prot != IPPROTO_UDP)
+  if (prot != IPPROTO_UDP && prot != IPPROTO_TCP)
     *(*reply)++ = htonl (0);
   else if ((prog == MOUNTPROG && vers == MOUNTVERS)
 	   || (prog == NFS_PROGRAM && vers == NFS_VERSION))
     *(*reply)++ = htonl (NFS_PORT);
-  else if (prog == PMAPPROG && vers == PMAPVERS)
+  else if (prot == IPPROTO_UDP && prog == PMAPPROG && vers == PMAPVERS)
     *(*reply)++ = htonl (PMAPPORT);
   else
     *(*reply)++ = 0;
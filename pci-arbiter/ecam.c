@@ -0,0 +1,343 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Memory-mapped config space access.
+ *
+ * PCI Express machines make the config space of every function visible
+ * in physical memory, 4K per function, in the areas the ACPI MCFG table
+ * lists.  Reading it there takes a single load per dword instead of a
+ * pair of port accesses, and needs no lock around them.
+ *
+ * We are started before the ACPI translator, so we look the table up
+ * ourselves, the same way it does.
+ */
+
+#include "ecam.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach.h>
+#include <device/device.h>
+
+/* PnP Extended System Configuration Data (ESCD) memory region */
+#define ESCD		0xe0000U
+#define ESCD_SIZE	0x20000U
+#define RSDP_MAGIC	"RSD PTR "
+#define MCFG_MAGIC	"MCFG"
+
+/* Size of the config space of a bus in the ECAM area */
+#define ECAM_BUS_SIZE	(32 * 8 * ECAM_FUNC_SIZE)
+
+struct rsdp_descr2
+{
+  uint8_t magic[8];
+  uint8_t checksum;
+  uint8_t oem_id[6];
+  uint8_t revision;
+  uint32_t rsdt_addr;
+  uint32_t length;
+  uint64_t xsdt_addr;
+  uint8_t ext_checksum;
+  uint8_t reserved[3];
+} __attribute__ ((packed));
+
+struct acpi_header
+{
+  uint8_t signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  uint8_t oem_id[6];
+  uint8_t oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} __attribute__ ((packed));
+
+/* MCFG entries follow the header and 8 reserved bytes */
+#define MCFG_ENTRIES_OFFSET	(sizeof (struct acpi_header) + 8)
+
+struct mcfg_entry
+{
+  /* Address of the config space of bus 0 of the segment */
+  uint64_t base_addr;
+  uint16_t segment;
+  uint8_t start_bus;
+  uint8_t end_bus;
+  uint32_t reserved;
+} __attribute__ ((packed));
+
+struct ecam_area
+{
+  uint64_t base_addr;
+  uint16_t segment;
+  uint8_t start_bus;
+  uint8_t end_bus;
+
+  /* Where the config space of each bus is mapped, if it is yet */
+  void *bus_map[256];
+};
+
+static struct ecam_area *areas;
+static size_t num_areas;
+
+/* The kernel device for physical memory */
+static device_t mem_device = MACH_PORT_NULL;
+
+/* Map SIZE bytes of physical memory at ADDR, and return where in *PTR */
+static error_t
+map_phys (uint64_t addr, size_t size, void **ptr)
+{
+  vm_offset_t start;
+  vm_size_t len;
+  vm_address_t va = 0;
+  mach_port_t memobj;
+  error_t err;
+
+  /* The kernel takes physical addresses as offsets */
+  if (size == 0 || addr + size - 1 > (uint64_t) (vm_offset_t) -1)
+    return EOVERFLOW;
+
+  start = trunc_page ((vm_offset_t) addr);
+  len = round_page ((vm_offset_t) addr + size) - start;
+
+  err = device_map (mem_device, VM_PROT_READ | VM_PROT_WRITE, start, len,
+		    &memobj, 0);
+  if (err)
+    return err;
+
+  err = vm_map (mach_task_self (), &va, len, 0, 1, memobj, 0, 0,
+		VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+		VM_INHERIT_NONE);
+  mach_port_deallocate (mach_task_self (), memobj);
+  if (err)
+    return err;
+
+  *ptr = (void *) (va + ((vm_offset_t) addr - start));
+  return 0;
+}
+
+static void
+unmap_phys (void *ptr, size_t size)
+{
+  vm_address_t start = trunc_page ((vm_address_t) ptr);
+
+  vm_deallocate (mach_task_self (), start,
+		 round_page ((vm_address_t) ptr + size) - start);
+}
+
+/* Map the whole ACPI table at ADDR */
+static error_t
+map_table (uint64_t addr, struct acpi_header **table)
+{
+  struct acpi_header *h;
+  uint32_t length;
+  error_t err;
+
+  err = map_phys (addr, sizeof *h, (void **) &h);
+  if (err)
+    return err;
+  length = h->length;
+  unmap_phys (h, sizeof *h);
+
+  if (length < sizeof *h)
+    return EINVAL;
+
+  return map_phys (addr, length, (void **) table);
+}
+
+/* Find the MCFG table through the RSDP and the root table, and map it */
+static error_t
+find_mcfg (struct acpi_header **mcfg)
+{
+  unsigned char *buf;
+  struct rsdp_descr2 rsdp;
+  struct acpi_header *root;
+  uint64_t sdt_addr;
+  uint32_t root_length;
+  size_t sz_ptr, ntables, i;
+  error_t err;
+
+  err = map_phys (ESCD, ESCD_SIZE, (void **) &buf);
+  if (err)
+    return err;
+
+  /* RSDP magic string is 16 byte aligned */
+  for (i = 0; i + sizeof rsdp <= ESCD_SIZE; i += 16)
+    if (!memcmp (&buf[i], RSDP_MAGIC, 8))
+      break;
+
+  if (i + sizeof rsdp > ESCD_SIZE)
+    {
+      unmap_phys (buf, ESCD_SIZE);
+      return ENODEV;
+    }
+
+  memcpy (&rsdp, &buf[i], sizeof rsdp);
+  unmap_phys (buf, ESCD_SIZE);
+
+  if (rsdp.revision >= 2 && rsdp.xsdt_addr)
+    {
+      /* ACPI >= 2.0 */
+      sdt_addr = rsdp.xsdt_addr;
+      sz_ptr = 8;
+    }
+  else
+    {
+      /* ACPI 1.0 */
+      sdt_addr = rsdp.rsdt_addr;
+      sz_ptr = 4;
+    }
+
+  err = map_table (sdt_addr, &root);
+  if (err)
+    return err;
+
+  root_length = root->length;
+  ntables = (root_length - sizeof *root) / sz_ptr;
+
+  err = ENODEV;
+  for (i = 0; i < ntables; i++)
+    {
+      uint64_t addr = 0;
+      struct acpi_header *h;
+      int found;
+
+      /* Little endian, as is everything in ACPI */
+      memcpy (&addr, (char *) (root + 1) + i * sz_ptr, sz_ptr);
+
+      if (map_phys (addr, sizeof *h, (void **) &h))
+	continue;
+      found = !memcmp (h->signature, MCFG_MAGIC, 4);
+      unmap_phys (h, sizeof *h);
+
+      if (found)
+	{
+	  err = map_table (addr, mcfg);
+	  break;
+	}
+    }
+
+  unmap_phys (root, root_length);
+
+  return err;
+}
+
+error_t
+ecam_init (void)
+{
+  mach_port_t device_master;
+  struct acpi_header *mcfg;
+  struct mcfg_entry *entry;
+  uint32_t length;
+  size_t nentries, i;
+  error_t err;
+
+  err = get_privileged_ports (0, &device_master);
+  if (err)
+    return err;
+
+  err = device_open (device_master, D_READ | D_WRITE, "mem", &mem_device);
+  mach_port_deallocate (mach_task_self (), device_master);
+  if (err)
+    return err;
+
+  err = find_mcfg (&mcfg);
+  if (err)
+    goto out;
+
+  length = mcfg->length;
+  nentries = 0;
+  if (length > MCFG_ENTRIES_OFFSET)
+    nentries = (length - MCFG_ENTRIES_OFFSET) / sizeof *entry;
+
+  areas = calloc (nentries, sizeof *areas);
+  if (!areas)
+    {
+      err = ENOMEM;
+      unmap_phys (mcfg, length);
+      goto out;
+    }
+
+  entry = (struct mcfg_entry *) ((char *) mcfg + MCFG_ENTRIES_OFFSET);
+  for (i = 0; i < nentries; i++, entry++)
+    {
+      if (entry->start_bus > entry->end_bus)
+	continue;
+
+      areas[num_areas].base_addr = entry->base_addr;
+      areas[num_areas].segment = entry->segment;
+      areas[num_areas].start_bus = entry->start_bus;
+      areas[num_areas].end_bus = entry->end_bus;
+      num_areas++;
+    }
+
+  unmap_phys (mcfg, length);
+
+  if (num_areas == 0)
+    {
+      free (areas);
+      areas = 0;
+      err = ENODEV;
+    }
+
+out:
+  if (err)
+    {
+      mach_port_deallocate (mach_task_self (), mem_device);
+      mem_device = MACH_PORT_NULL;
+    }
+
+  return err;
+}
+
+volatile void *
+ecam_map_config (struct pci_device *device)
+{
+  struct ecam_area *a;
+  volatile uint8_t *space;
+
+  for (a = areas; a < areas + num_areas; a++)
+    {
+      if (a->segment != device->domain
+	  || device->bus < a->start_bus || device->bus > a->end_bus)
+	continue;
+
+      if (!a->bus_map[device->bus]
+	  && map_phys (a->base_addr + (uint64_t) device->bus * ECAM_BUS_SIZE,
+		       ECAM_BUS_SIZE, &a->bus_map[device->bus]))
+	{
+	  a->bus_map[device->bus] = 0;
+	  return 0;
+	}
+
+      space = (volatile uint8_t *) a->bus_map[device->bus]
+	+ ((device->dev << 15) | (device->func << 12));
+
+      /* Don't trust firmware that points us somewhere else */
+      if (*(volatile uint16_t *) space != device->vendor_id)
+	return 0;
+
+      return space;
+    }
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Header for memory-mapped (ECAM) config space access */
+
+#ifndef ECAM_H
+#define ECAM_H
+
+#include <hurd.h>
+
+#include <pciaccess.h>
+
+/* Size of the config space of a function in the ECAM area */
+#define ECAM_FUNC_SIZE	0x1000
+
+/*
+ * Find the ECAM areas in the ACPI MCFG table.  Returns an error if the
+ * firmware describes none, or they can't be used; config space is then
+ * accessed through libpciaccess.
+ */
+error_t ecam_init (void);
+
+/*
+ * Return the address where the config space of DEVICE is mapped, mapping
+ * it if needed, or NULL if it isn't in an ECAM area.  Only called while
+ * the filesystem tree is being built.
+ */
+volatile void *ecam_map_config (struct pci_device *device);
+
+#endif /* ECAM_H */
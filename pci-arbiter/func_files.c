@@ -26,11 +26,20 @@
 #include "func_files.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/io.h>
 
 #include <pciaccess.h>
 
 #include "device_map.h"
+#include "ecam.h"
+
+/* Header registers */
+#define PCI_VENDOR_ID			0x00
+#define PCI_REVISION_ID			0x08
+#define PCI_HEADER_TYPE			0x0e
+#define PCI_SUBSYSTEM_VENDOR_ID		0x2c
 
 /* Read or write a block of data from/to the configuration space */
 static error_t
@@ -79,25 +88,174 @@ config_block_op (struct pci_device *dev, off_t offset, size_t * len,
   return 0;
 }
 
+/* Read or write a block of data from/to the memory-mapped config space */
+static void
+config_block_ecam_op (volatile void *space, off_t offset, size_t len,
+		      void *data, int read)
+{
+  volatile uint8_t *p = (volatile uint8_t *) space + offset;
+  size_t n;
+
+  /* Each access must be naturally aligned */
+  for (; len > 0; p += n, offset += n, data += n, len -= n)
+    {
+      if (!(offset & 3) && len >= 4)
+	{
+	  uint32_t v;
+
+	  n = 4;
+	  if (read)
+	    {
+	      v = *(volatile uint32_t *) p;
+	      memcpy (data, &v, n);
+	    }
+	  else
+	    {
+	      memcpy (&v, data, n);
+	      *(volatile uint32_t *) p = v;
+	    }
+	}
+      else if (!(offset & 1) && len >= 2)
+	{
+	  uint16_t v;
+
+	  n = 2;
+	  if (read)
+	    {
+	      v = *(volatile uint16_t *) p;
+	      memcpy (data, &v, n);
+	    }
+	  else
+	    {
+	      memcpy (&v, data, n);
+	      *(volatile uint16_t *) p = v;
+	    }
+	}
+      else
+	{
+	  n = 1;
+	  if (read)
+	    *(uint8_t *) data = *p;
+	  else
+	    *p = *(uint8_t *) data;
+	}
+    }
+}
+
+/* Read or write LEN bytes of the config space of E at OFFSET */
+static error_t
+config_op (struct pcifs_dirent *e, off_t offset, size_t len, void *data,
+	   int read)
+{
+  error_t err;
+
+  /* Memory-mapped accesses don't need arbitration */
+  if (e->config_map)
+    {
+      config_block_ecam_op (e->config_map, offset, len, data, read);
+      return 0;
+    }
+
+  pthread_mutex_lock (&fs->pci_conf_lock);
+  err = config_block_op (e->device, offset, &len, data,
+			 read ? pci_device_cfg_read
+			 : (pci_io_op_t) pci_device_cfg_write);
+  pthread_mutex_unlock (&fs->pci_conf_lock);
+
+  return err;
+}
+
+/* Whether the header dword holding the byte at OFFSET is in the cache */
+static int
+header_cached (struct pcifs_dirent *e, off_t offset)
+{
+  return (offset < PCI_HEADER_CACHE_DWORDS * 4
+	  && (__atomic_load_n (&e->header_cached, __ATOMIC_RELAXED)
+	      & (1U << (offset / 4))));
+}
+
+/* Set up the config file entry E: map the config space and keep the
+   header fields that don't change */
+void
+init_config_file (struct pcifs_dirent *e)
+{
+  struct pci_device *dev = e->device;
+  uint8_t hdr_type;
+  error_t err;
+
+  e->config_map = ecam_map_config (dev);
+
+  e->header_cache[PCI_VENDOR_ID / 4] = dev->vendor_id
+    | (uint32_t) dev->device_id << 16;
+  e->header_cache[PCI_REVISION_ID / 4] = dev->revision
+    | (uint32_t) dev->device_class << 8;
+  e->header_cached = 1U << (PCI_VENDOR_ID / 4) | 1U << (PCI_REVISION_ID / 4);
+
+  pthread_mutex_lock (&fs->pci_conf_lock);
+  err = pci_device_cfg_read_u8 (dev, &hdr_type, PCI_HEADER_TYPE);
+  pthread_mutex_unlock (&fs->pci_conf_lock);
+
+  /* Bridges have other registers there */
+  if (!err && (hdr_type & 0x7f) == 0)
+    {
+      e->header_cache[PCI_SUBSYSTEM_VENDOR_ID / 4] = dev->subvendor_id
+	| (uint32_t) dev->subdevice_id << 16;
+      e->header_cached |= 1U << (PCI_SUBSYSTEM_VENDOR_ID / 4);
+    }
+}
+
 /* Read or write from/to the config file */
 error_t
-io_config_file (struct pci_device * dev, off_t offset, size_t * len,
-		void *data, pci_io_op_t op)
+io_config_file (struct pcifs_dirent * e, off_t offset, size_t * len,
+		void *data, int read)
 {
-  error_t err;
+  error_t err = 0;
+  off_t pos, end, next;
+  size_t n;
 
   /* This should never happen */
-  assert_backtrace (dev != 0);
+  assert_backtrace (e->device != 0);
 
   /* Don't exceed the config space size */
   if (offset > PCI_CONFIG_SIZE)
     return EINVAL;
   if ((offset + *len) > PCI_CONFIG_SIZE)
     *len = PCI_CONFIG_SIZE - offset;
+  end = offset + *len;
 
-  pthread_mutex_lock (&fs->pci_conf_lock);
-  err = config_block_op (dev, offset, len, data, op);
-  pthread_mutex_unlock (&fs->pci_conf_lock);
+  if (!read && offset < PCI_HEADER_CACHE_DWORDS * 4)
+    {
+      /* The class code of some devices can be written; read again whatever
+         this changes */
+      uint32_t mask = 0;
+
+      for (pos = offset & ~3; pos < end && pos < PCI_HEADER_CACHE_DWORDS * 4;
+	   pos += 4)
+	mask |= 1U << (pos / 4);
+      __atomic_and_fetch (&e->header_cached, ~mask, __ATOMIC_RELAXED);
+    }
+
+  /* Serve the cached dwords from the cache, and each run of others with a
+     single block operation */
+  for (pos = offset; pos < end; pos += n, data += n)
+    {
+      next = (pos & ~3) + 4;
+
+      if (read && header_cached (e, pos))
+	{
+	  n = (next < end ? next : end) - pos;
+	  memcpy (data, (char *) &e->header_cache[pos / 4] + (pos & 3), n);
+	  continue;
+	}
+
+      while (read && next < end && !header_cached (e, next))
+	next += 4;
+      n = (next < end ? next : end) - pos;
+
+      err = config_op (e, pos, n, data, read);
+      if (err)
+	break;
+    }
 
   return err;
 }
@@ -37,8 +37,10 @@ typedef int (*pci_io_op_t) (struct pci_device *dev, void *data,
 /* Region */
 #define FILE_REGION_NAME     "region"
 
-error_t io_config_file (struct pci_device * dev, off_t offset, size_t * len,
-			void *data, pci_io_op_t op);
+void init_config_file (struct pcifs_dirent *e);
+
+error_t io_config_file (struct pcifs_dirent *e, off_t offset, size_t * len,
+			void *data, int read);
 
 error_t read_rom_file (struct pcifs_dirent * e, off_t offset, size_t * len,
 		       void *data);
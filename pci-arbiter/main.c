@@ -45,6 +45,7 @@
 #include <pciaccess.h>
 #include <pthread.h>
 #include "pcifs.h"
+#include "ecam.h"
 
 struct pcifs *fs;
 volatile struct mapped_time_value *pcifs_maptime;
@@ -238,6 +239,10 @@ main (int argc, char **argv)
   if (err)
     error (1, err, "Starting the PCI system");
 
+  /* Use memory-mapped config space where the firmware describes it; port
+     I/O through libpciaccess otherwise */
+  ecam_init ();
+
   if (next_task != MACH_PORT_NULL)
     machdev_trivfs_server_startup (bootstrap);
 
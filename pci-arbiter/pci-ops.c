@@ -112,9 +112,20 @@ S_pci_conf_read (struct protid * master, int reg, char **data,
    * The server is not single-threaded anymore. Incoming rpcs are handled by
    * libnetfs which is multi-threaded. A lock is needed for arbitration.
    */
-  pthread_mutex_lock (lock);
-  err = pci_device_cfg_read (e->device, *data, reg, amount, &actual_len);
-  pthread_mutex_unlock (lock);
+  if (reg >= 0 && reg + amount <= PCI_CONFIG_SIZE)
+    {
+      size_t len = amount;
+
+      /* Use the header cache and the mapped config space */
+      err = io_config_file (e, reg, &len, *data, 1);
+      actual_len = len;
+    }
+  else
+    {
+      pthread_mutex_lock (lock);
+      err = pci_device_cfg_read (e->device, *data, reg, amount, &actual_len);
+      pthread_mutex_unlock (lock);
+    }
 
   if (!err)
     {
@@ -150,9 +161,19 @@ S_pci_conf_write (struct protid * master, int reg, const char *data, mach_msg_ty
   if (err)
     return err;
 
-  pthread_mutex_lock (lock);
-  err = pci_device_cfg_write (e->device, data, reg, datalen, &actual_len);
-  pthread_mutex_unlock (lock);
+  if (reg >= 0 && reg + datalen <= PCI_CONFIG_SIZE)
+    {
+      size_t len = datalen;
+
+      err = io_config_file (e, reg, &len, (void *) data, 0);
+      actual_len = len;
+    }
+  else
+    {
+      pthread_mutex_lock (lock);
+      err = pci_device_cfg_write (e->device, data, reg, datalen, &actual_len);
+      pthread_mutex_unlock (lock);
+    }
 
   if (!err)
     {
@@ -307,9 +307,10 @@ create_fs_tree (struct pcifs * fs)
       err =
 	create_dir_entry (device->domain, device->bus, device->dev,
 			  device->func, device->device_class, entry_name,
-			  func_parent, e_stat, 0, device, e++);
+			  func_parent, e_stat, 0, device, e);
       if (err)
 	return err;
+      init_config_file (e++);
 
       /* Create regions entries */
       for (j = 0; j < 6; j++)
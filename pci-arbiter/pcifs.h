@@ -31,6 +31,9 @@
 // FIXME: Hardcoded PCI config size
 #define PCI_CONFIG_SIZE 256
 
+/* Header dwords that may be kept in the config file entry */
+#define PCI_HEADER_CACHE_DWORDS 12
+
 #include <netfs_impl.h>
 
 /* Size of a directory entry name */
@@ -105,6 +108,23 @@ struct pcifs_dirent
    * Only when a device is present
    */
   void *rom_map;
+
+  /*
+   * Address where the config space is mapped, or NULL to access it through
+   * libpciaccess
+   *
+   * Only for config files
+   */
+  volatile void *config_map;
+
+  /*
+   * Copies of the header dwords that don't change, with a bit in
+   * `header_cached' for each valid one
+   *
+   * Only for config files
+   */
+  uint32_t header_cache[PCI_HEADER_CACHE_DWORDS];
+  uint32_t header_cached;
 };
 
 /*
@@ -56,8 +56,8 @@ extern void inquire_device (struct device *dev, uint32_t *addr,
                             uint32_t *netmask, uint32_t *peer,
 			    uint32_t *broadcast);
 
-/* Truncate name, take the global lock and find device with this name.  */
-struct device *get_dev (const char *name)
+static struct device *
+find_dev (const char *name)
 {
   char ifname[IFNAMSIZ];
   struct device *dev;
@@ -65,8 +65,6 @@ struct device *get_dev (const char *name)
   memcpy (ifname, name, IFNAMSIZ-1);
   ifname[IFNAMSIZ-1] = 0;
 
-  pthread_mutex_lock (&global_lock);
-
   for (dev = dev_base; dev; dev = dev->next)
     if (strcmp (dev->name, ifname) == 0)
       break;
@@ -74,6 +72,25 @@ struct device *get_dev (const char *name)
   return dev;
 }
 
+/* Truncate name, take the global lock and the configuration lock for
+   writing, and find device with this name.  */
+struct device *get_dev (const char *name)
+{
+  pthread_mutex_lock (&global_lock);
+  pthread_rwlock_wrlock (&config_lock);
+  return find_dev (name);
+}
+
+/* Likewise, for only looking at the device: just take the configuration
+   lock for reading, so that neither the stack nor other readers are kept
+   waiting.  */
+static struct device *
+get_dev_ro (const char *name)
+{
+  pthread_rwlock_rdlock (&config_lock);
+  return find_dev (name);
+}
+
 /* This code is cobbled together from what
  * the SIOCADDRT ioctl code does, and from the apparent functionality
  * of the "netlink" layer from perusing a little.
@@ -299,7 +316,7 @@ siocgifXaddr (struct sock_user *user,
   if (!user)
     return EOPNOTSUPP;
 
-  dev = get_dev (ifnam);
+  dev = get_dev_ro (ifnam);
   if (!dev)
     err = ENODEV;
   else if (user->sock->sk->family != AF_INET)
@@ -312,7 +329,7 @@ siocgifXaddr (struct sock_user *user,
       sin->sin_addr.s_addr = addrs[type];
     }
 
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -357,6 +374,7 @@ siocsifXaddr (struct sock_user *user,
       err = configure_device (dev, addrs[0], addrs[1], addrs[2], addrs[3]);
     }
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
   return err;
 }
@@ -382,6 +400,7 @@ S_rioctl_siocaddrt (struct sock_user *user,
   else
     err = add_route (dev, &route);
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
   return err;
 }
@@ -407,6 +426,7 @@ S_rioctl_siocdelrt (struct sock_user *user,
   else
     err = delete_route (dev, &route);
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
   return err;
 }
@@ -438,6 +458,7 @@ S_iioctl_siocsifflags (struct sock_user *user,
   else
     err = dev_change_flags (dev, flags);
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
   return err;
 }
@@ -451,14 +472,14 @@ S_iioctl_siocgifflags (struct sock_user *user,
   error_t err = 0;
   struct device *dev;
 
-  dev = get_dev (name);
+  dev = get_dev_ro (name);
   if (!dev)
     err = ENODEV;
   else
     {
       *flags = dev->flags;
     }
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -477,14 +498,14 @@ S_iioctl_siocgifmetric (struct sock_user *user,
   error_t err = 0;
   struct device *dev;
 
-  dev = get_dev (ifnam);
+  dev = get_dev_ro (ifnam);
   if (!dev)
     err = ENODEV;
   else
     {
       *metric = 0; /* Not supported.  */
     }
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -530,7 +551,7 @@ S_iioctl_siocgifhwaddr (struct sock_user *user,
   if (!user)
     return EOPNOTSUPP;
 
-  dev = get_dev (ifname);
+  dev = get_dev_ro (ifname);
   if (!dev)
     err = ENODEV;
   else
@@ -539,7 +560,7 @@ S_iioctl_siocgifhwaddr (struct sock_user *user,
       addr->sa_family = dev->type;
     }
   
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -552,14 +573,14 @@ S_iioctl_siocgifmtu (struct sock_user *user,
   error_t err = 0;
   struct device *dev;
 
-  dev = get_dev (ifnam);
+  dev = get_dev_ro (ifnam);
   if (!dev)
     err = ENODEV;
   else
     {
       *mtu = dev->mtu;
     }
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -593,6 +614,7 @@ S_iioctl_siocsifmtu (struct sock_user *user,
       notifier_call_chain (&netdev_chain, NETDEV_CHANGEMTU, dev);
     }
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
   return err;
 }
@@ -606,14 +628,14 @@ S_iioctl_siocgifindex (struct sock_user *user,
   error_t err = 0;
   struct device *dev;
 
-  dev = get_dev (ifnam);
+  dev = get_dev_ro (ifnam);
   if (!dev)
     err = ENODEV;
   else
     {
       *index = dev->ifindex;
     }
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -626,7 +648,7 @@ S_iioctl_siocgifname (struct sock_user *user,
   error_t err = 0;
   struct device *dev;
 
-  pthread_mutex_lock (&global_lock);
+  pthread_rwlock_rdlock (&config_lock);
   dev = dev_get_by_index (*index);
   if (!dev)
     err = ENODEV;
@@ -635,7 +657,7 @@ S_iioctl_siocgifname (struct sock_user *user,
       strncpy (ifnam, dev->name, IFNAMSIZ);
       ifnam[IFNAMSIZ-1] = '\0';
     }
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
 
   return err;
 }
@@ -83,24 +83,37 @@ S_io_read (struct sock_user *user,
   if (!user)
     return EOPNOTSUPP;
 
-  /* Instead of this, we should peek and the socket and only
-     allocate as much as necessary. */
+  pthread_mutex_lock (&global_lock);
+  become_task (user);
+
+  /* A TCP read takes no more than what is queued when there is
+     something, so only allocate that much; it then often fits in the
+     reply message.  */
+  if (amount > *datalen && user->sock->type == SOCK_STREAM)
+    {
+      mach_msg_type_number_t queued;
+      if (! tcp_tiocinq (user->sock->sk, &queued)
+	  && queued > 0 && queued < amount)
+	amount = queued;
+    }
+
   if (amount > *datalen)
     {
       *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
       if (*data == MAP_FAILED)
-        /* Should check whether errno is indeed ENOMEM --
-           but this can't be done in a straightforward way,
-           because the glue headers #undef errno. */
-        return ENOMEM;
+	{
+	  pthread_mutex_unlock (&global_lock);
+	  /* Should check whether errno is indeed ENOMEM --
+	     but this can't be done in a straightforward way,
+	     because the glue headers #undef errno. */
+	  return ENOMEM;
+	}
       alloced = 1;
     }
 
   iov.iov_base = *data;
   iov.iov_len = amount;
 
-  pthread_mutex_lock (&global_lock);
-  become_task (user);
   err = (*user->sock->ops->recvmsg) (user->sock, &m, amount,
 				     ((user->sock->flags & O_NONBLOCK)
     				      ? MSG_DONTWAIT : 0),
@@ -419,7 +432,7 @@ S_io_reauthenticate (struct sock_user *user,
       }
 
   mach_port_move_member (mach_task_self (), newuser->pi.port_right,
-			 pfinet_bucket->portset);
+			 ports_bucket_portset (pfinet_bucket, &newuser->pi));
 
   pthread_mutex_unlock (&global_lock);
 
@@ -1,5 +1,5 @@
-/* Hack replacement for Linux's kmem_cache_t allocator
-   Copyright (C) 2000 Free Software Foundation, Inc.
+/* Replacement for Linux's kmem_cache_t allocator
+   Copyright (C) 2000, 2026 Free Software Foundation, Inc.
 
    This file is part of the GNU Hurd.
 
@@ -17,23 +17,112 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-/* Hack replacement for Linux's kmem_cache_t allocator, using plain malloc
-   and pthread locking.  The locking here is probably unnecessary.  */
+/* Each kmem_cache_t is a libhurd-slab space, whose per-thread
+   magazines keep the sockets and buffers a thread frees for its next
+   allocations.  As in Linux, the constructor runs when an object is
+   first created, not on every allocation.  A thread gives the slabs
+   without allocated objects back to the system every
+   KMEM_CACHE_REAP_INTERVAL seconds.  */
 
+/* Do not include glue-include/linux/errno.h */
+#define _HACK_ERRNO_H
+
+#include <errno.h>
+#include <error.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <hurd/slab.h>
 #include <linux/malloc.h>
 
+#include "pfinet.h"
+
+#define KMEM_CACHE_REAP_INTERVAL 60
+
 struct kmem_cache_s
 {
-  pthread_mutex_t lock;
+  struct hurd_slab_space space;
 
-  void *freelist;
+  /* False if the objects are too big for a slab; they then come from
+     malloc.  */
+  bool use_slab;
+
+  const char *name;
   size_t item_size;
+  unsigned long flags;
 
   void (*ctor) (void *, kmem_cache_t *, unsigned long);
   void (*dtor) (void *, kmem_cache_t *, unsigned long);
+
+  /* Only ever incremented, atomically.  */
+  unsigned long allocs;
+  unsigned long frees;
+
+  kmem_cache_t *next;
 };
 
+/* All the caches, for the reaper and kmem_cache_slabinfo.  Caches are
+   never destroyed.  */
+static kmem_cache_t *caches;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t reaper_once = PTHREAD_ONCE_INIT;
+
+static error_t
+cache_constructor (void *hook, void *object)
+{
+  kmem_cache_t *cache = hook;
+
+  (*cache->ctor) (object, cache, 0);
+  return 0;
+}
+
+static void
+cache_destructor (void *hook, void *object)
+{
+  kmem_cache_t *cache = hook;
+
+  (*cache->dtor) (object, cache, 0);
+}
+
+/* Give the free slabs of every cache back to the system.  */
+static void
+kmem_cache_reap_all (void)
+{
+  kmem_cache_t *cache;
+
+  pthread_mutex_lock (&caches_lock);
+  for (cache = caches; cache; cache = cache->next)
+    if (cache->use_slab)
+      hurd_slab_reap (&cache->space);
+  pthread_mutex_unlock (&caches_lock);
+}
+
+static void *
+reaper_function (void *arg)
+{
+  for (;;)
+    {
+      sleep (KMEM_CACHE_REAP_INTERVAL);
+      kmem_cache_reap_all ();
+    }
+
+  return NULL;
+}
+
+static void
+start_reaper (void)
+{
+  pthread_t thread;
+  error_t err;
+
+  err = pthread_create (&thread, NULL, reaper_function, NULL);
+  if (!err)
+    pthread_detach (thread);
+  else
+    error (0, err, "pthread_create");
+}
+
 kmem_cache_t *
 kmem_cache_create (const char *name, size_t item_size,
 		   size_t something, unsigned long flags,
@@ -43,11 +132,23 @@ kmem_cache_create (const char *name, size_t item_size,
   kmem_cache_t *new = malloc (sizeof *new);
   if (!new)
     return 0;
-  pthread_mutex_init (&new->lock, NULL);
-  new->freelist = 0;
+  new->name = name;
   new->item_size = item_size;
+  new->flags = flags;
   new->ctor = ctor;
   new->dtor = dtor;
+  new->allocs = new->frees = 0;
+  new->use_slab = !hurd_slab_init (&new->space, item_size,
+				   __alignof__ (long long), NULL, NULL,
+				   ctor ? cache_constructor : NULL,
+				   dtor ? cache_destructor : NULL, new);
+
+  pthread_once (&reaper_once, start_reaper);
+
+  pthread_mutex_lock (&caches_lock);
+  new->next = caches;
+  caches = new;
+  pthread_mutex_unlock (&caches_lock);
 
   return new;
 }
@@ -58,18 +159,21 @@ kmem_cache_alloc (kmem_cache_t *cache, int flags)
 {
   void *p;
 
-  pthread_mutex_lock (&cache->lock);
-  p = cache->freelist;
-  if (p != 0) {
-    cache->freelist = *(void **)(p + cache->item_size);
-    pthread_mutex_unlock (&cache->lock);
-    return p;
-  }
-  pthread_mutex_unlock (&cache->lock);
-
-  p = malloc (cache->item_size + sizeof (void *));
-  if (p && cache->ctor)
-    (*cache->ctor) (p, cache, flags);
+  if (cache->use_slab)
+    {
+      if (hurd_slab_alloc (&cache->space, &p))
+	return 0;
+    }
+  else
+    {
+      p = malloc (cache->item_size);
+      if (!p)
+	return 0;
+      if (cache->ctor)
+	(*cache->ctor) (p, cache, flags);
+    }
+
+  __atomic_add_fetch (&cache->allocs, 1, __ATOMIC_RELAXED);
   return p;
 }
 
@@ -77,12 +181,76 @@ kmem_cache_alloc (kmem_cache_t *cache, int flags)
 void
 kmem_cache_free (kmem_cache_t *cache, void *p)
 {
-  void **const nextp = (void **) (p + cache->item_size);
+  __atomic_add_fetch (&cache->frees, 1, __ATOMIC_RELAXED);
+
+  if (cache->use_slab)
+    hurd_slab_dealloc (&cache->space, p);
+  else
+    {
+      if (cache->dtor)
+	(*cache->dtor) (p, cache, 0);
+      free (p);
+    }
+}
+
+
+/* Describe the caches in *CONTENTS, in the format of /proc/slabinfo.  */
+error_t
+kmem_cache_slabinfo (char **contents, size_t *len)
+{
+  FILE *m;
+  kmem_cache_t *cache;
+  size_t mem_total = 0, mem_total_reclaimable = 0;
+
+  m = open_memstream (contents, len);
+  if (m == NULL)
+    return ENOMEM;
+
+  fprintf (m, "cache                          obj slab  bufs   objs   bufs"
+	   "    total reclaimable\n"
+	   "name                  flags   size size /slab  usage  count"
+	   "   memory      memory\n");
+
+  pthread_mutex_lock (&caches_lock);
+  for (cache = caches; cache; cache = cache->next)
+    {
+      struct hurd_slab_info info;
+      unsigned long objs;
+      size_t mem_usage, mem_reclaimable;
+
+      objs = (__atomic_load_n (&cache->allocs, __ATOMIC_RELAXED)
+	      - __atomic_load_n (&cache->frees, __ATOMIC_RELAXED));
+
+      if (cache->use_slab)
+	hurd_slab_get_info (&cache->space, &info);
+      else
+	/* Malloced objects are reported as slabs of one object, which
+	   are freed at once.  */
+	info = (struct hurd_slab_info) {
+	  .object_size = cache->item_size,
+	  .slab_size = cache->item_size,
+	  .objects_per_slab = 1,
+	  .slabs = objs,
+	};
+
+      mem_usage = (info.slabs * info.slab_size) >> 10;
+      mem_total += mem_usage;
+      mem_reclaimable = (info.free_slabs * info.slab_size) >> 10;
+      mem_total_reclaimable += mem_reclaimable;
+      fprintf (m,
+	       "%-21s %04lx %7zu %3zuk  %4zu %6lu %6zu %7zuk %10zuk\n",
+	       cache->name, cache->flags & 0xffff,
+	       info.object_size, info.slab_size >> 10,
+	       info.objects_per_slab, objs,
+	       info.slabs * info.objects_per_slab, mem_usage,
+	       mem_reclaimable);
+    }
+  pthread_mutex_unlock (&caches_lock);
 
-  pthread_mutex_lock (&cache->lock);
-  *nextp = cache->freelist;
-  cache->freelist = p;
-  pthread_mutex_unlock (&cache->lock);
+  fprintf (m, "total: %zuk, reclaimable: %zuk\n",
+	   mem_total, mem_total_reclaimable);
 
-  /* XXX eventually destroy some... */
+  if (fclose (m))
+    return ENOMEM;
+  return 0;
 }
@@ -58,12 +58,87 @@ unsigned int csum_tcpudp_nofold(unsigned long saddr,
 	return result;
 }
 
+static inline unsigned long fold32(unsigned long x)
+{
+	x = (x & 0xffffffff) + (x >> 32);
+	return (x & 0xffffffff) + (x >> 32);
+}
+
 /*
- * Do a 64-bit checksum on an arbitrary memory area..
+ * The 64-bit words are added up as pairs of 32-bit halves in 64-bit
+ * accumulators, which cannot overflow for any length we are given, so
+ * no carry has to be propagated word by word.  2^32 is 1 modulo
+ * 0xffff, so once folded this is the same ones' complement sum.
  *
- * This isn't a great routine, but it's not _horrible_ either. The
- * inner loop could be unrolled a bit further, and there are better
- * ways to do the carry, but this is reasonable.
+ * If DST is not NULL, the words are copied there on the way.
+ */
+static inline unsigned long sum_words(const unsigned char *src,
+				      unsigned char *dst, unsigned long count)
+{
+	unsigned long a = 0, b = 0;
+
+	for (; count; count--, src += 8) {
+		unsigned long w;
+		__builtin_memcpy(&w, src, 8);
+		if (dst) {
+			__builtin_memcpy(dst, &w, 8);
+			dst += 8;
+		}
+		a += w & 0xffffffff;
+		b += w >> 32;
+	}
+	return fold32(a) + fold32(b);
+}
+
+/* Below this many words, the AVX2 loop does not pay for itself.  */
+#define AVX2_MIN_WORDS	32
+
+typedef unsigned long v4du __attribute__ ((vector_size (32)));
+
+/* The same, 64 bytes at a time in two pairs of 256-bit accumulators.  */
+__attribute__ ((target ("avx2")))
+static unsigned long sum_words_avx2(const unsigned char *src,
+				    unsigned char *dst, unsigned long count)
+{
+	const v4du mask = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+	v4du a = { 0 }, b = { 0 };
+
+	for (; count >= 8; count -= 8, src += 64) {
+		v4du x, y;
+		__builtin_memcpy(&x, src, 32);
+		__builtin_memcpy(&y, src + 32, 32);
+		if (dst) {
+			__builtin_memcpy(dst, &x, 32);
+			__builtin_memcpy(dst + 32, &y, 32);
+			dst += 64;
+		}
+		a += (x & mask) + (x >> 32);
+		b += (y & mask) + (y >> 32);
+	}
+	a += b;
+	return fold32(a[0]) + fold32(a[1]) + fold32(a[2]) + fold32(a[3])
+		+ sum_words(src, dst, count);
+}
+
+static inline int have_avx2(void)
+{
+	static int have = -1;
+
+	if (have < 0)
+		have = __builtin_cpu_supports("avx2");
+	return have;
+}
+
+static unsigned long csum_words(const unsigned char *src,
+				unsigned char *dst, unsigned long count)
+{
+	if (count >= AVX2_MIN_WORDS && have_avx2())
+		return sum_words_avx2(src, dst, count);
+	return sum_words(src, dst, count);
+}
+
+/*
+ * Do a 64-bit checksum on an arbitrary memory area..
  */
 static inline unsigned long do_csum(const unsigned char * buff, int len)
 {
@@ -96,16 +171,8 @@ static inline unsigned long do_csum(const unsigned char * buff, int len)
 			}
 			count >>= 1;	/* nr of 64-bit words.. */
 			if (count) {
-				unsigned long carry = 0;
-				do {
-					unsigned long w = *(unsigned long *) buff;
-					count--;
-					buff += 8;
-					result += carry;
-					result += w;
-					carry = (w > result);
-				} while (count);
-				result += carry;
+				result += csum_words(buff, NULL, count);
+				buff += count * 8;
 				result = (result & 0xffffffff) + (result >> 32);
 			}
 			if (len & 4) {
@@ -159,6 +226,52 @@ unsigned int csum_partial(const unsigned char * buff, int len, unsigned int sum)
 	return result;
 }
 
+/*
+ * copy from src to dst while checksumming, in a single pass
+ *
+ * returns a 32-bit number suitable for feeding into itself
+ * or csum_tcpudp_magic, like csum_partial on dst
+ */
+unsigned int csum_partial_copy(const char *src, char *dst, int len,
+			       unsigned int sum)
+{
+	unsigned long result = 0;
+
+	if (len > 0) {
+		result = csum_words((const unsigned char *) src,
+				    (unsigned char *) dst, len >> 3);
+		src += len & ~7;
+		dst += len & ~7;
+		if (len & 4) {
+			unsigned int w;
+			__builtin_memcpy(&w, src, 4);
+			__builtin_memcpy(dst, &w, 4);
+			result += w;
+			src += 4;
+			dst += 4;
+		}
+		if (len & 2) {
+			unsigned short w;
+			__builtin_memcpy(&w, src, 2);
+			__builtin_memcpy(dst, &w, 2);
+			result += w;
+			src += 2;
+			dst += 2;
+		}
+		if (len & 1) {
+			*dst = *src;
+			result += *(const unsigned char *) src;
+		}
+		result = from64to16(result);
+	}
+
+	/* add in old sum, and carry.. */
+	result += sum;
+	/* 32+c bits -> 32 bits */
+	result = (result & 0xffffffff) + (result >> 32);
+	return result;
+}
+
 /*
  * this routine is used for miscellaneous IP-like checksums, mainly
  * in icmp.c
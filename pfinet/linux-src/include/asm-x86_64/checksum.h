@@ -56,12 +56,12 @@ extern unsigned int csum_partial(const void *buff, int len, unsigned int sum);
 #define  _HAVE_ARCH_COPY_AND_CSUM_FROM_USER 1
 #define HAVE_CSUM_COPY_USER 1
 
-static inline unsigned int 
-csum_partial_copy(const char *src, char *dst, int len,unsigned int sum)
-{
-	memcpy(dst,src,len);
-        return csum_partial(dst, len, sum);
-}
+/*
+ * Copy LEN bytes from SRC to DST and return their checksum added to
+ * SUM, like csum_partial on DST but in a single pass.
+ */
+extern unsigned int csum_partial_copy(const char *src, char *dst, int len,
+				      unsigned int sum);
 
 /* Do not call this directly. Use the wrappers below */
 static inline unsigned int
@@ -242,6 +242,7 @@ find_device (char *name, struct device **device)
   else
     base_name = name;
 
+  pthread_rwlock_wrlock (&config_lock);
   if (strncmp(base_name, "tun", 3) == 0)
     setup_tunnel_device (name, device);
   else if (strncmp(base_name, "dummy", 5) == 0)
@@ -251,6 +252,7 @@ find_device (char *name, struct device **device)
 
   /* Turn on device. */
   dev_open (*device);
+  pthread_rwlock_unlock (&config_lock);
 
   return 0;
 }
@@ -313,6 +315,7 @@ main (int argc,
     }
 
   pthread_mutex_lock (&global_lock);
+  pthread_rwlock_wrlock (&config_lock);
 
   prepare_current (1);		/* Set up to call into Linux initialization. */
 
@@ -333,6 +336,7 @@ main (int argc,
 		    htonl (INADDR_LOOPBACK), htonl (IN_CLASSA_NET),
 		    htonl (INADDR_NONE), htonl (INADDR_NONE));
 
+  pthread_rwlock_unlock (&config_lock);
   pthread_mutex_unlock (&global_lock);
 
   /* Parse options.  When successful, this configures the interfaces
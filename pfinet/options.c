@@ -452,6 +452,7 @@ parse_opt (int opt, char *arg, struct argp_state *state)
       /* Successfully finished parsing, return a result.  */
 
       pthread_mutex_lock (&global_lock);
+      pthread_rwlock_wrlock (&config_lock);
 
       for (in = h->interfaces; in < h->interfaces + h->num_interfaces; in++)
 	{
@@ -474,6 +475,7 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 
 	  if (err)
 	    {
+	      pthread_rwlock_unlock (&config_lock);
 	      pthread_mutex_unlock (&global_lock);
 	      FAIL (err, 16, 0, "cannot configure interface");
 	    }
@@ -524,6 +526,7 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	    err = add_route (gw4_in->device, &route);
 	    if (err)
 	      {
+		pthread_rwlock_unlock (&config_lock);
 		pthread_mutex_unlock (&global_lock);
 	        FAIL (err, 17, 0, "cannot set default gateway");
 	      }
@@ -563,11 +566,13 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	  err = add_route (in->device, &route);
 	  if (err)
 	    {
+	      pthread_rwlock_unlock (&config_lock);
 	      pthread_mutex_unlock (&global_lock);
 	      FAIL (err, 17, 0, "cannot add route");
 	    }
 	}
 
+      pthread_rwlock_unlock (&config_lock);
       pthread_mutex_unlock (&global_lock);
 
       /* Fall through to free hook.  */
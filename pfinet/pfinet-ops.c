@@ -56,7 +56,7 @@ S_pfinet_siocgifconf (io_t port,
   error_t err = 0;
   struct ifconf ifc;
 
-  pthread_mutex_lock (&global_lock);
+  pthread_rwlock_rdlock (&config_lock);
   if (amount == (vm_size_t) -1)
     {
       /* Get the needed buffer length.  */
@@ -65,7 +65,7 @@ S_pfinet_siocgifconf (io_t port,
       err = dev_ifconf ((char *) &ifc);
       if (err)
 	{
-	  pthread_mutex_unlock (&global_lock);
+	  pthread_rwlock_unlock (&config_lock);
 	  return -err;
 	}
       amount = ifc.ifc_len;
@@ -96,7 +96,7 @@ S_pfinet_siocgifconf (io_t port,
       *ifr = ifc.ifc_buf;
     }
 
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
 
@@ -130,7 +130,7 @@ S_pfinet_getroutes (io_t port,
   int n;
   ifrtreq_t *rtable = NULL;
 
-  pthread_mutex_lock (&global_lock);
+  pthread_rwlock_rdlock (&config_lock);
 
   if (dealloc_data)
     *dealloc_data = FALSE;
@@ -174,6 +174,35 @@ S_pfinet_getroutes (io_t port,
       *routes = (char *)rtable;
     }
 
-  pthread_mutex_unlock (&global_lock);
+  pthread_rwlock_unlock (&config_lock);
   return err;
 }
+
+kern_return_t
+S_pfinet_getslabinfo (io_t port,
+		      data_t *info,
+		      mach_msg_type_number_t *len)
+{
+  error_t err;
+  char *contents;
+  size_t contents_len;
+
+  err = kmem_cache_slabinfo (&contents, &contents_len);
+  if (err)
+    return err;
+
+  if (*len < contents_len)
+    {
+      *info = mmap (0, contents_len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (*info == MAP_FAILED)
+	{
+	  free (contents);
+	  return ENOMEM;
+	}
+    }
+
+  memcpy (*info, contents, contents_len);
+  *len = contents_len;
+  free (contents);
+  return 0;
+}
@@ -39,6 +39,12 @@
 extern pthread_mutex_t global_lock;
 extern pthread_mutex_t net_bh_lock;
 
+/* Interfaces, their IPv4 addresses and the routing table are only changed
+   with both global_lock held and this lock held for writing, so that
+   they can be looked at with just this lock held for reading, without
+   holding up the stack.  */
+extern pthread_rwlock_t config_lock;
+
 extern struct port_bucket *pfinet_bucket;
 extern struct port_class *addrport_class;
 extern struct port_class *socketport_class;
@@ -73,7 +79,6 @@ extern uid_t pfinet_owner;
 extern uid_t pfinet_group;
 
 void ethernet_initialize (void);
-int ethernet_demuxer (mach_msg_header_t *, mach_msg_header_t *);
 void setup_ethernet_device (char *, struct device **);
 void setup_dummy_device (char *, struct device **);
 void setup_tunnel_device (char *, struct device **);
@@ -84,6 +89,7 @@ void init_devices (void);
 void *net_bh_worker (void *);
 void init_time (void);
 int get_routing_table(int start, int count, ifrtreq_t *routes);
+error_t kmem_cache_slabinfo (char **contents, size_t *len);
 struct sock;
 error_t tcp_tiocinq (struct sock *sk, mach_msg_type_number_t *amount);
 
@@ -32,9 +32,145 @@
 long long root_jiffies;
 volatile struct mapped_time_value *mapped_time;
 
-static struct timer_list *timers;
+/* Pending timers are kept in a hierarchical timing wheel, as in Linux:
+   TV1 has a list for each of the next TVR_SIZE jiffies, and each level
+   of TVN a list for each of TVN_SIZE spans as long as a whole turn of
+   the level below.  When TV1 comes round, the next list of each level
+   that has come round too is spread out over the level below.  Adding
+   and deleting a timer are thus constant time, and expiry costs a list
+   per jiffy.  All of it is protected by global_lock.  */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_LEVELS 4
+
+static struct timer_list *tv1[TVR_SIZE];
+static struct timer_list *tvn[TVN_LEVELS][TVN_SIZE];
+
+/* The next jiffy whose TV1 list is to be run.  */
+static unsigned long timer_jiffies;
+static unsigned long timer_count;
+static int timers_running;	/* In run_timers */
+
+/* When the timer thread is to wake up next, unless it waits for a new
+   timer to be added.  */
+static unsigned long timer_wakeup;
+static int timer_waits_forever = 1;
+
 static thread_t timer_thread = 0;
 
+/* Link TIMER into the list of the wheel its expiry time falls in.  */
+static void
+internal_add_timer (struct timer_list *timer)
+{
+  unsigned long expires = timer->expires;
+  unsigned long idx = expires - timer_jiffies;
+  struct timer_list **vec;
+
+  if ((long) idx < 0)
+    /* Already due: run it with the current jiffy.  */
+    vec = &tv1[timer_jiffies & TVR_MASK];
+  else if (idx < TVR_SIZE)
+    vec = &tv1[expires & TVR_MASK];
+  else
+    {
+      int level;
+
+      /* Timers further away than the wheel reaches wait in the last
+	 list, and are put back until they are near enough.  */
+      if (idx > 0xffffffffUL)
+	expires = timer_jiffies + 0xffffffffUL;
+      for (level = 0; level < TVN_LEVELS - 1; level++)
+	if (idx < 1UL << (TVR_BITS + (level + 1) * TVN_BITS))
+	  break;
+      vec = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS))
+			& TVN_MASK];
+    }
+
+  timer->next = *vec;
+  if (timer->next)
+    timer->next->prev = &timer->next;
+  timer->prev = vec;
+  *vec = timer;
+}
+
+static void
+unlink_timer (struct timer_list *timer)
+{
+  *timer->prev = timer->next;
+  if (timer->next)
+    timer->next->prev = timer->prev;
+
+  timer->next = 0;
+  timer->prev = 0;
+}
+
+/* Spread the list of LEVEL that timer_jiffies has come to over the
+   levels below.  Return its index, which is 0 when the level above has
+   come round as well.  */
+static int
+cascade (int level)
+{
+  int index = (timer_jiffies >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+  struct timer_list *tp = tvn[level][index];
+
+  tvn[level][index] = 0;
+  while (tp)
+    {
+      struct timer_list *next = tp->next;
+      internal_add_timer (tp);
+      tp = next;
+    }
+  return index;
+}
+
+/* Run every timer that expired by NOW.  */
+static void
+run_timers (unsigned long now)
+{
+  timers_running = 1;
+  while (time_after_eq (now, timer_jiffies))
+    {
+      int index = timer_jiffies & TVR_MASK;
+      int level;
+
+      if (index == 0)
+	for (level = 0; level < TVN_LEVELS && cascade (level) == 0; level++)
+	  ;
+
+      /* A function may add timers that are already due, which go on
+	 this same list.  */
+      while (tv1[index])
+	{
+	  struct timer_list *tp = tv1[index];
+
+	  unlink_timer (tp);
+	  timer_count--;
+	  (*tp->function) (tp->data);
+	}
+      timer_jiffies++;
+    }
+  timers_running = 0;
+}
+
+/* Return the jiffy by which the timer thread has to look at the wheel
+   again: the next one with a TV1 list, or the one at which TV1 comes
+   round, as timers from above may then be due before the rest of
+   TV1.  */
+static unsigned long
+next_wakeup (void)
+{
+  unsigned long j;
+
+  for (j = timer_jiffies; (j & TVR_MASK) != 0 || j == timer_jiffies; j++)
+    if (tv1[j & TVR_MASK])
+      return j;
+  return j;
+}
+
 static void *
 timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 {
@@ -49,14 +185,19 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
   pthread_mutex_lock (&global_lock);
   while (1)
     {
-      int jiff = jiffies;
+      unsigned long jiff = jiffies;
 
-      if (!timers)
+      timer_waits_forever = timer_count == 0;
+      if (timer_waits_forever)
 	wait = -1;
-      else if (timers->expires <= jiff)
-	wait = 0;
       else
-	wait = ((timers->expires - jiff) * 1000) / HZ;
+	{
+	  timer_wakeup = next_wakeup ();
+	  if (time_after_eq (jiff, timer_wakeup))
+	    wait = 0;
+	  else
+	    wait = ((timer_wakeup - jiff) * 1000) / HZ;
+	}
 
       pthread_mutex_unlock (&global_lock);
 
@@ -66,21 +207,7 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 
       pthread_mutex_lock (&global_lock);
 
-      while (timers->expires <= jiffies)
-	{
-	  struct timer_list *tp;
-
-	  tp = timers;
-
-	  timers = timers->next;
-	  if (timers)
-	    timers->prev = &timers;
-
-	  tp->next = 0;
-	  tp->prev = 0;
-
-	  (*tp->function) (tp->data);
-	}
+      run_timers (jiffies);
     }
 
   return NULL;
@@ -90,28 +217,21 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 void
 add_timer (struct timer_list *timer)
 {
-  struct timer_list **tp;
-
-  for (tp = &timers; *tp; tp = &(*tp)->next)
-    if ((*tp)->expires > timer->expires)
-      {
-	timer->next = *tp;
-	timer->next->prev = &timer->next;
-	timer->prev = tp;
-	*tp = timer;
-	break;
-      }
-  if (!*tp)
-    {
-      timer->next = 0;
-      timer->prev = tp;
-      *tp = timer;
-    }
+  /* With nothing pending, the wheel can skip the jiffies it has not
+     run yet instead of running them one by one.  */
+  if (timer_count == 0 && !timers_running)
+    timer_jiffies = jiffies;
+
+  internal_add_timer (timer);
+  timer_count++;
 
-  if (timers == timer)
+  if (timer_waits_forever || time_before (timer->expires, timer_wakeup))
     {
-      /* We have change the first one, so tweak the timer thread
-	 to push things up. */
+      /* The timer thread sleeps past this one, so tweak it to push
+	 things up. */
+      timer_waits_forever = 0;
+      timer_wakeup = timer->expires;
+
       while (timer_thread == 0)
 	swtch_pri (0);
 
@@ -129,12 +249,8 @@ del_timer (struct timer_list *timer)
 {
   if (timer->prev)
     {
-      *timer->prev = timer->next;
-      if (timer->next)
-	timer->next->prev = timer->prev;
-
-      timer->next = 0;
-      timer->prev = 0;
+      unlink_timer (timer);
+      timer_count--;
       return 1;
     }
   else
@@ -144,7 +260,6 @@ del_timer (struct timer_list *timer)
 void
 mod_timer (struct timer_list *timer, unsigned long expires)
 {
-  /* Should optimize this.  */
   del_timer (timer);
   timer->expires = expires;
   add_timer (timer);
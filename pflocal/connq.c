@@ -41,6 +41,10 @@ struct connq
   pthread_cond_t connectors;
   unsigned num_connectors;
 
+  /* Requests that have been accepted, kept for reuse so that setting up
+     a connection needn't allocate one.  */
+  struct connq_request *free_requests;
+
   pthread_mutex_t lock;
 };
 
@@ -96,6 +100,35 @@ connq_request_dequeue (struct connq *cq)
   return req;
 }
 
+/* Return an unused request for CQ, reusing one if possible.  CQ must be
+   locked.  */
+static struct connq_request *
+connq_request_alloc (struct connq *cq)
+{
+  struct connq_request *req = cq->free_requests;
+
+  if (req)
+    cq->free_requests = req->next;
+  else
+    {
+      req = malloc (sizeof (struct connq_request));
+      if (! req)
+	abort ();
+    }
+
+  return req;
+}
+
+/* Keep REQ, which has been dequeued from CQ, for reuse.  CQ must be
+   locked.  */
+static void
+connq_request_release (struct connq *cq, struct connq_request *req)
+{
+  req->sock = NULL;
+  req->next = cq->free_requests;
+  cq->free_requests = req;
+}
+
 /* ---------------------------------------------------------------- */
 
 /* Create a new listening queue, returning it in CQ.  The resulting queue
@@ -117,6 +150,7 @@ connq_create (struct connq **cq)
 
   new->num_listeners = 0;
   new->num_connectors = 0;
+  new->free_requests = NULL;
 
   pthread_mutex_init (&new->lock, NULL);
   pthread_cond_init (&new->listeners, NULL);
@@ -135,6 +169,13 @@ connq_destroy (struct connq *cq)
   assert_backtrace (! cq->head);
   assert_backtrace (cq->count == 0);
 
+  while (cq->free_requests)
+    {
+      struct connq_request *req = cq->free_requests;
+      cq->free_requests = req->next;
+      free (req);
+    }
+
   free (cq);
 }
 
@@ -197,7 +238,7 @@ connq_listen (struct connq *cq, struct timespec *tsp, struct sock **sock)
     {
       struct connq_request *req = connq_request_dequeue (cq);
       *sock = req->sock;
-      free (req);
+      connq_request_release (cq, req);
     }
   else if (cq->num_listeners > 0)
     /* The caller will not actually process this request but someone
@@ -263,14 +304,11 @@ connq_connect_complete (struct connq *cq, struct sock *sock)
 {
   struct connq_request *req;
 
-  req = malloc (sizeof (struct connq_request));
-  if (! req)
-    abort ();
+  pthread_mutex_lock (&cq->lock);
 
+  req = connq_request_alloc (cq);
   connq_request_init (req, sock);
 
-  pthread_mutex_lock (&cq->lock);
-
   assert_backtrace (cq->num_connectors > 0);
   cq->num_connectors --;
 
@@ -384,10 +384,26 @@ sock_get_addr (struct sock *sock, struct addr **addr)
 
 /* ---------------------------------------------------------------- */
 
-/* We hold this lock before we lock two sockets at once, to prevent someone
-   else trying to lock the same two sockets in the reverse order, resulting
-   in a deadlock.  */
-static pthread_mutex_t socket_pair_lock;
+/* Lock SOCK1 and SOCK2, which may be the same.  Two sockets are always
+   locked in the order of their addresses, so that someone locking the
+   same two the other way round can't deadlock with us; this is cheaper
+   than serializing every connection of the server on a single lock.  */
+static void
+sock_lock_pair (struct sock *sock1, struct sock *sock2)
+{
+  if (sock1 == sock2)
+    pthread_mutex_lock (&sock1->lock);
+  else if (sock1 < sock2)
+    {
+      pthread_mutex_lock (&sock1->lock);
+      pthread_mutex_lock (&sock2->lock);
+    }
+  else
+    {
+      pthread_mutex_lock (&sock2->lock);
+      pthread_mutex_lock (&sock1->lock);
+    }
+}
 
 /* Connect SOCK1 and SOCK2.  */
 error_t
@@ -416,11 +432,8 @@ sock_connect (struct sock *sock1, struct sock *sock2)
     /* Incompatible socket types.  */
     return EOPNOTSUPP;		/* XXX?? */
 
-  pthread_mutex_lock (&socket_pair_lock);
-  pthread_mutex_lock (&sock1->lock);
-  if (sock1 != sock2)
-    /* If SOCK1 == SOCK2, then we get a fifo!  */
-    pthread_mutex_lock (&sock2->lock);
+  /* If SOCK1 == SOCK2, then we get a fifo!  */
+  sock_lock_pair (sock1, sock2);
 
   if ((sock1->flags & PFLOCAL_SOCK_CONNECTED) || (sock2->flags & PFLOCAL_SOCK_CONNECTED))
     /* An already-connected socket.  */
@@ -447,7 +460,6 @@ sock_connect (struct sock *sock1, struct sock *sock2)
   if (sock1 != sock2)
     pthread_mutex_unlock (&sock2->lock);
   pthread_mutex_unlock (&sock1->lock);
-  pthread_mutex_unlock (&socket_pair_lock);
 
   if (old_sock1_write_pipe)
     pipe_remove_writer (old_sock1_write_pipe);
@@ -26,14 +26,40 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/resource.h>
+#include <pthread.h>
 
 #include "proc.h"
 #include <hurd/ihash.h>
 
 static struct hurd_ihash pghash
   = HURD_IHASH_INITIALIZER (offsetof (struct pgrp, pg_hashloc));
-static struct hurd_ihash pidhash
-  = HURD_IHASH_INITIALIZER (offsetof (struct proc, p_pidhashloc));
+
+/* The processes by pid are split in shards, each with a lock of its
+   own.  Whoever changes a shard holds both GLOBAL_LOCK and the lock of
+   the shard, so that code holding GLOBAL_LOCK needs no shard lock, and
+   code not holding it, like S_proc_getallpids, can still read a shard
+   under its lock alone without holding up the rest of the server.  */
+#define PID_SHARDS 16
+
+static struct pid_shard
+{
+  pthread_rwlock_t lock;
+  struct hurd_ihash hash;
+} pidshards[PID_SHARDS] =
+  {
+    [0 ... PID_SHARDS - 1] =
+      {
+	PTHREAD_RWLOCK_INITIALIZER,
+	HURD_IHASH_INITIALIZER (offsetof (struct proc, p_pidhashloc))
+      }
+  };
+
+static inline struct pid_shard *
+pid_shard (pid_t pid)
+{
+  return &pidshards[(unsigned int) pid % PID_SHARDS];
+}
+
 static struct hurd_ihash taskhash
   = HURD_IHASH_INITIALIZER (offsetof (struct proc, p_taskhashloc));
 static struct hurd_ihash sidhash
@@ -45,7 +71,7 @@ struct proc *
 pid_find (pid_t pid)
 {
   struct proc *p;
-  p = hurd_ihash_find (&pidhash, pid);
+  p = hurd_ihash_find (&pid_shard (pid)->hash, pid);
   return (!p || p->p_dead) ? 0 : p;
 }
 
@@ -54,7 +80,7 @@ pid_find (pid_t pid)
 struct proc *
 pid_find_allow_zombie (pid_t pid)
 {
-  return hurd_ihash_find (&pidhash, pid);
+  return hurd_ihash_find (&pid_shard (pid)->hash, pid);
 }
 
 /* Find the process corresponding to a given task. */
@@ -94,7 +120,11 @@ session_find (pid_t sid)
 void
 add_proc_to_hash (struct proc *p)
 {
-  hurd_ihash_add (&pidhash, p->p_pid, p);
+  struct pid_shard *shard = pid_shard (p->p_pid);
+
+  pthread_rwlock_wrlock (&shard->lock);
+  hurd_ihash_add (&shard->hash, p->p_pid, p);
+  pthread_rwlock_unlock (&shard->lock);
   hurd_ihash_add (&taskhash, p->p_task, p);
 }
 
@@ -123,7 +153,11 @@ remove_pgrp_from_hash (struct pgrp *pg)
 void
 remove_proc_from_hash (struct proc *p)
 {
-  hurd_ihash_locp_remove (&pidhash, p->p_pidhashloc);
+  struct pid_shard *shard = pid_shard (p->p_pid);
+
+  pthread_rwlock_wrlock (&shard->lock);
+  hurd_ihash_locp_remove (&shard->hash, p->p_pidhashloc);
+  pthread_rwlock_unlock (&shard->lock);
   hurd_ihash_locp_remove (&taskhash, p->p_taskhashloc);
 }
 
@@ -139,12 +173,60 @@ remove_session_from_hash (struct session *s)
 void
 prociterate (void (*fun) (struct proc *, void *), void *arg)
 {
-  HURD_IHASH_ITERATE (&pidhash, value)
+  int i;
+
+  for (i = 0; i < PID_SHARDS; i++)
+    HURD_IHASH_ITERATE (&pidshards[i].hash, value)
+      {
+	struct proc *p = value;
+	if (!p->p_dead)
+	  (*fun)(p, arg);
+      }
+}
+
+/* Store the pids of the live processes in *PIDS, a malloced array of
+   *NPIDS elements.  This only takes the lock of one pid shard at a
+   time, and does not need GLOBAL_LOCK.  */
+error_t
+collect_pids (pid_t **pids, size_t *npids)
+{
+  pid_t *buf = NULL;
+  size_t n = 0, alloced = 0;
+  int i;
+
+  for (i = 0; i < PID_SHARDS; i++)
     {
-      struct proc *p = value;
-      if (!p->p_dead)
-	(*fun)(p, arg);
+      struct pid_shard *shard = &pidshards[i];
+
+      pthread_rwlock_rdlock (&shard->lock);
+      if (n + shard->hash.nr_items > alloced)
+	{
+	  size_t new_alloced = 2 * (n + shard->hash.nr_items);
+	  pid_t *new = realloc (buf, new_alloced * sizeof (pid_t));
+	  if (! new)
+	    {
+	      pthread_rwlock_unlock (&shard->lock);
+	      free (buf);
+	      return ENOMEM;
+	    }
+	  buf = new;
+	  alloced = new_alloced;
+	}
+      HURD_IHASH_ITERATE (&shard->hash, value)
+	{
+	  /* P_DEAD only ever changes from 0 to 1 under GLOBAL_LOCK; a
+	     process dying meanwhile is listed like one dying just after
+	     the reply.  */
+	  struct proc *p = value;
+	  if (!p->p_dead)
+	    buf[n++] = p->p_pid;
+	}
+      pthread_rwlock_unlock (&shard->lock);
     }
+
+  *pids = buf;
+  *npids = n;
+  return 0;
 }
 
 /* Tell if a pid is available for use */
@@ -749,51 +749,52 @@ S_proc_exception_raise (struct exc *e,
 
 }
 
-/* This function is used as callback in S_proc_getallpids.  */
-static void
-count_up (struct proc *p, void *counter)
-{
-  ++*(int *)counter;
-}
-
-/* This function is used as callback in S_proc_getallpids.  */
-static void
-store_pid (struct proc *p, void *loc)
-{
-  *(*(pid_t **)loc)++ = p->p_pid;
-}
-
 /* Implement proc_getallpids as described in <hurd/process.defs>. */
 kern_return_t
 S_proc_getallpids (struct proc *p,
 		   pid_t **pids,
 		   mach_msg_type_number_t *pidslen)
 {
-  int nprocs;
-  pid_t *loc;
+  task_t *tasks;
+  size_t ntasks, nprocs;
+  pid_t *all;
+  error_t err;
 
   /* No need to check P here; we don't use it. */
 
-  add_tasks (0);
-
-  nprocs = 0;
-  prociterate (count_up, &nprocs);
+  /* Only hold GLOBAL_LOCK to add the tasks we don't know yet, not while
+     asking the kernel for them nor while listing the pids, so that ps
+     does not hold up fork, exec and wait.  */
+  pthread_mutex_unlock (&global_lock);
+  err = fetch_tasks (&tasks, &ntasks);
+  pthread_mutex_lock (&global_lock);
+  if (! err)
+    enter_tasks (tasks, ntasks, 0);
+  pthread_mutex_unlock (&global_lock);
 
-  if (nprocs > *pidslen)
+  err = collect_pids (&all, &nprocs);
+  if (! err)
     {
-      *pids = mmap (0, nprocs * sizeof (pid_t), PROT_READ|PROT_WRITE,
-		    MAP_ANON, 0, 0);
-      if (*pids == MAP_FAILED)
-        return ENOMEM;
+      if (nprocs > *pidslen)
+	{
+	  *pids = mmap (0, nprocs * sizeof (pid_t), PROT_READ|PROT_WRITE,
+			MAP_ANON, 0, 0);
+	  if (*pids == MAP_FAILED)
+	    err = ENOMEM;
+	}
+      if (! err)
+	{
+	  memcpy (*pids, all, nprocs * sizeof (pid_t));
+	  *pidslen = nprocs;
+	}
+      free (all);
     }
 
-  loc = *pids;
-  prociterate (store_pid, &loc);
-
-  *pidslen = nprocs;
-  return 0;
+  /* Reacquire GLOBAL_LOCK to make the central locking code happy.  */
+  pthread_mutex_lock (&global_lock);
+  return err;
 }
-
+
 /* Create a process for TASK, which is not otherwise known to us.
    The PID/parentage/job-control fields are not yet filled in,
    and the proc is not entered into any hash table.  */
@@ -1160,62 +1161,111 @@ complete_exit (struct proc *p)
   ports_port_deref (p);
 }
 
-/* Get the list of all tasks from the kernel and start adding them.
-   If we encounter TASK, then don't do any more and return its proc.
-   If TASK is null or we never find it, then return 0. */
-struct proc *
-add_tasks (task_t task)
+/* Get the list of all tasks from the kernel into *TASKS, a malloced
+   array of *NTASKS task ports.  This makes no use of our own state, so
+   GLOBAL_LOCK need not be held.  */
+static error_t
+fetch_tasks (task_t **tasks, size_t *ntasks)
 {
   mach_port_t *psets;
   mach_msg_type_number_t npsets;
+  task_t *all = NULL;
+  size_t nall = 0;
   int i;
-  struct proc *foundp = 0;
+  error_t err;
+
+  err = host_processor_sets (mach_host_self (), &psets, &npsets);
+  if (err)
+    return err;
 
-  host_processor_sets (mach_host_self (), &psets, &npsets);
   for (i = 0; i < npsets; i++)
     {
       mach_port_t psetpriv;
-      mach_port_t *tasks;
-      mach_msg_type_number_t ntasks;
+      mach_port_t *settasks;
+      mach_msg_type_number_t nsettasks;
       int j;
 
-      if (!foundp)
+      if (!err
+	  && !host_processor_set_priv (_hurd_host_priv, psets[i], &psetpriv))
 	{
-	  host_processor_set_priv (_hurd_host_priv, psets[i], &psetpriv);
-	  processor_set_tasks (psetpriv, &tasks, &ntasks);
-	  for (j = 0; j < ntasks; j++)
+	  if (!processor_set_tasks (psetpriv, &settasks, &nsettasks))
 	    {
-	      int set = 0;
-
-	      /* The kernel can deliver us an array with null slots in the
-		 middle, e.g. if a task died during the call.  */
-	      if (! MACH_PORT_VALID (tasks[j]))
-		continue;
-
-	      if (!foundp)
-		{
-		  struct proc *p = task_find_nocreate (tasks[j]);
-		  if (!p)
-		    {
-		      p = new_proc (tasks[j]);
-		      if (p)
-			set = 1;
-		    }
-		  if (!foundp && tasks[j] == task)
-		    foundp = p;
-		}
-	      if (!set)
-		mach_port_deallocate (mach_task_self (), tasks[j]);
+	      task_t *new = realloc (all, (nall + nsettasks) * sizeof (task_t));
+	      if (! new)
+		err = ENOMEM;
+
+	      for (j = 0; j < nsettasks; j++)
+		/* The kernel can deliver us an array with null slots in
+		   the middle, e.g. if a task died during the call.  */
+		if (! MACH_PORT_VALID (settasks[j]))
+		  continue;
+		else if (new)
+		  new[nall++] = settasks[j];
+		else
+		  mach_port_deallocate (mach_task_self (), settasks[j]);
+
+	      if (new)
+		all = new;
+	      munmap (settasks, nsettasks * sizeof (task_t));
 	    }
-	  munmap (tasks, ntasks * sizeof (task_t));
 	  mach_port_deallocate (mach_task_self (), psetpriv);
 	}
       mach_port_deallocate (mach_task_self (), psets[i]);
     }
   munmap (psets, npsets * sizeof (mach_port_t));
+
+  *tasks = all;
+  *ntasks = nall;
+  return 0;
+}
+
+/* Add the NTASKS tasks in TASKS, as returned by fetch_tasks, that we do
+   not know yet, consuming the array.  If we encounter TASK, then don't
+   add any more and return its proc.  If TASK is null or we never find
+   it, then return 0.  */
+static struct proc *
+enter_tasks (task_t *tasks, size_t ntasks, task_t task)
+{
+  struct proc *foundp = 0;
+  size_t j;
+
+  for (j = 0; j < ntasks; j++)
+    {
+      int set = 0;
+
+      if (!foundp)
+	{
+	  struct proc *p = task_find_nocreate (tasks[j]);
+	  if (!p)
+	    {
+	      p = new_proc (tasks[j]);
+	      if (p)
+		set = 1;
+	    }
+	  if (!foundp && tasks[j] == task)
+	    foundp = p;
+	}
+      if (!set)
+	mach_port_deallocate (mach_task_self (), tasks[j]);
+    }
+  free (tasks);
   return foundp;
 }
 
+/* Get the list of all tasks from the kernel and start adding them.
+   If we encounter TASK, then don't do any more and return its proc.
+   If TASK is null or we never find it, then return 0. */
+struct proc *
+add_tasks (task_t task)
+{
+  task_t *tasks;
+  size_t ntasks;
+
+  if (fetch_tasks (&tasks, &ntasks))
+    return 0;
+  return enter_tasks (tasks, ntasks, task);
+}
+
 /* Allocate a new unused PID.
    (Unused means it is neither the pid nor pgrp of any relevant data.) */
 int
@@ -163,6 +163,7 @@ int check_uid (struct proc *, uid_t);
 int check_owner (struct proc *, struct proc *);
 void addalltasks (void);
 void prociterate (void (*)(struct proc *, void *), void *);
+error_t collect_pids (pid_t **, size_t *);
 void free_process (struct proc *);
 void panic (char *);
 int valid_task (task_t);
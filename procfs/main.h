@@ -22,3 +22,4 @@ extern int opt_clk_tck;
 extern mode_t opt_stat_mode;
 extern pid_t opt_kernel_pid;
 extern uid_t opt_anon_owner;
+extern int opt_cache_time;
@@ -19,7 +19,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <hurd/process.h>
 #include <hurd/resource.h>
 #include <mach/vm_param.h>
@@ -521,6 +524,101 @@ static struct procfs_dir_entry entries[] = {
   {}
 };
 
+/* The proc_stats made for all the processes at once by process_prefetch,
+   sorted by pid, for process_lookup_pid to take.  */
+static struct proc_stat **prefetched;
+static size_t num_prefetched;
+static struct timespec prefetched_time;
+static pthread_mutex_t prefetched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+compare_proc_stat_pid (const void *a, const void *b)
+{
+  pid_t x = (*(struct proc_stat **) a)->pid;
+  pid_t y = (*(struct proc_stat **) b)->pid;
+  return (x > y) - (x < y);
+}
+
+/* Free the proc_stats left in PREFETCHED.  PREFETCHED_LOCK is held.  */
+static void
+drop_prefetched (void)
+{
+  size_t i;
+
+  for (i = 0; i < num_prefetched; i++)
+    if (prefetched[i])
+      _proc_stat_free (prefetched[i]);
+  free (prefetched);
+  prefetched = NULL;
+  num_prefetched = 0;
+}
+
+/* Take the proc_stat prefetched for PID, if any is recent enough.  */
+static struct proc_stat *
+take_prefetched (pid_t pid)
+{
+  struct proc_stat *ps = NULL, **psp;
+  struct timespec now;
+  long long ms;
+
+  pthread_mutex_lock (&prefetched_lock);
+  if (num_prefetched)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      ms = (now.tv_sec - prefetched_time.tv_sec) * 1000LL
+	+ (now.tv_nsec - prefetched_time.tv_nsec) / 1000000;
+      if (ms >= opt_cache_time)
+	drop_prefetched ();
+    }
+  if (num_prefetched)
+    {
+      struct proc_stat key = { .pid = pid }, *keyp = &key;
+
+      psp = bsearch (&keyp, prefetched, num_prefetched, sizeof *prefetched,
+		     compare_proc_stat_pid);
+      if (psp)
+	{
+	  ps = *psp;
+	  *psp = NULL;
+	}
+    }
+  pthread_mutex_unlock (&prefetched_lock);
+  return ps;
+}
+
+void
+process_prefetch (struct ps_context *pc, const pid_t *pids, size_t num_pids)
+{
+  struct proc_stat **stats;
+  ps_flags_t needs = PSTAT_OWNER_UID;
+  const struct procfs_dir_entry *ent;
+  size_t i, n = 0;
+
+  if (! opt_cache_time || num_pids < 2)
+    return;
+
+  stats = malloc (num_pids * sizeof *stats);
+  if (! stats)
+    return;
+  for (i = 0; i < num_pids; i++)
+    if (! _proc_stat_create (pids[i], pc, &stats[n]))
+      n++;
+
+  /* What any of the files of a process needs from proc_getprocinfo is
+     fetched for all of them in one go.  */
+  for (ent = entries; ent->name; ent++)
+    needs |= ((const struct process_file_desc *) ent->hook)->needs;
+  _proc_stats_prefetch_procinfo (stats, n, needs);
+  qsort (stats, n, sizeof *stats, compare_proc_stat_pid);
+
+  pthread_mutex_lock (&prefetched_lock);
+  drop_prefetched ();
+  prefetched = stats;
+  num_prefetched = n;
+  clock_gettime (CLOCK_MONOTONIC, &prefetched_time);
+  pthread_mutex_unlock (&prefetched_lock);
+}
+
 error_t
 process_lookup_pid (struct ps_context *pc, pid_t pid, struct node **np)
 {
@@ -535,11 +633,15 @@ process_lookup_pid (struct ps_context *pc, pid_t pid, struct node **np)
   int owner;
   error_t err;
 
-  err = _proc_stat_create (pid, pc, &ps);
-  if (err == ESRCH)
-    return ENOENT;
-  if (err)
-    return EIO;
+  ps = take_prefetched (pid);
+  if (! ps)
+    {
+      err = _proc_stat_create (pid, pc, &ps);
+      if (err == ESRCH)
+	return ENOENT;
+      if (err)
+	return EIO;
+    }
 
   err = proc_stat_set_flags (ps, PSTAT_OWNER_UID);
   if (err || ! (proc_stat_flags (ps) & PSTAT_OWNER_UID))
@@ -25,3 +25,8 @@
 error_t
 process_lookup_pid (struct ps_context *pc, pid_t pid, struct node **np);
 
+/* Fetch ahead, in one batch, what the files of the NUM_PIDS processes in
+   PIDS will need from the proc server, for process_lookup_pid to use for
+   the cache time.  */
+void
+process_prefetch (struct ps_context *pc, const pid_t *pids, size_t num_pids);
@@ -24,16 +24,27 @@
 #include <mach.h>
 #include <hurd/netfs.h>
 #include <hurd/fshelp.h>
+#include <pthread.h>
+#include <time.h>
 #include "procfs.h"
+#include "main.h"
 
 struct netnode
 {
   const struct procfs_node_ops *ops;
   void *hook;
 
-  /* (cached) contents of the node */
+  /* (cached) contents of the node, and when they were generated */
   char *contents;
   ssize_t contents_len;
+  struct timespec contents_time;
+
+  /* The contents are malloced copies of shared ones, rather than made by
+     OPS->get_contents.  */
+  int contents_copied;
+
+  /* See procfs_node_share_contents.  */
+  int share_contents;
 
   /* parent directory, if applicable */
   struct node *parent;
@@ -90,6 +101,11 @@ fail:
   return NULL;
 }
 
+void procfs_node_share_contents (struct node *np)
+{
+  np->nn->share_contents = 1;
+}
+
 void procfs_node_chown (struct node *np, uid_t owner)
 {
   np->nn_stat.st_uid = owner;
@@ -132,9 +148,105 @@ procfs_make_ino (struct node *np, const char *filename)
   return (unsigned long) jrand48 (x);
 }
 
+/* Contents generated for the nodes sharing theirs, by ops and hook.  */
+struct shared_contents
+{
+  struct shared_contents *next;
+  const struct procfs_node_ops *ops;
+  void *hook;
+  char *contents;
+  ssize_t contents_len;
+  struct timespec time;
+};
+
+static struct shared_contents *shared_contents;
+static pthread_mutex_t shared_contents_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return true if contents generated at T are still to be used.  */
+static int
+contents_fresh (const struct timespec *t)
+{
+  struct timespec now;
+  long long ms;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  ms = (now.tv_sec - t->tv_sec) * 1000LL
+    + (now.tv_nsec - t->tv_nsec) / 1000000;
+  return ms < opt_cache_time;
+}
+
+/* Look for fresh contents shared with NP, and make a copy of them the
+   contents of NP; return true if found.  */
+static int
+get_shared_contents (struct node *np)
+{
+  struct shared_contents *sc;
+  int found = 0;
+
+  pthread_mutex_lock (&shared_contents_lock);
+  for (sc = shared_contents; sc; sc = sc->next)
+    if (sc->ops == np->nn->ops && sc->hook == np->nn->hook)
+      break;
+  if (sc && contents_fresh (&sc->time))
+    {
+      char *copy = malloc (sc->contents_len ?: 1);
+      if (copy)
+	{
+	  memcpy (copy, sc->contents, sc->contents_len);
+	  np->nn->contents = copy;
+	  np->nn->contents_len = sc->contents_len;
+	  np->nn->contents_time = sc->time;
+	  np->nn->contents_copied = 1;
+	  found = 1;
+	}
+    }
+  pthread_mutex_unlock (&shared_contents_lock);
+  return found;
+}
+
+/* Share a copy of the contents just generated for NP.  */
+static void
+put_shared_contents (struct node *np)
+{
+  struct shared_contents *sc;
+  char *copy;
+
+  copy = malloc (np->nn->contents_len ?: 1);
+  if (! copy)
+    return;
+  memcpy (copy, np->nn->contents, np->nn->contents_len);
+
+  pthread_mutex_lock (&shared_contents_lock);
+  for (sc = shared_contents; sc; sc = sc->next)
+    if (sc->ops == np->nn->ops && sc->hook == np->nn->hook)
+      break;
+  if (! sc)
+    {
+      sc = malloc (sizeof *sc);
+      if (! sc)
+	{
+	  pthread_mutex_unlock (&shared_contents_lock);
+	  free (copy);
+	  return;
+	}
+      sc->ops = np->nn->ops;
+      sc->hook = np->nn->hook;
+      sc->next = shared_contents;
+      shared_contents = sc;
+    }
+  else
+    free (sc->contents);
+  sc->contents = copy;
+  sc->contents_len = np->nn->contents_len;
+  sc->time = np->nn->contents_time;
+  pthread_mutex_unlock (&shared_contents_lock);
+}
+
 error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len)
 {
-  if (! np->nn->contents && np->nn->ops->get_contents)
+  if (! np->nn->contents && np->nn->ops->get_contents
+      && ! (np->nn->share_contents && opt_cache_time
+	    && get_shared_contents (np)))
     {
       char *contents;
       ssize_t contents_len;
@@ -149,6 +261,11 @@ error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len)
 
       np->nn->contents = contents;
       np->nn->contents_len = contents_len;
+      np->nn->contents_copied = 0;
+      clock_gettime (CLOCK_MONOTONIC, &np->nn->contents_time);
+
+      if (np->nn->share_contents && opt_cache_time)
+	put_shared_contents (np);
     }
 
   *data = np->nn->contents;
@@ -156,14 +273,27 @@ error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len)
   return 0;
 }
 
-void procfs_refresh (struct node *np)
+/* Forget the contents of NP.  */
+static void
+drop_contents (struct node *np)
 {
-  if (np->nn->contents && np->nn->ops->cleanup_contents)
+  if (np->nn->contents && np->nn->contents_copied)
+    free (np->nn->contents);
+  else if (np->nn->contents && np->nn->ops->cleanup_contents)
     np->nn->ops->cleanup_contents (np->nn->hook, np->nn->contents, np->nn->contents_len);
 
   np->nn->contents = NULL;
 }
 
+void procfs_refresh (struct node *np)
+{
+  if (np->nn->contents && opt_cache_time
+      && contents_fresh (&np->nn->contents_time))
+    return;
+
+  drop_contents (np);
+}
+
 error_t procfs_lookup (struct node *np, const char *name, struct node **npp)
 {
   error_t err = ENOENT;
@@ -195,7 +325,7 @@ error_t procfs_lookup (struct node *np, const char *name, struct node **npp)
 
 void procfs_cleanup (struct node *np)
 {
-  procfs_refresh (np);
+  drop_contents (np);
 
   if (np->nn->ops->cleanup)
     np->nn->ops->cleanup (np->nn->hook);
@@ -64,6 +64,13 @@ void procfs_cleanup_contents_with_vm_deallocate (void *, char *, ssize_t);
    enough memory.  In this case, ops->cleanup will be invoked.  */
 struct node *procfs_make_node (const struct procfs_node_ops *ops, void *hook);
 
+/* Let the nodes made with the same ops and hook as NP share their
+   contents, for nodes whose contents only depend on these: a node
+   looked up anew within the cache time then reuses the contents
+   generated for another one.  Must be called right after the node has
+   been created.  */
+void procfs_node_share_contents (struct node *np);
+
 /* Set the owner of the node NP.  Must be called right after the node
    has been created.  */
 void procfs_node_chown (struct node *np, uid_t owner);
@@ -85,9 +92,10 @@ void procfs_node_chtype (struct node *np, mode_t type);
    corresponding child nodes.  */
 ino64_t procfs_make_ino (struct node *np, const char *filename);
 
-/* Forget the current cached contents for the node.  This is done before reads
-   from offset 0, to ensure that the data are recent even for utilities such as
-   top which keep some nodes open.  */
+/* Forget the current cached contents for the node, unless they are more
+   recent than the cache time.  This is done before reads from offset 0, to
+   ensure that the data are recent even for utilities such as top which keep
+   some nodes open.  */
 void procfs_refresh (struct node *np);
 
 error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len);
@@ -42,6 +42,9 @@ proclist_get_contents (void *hook, char **contents, ssize_t *contents_len)
   if (err)
     return EIO;
 
+  /* Whoever lists the processes likely looks at each of them next.  */
+  process_prefetch (pc, pids, num_pids);
+
   *contents = malloc (num_pids * PID_STR_SIZE);
   if (*contents)
     {
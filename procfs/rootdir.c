@@ -551,6 +551,38 @@ rootdir_gc_slabinfo (void *hook, char **contents, ssize_t *contents_len)
   return err;
 }
 
+static error_t
+rootdir_gc_pfinet_slabinfo (void *hook, char **contents, ssize_t *contents_len)
+{
+  error_t err;
+  mach_port_t pfinet;
+  char *info = NULL;
+  mach_msg_type_number_t info_len = 0;
+  char socket_inet[20];
+
+  snprintf(socket_inet, sizeof(socket_inet), _SERVERS_SOCKET "/%d", AF_INET);
+  pfinet = file_name_lookup (socket_inet, O_RDONLY, 0);
+  if (pfinet == MACH_PORT_NULL)
+    return errno;
+
+  err = pfinet_getslabinfo (pfinet, &info, &info_len);
+  mach_port_deallocate (mach_task_self (), pfinet);
+  if (err)
+    return err;
+
+  *contents = malloc (info_len);
+  if (*contents)
+    {
+      memcpy (*contents, info, info_len);
+      *contents_len = info_len;
+    }
+  else
+    err = ENOMEM;
+
+  vm_deallocate (mach_task_self (), (vm_address_t) info, info_len);
+  return err;
+}
+
 static error_t
 rootdir_gc_hostinfo (void *hook, char **contents, ssize_t *contents_len)
 {
@@ -917,8 +949,12 @@ rootdir_file_make_node (void *dir_hook, const void *entry_hook)
   /* The entry hook we use is actually a procfs_node_ops for the file to be
      created.  The hook associated to these newly created files (and passed
      to the generators above as a consequence) is always the same global
-     ps_context, which we get from rootdir_make_node as the directory hook. */
-  return procfs_make_node (entry_hook, dir_hook);
+     ps_context, which we get from rootdir_make_node as the directory hook.
+     Their contents thus only depend on the entry, and can be shared.  */
+  struct node *np = procfs_make_node (entry_hook, dir_hook);
+  if (np)
+    procfs_node_share_contents (np);
+  return np;
 }
 
 
@@ -1079,6 +1115,13 @@ static const struct procfs_dir_entry rootdir_entries[] = {
       .cleanup_contents = procfs_cleanup_contents_with_free,
     },
   },
+  {
+    .name = "pfinet-slabinfo",
+    .hook = & (struct procfs_node_ops) {
+      .get_contents = rootdir_gc_pfinet_slabinfo,
+      .cleanup_contents = procfs_cleanup_contents_with_free,
+    },
+  },
   {
     .name = "hostinfo",
     .hook = & (struct procfs_node_ops) {
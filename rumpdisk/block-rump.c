@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
@@ -44,10 +45,19 @@
 #define DIOCGSECTORSIZE _IOR('d', 133, unsigned int)
 
 #define BLKRRPART  0x125F     /* re-read partition table */
+#define BLKDISCARD 0x1277     /* discard a byte range */
 
 #define DISK_NAME_LEN 32
 #define MAX_DISK_DEV 2
 
+/* How many reads and writes may be in progress at once.  */
+#define RUMPDISK_IO_THREADS 32
+
+/* The size and the largest number of the buffers unaligned writes are
+   copied into.  */
+#define RUMPDISK_DMA_SIZE (128 * 1024)
+#define RUMPDISK_DMA_BUFFERS (RUMPDISK_IO_THREADS + 8)
+
 #ifdef _RUMP_SATA
 #define RUMP_TYPE_STRING "rump SATA/IDE"
 #else
@@ -348,18 +358,137 @@ rumpdisk_device_open (mach_port_t reply_port, mach_msg_type_name_t reply_port_ty
   return D_SUCCESS;
 }
 
+/* Physically contiguous buffers kept for copying unaligned data, so that
+   they needn't be allocated for each request.  */
+struct dma_buf
+{
+  vm_address_t addr;
+  struct dma_buf *next;
+};
+
+static struct dma_buf *dma_free;
+static int dma_count;
+static pthread_mutex_t dma_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dma_cond = PTHREAD_COND_INITIALIZER;
+
+/* Return a buffer of RUMPDISK_DMA_SIZE bytes from the pool, waiting for
+   one if there are already RUMPDISK_DMA_BUFFERS of them in use.  */
+static struct dma_buf *
+get_dma_buf (void)
+{
+  struct dma_buf *b;
+
+  pthread_mutex_lock (&dma_lock);
+  while (! dma_free && dma_count >= RUMPDISK_DMA_BUFFERS)
+    pthread_cond_wait (&dma_cond, &dma_lock);
+  b = dma_free;
+  if (b)
+    dma_free = b->next;
+  else
+    {
+      rpc_phys_addr_t pap;
+
+      b = malloc (sizeof *b);
+      if (b && vm_allocate_contiguous (master_host, mach_task_self (),
+				       &b->addr, &pap, RUMPDISK_DMA_SIZE,
+				       0, 0x100000000ULL, 0) != KERN_SUCCESS)
+	{
+	  free (b);
+	  b = NULL;
+	}
+      if (b)
+	dma_count++;
+    }
+  pthread_mutex_unlock (&dma_lock);
+  return b;
+}
+
+static void
+put_dma_buf (struct dma_buf *b)
+{
+  pthread_mutex_lock (&dma_lock);
+  b->next = dma_free;
+  dma_free = b;
+  pthread_cond_signal (&dma_cond);
+  pthread_mutex_unlock (&dma_lock);
+}
+
+/* Read or write the COUNT bytes at the page-aligned BUF from or to byte
+   OFFSET of BD.  Each run of physically contiguous pages is done at once;
+   only if their addresses can't be had is each page done on its own.
+   Return how much was done, or -1 having set errno.  */
+static ssize_t
+rw_pages (struct block_data *bd, int write, void *buf, size_t count,
+	  off_t offset)
+{
+  int pagesize = sysconf (_SC_PAGE_SIZE);
+  size_t npages = (count + pagesize - 1) / pagesize;
+  rpc_phys_addr_t phys_buf[64], *phys = phys_buf;
+  mach_msg_type_number_t nphys = sizeof phys_buf / sizeof phys_buf[0];
+  size_t done = 0, i, j;
+
+  /* Make sure the pages are there, by touching a byte of each; the task
+     is wired, so they then stay where they are during the transfer.  */
+  for (i = 0; i < npages; i++)
+    if (write)
+      (void) ((volatile uint8_t *) buf)[i * pagesize];
+    else
+      ((volatile uint8_t *) buf)[i * pagesize] = 0;
+
+  if (vm_pages_phys (master_host, mach_task_self (), (vm_address_t) buf,
+		     npages * pagesize, &phys, &nphys) != KERN_SUCCESS)
+    nphys = 0;
+
+  /* XXX: _bus_dmamap_load_buffer seems not to call rumpcomp_pci_virt_to_mach
+   * for each page, so a single transfer must not cross into a page that is
+   * not physically next to the previous one.  */
+  for (i = 0; i < npages; i = j)
+    {
+      size_t todo;
+      ssize_t cc;
+
+      for (j = i + 1;
+	   j < npages && j < nphys && i < nphys
+	   && phys[j] == phys[j - 1] + pagesize;
+	   j++)
+	;
+      todo = (j - i) * pagesize;
+      if (todo > count - done)
+	todo = count - done;
+
+      if (write)
+	cc = rump_sys_pwrite (bd->rump_fd, buf + done, todo, offset + done);
+      else
+	cc = rump_sys_pread (bd->rump_fd, buf + done, todo, offset + done);
+      if (cc < 0)
+	{
+	  int err = errno;
+	  if (phys != phys_buf)
+	    vm_deallocate (mach_task_self (), (vm_address_t) phys,
+			   nphys * sizeof *phys);
+	  errno = err;
+	  return -1;
+	}
+      done += cc;
+      if (cc < todo)
+	break;
+    }
+
+  if (phys != phys_buf)
+    vm_deallocate (mach_task_self (), (vm_address_t) phys,
+		   nphys * sizeof *phys);
+  return done;
+}
+
+/* Write COUNT bytes of DATA at block BN of BD.  DATA is left to the
+   caller.  */
 static io_return_t
-rumpdisk_device_write (void *d, mach_port_t reply_port,
-		       mach_msg_type_name_t reply_port_type, dev_mode_t mode,
-		       recnum_t bn, io_buf_ptr_t data, unsigned int count,
-		       int *bytes_written)
+do_write (struct block_data *bd, recnum_t bn, io_buf_ptr_t data,
+	  unsigned int count, int *bytes_written)
 {
-  struct block_data *bd = d;
   ssize_t written;
   int pagesize = sysconf (_SC_PAGE_SIZE);
-
-  if ((bd->mode & D_WRITE) == 0)
-    return D_INVALID_OPERATION;
+  off_t offset = (off_t) bn * bd->block_size;
 
   pthread_rwlock_rdlock (&rumpdisk_rwlock);
   /* Ensure device is still open */
@@ -371,95 +500,71 @@ rumpdisk_device_write (void *d, mach_port_t reply_port,
 
   if ((vm_offset_t) data % pagesize)
     {
-      /* Not aligned, have to copy to aligned buffer.  */
-      vm_address_t buf;
-      rpc_phys_addr_t pap;
-      kern_return_t ret;
-      int err;
+      /* Not aligned, have to copy to an aligned and contiguous buffer,
+	 one piece at a time.  */
+      struct dma_buf *b = get_dma_buf ();
 
-      /* While at it, make it contiguous */
-      ret = vm_allocate_contiguous (master_host, mach_task_self (), &buf, &pap, count, 0, 0x100000000ULL, 0);
-      if (ret != KERN_SUCCESS)
+      if (! b)
 	{
 	  pthread_rwlock_unlock (&rumpdisk_rwlock);
 	  return ENOMEM;
 	}
 
-      memcpy ((void*) buf, data, count);
-
-      written = rump_sys_pwrite (bd->rump_fd, (const void *)buf, (size_t)count, (off_t)bn * bd->block_size);
-      err = errno;
-
-      vm_deallocate (mach_task_self (), (vm_address_t) buf, count);
-
-      if (written < 0)
-	{
-	  vm_deallocate (mach_task_self (), (vm_address_t) data, count);
-	  pthread_rwlock_unlock (&rumpdisk_rwlock);
-	  return rump_errno2host (err);
-	}
-    }
-  else
-    {
-      volatile uint8_t dummy_read __attribute__ ((unused));
-      int npages = (count + pagesize - 1) / pagesize;
-      int i;
-
-      /* Fault-in the memory pages by reading a single byte of each */
-      for (i = 0; i < npages; i++)
-	dummy_read = ((volatile uint8_t *)data)[i * pagesize];
-
-      /* XXX: _bus_dmamap_load_buffer seems not to call rumpcomp_pci_virt_to_mach
-       * for each page, so separate out pages ourselves :/ */
       written = 0;
       while (written < count)
 	{
 	  size_t todo = count - written;
 	  ssize_t done;
 
-	  if (todo > pagesize)
-	    todo = pagesize;
-
-	  done = rump_sys_pwrite (bd->rump_fd, (const void *)data + written, todo, (off_t)bn * bd->block_size + written);
+	  if (todo > RUMPDISK_DMA_SIZE)
+	    todo = RUMPDISK_DMA_SIZE;
 
+	  memcpy ((void *) b->addr, data + written, todo);
+	  done = rump_sys_pwrite (bd->rump_fd, (const void *) b->addr, todo,
+				  offset + written);
 	  if (done < 0)
 	    {
-	      vm_deallocate (mach_task_self (), (vm_address_t) data, count);
+	      int err = errno;
+	      put_dma_buf (b);
 	      pthread_rwlock_unlock (&rumpdisk_rwlock);
-	      return rump_errno2host (errno);
+	      return rump_errno2host (err);
 	    }
 
 	  written += done;
+	  if (done < todo)
+	    break;
 	}
-    }
 
-  vm_deallocate (mach_task_self (), (vm_address_t) data, count);
+      put_dma_buf (b);
+    }
+  else
+    {
+      /* Write the caller's pages themselves.  */
+      written = rw_pages (bd, 1, data, count, offset);
+      if (written < 0)
+	{
+	  pthread_rwlock_unlock (&rumpdisk_rwlock);
+	  return rump_errno2host (errno);
+	}
+    }
 
   *bytes_written = (int)written;
   pthread_rwlock_unlock (&rumpdisk_rwlock);
   return D_SUCCESS;
 }
 
+/* Read COUNT bytes at block BN of BD into a new buffer returned in DATA.
+   The reply moves the buffer out of our task, so it has to be new.  */
 static io_return_t
-rumpdisk_device_read (void *d, mach_port_t reply_port,
-		      mach_msg_type_name_t reply_port_type, dev_mode_t mode,
-		      recnum_t bn, int count, io_buf_ptr_t * data,
-		      unsigned *bytes_read)
+do_read (struct block_data *bd, recnum_t bn, int count, io_buf_ptr_t *data,
+	 unsigned *bytes_read)
 {
-  struct block_data *bd = d;
   vm_address_t buf;
   int pagesize = sysconf (_SC_PAGE_SIZE);
   int npages = (count + pagesize - 1) / pagesize;
-  int i;
-  ssize_t done, err;
+  ssize_t done;
   kern_return_t ret;
 
-  if ((bd->mode & D_READ) == 0)
-    return D_INVALID_OPERATION;
-
-  if (count == 0)
-    return D_SUCCESS;
-
   pthread_rwlock_rdlock (&rumpdisk_rwlock);
   /* Ensure device is still open */
   if (! bd->taken)
@@ -468,7 +573,6 @@ rumpdisk_device_read (void *d, mach_port_t reply_port,
       return D_INVALID_OPERATION;
     }
 
-  /* TODO: directly write at *data when it is aligned */
   *data = 0;
   ret = vm_allocate (mach_task_self (), &buf, npages * pagesize, TRUE);
   if (ret != KERN_SUCCESS)
@@ -477,34 +581,219 @@ rumpdisk_device_read (void *d, mach_port_t reply_port,
       return ENOMEM;
     }
 
-  /* Ensure physical allocation by writing a single byte of each */
-  for (i = 0; i < npages; i++)
-    ((uint8_t *)buf)[i * pagesize] = 0;
-
-  /* XXX: _bus_dmamap_load_buffer seems not to call rumpcomp_pci_virt_to_mach
-   * for each page, so separate out pages ourselves :/ */
-  done = 0;
-  while (done < count)
+  done = rw_pages (bd, 0, (void *) buf, count, (off_t) bn * bd->block_size);
+  if (done < 0)
     {
-      size_t todo = count - done;
+      int err = errno;
+      vm_deallocate (mach_task_self (), buf, npages * pagesize);
+      pthread_rwlock_unlock (&rumpdisk_rwlock);
+      return rump_errno2host (err);
+    }
+
+  *bytes_read = done;
+  *data = (void*) buf;
+  pthread_rwlock_unlock (&rumpdisk_rwlock);
+  return D_SUCCESS;
+}
+
+/* A read or write whose reply is sent once it is done.  */
+struct io_request
+{
+  struct block_data *bd;	/* holds a reference */
+  int write;
+  mach_port_t reply_port;
+  mach_msg_type_name_t reply_port_type;
+  recnum_t bn;
+  io_buf_ptr_t data;		/* for a write */
+  unsigned int count;
+  struct io_request *next;
+};
 
-      if (todo > pagesize)
-	todo = pagesize;
+static struct io_request *io_queue, **io_queue_tail = &io_queue;
+static pthread_mutex_t io_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_queue_cond = PTHREAD_COND_INITIALIZER;
 
-      err = rump_sys_pread (bd->rump_fd, (void *)buf + done, todo, (off_t)bn * bd->block_size + done);
-      if (err < 0)
+/* Wait for requests and do them.  The RPC threads only queue the
+   requests, so there are as many of them in the disk at once as there are
+   threads here, however few RPC threads there are.  */
+static void *
+io_thread (void *arg)
+{
+  /* Like the RPC threads, we may be paging.  */
+  mach_port_t self = mach_thread_self ();
+  thread_wire (master_host, self, TRUE);
+  mach_port_deallocate (mach_task_self (), self);
+
+  for (;;)
+    {
+      struct io_request *req;
+      io_return_t err;
+
+      pthread_mutex_lock (&io_queue_lock);
+      while (! io_queue)
+	pthread_cond_wait (&io_queue_cond, &io_queue_lock);
+      req = io_queue;
+      io_queue = req->next;
+      if (! io_queue)
+	io_queue_tail = &io_queue;
+      pthread_mutex_unlock (&io_queue_lock);
+
+      if (req->write)
 	{
-	  err = errno;
-	  vm_deallocate (mach_task_self (), buf, npages * pagesize);
-	  pthread_rwlock_unlock (&rumpdisk_rwlock);
-	  return rump_errno2host (err);
+	  int written = 0;
+	  err = do_write (req->bd, req->bn, req->data, req->count, &written);
+	  vm_deallocate (mach_task_self (), (vm_address_t) req->data,
+			 req->count);
+	  machdev_write_done (req->reply_port, req->reply_port_type,
+			      err, written);
+	}
+      else
+	{
+	  io_buf_ptr_t data = 0;
+	  unsigned nread = 0;
+	  err = do_read (req->bd, req->bn, req->count, &data, &nread);
+	  /* This consumes DATA.  */
+	  machdev_read_done (req->reply_port, req->reply_port_type,
+			     err, data, nread);
 	}
 
-      done += err;
+      ports_port_deref (req->bd);
+      free (req);
+    }
+
+  return NULL;
+}
+
+static void
+start_io_threads (void)
+{
+  int i;
+
+  for (i = 0; i < RUMPDISK_IO_THREADS; i++)
+    {
+      pthread_t t;
+      if (pthread_create (&t, NULL, io_thread, NULL) == 0)
+	pthread_detach (t);
+    }
+}
+
+/* Queue a read or write of BD to be replied to on REPLY_PORT.  Return
+   MIG_NO_REPLY, or an error if it couldn't be queued.  */
+static io_return_t
+queue_request (struct block_data *bd, int write, mach_port_t reply_port,
+	       mach_msg_type_name_t reply_port_type, recnum_t bn,
+	       io_buf_ptr_t data, unsigned int count)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  struct io_request *req;
+
+  req = malloc (sizeof *req);
+  if (! req)
+    return ENOMEM;
+
+  pthread_once (&once, start_io_threads);
+
+  ports_port_ref (bd);
+  req->bd = bd;
+  req->write = write;
+  req->reply_port = reply_port;
+  req->reply_port_type = reply_port_type;
+  req->bn = bn;
+  req->data = data;
+  req->count = count;
+  req->next = NULL;
+
+  pthread_mutex_lock (&io_queue_lock);
+  *io_queue_tail = req;
+  io_queue_tail = &req->next;
+  pthread_cond_signal (&io_queue_cond);
+  pthread_mutex_unlock (&io_queue_lock);
+
+  return MIG_NO_REPLY;
+}
+
+static io_return_t
+rumpdisk_device_write (void *d, mach_port_t reply_port,
+		       mach_msg_type_name_t reply_port_type, dev_mode_t mode,
+		       recnum_t bn, io_buf_ptr_t data, unsigned int count,
+		       int *bytes_written)
+{
+  struct block_data *bd = d;
+  io_return_t err;
+
+  if ((bd->mode & D_WRITE) == 0)
+    return D_INVALID_OPERATION;
+
+  if (MACH_PORT_VALID (reply_port))
+    {
+      err = queue_request (bd, 1, reply_port, reply_port_type, bn,
+			   data, count);
+      if (err != ENOMEM)
+	return err;
+    }
+
+  /* On error, the request message is destroyed along with DATA.  */
+  err = do_write (bd, bn, data, count, bytes_written);
+  if (err == D_SUCCESS)
+    vm_deallocate (mach_task_self (), (vm_address_t) data, count);
+  return err;
+}
+
+static io_return_t
+rumpdisk_device_read (void *d, mach_port_t reply_port,
+		      mach_msg_type_name_t reply_port_type, dev_mode_t mode,
+		      recnum_t bn, int count, io_buf_ptr_t * data,
+		      unsigned *bytes_read)
+{
+  struct block_data *bd = d;
+  io_return_t err;
+
+  if ((bd->mode & D_READ) == 0)
+    return D_INVALID_OPERATION;
+
+  if (count == 0)
+    return D_SUCCESS;
+
+  if (MACH_PORT_VALID (reply_port))
+    {
+      err = queue_request (bd, 0, reply_port, reply_port_type, bn,
+			   0, count);
+      if (err != ENOMEM)
+	return err;
+    }
+
+  return do_read (bd, bn, count, data, bytes_read);
+}
+
+/* Tell the disk that the LEN bytes at OFFSET need not be kept.  */
+static io_return_t
+do_discard (struct block_data *bd, uint64_t offset, uint64_t len)
+{
+  int ret;
+
+  if (offset > bd->media_size || len > bd->media_size - offset
+      || offset % bd->block_size || len % bd->block_size)
+    return D_INVALID_SIZE;
+
+  pthread_rwlock_rdlock (&rumpdisk_rwlock);
+  /* Ensure device is still open */
+  if (! bd->taken)
+    {
+      pthread_rwlock_unlock (&rumpdisk_rwlock);
+      return D_INVALID_OPERATION;
+    }
+
+  ret = rump_sys_fdiscard (bd->rump_fd, offset, len);
+  if (ret < 0)
+    {
+      int err = errno;
+      pthread_rwlock_unlock (&rumpdisk_rwlock);
+      /* Disks that can't discard say so in the way unknown flavors do.  */
+      if (err == RUMP_EOPNOTSUPP || err == RUMP_ENODEV)
+	return D_INVALID_OPERATION;
+      return rump_errno2host (err);
     }
 
-  *bytes_read = done;
-  *data = (void*) buf;
   pthread_rwlock_unlock (&rumpdisk_rwlock);
   return D_SUCCESS;
 }
@@ -513,12 +802,22 @@ static io_return_t
 rumpdisk_device_set_status (void *d, dev_flavor_t flavor, dev_status_t status,
 			    mach_msg_type_number_t status_count)
 {
+  struct block_data *bd = d;
+
   switch (flavor)
     {
     case BLKRRPART:
       /* Partitions are not implemented here, but in the parted-based
        * translators.  */
       return D_SUCCESS;
+    case BLKDISCARD:
+      if (status_count < 4)
+	return D_INVALID_SIZE;
+      if ((bd->mode & D_WRITE) == 0)
+	return D_INVALID_OPERATION;
+      return do_discard (bd,
+			 (uint32_t) status[0] | (uint64_t) status[1] << 32,
+			 (uint32_t) status[2] | (uint64_t) status[3] << 32);
     default:
       return D_INVALID_OPERATION;
     }
@@ -553,14 +852,6 @@ rumpdisk_device_get_status (void *d, dev_flavor_t flavor, dev_status_t status,
   return D_SUCCESS;
 }
 
-/* FIXME:
- * Long term strategy:
- *
- * Call rump_sys_aio_read/write and return MIG_NO_REPLY from
- * device_read/write, and send the mig reply once the aio request has
- * completed. That way, only the aio request will be kept in rumpdisk
- * memory instead of a whole thread structure.
- */
 static struct machdev_device_emulation_ops rump_block_emulation_ops = {
   rumpdisk_device_init,
   NULL,
@@ -24,6 +24,8 @@
 #include <hurd/pager.h>
 #include <hurd/store.h>
 #include <sys/mman.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "dev.h"
 
@@ -188,6 +190,8 @@ dev_open (struct dev *dev)
       dev->block_mask = (1 << dev->store->log2_block_size) - 1;
       dev->pager = 0;
       pthread_mutex_init (&dev->pager_lock, NULL);
+      dev->ra_next = 0;
+      dev->ra_window = 0;
     }
 
   return 0;
@@ -317,6 +321,15 @@ dev_rw (struct dev *dev, off_t offs, size_t len, size_t *amount,
   else if (offs + len > dev->store->size)
     len = dev->store->size - offs;
 
+  if (dev->aligned)
+    /* Only whole blocks are allowed, so DEV's buffer is never used and
+       the store can be gone to straight away, without any lock.  */
+    {
+      if ((offs & block_mask) != 0 || (len & block_mask) != 0)
+	return EINVAL;
+      return (*raw_rw) (offs, 0, len, amount);
+    }
+
   pthread_rwlock_rdlock (&dev->io_lock);
   if (dev_buf_is_active (dev)
       || (offs & block_mask) != 0 || (len & block_mask) != 0)
@@ -341,9 +354,9 @@ dev_rw (struct dev *dev, off_t offs, size_t len, size_t *amount,
 /* Write LEN bytes from BUF to DEV, returning the amount actually written in
    AMOUNT.  If successful, 0 is returned, otherwise an error code is
    returned.  */
-error_t
-dev_write (struct dev *dev, off_t offs, const void *buf, size_t len,
-	   size_t *amount)
+static error_t
+do_write (struct dev *dev, off_t offs, const void *buf, size_t len,
+	  size_t *amount)
 {
   error_t buf_write (size_t buf_offs, size_t io_offs, size_t len)
     {
@@ -354,6 +367,9 @@ dev_write (struct dev *dev, off_t offs, const void *buf, size_t len,
   error_t raw_write (off_t offs, size_t io_offs, size_t len, size_t *amount)
     {
       struct store *store = dev->store;
+      if (dev->sched)
+	return iosched_rw (dev->sched, store, 1, offs,
+			   (void *) buf + io_offs, len, amount);
       return
 	store_write (store, offs >> store->log2_block_size,
 		     buf + io_offs, len, amount);
@@ -386,9 +402,9 @@ dev_write (struct dev *dev, off_t offs, const void *buf, size_t len,
 /* Read up to WHOLE_AMOUNT bytes from DEV, returned in BUF and LEN in the
    with the usual mach memory result semantics.  If successful, 0 is
    returned, otherwise an error code is returned.  */
-error_t
-dev_read (struct dev *dev, off_t offs, size_t whole_amount,
-	  void **buf, size_t *len)
+static error_t
+do_read (struct dev *dev, off_t offs, size_t whole_amount,
+	 void **buf, size_t *len)
 {
   error_t err;
   int allocated_buf = 0;
@@ -416,7 +432,16 @@ dev_read (struct dev *dev, off_t offs, size_t whole_amount,
     {
       struct store *store = dev->store;
       off_t addr = offs >> store->log2_block_size;
-      if (len == whole_amount)
+      if (dev->sched)
+	{
+	  /* The scheduler reads into the place we give it.  */
+	  error_t err = ensure_buf ();
+	  if (! err)
+	    err = iosched_rw (dev->sched, store, 0, offs,
+			      *buf + io_offs, len, amount);
+	  return err;
+	}
+      else if (len == whole_amount)
 	/* Just return whatever the device does.  */
 	return store_read (store, addr, len, buf, amount);
       else
@@ -482,3 +507,108 @@ dev_read (struct dev *dev, off_t offs, size_t whole_amount,
 
   return err;
 }
+
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Account for an I/O of AMOUNT bytes for CLIENT that took US
+   microseconds.  Each field is only added to, so no lock is needed.  */
+static void
+account (uint64_t *ops, uint64_t *bytes, uint64_t *total_us,
+	 uint64_t *max_us, size_t amount, uint64_t us)
+{
+  uint64_t max;
+
+  __atomic_add_fetch (ops, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (bytes, amount, __ATOMIC_RELAXED);
+  __atomic_add_fetch (total_us, us, __ATOMIC_RELAXED);
+  max = __atomic_load_n (max_us, __ATOMIC_RELAXED);
+  while (us > max
+	 && ! __atomic_compare_exchange_n (max_us, &max, us, 1,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+error_t
+dev_write (struct dev *dev, struct dev_client *client, off_t offs,
+	   const void *buf, size_t len, size_t *amount)
+{
+  uint64_t start = now_us ();
+  error_t err = do_write (dev, offs, buf, len, amount);
+
+  if (! err)
+    account (&client->writes, &client->write_bytes, &client->write_us,
+	     &client->write_max_us, *amount, now_us () - start);
+  return err;
+}
+
+error_t
+dev_read (struct dev *dev, struct dev_client *client, off_t offs,
+	  size_t amount, void **buf, size_t *len)
+{
+  uint64_t start = now_us ();
+  error_t err = do_read (dev, offs, amount, buf, len);
+
+  if (! err)
+    account (&client->reads, &client->read_bytes, &client->read_us,
+	     &client->read_max_us, *len, now_us () - start);
+  return err;
+}
+
+void
+dev_client_add (struct dev *dev, struct dev_client *client)
+{
+  memset (client, 0, sizeof *client);
+
+  pthread_mutex_lock (&dev->clients_lock);
+  if (client != &dev->pager_client)
+    client->id = ++dev->next_client_id;
+  client->next = dev->clients;
+  if (client->next)
+    client->next->prevp = &client->next;
+  client->prevp = &dev->clients;
+  dev->clients = client;
+  pthread_mutex_unlock (&dev->clients_lock);
+}
+
+void
+dev_client_remove (struct dev *dev, struct dev_client *client)
+{
+  pthread_mutex_lock (&dev->clients_lock);
+  *client->prevp = client->next;
+  if (client->next)
+    client->next->prevp = client->prevp;
+  pthread_mutex_unlock (&dev->clients_lock);
+}
+
+void
+dev_print_stats (struct dev *dev, FILE *out)
+{
+  struct dev_client *c;
+
+  pthread_mutex_lock (&dev->clients_lock);
+  for (c = dev->clients; c; c = c->next)
+    {
+      if (c->id == 0)
+	fprintf (out, "pager:");
+      else
+	fprintf (out, "open %d:", c->id);
+      fprintf (out, " %" PRIu64 " reads of %" PRIu64 " bytes"
+	       " (avg %" PRIu64 " us, max %" PRIu64 " us),"
+	       " %" PRIu64 " writes of %" PRIu64 " bytes"
+	       " (avg %" PRIu64 " us, max %" PRIu64 " us)\n",
+	       c->reads, c->read_bytes,
+	       c->reads ? c->read_us / c->reads : 0, c->read_max_us,
+	       c->writes, c->write_bytes,
+	       c->writes ? c->write_us / c->writes : 0, c->write_max_us);
+    }
+  pthread_mutex_unlock (&dev->clients_lock);
+
+  if (dev->sched)
+    iosched_print_stats (dev->sched, out);
+}
@@ -23,11 +23,24 @@
 #include <mach.h>
 #include <device/device.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <hurd/store.h>
 #include <hurd/trivfs.h>
 
+#include "iosched.h"
+
 extern struct trivfs_control *storeio_fsys;
 
+/* Someone doing I/O on a device, for which statistics are kept.  */
+struct dev_client
+{
+  int id;			/* 0 for the pager.  */
+  uint64_t reads, read_bytes, read_us, read_max_us;
+  uint64_t writes, write_bytes, write_us, write_max_us;
+  struct dev_client *next, **prevp;
+};
+
 /* Information about backend store, which we presumptively call a "device".  */
 struct dev
 {
@@ -41,6 +54,7 @@ struct dev
   int readonly;			/* Nonzero if user gave --readonly flag.  */
   int enforced;			/* Nonzero if user gave --enforced flag.  */
   int no_fileio;		/* Nonzero if user gave --no-fileio flag.  */
+  int aligned;			/* Nonzero if user gave --aligned flag.  */
   dev_t rdev;			/* A unixy device number for st_rdev.  */
 
   /* The current owner of the open device.  For terminals, this affects
@@ -82,6 +96,25 @@ struct dev
 
   struct pager *pager;
   pthread_mutex_t pager_lock;
+
+  /* Pageins that follow on from the last read ahead more; RA_NEXT is
+     the page after it, and RA_WINDOW how many pages it was.  Locked by
+     PAGER_LOCK.  */
+  vm_offset_t ra_next;
+  int ra_window;
+
+  /* The scheduler block I/O goes through, unless null.  The policy and
+     its parameters are those given by the user.  */
+  struct iosched *sched;
+  enum iosched_policy sched_policy;
+  unsigned sched_deadline;	/* In milliseconds.  */
+  unsigned sched_depth;
+
+  /* Everyone doing I/O, the pager first.  */
+  struct dev_client pager_client;
+  struct dev_client *clients;
+  int next_client_id;
+  pthread_mutex_t clients_lock;
 };
 
 static inline int
@@ -112,16 +145,25 @@ int dev_stop_paging (struct dev *dev, int nosync);
    for any paging activity to cease.  */
 error_t dev_sync (struct dev *dev, int wait);
 
-/* Write LEN bytes from BUF to DEV, returning the amount actually written in
-   AMOUNT.  If successful, 0 is returned, otherwise an error code is
-   returned.  */
-error_t dev_write (struct dev *dev, off_t offs, const void *buf, size_t len,
-		   size_t *amount);
-
-/* Read up to AMOUNT bytes from DEV, returned in BUF and LEN in the with the
-   usual mach memory result semantics.  If successful, 0 is returned,
-   otherwise an error code is returned.  */
-error_t dev_read (struct dev *dev, off_t offs, size_t amount,
-		  void **buf, size_t *len);
+/* Write LEN bytes from BUF to DEV on behalf of CLIENT, returning the amount
+   actually written in AMOUNT.  If successful, 0 is returned, otherwise an
+   error code is returned.  */
+error_t dev_write (struct dev *dev, struct dev_client *client, off_t offs,
+		   const void *buf, size_t len, size_t *amount);
+
+/* Read up to AMOUNT bytes from DEV on behalf of CLIENT, returned in BUF and
+   LEN in the with the usual mach memory result semantics.  If successful, 0
+   is returned, otherwise an error code is returned.  */
+error_t dev_read (struct dev *dev, struct dev_client *client, off_t offs,
+		  size_t amount, void **buf, size_t *len);
+
+/* Start keeping statistics for CLIENT, a new client of DEV.  */
+void dev_client_add (struct dev *dev, struct dev_client *client);
+
+/* Stop keeping statistics for CLIENT of DEV.  */
+void dev_client_remove (struct dev *dev, struct dev_client *client);
+
+/* Print the statistics of DEV's clients and scheduler to OUT.  */
+void dev_print_stats (struct dev *dev, FILE *out);
 
 #endif /* !__DEV_H__ */
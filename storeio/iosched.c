@@ -0,0 +1,281 @@
+/* Scheduling of the I/O done on a storeio device
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Requests wait in a queue sorted by offset.  There is no thread of our
+   own: whenever fewer than DEPTH transfers are going on, one of the
+   waiting threads takes the next request in the direction of the sweep,
+   along with those right after it on the device, and does them as a
+   single transfer, whoever they belong to.  With a deadline, the oldest
+   request goes first once it has waited too long.  */
+
+#include <hurd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "iosched.h"
+
+/* The largest transfer requests are merged into.  */
+#define MERGE_MAX	(1024 * 1024)
+
+struct ioreq
+{
+  struct store *store;
+  int write;
+  off_t offs;
+  void *buf;
+  size_t len;
+  uint64_t deadline;		/* In microseconds.  */
+
+  int done;
+  size_t amount;
+  error_t err;
+
+  struct ioreq *next;		/* In the queue, or in a transfer.  */
+};
+
+struct iosched
+{
+  enum iosched_policy policy;
+  uint64_t deadline_us;
+  unsigned depth;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  struct ioreq *queue;		/* Sorted by offset.  */
+  unsigned active;		/* Transfers going on.  */
+  off_t head;			/* Where the last one started ended.  */
+
+  uint64_t requests, transfers, merged, expired;
+};
+
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+error_t
+iosched_create (enum iosched_policy policy, unsigned deadline_ms,
+		unsigned depth, struct iosched **sched)
+{
+  struct iosched *s = calloc (1, sizeof *s);
+  if (! s)
+    return ENOMEM;
+
+  s->policy = policy;
+  s->deadline_us = (uint64_t) deadline_ms * 1000;
+  s->depth = depth ?: 1;
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->wakeup, NULL);
+
+  *sched = s;
+  return 0;
+}
+
+/* Take the next transfer out of SCHED's queue, which isn't empty, and
+   return its requests, which are in order and end to end.  */
+static struct ioreq *
+next_transfer (struct iosched *sched)
+{
+  struct ioreq **pp, *first, *last, *r;
+  off_t end;
+  size_t total;
+
+  /* Carry on from where the last transfer ended, starting over from the
+     beginning once past the end.  */
+  for (pp = &sched->queue; *pp; pp = &(*pp)->next)
+    if ((*pp)->offs >= sched->head)
+      break;
+  if (! *pp)
+    pp = &sched->queue;
+
+  if (sched->policy == IOSCHED_DEADLINE)
+    {
+      struct ioreq **oldest = &sched->queue;
+      for (struct ioreq **qp = &sched->queue; *qp; qp = &(*qp)->next)
+	if ((*qp)->deadline < (*oldest)->deadline)
+	  oldest = qp;
+      if ((*oldest)->deadline <= now_us ())
+	{
+	  pp = oldest;
+	  sched->expired++;
+	}
+    }
+
+  first = last = *pp;
+  end = first->offs + first->len;
+  total = first->len;
+  for (r = first->next;
+       r && r->store == first->store && r->write == first->write
+	 && r->offs == end && total + r->len <= MERGE_MAX;
+       r = r->next)
+    {
+      last = r;
+      end += r->len;
+      total += r->len;
+    }
+
+  *pp = last->next;
+  last->next = NULL;
+  sched->head = end;
+  return first;
+}
+
+/* Do the transfer made of the requests in FIRST.  */
+static void
+do_transfer (struct ioreq *first)
+{
+  struct store *store = first->store;
+  store_offset_t addr = first->offs >> store->log2_block_size;
+  size_t total = 0, amount = 0;
+  struct ioreq *r;
+  void *buf;
+  error_t err;
+
+  for (r = first; r; r = r->next)
+    total += r->len;
+
+  if (! first->next)
+    buf = first->buf;
+  else
+    {
+      /* Several requests: gather them in one buffer.  */
+      buf = mmap (0, total, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (buf == MAP_FAILED)
+	{
+	  err = errno;
+	  for (r = first; r; r = r->next)
+	    r->err = err;
+	  return;
+	}
+      if (first->write)
+	{
+	  size_t ofs = 0;
+	  for (r = first; r; r = r->next)
+	    {
+	      memcpy (buf + ofs, r->buf, r->len);
+	      ofs += r->len;
+	    }
+	}
+    }
+
+  if (first->write)
+    err = store_write (store, addr, buf, total, &amount);
+  else
+    {
+      void *data = buf;
+      amount = total;
+      err = store_read (store, addr, total, &data, &amount);
+      if (! err && data != buf)
+	{
+	  memcpy (buf, data, amount);
+	  munmap (data, amount);
+	}
+    }
+
+  /* Each request gets its share of what was done.  */
+  size_t ofs = 0;
+  for (r = first; r; r = r->next)
+    {
+      r->err = err;
+      r->amount = 0;
+      if (! err && ofs < amount)
+	r->amount = amount - ofs < r->len ? amount - ofs : r->len;
+      if (! first->write && buf != first->buf)
+	memcpy (r->buf, buf + ofs, r->amount);
+      ofs += r->len;
+    }
+
+  if (buf != first->buf)
+    munmap (buf, total);
+}
+
+error_t
+iosched_rw (struct iosched *sched, struct store *store, int write,
+	    off_t offs, void *buf, size_t len, size_t *amount)
+{
+  struct ioreq req =
+    {
+      .store = store, .write = write, .offs = offs, .buf = buf, .len = len,
+      .deadline = now_us () + sched->deadline_us,
+    };
+  struct ioreq **pp;
+
+  pthread_mutex_lock (&sched->lock);
+
+  for (pp = &sched->queue; *pp; pp = &(*pp)->next)
+    if ((*pp)->offs > offs)
+      break;
+  req.next = *pp;
+  *pp = &req;
+  sched->requests++;
+
+  while (! req.done)
+    if (sched->queue && sched->active < sched->depth)
+      {
+	struct ioreq *first = next_transfer (sched), *r, *next;
+
+	sched->active++;
+	sched->transfers++;
+	for (r = first->next; r; r = r->next)
+	  sched->merged++;
+	pthread_mutex_unlock (&sched->lock);
+
+	do_transfer (first);
+
+	pthread_mutex_lock (&sched->lock);
+	sched->active--;
+	/* Once done, a request may go away at any time.  */
+	for (r = first; r; r = next)
+	  {
+	    next = r->next;
+	    r->done = 1;
+	  }
+	pthread_cond_broadcast (&sched->wakeup);
+      }
+    else
+      pthread_cond_wait (&sched->wakeup, &sched->lock);
+
+  pthread_mutex_unlock (&sched->lock);
+
+  *amount = req.amount;
+  return req.err;
+}
+
+void
+iosched_print_stats (struct iosched *sched, FILE *out)
+{
+  static const char *const names[] = { "none", "elevator", "deadline" };
+
+  pthread_mutex_lock (&sched->lock);
+  fprintf (out, "scheduler %s: %" PRIu64 " requests in %" PRIu64
+	   " transfers, %" PRIu64 " merged",
+	   names[sched->policy], sched->requests, sched->transfers,
+	   sched->merged);
+  if (sched->policy == IOSCHED_DEADLINE)
+    fprintf (out, ", %" PRIu64 " past their deadline", sched->expired);
+  fputc ('\n', out);
+  pthread_mutex_unlock (&sched->lock);
+}
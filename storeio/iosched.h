@@ -0,0 +1,51 @@
+/* Scheduling of the I/O done on a storeio device
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef __IOSCHED_H__
+#define __IOSCHED_H__
+
+#include <stdio.h>
+#include <hurd/store.h>
+
+enum iosched_policy
+{
+  IOSCHED_NONE,			/* Straight to the store, in arrival order.  */
+  IOSCHED_ELEVATOR,		/* Sorted by offset, and merged.  */
+  IOSCHED_DEADLINE,		/* Likewise, but no later than a deadline.  */
+};
+
+struct iosched;
+
+/* Return in SCHED a new scheduler following POLICY, which isn't
+   IOSCHED_NONE, that keeps up to DEPTH transfers going on at once and,
+   with IOSCHED_DEADLINE, starts every request at most DEADLINE_MS
+   milliseconds after it came.  */
+error_t iosched_create (enum iosched_policy policy, unsigned deadline_ms,
+			unsigned depth, struct iosched **sched);
+
+/* Read (if WRITE is zero) into BUF, or write from it, the LEN bytes at
+   byte offset OFFS of STORE, once SCHED thinks it is time.  LEN and OFFS
+   are multiples of STORE's block size.  Return in AMOUNT how much was
+   done.  */
+error_t iosched_rw (struct iosched *sched, struct store *store, int write,
+		    off_t offs, void *buf, size_t len, size_t *amount);
+
+/* Print what SCHED has done to OUT.  */
+void iosched_print_stats (struct iosched *sched, FILE *out);
+
+#endif /* !__IOSCHED_H__ */
@@ -36,6 +36,7 @@ open_create (struct dev *dev, struct open **open)
   (*open)->dev = dev;
   (*open)->offs = 0;
   pthread_mutex_init (&(*open)->lock, NULL);
+  dev_client_add (dev, &(*open)->client);
 
   return 0;
 }
@@ -44,6 +45,7 @@ open_create (struct dev *dev, struct open **open)
 void
 open_free (struct open *open)
 {
+  dev_client_remove (open->dev, &open->client);
   free (open);
 }
 
@@ -60,13 +62,14 @@ open_write (struct open *open, off_t offs, const void *buf, size_t len,
     /* Use OPEN's offset.  */
     {
       pthread_mutex_lock (&open->lock);
-      err = dev_write (open->dev, open->offs, buf, len, amount);
+      err = dev_write (open->dev, &open->client, open->offs, buf, len,
+		       amount);
       if (! err)
 	open->offs += *amount;
       pthread_mutex_unlock (&open->lock);
     }
   else
-    err = dev_write (open->dev, offs, buf, len, amount);
+    err = dev_write (open->dev, &open->client, offs, buf, len, amount);
   return err;
 }    
 
@@ -82,13 +85,14 @@ open_read (struct open *open, off_t offs, vm_size_t amount,
     /* Use OPEN's offset.  */
     {
       pthread_mutex_lock (&open->lock);
-      err = dev_read (open->dev, open->offs, amount, buf, len);
+      err = dev_read (open->dev, &open->client, open->offs, amount,
+		      buf, len);
       if (! err)
 	open->offs += *len;
       pthread_mutex_unlock (&open->lock);
     }
   else
-    err = dev_read (open->dev, offs, amount, buf, len);
+    err = dev_read (open->dev, &open->client, offs, amount, buf, len);
   return err;
 }   
 
@@ -37,6 +37,9 @@ struct open
 
   /* A lock used to control write access to OFFS.  */
   pthread_mutex_t lock;
+
+  /* The statistics of the I/O done through this open.  */
+  struct dev_client client;
 };
 
 /* Returns a new per-open structure for the device DEV in OPEN.  If an error
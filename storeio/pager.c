@@ -30,6 +30,92 @@
 
 #include "dev.h"
 
+/* Pageins just past what was last read ahead, or just past the previous
+   pagein if nothing was, double the readahead window up to
+   READAHEAD_MAX_PAGES; any other pagein closes it.  */
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+/* The NPAGES pages of DEV at PAGE were just read in; if DEV is being
+   read sequentially, offer the kernel the whole pages after them.  They
+   are offered writable, so none are for a read-only store.  */
+static void
+dev_readahead (struct dev *dev, vm_offset_t page, int npages)
+{
+  vm_offset_t start = page + npages * vm_page_size;
+  struct store *store = dev->store;
+  struct pager *pager = NULL;
+  void *buf, *read_buf;
+  size_t want, read;
+  int window = 0;
+  error_t err;
+
+  if (store->flags & STORE_READONLY)
+    return;
+
+  pthread_mutex_lock (&dev->pager_lock);
+  if (page == dev->ra_next)
+    {
+      window = dev->ra_window * 2 ?: READAHEAD_MIN_PAGES;
+      if (window > READAHEAD_MAX_PAGES)
+	window = READAHEAD_MAX_PAGES;
+      if (start >= store->size)
+	window = 0;
+      else if (window > (store->size - start) / vm_page_size)
+	window = (store->size - start) / vm_page_size;
+    }
+  dev->ra_window = window;
+  dev->ra_next = start;
+  if (window > 0 && dev->pager)
+    {
+      pager = dev->pager;
+      ports_port_ref (pager);
+    }
+  pthread_mutex_unlock (&dev->pager_lock);
+
+  if (! pager)
+    return;
+
+  buf = mmap (0, window * vm_page_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    {
+      ports_port_deref (pager);
+      return;
+    }
+
+  npages = pager_prepare_offer (pager, start, window);
+  if (npages < window)
+    munmap (buf + npages * vm_page_size, (window - npages) * vm_page_size);
+  window = npages;
+  if (window == 0)
+    {
+      ports_port_deref (pager);
+      return;
+    }
+
+  want = window * vm_page_size;
+  read_buf = buf;
+  read = want;
+  err = dev_read (dev, &dev->pager_client, start, want, &read_buf, &read);
+  if (! err && read_buf != buf)
+    /* The store put the data somewhere else.  */
+    {
+      memcpy (buf, read_buf, read < want ? read : want);
+      munmap (read_buf, read);
+    }
+  if (! err && read < want)
+    err = EIO;
+
+  pager_offer_pages (pager, 0, start, window, (vm_address_t) buf, err);
+
+  pthread_mutex_lock (&dev->pager_lock);
+  if (dev->ra_next == start)
+    dev->ra_next = start + want;
+  pthread_mutex_unlock (&dev->pager_lock);
+
+  ports_port_deref (pager);
+}
+
 /* ---------------------------------------------------------------- */
 /* Pager library callbacks; see <hurd/pager.h> for more info.  */
 
@@ -51,7 +137,8 @@ pager_read_page (struct user_pager_info *upi,
     /* Read a partial page if necessary to avoid reading off the end.  */
     want = store->size - page;
 
-  err = dev_read (dev, page, want, (void **)buf, &read);
+  err = dev_read (dev, &dev->pager_client, page, want, (void **)buf,
+		  &read);
 
   if (!err && want < vm_page_size)
     /* Zero anything we didn't read.  Allocation only happens in page-size
@@ -62,8 +149,41 @@ pager_read_page (struct user_pager_info *upi,
 
   if (err || read < want)
     return EIO;
-  else
-    return 0;
+
+  dev_readahead (dev, page, 1);
+  return 0;
+}
+
+/* For pager PAGER, read the NPAGES pages from OFFSET with a single store
+   read.  The partial page at the end of the store is left to
+   pager_read_page.  */
+error_t
+pager_read_pages (struct user_pager_info *upi, vm_offset_t offset,
+		  int npages, vm_address_t *buf, int *writelock)
+{
+  error_t err;
+  size_t read = 0;
+  size_t want = npages * vm_page_size;
+  struct dev *dev = (struct dev *)upi;
+  struct store *store = dev->store;
+
+  if (offset + want > store->size)
+    return EOPNOTSUPP;
+
+  err = dev_read (dev, &dev->pager_client, offset, want, (void **)buf,
+		  &read);
+  if (! err && read < want)
+    {
+      if (read > 0)
+	munmap ((void *) *buf, read);
+      err = EIO;
+    }
+  if (err)
+    return EIO;
+
+  *writelock = (store->flags & STORE_READONLY);
+  dev_readahead (dev, offset, npages);
+  return 0;
 }
 
 /* For pager PAGER, synchronously write one page from BUF to offset PAGE.
@@ -88,7 +208,8 @@ pager_write_page (struct user_pager_info *upi,
 	/* Write a partial page if necessary to avoid reading off the end.  */
 	want = store->size - page;
 
-      err = dev_write (dev, page, (char *)buf, want, &written);
+      err = dev_write (dev, &dev->pager_client, page, (char *)buf, want,
+		       &written);
 
       if (err || written < want)
 	return EIO;
@@ -97,6 +218,37 @@ pager_write_page (struct user_pager_info *upi,
     }
 }
 
+/* For pager PAGER, synchronously write the NPAGES pages from BUF to
+   OFFSET with a single store write.  */
+void
+pager_write_pages (struct user_pager_info *upi, vm_offset_t offset,
+		   vm_address_t buf, int npages, error_t *errors)
+{
+  struct dev *dev = (struct dev *)upi;
+  struct store *store = dev->store;
+  error_t err = 0;
+  size_t want = npages * vm_page_size;
+  size_t written;
+  int i;
+
+  if (store->flags & STORE_READONLY)
+    err = EROFS;
+  else
+    {
+      if (offset + want > store->size)
+	/* Write a partial page if necessary to avoid writing off the end.  */
+	want = store->size - offset;
+
+      err = dev_write (dev, &dev->pager_client, offset, (char *)buf, want,
+		       &written);
+      if (err || written < want)
+	err = EIO;
+    }
+
+  for (i = 0; i < npages; i++)
+    errors[i] = err;
+}
+
 /* A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *upi, vm_offset_t address)
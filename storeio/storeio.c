@@ -18,6 +18,8 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
 #include <error.h>
 #include <assert-backtrace.h>
 #include <fcntl.h>
@@ -40,6 +42,8 @@ static struct argp_option options[] =
   {"readonly", 'r', 0,	  0,"Disallow writing"},
   {"writable", 'w', 0,	  0,"Allow writing"},
   {"no-cache", 'c', 0,	  0,"Never cache data--user io does direct device io"},
+  {"aligned",  'a', 0,	  0,"Only allow user io of whole blocks, which then"
+   " goes straight to the device"},
   {"no-file-io", 'F', 0,  0,"Never perform io via plain file io RPCs"},
   {"no-fileio",  0,   0, OPTION_ALIAS | OPTION_HIDDEN},
   {"enforced",  'e', 0,	  0,"Never reveal underlying devices, even to root"},
@@ -48,9 +52,19 @@ static struct argp_option options[] =
   {"rdev",     'n', "ID", 0,
    "The stat rdev number for this node; may be either a"
    " single integer, or of the form MAJOR,MINOR"},
+  {"io-scheduler", 'S', "POLICY", 0,
+   "Order block I/O by POLICY: none (the default), elevator, which sorts"
+   " and merges requests, or deadline, which also bounds their wait"},
+  {"io-deadline", 'D', "MS", 0,
+   "With the deadline policy, start each request within MS milliseconds"
+   " (default 100)"},
+  {"io-depth",  'Q', "N", 0,
+   "Have at most N scheduled transfers going on at once (default 4)"},
   {0}
 };
-static const char doc[] = "Translator for devices and other stores";
+static const char doc[] = "Translator for devices and other stores"
+"\vOn SIGINFO, the I/O statistics of each open and of the pager are"
+" printed on the standard error.";
 
 const char *argp_program_version = STANDARD_HURD_VERSION (storeio);
 
@@ -77,6 +91,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'w': params->dev->readonly = 0; break;
 
     case 'c': params->dev->inhibit_cache = 1; break;
+    case 'a': params->dev->aligned = 1; break;
     case 'e': params->dev->enforced = 1; break;
     case 'F': params->dev->no_fileio = 1; break;
 
@@ -103,6 +118,38 @@ parse_opt (int key, char *arg, struct argp_state *state)
       }
       break;
 
+    case 'S':
+      if (! strcmp (arg, "none"))
+	params->dev->sched_policy = IOSCHED_NONE;
+      else if (! strcmp (arg, "elevator"))
+	params->dev->sched_policy = IOSCHED_ELEVATOR;
+      else if (! strcmp (arg, "deadline"))
+	params->dev->sched_policy = IOSCHED_DEADLINE;
+      else
+	{
+	  argp_error (state, "%s: Invalid argument to --io-scheduler", arg);
+	  return EINVAL;
+	}
+      break;
+
+    case 'D':
+    case 'Q':
+      {
+	char *end;
+	unsigned long n = strtoul (arg, &end, 0);
+	if (end == arg || *end != '\0' || (key == 'Q' && n == 0))
+	  {
+	    argp_error (state, "%s: Invalid argument to --%s", arg,
+			key == 'D' ? "io-deadline" : "io-depth");
+	    return EINVAL;
+	  }
+	if (key == 'D')
+	  params->dev->sched_deadline = n;
+	else
+	  params->dev->sched_depth = n;
+      }
+      break;
+
     case 'd':
       {
 	debug=true;
@@ -137,6 +184,24 @@ static const struct argp argp = { options, parse_opt, 0, doc, argp_kids };
 
 struct trivfs_control *storeio_fsys;
 
+/* Print the I/O statistics of DEV to stderr each time we get SIGINFO.  */
+static void *
+stats_thread (void *dev)
+{
+  sigset_t set;
+  int sig;
+
+  sigemptyset (&set);
+  sigaddset (&set, SIGINFO);
+  for (;;)
+    if (sigwait (&set, &sig) == 0)
+      {
+	dev_print_stats (dev, stderr);
+	fflush (stderr);
+      }
+  return NULL;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -144,13 +209,37 @@ main (int argc, char *argv[])
   mach_port_t bootstrap;
   struct dev device;
   struct storeio_argp_params params;
+  sigset_t set;
+  pthread_t t;
 
   memset (&device, 0, sizeof device);
   pthread_mutex_init (&device.lock, NULL);
+  pthread_mutex_init (&device.clients_lock, NULL);
+  device.sched_deadline = 100;
+  device.sched_depth = 4;
 
   params.dev = &device;
   argp_parse (&argp, argc, argv, 0, 0, &params);
 
+  if (device.sched_policy != IOSCHED_NONE)
+    {
+      err = iosched_create (device.sched_policy, device.sched_deadline,
+			    device.sched_depth, &device.sched);
+      if (err)
+	error (3, err, "iosched_create");
+    }
+
+  dev_client_add (&device, &device.pager_client);
+
+  /* Only the statistics thread takes SIGINFO.  */
+  sigemptyset (&set);
+  sigaddset (&set, SIGINFO);
+  pthread_sigmask (SIG_BLOCK, &set, NULL);
+  err = pthread_create (&t, NULL, stats_thread, &device);
+  if (err)
+    error (3, err, "pthread_create");
+  pthread_detach (t);
+
   if (debug)
     {
       if (!debug_fname)
@@ -199,12 +288,34 @@ trivfs_append_args (struct trivfs_control *trivfs_control,
   if (!err && dev->inhibit_cache)
     err = argz_add (argz, argz_len, "--no-cache");
 
+  if (!err && dev->aligned)
+    err = argz_add (argz, argz_len, "--aligned");
+
   if (!err && dev->enforced)
     err = argz_add (argz, argz_len, "--enforced");
 
   if (!err && dev->no_fileio)
     err = argz_add (argz, argz_len, "--no-file-io");
 
+  if (!err && dev->sched_policy != IOSCHED_NONE)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--io-scheduler=%s",
+		dev->sched_policy == IOSCHED_ELEVATOR ? "elevator"
+		: "deadline");
+      err = argz_add (argz, argz_len, buf);
+      if (!err && dev->sched_policy == IOSCHED_DEADLINE)
+	{
+	  snprintf (buf, sizeof buf, "--io-deadline=%u", dev->sched_deadline);
+	  err = argz_add (argz, argz_len, buf);
+	}
+      if (! err)
+	{
+	  snprintf (buf, sizeof buf, "--io-depth=%u", dev->sched_depth);
+	  err = argz_add (argz, argz_len, buf);
+	}
+    }
+
   if (! err)
     err = argz_add (argz, argz_len,
 		    dev->readonly ? "--readonly" : "--writable");
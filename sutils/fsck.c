@@ -39,6 +39,13 @@
    The exit-status from this wrapper is the greatest status returned from any
    individual fsck.
 
+   Filesystems are checked in the order of their fstab pass numbers.  Those
+   of one pass are checked in parallel, but only one at a time on each disk,
+   where parallel checks would mostly make it seek between them.  In preen
+   mode, an ext2 filesystem with a journal and no recorded errors is not
+   checked at all: whatever is in its journal is replayed by ext2fs when
+   it is started.
+
    Although it knows something about the hurd, this fsck still uses
    /etc/fstab, and is generally not very integrated.  That will have to wait
    until the appropriate mechanisms for doing so are decided.  */
@@ -47,6 +54,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <endian.h>
+#include <stdint.h>
 #include <error.h>
 #include <argp.h>
 #include <argz.h>
@@ -112,6 +123,7 @@ static void sigint (int signum)
 struct fsck
 {
   struct fs *fs;		/* Filesystem being fscked.  */
+  char *disk;			/* What fs_disk returns for FS.  */
   int pid;			/* Pid for process.  */
   int make_writable;		/* Make writable after fscking if possible.  */
   struct fsck *next, **self;
@@ -124,6 +136,93 @@ struct fscks
   int flags;
 };
 
+/* Return in a malloced string the name of the disk FS is on: the device
+   part:N:device:hd0 or /dev/hd0s1 names, hd0.  Filesystems on one disk
+   are checked one after the other.  */
+static char *
+fs_disk (struct fs *fs)
+{
+  const char *name = fs->mntent.mnt_fsname;
+  const char *colon = strrchr (name, ':');
+  const char *slash;
+  char *disk, *p;
+
+  if (colon)
+    name = colon + 1;
+  slash = strrchr (name, '/');
+  if (slash)
+    name = slash + 1;
+
+  disk = strdup (name);
+  if (! disk)
+    return NULL;
+
+  /* Strip a slice number, as in hd0s1.  */
+  p = disk + strlen (disk);
+  while (p > disk && isdigit (p[-1]))
+    p--;
+  if (*p && p - 1 > disk && p[-1] == 's' && isdigit (p[-2]))
+    p[-1] = '\0';
+
+  return disk;
+}
+
+/* Offsets in an ext2 superblock, which starts at byte 1024.  */
+#define EXT2_SB_START		1024
+#define EXT2_SB_MAGIC		56
+#define EXT2_SB_STATE		58
+#define EXT2_SB_FEATURE_COMPAT	92
+#define EXT2_SB_SIZE		104
+
+#define EXT2_MAGIC		0xEF53
+#define EXT2_ERROR_FS		0x0002
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL 0x0004
+
+/* Return true if FS is an ext2 filesystem with a journal, and no errors
+   noted in its superblock.  */
+static int
+fs_journal_clean (struct fs *fs)
+{
+  unsigned char sb[EXT2_SB_SIZE];
+  uint16_t magic, state;
+  uint32_t compat;
+  ssize_t n;
+  int fd;
+
+  if (strcmp (fs->mntent.mnt_type, "ext2") != 0
+      && strcmp (fs->mntent.mnt_type, "ext3") != 0
+      && strcmp (fs->mntent.mnt_type, "ext4") != 0)
+    return 0;
+
+  fd = open (fs->mntent.mnt_fsname, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  n = pread (fd, sb, sizeof sb, EXT2_SB_START);
+  close (fd);
+  if (n != sizeof sb)
+    return 0;
+
+  memcpy (&magic, sb + EXT2_SB_MAGIC, sizeof magic);
+  memcpy (&state, sb + EXT2_SB_STATE, sizeof state);
+  memcpy (&compat, sb + EXT2_SB_FEATURE_COMPAT, sizeof compat);
+
+  return (le16toh (magic) == EXT2_MAGIC
+	  && (le32toh (compat) & EXT3_FEATURE_COMPAT_HAS_JOURNAL)
+	  && !(le16toh (state) & EXT2_ERROR_FS));
+}
+
+/* Return true if a fsck is running on DISK.  */
+static int
+fscks_disk_busy (struct fscks *fscks, const char *disk)
+{
+  struct fsck *fsck;
+
+  for (fsck = fscks->running; fsck; fsck = fsck->next)
+    if (fsck->pid && fsck->disk && disk && strcmp (fsck->disk, disk) == 0)
+      return 1;
+  return 0;
+}
+
 /* Starts FS's fsck program on FS's device, returning the pid of the process.
    If an error is encountered, prints an error message and returns 0.
    Filesystems that need not be fscked at all also return 0 (but don't print
@@ -272,6 +371,7 @@ fscks_start_fsck (struct fscks *fscks, struct fs *fs)
     }
 
   fsck->fs = fs;
+  fsck->disk = fs_disk (fs);
   fsck->make_writable = make_writable;
   fsck->next = fscks->running;
   if (fsck->next)
@@ -324,6 +424,7 @@ fsck_cleanup (struct fsck *fsck, int remount, int make_writable)
 	}
     }
 
+   free (fsck->disk);
    free (fsck);
 }
 
@@ -397,8 +498,8 @@ fscks_wait (struct fscks *fscks)
 }
 
 /* Fsck all the filesystems in FSTAB, with the flags in FLAGS, doing at most
-   MAX_PARALLEL parallel fscks.  The greatest exit code returned by any one
-   fsck is returned.  */
+   MAX_PARALLEL parallel fscks, and at most one on each disk.  The greatest
+   exit code returned by any one fsck is returned.  */
 static int
 fsck (struct fstab *fstab, int flags, int max_parallel)
 {
@@ -407,6 +508,8 @@ fsck (struct fstab *fstab, int flags, int max_parallel)
   int autom = (flags & FSCK_F_AUTO);
   int summary_status = 0;
   struct fscks fscks = { running: 0, flags: flags };
+  struct fs **todo = NULL;
+  size_t todo_alloced = 0;
 
   void merge_status (int status)
     {
@@ -421,9 +524,11 @@ fsck (struct fstab *fstab, int flags, int max_parallel)
     {
       debug ("Pass %d", pass);
 
+      size_t num_todo = 0, i;
+
       fscks.free_slots = max_parallel;
 
-      /* Try and fsck every filesystem in this pass.  */
+      /* Find the filesystems of this pass that should be fscked.  */
       for (fs = fstab->entries; fs; fs = fs->next)
 	if (fs->mntent.mnt_passno == pass)
 	  /* FS is applicable for this pass.  */
@@ -437,14 +542,31 @@ fsck (struct fstab *fstab, int flags, int max_parallel)
 		       fs->mntent.mnt_dir, fs->mntent.mnt_type);
 		merge_status (FSCK_EX_ERROR);
 	      }
+	    else if (type->program
+		     && (flags & (FSCK_F_PREEN|FSCK_F_FORCE)) == FSCK_F_PREEN
+		     && fs_journal_clean (fs))
+	      {
+		fs_debug (fs, "Journaled and clean; not fscking");
+		if (flags & FSCK_F_VERBOSE)
+		  printf ("%s: journaled and clean\n", fs->mntent.mnt_dir);
+	      }
 	    else if (type->program)
 	      /* This is a fsckable filesystem.  */
 	      {
-		fs_debug (fs, "Fsckable; free_slots = %d", fscks.free_slots);
-		while (fscks.free_slots == 0)
-		  /* No room; wait for another fsck to finish.  */
-		  merge_status (fscks_wait (&fscks));
-		merge_status (fscks_start_fsck (&fscks, fs));
+		if (num_todo == todo_alloced)
+		  {
+		    size_t alloced = todo_alloced ? todo_alloced * 2 : 16;
+		    struct fs **new = realloc (todo, alloced * sizeof *todo);
+		    if (! new)
+		      {
+			error (0, ENOMEM, "malloc");
+			merge_status (FSCK_EX_ERROR);
+			continue;
+		      }
+		    todo = new;
+		    todo_alloced = alloced;
+		  }
+		todo[num_todo++] = fs;
 	      }
 	    else if (autom)
 	      fs_debug (fs, "Not fsckable");
@@ -453,11 +575,46 @@ fsck (struct fstab *fstab, int flags, int max_parallel)
 		     fs->mntent.mnt_dir, fs->mntent.mnt_type);
 	  }
 
+      /* Start them in order, as slots free up, skipping over those whose
+	 disk is busy until its fsck is done.  */
+      while (num_todo > 0)
+	{
+	  int started = 0;
+
+	  for (i = 0; i < num_todo && fscks.free_slots > 0; )
+	    {
+	      char *disk = fs_disk (todo[i]);
+	      int busy = fscks_disk_busy (&fscks, disk);
+
+	      free (disk);
+	      if (busy)
+		{
+		  fs_debug (todo[i], "Disk busy; deferred");
+		  i++;
+		  continue;
+		}
+
+	      fs_debug (todo[i], "Fsckable; free_slots = %d",
+			fscks.free_slots);
+	      merge_status (fscks_start_fsck (&fscks, todo[i]));
+	      memmove (&todo[i], &todo[i + 1],
+		       (num_todo - i - 1) * sizeof *todo);
+	      num_todo--;
+	      started = 1;
+	    }
+
+	  if (! started)
+	    /* No room, or only busy disks left; wait for a fsck to
+	       finish.  */
+	    merge_status (fscks_wait (&fscks));
+	}
+
       /* Now wait for them all to finish.  */
       while (fscks.running)
 	merge_status (fscks_wait (&fscks));
     }
 
+  free (todo);
   return summary_status;
 }
 
@@ -111,6 +111,117 @@ write_character (int c)
   echo_pstart = output_psize;
 }
 
+/* Bytes of a word full of byte B.  */
+#define WORD_OF(b) ((unsigned long) -1 / 0xff * (b))
+
+/* Whether C is printed as it is, taking one column.  */
+static inline int
+plain_char_p (unsigned char c)
+{
+  return c >= ' ' && c < '\177';
+}
+
+/* Return how many characters at the start of DATA, at most LEN, are
+   plain.  Words are checked at once: a word has no byte below ' '
+   nor above '~' if subtracting ' ' from each byte borrows nowhere, and
+   adding 1 carries into no high bit.  */
+static size_t
+plain_run (const char *data, size_t len)
+{
+  size_t i = 0;
+  unsigned long x;
+
+  for (; i + sizeof x <= len; i += sizeof x)
+    {
+      memcpy (&x, data + i, sizeof x);
+      if ((((x - WORD_OF (' ')) & ~x) | x | (x + WORD_OF (1)))
+	  & WORD_OF (0x80))
+	break;
+    }
+  while (i < len && plain_char_p (data[i]))
+    i++;
+  return i;
+}
+
+/* Put the LEN plain characters at DATA on the output queue at once, as
+   poutput would one after the other.  */
+static void
+poutput_run (const char *data, size_t len)
+{
+  struct queue *q = outputq;
+  int was_empty = qsize (q) == 0;
+
+  output_psize += len;
+  while (len > 0)
+    {
+      size_t room, i;
+
+      /* Each reallocation makes room for at least one more character,
+	 as it does for enqueue, but not necessarily for all of them.  */
+      if (q->ce == q->array + q->arraylen)
+	q = outputq = reallocate_queue (q);
+
+      room = q->array + q->arraylen - q->ce;
+      if (room > len)
+	room = len;
+      for (i = 0; i < room; i++)
+	q->ce[i] = (unsigned char) data[i];
+      q->ce += room;
+      data += room;
+      len -= room;
+    }
+
+  if (was_empty)
+    {
+      pthread_cond_broadcast (q->wait);
+      pthread_cond_broadcast (&select_alert);
+    }
+  if (!q->susp && (qsize (q) > q->hiwat))
+    q->susp = 1;
+}
+
+/* Place up to LEN characters from DATA on the output queue, as
+   write_character would each, and return how many; stop once the queue
+   is full, where the caller would have to wait between two calls of
+   write_character.  The output queue must not be full already.  */
+size_t
+write_characters (const char *data, size_t len)
+{
+  size_t i = 0;
+
+  if (termflags & FLUSH_OUTPUT)
+    /* poutput drops them all.  */
+    i = len;
+  else if ((termstate.c_oflag & (OPOST | OLCASE)) == (OPOST | OLCASE))
+    /* Letters are special; there's little point in hurrying.  */
+    while (i < len && qavail (outputq))
+      output_character (data[i++]);
+  else
+    while (i < len && qavail (outputq))
+      {
+	size_t n = plain_run (data + i, len - i);
+
+	if (n > 0)
+	  {
+	    /* Fill the queue only as far as enqueuing one at a time would
+	       before it stopped.  */
+	    int room = outputq->hiwat + 1 - qsize (outputq);
+	    if (room < 1)
+	      room = 1;
+	    if (n > (size_t) room)
+	      n = room;
+	    poutput_run (data + i, n);
+	    i += n;
+	  }
+	else
+	  output_character (data[i++]);
+      }
+
+  echo_qsize = 0;
+  echo_pstart = output_psize;
+  return i;
+}
+
 /* Report the width of character C as printed by output_character,
    if output_psize were at LOC. . */
 int
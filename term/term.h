@@ -379,6 +379,7 @@ void output_character (int);
 void copy_rawq (void);
 void rescan_inputq (void);
 void write_character (int);
+size_t write_characters (const char *, size_t);
 void init_users (void);
 
 extern char *tty_arg;
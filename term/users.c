@@ -600,7 +600,7 @@ trivfs_S_io_write (struct trivfs_protid *cred,
     }
 
   cancel = 0;
-  for (i = 0; i < datalen; i++)
+  for (i = 0; i < datalen; )
     {
       while (!qavail (outputq) && !cancel)
 	{
@@ -617,7 +617,7 @@ trivfs_S_io_write (struct trivfs_protid *cred,
       if (cancel)
 	break;
 
-      write_character (data[i]);
+      i += write_characters (data + i, datalen - i);
     }
 
   *amt = i;
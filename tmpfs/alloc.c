@@ -0,0 +1,78 @@
+/* Allocation of the small objects of tmpfs.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Directory entries and symlink targets are mostly a few dozen bytes,
+   and a tmpfs holding many files has many of them.  They are taken
+   from slab spaces of a few sizes rather than from malloc, so that they
+   are packed together and freeing them leaves no holes of odd sizes.  */
+
+#include "tmpfs.h"
+#include <stdlib.h>
+#include <hurd/slab.h>
+
+#define SIZE_CLASS(size)						\
+  HURD_SLAB_SPACE_INITIALIZER (union { char c[size]; void *p; },	\
+			       NULL, NULL, NULL, NULL, NULL)
+
+/* The sizes of the classes; larger objects come from malloc.  */
+static const size_t class_size[] = { 32, 64, 128, 256 };
+#define NUM_CLASSES (sizeof class_size / sizeof class_size[0])
+
+static struct hurd_slab_space classes[NUM_CLASSES] =
+{
+  SIZE_CLASS (32), SIZE_CLASS (64), SIZE_CLASS (128), SIZE_CLASS (256)
+};
+
+static int
+size_class (size_t size)
+{
+  int i;
+
+  for (i = 0; i < NUM_CLASSES; i++)
+    if (size <= class_size[i])
+      return i;
+  return -1;
+}
+
+void *
+tmpfs_alloc (size_t size)
+{
+  int i = size_class (size);
+  void *p;
+
+  if (i < 0)
+    return malloc (size);
+  if (hurd_slab_alloc (&classes[i], &p))
+    return NULL;
+  return p;
+}
+
+void
+tmpfs_free (void *p, size_t size)
+{
+  int i = size_class (size);
+
+  if (p == NULL)
+    return;
+  if (i < 0)
+    free (p);
+  else
+    hurd_slab_dealloc (&classes[i], p);
+}
@@ -23,12 +23,59 @@
 
 #include "tmpfs.h"
 #include <stdlib.h>
+#include <string.h>
+
+/* Once a directory has this many entries, they are also hashed by name,
+   so that lookups need not walk them all.  */
+#define DIR_HASH_THRESHOLD 16
+
+static hurd_ihash_key_t
+name_hash (const void *name)
+{
+  return (hurd_ihash_key_t) hurd_ihash_hash32 (name, strlen (name), 0);
+}
+
+static int
+name_compare (const void *name1, const void *name2)
+{
+  return strcmp (name1, name2) == 0;
+}
+
+/* Hash the entries of directory DN by name.  */
+static void
+hash_entries (struct disknode *dn)
+{
+  struct tmpfs_dirent *d;
+
+  if (hurd_ihash_create (&dn->u.dir.names,
+			 offsetof (struct tmpfs_dirent, locp)))
+    return;
+  hurd_ihash_set_gki (dn->u.dir.names, name_hash, name_compare);
+
+  for (d = dn->u.dir.entries; d != 0; d = d->next)
+    if (hurd_ihash_add (dn->u.dir.names, (hurd_ihash_key_t) d->name, d))
+      {
+	/* Go on without the table.  */
+	hurd_ihash_free (dn->u.dir.names);
+	dn->u.dir.names = 0;
+	return;
+      }
+}
+
+static size_t
+dirent_size (size_t namelen)
+{
+  return offsetof (struct tmpfs_dirent, name) + namelen + 1;
+}
 
 error_t
 diskfs_init_dir (struct node *dp, struct node *pdp, struct protid *cred)
 {
   dp->dn->u.dir.dotdot = pdp->dn;
   dp->dn->u.dir.entries = 0;
+  dp->dn->u.dir.tail = &dp->dn->u.dir.entries;
+  dp->dn->u.dir.count = 0;
+  dp->dn->u.dir.names = 0;
 
   /* Increase hardlink count for parent directory */
   pdp->dn_stat.st_nlink++;
@@ -47,6 +94,12 @@ diskfs_clear_directory (struct node *dp, struct node *pdp,
   assert_backtrace (dp->dn_stat.st_size == 0);
   assert_backtrace (dp->dn->u.dir.dotdot == pdp->dn);
 
+  if (dp->dn->u.dir.names)
+    {
+      hurd_ihash_free (dp->dn->u.dir.names);
+      dp->dn->u.dir.names = 0;
+    }
+
   /* Decrease hardlink count for parent directory */
   pdp->dn_stat.st_nlink--;
   /* Take '.' directory into account */
@@ -149,7 +202,7 @@ diskfs_get_directs (struct node *dp, int entry, int n,
 
 struct dirstat
 {
-  struct tmpfs_dirent **prevp;
+  struct tmpfs_dirent *d;	/* The entry found, if any.  */
   int dotdot;
 };
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -157,7 +210,7 @@ const size_t diskfs_dirstat_size = sizeof (struct dirstat);
 void
 diskfs_null_dirstat (struct dirstat *ds)
 {
-  ds->prevp = 0;
+  ds->d = 0;
 }
 
 error_t
@@ -174,7 +227,7 @@ diskfs_lookup_hard (struct node *dp,
 		    struct protid *cred)
 {
   const size_t namelen = strlen (name);
-  struct tmpfs_dirent *d, **prevp;
+  struct tmpfs_dirent *d;
 
   if (type == REMOVE || type == RENAME)
     assert_backtrace (np);
@@ -225,24 +278,27 @@ diskfs_lookup_hard (struct node *dp,
 	}
     }
 
-  for (d = *(prevp = &dp->dn->u.dir.entries); d != 0;
-       d = *(prevp = &d->next))
-    if (d->namelen == namelen && !memcmp (d->name, name, namelen))
-      {
-	if (ds)
-	  ds->prevp = prevp;
-
-	if (np)
-	  return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
-	else
-	  return 0;
-      }
+  if (dp->dn->u.dir.names)
+    d = hurd_ihash_find (dp->dn->u.dir.names, (hurd_ihash_key_t) name);
+  else
+    for (d = dp->dn->u.dir.entries; d != 0; d = d->next)
+      if (d->namelen == namelen && !memcmp (d->name, name, namelen))
+	break;
 
   if (ds)
-    ds->prevp = prevp;
+    ds->d = d;
+
+  if (d == 0)
+    {
+      if (np)
+	*np = 0;
+      return ENOENT;
+    }
+
   if (np)
-    *np = 0;
-  return ENOENT;
+    return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
+  else
+    return 0;
 }
 
 
@@ -254,21 +310,36 @@ diskfs_direnter_hard (struct node *dp, const char *name,
   const size_t namelen = strlen (name);
   const size_t entsize
 	  = (offsetof (struct dirent, d_name[1]) + namelen + 7) & ~7;
-  struct tmpfs_dirent *new;
+  struct disknode *dn = dp->dn;
+  struct tmpfs_dirent *new, **tail;
 
   if (round_page (tmpfs_space_used + entsize) / vm_page_size
       > tmpfs_page_limit)
     return ENOSPC;
 
-  new = malloc (offsetof (struct tmpfs_dirent, name) + namelen + 1);
+  new = tmpfs_alloc (dirent_size (namelen));
   if (new == 0)
     return ENOSPC;
 
-  new->next = 0;
   new->dn = np->dn;
   new->namelen = namelen;
   memcpy (new->name, name, namelen + 1);
-  *ds->prevp = new;
+
+  if (dn->u.dir.names
+      && hurd_ihash_add (dn->u.dir.names, (hurd_ihash_key_t) new->name, new))
+    {
+      tmpfs_free (new, dirent_size (namelen));
+      return ENOSPC;
+    }
+
+  /* New entries go last, so that those read so far keep their place.  */
+  tail = dn->u.dir.tail ?: &dn->u.dir.entries;
+  new->next = 0;
+  new->prevp = tail;
+  *tail = new;
+  dn->u.dir.tail = &new->next;
+  if (++dn->u.dir.count >= DIR_HASH_THRESHOLD && dn->u.dir.names == 0)
+    hash_entries (dn);
 
   dp->dn_stat.st_size += entsize;
   adjust_used (entsize);
@@ -286,7 +357,7 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
   if (ds->dotdot)
     dp->dn->u.dir.dotdot = np->dn;
   else
-    (*ds->prevp)->dn = np->dn;
+    ds->d->dn = np->dn;
 
   return 0;
 }
@@ -294,16 +365,24 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
 error_t
 diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
 {
-  struct tmpfs_dirent *d = *ds->prevp;
+  struct disknode *dn = dp->dn;
+  struct tmpfs_dirent *d = ds->d;
   const size_t entsize
 	  = (offsetof (struct dirent, d_name[1]) + d->namelen + 7) & ~7;
 
-  *ds->prevp = d->next;
+  if (dn->u.dir.names)
+    hurd_ihash_locp_remove (dn->u.dir.names, d->locp);
+  *d->prevp = d->next;
+  if (d->next)
+    d->next->prevp = d->prevp;
+  else
+    dn->u.dir.tail = d->prevp;
+  dn->u.dir.count--;
 
   if (dp->dirmod_reqs != 0)
     diskfs_notice_dirchange (dp, DIR_CHANGED_UNLINK, d->name);
 
-  free (d);
+  tmpfs_free (d, dirent_size (d->namelen));
 
   adjust_used (-entsize);
   dp->dn_stat.st_size -= entsize;
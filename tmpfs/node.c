@@ -24,6 +24,7 @@
 #include <mach/mach4.h>
 #include <hurd/hurd_types.h>
 #include <hurd/store.h>
+#include <hurd/slab.h>
 #include "default_pager_U.h"
 #include "libdiskfs/fs_S.h"
 
@@ -43,20 +44,23 @@ struct node *all_nodes;
 static size_t all_nodes_nr_items;
 pthread_rwlock_t all_nodes_lock = PTHREAD_RWLOCK_INITIALIZER;
 
+static struct hurd_slab_space disknode_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct disknode, NULL, NULL, NULL, NULL, NULL);
+
 error_t
 diskfs_alloc_node (struct node *dp, mode_t mode, struct node **npp)
 {
   struct disknode *dn;
 
-  dn = calloc (1, sizeof *dn);
-  if (dn == 0)
+  if (hurd_slab_alloc (&disknode_space, (void **) &dn))
     return ENOSPC;
+  memset (dn, 0, sizeof *dn);
 
   if (round_page (get_used () + sizeof *dn) / vm_page_size
       > tmpfs_page_limit)
     {
       pthread_rwlock_unlock (&all_nodes_lock);
-      free (dn);
+      hurd_slab_dealloc (&disknode_space, dn);
       return ENOSPC;
     }
   dn->gen = gen++;
@@ -78,13 +82,17 @@ diskfs_free_node (struct node *np, mode_t mode)
        * will get SIGBUS.  */
 	vm_deallocate (mach_task_self (), np->dn->u.reg.memref, 4096);
 	mach_port_deallocate (mach_task_self (), np->dn->u.reg.memobj);
+	if (np->dn->u.reg.ro_memobj != MACH_PORT_NULL)
+	  mach_port_deallocate (mach_task_self (), np->dn->u.reg.ro_memobj);
       }	
       break;
     case DT_DIR:
       assert_backtrace (np->dn->u.dir.entries == 0);
+      if (np->dn->u.dir.names)
+	hurd_ihash_free (np->dn->u.dir.names);
       break;
     case DT_LNK:
-      free (np->dn->u.lnk);
+      tmpfs_free (np->dn->u.lnk, np->dn_stat.st_size + 1);
       break;
     }
 
@@ -95,7 +103,7 @@ diskfs_free_node (struct node *np, mode_t mode)
   all_nodes_nr_items -= 1;
   pthread_rwlock_unlock (&all_nodes_lock);
 
-  free (np->dn);
+  hurd_slab_dealloc (&disknode_space, np->dn);
   np->dn = 0;
 
   __atomic_sub_fetch (&num_files, 1, __ATOMIC_RELAXED);
@@ -387,7 +395,7 @@ create_symlink_hook (struct node *np, const char *target)
   if (np->dn_stat.st_size > 0)
     {
       const size_t size = np->dn_stat.st_size + 1;
-      np->dn->u.lnk = malloc (size);
+      np->dn->u.lnk = tmpfs_alloc (size);
       if (np->dn->u.lnk == 0)
 	return ENOSPC;
       memcpy (np->dn->u.lnk, target, size);
@@ -437,7 +445,7 @@ diskfs_truncate (struct node *np, off_t size)
 {
   if (np->dn->type == DT_LNK)
     {
-      free (np->dn->u.lnk);
+      tmpfs_free (np->dn->u.lnk, np->dn_stat.st_size + 1);
       adjust_used (size - np->dn_stat.st_size);
       np->dn->u.lnk = 0;
       np->dn_stat.st_size = size;
@@ -567,24 +575,31 @@ diskfs_get_filemap (struct node *np, vm_prot_t prot)
     right = np->dn->u.reg.memobj;
   else
     {
-      vm_offset_t offset = 0;
-      vm_offset_t start = 0;
-      vm_size_t len = ~0;
-      err = memory_object_create_proxy (mach_task_self (),
-                                        VM_PROT_READ | VM_PROT_EXECUTE,
-                                        &np->dn->u.reg.memobj,
-                                        MACH_MSG_TYPE_COPY_SEND, 1,
-                                        &offset, 1, &start, 1, &len, 1,
-                                        &right);
-      if (err)
-        {
-          errno = err;
-          return MACH_PORT_NULL;
-        }
+      /* Every read of the file comes here, so the read-only proxy is
+	 made once and kept along with the object.  */
+      if (np->dn->u.reg.ro_memobj == MACH_PORT_NULL)
+	{
+	  vm_offset_t offset = 0;
+	  vm_offset_t start = 0;
+	  vm_size_t len = ~0;
+	  err = memory_object_create_proxy (mach_task_self (),
+					    VM_PROT_READ | VM_PROT_EXECUTE,
+					    &np->dn->u.reg.memobj,
+					    MACH_MSG_TYPE_COPY_SEND, 1,
+					    &offset, 1, &start, 1, &len, 1,
+					    &np->dn->u.reg.ro_memobj);
+	  if (err)
+	    {
+	      np->dn->u.reg.ro_memobj = MACH_PORT_NULL;
+	      errno = err;
+	      return MACH_PORT_NULL;
+	    }
+	}
+      right = np->dn->u.reg.ro_memobj;
     }
 
   /* Add a reference for each call, the caller will deallocate it.  */
-  err = mach_port_mod_refs (mach_task_self (), np->dn->u.reg.memobj,
+  err = mach_port_mod_refs (mach_task_self (), right,
 			    MACH_PORT_RIGHT_SEND, +1);
   assert_perror_backtrace (err);
 
@@ -21,6 +21,7 @@ the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 #define _tmpfs_h 1
 
 #include <hurd/diskfs.h>
+#include <hurd/ihash.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <stdint.h>
@@ -53,6 +54,10 @@ struct disknode
     struct
     {
       struct tmpfs_dirent *entries;
+      struct tmpfs_dirent **tail; /* Where to link the next entry; if null,
+				     ENTRIES.  */
+      unsigned int count;	/* Number of entries.  */
+      hurd_ihash_t names;	/* Entries by name, once there are many.  */
       struct disknode *dotdot;
     } dir;
     dev_t chr, blk;
@@ -63,12 +68,18 @@ struct disknode
 
 struct tmpfs_dirent
 {
-  struct tmpfs_dirent *next;
+  struct tmpfs_dirent *next, **prevp;
+  hurd_ihash_locp_t locp;	/* In the directory's names, if any.  */
   struct disknode *dn;
   uint8_t namelen;
   char name[0];
 };
 
+/* Allocate SIZE bytes for a directory entry or a symlink target, and
+   free them.  */
+void *tmpfs_alloc (size_t size);
+void tmpfs_free (void *p, size_t size);
+
 extern off_t tmpfs_page_limit;
 extern mach_port_t default_pager;
 
@@ -50,6 +50,8 @@ struct netnode
 {
   hurd_ihash_locp_t idport_locp;/* easy removal pointer in idport ihash */
   mach_port_t idport;		/* port from io_identity */
+  mach_port_t fsidport;		/* the rest of what io_identity returned, */
+  ino_t fileno;			/* which we give out for our own */
   int openmodes;		/* O_READ | O_WRITE | O_EXEC */
   file_t file;			/* port on real file */
 
@@ -62,20 +64,48 @@ struct netnode
 #define FAKE_MODE	(1 << 3)
 #define FAKE_DEFAULT	(1 << 4)
 
-pthread_mutex_t idport_ihash_lock = PTHREAD_MUTEX_INITIALIZER;
-struct hurd_ihash idport_ihash
-= HURD_IHASH_INITIALIZER (sizeof (struct node)
-			  + offsetof (struct netnode, idport_locp));
+/* Number of shards of the table of nodes by idport; a power of two.
+   Every lookup through us goes through the table, so parallel lookups of
+   unrelated files should not wait for one another's lock.  */
+#define IDPORT_SHARDS	16
 
+struct idport_shard
+  {
+    pthread_mutex_t lock;
+    struct hurd_ihash ihash;
+  } __attribute__ ((aligned (64)));
 
-/* Make a new virtual node.  Always consumes the ports.  If
-   successful, NP will be locked.  */
+static struct idport_shard idport_shards[IDPORT_SHARDS] =
+  {
+    [0 ... IDPORT_SHARDS - 1] =
+      {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ihash = HURD_IHASH_INITIALIZER (sizeof (struct node)
+					 + offsetof (struct netnode,
+						     idport_locp)),
+      }
+  };
+
+/* The low bits of a name are a generation count; pick the shard by the
+   index.  */
+static inline struct idport_shard *
+idport_shard (mach_port_t idport)
+{
+  return &idport_shards[MACH_PORT_INDEX (idport) & (IDPORT_SHARDS - 1)];
+}
+
+
+/* Make a new virtual node.  Always consumes the ports.  IDPORT, FSIDPORT
+   and FILENO are what io_identity returns for FILE, or MACH_PORT_NULL if
+   that is yet to be called.  If LOCKED, the shard of IDPORT is locked.
+   If successful, NP will be locked.  */
 static error_t
-new_node (file_t file, mach_port_t idport, int locked, int openmodes,
-	  struct node **np)
+new_node (file_t file, mach_port_t idport, mach_port_t fsidport,
+	  ino_t fileno, int locked, int openmodes, struct node **np)
 {
   error_t err;
   struct netnode *nn;
+  struct idport_shard *shard;
 
   assert_backtrace ((openmodes & ~(O_RDWR|O_EXEC)) == 0);
 
@@ -84,22 +114,27 @@ new_node (file_t file, mach_port_t idport, int locked, int openmodes,
     {
       mach_port_deallocate (mach_task_self (), file);
       if (idport != MACH_PORT_NULL)
-	mach_port_deallocate (mach_task_self (), idport);
+	{
+	  mach_port_deallocate (mach_task_self (), idport);
+	  mach_port_deallocate (mach_task_self (), fsidport);
+	}
       if (locked)
-	pthread_mutex_unlock (&idport_ihash_lock);
+	pthread_mutex_unlock (&idport_shard (idport)->lock);
       return ENOMEM;
     }
   nn = netfs_node_netnode (*np);
   nn->file = file;
   nn->openmodes = openmodes;
   if (idport != MACH_PORT_NULL)
-    nn->idport = idport;
+    {
+      nn->idport = idport;
+      nn->fsidport = fsidport;
+      nn->fileno = fileno;
+    }
   else
     {
-      ino_t fileno;
-      mach_port_t fsidport;
       assert_backtrace (!locked);
-      err = io_identity (file, &nn->idport, &fsidport, &fileno);
+      err = io_identity (file, &nn->idport, &nn->fsidport, &nn->fileno);
       if (err)
 	{
 	  mach_port_deallocate (mach_task_self (), file);
@@ -112,19 +147,21 @@ new_node (file_t file, mach_port_t idport, int locked, int openmodes,
   /* The light reference allows us to safely keep the node in the
      hash table.  */
   netfs_nref_light (*np);
+  shard = idport_shard (nn->idport);
   if (!locked)
-    pthread_mutex_lock (&idport_ihash_lock);
-  err = hurd_ihash_add (&idport_ihash, nn->idport, *np);
+    pthread_mutex_lock (&shard->lock);
+  err = hurd_ihash_add (&shard->ihash, nn->idport, *np);
   if (err)
     goto lose;
 
   pthread_mutex_lock (&(*np)->lock);
-  pthread_mutex_unlock (&idport_ihash_lock);
+  pthread_mutex_unlock (&shard->lock);
   return 0;
 
  lose:
-  pthread_mutex_unlock (&idport_ihash_lock);
+  pthread_mutex_unlock (&shard->lock);
   mach_port_deallocate (mach_task_self (), nn->idport);
+  mach_port_deallocate (mach_task_self (), nn->fsidport);
   mach_port_deallocate (mach_task_self (), file);
   free (*np);
   *np = NULL;
@@ -163,11 +200,12 @@ void
 netfs_try_dropping_softrefs (struct node *np)
 {
   /* We have to drop our light reference by removing the node from the
-     idport_ihash hash table.  */
-  pthread_mutex_lock (&idport_ihash_lock);
+     idport hash table.  */
+  struct idport_shard *shard = idport_shard (netfs_node_netnode (np)->idport);
 
-  hurd_ihash_locp_remove (&idport_ihash, netfs_node_netnode (np)->idport_locp);
-  pthread_mutex_unlock (&idport_ihash_lock);
+  pthread_mutex_lock (&shard->lock);
+  hurd_ihash_locp_remove (&shard->ihash, netfs_node_netnode (np)->idport_locp);
+  pthread_mutex_unlock (&shard->lock);
 
   netfs_nrele_light (np);
 }
@@ -178,11 +216,12 @@ netfs_node_norefs (struct node *np)
 {
   pthread_mutex_unlock (&np->lock);
 
-  /* NP was already removed from idport_ihash through
+  /* NP was already removed from the idport hash table through
      netfs_try_dropping_softrefs.  */
 
   mach_port_deallocate (mach_task_self (), netfs_node_netnode (np)->file);
   mach_port_deallocate (mach_task_self (), netfs_node_netnode (np)->idport);
+  mach_port_deallocate (mach_task_self (), netfs_node_netnode (np)->fsidport);
   free (np);
 }
 
@@ -297,6 +336,7 @@ netfs_S_dir_lookup (struct protid *diruser,
   mach_port_t file;
   mach_port_t idport, fsidport;
   ino_t fileno;
+  struct idport_shard *shard;
 
   if (!diruser)
     return EOPNOTSUPP;
@@ -429,12 +469,12 @@ netfs_S_dir_lookup (struct protid *diruser,
       return err;
     }
 
-  mach_port_deallocate (mach_task_self (), fsidport);
+  shard = idport_shard (idport);
 
  redo_hash_lookup:
-  pthread_mutex_lock (&idport_ihash_lock);
+  pthread_mutex_lock (&shard->lock);
   pthread_mutex_lock (&dnp->lock);
-  np = hurd_ihash_find (&idport_ihash, idport);
+  np = hurd_ihash_find (&shard->ihash, idport);
   if (np != NULL)
     {
       /* We quickly check that NP has hard references. If the node is being
@@ -449,7 +489,7 @@ netfs_S_dir_lookup (struct protid *diruser,
 	  /* If so, unlock the hash table to give the node a chance to actually
 	     be removed and retry.  */
 	  pthread_mutex_unlock (&dnp->lock);
-	  pthread_mutex_unlock (&idport_ihash_lock);
+	  pthread_mutex_unlock (&shard->lock);
 	  goto redo_hash_lookup;
 	}
 
@@ -457,6 +497,7 @@ netfs_S_dir_lookup (struct protid *diruser,
       netfs_nref (np);
 
       mach_port_deallocate (mach_task_self (), idport);
+      mach_port_deallocate (mach_task_self (), fsidport);
 
       if (np == dnp)
 	{
@@ -470,11 +511,12 @@ netfs_S_dir_lookup (struct protid *diruser,
 
       err = check_openmodes (netfs_node_netnode (np),
 			     (flags & (O_RDWR|O_EXEC)), file);
-      pthread_mutex_unlock (&idport_ihash_lock);
+      pthread_mutex_unlock (&shard->lock);
     }
   else
     {
-      err = new_node (file, idport, 1, flags & (O_RDWR|O_EXEC), &np);
+      err = new_node (file, idport, fsidport, fileno, 1,
+		      flags & (O_RDWR|O_EXEC), &np);
       pthread_mutex_unlock (&dnp->lock);
       if (!err)
 	{
@@ -805,7 +847,8 @@ netfs_attempt_mkfile (struct iouser *user, struct node *dir,
 			    real_mode, &newfile);
   pthread_mutex_unlock (&dir->lock);
   if (err == 0)
-    err = new_node (newfile, MACH_PORT_NULL, 0, O_RDWR|O_EXEC, np);
+    err = new_node (newfile, MACH_PORT_NULL, MACH_PORT_NULL, 0, 0,
+		    O_RDWR|O_EXEC, np);
   if (err == 0)
     {
       pthread_mutex_unlock (&(*np)->lock);
@@ -1064,18 +1107,16 @@ netfs_S_io_identity (struct protid *user,
 		     mach_msg_type_name_t *fsystype,
 		     ino_t *fileno)
 {
-  error_t err;
-
   if (!user)
     return EOPNOTSUPP;
 
-  *idtype = *fsystype = MACH_MSG_TYPE_MOVE_SEND;
-
-  pthread_mutex_lock (&user->po->np->lock);
-  err = io_identity (netfs_node_netnode (user->po->np)->file,
-		     id, fsys, fileno);
-  pthread_mutex_unlock (&user->po->np->lock);
-  return err;
+  /* The identity of the underlying file is known since the node was
+     made, and never changes; give it out without asking again.  */
+  *idtype = *fsystype = MACH_MSG_TYPE_COPY_SEND;
+  *id = netfs_node_netnode (user->po->np)->idport;
+  *fsys = netfs_node_netnode (user->po->np)->fsidport;
+  *fileno = netfs_node_netnode (user->po->np)->fileno;
+  return 0;
 }
 
 #define NETFS_S_SIMPLE(name)			\
@@ -1221,8 +1262,8 @@ any user to open nodes regardless of permissions as is done for root." };
 
   /* Get our underlying node (we presume it's a directory) and use
      that to make the root node of the filesystem.  */
-  err = new_node (netfs_startup (bootstrap, O_READ), MACH_PORT_NULL, 0, O_READ,
-		  &netfs_root_node);
+  err = new_node (netfs_startup (bootstrap, O_READ), MACH_PORT_NULL,
+		  MACH_PORT_NULL, 0, 0, O_READ, &netfs_root_node);
   if (err)
     error (5, err, "Cannot create root node");
 
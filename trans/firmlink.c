@@ -27,7 +27,6 @@
 #include <argp.h>
 #include <argz.h>
 #include <error.h>
-#include <sys/mman.h>
 
 #include <hurd/trivfs.h>
 
@@ -223,16 +222,9 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 	return EINVAL;
       if (start + amount > max)
 	amount = max - start;
-      if (amount > *data_len)
-	*data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-      err = (*data == MAP_FAILED) ? errno : 0;
-      if (!err && amount > 0)
-	{
-	  memcpy (*data, target + start, amount);
-	  if (offs < 0)
-	    cred->po->hook = (void *)(start + amount); /* Update PO offset.  */
-	}
-      *data_len = amount;
+      err = trivfs_reply_data_copy (data, data_len, target + start, amount);
+      if (!err && amount > 0 && offs < 0)
+	cred->po->hook = (void *)(start + amount); /* Update PO offset.  */
     }
 
   return err;
@@ -25,7 +25,6 @@
 #include <error.h>
 #include <string.h>
 #include <fcntl.h>
-#include <sys/mman.h>
 
 #include <version.h>
 
@@ -139,16 +138,12 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 
   if (amount > 0)
     {
-      /* Possibly allocate a new buffer. */
-      if (*data_len < amount)
-	{
-	  *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (*data == MAP_FAILED)
-	    return ENOMEM;
-	}
-
-      /* Copy the constant data into the buffer. */
-      memcpy ((char *) *data, contents + offs, amount);
+      /* Copy the constant data into a buffer, which is allocated if
+	 the one we were passed is too small. */
+      error_t err = trivfs_reply_data_copy (data, data_len,
+					    contents + offs, amount);
+      if (err)
+	return err;
 
       /* Update the saved offset. */
       op->offs += amount;
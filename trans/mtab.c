@@ -33,14 +33,15 @@
 #include "fsys_U.h"
 #endif
 #include <inttypes.h>
+#include <mach/notify.h>
 #include <mntent.h>
 #include <nullauth.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <version.h>
 
@@ -53,6 +54,10 @@ static char *target_path = NULL;
 #define MAX_DEPTH	10
 static int max_depth = MAX_DEPTH;
 
+/* How many seconds the generated contents are reused for.  */
+#define CACHE_TIMEOUT	5
+static int cache_timeout = CACHE_TIMEOUT;
+
 /* Our control port.  */
 struct trivfs_control *control;
 
@@ -66,6 +71,20 @@ struct mtab
   off_t offs;
   struct hurd_ihash ports_seen;
 };
+
+/* The contents last generated, which are handed out to the following
+   opens without walking the translators again.  Its ports_seen keeps
+   the control ports of the translators it describes, for which we have
+   dead-name notifications; one going away makes the cache stale.  There
+   is no such thing for a new translator attaching, so the cache also
+   goes stale after CACHE_TIMEOUT seconds.  */
+static struct mtab cache =
+  {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ports_seen = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP),
+  };
+static int cache_valid;
+static struct timespec cache_stamp;
 
 const char *argp_program_version = STANDARD_HURD_VERSION (mtab);
 
@@ -73,6 +92,9 @@ static const struct argp_option options[] =
 {
   {"depth", 'd', "DEPTH", 0,
    "Maximum depth to traverse"},
+  {"cache-timeout", 't', "SECONDS", 0,
+   "Reuse the contents for SECONDS, unless a translator goes away"
+   " (default 5; 0 disables the cache)"},
   {}
 };
 
@@ -88,6 +110,15 @@ error_t parse_opt (int key, char *arg, struct argp_state *state)
         argp_error (state, "Could not parse depth '%s'.", arg);
       break;
 
+    case 't':
+      cache_timeout = strtoul (arg, &end, 10);
+      if (arg == end || end[0] != 0)
+        argp_error (state, "Could not parse timeout '%s'.", arg);
+      pthread_mutex_lock (&cache.lock);
+      cache_valid = 0;
+      pthread_mutex_unlock (&cache.lock);
+      break;
+
     case ARGP_KEY_ARG:
       target_path = realpath (arg, NULL);
       if (! target_path)
@@ -133,6 +164,18 @@ trivfs_append_args (struct trivfs_control *fsys,
 	return err;
     }
 
+  if (cache_timeout != CACHE_TIMEOUT)
+    {
+      char *arg;
+      if (asprintf (&arg, "--cache-timeout=%d", cache_timeout) < 0)
+        return errno;
+
+      err = argz_add (argz, argz_len, arg);
+      free (arg);
+      if (err)
+	return err;
+    }
+
   err = argz_add (argz, argz_len, target_path);
   return err;
 }
@@ -506,6 +549,69 @@ mtab_populate (struct mtab *mtab, const char *path, mach_port_t control,
   return err;
 }
 
+/* Forget the contents of the cache, and the ports it kept.  */
+/* Be careful that the lock of the cache is already locked.  */
+static void
+cache_drop (void)
+{
+  free (cache.contents);
+  cache.contents = NULL;
+  cache.contents_len = 0;
+  HURD_IHASH_ITERATE (&cache.ports_seen, p)
+    mach_port_deallocate (mach_task_self (), (mach_port_t)(uintptr_t) p);
+  hurd_ihash_destroy (&cache.ports_seen);
+  hurd_ihash_init (&cache.ports_seen, HURD_IHASH_NO_LOCP);
+  cache_valid = 0;
+}
+
+/* Populate MTAB with the contents of the cache, generating them
+   first if they are stale.  */
+static error_t
+mtab_fill (struct mtab *mtab)
+{
+  error_t err = 0;
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock (&cache.lock);
+  if (! cache_valid || now.tv_sec - cache_stamp.tv_sec >= cache_timeout)
+    {
+      cache_drop ();
+      err = mtab_populate (&cache, target_path, target_control, max_depth);
+      if (err)
+	{
+	  cache_drop ();
+	  goto out;
+	}
+
+      HURD_IHASH_ITERATE (&cache.ports_seen, p)
+	ports_request_dead_name_notification (&control->pi,
+					      (mach_port_t)(uintptr_t) p,
+					      NULL);
+      cache_stamp = now;
+      cache_valid = 1;
+    }
+
+  err = mtab_add_entry (mtab, cache.contents ?: "", cache.contents_len);
+
+ out:
+  pthread_mutex_unlock (&cache.lock);
+  return err;
+}
+
+/* A translator we have looked at went away.  */
+void
+ports_dead_name (void *notify, mach_port_t dead_name)
+{
+  pthread_mutex_lock (&cache.lock);
+  if (hurd_ihash_find (&cache.ports_seen, (hurd_ihash_key_t) dead_name))
+    cache_valid = 0;
+  pthread_mutex_unlock (&cache.lock);
+
+  ports_interrupt_notified_rpcs (notify, dead_name, MACH_NOTIFY_DEAD_NAME);
+}
+
 /* Decodes the DEVICE string into appropriate OPTIONS.  Currently only
    tmpfs-style size declarations are supported.  */
 error_t
@@ -676,7 +782,7 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 
   if (op->contents == NULL)
     {
-      err = mtab_populate (op, target_path, target_control, max_depth);
+      err = mtab_fill (op);
       if (err)
 	goto out;
     }
@@ -692,19 +798,11 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 
   if (amount > 0)
     {
-      /* Possibly allocate a new buffer.  */
-      if (*data_len < amount)
-	{
-	  *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (*data == MAP_FAILED)
-	    {
-	      err = ENOMEM;
-	      goto out;
-	    }
-	}
-
-      /* Copy the constant data into the buffer.  */
-      memcpy ((char *) *data, op->contents + offs, amount);
+      /* Copy the constant data into a buffer.  */
+      err = trivfs_reply_data_copy (data, data_len,
+				    op->contents + offs, amount);
+      if (err)
+	goto out;
 
       /* Update the saved offset.  */
       op->offs += amount;
@@ -732,7 +830,7 @@ trivfs_S_io_seek (struct trivfs_protid *cred,
 
   if (op->contents == NULL)
     {
-      err = mtab_populate (op, target_path, target_control, max_depth);
+      err = mtab_fill (op);
       if (err)
 	goto out;
     }
@@ -789,7 +887,7 @@ trivfs_S_io_readable (struct trivfs_protid *cred,
 
   if (op->contents == NULL)
     {
-      error_t err = mtab_populate (op, target_path, target_control, max_depth);
+      err = mtab_fill (op);
       if (err)
 	goto out;
     }
@@ -87,6 +87,10 @@ pool_initialize (void)
     error (1, err, "Failed to map time device");
 }
 
+/* Bumped whenever data is mixed into the pool, so that the generators
+   know to reseed.  */
+static unsigned int pool_generation;
+
 /* Mix data into the pool.  */
 static void
 pool_add_entropy (const void *buffer, size_t length)
@@ -94,6 +98,7 @@ pool_add_entropy (const void *buffer, size_t length)
   pthread_mutex_lock (&pool_lock);
   gcry_md_write (pool, buffer, length);
   pthread_mutex_unlock (&pool_lock);
+  __atomic_add_fetch (&pool_generation, 1, __ATOMIC_RELAXED);
 }
 
 /* Extract data from the pool.  */
@@ -112,6 +117,195 @@ pool_randomize (void *buffer, size_t length)
   return cerr ? EIO : 0;
 }
 
+
+/* Reads are not served from the pool, for its lock would serialize
+   them, but by a generator of their thread's own, seeded from the pool.
+   It is a fast-key-erasure generator: each use of its ChaCha20 key
+   replaces the key with the first bytes of the keystream, and the
+   bytes handed out are wiped from its buffer, so nothing left in memory
+   tells what was read before.  It is reseeded when new data has been
+   mixed into the pool, which the gathering thread does every second or
+   two, and after GEN_RESEED_BYTES bytes.  */
+
+/* The size of a ChaCha20 key.  */
+#define GEN_KEY_SIZE		32
+
+/* The output kept for small reads.  Larger ones are generated in
+   place.  */
+#define GEN_BUFFER_SIZE		512
+
+#define GEN_RESEED_BYTES	(1024 * 1024)
+
+struct generator
+{
+  gcry_cipher_hd_t cipher;
+  unsigned char key[GEN_KEY_SIZE];
+
+  /* The pool_generation when last reseeded.  */
+  unsigned int generation;
+
+  /* Bytes handed out since.  */
+  size_t output;
+
+  /* The bytes at the end of BUFFER not handed out yet.  */
+  size_t avail;
+  unsigned char buffer[GEN_BUFFER_SIZE];
+};
+
+static __thread struct generator *thread_generator;
+
+/* Destroys the generator of an exiting thread.  */
+static pthread_key_t generator_key;
+static pthread_once_t generator_key_once = PTHREAD_ONCE_INIT;
+
+static void
+generator_destroy (void *arg)
+{
+  struct generator *g = arg;
+
+  gcry_cipher_close (g->cipher);
+  explicit_bzero (g, sizeof *g);
+  free (g);
+}
+
+static void
+make_generator_key (void)
+{
+  pthread_key_create (&generator_key, generator_destroy);
+}
+
+/* Fill BUFFER with LENGTH bytes of the keystream of the key of G,
+   after replacing the key with the first bytes of that keystream.  */
+static error_t
+generator_output (struct generator *g, void *buffer, size_t length)
+{
+  static const unsigned char nonce[12];
+  gcry_error_t cerr;
+
+  cerr = gcry_cipher_setkey (g->cipher, g->key, GEN_KEY_SIZE);
+  if (! cerr)
+    cerr = gcry_cipher_setiv (g->cipher, nonce, sizeof nonce);
+  if (! cerr)
+    {
+      memset (g->key, 0, GEN_KEY_SIZE);
+      cerr = gcry_cipher_encrypt (g->cipher, g->key, GEN_KEY_SIZE, NULL, 0);
+    }
+  if (! cerr)
+    {
+      memset (buffer, 0, length);
+      cerr = gcry_cipher_encrypt (g->cipher, buffer, length, NULL, 0);
+    }
+  return cerr ? EIO : 0;
+}
+
+/* Mix fresh data from the pool into the key of G.  */
+static error_t
+generator_reseed (struct generator *g)
+{
+  unsigned char seed[GEN_KEY_SIZE];
+  unsigned int generation;
+  error_t err;
+  int i;
+
+  generation = __atomic_load_n (&pool_generation, __ATOMIC_RELAXED);
+  err = pool_randomize (seed, sizeof seed);
+  if (err)
+    return err;
+
+  for (i = 0; i < GEN_KEY_SIZE; i++)
+    g->key[i] ^= seed[i];
+  explicit_bzero (seed, sizeof seed);
+
+  /* What is left of the output of the old key goes too.  */
+  explicit_bzero (g->buffer, sizeof g->buffer);
+  g->avail = 0;
+
+  g->generation = generation;
+  g->output = 0;
+  return 0;
+}
+
+/* Return the generator of this thread, making it if needed, or NULL.  */
+static struct generator *
+generator_get (void)
+{
+  struct generator *g;
+
+  pthread_once (&generator_key_once, make_generator_key);
+
+  g = calloc (1, sizeof *g);
+  if (! g)
+    return NULL;
+
+  if (gcry_cipher_open (&g->cipher, GCRY_CIPHER_CHACHA20,
+			GCRY_CIPHER_MODE_STREAM, GCRY_CIPHER_SECURE))
+    {
+      free (g);
+      return NULL;
+    }
+
+  if (generator_reseed (g))
+    {
+      generator_destroy (g);
+      return NULL;
+    }
+
+  pthread_setspecific (generator_key, g);
+  return thread_generator = g;
+}
+
+/* Fill BUFFER with LENGTH random bytes, like pool_randomize does but
+   without taking the lock of the pool most of the time.  */
+static error_t
+generator_randomize (void *buffer, size_t length)
+{
+  struct generator *g = thread_generator;
+  error_t err;
+
+  if (! g)
+    {
+      g = generator_get ();
+      if (! g)
+	return pool_randomize (buffer, length);
+    }
+
+  if (g->generation != __atomic_load_n (&pool_generation, __ATOMIC_RELAXED)
+      || g->output >= GEN_RESEED_BYTES)
+    {
+      err = generator_reseed (g);
+      if (err)
+	return err;
+    }
+  g->output += length;
+
+  if (length > GEN_BUFFER_SIZE / 2)
+    return generator_output (g, buffer, length);
+
+  while (length > 0)
+    {
+      unsigned char *p;
+      size_t n;
+
+      if (g->avail == 0)
+	{
+	  err = generator_output (g, g->buffer, sizeof g->buffer);
+	  if (err)
+	    return err;
+	  g->avail = sizeof g->buffer;
+	}
+
+      n = length < g->avail ? length : g->avail;
+      p = g->buffer + sizeof g->buffer - g->avail;
+      memcpy (buffer, p, n);
+      explicit_bzero (p, n);
+      g->avail -= n;
+      buffer = (char *) buffer + n;
+      length -= n;
+    }
+
+  return 0;
+}
+
 
 
 /* Name of file to use as seed.  */
@@ -322,8 +516,7 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 		  off_t offs, vm_size_t amount)
 {
   error_t err;
-  void *buf = NULL;
-  size_t length = 0;
+  data_t buf = *data;
 
   if (! cred)
     return EOPNOTSUPP;
@@ -332,24 +525,12 @@ trivfs_S_io_read (struct trivfs_protid *cred,
 
   if (amount > 0)
     {
-      /* Possibly allocate a new buffer. */
-      if (*data_len < amount)
-	{
-	  *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (*data == MAP_FAILED)
-	    {
-              err = errno;
-              goto errout;
-	    }
-
-	  /* Keep track of our map in case of errors.  */
-	  buf = *data, length = amount;
-
-	  /* Update DATA_LEN to reflect the new buffers size.  */
-	  *data_len = amount;
-	}
+      /* Possibly get a new buffer. */
+      err = trivfs_get_reply_data (data, data_len, amount);
+      if (err)
+	return err;
 
-      err = pool_randomize (*data, amount);
+      err = generator_randomize (*data, amount);
       if (err)
         goto errout;
 
@@ -360,8 +541,8 @@ trivfs_S_io_read (struct trivfs_protid *cred,
   return 0;
 
  errout:
-  if (buf)
-    munmap (buf, length);
+  if (*data != buf)
+    munmap (*data, amount);
   return err;
 }
 
@@ -19,6 +19,7 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <string.h>
+#include <stdlib.h>
 #include <assert-backtrace.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -56,13 +57,18 @@ struct port_bucket *streamdev_bucket;
 struct buffer *input_buffer, *output_buffer;
 
 
-/* Information about a buffer.  */
+/* The size of the input buffer.  It is big enough to hold several
+   device reads, so that the device need not wait for the readers.  */
+#define INPUT_BUFFER_SIZE	(64 * 1024)
+
+/* Information about a buffer.  It is a ring, so that reading from it
+   never moves the rest of the data.  */
 struct buffer
 {
-  /* Point to the head of the buffer.  */
-  char *head;
-  /* Point to the tail of the buffer.  */
-  char *tail;
+  /* Offset of the first character in BUF.  */
+  size_t head;
+  /* The number of characters in the buffer.  */
+  size_t len;
   /* The buffer array size.  */
   size_t size;
   /* Wakeup when the buffer is not empty or not full.  */
@@ -77,7 +83,7 @@ create_buffer (size_t size)
 {
   struct buffer *new = malloc (sizeof (struct buffer) + size);
   assert_backtrace (new);
-  new->head = new->tail = new->buf;
+  new->head = new->len = 0;
   new->size = size;
   new->wait = malloc (sizeof (pthread_cond_t));
   assert_backtrace (new->wait);
@@ -89,7 +95,7 @@ create_buffer (size_t size)
 static inline size_t
 buffer_size (struct buffer *b)
 {
-  return b->tail - b->head;
+  return b->len;
 }
 
 /* Return how much characters can be read from B.  */
@@ -112,7 +118,7 @@ clear_buffer (struct buffer *b)
 {
   if (b == 0)
     return;
-  b->head = b->tail = b->buf;
+  b->head = b->len = 0;
   pthread_cond_broadcast (b->wait);
   pthread_cond_broadcast (&select_alert);
 }
@@ -122,21 +128,20 @@ static inline size_t
 buffer_read (struct buffer *b, void *data, size_t len)
 {
   size_t max = buffer_size (b);
+  size_t first;
 
   if (len > max)
     len = max;
 
-  memcpy (data, b->head, len);
-  b->head += len;
+  /* The data may wrap around the end of the array.  */
+  first = b->size - b->head;
+  if (first > len)
+    first = len;
+  memcpy (data, b->buf + b->head, first);
+  memcpy (data + first, b->buf, len - first);
 
-  if (b->head > b->buf + b->size / 2)
-    {
-      size_t size = buffer_size (b);
-
-      memmove (b->buf, b->head, size);
-      b->head = b->buf;
-      b->tail = b->buf + size;
-    }
+  b->head = (b->head + len) % b->size;
+  b->len -= len;
 
   pthread_cond_broadcast (b->wait);
   pthread_cond_broadcast (&select_alert);
@@ -148,12 +153,18 @@ static inline size_t
 buffer_write (struct buffer *b, const void *data, size_t len)
 {
   size_t size = buffer_writable (b);
+  size_t tail, first;
 
   if (len > size)
     len = size;
 
-  memcpy (b->tail, data, len);
-  b->tail += len;
+  tail = (b->head + b->len) % b->size;
+  first = b->size - tail;
+  if (first > len)
+    first = len;
+  memcpy (b->buf + tail, data, first);
+  memcpy (b->buf, data + first, len - first);
+  b->len += len;
 
   pthread_cond_broadcast (b->wait);
   pthread_cond_broadcast (&select_alert);
@@ -315,7 +326,7 @@ main (int argc, char *argv[])
   pthread_cond_init (&select_alert, NULL);
 
   if (trivfs_allow_open & O_READ)
-    input_buffer = create_buffer (256);
+    input_buffer = create_buffer (INPUT_BUFFER_SIZE);
   if (trivfs_allow_open & O_WRITE)
     output_buffer = create_buffer (256);
 
@@ -765,8 +776,41 @@ trivfs_append_args (struct trivfs_control *fsys,
 /* This flag is set if there is an outstanding device_write.  */
 static int output_pending;
 
-/* This flag is set if there is an outstanding device_read.  */
-static int input_pending;
+/* The most device_reads we have outstanding at once.  */
+#define READS_MAX	4
+
+/* An outstanding device_read.  Each has its own reply port: the replies
+   are handled by several threads, and would otherwise be put in the
+   input buffer in whatever order those get the global lock.  */
+struct read_request
+{
+  struct port_info *pi;
+  mach_port_t port;
+  /* Set while the device_read is outstanding.  */
+  int pending;
+  /* Set if the reply came, but earlier requests are still outstanding.
+     The reply is then kept in ERR, DATA and LEN.  */
+  int done;
+  /* The space reserved in the input buffer for the reply.  */
+  size_t amount;
+  error_t err;
+  void *data;
+  size_t len;
+  /* Set if DATA is out-of-line memory rather than malloced.  */
+  int ool;
+};
+
+static struct read_request reads[READS_MAX];
+
+/* The oldest outstanding request, and how many there are.  */
+static int reads_first;
+static int reads_pending;
+
+/* The space in the input buffer reserved for outstanding requests.  */
+static size_t input_reserved;
+
+/* This flag is set if the device does not take out-of-line reads.  */
+static int reads_inband_only;
 
 /* This flag is set if there is an outstanding device_open.  */
 static int open_pending;
@@ -800,6 +844,66 @@ static size_t dev_blksize;
 static size_t dev_size;
 
 
+/* Drop the reply ports of the device_reads, and whatever replies they
+   hold.  */
+/* Be careful that the global lock is already locked.  */
+static void
+destroy_read_ports (void)
+{
+  int i;
+
+  for (i = 0; i < READS_MAX; i++)
+    {
+      struct read_request *r = &reads[i];
+
+      if (r->done && r->data)
+	{
+	  if (r->ool)
+	    vm_deallocate (mach_task_self (), (vm_address_t) r->data, r->len);
+	  else
+	    free (r->data);
+	}
+      if (r->pi)
+	{
+	  mach_port_deallocate (mach_task_self (), r->port);
+	  ports_port_deref (r->pi);
+	}
+      memset (r, 0, sizeof *r);
+    }
+
+  reads_first = reads_pending = 0;
+  input_reserved = 0;
+}
+
+/* Make the reply ports of the device_reads.  */
+/* Be careful that the global lock is already locked.  */
+static error_t
+create_read_ports (void)
+{
+  error_t err;
+  int i;
+
+  for (i = 0; i < READS_MAX; i++)
+    {
+      struct read_request *r = &reads[i];
+
+      err = ports_create_port (phys_reply_class, streamdev_bucket,
+			       sizeof (struct port_info), &r->pi);
+      if (err)
+	{
+	  r->pi = 0;
+	  destroy_read_ports ();
+	  return err;
+	}
+
+      r->port = ports_get_right (r->pi);
+      mach_port_insert_right (mach_task_self (), r->port, r->port,
+			      MACH_MSG_TYPE_MAKE_SEND);
+    }
+
+  return 0;
+}
+
 /* Open a new device structure for the device NAME with MODE. If an error
    occurs, the error code is returned, otherwise 0.  */
 /* Be careful that the global lock is already locked.  */
@@ -826,6 +930,20 @@ dev_open (const char *name, dev_mode_t mode)
   mach_port_insert_right (mach_task_self (), phys_reply, phys_reply,
 			  MACH_MSG_TYPE_MAKE_SEND);
 
+  if (input_buffer)
+    {
+      err = create_read_ports ();
+      if (err)
+	{
+	  mach_port_deallocate (mach_task_self (), phys_reply);
+	  phys_reply = MACH_PORT_NULL;
+	  ports_port_deref (phys_reply_pi);
+	  phys_reply_pi = 0;
+	  mach_port_deallocate (mach_task_self (), device_master);
+	  return err;
+	}
+    }
+
   if (output_buffer)
     {
       err = ports_create_port (phys_reply_class, streamdev_bucket,
@@ -837,6 +955,7 @@ dev_open (const char *name, dev_mode_t mode)
 	  phys_reply = MACH_PORT_NULL;
 	  ports_port_deref (phys_reply_pi);
 	  phys_reply_pi = 0;
+	  destroy_read_ports ();
 	  mach_port_deallocate (mach_task_self (), device_master);
 	  return err;
 	}
@@ -853,6 +972,7 @@ dev_open (const char *name, dev_mode_t mode)
       phys_reply = MACH_PORT_NULL;
       ports_port_deref (phys_reply_pi);
       phys_reply_pi = 0;
+      destroy_read_ports ();
       if (output_buffer)
 	{
 	  mach_port_deallocate (mach_task_self (), phys_reply_writes);
@@ -951,7 +1071,7 @@ dev_close (void)
   ports_port_deref (phys_reply_pi);
   phys_reply_pi = 0;
   clear_buffer (input_buffer);
-  input_pending = 0;
+  destroy_read_ports ();
 
   if (output_buffer)
     {
@@ -965,34 +1085,167 @@ dev_close (void)
     }
 }
 
+/* Start as many device_reads as there is room for in the input buffer.
+   If NOWAIT is non-zero, start only one, which does not wait for input.  */
 /* Be careful that the global lock is already locked.  */
 static error_t
 start_input (int nowait)
 {
-  int size;
   error_t err;
-  size_t amount;
 
-  size = buffer_writable (input_buffer);
+  while (reads_pending < (nowait ? 1 : READS_MAX))
+    {
+      struct read_request *r;
+      size_t amount;
+      int inband;
+
+      amount = buffer_writable (input_buffer) - input_reserved;
+      if (amount > INPUT_BUFFER_SIZE / READS_MAX)
+	amount = INPUT_BUFFER_SIZE / READS_MAX;
+
+      /* Only bother with out-of-line memory for more than fits in the
+	 message.  */
+      inband = reads_inband_only || amount <= IO_INBAND_MAX;
+      if (inband && amount > IO_INBAND_MAX)
+	amount = IO_INBAND_MAX;
+
+      if (dev_blksize != 1)
+	amount = amount / dev_blksize * dev_blksize;
+      if (amount < dev_blksize)
+	return 0;
 
-  if (size < dev_blksize || input_pending)
-    return 0;
+      r = &reads[(reads_first + reads_pending) % READS_MAX];
+      assert_backtrace (!r->pending && !r->done);
 
-  amount = vm_page_size;
-  if (dev_blksize != 1)
-    amount = amount / dev_blksize * dev_blksize;
+      if (inband)
+	err = device_read_request_inband (phys_device, r->port,
+					  nowait? D_NOWAIT : 0,
+					  0, amount);
+      else
+	err = device_read_request (phys_device, r->port,
+				   nowait? D_NOWAIT : 0,
+				   0, amount);
+      if (err == D_WOULD_BLOCK)
+	return 0;
+      if (err)
+	{
+	  dev_close ();
+	  return err;
+	}
 
-  err = device_read_request_inband (phys_device, phys_reply,
-				    nowait? D_NOWAIT : 0,
-				    0, amount);
-  if (err == D_WOULD_BLOCK)
-    err = 0;
-  if (err)
-    dev_close ();
-  else
-    input_pending = 1;
+      r->pending = 1;
+      r->amount = amount;
+      input_reserved += amount;
+      reads_pending++;
+    }
 
-  return err;
+  return 0;
+}
+
+/* Put the replies that came for the oldest requests in the input
+   buffer, in the order the requests were made.  */
+/* Be careful that the global lock is already locked.  */
+static void
+finish_input (void)
+{
+  while (reads_pending && reads[reads_first].done)
+    {
+      struct read_request *r = &reads[reads_first];
+      error_t rerr = r->err;
+      size_t len = r->len;
+
+      if (r->data)
+	{
+	  buffer_write (input_buffer, r->data, len);
+	  if (r->ool)
+	    vm_deallocate (mach_task_self (), (vm_address_t) r->data, len);
+	  else
+	    free (r->data);
+	  r->data = NULL;
+	}
+      input_reserved -= r->amount;
+      r->done = 0;
+      reads_first = (reads_first + 1) % READS_MAX;
+      reads_pending--;
+
+      /* A read with D_NOWAIT which found nothing, or an out-of-line read
+	 the device refused; neither is the end of the file.  */
+      if (rerr == D_WOULD_BLOCK)
+	continue;
+
+      if (rerr || len == 0)
+	{
+	  err = rerr;
+	  if (!err)
+	    eof = 1;
+	  dev_close ();
+	  return;
+	}
+    }
+}
+
+/* Take the reply to the device_read with the reply port REPLY, with
+   ERRORCODE and LEN bytes of DATA.  If OOL, DATA is out-of-line memory,
+   which is consumed.  */
+static kern_return_t
+read_reply (mach_port_t reply, kern_return_t errorcode,
+	    void *data, size_t len, int ool)
+{
+  struct read_request *r;
+  int i;
+
+  pthread_mutex_lock (&global_lock);
+
+  for (i = 0; i < READS_MAX; i++)
+    if (reads[i].pending && reads[i].port == reply)
+      break;
+  if (i == READS_MAX)
+    {
+      pthread_mutex_unlock (&global_lock);
+      return EOPNOTSUPP;
+    }
+
+  r = &reads[i];
+  r->pending = 0;
+  r->done = 1;
+  r->err = errorcode;
+  r->data = NULL;
+  r->len = 0;
+  r->ool = ool;
+
+  if (errorcode == D_INVALID_OPERATION && ool)
+    {
+      /* Fall back on reading in-band; the next start_input does.  */
+      reads_inband_only = 1;
+      r->err = D_WOULD_BLOCK;
+    }
+  else if (!errorcode && len > 0)
+    {
+      r->len = len;
+      if (ool)
+	r->data = data;
+      else if (i == reads_first)
+	/* The message is freed when we return, but this reply is next in
+	   line anyway.  */
+	buffer_write (input_buffer, data, len);
+      else
+	{
+	  r->data = malloc (len);
+	  if (r->data)
+	    memcpy (r->data, data, len);
+	  else
+	    r->err = ENOMEM;
+	}
+    }
+
+  finish_input ();
+
+  /* Wake up dev_read even if nothing came, to start reading again.  */
+  if (input_buffer)
+    pthread_cond_broadcast (input_buffer->wait);
+  pthread_cond_broadcast (&select_alert);
+  pthread_mutex_unlock (&global_lock);
+  return 0;
 }
 
 /* Read up to AMOUNT bytes, returned in BUF and LEN. If NOWAIT is non-zero
@@ -1042,45 +1295,14 @@ kern_return_t
 device_read_reply_inband (mach_port_t reply, kern_return_t errorcode,
 			  const io_buf_ptr_inband_t data, mach_msg_type_number_t datalen)
 {
-  if (reply != phys_reply)
-    return EOPNOTSUPP;
-
-  pthread_mutex_lock (&global_lock);
-
-  input_pending = 0;
-  err = errorcode;
-  if (!err)
-    {
-      if (datalen == 0)
-	{
-	  eof = 1;
-	  dev_close ();
-	  pthread_mutex_unlock (&global_lock);
-	  return 0;
-	}
-
-      while (datalen)
-	{
-	  size_t nwritten;
-
-	  while (!buffer_writable (input_buffer))
-	    pthread_cond_wait (input_buffer->wait, &global_lock);
+  return read_reply (reply, errorcode, (void *) data, datalen, 0);
+}
 
-	  nwritten = buffer_write (input_buffer, data, datalen);
-	  data += nwritten;
-	  datalen -= nwritten;
-	  pthread_cond_broadcast (input_buffer->wait);
-	  pthread_cond_broadcast (&select_alert);
-	}
-    }
-  else
-    {
-      dev_close ();
-      pthread_mutex_unlock (&global_lock);
-      return 0;
-    }
-  pthread_mutex_unlock (&global_lock);
-  return 0;
+kern_return_t
+device_read_reply (mach_port_t reply, kern_return_t returncode,
+		   io_buf_ptr_t data, mach_msg_type_number_t amount)
+{
+  return read_reply (reply, returncode, data, amount, 1);
 }
 
 /* Return current readable size in AMOUNT. If an error occurs, the error
@@ -1219,14 +1441,7 @@ dev_sync (int wait)
   return 0;
 }
 
-/* Unused stubs.  */
-kern_return_t
-device_read_reply (mach_port_t reply, kern_return_t returncode,
-		   io_buf_ptr_t data, mach_msg_type_number_t amount)
-{
-  return EOPNOTSUPP;
-}
-
+/* Unused stub.  */
 kern_return_t
 device_write_reply (mach_port_t reply, kern_return_t returncode, int amount)
 {
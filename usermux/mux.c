@@ -273,21 +273,46 @@ netfs_get_dirents (struct iouser *cred, struct node *dir,
 
 /* User lookup.  */
 
+/* How many seconds a user name is remembered once its node has gone
+   away, so that looking it up again does not ask NSS.  */
+#define NAME_CACHE_TIME		300
+/* The same for a name that was found not to be that of any user.  */
+#define NEGATIVE_CACHE_TIME	30
+
+static time_t
+now (void)
+{
+  struct timeval tv;
+  maptime_read (usermux_maptime, &tv);
+  return tv.tv_sec;
+}
+
 /* Free storage allocated consumed by the user mux name NM, but not the node
    it points to.  */
 static void
 free_name (struct usermux_name *nm)
 {
+  free (nm->dir);
   free ((char *)nm->name);
   free (nm);
 }
 
+/* Return true if NM is the entry for USER.  Only found users are matched
+   regardless of case, as `lookup_cached' always has; that one spelling of
+   a name is none must not hide another.  */
+static int
+name_matches (const struct usermux_name *nm, const char *user)
+{
+  return (nm->dir ? strcasecmp (user, nm->name)
+	  : strcmp (user, nm->name)) == 0;
+}
+
 /* See if there's an existing entry for the name USER, and if so, return its
    node in NODE with an additional references.  True is returned iff the
-   lookup succeeds.  If PURGE is true, then any nodes with a null node are
-   removed.  */
+   lookup succeeds.  If PURGE is true, then any names with a null node that
+   have expired at time T, or that are for USER, are removed.  */
 static int
-lookup_cached (struct usermux *mux, const char *user, int purge,
+lookup_cached (struct usermux *mux, const char *user, int purge, time_t t,
 	       struct node **node)
 {
   struct usermux_name *nm = mux->names, **prevl = &mux->names;
@@ -295,20 +320,16 @@ lookup_cached (struct usermux *mux, const char *user, int purge,
   while (nm)
     {
       struct usermux_name *next = nm->next;
+      int match = name_matches (nm, user);
 
-      if (strcasecmp (user, nm->name) == 0)
+      if (match && nm->node)
 	{
-          if (nm->node)
-            netfs_nref (nm->node);
-
-	  if (nm->node)
-	    {
-	      *node = nm->node;
-	      return 1;
-	    }
+	  netfs_nref (nm->node);
+	  *node = nm->node;
+	  return 1;
 	}
 
-      if (purge && !nm->node)
+      if (purge && !nm->node && (match || t >= nm->expires))
 	{
 	  *prevl = nm->next;
 	  free_name (nm);
@@ -321,7 +342,71 @@ lookup_cached (struct usermux *mux, const char *user, int purge,
 
   return 0;
 }
-
+
+/* See if USER was looked up in MUX less than a while before time T, and
+   if so, return what that found: a new node for it like the one it had
+   then, with a single reference, in NODE, or ENOENT if there is no such
+   user.  Return EAGAIN if USER must be looked up anew.  NAMES_LOCK must be
+   held for writing.  */
+static error_t
+lookup_remembered (struct usermux *mux, const char *user, time_t t,
+		   struct node **node)
+{
+  struct usermux_name *nm;
+
+  for (nm = mux->names; nm; nm = nm->next)
+    if (name_matches (nm, user) && (nm->node || t < nm->expires))
+      {
+	if (nm->node)
+	  /* Made again since we last looked.  */
+	  {
+	    netfs_nref (nm->node);
+	    *node = nm->node;
+	    return 0;
+	  }
+	else if (! nm->dir)
+	  return ENOENT;
+	else
+	  {
+	    struct passwd pw =
+	      { pw_name: (char *) nm->name, pw_dir: nm->dir, pw_uid: nm->uid };
+
+	    nm->expires = t + NAME_CACHE_TIME;
+	    return create_user_node (mux, nm, &pw, node);
+	  }
+      }
+
+  return EAGAIN;
+}
+
+/* Enter NM, whose node if any is new and the only reference to which is in
+   NODE, into MUX's list of names at time T, unless an entry for its name
+   has already been created between the time we last looked and now (which
+   is possible because we didn't lock MUX); then throw NM away, and return
+   in NODE the node of that entry, if it has one, instead.  */
+static void
+enter_name (struct usermux *mux, struct usermux_name *nm, time_t t,
+	    struct node **node)
+{
+  pthread_rwlock_wrlock (&mux->names_lock);
+  if (lookup_cached (mux, nm->name, 1, t, node))
+    {
+      pthread_rwlock_unlock (&mux->names_lock);
+      if (nm->node)
+	{
+	  nm->node->nn->name = 0; /* Avoid touching the mux name list.  */
+	  netfs_nrele (nm->node); /* Free the tentative new node.  */
+	}
+      free_name (nm);		/* And the name it was under.  */
+    }
+  else
+    {
+      nm->next = mux->names;
+      mux->names = nm;
+      pthread_rwlock_unlock (&mux->names_lock);
+    }
+}
+
 /* See if there's an existing entry for the name USER, and if so, return its
    node in NODE, with an additional reference, otherwise, create a new node
    for the user HE as referred to by USER, and return that instead, with a
@@ -330,7 +415,7 @@ lookup_cached (struct usermux *mux, const char *user, int purge,
    official name, if it doesn't.  */
 static error_t
 lookup_pwent (struct usermux *mux, const char *user, struct passwd *pw,
-		struct node **node)
+	      time_t t, struct node **node)
 {
   error_t err;
   struct usermux_name *nm = malloc (sizeof (struct usermux_name));
@@ -339,32 +424,23 @@ lookup_pwent (struct usermux *mux, const char *user, struct passwd *pw,
     return ENOMEM;
 
   nm->name = strdup (user);
-  err = create_user_node (mux, nm, pw, node);
-  if (err)
+  nm->dir = strdup (pw->pw_dir);
+  nm->uid = pw->pw_uid;
+  nm->expires = t + NAME_CACHE_TIME;
+  if (! nm->name || ! nm->dir)
     {
       free_name (nm);
-      return err;
+      return ENOMEM;
     }
 
-  pthread_rwlock_wrlock (&mux->names_lock);
-  if (lookup_cached (mux, user, 1, node))
-    /* An entry for USER has already been created between the time we last
-       looked and now (which is possible because we didn't lock MUX).
-       Just throw away our version and return the one already in the cache.  */
-    {
-      pthread_rwlock_unlock (&mux->names_lock);
-      nm->node->nn->name = 0;	/* Avoid touching the mux name list.  */
-      netfs_nrele (nm->node);	/* Free the tentative new node.  */
-      free_name (nm);		/* And the name it was under.  */
-    }
-  else
-    /* Enter NM into MUX's list of names, and return the new node.  */
+  err = create_user_node (mux, nm, pw, node);
+  if (err)
     {
-      nm->next = mux->names;
-      mux->names = nm;
-      pthread_rwlock_unlock (&mux->names_lock);
+      free_name (nm);
+      return err;
     }
 
+  enter_name (mux, nm, t, node);
   return 0;
 }
 
@@ -374,25 +450,56 @@ static error_t
 lookup_user (struct usermux *mux, const char *user, struct node **node)
 {
   int was_cached;
+  error_t err;
+  time_t t;
   struct passwd _pw, *pw;
   char pwent_data[2048];	/* XXX what size should this be???? */
 
   pthread_rwlock_rdlock (&mux->names_lock);
-  was_cached = lookup_cached (mux, user, 0, node);
+  was_cached = lookup_cached (mux, user, 0, 0, node);
   pthread_rwlock_unlock (&mux->names_lock);
 
   if (was_cached)
     return 0;
-  else 
+
+  /* USER may still be known from a node since gone.  */
+  t = now ();
+  pthread_rwlock_wrlock (&mux->names_lock);
+  err = lookup_remembered (mux, user, t, node);
+  pthread_rwlock_unlock (&mux->names_lock);
+
+  if (err != EAGAIN)
+    return err;
+
+  if (getpwnam_r (user, &_pw, pwent_data, sizeof pwent_data, &pw))
+    return ENOENT;
+  if (pw == NULL)
     {
-      if (getpwnam_r (user, &_pw, pwent_data, sizeof pwent_data, &pw))
-	return ENOENT;
-      if (pw == NULL)
-	return ENOENT;
-      return lookup_pwent (mux, user, pw, node);
+      /* Remember that there is no USER for a while.  */
+      struct usermux_name *nm = malloc (sizeof (struct usermux_name));
+
+      if (nm)
+	{
+	  nm->name = strdup (user);
+	  nm->dir = 0;
+	  nm->node = 0;
+	  nm->expires = t + NEGATIVE_CACHE_TIME;
+	  if (nm->name)
+	    {
+	      struct node *found = 0;
+	      enter_name (mux, nm, t, &found);
+	      if (found)
+		/* Someone found USER meanwhile after all.  */
+		netfs_nrele (found);
+	    }
+	  else
+	    free (nm);
+	}
+      return ENOENT;
     }
+  return lookup_pwent (mux, user, pw, t, node);
 }
-
+
 /* This should sync the entire remote filesystem.  If WAIT is set, return
    only after sync is completely finished.  */
 error_t
@@ -33,7 +33,11 @@ netfs_node_norefs (struct node *node)
   if (node->nn->name)
     /* Remove our name's pointer to us; the name itself will eventually be
        freed by another party.  */
-    node->nn->name->node = 0;
+    {
+      pthread_rwlock_wrlock (&node->nn->mux->names_lock);
+      node->nn->name->node = 0;
+      pthread_rwlock_unlock (&node->nn->mux->names_lock);
+    }
   if (node->nn->trans_len > 0)
     free (node->nn->trans);
   free (node->nn);
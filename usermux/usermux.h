@@ -68,6 +68,16 @@ struct usermux_name
   /* A filesystem node associated with NAME.  */
   struct node *node;
 
+  /* What NODE is made from, to make it again without asking NSS once it
+     has gone away: the user's home directory, malloc'd, or 0 if there is
+     no such user, and its uid.  */
+  char *dir;
+  uid_t uid;
+
+  /* Until when NAME is remembered once NODE has gone away.  Protected by
+     NAMES_LOCK, like NODE.  */
+  time_t expires;
+
   struct usermux_name *next;
 };
 
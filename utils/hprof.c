@@ -0,0 +1,513 @@
+/* hprof -- Sample the stacks of a running program.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <hurd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+#include <elf.h>
+#include <link.h>
+#include <error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mach.h>
+#include <mach/thread_status.h>
+#include <version.h>
+
+const char *argp_program_version = STANDARD_HURD_VERSION (hprof);
+
+static pid_t pid;
+static unsigned int rate = 99;
+static unsigned int duration = 10;
+static unsigned int max_depth = 64;
+static const char *binary;
+
+static const struct argp_option options[] =
+{
+  {"rate",     'r', "HZ",      0, "Take HZ samples a second (default 99)"},
+  {"duration", 'd', "SECONDS", 0, "Sample for SECONDS seconds (default 10)"},
+  {"depth",    'D', "FRAMES",  0, "Follow at most FRAMES frames (default 64)"},
+  {"binary",   'b', "FILE",    0, "Take the symbols from FILE"
+				  " (default /proc/PID/exe)"},
+  {0}
+};
+
+static const char args_doc[] = "PID";
+static const char doc[] =
+"Sample the stacks of all the threads of the program PID, and print them"
+" folded, with the number of samples that saw each, for flame graphs."
+"\vEach sample suspends the task, reads the program counter and frame"
+" pointer of its threads, and follows the chain of frame pointers, so the"
+" program should be built with -fno-omit-frame-pointer.  Only the symbols"
+" of the program itself are known; other addresses are shown in hex.  As"
+" long as the task is suspended, nothing but the kernel is used, so the"
+" file system being profiled may be the one we run from.";
+
+static unsigned int
+parse_num (char *arg, struct argp_state *state, const char *what)
+{
+  char *end;
+  unsigned long num = strtoul (arg, &end, 10);
+
+  if (*arg == '\0' || *end != '\0' || num == 0 || num > 100000)
+    argp_error (state, "%s: Invalid %s", arg, what);
+  return num;
+}
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'r': rate = parse_num (arg, state, "rate"); break;
+    case 'd': duration = parse_num (arg, state, "duration"); break;
+    case 'D': max_depth = parse_num (arg, state, "depth"); break;
+    case 'b': binary = arg; break;
+
+    case ARGP_KEY_ARG:
+      if (state->arg_num > 0)
+	argp_usage (state);
+      pid = parse_num (arg, state, "PID");
+      break;
+
+    case ARGP_KEY_NO_ARGS:
+      argp_usage (state);
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* The function symbols of the program, sorted by address.  */
+struct symbol
+{
+  uintptr_t addr;
+  size_t size;
+  const char *name;
+};
+static struct symbol *symbols;
+static size_t nsymbols;
+
+/* What to add to the addresses of the ELF file to get those in the
+   task.  */
+static uintptr_t bias;
+
+static int
+symbol_cmp (const void *a, const void *b)
+{
+  const struct symbol *x = a, *y = b;
+  return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Read the function symbols of FILE, from its symbol table, or its
+   dynamic symbols if it is stripped.  Return its ELF header, which is
+   left mapped.  */
+static const ElfW(Ehdr) *
+load_symbols (const char *file)
+{
+  const ElfW(Ehdr) *ehdr;
+  const ElfW(Shdr) *shdr;
+  const char *image;
+  struct stat st;
+  int fd, pass, i;
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    error (1, errno, "%s", file);
+  if (fstat (fd, &st) < 0)
+    error (1, errno, "%s", file);
+  image = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED)
+    error (1, errno, "%s", file);
+  close (fd);
+
+  ehdr = (const ElfW(Ehdr) *) image;
+  if ((size_t) st.st_size < sizeof *ehdr
+      || memcmp (ehdr->e_ident, ELFMAG, SELFMAG)
+      || ehdr->e_ident[EI_CLASS] != (sizeof (void *) == 8
+				     ? ELFCLASS64 : ELFCLASS32)
+      || ehdr->e_shoff + (size_t) ehdr->e_shnum * sizeof *shdr
+	 > (size_t) st.st_size)
+    error (1, 0, "%s: Not an ELF file for this machine", file);
+  shdr = (const ElfW(Shdr) *) (image + ehdr->e_shoff);
+
+  for (pass = 0; pass < 2 && nsymbols == 0; pass++)
+    for (i = 0; i < ehdr->e_shnum; i++)
+      {
+	const ElfW(Sym) *sym, *end;
+	const char *strtab;
+
+	if (shdr[i].sh_type != (pass == 0 ? SHT_SYMTAB : SHT_DYNSYM)
+	    || shdr[i].sh_link >= ehdr->e_shnum)
+	  continue;
+
+	sym = (const ElfW(Sym) *) (image + shdr[i].sh_offset);
+	end = sym + shdr[i].sh_size / sizeof *sym;
+	strtab = image + shdr[shdr[i].sh_link].sh_offset;
+
+	symbols = realloc (symbols, (nsymbols + (end - sym))
+			   * sizeof *symbols);
+	if (! symbols)
+	  error (1, errno, "realloc");
+
+	for (; sym < end; sym++)
+	  if (ELFW(ST_TYPE) (sym->st_info) == STT_FUNC
+	      && sym->st_shndx != SHN_UNDEF && sym->st_value != 0)
+	    symbols[nsymbols++] = (struct symbol) {
+	      .addr = sym->st_value,
+	      .size = sym->st_size,
+	      .name = strtab + sym->st_name,
+	    };
+      }
+
+  if (nsymbols == 0)
+    error (0, 0, "%s: No symbols", file);
+  qsort (symbols, nsymbols, sizeof *symbols, symbol_cmp);
+  return ehdr;
+}
+
+/* Find where FILE, whose ELF header is EHDR, is loaded in TASK: the
+   region that starts with the same header.  */
+static void
+find_bias (task_t task, const ElfW(Ehdr) *ehdr)
+{
+  const ElfW(Phdr) *phdr = (const void *) ((const char *) ehdr
+					   + ehdr->e_phoff);
+  uintptr_t first = 0;
+  vm_address_t addr;
+  vm_size_t size;
+  int i;
+
+  if (ehdr->e_type != ET_DYN)
+    return;
+
+  for (i = 0; i < ehdr->e_phnum; i++)
+    if (phdr[i].p_type == PT_LOAD)
+      {
+	first = phdr[i].p_vaddr & ~(vm_page_size - 1);
+	break;
+      }
+
+  for (addr = 0; ; addr += size)
+    {
+      vm_prot_t prot, max_prot;
+      vm_inherit_t inh;
+      boolean_t shared;
+      mach_port_t obj;
+      vm_offset_t offs, data;
+      mach_msg_type_number_t data_len;
+      int same;
+
+      if (vm_region (task, &addr, &size, &prot, &max_prot, &inh, &shared,
+		     &obj, &offs))
+	break;
+      if (MACH_PORT_VALID (obj))
+	mach_port_deallocate (mach_task_self (), obj);
+      if (! (prot & VM_PROT_READ)
+	  || vm_read (task, addr, vm_page_size, &data, &data_len))
+	continue;
+      same = ! memcmp ((void *) data, ehdr, sizeof *ehdr);
+      vm_deallocate (mach_task_self (), data, data_len);
+      if (same)
+	{
+	  bias = addr - first;
+	  return;
+	}
+    }
+
+  error (0, 0, "Can't find where the program is loaded; symbols may be off");
+}
+
+/* Print the name of the function at ADDR, in the task, to STREAM.  */
+static void
+print_symbol (FILE *stream, uintptr_t addr)
+{
+  size_t lo = 0, hi = nsymbols;
+
+  addr -= bias;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (symbols[mid].addr <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo > 0 && (symbols[lo - 1].size == 0
+		 || addr < symbols[lo - 1].addr + symbols[lo - 1].size))
+    fputs (symbols[lo - 1].name, stream);
+  else
+    fprintf (stream, "%#lx", (unsigned long) (addr + bias));
+}
+
+/* The pages of the task that one sample has read.  */
+#define PAGES_MAX 16
+static struct
+{
+  vm_address_t addr;
+  vm_offset_t data;
+  mach_msg_type_number_t len;
+} pages[PAGES_MAX];
+static int npages;
+
+/* Read the word at ADDR in TASK into *WORD; return 0 if it can't be
+   read.  */
+static int
+read_word (task_t task, uintptr_t addr, uintptr_t *word)
+{
+  vm_address_t page = addr & ~(vm_page_size - 1);
+  int i;
+
+  if (addr % sizeof *word)
+    return 0;
+
+  for (i = 0; i < npages; i++)
+    if (pages[i].addr == page)
+      break;
+  if (i == npages)
+    {
+      if (npages == PAGES_MAX)
+	return 0;
+      if (vm_read (task, page, vm_page_size, &pages[i].data, &pages[i].len))
+	return 0;
+      pages[i].addr = page;
+      npages++;
+    }
+
+  *word = *(uintptr_t *) (pages[i].data + (addr - page));
+  return 1;
+}
+
+static void
+drop_pages (void)
+{
+  while (npages > 0)
+    {
+      npages--;
+      vm_deallocate (mach_task_self (), pages[npages].data,
+		     pages[npages].len);
+    }
+}
+
+/* The stacks seen, each as the addresses of its frames from the
+   innermost out.  */
+struct stack
+{
+  size_t depth;
+  uintptr_t pc[];
+};
+static struct stack **stacks;
+static size_t nstacks, stacks_alloced;
+
+/* Get the program counter and frame pointer of THREAD.  */
+static error_t
+get_pc_fp (thread_t thread, uintptr_t *pc, uintptr_t *fp)
+{
+  error_t err;
+#if defined (i386_THREAD_STATE)
+  struct i386_thread_state state;
+  mach_msg_type_number_t count = i386_THREAD_STATE_COUNT;
+
+  err = thread_get_state (thread, i386_THREAD_STATE,
+			  (thread_state_t) &state, &count);
+# ifdef __x86_64__
+  *pc = state.rip;
+  *fp = state.rbp;
+# else
+  *pc = state.eip;
+  *fp = state.ebp;
+# endif
+#elif defined (AARCH64_THREAD_STATE)
+  struct aarch64_thread_state state;
+  mach_msg_type_number_t count = AARCH64_THREAD_STATE_COUNT;
+
+  err = thread_get_state (thread, AARCH64_THREAD_STATE,
+			  (thread_state_t) &state, &count);
+  *pc = state.pc;
+  *fp = state.x[29];
+#else
+# error "Don't know how to get the frame pointer on this machine"
+#endif
+  return err;
+}
+
+/* Record the stack of THREAD, which is suspended.  */
+static void
+sample_thread (task_t task, thread_t thread)
+{
+  struct stack *stack;
+  uintptr_t pc, fp, next;
+
+  if (get_pc_fp (thread, &pc, &fp))
+    return;
+
+  stack = malloc (sizeof *stack + max_depth * sizeof stack->pc[0]);
+  if (! stack)
+    error (1, errno, "malloc");
+  stack->depth = 0;
+  stack->pc[stack->depth++] = pc;
+
+  /* Each frame record holds the caller's frame pointer, followed by
+     the return address; frames go up the stack.  */
+  while (stack->depth < max_depth && fp != 0
+	 && read_word (task, fp + sizeof fp, &pc) && pc != 0
+	 && read_word (task, fp, &next))
+    {
+      stack->pc[stack->depth++] = pc;
+      if (next <= fp)
+	break;
+      fp = next;
+    }
+
+  if (nstacks == stacks_alloced)
+    {
+      stacks_alloced = stacks_alloced ? 2 * stacks_alloced : 1024;
+      stacks = realloc (stacks, stacks_alloced * sizeof *stacks);
+      if (! stacks)
+	error (1, errno, "realloc");
+    }
+  stacks[nstacks++] = stack;
+}
+
+static void
+sample (task_t task)
+{
+  thread_array_t threads;
+  mach_msg_type_number_t nthreads, i;
+  error_t err;
+
+  err = task_suspend (task);
+  if (err)
+    error (1, err, "task_suspend");
+
+  err = task_threads (task, &threads, &nthreads);
+  if (! err)
+    {
+      for (i = 0; i < nthreads; i++)
+	{
+	  sample_thread (task, threads[i]);
+	  mach_port_deallocate (mach_task_self (), threads[i]);
+	}
+      vm_deallocate (mach_task_self (), (vm_address_t) threads,
+		     nthreads * sizeof *threads);
+    }
+
+  task_resume (task);
+  drop_pages ();
+
+  if (err)
+    error (1, err, "task_threads");
+}
+
+static int
+stack_cmp (const void *a, const void *b)
+{
+  const struct stack *x = *(const struct stack **) a;
+  const struct stack *y = *(const struct stack **) b;
+  size_t i;
+
+  for (i = 0; i < x->depth && i < y->depth; i++)
+    if (x->pc[i] != y->pc[i])
+      return x->pc[i] < y->pc[i] ? -1 : 1;
+  return x->depth < y->depth ? -1 : x->depth > y->depth;
+}
+
+/* Print each different stack once, from the outermost frame in, with
+   the number of times it was seen.  */
+static void
+print_folded (void)
+{
+  size_t i, j, n;
+
+  qsort (stacks, nstacks, sizeof *stacks, stack_cmp);
+
+  for (i = 0; i < nstacks; i = j)
+    {
+      for (j = i + 1; j < nstacks && ! stack_cmp (&stacks[i], &stacks[j]);
+	   j++)
+	;
+
+      for (n = stacks[i]->depth; n > 0; n--)
+	{
+	  /* Past the innermost frame, these are return addresses, which
+	     may be in the next function already.  */
+	  print_symbol (stdout, stacks[i]->pc[n - 1] - (n > 1));
+	  putchar (n > 1 ? ';' : ' ');
+	}
+      printf ("%zu\n", j - i);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const struct argp argp = { options, parse_opt, args_doc, doc };
+  const ElfW(Ehdr) *ehdr;
+  struct timespec interval, next;
+  char *exe = NULL;
+  unsigned long i, samples;
+  task_t task;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  err = proc_pid2task (getproc (), pid, &task);
+  if (err)
+    error (1, err, "%d", pid);
+  if (! MACH_PORT_VALID (task))
+    error (1, 0, "%d: No such process", pid);
+
+  if (! binary)
+    {
+      if (asprintf (&exe, "/proc/%d/exe", pid) < 0)
+	error (1, errno, "asprintf");
+      binary = exe;
+    }
+  ehdr = load_symbols (binary);
+  find_bias (task, ehdr);
+
+  interval.tv_sec = 0;
+  interval.tv_nsec = 1000000000 / rate;
+  if (rate == 1)
+    interval.tv_sec = 1, interval.tv_nsec = 0;
+  samples = (unsigned long) rate * duration;
+
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  for (i = 0; i < samples; i++)
+    {
+      sample (task);
+
+      next.tv_nsec += interval.tv_nsec;
+      next.tv_sec += interval.tv_sec + next.tv_nsec / 1000000000;
+      next.tv_nsec %= 1000000000;
+      clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+  print_folded ();
+  free (exe);
+  return 0;
+}
@@ -0,0 +1,220 @@
+/* journalrecv -- Keep a replica of a filesystem journal sent over a socket.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+#include <fcntl.h>
+#include <error.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <version.h>
+
+#include <libdiskfs/journal.h>
+
+const char *argp_program_version = STANDARD_HURD_VERSION (journalrecv);
+
+static char *port;
+static char *socket_name;
+static char *file_name;
+
+static int
+read_all (int fd, void *buf, size_t len)
+{
+  char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n = read (fd, p, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return 0;
+      p += n;
+      len -= n;
+    }
+  return 1;
+}
+
+/* Apply the messages read from the connection CONN to the replica FD,
+   until the connection is closed or a message is malformed.  */
+static void
+serve (int conn, int fd, char *buf)
+{
+  struct journal_replica_msg msg;
+
+  while (read_all (conn, &msg, sizeof msg))
+    {
+      if (msg.magic != JOURNAL_REPLICA_MAGIC
+	  || msg.length > JOURNAL_REPLICA_MAX_LEN)
+	{
+	  error (0, 0, "Malformed message; dropping the connection");
+	  return;
+	}
+
+      if (msg.flags & JOURNAL_REPLICA_SYNC)
+	{
+	  uint32_t status = fsync (fd) ? errno : 0;
+	  if (write (conn, &status, sizeof status) != sizeof status)
+	    return;
+	  continue;
+	}
+
+      if (! read_all (conn, buf, msg.length))
+	return;
+      if (pwrite (fd, buf, msg.length, msg.offset) != (ssize_t) msg.length)
+	{
+	  /* Dropping the connection makes the journal copy itself whole
+	     once the replica can be written again.  */
+	  error (0, errno, "%s", file_name);
+	  return;
+	}
+    }
+}
+
+/* Return a socket listening on PORT, or on the local socket NAME.  */
+static int
+listen_on (void)
+{
+  int sock = -1;
+
+  if (port)
+    {
+      struct addrinfo hints = {
+	.ai_flags = AI_PASSIVE,
+	.ai_family = AF_UNSPEC,
+	.ai_socktype = SOCK_STREAM,
+      };
+      struct addrinfo *ai, *a;
+      int err = getaddrinfo (NULL, port, &hints, &ai);
+      if (err)
+	error (1, 0, "%s: %s", port, gai_strerror (err));
+
+      for (a = ai; a && sock < 0; a = a->ai_next)
+	{
+	  int one = 1;
+	  sock = socket (a->ai_family, a->ai_socktype, a->ai_protocol);
+	  if (sock < 0)
+	    continue;
+	  setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	  if (bind (sock, a->ai_addr, a->ai_addrlen) < 0)
+	    {
+	      close (sock);
+	      sock = -1;
+	    }
+	}
+      freeaddrinfo (ai);
+      if (sock < 0)
+	error (1, errno, "%s", port);
+    }
+  else
+    {
+      struct sockaddr_un sun = { .sun_family = AF_LOCAL };
+      if (strlen (socket_name) >= sizeof sun.sun_path)
+	error (1, ENAMETOOLONG, "%s", socket_name);
+      strcpy (sun.sun_path, socket_name);
+
+      sock = socket (PF_LOCAL, SOCK_STREAM, 0);
+      if (sock < 0)
+	error (1, errno, "socket");
+      unlink (socket_name);
+      if (bind (sock, (struct sockaddr *) &sun, sizeof sun) < 0)
+	error (1, errno, "%s", socket_name);
+    }
+
+  if (listen (sock, 1) < 0)
+    error (1, errno, "listen");
+  return sock;
+}
+
+static error_t
+parser (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'p': port = arg; break;
+    case 's': socket_name = arg; break;
+
+    case ARGP_KEY_ARG:
+      if (file_name)
+	argp_error (state, "Too many arguments");
+      file_name = arg;
+      break;
+
+    case ARGP_KEY_END:
+      if (! file_name)
+	argp_error (state, "No replica file given");
+      if (!port == !socket_name)
+	argp_error (state, "Exactly one of --port and --socket is needed");
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static struct argp_option options[] =
+  {
+    {"port", 'p', "PORT", 0, "Listen on the TCP port PORT"},
+    {"socket", 's', "PATH", 0, "Listen on the local socket PATH"},
+    {0}
+  };
+  struct argp argp =
+  {options, parser,
+   "FILE", "Keep a replica of a filesystem journal in FILE"
+   "\vThe journal is sent by a filesystem started with"
+   " --journal-replica=tcp:HOST:PORT or --journal-replica=unix:PATH."
+   "  One filesystem is served at a time; when it connects, it copies"
+   " its whole journal before sending what it writes."};
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  int fd = open (file_name, O_WRONLY | O_CREAT, 0600);
+  if (fd < 0)
+    error (1, errno, "%s", file_name);
+
+  char *buf = malloc (JOURNAL_REPLICA_MAX_LEN);
+  if (! buf)
+    error (1, ENOMEM, "malloc");
+
+  int sock = listen_on ();
+  while (1)
+    {
+      int conn = accept (sock, NULL, NULL);
+      if (conn < 0)
+	{
+	  if (errno != EINTR)
+	    error (0, errno, "accept");
+	  continue;
+	}
+      serve (conn, fd, buf);
+      close (conn);
+    }
+
+  return 0;
+}
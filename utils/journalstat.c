@@ -0,0 +1,263 @@
+/* journalstat -- Show the metadata journal statistics of a filesystem.
+
+   Copyright (C) 2025 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <hurd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+#include <fcntl.h>
+#include <error.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <version.h>
+
+#include "journal_U.h"
+
+const char *argp_program_version = STANDARD_HURD_VERSION (journalstat);
+
+static int raw;
+
+/* For --changes: where to start, how many events to ask for at a time,
+   and the name of the cursor to keep in the filesystem.  */
+static int changes;
+static uint64_t cursor;
+static const char *cursor_name;
+#define CHANGES_BATCH 1024
+
+/* For --history: print the events about each FILE instead.  */
+static int history;
+
+/* Print a histogram line, NAME followed by its bucket counts in VALUES,
+   with the range of each bucket that is not empty.  Bucket 0 counts
+   zeros, bucket I the values from 2^(I-1) to 2^I - 1, and the last
+   bucket everything larger.  */
+static void
+print_hist (const char *name, char *values)
+{
+  char *end;
+  unsigned long long count;
+  int i;
+
+  printf ("%s:\n", name);
+  for (i = 0; (count = strtoull (values, &end, 10)), end != values;
+       i++, values = end)
+    {
+      if (count == 0)
+	continue;
+      if (i == 0)
+	printf ("  %20s  %llu\n", "0", count);
+      else
+	{
+	  char range[48];
+	  unsigned long long lo = 1ULL << (i - 1);
+	  if (*end == '\0' || *end == '\n')
+	    snprintf (range, sizeof range, "%llu-", lo);
+	  else
+	    snprintf (range, sizeof range, "%llu-%llu", lo, 2 * lo - 1);
+	  printf ("  %20s  %llu\n", range, count);
+	}
+    }
+}
+
+/* Print the events journaled by FSYS since the cursor, then the cursor
+   to continue from on a line of its own, "next CURSOR".  With a cursor
+   name, start from the remembered cursor unless one was given, and
+   remember the new one.  */
+static void
+show_changes (const char *name, fsys_t fsys)
+{
+  uint64_t from = cursor, next;
+  error_t err;
+
+  if (cursor_name && !from)
+    {
+      err = journal_get_cursor (fsys, cursor_name, &from);
+      if (err && err != ENOENT)
+	error (3, err, "%s", name);
+    }
+
+  while (1)
+    {
+      char *data = NULL;
+      mach_msg_type_number_t len = 0;
+
+      err = journal_read_changes (fsys, from, CHANGES_BATCH, &data, &len,
+				  &next);
+      if (err)
+	error (3, err, "%s", name);
+      fwrite (data, 1, len, stdout);
+      munmap (data, len);
+      if (next == from)
+	break;
+      from = next;
+    }
+
+  printf ("next %llu\n", (unsigned long long) from);
+
+  if (cursor_name && from)
+    {
+      err = journal_set_cursor (fsys, cursor_name, from);
+      if (err)
+	error (3, err, "%s: %s", name, cursor_name);
+    }
+}
+
+/* Print the events journaled about the node NODE named NAME on FSYS,
+   or about the entries of NODE if it is a directory.  */
+static void
+show_history (const char *name, fsys_t fsys, file_t node)
+{
+  struct stat st;
+  char *data = NULL;
+  mach_msg_type_number_t len = 0;
+  error_t err;
+
+  err = io_stat (node, &st);
+  if (err)
+    error (2, err, "%s", name);
+
+  err = journal_read_history (fsys, st.st_ino, S_ISDIR (st.st_mode), cursor,
+			      &data, &len);
+  if (err)
+    error (3, err, "%s", name);
+  fwrite (data, 1, len, stdout);
+  munmap (data, len);
+}
+
+static void
+show (const char *name, file_t node)
+{
+  fsys_t fsys;
+  char *data = NULL;
+  mach_msg_type_number_t len = 0;
+  error_t err;
+
+  if (node == MACH_PORT_NULL)
+    error (1, errno, "%s", name);
+
+  err = file_getcontrol (node, &fsys);
+  if (err)
+    error (2, err, "%s", name);
+
+  if (history || changes)
+    {
+      if (history)
+	show_history (name, fsys, node);
+      else
+	show_changes (name, fsys);
+      mach_port_deallocate (mach_task_self (), fsys);
+      mach_port_deallocate (mach_task_self (), node);
+      return;
+    }
+
+  err = journal_fetch_stats (fsys, &data, &len);
+  if (err)
+    error (3, err, "%s", name);
+
+  if (raw)
+    fwrite (data, 1, len, stdout);
+  else
+    {
+      char *stats = strndup (data, len);
+      char *saveptr;
+      if (!stats)
+	error (4, errno, "%s", name);
+      for (char *line = strtok_r (stats, "\n", &saveptr); line;
+	   line = strtok_r (NULL, "\n", &saveptr))
+	{
+	  char *values = strchr (line, ' ');
+	  if (!values)
+	    continue;
+	  *values++ = '\0';
+	  if (strchr (values, ' '))
+	    print_hist (line, values);
+	  else
+	    printf ("%-20s %s\n", line, values);
+	}
+      free (stats);
+    }
+
+  munmap (data, len);
+  mach_port_deallocate (mach_task_self (), fsys);
+  mach_port_deallocate (mach_task_self (), node);
+}
+
+static error_t
+parser (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'r': raw = 1; break;
+    case 'c':
+      changes = 1;
+      if (arg)
+	{
+	  char *end;
+	  cursor = strtoull (arg, &end, 0);
+	  if (*end)
+	    argp_error (state, "%s: Invalid cursor", arg);
+	}
+      break;
+    case 'n': changes = 1; cursor_name = arg; break;
+    case 'H': history = 1; break;
+
+    case ARGP_KEY_NO_ARGS:
+      show ("/", getcrdir ());
+      break;
+
+    case ARGP_KEY_ARG:
+      show (arg, file_name_lookup (arg, 0, 0));
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static struct argp_option options[] =
+  {
+    {"raw", 'r', 0, 0, "Print the statistics as the filesystem reports them"},
+    {"changes", 'c', "CURSOR", OPTION_ARG_OPTIONAL,
+     "Print the changes journaled since CURSOR (default: all that are kept)"
+     " instead of the statistics"},
+    {"cursor-name", 'n', "NAME", 0,
+     "With --changes, start from the cursor the filesystem keeps as NAME,"
+     " and keep the new one"},
+    {"history", 'H', 0, 0,
+     "Print the changes journaled about each FILE, or about its entries"
+     " if it is a directory, since the --changes CURSOR"},
+    {0}
+  };
+  struct argp argp =
+  {options, parser,
+   "[FILE...]", "Show the metadata journal statistics of filesystems"
+   "\vThe statistics of the filesystem containing each FILE are shown;"
+   " with no FILE argument, those of the root filesystem."};
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/* portstat -- Show the statistics of the RPCs served by a translator.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <hurd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+#include <argz.h>
+#include <fcntl.h>
+#include <error.h>
+#include <sys/mman.h>
+#include <version.h>
+
+#include "msgids.h"
+#include "fsys_U.h"
+
+const char *argp_program_version = STANDARD_HURD_VERSION (portstat);
+
+static int enable = -1;
+static int raw, numeric, histogram;
+static char *files;
+static size_t files_len;
+
+/* Print the name of message id ID, or the number if it is unknown.  */
+static void
+print_msgid (mach_msg_id_t id)
+{
+  const struct msgid_info *info = numeric ? NULL : msgid_info (id);
+  char buf[80];
+
+  if (info)
+    snprintf (buf, sizeof buf, "%s/%s", info->subsystem, info->name);
+  else
+    snprintf (buf, sizeof buf, "%d", id);
+  printf ("%-36s", buf);
+}
+
+/* Print the histogram in VALUES, bucket 0 counting the RPCs that took
+   no microsecond, bucket I those from 2^(I-1) to 2^I - 1, and the last
+   the longer ones.  */
+static void
+print_hist (char *values)
+{
+  char *end;
+  unsigned long long count;
+  int i;
+
+  for (i = 0; (count = strtoull (values, &end, 10)), end != values;
+       i++, values = end)
+    {
+      char range[48];
+      if (count == 0)
+	continue;
+      if (i == 0)
+	snprintf (range, sizeof range, "0");
+      else
+	{
+	  unsigned long long lo = 1ULL << (i - 1);
+	  if (*end == '\0')
+	    snprintf (range, sizeof range, "%llu-", lo);
+	  else
+	    snprintf (range, sizeof range, "%llu-%llu", lo, 2 * lo - 1);
+	}
+      printf ("    %20s us  %llu\n", range, count);
+    }
+}
+
+static void
+show (const char *name, file_t node)
+{
+  fsys_t fsys;
+  char *data = NULL;
+  mach_msg_type_number_t len = 0;
+  error_t err;
+
+  if (node == MACH_PORT_NULL)
+    error (1, errno, "%s", name);
+
+  err = file_getcontrol (node, &fsys);
+  if (err)
+    error (2, err, "%s", name);
+
+  err = fsys_get_rpc_stats (fsys, enable, &data, &len);
+  if (err)
+    error (3, err, "%s", name);
+
+  if (raw)
+    fwrite (data, 1, len, stdout);
+  else if (enable == -1)
+    {
+      char *stats = strndup (data, len);
+      char *saveptr;
+      if (!stats)
+	error (4, errno, "%s", name);
+
+      printf ("%-36s %10s %12s %8s %8s\n",
+	      "RPC", "COUNT", "TOTAL-US", "AVG-US", "MAX-US");
+      for (char *line = strtok_r (stats, "\n", &saveptr); line;
+	   line = strtok_r (NULL, "\n", &saveptr))
+	{
+	  char *end;
+	  long id = strtol (line, &end, 10);
+	  unsigned long long count, total, max;
+
+	  if (end == line)
+	    {
+	      /* "enabled" or "dropped".  */
+	      if (strcmp (line, "enabled 1") && strcmp (line, "dropped 0"))
+		printf ("# %s\n", line);
+	      continue;
+	    }
+
+	  count = strtoull (end, &end, 10);
+	  total = strtoull (end, &end, 10);
+	  max = strtoull (end, &end, 10);
+	  print_msgid (id);
+	  printf (" %10llu %12llu %8llu %8llu\n",
+		  count, total, count ? total / count : 0, max);
+	  if (histogram)
+	    print_hist (end);
+	}
+      free (stats);
+    }
+
+  munmap (data, len);
+  mach_port_deallocate (mach_task_self (), fsys);
+  mach_port_deallocate (mach_task_self (), node);
+}
+
+static error_t
+parser (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 's': enable = 1; break;
+    case 'S': enable = 0; break;
+    case 'r': raw = 1; break;
+    case 'n': numeric = 1; break;
+    case 'H': histogram = 1; break;
+
+    case ARGP_KEY_ARG:
+      if (argz_add (&files, &files_len, arg))
+	argp_failure (state, 1, errno, "argz_add");
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static struct argp_option options[] =
+  {
+    {"start", 's', 0, 0, "Start keeping the statistics"},
+    {"stop", 'S', 0, 0, "Stop keeping the statistics"},
+    {"raw", 'r', 0, 0, "Print the statistics as the translator reports them"},
+    {"numeric", 'n', 0, 0, "Show message ids as numbers"},
+    {"histogram", 'H', 0, 0, "Show the latency histogram of each RPC"},
+    {0}
+  };
+  static const struct argp_child children[] =
+  {
+    { .argp = &msgid_argp, },
+    { 0 }
+  };
+  struct argp argp =
+  {options, parser,
+   "[FILE...]", "Show the statistics of the RPCs served by translators"
+   "\vThe statistics of the translator serving each FILE are shown;"
+   " with no FILE argument, those of the root filesystem.  The statistics"
+   " are only kept once started, so as to cost nothing otherwise; with"
+   " --start or --stop, nothing is shown.",
+   children};
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  /* The names of the message ids are only known once all the arguments
+     are parsed.  */
+  if (! files)
+    show ("/", getcrdir ());
+  else
+    for (char *file = files; file; file = argz_next (files, files_len, file))
+      show (file, file_name_lookup (file, 0, 0));
+
+  return 0;
+}
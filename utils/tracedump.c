@@ -0,0 +1,278 @@
+/* tracedump -- Show the events traced by a running program.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, see <https://www.gnu.org/licenses/>.  */
+
+#include <hurd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <mach.h>
+#include <version.h>
+#include <trace.h>
+
+const char *argp_program_version = STANDARD_HURD_VERSION (tracedump);
+
+static int enable = -1;
+static int follow;
+static pid_t pid;
+
+/* How long --follow waits between looks, in microseconds.  */
+#define FOLLOW_INTERVAL 100000
+
+static const struct argp_option options[] =
+{
+  {"enable",  'e', 0, 0, "Start recording events"},
+  {"disable", 'd', 0, 0, "Stop recording events"},
+  {"follow",  'f', 0, 0, "Keep showing the new events as they come"},
+  {0}
+};
+
+static const char args_doc[] = "PID";
+static const char doc[] =
+"Show the events that the program PID has traced."
+"\vThe program must have been started with HURD_TRACE in its environment;"
+" with HURD_TRACE=0 it starts with recording disabled.  The events of"
+" all the threads are shown in the order of their time, in microseconds,"
+" with the thread they were recorded by and their two arguments.";
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *end;
+
+  switch (key)
+    {
+    case 'e': enable = 1; break;
+    case 'd': enable = 0; break;
+    case 'f': follow = 1; break;
+
+    case ARGP_KEY_ARG:
+      if (state->arg_num > 0)
+	argp_usage (state);
+      pid = strtol (arg, &end, 10);
+      if (*arg == '\0' || *end != '\0' || pid <= 0)
+	argp_error (state, "%s: Invalid PID", arg);
+      break;
+
+    case ARGP_KEY_NO_ARGS:
+      argp_usage (state);
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Find the trace area of TASK and map it here through a proxy memory
+   object, so that what we see is live.  */
+static struct trace_area *
+map_area (task_t task)
+{
+  vm_address_t addr = 0;
+  vm_size_t size, area_size = round_page (sizeof (struct trace_area));
+  error_t err;
+
+  for (;; addr += size)
+    {
+      vm_prot_t prot, max_prot;
+      vm_inherit_t inh;
+      boolean_t shared;
+      mach_port_t obj;
+      vm_offset_t offs;
+      vm_offset_t data;
+      mach_msg_type_number_t data_len;
+      struct trace_area *area;
+      memory_object_t proxy;
+      int found;
+
+      err = vm_region (task, &addr, &size, &prot, &max_prot, &inh, &shared,
+		       &obj, &offs);
+      if (err == EKERN_NO_SPACE)
+	return NULL;
+      if (err)
+	error (2, err, "vm_region");
+      if (MACH_PORT_VALID (obj))
+	mach_port_deallocate (mach_task_self (), obj);
+
+      if (size < area_size
+	  || (prot & (VM_PROT_READ | VM_PROT_WRITE))
+	     != (VM_PROT_READ | VM_PROT_WRITE))
+	continue;
+
+      /* Look at the header first.  */
+      if (vm_read (task, addr, vm_page_size, &data, &data_len))
+	continue;
+      area = (struct trace_area *) data;
+      found = (area->magic == TRACE_MAGIC && area->version == TRACE_VERSION
+	       && area->ring_events == TRACE_RING_EVENTS
+	       && area->rings == TRACE_RINGS);
+      vm_deallocate (mach_task_self (), data, data_len);
+      if (! found)
+	continue;
+
+      err = vm_region_create_proxy (task, addr, VM_PROT_READ | VM_PROT_WRITE,
+				    area_size, &proxy);
+      if (err)
+	error (2, err, "vm_region_create_proxy");
+      data = 0;
+      err = vm_map (mach_task_self (), &data, area_size, 0, 1, proxy, 0, 0,
+		    VM_PROT_READ | VM_PROT_WRITE,
+		    VM_PROT_READ | VM_PROT_WRITE, VM_INHERIT_NONE);
+      mach_port_deallocate (mach_task_self (), proxy);
+      if (err)
+	error (2, err, "vm_map");
+      return (struct trace_area *) data;
+    }
+}
+
+static int
+event_cmp (const void *a, const void *b)
+{
+  const struct trace_event *x = a, *y = b;
+  return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/* Copy the events of AREA that come after SEEN to EVENTS, which has
+   room for all the rings, and update SEEN.  Return how many there are,
+   and add those overwritten before we could copy them to *LOST.  */
+static size_t
+drain (struct trace_area *area, uint64_t *seen, struct trace_event *events,
+       uint64_t *lost)
+{
+  size_t n = 0;
+  int i;
+
+  for (i = 0; i < TRACE_RINGS; i++)
+    {
+      struct trace_ring *ring = &area->ring[i];
+      uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      uint64_t from = seen[i], some, k;
+      size_t start = n;
+
+      if (head < from)
+	/* Can't happen, but don't go into a long loop if it does.  */
+	from = head;
+      if (head - from > TRACE_RING_EVENTS)
+	{
+	  *lost += head - from - TRACE_RING_EVENTS;
+	  from = head - TRACE_RING_EVENTS;
+	}
+
+      for (k = from; k < head; k++)
+	events[n++] = ring->events[k % TRACE_RING_EVENTS];
+
+      /* Drop what the owner overwrote while we copied.  */
+      some = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      if (some - from > TRACE_RING_EVENTS)
+	{
+	  uint64_t gone = some - from - TRACE_RING_EVENTS;
+	  if (gone > n - start)
+	    gone = n - start;
+	  memmove (&events[start], &events[start + gone],
+		   (n - start - gone) * sizeof *events);
+	  n -= gone;
+	  *lost += gone;
+	}
+
+      seen[i] = head;
+    }
+
+  qsort (events, n, sizeof *events, event_cmp);
+  return n;
+}
+
+static void
+print_events (const struct trace_event *events, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      const struct trace_event *e = &events[i];
+      const char *name = (e->id < TRACE_EVENTS_MAX
+			  ? trace_event_names[e->id] : NULL);
+
+      printf ("%llu.%06llu %5u ",
+	      (unsigned long long) e->time / 1000000,
+	      (unsigned long long) e->time % 1000000, e->thread);
+      if (name)
+	printf ("%-20s", name);
+      else
+	printf ("%-20u", e->id);
+      printf (" %#llx %#llx\n",
+	      (unsigned long long) e->arg[0], (unsigned long long) e->arg[1]);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const struct argp argp = { options, parse_opt, args_doc, doc };
+  struct trace_area *area;
+  struct trace_event *events;
+  uint64_t seen[TRACE_RINGS] = { 0 };
+  uint64_t lost = 0;
+  task_t task;
+  size_t n;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  err = proc_pid2task (getproc (), pid, &task);
+  if (err)
+    error (1, err, "%d", pid);
+  if (! MACH_PORT_VALID (task))
+    error (1, 0, "%d: No such process", pid);
+
+  area = map_area (task);
+  if (! area)
+    error (1, 0, "%d: Not tracing (no HURD_TRACE in its environment?)", pid);
+
+  if (enable >= 0)
+    {
+      __atomic_store_n (&area->enabled, enable, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+  events = malloc (TRACE_RINGS * TRACE_RING_EVENTS * sizeof *events);
+  if (! events)
+    error (1, errno, "malloc");
+
+  do
+    {
+      n = drain (area, seen, events, &lost);
+      print_events (events, n);
+      fflush (stdout);
+      if (follow)
+	usleep (FOLLOW_INTERVAL);
+    }
+  while (follow);
+
+  if (lost)
+    fprintf (stderr, "%llu events overwritten before they were read\n",
+	     (unsigned long long) lost);
+  if (area->lost_threads)
+    fprintf (stderr, "%llu threads found no free ring\n",
+	     (unsigned long long) area->lost_threads);
+  return 0;
+}